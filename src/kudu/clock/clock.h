@@ -17,6 +17,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <glog/logging.h>
 
@@ -49,6 +50,17 @@ class Clock : public RefCountedThreadSafe<Clock> {
   // Obtains a new transaction timestamp corresponding to the current instant.
   virtual Timestamp Now() = 0;
 
+  // Obtains 'count' new transaction timestamps, in increasing order, as if by
+  // calling Now() 'count' times. Implementations may read the underlying clock
+  // just once for the whole batch.
+  virtual void NowBatch(int count, std::vector<Timestamp>* timestamps) {
+    timestamps->clear();
+    timestamps->reserve(count);
+    for (int i = 0; i < count; i++) {
+      timestamps->push_back(Now());
+    }
+  }
+
   // Obtains a new transaction timestamp corresponding to the current instant
   // plus the max_error.
   virtual Timestamp NowLatest() = 0;
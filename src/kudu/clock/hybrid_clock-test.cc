@@ -155,6 +155,20 @@ TEST_F(HybridClockTest, TestNow_ValuesIncreaseMonotonically) {
   ASSERT_LT(now1.value(), now2.value());
 }
 
+// Test that a batch of timestamps is a consecutive, increasing run which
+// Now() then continues past.
+TEST_F(HybridClockTest, TestNowBatch) {
+  const Timestamp before = clock_->Now();
+  std::vector<Timestamp> batch;
+  clock_->NowBatch(100, &batch);
+  ASSERT_EQ(100, batch.size());
+  ASSERT_GT(batch.front(), before);
+  for (int i = 1; i < batch.size(); i++) {
+    ASSERT_EQ(batch[i - 1].value() + 1, batch[i].value());
+  }
+  ASSERT_GT(clock_->Now(), batch.back());
+}
+
 // Tests the clock updates with the incoming value if it is higher.
 TEST_F(HybridClockTest, TestUpdate_LogicalValueIncreasesByAmount) {
   Timestamp now = clock_->Now();
@@ -21,6 +21,7 @@
 #include <mutex>
 #include <ostream>
 #include <string>
+#include <vector>
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <gflags/gflags.h>
@@ -81,6 +82,13 @@ METRIC_DEFINE_gauge_uint64(server, hybrid_clock_error,
                            kudu::MetricUnit::kMicroseconds,
                            "Server clock maximum error.");
 
+METRIC_DEFINE_histogram(server, hybrid_clock_read_latency,
+                        "Hybrid Clock Read Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Time taken to read the current time and its error bound "
+                        "from the time source.",
+                        60000000LU, 2);
+
 namespace kudu {
 namespace clock {
 
@@ -142,6 +150,24 @@ Timestamp HybridClock::Now() {
   return now;
 }
 
+void HybridClock::NowBatch(int count, std::vector<Timestamp>* timestamps) {
+  DCHECK_GT(count, 0);
+  timestamps->clear();
+  timestamps->reserve(count);
+
+  Timestamp first;
+  uint64_t error;
+  {
+    std::lock_guard<simple_spinlock> lock(lock_);
+    NowWithError(&first, &error);
+    // NowWithError() has already handed out 'first'; reserve the rest of the run.
+    next_timestamp_ += count - 1;
+  }
+  for (int i = 0; i < count; i++) {
+    timestamps->emplace_back(first.value() + i);
+  }
+}
+
 Timestamp HybridClock::NowLatest() {
   Timestamp now;
   uint64_t error;
@@ -372,6 +398,9 @@ Status HybridClock::WalltimeWithError(uint64_t* now_usec, uint64_t* error_usec)
         MonoDelta::FromMicroseconds(read_time_error_us);
 
     std::unique_lock<simple_spinlock> l(last_clock_read_lock_);
+    if (clock_read_latency_) {
+      clock_read_latency_->Increment(read_duration_us);
+    }
     if (!last_clock_read_time_.Initialized() ||
         last_clock_read_time_ < read_time_max_likelihood) {
       last_clock_read_time_ = read_time_max_likelihood;
@@ -434,6 +463,10 @@ void HybridClock::RegisterMetrics(const scoped_refptr<MetricEntity>& metric_enti
       metric_entity,
       Bind(&HybridClock::ErrorForMetrics, Unretained(this)))
     ->AutoDetachToLastValue(&metric_detacher_);
+  scoped_refptr<Histogram> clock_read_latency =
+      metric_entity->FindOrCreateHistogram(&METRIC_hybrid_clock_read_latency);
+  std::lock_guard<simple_spinlock> l(last_clock_read_lock_);
+  clock_read_latency_ = std::move(clock_read_latency);
 }
 
 string HybridClock::Stringify(Timestamp timestamp) {
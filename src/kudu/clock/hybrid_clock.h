@@ -19,6 +19,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "kudu/clock/clock.h"
 #include "kudu/clock/time_service.h"
@@ -47,6 +48,10 @@ class HybridClock : public Clock {
   // Obtains the timestamp corresponding to the current time.
   virtual Timestamp Now() override;
 
+  // Reads the physical clock once and hands out a run of 'count' consecutive
+  // timestamps from it, all under a single acquisition of the clock lock.
+  virtual void NowBatch(int count, std::vector<Timestamp>* timestamps) override;
+
   // Obtains the timestamp corresponding to latest possible current
   // time.
   virtual Timestamp NowLatest() override;
@@ -206,6 +211,10 @@ class HybridClock : public Clock {
 
   State state_;
 
+  // Latency of reading the time service, set by RegisterMetrics(). Protected by
+  // 'last_clock_read_lock_'.
+  scoped_refptr<Histogram> clock_read_latency_;
+
   // Clock metrics are set to detach to their last value. This means
   // that, during our destructor, we'll need to access other class members
   // declared above this. Hence, this member must be declared last.
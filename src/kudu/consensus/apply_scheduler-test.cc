@@ -0,0 +1,129 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/apply_scheduler.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <boost/optional/optional.hpp>
+#include <gtest/gtest.h>
+
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+namespace kudu {
+namespace consensus {
+
+using std::vector;
+
+class ApplySchedulerTest : public KuduTest {
+ protected:
+  // Records that the op with 'seqno' was applied under 'key'.
+  void Record(uint64_t key, int seqno) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    applied_[key].push_back(seqno);
+  }
+
+  simple_spinlock lock_;
+  vector<int> applied_[4];
+};
+
+// Ops with the same key are applied in the order they're scheduled, and ops
+// with different keys don't wait for each other.
+TEST_F(ApplySchedulerTest, TestOrderedPerKey) {
+  ApplyScheduler scheduler(4);
+  ASSERT_OK(scheduler.Init());
+
+  // Block the lane of key 0; ops of the other keys must still get applied.
+  CountDownLatch blocked(1);
+  scheduler.Schedule(uint64_t{0}, [&]() { blocked.Wait(); });
+  for (int i = 0; i < 100; i++) {
+    uint64_t key = i % 4;
+    scheduler.Schedule(key, [this, key, i]() { Record(key, i); });
+  }
+  ASSERT_EVENTUALLY([&]() {
+    std::lock_guard<simple_spinlock> l(lock_);
+    for (int key = 1; key < 4; key++) {
+      ASSERT_EQ(25, applied_[key].size());
+    }
+  });
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    ASSERT_TRUE(applied_[0].empty());
+  }
+  blocked.CountDown();
+  scheduler.Wait();
+
+  for (int key = 0; key < 4; key++) {
+    ASSERT_EQ(25, applied_[key].size());
+    for (int i = 0; i < 25; i++) {
+      ASSERT_EQ(key + 4 * i, applied_[key][i]);
+    }
+  }
+  scheduler.Shutdown();
+}
+
+// An op without a key is applied after every op scheduled before it and
+// before every op scheduled after it.
+TEST_F(ApplySchedulerTest, TestBarrier) {
+  ApplyScheduler scheduler(4);
+  ASSERT_OK(scheduler.Init());
+
+  std::atomic<int> before(0);
+  std::atomic<int> after(0);
+  std::atomic<int> seen_before(-1);
+  std::atomic<int> seen_after(-1);
+  for (int round = 0; round < 10; round++) {
+    for (uint64_t key = 0; key < 8; key++) {
+      scheduler.Schedule(key, [&]() {
+        SleepFor(MonoDelta::FromMilliseconds(1));
+        before++;
+      });
+    }
+    scheduler.Schedule(boost::none, [&]() {
+      seen_before = before.load();
+      seen_after = after.load();
+    });
+    for (uint64_t key = 0; key < 8; key++) {
+      scheduler.Schedule(key, [&]() { after++; });
+    }
+    scheduler.Wait();
+    ASSERT_EQ(8 * (round + 1), seen_before.load());
+    ASSERT_EQ(8 * round, seen_after.load());
+  }
+  scheduler.Shutdown();
+}
+
+// After Shutdown(), ops are applied inline.
+TEST_F(ApplySchedulerTest, TestApplyInlineAfterShutdown) {
+  ApplyScheduler scheduler(2);
+  ASSERT_OK(scheduler.Init());
+  scheduler.Shutdown();
+
+  bool applied = false;
+  scheduler.Schedule(uint64_t{1}, [&]() { applied = true; });
+  ASSERT_TRUE(applied);
+}
+
+}  // namespace consensus
+}  // namespace kudu
@@ -0,0 +1,123 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/apply_scheduler.h"
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/threadpool.h"
+
+namespace kudu {
+namespace consensus {
+
+ApplyScheduler::ApplyScheduler(int num_lanes)
+    : num_lanes_(num_lanes),
+      shut_down_(false) {
+  CHECK_GT(num_lanes_, 0);
+}
+
+ApplyScheduler::~ApplyScheduler() {
+  Shutdown();
+}
+
+Status ApplyScheduler::Init() {
+  // Every lane may be parked at a barrier at the same time, so there must be
+  // a thread per lane.
+  RETURN_NOT_OK(ThreadPoolBuilder("raft-apply")
+                .set_min_threads(0)
+                .set_max_threads(num_lanes_)
+                .Build(&pool_));
+  lanes_.reserve(num_lanes_);
+  for (int i = 0; i < num_lanes_; i++) {
+    lanes_.emplace_back(pool_->NewToken(ThreadPool::ExecutionMode::SERIAL));
+  }
+  return Status::OK();
+}
+
+void ApplyScheduler::Schedule(const boost::optional<uint64_t>& dependency_key,
+                              std::function<void()> apply) {
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (PREDICT_TRUE(!shut_down_ && !lanes_.empty())) {
+      // The tokens are only shut down after 'shut_down_' is set, so
+      // submission can't fail here.
+      if (!dependency_key) {
+        ScheduleBarrierUnlocked(std::move(apply));
+      } else {
+        CHECK_OK(lanes_[*dependency_key % num_lanes_]->SubmitFunc(std::move(apply)));
+      }
+      return;
+    }
+  }
+  apply();
+}
+
+void ApplyScheduler::ScheduleBarrierUnlocked(std::function<void()> apply) {
+  if (num_lanes_ == 1) {
+    CHECK_OK(lanes_[0]->SubmitFunc(std::move(apply)));
+    return;
+  }
+  // A task is queued on every lane. The first lane's task waits for the
+  // others to reach the barrier, which they do only once the operations
+  // queued ahead of them have been applied, then applies the operation and
+  // releases them.
+  auto arrived = std::make_shared<CountDownLatch>(num_lanes_ - 1);
+  auto applied = std::make_shared<CountDownLatch>(1);
+  for (int i = 1; i < num_lanes_; i++) {
+    CHECK_OK(lanes_[i]->SubmitFunc([arrived, applied]() {
+      arrived->CountDown();
+      applied->Wait();
+    }));
+  }
+  CHECK_OK(lanes_[0]->SubmitFunc([arrived, applied, apply]() {
+    arrived->Wait();
+    apply();
+    applied->CountDown();
+  }));
+}
+
+void ApplyScheduler::Wait() {
+  for (const auto& lane : lanes_) {
+    lane->Wait();
+  }
+}
+
+void ApplyScheduler::Shutdown() {
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (shut_down_) {
+      return;
+    }
+    shut_down_ = true;
+  }
+  Wait();
+  for (const auto& lane : lanes_) {
+    lane->Shutdown();
+  }
+  if (pool_) {
+    pool_->Shutdown();
+  }
+}
+
+}  // namespace consensus
+}  // namespace kudu
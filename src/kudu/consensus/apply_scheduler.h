@@ -0,0 +1,90 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <boost/optional/optional.hpp>
+
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+class ThreadPool;
+class ThreadPoolToken;
+
+namespace consensus {
+
+// Runs the apply callbacks of committed operations on a pool of threads.
+//
+// Each operation may carry a dependency key. Operations are spread over a
+// fixed number of lanes by key, and each lane runs its operations serially
+// in the order they were scheduled, so operations with the same key are
+// applied in commit order while operations with different keys may be
+// applied concurrently. An operation without a key is a barrier: it is
+// applied only once every operation scheduled before it has been applied,
+// and before any operation scheduled after it.
+//
+// Schedule() is expected to be called from a single thread at a time, in
+// commit order.
+class ApplyScheduler {
+ public:
+  explicit ApplyScheduler(int num_lanes);
+  ~ApplyScheduler();
+
+  Status Init();
+
+  // Schedules 'apply' to run after the operations it depends on, as
+  // described above. Once Shutdown() has been called the callback is run
+  // inline instead.
+  void Schedule(const boost::optional<uint64_t>& dependency_key,
+                std::function<void()> apply);
+
+  // Waits for every scheduled callback to finish running.
+  void Wait();
+
+  // Waits for the scheduled callbacks to finish and stops the threads.
+  void Shutdown();
+
+  int num_lanes() const { return num_lanes_; }
+
+ private:
+  void ScheduleBarrierUnlocked(std::function<void()> apply);
+
+  const int num_lanes_;
+
+  gscoped_ptr<ThreadPool> pool_;
+
+  // One serial token per lane.
+  std::vector<std::unique_ptr<ThreadPoolToken>> lanes_;
+
+  // Protects 'shut_down_' and submission to the lanes, so that nothing
+  // is submitted once the lanes start shutting down.
+  simple_spinlock lock_;
+  bool shut_down_;
+
+  DISALLOW_COPY_AND_ASSIGN(ApplyScheduler);
+};
+
+}  // namespace consensus
+}  // namespace kudu
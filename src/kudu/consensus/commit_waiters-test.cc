@@ -0,0 +1,128 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/commit_waiters.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+namespace kudu {
+namespace consensus {
+
+using std::vector;
+
+class CommitWaitersTest : public KuduTest {
+ protected:
+  CommitWaiters waiters_;
+};
+
+// Tests that advancing the committed index runs just the callbacks it
+// satisfies, in index order.
+TEST_F(CommitWaitersTest, TestAdvanceRunsSatisfiedWaiters) {
+  vector<int64_t> woken;
+  for (int64_t index : { 5, 3, 8, 3, 1 }) {
+    waiters_.AddWaiter(index, [&woken, index](const Status& s) {
+      ASSERT_OK(s);
+      woken.push_back(index);
+    });
+  }
+  ASSERT_EQ(5, waiters_.num_waiters());
+
+  waiters_.Advance(3);
+  ASSERT_EQ(vector<int64_t>({ 1, 3, 3 }), woken);
+  ASSERT_EQ(2, waiters_.num_waiters());
+
+  // A lower index is ignored.
+  waiters_.Advance(2);
+  ASSERT_EQ(3, woken.size());
+
+  waiters_.Advance(7);
+  ASSERT_EQ(vector<int64_t>({ 1, 3, 3, 5 }), woken);
+
+  // A waiter for an op which is already committed runs right away.
+  waiters_.AddWaiter(6, [&woken](const Status& s) {
+    ASSERT_OK(s);
+    woken.push_back(6);
+  });
+  ASSERT_EQ(vector<int64_t>({ 1, 3, 3, 5, 6 }), woken);
+  ASSERT_EQ(1, waiters_.num_waiters());
+}
+
+// Tests that shutting down fails the waiting callbacks, and those added
+// after.
+TEST_F(CommitWaitersTest, TestShutdown) {
+  int aborted = 0;
+  auto callback = [&aborted](const Status& s) {
+    ASSERT_TRUE(s.IsAborted()) << s.ToString();
+    aborted++;
+  };
+  waiters_.AddWaiter(1, callback);
+  waiters_.AddWaiter(2, callback);
+  waiters_.Shutdown(Status::Aborted("shutting down"));
+  ASSERT_EQ(2, aborted);
+  ASSERT_EQ(0, waiters_.num_waiters());
+
+  waiters_.AddWaiter(3, callback);
+  ASSERT_EQ(3, aborted);
+  Status s = waiters_.WaitForCommit(3, MonoTime::Now() + MonoDelta::FromSeconds(10));
+  ASSERT_TRUE(s.IsAborted()) << s.ToString();
+}
+
+// Tests that WaitForCommit() times out, and that the waiter it leaves behind
+// is harmless once the op is committed.
+TEST_F(CommitWaitersTest, TestWaitForCommitTimesOut) {
+  Status s = waiters_.WaitForCommit(1, MonoTime::Now() + MonoDelta::FromMilliseconds(10));
+  ASSERT_TRUE(s.IsTimedOut()) << s.ToString();
+  ASSERT_EQ(1, waiters_.num_waiters());
+  waiters_.Advance(1);
+  ASSERT_EQ(0, waiters_.num_waiters());
+  ASSERT_OK(waiters_.WaitForCommit(1, MonoTime::Now()));
+}
+
+// Tests that threads blocked in WaitForCommit() are woken as the committed
+// index passes their indexes.
+TEST_F(CommitWaitersTest, TestConcurrentWaiters) {
+  const int kNumThreads = 16;
+  std::atomic<int> committed(0);
+  vector<std::thread> threads;
+  for (int i = 1; i <= kNumThreads; i++) {
+    threads.emplace_back([this, i, &committed]() {
+      ASSERT_OK(waiters_.WaitForCommit(i, MonoTime::Now() + MonoDelta::FromSeconds(30)));
+      committed++;
+    });
+  }
+  for (int i = 1; i <= kNumThreads; i++) {
+    waiters_.Advance(i);
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(kNumThreads, committed);
+  ASSERT_EQ(0, waiters_.num_waiters());
+}
+
+} // namespace consensus
+} // namespace kudu
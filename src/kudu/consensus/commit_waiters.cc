@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/commit_waiters.h"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+
+#include "kudu/util/async_util.h"
+#include "kudu/util/monotime.h"
+
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+CommitWaiters::CommitWaiters()
+    : committed_index_(0),
+      next_seq_(0),
+      shut_down_(false) {
+}
+
+CommitWaiters::~CommitWaiters() {
+}
+
+void CommitWaiters::AddWaiter(int64_t index, StdStatusCallback callback) {
+  Status s;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (shut_down_) {
+      s = shutdown_status_;
+    } else if (index > committed_index_) {
+      waiters_.push_back({ index, next_seq_++, std::move(callback) });
+      std::push_heap(waiters_.begin(), waiters_.end(), LaterWaiter());
+      return;
+    }
+  }
+  callback(s);
+}
+
+Status CommitWaiters::WaitForCommit(int64_t index, const MonoTime& deadline) {
+  // The synchronizer's callback only holds a weak reference to it, so the
+  // waiter may outlive a wait which timed out.
+  Synchronizer sync;
+  AddWaiter(index, sync.AsStdStatusCallback());
+  Status s = sync.WaitFor(deadline - MonoTime::Now());
+  if (s.IsTimedOut()) {
+    return Status::TimedOut("Timed out waiting for the op to be committed");
+  }
+  return s;
+}
+
+void CommitWaiters::Advance(int64_t committed_index) {
+  vector<StdStatusCallback> woken;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (committed_index <= committed_index_) {
+      return;
+    }
+    committed_index_ = committed_index;
+    while (!waiters_.empty() && waiters_.front().index <= committed_index) {
+      std::pop_heap(waiters_.begin(), waiters_.end(), LaterWaiter());
+      woken.emplace_back(std::move(waiters_.back().callback));
+      waiters_.pop_back();
+    }
+  }
+  for (StdStatusCallback& callback : woken) {
+    callback(Status::OK());
+  }
+}
+
+void CommitWaiters::Shutdown(const Status& s) {
+  DCHECK(!s.ok());
+  vector<Waiter> waiters;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    shut_down_ = true;
+    shutdown_status_ = s;
+    waiters.swap(waiters_);
+  }
+  // Run in index order, as Advance() would have.
+  std::sort_heap(waiters.begin(), waiters.end(), LaterWaiter());
+  for (auto it = waiters.rbegin(); it != waiters.rend(); ++it) {
+    it->callback(s);
+  }
+}
+
+size_t CommitWaiters::num_waiters() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  return waiters_.size();
+}
+
+} // namespace consensus
+} // namespace kudu
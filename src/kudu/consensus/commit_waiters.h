@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/status.h"
+#include "kudu/util/status_callback.h"
+
+namespace kudu {
+
+class MonoTime;
+
+namespace consensus {
+
+// The callbacks waiting for ops to be committed, by index.
+//
+// The waiters are kept in a min-heap keyed by the index they wait for, so
+// that advancing the committed index pops just the waiters it satisfies and
+// runs them in one pass, at a cost proportional to the number woken rather
+// than to the number waiting. A thread blocked in WaitForCommit() waits on a
+// latch of its own, so only the threads whose index is committed wake up.
+//
+// This class is thread-safe.
+class CommitWaiters {
+ public:
+  CommitWaiters();
+  ~CommitWaiters();
+
+  // Runs 'callback' with OK once the op with 'index' has been committed, or
+  // with the shutdown status if Shutdown() is called first. If the op has
+  // already been committed, or Shutdown() already called, 'callback' runs
+  // before this returns. Otherwise it runs on the thread which calls
+  // Advance() or Shutdown(), so it must not block.
+  void AddWaiter(int64_t index, StdStatusCallback callback);
+
+  // Blocks until the op with 'index' has been committed.
+  //
+  // Returns "TimedOut" if it hasn't been by 'deadline', or the shutdown
+  // status if Shutdown() is called first. A wait which times out leaves its
+  // waiter behind until the op is committed, which then runs as a no-op.
+  Status WaitForCommit(int64_t index, const MonoTime& deadline);
+
+  // Marks the ops up to and including 'committed_index' as committed, and
+  // runs the callbacks waiting for them, once the lock is released. Indexes
+  // lower than the last one passed are ignored.
+  void Advance(int64_t committed_index);
+
+  // Runs every waiting callback with 's', as well as the callbacks added
+  // from now on.
+  void Shutdown(const Status& s);
+
+  // Returns the number of callbacks waiting.
+  size_t num_waiters() const;
+
+ private:
+  struct Waiter {
+    int64_t index;
+    // Breaks ties between waiters for the same index, so that they are run
+    // in the order they were added.
+    uint64_t seq;
+    StdStatusCallback callback;
+  };
+
+  struct LaterWaiter {
+    bool operator()(const Waiter& a, const Waiter& b) const {
+      return a.index > b.index || (a.index == b.index && a.seq > b.seq);
+    }
+  };
+
+  mutable simple_spinlock lock_;
+
+  // The waiters, kept as a heap by LaterWaiter so that the one for the
+  // lowest index is at the front. Protected by 'lock_'.
+  std::vector<Waiter> waiters_;
+
+  // The highest index passed to Advance(). Protected by 'lock_'.
+  int64_t committed_index_;
+
+  // Protected by 'lock_'.
+  uint64_t next_seq_;
+
+  // Set by Shutdown(). Protected by 'lock_'.
+  Status shutdown_status_;
+  bool shut_down_;
+
+  DISALLOW_COPY_AND_ASSIGN(CommitWaiters);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -21,6 +21,7 @@
 // out of Kudu into a fork known as kuduraft.
 // ********************************************************************
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
@@ -728,6 +729,15 @@ class TestTransactionFactory : public ConsensusRoundHandler {
 
   void FinishConsensusOnlyRound(ConsensusRound* /*round*/) override {}
 
+  void FinishReplicationOfRounds(
+      const std::vector<scoped_refptr<ConsensusRound>>& rounds) override {
+    batched_rounds_ += rounds.size();
+    ConsensusRoundHandler::FinishReplicationOfRounds(rounds);
+  }
+
+  // The number of rounds which were handed to FinishReplicationOfRounds().
+  int64_t batched_rounds() const { return batched_rounds_; }
+
   void ReplicateAsync(ConsensusRound* round) {
     CHECK_OK(consensus_->Replicate(round));
   }
@@ -749,6 +759,7 @@ class TestTransactionFactory : public ConsensusRoundHandler {
   gscoped_ptr<ThreadPool> pool_;
   RaftConsensus* consensus_;
   log::Log* log_;
+  std::atomic<int64_t> batched_rounds_{0};
 };
 
 }  // namespace consensus
@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
@@ -33,12 +34,16 @@
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/env.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_bool(cmeta_journal_updates);
+DECLARE_int32(cmeta_journal_max_records);
+
 namespace kudu {
 namespace consensus {
 
@@ -174,6 +179,100 @@ TEST_F(ConsensusMetadataTest, TestFlush) {
   }
 }
 
+// Tests that updates which leave the committed config unchanged are appended
+// to the journal, that loading applies them, and that the file is rewritten
+// once the config changes or the journal fills up.
+TEST_F(ConsensusMetadataTest, TestJournaledUpdates) {
+  FLAGS_cmeta_journal_updates = true;
+  FLAGS_cmeta_journal_max_records = 3;
+  const string kPeerUuid = fs_manager_.uuid();
+  const string path = fs_manager_.GetConsensusMetadataPath(kTabletId);
+  const string journal_path = fs_manager_.GetConsensusMetadataJournalPath(kTabletId);
+  scoped_refptr<ConsensusMetadata> cmeta;
+  ASSERT_OK(ConsensusMetadata::Create(&fs_manager_, kTabletId, kPeerUuid,
+                                      config_, kInitialTerm,
+                                      ConsensusMetadataCreateMode::FLUSH_ON_CREATE,
+                                      &cmeta));
+  ASSERT_FALSE(env_->FileExists(journal_path));
+
+  auto file_term = [&]() {
+    ConsensusMetadataPB pb;
+    CHECK_OK(pb_util::ReadPBContainerFromPath(env_, path, &pb));
+    return pb.current_term();
+  };
+  auto load = [&]() {
+    scoped_refptr<ConsensusMetadata> cmeta_read;
+    CHECK_OK(ConsensusMetadata::Load(&fs_manager_, kTabletId, kPeerUuid, &cmeta_read));
+    return cmeta_read;
+  };
+
+  // A term change and a vote only go to the journal.
+  cmeta->set_current_term(kInitialTerm + 1);
+  ASSERT_OK(cmeta->Flush());
+  cmeta->set_voted_for(kPeerUuid);
+  ASSERT_OK(cmeta->Flush());
+  ASSERT_EQ(2, cmeta->journal_records_);
+  ASSERT_EQ(kInitialTerm, file_term());
+  {
+    scoped_refptr<ConsensusMetadata> cmeta_read = load();
+    ASSERT_EQ(kInitialTerm + 1, cmeta_read->current_term());
+    ASSERT_EQ(kPeerUuid, cmeta_read->voted_for());
+    ASSERT_EQ(cmeta->on_disk_size(), cmeta_read->on_disk_size());
+  }
+
+  // A partial record at the end of the journal is ignored.
+  cmeta->set_current_term(kInitialTerm + 2);
+  ASSERT_OK(cmeta->Flush());
+  {
+    uint64_t journal_size;
+    ASSERT_OK(env_->GetFileSize(journal_path, &journal_size));
+    RWFileOptions opts;
+    opts.mode = Env::OPEN_EXISTING;
+    unique_ptr<RWFile> file;
+    ASSERT_OK(env_->NewRWFile(opts, journal_path, &file));
+    ASSERT_OK(file->Truncate(journal_size - 3));
+    ASSERT_OK(file->Close());
+  }
+  {
+    scoped_refptr<ConsensusMetadata> cmeta_read = load();
+    ASSERT_EQ(kInitialTerm + 1, cmeta_read->current_term());
+    ASSERT_EQ(kPeerUuid, cmeta_read->voted_for());
+  }
+
+  // A config change rewrites the file, which supersedes the journal.
+  RaftConfigPB new_config = config_;
+  new_config.set_opid_index(2);
+  cmeta->set_committed_config(new_config);
+  ASSERT_OK(cmeta->Flush());
+  ASSERT_EQ(0, cmeta->journal_records_);
+  ASSERT_EQ(kInitialTerm + 2, file_term());
+  {
+    scoped_refptr<ConsensusMetadata> cmeta_read = load();
+    ASSERT_EQ(kInitialTerm + 2, cmeta_read->current_term());
+    ASSERT_FALSE(cmeta_read->has_voted_for());
+    ASSERT_EQ(2, cmeta_read->CommittedConfig().opid_index());
+  }
+
+  // So does an update once the journal is full.
+  for (int i = 1; i <= FLAGS_cmeta_journal_max_records; i++) {
+    cmeta->set_current_term(kInitialTerm + 2 + i);
+    ASSERT_OK(cmeta->Flush());
+  }
+  ASSERT_EQ(kInitialTerm + 2, file_term());
+  cmeta->set_voted_for(kPeerUuid);
+  ASSERT_OK(cmeta->Flush());
+  ASSERT_EQ(0, cmeta->journal_records_);
+  ASSERT_EQ(kInitialTerm + 5, file_term());
+  {
+    scoped_refptr<ConsensusMetadata> cmeta_read = load();
+    ASSERT_EQ(kInitialTerm + 5, cmeta_read->current_term());
+    ASSERT_EQ(kPeerUuid, cmeta_read->voted_for());
+  }
+
+  ASSERT_OK(ConsensusMetadata::DeleteOnDiskData(&fs_manager_, kTabletId));
+  ASSERT_FALSE(env_->FileExists(journal_path));
+}
+
 // Builds a distributed configuration of voters with the given uuids.
 RaftConfigPB BuildConfig(const vector<string>& uuids) {
   RaftConfigPB config;
@@ -292,6 +391,47 @@ TEST_F(ConsensusMetadataTest, TestToConsensusStatePB) {
   ASSERT_OK(VerifyConsensusState(new_cstate));
 }
 
+// Ensure that the snapshot is republished by every update of the state it
+// copies, and that earlier snapshots are left as they were.
+TEST_F(ConsensusMetadataTest, TestSnapshot) {
+  vector<string> uuids = { "a", "b", "c", "d", "e" };
+  RaftConfigPB config = BuildConfig(uuids);
+  config.set_opid_index(1);
+  scoped_refptr<ConsensusMetadata> cmeta;
+  ASSERT_OK(ConsensusMetadata::Create(&fs_manager_, kTabletId, "e",
+                                      config, kInitialTerm,
+                                      ConsensusMetadataCreateMode::FLUSH_ON_CREATE,
+                                      &cmeta));
+  auto initial = cmeta->snapshot();
+  ASSERT_EQ(kInitialTerm, initial->current_term);
+  ASSERT_EQ(RaftPeerPB::FOLLOWER, initial->active_role);
+  ASSERT_TRUE(initial->leader_uuid.empty());
+  ASSERT_EQ(1, initial->cstate.committed_config().opid_index());
+
+  cmeta->set_current_term(kInitialTerm + 1);
+  ASSERT_OK(cmeta->set_leader_uuid("e"));
+  auto leader = cmeta->snapshot();
+  ASSERT_EQ(kInitialTerm + 1, leader->current_term);
+  ASSERT_EQ("e", leader->leader_uuid);
+  ASSERT_EQ(RaftPeerPB::LEADER, leader->active_role);
+  ASSERT_EQ("255.255.255.255", leader->leader_hostport.first);
+  ASSERT_EQ(pb_util::SecureShortDebugString(cmeta->ToConsensusStatePB()),
+            pb_util::SecureShortDebugString(leader->cstate));
+
+  config.set_opid_index(2);
+  cmeta->set_pending_config(config);
+  ASSERT_TRUE(cmeta->snapshot()->cstate.has_pending_config());
+  cmeta->set_committed_config(config);
+  cmeta->clear_pending_config();
+  auto committed = cmeta->snapshot();
+  ASSERT_FALSE(committed->cstate.has_pending_config());
+  ASSERT_EQ(2, committed->cstate.committed_config().opid_index());
+
+  // Holders of earlier snapshots still see the state they were published with.
+  ASSERT_EQ(kInitialTerm, initial->current_term);
+  ASSERT_EQ(1, leader->cstate.committed_config().opid_index());
+}
+
 // Helper for TestMergeCommittedConsensusStatePB.
 static void AssertConsensusMergeExpected(const scoped_refptr<ConsensusMetadata>& cmeta,
                                          const ConsensusStatePB& cstate,
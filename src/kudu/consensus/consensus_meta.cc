@@ -22,6 +22,7 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/util/message_differencer.h>
 
 #include "kudu/consensus/log_util.h"
 #include "kudu/consensus/metadata.pb.h"
@@ -34,6 +35,7 @@
 #include "kudu/util/env_util.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/io_class.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
@@ -44,13 +46,34 @@ DEFINE_double(fault_crash_before_cmeta_flush, 0.0,
               "Fraction of the time when the server will crash just before flushing "
               "consensus metadata. (For testing only!)");
 TAG_FLAG(fault_crash_before_cmeta_flush, unsafe);
+
+DEFINE_bool(cmeta_journal_updates, false,
+            "Whether updates to the consensus metadata which leave the committed "
+            "config unchanged, such as term changes and votes, are appended to a "
+            "journal next to the consensus metadata file rather than rewriting "
+            "it. An update then costs a single append and fsync instead of "
+            "writing, fsyncing and renaming a new file.");
+TAG_FLAG(cmeta_journal_updates, experimental);
+TAG_FLAG(cmeta_journal_updates, runtime);
+
+DEFINE_int32(cmeta_journal_max_records, 64,
+             "The number of updates appended to the journal of the consensus "
+             "metadata before the next update rewrites the consensus metadata "
+             "file, and so empties the journal.");
+TAG_FLAG(cmeta_journal_max_records, experimental);
+TAG_FLAG(cmeta_journal_max_records, runtime);
 DECLARE_bool(enable_flexi_raft);
 
 namespace kudu {
 namespace consensus {
 
+using google::protobuf::util::MessageDifferencer;
+using pb_util::ReadablePBContainerFile;
+using pb_util::WritablePBContainerFile;
 using std::lock_guard;
+using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using strings::Substitute;
 
 int64_t ConsensusMetadata::current_term() const {
@@ -63,6 +86,7 @@ void ConsensusMetadata::set_current_term(int64_t term) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   DCHECK_GE(term, kMinimumTerm);
   pb_.set_current_term(term);
+  PublishSnapshot();
 }
 
 bool ConsensusMetadata::has_voted_for() const {
@@ -191,12 +215,15 @@ void ConsensusMetadata::set_committed_config(const RaftConfigPB& config) {
   *pb_.mutable_committed_config() = config;
   if (!has_pending_config_) {
     UpdateActiveRole();
+  } else {
+    PublishSnapshot();
   }
 }
 
 void ConsensusMetadata::set_committed_config_raw(const RaftConfigPB &config) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   *pb_.mutable_committed_config() = config;
+  PublishSnapshot();
 }
 
 kudu::Status ConsensusMetadata::voter_distribution(std::map<std::string, int32> *vd) const {
@@ -350,12 +377,28 @@ Status ConsensusMetadata::Flush(FlushMode flush_mode) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   MAYBE_FAULT(FLAGS_fault_crash_before_cmeta_flush);
   SCOPED_LOG_SLOW_EXECUTION_PREFIX(WARNING, 500, LogPrefix(), "flushing consensus metadata");
+  // Votes and config changes wait for the flush.
+  ScopedIOClass io_class(IOClass::kForeground);
 
   flush_count_for_tests_++;
   // Sanity test to ensure we never write out a bad configuration.
   RETURN_NOT_OK_PREPEND(VerifyRaftConfig(pb_.committed_config()),
                         "Invalid config in ConsensusMetadata, cannot flush to disk");
 
+  if (CanJournal(flush_mode)) {
+    Status s = AppendToJournal();
+    if (s.ok()) {
+      return Status::OK();
+    }
+    // The journal may end in a partial record now, which would hide any
+    // record appended after it: rewrite the file instead, which starts a
+    // new journal.
+    LOG_WITH_PREFIX(WARNING) << "Unable to append to the consensus metadata journal, "
+                             << "rewriting the consensus metadata: " << s.ToString();
+    journal_.reset();
+    can_journal_ = false;
+  }
+
   // Create directories if needed.
   string dir = fs_manager_->GetConsensusMetadataDir();
   bool created_dir = false;
@@ -370,6 +413,8 @@ Status ConsensusMetadata::Flush(FlushMode flush_mode) {
   }
 
   string meta_file_path = fs_manager_->GetConsensusMetadataPath(tablet_id_);
+  // The records in the journal so far are all included in the new file.
+  pb_.set_journal_seqno(pb_.journal_seqno() + 1);
   RETURN_NOT_OK_PREPEND(pb_util::WritePBContainerToPath(
       fs_manager_->env(), meta_file_path, pb_,
       flush_mode == OVERWRITE ? pb_util::OVERWRITE : pb_util::NO_OVERWRITE,
@@ -380,10 +425,121 @@ Status ConsensusMetadata::Flush(FlushMode flush_mode) {
       FLAGS_log_force_fsync_all ? pb_util::SYNC : pb_util::NO_SYNC),
           Substitute("Unable to write consensus meta file for tablet $0 to path $1",
                      tablet_id_, meta_file_path));
+  if (journal_) {
+    WARN_NOT_OK(journal_->Close(), LogPrefix() + "Unable to close consensus metadata journal");
+    journal_.reset();
+  }
+  journal_records_ = 0;
+  can_journal_ = true;
+  flushed_config_ = pb_.committed_config();
   RETURN_NOT_OK(UpdateOnDiskSize());
   return Status::OK();
 }
 
+bool ConsensusMetadata::CanJournal(FlushMode flush_mode) const {
+  return FLAGS_cmeta_journal_updates &&
+      can_journal_ &&
+      flush_mode == OVERWRITE &&
+      journal_records_ < FLAGS_cmeta_journal_max_records &&
+      MessageDifferencer::Equals(flushed_config_, pb_.committed_config());
+}
+
+Status ConsensusMetadata::AppendToJournal() {
+  const bool sync = FLAGS_log_force_fsync_all;
+  Env* env = fs_manager_->env();
+  if (!journal_) {
+    // Start a new journal. Whatever an earlier one holds is included in the
+    // consensus metadata file already.
+    string path = fs_manager_->GetConsensusMetadataJournalPath(tablet_id_);
+    bool created = !env->FileExists(path);
+    unique_ptr<RWFile> file;
+    RETURN_NOT_OK_PREPEND(env->NewRWFile(RWFileOptions(), path, &file),
+                          "Unable to create consensus metadata journal");
+    unique_ptr<WritablePBContainerFile> journal(
+        new WritablePBContainerFile(shared_ptr<RWFile>(std::move(file))));
+    RETURN_NOT_OK(journal->CreateNew(ConsensusMetadataJournalRecordPB()));
+    if (sync) {
+      RETURN_NOT_OK(journal->Sync());
+      if (created) {
+        RETURN_NOT_OK_PREPEND(env->SyncDir(fs_manager_->GetConsensusMetadataDir()),
+                              "Unable to fsync consensus metadata dir");
+      }
+    }
+    journal_ = std::move(journal);
+  }
+
+  ConsensusMetadataJournalRecordPB record;
+  record.set_seqno(pb_.journal_seqno() + 1);
+  record.set_current_term(pb_.current_term());
+  if (pb_.has_voted_for()) {
+    record.set_voted_for(pb_.voted_for());
+  }
+  if (pb_.has_last_known_leader()) {
+    *record.mutable_last_known_leader() = pb_.last_known_leader();
+  }
+  if (pb_.has_last_pruned_term()) {
+    record.set_last_pruned_term(pb_.last_pruned_term());
+  }
+  *record.mutable_previous_vote_history() = pb_.previous_vote_history();
+  RETURN_NOT_OK(journal_->Append(record));
+  if (sync) {
+    RETURN_NOT_OK(journal_->Sync());
+  }
+  pb_.set_journal_seqno(record.seqno());
+  journal_records_++;
+  return UpdateOnDiskSize();
+}
+
+Status ConsensusMetadata::ReplayJournal() {
+  Env* env = fs_manager_->env();
+  string path = fs_manager_->GetConsensusMetadataJournalPath(tablet_id_);
+  if (!env->FileExists(path)) {
+    return Status::OK();
+  }
+  unique_ptr<RandomAccessFile> file;
+  RETURN_NOT_OK(env->NewRandomAccessFile(path, &file));
+  ReadablePBContainerFile reader(std::move(file));
+  Status s = reader.Open();
+  if (s.IsIncomplete()) {
+    // The journal was being created, and holds no records yet.
+    return Status::OK();
+  }
+  RETURN_NOT_OK_PREPEND(s, "Unable to open consensus metadata journal");
+
+  int num_applied = 0;
+  while (true) {
+    ConsensusMetadataJournalRecordPB record;
+    s = reader.ReadNextPB(&record);
+    if (s.IsEndOfFile() || s.IsIncomplete()) {
+      // A partial record was never acknowledged as flushed.
+      break;
+    }
+    RETURN_NOT_OK_PREPEND(s, "Unable to read consensus metadata journal");
+    if (record.seqno() <= pb_.journal_seqno()) {
+      continue;
+    }
+    pb_.set_journal_seqno(record.seqno());
+    pb_.set_current_term(record.current_term());
+    if (record.has_voted_for()) {
+      pb_.set_voted_for(record.voted_for());
+    } else {
+      pb_.clear_voted_for();
+    }
+    if (record.has_last_known_leader()) {
+      *pb_.mutable_last_known_leader() = record.last_known_leader();
+    }
+    if (record.has_last_pruned_term()) {
+      pb_.set_last_pruned_term(record.last_pruned_term());
+    }
+    *pb_.mutable_previous_vote_history() = record.previous_vote_history();
+    num_applied++;
+  }
+  if (num_applied > 0) {
+    VLOG_WITH_PREFIX(1) << "Applied " << num_applied << " consensus metadata journal records";
+  }
+  return Status::OK();
+}
+
 ConsensusMetadata::ConsensusMetadata(FsManager* fs_manager,
                                      std::string tablet_id,
                                      std::string peer_uuid)
@@ -392,12 +548,19 @@ ConsensusMetadata::ConsensusMetadata(FsManager* fs_manager,
       peer_uuid_(std::move(peer_uuid)),
       has_pending_config_(false),
       flush_count_for_tests_(0),
+      journal_records_(0),
+      can_journal_(false),
       on_disk_size_(0) {
   // This is not really required as default values but specifying explicitly
   // since correctness is dependent on it.
   pb_.mutable_last_known_leader()->set_uuid("");
   pb_.mutable_last_known_leader()->set_election_term(0);
   pb_.set_last_pruned_term(-1);
+  std::atomic_store(&snapshot_, shared_ptr<const Snapshot>(
+      new Snapshot{ kMinimumTerm, "", RaftPeerPB::UNKNOWN_ROLE, {}, ConsensusStatePB() }));
+}
+
+ConsensusMetadata::~ConsensusMetadata() {
 }
 
 Status ConsensusMetadata::Create(FsManager* fs_manager,
@@ -433,6 +596,7 @@ Status ConsensusMetadata::Load(FsManager* fs_manager,
   RETURN_NOT_OK(pb_util::ReadPBContainerFromPath(fs_manager->env(),
                                                  fs_manager->GetConsensusMetadataPath(tablet_id),
                                                  &cmeta->pb_));
+  RETURN_NOT_OK(cmeta->ReplayJournal());
   cmeta->UpdateActiveRole(); // Needs to happen here as we sidestep the accessor APIs.
 
   RETURN_NOT_OK(cmeta->UpdateOnDiskSize());
@@ -445,6 +609,12 @@ Status ConsensusMetadata::DeleteOnDiskData(FsManager* fs_manager, const string&
   RETURN_NOT_OK_PREPEND(fs_manager->env()->DeleteFile(cmeta_path),
                         Substitute("Unable to delete consensus metadata file for tablet $0",
                                    tablet_id));
+  string journal_path = fs_manager->GetConsensusMetadataJournalPath(tablet_id);
+  if (fs_manager->env()->FileExists(journal_path)) {
+    RETURN_NOT_OK_PREPEND(fs_manager->env()->DeleteFile(journal_path),
+                          Substitute("Unable to delete consensus metadata journal for tablet $0",
+                                     tablet_id));
+  }
   return Status::OK();
 }
 
@@ -459,12 +629,29 @@ void ConsensusMetadata::UpdateActiveRole() {
   VLOG_WITH_PREFIX(1) << "Updating active role to " << RaftPeerPB::Role_Name(active_role_)
                       << ". Consensus state: "
                       << pb_util::SecureShortDebugString(ToConsensusStatePB());
+  PublishSnapshot();
+}
+
+void ConsensusMetadata::PublishSnapshot() {
+  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->current_term = pb_.has_current_term() ? pb_.current_term() : kMinimumTerm;
+  snapshot->leader_uuid = leader_uuid_;
+  snapshot->active_role = active_role_;
+  snapshot->leader_hostport = leader_hostport();
+  snapshot->cstate = ToConsensusStatePB();
+  std::atomic_store(&snapshot_, shared_ptr<const Snapshot>(std::move(snapshot)));
 }
 
 Status ConsensusMetadata::UpdateOnDiskSize() {
   string path = fs_manager_->GetConsensusMetadataPath(tablet_id_);
   uint64_t on_disk_size;
   RETURN_NOT_OK(fs_manager_->env()->GetFileSize(path, &on_disk_size));
+  string journal_path = fs_manager_->GetConsensusMetadataJournalPath(tablet_id_);
+  uint64_t journal_size;
+  if (fs_manager_->env()->GetFileSize(journal_path, &journal_size).ok()) {
+    on_disk_size += journal_size;
+  }
   on_disk_size_ = on_disk_size;
   return Status::OK();
 }
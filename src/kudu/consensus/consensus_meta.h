@@ -19,7 +19,9 @@
 #include <atomic>
 #include <cstdint>
 #include <deque>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include <gtest/gtest_prod.h>
 
@@ -34,6 +36,10 @@ namespace kudu {
 class FsManager;
 class Status;
 
+namespace pb_util {
+class WritablePBContainerFile;
+} // namespace pb_util
+
 namespace consensus {
 
 class ConsensusMetadataManager; // IWYU pragma: keep
@@ -66,7 +72,8 @@ enum class ConsensusMetadataCreateMode {
 // the pending configuration if a pending configuration is set, otherwise the committed
 // configuration.
 //
-// This class is not thread-safe and requires external synchronization.
+// This class is not thread-safe and requires external synchronization, with
+// the exception of snapshot().
 class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
  public:
 
@@ -76,6 +83,22 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
     NO_OVERWRITE
   };
 
+  // An immutable copy of the state which is read most often: republished
+  // whenever the term, the leader or a config changes.
+  struct Snapshot {
+    int64_t current_term;
+    std::string leader_uuid;
+    RaftPeerPB::Role active_role;
+    std::pair<std::string, unsigned int> leader_hostport;
+    ConsensusStatePB cstate;
+  };
+
+  // Returns the last published snapshot. Unlike the other accessors, this may
+  // be called without external synchronization. Never returns null.
+  std::shared_ptr<const Snapshot> snapshot() const {
+    return std::atomic_load(&snapshot_);
+  }
+
   // Accessors for current term.
   int64_t current_term() const;
   void set_current_term(int64_t term);
@@ -180,6 +203,11 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   void MergeCommittedConsensusStatePB(const ConsensusStatePB& cstate);
 
   // Persist current state of the protobuf to disk.
+  //
+  // With --cmeta_journal_updates, an update which leaves the committed config
+  // as it was is appended to the journal of the consensus metadata instead,
+  // and the whole protobuf is only rewritten every
+  // --cmeta_journal_max_records updates.
   Status Flush(FlushMode flush_mode = OVERWRITE);
 
   int64_t flush_count_for_tests() const {
@@ -224,12 +252,15 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   FRIEND_TEST(ConsensusMetadataTest, TestFlush);
   FRIEND_TEST(ConsensusMetadataTest, TestActiveRole);
   FRIEND_TEST(ConsensusMetadataTest, TestToConsensusStatePB);
+  FRIEND_TEST(ConsensusMetadataTest, TestSnapshot);
   FRIEND_TEST(ConsensusMetadataTest, TestMergeCommittedConsensusStatePB);
+  FRIEND_TEST(ConsensusMetadataTest, TestJournaledUpdates);
 
   static const int32_t VOTE_HISTORY_MAX_SIZE = 100;
 
   ConsensusMetadata(FsManager* fs_manager, std::string tablet_id,
                     std::string peer_uuid);
+  ~ConsensusMetadata();
 
   // Create a ConsensusMetadata object with provided initial state.
   // If 'create_mode' is set to FLUSH_ON_CREATE, the encoded PB is flushed to
@@ -254,9 +285,23 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
                      scoped_refptr<ConsensusMetadata>* cmeta_out = nullptr);
 
   // Delete the ConsensusMetadata file associated with the given tablet from
-  // disk. Returns Status::NotFound if the on-disk data is not found.
+  // disk, along with its journal. Returns Status::NotFound if the on-disk data
+  // is not found.
   static Status DeleteOnDiskData(FsManager* fs_manager, const std::string& tablet_id);
 
+  // Returns whether Flush() may append the current state to the journal
+  // rather than rewrite the whole protobuf.
+  bool CanJournal(FlushMode flush_mode) const;
+
+  // Appends the current state, other than the committed config, to the
+  // journal, creating it if it isn't open.
+  Status AppendToJournal();
+
+  // Applies the records of the journal which came after the last rewrite of
+  // the protobuf to 'pb_'. A partial record at the end of the journal, left by
+  // a crash while appending it, is ignored.
+  Status ReplayJournal();
+
   // Return the specified config.
   const RaftConfigPB& GetConfig(RaftConfigState type) const;
 
@@ -265,9 +310,12 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
 
   std::string LogPrefix() const;
 
-  // Updates the cached active role.
+  // Updates the cached active role, and republishes the snapshot.
   void UpdateActiveRole();
 
+  // Replaces the snapshot returned by snapshot() with the current state.
+  void PublishSnapshot();
+
   // Updates the cached on-disk size of the consensus metadata.
   Status UpdateOnDiskSize();
 
@@ -289,9 +337,23 @@ class ConsensusMetadata : public RefCountedThreadSafe<ConsensusMetadata> {
   // Cached role of the peer_uuid_ within the active configuration.
   RaftPeerPB::Role active_role_;
 
+  // Loaded and stored atomically, see snapshot().
+  std::shared_ptr<const Snapshot> snapshot_;
+
   // The number of times the metadata has been flushed to disk.
   int64_t flush_count_for_tests_;
 
+  // The journal of the updates flushed since the protobuf was last rewritten,
+  // and the number of records in it. Only appended to once this object has
+  // rewritten the protobuf itself, as 'journal_' is truncated when it opens.
+  std::unique_ptr<pb_util::WritablePBContainerFile> journal_;
+  int journal_records_;
+  bool can_journal_;
+
+  // The committed config as of the last rewrite of the protobuf. Updates which
+  // change it rewrite the protobuf.
+  RaftConfigPB flushed_config_;
+
   // Durable fields.
   ConsensusMetadataPB pb_;
 
@@ -22,11 +22,15 @@
 // ********************************************************************
 
 #include <cstddef>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
@@ -51,7 +55,9 @@
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/messenger.h"
+#include "kudu/rpc/rpc_controller.h"
 //#include "kudu/tserver/tserver.pb.h"
 #include "kudu/util/metrics.h"
 //METRIC_DEFINE_entity(tablet);
@@ -61,6 +67,10 @@
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
 
+DECLARE_bool(raft_coalesce_heartbeats);
+DECLARE_int32(consensus_max_inflight_requests_per_peer);
+DECLARE_int32(raft_heartbeat_interval_ms);
+
 METRIC_DECLARE_entity(tablet);
 
 namespace kudu {
@@ -74,6 +84,8 @@ using std::make_shared;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
 
 const char* kTabletId = "test-peers-tablet";
 const char* kLeaderUuid = "peer-0";
@@ -165,6 +177,7 @@ class ConsensusPeersTest : public KuduTest {
                                  raft_pool_token_.get(),
                                  std::move(proxy),
                                  messenger_,
+                                 nullptr,
                                  peer));
     return proxy_ptr;
   }
@@ -310,6 +323,7 @@ TEST_F(ConsensusPeersTest, TestCloseWhenRemotePeerDoesntMakeProgress) {
                                 raft_pool_token_.get(),
                                 mock_proxy,
                                 messenger_,
+                                nullptr,
                                 &peer));
 
   // Make the peer respond without making any progress -- it always returns
@@ -350,6 +364,7 @@ TEST_F(ConsensusPeersTest, TestDontSendOneRpcPerWriteWhenPeerIsDown) {
                                 raft_pool_token_.get(),
                                 mock_proxy,
                                 messenger_,
+                                nullptr,
                                 &peer));
 
   // Initial response has to be successful -- otherwise we'll consider the peer
@@ -394,5 +409,219 @@ TEST_F(ConsensusPeersTest, TestDontSendOneRpcPerWriteWhenPeerIsDown) {
   ASSERT_LT(mock_proxy->update_count(), 5);
 }
 
+// Tests that with requests pipelined to a peer, the responses which arrive
+// while others are being handled, or ahead of an earlier one, are all handled
+// in order without each queuing a task of its own.
+TEST_F(ConsensusPeersTest, TestPipelinedResponses) {
+  FLAGS_consensus_max_inflight_requests_per_peer = 4;
+  message_queue_->SetLeaderMode(kMinimumOpIdIndex,
+                                kMinimumTerm,
+                                BuildRaftConfigPBForTests(3));
+
+  shared_ptr<Peer> remote_peer;
+  DelayablePeerProxy<NoOpTestPeerProxy>* proxy =
+      NewRemotePeer(kFollowerUuid, &remote_peer);
+
+  for (int i = 1; i <= 100; i += 10) {
+    AppendReplicateMessagesToQueue(message_queue_.get(), clock_, i, 10);
+    ASSERT_OK(remote_peer->SignalRequest());
+  }
+  NO_FATALS(WaitForCommitIndex(100));
+  // Every op reaches the peer, however the responses interleaved.
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_OK(remote_peer->SignalRequest());
+    ASSERT_EQ(100, proxy->proxy()->last_received().index());
+  });
+}
+
+// Tests that with --raft_coalesce_heartbeats the peers share their messenger's
+// scheduler, which heartbeats all of them and forgets the ones destroyed.
+TEST_F(ConsensusPeersTest, TestCoalescedHeartbeats) {
+  FLAGS_raft_coalesce_heartbeats = true;
+  FLAGS_raft_heartbeat_interval_ms = 50;
+  message_queue_->SetLeaderMode(kMinimumOpIdIndex,
+                                kMinimumTerm,
+                                BuildRaftConfigPBForTests(3));
+
+  vector<shared_ptr<MockedPeerProxy>> proxies;
+  vector<shared_ptr<Peer>> peers;
+  for (const char* uuid : { "peer-1", "peer-2" }) {
+    auto mock_proxy = make_shared<MockedPeerProxy>(raft_pool_.get());
+    ConsensusResponsePB resp;
+    resp.set_responder_uuid(uuid);
+    resp.set_responder_term(0);
+    resp.mutable_status()->mutable_last_received()->CopyFrom(MinimumOpId());
+    resp.mutable_status()->mutable_last_received_current_leader()->CopyFrom(MinimumOpId());
+    resp.mutable_status()->set_last_committed_idx(0);
+    mock_proxy->set_update_response(resp);
+    peer_proxy_pool_.Put(uuid, mock_proxy);
+    shared_ptr<Peer> peer;
+    ASSERT_OK(Peer::NewRemotePeer(FakeRaftPeerPB(uuid),
+                                  kTabletId,
+                                  kLeaderUuid,
+                                  message_queue_.get(),
+                                  &peer_proxy_pool_,
+                                  raft_pool_token_.get(),
+                                  mock_proxy,
+                                  messenger_,
+                                  nullptr,
+                                  &peer));
+    proxies.push_back(std::move(mock_proxy));
+    peers.push_back(std::move(peer));
+  }
+
+  shared_ptr<HeartbeatScheduler> scheduler = HeartbeatScheduler::Get(messenger_);
+  ASSERT_EQ(2, scheduler->num_peers());
+  ASSERT_EVENTUALLY([&]() {
+    for (const auto& proxy : proxies) {
+      ASSERT_GE(proxy->update_count(), 2);
+    }
+  });
+
+  peers[1]->Close();
+  peers.pop_back();
+  // A task on the raft pool may still hold the closed peer for a moment.
+  ASSERT_EVENTUALLY([&]() {
+    scheduler->SendHeartbeats();
+    ASSERT_EQ(1, scheduler->num_peers());
+  });
+  peers[0]->Close();
+}
+
+// Tests that the proxy batching window grows while the hops are over their
+// latency budget and shrinks to zero once they are well within it.
+TEST(ProxyBatchWindowTest, TestWindowFollowsHopLatency) {
+  const MonoDelta kBudget = MonoDelta::FromMilliseconds(10);
+  const MonoDelta kMaxWindow = MonoDelta::FromMilliseconds(5);
+  const MonoDelta kSlow = MonoDelta::FromMilliseconds(20);
+  const MonoDelta kOnBudget = MonoDelta::FromMilliseconds(8);
+  const MonoDelta kFast = MonoDelta::FromMilliseconds(1);
+
+  MonoDelta window = MonoDelta::FromMicroseconds(0);
+  window = NextProxyBatchWindow(window, kSlow, kBudget, kMaxWindow);
+  ASSERT_EQ(1000, window.ToMicroseconds());
+  window = NextProxyBatchWindow(window, kSlow, kBudget, kMaxWindow);
+  ASSERT_EQ(2000, window.ToMicroseconds());
+  window = NextProxyBatchWindow(window, kSlow, kBudget, kMaxWindow);
+  window = NextProxyBatchWindow(window, kSlow, kBudget, kMaxWindow);
+  ASSERT_EQ(5000, window.ToMicroseconds());
+
+  // Near the budget, the window holds.
+  window = NextProxyBatchWindow(window, kOnBudget, kBudget, kMaxWindow);
+  ASSERT_EQ(5000, window.ToMicroseconds());
+
+  window = NextProxyBatchWindow(window, kFast, kBudget, kMaxWindow);
+  ASSERT_EQ(2500, window.ToMicroseconds());
+  window = NextProxyBatchWindow(window, kFast, kBudget, kMaxWindow);
+  ASSERT_EQ(1250, window.ToMicroseconds());
+  window = NextProxyBatchWindow(window, kFast, kBudget, kMaxWindow);
+  ASSERT_EQ(0, window.ToMicroseconds());
+}
+
+// A proxy which holds on to the BatchUpdateConsensus calls made through it
+// until the test completes them, answering each request with a response
+// naming the request's tablet as the responder.
+class BatchingPeerProxy : public PeerProxy {
+ public:
+  void UpdateAsync(const ConsensusRequestPB* /*request*/,
+                   ConsensusResponsePB* /*response*/,
+                   rpc::RpcController* /*controller*/,
+                   const rpc::ResponseCallback& callback) override {
+    callback();
+  }
+
+  bool SupportsBatchUpdate() const override { return true; }
+
+  void BatchUpdateAsync(const BatchConsensusRequestPB* request,
+                        BatchConsensusResponsePB* response,
+                        rpc::RpcController* /*controller*/,
+                        const rpc::ResponseCallback& callback) override {
+    std::lock_guard<simple_spinlock> l(lock_);
+    batch_sizes_.push_back(request->requests_size());
+    pending_.emplace_back([request, response, callback]() {
+      for (const ConsensusRequestPB& update : request->requests()) {
+        response->add_responses()->set_responder_uuid(update.tablet_id());
+      }
+      callback();
+    });
+  }
+
+  void RequestConsensusVoteAsync(const VoteRequestPB* /*request*/,
+                                 VoteResponsePB* /*response*/,
+                                 rpc::RpcController* /*controller*/,
+                                 const rpc::ResponseCallback& callback) override {
+    callback();
+  }
+
+  Status StartElection(const RunLeaderElectionRequestPB* /*request*/,
+                       RunLeaderElectionResponsePB* /*response*/,
+                       rpc::RpcController* /*controller*/) override {
+    return Status::OK();
+  }
+
+  std::string PeerName() const override { return "batching-proxy"; }
+
+  // Completes the oldest call which is still in flight.
+  void CompleteBatch() {
+    std::function<void()> complete;
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      CHECK(!pending_.empty());
+      complete = std::move(pending_.front());
+      pending_.pop_front();
+    }
+    complete();
+  }
+
+  // The number of requests in each of the calls made so far.
+  vector<int> batch_sizes() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return batch_sizes_;
+  }
+
+ private:
+  mutable simple_spinlock lock_;
+  vector<int> batch_sizes_;
+  std::deque<std::function<void()>> pending_;
+};
+
+// Tests that the requests sent to a server while a batch is in flight to it
+// go out together once it completes, and get their own responses back.
+TEST(UpdateBatcherTest, TestBatchesRequestsWhileCallInFlight) {
+  shared_ptr<Messenger> messenger;
+  ASSERT_OK(MessengerBuilder("test").Build(&messenger));
+  shared_ptr<UpdateBatcher> batcher = UpdateBatcher::Get(messenger, kFollowerUuid);
+  ASSERT_EQ(batcher, UpdateBatcher::Get(messenger, kFollowerUuid));
+  ASSERT_NE(batcher, UpdateBatcher::Get(messenger, "peer-2"));
+
+  auto proxy = make_shared<BatchingPeerProxy>();
+  const int kNumRequests = 4;
+  ConsensusRequestPB requests[kNumRequests];
+  ConsensusResponsePB responses[kNumRequests];
+  rpc::RpcController controllers[kNumRequests];
+  vector<Status> statuses(kNumRequests, Status::Incomplete("no response"));
+  for (int i = 0; i < kNumRequests; i++) {
+    requests[i].set_tablet_id(Substitute("tablet-$0", i));
+    batcher->Send(proxy, &requests[i], &responses[i], &controllers[i],
+                  [&statuses, i](const Status& s) { statuses[i] = s; });
+  }
+
+  // The first request went out on its own, and the others wait for it.
+  ASSERT_EQ(vector<int>({ 1 }), proxy->batch_sizes());
+  ASSERT_EQ(kNumRequests - 1, batcher->num_queued());
+  proxy->CompleteBatch();
+  ASSERT_OK(statuses[0]);
+  ASSERT_EQ("tablet-0", responses[0].responder_uuid());
+
+  ASSERT_EQ(vector<int>({ 1, kNumRequests - 1 }), proxy->batch_sizes());
+  ASSERT_EQ(0, batcher->num_queued());
+  proxy->CompleteBatch();
+  for (int i = 0; i < kNumRequests; i++) {
+    ASSERT_OK(statuses[i]);
+    ASSERT_EQ(Substitute("tablet-$0", i), responses[i].responder_uuid());
+  }
+  messenger->Shutdown();
+}
+
 }  // namespace consensus
 }  // namespace kudu
@@ -25,11 +25,14 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <ostream>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <gflags/gflags.h>
@@ -44,14 +47,20 @@
 #include "kudu/consensus/consensus_queue.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/quorum_util.h"
 #include "kudu/consensus/routing.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/rpc/messenger.h"
 #include "kudu/rpc/periodic.h"
 #include "kudu/rpc/response_callback.h"
 #include "kudu/rpc/rpc_controller.h"
+#include "kudu/rpc/rpc_header.pb.h"
+#include "kudu/rpc/rpc_sidecar.h"
+#include "kudu/rpc/socket_profile.h"
 #ifdef FB_DO_NOT_REMOVE
 #include "kudu/tserver/tserver.pb.h"
 #endif
@@ -63,6 +72,9 @@
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/threadpool.h"
 
@@ -97,12 +109,186 @@ DEFINE_int32(raft_proxy_max_hops, 16,
              "Maximum proxy routing hops allowed. In other words, the proxy routing TTL");
 TAG_FLAG(raft_proxy_max_hops, advanced);
 
+DEFINE_int32(consensus_payload_sidecar_min_bytes, 0,
+             "Write payloads of at least this many bytes are sent to followers "
+             "as RPC sidecars, rather than being copied into the serialized "
+             "UpdateConsensus request. If 0, payloads are always sent inline. "
+             "Must only be enabled once all the servers of a cluster run a "
+             "version which understands payload sidecars.");
+TAG_FLAG(consensus_payload_sidecar_min_bytes, experimental);
+TAG_FLAG(consensus_payload_sidecar_min_bytes, runtime);
+
+DEFINE_int32(consensus_gather_payload_min_bytes, 0,
+             "Write payloads of at least this many bytes which are sent inline "
+             "in UpdateConsensus requests are written to the socket straight "
+             "from the ops they belong to, rather than being copied into the "
+             "serialized request first. The bytes sent are the same, so this "
+             "doesn't need followers to support it. If 0, requests are "
+             "serialized in full.");
+TAG_FLAG(consensus_gather_payload_min_bytes, experimental);
+TAG_FLAG(consensus_gather_payload_min_bytes, runtime);
+
+DEFINE_int32(consensus_max_inflight_requests_per_peer, 1,
+             "The maximum number of UpdateConsensus requests carrying ops which "
+             "the leader keeps in flight to each peer. With more than one, the "
+             "next batch of ops is sent before the response to the previous one "
+             "arrives, so that replication to distant peers isn't limited to one "
+             "batch per round trip.");
+TAG_FLAG(consensus_max_inflight_requests_per_peer, experimental);
+TAG_FLAG(consensus_max_inflight_requests_per_peer, runtime);
+
+DEFINE_int32(raft_fast_leader_transfer_inflight_requests, 4,
+             "The number of UpdateConsensus requests which the leader keeps in "
+             "flight to the successor of a leadership transfer with "
+             "--raft_fast_leader_transfer, if more than "
+             "--consensus_max_inflight_requests_per_peer.");
+TAG_FLAG(raft_fast_leader_transfer_inflight_requests, experimental);
+TAG_FLAG(raft_fast_leader_transfer_inflight_requests, runtime);
+
+DEFINE_int32(raft_learner_catchup_inflight_requests, 4,
+             "The number of UpdateConsensus requests which the leader keeps in "
+             "flight to a learner catching up under --raft_learner_fast_catchup, "
+             "if more than --consensus_max_inflight_requests_per_peer.");
+TAG_FLAG(raft_learner_catchup_inflight_requests, experimental);
+TAG_FLAG(raft_learner_catchup_inflight_requests, runtime);
+
+DEFINE_bool(raft_socket_profiles_by_region, false,
+            "Whether the connections to and from each peer are tuned for the link "
+            "to its region, with the socket options of the in-region or the "
+            "cross-region profile of the RPC layer, according to whether the "
+            "peer is in this server's region. Applies to connections made after "
+            "the peer's proxy is created.");
+TAG_FLAG(raft_socket_profiles_by_region, experimental);
+TAG_FLAG(raft_socket_profiles_by_region, runtime);
+
+DEFINE_bool(raft_witness_metadata_only_log, false,
+            "Whether the leader sends witnesses, i.e. voters which aren't "
+            "backed by a database, only the metadata of each write op: its "
+            "OpId, timestamp and payload checksum, without the payload, which "
+            "they then store in their log in place of the op. Witnesses still "
+            "count towards durability, but don't proxy for other peers or run "
+            "for leader, as they can't serve the payloads. Must be set on all "
+            "the replicas of a tablet.");
+TAG_FLAG(raft_witness_metadata_only_log, experimental);
+TAG_FLAG(raft_witness_metadata_only_log, runtime);
+
+DEFINE_bool(consensus_serialize_ops_once, false,
+            "Whether to send the ops of UpdateConsensus requests as a sidecar "
+            "which is serialized once per batch and shared by all the peers the "
+            "batch is sent to, rather than serializing the ops into the request "
+            "to each peer. Should only be enabled once all the servers understand "
+            "ops sidecars.");
+TAG_FLAG(consensus_serialize_ops_once, experimental);
+TAG_FLAG(consensus_serialize_ops_once, runtime);
+
+DEFINE_bool(consensus_pack_ops, false,
+            "Whether to send the ops of UpdateConsensus requests in a fixed "
+            "binary layout, which is cheaper to encode and decode than "
+            "protobufs, to the peers which support it. Like with "
+            "--consensus_serialize_ops_once, a batch is encoded once for all "
+            "the peers it is sent to. Peers which don't support it are sent "
+            "protobufs.");
+TAG_FLAG(consensus_pack_ops, experimental);
+TAG_FLAG(consensus_pack_ops, runtime);
+
+DEFINE_bool(consensus_pack_ops_delta, false,
+            "With --consensus_pack_ops, whether to encode the ids, timestamps "
+            "and sizes of packed write ops as group varints relative to the "
+            "previous op, to the peers which support it. This shrinks their "
+            "headers from 56 bytes to around a dozen.");
+TAG_FLAG(consensus_pack_ops_delta, experimental);
+TAG_FLAG(consensus_pack_ops_delta, runtime);
+
 DECLARE_int32(raft_heartbeat_interval_ms);
 
+DEFINE_bool(raft_suppress_redundant_heartbeats, false,
+            "Whether the leader skips a heartbeat to a peer which accepted a "
+            "request sent within the last heartbeat interval and has been sent "
+            "the current committed index. The skipped heartbeat's safe time "
+            "goes out with the next request instead.");
+TAG_FLAG(raft_suppress_redundant_heartbeats, experimental);
+TAG_FLAG(raft_suppress_redundant_heartbeats, runtime);
+
+DEFINE_bool(raft_coalesce_heartbeats, false,
+            "Whether the heartbeats to the peers are sent from one timer for "
+            "each messenger, which wakes up once a heartbeat interval and "
+            "sends all of them together, grouped by destination host, rather "
+            "than from a jittered timer for each peer. Applies to the peers "
+            "created after it is set.");
+TAG_FLAG(raft_coalesce_heartbeats, experimental);
+TAG_FLAG(raft_coalesce_heartbeats, runtime);
+
 DEFINE_int32(proxy_batch_duration_ms, 0,
              "Time (in ms) to wait before reading ops for proxy requests");
 
+DEFINE_bool(raft_proxy_adaptive_batching, false,
+            "Whether the leader adapts the time it waits between requests to a "
+            "proxied peer to the latency of those requests, rather than "
+            "waiting --proxy_batch_duration_ms. The window grows while the "
+            "requests take longer than --raft_proxy_hop_latency_budget_ms per "
+            "hop and shrinks to zero once they are well within it.");
+TAG_FLAG(raft_proxy_adaptive_batching, experimental);
+TAG_FLAG(raft_proxy_adaptive_batching, runtime);
+
+DEFINE_int32(raft_proxy_hop_latency_budget_ms, 10,
+             "The latency per hop which --raft_proxy_adaptive_batching aims "
+             "to keep the requests to proxied peers within.");
+TAG_FLAG(raft_proxy_hop_latency_budget_ms, experimental);
+TAG_FLAG(raft_proxy_hop_latency_budget_ms, runtime);
+
+DEFINE_int32(raft_proxy_max_batch_window_ms, 100,
+             "The longest time --raft_proxy_adaptive_batching waits between "
+             "requests to a proxied peer.");
+TAG_FLAG(raft_proxy_max_batch_window_ms, experimental);
+TAG_FLAG(raft_proxy_max_batch_window_ms, runtime);
+
+DEFINE_int32(raft_bulk_connections_per_peer, 0,
+             "If positive, the UpdateConsensus requests which carry ops are "
+             "spread across this many connections to each peer, apart from the "
+             "one which heartbeats, votes and the other RPCs go over, so that "
+             "they don't wait behind big catch-up batches and the bulk traffic "
+             "isn't limited to one TCP stream. Applies to the peers connected "
+             "to after it is set.");
+TAG_FLAG(raft_bulk_connections_per_peer, experimental);
+
+DEFINE_bool(raft_batch_update_consensus, false,
+            "Whether the UpdateConsensus requests to a server which carry no "
+            "ops, or few enough with --raft_batch_update_max_ops_bytes, are "
+            "sent together with those of the other tablets' peers on the "
+            "server, in BatchUpdateConsensus calls, at most one at a time to "
+            "each server. Cuts down the calls with many tablets per server. "
+            "Applies to the peers created after it is set.");
+TAG_FLAG(raft_batch_update_consensus, experimental);
+TAG_FLAG(raft_batch_update_consensus, runtime);
+
+DEFINE_int32(raft_batch_update_max_ops_bytes, 0,
+             "With --raft_batch_update_consensus, the most bytes of ops which "
+             "a request may carry to be batched. The follower handles the "
+             "requests of a batch one after another, so 0 only batches the "
+             "requests without ops.");
+TAG_FLAG(raft_batch_update_max_ops_bytes, experimental);
+TAG_FLAG(raft_batch_update_max_ops_bytes, runtime);
+
+DEFINE_bool(raft_proxy_trace_requests, false,
+            "Whether the leader tags the requests it sends through proxies "
+            "with a request id, its send time and a hop count, which the "
+            "proxies pass on and the destination echoes. Each proxy reports "
+            "how long it took to forward the request in the response, and "
+            "records it in the histogram for its position on the route.");
+TAG_FLAG(raft_proxy_trace_requests, experimental);
+TAG_FLAG(raft_proxy_trace_requests, runtime);
+
+DEFINE_int32(raft_proxy_trace_slow_request_ms, 0,
+             "With --raft_proxy_trace_requests, the leader logs the hops of "
+             "traced requests which take longer than this to be responded "
+             "to, and proxies log the ones which they take longer than this "
+             "to forward, not counting the time waiting for their next hop. "
+             "0 disables the logging.");
+TAG_FLAG(raft_proxy_trace_slow_request_ms, experimental);
+TAG_FLAG(raft_proxy_trace_slow_request_ms, runtime);
+
 DECLARE_bool(raft_enforce_rpc_token);
+DECLARE_bool(raft_fast_leader_transfer);
 
 METRIC_DEFINE_counter(server, raft_rpc_token_num_response_mismatches,
                            "Reponse RPC token mismatches",
@@ -114,17 +300,88 @@ using kudu::pb_util::SecureShortDebugString;
 using kudu::rpc::Messenger;
 using kudu::rpc::PeriodicTimer;
 using kudu::rpc::RpcController;
+using kudu::rpc::RpcSidecar;
 //using kudu::tserver::TabletServerErrorPB;
 using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 using std::weak_ptr;
 using strings::Substitute;
+using strings::SubstituteAndAppend;
 
 
 namespace kudu {
 namespace consensus {
 
+namespace {
+
+// Picks the ids of the requests traced with --raft_proxy_trace_requests.
+ThreadSafeRandom* TraceRequestIdRandom() {
+  static ThreadSafeRandom* rng = new ThreadSafeRandom(GetRandomSeed32());
+  return rng;
+}
+
+// Sends the write payload of a replicate message straight from the message,
+// which it keeps alive until the RPC carrying it completes.
+class WritePayloadSidecar : public RpcSidecar {
+ public:
+  explicit WritePayloadSidecar(ReplicateRefPtr msg)
+      : msg_(std::move(msg)) {
+  }
+
+  Slice AsSlice() const override {
+    return Slice(msg_->get()->write_payload().payload());
+  }
+
+ private:
+  const ReplicateRefPtr msg_;
+};
+
+// Sends a buffer of serialized ops, which may be shared with the RPCs to other
+// peers.
+class SharedOpsSidecar : public RpcSidecar {
+ public:
+  explicit SharedOpsSidecar(std::shared_ptr<const string> buf)
+      : buf_(std::move(buf)) {
+  }
+
+  Slice AsSlice() const override {
+    return Slice(*buf_);
+  }
+
+ private:
+  const std::shared_ptr<const string> buf_;
+};
+
+// Returns a copy of the write op 'op' with everything but its payload.
+ReplicateRefPtr CopyOpWithoutPayload(const ReplicateMsg& op) {
+  ReplicateRefPtr copy = make_scoped_refptr_replicate(new ReplicateMsg);
+  ReplicateMsg* copy_op = copy->get();
+  *copy_op->mutable_id() = op.id();
+  copy_op->set_timestamp(op.timestamp());
+  copy_op->set_op_type(op.op_type());
+  if (op.has_request_id()) {
+    *copy_op->mutable_request_id() = op.request_id();
+  }
+  if (op.has_dependency_key()) {
+    copy_op->set_dependency_key(op.dependency_key());
+  }
+  const WritePayloadPB& payload = op.write_payload();
+  WritePayloadPB* copy_payload = copy_op->mutable_write_payload();
+  copy_payload->set_compression_codec(payload.compression_codec());
+  if (payload.has_uncompressed_size()) {
+    copy_payload->set_uncompressed_size(payload.uncompressed_size());
+  }
+  if (payload.has_compression_dictionary_id()) {
+    copy_payload->set_compression_dictionary_id(payload.compression_dictionary_id());
+  }
+  copy_payload->set_crc32(payload.crc32());
+  return copy;
+}
+
+} // anonymous namespace
+
 Status Peer::NewRemotePeer(RaftPeerPB peer_pb,
                            string tablet_id,
                            string leader_uuid,
@@ -133,6 +390,7 @@ Status Peer::NewRemotePeer(RaftPeerPB peer_pb,
                            ThreadPoolToken* raft_pool_token,
                            shared_ptr<PeerProxy> proxy,
                            shared_ptr<Messenger> messenger,
+                           scoped_refptr<Histogram> request_dispatch_latency,
                            shared_ptr<Peer>* peer) {
 
   shared_ptr<Peer> new_peer(new Peer(std::move(peer_pb),
@@ -142,7 +400,8 @@ Status Peer::NewRemotePeer(RaftPeerPB peer_pb,
                                      peer_proxy_pool,
                                      raft_pool_token,
                                      std::move(proxy),
-                                     std::move(messenger)));
+                                     std::move(messenger),
+                                     std::move(request_dispatch_latency)));
   RETURN_NOT_OK(new_peer->Init());
   *peer = std::move(new_peer);
   return Status::OK();
@@ -155,7 +414,8 @@ Peer::Peer(RaftPeerPB peer_pb,
            PeerProxyPool* peer_proxy_pool,
            ThreadPoolToken* raft_pool_token,
            shared_ptr<PeerProxy> proxy,
-           shared_ptr<Messenger> messenger)
+           shared_ptr<Messenger> messenger,
+           scoped_refptr<Histogram> request_dispatch_latency)
     : tablet_id_(std::move(tablet_id)),
       leader_uuid_(std::move(leader_uuid)),
       peer_pb_(std::move(peer_pb)),
@@ -164,9 +424,30 @@ Peer::Peer(RaftPeerPB peer_pb,
       peer_proxy_pool_(peer_proxy_pool),
       failed_attempts_(0),
       last_request_time_(MonoTime::Now()),
+      request_dispatch_latency_(std::move(request_dispatch_latency)),
       messenger_(std::move(messenger)),
       raft_pool_token_(raft_pool_token) {
-  request_pending_ = false;
+  num_in_flight_ = 0;
+}
+
+Peer::UpdateRpc::~UpdateRpc() {
+  ReleaseOps();
+}
+
+void Peer::UpdateRpc::ReleaseOps() {
+  // We don't own the ops (the queue does).
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+  if (replicate_msg_refs.use_count() == 1) {
+    replicate_msg_refs->clear();
+  } else {
+    // A call still holds on to the list: leave it to the call.
+    replicate_msg_refs = std::make_shared<vector<ReplicateRefPtr>>();
+  }
 }
 
 Status Peer::Init() {
@@ -175,6 +456,16 @@ Status Peer::Init() {
     queue_->TrackPeer(peer_pb_);
   }
 
+  if (FLAGS_raft_batch_update_consensus) {
+    update_batcher_ = UpdateBatcher::Get(messenger_, peer_pb_.permanent_uuid());
+  }
+
+  if (FLAGS_raft_coalesce_heartbeats) {
+    heartbeat_scheduler_ = HeartbeatScheduler::Get(messenger_);
+    heartbeat_scheduler_->Register(shared_from_this());
+    return Status::OK();
+  }
+
   // Capture a weak_ptr reference into the functor so it can safely handle
   // outliving the peer.
   weak_ptr<Peer> w = shared_from_this();
@@ -191,14 +482,14 @@ Status Peer::Init() {
 }
 
 Status Peer::SignalRequest(bool even_if_queue_empty, bool from_heartbeater) {
-  // Only allow one request at a time. No sense waking up the
-  // raft thread pool if the task will just abort anyway.
+  // Only allow as many requests at a time as the pipeline holds. No sense
+  // waking up the raft thread pool if the task will just abort anyway.
   //
-  // "request_pending_" is an atomic, hence no need to take peer_lock_ here.
+  // "num_in_flight_" is an atomic, hence no need to take peer_lock_ here.
   // This allows to return early without blocking on "peer_lock_". Note that
   // "peer_lock_" is also held during Peer::SendNextRequest(...) which could
   // take some time for a lagging peer as it involves multiple disk IO
-  if (request_pending_) {
+  if (num_in_flight_ >= MaxInFlightRequests()) {
     return Status::OK();
   }
 
@@ -214,25 +505,68 @@ Status Peer::SignalRequest(bool even_if_queue_empty, bool from_heartbeater) {
     return Status::OK();
   }
 
+  if (from_heartbeater && FLAGS_raft_suppress_redundant_heartbeats &&
+      HeartbeatIsRedundantUnlocked()) {
+    return Status::OK();
+  }
+
+  // The scheduler's heartbeats aren't snoozed by requests carrying ops, so
+  // skip them here instead. Half an interval keeps the longest gap between
+  // two requests at one and a half intervals.
+  if (from_heartbeater && heartbeat_scheduler_ && last_ops_send_time_.Initialized() &&
+      MonoTime::Now() - last_ops_send_time_ <
+          MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms / 2)) {
+    return Status::OK();
+  }
+
+  // If a send is already queued, fold this signal into it: it hasn't read
+  // from the queue yet, so it will pick up whatever this signal is about, and
+  // a heartbeat doesn't have to wait behind it.
+  if (send_queued_) {
+    queued_even_if_queue_empty_ |= even_if_queue_empty;
+    queued_from_heartbeater_ |= from_heartbeater;
+    return Status::OK();
+  }
+
   // Capture a weak_ptr reference into the submitted functor so that we can
   // safely handle the functor outliving its peer.
   weak_ptr<Peer> w_this = shared_from_this();
-  RETURN_NOT_OK(raft_pool_token_->SubmitFunc(
-        [even_if_queue_empty, from_heartbeater, w_this]() {
+  RETURN_NOT_OK(raft_pool_token_->SubmitFunc([w_this]() {
     if (auto p = w_this.lock()) {
-      p->SendNextRequest(even_if_queue_empty, from_heartbeater);
+      p->RunQueuedSend();
     }
   }));
+  send_queued_ = true;
+  queued_even_if_queue_empty_ = even_if_queue_empty;
+  queued_from_heartbeater_ = from_heartbeater;
+  queued_signal_time_ = MonoTime::Now();
   return Status::OK();
 }
 
+void Peer::RunQueuedSend() {
+  bool even_if_queue_empty;
+  bool from_heartbeater;
+  MonoTime signaled_time;
+  {
+    std::lock_guard<simple_spinlock> l(peer_lock_);
+    DCHECK(send_queued_);
+    send_queued_ = false;
+    even_if_queue_empty = queued_even_if_queue_empty_;
+    from_heartbeater = queued_from_heartbeater_;
+    signaled_time = queued_signal_time_;
+  }
+  SendNextRequest(even_if_queue_empty, from_heartbeater, signaled_time);
+}
+
 bool Peer::ProxyBatchDurationHasPassed() {
-  if (FLAGS_proxy_batch_duration_ms == 0) {
+  const MonoDelta batch_duration = FLAGS_raft_proxy_adaptive_batching ?
+      proxy_batch_window_ : MonoDelta::FromMilliseconds(FLAGS_proxy_batch_duration_ms);
+  if (batch_duration.ToMicroseconds() == 0) {
     return true;
   }
 
   const bool has_duration_passed = MonoTime::Now() - last_request_time_ >=
-    MonoDelta::FromMilliseconds(FLAGS_proxy_batch_duration_ms);
+    batch_duration;
 
   // We update cached proxied status when batch duration has passed (or it's not
   // populated yet), this means we could be looking at stale info for
@@ -249,15 +583,54 @@ bool Peer::ProxyBatchDurationHasPassed() {
   return cached_is_peer_proxied_ != 1 || has_duration_passed;
 }
 
-void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
+bool Peer::HeartbeatIsRedundantUnlocked() const {
+  DCHECK(peer_lock_.is_locked());
+  // A request skipped now waits for the next heartbeat, so the peer goes at
+  // most two heartbeat intervals plus a round trip without hearing from the
+  // leader: inside the --leader_failure_max_missed_heartbeat_periods it
+  // tolerates.
+  // A peer which is still catching up needs its heartbeats to keep being
+  // sent ops.
+  return failed_attempts_ == 0 &&
+      last_exchange_reached_log_end_ &&
+      last_exchange_time_.Initialized() &&
+      MonoTime::Now() - last_exchange_time_ <
+          MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms) &&
+      last_sent_committed_index_ >= queue_->GetCommittedIndex();
+}
+
+int Peer::MaxInFlightRequests() const {
+  int max_in_flight = std::max(1, FLAGS_consensus_max_inflight_requests_per_peer);
+  if (FLAGS_raft_fast_leader_transfer &&
+      queue_->IsFastTransferTarget(peer_pb_.permanent_uuid())) {
+    max_in_flight = std::max(max_in_flight,
+                             FLAGS_raft_fast_leader_transfer_inflight_requests);
+  } else if (queue_->IsLearnerCatchingUp(peer_pb_.permanent_uuid())) {
+    max_in_flight = std::max(max_in_flight,
+                             FLAGS_raft_learner_catchup_inflight_requests);
+  }
+  return max_in_flight;
+}
+
+void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater,
+                           MonoTime signaled_time) {
   std::unique_lock<simple_spinlock> l(peer_lock_);
 
   if (PREDICT_FALSE(closed_)) {
     return;
   }
 
-  // Only allow one request at a time.
-  if (request_pending_) {
+  // Only allow as many requests at a time as the pipeline holds.
+  if (static_cast<int>(in_flight_.size()) >= MaxInFlightRequests()) {
+    return;
+  }
+
+  // Only batches of ops are pipelined behind the requests in flight, and only
+  // once we know where the peer's log is at: heartbeats, retries after errors
+  // and the requests which resynchronize with the peer's log wait for the
+  // responses to the requests in flight instead.
+  const bool pipelined = !in_flight_.empty();
+  if (pipelined && (failed_attempts_ > 0 || pipeline_next_index_ == kInvalidOpIdIndex)) {
     return;
   }
 
@@ -287,7 +660,7 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
     return;
   }
 
-  // The peer has no pending request nor is sending: send the request.
+  // The peer has room in its pipeline: send the request.
   bool needs_tablet_copy = false;
 
   // If this peer is not healthy (as indicated by failed_attempts_), then
@@ -298,20 +671,33 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
   // reachable.
   bool read_ops = (failed_attempts_ <= 0);
 
-  request_pending_ = true;
+  unique_ptr<UpdateRpc> rpc;
+  if (free_rpcs_.empty()) {
+    rpc.reset(new UpdateRpc);
+  } else {
+    rpc = std::move(free_rpcs_.back());
+    free_rpcs_.pop_back();
+  }
+  UpdateRpc* const rpc_ptr = rpc.get();
+  // Returns the request to the free list unless it was sent.
+  auto release_rpc = [&]() {
+    if (rpc) {
+      free_rpcs_.emplace_back(std::move(rpc));
+    }
+  };
+  num_in_flight_++;
 
   last_request_time_ = MonoTime::Now();
 
   // The next hop to route to to ship messages to this peer. This could be
   // different than the peer_uuid when proxy is enabled
   string next_hop_uuid;
-  int64_t commit_index_before = request_.has_committed_index() ?
-      request_.committed_index() : kMinimumOpIdIndex;
-  Status s = queue_->RequestForPeer(peer_pb_.permanent_uuid(), read_ops, &request_,
-                                    &replicate_msg_refs_, &needs_tablet_copy,
-                                    &next_hop_uuid);
-  int64_t commit_index_after = request_.has_committed_index() ?
-      request_.committed_index() : kMinimumOpIdIndex;
+  Status s = queue_->RequestForPeer(peer_pb_.permanent_uuid(), read_ops, &rpc->request,
+                                    rpc->replicate_msg_refs.get(), &needs_tablet_copy,
+                                    &next_hop_uuid,
+                                    pipelined ? pipeline_next_index_ : kInvalidOpIdIndex);
+  int64_t commit_index_after = rpc->request.has_committed_index() ?
+      rpc->request.committed_index() : kMinimumOpIdIndex;
 
   if (PREDICT_FALSE(!s.ok())) {
     // Incrementing failed_attempts_ prevents a RequestForPeer error to continually
@@ -324,7 +710,8 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
     // it. Otherwise node keeps asking for votes, destabilizing cluster.
     failed_attempts_++;
     VLOG_WITH_PREFIX_UNLOCKED(1) << s.ToString();
-    request_pending_ = false;
+    num_in_flight_--;
+    release_rpc();
     return;
   }
 
@@ -351,42 +738,104 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
   }
 #endif
 
-  request_.set_tablet_id(tablet_id_);
-  request_.set_caller_uuid(leader_uuid_);
-  request_.set_dest_uuid(peer_pb_.permanent_uuid());
+  ConsensusRequestPB& request = rpc->request;
+  request.set_tablet_id(tablet_id_);
+  request.set_caller_uuid(leader_uuid_);
+  request.set_dest_uuid(peer_pb_.permanent_uuid());
 
-  bool req_has_ops = request_.ops_size() > 0 || (commit_index_after > commit_index_before);
+  bool req_has_ops = request.ops_size() > 0 ||
+      (commit_index_after > last_sent_committed_index_);
   // If the queue is empty, check if we were told to send a status-only
-  // message, if not just return.
-  if (PREDICT_FALSE(!req_has_ops && !even_if_queue_empty)) {
-    request_pending_ = false;
+  // message, if not just return. A pipelined request is only worth sending
+  // if it carries new ops.
+  if (PREDICT_FALSE((!req_has_ops && !even_if_queue_empty) ||
+                    (pipelined && request.ops_size() == 0))) {
+    num_in_flight_--;
+    release_rpc();
     return;
   }
+  last_sent_committed_index_ = commit_index_after;
 
   if (req_has_ops) {
     // If we're actually sending ops there's no need to heartbeat for a while.
-    heartbeater_->Snooze();
+    if (heartbeater_) {
+      heartbeater_->Snooze();
+    } else {
+      last_ops_send_time_ = MonoTime::Now();
+    }
+  }
+
+  // Requests which carry ops advance the position that the next pipelined
+  // request starts from. A status-only request sent with nothing else in
+  // flight leaves it unknown until the response comes back.
+  if (request.ops_size() > 0) {
+    pipeline_next_index_ = request.ops(request.ops_size() - 1).id().index() + 1;
+  } else if (!pipelined) {
+    pipeline_next_index_ = kInvalidOpIdIndex;
   }
 
   MAYBE_FAULT(FLAGS_fault_crash_on_leader_request_fraction);
 
 
   VLOG_WITH_PREFIX_UNLOCKED(2) << "Sending to peer " << peer_pb().permanent_uuid() << ": "
-      << SecureShortDebugString(request_);
-  controller_.Reset();
-
-  l.unlock();
-  // Capture a shared_ptr reference into the RPC callback so that we're guaranteed
-  // that this object outlives the RPC.
-  shared_ptr<Peer> s_this = shared_from_this();
+      << SecureShortDebugString(request);
+  rpc->controller.Reset();
+  rpc->responded = false;
+  rpc->send_time = last_request_time_;
+  rpc->reached_log_end =
+      (request.ops_size() > 0 ? request.ops(request.ops_size() - 1).id().index()
+                              : request.preceding_id().index()) >=
+      request.last_idx_appended_to_leader();
+  // The ops of a proxied request are stubs which the proxy fills in from its
+  // own log.
+  if (FLAGS_raft_witness_metadata_only_log && IsWitness(peer_pb_) &&
+      next_hop_uuid == peer_pb_.permanent_uuid()) {
+    StripPayloadsForWitnessUnlocked(rpc_ptr);
+  }
+  rpc->batched = CanBatchUnlocked(request, pipelined, next_hop_uuid);
+  if (rpc->batched) {
+    // The sidecars of the batch's call aren't the request's own, so its ops
+    // go inline.
+    request.clear_ops_sidecar_idx();
+    request.clear_packed_ops_sidecar_idx();
+    rpc->batch_status = Status::OK();
+  } else if (!MoveOpsToSharedSidecarUnlocked(rpc_ptr)) {
+    MovePayloadsToSidecarsUnlocked(rpc_ptr);
+    const int32_t gather_min_bytes = FLAGS_consensus_gather_payload_min_bytes;
+    if (gather_min_bytes > 0 && request.ops_size() > 0) {
+      // The ops may still be being sent after the RPC times out and
+      // 'replicate_msg_refs' moves on, so the call shares the list.
+      rpc->controller.SetRequestGather(gather_min_bytes, rpc->replicate_msg_refs);
+    }
+  }
 
-  // TODO: Refactor this code. Ideally all fields in 'request_' related to
+  // TODO: Refactor this code. Ideally all fields in 'request' related to
   // proxying should be set inside PeerMessageQueue::RequestForPeer(). Move the
   // setting of 'proxy_hops_remaining' to PeerMessageQueue::RequestForPeer()
   if (next_hop_uuid != peer_pb().permanent_uuid()) {
     // If this is a proxy request, set the hops remaining value.
-    request_.set_proxy_hops_remaining(FLAGS_raft_proxy_max_hops);
+    request.set_proxy_hops_remaining(FLAGS_raft_proxy_max_hops);
+  } else {
+    request.clear_proxy_hops_remaining();
+  }
+  if (FLAGS_raft_proxy_trace_requests && request.has_proxy_hops_remaining()) {
+    ProxyTraceContextPB* trace = request.mutable_trace_context();
+    trace->set_request_id(TraceRequestIdRandom()->Next64());
+    trace->set_origin_timestamp_us(GetCurrentTimeMicros());
+    trace->set_hop_count(0);
+  } else {
+    request.clear_trace_context();
   }
+  in_flight_.emplace_back(std::move(rpc));
+
+  l.unlock();
+  if (request_dispatch_latency_ && signaled_time.Initialized()) {
+    request_dispatch_latency_->Increment(
+        (MonoTime::Now() - signaled_time).ToMicroseconds());
+  }
+  // Capture a shared_ptr reference into the RPC callback so that we're guaranteed
+  // that this object outlives the RPC.
+  shared_ptr<Peer> s_this = shared_from_this();
 
   shared_ptr<PeerProxy> next_hop_proxy = peer_proxy_pool_->Get(next_hop_uuid);
   if (!next_hop_proxy) {
@@ -394,12 +843,128 @@ void Peer::SendNextRequest(bool even_if_queue_empty, bool from_heartbeater) {
                                     << " not found in peer proxy pool";
   }
 
-  next_hop_proxy->UpdateAsync(&request_, &response_, &controller_,
-                              [s_this]() {
-                                s_this->ProcessResponse();
+  if (rpc_ptr->batched) {
+    update_batcher_->Send(std::move(next_hop_proxy), &rpc_ptr->request, &rpc_ptr->response,
+                          &rpc_ptr->controller,
+                          [s_this, rpc_ptr](const Status& s) {
+                            rpc_ptr->batch_status = s;
+                            s_this->ProcessResponse(rpc_ptr);
+                          });
+    return;
+  }
+  next_hop_proxy->UpdateAsync(&rpc_ptr->request, &rpc_ptr->response, &rpc_ptr->controller,
+                              [s_this, rpc_ptr]() {
+                                s_this->ProcessResponse(rpc_ptr);
                               });
 }
 
+bool Peer::CanBatchUnlocked(const ConsensusRequestPB& request, bool pipelined,
+                            const string& next_hop_uuid) const {
+  if (!update_batcher_ || !FLAGS_raft_batch_update_consensus || pipelined ||
+      next_hop_uuid != peer_pb_.permanent_uuid() || !proxy_->SupportsBatchUpdate()) {
+    return false;
+  }
+  if (request.ops_size() == 0) {
+    return true;
+  }
+  const int64_t max_bytes = FLAGS_raft_batch_update_max_ops_bytes;
+  int64_t bytes = 0;
+  for (const ReplicateMsg& op : request.ops()) {
+    bytes += op.ByteSizeLong();
+    if (bytes > max_bytes) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Peer::MoveOpsToSharedSidecarUnlocked(UpdateRpc* rpc) {
+  ConsensusRequestPB& request = rpc->request;
+  request.clear_ops_sidecar_idx();
+  request.clear_packed_ops_sidecar_idx();
+  const bool packed = FLAGS_consensus_pack_ops && !packed_ops_unsupported_;
+  const bool delta = packed && FLAGS_consensus_pack_ops_delta && !packed_ops_v2_unsupported_;
+  // The ops of a proxied request are stubs built for that request alone.
+  if ((!FLAGS_consensus_serialize_ops_once && !packed) || request.ops_size() == 0 ||
+      request.has_proxy_dest_uuid()) {
+    return false;
+  }
+  DCHECK_EQ(request.ops_size(), rpc->replicate_msg_refs->size());
+  // The ops stay referenced by 'replicate_msg_refs' until the RPC completes.
+  return MoveOpsToSharedSidecar(queue_, *rpc->replicate_msg_refs, &rpc->controller, &request,
+                                packed, delta);
+}
+
+ConsensusFeatureFlags Peer::RejectedPackedOps(const UpdateRpc& rpc) {
+  if (!rpc.request.has_packed_ops_sidecar_idx()) {
+    return UNKNOWN_CONSENSUS_FEATURE;
+  }
+  const rpc::ErrorStatusPB* err = rpc.controller.error_response();
+  if (!err) {
+    return UNKNOWN_CONSENSUS_FEATURE;
+  }
+  for (uint32_t feature : err->unsupported_feature_flags()) {
+    if (feature == PACKED_OPS || feature == PACKED_OPS_V2) {
+      return static_cast<ConsensusFeatureFlags>(feature);
+    }
+  }
+  return UNKNOWN_CONSENSUS_FEATURE;
+}
+
+void Peer::MovePayloadsToSidecarsUnlocked(UpdateRpc* rpc) {
+  const int32_t min_bytes = FLAGS_consensus_payload_sidecar_min_bytes;
+  ConsensusRequestPB& request = rpc->request;
+  vector<ReplicateRefPtr>& replicate_msg_refs = *rpc->replicate_msg_refs;
+  if (min_bytes <= 0 || request.ops_size() == 0) {
+    return;
+  }
+  DCHECK_EQ(request.ops_size(), replicate_msg_refs.size());
+
+  auto ops = request.mutable_ops()->pointer_begin();
+  for (int i = 0; i < request.ops_size(); i++) {
+    const ReplicateMsg* op = replicate_msg_refs[i]->get();
+    DCHECK_EQ(op, ops[i]);
+    if (!op->has_write_payload() || op->write_payload().payload().size() < min_bytes) {
+      continue;
+    }
+    int idx;
+    if (!rpc->controller.AddOutboundSidecar(
+            std::unique_ptr<RpcSidecar>(new WritePayloadSidecar(replicate_msg_refs[i])),
+            &idx).ok()) {
+      // Out of sidecars: the remaining payloads go inline.
+      break;
+    }
+
+    // The message may be shared with the requests to other peers through the
+    // log cache, so send a copy of it without the payload in its place.
+    ReplicateRefPtr stripped = CopyOpWithoutPayload(*op);
+    stripped->get()->mutable_write_payload()->set_payload_sidecar_idx(idx);
+
+    ops[i] = stripped->get();
+    replicate_msg_refs[i] = std::move(stripped);
+  }
+}
+
+void Peer::StripPayloadsForWitnessUnlocked(UpdateRpc* rpc) {
+  ConsensusRequestPB& request = rpc->request;
+  vector<ReplicateRefPtr>& replicate_msg_refs = *rpc->replicate_msg_refs;
+  DCHECK_EQ(request.ops_size(), replicate_msg_refs.size());
+
+  auto ops = request.mutable_ops()->pointer_begin();
+  for (int i = 0; i < request.ops_size(); i++) {
+    const ReplicateMsg* op = replicate_msg_refs[i]->get();
+    DCHECK_EQ(op, ops[i]);
+    if (op->op_type() != WRITE_OP_EXT || !op->has_write_payload()) {
+      continue;
+    }
+    ReplicateRefPtr stripped = CopyOpWithoutPayload(*op);
+    stripped->get()->mutable_write_payload()->set_payload_stripped(true);
+
+    ops[i] = stripped->get();
+    replicate_msg_refs[i] = std::move(stripped);
+  }
+}
+
 Status Peer::StartElection(RunLeaderElectionRequestPB req) {
   RunLeaderElectionResponsePB resp;
   RpcController controller;
@@ -408,51 +973,151 @@ Status Peer::StartElection(RunLeaderElectionRequestPB req) {
   RETURN_NOT_OK(proxy_->StartElection(&req, &resp, &controller));
   RETURN_NOT_OK(controller.status());
   if (resp.has_error()) {
-    return StatusFromPB(response_.error().status());
+    return StatusFromPB(resp.error().status());
   }
   return Status::OK();
 }
 
-void Peer::ProcessResponse() {
+void Peer::ProcessResponse(UpdateRpc* rpc) {
   // Note: This method runs on the reactor thread.
+  {
+    std::lock_guard<simple_spinlock> lock(peer_lock_);
+    if (closed_) {
+      return;
+    }
+    MAYBE_FAULT(FLAGS_fault_crash_after_leader_request_fraction);
+    rpc->responded = true;
+    // Responses are handled in the order the requests were sent, so one which
+    // arrives behind an earlier request still in flight is picked up once
+    // that one's response arrives. One which arrives while a task is queued
+    // or running is picked up by it, since it checks for more responses
+    // under the lock before it's done.
+    if (responses_queued_ || processing_responses_ ||
+        in_flight_.empty() || !in_flight_.front()->responded) {
+      return;
+    }
+    responses_queued_ = true;
+  }
+
+  // The queue's handling of the peer response may generate IO (reads against
+  // the WAL) and SendNextRequest() may do the same thing. So we run the
+  // response handling logic on our thread pool and not on the reactor thread.
+  //
+  // Capture a weak_ptr reference into the submitted functor so that we can
+  // safely handle the functor outliving its peer.
+  weak_ptr<Peer> w_this = shared_from_this();
+  Status s = raft_pool_token_->SubmitFunc([w_this]() {
+    if (auto p = w_this.lock()) {
+      p->DoProcessResponses();
+    }
+  });
+  if (PREDICT_FALSE(!s.ok())) {
+    {
+      std::lock_guard<simple_spinlock> lock(peer_lock_);
+      responses_queued_ = false;
+    }
+    LOG_WITH_PREFIX_UNLOCKED(WARNING) << "Unable to process peer response: " << s.ToString()
+        << ": " << SecureShortDebugString(rpc->response);
+  }
+}
+
+void Peer::DoProcessResponses() {
   std::unique_lock<simple_spinlock> lock(peer_lock_);
-  if (closed_) {
+  responses_queued_ = false;
+  // Responses are handled one at a time, in the order the requests were sent,
+  // so that the queue sees the peer's log advance in order. A response which
+  // arrives ahead of an earlier one waits for it.
+  if (processing_responses_) {
     return;
   }
-  CHECK(request_pending_);
+  processing_responses_ = true;
+  while (!closed_ && !in_flight_.empty() && in_flight_.front()->responded) {
+    unique_ptr<UpdateRpc> rpc = std::move(in_flight_.front());
+    in_flight_.pop_front();
+    lock.unlock();
+
+    bool send_more_immediately = HandleResponse(*rpc);
+    rpc->ReleaseOps();
+
+    lock.lock();
+    free_rpcs_.emplace_back(std::move(rpc));
+    num_in_flight_--;
+    if (send_more_immediately) {
+      // We're OK to read the state_ without a lock here -- if we get a race,
+      // the worst thing that could happen is that we'll make one more request
+      // before noticing a close.
+      lock.unlock();
+      SendNextRequest(true);
+      lock.lock();
+    }
+  }
+  processing_responses_ = false;
+}
 
-  MAYBE_FAULT(FLAGS_fault_crash_after_leader_request_fraction);
+bool Peer::HandleResponse(const UpdateRpc& rpc) {
+  const ConsensusResponsePB& response = rpc.response;
 
   // Process RpcController errors.
-  const auto controller_status = controller_.status();
+  const auto controller_status = rpc.batched ? rpc.batch_status : rpc.controller.status();
   if (!controller_status.ok()) {
+    const ConsensusFeatureFlags rejected = RejectedPackedOps(rpc);
+    if (rejected == PACKED_OPS_V2) {
+      // The peer only understands the first version of packed ops. Resend
+      // the ops in that version right away.
+      std::lock_guard<simple_spinlock> lock(peer_lock_);
+      pipeline_next_index_ = kInvalidOpIdIndex;
+      if (!packed_ops_v2_unsupported_) {
+        LOG_WITH_PREFIX_UNLOCKED(INFO) << "Peer doesn't support delta encoded packed ops, "
+                                       << "sending it version 1 instead";
+        packed_ops_v2_unsupported_ = true;
+      }
+      return true;
+    }
+    if (rejected == PACKED_OPS) {
+      // The peer runs a version which predates packed ops. Resend the ops
+      // as protobufs right away, rather than backing off as from a failure.
+      std::lock_guard<simple_spinlock> lock(peer_lock_);
+      pipeline_next_index_ = kInvalidOpIdIndex;
+      if (!packed_ops_unsupported_) {
+        LOG_WITH_PREFIX_UNLOCKED(INFO) << "Peer doesn't support packed ops, "
+                                       << "sending it protobufs instead";
+        packed_ops_unsupported_ = true;
+      }
+      return true;
+    }
     auto ps = controller_status.IsRemoteError() ?
         PeerStatus::REMOTE_ERROR : PeerStatus::RPC_LAYER_ERROR;
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), ps, controller_status);
     ProcessResponseError(controller_status);
-    return;
+    return false;
   }
 
   // Process CANNOT_PREPARE.
   // TODO(todd): there is no integration test coverage of this code path. Likely a bug in
   // this path is responsible for KUDU-1779.
-  if (response_.status().has_error() &&
-      response_.status().error().code() == consensus::ConsensusErrorPB::CANNOT_PREPARE) {
-    Status response_status = StatusFromPB(response_.status().error().status());
+  if (response.status().has_error() &&
+      response.status().error().code() == consensus::ConsensusErrorPB::CANNOT_PREPARE) {
+    Status response_status = StatusFromPB(response.status().error().status());
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), PeerStatus::CANNOT_PREPARE,
                              response_status);
+    // The response still tells exactly which ops the peer has, so they aren't
+    // resent with the next attempt.
+    if (response.status().has_last_received()) {
+      queue_->SkipOpsReceivedByPeer(peer_pb_.permanent_uuid(),
+                                    response.status().last_received());
+    }
     ProcessResponseError(response_status);
-    return;
+    return false;
   }
 
   // Process tserver-level errors.
-  if (response_.has_error()) {
-    Status response_status = StatusFromPB(response_.error().status());
+  if (response.has_error()) {
+    Status response_status = StatusFromPB(response.error().status());
     PeerStatus ps;
     ps = PeerStatus::REMOTE_ERROR;
 
-    ServerErrorPB resp_error = response_.error();
-    switch (response_.error().code()) {
+    ServerErrorPB resp_error = response.error();
+    switch (response.error().code()) {
       // We treat WRONG_SERVER_UUID as failed.
       case ServerErrorPB::WRONG_SERVER_UUID: FALLTHROUGH_INTENDED;
 #ifdef FB_DO_NOT_REMOVE
@@ -469,49 +1134,42 @@ void Peer::ProcessResponse() {
     }
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), ps, response_status);
     ProcessResponseError(response_status);
-    return;
+    return false;
   }
 
-  // The queue's handling of the peer response may generate IO (reads against
-  // the WAL) and SendNextRequest() may do the same thing. So we run the rest
-  // of the response handling logic on our thread pool and not on the reactor
-  // thread.
-  //
-  // Capture a weak_ptr reference into the submitted functor so that we can
-  // safely handle the functor outliving its peer.
-  weak_ptr<Peer> w_this = shared_from_this();
-  Status s = raft_pool_token_->SubmitFunc([w_this]() {
-    if (auto p = w_this.lock()) {
-      p->DoProcessResponse();
-
-    }
-  });
-  if (PREDICT_FALSE(!s.ok())) {
-    LOG_WITH_PREFIX_UNLOCKED(WARNING) << "Unable to process peer response: " << s.ToString()
-        << ": " << SecureShortDebugString(response_);
-    request_pending_ = false;
-  }
-}
-
-void Peer::DoProcessResponse() {
-
   VLOG_WITH_PREFIX_UNLOCKED(2) << "Response from peer " << peer_pb().permanent_uuid() << ": "
-      << SecureShortDebugString(response_);
+      << SecureShortDebugString(response);
+  if (rpc.request.has_trace_context()) {
+    LogSlowTracedRequest(rpc);
+  }
 
-  bool send_more_immediately = queue_->ResponseFromPeer(peer_pb_.permanent_uuid(), response_);
+  bool send_more_immediately = queue_->ResponseFromPeer(peer_pb_.permanent_uuid(), response,
+                                                        rpc.send_time);
 
   {
-    std::unique_lock<simple_spinlock> lock(peer_lock_);
-    CHECK(request_pending_);
+    std::lock_guard<simple_spinlock> lock(peer_lock_);
     failed_attempts_ = 0;
-    request_pending_ = false;
-  }
-  // We're OK to read the state_ without a lock here -- if we get a race,
-  // the worst thing that could happen is that we'll make one more request before
-  // noticing a close.
-  if (send_more_immediately) {
-    SendNextRequest(true);
+    if (response.status().has_error()) {
+      // The peer refused the ops, e.g. because of an LMP mismatch, and the
+      // queue has rewound the peer's next index: the requests still in flight
+      // were built on the old position, so stop pipelining behind them.
+      pipeline_next_index_ = kInvalidOpIdIndex;
+    } else if (!last_exchange_time_.Initialized() ||
+               rpc.send_time > last_exchange_time_) {
+      last_exchange_time_ = rpc.send_time;
+      last_exchange_reached_log_end_ = rpc.reached_log_end;
+    }
+    if (FLAGS_raft_proxy_adaptive_batching && rpc.request.has_proxy_dest_uuid()) {
+      // The request went to the proxy and from there to the peer.
+      const MonoDelta hop_latency = MonoDelta::FromMicroseconds(
+          (MonoTime::Now() - rpc.send_time).ToMicroseconds() / 2);
+      proxy_batch_window_ = NextProxyBatchWindow(
+          proxy_batch_window_, hop_latency,
+          MonoDelta::FromMilliseconds(FLAGS_raft_proxy_hop_latency_budget_ms),
+          MonoDelta::FromMilliseconds(FLAGS_raft_proxy_max_batch_window_ms));
+    }
   }
+  return send_more_immediately;
 }
 
 #ifdef FB_DO_NOT_REMOVE
@@ -557,6 +1215,31 @@ void Peer::ProcessTabletCopyResponse() {
 }
 #endif
 
+void Peer::LogSlowTracedRequest(const UpdateRpc& rpc) const {
+  const int32_t slow_ms = FLAGS_raft_proxy_trace_slow_request_ms;
+  const MonoDelta elapsed = MonoTime::Now() - rpc.send_time;
+  if (slow_ms <= 0 || elapsed < MonoDelta::FromMilliseconds(slow_ms)) {
+    return;
+  }
+  const uint64_t request_id = rpc.request.trace_context().request_id();
+  const ConsensusResponsePB& response = rpc.response;
+  string hops;
+  // The hops come back the furthest first, and are only those of this
+  // request if the destination echoed its id.
+  if (response.has_trace_context() && response.trace_context().request_id() == request_id) {
+    for (auto it = response.proxy_hops().rbegin(); it != response.proxy_hops().rend(); ++it) {
+      SubstituteAndAppend(&hops, "$0hop $1 through $2 took $3 us, $4 us of which downstream",
+                          hops.empty() ? "" : "; ", it->hop(), it->proxy_uuid(),
+                          it->latency_us(), it->downstream_us());
+    }
+  }
+  KLOG_EVERY_N_SECS(INFO, 1) << LogPrefixUnlocked()
+                             << Substitute("Slow proxied request $0 took $1 us: $2",
+                                           request_id, elapsed.ToMicroseconds(),
+                                           hops.empty() ? "no hops reported" : hops)
+                             << THROTTLE_MSG;
+}
+
 void Peer::ProcessResponseError(const Status& status) {
   string resp_err_info;
 
@@ -568,7 +1251,10 @@ void Peer::ProcessResponseError(const Status& status) {
   }
 #endif
 
-  request_pending_ = false;
+  std::lock_guard<simple_spinlock> lock(peer_lock_);
+  // Whatever the requests still in flight carry is now suspect, so any
+  // further requests wait for them to come back.
+  pipeline_next_index_ = kInvalidOpIdIndex;
 
   if (status.IsIllegalState() &&
       status.ToString().find("Previous Rotate Event with") != std::string::npos) {
@@ -611,14 +1297,221 @@ Peer::~Peer() {
   if (heartbeater_) {
     heartbeater_->Stop();
   }
+}
 
-  // We don't own the ops (the queue does).
-#if GOOGLE_PROTOBUF_VERSION >= 3017003
-  request_.mutable_ops()->UnsafeArenaExtractSubrange(
-      0, request_.ops_size(), nullptr);
-#else
-  request_.mutable_ops()->ExtractSubrange(0, request_.ops_size(), nullptr);
-#endif
+shared_ptr<HeartbeatScheduler> HeartbeatScheduler::Get(
+    const shared_ptr<Messenger>& messenger) {
+  static simple_spinlock schedulers_lock;
+  static auto* schedulers = new std::unordered_map<Messenger*, weak_ptr<HeartbeatScheduler>>();
+
+  std::lock_guard<simple_spinlock> l(schedulers_lock);
+  // Forget the schedulers which stopped, since their messengers may be gone.
+  for (auto it = schedulers->begin(); it != schedulers->end();) {
+    if (it->second.expired()) {
+      it = schedulers->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  weak_ptr<HeartbeatScheduler>& w = (*schedulers)[messenger.get()];
+  if (auto scheduler = w.lock()) {
+    return scheduler;
+  }
+  shared_ptr<HeartbeatScheduler> scheduler(new HeartbeatScheduler());
+  weak_ptr<HeartbeatScheduler> w_scheduler = scheduler;
+  PeriodicTimer::Options opts;
+  opts.jitter_pct = 0;
+  scheduler->timer_ = PeriodicTimer::Create(
+      messenger,
+      [w_scheduler]() {
+        if (auto s = w_scheduler.lock()) {
+          s->SendHeartbeats();
+        }
+      },
+      MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms),
+      opts);
+  scheduler->timer_->Start();
+  w = scheduler;
+  return scheduler;
+}
+
+HeartbeatScheduler::~HeartbeatScheduler() {
+  if (timer_) {
+    timer_->Stop();
+  }
+}
+
+void HeartbeatScheduler::Register(const shared_ptr<Peer>& peer) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  peers_.emplace_back(peer);
+}
+
+void HeartbeatScheduler::SendHeartbeats() {
+  vector<shared_ptr<Peer>> peers;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    peers.reserve(peers_.size());
+    auto live_end = std::remove_if(peers_.begin(), peers_.end(),
+                                   [&](const weak_ptr<Peer>& w) {
+                                     auto p = w.lock();
+                                     if (!p) return true;
+                                     peers.emplace_back(std::move(p));
+                                     return false;
+                                   });
+    peers_.erase(live_end, peers_.end());
+  }
+  // Signal the peers one host after another, so that the heartbeats to each
+  // host are written out together.
+  std::stable_sort(peers.begin(), peers.end(),
+                   [](const shared_ptr<Peer>& a, const shared_ptr<Peer>& b) {
+                     return a->peer_pb().last_known_addr().host() <
+                            b->peer_pb().last_known_addr().host();
+                   });
+  for (const auto& p : peers) {
+    p->SignalRequest(true, true);
+  }
+}
+
+size_t HeartbeatScheduler::num_peers() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  return peers_.size();
+}
+
+shared_ptr<UpdateBatcher> UpdateBatcher::Get(const shared_ptr<Messenger>& messenger,
+                                             const string& dest_uuid) {
+  static simple_spinlock batchers_lock;
+  static auto* batchers =
+      new std::map<std::pair<Messenger*, string>, weak_ptr<UpdateBatcher>>();
+
+  std::lock_guard<simple_spinlock> l(batchers_lock);
+  // Forget the batchers which no peer holds, since their messengers may be
+  // gone.
+  for (auto it = batchers->begin(); it != batchers->end();) {
+    if (it->second.expired()) {
+      it = batchers->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  weak_ptr<UpdateBatcher>& w = (*batchers)[std::make_pair(messenger.get(), dest_uuid)];
+  if (auto batcher = w.lock()) {
+    return batcher;
+  }
+  shared_ptr<UpdateBatcher> batcher(new UpdateBatcher());
+  w = batcher;
+  return batcher;
+}
+
+void UpdateBatcher::Send(shared_ptr<PeerProxy> proxy,
+                         const ConsensusRequestPB* request,
+                         ConsensusResponsePB* response,
+                         RpcController* controller,
+                         StdStatusCallback callback) {
+  PendingUpdate update{ std::move(proxy), request, response, controller, std::move(callback) };
+  std::unique_lock<simple_spinlock> l(lock_);
+  if (PREDICT_FALSE(batch_unsupported_)) {
+    l.unlock();
+    SendAlone(std::move(update));
+    return;
+  }
+  queued_.emplace_back(std::move(update));
+  if (in_flight_) {
+    return;
+  }
+  SendBatch(std::move(l));
+}
+
+size_t UpdateBatcher::num_queued() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  return queued_.size();
+}
+
+void UpdateBatcher::SendBatch(std::unique_lock<simple_spinlock> l) {
+  DCHECK(!in_flight_);
+  DCHECK(!queued_.empty());
+  DCHECK(batch_.empty());
+  in_flight_ = true;
+  batch_.swap(queued_);
+  l.unlock();
+
+  batch_request_.Clear();
+  batch_response_.Clear();
+  batch_controller_.Reset();
+  batch_controller_.RequireServerFeature(BATCH_UPDATE_CONSENSUS);
+  for (const PendingUpdate& update : batch_) {
+    batch_request_.add_requests()->CopyFrom(*update.request);
+  }
+  // All the proxies lead to the same server.
+  shared_ptr<UpdateBatcher> s_this = shared_from_this();
+  batch_.front().proxy->BatchUpdateAsync(&batch_request_, &batch_response_, &batch_controller_,
+                                         [s_this]() { s_this->BatchDone(); });
+}
+
+void UpdateBatcher::BatchDone() {
+  vector<PendingUpdate> batch;
+  batch.swap(batch_);
+  const Status s = batch_controller_.status();
+
+  bool unsupported = false;
+  const rpc::ErrorStatusPB* err = batch_controller_.error_response();
+  if (!s.ok() && err) {
+    for (uint32_t feature : err->unsupported_feature_flags()) {
+      unsupported |= feature == BATCH_UPDATE_CONSENSUS;
+    }
+  }
+
+  if (PREDICT_FALSE(unsupported)) {
+    // The server runs a version which predates BatchUpdateConsensus. Resend
+    // the requests on their own right away, as for any later ones.
+    LOG(INFO) << "Server " << batch.front().proxy->PeerName() << " doesn't support "
+              << "BatchUpdateConsensus, sending it UpdateConsensus calls instead";
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      batch_unsupported_ = true;
+    }
+    for (PendingUpdate& update : batch) {
+      SendAlone(std::move(update));
+    }
+  } else if (PREDICT_FALSE(s.ok() && batch_response_.responses_size() != static_cast<int>(batch.size()))) {
+    Status mismatch = Status::IllegalState(Substitute(
+        "BatchUpdateConsensus returned $0 responses to $1 requests",
+        batch_response_.responses_size(), batch.size()));
+    for (PendingUpdate& update : batch) {
+      update.callback(mismatch);
+    }
+  } else {
+    for (int i = 0; i < static_cast<int>(batch.size()); i++) {
+      if (s.ok()) {
+        batch[i].response->Swap(batch_response_.mutable_responses(i));
+      }
+      batch[i].callback(s);
+    }
+  }
+
+  std::unique_lock<simple_spinlock> l(lock_);
+  in_flight_ = false;
+  if (queued_.empty()) {
+    return;
+  }
+  if (PREDICT_FALSE(batch_unsupported_)) {
+    vector<PendingUpdate> queued;
+    queued.swap(queued_);
+    l.unlock();
+    for (PendingUpdate& update : queued) {
+      SendAlone(std::move(update));
+    }
+    return;
+  }
+  SendBatch(std::move(l));
+}
+
+void UpdateBatcher::SendAlone(PendingUpdate update) {
+  RpcController* controller = update.controller;
+  StdStatusCallback callback = std::move(update.callback);
+  update.proxy->UpdateAsync(update.request, update.response, controller,
+                            [controller, callback]() {
+                              callback(controller->status());
+                            });
 }
 
 shared_ptr<PeerProxy> PeerProxyPool::Get(const string& uuid) const {
@@ -681,9 +1574,12 @@ void CheckAndEnforceResponseToken(
 
 RpcPeerProxy::RpcPeerProxy(gscoped_ptr<HostPort> hostport,
                            shared_ptr<ConsensusServiceProxy> consensus_proxy,
-                           scoped_refptr<Counter> num_rpc_token_mismatches)
+                           scoped_refptr<Counter> num_rpc_token_mismatches,
+                           vector<shared_ptr<ConsensusServiceProxy>> bulk_proxies)
     : hostport_(std::move(hostport)),
       consensus_proxy_(std::move(consensus_proxy)),
+      bulk_proxies_(std::move(bulk_proxies)),
+      next_bulk_proxy_(0),
       num_rpc_token_mismatches_(std::move(num_rpc_token_mismatches)) {
   DCHECK(hostport_ != NULL);
   DCHECK(consensus_proxy_ != NULL);
@@ -699,7 +1595,13 @@ void RpcPeerProxy::UpdateAsync(const ConsensusRequestPB* request,
   boost::optional<std::string> rpc_token = request->has_raft_rpc_token()
                                                ? request->raft_rpc_token()
                                                : boost::optional<std::string>();
-  consensus_proxy_->UpdateConsensusAsync(
+  ConsensusServiceProxy* proxy = consensus_proxy_.get();
+  if (!bulk_proxies_.empty() &&
+      (request->ops_size() > 0 || request->has_ops_sidecar_idx() ||
+       request->has_packed_ops_sidecar_idx())) {
+    proxy = bulk_proxies_[next_bulk_proxy_++ % bulk_proxies_.size()].get();
+  }
+  proxy->UpdateConsensusAsync(
       *request, response, controller,
       [callback, response, request_token = std::move(rpc_token),
        mismatch_counter = num_rpc_token_mismatches_]() {
@@ -711,6 +1613,28 @@ void RpcPeerProxy::UpdateAsync(const ConsensusRequestPB* request,
       });
 }
 
+void RpcPeerProxy::BatchUpdateAsync(const BatchConsensusRequestPB* request,
+                                    BatchConsensusResponsePB* response,
+                                    rpc::RpcController* controller,
+                                    const rpc::ResponseCallback& callback) {
+  controller->set_timeout(MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  consensus_proxy_->BatchUpdateConsensusAsync(
+      *request, response, controller,
+      [callback, request, response, mismatch_counter = num_rpc_token_mismatches_]() {
+        // The batch's request stays alive until the callback has run.
+        const int n = std::min(request->requests_size(), response->responses_size());
+        for (int i = 0; i < n; i++) {
+          const ConsensusRequestPB& update = request->requests(i);
+          CheckAndEnforceResponseToken("BatchUpdateAsync", response->mutable_responses(i),
+                                       update.has_raft_rpc_token()
+                                           ? boost::optional<std::string>(update.raft_rpc_token())
+                                           : boost::optional<std::string>(),
+                                       mismatch_counter);
+        }
+        callback();
+      });
+}
+
 Status RpcPeerProxy::StartElection(const RunLeaderElectionRequestPB* request,
                                  RunLeaderElectionResponsePB* response,
                                  rpc::RpcController* controller) {
@@ -718,6 +1642,12 @@ Status RpcPeerProxy::StartElection(const RunLeaderElectionRequestPB* request,
   return consensus_proxy_->RunLeaderElection(*request, response, controller);
 }
 
+Status RpcPeerProxy::ReadIndex(const ReadIndexRequestPB* request,
+                               ReadIndexResponsePB* response,
+                               rpc::RpcController* controller) {
+  return consensus_proxy_->ReadIndex(*request, response, controller);
+}
+
 void RpcPeerProxy::RequestConsensusVoteAsync(const VoteRequestPB* request,
                                              VoteResponsePB* response,
                                              rpc::RpcController* controller,
@@ -735,6 +1665,10 @@ void RpcPeerProxy::RequestConsensusVoteAsync(const VoteRequestPB* request,
       });
 }
 
+void RpcPeerProxy::CancelConsensusVote(rpc::RpcController* controller) {
+  controller->Cancel();
+}
+
 #ifdef FB_DO_NOT_REMOVE
 void RpcPeerProxy::StartTabletCopyAsync(const StartTabletCopyRequestPB* request,
                                         StartTabletCopyResponsePB* response,
@@ -745,23 +1679,41 @@ void RpcPeerProxy::StartTabletCopyAsync(const StartTabletCopyRequestPB* request,
 }
 #endif
 
+void RpcPeerProxy::WarmUpConnections() {
+  consensus_proxy_->WarmUpConnection();
+  for (const auto& proxy : bulk_proxies_) {
+    proxy->WarmUpConnection();
+  }
+}
+
 string RpcPeerProxy::PeerName() const {
   return hostport_->ToString();
 }
 
 namespace {
 
+// Resolves 'hostport' through 'resolver', and its cache, if set. If
+// 'remote' is set, the address the proxy sends to is copied into it.
 Status CreateConsensusServiceProxyForHost(const shared_ptr<Messenger>& messenger,
                                           const HostPort& hostport,
-                                          shared_ptr<ConsensusServiceProxy>* new_proxy) {
+                                          DnsResolver* resolver,
+                                          shared_ptr<ConsensusServiceProxy>* new_proxy,
+                                          Sockaddr* remote = nullptr) {
   vector<Sockaddr> addrs;
-  RETURN_NOT_OK(hostport.ResolveAddresses(&addrs));
+  if (resolver) {
+    RETURN_NOT_OK(resolver->ResolveAddresses(hostport, &addrs));
+  } else {
+    RETURN_NOT_OK(hostport.ResolveAddresses(&addrs));
+  }
   if (addrs.size() > 1) {
     LOG(WARNING)<< "Peer address '" << hostport.ToString() << "' "
     << "resolves to " << addrs.size() << " different addresses. Using "
     << addrs[0].ToString();
   }
   new_proxy->reset(new ConsensusServiceProxy(messenger, addrs[0], hostport.host()));
+  if (remote) {
+    *remote = addrs[0];
+  }
   return Status::OK();
 }
 
@@ -769,8 +1721,11 @@ Status CreateConsensusServiceProxyForHost(const shared_ptr<Messenger>& messenger
 
 RpcPeerProxyFactory::RpcPeerProxyFactory(
     shared_ptr<Messenger> messenger,
-    const scoped_refptr<MetricEntity>& metric_entity)
+    const scoped_refptr<MetricEntity>& metric_entity,
+    string local_region)
     : messenger_(std::move(messenger)),
+      local_region_(std::move(local_region)),
+      dns_resolver_(metric_entity),
       num_rpc_token_mismatches_(metric_entity->FindOrCreateCounter(
           &METRIC_raft_rpc_token_num_response_mismatches)) {}
 
@@ -779,9 +1734,27 @@ Status RpcPeerProxyFactory::NewProxy(const RaftPeerPB& peer_pb,
   gscoped_ptr<HostPort> hostport(new HostPort);
   RETURN_NOT_OK(HostPortFromPB(peer_pb.last_known_addr(), hostport.get()));
   shared_ptr<ConsensusServiceProxy> new_proxy;
-  RETURN_NOT_OK(CreateConsensusServiceProxyForHost(messenger_, *hostport, &new_proxy));
+  Sockaddr remote;
+  RETURN_NOT_OK(CreateConsensusServiceProxyForHost(messenger_, *hostport, &dns_resolver_,
+                                                   &new_proxy, &remote));
+  // The profile is set before any of the proxies connects, and also applies
+  // to the connections the peer makes to this server.
+  if (FLAGS_raft_socket_profiles_by_region && !local_region_.empty() &&
+      peer_pb.attrs().has_region()) {
+    messenger_->SetSocketProfile(remote, peer_pb.attrs().region() == local_region_ ?
+                                         rpc::SocketProfile::InRegion() :
+                                         rpc::SocketProfile::CrossRegion());
+  }
+  vector<shared_ptr<ConsensusServiceProxy>> bulk_proxies;
+  for (int i = 1; i <= FLAGS_raft_bulk_connections_per_peer; i++) {
+    shared_ptr<ConsensusServiceProxy> bulk_proxy;
+    RETURN_NOT_OK(CreateConsensusServiceProxyForHost(messenger_, *hostport, &dns_resolver_,
+                                                     &bulk_proxy));
+    bulk_proxy->set_connection_stripe(i);
+    bulk_proxies.emplace_back(std::move(bulk_proxy));
+  }
   proxy->reset(new RpcPeerProxy(std::move(hostport), std::move(new_proxy),
-                                num_rpc_token_mismatches_));
+                                num_rpc_token_mismatches_, std::move(bulk_proxies)));
   return Status::OK();
 }
 
@@ -793,7 +1766,7 @@ Status SetPermanentUuidForRemotePeer(const shared_ptr<Messenger>& messenger,
   HostPort hostport;
   RETURN_NOT_OK(HostPortFromPB(remote_peer->last_known_addr(), &hostport));
   shared_ptr<ConsensusServiceProxy> proxy;
-  RETURN_NOT_OK(CreateConsensusServiceProxyForHost(messenger, hostport, &proxy));
+  RETURN_NOT_OK(CreateConsensusServiceProxyForHost(messenger, hostport, nullptr, &proxy));
   GetNodeInstanceRequestPB req;
   GetNodeInstanceResponsePB resp;
   rpc::RpcController controller;
@@ -840,5 +1813,52 @@ Status SetPermanentUuidForRemotePeer(const shared_ptr<Messenger>& messenger,
   return Status::OK();
 }
 
+bool MoveOpsToSharedSidecar(PeerMessageQueue* queue,
+                            const vector<ReplicateRefPtr>& msgs,
+                            rpc::RpcController* controller,
+                            ConsensusRequestPB* request,
+                            bool packed,
+                            bool delta) {
+  DCHECK(packed || !delta);
+  int idx;
+  if (!controller->AddOutboundSidecar(
+          std::unique_ptr<RpcSidecar>(
+              new SharedOpsSidecar(queue->SerializeOpsForPeers(msgs, packed, delta))),
+          &idx).ok()) {
+    return false;
+  }
+  if (packed) {
+    // An older server would ignore the packed ops and see an empty request.
+    controller->RequireServerFeature(delta ? PACKED_OPS_V2 : PACKED_OPS);
+    request->set_packed_ops_sidecar_idx(idx);
+  } else {
+    request->set_ops_sidecar_idx(idx);
+  }
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request->mutable_ops()->UnsafeArenaExtractSubrange(0, request->ops_size(), nullptr);
+#else
+  request->mutable_ops()->ExtractSubrange(0, request->ops_size(), nullptr);
+#endif
+  return true;
+}
+
+MonoDelta NextProxyBatchWindow(const MonoDelta& window,
+                               const MonoDelta& hop_latency,
+                               const MonoDelta& budget,
+                               const MonoDelta& max_window) {
+  const int64_t kMinWindowUs = 1000;
+  int64_t window_us = window.ToMicroseconds();
+  if (hop_latency > budget) {
+    window_us = std::min(std::max(window_us * 2, kMinWindowUs),
+                         max_window.ToMicroseconds());
+  } else if (hop_latency.ToMicroseconds() * 2 < budget.ToMicroseconds()) {
+    window_us /= 2;
+    if (window_us < kMinWindowUs) {
+      window_us = 0;
+    }
+  }
+  return MonoDelta::FromMicroseconds(std::max<int64_t>(window_us, 0));
+}
+
 }  // namespace consensus
 }  // namespace kudu
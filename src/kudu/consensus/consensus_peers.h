@@ -26,7 +26,9 @@
 
 #include <atomic>
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -36,13 +38,19 @@
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus.proxy.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/peer_id.h"
 #include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/gutil/macros.h"
 #include "kudu/rpc/response_callback.h"
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/net/dns_resolver.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/status.h"
+#include "kudu/util/status_callback.h"
 
 namespace kudu {
 class ThreadPoolToken;
@@ -53,6 +61,8 @@ class PeriodicTimer;
 }
 
 namespace consensus {
+class HeartbeatScheduler;
+class UpdateBatcher;
 class PeerMessageQueue;
 class PeerProxy;
 class PeerProxyPool;
@@ -69,7 +79,8 @@ class PeerProxyPool;
 //
 // Peers are also responsible for sending periodic heartbeats
 // to assert liveness of the leader. The peer constructs a heartbeater
-// thread to trigger these heartbeats.
+// thread to trigger these heartbeats, or with --raft_coalesce_heartbeats,
+// registers with the HeartbeatScheduler of its messenger.
 //
 // The actual request construction is delegated to a PeerMessageQueue
 // object, and performed on a thread pool (since it may do IO). When a
@@ -114,6 +125,9 @@ class Peer : public std::enable_shared_from_this<Peer> {
   // log entries) are assembled on 'raft_pool_token'.
   // Response handling may also involve IO related to log-entry lookups and is
   // also done on 'raft_pool_token'.
+  //
+  // If not null, 'request_dispatch_latency' records the time from
+  // SignalRequest() until each request is handed to the RPC layer.
   static Status NewRemotePeer(RaftPeerPB peer_pb,
                               std::string tablet_id,
                               std::string leader_uuid,
@@ -122,6 +136,7 @@ class Peer : public std::enable_shared_from_this<Peer> {
                               ThreadPoolToken* raft_pool_token,
                               std::shared_ptr<PeerProxy> proxy,
                               std::shared_ptr<rpc::Messenger> messenger,
+                              scoped_refptr<Histogram> request_dispatch_latency,
                               std::shared_ptr<Peer>* peer);
 
  private:
@@ -132,19 +147,111 @@ class Peer : public std::enable_shared_from_this<Peer> {
        PeerProxyPool* peer_proxy_pool,
        ThreadPoolToken* raft_pool_token,
        std::shared_ptr<PeerProxy> proxy,
-       std::shared_ptr<rpc::Messenger> messenger);
-
-  void SendNextRequest(bool even_if_queue_empty, bool from_heartbeater = false);
-
-  // Signals that a response was received from the peer.
+       std::shared_ptr<rpc::Messenger> messenger,
+       scoped_refptr<Histogram> request_dispatch_latency);
+
+  // An UpdateConsensus request to the peer and its response.
+  struct UpdateRpc {
+    ~UpdateRpc();
+
+    // Removes the ops from 'request' without deleting them, and drops the
+    // references to them.
+    void ReleaseOps();
+
+    ConsensusRequestPB request;
+    ConsensusResponsePB response;
+    rpc::RpcController controller;
+
+    // Reference-counted pointers to any ReplicateMsgs which are in-flight to the peer. We
+    // may have loaded these messages from the LogCache, in which case we are potentially
+    // sharing the same object as other peers. Since the PB request itself can't hold
+    // reference counts, this holds them.
+    //
+    // The list itself is shared, so that what else keeps the ops alive while
+    // the call is in flight, like a gathered request, takes one reference to
+    // the list rather than one to each op. Never null.
+    std::shared_ptr<std::vector<ReplicateRefPtr>> replicate_msg_refs =
+        std::make_shared<std::vector<ReplicateRefPtr>>();
+
+    // Whether the response has arrived, and awaits its turn to be handled.
+    bool responded = false;
+
+    // When the request was sent, and whether it carried the leader's log up
+    // to its last op.
+    MonoTime send_time;
+    bool reached_log_end = false;
+
+    // Whether the request went through the UpdateBatcher, in which case
+    // 'batch_status' is the status of the call rather than 'controller's.
+    bool batched = false;
+    Status batch_status;
+  };
+
+  // The maximum number of requests to keep in flight to the peer, as set by
+  // --consensus_max_inflight_requests_per_peer, or by
+  // --raft_fast_leader_transfer_inflight_requests while the peer is the
+  // successor of a fast leadership transfer, or by
+  // --raft_learner_catchup_inflight_requests while it is a learner catching
+  // up.
+  int MaxInFlightRequests() const;
+
+  // Returns true if a heartbeat to the peer would tell it nothing that the
+  // last successful exchange didn't, and it is recent enough that the peer
+  // won't suspect the leader of failure before the next heartbeat is due.
+  // See --raft_suppress_redundant_heartbeats.
+  bool HeartbeatIsRedundantUnlocked() const;
+
+  // Runs on 'raft_pool_token'. Sends the request which SignalRequest() queued.
+  void RunQueuedSend();
+
+  // 'signaled_time' is when SignalRequest() was called for this request, if it
+  // was, and is used to record the dispatch latency.
+  void SendNextRequest(bool even_if_queue_empty, bool from_heartbeater = false,
+                       MonoTime signaled_time = MonoTime());
+
+  // Moves the write payloads of at least --consensus_payload_sidecar_min_bytes
+  // out of 'rpc->request' and into sidecars of 'rpc->controller', which send
+  // them straight from the messages rather than through the serialized request.
+  void MovePayloadsToSidecarsUnlocked(UpdateRpc* rpc);
+
+  // With --raft_witness_metadata_only_log, replaces the write ops of
+  // 'rpc->request' to a witness with copies which leave out the payload but
+  // keep its checksum.
+  void StripPayloadsForWitnessUnlocked(UpdateRpc* rpc);
+
+  // With --consensus_serialize_ops_once or --consensus_pack_ops, moves the
+  // ops out of 'rpc->request' and into a sidecar of 'rpc->controller' holding
+  // them serialized, in a buffer shared with the requests to the other peers
+  // sent the same batch. Returns whether the ops were moved.
+  bool MoveOpsToSharedSidecarUnlocked(UpdateRpc* rpc);
+
+  // Whether 'request' may go through 'update_batcher_': with
+  // --raft_batch_update_consensus, a request straight to the peer, carrying
+  // no more than --raft_batch_update_max_ops_bytes of ops, with no other
+  // request in flight to the peer to keep it in order with.
+  bool CanBatchUnlocked(const ConsensusRequestPB& request, bool pipelined,
+                        const std::string& next_hop_uuid) const;
+
+  // If 'rpc' failed because the peer doesn't support the version of packed
+  // ops it was sent, returns the feature of that version, PACKED_OPS or
+  // PACKED_OPS_V2. Otherwise returns UNKNOWN_CONSENSUS_FEATURE.
+  static ConsensusFeatureFlags RejectedPackedOps(const UpdateRpc& rpc);
+
+  // Signals that a response to 'rpc' was received from the peer.
   //
   // This method is called from the reactor thread and calls
-  // DoProcessResponse() on raft_pool_token_ to do any work that requires IO or
+  // DoProcessResponses() on raft_pool_token_ to do any work that requires IO or
   // lock-taking.
-  void ProcessResponse();
+  void ProcessResponse(UpdateRpc* rpc);
+
+  // Run on 'raft_pool_token'. Handles the responses which have arrived, in the
+  // order the requests were sent, stopping at the first request which is still
+  // waiting for its response.
+  void DoProcessResponses();
 
-  // Run on 'raft_pool_token'. Does response handling that requires IO or may block.
-  void DoProcessResponse();
+  // Does the handling of the response to 'rpc' that requires IO or may block.
+  // Returns whether another request should be sent right away.
+  bool HandleResponse(const UpdateRpc& rpc);
 
 #ifndef FB_DO_NOT_REMOVE
   // Fetch the desired tablet copy request from the queue and set up
@@ -158,10 +265,16 @@ class Peer : public std::enable_shared_from_this<Peer> {
   void ProcessTabletCopyResponse();
 #endif
 
+  // Logs the hops of the traced request 'rpc' if it was slower than
+  // --raft_proxy_trace_slow_request_ms.
+  void LogSlowTracedRequest(const UpdateRpc& rpc) const;
+
   // Signals there was an error sending the request to the peer.
   void ProcessResponseError(const Status& status);
 
-  // Has FLAGS_proxy_batch_duration_ms passed since the last request was sent?
+  // Has the proxy batch window passed since the last request was sent? The
+  // window is FLAGS_proxy_batch_duration_ms, or the adaptive
+  // 'proxy_batch_window_' with --raft_proxy_adaptive_batching.
   // Only relavant for proxied peers
   // We don't send requests to proxied peers until the batch duration has passed
   bool ProxyBatchDurationHasPassed();
@@ -184,9 +297,66 @@ class Peer : public std::enable_shared_from_this<Peer> {
   // Time when the last request was sent
   MonoTime last_request_time_;
 
-  // The latest consensus update request and response.
-  ConsensusRequestPB request_;
-  ConsensusResponsePB response_;
+  // The batching window of a proxied peer with --raft_proxy_adaptive_batching,
+  // adapted to the latency of the requests sent through its proxy. Protected
+  // by 'peer_lock_'.
+  MonoDelta proxy_batch_window_ = MonoDelta::FromMicroseconds(0);
+
+  // The consensus update requests in flight to the peer, in the order they
+  // were sent. Protected by 'peer_lock_'.
+  std::deque<std::unique_ptr<UpdateRpc>> in_flight_;
+
+  // Requests whose responses were handled, kept for reuse. Protected by
+  // 'peer_lock_'.
+  std::vector<std::unique_ptr<UpdateRpc>> free_rpcs_;
+
+  // The size of 'in_flight_', readable without 'peer_lock_'.
+  std::atomic<int> num_in_flight_;
+
+  // The index of the op the next pipelined request starts at: one past the
+  // last op of the requests in flight. kInvalidOpIdIndex if requests must not
+  // be pipelined behind the ones in flight, since the peer's position in its
+  // log is unknown. Protected by 'peer_lock_'.
+  int64_t pipeline_next_index_ = kInvalidOpIdIndex;
+
+  // The committed index sent with the latest request. Protected by 'peer_lock_'.
+  int64_t last_sent_committed_index_ = kMinimumOpIdIndex;
+
+  // When the latest request which the peer accepted was sent, and whether
+  // that request brought the peer up to the end of the leader's log.
+  // Protected by 'peer_lock_'.
+  MonoTime last_exchange_time_;
+  bool last_exchange_reached_log_end_ = false;
+
+  // Whether the peer rejected a request with packed ops, so that they're no
+  // longer sent to it. Protected by 'peer_lock_'.
+  bool packed_ops_unsupported_ = false;
+
+  // Whether the peer rejected a request with delta encoded packed ops, so
+  // that it's sent the first version of packed ops instead. Protected by
+  // 'peer_lock_'.
+  bool packed_ops_v2_unsupported_ = false;
+
+  // Whether a thread is in DoProcessResponses(). Protected by 'peer_lock_'.
+  bool processing_responses_ = false;
+
+  // Whether ProcessResponse() has submitted a DoProcessResponses() task which
+  // hasn't started yet. Responses which arrive until it starts, or while a
+  // thread is in DoProcessResponses(), are handled by it rather than each
+  // queuing a task of its own. Protected by 'peer_lock_'.
+  bool responses_queued_ = false;
+
+  // Whether SignalRequest() has submitted a RunQueuedSend() task which hasn't
+  // started yet. Until it starts, further signals, heartbeats included, are
+  // folded into it rather than queuing more tasks behind it. The arguments for
+  // SendNextRequest() and the time of the first signal are kept alongside.
+  // Protected by 'peer_lock_'.
+  bool send_queued_ = false;
+  bool queued_even_if_queue_empty_ = false;
+  bool queued_from_heartbeater_ = false;
+  MonoTime queued_signal_time_;
+
+  scoped_refptr<Histogram> request_dispatch_latency_;
 
 #ifdef FB_DO_NOT_REMOVE
   // The latest tablet copy request and response.
@@ -194,27 +364,32 @@ class Peer : public std::enable_shared_from_this<Peer> {
   StartTabletCopyResponsePB tc_response_;
 #endif
 
-  // Reference-counted pointers to any ReplicateMsgs which are in-flight to the peer. We
-  // may have loaded these messages from the LogCache, in which case we are potentially
-  // sharing the same object as other peers. Since the PB request_ itself can't hold
-  // reference counts, this holds them.
-  std::vector<ReplicateRefPtr> replicate_msg_refs_;
-
-  rpc::RpcController controller_;
-
   std::shared_ptr<rpc::Messenger> messenger_;
 
   // Thread pool token used to construct requests to this peer.
   //
-  // RaftConsensus owns this shared token and is responsible for destroying it.
+  // RaftConsensus (or PeerManager, for a token dedicated to this peer) owns
+  // this token and is responsible for destroying it.
   ThreadPoolToken* raft_pool_token_;
 
   // Repeating timer responsible for scheduling heartbeats to this peer.
   std::shared_ptr<rpc::PeriodicTimer> heartbeater_;
 
+  // With --raft_coalesce_heartbeats, the scheduler which sends the heartbeats
+  // to this peer instead of 'heartbeater_'.
+  std::shared_ptr<HeartbeatScheduler> heartbeat_scheduler_;
+
+  // With --raft_batch_update_consensus, sends the small requests to the
+  // peer's server together with those of the other tablets' peers there.
+  std::shared_ptr<UpdateBatcher> update_batcher_;
+
+  // When a request carrying ops was last sent to the peer. The scheduler's
+  // heartbeats are skipped while it's recent, as the heartbeater is snoozed.
+  // Protected by 'peer_lock_'.
+  MonoTime last_ops_send_time_;
+
   // lock that protects Peer state changes, initialization, etc.
   mutable simple_spinlock peer_lock_;
-  std::atomic<bool> request_pending_;
   bool closed_ = false;
   bool has_sent_first_request_ = false;
   // Cached state of whether this peer is proxied thru another peer. This info
@@ -224,6 +399,115 @@ class Peer : public std::enable_shared_from_this<Peer> {
 
 };
 
+// Sends the heartbeats of all the peers using a messenger from a single
+// timer, rather than from a timer for each peer. See
+// --raft_coalesce_heartbeats.
+//
+// The timer fires once every --raft_heartbeat_interval_ms, without jitter,
+// and signals a heartbeat to each registered peer in one pass, one
+// destination host after another, so that the heartbeats to a host go out
+// back to back and share its connections' writes. The failure detectors keep
+// their own jittered timers, since elections rely on the jitter.
+class HeartbeatScheduler : public std::enable_shared_from_this<HeartbeatScheduler> {
+ public:
+  // Returns the scheduler of 'messenger', creating and starting it if no
+  // peer holds one. The scheduler stops once the last peer releases it.
+  static std::shared_ptr<HeartbeatScheduler> Get(
+      const std::shared_ptr<rpc::Messenger>& messenger);
+
+  ~HeartbeatScheduler();
+
+  // Starts sending heartbeats to 'peer', until it's destroyed.
+  void Register(const std::shared_ptr<Peer>& peer);
+
+  // Signals a heartbeat to each of the registered peers, and forgets the
+  // ones which were destroyed. Runs on the timer, but may be called directly.
+  void SendHeartbeats();
+
+  // Returns the number of registered peers, including any destroyed since
+  // the last pass.
+  size_t num_peers() const;
+
+ private:
+  HeartbeatScheduler() = default;
+
+  std::shared_ptr<rpc::PeriodicTimer> timer_;
+
+  mutable simple_spinlock lock_;
+  std::vector<std::weak_ptr<Peer>> peers_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeartbeatScheduler);
+};
+
+// Sends the UpdateConsensus requests of the peers of different tablets on the
+// same server together, in BatchUpdateConsensus calls to it. See
+// --raft_batch_update_consensus.
+//
+// At most one call is in flight to the server at a time. The requests sent
+// while it is in flight are queued, and go out together in the next call once
+// it completes, so that a server hosting many tablets gets their heartbeats
+// in a few calls rather than in a call each.
+class UpdateBatcher : public std::enable_shared_from_this<UpdateBatcher> {
+ public:
+  // Returns the batcher of the server 'dest_uuid' for 'messenger', creating it
+  // if no peer holds one.
+  static std::shared_ptr<UpdateBatcher> Get(
+      const std::shared_ptr<rpc::Messenger>& messenger,
+      const std::string& dest_uuid);
+
+  // Sends 'request' through 'proxy', a proxy to the server, as part of the
+  // next call. Once 'response' is filled in, runs 'callback' with the status
+  // of the call. 'request', 'response' and 'controller' must stay alive
+  // until then.
+  //
+  // If the server doesn't support BatchUpdateConsensus, the requests are sent
+  // on their own from then on, with 'controller', whose status the callback
+  // is run with.
+  void Send(std::shared_ptr<PeerProxy> proxy,
+            const ConsensusRequestPB* request,
+            ConsensusResponsePB* response,
+            rpc::RpcController* controller,
+            StdStatusCallback callback);
+
+  // Returns the number of requests waiting for the call in flight.
+  size_t num_queued() const;
+
+ private:
+  struct PendingUpdate {
+    std::shared_ptr<PeerProxy> proxy;
+    const ConsensusRequestPB* request;
+    ConsensusResponsePB* response;
+    rpc::RpcController* controller;
+    StdStatusCallback callback;
+  };
+
+  UpdateBatcher() = default;
+
+  // Sends the queued requests in one call. Releases 'l', which holds 'lock_'.
+  void SendBatch(std::unique_lock<simple_spinlock> l);
+
+  // Hands the responses of the call out to the requests it carried, and sends
+  // the requests which queued behind it.
+  void BatchDone();
+
+  // Sends 'update' through UpdateConsensus, in a call of its own.
+  static void SendAlone(PendingUpdate update);
+
+  mutable simple_spinlock lock_;
+  std::vector<PendingUpdate> queued_;
+  bool in_flight_ = false;
+  bool batch_unsupported_ = false;
+
+  // The call in flight and the requests it carries. Only used by the sender
+  // of the call, until BatchDone() is done with it.
+  std::vector<PendingUpdate> batch_;
+  BatchConsensusRequestPB batch_request_;
+  BatchConsensusResponsePB batch_response_;
+  rpc::RpcController batch_controller_;
+
+  DISALLOW_COPY_AND_ASSIGN(UpdateBatcher);
+};
+
 // A proxy to another peer. Usually a thin wrapper around an rpc proxy but can
 // be replaced for tests.
 class PeerProxy {
@@ -236,16 +520,39 @@ class PeerProxy {
                            rpc::RpcController* controller,
                            const rpc::ResponseCallback& callback) = 0;
 
+  // Whether the proxy implements BatchUpdateAsync().
+  virtual bool SupportsBatchUpdate() const { return false; }
+
+  // Sends the requests of several tablets, asynchronously, to a remote peer's
+  // server in one call. See UpdateBatcher.
+  virtual void BatchUpdateAsync(const BatchConsensusRequestPB* /*request*/,
+                                BatchConsensusResponsePB* /*response*/,
+                                rpc::RpcController* /*controller*/,
+                                const rpc::ResponseCallback& /*callback*/) {
+    LOG(DFATAL) << "Not implemented";
+  }
+
   // Sends a RequestConsensusVote to a remote peer.
   virtual void RequestConsensusVoteAsync(const VoteRequestPB* request,
                                          VoteResponsePB* response,
                                          rpc::RpcController* controller,
                                          const rpc::ResponseCallback& callback) = 0;
 
+  // Cancels, best effort, a RequestConsensusVoteAsync() call made with
+  // 'controller' that may still be outstanding. Its callback is still run.
+  virtual void CancelConsensusVote(rpc::RpcController* /*controller*/) {}
+
   virtual Status StartElection(const RunLeaderElectionRequestPB* request,
                                RunLeaderElectionResponsePB* response,
                                rpc::RpcController* controller) = 0;
 
+  // Asks the peer, the leader, for a read index.
+  virtual Status ReadIndex(const ReadIndexRequestPB* /*request*/,
+                           ReadIndexResponsePB* /*response*/,
+                           rpc::RpcController* /*controller*/) {
+    return Status::NotSupported("ReadIndex not supported by this proxy");
+  }
+
 #ifdef FB_DO_NOT_REMOVE
   // Instructs a peer to begin a tablet copy session.
   virtual void StartTabletCopyAsync(const StartTabletCopyRequestPB* /*request*/,
@@ -256,6 +563,10 @@ class PeerProxy {
   }
 #endif
 
+  // Starts establishing the connections to the peer ahead of the first
+  // request over them.
+  virtual void WarmUpConnections() {}
+
   // Remote endpoint or description of the peer.
   virtual std::string PeerName() const = 0;
 };
@@ -289,30 +600,47 @@ class PeerProxyPool {
 
  private:
   mutable percpu_rwlock lock_;
-  std::unordered_map<std::string, std::shared_ptr<PeerProxy>> peer_proxy_map_;
+  std::unordered_map<PeerId, std::shared_ptr<PeerProxy>> peer_proxy_map_;
 };
 
 // PeerProxy implementation that does RPC calls
 class RpcPeerProxy : public PeerProxy {
  public:
+  // The UpdateConsensus requests which carry ops go round-robin through
+  // 'bulk_proxies', if any, which should have connection stripes of their own.
+  // All the other RPCs go through 'consensus_proxy'.
   RpcPeerProxy(gscoped_ptr<HostPort> hostport,
                std::shared_ptr<ConsensusServiceProxy> consensus_proxy,
-               scoped_refptr<Counter> num_rpc_token_mismatches);
+               scoped_refptr<Counter> num_rpc_token_mismatches,
+               std::vector<std::shared_ptr<ConsensusServiceProxy>> bulk_proxies = {});
 
   void UpdateAsync(const ConsensusRequestPB* request,
                    ConsensusResponsePB* response,
                    rpc::RpcController* controller,
                    const rpc::ResponseCallback& callback) override;
 
+  bool SupportsBatchUpdate() const override { return true; }
+
+  void BatchUpdateAsync(const BatchConsensusRequestPB* request,
+                        BatchConsensusResponsePB* response,
+                        rpc::RpcController* controller,
+                        const rpc::ResponseCallback& callback) override;
+
   void RequestConsensusVoteAsync(const VoteRequestPB* request,
                                  VoteResponsePB* response,
                                  rpc::RpcController* controller,
                                  const rpc::ResponseCallback& callback) override;
 
+  void CancelConsensusVote(rpc::RpcController* controller) override;
+
   Status StartElection(const RunLeaderElectionRequestPB* request,
                        RunLeaderElectionResponsePB* response,
                        rpc::RpcController* controller) override;
 
+  Status ReadIndex(const ReadIndexRequestPB* request,
+                   ReadIndexResponsePB* response,
+                   rpc::RpcController* controller) override;
+
 #ifdef FB_DO_NOT_REMOVE
   void StartTabletCopyAsync(const StartTabletCopyRequestPB* request,
                             StartTabletCopyResponsePB* response,
@@ -320,11 +648,15 @@ class RpcPeerProxy : public PeerProxy {
                             const rpc::ResponseCallback& callback) override;
 #endif
 
+  void WarmUpConnections() override;
+
   std::string PeerName() const override;
 
  private:
   gscoped_ptr<HostPort> hostport_;
   std::shared_ptr<ConsensusServiceProxy> consensus_proxy_;
+  const std::vector<std::shared_ptr<ConsensusServiceProxy>> bulk_proxies_;
+  std::atomic<uint32_t> next_bulk_proxy_;
 
   scoped_refptr<Counter> num_rpc_token_mismatches_;
 };
@@ -332,9 +664,12 @@ class RpcPeerProxy : public PeerProxy {
 // PeerProxyFactory implementation that generates RPCPeerProxies
 class RpcPeerProxyFactory : public PeerProxyFactory {
  public:
+   // 'local_region' is the region of this server, if known, which the
+   // connections to peers are tuned by with --raft_socket_profiles_by_region.
    explicit RpcPeerProxyFactory(
        std::shared_ptr<rpc::Messenger> messenger,
-       const scoped_refptr<MetricEntity>& metric_entity);
+       const scoped_refptr<MetricEntity>& metric_entity,
+       std::string local_region = "");
 
    Status NewProxy(const RaftPeerPB &peer_pb,
                    std::shared_ptr<PeerProxy> *proxy) override;
@@ -348,6 +683,12 @@ class RpcPeerProxyFactory : public PeerProxyFactory {
  private:
   std::shared_ptr<rpc::Messenger> messenger_;
 
+  const std::string local_region_;
+
+  // Resolves the peers' addresses, caching them if
+  // --dns_resolver_cache_ttl_sec is positive.
+  DnsResolver dns_resolver_;
+
   scoped_refptr<Counter> num_rpc_token_mismatches_;
 };
 
@@ -357,6 +698,31 @@ class RpcPeerProxyFactory : public PeerProxyFactory {
 Status SetPermanentUuidForRemotePeer(const std::shared_ptr<rpc::Messenger>& messenger,
                                      RaftPeerPB* remote_peer);
 
+// Moves the ops out of 'request' and into a sidecar of 'controller' holding
+// them serialized, in a buffer which 'queue' shares with the other requests
+// carrying the same ops. If 'packed', the ops are encoded by PackOps(), and
+// the RPC requires the PACKED_OPS feature of the server. If also 'delta', the
+// write ops are delta encoded, and the RPC requires PACKED_OPS_V2 instead.
+// The ops must stay
+// referenced by 'msgs', in the same order, until the RPC completes. Returns
+// false, leaving 'request' as it is, if the sidecar couldn't be added.
+bool MoveOpsToSharedSidecar(PeerMessageQueue* queue,
+                            const std::vector<ReplicateRefPtr>& msgs,
+                            rpc::RpcController* controller,
+                            ConsensusRequestPB* request,
+                            bool packed = false,
+                            bool delta = false);
+
+// Returns the proxy batching window which follows 'window' once a request
+// took 'hop_latency' per hop: doubled, up to 'max_window', when the latency
+// is over 'budget', since the downstream links are saturated and batching
+// more ops per request relieves them; halved, and dropped to zero once under
+// a millisecond, when the latency is under half the budget.
+MonoDelta NextProxyBatchWindow(const MonoDelta& window,
+                               const MonoDelta& hop_latency,
+                               const MonoDelta& budget,
+                               const MonoDelta& max_window);
+
 }  // namespace consensus
 }  // namespace kudu
 
@@ -22,13 +22,16 @@
 // ********************************************************************
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <ostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 #include <gtest/gtest.h>
 
 #include "kudu/clock/clock.h"
@@ -58,6 +61,7 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/metrics.h"
 //METRIC_DEFINE_entity(tablet);
 #include "kudu/util/monotime.h"
@@ -67,8 +71,22 @@
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
 
+DECLARE_bool(consensus_adaptive_batch_size);
+DECLARE_bool(consensus_coalesce_observer_notifications);
+DECLARE_int32(consensus_adaptive_batch_min_bytes);
+DECLARE_int32(consensus_adaptive_batch_target_rtt_ms);
+DECLARE_int64(consensus_catchup_min_lag_ops);
+DECLARE_int64(consensus_catchup_peer_bytes_per_sec);
 DECLARE_int32(consensus_max_batch_size_bytes);
+DECLARE_int32(consensus_prefetch_batches_for_lagging_peers);
+DECLARE_bool(consensus_prefetch_async_log_reads);
 DECLARE_int32(follower_unavailable_considered_failed_sec);
+DECLARE_int32(log_cache_follower_retained_ops);
+DECLARE_int32(raft_heartbeat_interval_ms);
+DECLARE_bool(raft_fast_leader_transfer);
+DECLARE_bool(raft_learner_fast_catchup);
+DECLARE_bool(raft_lmp_term_hints);
+DECLARE_bool(raft_prepare_replacement_before_eviction);
 
 using kudu::consensus::HealthReportPB;
 using std::atomic;
@@ -386,6 +404,50 @@ TEST_F(ConsensusQueueTest, TestGetPagedMessages) {
 #endif
 }
 
+// Tests that ops allocated on the arena of the request they came in with are
+// sent to peers in place, and keep the arena alive while the queue holds them.
+TEST_F(ConsensusQueueTest, TestRequestForPeerWithArenaOps) {
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(&request, &response, MinimumOpId(), MinimumOpId(),
+                          &send_more_immediately);
+
+  const int kNumOps = 5;
+  auto arena = std::make_shared<google::protobuf::Arena>();
+  std::weak_ptr<google::protobuf::Arena> weak_arena = arena;
+  vector<const ReplicateMsg*> msgs;
+  for (int i = 1; i <= kNumOps; i++) {
+    ReplicateMsg* msg = google::protobuf::Arena::CreateMessage<ReplicateMsg>(arena.get());
+    *msg = *CreateDummyReplicate(1, i, clock_->Now(), 0);
+    msgs.push_back(msg);
+    ASSERT_OK(queue_->AppendOperation(make_scoped_refptr_replicate(msg, arena)));
+  }
+  arena.reset();
+  ASSERT_FALSE(weak_arena.expired());
+
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_EQ(kNumOps, request.ops_size());
+  for (int i = 0; i < kNumOps; i++) {
+    ASSERT_EQ(msgs[i], &request.ops(i));
+  }
+
+  // The messages still belong to the queue so we have to release them.
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops().size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops().size(), nullptr);
+#endif
+}
+
 TEST_F(ConsensusQueueTest, TestPeersDontAckBeyondWatermarks) {
   queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
   AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100);
@@ -663,6 +725,72 @@ TEST_F(ConsensusQueueTest, TestQueueLoadsOperationsForPeer) {
 #end
 }
 
+// Tests that once a peer needs ops which aren't cached, the following ops are
+// read ahead and its next request is built from them.
+TEST_F(ConsensusQueueTest, TestQueuePrefetchesOperationsForLaggingPeer) {
+  gflags::FlagSaver saver;
+  FLAGS_consensus_max_batch_size_bytes = 1000;
+  FLAGS_consensus_prefetch_batches_for_lagging_peers = 2;
+
+  OpId opid = MakeOpId(1, 1);
+  for (int i = 1; i <= 100; i++) {
+    ASSERT_OK(log::AppendNoOpToLogSync(clock_, log_.get(), &opid));
+  }
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+  OpId last_logged_opid = MakeOpId(opid.term(), opid.index() - 1);
+
+  // Ops are prefetched a batch at a time through the log cache, or with a
+  // single read of the whole range from the log.
+  for (bool async_log_reads : { false, true }) {
+    SCOPED_TRACE(async_log_reads);
+    FLAGS_consensus_prefetch_async_log_reads = async_log_reads;
+
+    // Reopening the queue leaves its cache empty.
+    CloseAndReopenQueue(last_logged_opid, last_logged_opid);
+    queue_->SetPrefetchPoolToken(raft_pool_->NewToken(ThreadPool::ExecutionMode::CONCURRENT));
+    queue_->SetLeaderMode(last_logged_opid.index(),
+                          last_logged_opid.term(),
+                          BuildRaftConfigPBForTests(3));
+    const int64_t prefetched_before = queue_->metrics_.prefetched_ops_sent->value();
+
+    ConsensusRequestPB request;
+    ConsensusResponsePB response;
+    response.set_responder_uuid(kPeerUuid);
+    bool send_more_immediately = false;
+    ASSERT_NO_FATAL_FAILURE(UpdatePeerWatermarkToOp(&request, &response, MakeOpId(1, 50),
+                                                    MinimumOpId(), &send_more_immediately));
+
+    vector<ReplicateRefPtr> refs;
+    bool needs_tablet_copy;
+    std::string next_hop_uuid;
+    ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                     &needs_tablet_copy, &next_hop_uuid));
+    ASSERT_GT(request.ops_size(), 0);
+    ASSERT_EQ(prefetched_before, queue_->metrics_.prefetched_ops_sent->value());
+    OpId last_sent = request.ops(request.ops_size() - 1).id();
+    ASSERT_LT(last_sent.index(), 100);
+    raft_pool_->Wait();
+
+    SetLastReceivedAndLastCommitted(&response, last_sent, last_logged_opid.index());
+    queue_->ResponseFromPeer(response.responder_uuid(), response);
+    ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                     &needs_tablet_copy, &next_hop_uuid));
+    ASSERT_GT(request.ops_size(), 0);
+    ASSERT_EQ(last_sent.index() + 1, request.ops(0).id().index());
+    ASSERT_OPID_EQ(last_sent, request.preceding_id());
+    ASSERT_EQ(request.ops_size(),
+              queue_->metrics_.prefetched_ops_sent->value() - prefetched_before);
+
+    // The messages still belong to the queue so we have to release them.
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    request.mutable_ops()->UnsafeArenaExtractSubrange(
+        0, request.ops().size(), nullptr);
+#else
+    request.mutable_ops()->ExtractSubrange(0, request.ops().size(), nullptr);
+#endif
+  }
+}
+
 // This tests that the queue is able to handle operation overwriting, i.e. when a
 // newly tracked peer reports the last received operations as some operation that
 // doesn't exist in the leader's log. In particular it tests the case where a
@@ -778,6 +906,65 @@ TEST_F(ConsensusQueueTest, TestQueueHandlesOperationOverwriting) {
 #endif
 }
 
+// Tests that, with --raft_lmp_term_hints, the queue resumes sending to a
+// divergent peer at the first op of the term the peer's log conflicts in,
+// rather than after the peer's committed index.
+TEST_F(ConsensusQueueTest, TestQueueUsesConflictingTermHint) {
+  FLAGS_raft_lmp_term_hints = true;
+
+  OpId opid = MakeOpId(1, 1);
+  // Append 10 messages in term 1 and 10 more in term 4 to the log.
+  for (int i = 1; i <= 10; i++) {
+    ASSERT_OK(log::AppendNoOpToLogSync(clock_, log_.get(), &opid));
+  }
+  opid = MakeOpId(4, 11);
+  for (int i = 11; i <= 20; i++) {
+    ASSERT_OK(log::AppendNoOpToLogSync(clock_, log_.get(), &opid));
+  }
+
+  OpId last_in_log = MakeOpId(opid.term(), opid.index() - 1);
+  int64_t committed_index = 15;
+  CloseAndReopenQueue(last_in_log, MakeOpId(4, committed_index));
+  queue_->SetLeaderMode(committed_index,
+                        last_in_log.term(),
+                        BuildRaftConfigPBForTests(3));
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  vector<ReplicateRefPtr> refs;
+  response.set_responder_uuid(kPeerUuid);
+  queue_->TrackPeer(MakePeer(kPeerUuid, RaftPeerPB::VOTER));
+
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs, &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_EQ(request.ops_size(), 0);
+  request.Clear();
+
+  // The peer has the term 1 ops, committed up to index 5, followed by 15
+  // uncommitted ops of term 3 which never made it to this leader.
+  response.set_responder_term(4);
+  RefuseWithLogPropertyMismatch(&response, MakeOpId(3, 25), MinimumOpId());
+  response.mutable_status()->set_last_committed_idx(5);
+  response.mutable_status()->set_conflicting_term(3);
+  response.mutable_status()->set_conflicting_term_first_index(11);
+  ASSERT_TRUE(queue_->ResponseFromPeer(response.responder_uuid(), response));
+
+  // The next request skips term 3 altogether.
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs, &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_FALSE(needs_tablet_copy);
+  ASSERT_OPID_EQ(MakeOpId(1, 10), request.preceding_id());
+  ASSERT_EQ(10, request.ops_size());
+
+  // The messages still belong to the queue so we have to release them.
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops().size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops().size(), nullptr);
+#endif
+}
+
 // Test for a bug where we wouldn't move any watermark back, when overwriting
 // operations, which would cause a check failure on the write immediately
 // following the overwriting write.
@@ -1023,6 +1210,582 @@ TEST_F(ConsensusQueueTest, TestFollowerCommittedIndexAndMetrics) {
   ASSERT_EQ(5, queue_->metrics_.num_ops_behind_leader->value());
 }
 
+// Tests that a follower keeps the most recent ops which were replicated to
+// all peers cached with --log_cache_follower_retained_ops.
+TEST_F(ConsensusQueueTest, TestFollowerRetainsRecentOps) {
+  gflags::FlagSaver saver;
+  FLAGS_log_cache_follower_retained_ops = 4;
+  queue_->SetNonLeaderMode(BuildRaftConfigPBForTests(3));
+  queue_->UpdateLastIndexAppendedToLeader(10);
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+  queue_->UpdateFollowerWatermarks(/*committed_index=*/ 10,
+                                   /*all_replicated_index=*/ 10,
+                                   /*region_durable_index=*/-1);
+
+  // The next local ack evicts the ops replicated to all peers, except for the
+  // last four.
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 11, 1);
+  WaitForLocalPeerToAckIndex(11);
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_FALSE(queue_->log_cache()->IsCached(6));
+  });
+  for (int i = 7; i <= 11; i++) {
+    ASSERT_TRUE(queue_->log_cache()->IsCached(i)) << i;
+  }
+}
+
+// Tests that with adaptive batch sizing the batch size to a peer grows as the
+// peer acks full batches and shrinks when a request to it fails.
+TEST_F(ConsensusQueueTest, TestAdaptiveBatchSize) {
+  gflags::FlagSaver saver;
+  FLAGS_consensus_adaptive_batch_size = true;
+  FLAGS_consensus_adaptive_batch_min_bytes = 4096;
+  FLAGS_consensus_adaptive_batch_target_rtt_ms = 60 * 1000;
+
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100, /*payload_size=*/1000);
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(&request, &response, MakeOpId(0, 5), MinimumOpId(),
+                          &send_more_immediately);
+  ASSERT_TRUE(send_more_immediately);
+  ASSERT_EQ(4096, queue_->metrics_.min_peer_batch_size->value());
+  ASSERT_EQ(0, queue_->metrics_.min_peer_throughput->value());
+
+  // The first batch is limited to the minimum batch size.
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  int first_batch_ops = request.ops_size();
+  ASSERT_GT(first_batch_ops, 0);
+  ASSERT_LT(first_batch_ops, 5);
+
+  // Acking it quickly doubles the batch size.
+  SetLastReceivedAndLastCommitted(&response, request.ops(first_batch_ops - 1).id());
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(8192, queue_->metrics_.min_peer_batch_size->value());
+  ASSERT_GT(queue_->metrics_.min_peer_throughput->value(), 0);
+
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_GT(request.ops_size(), first_batch_ops);
+
+  // A timed out request halves it.
+  queue_->UpdatePeerStatus(kPeerUuid, PeerStatus::RPC_LAYER_ERROR,
+                           Status::TimedOut("timed out"));
+  ASSERT_EQ(4096, queue_->metrics_.min_peer_batch_size->value());
+
+  // extract the ops from the request to avoid double free
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+}
+
+// Tests that requests to a peer which is catching up are held to its budget,
+// and that a peer which is nearly caught up isn't.
+TEST_F(ConsensusQueueTest, TestCatchupThrottling) {
+  gflags::FlagSaver saver;
+  FLAGS_raft_heartbeat_interval_ms = 100;
+  FLAGS_consensus_catchup_min_lag_ops = 10;
+  FLAGS_consensus_catchup_peer_bytes_per_sec = 100 * 1000;
+
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100, /*payload_size=*/1000);
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(&request, &response, MakeOpId(0, 5), MinimumOpId(),
+                          &send_more_immediately);
+
+  // The budget grants 10KB over a heartbeat interval, which the first
+  // request uses up.
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_GT(request.ops_size(), 0);
+  ASSERT_LT(request.ops_size(), 10);
+  OpId last_sent = request.ops(request.ops_size() - 1).id();
+
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_EQ(0, request.ops_size());
+  ASSERT_EQ(1, queue_->metrics_.catchup_throttled_requests->value());
+
+  // The peer waits for its next heartbeat rather than being sent more.
+  SetLastReceivedAndLastCommitted(&response, last_sent);
+  ASSERT_FALSE(queue_->ResponseFromPeer(response.responder_uuid(), response));
+
+  // A peer which is nearly caught up isn't subject to the budget.
+  FLAGS_consensus_catchup_min_lag_ops = 1000;
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_GT(request.ops_size(), 0);
+  ASSERT_EQ(1, queue_->metrics_.catchup_throttled_requests->value());
+
+  // extract the ops from the request to avoid double free
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+}
+
+// Tests that the successor of a fast leadership transfer is sent the rest of
+// the log without regard for its catch-up budget, and only while the transfer
+// is in progress.
+TEST_F(ConsensusQueueTest, TestFastLeaderTransferIgnoresCatchupBudget) {
+  gflags::FlagSaver saver;
+  FLAGS_raft_heartbeat_interval_ms = 100;
+  FLAGS_consensus_catchup_min_lag_ops = 10;
+  FLAGS_consensus_catchup_peer_bytes_per_sec = 100 * 1000;
+  FLAGS_raft_fast_leader_transfer = true;
+
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100, /*payload_size=*/1000);
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(&request, &response, MakeOpId(0, 5), MinimumOpId(),
+                          &send_more_immediately);
+  ASSERT_FALSE(queue_->IsFastTransferTarget(kPeerUuid));
+
+  queue_->BeginWatchForSuccessor(
+      string(kPeerUuid), nullptr,
+      {std::chrono::system_clock::now(), kLeaderUuid, false});
+  ASSERT_TRUE(queue_->IsFastTransferTarget(kPeerUuid));
+
+  // The whole tail fits in one full-size batch, where the budget would have
+  // allowed about 10KB.
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_EQ(95, request.ops_size());
+  ASSERT_EQ(0, queue_->metrics_.catchup_throttled_requests->value());
+
+  // Once the transfer is over, the peer is subject to the budget again.
+  queue_->EndWatchForSuccessor();
+  ASSERT_FALSE(queue_->IsFastTransferTarget(kPeerUuid));
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_LT(request.ops_size(), 10);
+
+  // extract the ops from the request to avoid double free
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+}
+
+// Tests that with --raft_learner_fast_catchup a learner which is catching up
+// waits while a voter is catching up too, and is then sent full-size batches
+// without regard for the per-peer catch-up budget.
+TEST_F(ConsensusQueueTest, TestLearnerFastCatchup) {
+  gflags::FlagSaver saver;
+  FLAGS_raft_heartbeat_interval_ms = 100;
+  FLAGS_consensus_catchup_min_lag_ops = 10;
+  FLAGS_raft_learner_fast_catchup = true;
+  const string kLearnerUuid = "non-voter-peer-0";
+
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm,
+                        BuildRaftConfigPBForTests(/*num_voters=*/ 2,
+                                                  /*num_non_voters=*/ 1));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100, /*payload_size=*/1000);
+
+  // Both the voter and the learner have only the first 5 ops.
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(&request, &response, MakeOpId(0, 5), MinimumOpId(),
+                          &send_more_immediately);
+
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  queue_->TrackPeer(MakePeer(kLearnerUuid, RaftPeerPB::NON_VOTER));
+  ASSERT_OK(queue_->RequestForPeer(kLearnerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ConsensusResponsePB learner_response;
+  learner_response.set_responder_uuid(kLearnerUuid);
+  RefuseWithLogPropertyMismatch(&learner_response, MakeOpId(0, 5), MinimumOpId());
+  learner_response.mutable_status()->set_last_committed_idx(5);
+  queue_->ResponseFromPeer(kLearnerUuid, learner_response);
+
+  // The learner waits while the voter is catching up.
+  ASSERT_OK(queue_->RequestForPeer(kLearnerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_EQ(0, request.ops_size());
+  ASSERT_EQ(1, queue_->metrics_.learner_catchup_deferred_requests->value());
+
+  // Catch the voter up.
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_EQ(95, request.ops_size());
+  response.set_responder_uuid(kPeerUuid);
+  SetLastReceivedAndLastCommitted(&response, request.ops(request.ops_size() - 1).id());
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+
+  // Now the learner is sent the whole tail in one full-size batch, where the
+  // per-peer budget would have allowed about 10KB.
+  FLAGS_consensus_catchup_peer_bytes_per_sec = 100 * 1000;
+  ASSERT_OK(queue_->RequestForPeer(kLearnerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_EQ(95, request.ops_size());
+  ASSERT_TRUE(queue_->IsLearnerCatchingUp(kLearnerUuid));
+  ASSERT_FALSE(queue_->IsLearnerCatchingUp(kPeerUuid));
+  ASSERT_EQ(1, queue_->metrics_.learner_catchup_deferred_requests->value());
+  ASSERT_EQ(0, queue_->metrics_.catchup_throttled_requests->value());
+
+  // extract the ops from the request to avoid double free
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+}
+
+// Tests that requests to a peer are sized to the bytes it advertises it can
+// accept, and carry no ops while it advertises none.
+TEST_F(ConsensusQueueTest, TestPeerAdvertisedAvailableBytes) {
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100, /*payload_size=*/1000);
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(&request, &response, MakeOpId(0, 5), MinimumOpId(),
+                          &send_more_immediately);
+
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(0, 5));
+  response.set_available_bytes(0);
+  ASSERT_FALSE(queue_->ResponseFromPeer(response.responder_uuid(), response));
+
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_EQ(0, request.ops_size());
+
+  // Once the peer has room again, the batch is sized to fit it.
+  response.set_available_bytes(5000);
+  ASSERT_TRUE(queue_->ResponseFromPeer(response.responder_uuid(), response));
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_GT(request.ops_size(), 0);
+  ASSERT_LE(request.ops_size(), 5);
+
+  // extract the ops from the request to avoid double free
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+}
+
+// Tests that ops a peer reports having, e.g. in a CANNOT_PREPARE response,
+// aren't sent to it again, unless the reported op isn't in the leader's log.
+TEST_F(ConsensusQueueTest, TestSkipOpsReceivedByPeer) {
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(2));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 100);
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(&request, &response, MakeOpId(0, 5), MinimumOpId(),
+                          &send_more_immediately);
+
+  // Index 20 is in term 2 in our log.
+  queue_->SkipOpsReceivedByPeer(kPeerUuid, MakeOpId(1, 20));
+  queue_->SkipOpsReceivedByPeer(kPeerUuid, MakeOpId(1, 10));
+
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  std::string next_hop_uuid;
+  ASSERT_OK(queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                   &needs_tablet_copy, &next_hop_uuid));
+  ASSERT_OPID_EQ(MakeOpId(1, 10), request.preceding_id());
+  ASSERT_GT(request.ops_size(), 0);
+  ASSERT_EQ(11, request.ops(0).id().index());
+
+  // extract the ops from the request to avoid double free
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  request.mutable_ops()->UnsafeArenaExtractSubrange(
+      0, request.ops_size(), nullptr);
+#else
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
+#endif
+}
+
+// Tests that the send time acked by a majority of the voters is tracked for
+// the leader's lease, and that acks can be disregarded from a point in time.
+TEST_F(ConsensusQueueTest, TestMajorityAckedSendTime) {
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  ASSERT_FALSE(queue_->GetMajorityAckedSendTime().Initialized());
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(&request, &response, MakeOpId(0, 5), MinimumOpId(),
+                          &send_more_immediately);
+  // A refused request doesn't count.
+  ASSERT_FALSE(queue_->GetMajorityAckedSendTime().Initialized());
+
+  MonoTime send_time = MonoTime::Now();
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(0, 5));
+  queue_->ResponseFromPeer(response.responder_uuid(), response, send_time);
+  ASSERT_TRUE(send_time == queue_->GetMajorityAckedSendTime());
+
+  queue_->DiscardAcksSentBefore(send_time + MonoDelta::FromMilliseconds(1));
+  ASSERT_FALSE(queue_->GetMajorityAckedSendTime().Initialized());
+}
+
+// Tests the index up to which the logs of a majority of voters are known to
+// extend, as sent to followers for them to decide whether to pre-vote.
+TEST_F(ConsensusQueueTest, TestVotersMajorityLogIndex) {
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  AppendReplicateMessagesToQueue(queue_.get(), clock_, 1, 10);
+  WaitForLocalPeerToAckIndex(10);
+  // Only the leader is known.
+  ASSERT_EQ(-1, queue_->GetVotersMajorityLogIndex());
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  UpdatePeerWatermarkToOp(&request, &response, MakeOpId(0, 5), MinimumOpId(),
+                          &send_more_immediately);
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(0, 5));
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  // The leader and "peer-1" are a majority, and the longer log of the two
+  // ends at 10.
+  ASSERT_EQ(10, queue_->GetVotersMajorityLogIndex());
+
+  queue_->TrackPeer(MakePeer("peer-2", RaftPeerPB::VOTER));
+  response.set_responder_uuid("peer-2");
+  SetLastReceivedAndLastCommitted(&response, MakeOpId(0, 3));
+  queue_->ResponseFromPeer(response.responder_uuid(), response);
+  ASSERT_EQ(5, queue_->GetVotersMajorityLogIndex());
+
+  queue_->SetNonLeaderMode(BuildRaftConfigPBForTests(3));
+  ASSERT_EQ(-1, queue_->GetVotersMajorityLogIndex());
+}
+
+// Tests that a batch sent to several peers is serialized once, and that the
+// serialized ops parse back into a request.
+TEST_F(ConsensusQueueTest, TestSerializeOpsForPeers) {
+  vector<ReplicateRefPtr> msgs;
+  for (int i = 1; i <= 3; i++) {
+    msgs.emplace_back(make_scoped_refptr_replicate(
+        CreateDummyReplicate(1, i, clock_->Now(), 100).release()));
+  }
+  std::shared_ptr<const string> buf = queue_->SerializeOpsForPeers(msgs);
+  ASSERT_EQ(buf, queue_->SerializeOpsForPeers(msgs));
+
+  // A different batch gets a buffer of its own.
+  vector<ReplicateRefPtr> fewer_msgs(msgs.begin(), msgs.begin() + 2);
+  ASSERT_NE(buf, queue_->SerializeOpsForPeers(fewer_msgs));
+
+  ConsensusRequestPB request;
+  ASSERT_TRUE(request.ParsePartialFromString(*buf));
+  ASSERT_EQ(3, request.ops_size());
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(pb_util::SecureShortDebugString(*msgs[i]->get()),
+              pb_util::SecureShortDebugString(request.ops(i)));
+  }
+}
+
+// An observer whose first commit index notification blocks until released.
+class BlockingCommitObserver : public PeerMessageQueueObserver {
+ public:
+  BlockingCommitObserver() : entered_(1), release_(1) {}
+
+  void NotifyCommitIndex(int64_t committed_index) override {
+    if (commit_indexes_.empty()) {
+      commit_indexes_.push_back(committed_index);
+      entered_.CountDown();
+      release_.Wait();
+      return;
+    }
+    commit_indexes_.push_back(committed_index);
+  }
+  void NotifyTermChange(int64_t /*term*/) override {}
+  void NotifyFailedFollower(const string& /*peer_uuid*/, int64_t /*term*/,
+                            const string& /*reason*/) override {}
+  void NotifyPeerToPromote(const string& /*peer_uuid*/) override {}
+  void NotifyPeerToStartElection(
+      const string& /*peer_uuid*/,
+      boost::optional<PeerMessageQueue::TransferContext> /*transfer_context*/) override {}
+  void NotifyPeerHealthChange() override {}
+  void NotifyProxyTopologyChange(const ProxyTopologyPB& /*proxy_topology*/) override {}
+  void NotifyPeerNeedsSnapshot(const string& /*peer_uuid*/,
+                               int64_t /*snapshot_index*/) override {}
+
+  CountDownLatch entered_;
+  CountDownLatch release_;
+  vector<int64_t> commit_indexes_;
+};
+
+// Tests that commit index notifications posted while one is being delivered
+// are coalesced into a single delivery of the latest index.
+TEST_F(ConsensusQueueTest, TestCoalescedObserverNotifications) {
+  FLAGS_consensus_coalesce_observer_notifications = true;
+  BlockingCommitObserver observer;
+  queue_->RegisterObserver(&observer);
+
+  queue_->NotifyObserversOfCommitIndexChange(1);
+  observer.entered_.Wait();
+  for (int64_t i = 2; i <= 100; i++) {
+    queue_->NotifyObserversOfCommitIndexChange(i);
+  }
+  observer.release_.CountDown();
+  raft_pool_->Wait();
+
+  ASSERT_EQ(vector<int64_t>({ 1, 100 }), observer.commit_indexes_);
+  ASSERT_OK(queue_->UnRegisterObserver(&observer));
+}
+
+// An observer which records the snapshot indexes peers are reported to need.
+class SnapshotObserver : public PeerMessageQueueObserver {
+ public:
+  void NotifyCommitIndex(int64_t /*committed_index*/) override {}
+  void NotifyTermChange(int64_t /*term*/) override {}
+  void NotifyFailedFollower(const string& /*peer_uuid*/, int64_t /*term*/,
+                            const string& /*reason*/) override {}
+  void NotifyPeerToPromote(const string& /*peer_uuid*/) override {}
+  void NotifyPeerToStartElection(
+      const string& /*peer_uuid*/,
+      boost::optional<PeerMessageQueue::TransferContext> /*transfer_context*/) override {}
+  void NotifyPeerHealthChange() override {}
+  void NotifyProxyTopologyChange(const ProxyTopologyPB& /*proxy_topology*/) override {}
+  void NotifyPeerNeedsSnapshot(const string& peer_uuid, int64_t snapshot_index) override {
+    snapshot_requests_.emplace_back(peer_uuid, snapshot_index);
+  }
+
+  vector<std::pair<string, int64_t>> snapshot_requests_;
+};
+
+// Tests that a peer which needs ops GCed from the log below the snapshot
+// index is reported as needing the snapshot, once per snapshot index.
+TEST_F(ConsensusQueueTest, TestPeerBehindGCedLogNeedsSnapshot) {
+  OpId opid = MakeOpId(1, 1);
+  for (int i = 1; i <= 100; i++) {
+    ASSERT_OK(log::AppendNoOpToLogSync(clock_, log_.get(), &opid));
+    if (i % 10 == 0) {
+      ASSERT_OK(log_->AllocateSegmentAndRollOver());
+    }
+  }
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+  int32_t num_gced;
+  ASSERT_OK(log_->GC(log::RetentionIndexes(51, 51), &num_gced));
+  ASSERT_GT(num_gced, 0);
+
+  OpId last_logged_opid = MakeOpId(opid.term(), opid.index() - 1);
+  CloseAndReopenQueue(last_logged_opid, last_logged_opid);
+  queue_->SetLeaderMode(last_logged_opid.index(),
+                        last_logged_opid.term(),
+                        BuildRaftConfigPBForTests(3));
+  queue_->SetSnapshotIndex(50);
+  SnapshotObserver observer;
+  queue_->RegisterObserver(&observer);
+
+  ConsensusRequestPB request;
+  ConsensusResponsePB response;
+  response.set_responder_uuid(kPeerUuid);
+  bool send_more_immediately = false;
+  ASSERT_NO_FATAL_FAILURE(UpdatePeerWatermarkToOp(&request,
+                                                  &response,
+                                                  MakeOpId(1, 20),
+                                                  MinimumOpId(),
+                                                  &send_more_immediately));
+
+  vector<ReplicateRefPtr> refs;
+  bool needs_tablet_copy;
+  string next_hop_uuid;
+  for (int i = 0; i < 2; i++) {
+    Status s = queue_->RequestForPeer(kPeerUuid, /*read_ops=*/true, &request, &refs,
+                                      &needs_tablet_copy, &next_hop_uuid);
+    ASSERT_TRUE(s.IsNotFound()) << s.ToString();
+  }
+  raft_pool_->Wait();
+  ASSERT_EQ(1, observer.snapshot_requests_.size());
+  ASSERT_EQ(kPeerUuid, observer.snapshot_requests_[0].first);
+  ASSERT_EQ(50, observer.snapshot_requests_[0].second);
+  ASSERT_OK(queue_->UnRegisterObserver(&observer));
+}
+
+// Unit test for PeerWatermarks keeping the peers' indexes sorted by group.
+TEST(ConsensusQueueUnitTest, PeerWatermarks) {
+  auto state = [](bool ok, bool voter, int64_t index, const string& region) {
+    PeerWatermarks::PeerState s;
+    s.ok = ok;
+    s.voter = voter;
+    s.index = index;
+    s.region = region;
+    s.quorum_id = region;
+    return s;
+  };
+
+  PeerWatermarks watermarks;
+  watermarks.Update("a", state(true, true, 7, "r1"));
+  watermarks.Update("b", state(true, true, 3, "r2"));
+  watermarks.Update("c", state(true, false, 5, "r1"));
+  watermarks.Update("d", state(false, true, 9, "r1"));
+  ASSERT_EQ(vector<int64_t>({ 3, 5, 7 }), watermarks.all());
+  ASSERT_EQ(vector<int64_t>({ 3, 7 }), watermarks.voters());
+  ASSERT_EQ(2, watermarks.voters_by_region().size());
+  ASSERT_EQ(vector<int64_t>({ 7 }), watermarks.voters_by_region().at("r1"));
+
+  // A peer which advances moves within the arrays.
+  watermarks.Update("b", state(true, true, 8, "r2"));
+  ASSERT_EQ(vector<int64_t>({ 5, 7, 8 }), watermarks.all());
+  ASSERT_EQ(vector<int64_t>({ 7, 8 }), watermarks.voters());
+
+  // A peer whose exchange failed stops being counted, and regions without
+  // counted voters are left out.
+  watermarks.Update("b", state(false, true, 8, "r2"));
+  ASSERT_EQ(vector<int64_t>({ 7 }), watermarks.voters());
+  ASSERT_EQ(0, watermarks.voters_by_region().count("r2"));
+
+  // A peer whose exchange succeeds again is counted again.
+  watermarks.Update("d", state(true, true, 9, "r1"));
+  ASSERT_EQ(vector<int64_t>({ 7, 9 }), watermarks.voters_by_quorum().at("r1"));
+
+  watermarks.Remove("a");
+  ASSERT_EQ(vector<int64_t>({ 5, 9 }), watermarks.all());
+  ASSERT_EQ(vector<int64_t>({ 9 }), watermarks.voters());
+}
+
 // Unit test for the PeerMessageQueue::PeerHealthStatus() method.
 TEST(ConsensusQueueUnitTest, PeerHealthStatus) {
   static constexpr PeerStatus kPeerStatusesForUnknown[] = {
@@ -1084,5 +1847,36 @@ TEST(ConsensusQueueUnitTest, PeerHealthStatus) {
   EXPECT_EQ(HealthReportPB::FAILED_UNRECOVERABLE, PeerMessageQueue::PeerHealthStatus(peer));
 }
 
+// Unit test for the PeerMessageQueue::PeerHealthMayChange() method.
+TEST(ConsensusQueueUnitTest, PeerHealthMayChange) {
+  gflags::FlagSaver saver;
+  FLAGS_raft_prepare_replacement_before_eviction = true;
+  RaftPeerPB peer_pb;
+  PeerMessageQueue::TrackedPeer peer(peer_pb);
+  peer.last_exchange_status = PeerStatus::OK;
+  peer.last_overall_health_status = HealthReportPB::HEALTHY;
+  EXPECT_FALSE(PeerMessageQueue::PeerHealthMayChange(peer, false, false));
+  EXPECT_FALSE(PeerMessageQueue::PeerHealthMayChange(peer, true, false));
+
+  // Catching up the WAL resets a requested snapshot, and failing to catch it
+  // up makes the peer unrecoverable.
+  peer.snapshot_requested_index = 10;
+  EXPECT_TRUE(PeerMessageQueue::PeerHealthMayChange(peer, true, false));
+  peer.snapshot_requested_index = -1;
+  EXPECT_TRUE(PeerMessageQueue::PeerHealthMayChange(peer, false, true));
+
+  // A peer which stopped answering fails.
+  peer.last_communication_time -=
+      MonoDelta::FromSeconds(FLAGS_follower_unavailable_considered_failed_sec + 1);
+  EXPECT_TRUE(PeerMessageQueue::PeerHealthMayChange(peer, false, false));
+  peer.last_overall_health_status = HealthReportPB::FAILED;
+  EXPECT_FALSE(PeerMessageQueue::PeerHealthMayChange(peer, false, false));
+
+  // Without replacement before eviction, a failed peer is re-evaluated each
+  // time, for it to be evicted once that's safe.
+  FLAGS_raft_prepare_replacement_before_eviction = false;
+  EXPECT_TRUE(PeerMessageQueue::PeerHealthMayChange(peer, false, false));
+}
+
 }  // namespace consensus
 }  // namespace kudu
@@ -24,9 +24,11 @@
 #include "kudu/consensus/consensus_queue.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -37,6 +39,8 @@
 #include <boost/optional/optional_io.hpp>
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
+#include <google/protobuf/arena.h>
+#include <google/protobuf/util/message_differencer.h>
 
 #include "kudu/common/common.pb.h"
 #include "kudu/common/timestamp.h"
@@ -44,9 +48,12 @@
 #include "kudu/consensus/log.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/packed_ops.h"
+#include "kudu/consensus/proxy_policy.h"
 #include "kudu/consensus/quorum_util.h"
 #include "kudu/consensus/routing.h"
 #include "kudu/consensus/time_manager.h"
+#include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/dynamic_annotations.h"
@@ -57,17 +64,83 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/jsonwriter.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/op_timeline.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/threadpool.h"
+#include "kudu/util/throttler.h"
 #include "kudu/util/url-coding.h"
 
 DEFINE_int32(consensus_max_batch_size_bytes, 1024 * 1024,
              "The maximum per-tablet RPC batch size when updating peers.");
 TAG_FLAG(consensus_max_batch_size_bytes, advanced);
 
+DEFINE_bool(consensus_adaptive_batch_size, false,
+            "Whether to size the batches of ops sent to each peer according to "
+            "how quickly the peer acks them, between "
+            "--consensus_adaptive_batch_min_bytes and "
+            "--consensus_max_batch_size_bytes, instead of always filling "
+            "batches up to --consensus_max_batch_size_bytes.");
+TAG_FLAG(consensus_adaptive_batch_size, experimental);
+TAG_FLAG(consensus_adaptive_batch_size, runtime);
+
+DEFINE_int32(consensus_adaptive_batch_min_bytes, 64 * 1024,
+             "The smallest batch size which adaptive batch sizing shrinks to, "
+             "and which it starts each peer at.");
+TAG_FLAG(consensus_adaptive_batch_min_bytes, experimental);
+TAG_FLAG(consensus_adaptive_batch_min_bytes, runtime);
+
+DEFINE_int32(consensus_adaptive_batch_target_rtt_ms, 200,
+             "With adaptive batch sizing, the batch size to a peer grows while "
+             "the peer acks full batches within this many milliseconds, and "
+             "shrinks when acks take longer.");
+TAG_FLAG(consensus_adaptive_batch_target_rtt_ms, experimental);
+TAG_FLAG(consensus_adaptive_batch_target_rtt_ms, runtime);
+
+DEFINE_int64(consensus_catchup_peer_bytes_per_sec, 0,
+             "The most bytes of ops per second which the leader sends to each "
+             "peer which is catching up, i.e. lags the leader's log by at least "
+             "--consensus_catchup_min_lag_ops ops. 0 means unlimited.");
+TAG_FLAG(consensus_catchup_peer_bytes_per_sec, experimental);
+TAG_FLAG(consensus_catchup_peer_bytes_per_sec, runtime);
+
+DEFINE_int64(consensus_catchup_region_bytes_per_sec, 0,
+             "The most bytes of ops per second which the leader sends to all "
+             "the peers of a region which are catching up, together. Peers "
+             "which are nearly caught up aren't counted against the budget, so "
+             "that it doesn't hold back replication to the healthy peers of the "
+             "region. 0 means unlimited.");
+TAG_FLAG(consensus_catchup_region_bytes_per_sec, experimental);
+TAG_FLAG(consensus_catchup_region_bytes_per_sec, runtime);
+
+DEFINE_int64(consensus_catchup_min_lag_ops, 1000,
+             "Peers which lag the leader's log by at least this many ops are "
+             "considered to be catching up, and are subject to "
+             "--consensus_catchup_peer_bytes_per_sec and "
+             "--consensus_catchup_region_bytes_per_sec.");
+TAG_FLAG(consensus_catchup_min_lag_ops, experimental);
+TAG_FLAG(consensus_catchup_min_lag_ops, runtime);
+
+DEFINE_int32(consensus_prefetch_batches_for_lagging_peers, 0,
+             "When a peer needs ops which are no longer in the log cache, the "
+             "leader reads up to this many batches of the following ops from "
+             "the log in the background, so that the next requests to the peer "
+             "don't wait on disk reads. 0 disables prefetching.");
+TAG_FLAG(consensus_prefetch_batches_for_lagging_peers, experimental);
+
+DEFINE_bool(consensus_prefetch_async_log_reads, false,
+            "Whether the ops prefetched for a lagging peer are read straight from "
+            "the log with a single asynchronous read of the whole "
+            "--consensus_prefetch_batches_for_lagging_peers range, rather than a "
+            "batch at a time through the log cache. Lets a derived log serve the "
+            "range from its own IO threads.");
+TAG_FLAG(consensus_prefetch_async_log_reads, experimental);
+TAG_FLAG(consensus_prefetch_async_log_reads, runtime);
+TAG_FLAG(consensus_prefetch_batches_for_lagging_peers, runtime);
+
 DEFINE_int32(follower_unavailable_considered_failed_sec, 300,
              "Seconds that a leader is unable to successfully heartbeat to a "
              "follower after which the follower is considered to be failed and "
@@ -82,7 +155,16 @@ DEFINE_int32(consensus_inject_latency_ms_in_notifications, 0,
 TAG_FLAG(consensus_inject_latency_ms_in_notifications, hidden);
 TAG_FLAG(consensus_inject_latency_ms_in_notifications, unsafe);
 
+DEFINE_bool(consensus_coalesce_observer_notifications, false,
+            "Whether commit index, term and peer health change notifications "
+            "from the consensus queue are coalesced, so that at most one of "
+            "each is pending on the notification thread at a time and it "
+            "delivers only the latest commit index or term.");
+TAG_FLAG(consensus_coalesce_observer_notifications, experimental);
+TAG_FLAG(consensus_coalesce_observer_notifications, runtime);
+
 DECLARE_int32(consensus_rpc_timeout_ms);
+DECLARE_int32(raft_heartbeat_interval_ms);
 DECLARE_bool(safe_time_advancement_without_writes);
 DECLARE_bool(raft_prepare_replacement_before_eviction);
 DECLARE_bool(raft_attempt_to_replace_replica_without_majority);
@@ -94,16 +176,105 @@ DEFINE_bool(synchronous_transfer_leadership, false,
 // FB - warning - this is disabled in upstream Mysql raft, because automatic
 // health management of peers is risky. It also reduces contention on consensus
 // queue lock, as it does not have to be reacquired.
+DEFINE_bool(consensus_incremental_peer_health, false,
+            "Whether the health of a peer is re-evaluated under the queue lock, "
+            "after a request is built for it, only when it may have changed, "
+            "and whether ReportHealthOfPeers() reads a snapshot of the peers' "
+            "health, republished on each change, rather than taking the queue "
+            "lock.");
+TAG_FLAG(consensus_incremental_peer_health, experimental);
+TAG_FLAG(consensus_incremental_peer_health, runtime);
+
 DEFINE_bool(update_peer_health_status, true,
             "After every request for peer, maintain the health status of the peer "
             " This can be used to evict an irrecovarable peer");
 
 TAG_FLAG(synchronous_transfer_leadership, advanced);
+
+DEFINE_bool(raft_fast_leader_transfer, false,
+            "Whether a leadership transfer to a designated successor pushes the "
+            "rest of the leader's log to it as fast as possible: with full-size "
+            "batches, exempt from adaptive batch sizing and catch-up throttling, "
+            "and pipelined up to --raft_fast_leader_transfer_inflight_requests "
+            "deep, so that the successor is told to start its election as soon "
+            "as it acks the leader's last op.");
+TAG_FLAG(raft_fast_leader_transfer, experimental);
+TAG_FLAG(raft_fast_leader_transfer, runtime);
+
+DEFINE_bool(raft_learner_fast_catchup, false,
+            "Whether learners, i.e. NON_VOTER peers, which are catching up "
+            "with the leader are sent full-size batches, exempt from adaptive "
+            "batch sizing and the per-peer catch-up budget, read ahead from "
+            "the log and pipelined up to "
+            "--raft_learner_catchup_inflight_requests deep, within the budget "
+            "of --raft_learner_catchup_bytes_per_sec. Learners wait while any "
+            "voter is catching up, and a learner to be promoted is only "
+            "promoted once its lag has stopped growing.");
+TAG_FLAG(raft_learner_fast_catchup, experimental);
+TAG_FLAG(raft_learner_fast_catchup, runtime);
+
+DEFINE_int64(raft_learner_catchup_bytes_per_sec, 0,
+             "The most bytes of ops per second which the leader sends to all "
+             "the learners catching up under --raft_learner_fast_catchup, "
+             "together. 0 means unlimited.");
+TAG_FLAG(raft_learner_catchup_bytes_per_sec, experimental);
+TAG_FLAG(raft_learner_catchup_bytes_per_sec, runtime);
+
+DEFINE_int32(raft_learner_catchup_prefetch_batches, 8,
+             "The number of batches of ops read ahead from the log for a "
+             "learner catching up under --raft_learner_fast_catchup, if more "
+             "than --consensus_prefetch_batches_for_lagging_peers.");
+TAG_FLAG(raft_learner_catchup_prefetch_batches, experimental);
+TAG_FLAG(raft_learner_catchup_prefetch_batches, runtime);
+
+DEFINE_bool(raft_lmp_term_hints, false,
+            "Whether the leader, when a peer whose log has diverged reports "
+            "the term its log conflicts in, resumes sending at the first op "
+            "of that term in the peer's log instead of after the peer's "
+            "committed index.");
+TAG_FLAG(raft_lmp_term_hints, experimental);
+TAG_FLAG(raft_lmp_term_hints, runtime);
+
+DEFINE_bool(raft_cost_based_proxy_topology, false,
+            "Whether the leader builds the proxy topology used under "
+            "DURABLE_ROUTING_POLICY itself, from the measured round trip time, "
+            "throughput and health of its links to the peers, choosing the "
+            "cheapest healthy peer of each remote region to proxy for the rest "
+            "of the region, and rebuilding it when a proxy degrades.");
+TAG_FLAG(raft_cost_based_proxy_topology, experimental);
+TAG_FLAG(raft_cost_based_proxy_topology, runtime);
+
+DEFINE_int32(raft_cost_based_proxy_topology_interval_ms, 5000,
+             "How often, at most, the leader rebuilds the proxy topology with "
+             "--raft_cost_based_proxy_topology.");
+TAG_FLAG(raft_cost_based_proxy_topology_interval_ms, experimental);
+TAG_FLAG(raft_cost_based_proxy_topology_interval_ms, runtime);
+
+DEFINE_double(raft_cost_based_proxy_switch_ratio, 1.5,
+              "With --raft_cost_based_proxy_topology, how many times the round "
+              "trip time of the best candidate a region's current proxy may "
+              "have before it is replaced.");
+TAG_FLAG(raft_cost_based_proxy_switch_ratio, experimental);
+TAG_FLAG(raft_cost_based_proxy_switch_ratio, runtime);
+
+DEFINE_int32(log_cache_follower_retained_ops, 0,
+             "The number of the most recent ops replicated to all peers which a "
+             "follower keeps in its log cache, rather than evicting them, so "
+             "that if it's elected leader it can catch lagging peers up "
+             "without reading its log. These ops count towards the log cache "
+             "memory limits, and are the first to go under memory pressure.");
+TAG_FLAG(log_cache_follower_retained_ops, experimental);
+TAG_FLAG(log_cache_follower_retained_ops, runtime);
 DECLARE_bool(enable_flexi_raft);
+DECLARE_bool(raft_pre_vote_hints);
+DECLARE_bool(raft_witness_metadata_only_log);
+DECLARE_bool(log_cache_deferred_truncation);
 
+using google::protobuf::util::MessageDifferencer;
 using kudu::log::Log;
 using kudu::pb_util::SecureDebugString;
 using kudu::pb_util::SecureShortDebugString;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::unordered_map;
@@ -124,6 +295,29 @@ METRIC_DEFINE_gauge_int64(server, in_progress_ops, "Operations in Progress",
 METRIC_DEFINE_gauge_int64(server, ops_behind_leader, "Operations Behind Leader",
                           MetricUnit::kOperations,
                           "Number of operations this server believes it is behind the leader.");
+METRIC_DEFINE_gauge_int64(server, min_peer_batch_size, "Smallest Peer Batch Size",
+                          MetricUnit::kBytes,
+                          "The smallest adaptive batch size among the peers of this leader. "
+                          "Zero if adaptive batch sizing is disabled or this is not a leader.");
+METRIC_DEFINE_gauge_int64(server, min_peer_throughput, "Lowest Peer Throughput",
+                          MetricUnit::kBytes,
+                          "The lowest rate, in bytes per second, at which a peer of this "
+                          "leader acks batches of operations. Zero if adaptive batch sizing "
+                          "is disabled, this is not a leader or no batch has been timed.");
+METRIC_DEFINE_counter(server, catchup_throttled_requests, "Catch-up Throttled Requests",
+                      MetricUnit::kRequests,
+                      "Number of requests to peers catching up with this leader which were "
+                      "sent without operations because the peer or its region was over its "
+                      "catch-up bandwidth budget.");
+METRIC_DEFINE_counter(server, prefetched_ops_sent, "Prefetched Operations Sent",
+                      MetricUnit::kOperations,
+                      "Number of operations sent to lagging peers which had been read ahead "
+                      "from the log rather than read when the request was built.");
+METRIC_DEFINE_counter(server, learner_catchup_deferred_requests,
+                      "Learner Catch-up Deferred Requests",
+                      MetricUnit::kRequests,
+                      "Number of requests to learners catching up with this leader which "
+                      "were sent without operations because a voter was catching up too.");
 
 const char* PeerStatusToString(PeerStatus p) {
   switch (p) {
@@ -141,6 +335,90 @@ const char* PeerStatusToString(PeerStatus p) {
   return "<unknown>";
 }
 
+namespace {
+
+// How often the lag of a learner to be promoted is sampled under
+// --raft_learner_fast_catchup, to tell whether it is keeping pace.
+const int64_t kLearnerPaceSampleIntervalMs = 1000;
+
+void InsertSorted(vector<int64_t>* v, int64_t index) {
+  v->insert(std::upper_bound(v->begin(), v->end(), index), index);
+}
+
+void EraseSorted(vector<int64_t>* v, int64_t index) {
+  auto it = std::lower_bound(v->begin(), v->end(), index);
+  DCHECK(it != v->end() && *it == index);
+  v->erase(it);
+}
+
+void EraseSorted(std::map<string, vector<int64_t>>* groups,
+                 const string& group, int64_t index) {
+  auto it = groups->find(group);
+  DCHECK(it != groups->end());
+  EraseSorted(&it->second, index);
+  if (it->second.empty()) {
+    groups->erase(it);
+  }
+}
+
+} // anonymous namespace
+
+void PeerWatermarks::Update(const string& uuid, PeerState state) {
+  auto it = peers_.find(uuid);
+  if (it != peers_.end()) {
+    if (it->second == state) {
+      return;
+    }
+    Subtract(it->second);
+    it->second = std::move(state);
+    Add(it->second);
+    return;
+  }
+  Add(state);
+  peers_.emplace(uuid, std::move(state));
+}
+
+void PeerWatermarks::Remove(const string& uuid) {
+  auto it = peers_.find(uuid);
+  if (it == peers_.end()) {
+    return;
+  }
+  Subtract(it->second);
+  peers_.erase(it);
+}
+
+void PeerWatermarks::Clear() {
+  peers_.clear();
+  all_.clear();
+  voters_.clear();
+  voters_by_region_.clear();
+  voters_by_quorum_.clear();
+}
+
+void PeerWatermarks::Add(const PeerState& state) {
+  if (!state.ok) {
+    return;
+  }
+  InsertSorted(&all_, state.index);
+  if (state.voter) {
+    InsertSorted(&voters_, state.index);
+    InsertSorted(&voters_by_region_[state.region], state.index);
+    InsertSorted(&voters_by_quorum_[state.quorum_id], state.index);
+  }
+}
+
+void PeerWatermarks::Subtract(const PeerState& state) {
+  if (!state.ok) {
+    return;
+  }
+  EraseSorted(&all_, state.index);
+  if (state.voter) {
+    EraseSorted(&voters_, state.index);
+    EraseSorted(&voters_by_region_, state.region, state.index);
+    EraseSorted(&voters_by_quorum_, state.quorum_id, state.index);
+  }
+}
+
 PeerMessageQueue::TrackedPeer::TrackedPeer(RaftPeerPB peer_pb)
     : peer_pb(std::move(peer_pb)),
       next_index(kInvalidOpIdIndex),
@@ -149,19 +427,32 @@ PeerMessageQueue::TrackedPeer::TrackedPeer(RaftPeerPB peer_pb)
       last_exchange_status(PeerStatus::NEW),
       last_communication_time(MonoTime::Now()),
       wal_catchup_possible(true),
+      snapshot_requested_index(-1),
       last_overall_health_status(HealthReportPB::UNKNOWN),
       status_log_throttler(std::make_shared<logging::LogThrottler>()),
+      batch_size_bytes(FLAGS_consensus_adaptive_batch_min_bytes),
+      throughput_bytes_per_sec(0),
+      batch_sample_last_index(kInvalidOpIdIndex),
+      batch_sample_bytes(0),
+      catchup_throttled(false),
+      learner_catching_up(false),
+      learner_lag_sample(-1),
+      learner_keeping_pace(false),
+      available_bytes(-1),
+      rtt_us(0),
       last_seen_term_(0) {
 }
 
 std::string PeerMessageQueue::TrackedPeer::ToString() const {
   return Substitute("Peer: $0, Status: $1, Last received: $2, Next index: $3, "
-                    "Last known committed idx: $4, Time since last communication: $5",
+                    "Last known committed idx: $4, Time since last communication: $5, "
+                    "Batch size: $6, Throughput: $7 bytes/s",
                     SecureShortDebugString(peer_pb),
                     PeerStatusToString(last_exchange_status),
                     OpIdToString(last_received), next_index,
                     last_known_committed_index,
-                    (MonoTime::Now() - last_communication_time).ToString());
+                    (MonoTime::Now() - last_communication_time).ToString(),
+                    batch_size_bytes, throughput_bytes_per_sec);
 }
 
 #define INSTANTIATE_METRIC(x) \
@@ -169,7 +460,13 @@ std::string PeerMessageQueue::TrackedPeer::ToString() const {
 PeerMessageQueue::Metrics::Metrics(const scoped_refptr<MetricEntity>& metric_entity)
   : num_majority_done_ops(INSTANTIATE_METRIC(METRIC_majority_done_ops)),
     num_in_progress_ops(INSTANTIATE_METRIC(METRIC_in_progress_ops)),
-    num_ops_behind_leader(INSTANTIATE_METRIC(METRIC_ops_behind_leader)) {
+    num_ops_behind_leader(INSTANTIATE_METRIC(METRIC_ops_behind_leader)),
+    min_peer_batch_size(INSTANTIATE_METRIC(METRIC_min_peer_batch_size)),
+    min_peer_throughput(INSTANTIATE_METRIC(METRIC_min_peer_throughput)),
+    catchup_throttled_requests(METRIC_catchup_throttled_requests.Instantiate(metric_entity)),
+    prefetched_ops_sent(METRIC_prefetched_ops_sent.Instantiate(metric_entity)),
+    learner_catchup_deferred_requests(
+        METRIC_learner_catchup_deferred_requests.Instantiate(metric_entity)) {
 }
 #undef INSTANTIATE_METRIC
 
@@ -188,6 +485,7 @@ PeerMessageQueue::PeerMessageQueue(const scoped_refptr<MetricEntity>& metric_ent
       routing_table_container_(std::move(routing_table_container)),
       tablet_id_(std::move(tablet_id)),
       adjust_voter_distribution_(true),
+      queue_lock_("PeerMessageQueue::queue_lock_"),
       successor_watch_in_progress_(false),
       log_cache_(metric_entity, std::move(log), local_peer_pb_.permanent_uuid(), tablet_id_),
       metrics_(metric_entity),
@@ -210,20 +508,27 @@ PeerMessageQueue::PeerMessageQueue(const scoped_refptr<MetricEntity>& metric_ent
   queue_state_.state = kQueueOpen;
   // TODO(mpercy): Merge LogCache::Init() with its constructor.
   log_cache_.Init(queue_state_.last_appended);
+  PublishQueueStateUnlocked();
 
   CHECK_OK(persistent_vars_manager->LoadPersistentVars(tablet_id_,
                                                        &persistent_vars_));
 }
 
+void PeerMessageQueue::SetPrefetchPoolToken(
+    unique_ptr<ThreadPoolToken> prefetch_pool_token) {
+  DCHECK(!prefetch_pool_token_);
+  prefetch_pool_token_ = std::move(prefetch_pool_token);
+}
+
 void PeerMessageQueue::SetProxyFailureThreshold(
     int32_t proxy_failure_threshold_ms) {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   proxy_failure_threshold_ms_ = proxy_failure_threshold_ms;
 }
 
 void PeerMessageQueue::SetProxyFailureThresholdLag(
     int32_t proxy_failure_threshold_lag) {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   proxy_failure_threshold_lag_ = proxy_failure_threshold_lag;
 }
 
@@ -256,7 +561,7 @@ bool PeerMessageQueue::HasProxyPeerFailedUnlocked(
 void PeerMessageQueue::SetLeaderMode(int64_t committed_index,
                                      int64_t current_term,
                                      const RaftConfigPB& active_config) {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   if (current_term != queue_state_.current_term) {
     CHECK_GT(current_term, queue_state_.current_term) << "Terms should only increase";
     queue_state_.first_index_in_current_term = boost::none;
@@ -266,27 +571,40 @@ void PeerMessageQueue::SetLeaderMode(int64_t committed_index,
   queue_state_.committed_index = committed_index;
   queue_state_.majority_replicated_index = committed_index;
   queue_state_.active_config.reset(new RaftConfigPB(active_config));
-  queue_state_.majority_size_ = MajoritySize(CountVoters(*queue_state_.active_config));
+  queue_state_.active_config_view = std::make_shared<const RaftConfigView>(active_config);
+  queue_state_.majority_size_ = queue_state_.active_config_view->majority_size();
   queue_state_.mode = LEADER;
+  // Acks of requests sent before this leadership, or before its config,
+  // prove nothing about it.
+  const MonoTime now = MonoTime::Now();
+  if (!ack_send_time_floor_.Initialized() || now > ack_send_time_floor_) {
+    ack_send_time_floor_ = now;
+  }
 
   TrackLocalPeerUnlocked();
+  RebuildPeerWatermarksUnlocked();
   CheckPeersInActiveConfigIfLeaderUnlocked();
+  prefetch_buffers_.clear();
+  cost_based_proxy_topology_.Clear();
+  last_proxy_topology_rebuild_ = MonoTime();
+  PublishQueueStateUnlocked();
 
   LOG_WITH_PREFIX_UNLOCKED(INFO) << "Queue going to LEADER mode. State: "
                                  << queue_state_.ToString();
 
   // Reset last communication time with all peers to reset the clock on the
   // failure timeout.
-  const auto now = MonoTime::Now();
   for (const PeersMap::value_type& entry : peers_map_) {
     entry.second->last_communication_time = now;
   }
+  UpdateBatchMetricsUnlocked();
   time_manager_->SetLeaderMode();
 }
 
 void PeerMessageQueue::SetNonLeaderMode(const RaftConfigPB& active_config) {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   queue_state_.active_config.reset(new RaftConfigPB(active_config));
+  queue_state_.active_config_view = std::make_shared<const RaftConfigView>(active_config);
   queue_state_.mode = NON_LEADER;
   queue_state_.majority_size_ = -1;
 
@@ -294,6 +612,10 @@ void PeerMessageQueue::SetNonLeaderMode(const RaftConfigPB& active_config) {
   queue_state_.last_idx_appended_to_leader = queue_state_.last_appended.index();
 
   TrackLocalPeerUnlocked();
+  RebuildPeerWatermarksUnlocked();
+  UpdateBatchMetricsUnlocked();
+  prefetch_buffers_.clear();
+  PublishQueueStateUnlocked();
 
   LOG_WITH_PREFIX_UNLOCKED(INFO) << "Queue going to NON_LEADER mode. State: "
                                  << queue_state_.ToString();
@@ -302,7 +624,7 @@ void PeerMessageQueue::SetNonLeaderMode(const RaftConfigPB& active_config) {
 }
 
 void PeerMessageQueue::TrackPeer(const RaftPeerPB& peer_pb) {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   TrackPeerUnlocked(peer_pb);
 }
 
@@ -323,23 +645,34 @@ void PeerMessageQueue::TrackPeerUnlocked(const RaftPeerPB& peer_pb) {
   // process will eventually find the right point to resume from.
   tracked_peer->next_index = queue_state_.last_appended.index() + 1;
   InsertOrDie(&peers_map_, tracked_peer->uuid(), tracked_peer);
+  SyncPeerWatermarksUnlocked(*tracked_peer);
 
   CheckPeersInActiveConfigIfLeaderUnlocked();
+  UpdateBatchMetricsUnlocked();
 
   // We don't know how far back this peer is, so set the all replicated watermark to
   // 0. We'll advance it when we know how far along the peer is.
   queue_state_.all_replicated_index = 0;
+  PublishQueueStateUnlocked();
+  PublishHealthSnapshotUnlocked();
 }
 
 void PeerMessageQueue::UntrackPeer(const string& uuid) {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   UntrackPeerUnlocked(uuid);
 }
 
 void PeerMessageQueue::UntrackPeerUnlocked(const string& uuid) {
   DCHECK(queue_lock_.is_locked());
   TrackedPeer* peer = EraseKeyReturnValuePtr(&peers_map_, uuid);
+  bool was_tracked = peer != nullptr;
   delete peer; // Deleting a nullptr is safe.
+  peer_watermarks_.Remove(uuid);
+  prefetch_buffers_.erase(uuid);
+  UpdateBatchMetricsUnlocked();
+  if (was_tracked) {
+    PublishHealthSnapshotUnlocked();
+  }
 }
 
 void PeerMessageQueue::TrackLocalPeerUnlocked() {
@@ -369,10 +702,20 @@ void PeerMessageQueue::TrackLocalPeerUnlocked() {
 }
 
 unordered_map<string, HealthReportPB> PeerMessageQueue::ReportHealthOfPeers() const {
+  if (FLAGS_consensus_incremental_peer_health) {
+    shared_ptr<const unordered_map<string, HealthReportPB>> snapshot =
+        std::atomic_load(&health_snapshot_);
+    return snapshot ? *snapshot : unordered_map<string, HealthReportPB>();
+  }
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+  return HealthReportsUnlocked();
+}
+
+unordered_map<string, HealthReportPB> PeerMessageQueue::HealthReportsUnlocked() const {
+  DCHECK(queue_lock_.is_locked());
   unordered_map<string, HealthReportPB> reports;
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
   for (const auto& entry : peers_map_) {
-    const string& peer_uuid = entry.first;
+    const string& peer_uuid = entry.second->uuid();
     const TrackedPeer* peer = entry.second;
     HealthReportPB report;
     auto overall_health = peer->last_overall_health_status;
@@ -387,6 +730,14 @@ unordered_map<string, HealthReportPB> PeerMessageQueue::ReportHealthOfPeers() co
   return reports;
 }
 
+void PeerMessageQueue::PublishHealthSnapshotUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  std::atomic_store(&health_snapshot_,
+                    shared_ptr<const unordered_map<string, HealthReportPB>>(
+                        std::make_shared<unordered_map<string, HealthReportPB>>(
+                            HealthReportsUnlocked())));
+}
+
 void PeerMessageQueue::CheckPeersInActiveConfigIfLeaderUnlocked() const {
   DCHECK(queue_lock_.is_locked());
   if (queue_state_.mode != LEADER) return;
@@ -395,10 +746,10 @@ void PeerMessageQueue::CheckPeersInActiveConfigIfLeaderUnlocked() const {
     InsertOrDie(&config_peer_uuids, peer_pb.permanent_uuid());
   }
   for (const PeersMap::value_type& entry : peers_map_) {
-    if (!ContainsKey(config_peer_uuids, entry.first)) {
+    if (!ContainsKey(config_peer_uuids, entry.second->uuid())) {
       LOG_WITH_PREFIX_UNLOCKED(FATAL) << Substitute("Peer $0 is not in the active config. "
                                                     "Queue state: $1",
-                                                    entry.first,
+                                                    entry.second->uuid(),
                                                     queue_state_.ToString());
     }
   }
@@ -413,10 +764,7 @@ void PeerMessageQueue::DoLocalPeerAppendFinished(const OpId& id) {
   fake_response.set_responder_uuid(local_peer_pb_.permanent_uuid());
   *fake_response.mutable_status()->mutable_last_received() = id;
   *fake_response.mutable_status()->mutable_last_received_current_leader() = id;
-  {
-    std::lock_guard<simple_spinlock> lock(queue_lock_);
-    fake_response.mutable_status()->set_last_committed_idx(queue_state_.committed_index);
-  }
+  fake_response.mutable_status()->set_last_committed_idx(GetCommittedIndex());
   ResponseFromPeer(local_peer_pb_.permanent_uuid(), fake_response);
 }
 
@@ -445,7 +793,7 @@ Status PeerMessageQueue::AppendOperations(const vector<ReplicateRefPtr>& msgs,
                                           const StatusCallback& log_append_callback) {
 
   DFAKE_SCOPED_LOCK(append_fake_lock_);
-  std::unique_lock<simple_spinlock> lock(queue_lock_);
+  std::unique_lock<profiled_adaptive_mutex> lock(queue_lock_);
 
   OpId last_id = msgs.back()->get()->id();
 
@@ -458,6 +806,7 @@ Status PeerMessageQueue::AppendOperations(const vector<ReplicateRefPtr>& msgs,
   // changes, so the refactor isn't trivial.
   for (const auto& msg : msgs) {
     const auto& id = msg->get()->id();
+    OpTimeline::Record(tablet_id_, id.term(), id.index(), OpTimeline::ENQUEUE);
     if (id.term() > queue_state_.current_term) {
       queue_state_.current_term = id.term();
       queue_state_.first_index_in_current_term = id.index();
@@ -489,6 +838,7 @@ Status PeerMessageQueue::AppendOperations(const vector<ReplicateRefPtr>& msgs,
   DCHECK(last_id.IsInitialized());
   queue_state_.last_appended = last_id;
   UpdateMetricsUnlocked();
+  PublishQueueStateUnlocked();
 
   return Status::OK();
 }
@@ -501,24 +851,274 @@ void PeerMessageQueue::TruncateOpsAfter(int64_t index) {
                               LogPrefixUnlocked(),
                               index));
   {
-    std::unique_lock<simple_spinlock> lock(queue_lock_);
+    std::unique_lock<profiled_adaptive_mutex> lock(queue_lock_);
     DCHECK(op.IsInitialized());
     queue_state_.last_appended = op;
+    PublishQueueStateUnlocked();
+    prefetch_buffers_.clear();
   }
   log_cache_.TruncateOpsAfter(op.index());
+  if (FLAGS_log_cache_deferred_truncation) {
+    // Free whatever the new leader's ops don't overwrite off this path.
+    WARN_NOT_OK(raft_pool_observers_token_->SubmitFunc([this]() {
+                  log_cache_.DropTruncatedOps();
+                }),
+                LogPrefixUnlocked() + "Unable to drop the truncated ops of the log cache");
+  }
 }
 
 OpId PeerMessageQueue::GetLastOpIdInLog() const {
-  std::unique_lock<simple_spinlock> lock(queue_lock_);
-  DCHECK(queue_state_.last_appended.IsInitialized());
-  return queue_state_.last_appended;
+  OpId last_appended;
+  int64_t current_term;
+  ReadPublishedLogState(&last_appended, &current_term);
+  return last_appended;
 }
 
 OpId PeerMessageQueue::GetNextOpId() const {
-  std::unique_lock<simple_spinlock> lock(queue_lock_);
+  OpId last_appended;
+  int64_t current_term;
+  ReadPublishedLogState(&last_appended, &current_term);
+  return MakeOpId(current_term, last_appended.index() + 1);
+}
+
+bool PeerMessageQueue::ReadPrefetchedOps(PrefetchBuffer* buffer, int64_t after_op_index,
+                                         int64_t max_size_bytes,
+                                         vector<ReplicateRefPtr>* messages,
+                                         OpId* preceding_id) {
+  std::lock_guard<simple_spinlock> l(buffer->lock);
+  const int64_t next_index = after_op_index + 1;
+  if (next_index < buffer->first_index || next_index >= buffer->end_index()) {
+    return false;
+  }
+  // The peer is past the ops before 'next_index', so they won't be sent again.
+  while (buffer->first_index < next_index) {
+    buffer->preceding_id = buffer->ops.front()->get()->id();
+    buffer->bytes -= buffer->op_bytes.front();
+    buffer->ops.pop_front();
+    buffer->op_bytes.pop_front();
+    buffer->first_index++;
+  }
+  *preceding_id = buffer->preceding_id;
+  int64_t remaining = max_size_bytes;
+  for (size_t i = 0; i < buffer->ops.size(); i++) {
+    remaining -= buffer->op_bytes[i];
+    if (remaining < 0 && !messages->empty()) {
+      break;
+    }
+    messages->push_back(buffer->ops[i]);
+  }
+  return true;
+}
+
+void PeerMessageQueue::MaybePrefetchForPeer(const string& uuid, const TrackedPeer& peer_copy,
+                                            int64_t next_index, int batches) {
+  if (batches <= 0 || !prefetch_pool_token_ ||
+      !log_cache_.HasOpBeenWritten(next_index) || log_cache_.IsCached(next_index)) {
+    return;
+  }
+
+  std::shared_ptr<PrefetchBuffer> buffer;
+  {
+    std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+    if (!ContainsKey(peers_map_, uuid)) {
+      return;
+    }
+    std::shared_ptr<PrefetchBuffer>& entry = prefetch_buffers_[uuid];
+    if (!entry) {
+      entry = std::make_shared<PrefetchBuffer>();
+    }
+    buffer = entry;
+  }
+
+  int64_t prefetch_from;
+  {
+    std::lock_guard<simple_spinlock> l(buffer->lock);
+    if (buffer->in_progress) {
+      return;
+    }
+    if (next_index >= buffer->first_index && next_index <= buffer->end_index()) {
+      // Top the buffer up once the peer has been sent half of it, counting the
+      // ops from 'next_index' on.
+      int64_t bytes_ahead = buffer->bytes;
+      for (int64_t i = buffer->first_index; i < next_index; i++) {
+        bytes_ahead -= buffer->op_bytes[i - buffer->first_index];
+      }
+      if (bytes_ahead * 2 >= static_cast<int64_t>(batches) *
+                             FLAGS_consensus_max_batch_size_bytes) {
+        return;
+      }
+      prefetch_from = buffer->end_index();
+    } else {
+      // The peer has moved somewhere else in the log: start over from there.
+      buffer->ops.clear();
+      buffer->op_bytes.clear();
+      buffer->bytes = 0;
+      buffer->first_index = next_index;
+      prefetch_from = next_index;
+    }
+    buffer->in_progress = true;
+  }
+
+  string host = peer_copy.peer_pb.last_known_addr().host();
+  int port = peer_copy.peer_pb.last_known_addr().port();
+  Status s = prefetch_pool_token_->SubmitFunc(
+      [this, buffer, prefetch_from, batches, uuid, host, port]() {
+    PrefetchOpsTask(buffer, prefetch_from, batches, uuid, host, port);
+  });
+  if (PREDICT_FALSE(!s.ok())) {
+    std::lock_guard<simple_spinlock> l(buffer->lock);
+    buffer->in_progress = false;
+  }
+}
+
+void PeerMessageQueue::PrefetchOpsTask(const std::shared_ptr<PrefetchBuffer>& buffer,
+                                       int64_t next_index, int batches, const string& uuid,
+                                       const string& host, int port) {
+  ReadContext read_context;
+  read_context.for_peer_uuid = &uuid;
+  read_context.for_peer_host = &host;
+  read_context.for_peer_port = port;
+
+  const int max_batch_size = FLAGS_consensus_max_batch_size_bytes;
+  if (FLAGS_consensus_prefetch_async_log_reads) {
+    Status s = log_cache_.AsyncReadOpsFromLog(
+        next_index - 1, static_cast<int64_t>(batches) * max_batch_size, read_context,
+        [this, buffer, next_index, uuid](const Status& s, const OpId& preceding_id,
+                                         vector<ReplicateRefPtr>* messages) {
+          std::lock_guard<simple_spinlock> l(buffer->lock);
+          if (s.ok() && !messages->empty()) {
+            AddPrefetchedOpsUnlocked(buffer.get(), next_index, preceding_id, messages);
+          } else {
+            VLOG_WITH_PREFIX_UNLOCKED(1) << "Unable to prefetch ops from " << next_index
+                                         << " for peer " << uuid << ": " << s.ToString();
+          }
+          buffer->in_progress = false;
+        });
+    if (PREDICT_FALSE(!s.ok())) {
+      VLOG_WITH_PREFIX_UNLOCKED(1) << "Unable to prefetch ops from " << next_index
+                                   << " for peer " << uuid << ": " << s.ToString();
+      std::lock_guard<simple_spinlock> l(buffer->lock);
+      buffer->in_progress = false;
+    }
+    return;
+  }
+
+  for (int i = 0; i < batches; i++) {
+    if (!log_cache_.HasOpBeenWritten(next_index) || log_cache_.IsCached(next_index)) {
+      break;
+    }
+    vector<ReplicateRefPtr> messages;
+    OpId preceding_id;
+    Status s = log_cache_.ReadOps(next_index - 1, max_batch_size, read_context,
+                                  &messages, &preceding_id);
+    if (!s.ok() || messages.empty()) {
+      VLOG_WITH_PREFIX_UNLOCKED(1) << "Unable to prefetch ops from " << next_index
+                                   << " for peer " << uuid << ": " << s.ToString();
+      break;
+    }
+
+    std::lock_guard<simple_spinlock> l(buffer->lock);
+    AddPrefetchedOpsUnlocked(buffer.get(), next_index, preceding_id, &messages);
+    next_index = buffer->end_index();
+  }
+
+  std::lock_guard<simple_spinlock> l(buffer->lock);
+  buffer->in_progress = false;
+}
+
+void PeerMessageQueue::AddPrefetchedOpsUnlocked(PrefetchBuffer* buffer, int64_t next_index,
+                                                const OpId& preceding_id,
+                                                vector<ReplicateRefPtr>* messages) {
+  DCHECK(buffer->lock.is_locked());
+  // The request path only ever drops ops from the front of the buffer, so
+  // the ops read always follow on from it.
+  DCHECK_EQ(next_index, buffer->end_index());
+  if (buffer->ops.empty()) {
+    buffer->preceding_id = preceding_id;
+  }
+  for (ReplicateRefPtr& msg : *messages) {
+    int64_t msg_bytes = msg->get()->ByteSizeLong();
+    buffer->ops.emplace_back(std::move(msg));
+    buffer->op_bytes.push_back(msg_bytes);
+    buffer->bytes += msg_bytes;
+  }
+}
+
+std::shared_ptr<Throttler> PeerMessageQueue::CatchupThrottler(CatchupBudget* budget,
+                                                             int64_t bytes_per_sec) {
+  if (bytes_per_sec <= 0) {
+    budget->bytes_per_sec = 0;
+    budget->throttler.reset();
+    return nullptr;
+  }
+  if (!budget->throttler || budget->bytes_per_sec != bytes_per_sec) {
+    // Let the budget accumulate over a heartbeat interval, so that a request
+    // of CatchupRequestBytes() fits in it.
+    double burst_factor = std::max(
+        1.0, FLAGS_raft_heartbeat_interval_ms * 1000.0 / Throttler::kRefillPeriodMicros);
+    budget->bytes_per_sec = bytes_per_sec;
+    budget->throttler = std::make_shared<Throttler>(MonoTime::Now(), 0, bytes_per_sec,
+                                                    burst_factor);
+  }
+  return budget->throttler;
+}
+
+int64_t PeerMessageQueue::CatchupRequestBytes(int64_t bytes_per_sec) {
+  int64_t period_us = std::max<int64_t>(FLAGS_raft_heartbeat_interval_ms * 1000LL,
+                                        Throttler::kRefillPeriodMicros);
+  // Rounded down to whole refill periods, as the throttler grants them.
+  int64_t periods = period_us / Throttler::kRefillPeriodMicros;
+  int64_t per_period = bytes_per_sec / (MonoTime::kMicrosecondsPerSecond /
+                                        Throttler::kRefillPeriodMicros);
+  return std::max<int64_t>(1, periods * per_period);
+}
+
+void PeerMessageQueue::PublishQueueStateUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  published_.committed_index.store(queue_state_.committed_index, std::memory_order_release);
+  published_.all_replicated_index.store(queue_state_.all_replicated_index,
+                                        std::memory_order_release);
+  published_.majority_replicated_index.store(queue_state_.majority_replicated_index,
+                                             std::memory_order_release);
+  published_.region_durable_index.store(queue_state_.region_durable_index,
+                                        std::memory_order_release);
+  published_.leader_mode.store(queue_state_.mode == LEADER, std::memory_order_release);
+  published_.committed_index_in_current_term.store(
+      queue_state_.first_index_in_current_term != boost::none &&
+      queue_state_.committed_index >= *queue_state_.first_index_in_current_term,
+      std::memory_order_release);
+
+  // Writers are serialized by 'queue_lock_'.
   DCHECK(queue_state_.last_appended.IsInitialized());
-  return MakeOpId(queue_state_.current_term,
-                  queue_state_.last_appended.index() + 1);
+  uint64_t seq = published_.log_state_seq.load(std::memory_order_relaxed);
+  published_.log_state_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  published_.last_appended_term.store(queue_state_.last_appended.term(),
+                                      std::memory_order_relaxed);
+  published_.last_appended_index.store(queue_state_.last_appended.index(),
+                                       std::memory_order_relaxed);
+  published_.current_term.store(queue_state_.current_term, std::memory_order_relaxed);
+  published_.log_state_seq.store(seq + 2, std::memory_order_release);
+}
+
+void PeerMessageQueue::ReadPublishedLogState(OpId* last_appended,
+                                             int64_t* current_term) const {
+  while (true) {
+    uint64_t seq = published_.log_state_seq.load(std::memory_order_acquire);
+    if (PREDICT_FALSE(seq & 1)) {
+      base::subtle::PauseCPU();
+      continue;
+    }
+    int64_t term = published_.last_appended_term.load(std::memory_order_relaxed);
+    int64_t index = published_.last_appended_index.load(std::memory_order_relaxed);
+    int64_t cur_term = published_.current_term.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (PREDICT_TRUE(published_.log_state_seq.load(std::memory_order_relaxed) == seq)) {
+      *last_appended = MakeOpId(term, index);
+      *current_term = cur_term;
+      return;
+    }
+  }
 }
 
 bool PeerMessageQueue::SafeToEvictUnlocked(const string& evict_uuid) const {
@@ -530,12 +1130,12 @@ bool PeerMessageQueue::SafeToEvictUnlocked(const string& evict_uuid) const {
   int remaining_viable_voters = 0;
 
   for (const auto& e : peers_map_) {
-    const auto& uuid = e.first;
+    const auto& uuid = e.second->uuid();
     const auto& peer = e.second;
     if (uuid == evict_uuid) {
       continue;
     }
-    if (!IsRaftConfigVoter(uuid, *queue_state_.active_config)) {
+    if (!queue_state_.active_config_view->IsVoter(uuid)) {
       continue;
     }
     remaining_voters++;
@@ -592,27 +1192,29 @@ void PeerMessageQueue::UpdatePeerHealthUnlocked(TrackedPeer* peer) {
 
   auto overall_health_status = PeerHealthStatus(*peer);
 
-  // Prepare error messages for different conditions.
-  string error_msg;
-  if (overall_health_status == HealthReportPB::FAILED ||
-      overall_health_status == HealthReportPB::FAILED_UNRECOVERABLE) {
+  // Prepares the error message for the different failure conditions. It's
+  // built only when it's logged or passed on.
+  auto failure_msg = [&]() -> string {
     if (peer->last_exchange_status == PeerStatus::TABLET_FAILED) {
-      error_msg = Substitute("The tablet replica hosted on peer $0 has failed", peer->uuid());
-    } else if (!peer->wal_catchup_possible) {
-      error_msg = Substitute("The logs necessary to catch up peer $0 have been "
-                             "garbage collected. The replica will never be able "
-                             "to catch up", peer->uuid());
-    } else {
-      error_msg = Substitute("Leader has been unable to successfully communicate "
-                             "with peer $0 for more than $1 seconds ($2)",
-                             peer->uuid(),
-                             FLAGS_follower_unavailable_considered_failed_sec,
-                             (MonoTime::Now() - peer->last_communication_time).ToString());
+      return Substitute("The tablet replica hosted on peer $0 has failed", peer->uuid());
     }
-  }
+    if (!peer->wal_catchup_possible) {
+      return Substitute("The logs necessary to catch up peer $0 have been "
+                        "garbage collected. The replica will never be able "
+                        "to catch up", peer->uuid());
+    }
+    return Substitute("Leader has been unable to successfully communicate "
+                      "with peer $0 for more than $1 seconds ($2)",
+                      peer->uuid(),
+                      FLAGS_follower_unavailable_considered_failed_sec,
+                      (MonoTime::Now() - peer->last_communication_time).ToString());
+  };
 
   bool changed = overall_health_status != peer->last_overall_health_status;
   peer->last_overall_health_status = overall_health_status;
+  if (changed) {
+    PublishHealthSnapshotUnlocked();
+  }
 
   if (FLAGS_raft_prepare_replacement_before_eviction) {
     // Only take action when there is a change.
@@ -620,7 +1222,7 @@ void PeerMessageQueue::UpdatePeerHealthUnlocked(TrackedPeer* peer) {
       // Only log a message when the status changes to some flavor of failure.
       if (overall_health_status == HealthReportPB::FAILED ||
           overall_health_status == HealthReportPB::FAILED_UNRECOVERABLE) {
-        LOG_WITH_PREFIX_UNLOCKED(INFO) << error_msg;
+        LOG_WITH_PREFIX_UNLOCKED(INFO) << failure_msg();
       }
       NotifyObserversOfPeerHealthChange();
     }
@@ -628,7 +1230,7 @@ void PeerMessageQueue::UpdatePeerHealthUnlocked(TrackedPeer* peer) {
     if ((overall_health_status == HealthReportPB::FAILED ||
          overall_health_status == HealthReportPB::FAILED_UNRECOVERABLE) &&
         SafeToEvictUnlocked(peer->uuid())) {
-      NotifyObserversOfFailedFollower(peer->uuid(), queue_state_.current_term, error_msg);
+      NotifyObserversOfFailedFollower(peer->uuid(), queue_state_.current_term, failure_msg());
     }
   }
 }
@@ -652,6 +1254,26 @@ void PeerMessageQueue::UpdatePeerHealthUnlocked(TrackedPeer* peer) {
 // However, once the replica falls behind the WAL log GC threshold, the system
 // should start reporting its healths status as FAILED_UNRECOVERABLE. The code
 // below is written to adhere to that informal policy.
+bool PeerMessageQueue::PeerHealthMayChange(const TrackedPeer& peer_copy,
+                                           bool wal_catchup_progress,
+                                           bool wal_catchup_failure) {
+  if (wal_catchup_progress &&
+      (!peer_copy.wal_catchup_possible || peer_copy.snapshot_requested_index != -1)) {
+    return true;
+  }
+  if (wal_catchup_failure && peer_copy.wal_catchup_possible) {
+    return true;
+  }
+  HealthReportPB::HealthStatus status = PeerHealthStatus(peer_copy);
+  if (status != peer_copy.last_overall_health_status) {
+    return true;
+  }
+  // Without replacement before eviction, a failed peer is checked for
+  // eviction on each evaluation rather than on a change only.
+  return !FLAGS_raft_prepare_replacement_before_eviction &&
+      (status == HealthReportPB::FAILED || status == HealthReportPB::FAILED_UNRECOVERABLE);
+}
+
 HealthReportPB::HealthStatus PeerMessageQueue::PeerHealthStatus(const TrackedPeer& peer) {
   // Replicas that have fallen behind the leader's retained WAL segments are
   // failed irrecoverably and will not come back because they cannot ever catch
@@ -688,7 +1310,7 @@ HealthReportPB::HealthStatus PeerMessageQueue::PeerHealthStatus(const TrackedPee
 }
 
 Status PeerMessageQueue::FindPeer(const std::string& uuid, TrackedPeer* peer) {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   TrackedPeer* peer_copy = FindPtrOrNull(peers_map_, uuid);
 
   if (peer_copy == nullptr)
@@ -703,14 +1325,23 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
                                         ConsensusRequestPB* request,
                                         vector<ReplicateRefPtr>* msg_refs,
                                         bool* needs_tablet_copy,
-                                        std::string* next_hop_uuid) {
+                                        std::string* next_hop_uuid,
+                                        int64_t pipelined_next_index) {
   // Maintain a thread-safe copy of necessary members.
   OpId preceding_id;
   int64_t current_term;
   TrackedPeer peer_copy;
   MonoDelta unreachable_time;
+  std::shared_ptr<Throttler> peer_catchup_throttler;
+  std::shared_ptr<Throttler> region_catchup_throttler;
+  std::shared_ptr<Throttler> learner_catchup_throttler;
+  int64_t catchup_request_bytes = std::numeric_limits<int64_t>::max();
+  std::shared_ptr<PrefetchBuffer> prefetch_buffer;
+  bool fast_transfer_target = false;
+  bool learner_catchup = false;
+  bool learner_deferred = false;
   {
-    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
     DCHECK_EQ(queue_state_.state, kQueueOpen);
     DCHECK_NE(uuid, local_peer_pb_.permanent_uuid());
 
@@ -719,7 +1350,46 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
       return Status::NotFound(Substitute("peer $0 is no longer tracked or "
                                          "queue is not in leader mode", uuid));
     }
+    // Peers far enough behind to be catching up draw on the catch-up budgets;
+    // the others, which keep up with the leader, don't. Neither does the
+    // successor of a fast leadership transfer, as writes are paused until it
+    // has caught up.
+    fast_transfer_target = IsFastTransferTargetUnlocked(uuid);
+    const int64_t lag = queue_state_.last_appended.index() + 1 -
+        std::max(peer->next_index, pipelined_next_index);
+    const bool catching_up = read_ops && !fast_transfer_target &&
+        peer->last_exchange_status != PeerStatus::NEW &&
+        lag >= FLAGS_consensus_catchup_min_lag_ops;
+    // A learner catching up has a budget of its own, shared with the other
+    // learners, in place of the per-peer one, and waits for the voters.
+    peer->learner_catching_up = catching_up && FLAGS_raft_learner_fast_catchup &&
+        IsLearnerUnlocked(uuid);
+    learner_catchup = peer->learner_catching_up;
+    if (learner_catchup) {
+      learner_deferred = AnyVoterCatchingUpUnlocked();
+      const int64_t learner_rate = FLAGS_raft_learner_catchup_bytes_per_sec;
+      learner_catchup_throttler = CatchupThrottler(&learner_catchup_budget_, learner_rate);
+      if (learner_catchup_throttler) {
+        catchup_request_bytes = CatchupRequestBytes(learner_rate);
+      }
+    }
+    if (catching_up) {
+      const int64_t peer_rate = learner_catchup ? 0 : FLAGS_consensus_catchup_peer_bytes_per_sec;
+      const int64_t region_rate = FLAGS_consensus_catchup_region_bytes_per_sec;
+      peer_catchup_throttler = CatchupThrottler(&peer->catchup_budget, peer_rate);
+      region_catchup_throttler = CatchupThrottler(
+          &region_catchup_budgets_[peer->peer_pb.attrs().region()], region_rate);
+      if (peer_catchup_throttler) {
+        catchup_request_bytes = std::min(catchup_request_bytes,
+                                         CatchupRequestBytes(peer_rate));
+      }
+      if (region_catchup_throttler) {
+        catchup_request_bytes = std::min(catchup_request_bytes,
+                                         CatchupRequestBytes(region_rate));
+      }
+    }
     peer_copy = *peer;
+    prefetch_buffer = FindWithDefault(prefetch_buffers_, uuid, nullptr);
 
     // Clear the requests without deleting the entries, as they may be in use by other peers.
 #if GOOGLE_PROTOBUF_VERSION >= 3017003
@@ -739,6 +1409,13 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
     request->set_last_idx_appended_to_leader(queue_state_.last_appended.index());
     request->set_caller_term(current_term);
     request->set_region_durable_index(queue_state_.region_durable_index);
+    int64_t voters_majority_log_index =
+        FLAGS_raft_pre_vote_hints ? GetVotersMajorityLogIndexUnlocked() : -1;
+    if (voters_majority_log_index >= 0) {
+      request->set_voters_majority_log_index(voters_majority_log_index);
+    } else {
+      request->clear_voters_majority_log_index();
+    }
     if(auto rpc_token = persistent_vars_->raft_rpc_token()) {
       request->set_raft_rpc_token(*rpc_token);
     }
@@ -754,9 +1431,11 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
       // works only on the leader. One solution could be for the leader to
       // periodically exchange the health report of all peers as part of
       // UpdateReplica() call
+      // Nor can a witness proxy, as it has no payloads to fill the ops in with.
       TrackedPeer* proxy_peer = FindPtrOrNull(peers_map_, *next_hop_uuid);
       if (proxy_peer == nullptr ||
-          HasProxyPeerFailedUnlocked(proxy_peer, peer)) {
+          HasProxyPeerFailedUnlocked(proxy_peer, peer) ||
+          (FLAGS_raft_witness_metadata_only_log && IsWitness(proxy_peer->peer_pb))) {
         *next_hop_uuid = uuid;
       }
     }
@@ -771,14 +1450,21 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
       if (!FLAGS_update_peer_health_status) {
         return;
       }
-      std::lock_guard<simple_spinlock> lock(queue_lock_);
+      if (FLAGS_consensus_incremental_peer_health &&
+          !PeerHealthMayChange(peer_copy, wal_catchup_progress, wal_catchup_failure)) {
+        return;
+      }
+      std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
       TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
       if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
         VLOG(1) << LogPrefixUnlocked() << "peer " << uuid
                 << " is no longer tracked or queue is not in leader mode";
         return;
       }
-      if (wal_catchup_progress) peer->wal_catchup_possible = true;
+      if (wal_catchup_progress) {
+        peer->wal_catchup_possible = true;
+        peer->snapshot_requested_index = -1;
+      }
       if (wal_catchup_failure) peer->wal_catchup_possible = false;
       UpdatePeerHealthUnlocked(peer);
     });
@@ -808,11 +1494,53 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
   // 'read_ops'), then we skip reading ops from log-cache/log. The caller
   // ususally does this when the leader detects that a peer is unhealthy and
   // hence needs to be degraded to a 'status-only' request
-  if (peer_copy.last_exchange_status != PeerStatus::NEW && read_ops) {
+  int64_t batch_size = FLAGS_consensus_max_batch_size_bytes;
+  const bool adaptive_batch_size = FLAGS_consensus_adaptive_batch_size;
+  if (adaptive_batch_size && !fast_transfer_target && !learner_catchup) {
+    batch_size = std::min(batch_size, peer_copy.batch_size_bytes);
+  }
+  batch_size = std::min(batch_size, catchup_request_bytes);
+  // A peer without room for any ops gets a status-only request until its
+  // responses advertise room again.
+  const bool peer_out_of_memory = peer_copy.available_bytes == 0;
+  if (peer_copy.available_bytes > 0) {
+    batch_size = std::min(batch_size, peer_copy.available_bytes);
+  }
+
+  // A peer which is catching up is charged for a full batch up front, since
+  // the size of the batch is only known once the ops have been read. The
+  // region's budget is charged first: shared by all the peers of the region,
+  // it is the scarcer of the two.
+  bool catchup_throttled = false;
+  if (learner_deferred) {
+    // A learner is only sent ops once no voter is catching up, so that it
+    // doesn't compete with the voters for the leader's bandwidth.
+    catchup_throttled = true;
+    metrics_.learner_catchup_deferred_requests->Increment();
+  } else if (peer_catchup_throttler || region_catchup_throttler || learner_catchup_throttler) {
+    MonoTime now = MonoTime::Now();
+    catchup_throttled =
+        (region_catchup_throttler && !region_catchup_throttler->Take(now, 0, batch_size)) ||
+        (learner_catchup_throttler && !learner_catchup_throttler->Take(now, 0, batch_size)) ||
+        (peer_catchup_throttler && !peer_catchup_throttler->Take(now, 0, batch_size));
+    if (catchup_throttled) {
+      metrics_.catchup_throttled_requests->Increment();
+    }
+  }
+  if (catchup_throttled != peer_copy.catchup_throttled) {
+    std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+    TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+    if (PREDICT_TRUE(peer != nullptr)) {
+      peer->catchup_throttled = catchup_throttled;
+    }
+  }
+
+  if (peer_copy.last_exchange_status != PeerStatus::NEW && read_ops && !catchup_throttled &&
+      !peer_out_of_memory) {
 
     // The batch of messages to send to the peer.
     vector<ReplicateRefPtr> messages;
-    int max_batch_size = FLAGS_consensus_max_batch_size_bytes - request->ByteSize();
+    int max_batch_size = batch_size - request->ByteSize();
 
     ReadContext read_context;
     read_context.for_peer_uuid = &uuid;
@@ -820,17 +1548,38 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
     read_context.for_peer_port = peer_copy.peer_pb.last_known_addr().port();
     read_context.route_via_proxy = route_via_proxy;
 
-    // We try to get the follower's next_index from our log.
-    Status s = log_cache_.ReadOps(peer_copy.next_index - 1,
-                                  max_batch_size,
-                                  read_context,
-                                  &messages,
-                                  &preceding_id);
+    // We try to get the follower's next_index from our log, or the op after
+    // the requests in flight if this one is pipelined behind them.
+    int64_t send_from_index = std::max(peer_copy.next_index, pipelined_next_index);
+    Status s;
+    if (prefetch_buffer && !route_via_proxy &&
+        ReadPrefetchedOps(prefetch_buffer.get(), send_from_index - 1, max_batch_size,
+                          &messages, &preceding_id)) {
+      metrics_.prefetched_ops_sent->IncrementBy(messages.size());
+    } else {
+      s = log_cache_.ReadOps(send_from_index - 1,
+                             max_batch_size,
+                             read_context,
+                             &messages,
+                             &preceding_id);
+    }
     if (PREDICT_FALSE(!s.ok())) {
       // It's normal to have a NotFound() here if a follower falls behind where
       // the leader has GCed its logs. The follower replica will hang around
       // for a while until it's evicted.
       if (PREDICT_TRUE(s.IsNotFound())) {
+        // If the missing ops are covered by the round handler's snapshot, the
+        // peer can still be caught up: from the snapshot, then from the log.
+        int64_t snapshot_index = snapshot_index_.load(std::memory_order_acquire);
+        if (snapshot_index >= 0 && snapshot_index >= send_from_index - 1) {
+          KLOG_EVERY_N_SECS_THROTTLER(INFO, 60, *peer_copy.status_log_throttler, "needs_snapshot")
+              << LogPrefixUnlocked()
+              << Substitute("The logs necessary to catch up peer $0 have been "
+                            "garbage collected. The follower needs the snapshot "
+                            "through index $1 ($2)", uuid, snapshot_index, s.ToString());
+          MaybeNotifyPeerNeedsSnapshot(uuid, snapshot_index);
+          return s;
+        }
         KLOG_EVERY_N_SECS_THROTTLER(INFO, 60, *peer_copy.status_log_throttler, "logs_gced")
             << LogPrefixUnlocked()
             << Substitute("The logs necessary to catch up peer $0 have been "
@@ -857,27 +1606,58 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
     // catchup is possible.
     wal_catchup_progress = true;
 
+    if (!route_via_proxy && !messages.empty()) {
+      int prefetch_batches = FLAGS_consensus_prefetch_batches_for_lagging_peers;
+      if (learner_catchup) {
+        prefetch_batches = std::max(prefetch_batches,
+                                    FLAGS_raft_learner_catchup_prefetch_batches);
+      }
+      MaybePrefetchForPeer(uuid, peer_copy, messages.back()->get()->id().index() + 1,
+                           prefetch_batches);
+    }
+
+    if (adaptive_batch_size && !messages.empty()) {
+      int64_t batch_bytes = 0;
+      for (const ReplicateRefPtr& msg : messages) {
+        batch_bytes += msg->get()->ByteSizeLong();
+      }
+      std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+      TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+      if (PREDICT_TRUE(peer != nullptr)) {
+        StartBatchSampleUnlocked(peer, messages.back()->get()->id().index(), batch_bytes);
+      }
+    }
+
     // We use AddAllocated rather than copy, because we pin the log cache at the
     // "all replicated" point. At some point we may want to allow partially loading
     // (and not pinning) earlier messages. At that point we'll need to do something
     // smarter here, like copy or ref-count.
     if (!route_via_proxy) {
       for (const ReplicateRefPtr& msg : messages) {
-        request->mutable_ops()->AddAllocated(msg->get());
+        // The message may be on the arena of the request it came in with, and
+        // AddAllocated() would copy it onto the heap.
+        request->mutable_ops()->UnsafeArenaAddAllocated(msg->get());
       }
       msg_refs->swap(messages);
     } else {
+      // The proxy ops of a request are allocated together on one arena.
+      auto arena = std::make_shared<google::protobuf::Arena>();
       vector<ReplicateRefPtr> proxy_ops;
       for (const ReplicateRefPtr& msg : messages) {
-        ReplicateRefPtr proxy_op = make_scoped_refptr_replicate(new ReplicateMsg);
+        ReplicateRefPtr proxy_op = make_scoped_refptr_replicate(
+            google::protobuf::Arena::CreateMessage<ReplicateMsg>(arena.get()), arena);
         *proxy_op->get()->mutable_id() = msg->get()->id();
         proxy_op->get()->set_timestamp(msg->get()->timestamp());
         proxy_op->get()->set_op_type(PROXY_OP);
-        request->mutable_ops()->AddAllocated(proxy_op->get());
+        request->mutable_ops()->UnsafeArenaAddAllocated(proxy_op->get());
         proxy_ops.emplace_back(std::move(proxy_op));
       }
       msg_refs->swap(proxy_ops);
     }
+    for (const ReplicateRefPtr& msg : *msg_refs) {
+      const OpId& id = msg->get()->id();
+      OpTimeline::Record(tablet_id_, id.term(), id.index(), OpTimeline::PEER_SEND, uuid);
+    }
   }
 
   DCHECK(preceding_id.IsInitialized());
@@ -929,7 +1709,7 @@ Status PeerMessageQueue::GetTabletCopyRequestForPeer(const string& uuid,
   TrackedPeer* peer = nullptr;
   int64_t current_term;
   {
-    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
     DCHECK_EQ(queue_state_.state, kQueueOpen);
     DCHECK_NE(uuid, local_peer_pb_.permanent_uuid());
     peer = FindPtrOrNull(peers_map_, uuid);
@@ -997,43 +1777,34 @@ void PeerMessageQueue::AdvanceQueueWatermark(const char* type,
   }
 
 
-  // Go through the peer's watermarks, we want the highest watermark that
-  // 'num_peers_required' of peers has replicated. To find this we do the
-  // following:
-  // - Store all the peer's 'last_received' in a vector
-  // - Sort the vector
-  // - Find the vector.size() - 'num_peers_required' position, this
-  //   will be the new 'watermark'.
-  std::vector<int64_t> watermarks;
-  for (const PeersMap::value_type& peer : peers_map_) {
-    if (replica_types == VOTER_REPLICAS &&
-        peer.second->peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
-    // TODO(todd): The fact that we only consider peers whose last exchange was
-    // successful can cause the "all_replicated" watermark to lag behind
-    // farther than necessary. For example:
-    // - local peer has replicated opid 100
-    // - remote peer A has replicated opid 100
-    // - remote peer B has replication opid 10 and is catching up
-    // - remote peer A goes down
-    // Here we'd start getting a non-OK last_exchange_status for peer A.
-    // In that case, the 'all_replicated_watermark', which requires 3 peers, would not
-    // be updateable, even once we've replicated peer 'B' up to opid 100. It would
-    // get "stuck" at 10. In fact, in this case, the 'majority_replicated_watermark' would
-    // also move *backwards* when peer A started getting errors.
-    //
-    // The issue with simply removing this condition is that 'last_received' does not
-    // perfectly correspond to the 'match_index' in Raft Figure 2. It is simply the
-    // highest operation in a peer's log, regardless of whether that peer currently
-    // holds a prefix of the leader's log. So, in the case that the last exchange
-    // was an error (LMP mismatch, for example), the 'last_received' is _not_ usable
-    // for watermark calculation. This could be fixed by separately storing the
-    // 'match_index' on a per-peer basis and using that for watermark calculation.
-    if (peer.second->last_exchange_status == PeerStatus::OK) {
-      watermarks.push_back(peer.second->last_received.index());
-    }
-  }
+  // We want the highest watermark that 'num_peers_required' of peers has
+  // replicated. 'peer_watermarks_' keeps the peers' 'last_received' indexes
+  // sorted, so this is the one at the watermarks.size() - 'num_peers_required'
+  // position.
+  //
+  // TODO(todd): The fact that we only consider peers whose last exchange was
+  // successful can cause the "all_replicated" watermark to lag behind
+  // farther than necessary. For example:
+  // - local peer has replicated opid 100
+  // - remote peer A has replicated opid 100
+  // - remote peer B has replication opid 10 and is catching up
+  // - remote peer A goes down
+  // Here we'd start getting a non-OK last_exchange_status for peer A.
+  // In that case, the 'all_replicated_watermark', which requires 3 peers, would not
+  // be updateable, even once we've replicated peer 'B' up to opid 100. It would
+  // get "stuck" at 10. In fact, in this case, the 'majority_replicated_watermark' would
+  // also move *backwards* when peer A started getting errors.
+  //
+  // The issue with simply counting all peers is that 'last_received' does not
+  // perfectly correspond to the 'match_index' in Raft Figure 2. It is simply the
+  // highest operation in a peer's log, regardless of whether that peer currently
+  // holds a prefix of the leader's log. So, in the case that the last exchange
+  // was an error (LMP mismatch, for example), the 'last_received' is _not_ usable
+  // for watermark calculation. This could be fixed by separately storing the
+  // 'match_index' on a per-peer basis and using that for watermark calculation.
+  DCHECK(PeerWatermarksMatchPeersUnlocked());
+  const std::vector<int64_t>& watermarks = replica_types == VOTER_REPLICAS ?
+      peer_watermarks_.voters() : peer_watermarks_.all();
 
   // If we haven't enough peers to calculate the watermark return.
   if (watermarks.size() < num_peers_required) {
@@ -1042,8 +1813,6 @@ void PeerMessageQueue::AdvanceQueueWatermark(const char* type,
     return;
   }
 
-  std::sort(watermarks.begin(), watermarks.end());
-
   int64_t new_watermark = watermarks[watermarks.size() - num_peers_required];
   int64_t old_watermark = *watermark;
   *watermark = new_watermark;
@@ -1064,7 +1833,7 @@ void PeerMessageQueue::AdvanceQueueWatermark(const char* type,
 
 int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
     const std::map<std::string, int>& voter_distribution,
-    const std::map<std::string, std::vector<int64_t> >& watermarks_by_region,
+    const std::map<std::string, std::vector<int64_t>>& watermarks_by_region,
     int64_t* watermark) {
   CHECK(watermark);
   CHECK(queue_state_.active_config->has_commit_rule());
@@ -1227,35 +1996,23 @@ int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
 
   const std::string& leader_quorum = getQuorumIdUsingCommitRule(local_peer_pb_);
 
-  // Compute the watermarks in leader quorum. As an example, at the end of this
-  // loop, watermarks_in_leader_quorum might have entries (3, 7, 5) which
-  // indicates that the leader quorum has 3 peers that have responded to OpId
-  // indexes 3, 7 and 5 respectively
-  std::vector<int64_t> watermarks_in_leader_quorum;
-  for (const PeersMap::value_type& peer : peers_map_) {
-    // Only voter members are considered for advancing watermark
-    if (peer.second->peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
-
-    // Refer to the comment in AdvanceQueueWatermark method for why only
-    // successful last exchanges are considered.
-    if (peer.second->last_exchange_status == PeerStatus::OK) {
-      const string& peer_quorum_id = getQuorumIdUsingCommitRule(peer.second->peer_pb);
-      if (peer_quorum_id == leader_quorum) {
-        watermarks_in_leader_quorum.push_back(
-            peer.second->last_received.index());
-      }
-    }
-  }
+  // The watermarks in leader quorum. As an example, watermarks_in_leader_quorum
+  // might have entries (3, 5, 7) which indicates that the leader quorum has 3
+  // peers that have responded to OpId indexes 3, 5 and 7 respectively. Only
+  // voter members whose last exchange was successful are counted (refer to
+  // the comment in AdvanceQueueWatermark method for why).
+  DCHECK(PeerWatermarksMatchPeersUnlocked());
+  static const std::vector<int64_t> kNoWatermarks;
+  const auto quorum_it = peer_watermarks_.voters_by_quorum().find(leader_quorum);
+  const std::vector<int64_t>& watermarks_in_leader_quorum =
+      quorum_it == peer_watermarks_.voters_by_quorum().end() ?
+      kNoWatermarks : quorum_it->second;
 
-  std::map<std::string, int> voter_distribution;
+  const RaftConfigView& config_view = *queue_state_.active_config_view;
 
   // Compute total number of voters in each region.
-  GetVoterDistributionForQuorumId(*(queue_state_.active_config), &voter_distribution);
-
   int total_voters_from_voter_distribution =
-    FindOrDie(voter_distribution, leader_quorum);
+    FindOrDie(config_view.quorum_id_voter_distribution(), leader_quorum);
 
   // Compute number of voters in each region in the active config.
   // As voter distribution provided in topology config can lag,
@@ -1263,22 +2020,8 @@ int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
   // membership changes.
   // Check for more comments in AdjustVoterDistributionWithCurrentVoters() which
   // does the same for static mode watermark calculation
-  int total_voters_from_active_config = 0;
-  for (const RaftPeerPB& peer_pb : queue_state_.active_config->peers()) {
-    if (!peer_pb.has_member_type() ||
-        peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
-
-    CHECK(peer_pb.has_permanent_uuid());
-    const std::string& peer_pb_quorum_id = getQuorumIdUsingCommitRule(peer_pb);
-    if (peer_pb_quorum_id != leader_quorum) {
-      // In dynamic mode, only the leader region matters
-      continue;
-    }
-
-    total_voters_from_active_config++;
-  }
+  int total_voters_from_active_config =
+      FindWithDefault(config_view.voters_per_quorum(), leader_quorum, 0);
 
   int total_voters = std::max(
       total_voters_from_voter_distribution, total_voters_from_active_config);
@@ -1308,10 +2051,6 @@ int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
     return *watermark;
   }
 
-  // Sort the watermarks
-  std::sort(
-      watermarks_in_leader_quorum.begin(), watermarks_in_leader_quorum.end());
-
   int64_t old_watermark = *watermark;
   *watermark = watermarks_in_leader_quorum[
       watermarks_in_leader_quorum.size() - commit_req];
@@ -1326,54 +2065,31 @@ int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
     return *watermark;
   }
 
-  // For each region, we compute a vector of indexes that were replicated.
-  // It might look like the following example:
+  // For each region, 'peer_watermarks_' keeps a sorted vector of indexes that
+  // were replicated. It might look like the following example:
   // prn: <4,4,5,7>
   // frc: <2,3,4>
   // lla: <5,5>
   // This example suggests that we received non-erroneous responses from 4
   // replicas in prn, 3 in frc and 2 in lla. Two replicas in prn have received
   // entries until index 4, one has received until 5 and one until 7. Similarly,
-  // 2 replicas in lla have received entries until index 5.
-  std::map<std::string, std::vector<int64_t> > watermarks_by_region;
-  for (const PeersMap::value_type& peer : peers_map_) {
-    if (peer.second->peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
-    // Refer to the comment in AdvanceQueueWatermark method for why only
-    // successful last exchanges are considered.
-    if (peer.second->last_exchange_status == PeerStatus::OK) {
-      const string& peer_region = peer.second->peer_pb.attrs().region();
-      std::vector<int64_t>& regional_watermarks = LookupOrInsert(
-          &watermarks_by_region, peer_region, std::vector<int64_t>());
-      regional_watermarks.push_back(peer.second->last_received.index());
-    }
-  }
-
-  // Sort all the watermarks.
-  for (std::map<std::string, std::vector<int64_t> >::iterator it =
-      watermarks_by_region.begin(); it != watermarks_by_region.end(); it++) {
-    std::sort(it->second.begin(), it->second.end());
-  }
-
-  // Map to store the number of voters in each region from the active config.
-  std::map<std::string, int> voter_distribution;
-
-  // Compute total number of voters in each region.
-  voter_distribution.insert(
-      queue_state_.active_config->voter_distribution().begin(),
-      queue_state_.active_config->voter_distribution().end());
-
+  // 2 replicas in lla have received entries until index 5. Only voters are
+  // counted, and only those whose last exchange was successful (refer to the
+  // comment in AdvanceQueueWatermark method for why).
+  DCHECK(PeerWatermarksMatchPeersUnlocked());
+  const std::map<std::string, std::vector<int64_t>>& watermarks_by_region =
+      peer_watermarks_.voters_by_region();
+
+  // The number of voters in each region from the active config.
+  //
   // adjust_voter_distribution_ is set to false on in cases where we want to
-  // perform an election forcefully i.e. unsafe config change
-  if (PREDICT_TRUE(adjust_voter_distribution_)) {
-    // Compute number of voters in each region in the active config.
-    // As voter distribution provided in topology config can lag,
-    // we need to take into account the active voters as well due to
-    // membership changes.
-    AdjustVoterDistributionWithCurrentVoters(
-        *(queue_state_.active_config), &voter_distribution);
-  }
+  // perform an election forcefully i.e. unsafe config change. Otherwise, as
+  // voter distribution provided in topology config can lag, we need to take
+  // into account the active voters as well due to membership changes.
+  const RaftConfigView& config_view = *queue_state_.active_config_view;
+  const std::map<std::string, int>& voter_distribution =
+      PREDICT_TRUE(adjust_voter_distribution_) ?
+      config_view.adjusted_voter_distribution() : config_view.voter_distribution();
 
   return DoComputeNewWatermarkStaticMode(
       voter_distribution, watermarks_by_region, watermark);
@@ -1416,7 +2132,7 @@ void PeerMessageQueue::BeginWatchForSuccessor(
     const boost::optional<string>& successor_uuid,
     const std::function<bool(const kudu::consensus::RaftPeerPB&)>& filter_fn,
     PeerMessageQueue::TransferContext transfer_context) {
-  std::lock_guard<simple_spinlock> l(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> l(queue_lock_);
 
   transfer_context_ = std::move(transfer_context);
   successor_watch_peer_notified_ = false;
@@ -1437,14 +2153,63 @@ void PeerMessageQueue::BeginWatchForSuccessor(
 }
 
 void PeerMessageQueue::EndWatchForSuccessor() {
-  std::lock_guard<simple_spinlock> l(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> l(queue_lock_);
   successor_watch_in_progress_ = false;
   transfer_context_ = boost::none;
   tl_filter_fn_ = nullptr;
 }
 
+bool PeerMessageQueue::IsFastTransferTarget(const string& peer_uuid) const {
+  std::lock_guard<profiled_adaptive_mutex> l(queue_lock_);
+  return IsFastTransferTargetUnlocked(peer_uuid);
+}
+
+bool PeerMessageQueue::IsFastTransferTargetUnlocked(const string& peer_uuid) const {
+  DCHECK(queue_lock_.is_locked());
+  return FLAGS_raft_fast_leader_transfer && successor_watch_in_progress_ &&
+      designated_successor_uuid_ && *designated_successor_uuid_ == peer_uuid;
+}
+
+bool PeerMessageQueue::IsLearnerCatchingUp(const string& peer_uuid) const {
+  std::lock_guard<profiled_adaptive_mutex> l(queue_lock_);
+  const TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_uuid);
+  return FLAGS_raft_learner_fast_catchup && peer != nullptr && peer->learner_catching_up;
+}
+
+bool PeerMessageQueue::IsLearnerUnlocked(const string& peer_uuid) const {
+  DCHECK(queue_lock_.is_locked());
+  if (!queue_state_.active_config_view) {
+    return false;
+  }
+  const RaftPeerPB* peer_pb = queue_state_.active_config_view->FindMember(peer_uuid);
+  return peer_pb != nullptr && peer_pb->member_type() == RaftPeerPB::NON_VOTER;
+}
+
+bool PeerMessageQueue::AnyVoterCatchingUpUnlocked() const {
+  DCHECK(queue_lock_.is_locked());
+  if (!queue_state_.active_config_view) {
+    return false;
+  }
+  for (const PeersMap::value_type& entry : peers_map_) {
+    const TrackedPeer* peer = entry.second;
+    if (peer->uuid() == local_peer_pb_.permanent_uuid() ||
+        peer->last_exchange_status == PeerStatus::NEW) {
+      continue;
+    }
+    const RaftPeerPB* peer_pb = queue_state_.active_config_view->FindMember(peer->uuid());
+    if (peer_pb == nullptr || peer_pb->member_type() != RaftPeerPB::VOTER) {
+      continue;
+    }
+    if (queue_state_.last_appended.index() + 1 - peer->next_index >=
+        FLAGS_consensus_catchup_min_lag_ops) {
+      return true;
+    }
+  }
+  return false;
+}
+
 bool PeerMessageQueue::WatchForSuccessorPeerNotified() {
-  std::lock_guard<simple_spinlock> l(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> l(queue_lock_);
   return successor_watch_peer_notified_;
 }
 
@@ -1454,10 +2219,69 @@ Status PeerMessageQueue::GetNextRoutingHopFromLeader(
       local_peer_pb_.permanent_uuid(), dest_uuid, next_hop);
 }
 
+std::shared_ptr<const string> PeerMessageQueue::SerializeOpsForPeers(
+    const vector<ReplicateRefPtr>& msgs, bool packed, bool delta) {
+  // Enough for the peers of a tablet which are caught up to share batches,
+  // without pinning many ops beyond what the log cache accounts for.
+  static const int kMaxSerializedBatches = 4;
+
+  auto same_ops = [&msgs, packed, delta](const SerializedOps& batch) {
+    if (batch.packed != packed || batch.delta != delta || batch.msgs.size() != msgs.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < msgs.size(); i++) {
+      if (batch.msgs[i].get() != msgs[i].get()) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  {
+    std::lock_guard<simple_spinlock> l(serialized_ops_lock_);
+    for (const SerializedOps& batch : serialized_ops_) {
+      if (same_ops(batch)) {
+        return batch.buf;
+      }
+    }
+  }
+
+  // Serialize outside of the lock. Peers racing to serialize the same batch
+  // may both do so, which is harmless.
+  auto buf = std::make_shared<string>();
+  if (packed) {
+    PackOps(msgs, buf.get(), delta);
+  } else {
+    ConsensusRequestPB ops_only;
+    for (const ReplicateRefPtr& msg : msgs) {
+      ops_only.mutable_ops()->UnsafeArenaAddAllocated(msg->get());
+    }
+    ops_only.SerializePartialToString(buf.get());
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    ops_only.mutable_ops()->UnsafeArenaExtractSubrange(0, ops_only.ops_size(), nullptr);
+#else
+    ops_only.mutable_ops()->ExtractSubrange(0, ops_only.ops_size(), nullptr);
+#endif
+  }
+
+  // The ops of an evicted batch may be the last references to them, so they
+  // are freed after the lock is released.
+  SerializedOps evicted;
+  {
+    std::lock_guard<simple_spinlock> l(serialized_ops_lock_);
+    serialized_ops_.push_front({ msgs, packed, delta, buf });
+    if (serialized_ops_.size() > kMaxSerializedBatches) {
+      evicted = std::move(serialized_ops_.back());
+      serialized_ops_.pop_back();
+    }
+  }
+  return buf;
+}
+
 void PeerMessageQueue::UpdateFollowerWatermarks(int64_t committed_index,
                                                 int64_t all_replicated_index,
                                                 int64_t region_durable_index) {
-  std::lock_guard<simple_spinlock> l(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> l(queue_lock_);
   DCHECK_EQ(queue_state_.mode, NON_LEADER);
   queue_state_.committed_index = committed_index;
   queue_state_.all_replicated_index = all_replicated_index;
@@ -1466,10 +2290,11 @@ void PeerMessageQueue::UpdateFollowerWatermarks(int64_t committed_index,
     queue_state_.region_durable_index = region_durable_index;
 
   UpdateMetricsUnlocked();
+  PublishQueueStateUnlocked();
 }
 
 void PeerMessageQueue::UpdateLastIndexAppendedToLeader(int64_t last_idx_appended_to_leader) {
-  std::lock_guard<simple_spinlock> l(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> l(queue_lock_);
   DCHECK_EQ(queue_state_.mode, NON_LEADER);
   queue_state_.last_idx_appended_to_leader = last_idx_appended_to_leader;
   UpdateLagMetricsUnlocked();
@@ -1478,7 +2303,7 @@ void PeerMessageQueue::UpdateLastIndexAppendedToLeader(int64_t last_idx_appended
 void PeerMessageQueue::UpdatePeerStatus(const string& peer_uuid,
                                         PeerStatus ps,
                                         const Status& status) {
-  std::unique_lock<simple_spinlock> l(queue_lock_);
+  std::unique_lock<profiled_adaptive_mutex> l(queue_lock_);
   TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_uuid);
   if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
     VLOG(1) << LogPrefixUnlocked() << "peer " << peer_uuid
@@ -1486,6 +2311,7 @@ void PeerMessageQueue::UpdatePeerStatus(const string& peer_uuid,
     return;
   }
   peer->last_exchange_status = ps;
+  SyncPeerWatermarksUnlocked(*peer);
 
   if (ps != PeerStatus::RPC_LAYER_ERROR) {
     // So long as we got _any_ response from the follower, we consider it a 'communication'.
@@ -1506,6 +2332,10 @@ void PeerMessageQueue::UpdatePeerStatus(const string& peer_uuid,
       // like shutdown and failure to deserialize a protobuf. Therefore, we
       // generally consider these errors to indicate an unreachable peer.
       DCHECK(!status.ok());
+      // Should it be a timeout, the batch may have been too large for the link.
+      if (FLAGS_consensus_adaptive_batch_size) {
+        FinishBatchSampleUnlocked(peer, true);
+      }
       break;
 
     case PeerStatus::TABLET_NOT_FOUND:
@@ -1577,6 +2407,71 @@ void PeerMessageQueue::UpdateExchangeStatus(TrackedPeer* peer,
   }
 }
 
+void PeerMessageQueue::StartBatchSampleUnlocked(TrackedPeer* peer,
+                                                int64_t last_index,
+                                                int64_t bytes) {
+  DCHECK(queue_lock_.is_locked());
+  if (peer->batch_sample_last_index != kInvalidOpIdIndex) {
+    return;
+  }
+  peer->batch_sample_last_index = last_index;
+  peer->batch_sample_bytes = bytes;
+  peer->batch_sample_send_time = MonoTime::Now();
+}
+
+void PeerMessageQueue::FinishBatchSampleUnlocked(TrackedPeer* peer, bool failed) {
+  DCHECK(queue_lock_.is_locked());
+  const int64_t min_size = std::min(FLAGS_consensus_adaptive_batch_min_bytes,
+                                    FLAGS_consensus_max_batch_size_bytes);
+  const int64_t max_size = FLAGS_consensus_max_batch_size_bytes;
+  int64_t size = std::min(std::max(peer->batch_size_bytes, min_size), max_size);
+
+  if (failed) {
+    size /= 2;
+  } else if (peer->batch_sample_last_index != kInvalidOpIdIndex) {
+    MonoDelta rtt = MonoTime::Now() - peer->batch_sample_send_time;
+    int64_t rtt_us = std::max<int64_t>(rtt.ToMicroseconds(), 1);
+    int64_t sample = peer->batch_sample_bytes * MonoTime::kMicrosecondsPerSecond / rtt_us;
+    // Smooth the throughput the way TCP smooths its RTT estimate.
+    peer->throughput_bytes_per_sec = peer->throughput_bytes_per_sec == 0 ?
+        sample : (peer->throughput_bytes_per_sec * 7 + sample) / 8;
+
+    if (rtt.ToMilliseconds() > FLAGS_consensus_adaptive_batch_target_rtt_ms) {
+      size /= 2;
+    } else if (peer->batch_sample_bytes >= size / 2) {
+      // Only grow the batch size when batches are filling up: the peer being
+      // quick to ack small batches says little about larger ones.
+      size *= 2;
+    }
+  }
+  peer->batch_size_bytes = std::min(std::max(size, min_size), max_size);
+  peer->batch_sample_last_index = kInvalidOpIdIndex;
+  UpdateBatchMetricsUnlocked();
+}
+
+void PeerMessageQueue::UpdateBatchMetricsUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  int64_t min_batch_size = 0;
+  int64_t min_throughput = 0;
+  if (FLAGS_consensus_adaptive_batch_size && queue_state_.mode == LEADER) {
+    for (const PeersMap::value_type& entry : peers_map_) {
+      const TrackedPeer* peer = entry.second;
+      if (peer->uuid() == local_peer_pb_.permanent_uuid()) {
+        continue;
+      }
+      if (min_batch_size == 0 || peer->batch_size_bytes < min_batch_size) {
+        min_batch_size = peer->batch_size_bytes;
+      }
+      if (peer->throughput_bytes_per_sec > 0 &&
+          (min_throughput == 0 || peer->throughput_bytes_per_sec < min_throughput)) {
+        min_throughput = peer->throughput_bytes_per_sec;
+      }
+    }
+  }
+  metrics_.min_peer_batch_size->set_value(min_batch_size);
+  metrics_.min_peer_throughput->set_value(min_throughput);
+}
+
 void PeerMessageQueue::PromoteIfNeeded(TrackedPeer* peer, const TrackedPeer& prev_peer_state,
                                        const ConsensusStatusPB& status) {
   DCHECK(queue_lock_.is_locked());
@@ -1585,12 +2480,9 @@ void PeerMessageQueue::PromoteIfNeeded(TrackedPeer* peer, const TrackedPeer& pre
     return;
   }
 
-  // TODO(mpercy): It would be more efficient to cache the member type in the
-  // TrackedPeer data structure.
-  RaftPeerPB* peer_pb;
-  Status s = GetRaftConfigMember(DCHECK_NOTNULL(queue_state_.active_config.get()),
-                                 peer->uuid(), &peer_pb);
-  if (s.ok() &&
+  const RaftPeerPB* peer_pb =
+      DCHECK_NOTNULL(queue_state_.active_config_view.get())->FindMember(peer->uuid());
+  if (peer_pb &&
       peer_pb->member_type() == RaftPeerPB::NON_VOTER &&
       peer_pb->attrs().promote()) {
 
@@ -1610,6 +2502,23 @@ void PeerMessageQueue::PromoteIfNeeded(TrackedPeer* peer, const TrackedPeer& pre
             >= queue_state_.committed_index;
     if (!peer_caught_up) return;
 
+    // With --raft_learner_fast_catchup, the peer must also be keeping pace
+    // with the leader: its lag mustn't have grown over the last sample
+    // interval, unless it is too small to count as catching up.
+    if (FLAGS_raft_learner_fast_catchup) {
+      const int64_t lag = queue_state_.last_appended.index() - peer->last_received.index();
+      const MonoTime now = MonoTime::Now();
+      if (!peer->learner_lag_sample_time.Initialized() ||
+          now - peer->learner_lag_sample_time >=
+              MonoDelta::FromMilliseconds(kLearnerPaceSampleIntervalMs)) {
+        peer->learner_keeping_pace = lag < FLAGS_consensus_catchup_min_lag_ops ||
+            (peer->learner_lag_sample >= 0 && lag <= peer->learner_lag_sample);
+        peer->learner_lag_sample = lag;
+        peer->learner_lag_sample_time = now;
+      }
+      if (!peer->learner_keeping_pace) return;
+    }
+
     // TODO(mpercy): Implement a SafeToPromote() check to ensure that we only
     // try to promote a NON_VOTER to VOTER if we will be able to commit the
     // resulting config change operation.
@@ -1701,8 +2610,96 @@ void PeerMessageQueue::TransferLeadershipIfNeeded(const TrackedPeer& peer,
   NotifyObserversOfSuccessor(peer.uuid());
 }
 
+void PeerMessageQueue::SkipOpsReceivedByPeer(const string& peer_uuid,
+                                             const OpId& last_received) {
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+  TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_uuid);
+  if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
+    return;
+  }
+  if (last_received.index() >= peer->next_index && IsOpInLog(last_received)) {
+    VLOG_WITH_PREFIX_UNLOCKED(1) << "Peer " << peer_uuid << " already has ops up to "
+                                 << OpIdToString(last_received) << ", skipping them";
+    peer->next_index = last_received.index() + 1;
+  }
+}
+
+MonoTime PeerMessageQueue::GetMajorityAckedSendTime() const {
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+  if (queue_state_.mode != LEADER || FLAGS_enable_flexi_raft ||
+      queue_state_.majority_size_ <= 0) {
+    return MonoTime();
+  }
+  const string& local_uuid = local_peer_pb_.permanent_uuid();
+  const MonoTime now = MonoTime::Now();
+  vector<MonoTime> send_times;
+  for (const RaftPeerPB& peer_pb : queue_state_.active_config->peers()) {
+    if (peer_pb.member_type() != RaftPeerPB::VOTER) {
+      continue;
+    }
+    if (peer_pb.permanent_uuid() == local_uuid) {
+      send_times.push_back(now);
+      continue;
+    }
+    const TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_pb.permanent_uuid());
+    if (peer && peer->last_acked_send_time.Initialized() &&
+        peer->last_acked_send_time >= ack_send_time_floor_) {
+      send_times.push_back(peer->last_acked_send_time);
+    }
+  }
+  if (static_cast<int>(send_times.size()) < queue_state_.majority_size_) {
+    return MonoTime();
+  }
+  std::nth_element(send_times.begin(), send_times.begin() + queue_state_.majority_size_ - 1,
+                   send_times.end(), std::greater<MonoTime>());
+  return send_times[queue_state_.majority_size_ - 1];
+}
+
+int64_t PeerMessageQueue::GetVotersMajorityLogIndex() const {
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+  return GetVotersMajorityLogIndexUnlocked();
+}
+
+int64_t PeerMessageQueue::GetVotersMajorityLogIndexUnlocked() const {
+  DCHECK(queue_lock_.is_locked());
+  if (queue_state_.mode != LEADER || FLAGS_enable_flexi_raft ||
+      queue_state_.majority_size_ <= 0) {
+    return -1;
+  }
+  const string& local_uuid = local_peer_pb_.permanent_uuid();
+  vector<int64_t> indexes;
+  for (const RaftPeerPB& peer_pb : queue_state_.active_config->peers()) {
+    if (peer_pb.member_type() != RaftPeerPB::VOTER) {
+      continue;
+    }
+    if (peer_pb.permanent_uuid() == local_uuid) {
+      indexes.push_back(queue_state_.last_appended.index());
+      continue;
+    }
+    // Voters we haven't heard from may hold anything.
+    const TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_pb.permanent_uuid());
+    if (peer && peer->last_exchange_status == PeerStatus::OK) {
+      indexes.push_back(peer->last_received.index());
+    }
+  }
+  if (static_cast<int>(indexes.size()) < queue_state_.majority_size_) {
+    return -1;
+  }
+  std::nth_element(indexes.begin(), indexes.begin() + queue_state_.majority_size_ - 1,
+                   indexes.end());
+  return indexes[queue_state_.majority_size_ - 1];
+}
+
+void PeerMessageQueue::DiscardAcksSentBefore(MonoTime floor) {
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+  if (floor > ack_send_time_floor_) {
+    ack_send_time_floor_ = floor;
+  }
+}
+
 bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
-                                        const ConsensusResponsePB& response) {
+                                        const ConsensusResponsePB& response,
+                                        MonoTime send_time) {
   DCHECK(response.IsInitialized()) << "Error: Uninitialized: "
       << response.InitializationErrorString() << ". Response: " << SecureShortDebugString(response);
 #ifdef FB_DO_NOT_REMOVE
@@ -1713,7 +2710,7 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
   boost::optional<int64_t> updated_commit_index;
   Mode mode_copy;
   {
-    std::lock_guard<simple_spinlock> scoped_lock(queue_lock_);
+    std::lock_guard<profiled_adaptive_mutex> scoped_lock(queue_lock_);
 
     // TODO(mpercy): Handle response from proxy on behalf of another peer.
     // For now, we'll try to ignore proxying here, but we may need to
@@ -1746,6 +2743,8 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
     DCHECK(status.has_last_received_current_leader());
     DCHECK(status.has_last_committed_idx());
 
+    peer->available_bytes = response.has_available_bytes() ? response.available_bytes() : -1;
+
     // Take a snapshot of the previously-recorded peer state.
     const TrackedPeer prev_peer_state = *peer;
 
@@ -1754,6 +2753,13 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
     // want to immediately send another request as we attempt to sync the log
     // offset between the local leader and the remote peer.
     UpdateExchangeStatus(peer, prev_peer_state, response, &send_more_immediately);
+    if (send_time.Initialized() && peer->last_exchange_status == PeerStatus::OK) {
+      if (!peer->last_acked_send_time.Initialized() || send_time > peer->last_acked_send_time) {
+        peer->last_acked_send_time = send_time;
+      }
+      int64_t sample = (MonoTime::Now() - send_time).ToMicroseconds();
+      peer->rtt_us = peer->rtt_us == 0 ? sample : (peer->rtt_us * 7 + sample) / 8;
+    }
 
     // If the reported last-received op for the replica is in our local log,
     // then resume sending entries from that point onward. Otherwise, resume
@@ -1778,6 +2784,20 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
       peer->last_received = status.last_received_current_leader();
       peer->next_index = peer->last_received.index() + 1;
 
+    } else if (FLAGS_raft_lmp_term_hints &&
+               status.has_conflicting_term_first_index() &&
+               status.conflicting_term_first_index() > peer->last_known_committed_index + 1 &&
+               status.conflicting_term_first_index() <= queue_state_.last_appended.index() + 1) {
+      // The peer is divergent, and told us the term its log conflicts with
+      // ours in. Its ops before the first one of that term are of earlier
+      // terms, so skip the whole term: if the op before it still doesn't
+      // match, the next refusal will point at the term before.
+      peer->next_index = status.conflicting_term_first_index();
+      LOG_WITH_PREFIX_UNLOCKED(INFO)
+          << "Peer " << peer_uuid << " log is divergent from this leader: "
+          << "its log conflicts with this leader's in term " << status.conflicting_term()
+          << ". Resuming at the first op of that term in its log, index "
+          << peer->next_index;
     } else {
       // The peer is divergent and they have not (successfully) received
       // anything from us yet. Start sending from their last committed index.
@@ -1793,6 +2813,21 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
           << "this leader's log and it has not received anything from this leader yet. "
           << "Falling back to committed index " << peer->last_known_committed_index;
     }
+    SyncPeerWatermarksUnlocked(*peer);
+
+    if (peer_uuid != local_peer_pb_.permanent_uuid()) {
+      OpTimeline::RecordRange(tablet_id_, prev_peer_state.last_received.index(),
+                              peer->last_received.index(), OpTimeline::PEER_ACK, peer_uuid);
+    }
+
+    if (peer->batch_sample_last_index != kInvalidOpIdIndex) {
+      if (peer->last_exchange_status != PeerStatus::OK) {
+        // The batch wasn't accepted, so its ack says nothing about the link.
+        peer->batch_sample_last_index = kInvalidOpIdIndex;
+      } else if (peer->last_received.index() >= peer->batch_sample_last_index) {
+        FinishBatchSampleUnlocked(peer, false);
+      }
+    }
 
     if (peer->last_exchange_status != PeerStatus::OK) {
       // In this case, 'send_more_immediately' has already been set by
@@ -1895,6 +2930,7 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
       // Once the commit index has been updated, go ahead and update the
       // region_durable_index
       AdvanceQueueRegionDurableIndex();
+      PublishQueueStateUnlocked();
 
       // Only notify observers if the commit index actually changed.
       if (queue_state_.committed_index != commit_index_before) {
@@ -1908,17 +2944,37 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
 
     // If the peer's committed index is lower than our own, or if our log has
     // the next request for the peer, set 'send_more_immediately' to true.
-    send_more_immediately = peer->last_known_committed_index < queue_state_.committed_index ||
-                            log_cache_.HasOpBeenWritten(peer->next_index);
+    // A peer which is over its catch-up budget, or has no room for ops,
+    // waits for its next heartbeat.
+    send_more_immediately =
+        (!peer->catchup_throttled || IsFastTransferTargetUnlocked(peer_uuid)) &&
+        peer->available_bytes != 0 &&
+        (peer->last_known_committed_index < queue_state_.committed_index ||
+         log_cache_.HasOpBeenWritten(peer->next_index));
 
     // Evict ops from log_cache only if:
     // 1. This is not a leader node OR
     // 2. 'all_replicated_index' has changed after processing this response
-    if (mode_copy != LEADER ||
-        (old_all_replicated_index != new_all_replicated_index)) {
+    if (mode_copy != LEADER) {
+      log_cache_.EvictThroughOp(queue_state_.all_replicated_index -
+                                std::max(FLAGS_log_cache_follower_retained_ops, 0));
+    } else if (old_all_replicated_index != new_all_replicated_index) {
       log_cache_.EvictThroughOp(queue_state_.all_replicated_index);
     }
 
+    // Let the log cache know which ops the peers will read next.
+    if (mode_copy == LEADER) {
+      vector<int64_t> next_indexes;
+      next_indexes.reserve(peers_map_.size());
+      for (const auto& entry : peers_map_) {
+        if (entry.second->uuid() != local_peer_pb_.permanent_uuid()) {
+          next_indexes.push_back(entry.second->next_index);
+        }
+      }
+      log_cache_.SetPeerNextIndexes(std::move(next_indexes));
+      MaybeRebuildProxyTopologyUnlocked();
+    }
+
     UpdateMetricsUnlocked();
   }
 
@@ -1930,40 +2986,37 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
 }
 
 PeerMessageQueue::TrackedPeer PeerMessageQueue::GetTrackedPeerForTests(const string& uuid) {
-  std::lock_guard<simple_spinlock> scoped_lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> scoped_lock(queue_lock_);
   TrackedPeer* tracked = FindOrDie(peers_map_, uuid);
   return *tracked;
 }
 
 int64_t PeerMessageQueue::GetAllReplicatedIndex() const {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
-  return queue_state_.all_replicated_index;
+  return published_.all_replicated_index.load(std::memory_order_acquire);
+}
+
+void PeerMessageQueue::SetSnapshotIndex(int64_t snapshot_index) {
+  snapshot_index_.store(snapshot_index, std::memory_order_release);
 }
 
 int64_t PeerMessageQueue::GetCommittedIndex() const {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
-  return queue_state_.committed_index;
+  return published_.committed_index.load(std::memory_order_acquire);
 }
 
 int64_t PeerMessageQueue::GetRegionDurableIndex() const {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
-  return queue_state_.region_durable_index;
+  return published_.region_durable_index.load(std::memory_order_acquire);
 }
 
 bool PeerMessageQueue::IsCommittedIndexInCurrentTerm() const {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
-  return queue_state_.first_index_in_current_term != boost::none &&
-      queue_state_.committed_index >= *queue_state_.first_index_in_current_term;
+  return published_.committed_index_in_current_term.load(std::memory_order_acquire);
 }
 
 bool PeerMessageQueue::IsInLeaderMode() const {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
-  return queue_state_.mode == Mode::LEADER;
+  return published_.leader_mode.load(std::memory_order_acquire);
 }
 
 int64_t PeerMessageQueue::GetMajorityReplicatedIndexForTests() const {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
-  return queue_state_.majority_replicated_index;
+  return published_.majority_replicated_index.load(std::memory_order_acquire);
 }
 
 
@@ -1989,7 +3042,7 @@ void PeerMessageQueue::UpdateLagMetricsUnlocked() {
 }
 
 void PeerMessageQueue::DumpToStrings(vector<string>* lines) const {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   DumpToStringsUnlocked(lines);
 }
 
@@ -1998,40 +3051,129 @@ void PeerMessageQueue::DumpToStringsUnlocked(vector<string>* lines) const {
   lines->push_back("Watermarks:");
   for (const PeersMap::value_type& entry : peers_map_) {
     lines->push_back(
-        Substitute("Peer: $0 Watermark: $1", entry.first, entry.second->ToString()));
+        Substitute("Peer: $0 Watermark: $1", entry.second->uuid(), entry.second->ToString()));
   }
 
   log_cache_.DumpToStrings(lines);
 }
 
+PeerMessageQueue::StatusSnapshot PeerMessageQueue::GetStatusSnapshot() const {
+  StatusSnapshot snapshot;
+  snapshot.leader_mode = published_.leader_mode.load(std::memory_order_acquire);
+  ReadPublishedLogState(&snapshot.last_appended, &snapshot.current_term);
+  snapshot.committed_index = published_.committed_index.load(std::memory_order_acquire);
+  snapshot.majority_replicated_index =
+      published_.majority_replicated_index.load(std::memory_order_acquire);
+  snapshot.all_replicated_index = published_.all_replicated_index.load(std::memory_order_acquire);
+
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+  snapshot.peers.reserve(peers_map_.size());
+  for (const PeersMap::value_type& entry : peers_map_) {
+    const TrackedPeer* peer = entry.second;
+    snapshot.peers.push_back({ peer->uuid(), peer->last_exchange_status, peer->last_received,
+                               peer->next_index, peer->last_known_committed_index,
+                               peer->last_communication_time, peer->batch_size_bytes,
+                               peer->throughput_bytes_per_sec,
+                               peer->last_overall_health_status });
+  }
+  return snapshot;
+}
+
 void PeerMessageQueue::DumpToHtml(std::ostream& out) const {
   using std::endl;
 
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  StatusSnapshot snapshot = GetStatusSnapshot();
+  const MonoTime now = MonoTime::Now();
   out << "<h3>Watermarks</h3>" << endl;
   out << "<table>" << endl;;
   out << "  <tr><th>Peer</th><th>Watermark</th></tr>" << endl;
-  for (const PeersMap::value_type& entry : peers_map_) {
+  for (const StatusSnapshot::Peer& peer : snapshot.peers) {
+    string watermark = Substitute(
+        "Status: $0, Last received: $1, Next index: $2, Last known committed idx: $3, "
+        "Time since last communication: $4, Batch size: $5, Throughput: $6 bytes/s, "
+        "Health: $7",
+        PeerStatusToString(peer.last_exchange_status), OpIdToString(peer.last_received),
+        peer.next_index, peer.last_known_committed_index,
+        (now - peer.last_communication_time).ToString(), peer.batch_size_bytes,
+        peer.throughput_bytes_per_sec, HealthReportPB::HealthStatus_Name(peer.health));
     out << Substitute("  <tr><td>$0</td><td>$1</td></tr>",
-                      EscapeForHtmlToString(entry.first),
-                      EscapeForHtmlToString(entry.second->ToString())) << endl;
+                      EscapeForHtmlToString(peer.uuid),
+                      EscapeForHtmlToString(watermark)) << endl;
   }
   out << "</table>" << endl;
-  out << "<p>" << queue_state_.ToString() << "</p>" << endl;
+  out << "<p>" << Substitute("All replicated index: $0, Majority replicated index: $1, "
+                             "Committed index: $2, Last appended: $3, Current term: $4, "
+                             "Mode: $5",
+                             snapshot.all_replicated_index, snapshot.majority_replicated_index,
+                             snapshot.committed_index, OpIdToString(snapshot.last_appended),
+                             snapshot.current_term,
+                             snapshot.leader_mode ? "LEADER" : "NON_LEADER")
+      << "</p>" << endl;
 
   log_cache_.DumpToHtml(out);
 }
 
+void PeerMessageQueue::DumpToJson(JsonWriter* jw) const {
+  StatusSnapshot snapshot = GetStatusSnapshot();
+  const MonoTime now = MonoTime::Now();
+  jw->StartObject();
+  jw->String("mode");
+  jw->String(snapshot.leader_mode ? "LEADER" : "NON_LEADER");
+  jw->String("current_term");
+  jw->Int64(snapshot.current_term);
+  jw->String("last_appended");
+  jw->String(OpIdToString(snapshot.last_appended));
+  jw->String("committed_index");
+  jw->Int64(snapshot.committed_index);
+  jw->String("majority_replicated_index");
+  jw->Int64(snapshot.majority_replicated_index);
+  jw->String("all_replicated_index");
+  jw->Int64(snapshot.all_replicated_index);
+  jw->String("peers");
+  jw->StartArray();
+  for (const StatusSnapshot::Peer& peer : snapshot.peers) {
+    jw->StartObject();
+    jw->String("uuid");
+    jw->String(peer.uuid);
+    jw->String("status");
+    jw->String(PeerStatusToString(peer.last_exchange_status));
+    jw->String("last_received");
+    jw->String(OpIdToString(peer.last_received));
+    jw->String("next_index");
+    jw->Int64(peer.next_index);
+    jw->String("last_known_committed_index");
+    jw->Int64(peer.last_known_committed_index);
+    jw->String("ms_since_last_communication");
+    jw->Int64((now - peer.last_communication_time).ToMilliseconds());
+    jw->String("batch_size_bytes");
+    jw->Int64(peer.batch_size_bytes);
+    jw->String("throughput_bytes_per_sec");
+    jw->Int64(peer.throughput_bytes_per_sec);
+    jw->String("health");
+    jw->String(HealthReportPB::HealthStatus_Name(peer.health));
+    jw->EndObject();
+  }
+  jw->EndArray();
+  jw->String("log_cache");
+  log_cache_.DumpToJson(jw);
+  jw->EndObject();
+}
+
 void PeerMessageQueue::ClearUnlocked() {
   DCHECK(queue_lock_.is_locked());
   STLDeleteValues(&peers_map_);
+  peer_watermarks_.Clear();
+  prefetch_buffers_.clear();
   queue_state_.state = kQueueClosed;
 }
 
 void PeerMessageQueue::Close() {
   raft_pool_observers_token_->Shutdown();
+  if (prefetch_pool_token_) {
+    prefetch_pool_token_->Shutdown();
+  }
 
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   ClearUnlocked();
 }
 
@@ -2042,7 +3184,7 @@ int64_t PeerMessageQueue::GetQueuedOperationsSizeBytesForTests() const {
 string PeerMessageQueue::ToString() const {
   // Even though metrics are thread-safe obtain the lock so that we get
   // a "consistent" snapshot of the metrics.
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   return ToStringUnlocked();
 }
 
@@ -2055,7 +3197,7 @@ string PeerMessageQueue::ToStringUnlocked() const {
 }
 
 void PeerMessageQueue::RegisterObserver(PeerMessageQueueObserver* observer) {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   auto iter = std::find(observers_.begin(), observers_.end(), observer);
   if (iter == observers_.end()) {
     observers_.push_back(observer);
@@ -2063,7 +3205,7 @@ void PeerMessageQueue::RegisterObserver(PeerMessageQueueObserver* observer) {
 }
 
 Status PeerMessageQueue::UnRegisterObserver(PeerMessageQueueObserver* observer) {
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
   auto iter = std::find(observers_.begin(), observers_.end(), observer);
   if (iter == observers_.end()) {
     return Status::NotFound("Can't find observer.");
@@ -2085,7 +3227,53 @@ bool PeerMessageQueue::IsOpInLog(const OpId& desired_op) const {
   return false; // Unreachable; here to squelch GCC warning.
 }
 
+constexpr int64_t PeerMessageQueue::CoalescedNotification::kNoValue;
+
+bool PeerMessageQueue::PostCoalescedNotification(CoalescedNotification* notification,
+                                                 int64_t value) {
+  int64_t pending = notification->pending.load();
+  while (pending < value &&
+         !notification->pending.compare_exchange_weak(pending, value)) {
+  }
+  // Whoever flips 'scheduled' submits the task; the values posted by
+  // everyone else are picked up by that task.
+  return !notification->scheduled.exchange(true);
+}
+
+void PeerMessageQueue::SubmitCoalescedNotification(
+    CoalescedNotification* notification,
+    std::function<void(PeerMessageQueueObserver*, int64_t)> func,
+    const string& error_msg) {
+  Status s = raft_pool_observers_token_->SubmitFunc([this, notification, func]() {
+    // Clear 'scheduled' before taking the value, so that anything posted
+    // after the exchange below schedules another task.
+    notification->scheduled.store(false);
+    int64_t value = notification->pending.exchange(CoalescedNotification::kNoValue);
+    if (value == CoalescedNotification::kNoValue) {
+      return;
+    }
+    NotifyObserversTask([&](PeerMessageQueueObserver* observer) {
+      func(observer, value);
+    });
+  });
+  WARN_NOT_OK(s, LogPrefixUnlocked() + error_msg);
+  if (PREDICT_FALSE(!s.ok())) {
+    notification->scheduled.store(false);
+  }
+}
+
 void PeerMessageQueue::NotifyObserversOfCommitIndexChange(int64_t new_commit_index) {
+  if (FLAGS_consensus_coalesce_observer_notifications) {
+    if (PostCoalescedNotification(&commit_index_notification_, new_commit_index)) {
+      SubmitCoalescedNotification(
+          &commit_index_notification_,
+          [](PeerMessageQueueObserver* observer, int64_t commit_index) {
+            observer->NotifyCommitIndex(commit_index);
+          },
+          "Unable to notify RaftConsensus of commit index change.");
+    }
+    return;
+  }
   WARN_NOT_OK(raft_pool_observers_token_->SubmitClosure(
       Bind(&PeerMessageQueue::NotifyObserversTask, Unretained(this),
            [=](PeerMessageQueueObserver* observer) {
@@ -2095,6 +3283,17 @@ void PeerMessageQueue::NotifyObserversOfCommitIndexChange(int64_t new_commit_ind
 }
 
 void PeerMessageQueue::NotifyObserversOfTermChange(int64_t term) {
+  if (FLAGS_consensus_coalesce_observer_notifications) {
+    if (PostCoalescedNotification(&term_notification_, term)) {
+      SubmitCoalescedNotification(
+          &term_notification_,
+          [](PeerMessageQueueObserver* observer, int64_t term) {
+            observer->NotifyTermChange(term);
+          },
+          "Unable to notify RaftConsensus of term change.");
+    }
+    return;
+  }
   WARN_NOT_OK(raft_pool_observers_token_->SubmitClosure(
       Bind(&PeerMessageQueue::NotifyObserversTask, Unretained(this),
            [=](PeerMessageQueueObserver* observer) {
@@ -2123,6 +3322,30 @@ void PeerMessageQueue::NotifyObserversOfPeerToPromote(const string& peer_uuid) {
       LogPrefixUnlocked() + "Unable to notify RaftConsensus of peer to promote.");
 }
 
+void PeerMessageQueue::NotifyObserversOfPeerNeedsSnapshot(const string& peer_uuid,
+                                                          int64_t snapshot_index) {
+  WARN_NOT_OK(raft_pool_observers_token_->SubmitClosure(
+      Bind(&PeerMessageQueue::NotifyObserversTask, Unretained(this),
+           [=](PeerMessageQueueObserver* observer) {
+             observer->NotifyPeerNeedsSnapshot(peer_uuid, snapshot_index);
+           })),
+      LogPrefixUnlocked() + "Unable to notify RaftConsensus of peer needing a snapshot.");
+}
+
+void PeerMessageQueue::MaybeNotifyPeerNeedsSnapshot(const string& uuid,
+                                                    int64_t snapshot_index) {
+  std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
+  TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
+  if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
+    return;
+  }
+  if (peer->snapshot_requested_index >= snapshot_index) {
+    return;
+  }
+  peer->snapshot_requested_index = snapshot_index;
+  NotifyObserversOfPeerNeedsSnapshot(uuid, snapshot_index);
+}
+
 void PeerMessageQueue::NotifyObserversOfSuccessor(const string& peer_uuid) {
   DCHECK(queue_lock_.is_locked());
   WARN_NOT_OK(raft_pool_observers_token_->SubmitClosure(
@@ -2137,7 +3360,68 @@ void PeerMessageQueue::NotifyObserversOfSuccessor(const string& peer_uuid) {
   transfer_context_ = boost::none;
 }
 
+void PeerMessageQueue::NotifyObserversOfProxyTopologyChange(ProxyTopologyPB proxy_topology) {
+  WARN_NOT_OK(raft_pool_observers_token_->SubmitClosure(
+      Bind(&PeerMessageQueue::NotifyObserversTask, Unretained(this),
+           [=](PeerMessageQueueObserver* observer) {
+             observer->NotifyProxyTopologyChange(proxy_topology);
+           })),
+      LogPrefixUnlocked() + "Unable to notify RaftConsensus of proxy topology change.");
+}
+
+void PeerMessageQueue::MaybeRebuildProxyTopologyUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  if (!FLAGS_raft_cost_based_proxy_topology || queue_state_.mode != LEADER ||
+      routing_table_container_->GetProxyPolicy() != ProxyPolicy::DURABLE_ROUTING_POLICY) {
+    return;
+  }
+  const MonoTime now = MonoTime::Now();
+  if (last_proxy_topology_rebuild_.Initialized() &&
+      now - last_proxy_topology_rebuild_ <
+          MonoDelta::FromMilliseconds(FLAGS_raft_cost_based_proxy_topology_interval_ms)) {
+    return;
+  }
+  last_proxy_topology_rebuild_ = now;
+
+  unordered_map<string, PeerLinkCost> link_costs;
+  for (const PeersMap::value_type& entry : peers_map_) {
+    const TrackedPeer* peer = entry.second;
+    PeerLinkCost& cost = link_costs[entry.second->uuid()];
+    cost.rtt_us = peer->rtt_us;
+    cost.throughput_bytes_per_sec = peer->throughput_bytes_per_sec;
+    // The same checks which make requests bypass a failed proxy.
+    cost.healthy = peer->last_exchange_status == PeerStatus::OK &&
+        now - peer->last_communication_time <
+            MonoDelta::FromMilliseconds(proxy_failure_threshold_ms_) &&
+        queue_state_.last_appended.index() + 1 - peer->next_index <=
+            proxy_failure_threshold_lag_;
+  }
+
+  ProxyTopologyPB proxy_topology = BuildCostBasedProxyTopology(
+      *queue_state_.active_config, local_peer_pb_.permanent_uuid(), link_costs,
+      cost_based_proxy_topology_, FLAGS_raft_cost_based_proxy_switch_ratio);
+  if (MessageDifferencer::Equals(proxy_topology, cost_based_proxy_topology_)) {
+    return;
+  }
+  VLOG_WITH_PREFIX_UNLOCKED(1) << "Rebuilt proxy topology: "
+                               << SecureShortDebugString(proxy_topology);
+  cost_based_proxy_topology_ = proxy_topology;
+  NotifyObserversOfProxyTopologyChange(std::move(proxy_topology));
+}
+
 void PeerMessageQueue::NotifyObserversOfPeerHealthChange() {
+  if (FLAGS_consensus_coalesce_observer_notifications) {
+    // There's nothing to deliver beyond the fact that something changed.
+    if (PostCoalescedNotification(&health_notification_, 0)) {
+      SubmitCoalescedNotification(
+          &health_notification_,
+          [](PeerMessageQueueObserver* observer, int64_t /*unused*/) {
+            observer->NotifyPeerHealthChange();
+          },
+          "Unable to notify RaftConsensus peer health change.");
+    }
+    return;
+  }
   WARN_NOT_OK(raft_pool_observers_token_->SubmitClosure(
       Bind(&PeerMessageQueue::NotifyObserversTask, Unretained(this),
            [](PeerMessageQueueObserver* observer) {
@@ -2151,7 +3435,7 @@ void PeerMessageQueue::NotifyObserversTask(
   MAYBE_INJECT_RANDOM_LATENCY(FLAGS_consensus_inject_latency_ms_in_notifications);
   std::vector<PeerMessageQueueObserver*> observers_copy;
   {
-    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
     observers_copy = observers_;
   }
   for (PeerMessageQueueObserver* observer : observers_copy) {
@@ -2192,7 +3476,7 @@ void PeerMessageQueue::UpdatePeerQuorumIdUnlocked(
     const std::map<std::string, std::string>& quorum_id_map) {
   // Update quorum_ids in peers_map
   for (const PeersMap::value_type& entry : peers_map_) {
-    auto it = quorum_id_map.find(entry.first);
+    auto it = quorum_id_map.find(entry.second->uuid());
     if (it != quorum_id_map.end()) {
       entry.second->peer_pb.mutable_attrs()->set_quorum_id(it->second);
     }
@@ -2203,6 +3487,40 @@ void PeerMessageQueue::UpdatePeerQuorumIdUnlocked(
   if (it != quorum_id_map.end()) {
     local_peer_pb_.mutable_attrs()->set_quorum_id(it->second);
   }
+
+  RebuildPeerWatermarksUnlocked();
+}
+
+PeerWatermarks::PeerState PeerMessageQueue::PeerWatermarkStateUnlocked(
+    const TrackedPeer& peer) {
+  PeerWatermarks::PeerState state;
+  state.ok = peer.last_exchange_status == PeerStatus::OK;
+  state.voter = peer.peer_pb.member_type() == RaftPeerPB::VOTER;
+  state.index = peer.last_received.index();
+  state.region = peer.peer_pb.attrs().region();
+  if (queue_state_.active_config && queue_state_.active_config->has_commit_rule()) {
+    state.quorum_id = getQuorumIdUsingCommitRule(peer.peer_pb);
+  }
+  return state;
+}
+
+void PeerMessageQueue::SyncPeerWatermarksUnlocked(const TrackedPeer& peer) {
+  peer_watermarks_.Update(peer.uuid(), PeerWatermarkStateUnlocked(peer));
+}
+
+void PeerMessageQueue::RebuildPeerWatermarksUnlocked() {
+  peer_watermarks_.Clear();
+  for (const PeersMap::value_type& entry : peers_map_) {
+    SyncPeerWatermarksUnlocked(*entry.second);
+  }
+}
+
+bool PeerMessageQueue::PeerWatermarksMatchPeersUnlocked() {
+  PeerWatermarks expected;
+  for (const PeersMap::value_type& entry : peers_map_) {
+    expected.Update(entry.second->uuid(), PeerWatermarkStateUnlocked(*entry.second));
+  }
+  return expected == peer_watermarks_;
 }
 
 }  // namespace consensus
@@ -24,9 +24,12 @@
 #ifndef KUDU_CONSENSUS_CONSENSUS_QUEUE_H_
 #define KUDU_CONSENSUS_CONSENSUS_QUEUE_H_
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <iosfwd>
+#include <map>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -39,6 +42,8 @@
 #include "kudu/consensus/log_cache.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/peer_id.h"
 #include "kudu/consensus/persistent_vars.h"
 #include "kudu/consensus/persistent_vars_manager.h"
 #include "kudu/consensus/ref_counted_replicate.h"
@@ -47,6 +52,7 @@
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/threading/thread_collision_warner.h"
+#include "kudu/util/lock_profile.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -54,6 +60,8 @@
 #include "kudu/util/status_callback.h"
 
 namespace kudu {
+class JsonWriter;
+class Throttler;
 class ThreadPoolToken;
 
 namespace log {
@@ -69,6 +77,7 @@ class ConsensusRequestPB;
 class ConsensusResponsePB;
 class ConsensusStatusPB;
 class PeerMessageQueueObserver;
+class RaftConfigView;
 #ifdef FB_DO_NOT_REMOVE
 class StartTabletCopyRequestPB;
 #endif
@@ -114,6 +123,73 @@ enum class PeerStatus {
 
 const char* PeerStatusToString(PeerStatus p);
 
+// Keeps the last received indexes of a set of peers in sorted arrays, for each
+// of the groups of peers which the queue's watermarks are computed over. The
+// arrays are updated as the peers' states change, so that a watermark can be
+// read off them rather than by collecting and sorting the indexes of all the
+// peers on every response.
+//
+// Only peers whose last exchange was successful are counted. See
+// PeerMessageQueue::AdvanceQueueWatermark() for why.
+class PeerWatermarks {
+ public:
+  // What a peer contributes to the watermarks.
+  struct PeerState {
+    // Whether the peer's last exchange was successful. The peer is not
+    // counted otherwise.
+    bool ok = false;
+    bool voter = false;
+    int64_t index = 0;
+    std::string region;
+    std::string quorum_id;
+
+    bool operator==(const PeerState& other) const {
+      return ok == other.ok && voter == other.voter && index == other.index &&
+          region == other.region && quorum_id == other.quorum_id;
+    }
+  };
+
+  // Sets the state of the peer with 'uuid', replacing its previous one.
+  void Update(const std::string& uuid, PeerState state);
+
+  // Stops counting the peer with 'uuid'.
+  void Remove(const std::string& uuid);
+
+  void Clear();
+
+  // The sorted indexes of all the peers.
+  const std::vector<int64_t>& all() const { return all_; }
+
+  // The sorted indexes of the voters.
+  const std::vector<int64_t>& voters() const { return voters_; }
+
+  // The sorted indexes of the voters by region and by quorum id. Groups
+  // without any counted voter are left out.
+  const std::map<std::string, std::vector<int64_t>>& voters_by_region() const {
+    return voters_by_region_;
+  }
+  const std::map<std::string, std::vector<int64_t>>& voters_by_quorum() const {
+    return voters_by_quorum_;
+  }
+
+  bool operator==(const PeerWatermarks& other) const {
+    return all_ == other.all_ && voters_ == other.voters_ &&
+        voters_by_region_ == other.voters_by_region_ &&
+        voters_by_quorum_ == other.voters_by_quorum_;
+  }
+
+ private:
+  // Adds or removes what 'state' contributes.
+  void Add(const PeerState& state);
+  void Subtract(const PeerState& state);
+
+  std::unordered_map<std::string, PeerState> peers_;
+  std::vector<int64_t> all_;
+  std::vector<int64_t> voters_;
+  std::map<std::string, std::vector<int64_t>> voters_by_region_;
+  std::map<std::string, std::vector<int64_t>> voters_by_quorum_;
+};
+
 // Tracks the state of the peers and which transactions they have replicated.
 // Owns the LogCache which actually holds the replicate messages which are
 // en route to the various peers.
@@ -121,11 +197,19 @@ const char* PeerStatusToString(PeerStatus p);
 // This also takes care of pushing requests to peers as new operations are
 // added, and notifying RaftConsensus when the commit index advances.
 //
-// TODO(todd): Right now this class is able to track one outstanding operation
-// per peer. If we want to have more than one outstanding RPC we need to
-// modify it.
+// The queue tracks the position of each peer as acknowledged by its responses.
+// A Peer which pipelines several requests keeps track of the position it has
+// sent up to itself, and passes it to RequestForPeer(); responses must be fed
+// back to ResponseFromPeer() in the order the requests were sent.
 class PeerMessageQueue {
  public:
+  // A bandwidth budget for the ops sent to peers which are catching up. The
+  // throttler is replaced when the budget's rate changes.
+  struct CatchupBudget {
+    int64_t bytes_per_sec = 0;
+    std::shared_ptr<Throttler> throttler;
+  };
+
   struct TrackedPeer {
     explicit TrackedPeer(RaftPeerPB peer_pb);
 
@@ -179,6 +263,10 @@ class PeerMessageQueue {
     // the local peer's WAL.
     bool wal_catchup_possible;
 
+    // The snapshot index the observers were last told this peer needs, or -1.
+    // Reset once the peer is caught up from the log again.
+    int64_t snapshot_requested_index;
+
     // The peer's latest overall health status.
     HealthReportPB::HealthStatus last_overall_health_status;
 
@@ -186,6 +274,50 @@ class PeerMessageQueue {
     // peer (eg when it is lagging, etc).
     std::shared_ptr<logging::LogThrottler> status_log_throttler;
 
+    // The most bytes of ops which a request to this peer may carry when
+    // --consensus_adaptive_batch_size is enabled. Grows while the peer acks
+    // full batches quickly and shrinks when they are slow or time out.
+    int64_t batch_size_bytes;
+
+    // Smoothed rate, in bytes per second, at which the peer has acked the
+    // batches sent to it. Zero until the first batch has been timed.
+    int64_t throughput_bytes_per_sec;
+
+    // The batch being timed to adapt 'batch_size_bytes': the index of its
+    // last op (kInvalidOpIdIndex if no batch is being timed), its size, and
+    // when it was sent.
+    int64_t batch_sample_last_index;
+    int64_t batch_sample_bytes;
+    MonoTime batch_sample_send_time;
+
+    // The peer's own budget under --consensus_catchup_peer_bytes_per_sec, and
+    // whether the latest request to it was left without ops because it was
+    // over budget.
+    CatchupBudget catchup_budget;
+    bool catchup_throttled;
+
+    // With --raft_learner_fast_catchup: whether the peer is a learner which
+    // is catching up, and, for a learner to be promoted, its lag at the last
+    // pace sample, when that was taken, and whether the lag had stopped
+    // growing by then.
+    bool learner_catching_up;
+    int64_t learner_lag_sample;
+    MonoTime learner_lag_sample_time;
+    bool learner_keeping_pace;
+
+    // The bytes of ops the peer last advertised it could accept, or -1 if it
+    // doesn't advertise them. Requests to the peer carry no ops while this
+    // is 0.
+    int64_t available_bytes;
+
+    // The send time of the latest request the peer accepted, which bounds
+    // from below the time it has been withholding its vote since.
+    MonoTime last_acked_send_time;
+
+    // Smoothed round trip time, in microseconds, of the requests the peer
+    // accepted. Zero until the first one.
+    int64_t rtt_us;
+
    private:
     // The last term we saw from a given peer.
     // This is only used for sanity checking that a peer doesn't
@@ -296,12 +428,17 @@ class PeerMessageQueue {
   // instance of ConsensusRequestPB to RequestForPeer(): the buffer will
   // replace the old entries with new ones without de-allocating the old
   // ones if they are still required.
+  //
+  // If 'pipelined_next_index' is set, the request starts at that index rather
+  // than at the peer's next index, to follow requests which are still in
+  // flight to the peer.
   Status RequestForPeer(const std::string& uuid,
                         bool read_ops,
                         ConsensusRequestPB* request,
                         std::vector<ReplicateRefPtr>* msg_refs,
                         bool* needs_tablet_copy,
-                        std::string* next_hop_uuid);
+                        std::string* next_hop_uuid,
+                        int64_t pipelined_next_index = kInvalidOpIdIndex);
 
 #ifdef FB_DO_NOT_REMOVE
   // Fill in a StartTabletCopyRequest for the specified peer.
@@ -319,13 +456,40 @@ class PeerMessageQueue {
                         PeerStatus ps,
                         const Status& status);
 
+  // Moves the next index of the peer past 'last_received', the last op the
+  // peer reported having in its log, if that op is in our log too. For
+  // responses such as CANNOT_PREPARE which don't otherwise move the peer's
+  // position, so that the ops it already has aren't sent to it again. The
+  // watermarks are left alone as the ops may not be durable on the peer yet.
+  void SkipOpsReceivedByPeer(const std::string& peer_uuid, const OpId& last_received);
+
   // Updates the request queue with the latest response from a request to a
-  // consensus peer.
+  // consensus peer. 'send_time', if initialized, is when the request was sent,
+  // and feeds GetMajorityAckedSendTime().
   // Returns true iff there are more requests pending in the queue for this
   // peer and another request should be sent immediately, with no intervening
   // delay.
   bool ResponseFromPeer(const std::string& peer_uuid,
-                        const ConsensusResponsePB& response);
+                        const ConsensusResponsePB& response,
+                        MonoTime send_time = MonoTime());
+
+  // Returns the latest time T such that a majority of the voters, counting
+  // the leader itself, accepted requests of this leadership sent at or after
+  // T. Returns an uninitialized MonoTime if there is no such time, if the
+  // queue isn't in leader mode, or under flexi-raft, where the quorums
+  // aren't simple majorities.
+  MonoTime GetMajorityAckedSendTime() const;
+
+  // Makes GetMajorityAckedSendTime() disregard requests sent before 'floor'.
+  void DiscardAcksSentBefore(MonoTime floor);
+
+  // Returns the lowest index L such that a majority of the voters, counting
+  // the leader itself, are known to have received no op past L. Returns -1
+  // under the same conditions as GetMajorityAckedSendTime(), or if too few
+  // voters have responded. Sent to the followers with
+  // --raft_pre_vote_hints so that a follower holding L can tell that it
+  // would win an election, in which case it skips the pre-election.
+  int64_t GetVotersMajorityLogIndex() const;
 
   // Called by the consensus implementation to update the queue's watermarks
   // based on information provided by the leader. This is used for metrics and
@@ -356,6 +520,11 @@ class PeerMessageQueue {
   // Check region_durable_index
   int64_t GetRegionDurableIndex() const;
 
+  // Sets the index through which the round handler can serve a snapshot, or
+  // -1 if it can't. A peer which needs ops GCed from the log at or below this
+  // index is reported with NotifyPeerNeedsSnapshot() rather than as failed.
+  void SetSnapshotIndex(int64_t snapshot_index);
+
   // Return true if the committed index falls within the current term.
   bool IsCommittedIndexInCurrentTerm() const;
 
@@ -376,6 +545,35 @@ class PeerMessageQueue {
 
   void DumpToHtml(std::ostream& out) const;
 
+  // Writes the state of the queue, of its peers and of its log cache as a
+  // JSON object.
+  void DumpToJson(JsonWriter* jw) const;
+
+  // What the status pages of the queue show. The queue state comes from the
+  // published atomics, and the peers are compact copies taken under a brief
+  // hold of the queue lock, so that the pages are rendered without it.
+  struct StatusSnapshot {
+    struct Peer {
+      std::string uuid;
+      PeerStatus last_exchange_status;
+      OpId last_received;
+      int64_t next_index;
+      int64_t last_known_committed_index;
+      MonoTime last_communication_time;
+      int64_t batch_size_bytes;
+      int64_t throughput_bytes_per_sec;
+      HealthReportPB::HealthStatus health;
+    };
+    bool leader_mode;
+    int64_t current_term;
+    OpId last_appended;
+    int64_t committed_index;
+    int64_t majority_replicated_index;
+    int64_t all_replicated_index;
+    std::vector<Peer> peers;
+  };
+  StatusSnapshot GetStatusSnapshot() const;
+
   void RegisterObserver(PeerMessageQueueObserver* observer);
 
   Status UnRegisterObserver(PeerMessageQueueObserver* observer);
@@ -389,6 +587,18 @@ class PeerMessageQueue {
     // Keeps track of the number of ops. behind the leader the peer is, measured as the difference
     // between the latest appended op index on this peer versus on the leader (0 if leader).
     scoped_refptr<AtomicGauge<int64_t> > num_ops_behind_leader;
+    // The smallest adaptive batch size and the lowest ack throughput among
+    // the remote peers (0 if not the leader or if not yet measured).
+    scoped_refptr<AtomicGauge<int64_t> > min_peer_batch_size;
+    scoped_refptr<AtomicGauge<int64_t> > min_peer_throughput;
+    // The number of requests to catching up peers which were sent without
+    // ops because the peer or its region was over its catch-up budget.
+    scoped_refptr<Counter> catchup_throttled_requests;
+    // The number of ops sent to lagging peers from their prefetch buffers.
+    scoped_refptr<Counter> prefetched_ops_sent;
+    // The number of requests to learners catching up which were sent without
+    // ops because a voter was catching up too.
+    scoped_refptr<Counter> learner_catchup_deferred_requests;
 
     explicit Metrics(const scoped_refptr<MetricEntity>& metric_entity);
   };
@@ -409,10 +619,27 @@ class PeerMessageQueue {
   // notification to a peer to start an election
   bool WatchForSuccessorPeerNotified();
 
+  // Whether 'peer_uuid' is the designated successor of a leadership transfer
+  // in progress with --raft_fast_leader_transfer, and so is to be sent the
+  // rest of the log as fast as possible.
+  bool IsFastTransferTarget(const std::string& peer_uuid) const;
+
+  // Whether 'peer_uuid' is a learner catching up under
+  // --raft_learner_fast_catchup, and so is sent pipelined batches.
+  bool IsLearnerCatchingUp(const std::string& peer_uuid) const;
+
   // Get the UUID of the next routing hop from the local node.
   // Results not guaranteed to be valid if the current node is not the leader.
   Status GetNextRoutingHopFromLeader(const std::string& dest_uuid, std::string* next_hop) const;
 
+  // Returns the ops of 'msgs' serialized as the 'ops' field of a
+  // ConsensusRequestPB would be, for sending as the ops sidecar of an
+  // UpdateConsensus request. The buffers of the last few batches are kept, so
+  // that a batch sent to several peers is serialized only once. If 'packed',
+  // the ops are encoded by PackOps() instead, delta encoded if 'delta'.
+  std::shared_ptr<const std::string> SerializeOpsForPeers(
+      const std::vector<ReplicateRefPtr>& msgs, bool packed = false, bool delta = false);
+
   // TODO(mpercy): It's probably not safe in general to access a queue's log
   // cache via bare pointer, since (IIRC) a queue will be reconstructed
   // transitioning to/from leader. Check this.
@@ -420,6 +647,10 @@ class PeerMessageQueue {
     return &log_cache_;
   }
 
+  // Sets the pool token on which the ops for lagging peers are prefetched
+  // from the log. See --consensus_prefetch_batches_for_lagging_peers.
+  void SetPrefetchPoolToken(std::unique_ptr<ThreadPoolToken> prefetch_pool_token);
+
   // Set the threshold (in milliseconds) that is used to determine the health of
   // the 'proxy peer'
   void SetProxyFailureThreshold(int32_t proxy_failure_threshold_ms);
@@ -438,7 +669,7 @@ class PeerMessageQueue {
       const TrackedPeer* proxy_peer, const TrackedPeer* dest_peer);
 
   void SetAdjustVoterDistribution(bool val) {
-    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    std::lock_guard<profiled_adaptive_mutex> lock(queue_lock_);
     adjust_voter_distribution_ = val;
   }
 
@@ -449,7 +680,12 @@ class PeerMessageQueue {
   FRIEND_TEST(ConsensusQueueTest, TestQueueAdvancesCommittedIndex);
   FRIEND_TEST(ConsensusQueueTest, TestQueueMovesWatermarksBackward);
   FRIEND_TEST(ConsensusQueueTest, TestFollowerCommittedIndexAndMetrics);
+  FRIEND_TEST(ConsensusQueueTest, TestAdaptiveBatchSize);
+  FRIEND_TEST(ConsensusQueueTest, TestCatchupThrottling);
+  FRIEND_TEST(ConsensusQueueTest, TestQueuePrefetchesOperationsForLaggingPeer);
+  FRIEND_TEST(ConsensusQueueTest, TestCoalescedObserverNotifications);
   FRIEND_TEST(ConsensusQueueUnitTest, PeerHealthStatus);
+  FRIEND_TEST(ConsensusQueueUnitTest, PeerHealthMayChange);
   FRIEND_TEST(RaftConsensusQuorumTest, TestReplicasEnforceTheLogMatchingProperty);
 
   // Mode specifies how the queue currently behaves:
@@ -523,6 +759,9 @@ class PeerMessageQueue {
     // The currently-active raft config. Only set if in LEADER mode.
     gscoped_ptr<RaftConfigPB> active_config;
 
+    // Lookups into 'active_config', rebuilt whenever it is set.
+    std::shared_ptr<const RaftConfigView> active_config_view;
+
     std::string ToString() const;
   };
 
@@ -532,6 +771,8 @@ class PeerMessageQueue {
   // fatal error.
   bool IsOpInLog(const OpId& desired_op) const;
 
+  int64_t GetVotersMajorityLogIndexUnlocked() const;
+
   // Return true if it would be safe to evict the peer 'evict_uuid' at this
   // point in time.
   bool SafeToEvictUnlocked(const std::string& evict_uuid) const;
@@ -540,6 +781,34 @@ class PeerMessageQueue {
   // notifications.
   void UpdatePeerHealthUnlocked(TrackedPeer* peer);
 
+  // Returns whether UpdatePeerHealthUnlocked() may change anything for the
+  // peer of which 'peer_copy' is a copy, once a request has been built for it
+  // which made progress catching up its WAL, or found that it can't, as
+  // indicated by 'wal_catchup_progress' and 'wal_catchup_failure'.
+  static bool PeerHealthMayChange(const TrackedPeer& peer_copy,
+                                  bool wal_catchup_progress,
+                                  bool wal_catchup_failure);
+
+  // Returns the health reports of the tracked peers.
+  std::unordered_map<std::string, HealthReportPB> HealthReportsUnlocked() const;
+
+  // Republishes 'health_snapshot_'.
+  void PublishHealthSnapshotUnlocked();
+
+  // Returns what 'peer' contributes to the watermarks.
+  PeerWatermarks::PeerState PeerWatermarkStateUnlocked(const TrackedPeer& peer);
+
+  // Updates 'peer_watermarks_' with the current state of 'peer'.
+  void SyncPeerWatermarksUnlocked(const TrackedPeer& peer);
+
+  // Rebuilds 'peer_watermarks_' from all the tracked peers, for when the
+  // config, which determines the peers' quorum ids, changes.
+  void RebuildPeerWatermarksUnlocked();
+
+  // Returns whether 'peer_watermarks_' matches the state of the tracked
+  // peers. For DCHECKs.
+  bool PeerWatermarksMatchPeersUnlocked();
+
   // Update the peer's last exchange status, and other fields, based on the
   // response. Sets 'lmp_mismatch' to true if the given response indicates
   // there was a log-matching property mismatch on the remote, otherwise sets
@@ -547,6 +816,19 @@ class PeerMessageQueue {
   void UpdateExchangeStatus(TrackedPeer* peer, const TrackedPeer& prev_peer_state,
                             const ConsensusResponsePB& response, bool* lmp_mismatch);
 
+  // Adaptive batch sizing. Starts timing the batch of 'bytes' ending at
+  // 'last_index' sent to 'peer', unless another batch is already being timed.
+  void StartBatchSampleUnlocked(TrackedPeer* peer, int64_t last_index, int64_t bytes);
+
+  // Adapts the peer's batch size to how the batch being timed fared: grows it
+  // if the peer acked a full batch within --consensus_adaptive_batch_target_rtt_ms
+  // and shrinks it if the ack took longer. If 'failed', the request timed out
+  // or otherwise failed and the batch size is halved.
+  void FinishBatchSampleUnlocked(TrackedPeer* peer, bool failed);
+
+  // Updates the min_peer_batch_size and min_peer_throughput gauges.
+  void UpdateBatchMetricsUnlocked();
+
   // Check if the peer is a NON_VOTER candidate ready for promotion. If so,
   // trigger promotion.
   void PromoteIfNeeded(TrackedPeer* peer, const TrackedPeer& prev_peer_state,
@@ -571,6 +853,15 @@ class PeerMessageQueue {
   bool PeerTransferLeadershipImmediatelyUnlocked(
       const std::string& peer_uuid);
 
+  bool IsFastTransferTargetUnlocked(const std::string& peer_uuid) const;
+
+  // Whether 'peer_uuid' is a NON_VOTER of the active config.
+  bool IsLearnerUnlocked(const std::string& peer_uuid) const;
+
+  // Whether any remote voter lags the leader's log by at least
+  // --consensus_catchup_min_lag_ops ops.
+  bool AnyVoterCatchingUpUnlocked() const;
+
   // Calculate a peer's up-to-date health status based on internal fields.
   static HealthReportPB::HealthStatus PeerHealthStatus(const TrackedPeer& peer);
 
@@ -582,13 +873,47 @@ class PeerMessageQueue {
                                        int64_t term,
                                        const std::string& reason);
   void NotifyObserversOfPeerToPromote(const std::string& peer_uuid);
+  void NotifyObserversOfPeerNeedsSnapshot(const std::string& peer_uuid,
+                                          int64_t snapshot_index);
+
+  // Notifies the observers that 'uuid' needs the snapshot through
+  // 'snapshot_index', unless they have already been told so.
+  void MaybeNotifyPeerNeedsSnapshot(const std::string& uuid, int64_t snapshot_index);
   void NotifyObserversOfSuccessor(const std::string& peer_uuid);
   void NotifyObserversOfPeerHealthChange();
+  void NotifyObserversOfProxyTopologyChange(ProxyTopologyPB proxy_topology);
+
+  // With --raft_cost_based_proxy_topology, rebuilds the proxy topology from
+  // the measured costs of the links to the peers at most once every
+  // --raft_cost_based_proxy_topology_interval_ms, and has the observers
+  // install it if it changed.
+  void MaybeRebuildProxyTopologyUnlocked();
 
   // Notify all PeerMessageQueueObservers using the given callback function.
   void NotifyObserversTask(const std::function<void(PeerMessageQueueObserver*)>& func);
 
-  typedef std::unordered_map<std::string, TrackedPeer*> PeersMap;
+  // A notification of which at most one delivery is pending on
+  // 'raft_pool_observers_token_' at a time. The delivery carries the highest
+  // value posted since the previous one.
+  struct CoalescedNotification {
+    static constexpr int64_t kNoValue = -1;
+    std::atomic<int64_t> pending{kNoValue};
+    std::atomic<bool> scheduled{false};
+  };
+
+  // Records 'value' in 'notification'. Returns true if the caller must submit
+  // the delivery with SubmitCoalescedNotification().
+  static bool PostCoalescedNotification(CoalescedNotification* notification,
+                                        int64_t value);
+
+  // Submits a task which takes the pending value of 'notification' and
+  // passes it to 'func' for every observer.
+  void SubmitCoalescedNotification(
+      CoalescedNotification* notification,
+      std::function<void(PeerMessageQueueObserver*, int64_t)> func,
+      const std::string& error_msg);
+
+  typedef std::unordered_map<PeerId, TrackedPeer*> PeersMap;
 
   std::string ToStringUnlocked() const;
 
@@ -599,6 +924,68 @@ class PeerMessageQueue {
   // Updates the metrics based on index math.
   void UpdateMetricsUnlocked();
 
+  // The ops which were read ahead from the log for a lagging peer: the ops
+  // from 'first_index' on, and the id of the op preceding them. Ops are
+  // dropped from the front as the peer is sent ops past them.
+  struct PrefetchBuffer {
+    simple_spinlock lock;
+    bool in_progress = false;
+    int64_t first_index = kInvalidOpIdIndex;
+    OpId preceding_id;
+    std::deque<ReplicateRefPtr> ops;
+    std::deque<int64_t> op_bytes;
+    int64_t bytes = 0;
+
+    int64_t end_index() const { return first_index + ops.size(); }
+  };
+
+  // Fills 'messages' with the prefetched ops after 'after_op_index', up to
+  // 'max_size_bytes' but at least one, and sets 'preceding_id'. Returns false
+  // if 'buffer' doesn't hold the op after 'after_op_index'.
+  bool ReadPrefetchedOps(PrefetchBuffer* buffer, int64_t after_op_index,
+                         int64_t max_size_bytes, std::vector<ReplicateRefPtr>* messages,
+                         OpId* preceding_id);
+
+  // Schedules reading ahead the ops from 'next_index' on for the peer with
+  // 'uuid', if they are no longer cached and the peer's prefetch buffer
+  // doesn't hold enough of 'batches' batches of them already.
+  void MaybePrefetchForPeer(const std::string& uuid, const TrackedPeer& peer_copy,
+                            int64_t next_index, int batches);
+
+  // Runs on 'prefetch_pool_token_'. Reads the ops from 'next_index' on into
+  // 'buffer', a batch at a time, until it holds 'batches' batches or the ops
+  // left are cached.
+  //
+  // With --consensus_prefetch_async_log_reads, issues a single asynchronous
+  // read of the whole range from the log instead, and the buffer is filled
+  // wherever the log runs the read's callback.
+  void PrefetchOpsTask(const std::shared_ptr<PrefetchBuffer>& buffer, int64_t next_index,
+                       int batches, const std::string& uuid, const std::string& host,
+                       int port);
+
+  // Appends 'messages', the ops from 'next_index' on which follow
+  // 'preceding_id', to 'buffer', whose lock must be held.
+  static void AddPrefetchedOpsUnlocked(PrefetchBuffer* buffer, int64_t next_index,
+                                       const OpId& preceding_id,
+                                       std::vector<ReplicateRefPtr>* messages);
+
+  // Returns the throttler of 'budget' for 'bytes_per_sec', or nullptr if
+  // 'bytes_per_sec' isn't positive.
+  static std::shared_ptr<Throttler> CatchupThrottler(CatchupBudget* budget,
+                                                     int64_t bytes_per_sec);
+
+  // The most bytes of ops which a request under a catch-up budget of
+  // 'bytes_per_sec' carries: what the budget grants over a heartbeat
+  // interval, so that a peer which is over budget is back within it by its
+  // next heartbeat.
+  static int64_t CatchupRequestBytes(int64_t bytes_per_sec);
+
+  // Copies the current 'queue_state_' into 'published_'.
+  void PublishQueueStateUnlocked();
+
+  // Reads the published 'last_appended' and 'current_term'.
+  void ReadPublishedLogState(OpId* last_appended, int64_t* current_term) const;
+
   // Update the metric that measures how many ops behind the leader the local
   // replica believes it is (0 if leader).
   void UpdateLagMetricsUnlocked();
@@ -654,7 +1041,7 @@ class PeerMessageQueue {
   // This function returns the old watermark.
   int64_t DoComputeNewWatermarkStaticMode(
     const std::map<std::string, int>& voter_distribution,
-    const std::map<std::string, std::vector<int64_t> >& watermarks_by_region,
+    const std::map<std::string, std::vector<int64_t>>& watermarks_by_region,
     int64_t* watermark);
   int64_t ComputeNewWatermarkStaticMode(int64_t* watermark);
 
@@ -682,6 +1069,12 @@ class PeerMessageQueue {
   // The pool token which executes observer notifications.
   std::unique_ptr<ThreadPoolToken> raft_pool_observers_token_;
 
+  // Pending notifications, when --consensus_coalesce_observer_notifications
+  // is set.
+  CoalescedNotification commit_index_notification_;
+  CoalescedNotification term_notification_;
+  CoalescedNotification health_notification_;
+
   // PB containing identifying information about the local peer.
   RaftPeerPB local_peer_pb_;
 
@@ -692,12 +1085,64 @@ class PeerMessageQueue {
 
   QueueState queue_state_;
 
+  // Requests sent before this time are disregarded by
+  // GetMajorityAckedSendTime(). Protected by 'queue_lock_'.
+  MonoTime ack_send_time_floor_;
+
+  // Copies of the parts of 'queue_state_' which RaftConsensus reads, published
+  // under 'queue_lock_' whenever they may have changed so that the getters
+  // don't contend for the lock with the appends and the peer responses.
+  struct PublishedState {
+    std::atomic<int64_t> committed_index{0};
+    std::atomic<int64_t> all_replicated_index{0};
+    std::atomic<int64_t> majority_replicated_index{0};
+    std::atomic<int64_t> region_durable_index{0};
+    std::atomic<bool> leader_mode{false};
+    std::atomic<bool> committed_index_in_current_term{false};
+
+    // 'last_appended' and 'current_term' are read together, so they are
+    // published under a sequence count which is odd while they are written.
+    std::atomic<uint64_t> log_state_seq{0};
+    std::atomic<int64_t> last_appended_term{0};
+    std::atomic<int64_t> last_appended_index{0};
+    std::atomic<int64_t> current_term{0};
+  };
+  PublishedState published_;
+
+  // The health reports of the tracked peers, republished under 'queue_lock_'
+  // whenever a peer is tracked, untracked or changes health, for
+  // ReportHealthOfPeers() to read without the lock under
+  // --consensus_incremental_peer_health. Accessed with std::atomic_load() and
+  // std::atomic_store().
+  std::shared_ptr<const std::unordered_map<std::string, HealthReportPB>> health_snapshot_;
+
+  // See SetSnapshotIndex().
+  std::atomic<int64_t> snapshot_index_{-1};
+
+  // The catch-up budgets of the regions under
+  // --consensus_catchup_region_bytes_per_sec, keyed by region. Protected by
+  // 'queue_lock_'.
+  std::unordered_map<std::string, CatchupBudget> region_catchup_budgets_;
+
+  // The catch-up budget shared by the learners under
+  // --raft_learner_catchup_bytes_per_sec. Protected by 'queue_lock_'.
+  CatchupBudget learner_catchup_budget_;
+
+  // The pool token which prefetches ops for lagging peers. Set before the
+  // queue is used; null if ops aren't prefetched.
+  std::unique_ptr<ThreadPoolToken> prefetch_pool_token_;
+
+  // The prefetch buffers of the peers, keyed by uuid. Dropped when the log is
+  // truncated or the queue changes mode, so that a buffer never holds ops
+  // from before either. Protected by 'queue_lock_'.
+  std::unordered_map<std::string, std::shared_ptr<PrefetchBuffer>> prefetch_buffers_;
+
   // Should we adjust voter distribution based on current config?
   bool adjust_voter_distribution_;
 
   // The currently tracked peers.
   PeersMap peers_map_;
-  mutable simple_spinlock queue_lock_; // TODO(todd): rename
+  mutable profiled_adaptive_mutex queue_lock_; // TODO(todd): rename
 
   bool successor_watch_in_progress_;
   boost::optional<std::string> designated_successor_uuid_;
@@ -710,8 +1155,27 @@ class PeerMessageQueue {
   // doesn't change.
   DFAKE_MUTEX(append_fake_lock_);
 
+  // The last received indexes of the tracked peers, as the watermarks are
+  // computed over them. Protected by 'queue_lock_'.
+  PeerWatermarks peer_watermarks_;
+
   LogCache log_cache_;
 
+  // A batch of ops serialized by SerializeOpsForPeers(), and the ops it holds.
+  // Holding on to the ops keeps their addresses from being reused, so that a
+  // batch can be recognized by the addresses of its ops.
+  struct SerializedOps {
+    std::vector<ReplicateRefPtr> msgs;
+    bool packed;
+    bool delta;
+    std::shared_ptr<const std::string> buf;
+  };
+
+  // The most recently serialized batches, most recent first. Protected by
+  // 'serialized_ops_lock_'.
+  std::deque<SerializedOps> serialized_ops_;
+  simple_spinlock serialized_ops_lock_;
+
   Metrics metrics_;
 
   scoped_refptr<ITimeManager> time_manager_;
@@ -727,6 +1191,11 @@ class PeerMessageQueue {
   // which proxy peer is marked unhealthy
   int64_t proxy_failure_threshold_lag_ = 1000;
 
+  // The proxy topology last built by MaybeRebuildProxyTopologyUnlocked() in
+  // the current term, and when. Protected by 'queue_lock_'.
+  ProxyTopologyPB cost_based_proxy_topology_;
+  MonoTime last_proxy_topology_rebuild_;
+
   // An instance of PersistentVars with access to some persistent global vars
   scoped_refptr<PersistentVars> persistent_vars_;
 };
@@ -760,6 +1229,15 @@ class PeerMessageQueueObserver {
   // Notify the observer that the health of one of the peers has changed.
   virtual void NotifyPeerHealthChange() = 0;
 
+  // Notify the observer that the proxy topology was rebuilt from the costs of
+  // the links to the peers, and should be installed.
+  virtual void NotifyProxyTopologyChange(const ProxyTopologyPB& proxy_topology) = 0;
+
+  // Notify the observer that the specified peer needs ops which were GCed from
+  // the log but are covered by the snapshot through 'snapshot_index'.
+  virtual void NotifyPeerNeedsSnapshot(const std::string& peer_uuid,
+                                       int64_t snapshot_index) = 0;
+
   virtual ~PeerMessageQueueObserver() {}
 };
 
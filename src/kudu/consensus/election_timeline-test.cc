@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/election_timeline.h"
+
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/jsonwriter.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::ostringstream;
+using std::string;
+
+namespace kudu {
+namespace consensus {
+
+class ElectionTimelineTest : public KuduTest {};
+
+TEST_F(ElectionTimelineTest, TestPhases) {
+  ElectionTimeline timeline(5, "leader failure");
+  const MonoTime start = MonoTime::Now();
+  timeline.RecordPhase(ElectionTimeline::PRE_ELECTION_STARTED, start);
+  timeline.RecordPhase(ElectionTimeline::PRE_ELECTION_DECIDED,
+                       start + MonoDelta::FromMilliseconds(10));
+  timeline.RecordPhase(ElectionTimeline::ELECTION_STARTED,
+                       start + MonoDelta::FromMilliseconds(12));
+  timeline.RecordPhase(ElectionTimeline::ELECTION_DECIDED,
+                       start + MonoDelta::FromMilliseconds(30));
+  // Only the first time a phase is recorded counts.
+  timeline.RecordPhase(ElectionTimeline::ELECTION_DECIDED,
+                       start + MonoDelta::FromMilliseconds(50));
+
+  ASSERT_EQ(5, timeline.term());
+  ASSERT_EQ(10, timeline.Between(ElectionTimeline::PRE_ELECTION_STARTED,
+                                 ElectionTimeline::PRE_ELECTION_DECIDED).ToMilliseconds());
+  ASSERT_EQ(18, timeline.Between(ElectionTimeline::ELECTION_STARTED,
+                                 ElectionTimeline::ELECTION_DECIDED).ToMilliseconds());
+  ASSERT_EQ(30, timeline.TimeTo(ElectionTimeline::ELECTION_DECIDED).ToMilliseconds());
+
+  // Phases which didn't happen have no time.
+  ASSERT_FALSE(timeline.phase_time(ElectionTimeline::VOTE_FLUSHED).Initialized());
+  ASSERT_FALSE(timeline.TimeTo(ElectionTimeline::NOOP_COMMITTED).Initialized());
+  ASSERT_FALSE(timeline.Between(ElectionTimeline::ELECTION_STARTED,
+                                ElectionTimeline::VOTE_FLUSHED).Initialized());
+}
+
+TEST_F(ElectionTimelineTest, TestVotesAndOutcome) {
+  ElectionTimeline timeline(3, "leader failure");
+  timeline.RecordPhase(ElectionTimeline::ELECTION_STARTED);
+  timeline.RecordVote("peer-1", false, true, "");
+  timeline.RecordVote("peer-2", false, false, "Timed out");
+  ASSERT_EQ(2, timeline.votes().size());
+  ASSERT_EQ("peer-1", timeline.votes()[0].voter_uuid);
+  ASSERT_TRUE(timeline.votes()[0].granted);
+  ASSERT_FALSE(timeline.votes()[1].granted);
+  ASSERT_EQ("Timed out", timeline.votes()[1].error);
+
+  ASSERT_EQ("", timeline.outcome());
+  ASSERT_TRUE(timeline.Finish("won"));
+  ASSERT_FALSE(timeline.Finish("superseded"));
+  ASSERT_EQ("won", timeline.outcome());
+
+  ostringstream out;
+  {
+    JsonWriter jw(&out, JsonWriter::COMPACT);
+    timeline.WriteAsJson(&jw);
+  }
+  const string json = out.str();
+  ASSERT_STR_CONTAINS(json, "\"term\":3");
+  ASSERT_STR_CONTAINS(json, "\"outcome\":\"won\"");
+  ASSERT_STR_CONTAINS(json, "\"election_started\":0");
+  ASSERT_STR_CONTAINS(json, "\"voter_uuid\":\"peer-2\"");
+  ASSERT_STR_CONTAINS(json, "\"error\":\"Timed out\"");
+  ASSERT_STR_CONTAINS(timeline.ToString(), "vote from peer-1 granted");
+}
+
+} // namespace consensus
+} // namespace kudu
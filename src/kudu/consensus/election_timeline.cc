@@ -0,0 +1,192 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/election_timeline.h"
+
+#include <mutex>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/jsonwriter.h"
+
+using std::lock_guard;
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+const char* ElectionTimeline::PhaseName(Phase phase) {
+  switch (phase) {
+    case LEADER_LAST_HEARD: return "leader_last_heard";
+    case FAILURE_DETECTED: return "failure_detected";
+    case PRE_ELECTION_STARTED: return "pre_election_started";
+    case PRE_ELECTION_DECIDED: return "pre_election_decided";
+    case ELECTION_STARTED: return "election_started";
+    case VOTE_FLUSHED: return "vote_flushed";
+    case ELECTION_DECIDED: return "election_decided";
+    case BECAME_LEADER: return "became_leader";
+    case NOOP_COMMITTED: return "noop_committed";
+    case kNumPhases: break;
+  }
+  LOG(FATAL) << "unknown election phase " << phase;
+  return nullptr;
+}
+
+ElectionTimeline::ElectionTimeline(int64_t term, string reason)
+    : term_(term),
+      reason_(std::move(reason)),
+      start_wall_micros_(GetCurrentTimeMicros()) {
+}
+
+void ElectionTimeline::RecordPhase(Phase phase, MonoTime at) {
+  DCHECK_LT(phase, kNumPhases);
+  lock_guard<simple_spinlock> l(lock_);
+  if (!phases_[phase].Initialized()) {
+    phases_[phase] = at;
+  }
+}
+
+void ElectionTimeline::RecordVote(const string& voter_uuid, bool pre_election,
+                                  bool granted, const string& error) {
+  Vote vote;
+  vote.voter_uuid = voter_uuid;
+  vote.pre_election = pre_election;
+  vote.granted = granted;
+  vote.received = MonoTime::Now();
+  vote.error = error;
+  lock_guard<simple_spinlock> l(lock_);
+  votes_.emplace_back(std::move(vote));
+}
+
+bool ElectionTimeline::Finish(const string& outcome) {
+  lock_guard<simple_spinlock> l(lock_);
+  if (!outcome_.empty()) {
+    return false;
+  }
+  outcome_ = outcome;
+  return true;
+}
+
+MonoTime ElectionTimeline::phase_time(Phase phase) const {
+  lock_guard<simple_spinlock> l(lock_);
+  return phases_[phase];
+}
+
+MonoTime ElectionTimeline::StartUnlocked() const {
+  for (const MonoTime& t : phases_) {
+    if (t.Initialized()) {
+      return t;
+    }
+  }
+  return MonoTime();
+}
+
+MonoDelta ElectionTimeline::TimeTo(Phase phase) const {
+  lock_guard<simple_spinlock> l(lock_);
+  if (!phases_[phase].Initialized()) {
+    return MonoDelta();
+  }
+  return phases_[phase] - StartUnlocked();
+}
+
+MonoDelta ElectionTimeline::Between(Phase from, Phase to) const {
+  lock_guard<simple_spinlock> l(lock_);
+  if (!phases_[from].Initialized() || !phases_[to].Initialized()) {
+    return MonoDelta();
+  }
+  return phases_[to] - phases_[from];
+}
+
+vector<ElectionTimeline::Vote> ElectionTimeline::votes() const {
+  lock_guard<simple_spinlock> l(lock_);
+  return votes_;
+}
+
+string ElectionTimeline::outcome() const {
+  lock_guard<simple_spinlock> l(lock_);
+  return outcome_;
+}
+
+void ElectionTimeline::WriteAsJson(JsonWriter* jw) const {
+  lock_guard<simple_spinlock> l(lock_);
+  const MonoTime start = StartUnlocked();
+  jw->StartObject();
+  jw->String("term");
+  jw->Int64(term_);
+  jw->String("reason");
+  jw->String(reason_);
+  jw->String("outcome");
+  jw->String(outcome_.empty() ? "in progress" : outcome_);
+  jw->String("start_wall_micros");
+  jw->Int64(start_wall_micros_);
+  jw->String("phases_us");
+  jw->StartObject();
+  for (int i = 0; i < kNumPhases; i++) {
+    if (phases_[i].Initialized()) {
+      jw->String(PhaseName(static_cast<Phase>(i)));
+      jw->Int64((phases_[i] - start).ToMicroseconds());
+    }
+  }
+  jw->EndObject();
+  jw->String("votes");
+  jw->StartArray();
+  for (const Vote& vote : votes_) {
+    jw->StartObject();
+    jw->String("voter_uuid");
+    jw->String(vote.voter_uuid);
+    jw->String("pre_election");
+    jw->Bool(vote.pre_election);
+    jw->String("granted");
+    jw->Bool(vote.granted);
+    jw->String("received_us");
+    jw->Int64(start.Initialized() ? (vote.received - start).ToMicroseconds() : 0);
+    if (!vote.error.empty()) {
+      jw->String("error");
+      jw->String(vote.error);
+    }
+    jw->EndObject();
+  }
+  jw->EndArray();
+  jw->EndObject();
+}
+
+string ElectionTimeline::ToString() const {
+  lock_guard<simple_spinlock> l(lock_);
+  const MonoTime start = StartUnlocked();
+  string ret = Substitute("term $0 ($1): $2", term_, reason_,
+                          outcome_.empty() ? "in progress" : outcome_);
+  for (int i = 0; i < kNumPhases; i++) {
+    if (phases_[i].Initialized()) {
+      ret += Substitute(", $0 +$1us", PhaseName(static_cast<Phase>(i)),
+                        (phases_[i] - start).ToMicroseconds());
+    }
+  }
+  for (const Vote& vote : votes_) {
+    ret += Substitute(", $0vote from $1 $2 +$3us", vote.pre_election ? "pre-" : "",
+                      vote.voter_uuid, vote.granted ? "granted" : "denied",
+                      start.Initialized() ? (vote.received - start).ToMicroseconds() : 0);
+  }
+  return ret;
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,126 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+
+class JsonWriter;
+
+namespace consensus {
+
+// The timeline of an attempt of a replica to become leader, from the failure
+// of the previous leader being detected to the first op of the new term
+// committing, for finding out where the time of a failover goes.
+//
+// A timeline covers a pre-election and the election it leads to, if any. The
+// candidate records its phases, and LeaderElection records the vote responses
+// as they arrive, so this class is thread-safe.
+class ElectionTimeline {
+ public:
+  enum Phase {
+    // The last time the replica heard from a leader before the election.
+    LEADER_LAST_HEARD,
+    // The failure detector fired.
+    FAILURE_DETECTED,
+    PRE_ELECTION_STARTED,
+    PRE_ELECTION_DECIDED,
+    ELECTION_STARTED,
+    // The vote for itself in the new term was flushed to the cmeta.
+    VOTE_FLUSHED,
+    ELECTION_DECIDED,
+    BECAME_LEADER,
+    // The no-op the leader replicates at the start of its term committed.
+    NOOP_COMMITTED,
+    kNumPhases
+  };
+
+  static const char* PhaseName(Phase phase);
+
+  // A vote response, or the failure to get one.
+  struct Vote {
+    std::string voter_uuid;
+    bool pre_election;
+    bool granted;
+    MonoTime received;
+    // The RPC or tablet error, if the voter didn't answer.
+    std::string error;
+  };
+
+  // Starts the timeline of a campaign for 'term', started for 'reason'.
+  ElectionTimeline(int64_t term, std::string reason);
+
+  // Records that 'phase' happened at 'at'. Only the first time a phase is
+  // recorded counts.
+  void RecordPhase(Phase phase, MonoTime at = MonoTime::Now());
+
+  void RecordVote(const std::string& voter_uuid, bool pre_election,
+                  bool granted, const std::string& error);
+
+  // Marks the timeline as over, with 'outcome' such as "won" or "lost".
+  // Returns false if it was already over.
+  bool Finish(const std::string& outcome);
+
+  // Returns when 'phase' happened, or an uninitialized MonoTime if it
+  // didn't.
+  MonoTime phase_time(Phase phase) const;
+
+  // Returns the time from the first phase recorded to 'phase', or an
+  // uninitialized MonoDelta if it didn't happen.
+  MonoDelta TimeTo(Phase phase) const;
+
+  // Returns the time between two phases, or an uninitialized MonoDelta if
+  // either didn't happen.
+  MonoDelta Between(Phase from, Phase to) const;
+
+  int64_t term() const { return term_; }
+  std::vector<Vote> votes() const;
+  std::string outcome() const;
+
+  // Writes the timeline as an object, with the phases and votes in
+  // microseconds since the first phase.
+  void WriteAsJson(JsonWriter* jw) const;
+
+  std::string ToString() const;
+
+ private:
+  MonoTime StartUnlocked() const;
+
+  const int64_t term_;
+  const std::string reason_;
+
+  // The wall clock time the timeline was started, to match it with the logs.
+  const int64_t start_wall_micros_;
+
+  mutable simple_spinlock lock_;
+  MonoTime phases_[kNumPhases];
+  std::vector<Vote> votes_;
+  std::string outcome_;
+
+  DISALLOW_COPY_AND_ASSIGN(ElectionTimeline);
+};
+
+} // namespace consensus
+} // namespace kudu
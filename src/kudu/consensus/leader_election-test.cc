@@ -24,6 +24,7 @@
 #include "kudu/consensus/leader_election.h"
 
 #include <functional>
+#include <map>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -710,6 +711,97 @@ TEST_F(VoteCounterTest, TestVoteCounter_EvenVoters) {
   }
 }
 
+// Voters in the candidate's and in the last known leader's regions are sent
+// their vote requests first.
+TEST(FlexibleVoteCounterTest, TestLikelyDecidingVoters) {
+  RaftConfigPB config;
+  const std::map<string, string> regions = {
+    {"A", "r1"}, {"B", "r1"}, {"C", "r2"}, {"D", "r3"}, {"E", "r3"} };
+  for (const auto& entry : regions) {
+    RaftPeerPB* peer = config.add_peers();
+    peer->set_permanent_uuid(entry.first);
+    peer->set_member_type(RaftPeerPB::VOTER);
+    peer->mutable_attrs()->set_region(entry.second);
+  }
+  (*config.mutable_voter_distribution())["r1"] = 2;
+  (*config.mutable_voter_distribution())["r2"] = 1;
+  (*config.mutable_voter_distribution())["r3"] = 2;
+  config.mutable_commit_rule()->set_mode(QuorumMode::SINGLE_REGION_DYNAMIC);
+
+  LastKnownLeaderPB last_known_leader;
+  last_known_leader.set_uuid("C");
+  last_known_leader.set_election_term(1);
+  FlexibleVoteCounter counter("A", 2, last_known_leader, config, true);
+
+  ASSERT_TRUE(counter.IsLikelyDecidingVoter("B"));
+  ASSERT_TRUE(counter.IsLikelyDecidingVoter("C"));
+  ASSERT_FALSE(counter.IsLikelyDecidingVoter("D"));
+  ASSERT_FALSE(counter.IsLikelyDecidingVoter("E"));
+  ASSERT_FALSE(counter.IsLikelyDecidingVoter("F"));
+}
+
+// Test the compiled region checks, for a static rule requiring a majority in
+// two of three regions.
+TEST(RegionQuorumEvaluatorTest, TestStaticQuorum) {
+  std::map<string, int> voter_distribution = { {"a", 3}, {"b", 3}, {"c", 1} };
+  CommitRulePB commit_rule;
+  commit_rule.set_mode(QuorumMode::STATIC_CONJUNCTION);
+  CommitRulePredicatePB* predicate = commit_rule.add_rule_predicates();
+  predicate->add_regions("a");
+  predicate->add_regions("b");
+  predicate->add_regions("c");
+  predicate->set_regions_subset_size(2);
+
+  std::unique_ptr<RegionQuorumEvaluator> evaluator;
+  ASSERT_OK(RegionQuorumEvaluator::Create(voter_distribution, commit_rule, &evaluator));
+  ASSERT_EQ(3, evaluator->num_regions());
+  ASSERT_EQ(-1, evaluator->RegionIndex("d"));
+  const int a = evaluator->RegionIndex("a");
+  const int b = evaluator->RegionIndex("b");
+  const int c = evaluator->RegionIndex("c");
+
+  ASSERT_EQ(std::make_pair(false, true), evaluator->IsStaticQuorumSatisfied());
+
+  // Two yes votes are a majority in "a".
+  evaluator->RegisterVote(a, VOTE_GRANTED);
+  ASSERT_EQ(std::make_pair(false, true), evaluator->IsRegionSatisfied(a));
+  evaluator->RegisterVote(a, VOTE_GRANTED);
+  ASSERT_EQ(std::make_pair(true, true), evaluator->IsRegionSatisfied(a));
+  ASSERT_EQ(std::make_pair(false, true), evaluator->IsStaticQuorumSatisfied());
+
+  // The only voter of "c" says no, so "b" is needed.
+  evaluator->RegisterVote(c, VOTE_DENIED);
+  ASSERT_EQ(std::make_pair(false, false), evaluator->IsRegionSatisfied(c));
+  ASSERT_EQ(std::make_pair(false, true), evaluator->IsStaticQuorumSatisfied());
+  ASSERT_EQ(std::make_pair(false, false),
+            evaluator->AreAllRegionsSatisfied(evaluator->all_regions()));
+
+  evaluator->RegisterVote(b, VOTE_DENIED);
+  evaluator->RegisterVote(b, VOTE_DENIED);
+  ASSERT_EQ(std::make_pair(false, false), evaluator->IsStaticQuorumSatisfied());
+  ASSERT_EQ(std::make_pair(true, true),
+            evaluator->AreRegionsSatisfied(evaluator->all_regions(), 1));
+
+  RegionQuorumEvaluator::RegionMask mask;
+  ASSERT_TRUE(evaluator->MaskOfRegions({"a"}, &mask));
+  ASSERT_EQ(std::make_pair(true, true), evaluator->AreAllRegionsSatisfied(mask));
+  ASSERT_FALSE(evaluator->MaskOfRegions({"a", "d"}, &mask));
+}
+
+// Rules naming regions that aren't in the distribution aren't compiled.
+TEST(RegionQuorumEvaluatorTest, TestUnknownRegion) {
+  std::map<string, int> voter_distribution = { {"a", 3} };
+  CommitRulePB commit_rule;
+  commit_rule.set_mode(QuorumMode::STATIC_DISJUNCTION);
+  CommitRulePredicatePB* predicate = commit_rule.add_rule_predicates();
+  predicate->add_regions("b");
+  predicate->set_regions_subset_size(1);
+
+  std::unique_ptr<RegionQuorumEvaluator> evaluator;
+  Status s = RegionQuorumEvaluator::Create(voter_distribution, commit_rule, &evaluator);
+  ASSERT_TRUE(s.IsNotSupported()) << s.ToString();
+  ASSERT_FALSE(evaluator);
+}
 
 }  // namespace consensus
 }  // namespace kudu
@@ -36,9 +36,11 @@
 
 #include "kudu/common/wire_protocol.h"
 #include "kudu/consensus/consensus_peers.h"
+#include "kudu/consensus/election_timeline.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/quorum_util.h"
 #include "kudu/gutil/bind.h"
+#include "kudu/gutil/bits.h"
 #include "kudu/gutil/callback.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
@@ -68,6 +70,17 @@ DEFINE_bool(trust_last_leader_entries, true,
 DEFINE_int32(wait_for_pessimistic_quorum_secs, 10,
              "Secs to wait for pessimistic quorum to be satisfied before "
              "trying the voter history method");
+DEFINE_bool(raft_election_cancel_outstanding_requests, false,
+            "Once an election is decided, cancel the vote requests still "
+            "outstanding and don't send the ones not sent yet, instead of "
+            "waiting for them to complete or time out");
+DEFINE_bool(raft_election_prioritize_deciding_voters, false,
+            "Send vote requests to the voters likely to decide the election, "
+            "e.g. in flexiraft those in the last known leader's region, first");
+DEFINE_bool(flexi_raft_compiled_quorum_evaluator, false,
+            "In flexiraft, compile the region-wise majority checks of the "
+            "config when an election starts so that each vote is counted "
+            "with bitmask updates instead of re-walking the per-region counts");
 
 namespace kudu {
 namespace consensus {
@@ -209,6 +222,137 @@ PotentialNextLeadersResponse::PotentialNextLeadersResponse(
   next_term = term;
 }
 
+///////////////////////////////////////////////////
+// RegionQuorumEvaluator
+///////////////////////////////////////////////////
+
+const int RegionQuorumEvaluator::kMaxRegions;
+
+Status RegionQuorumEvaluator::Create(
+    const std::map<std::string, int>& voter_distribution,
+    const CommitRulePB& commit_rule,
+    std::unique_ptr<RegionQuorumEvaluator>* evaluator) {
+  if (voter_distribution.size() > kMaxRegions) {
+    return Status::NotSupported(Substitute(
+        "$0 regions, at most $1 are supported",
+        voter_distribution.size(), kMaxRegions));
+  }
+  std::unique_ptr<RegionQuorumEvaluator> e(new RegionQuorumEvaluator());
+  for (const std::pair<const std::string, int>& regional_voter_count :
+      voter_distribution) {
+    int idx = e->voters_.size();
+    e->region_index_.emplace(regional_voter_count.first, idx);
+    e->voters_.push_back(regional_voter_count.second);
+    // A region without voters can't be satisfied, as with the majority of
+    // zero voters being one.
+    e->majority_size_.push_back(
+        MajoritySize(std::max(regional_voter_count.second, 1)));
+    e->yes_votes_.push_back(0);
+    e->no_votes_.push_back(0);
+    e->all_regions_ |= RegionMask{1} << idx;
+    e->UpdateRegion(idx);
+  }
+
+  if (IsStaticQuorumMode(commit_rule.mode())) {
+    for (const CommitRulePredicatePB& rule_predicate :
+        commit_rule.rule_predicates()) {
+      Predicate predicate;
+      predicate.regions = 0;
+      predicate.required = rule_predicate.regions_size() + 1 -
+          rule_predicate.regions_subset_size();
+      for (const std::string& region : rule_predicate.regions()) {
+        int idx = e->RegionIndex(region);
+        if (idx < 0) {
+          return Status::NotSupported(Substitute(
+              "commit rule region $0 has no voters", region));
+        }
+        RegionMask bit = RegionMask{1} << idx;
+        if (predicate.regions & bit) {
+          return Status::NotSupported(Substitute(
+              "commit rule region $0 is repeated", region));
+        }
+        predicate.regions |= bit;
+      }
+      e->predicates_.push_back(predicate);
+    }
+  }
+  *evaluator = std::move(e);
+  return Status::OK();
+}
+
+int RegionQuorumEvaluator::RegionIndex(const std::string& region) const {
+  return FindWithDefault(region_index_, region, -1);
+}
+
+void RegionQuorumEvaluator::RegisterVote(int region_idx, ElectionVote vote) {
+  DCHECK_GE(region_idx, 0);
+  DCHECK_LT(region_idx, num_regions());
+  switch (vote) {
+    case VOTE_GRANTED:
+      yes_votes_[region_idx]++;
+      break;
+    case VOTE_DENIED:
+      no_votes_[region_idx]++;
+      break;
+  }
+  UpdateRegion(region_idx);
+}
+
+void RegionQuorumEvaluator::UpdateRegion(int region_idx) {
+  const RegionMask bit = RegionMask{1} << region_idx;
+  const int majority = majority_size_[region_idx];
+  satisfied_ &= ~bit;
+  impossible_ &= ~bit;
+  if (yes_votes_[region_idx] >= majority) {
+    satisfied_ |= bit;
+  } else if (no_votes_[region_idx] + majority > voters_[region_idx]) {
+    impossible_ |= bit;
+  }
+}
+
+bool RegionQuorumEvaluator::MaskOfRegions(
+    const std::set<std::string>& regions, RegionMask* mask) const {
+  *mask = 0;
+  for (const std::string& region : regions) {
+    int idx = RegionIndex(region);
+    if (idx < 0) {
+      return false;
+    }
+    *mask |= RegionMask{1} << idx;
+  }
+  return true;
+}
+
+std::pair<bool, bool> RegionQuorumEvaluator::IsRegionSatisfied(
+    int region_idx) const {
+  return AreAllRegionsSatisfied(RegionMask{1} << region_idx);
+}
+
+std::pair<bool, bool> RegionQuorumEvaluator::AreRegionsSatisfied(
+    RegionMask mask, int count) const {
+  return std::make_pair<>(
+      Bits::CountOnes64(satisfied_ & mask) >= count,
+      Bits::CountOnes64(mask & ~impossible_) >= count);
+}
+
+std::pair<bool, bool> RegionQuorumEvaluator::AreAllRegionsSatisfied(
+    RegionMask mask) const {
+  return std::make_pair<>((satisfied_ & mask) == mask,
+                          (impossible_ & mask) == 0);
+}
+
+std::pair<bool, bool> RegionQuorumEvaluator::IsStaticQuorumSatisfied() const {
+  bool quorum_satisfied = true;
+  bool quorum_satisfaction_possible = true;
+  for (const Predicate& predicate : predicates_) {
+    std::pair<bool, bool> result =
+        AreRegionsSatisfied(predicate.regions, predicate.required);
+    quorum_satisfied = quorum_satisfied && result.first;
+    quorum_satisfaction_possible = quorum_satisfaction_possible && result.second;
+  }
+  return std::make_pair<>(quorum_satisfied, quorum_satisfaction_possible);
+}
+
 void FlexibleVoteCounter::FetchTopologyInfo() {
   CHECK(config_.has_commit_rule());
 
@@ -277,6 +421,14 @@ FlexibleVoteCounter::FlexibleVoteCounter(
   num_voters_ = uuid_to_quorum_id_.size();
 
   CHECK_GT(num_voters_, 0);
+
+  if (FLAGS_flexi_raft_compiled_quorum_evaluator) {
+    Status s = RegionQuorumEvaluator::Create(
+        voter_distribution_, config_.commit_rule(), &evaluator_);
+    if (!s.ok()) {
+      VLOG_WITH_PREFIX(1) << "Not compiling the election quorum: " << s.ToString();
+    }
+  }
 }
 
 Status FlexibleVoteCounter::RegisterVote(
@@ -316,6 +468,12 @@ Status FlexibleVoteCounter::RegisterVote(
       no_vote_count_[quorum_id]++;
       break;
   }
+  if (evaluator_) {
+    int region_idx = evaluator_->RegionIndex(quorum_id);
+    if (region_idx >= 0) {
+      evaluator_->RegisterVote(region_idx, vote_info.vote);
+    }
+  }
 
   // TODO - explain this more
   InsertOrUpdate(
@@ -434,6 +592,12 @@ FlexibleVoteCounter::IsMajoritySatisfiedInRegions(
 std::pair<bool, bool>
 FlexibleVoteCounter::IsMajoritySatisfiedInRegion(
     const std::string& region) const {
+  if (evaluator_) {
+    int region_idx = evaluator_->RegionIndex(region);
+    if (region_idx >= 0) {
+      return evaluator_->IsRegionSatisfied(region_idx);
+    }
+  }
   // We piggyback on the general implementation that takes a vector of
   // regions and then provides quorum satisfaction information corresponding
   // to each region. Each pair of booleans represent if the quorum is already
@@ -448,6 +612,9 @@ std::pair<bool, bool> FlexibleVoteCounter::IsStaticQuorumSatisfied() const {
   CHECK(config_.commit_rule().mode() == QuorumMode::STATIC_DISJUNCTION ||
       config_.commit_rule().mode() == QuorumMode::STATIC_CONJUNCTION);
   CHECK(config_.commit_rule().rule_predicates_size() > 0);
+  if (evaluator_) {
+    return evaluator_->IsStaticQuorumSatisfied();
+  }
   const auto& rule_predicates = config_.commit_rule().rule_predicates();
   bool quorum_satisfied = true;
   bool quorum_satisfaction_possible = true;
@@ -514,6 +681,9 @@ std::pair<bool, bool> FlexibleVoteCounter::IsStaticQuorumSatisfied() const {
 std::pair<bool, bool>
 FlexibleVoteCounter::IsPessimisticQuorumSatisfied() const {
   VLOG_WITH_PREFIX(3) << "Checking if pessimistic quorum is satisfied.";
+  if (evaluator_) {
+    return evaluator_->AreAllRegionsSatisfied(evaluator_->all_regions());
+  }
 
   // Fetching all regions.
   std::set<std::string> regions;
@@ -526,6 +696,10 @@ FlexibleVoteCounter::IsPessimisticQuorumSatisfied() const {
 
 std::pair<bool, bool>
 FlexibleVoteCounter::IsMajoritySatisfiedInMajorityOfRegions() const {
+  if (evaluator_) {
+    return evaluator_->AreRegionsSatisfied(
+        evaluator_->all_regions(), MajoritySize(evaluator_->num_regions()));
+  }
   std::vector<std::string> regions_vector;
   for (const std::pair<const std::string, int32_t>& regional_count :
       voter_distribution_) {
@@ -561,6 +735,10 @@ FlexibleVoteCounter::IsMajoritySatisfiedInMajorityOfRegions() const {
 std::pair<bool, bool> FlexibleVoteCounter::IsMajoritySatisfiedInAllRegions(
     const std::set<std::string>& regions) const {
   CHECK(!regions.empty());
+  RegionQuorumEvaluator::RegionMask mask;
+  if (evaluator_ && evaluator_->MaskOfRegions(regions, &mask)) {
+    return evaluator_->AreAllRegionsSatisfied(mask);
+  }
   std::vector<std::string> region_vector(regions.begin(), regions.end());
   const std::vector<std::pair<bool, bool> >& results =
       IsMajoritySatisfiedInRegions(region_vector);
@@ -1153,6 +1331,19 @@ Status FlexibleVoteCounter::GetDecision(ElectionVote* decision) const {
   return Status::IllegalState("Vote not yet decided");
 }
 
+bool FlexibleVoteCounter::IsLikelyDecidingVoter(
+    const std::string& voter_uuid) const {
+  const std::string voter_quorum_id = DetermineQuorumIdForUUID(voter_uuid);
+  if (voter_quorum_id.empty()) {
+    return false;
+  }
+  if (voter_quorum_id == DetermineQuorumIdForUUID(candidate_uuid_)) {
+    return true;
+  }
+  return last_known_leader_.has_uuid() &&
+      voter_quorum_id == DetermineQuorumIdForUUID(last_known_leader_.uuid());
+}
+
 std::string FlexibleVoteCounter::LogPrefix() const {
   return Substitute(
       "[Flexible Vote Counter] Election term: $0 ", election_term_);
@@ -1195,7 +1386,8 @@ LeaderElection::LeaderElection(RaftConfigPB config,
                                gscoped_ptr<VoteCounter> vote_counter,
                                MonoDelta timeout,
                                ElectionDecisionCallback decision_callback,
-                               std::shared_ptr<VoteLoggerInterface> vote_logger)
+                               std::shared_ptr<VoteLoggerInterface> vote_logger,
+                               std::shared_ptr<ElectionTimeline> timeline)
     : has_responded_(false),
       config_(std::move(config)),
       proxy_factory_(proxy_factory),
@@ -1205,7 +1397,8 @@ LeaderElection::LeaderElection(RaftConfigPB config,
       decision_callback_(std::move(decision_callback)),
       highest_voter_term_(0),
       start_time_(MonoTime::Now()),
-      vote_logger_(std::move(vote_logger)) {
+      vote_logger_(std::move(vote_logger)),
+      timeline_(std::move(timeline)) {
 }
 
 LeaderElection::~LeaderElection() {
@@ -1254,6 +1447,14 @@ void LeaderElection::Run() {
   // single-node configuration, since we always pre-vote for ourselves).
   CheckForDecision();
 
+  if (FLAGS_raft_election_prioritize_deciding_voters) {
+    std::stable_partition(
+        other_voter_uuids.begin(), other_voter_uuids.end(),
+        [this](const std::string& uuid) {
+          return vote_counter_->IsLikelyDecidingVoter(uuid);
+        });
+  }
+
   std::string msg;
   msg.reserve(100 * other_voter_uuids.size());
   size_t pnum = 0;
@@ -1265,6 +1466,10 @@ void LeaderElection::Run() {
       state = FindOrDie(voter_state_, voter_uuid);
       // Safe to drop the lock because voter_state_ is not mutated outside of
       // the constructor / destructor. We do this to avoid deadlocks below.
+      if (result_ && FLAGS_raft_election_cancel_outstanding_requests) {
+        // Decided already; the remaining votes can't change the result.
+        break;
+      }
     }
 
     // If we failed to construct the proxy, just record a 'NO' vote with the status
@@ -1301,6 +1506,17 @@ void LeaderElection::Run() {
         // gutil Callback to a thunk.
         boost::bind(&Closure::Run,
                     Bind(&LeaderElection::VoteResponseRpcCallback, this, voter_uuid)));
+    bool decided;
+    {
+      std::lock_guard<Lock> guard(lock_);
+      state->rpc_sent = true;
+      decided = has_responded_;
+    }
+    // The election may have been decided while the request was being sent,
+    // in which case CancelOutstandingRequests() skipped it.
+    if (decided && FLAGS_raft_election_cancel_outstanding_requests) {
+      CancelOutstandingRequests();
+    }
   }
   // Send the RPC request.
   LOG_WITH_PREFIX(INFO) << "Requesting "
@@ -1334,6 +1550,11 @@ void LeaderElection::CheckForDecision() {
 
       result_.reset(new ElectionResult(
             request_, decision, highest_voter_term_, msg, is_candidate_removed));
+      if (timeline_) {
+        timeline_->RecordPhase(request_.is_pre_election() ?
+                               ElectionTimeline::PRE_ELECTION_DECIDED :
+                               ElectionTimeline::ELECTION_DECIDED, end);
+      }
       if (vote_logger_)
         vote_logger_->logElectionDecided(*result_);
     }
@@ -1350,6 +1571,30 @@ void LeaderElection::CheckForDecision() {
   if (to_respond) {
     // This is thread-safe since result_ is write-once.
     decision_callback_(*result_);
+    if (FLAGS_raft_election_cancel_outstanding_requests) {
+      CancelOutstandingRequests();
+    }
+  }
+}
+
+void LeaderElection::CancelOutstandingRequests() {
+  vector<VoterState*> to_cancel;
+  {
+    std::lock_guard<Lock> guard(lock_);
+    for (const auto& entry : voter_state_) {
+      VoterState* state = entry.second;
+      if (state->rpc_sent && !state->responded) {
+        to_cancel.push_back(state);
+      }
+    }
+  }
+  // The caller holds a reference to this election, so the states stay valid.
+  // Cancelling a request that completed in the meantime is harmless, and the
+  // callbacks of the cancelled ones still run, with an Aborted status.
+  for (VoterState* state : to_cancel) {
+    VLOG_WITH_PREFIX(1) << "Cancelling vote request to " << state->PeerInfo()
+                        << ": election already decided";
+    state->proxy->CancelConsensusVote(&state->rpc);
   }
 }
 
@@ -1357,6 +1602,7 @@ void LeaderElection::VoteResponseRpcCallback(const std::string& voter_uuid) {
   {
     std::lock_guard<Lock> guard(lock_);
     VoterState* state = FindOrDie(voter_state_, voter_uuid);
+    state->responded = true;
 
     // Check for RPC errors.
     if (!state->rpc.status().ok()) {
@@ -1395,6 +1641,16 @@ void LeaderElection::VoteResponseRpcCallback(const std::string& voter_uuid) {
     }
     if (vote_logger_)
       vote_logger_->logVoteReceived(state->response);
+    if (timeline_) {
+      std::string error;
+      if (!state->rpc.status().ok()) {
+        error = state->rpc.status().ToString();
+      } else if (state->response.has_error()) {
+        error = ServerErrorPB::Code_Name(state->response.error().code());
+      }
+      timeline_->RecordVote(voter_uuid, request_.is_pre_election(),
+                            error.empty() && state->response.vote_granted(), error);
+    }
   }
 
   // Check for a decision outside the lock.
@@ -23,8 +23,11 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus_peers.h"
@@ -40,6 +43,7 @@
 namespace kudu {
 namespace consensus {
 
+class ElectionTimeline;
 class FlexibleVoteCounterTest;
 
 // The vote a peer has given.
@@ -117,6 +121,12 @@ class VoteCounter {
   // Return true iff GetTotalVotesCounted() == num_voters_;
   bool AreAllVotesIn() const;
 
+  // Returns true if the vote of 'voter_uuid' is likely to be needed to
+  // decide the election, so its request should be sent first.
+  virtual bool IsLikelyDecidingVoter(const std::string& /*voter_uuid*/) const {
+    return false;
+  }
+
  protected:
   int num_voters_;
 
@@ -136,6 +146,90 @@ class VoteCounter {
   DISALLOW_COPY_AND_ASSIGN(VoteCounter);
 };
 
+// A compiled form of the region-wise majority checks done on the votes of a
+// FlexiRaft election. Regions are numbered once, when the evaluator is built,
+// and whether each region's majority is satisfied or can no longer be
+// satisfied is kept as a pair of bitmasks. Registering a vote is then an
+// array update, and checking a quorum over a set of regions (all of them, a
+// majority of them, or a static commit rule predicate) is a mask operation
+// rather than a walk over maps keyed by region.
+class RegionQuorumEvaluator {
+ public:
+  typedef uint64_t RegionMask;
+  static const int kMaxRegions = 64;
+
+  // Builds an evaluator for 'voter_distribution', the number of voters in
+  // each region, along with the predicates of 'commit_rule' if it is a
+  // static one. Returns NotSupported if they can't be compiled, e.g. if
+  // there are more than kMaxRegions regions.
+  static Status Create(const std::map<std::string, int>& voter_distribution,
+                       const CommitRulePB& commit_rule,
+                       std::unique_ptr<RegionQuorumEvaluator>* evaluator);
+
+  // Returns the index of 'region', or -1 if it isn't part of the
+  // distribution.
+  int RegionIndex(const std::string& region) const;
+
+  // Registers a vote from a voter in the region with index 'region_idx'.
+  void RegisterVote(int region_idx, ElectionVote vote);
+
+  RegionMask all_regions() const { return all_regions_; }
+  int num_regions() const { return static_cast<int>(voters_.size()); }
+
+  // Sets 'mask' to the regions in 'regions'. Returns false if one of them
+  // isn't part of the distribution.
+  bool MaskOfRegions(const std::set<std::string>& regions, RegionMask* mask) const;
+
+  // The following return a pair of booleans representing:
+  // 1. if the quorum is satisfied in the current state
+  // 2. if the quorum can still be satisfied in the current state
+
+  // The quorum is a majority in the region with index 'region_idx'.
+  std::pair<bool, bool> IsRegionSatisfied(int region_idx) const;
+
+  // The quorum is a majority in at least 'count' of the regions in 'mask'.
+  std::pair<bool, bool> AreRegionsSatisfied(RegionMask mask, int count) const;
+
+  // The quorum is a majority in every region in 'mask'.
+  std::pair<bool, bool> AreAllRegionsSatisfied(RegionMask mask) const;
+
+  // The quorum is the static commit rule the evaluator was built with.
+  std::pair<bool, bool> IsStaticQuorumSatisfied() const;
+
+ private:
+  RegionQuorumEvaluator() = default;
+
+  // A static commit rule predicate: a majority in at least 'required' of
+  // 'regions'.
+  struct Predicate {
+    RegionMask regions;
+    int required;
+  };
+
+  // Recomputes the bits of the region with index 'region_idx'.
+  void UpdateRegion(int region_idx);
+
+  std::map<std::string, int> region_index_;
+
+  // Indexed by region index.
+  std::vector<int> voters_;
+  std::vector<int> majority_size_;
+  std::vector<int> yes_votes_;
+  std::vector<int> no_votes_;
+
+  RegionMask all_regions_ = 0;
+
+  // Regions where the majority is satisfied.
+  RegionMask satisfied_ = 0;
+
+  // Regions where the majority can no longer be satisfied.
+  RegionMask impossible_ = 0;
+
+  std::vector<Predicate> predicates_;
+
+  DISALLOW_COPY_AND_ASSIGN(RegionQuorumEvaluator);
+};
+
 // Class to enable FlexiRaft vote counting for different quorum modes.
 class FlexibleVoteCounter : public VoteCounter {
  public:
@@ -154,6 +248,10 @@ class FlexibleVoteCounter : public VoteCounter {
       bool* is_duplicate) override;
   bool IsDecided() const override;
   Status GetDecision(ElectionVote* decision) const override;
+
+  // Voters in the region of the last known leader or of the candidate are
+  // the ones the quorum is most likely to be decided by.
+  bool IsLikelyDecidingVoter(const std::string& voter_uuid) const override;
  private:
   friend class FlexibleVoteCounterTest;
 
@@ -369,6 +467,10 @@ class FlexibleVoteCounter : public VoteCounter {
   // Time when vote counter object was created
   std::chrono::time_point<std::chrono::system_clock> creation_time_;
 
+  // Compiled region checks, set if --flexi_raft_compiled_quorum_evaluator
+  // is on and the config could be compiled.
+  std::unique_ptr<RegionQuorumEvaluator> evaluator_;
+
   DISALLOW_COPY_AND_ASSIGN(FlexibleVoteCounter);
 };
 
@@ -435,7 +537,8 @@ class LeaderElection : public RefCountedThreadSafe<LeaderElection> {
                  gscoped_ptr<VoteCounter> vote_counter,
                  MonoDelta timeout,
                  ElectionDecisionCallback decision_callback,
-                 std::shared_ptr<VoteLoggerInterface> vote_logger);
+                 std::shared_ptr<VoteLoggerInterface> vote_logger,
+                 std::shared_ptr<ElectionTimeline> timeline = nullptr);
 
   // Run the election: send the vote request to followers.
   void Run();
@@ -455,6 +558,10 @@ class LeaderElection : public RefCountedThreadSafe<LeaderElection> {
     VoteRequestPB request;
     VoteResponsePB response;
 
+    // Whether the vote request was sent and whether its callback has run.
+    bool rpc_sent = false;
+    bool responded = false;
+
     std::string PeerInfo() const;
   };
 
@@ -471,6 +578,10 @@ class LeaderElection : public RefCountedThreadSafe<LeaderElection> {
   // Callback called when the RPC responds.
   void VoteResponseRpcCallback(const std::string& voter_uuid);
 
+  // Cancels the vote requests that haven't been responded to yet. Called
+  // once the election is decided.
+  void CancelOutstandingRequests();
+
   // Record vote from specified peer.
   void RecordVoteUnlocked(
     const VoterState& state, ElectionVote vote);
@@ -529,6 +640,9 @@ class LeaderElection : public RefCountedThreadSafe<LeaderElection> {
   MonoTime start_time_;
 
   std::shared_ptr<VoteLoggerInterface> vote_logger_;
+
+  // Where the vote responses and the decision are recorded, if anywhere.
+  const std::shared_ptr<ElectionTimeline> timeline_;
 };
 
 class VoteLoggerInterface {
@@ -538,6 +652,10 @@ class VoteLoggerInterface {
     virtual void logVoteReceived(const VoteResponsePB& voteResponse) = 0;
     virtual void logElectionDecided(const ElectionResult& electionResult) = 0;
     virtual void advanceEpoch(int64_t epoch) = 0;
+
+    // Called with the timeline of each attempt to become leader once it's
+    // over, if --raft_election_timeline_history is positive.
+    virtual void logElectionTimeline(const ElectionTimeline& /* timeline */) {}
 };
 
 } // namespace consensus
@@ -0,0 +1,241 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// A benchmark of the WAL append pipeline. Producer threads append batches of
+// WRITE_OP_EXT replicates through Log::AsyncAppendReplicates(), each waiting
+// for its batch to be durable before appending the next one, as leaders do.
+// It reports the appended MB/s, and the histograms the log keeps of group
+// sizes, group commit queue wait, and sync latency.
+//
+// The log compresses with --log_compression_codec. Segments are sized and
+// preallocated as --log_segment_size_mb, --log_preallocate_segments and
+// --log_async_preallocate_segments say. Syncs are real with
+// --bench_fsync_mode=real, emulated by sleeping --bench_emulated_fsync_us
+// with 'emulated', and skipped with 'none'.
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/clock/clock.h"
+#include "kudu/clock/logical_clock.h"
+#include "kudu/common/timestamp.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
+#include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DEFINE_int32(bench_producer_threads, 4, "Number of threads appending to the log.");
+DEFINE_int32(bench_batch_size, 8, "Number of replicates in each appended batch.");
+DEFINE_int32(bench_payload_bytes, 1024, "Size of the payload of each replicate.");
+DEFINE_int32(bench_run_seconds, 1, "Seconds to run the benchmark for.");
+DEFINE_string(bench_fsync_mode, "emulated",
+              "How the log's syncs are made: 'real' fsyncs, 'emulated' sleeps "
+              "of --bench_emulated_fsync_us, or 'none'.");
+DEFINE_int32(bench_emulated_fsync_us, 1000,
+             "Latency of an emulated sync, with --bench_fsync_mode=emulated.");
+
+DECLARE_string(log_compression_codec);
+
+METRIC_DECLARE_counter(log_bytes_logged);
+METRIC_DECLARE_histogram(log_entry_batches_per_group);
+METRIC_DECLARE_histogram(log_group_commit_wait_latency);
+METRIC_DECLARE_histogram(log_group_commit_latency);
+METRIC_DECLARE_histogram(log_sync_latency);
+
+using std::atomic;
+using std::string;
+using std::thread;
+using std::vector;
+
+namespace kudu {
+namespace log {
+
+namespace {
+
+// Emulates a disk whose syncs take --bench_emulated_fsync_us.
+class SlowSyncHooks : public Log::LogFaultHooks {
+ public:
+  Status PostSync() override {
+    SleepFor(MonoDelta::FromMicroseconds(FLAGS_bench_emulated_fsync_us));
+    return Status::OK();
+  }
+};
+
+} // anonymous namespace
+
+class LogBench : public KuduTest {
+ public:
+  LogBench()
+      : clock_(clock::LogicalClock::CreateStartingAt(Timestamp(1))),
+        metric_entity_(METRIC_ENTITY_server.Instantiate(&metric_registry_, "log-bench")),
+        append_latency_us_(60 * 1000 * 1000, 2),
+        next_index_(1) {
+  }
+
+  void SetUp() override {
+    KuduTest::SetUp();
+    OverrideFlagForSlowTests("bench_run_seconds", "10");
+
+    fs_manager_.reset(new FsManager(env_, GetTestPath("fs_root")));
+    ASSERT_OK(fs_manager_->CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager_->Open());
+
+    LogOptions options;
+    options.force_fsync_all = FLAGS_bench_fsync_mode == "real";
+    ASSERT_OK(Log::Open(options, fs_manager_.get(), "log-bench-tablet",
+                        metric_entity_, &log_));
+    if (FLAGS_bench_fsync_mode == "emulated") {
+      log_->SetLogFaultHooksForTests(std::make_shared<SlowSyncHooks>());
+    } else {
+      ASSERT_TRUE(FLAGS_bench_fsync_mode == "real" || FLAGS_bench_fsync_mode == "none")
+          << "unknown --bench_fsync_mode: " << FLAGS_bench_fsync_mode;
+    }
+  }
+
+  void TearDown() override {
+    ASSERT_OK(log_->Close());
+    KuduTest::TearDown();
+  }
+
+  // Appends batches until 'stop' is set.
+  void ProducerThread(const atomic<bool>* stop) {
+    // Letters of a small alphabet compress about as well as typical row data.
+    Random rng(GetRandomSeed32());
+    string payload(FLAGS_bench_payload_bytes, '\0');
+    for (char& c : payload) {
+      c = 'a' + rng.Uniform(16);
+    }
+
+    while (!stop->load()) {
+      vector<consensus::ReplicateRefPtr> replicates;
+      for (int i = 0; i < FLAGS_bench_batch_size; i++) {
+        consensus::ReplicateRefPtr replicate =
+            consensus::make_scoped_refptr_replicate(new consensus::ReplicateMsg());
+        consensus::ReplicateMsg* msg = replicate->get();
+        msg->set_op_type(consensus::WRITE_OP_EXT);
+        msg->set_timestamp(clock_->Now().ToUint64());
+        msg->mutable_write_payload()->set_payload(payload);
+        replicates.emplace_back(std::move(replicate));
+      }
+
+      Synchronizer s;
+      MonoTime start = MonoTime::Now();
+      {
+        // Like a leader, append in the order of the ops' indexes.
+        std::lock_guard<std::mutex> l(append_lock_);
+        for (const auto& replicate : replicates) {
+          replicate->get()->mutable_id()->set_term(1);
+          replicate->get()->mutable_id()->set_index(next_index_++);
+        }
+        CHECK_OK(log_->AsyncAppendReplicates(replicates, s.AsStatusCallback()));
+      }
+      CHECK_OK(s.Wait());
+      append_latency_us_.Increment((MonoTime::Now() - start).ToMicroseconds());
+    }
+  }
+
+  void SummarizePerf(CpuTimes elapsed) {
+    const int64_t bytes = METRIC_log_bytes_logged.Instantiate(metric_entity_)->value();
+    HdrHistogram group_size(*METRIC_log_entry_batches_per_group.Instantiate(
+        metric_entity_)->histogram());
+    HdrHistogram queue_wait(*METRIC_log_group_commit_wait_latency.Instantiate(
+        metric_entity_)->histogram());
+    HdrHistogram group_commit(*METRIC_log_group_commit_latency.Instantiate(
+        metric_entity_)->histogram());
+    HdrHistogram sync(*METRIC_log_sync_latency.Instantiate(metric_entity_)->histogram());
+
+    LOG(INFO) << "Producer threads:     " << FLAGS_bench_producer_threads;
+    LOG(INFO) << "Batch size:           " << FLAGS_bench_batch_size << " x "
+              << FLAGS_bench_payload_bytes << " bytes";
+    LOG(INFO) << "Compression:          " << FLAGS_log_compression_codec;
+    LOG(INFO) << "Fsync:                " << FLAGS_bench_fsync_mode;
+    LOG(INFO) << "----------------------------------";
+    LOG(INFO) << "Appended MB/sec:      " << bytes / elapsed.wall_seconds() / (1024 * 1024);
+    LOG(INFO) << "Batches/sec:          "
+              << append_latency_us_.TotalCount() / elapsed.wall_seconds();
+    LOG(INFO) << "Append latency:       p50 " << append_latency_us_.ValueAtPercentile(50)
+              << "us, p99 " << append_latency_us_.ValueAtPercentile(99) << "us";
+    LOG(INFO) << "Batches per group:    mean " << group_size.MeanValue()
+              << ", p99 " << group_size.ValueAtPercentile(99);
+    LOG(INFO) << "Queue wait:           p50 " << queue_wait.ValueAtPercentile(50)
+              << "us, p99 " << queue_wait.ValueAtPercentile(99) << "us";
+    LOG(INFO) << "Group commit latency: p50 " << group_commit.ValueAtPercentile(50)
+              << "us, p99 " << group_commit.ValueAtPercentile(99) << "us";
+    LOG(INFO) << "Sync latency:         p50 " << sync.ValueAtPercentile(50)
+              << "us, p99 " << sync.ValueAtPercentile(99) << "us";
+    LOG(INFO) << "CPU per batch:        "
+              << (elapsed.user + elapsed.system) / 1000.0 / append_latency_us_.TotalCount()
+              << "us";
+  }
+
+ protected:
+  scoped_refptr<clock::Clock> clock_;
+  MetricRegistry metric_registry_;
+  scoped_refptr<MetricEntity> metric_entity_;
+  std::unique_ptr<FsManager> fs_manager_;
+  scoped_refptr<Log> log_;
+  HdrHistogram append_latency_us_;
+
+  std::mutex append_lock_;
+  int64_t next_index_; // Protected by 'append_lock_'.
+};
+
+TEST_F(LogBench, BenchmarkAppend) {
+  atomic<bool> stop(false);
+  Stopwatch sw(Stopwatch::ALL_THREADS);
+  sw.start();
+  vector<thread> threads;
+  for (int i = 0; i < FLAGS_bench_producer_threads; i++) {
+    threads.emplace_back(&LogBench::ProducerThread, this, &stop);
+  }
+  SleepFor(MonoDelta::FromSeconds(FLAGS_bench_run_seconds));
+  stop = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  sw.stop();
+
+  ASSERT_GT(append_latency_us_.TotalCount(), 0);
+  SummarizePerf(sw.elapsed());
+}
+
+} // namespace log
+} // namespace kudu
@@ -59,11 +59,13 @@
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/env.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/random.h"
 #include "kudu/util/status.h"
 #include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
+#include "kudu/util/threadpool.h"
 
 DEFINE_int32(num_batches, 10000,
              "Number of batches to write to/read from the Log in TestWriteManyBatches");
@@ -74,6 +76,25 @@ DECLARE_double(log_inject_io_error_on_preallocate_fraction);
 DECLARE_int64(fs_wal_dir_reserved_bytes);
 DECLARE_int64(disk_reserved_bytes_free_for_testing);
 DECLARE_string(log_compression_codec);
+DECLARE_bool(log_mmap_closed_segments);
+DECLARE_int32(log_reader_open_threads);
+DECLARE_bool(log_verify_checksums_on_open);
+DECLARE_int32(log_sparse_index_interval);
+DECLARE_bool(log_async_gc);
+DECLARE_int64(log_gc_max_bytes_per_sec);
+DECLARE_string(log_gc_reclaim_mode);
+DECLARE_int32(log_max_recycled_segments);
+DECLARE_int64(log_reader_readahead_bytes);
+DECLARE_int32(log_segment_file_cache_capacity);
+DECLARE_bool(log_drop_page_cache_behind_peers);
+DECLARE_bool(log_clean_shutdown_checkpoint);
+DECLARE_bool(log_adaptive_segment_size);
+DECLARE_int32(log_adaptive_segment_roll_interval_secs);
+DECLARE_int32(log_max_segment_size_mb);
+DECLARE_int32(log_preallocate_ahead_pct);
+
+METRIC_DECLARE_gauge_int64(log_gc_pending_bytes);
+METRIC_DECLARE_counter(log_segments_recycled);
 
 namespace kudu {
 namespace log {
@@ -320,6 +341,41 @@ TEST_P(LogTestOptionalCompression, TestBlankLogFile) {
   ASSERT_TRUE(entries.empty());
 }
 
+// Test that a log closed cleanly reports its last operations when it's
+// reopened, and that its checkpoint is only used once.
+TEST_F(LogTest, TestCleanShutdownCheckpoint) {
+  FLAGS_log_clean_shutdown_checkpoint = true;
+  ASSERT_OK(BuildLog());
+
+  OpId opid = MakeOpId(1, 1);
+  ASSERT_OK(AppendNoOps(&opid, 5));
+  ASSERT_OK(AppendCommit(MakeOpId(1, 3)));
+  ASSERT_OK(log_->Close());
+
+  string checkpoint_path = JoinPathSegments(fs_manager_->GetTabletWalDir(kTestTablet),
+                                            "clean-shutdown-checkpoint");
+  ASSERT_TRUE(env_->FileExists(checkpoint_path));
+
+  ASSERT_OK(BuildLog());
+  ASSERT_FALSE(env_->FileExists(checkpoint_path));
+  ConsensusBootstrapInfo info;
+  log_->GetRecoveryInfo(&info);
+  ASSERT_EQ(1, info.last_id.term());
+  ASSERT_EQ(5, info.last_id.index());
+  ASSERT_EQ(1, info.last_committed_id.term());
+  ASSERT_EQ(3, info.last_committed_id.index());
+
+  // Without a checkpoint, the next open knows nothing of the last operations.
+  FLAGS_log_clean_shutdown_checkpoint = false;
+  ASSERT_OK(log_->Close());
+  ASSERT_FALSE(env_->FileExists(checkpoint_path));
+  ASSERT_OK(BuildLog());
+  ConsensusBootstrapInfo empty_info;
+  log_->GetRecoveryInfo(&empty_info);
+  ASSERT_FALSE(empty_info.last_id.IsInitialized());
+  ASSERT_OK(log_->Close());
+}
+
 void LogTest::DoCorruptionTest(CorruptionType type, CorruptionPosition place,
                                const Status& expected_status, int expected_entries) {
   const int kNumEntries = 4;
@@ -428,6 +484,87 @@ TEST_P(LogTestOptionalCompression, TestSegmentRollover) {
   ASSERT_EQ(num_entries, entries_.size());
 }
 
+// Tests that with WAL striping, segments rotate across the WAL roots and are
+// all found again, in order, when the log is reopened.
+TEST_F(LogTest, TestSegmentRolloverAcrossStripes) {
+  FsManagerOpts opts(GetTestPath("striped_root"));
+  opts.wal_stripe_roots = { GetTestPath("stripe-1"), GetTestPath("stripe-2") };
+  fs_manager_.reset(new FsManager(env_, opts));
+  ASSERT_OK(fs_manager_->CreateInitialFileSystemLayout());
+  ASSERT_OK(fs_manager_->Open());
+
+  ASSERT_OK(BuildLog());
+  log_->SetMaxSegmentSizeForTests(990);
+
+  OpId op_id = MakeOpId(1, 1);
+  int num_entries = 0;
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  while (segments.size() < 5) {
+    ASSERT_OK(AppendNoOps(&op_id, 100));
+    num_entries += 100;
+    ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  }
+  ASSERT_OK(log_->Close());
+
+  // Each segment lives in the WAL root picked by its sequence number.
+  for (const auto& segment : segments) {
+    int64_t seqno = segment->header().sequence_number();
+    ASSERT_EQ(fs_manager_->GetTabletWalDirForSegment(kTestTablet, seqno),
+              DirName(segment->path()));
+  }
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(5, segments.size());
+  for (const scoped_refptr<ReadableLogSegment>& entry : segments) {
+    ASSERT_OK(entry->ReadEntries(&entries_));
+  }
+  ASSERT_EQ(num_entries, entries_.size());
+
+  ASSERT_OK(Log::DeleteOnDiskData(fs_manager_.get(), kTestTablet));
+  ASSERT_FALSE(Log::HasOnDiskData(fs_manager_.get(), kTestTablet));
+}
+
+// Tests that segments opened in parallel come back in order, and that a
+// corrupt entry in a closed segment is caught when verification is enabled.
+TEST_F(LogTest, TestParallelOpenVerifiesChecksums) {
+  FLAGS_log_reader_open_threads = 4;
+  const int kNumTotalSegments = 6;
+  const int kNumOpsPerSegment = 5;
+
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(kNumTotalSegments, kNumOpsPerSegment,
+                                       &op_id, nullptr));
+  LogIndexEntry entry;
+  ASSERT_OK(log_->log_index_->GetEntry(kNumOpsPerSegment + 2, &entry));
+  string corrupt_path =
+      log_->reader()->GetSegmentBySequenceNumber(entry.segment_sequence_number)->path();
+  ASSERT_OK(log_->Close());
+
+  FLAGS_log_verify_checksums_on_open = true;
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(kNumTotalSegments, segments.size());
+  for (int i = 1; i < segments.size(); i++) {
+    ASSERT_EQ(segments[i - 1]->header().sequence_number() + 1,
+              segments[i]->header().sequence_number());
+  }
+
+  ASSERT_OK(CorruptLogFile(env_, corrupt_path, FLIP_BYTE,
+                           entry.offset_in_segment + kEntryHeaderSizeV2 + 1));
+  Status s = LogReader::Open(fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader);
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+
+  // Without verification, only the headers and footers are read.
+  FLAGS_log_verify_checksums_on_open = false;
+  ASSERT_OK(LogReader::Open(fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+}
+
 TEST_F(LogTest, TestWriteAndReadToAndFromInProgressSegment) {
   FLAGS_log_compression_codec = "none";
 
@@ -599,6 +736,187 @@ TEST_P(LogTestOptionalCompression, TestGCWithLogRunning) {
   }
 }
 
+// Tests that with --log_async_gc, GC'd segments are removed from the log right
+// away while their files are reclaimed in the background at a throttled rate,
+// and that closing the log finishes reclaiming them.
+TEST_F(LogTest, TestAsyncGCWithThrottledReclaim) {
+  FLAGS_log_min_segments_to_retain = 1;
+  FLAGS_log_async_gc = true;
+  FLAGS_log_gc_max_bytes_per_sec = 1024;
+  FLAGS_log_gc_reclaim_mode = "truncate";
+  ASSERT_OK(BuildLog());
+
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, 5, &op_id, nullptr));
+  int64_t gcable_size = log_->GetGCableDataSize(RetentionIndexes(op_id.index()));
+  ASSERT_GT(gcable_size, 0);
+
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(RetentionIndexes(op_id.index()), &num_gced_segments));
+  ASSERT_EQ(3, num_gced_segments);
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(1, segments.size()) << DumpSegmentsToString(segments);
+
+  // At 1KB/s, the files cannot have been reclaimed yet.
+  ASSERT_EQ(0, log_->GetGCableDataSize(RetentionIndexes(op_id.index())));
+  int64_t pending = log_->GetPendingGCDataSize();
+  ASSERT_GT(pending, 0);
+  ASSERT_LE(pending, gcable_size);
+  ASSERT_EQ(pending, METRIC_log_gc_pending_bytes.Instantiate(metric_entity_, 0)->value());
+
+  ASSERT_OK(log_->Close());
+  ASSERT_EQ(0, log_->GetPendingGCDataSize());
+  NO_FATALS(CheckRightNumberOfSegmentFiles(1));
+}
+
+// Tests that the latest TERM_VOTE entry can be read back, both from the open
+// log and by scanning the segments after a restart, and that GC keeps it.
+TEST_F(LogTest, TestTermVoteEntries) {
+  FLAGS_log_min_segments_to_retain = 1;
+  ASSERT_OK(BuildLog());
+
+  TermVotePB term_vote;
+  bool found;
+  ASSERT_OK(log_->ReadLastTermVote(&term_vote, &found));
+  ASSERT_FALSE(found);
+
+  for (int term = 1; term <= 3; term++) {
+    TermVotePB record;
+    record.set_current_term(term);
+    if (term == 3) record.set_voted_for("peer-b");
+    Synchronizer s;
+    ASSERT_OK(log_->AsyncAppendTermVote(record, s.AsStatusCallback()));
+    ASSERT_OK(s.Wait());
+  }
+  ASSERT_OK(log_->ReadLastTermVote(&term_vote, &found));
+  ASSERT_TRUE(found);
+  ASSERT_EQ(3, term_vote.current_term());
+  ASSERT_EQ("peer-b", term_vote.voted_for());
+
+  // GC'ing the segment which holds the record must not lose it.
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, 5, &op_id, nullptr));
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(RetentionIndexes(op_id.index()), &num_gced_segments));
+  ASSERT_GT(num_gced_segments, 0);
+
+  ASSERT_OK(log_->Close());
+  ASSERT_OK(BuildLog());
+  term_vote.Clear();
+  ASSERT_OK(log_->ReadLastTermVote(&term_vote, &found));
+  ASSERT_TRUE(found);
+  ASSERT_EQ(3, term_vote.current_term());
+  ASSERT_EQ("peer-b", term_vote.voted_for());
+}
+
+// Tests the asynchronous flush and read entry points which derived logs
+// override, through their default implementations.
+TEST_F(LogTest, TestAsyncFlushAndRead) {
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(2, 5, &op_id, nullptr));
+  const int64_t last_index = op_id.index() - 1;
+
+  Synchronizer flushed;
+  ASSERT_OK(log_->AsyncWaitUntilAllFlushed(flushed.AsStatusCallback()));
+  ASSERT_OK(flushed.Wait());
+
+  Status read_status = Status::Incomplete("callback not run");
+  vector<ReplicateMsg*> replicates;
+  ElementDeleter deleter(&replicates);
+  ASSERT_OK(log_->AsyncReadReplicatesInRange(
+      2, last_index, LogReader::kNoSizeLimit, consensus::ReadContext(),
+      [&](const Status& s, vector<ReplicateMsg*>* read) {
+        read_status = s;
+        replicates.swap(*read);
+      }));
+  ASSERT_OK(read_status);
+  ASSERT_EQ(last_index - 1, replicates.size());
+  for (int i = 0; i < replicates.size(); i++) {
+    ASSERT_EQ(i + 2, replicates[i]->id().index());
+  }
+}
+
+// Tests a log which appends and syncs on a pool shared with other logs, and
+// gives its thread back whenever its queue is drained.
+TEST_F(LogTest, TestSharedAppendPool) {
+  gscoped_ptr<ThreadPool> append_pool;
+  ASSERT_OK(ThreadPoolBuilder("wal-append").set_max_threads(1).Build(&append_pool));
+  options_.append_pool = append_pool.get();
+  ASSERT_OK(BuildLog());
+
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(2, 5, &op_id, nullptr));
+  // The append task doesn't wait for more batches on the shared pool, so
+  // the pool goes idle once the appends are done.
+  append_pool->Wait();
+
+  // The log wakes up on the pool again for the next batch.
+  ASSERT_OK(AppendNoOp(&op_id));
+  ASSERT_OK(log_->WaitUntilAllFlushed());
+  append_pool->Wait();
+  ASSERT_OK(log_->Close());
+}
+
+// Tests that the files of GC'd segments are reused for new segments, and that
+// the entries left over in a recycled file are not read as part of the new
+// segment, whether or not the new segment has been closed.
+TEST_F(LogTest, TestRecycledSegmentsAreReused) {
+  FLAGS_log_compression_codec = "none";
+  FLAGS_log_min_segments_to_retain = 1;
+  FLAGS_log_max_recycled_segments = 2;
+  ASSERT_OK(BuildLog());
+  scoped_refptr<Counter> recycled = METRIC_log_segments_recycled.Instantiate(metric_entity_);
+
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, 5, &op_id, nullptr));
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(RetentionIndexes(op_id.index()), &num_gced_segments));
+  ASSERT_EQ(3, num_gced_segments);
+  NO_FATALS(CheckRightNumberOfSegmentFiles(1));
+
+  // The next segment is written into a recycled file which is larger than
+  // what gets written to it, so it has a stale tail.
+  ASSERT_OK(RollLog());
+  ASSERT_EQ(1, recycled->value());
+  ASSERT_OK(AppendNoOp(&op_id));
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(2, segments.size());
+  const string active_path = segments.back()->path();
+  ASSERT_TRUE(segments.back()->header().incompatible_features_size() > 0);
+
+  // While the segment is in progress, its footer has to be rebuilt by
+  // scanning, which must stop at the last entry of the new segment.
+  {
+    scoped_refptr<ReadableLogSegment> segment;
+    ASSERT_OK(ReadableLogSegment::Open(env_, active_path, &segment));
+    ASSERT_FALSE(segment->HasFooter());
+    LogEntries entries;
+    ASSERT_OK(segment->ReadEntries(&entries));
+    ASSERT_EQ(1, entries.size());
+    ASSERT_EQ(op_id.index() - 1, entries[0]->replicate().id().index());
+  }
+
+  // The second recycled file is used by the next roll; after that the pool
+  // is empty and a new file is allocated.
+  ASSERT_OK(RollLog());
+  ASSERT_OK(AppendNoOp(&op_id));
+  ASSERT_OK(RollLog());
+  ASSERT_EQ(2, recycled->value());
+  ASSERT_OK(log_->Close());
+
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(fs_manager_.get(), nullptr, kTestTablet, nullptr, &reader));
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(4, segments.size());
+  ASSERT_EQ(active_path, segments[1]->path());
+  LogEntries entries;
+  ASSERT_OK(segments[1]->ReadEntries(&entries));
+  ASSERT_EQ(1, entries.size());
+}
+
 // Test that, when we are set to retain a given number of log segments,
 // we also retain any relevant log index chunks, even if those operations
 // are not necessary for recovery.
@@ -1038,6 +1356,205 @@ TEST_P(LogTestOptionalCompression, TestReadLogWithReplacedReplicates) {
   }
 }
 
+// Tests that closed segments are read through their mapping, both by the log's
+// own reader after rollover and by a reader on the reopened log.
+TEST_P(LogTestOptionalCompression, TestReadReplicatesFromMappedSegments) {
+  FLAGS_log_mmap_closed_segments = true;
+  const int kNumTotalSegments = 3;
+  const int kNumOpsPerSegment = 5;
+
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(kNumTotalSegments, kNumOpsPerSegment,
+                                       &op_id, nullptr));
+  const int64_t last_index = op_id.index() - 1;
+
+  auto read_all = [&](const shared_ptr<LogReader>& reader) {
+    vector<ReplicateMsg*> replicates;
+    ElementDeleter deleter(&replicates);
+    ASSERT_OK(reader->ReadReplicatesInRange(1, last_index, LogReader::kNoSizeLimit,
+                                            &replicates));
+    ASSERT_EQ(last_index, replicates.size());
+    for (int i = 0; i < replicates.size(); i++) {
+      ASSERT_EQ(i + 1, replicates[i]->id().index());
+    }
+  };
+
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(kNumTotalSegments, segments.size());
+  // All but the active segment are closed, and thus mapped.
+  for (int i = 0; i < segments.size() - 1; i++) {
+    ASSERT_TRUE(segments[i]->mapped_file_) << segments[i]->path();
+  }
+  ASSERT_FALSE(segments.back()->mapped_file_);
+  NO_FATALS(read_all(log_->reader()));
+  ASSERT_OK(log_->Close());
+
+  ASSERT_OK(BuildLog());
+  NO_FATALS(read_all(log_->reader()));
+}
+
+// Tests that a range read spanning several segments of multi-entry batches
+// returns the right ops with readahead enabled, and that a size-limited read
+// does not parse the entries of a batch past the last one it returns.
+TEST_P(LogTestOptionalCompression, TestReadReplicatesAcrossSegmentsLazily) {
+  FLAGS_log_reader_readahead_bytes = 4096;
+  const int kNumSegments = 4;
+  const int kOpsPerBatch = 10;
+  const int kBatchesPerSegment = 3;
+
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  for (int seg = 0; seg < kNumSegments; seg++) {
+    for (int b = 0; b < kBatchesPerSegment; b++) {
+      ASSERT_OK(AppendNoOpsToLogSync(clock_, log_.get(), &op_id, kOpsPerBatch));
+    }
+    ASSERT_OK(log_->AllocateSegmentAndRollOver());
+  }
+  const int64_t last_index = op_id.index() - 1;
+  ASSERT_EQ(kNumSegments * kBatchesPerSegment * kOpsPerBatch, last_index);
+
+  shared_ptr<LogReader> reader = log_->reader();
+  {
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    ASSERT_OK(reader->ReadReplicatesInRange(5, last_index, LogReader::kNoSizeLimit, &repls));
+    ASSERT_EQ(last_index - 4, repls.size());
+    for (int i = 0; i < repls.size(); i++) {
+      ASSERT_EQ(i + 5, repls[i]->id().index());
+    }
+  }
+
+  // A read limited to a single op stops decoding its batch right there.
+  int64_t entries_read = reader->entries_read_->value();
+  {
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    ASSERT_OK(reader->ReadReplicatesInRange(1, last_index, 1, &repls));
+    ASSERT_EQ(1, repls.size());
+    ASSERT_EQ(1, repls[0]->id().index());
+  }
+  ASSERT_EQ(entries_read + 2, reader->entries_read_->value());
+}
+
+// Tests reading and GCing segments opened through a file cache which holds
+// fewer files than the log has segments, and dropping the segments every peer
+// has from the page cache.
+TEST_F(LogTest, TestSegmentFileCache) {
+  FLAGS_log_segment_file_cache_capacity = 2;
+  FLAGS_log_drop_page_cache_behind_peers = true;
+  FLAGS_log_min_segments_to_retain = 1;
+  const int kNumSegments = 5;
+  const int kOpsPerSegment = 10;
+
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  for (int seg = 0; seg < kNumSegments; seg++) {
+    ASSERT_OK(AppendNoOpsToLogSync(clock_, log_.get(), &op_id, kOpsPerSegment));
+    ASSERT_OK(log_->AllocateSegmentAndRollOver());
+  }
+  const int64_t last_index = op_id.index() - 1;
+
+  auto read_from = [&](int64_t first_index) {
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        first_index, last_index, LogReader::kNoSizeLimit, &repls));
+    ASSERT_EQ(last_index - first_index + 1, repls.size());
+    for (int i = 0; i < repls.size(); i++) {
+      ASSERT_EQ(first_index + i, repls[i]->id().index());
+    }
+  };
+  NO_FATALS(read_from(1));
+  // Reading again reopens the files which were evicted.
+  NO_FATALS(read_from(1));
+
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  const string first_path = segments[0]->path();
+  const string second_path = segments[1]->path();
+  segments.clear();
+
+  // GC the first two segments, and drop the third, which a peer still needs,
+  // from the page cache.
+  const int64_t gc_index = 2 * kOpsPerSegment + 1;
+  int num_gced;
+  ASSERT_OK(log_->GC(RetentionIndexes(gc_index, 3 * kOpsPerSegment + 1), &num_gced));
+  ASSERT_EQ(2, num_gced);
+  ASSERT_FALSE(env_->FileExists(first_path));
+  ASSERT_FALSE(env_->FileExists(second_path));
+  NO_FATALS(read_from(gc_index));
+}
+
+TEST_F(LogTest, TestSegmentSparseIndex) {
+  FLAGS_log_sparse_index_interval = 10;
+  SegmentSparseIndex index;
+  ASSERT_EQ(-1, index.FindScanStart(1));
+
+  // Batches of 4 indexes each: 1-4 @100, 5-8 @200, ..., sampled every 10.
+  int64_t offset = 100;
+  for (int64_t first = 1; first <= 40; first += 4, offset += 100) {
+    index.AddBatch(first, first + 3, offset);
+  }
+  ASSERT_EQ(100, index.FindScanStart(1));
+  ASSERT_EQ(100, index.FindScanStart(12));
+  ASSERT_EQ(400, index.FindScanStart(13));
+  ASSERT_EQ(1000, index.FindScanStart(40));
+
+  // Truncate back to index 15: samples above it go, and the rewrite is
+  // always sampled.
+  index.AddBatch(15, 16, 1100);
+  ASSERT_EQ(400, index.FindScanStart(14));
+  ASSERT_EQ(1100, index.FindScanStart(15));
+  ASSERT_EQ(1100, index.FindScanStart(40));
+
+  string encoded;
+  index.EncodeTo(&encoded);
+  SegmentSparseIndex decoded;
+  ASSERT_OK(decoded.DecodeFrom(encoded));
+  for (int64_t i = 0; i <= 50; i++) {
+    ASSERT_EQ(index.FindScanStart(i), decoded.FindScanStart(i)) << i;
+  }
+  ASSERT_TRUE(decoded.DecodeFrom(Slice(encoded).substr(0, encoded.size() - 1)).IsCorruption());
+}
+
+// Tests that ops can be read from closed segments through their footers'
+// sparse indexes once they are no longer in the log index.
+TEST_P(LogTestOptionalCompression, TestReadReplicatesUsingSparseIndex) {
+  FLAGS_log_sparse_index_interval = 3;
+  const int kNumTotalSegments = 4;
+  const int kNumOpsPerSegment = 10;
+
+  ASSERT_OK(BuildLog());
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(kNumTotalSegments, kNumOpsPerSegment,
+                                       &op_id, nullptr));
+  ASSERT_OK(log_->Close());
+
+  // Open a reader with an empty log index, so that every lookup misses it.
+  string empty_index_dir = GetTestPath("empty-index");
+  ASSERT_OK(env_->CreateDir(empty_index_dir));
+  shared_ptr<LogReader> reader;
+  ASSERT_OK(LogReader::Open(fs_manager_.get(),
+                            make_scoped_refptr(new LogIndex(empty_index_dir)),
+                            kTestTablet, nullptr, &reader));
+
+  const int64_t last_closed_index = (kNumTotalSegments - 1) * kNumOpsPerSegment;
+  vector<ReplicateMsg*> replicates;
+  ElementDeleter deleter(&replicates);
+  ASSERT_OK(reader->ReadReplicatesInRange(5, last_closed_index, LogReader::kNoSizeLimit,
+                                          &replicates));
+  ASSERT_EQ(last_closed_index - 4, replicates.size());
+  for (int i = 0; i < replicates.size(); i++) {
+    ASSERT_EQ(i + 5, replicates[i]->id().index());
+  }
+
+  OpId looked_up;
+  ASSERT_OK(reader->LookupOpId(17, &looked_up));
+  ASSERT_EQ(17, looked_up.index());
+}
+
 // Ensure that we can read replicate messages from the LogReader with a very
 // high (> 32 bit) log index and term. Regression test for KUDU-1933.
 TEST_P(LogTestOptionalCompression, TestReadReplicatesHighIndex) {
@@ -1121,6 +1638,59 @@ TEST_F(LogTest, TestFailedLogPreAllocation) {
   ASSERT_STR_CONTAINS(s.ToString(), "Injected IOError");
 }
 
+// Tests that, with --log_preallocate_ahead_pct, the next segment is allocated
+// before the active one is full, and only switched to once it is.
+TEST_F(LogTest, TestPreallocateAhead) {
+  FLAGS_log_preallocate_ahead_pct = 50;
+  const int kSegmentSizeBytes = 16 * 1024;
+  ASSERT_OK(BuildLog());
+  log_->SetMaxSegmentSizeForTests(kSegmentSizeBytes);
+
+  OpId opid = MakeOpId(1, 1);
+  while (log_->allocation_state() == Log::kAllocationNotStarted) {
+    ASSERT_OK(AppendNoOp(&opid));
+  }
+  ASSERT_LT(log_->active_segment_->Size(), kSegmentSizeBytes);
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(Log::kAllocationFinished, log_->allocation_state());
+  });
+
+  // The allocated segment is switched to once the active one is full.
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(1, segments.size());
+  while (segments.size() == 1) {
+    ASSERT_OK(AppendNoOp(&opid));
+    ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  }
+  ASSERT_EQ(2, segments.size());
+  ASSERT_GE(segments[0]->file_size(), kSegmentSizeBytes);
+}
+
+// Tests that, with --log_adaptive_segment_size, the size of new segments
+// follows the rate at which the log is appended to, within bounds.
+TEST_F(LogTest, TestAdaptiveSegmentSize) {
+  const uint64_t kMB = 1024 * 1024;
+  FLAGS_log_adaptive_segment_size = true;
+  FLAGS_log_max_segment_size_mb = 4;
+  options_.segment_size_mb = 1;
+  ASSERT_OK(BuildLog());
+
+  // A burst of appends right after the switch to a segment is sized for at
+  // the upper bound.
+  FLAGS_log_adaptive_segment_roll_interval_secs = 3600;
+  OpId opid = MakeOpId(1, 1);
+  ASSERT_OK(AppendNoOps(&opid, 10));
+  ASSERT_OK(log_->AllocateSegmentAndRollOver());
+  ASSERT_EQ(4 * kMB, log_->max_segment_size_);
+
+  // An idle segment is sized for at the lower bound.
+  FLAGS_log_adaptive_segment_roll_interval_secs = 1;
+  SleepFor(MonoDelta::FromMilliseconds(100));
+  ASSERT_OK(log_->AllocateSegmentAndRollOver());
+  ASSERT_EQ(kMB, log_->max_segment_size_);
+}
+
 // Test the enforcement of reserving disk space for the log.
 TEST_F(LogTest, TestDiskSpaceCheck) {
   FLAGS_fs_wal_dir_reserved_bytes = 1; // Keep at least 1 byte reserved in the FS.
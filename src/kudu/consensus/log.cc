@@ -23,6 +23,8 @@
 
 #include "kudu/consensus/log.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <memory>
@@ -39,9 +41,11 @@
 #include "kudu/consensus/log_index.h"
 #include "kudu/consensus/log_metrics.h"
 #include "kudu/consensus/log_reader.h"
+#include "kudu/consensus/log_sync_group.h"
 #include "kudu/consensus/log_util.h"
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/atomicops.h"
+#include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/dynamic_annotations.h"
@@ -56,17 +60,21 @@
 #include "kudu/util/env.h"
 #include "kudu/util/env_util.h"
 #include "kudu/util/fault_injection.h"
+#include "kudu/util/faststring_pool.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/io_class.h"
 #include "kudu/util/kernel_stack_watchdog.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/op_timeline.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/random.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/stopwatch.h"
 #include "kudu/util/threadpool.h"
+#include "kudu/util/throttler.h"
 #include "kudu/util/trace.h"
 
 // Log retention configuration.
@@ -85,6 +93,81 @@ TAG_FLAG(log_max_segments_to_retain, runtime);
 TAG_FLAG(log_max_segments_to_retain, advanced);
 TAG_FLAG(log_max_segments_to_retain, experimental);
 
+DEFINE_bool(log_async_gc, false,
+            "If true, log GC only removes the GC'd segments from the log, and their "
+            "files are reclaimed in the background at a rate limited by "
+            "--log_gc_max_bytes_per_sec. This avoids latency spikes on the WAL device "
+            "when many segments become GCable at once.");
+TAG_FLAG(log_async_gc, experimental);
+
+DEFINE_int64(log_gc_max_bytes_per_sec, 0,
+             "Maximum rate in bytes per second at which the files of GC'd log segments "
+             "are reclaimed. If 0, reclamation is not throttled. Only takes effect if "
+             "--log_async_gc is true.");
+TAG_FLAG(log_gc_max_bytes_per_sec, experimental);
+DEFINE_validator(log_gc_max_bytes_per_sec, [](const char* /*n*/, int64_t v) { return v >= 0; });
+
+DEFINE_string(log_gc_reclaim_mode, "unlink",
+              "How the background log GC reclaims the file of a GC'd segment. One of "
+              "'unlink', which deletes the file once its bytes have been accounted for by "
+              "the throttle; 'truncate', which truncates the file in throttled steps "
+              "before deleting it; or 'punch_hole', which punches holes into the file in "
+              "throttled steps before deleting it. Segments still referenced by a reader "
+              "are always unlinked. Only takes effect if --log_async_gc is true.");
+TAG_FLAG(log_gc_reclaim_mode, experimental);
+
+DEFINE_int32(log_max_recycled_segments, 0,
+             "Maximum number of files of GC'd log segments to keep per log for reuse as "
+             "new segments. A recycled file is overwritten in place when the log rolls "
+             "over, which avoids the cost of creating and preallocating a new file and "
+             "keeps its extent layout. Not used with --log_direct_io or --log_io_uring. "
+             "If 0, GC'd segments are always deleted.");
+TAG_FLAG(log_max_recycled_segments, experimental);
+TAG_FLAG(log_max_recycled_segments, runtime);
+
+DEFINE_bool(log_adaptive_segment_size, false,
+            "Whether the size of each new log segment is adapted to the rate "
+            "at which the previous one was appended to, so that a segment "
+            "lasts about --log_adaptive_segment_roll_interval_secs. Segments "
+            "are at least --log_segment_size_mb and at most "
+            "--log_max_segment_size_mb. At high write rates this makes for "
+            "fewer roll-overs, and fewer segments for readers and GC to go "
+            "through.");
+TAG_FLAG(log_adaptive_segment_size, experimental);
+TAG_FLAG(log_adaptive_segment_size, runtime);
+
+DEFINE_int32(log_adaptive_segment_roll_interval_secs, 60,
+             "How long a log segment is sized to last for with "
+             "--log_adaptive_segment_size.");
+TAG_FLAG(log_adaptive_segment_roll_interval_secs, experimental);
+TAG_FLAG(log_adaptive_segment_roll_interval_secs, runtime);
+
+DEFINE_int32(log_max_segment_size_mb, 256,
+             "The largest a log segment may grow to with "
+             "--log_adaptive_segment_size.");
+TAG_FLAG(log_max_segment_size_mb, experimental);
+TAG_FLAG(log_max_segment_size_mb, runtime);
+
+DEFINE_int32(log_preallocate_ahead_pct, 0,
+             "How full, in percent of its size, the active log segment must "
+             "be for the next one to start being allocated in the background, "
+             "so that it is ready by the time the active one fills up and "
+             "rolling over never waits for the allocation. 0 starts the "
+             "allocation once the active segment is full. Only used with "
+             "--log_async_preallocate_segments.");
+TAG_FLAG(log_preallocate_ahead_pct, experimental);
+TAG_FLAG(log_preallocate_ahead_pct, runtime);
+
+DEFINE_bool(log_drop_page_cache_behind_peers, false,
+            "Whether log GC drops the closed segments which every peer already has "
+            "from the page cache, so that the segments which lagging peers still read "
+            "stay cached rather than the ones nobody needs anymore.");
+TAG_FLAG(log_drop_page_cache_behind_peers, experimental);
+TAG_FLAG(log_drop_page_cache_behind_peers, runtime);
+DEFINE_validator(log_gc_reclaim_mode, [](const char* /*n*/, const std::string& v) {
+    return v == "unlink" || v == "truncate" || v == "punch_hole";
+  });
+
 
 // Group commit configuration.
 // -----------------------------
@@ -92,6 +175,26 @@ DEFINE_int32(group_commit_queue_size_bytes, 4 * 1024 * 1024,
              "Maximum size of the group commit queue in bytes");
 TAG_FLAG(group_commit_queue_size_bytes, advanced);
 
+DEFINE_bool(log_pipelined_append, false,
+            "If true, the log append thread hands each written group off to a "
+            "separate sync thread, so that the next group can be written while the "
+            "previous group's fsync is still in flight. Callbacks are still run in "
+            "the order the groups were appended.");
+TAG_FLAG(log_pipelined_append, experimental);
+
+
+DEFINE_int32(log_serialization_threads, 0,
+             "Number of threads used to serialize, checksum and compress batches of "
+             "replicates before the log append thread writes them out. If 0, batches "
+             "are serialized by the thread appending them and compressed by the "
+             "append thread.");
+TAG_FLAG(log_serialization_threads, experimental);
+
+DEFINE_int32(log_entry_buffer_pool_size, 0,
+             "Number of buffers kept around for serializing and framing batches of "
+             "log entries, so that batches reuse buffers rather than allocating "
+             "and growing their own. 0 disables pooling.");
+TAG_FLAG(log_entry_buffer_pool_size, experimental);
 
 DEFINE_int32(log_thread_idle_threshold_ms, 1000,
              "Number of milliseconds after which the log append thread decides that a "
@@ -99,6 +202,31 @@ DEFINE_int32(log_thread_idle_threshold_ms, 1000,
 TAG_FLAG(log_thread_idle_threshold_ms, experimental);
 TAG_FLAG(log_thread_idle_threshold_ms, hidden);
 
+DEFINE_int32(log_group_commit_target_latency_us, 0,
+             "Target latency in microseconds for a group commit, from the time a group "
+             "is drained from the queue until it is synced. If positive, the append "
+             "thread tracks the measured fsync time and the batch arrival rate, and "
+             "under load briefly delays the sync of a group to gather more batches "
+             "into it, for as long as the group would still be synced within the "
+             "target. Under light load groups are synced immediately. If 0, groups "
+             "are synced as soon as they are written.");
+TAG_FLAG(log_group_commit_target_latency_us, experimental);
+TAG_FLAG(log_group_commit_target_latency_us, runtime);
+
+DEFINE_bool(log_direct_io, false,
+            "If true, WAL segments are written with O_DIRECT and O_DSYNC, so that each "
+            "append is a single durable write which bypasses the page cache, and "
+            "preallocated segments are zero-filled by the allocation thread. Requires "
+            "a filesystem which supports direct I/O.");
+TAG_FLAG(log_direct_io, experimental);
+
+DEFINE_bool(log_io_uring, false,
+            "If true, WAL segments are written and synced through io_uring: the writes "
+            "of a group and its fsync are submitted together as one linked chain, and "
+            "the group's callbacks are run from a completion thread rather than the "
+            "append thread. Falls back to regular I/O if the kernel lacks io_uring.");
+TAG_FLAG(log_io_uring, experimental);
+
 // Compression configuration.
 // -----------------------------
 DEFINE_string(log_compression_codec, "LZ4",
@@ -155,6 +283,13 @@ DEFINE_double(log_inject_io_error_on_preallocate_fraction, 0.0,
 TAG_FLAG(log_inject_io_error_on_preallocate_fraction, unsafe);
 TAG_FLAG(log_inject_io_error_on_preallocate_fraction, runtime);
 
+DEFINE_bool(log_clean_shutdown_checkpoint, false,
+            "If true, a log which is closed cleanly writes a checkpoint of its "
+            "last operation ids and last segment next to its segments, which "
+            "lets it report its last operations when it's reopened without "
+            "reading its segments.");
+TAG_FLAG(log_clean_shutdown_checkpoint, experimental);
+
 DEFINE_int64(fs_wal_dir_reserved_bytes, -1,
              "Number of bytes to reserve on the log directory filesystem for "
              "non-Kudu usage. The default, which is represented by -1, is that "
@@ -186,13 +321,105 @@ namespace log {
 using consensus::CommitMsg;
 using consensus::OpId;
 using consensus::ReplicateRefPtr;
-using env_util::OpenFileForRandom;
 using std::shared_ptr;
 using std::string;
 using std::vector;
 using std::unique_ptr;
 using strings::Substitute;
 
+namespace {
+
+// The name of the clean shutdown checkpoint in the log directory. It doesn't
+// start with FsManager::kWalFileNamePrefix, so it isn't taken for a segment.
+const char* const kCleanShutdownCheckpointFileName = "clean-shutdown-checkpoint";
+
+// The largest buffer which is returned to the pool of entry buffers. Larger
+// ones are rare enough to be freed.
+const size_t kMaxPooledEntryBufferBytes = 16 * 1024 * 1024;
+
+// Returns the pool of the buffers of log entry batches, or nullptr if
+// --log_entry_buffer_pool_size is 0.
+FaststringPool* EntryBufferPool() {
+  static FaststringPool* pool = FLAGS_log_entry_buffer_pool_size > 0 ?
+      new FaststringPool(FLAGS_log_entry_buffer_pool_size, kMaxPooledEntryBufferBytes) :
+      nullptr;
+  return pool;
+}
+
+} // anonymous namespace
+
+// Decides how long the append thread should wait to gather more batches into a
+// group before writing and syncing it, based on the recent fsync latency and
+// batch arrival rate. See --log_group_commit_target_latency_us.
+//
+// Waiting only pays off if more batches are expected to arrive while waiting,
+// and it is never worth waiting longer than one fsync: by then the group could
+// have been synced and a new one started. So the wait is the smallest of the
+// headroom left in the latency target and the fsync time, and is zero if fewer
+// than one batch is expected to arrive in that time.
+//
+// RecordGroup() and ComputeWait() are only called by the append thread.
+// RecordSync() may be called from the sync or completion thread.
+class GroupCommitController {
+ public:
+  GroupCommitController()
+      : sync_latency_us_(0),
+        arrivals_per_us_(0) {
+  }
+
+  // Records that 'num_batches' were drained from the queue, which is the
+  // number of batches that arrived since the previous drain.
+  void RecordGroup(size_t num_batches, MonoTime now) {
+    if (last_drain_.Initialized()) {
+      int64_t elapsed_us = std::max<int64_t>((now - last_drain_).ToMicroseconds(), 1);
+      arrivals_per_us_ = Ewma(arrivals_per_us_,
+                              static_cast<double>(num_batches) / elapsed_us);
+    }
+    last_drain_ = now;
+  }
+
+  // Records the latency of one sync of the active segment.
+  void RecordSync(MonoDelta latency) {
+    int64_t old_us = sync_latency_us_.load(std::memory_order_relaxed);
+    sync_latency_us_.store(static_cast<int64_t>(Ewma(old_us, latency.ToMicroseconds())),
+                           std::memory_order_relaxed);
+  }
+
+  // Returns how long to wait for more batches before writing a group of
+  // 'num_batches', and sets 'target_batches' to the group size after which
+  // there is no point in waiting any longer.
+  MonoDelta ComputeWait(int64_t target_latency_us, size_t num_batches,
+                        size_t* target_batches) const {
+    *target_batches = num_batches;
+    int64_t sync_us = sync_latency_us_.load(std::memory_order_relaxed);
+    int64_t wait_us = std::min(target_latency_us - sync_us, sync_us);
+    if (wait_us <= 0) {
+      return MonoDelta::FromMicroseconds(0);
+    }
+    double expected_arrivals = arrivals_per_us_ * wait_us;
+    if (expected_arrivals < 1) {
+      return MonoDelta::FromMicroseconds(0);
+    }
+    *target_batches += static_cast<size_t>(expected_arrivals);
+    return MonoDelta::FromMicroseconds(wait_us);
+  }
+
+ private:
+  static double Ewma(double old_value, double sample) {
+    static const double kAlpha = 0.2;
+    return old_value == 0 ? sample : old_value + kAlpha * (sample - old_value);
+  }
+
+  // Moving average of the sync latency.
+  std::atomic<int64_t> sync_latency_us_;
+
+  // Moving average of the number of batches queued per microsecond.
+  double arrivals_per_us_;
+
+  // When the queue was last drained.
+  MonoTime last_drain_;
+};
+
 // Manages the thread which drains groups of batches from the log's queue and
 // appends them to the underlying log instance.
 //
@@ -237,11 +464,21 @@ class Log::AppendThread {
     return base::subtle::NoBarrier_Load(&worker_state_) == WORKER_ACTIVE;
   }
 
+  // Blocks until the group currently being synced by the sync thread, if any,
+  // has been synced and its callbacks have run. Must be called before the
+  // active segment is rolled over. No-op unless the append is pipelined.
+  void WaitForInFlightSync();
+
  private:
   // The task submitted to the threadpool which collects batches from the queue
   // and appends them, until it determines that the queue is idle.
   void DoWork();
 
+  // If --log_group_commit_target_latency_us is set, waits for more batches to
+  // be queued and appends them to 'entry_batches', for as long as
+  // 'group_commit_controller_' decides it is worth delaying the group.
+  void MaybeGatherMoreBatches(vector<LogEntryBatch*>* entry_batches);
+
   // Tries to transition back to WORKER_STOPPED state. If successful, returns true.
   //
   // Otherwise, returns false to indicate that the task should keep running because
@@ -252,6 +489,26 @@ class Log::AppendThread {
   // LogEntryBatch* pointers.
   void HandleGroup(vector<LogEntryBatch*> entry_batches);
 
+  // Syncs the log, if required for a group that was already written by
+  // HandleGroup(), and then finishes the group. 'append_statuses' holds the
+  // result of appending each batch in 'entry_batches'.
+  void SyncAndFinishGroup(const vector<LogEntryBatch*>& entry_batches,
+                          const vector<Status>& append_statuses,
+                          bool is_all_commits);
+
+  // Invokes the callback of each batch with its append status, or with
+  // 'sync_status' if the append succeeded, and deletes the batches.
+  void FinishGroup(const vector<LogEntryBatch*>& entry_batches,
+                   const vector<Status>& append_statuses,
+                   const Status& sync_status);
+
+  // Records the latency of an asynchronous sync started at 'sync_start', and
+  // finishes the group. Used as the completion callback with --log_io_uring.
+  void FinishAsyncSyncedGroup(MonoTime sync_start,
+                              const vector<LogEntryBatch*>& entry_batches,
+                              const vector<Status>& append_statuses,
+                              const Status& sync_status);
+
   string LogPrefix() const;
 
   Log* const log_;
@@ -267,8 +524,17 @@ class Log::AppendThread {
   Atomic32 worker_state_ = WORKER_STOPPED;
 
   // Pool with a single thread, which handles shutting down the thread
-  // when idle.
+  // when idle. NULL if the log runs on a shared LogOptions::append_pool.
   gscoped_ptr<ThreadPool> append_pool_;
+
+  // Serial token on the shared append pool, if the log runs on one.
+  std::unique_ptr<ThreadPoolToken> append_token_;
+
+  // Pool with a single thread which syncs written groups and runs their
+  // callbacks. Only used if --log_pipelined_append is set.
+  gscoped_ptr<ThreadPool> sync_pool_;
+
+  GroupCommitController group_commit_controller_;
 };
 
 
@@ -277,9 +543,12 @@ Log::AppendThread::AppendThread(Log *log)
 }
 
 Status Log::AppendThread::Init() {
-  DCHECK(!append_pool_) << "Already initialized";
+  DCHECK(!append_pool_ && !append_token_) << "Already initialized";
   VLOG_WITH_PREFIX(1) << "Starting log append thread";
-  RETURN_NOT_OK(ThreadPoolBuilder("wal-append")
+  if (log_->options_.append_pool) {
+    append_token_ = log_->options_.append_pool->NewToken(ThreadPool::ExecutionMode::SERIAL);
+  } else {
+    RETURN_NOT_OK(ThreadPoolBuilder("wal-append")
                 .set_min_threads(0)
                 // Only need one thread since we'll only schedule one
                 // task at a time.
@@ -288,15 +557,29 @@ Status Log::AppendThread::Init() {
                 // handles waiting for work while idle.
                 .set_idle_timeout(MonoDelta::FromSeconds(0))
                 .Build(&append_pool_));
+  }
+  if (FLAGS_log_pipelined_append && !FLAGS_log_io_uring) {
+    // Only a single group may be synced at a time, so that callbacks are
+    // always run in append order.
+    RETURN_NOT_OK(ThreadPoolBuilder("wal-sync")
+                  .set_min_threads(0)
+                  .set_max_threads(1)
+                  .Build(&sync_pool_));
+  }
   return Status::OK();
 }
 
 void Log::AppendThread::Wake() {
-  DCHECK(append_pool_);
+  DCHECK(append_pool_ || append_token_);
   auto old_status = base::subtle::NoBarrier_CompareAndSwap(
       &worker_state_, WORKER_STOPPED, WORKER_ACTIVE);
   if (old_status == WORKER_STOPPED) {
-    CHECK_OK(append_pool_->SubmitClosure(Bind(&Log::AppendThread::DoWork, Unretained(this))));
+    Closure work = Bind(&Log::AppendThread::DoWork, Unretained(this));
+    if (append_token_) {
+      CHECK_OK(append_token_->SubmitClosure(std::move(work)));
+    } else {
+      CHECK_OK(append_pool_->SubmitClosure(std::move(work)));
+    }
   }
 }
 
@@ -342,11 +625,15 @@ bool Log::AppendThread::GoIdle() {
 
 void Log::AppendThread::DoWork() {
   DCHECK_EQ(ANNOTATE_UNPROTECTED_READ(worker_state_), WORKER_ACTIVE);
+  ScopedIOClass io_class(IOClass::kForeground);
   VLOG_WITH_PREFIX(2) << "WAL Appender going active";
+  // On a pool shared with other logs, give the thread back as soon as the
+  // queue is drained rather than waiting for more batches on it.
+  const MonoDelta idle_threshold = append_token_ ? MonoDelta::FromMilliseconds(0) :
+      MonoDelta::FromMilliseconds(FLAGS_log_thread_idle_threshold_ms);
   while (true) {
     CHECK(!FLAGS_raft_derived_log_mode);
-    MonoTime deadline = MonoTime::Now() +
-        MonoDelta::FromMilliseconds(FLAGS_log_thread_idle_threshold_ms);
+    MonoTime deadline = MonoTime::Now() + idle_threshold;
     vector<LogEntryBatch*> entry_batches;
     Status s = log_->entry_queue()->BlockingDrainTo(&entry_batches, deadline);
     if (PREDICT_FALSE(s.IsAborted())) {
@@ -355,11 +642,39 @@ void Log::AppendThread::DoWork() {
       if (GoIdle()) break;
       continue;
     }
+    group_commit_controller_.RecordGroup(entry_batches.size(), MonoTime::Now());
+    MaybeGatherMoreBatches(&entry_batches);
     HandleGroup(std::move(entry_batches));
   }
   VLOG_WITH_PREFIX(2) << "WAL Appender going idle";
 }
 
+void Log::AppendThread::MaybeGatherMoreBatches(vector<LogEntryBatch*>* entry_batches) {
+  int64_t target_latency_us = FLAGS_log_group_commit_target_latency_us;
+  if (target_latency_us <= 0) {
+    return;
+  }
+  size_t target_batches;
+  MonoDelta wait = group_commit_controller_.ComputeWait(
+      target_latency_us, entry_batches->size(), &target_batches);
+  if (log_->metrics_) {
+    log_->metrics_->group_commit_target_batches->Increment(target_batches);
+    log_->metrics_->group_commit_wait_latency->Increment(wait.ToMicroseconds());
+  }
+  if (wait.ToMicroseconds() == 0) {
+    return;
+  }
+  TRACE_EVENT1("log", "GatherBatches", "wait_us", wait.ToMicroseconds());
+  MonoTime deadline = MonoTime::Now() + wait;
+  while (entry_batches->size() < target_batches) {
+    // Stop gathering once the deadline passes, or if the queue shuts down; in
+    // the latter case, the next drain in DoWork() notices the shutdown.
+    if (!log_->entry_queue()->BlockingDrainTo(entry_batches, deadline).ok()) {
+      break;
+    }
+  }
+}
+
 void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
   CHECK(!FLAGS_raft_derived_log_mode);
   if (log_->metrics_) {
@@ -370,59 +685,127 @@ void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
   SCOPED_LATENCY_METRIC(log_->metrics_, group_commit_latency);
 
   bool is_all_commits = true;
-  for (LogEntryBatch* entry_batch : entry_batches) {
-    TRACE_EVENT_FLOW_END0("log", "Batch", entry_batch);
-    Status s = log_->DoAppend(entry_batch);
-    if (PREDICT_FALSE(!s.ok())) {
-      LOG_WITH_PREFIX(ERROR) << "Error appending to the log: " << s.ToString();
-      // TODO(af): If a single transaction fails to append, should we
-      // abort all subsequent transactions in this batch or allow
-      // them to be appended? What about transactions in future
-      // batches?
-      if (!entry_batch->callback().is_null()) {
-        entry_batch->callback().Run(s);
-        entry_batch->callback_.Reset();
+  vector<Status> append_statuses(entry_batches.size());
+  {
+    SCOPED_LATENCY_METRIC(log_->metrics_, group_write_latency);
+    for (size_t i = 0; i < entry_batches.size(); i++) {
+      LogEntryBatch* entry_batch = entry_batches[i];
+      TRACE_EVENT_FLOW_END0("log", "Batch", entry_batch);
+      Status s = log_->DoAppend(entry_batch);
+      if (PREDICT_FALSE(!s.ok())) {
+        LOG_WITH_PREFIX(ERROR) << "Error appending to the log: " << s.ToString();
+        // TODO(af): If a single transaction fails to append, should we
+        // abort all subsequent transactions in this batch or allow
+        // them to be appended? What about transactions in future
+        // batches?
+        append_statuses[i] = std::move(s);
+      } else {
+        entry_batch->RecordOpTimelines(log_->tablet_id(), OpTimeline::WAL_WRITE);
+      }
+      if (is_all_commits && entry_batch->type_ != COMMIT) {
+        is_all_commits = false;
       }
     }
-    if (is_all_commits && entry_batch->type_ != COMMIT) {
-      is_all_commits = false;
-    }
   }
 
+  if (FLAGS_log_io_uring) {
+    // The group is finished from the completion thread once the sync is
+    // done. Groups of only commits are synced as well: their callbacks must
+    // not overtake those of an earlier group still being synced.
+    log_->AsyncSync(Bind(&Log::AppendThread::FinishAsyncSyncedGroup, Unretained(this),
+                         MonoTime::Now(), entry_batches, append_statuses));
+    return;
+  }
+
+  if (!sync_pool_) {
+    SyncAndFinishGroup(entry_batches, append_statuses, is_all_commits);
+    return;
+  }
+
+  // Wait for the previous group to be synced before handing this one off.
+  // That bounds the pipeline to one group being written while one group is
+  // being synced.
+  WaitForInFlightSync();
+  Status s = sync_pool_->SubmitFunc([this, entry_batches, append_statuses, is_all_commits]() {
+      this->SyncAndFinishGroup(entry_batches, append_statuses, is_all_commits);
+    });
+  if (PREDICT_FALSE(!s.ok())) {
+    // The sync pool only fails to accept work if it has been shut down, which
+    // cannot happen while the append thread is running. Be safe anyway.
+    LOG_WITH_PREFIX(DFATAL) << "Unable to submit group to the sync thread: " << s.ToString();
+    SyncAndFinishGroup(entry_batches, append_statuses, is_all_commits);
+  }
+}
+
+void Log::AppendThread::SyncAndFinishGroup(const vector<LogEntryBatch*>& entry_batches,
+                                           const vector<Status>& append_statuses,
+                                           bool is_all_commits) {
+  ScopedIOClass io_class(IOClass::kForeground);
   Status s;
   if (!is_all_commits) {
+    MonoTime sync_start = MonoTime::Now();
     s = log_->Sync();
+    group_commit_controller_.RecordSync(MonoTime::Now() - sync_start);
   }
   if (PREDICT_FALSE(!s.ok())) {
     LOG_WITH_PREFIX(ERROR) << "Error syncing log: " << s.ToString();
-    for (LogEntryBatch* entry_batch : entry_batches) {
-      if (!entry_batch->callback().is_null()) {
-        entry_batch->callback().Run(s);
-      }
-      delete entry_batch;
-    }
   } else {
-    TRACE_EVENT0("log", "Callbacks");
     VLOG_WITH_PREFIX(2) << "Synchronized " << entry_batches.size() << " entry batches";
-    SCOPED_WATCH_STACK(0);
-    for (LogEntryBatch* entry_batch : entry_batches) {
-      if (PREDICT_TRUE(!entry_batch->callback().is_null())) {
-        entry_batch->callback().Run(Status::OK());
-      }
-      // It's important to delete each batch as we see it, because
-      // deleting it may free up memory from memory trackers, and the
-      // callback of a later batch may want to use that memory.
-      delete entry_batch;
+  }
+  FinishGroup(entry_batches, append_statuses, s);
+}
+
+void Log::AppendThread::FinishGroup(const vector<LogEntryBatch*>& entry_batches,
+                                    const vector<Status>& append_statuses,
+                                    const Status& sync_status) {
+  TRACE_EVENT0("log", "Callbacks");
+  SCOPED_LATENCY_METRIC(log_->metrics_, group_callback_latency);
+  SCOPED_WATCH_STACK(0);
+  for (size_t i = 0; i < entry_batches.size(); i++) {
+    LogEntryBatch* entry_batch = entry_batches[i];
+    if (append_statuses[i].ok() && sync_status.ok()) {
+      entry_batch->RecordOpTimelines(log_->tablet_id(), OpTimeline::FSYNC);
+    }
+    if (PREDICT_TRUE(!entry_batch->callback().is_null())) {
+      entry_batch->callback().Run(append_statuses[i].ok() ? sync_status : append_statuses[i]);
     }
+    // It's important to delete each batch as we see it, because
+    // deleting it may free up memory from memory trackers, and the
+    // callback of a later batch may want to use that memory.
+    delete entry_batch;
   }
 }
 
+void Log::AppendThread::FinishAsyncSyncedGroup(MonoTime sync_start,
+                                               const vector<LogEntryBatch*>& entry_batches,
+                                               const vector<Status>& append_statuses,
+                                               const Status& sync_status) {
+  group_commit_controller_.RecordSync(MonoTime::Now() - sync_start);
+  FinishGroup(entry_batches, append_statuses, sync_status);
+}
+
+void Log::AppendThread::WaitForInFlightSync() {
+  if (!sync_pool_) {
+    return;
+  }
+  SCOPED_LATENCY_METRIC(log_->metrics_, sync_wait_latency);
+  sync_pool_->Wait();
+}
+
 void Log::AppendThread::Shutdown() {
   log_->entry_queue()->Shutdown();
   if (append_pool_) {
     append_pool_->Wait();
     append_pool_->Shutdown();
   }
+  if (append_token_) {
+    append_token_->Wait();
+    append_token_->Shutdown();
+  }
+  if (sync_pool_) {
+    sync_pool_->Wait();
+    sync_pool_->Shutdown();
+  }
 }
 
 string Log::AppendThread::LogPrefix() const {
@@ -439,6 +822,7 @@ bool Log::append_thread_active_for_tests() const {
 // asynchronously pre-allocate new log segments.
 void Log::SegmentAllocationTask() {
   CHECK(!FLAGS_raft_derived_log_mode);
+  ScopedIOClass io_class(IOClass::kBackground);
   allocation_status_.Set(PreAllocateNewSegment());
 }
 
@@ -458,8 +842,11 @@ Status Log::Open(const LogOptions &options,
                  scoped_refptr<Log>* log) {
 
   string tablet_wal_path = fs_manager->GetTabletWalDir(tablet_id);
-  RETURN_NOT_OK(env_util::CreateDirIfMissing(
-      fs_manager->env(), tablet_wal_path));
+  // With --fs_wal_stripe_dirs, segments rotate across several WAL roots; the
+  // tablet's directory in the first one also holds the log index.
+  for (const string& dir : fs_manager->GetTabletWalDirs(tablet_id)) {
+    RETURN_NOT_OK(env_util::CreateDirIfMissing(fs_manager->env(), dir));
+  }
 
   scoped_refptr<Log> new_log;
   if (options.log_factory) {
@@ -498,8 +885,12 @@ Log::Log(LogOptions options, FsManager* fs_manager, string log_path,
       active_segment_sequence_number_(0),
       log_state_(kLogInitialized),
       max_segment_size_(options_.segment_size_mb * 1024 * 1024),
+      next_segment_size_(max_segment_size_),
       entry_batch_queue_(FLAGS_group_commit_queue_size_bytes),
       append_thread_(new AppendThread(this)),
+      pending_gc_bytes_(0),
+      gc_unthrottled_(false),
+      next_segment_recycled_(false),
       force_sync_all_(options_.force_fsync_all),
       sync_disabled_(false),
       allocation_state_(kAllocationNotStarted),
@@ -507,6 +898,18 @@ Log::Log(LogOptions options, FsManager* fs_manager, string log_path,
       metric_entity_(std::move(metric_entity)),
       on_disk_size_(0) {
   CHECK_OK(ThreadPoolBuilder("log-alloc").set_max_threads(1).Build(&allocation_pool_));
+  if (FLAGS_log_serialization_threads > 0) {
+    CHECK_OK(ThreadPoolBuilder("log-serialize")
+             .set_min_threads(0)
+             .set_max_threads(FLAGS_log_serialization_threads)
+             .Build(&serialize_pool_));
+  }
+  if (FLAGS_log_async_gc) {
+    CHECK_OK(ThreadPoolBuilder("log-gc").set_max_threads(1).Build(&gc_pool_));
+    if (FLAGS_log_gc_max_bytes_per_sec > 0) {
+      gc_throttler_.reset(new Throttler(MonoTime::Now(), 0, FLAGS_log_gc_max_bytes_per_sec, 1.0));
+    }
+  }
   if (metric_entity_) {
     metrics_.reset(new LogMetrics(metric_entity_));
   }
@@ -556,6 +959,17 @@ Status Log::Init() {
     vector<scoped_refptr<ReadableLogSegment> > segments;
     RETURN_NOT_OK(reader_->GetSegmentsSnapshot(&segments));
     active_segment_sequence_number_ = segments.back()->header().sequence_number();
+    RETURN_NOT_OK(RecoverCleanShutdownCheckpoint(segments));
+  } else {
+    RETURN_NOT_OK(RecoverCleanShutdownCheckpoint({}));
+  }
+
+  if (options_.sync_group && FLAGS_log_io_uring) {
+    // The writes of a group are only submitted by the time it's synced, so
+    // a sync of the filesystem wouldn't cover them.
+    KLOG_FIRST_N(WARNING, 1) << LogPrefix() << "Shared log syncs are not supported with "
+                             << "--log_io_uring, syncing the log's own segments instead";
+    options_.sync_group = nullptr;
   }
 
   if (force_sync_all_) {
@@ -577,15 +991,43 @@ Status Log::Init() {
 
 Status Log::AsyncAllocateSegment() {
   CHECK(!FLAGS_raft_derived_log_mode);
-  std::lock_guard<RWMutex> l(allocation_lock_);
+  std::lock_guard<PerCpuRWMutex> l(allocation_lock_);
   CHECK_EQ(allocation_state_, kAllocationNotStarted);
   allocation_status_.Reset();
   allocation_state_ = kAllocationInProgress;
+  next_segment_size_ = NextSegmentSize();
   RETURN_NOT_OK(allocation_pool_->SubmitClosure(
                   Bind(&Log::SegmentAllocationTask, Unretained(this))));
   return Status::OK();
 }
 
+uint64_t Log::NextSegmentSize() const {
+  if (!FLAGS_log_adaptive_segment_size || !active_segment_) {
+    return max_segment_size_;
+  }
+  const uint64_t kMB = 1024 * 1024;
+  const uint64_t min_size = options_.segment_size_mb * kMB;
+  const uint64_t max_size = std::max<uint64_t>(FLAGS_log_max_segment_size_mb * kMB, min_size);
+  const double elapsed_secs = (MonoTime::Now() - active_segment_start_).ToSeconds();
+  if (elapsed_secs <= 0) {
+    return max_segment_size_;
+  }
+  // Size the next segment for the rate the active one was appended at.
+  const double bytes_per_sec = active_segment_->Size() / elapsed_secs;
+  const double target = bytes_per_sec * FLAGS_log_adaptive_segment_roll_interval_secs;
+  if (target >= max_size) {
+    return max_size;
+  }
+  const uint64_t size = std::max<uint64_t>((static_cast<uint64_t>(target) + kMB - 1) / kMB * kMB,
+                                           min_size);
+  if (size != max_segment_size_) {
+    VLOG_WITH_PREFIX(1) << "Sizing the next log segment to " << size << " bytes for an "
+                        << "append rate of " << static_cast<int64_t>(bytes_per_sec)
+                        << " bytes/sec";
+  }
+  return size;
+}
+
 Status Log::CloseCurrentSegment() {
   CHECK(!FLAGS_raft_derived_log_mode);
   if (!footer_builder_.has_min_replicate_index()) {
@@ -596,6 +1038,9 @@ Status Log::CloseCurrentSegment() {
                       << ": " << pb_util::SecureShortDebugString(footer_builder_);
 
   footer_builder_.set_close_timestamp_micros(GetCurrentTimeMicros());
+  if (!sparse_index_builder_.empty()) {
+    sparse_index_builder_.EncodeTo(footer_builder_.mutable_sparse_index());
+  }
   RETURN_NOT_OK(active_segment_->WriteFooterAndClose(footer_builder_));
 
   return Status::OK();
@@ -610,6 +1055,10 @@ Status Log::RollOver() {
 
   DCHECK_EQ(allocation_state(), kAllocationFinished);
 
+  // With a pipelined append thread, the sync thread may still be syncing the
+  // active segment. Let it finish before the segment is closed.
+  append_thread_->WaitForInFlightSync();
+
   RETURN_NOT_OK(Sync());
   RETURN_NOT_OK(CloseCurrentSegment());
 
@@ -654,11 +1103,33 @@ Status Log::AsyncAppendReplicates(const vector<ReplicateRefPtr>& replicates,
   unique_ptr<LogEntryBatchPB> batch_pb = CreateBatchFromAllocatedOperations(replicates);
 
   unique_ptr<LogEntryBatch> batch;
-  RETURN_NOT_OK(CreateBatchFromPB(REPLICATE, std::move(batch_pb), &batch));
+  if (serialize_pool_) {
+    batch.reset(new LogEntryBatch(REPLICATE, std::move(batch_pb), replicates.size()));
+    batch->SetReplicates(replicates);
+    RETURN_NOT_OK(SubmitBatchForEncoding(batch.get()));
+    return AsyncAppend(std::move(batch), callback);
+  }
+  {
+    SCOPED_LATENCY_METRIC(metrics_, serialize_latency);
+    RETURN_NOT_OK(CreateBatchFromPB(REPLICATE, std::move(batch_pb), &batch));
+  }
   batch->SetReplicates(replicates);
   return AsyncAppend(std::move(batch), callback);
 }
 
+Status Log::SubmitBatchForEncoding(LogEntryBatch* entry_batch) {
+  DCHECK(serialize_pool_);
+  DCHECK(!entry_batch->is_encoded_async_);
+  LogMetrics* metrics = metrics_.get();
+  const CompressionCodec* codec = codec_;
+  RETURN_NOT_OK(serialize_pool_->SubmitFunc([entry_batch, metrics, codec]() {
+      SCOPED_LATENCY_METRIC(metrics, serialize_latency);
+      entry_batch->SerializeAndEncode(codec);
+    }));
+  entry_batch->is_encoded_async_ = true;
+  return Status::OK();
+}
+
 Status Log::AsyncAppendCommit(gscoped_ptr<consensus::CommitMsg> commit_msg,
                               const StatusCallback& callback) {
   CHECK(!FLAGS_raft_derived_log_mode);
@@ -680,10 +1151,13 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
   size_t num_entries = entry_batch->count();
   DCHECK_GT(num_entries, 0) << "Cannot call DoAppend() with zero entries reserved";
 
+  if (entry_batch->is_encoded_async()) {
+    RETURN_NOT_OK_PREPEND(entry_batch->WaitForEncoding(), "Failed to encode log entry batch");
+  }
+
   MAYBE_RETURN_FAILURE(FLAGS_log_inject_io_error_on_append_fraction,
                        Status::IOError("Injected IOError in Log::DoAppend()"));
 
-  Slice entry_batch_data = entry_batch->data();
   uint32_t entry_batch_bytes = entry_batch->total_size_bytes();
   // If there is no data to write return OK.
   if (PREDICT_FALSE(entry_batch_bytes == 0)) {
@@ -691,8 +1165,10 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
   }
 
   // if the size of this entry overflows the current segment, get a new one
+  const bool segment_full = (active_segment_->Size() + entry_batch_bytes + 4) > max_segment_size_;
   if (allocation_state() == kAllocationNotStarted) {
-    if ((active_segment_->Size() + entry_batch_bytes + 4) > max_segment_size_) {
+    const int32_t ahead_pct = FLAGS_log_preallocate_ahead_pct;
+    if (segment_full) {
       LOG_WITH_PREFIX(INFO) << "Max segment size reached. Starting new segment allocation";
       RETURN_NOT_OK(AsyncAllocateSegment());
       if (!options_.async_preallocate_segments) {
@@ -700,8 +1176,14 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
           RETURN_NOT_OK(RollOver());
         }
       }
+    } else if (ahead_pct > 0 && options_.async_preallocate_segments &&
+               active_segment_->Size() >= max_segment_size_ / 100 * std::min(ahead_pct, 100)) {
+      // Get the next segment ready while there's still room in this one. The
+      // roll-over happens once this one is full.
+      VLOG_WITH_PREFIX(1) << "Segment " << ahead_pct << "% full. Starting new segment allocation";
+      RETURN_NOT_OK(AsyncAllocateSegment());
     }
-  } else if (allocation_state() == kAllocationFinished) {
+  } else if (allocation_state() == kAllocationFinished && segment_full) {
     LOG_SLOW_EXECUTION(WARNING, 50, Substitute("$0Log roll took a long time", LogPrefix())) {
       RETURN_NOT_OK(RollOver());
     }
@@ -715,7 +1197,11 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
     SCOPED_LATENCY_METRIC(metrics_, append_latency);
     SCOPED_WATCH_STACK(0);
 
-    RETURN_NOT_OK(active_segment_->WriteEntryBatch(entry_batch_data, codec_));
+    if (entry_batch->is_encoded_async()) {
+      RETURN_NOT_OK(active_segment_->WriteEncodedEntryBatch(entry_batch->encoded_data()));
+    } else {
+      RETURN_NOT_OK(active_segment_->WriteEntryBatch(entry_batch->data(), codec_));
+    }
 
     // Update the reader on how far it can read the active segment.
     reader_->UpdateLastSegmentOffset(active_segment_->written_offset());
@@ -730,7 +1216,24 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
   }
 
   CHECK_OK(UpdateIndexForBatch(*entry_batch, start_offset));
-  UpdateFooterForBatch(entry_batch);
+  UpdateFooterForBatch(entry_batch, start_offset);
+  const auto& entries = entry_batch->entry_batch_pb_->entry();
+  if (entry_batch->type_ == REPLICATE && !entries.empty()) {
+    last_replicate_id_ = entries.Get(entries.size() - 1).replicate().id();
+  } else if (entry_batch->type_ == COMMIT) {
+    for (const LogEntryPB& entry_pb : entries) {
+      if (entry_pb.commit().has_commited_op_id() &&
+          (!last_committed_id_.IsInitialized() ||
+           entry_pb.commit().commited_op_id().index() > last_committed_id_.index())) {
+        last_committed_id_ = entry_pb.commit().commited_op_id();
+      }
+    }
+  }
+  if (entry_batch->type_ == TERM_VOTE) {
+    std::lock_guard<simple_spinlock> l(term_vote_lock_);
+    last_term_vote_ = entry_batch->entry_batch_pb_->entry(0).term_vote();
+    last_term_vote_segment_ = active_segment_sequence_number_;
+  }
 
   return Status::OK();
 }
@@ -752,7 +1255,7 @@ Status Log::UpdateIndexForBatch(const LogEntryBatch& batch,
   return Status::OK();
 }
 
-void Log::UpdateFooterForBatch(LogEntryBatch* batch) {
+void Log::UpdateFooterForBatch(LogEntryBatch* batch, int64_t start_offset) {
   CHECK(!FLAGS_raft_derived_log_mode);
   footer_builder_.set_num_entries(footer_builder_.num_entries() + batch->count());
 
@@ -766,12 +1269,22 @@ void Log::UpdateFooterForBatch(LogEntryBatch* batch) {
     for (const LogEntryPB& entry_pb : batch->entry_batch_pb_->entry()) {
       UpdateFooterForReplicateEntry(entry_pb, &footer_builder_);
     }
+    const auto& entries = batch->entry_batch_pb_->entry();
+    if (!entries.empty()) {
+      sparse_index_builder_.AddBatch(entries.Get(0).replicate().id().index(),
+                                     entries.Get(entries.size() - 1).replicate().id().index(),
+                                     start_offset);
+    }
   }
 }
 
 Status Log::AllocateSegmentAndRollOver() {
   CHECK(!FLAGS_raft_derived_log_mode);
-  RETURN_NOT_OK(AsyncAllocateSegment());
+  // With --log_preallocate_ahead_pct, the next segment may already be being
+  // allocated.
+  if (allocation_state() == kAllocationNotStarted) {
+    RETURN_NOT_OK(AsyncAllocateSegment());
+  }
   return RollOver();
 }
 
@@ -779,11 +1292,7 @@ FsManager* Log::GetFsManager() {
   return fs_manager_;
 }
 
-Status Log::Sync() {
-  CHECK(!FLAGS_raft_derived_log_mode);
-  TRACE_EVENT0("log", "Sync");
-  SCOPED_LATENCY_METRIC(metrics_, sync_latency);
-
+void Log::MaybeInjectSyncLatency() {
   if (PREDICT_FALSE(FLAGS_log_inject_latency && !sync_disabled_)) {
     Random r(GetCurrentTimeMicros());
     int sleep_ms = r.Normal(FLAGS_log_inject_latency_ms_mean,
@@ -793,10 +1302,22 @@ Status Log::Sync() {
       SleepFor(MonoDelta::FromMilliseconds(sleep_ms));
     }
   }
+}
+
+Status Log::Sync() {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  TRACE_EVENT0("log", "Sync");
+  SCOPED_LATENCY_METRIC(metrics_, sync_latency);
+
+  MaybeInjectSyncLatency();
 
   if (force_sync_all_ && !sync_disabled_) {
     LOG_SLOW_EXECUTION(WARNING, 50, Substitute("$0Fsync log took a long time", LogPrefix())) {
-      RETURN_NOT_OK(active_segment_->Sync());
+      if (options_.sync_group) {
+        RETURN_NOT_OK(options_.sync_group->Sync());
+      } else {
+        RETURN_NOT_OK(active_segment_->Sync());
+      }
 
       if (log_hooks_) {
         RETURN_NOT_OK_PREPEND(log_hooks_->PostSyncIfFsyncEnabled(),
@@ -811,6 +1332,43 @@ Status Log::Sync() {
   return Status::OK();
 }
 
+void Log::AsyncSync(const StatusCallback& callback) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  TRACE_EVENT0("log", "AsyncSync");
+
+  MaybeInjectSyncLatency();
+
+  if (force_sync_all_ && !sync_disabled_) {
+    active_segment_->SyncAsync(Bind(&Log::AsyncSyncDone, Unretained(this),
+                                    MonoTime::Now(), callback));
+    return;
+  }
+
+  Status s;
+  if (log_hooks_) {
+    s = log_hooks_->PostSync().CloneAndPrepend("PostSync hook failed");
+  }
+  callback.Run(s);
+}
+
+void Log::AsyncSyncDone(MonoTime start_time, const StatusCallback& callback, const Status& s) {
+  if (metrics_) {
+    metrics_->sync_latency->Increment((MonoTime::Now() - start_time).ToMicroseconds());
+  }
+  Status hook_status = s;
+  if (hook_status.ok() && log_hooks_) {
+    hook_status = log_hooks_->PostSyncIfFsyncEnabled().CloneAndPrepend(
+        "PostSyncIfFsyncEnabled hook failed");
+    if (hook_status.ok()) {
+      hook_status = log_hooks_->PostSync().CloneAndPrepend("PostSync hook failed");
+    }
+  }
+  if (PREDICT_FALSE(!hook_status.ok())) {
+    LOG_WITH_PREFIX(ERROR) << "Error syncing log: " << hook_status.ToString();
+  }
+  callback.Run(hook_status);
+}
+
 int GetPrefixSizeToGC(RetentionIndexes retention_indexes, const SegmentSequence& segments) {
   CHECK(!FLAGS_raft_derived_log_mode);
   int rem_segs = segments.size();
@@ -841,6 +1399,23 @@ int GetPrefixSizeToGC(RetentionIndexes retention_indexes, const SegmentSequence&
   return prefix_size;
 }
 
+void Log::DropPageCacheBehindPeers(int64_t min_index_for_peers) {
+  SegmentSequence segments;
+  {
+    shared_lock<rw_spinlock> l(state_lock_.get_lock());
+    CHECK_EQ(kLogWriting, log_state_);
+    WARN_NOT_OK(reader_->GetSegmentsSnapshot(&segments),
+                "Unable to look up the log segments to drop from the page cache");
+  }
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    if (!segment->HasFooter() ||
+        segment->footer().max_replicate_index() >= min_index_for_peers) {
+      break;
+    }
+    segment->DropFromPageCache();
+  }
+}
+
 Status Log::GetSegmentsToGCUnlocked(RetentionIndexes retention_indexes,
                                     SegmentSequence* segments_to_gc) const {
   CHECK(!FLAGS_raft_derived_log_mode);
@@ -869,6 +1444,12 @@ Status Log::Append(LogEntryPB* entry) {
 }
 
 Status Log::WaitUntilAllFlushed() {
+  Synchronizer s;
+  RETURN_NOT_OK(AsyncWaitUntilAllFlushed(s.AsStatusCallback()));
+  return s.Wait();
+}
+
+Status Log::AsyncWaitUntilAllFlushed(const StatusCallback& callback) {
   // In order to make sure we empty the queue we need to use
   // the async api.
   CHECK(!FLAGS_raft_derived_log_mode);
@@ -876,8 +1457,79 @@ Status Log::WaitUntilAllFlushed() {
   entry_batch->add_entry()->set_type(log::FLUSH_MARKER);
   unique_ptr<LogEntryBatch> reserved_entry_batch;
   RETURN_NOT_OK(CreateBatchFromPB(FLUSH_MARKER, std::move(entry_batch), &reserved_entry_batch));
+  return AsyncAppend(std::move(reserved_entry_batch), callback);
+}
+
+Status Log::AsyncAppendTermVote(const TermVotePB& term_vote,
+                                const StatusCallback& callback) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  unique_ptr<LogEntryBatchPB> batch_pb(new LogEntryBatchPB);
+  LogEntryPB* entry = batch_pb->add_entry();
+  entry->set_type(TERM_VOTE);
+  *entry->mutable_term_vote() = term_vote;
+
+  unique_ptr<LogEntryBatch> entry_batch;
+  RETURN_NOT_OK(CreateBatchFromPB(TERM_VOTE, std::move(batch_pb), &entry_batch));
+  return AsyncAppend(std::move(entry_batch), callback);
+}
+
+Status Log::ReadLastTermVote(TermVotePB* term_vote, bool* found) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  *found = false;
+  {
+    std::lock_guard<simple_spinlock> l(term_vote_lock_);
+    if (last_term_vote_segment_ >= 0) {
+      *term_vote = last_term_vote_;
+      *found = true;
+      return Status::OK();
+    }
+  }
+
+  SegmentSequence segments;
+  {
+    shared_lock<rw_spinlock> l(state_lock_.get_lock());
+    CHECK_EQ(kLogWriting, log_state_);
+    RETURN_NOT_OK(reader_->GetSegmentsSnapshot(&segments));
+  }
+  for (const auto& segment : boost::adaptors::reverse(segments)) {
+    LogEntryReader reader(segment.get());
+    while (true) {
+      unique_ptr<LogEntryPB> entry;
+      Status s = reader.ReadNextEntry(&entry);
+      if (s.IsEndOfFile()) {
+        break;
+      }
+      if (PREDICT_FALSE(!s.ok())) {
+        // Nothing after a bad entry was acknowledged as durable.
+        LOG_WITH_PREFIX(WARNING) << "Stopped looking for TERM_VOTE entries in "
+                                 << segment->path() << ": " << s.ToString();
+        break;
+      }
+      if (entry->type() == TERM_VOTE && entry->has_term_vote()) {
+        *term_vote = entry->term_vote();
+        *found = true;
+      }
+    }
+    if (*found) {
+      break;
+    }
+  }
+  return Status::OK();
+}
+
+Status Log::CarryForwardTermVote() {
+  TermVotePB term_vote;
+  {
+    shared_lock<rw_spinlock> state_lock(state_lock_.get_lock());
+    std::lock_guard<simple_spinlock> l(term_vote_lock_);
+    if (last_term_vote_segment_ < 0 ||
+        last_term_vote_segment_ == active_segment_sequence_number_) {
+      return Status::OK();
+    }
+    term_vote = last_term_vote_;
+  }
   Synchronizer s;
-  AsyncAppend(std::move(reserved_entry_batch), s.AsStatusCallback());
+  RETURN_NOT_OK(AsyncAppendTermVote(term_vote, s.AsStatusCallback()));
   return s.Wait();
 }
 
@@ -895,6 +1547,11 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
   VLOG_WITH_PREFIX(1) << "Running Log GC on " << log_dir_ << ": retaining "
       "ops >= " << retention_indexes.for_durability << " for durability, "
       "ops >= " << retention_indexes.for_peers << " for peers";
+  RETURN_NOT_OK_PREPEND(CarryForwardTermVote(),
+                        "Unable to keep the latest TERM_VOTE entry out of GC");
+  if (FLAGS_log_drop_page_cache_behind_peers) {
+    DropPageCacheBehindPeers(retention_indexes.for_peers);
+  }
   VLOG_TIMING(1, Substitute("$0Log GC", LogPrefix())) {
     SegmentSequence segments_to_delete;
 
@@ -917,17 +1574,34 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
 
     // Now that they are no longer referenced by the Log, delete the files.
     *num_gced = 0;
-    for (const scoped_refptr<ReadableLogSegment>& segment : segments_to_delete) {
-      string ops_str;
-      if (segment->HasFooter() && segment->footer().has_min_replicate_index()) {
-        DCHECK(segment->footer().has_max_replicate_index());
-        ops_str = Substitute(" (ops $0-$1)",
-                             segment->footer().min_replicate_index(),
-                             segment->footer().max_replicate_index());
+    if (gc_pool_) {
+      // Hand the files off to be reclaimed in the background.
+      int64_t bytes = 0;
+      for (const scoped_refptr<ReadableLogSegment>& segment : segments_to_delete) {
+        bytes += segment->file_size();
+      }
+      UpdatePendingGCBytes(bytes);
+      RETURN_NOT_OK(gc_pool_->SubmitFunc([this, segments_to_delete]() {
+          this->ReclaimSegmentsTask(segments_to_delete);
+        }));
+      *num_gced = segments_to_delete.size();
+    } else {
+      ScopedIOClass io_class(IOClass::kIdle);
+      for (const scoped_refptr<ReadableLogSegment>& segment : segments_to_delete) {
+        string ops_str;
+        if (segment->HasFooter() && segment->footer().has_min_replicate_index()) {
+          DCHECK(segment->footer().has_max_replicate_index());
+          ops_str = Substitute(" (ops $0-$1)",
+                               segment->footer().min_replicate_index(),
+                               segment->footer().max_replicate_index());
+        }
+        (*num_gced)++;
+        if (MaybeRecycleSegment(segment)) {
+          continue;
+        }
+        LOG_WITH_PREFIX(INFO) << "Deleting log segment in path: " << segment->path() << ops_str;
+        RETURN_NOT_OK(DeleteLogSegmentFile(fs_manager_->env(), segment->path()));
       }
-      LOG_WITH_PREFIX(INFO) << "Deleting log segment in path: " << segment->path() << ops_str;
-      RETURN_NOT_OK(fs_manager_->env()->DeleteFile(segment->path()));
-      (*num_gced)++;
     }
 
     // Determine the minimum remaining replicate index in order to properly GC
@@ -940,6 +1614,185 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
   return Status::OK();
 }
 
+void Log::ReclaimSegmentsTask(const SegmentSequence& segments) {
+  ScopedIOClass io_class(IOClass::kIdle);
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    Status s = ReclaimSegment(segment);
+    if (PREDICT_FALSE(!s.ok())) {
+      LOG_WITH_PREFIX(WARNING) << "Unable to reclaim log segment " << segment->path()
+                               << ": " << s.ToString();
+    }
+  }
+}
+
+Status Log::ReclaimSegment(const scoped_refptr<ReadableLogSegment>& segment) {
+  static const int64_t kMaxReclaimStepBytes = 8 * 1024 * 1024;
+  // With a throttle, each step must fit in the tokens of one refill period.
+  const int64_t step_bytes = gc_throttler_ ?
+      std::max<int64_t>(1, std::min<int64_t>(
+          kMaxReclaimStepBytes,
+          FLAGS_log_gc_max_bytes_per_sec * Throttler::kRefillPeriodMicros /
+          MonoTime::kMicrosecondsPerSecond)) :
+      kMaxReclaimStepBytes;
+  const int64_t size = segment->file_size();
+  if (MaybeRecycleSegment(segment)) {
+    UpdatePendingGCBytes(-size);
+    return Status::OK();
+  }
+
+  // Only reclaim the file in place if nobody else can still read it: the
+  // segment may be mapped into memory, or a concurrent reader may be in the
+  // middle of scanning it. Unlinking is always safe.
+  unique_ptr<RWFile> file;
+  if (FLAGS_log_gc_reclaim_mode != "unlink" && segment->HasOneRef()) {
+    RWFileOptions opts;
+    opts.mode = Env::OPEN_EXISTING;
+    RETURN_NOT_OK(fs_manager_->env()->NewRWFile(opts, segment->path(), &file));
+  }
+
+  VLOG_WITH_PREFIX(1) << "Reclaiming log segment in path: " << segment->path();
+  SCOPED_CLEANUP({
+    if (file) {
+      WARN_NOT_OK(file->Close(), "Unable to close reclaimed log segment");
+    }
+  });
+  int64_t reclaimed = 0;
+  while (reclaimed < size) {
+    int64_t step = std::min(step_bytes, size - reclaimed);
+    ThrottleReclaim(step);
+    if (file && FLAGS_log_gc_reclaim_mode == "truncate") {
+      RETURN_NOT_OK(file->Truncate(size - reclaimed - step));
+    } else if (file) {
+      RETURN_NOT_OK(file->PunchHole(reclaimed, step));
+    }
+    reclaimed += step;
+  }
+  LOG_WITH_PREFIX(INFO) << "Deleting log segment in path: " << segment->path();
+  return DeleteLogSegmentFile(fs_manager_->env(), segment->path());
+}
+
+void Log::ThrottleReclaim(int64_t bytes) {
+  while (gc_throttler_ && !gc_unthrottled_ &&
+         !gc_throttler_->Take(MonoTime::Now(), 0, bytes)) {
+    SleepFor(MonoDelta::FromMicroseconds(Throttler::kRefillPeriodMicros / 10));
+  }
+  UpdatePendingGCBytes(-bytes);
+}
+
+void Log::UpdatePendingGCBytes(int64_t delta) {
+  int64_t pending = pending_gc_bytes_.fetch_add(delta) + delta;
+  if (metrics_) {
+    metrics_->gc_pending_bytes->set_value(pending);
+  }
+}
+
+bool Log::MaybeRecycleSegment(const scoped_refptr<ReadableLogSegment>& segment) {
+  // Recycled files are overwritten through a buffered WritableFile.
+  if (FLAGS_log_max_recycled_segments <= 0 || FLAGS_log_direct_io || FLAGS_log_io_uring) {
+    return false;
+  }
+  // Overwriting the file must not pull it from under a reader, which may have
+  // mapped it into memory.
+  if (!segment->HasOneRef()) {
+    return false;
+  }
+  {
+    std::lock_guard<simple_spinlock> l(recycled_segments_lock_);
+    if (recycled_segments_.size() >= FLAGS_log_max_recycled_segments) {
+      return false;
+    }
+  }
+  Status s = RecycleSegment(segment);
+  if (PREDICT_FALSE(!s.ok())) {
+    LOG_WITH_PREFIX(WARNING) << "Unable to recycle log segment " << segment->path()
+                             << ", deleting it instead: " << s.ToString();
+    return false;
+  }
+  return true;
+}
+
+Status Log::RecycleSegment(const scoped_refptr<ReadableLogSegment>& segment) {
+  Env* env = fs_manager_->env();
+  uint64_t size;
+  {
+    // A crash may leave a recycled file partially overwritten by a new
+    // segment. Without its old footer trailer, that segment is rebuilt by
+    // scanning on startup, and the fenced entry headers of the new segment
+    // keep the scan from picking up the stale entries left in the file.
+    unique_ptr<RWFile> file;
+    RWFileOptions opts;
+    opts.mode = Env::OPEN_EXISTING;
+    RETURN_NOT_OK(env->NewRWFile(opts, segment->path(), &file));
+    RETURN_NOT_OK(file->Size(&size));
+    if (size >= kLogSegmentFooterMagicAndFooterLength) {
+      uint8_t zeros[kLogSegmentFooterMagicAndFooterLength] = {};
+      RETURN_NOT_OK(file->Write(size - kLogSegmentFooterMagicAndFooterLength,
+                                Slice(zeros, sizeof(zeros))));
+      RETURN_NOT_OK(file->Sync());
+    }
+    RETURN_NOT_OK(file->Close());
+  }
+
+  RecycledSegment recycled;
+  recycled.dir = DirName(segment->path());
+  recycled.path = JoinPathSegments(
+      recycled.dir, Substitute("$0.recycledsegment-$1", kTmpInfix,
+                               segment->header().sequence_number()));
+  recycled.size = size;
+  RETURN_NOT_OK(env->RenameFile(segment->path(), recycled.path));
+  LOG_WITH_PREFIX(INFO) << "Recycled log segment in path: " << segment->path();
+
+  std::lock_guard<simple_spinlock> l(recycled_segments_lock_);
+  recycled_segments_.emplace_back(std::move(recycled));
+  return Status::OK();
+}
+
+Status Log::OpenRecycledSegment(const WritableFileOptions& opts,
+                                string* path,
+                                shared_ptr<WritableFile>* out,
+                                uint64_t* size) {
+  string dir = fs_manager_->GetTabletWalDirForSegment(
+      tablet_id_, active_segment_sequence_number_ + 1);
+  RecycledSegment recycled;
+  {
+    std::lock_guard<simple_spinlock> l(recycled_segments_lock_);
+    auto it = std::find_if(recycled_segments_.begin(), recycled_segments_.end(),
+                           [&](const RecycledSegment& r) { return r.dir == dir; });
+    if (it == recycled_segments_.end()) {
+      return Status::NotFound("no recycled segment in directory", dir);
+    }
+    recycled = std::move(*it);
+    recycled_segments_.erase(it);
+  }
+
+  WritableFileOptions overwrite_opts = opts;
+  overwrite_opts.mode = Env::OPEN_EXISTING;
+  overwrite_opts.overwrite_existing = true;
+  unique_ptr<WritableFile> file;
+  Status s = fs_manager_->env()->NewWritableFile(overwrite_opts, recycled.path, &file);
+  if (PREDICT_FALSE(!s.ok())) {
+    WARN_NOT_OK(fs_manager_->env()->DeleteFile(recycled.path),
+                "Unable to delete recycled log segment");
+    return s;
+  }
+  *path = std::move(recycled.path);
+  out->reset(file.release());
+  *size = recycled.size;
+  return Status::OK();
+}
+
+void Log::DeleteRecycledSegments() {
+  std::deque<RecycledSegment> recycled;
+  {
+    std::lock_guard<simple_spinlock> l(recycled_segments_lock_);
+    recycled.swap(recycled_segments_);
+  }
+  for (const auto& r : recycled) {
+    WARN_NOT_OK(fs_manager_->env()->DeleteFile(r.path),
+                Substitute("Unable to delete recycled log segment $0", r.path));
+  }
+}
+
 int64_t Log::GetGCableDataSize(RetentionIndexes retention_indexes) const {
   CHECK(!FLAGS_raft_derived_log_mode);
   CHECK_GE(retention_indexes.for_durability, 0);
@@ -1019,6 +1872,19 @@ Status Log::ReadReplicatesInRange(
       starting_at, up_to, max_bytes_to_read, replicates);
 }
 
+Status Log::AsyncReadReplicatesInRange(
+    int64_t starting_at,
+    int64_t up_to,
+    int64_t max_bytes_to_read,
+    const consensus::ReadContext& context,
+    const ReadReplicatesCallback& callback) const {
+  vector<consensus::ReplicateMsg*> replicates;
+  Status s = ReadReplicatesInRange(starting_at, up_to, max_bytes_to_read,
+                                   context, &replicates);
+  callback(s, &replicates);
+  return Status::OK();
+}
+
 Status Log::LookupOpId(int64_t op_index, OpId* op_id) const {
   return reader()->LookupOpId(op_index, op_id);
 }
@@ -1026,7 +1892,21 @@ Status Log::LookupOpId(int64_t op_index, OpId* op_id) const {
 Status Log::Close() {
   CHECK(!FLAGS_raft_derived_log_mode);
   allocation_pool_->Shutdown();
+  if (gc_pool_) {
+    // Finish reclaiming the GC'd segments as fast as possible rather than
+    // leaving their files behind.
+    gc_unthrottled_ = true;
+    gc_pool_->Wait();
+    gc_pool_->Shutdown();
+  }
+  // No new segments will be allocated, so the recycled files are not needed.
+  DeleteRecycledSegments();
   append_thread_->Shutdown();
+  if (serialize_pool_) {
+    // The append thread is done with all the queued batches, so nothing
+    // depends on the serialization pool anymore.
+    serialize_pool_->Shutdown();
+  }
 
   std::lock_guard<percpu_rwlock> l(state_lock_);
   switch (log_state_) {
@@ -1038,6 +1918,10 @@ Status Log::Close() {
       RETURN_NOT_OK(Sync());
       RETURN_NOT_OK(CloseCurrentSegment());
       RETURN_NOT_OK(ReplaceSegmentInReaderUnlocked());
+      if (FLAGS_log_clean_shutdown_checkpoint) {
+        RETURN_NOT_OK_PREPEND(WriteCleanShutdownCheckpoint(),
+                              "Could not write the clean shutdown checkpoint");
+      }
       log_state_ = kLogClosed;
       VLOG_WITH_PREFIX(1) << "Log closed";
 
@@ -1060,22 +1944,99 @@ Status Log::Close() {
   }
 }
 
+Status Log::WriteCleanShutdownCheckpoint() {
+  LogCleanShutdownCheckpointPB checkpoint;
+  if (last_replicate_id_.IsInitialized()) {
+    *checkpoint.mutable_last_id() = last_replicate_id_;
+  }
+  if (last_committed_id_.IsInitialized()) {
+    *checkpoint.mutable_last_committed_id() = last_committed_id_;
+  }
+  checkpoint.set_last_segment_sequence_number(active_segment_sequence_number_);
+  *checkpoint.mutable_last_segment_footer() = footer_builder_;
+  // The sparse index is only needed to read the segment, from its own footer.
+  checkpoint.mutable_last_segment_footer()->clear_sparse_index();
+  return pb_util::WritePBContainerToPath(
+      fs_manager_->env(), JoinPathSegments(log_dir_, kCleanShutdownCheckpointFileName),
+      checkpoint, pb_util::OVERWRITE, pb_util::SYNC);
+}
+
+Status Log::RecoverCleanShutdownCheckpoint(const SegmentSequence& segments) {
+  Env* env = fs_manager_->env();
+  string path = JoinPathSegments(log_dir_, kCleanShutdownCheckpointFileName);
+  auto checkpoint = std::unique_ptr<LogCleanShutdownCheckpointPB>(
+      new LogCleanShutdownCheckpointPB);
+  Status s = pb_util::ReadPBContainerFromPath(env, path, checkpoint.get());
+  if (s.IsNotFound()) {
+    return Status::OK();
+  }
+  if (!s.ok()) {
+    LOG_WITH_PREFIX(WARNING) << "Ignoring unreadable clean shutdown checkpoint "
+                             << path << ": " << s.ToString();
+  } else if (!segments.empty() &&
+             segments.back()->HasFooter() &&
+             checkpoint->last_segment_sequence_number() ==
+                 segments.back()->header().sequence_number() &&
+             checkpoint->last_segment_footer().num_entries() ==
+                 segments.back()->footer().num_entries() &&
+             checkpoint->last_segment_footer().max_replicate_index() ==
+                 segments.back()->footer().max_replicate_index()) {
+    VLOG_WITH_PREFIX(1) << "Recovered clean shutdown checkpoint: "
+                        << pb_util::SecureShortDebugString(*checkpoint);
+    if (checkpoint->has_last_id()) {
+      last_replicate_id_ = checkpoint->last_id();
+    }
+    if (checkpoint->has_last_committed_id()) {
+      last_committed_id_ = checkpoint->last_committed_id();
+    }
+    recovered_checkpoint_ = std::move(checkpoint);
+  } else {
+    LOG_WITH_PREFIX(WARNING) << "Ignoring clean shutdown checkpoint which doesn't "
+                             << "match the last segment of the log";
+  }
+  // Once new segments are written, the checkpoint no longer describes the log.
+  RETURN_NOT_OK(env->DeleteFile(path));
+  return env->SyncDir(log_dir_);
+}
+
+void Log::GetRecoveryInfo(consensus::ConsensusBootstrapInfo *bootstrap_info) {
+  if (!recovered_checkpoint_) {
+    return;
+  }
+  if (recovered_checkpoint_->has_last_id()) {
+    bootstrap_info->last_id = recovered_checkpoint_->last_id();
+  }
+  if (recovered_checkpoint_->has_last_committed_id()) {
+    bootstrap_info->last_committed_id = recovered_checkpoint_->last_committed_id();
+  }
+}
+
 bool Log::HasOnDiskData(FsManager* fs_manager, const string& tablet_id) {
-  string wal_dir = fs_manager->GetTabletWalDir(tablet_id);
-  return fs_manager->env()->FileExists(wal_dir);
+  for (const string& wal_dir : fs_manager->GetTabletWalDirs(tablet_id)) {
+    if (fs_manager->env()->FileExists(wal_dir)) {
+      return true;
+    }
+  }
+  return false;
 }
 
 Status Log::DeleteOnDiskData(FsManager* fs_manager, const string& tablet_id) {
   CHECK(!FLAGS_raft_derived_log_mode);
-  string wal_dir = fs_manager->GetTabletWalDir(tablet_id);
   Env* env = fs_manager->env();
-  if (!env->FileExists(wal_dir)) {
-    return Status::OK();
+  // Delete the stripe directories before the primary one, so that a crash
+  // part-way through never leaves stripes behind without the primary
+  // directory that HasOnDiskData() and LogReader expect.
+  vector<string> wal_dirs = fs_manager->GetTabletWalDirs(tablet_id);
+  for (auto it = wal_dirs.rbegin(); it != wal_dirs.rend(); ++it) {
+    const string& wal_dir = *it;
+    if (!env->FileExists(wal_dir)) {
+      continue;
+    }
+    LOG(INFO) << Substitute("T $0 P $1: Deleting WAL directory at $2",
+                            tablet_id, fs_manager->uuid(), wal_dir);
+    RETURN_NOT_OK_PREPEND(env->DeleteRecursively(wal_dir),
+                          "Unable to recursively delete WAL dir for tablet " + tablet_id);
   }
-  LOG(INFO) << Substitute("T $0 P $1: Deleting WAL directory at $2",
-                          tablet_id, fs_manager->uuid(), wal_dir);
-  RETURN_NOT_OK_PREPEND(env->DeleteRecursively(wal_dir),
-                        "Unable to recursively delete WAL dir for tablet " + tablet_id);
   return Status::OK();
 }
 
@@ -1117,26 +2078,54 @@ Status Log::PreAllocateNewSegment() {
 
   // We must mark allocation as finished when returning from this method.
   auto alloc_finished = MakeScopedCleanup([&] () {
-    std::lock_guard<RWMutex> l(allocation_lock_);
+    std::lock_guard<PerCpuRWMutex> l(allocation_lock_);
     allocation_state_ = kAllocationFinished;
   });
 
   WritableFileOptions opts;
   opts.sync_on_close = force_sync_all_;
-  RETURN_NOT_OK(CreatePlaceholderSegment(opts, &next_segment_path_, &next_segment_file_));
+  opts.direct_io = FLAGS_log_direct_io;
+  opts.use_io_uring = FLAGS_log_io_uring;
+
+  // Reuse the file of a GC'd segment if there is one: its blocks are already
+  // allocated, up to its size.
+  next_segment_recycled_ = false;
+  uint64_t allocated_size = 0;
+  Status s = OpenRecycledSegment(opts, &next_segment_path_, &next_segment_file_,
+                                 &allocated_size);
+  if (s.ok()) {
+    next_segment_recycled_ = true;
+    if (metrics_) {
+      metrics_->segments_recycled->Increment();
+    }
+    TRACE("Reusing recycled segment $0", next_segment_path_);
+  } else {
+    if (!s.IsNotFound()) {
+      LOG_WITH_PREFIX(WARNING) << "Unable to reuse recycled log segment: " << s.ToString();
+    }
+    s = CreatePlaceholderSegment(opts, &next_segment_path_, &next_segment_file_);
+    if (s.IsNotSupported() && opts.use_io_uring) {
+      KLOG_FIRST_N(WARNING, 1) << LogPrefix() << "Unable to use io_uring for WAL segments, "
+                               << "falling back to regular I/O: " << s.ToString();
+      opts.use_io_uring = false;
+      s = CreatePlaceholderSegment(opts, &next_segment_path_, &next_segment_file_);
+    }
+    RETURN_NOT_OK(s);
+  }
 
   MAYBE_RETURN_FAILURE(FLAGS_log_inject_io_error_on_preallocate_fraction,
                        Status::IOError("Injected IOError in Log::PreAllocateNewSegment()"));
 
-  if (options_.preallocate_segments) {
-    TRACE("Preallocating $0 byte segment in $1", max_segment_size_, next_segment_path_);
+  if (options_.preallocate_segments && allocated_size < next_segment_size_) {
+    uint64_t bytes = next_segment_size_ - allocated_size;
+    TRACE("Preallocating $0 bytes for segment in $1", bytes, next_segment_path_);
     RETURN_NOT_OK(env_util::VerifySufficientDiskSpace(fs_manager_->env(),
                                                       next_segment_path_,
-                                                      max_segment_size_,
+                                                      bytes,
                                                       FLAGS_fs_wal_dir_reserved_bytes));
-    // TODO (perf) zero the new segments -- this could result in
-    // additional performance improvements.
-    RETURN_NOT_OK(next_segment_file_->PreAllocate(max_segment_size_));
+    // With --log_direct_io, this also zeroes the new segment, so that appends
+    // don't have to convert unwritten extents.
+    RETURN_NOT_OK(next_segment_file_->PreAllocate(bytes));
   }
 
   return Status::OK();
@@ -1154,7 +2143,8 @@ Status Log::SwitchToAllocatedSegment() {
 
   RETURN_NOT_OK(fs_manager_->env()->RenameFile(next_segment_path_, new_segment_path));
   if (force_sync_all_) {
-    RETURN_NOT_OK(fs_manager_->env()->SyncDir(log_dir_));
+    RETURN_NOT_OK(fs_manager_->env()->SyncDir(
+        fs_manager_->GetTabletWalDirForSegment(tablet_id_, active_segment_sequence_number_)));
   }
 
   // Create a new segment.
@@ -1165,6 +2155,10 @@ Status Log::SwitchToAllocatedSegment() {
   LogSegmentHeaderPB header;
   header.set_sequence_number(active_segment_sequence_number_);
   header.set_tablet_id(tablet_id_);
+  if (next_segment_recycled_) {
+    // The file still holds the entries of the segment it was recycled from.
+    header.add_incompatible_features(LogSegmentHeaderPB::FENCED_ENTRY_HEADERS);
+  }
 
   if (codec_) {
     header.set_compression_codec(codec_->type());
@@ -1173,6 +2167,7 @@ Status Log::SwitchToAllocatedSegment() {
   // Set up the new footer. This will be maintained as the segment is written.
   footer_builder_.Clear();
   footer_builder_.set_num_entries(0);
+  sparse_index_builder_.Clear();
 
 
 #ifdef FB_DO_NOT_REMOVE
@@ -1196,20 +2191,20 @@ Status Log::SwitchToAllocatedSegment() {
   }
 
   // Open the segment we just created in readable form and add it to the reader.
-  // TODO(todd): consider using a global FileCache here? With short log segments and
-  // lots of tablets, this file descriptor usage may add up.
-  unique_ptr<RandomAccessFile> readable_file;
-
-  RandomAccessFileOptions opts;
-  RETURN_NOT_OK(fs_manager_->env()->NewRandomAccessFile(opts, new_segment_path, &readable_file));
+  // With short log segments and lots of tablets, this file descriptor usage may
+  // add up, unless --log_segment_file_cache_capacity bounds it.
+  shared_ptr<RandomAccessFile> readable_file;
+  RETURN_NOT_OK(OpenLogSegmentFileForRandom(fs_manager_->env(), new_segment_path,
+                                            &readable_file));
   scoped_refptr<ReadableLogSegment> readable_segment(
-    new ReadableLogSegment(new_segment_path,
-                           shared_ptr<RandomAccessFile>(readable_file.release())));
+    new ReadableLogSegment(new_segment_path, std::move(readable_file)));
   RETURN_NOT_OK(readable_segment->Init(header, new_segment->first_entry_offset()));
   RETURN_NOT_OK(reader_->AppendEmptySegment(readable_segment));
 
   // Now set 'active_segment_' to the new segment.
   active_segment_.reset(new_segment.release());
+  active_segment_start_ = MonoTime::Now();
+  max_segment_size_ = next_segment_size_;
 
   allocation_state_ = kAllocationNotStarted;
 
@@ -1221,7 +2216,8 @@ Status Log::ReplaceSegmentInReaderUnlocked() {
   // We should never switch to a new segment if we wrote nothing to the old one.
   CHECK(active_segment_->IsClosed());
   shared_ptr<RandomAccessFile> readable_file;
-  RETURN_NOT_OK(OpenFileForRandom(fs_manager_->env(), active_segment_->path(), &readable_file));
+  RETURN_NOT_OK(OpenLogSegmentFileForRandom(fs_manager_->env(), active_segment_->path(),
+                                            &readable_file));
   scoped_refptr<ReadableLogSegment> readable_segment(
       new ReadableLogSegment(active_segment_->path(),
                              readable_file));
@@ -1230,6 +2226,9 @@ Status Log::ReplaceSegmentInReaderUnlocked() {
   RETURN_NOT_OK(readable_segment->Init(active_segment_->header(),
                                        active_segment_->footer(),
                                        active_segment_->first_entry_offset()));
+  WARN_NOT_OK(readable_segment->MaybeMapClosedSegment(fs_manager_->env()),
+              Substitute("Could not map log segment $0, reading it with pread()",
+                         active_segment_->path()));
 
   return reader_->ReplaceLastSegment(readable_segment);
 }
@@ -1239,7 +2238,11 @@ Status Log::CreatePlaceholderSegment(const WritableFileOptions& opts,
                                      shared_ptr<WritableFile>* out) {
   CHECK(!FLAGS_raft_derived_log_mode);
   string tmp_suffix = strings::Substitute("$0$1", kTmpInfix, ".newsegmentXXXXXX");
-  string path_tmpl = JoinPathSegments(log_dir_, tmp_suffix);
+  // The placeholder is created in the directory of the segment it will become,
+  // so that SwitchToAllocatedSegment() only has to rename it in place.
+  string segment_dir = fs_manager_->GetTabletWalDirForSegment(
+      tablet_id_, active_segment_sequence_number_ + 1);
+  string path_tmpl = JoinPathSegments(segment_dir, tmp_suffix);
   VLOG_WITH_PREFIX(2) << "Creating temp. file for place holder segment, template: " << path_tmpl;
   unique_ptr<WritableFile> segment_file;
   RETURN_NOT_OK(fs_manager_->env()->NewTempWritableFile(opts,
@@ -1268,9 +2271,15 @@ LogEntryBatch::LogEntryBatch(LogEntryTypePB type,
           PREDICT_FALSE(count == 1 && entry_batch_pb_->entry(0).type() == FLUSH_MARKER) ?
           0 : entry_batch_pb_->ByteSize()),
       count_(count) {
+  buffer_.AllowHugePages();
+  encoded_buffer_.AllowHugePages();
 }
 
 LogEntryBatch::~LogEntryBatch() {
+  if (is_encoded_async_) {
+    // Make sure the serialization pool is done with this batch.
+    ignore_result(encode_status_.Get());
+  }
   if (type_ == REPLICATE && entry_batch_pb_) {
     for (LogEntryPB& entry : *entry_batch_pb_->mutable_entry()) {
       // ReplicateMsg elements are owned by and must be freed by the caller
@@ -1278,6 +2287,10 @@ LogEntryBatch::~LogEntryBatch() {
       std::ignore = entry.release_replicate();
     }
   }
+  if (FaststringPool* pool = EntryBufferPool()) {
+    pool->Release(&buffer_);
+    pool->Release(&encoded_buffer_);
+  }
 }
 
 void LogEntryBatch::Serialize() {
@@ -1286,10 +2299,41 @@ void LogEntryBatch::Serialize() {
   if (PREDICT_FALSE(count() == 1 && entry_batch_pb_->entry(0).type() == FLUSH_MARKER)) {
     return;
   }
-  buffer_.reserve(total_size_bytes_);
+  if (FaststringPool* pool = EntryBufferPool()) {
+    pool->Acquire(total_size_bytes_, &buffer_);
+  } else {
+    buffer_.reserve(total_size_bytes_);
+  }
   pb_util::AppendToString(*entry_batch_pb_, &buffer_);
 }
 
+void LogEntryBatch::RecordOpTimelines(const string& tablet_id, OpTimeline::Stage stage) const {
+  for (const consensus::ReplicateRefPtr& replicate : replicates_) {
+    const consensus::OpId& id = replicate->get()->id();
+    OpTimeline::Record(tablet_id, id.term(), id.index(), stage);
+  }
+}
+
+void LogEntryBatch::SerializeAndEncode(const CompressionCodec* codec) {
+  Serialize();
+  FaststringPool* pool = EntryBufferPool();
+  if (pool) {
+    // The framed entry is about as large as the serialized one, compressed or not.
+    pool->Acquire(buffer_.size() + kEntryHeaderSizeV2, &encoded_buffer_);
+  }
+  Status s = WritableLogSegment::EncodeEntryBatch(data(), codec, &encoded_buffer_);
+  if (s.ok()) {
+    // Only the framed copy is written out.
+    if (pool) {
+      pool->Release(&buffer_);
+    } else {
+      buffer_.clear();
+      buffer_.shrink_to_fit();
+    }
+  }
+  encode_status_.Set(s);
+}
+
 
 }  // namespace log
 }  // namespace kudu
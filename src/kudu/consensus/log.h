@@ -27,6 +27,8 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <limits>
 #include <map>
 #include <memory>
@@ -49,11 +51,13 @@
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
-#include "kudu/util/blocking_queue.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mpsc_queue.h"
+#include "kudu/util/op_timeline.h"
+#include "kudu/util/percpu_rw_mutex.h"
 #include "kudu/util/promise.h"
-#include "kudu/util/rw_mutex.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
@@ -64,6 +68,7 @@ class CompressionCodec;
 class FsManager;
 class MetricEntity;
 class ThreadPool;
+class Throttler;
 class WritableFile;
 struct WritableFileOptions;
 
@@ -115,7 +120,8 @@ class LogEntryBatch;
 class LogIndex;
 class LogReader;
 
-typedef BlockingQueue<LogEntryBatch*, LogEntryBatchLogicalSize> LogEntryBatchQueue;
+// Lock-free for the threads appending to the log; drained by the append thread.
+typedef MpscQueue<LogEntryBatch*, LogEntryBatchLogicalSize> LogEntryBatchQueue;
 
 // Log interface, inspired by Raft's (logcabin) Log. Provides durability to
 // Kudu as a normal Write Ahead Log and also plays the role of persistent
@@ -161,6 +167,10 @@ class Log : public RefCountedThreadSafe<Log> {
 
   // Append the given set of replicate messages, asynchronously.
   // This requires that the replicates have already been assigned OpIds.
+  //
+  // This is the batch which a derived log (--raft_derived_log_mode) takes
+  // into its own group commit: the replicates are shared, not copied, and
+  // 'callback' is run once the whole batch is durable.
   virtual Status AsyncAppendReplicates(
       const std::vector<consensus::ReplicateRefPtr>& replicates,
       const StatusCallback& callback);
@@ -173,25 +183,51 @@ class Log : public RefCountedThreadSafe<Log> {
   // start the instance from where it crashed. In abstracted logs like
   // MySQL, this bootstrap_info object is populated by log abstraction during
   // Log::Init and plumbed via this function to RaftConsensus::Start
-  virtual void GetRecoveryInfo(consensus::ConsensusBootstrapInfo *bootstrap_info) {
-    // In base implementation, we don't override the bootstrap_info
-  }
+  //
+  // The base implementation only knows the last operations of a log which was
+  // closed cleanly with --log_clean_shutdown_checkpoint, and otherwise leaves
+  // 'bootstrap_info' as it is.
+  virtual void GetRecoveryInfo(consensus::ConsensusBootstrapInfo *bootstrap_info);
 
   // Append the given commit message, asynchronously.
   //
   // Returns a bad status if the log is already shut down.
-  Status AsyncAppendCommit(gscoped_ptr<consensus::CommitMsg> commit_msg,
-                           const StatusCallback& callback);
-
+  virtual Status AsyncAppendCommit(gscoped_ptr<consensus::CommitMsg> commit_msg,
+                                   const StatusCallback& callback);
 
   // Blocks the current thread until all the entries in the log queue
   // are flushed and fsynced (if fsync of log entries is enabled).
+  //
+  // Implemented on top of AsyncWaitUntilAllFlushed(), which is what derived
+  // logs should override.
   virtual Status WaitUntilAllFlushed();
 
+  // Runs 'callback' once all the entries appended so far are flushed and
+  // fsynced (if fsync of log entries is enabled).
+  //
+  // Returns a bad status, without running 'callback', if the log is already
+  // shut down.
+  virtual Status AsyncWaitUntilAllFlushed(const StatusCallback& callback);
+
+  // Append a TERM_VOTE entry, asynchronously. It is synced along with the
+  // rest of the group the append thread is writing.
+  //
+  // Returns a bad status if the log is already shut down.
+  virtual Status AsyncAppendTermVote(const TermVotePB& term_vote,
+                                     const StatusCallback& callback);
+
+  // Finds the latest TERM_VOTE entry in the log. Sets 'found' to false if
+  // the log has none.
+  virtual Status ReadLastTermVote(TermVotePB* term_vote, bool* found);
+
   // index_if_truncated - if caller e.g. Log Cache passes in index_if_truncated,
   // the log specialization is expected to return the index of truncation
   virtual Status TruncateOpsAfter(int64_t index, int64_t *index_if_truncated = nullptr);
 
+  // If the latest TERM_VOTE entry is in a segment other than the active one,
+  // appends it again, so that GC'ing that segment doesn't lose it.
+  Status CarryForwardTermVote();
+
   // Kick off an asynchronous task that pre-allocates a new
   // log-segment, setting 'allocation_status_'. To wait for the
   // result of the task, use allocation_status_.Get().
@@ -200,6 +236,42 @@ class Log : public RefCountedThreadSafe<Log> {
   // The closure submitted to allocation_pool_ to allocate a new segment.
   void SegmentAllocationTask();
 
+  // The task submitted to gc_pool_ to reclaim the files of GC'd segments.
+  void ReclaimSegmentsTask(const SegmentSequence& segments);
+
+  // Reclaims the file of a single GC'd segment according to
+  // --log_gc_reclaim_mode, throttled by 'gc_throttler_'.
+  Status ReclaimSegment(const scoped_refptr<ReadableLogSegment>& segment);
+
+  // Blocks until 'bytes' may be reclaimed without exceeding
+  // --log_gc_max_bytes_per_sec, then updates the pending GC bytes.
+  void ThrottleReclaim(int64_t bytes);
+
+  // Adds 'delta' to the pending GC bytes and updates the metric.
+  void UpdatePendingGCBytes(int64_t delta);
+
+  // If --log_max_recycled_segments allows it, and nothing but the caller
+  // still references the GC'd 'segment', moves its file into the pool of
+  // recycled segments instead of deleting it. Returns true if it did.
+  bool MaybeRecycleSegment(const scoped_refptr<ReadableLogSegment>& segment);
+
+  // Zeroes the footer trailer of the file of 'segment', so that the file
+  // can never again be mistaken for a closed segment, and renames it into
+  // the pool of recycled segments.
+  Status RecycleSegment(const scoped_refptr<ReadableLogSegment>& segment);
+
+  // Takes a recycled segment file from the directory of the next segment
+  // out of the pool and opens it with 'opts' for overwriting, setting 'path'
+  // and 'out' accordingly and 'size' to the size of the file. Returns
+  // NotFound if the pool has no file in that directory.
+  Status OpenRecycledSegment(const WritableFileOptions& opts,
+                             std::string* path,
+                             std::shared_ptr<WritableFile>* out,
+                             uint64_t* size);
+
+  // Deletes the files left in the pool of recycled segments.
+  void DeleteRecycledSegments();
+
   // Return true if there is any on-disk data for the given tablet.
   static bool HasOnDiskData(FsManager* fs_manager, const std::string& tablet_id);
 
@@ -219,6 +291,7 @@ class Log : public RefCountedThreadSafe<Log> {
 
   void SetMaxSegmentSizeForTests(uint64_t max_segment_size) {
     max_segment_size_ = max_segment_size;
+    next_segment_size_ = max_segment_size;
   }
 
   void DisableAsyncAllocationForTests() {
@@ -249,11 +322,23 @@ class Log : public RefCountedThreadSafe<Log> {
   // 'min_op_idx' is the minimum operation index required to be retained.
   // If successful, num_gced is set to the number of deleted log segments.
   //
+  // With --log_async_gc, the segments are removed from the log right away but
+  // their files are reclaimed in the background at a throttled rate, and
+  // num_gced is set to the number of segments handed off for reclamation.
+  //
   // This method is thread-safe.
-  Status GC(RetentionIndexes retention_indexes, int* num_gced);
+  virtual Status GC(RetentionIndexes retention_indexes, int* num_gced);
 
   // Computes the amount of bytes that would have been GC'd if Log::GC had been called.
-  int64_t GetGCableDataSize(RetentionIndexes retention_indexes) const;
+  // Does not include the segments already GC'd but still pending reclamation, see
+  // GetPendingGCDataSize().
+  virtual int64_t GetGCableDataSize(RetentionIndexes retention_indexes) const;
+
+  // Returns the number of bytes of GC'd segments which have not yet been
+  // reclaimed by the background GC thread. Always 0 without --log_async_gc.
+  int64_t GetPendingGCDataSize() const {
+    return pending_gc_bytes_.load(std::memory_order_relaxed);
+  }
 
   // Returns a map which can be used to determine the cumulative size of log segments
   // containing entries at or above any given log index.
@@ -277,11 +362,11 @@ class Log : public RefCountedThreadSafe<Log> {
   // and any anchor on 100 < index <= 200 would retain 25MB of logs, etc.
   //
   // Note that the returned values are in units of bytes, not MB.
-  void GetReplaySizeMap(std::map<int64_t, int64_t>* replay_size) const;
+  virtual void GetReplaySizeMap(std::map<int64_t, int64_t>* replay_size) const;
 
   // Returns the total size of the current segments, in bytes.
   // Returns 0 if the log is shut down.
-  int64_t OnDiskSize();
+  virtual int64_t OnDiskSize();
 
   // Returns the file system location of the currently active WAL segment.
   const std::string& ActiveSegmentPathForTests() const {
@@ -318,6 +403,27 @@ class Log : public RefCountedThreadSafe<Log> {
       int64_t max_bytes_to_read,
       const consensus::ReadContext& context,
       std::vector<consensus::ReplicateMsg*>* replicates) const;
+
+  // Run with the result of AsyncReadReplicatesInRange(). The callback takes
+  // ownership of the messages in 'replicates', which may be non-empty even
+  // if 's' is bad.
+  typedef std::function<void(const Status& s,
+                             std::vector<consensus::ReplicateMsg*>* replicates)>
+      ReadReplicatesCallback;
+
+  // Like ReadReplicatesInRange(), but runs 'callback' with the result rather
+  // than blocking on it, so that a derived log can serve the read from its own
+  // IO threads. 'context' is only valid for the duration of the call.
+  //
+  // Returns a bad status, without running 'callback', if the read could not
+  // be started. The callbacks of reads still in flight must have run by the
+  // time Close() returns. The default runs ReadReplicatesInRange() inline.
+  virtual Status AsyncReadReplicatesInRange(
+      int64_t starting_at,
+      int64_t up_to,
+      int64_t max_bytes_to_read,
+      const consensus::ReadContext& context,
+      const ReadReplicatesCallback& callback) const;
   virtual Status LookupOpId(int64_t op_index, consensus::OpId* op_id) const;
 
  protected:
@@ -327,6 +433,9 @@ class Log : public RefCountedThreadSafe<Log> {
   FRIEND_TEST(LogTestOptionalCompression, TestMultipleEntriesInABatch);
   FRIEND_TEST(LogTestOptionalCompression, TestReadLogWithReplacedReplicates);
   FRIEND_TEST(LogTest, TestWriteAndReadToAndFromInProgressSegment);
+  FRIEND_TEST(LogTest, TestParallelOpenVerifiesChecksums);
+  FRIEND_TEST(LogTest, TestPreallocateAhead);
+  FRIEND_TEST(LogTest, TestAdaptiveSegmentSize);
 
   class AppendThread;
 
@@ -351,6 +460,12 @@ class Log : public RefCountedThreadSafe<Log> {
 #endif
       scoped_refptr<MetricEntity> metric_entity);
 
+  // Returns the size to allocate the next segment with: the configured one,
+  // or with --log_adaptive_segment_size, one which lasts about
+  // --log_adaptive_segment_roll_interval_secs at the rate the active segment
+  // was appended at.
+  uint64_t NextSegmentSize() const;
+
   // Make segments roll over.
   Status RollOver();
 
@@ -358,6 +473,11 @@ class Log : public RefCountedThreadSafe<Log> {
                                   std::unique_ptr<LogEntryBatchPB> entry_batch_pb,
                                   std::unique_ptr<LogEntryBatch>* entry_batch);
 
+  // Hands 'entry_batch' off to 'serialize_pool_', which serializes and frames
+  // it in the background. The append thread waits for the encoding to finish
+  // before writing the batch out.
+  Status SubmitBatchForEncoding(LogEntryBatch* entry_batch);
+
   // Asynchronously appends 'entry_batch' to the log. Once the append
   // completes and is synced, 'callback' will be invoked.
   Status AsyncAppend(std::unique_ptr<LogEntryBatch> entry_batch,
@@ -366,6 +486,15 @@ class Log : public RefCountedThreadSafe<Log> {
   // Writes the footer and closes the current segment.
   Status CloseCurrentSegment();
 
+  // Writes the clean shutdown checkpoint of the log, once its last segment is
+  // closed. See --log_clean_shutdown_checkpoint.
+  Status WriteCleanShutdownCheckpoint();
+
+  // Reads and removes the clean shutdown checkpoint left by the previous
+  // Close(), if any, keeping it in 'recovered_checkpoint_' if it matches the
+  // last of 'segments'.
+  Status RecoverCleanShutdownCheckpoint(const SegmentSequence& segments);
+
   // Sets 'out' to a newly created temporary file (see
   // Env::NewTempWritableFile()) for a placeholder segment. Sets
   // 'result_path' to the fully qualified path to the unique filename
@@ -385,8 +514,9 @@ class Log : public RefCountedThreadSafe<Log> {
   // AppenderThread.
   Status DoAppend(LogEntryBatch* entry_batch);
 
-  // Update footer_builder_ to reflect the log indexes seen in 'batch'.
-  void UpdateFooterForBatch(LogEntryBatch* batch);
+  // Update footer_builder_ and sparse_index_builder_ to reflect the log
+  // indexes seen in 'batch', which was written at 'start_offset'.
+  void UpdateFooterForBatch(LogEntryBatch* batch, int64_t start_offset);
 
   // Update the LogIndex to include entries for the replicate messages found in
   // 'batch'. The index entry points to the offset 'start_offset' in the current
@@ -400,6 +530,22 @@ class Log : public RefCountedThreadSafe<Log> {
 
   Status Sync();
 
+  // Like Sync(), but invokes 'callback' with the result rather than returning
+  // it, which may happen from another thread once the active segment's file
+  // is durable. Callbacks are invoked in order.
+  void AsyncSync(const StatusCallback& callback);
+
+  // Completes an AsyncSync() started at 'start_time' by running the sync
+  // hooks and then 'callback'.
+  void AsyncSyncDone(MonoTime start_time, const StatusCallback& callback, const Status& s);
+
+  // If --log_inject_latency is enabled, sleeps before syncing.
+  void MaybeInjectSyncLatency();
+
+  // Drops the closed segments holding no ops at or above 'min_index_for_peers',
+  // i.e. which no peer needs to catch up from, from the page cache.
+  void DropPageCacheBehindPeers(int64_t min_index_for_peers);
+
   // Helper method to get the segment sequence to GC based on the provided 'retention' struct.
   Status GetSegmentsToGCUnlocked(RetentionIndexes retention_indexes,
                                  SegmentSequence* segments_to_gc) const;
@@ -409,7 +555,7 @@ class Log : public RefCountedThreadSafe<Log> {
   }
 
   const SegmentAllocationState allocation_state() {
-    shared_lock<RWMutex> l(allocation_lock_);
+    shared_lock<PerCpuRWMutex> l(allocation_lock_);
     return allocation_state_;
   }
 
@@ -462,9 +608,19 @@ class Log : public RefCountedThreadSafe<Log> {
   // When the segment is closed, it will be written.
   LogSegmentFooterPB footer_builder_;
 
-  // The maximum segment size, in bytes.
+  // The sparse index of the active segment, written into its footer on close.
+  SegmentSparseIndex sparse_index_builder_;
+
+  // The maximum size of the active segment, in bytes.
   uint64_t max_segment_size_;
 
+  // The maximum size of the segment being allocated, in bytes, which becomes
+  // 'max_segment_size_' once it's switched to. Set by AsyncAllocateSegment().
+  uint64_t next_segment_size_;
+
+  // When the active segment was switched to.
+  MonoTime active_segment_start_;
+
   // The queue used to communicate between the threads appending operations
   // and the thread which actually appends them to the log.
   LogEntryBatchQueue entry_batch_queue_;
@@ -474,6 +630,64 @@ class Log : public RefCountedThreadSafe<Log> {
 
   gscoped_ptr<ThreadPool> allocation_pool_;
 
+  // Pool which serializes, checksums and compresses REPLICATE batches before
+  // they are written by the append thread. NULL unless
+  // --log_serialization_threads is positive.
+  gscoped_ptr<ThreadPool> serialize_pool_;
+
+  // Pool with a single thread which reclaims the files of GC'd segments.
+  // NULL unless --log_async_gc is set.
+  gscoped_ptr<ThreadPool> gc_pool_;
+
+  // Limits the rate at which gc_pool_ reclaims segment files. NULL if
+  // reclamation is not throttled. Only used by the gc_pool_ thread.
+  std::unique_ptr<Throttler> gc_throttler_;
+
+  // The number of bytes of GC'd segments that gc_pool_ has yet to reclaim.
+  std::atomic<int64_t> pending_gc_bytes_;
+
+  // Set when the log is closed, so that the remaining segments are reclaimed
+  // without throttling.
+  std::atomic<bool> gc_unthrottled_;
+
+  // The file of a GC'd segment, kept to be reused for a new segment.
+  struct RecycledSegment {
+    // The WAL directory the file is in.
+    std::string dir;
+    std::string path;
+    uint64_t size;
+  };
+
+  // Protects 'recycled_segments_'.
+  simple_spinlock recycled_segments_lock_;
+
+  // Files of GC'd segments, oldest first. See --log_max_recycled_segments.
+  std::deque<RecycledSegment> recycled_segments_;
+
+  // Protects 'last_term_vote_' and 'last_term_vote_segment_'.
+  simple_spinlock term_vote_lock_;
+
+  // The latest TERM_VOTE entry appended since the log was opened, and the
+  // sequence number of the segment it went to, or -1 if there is none. GC
+  // appends it again before deleting that segment, so that the log keeps it.
+  TermVotePB last_term_vote_;
+  int64_t last_term_vote_segment_ = -1;
+
+  // The ids of the last REPLICATE and of the last operation a COMMIT was
+  // appended for, starting from those of the clean shutdown checkpoint the log
+  // was opened with. Only used by the append thread, and by Close() once that
+  // has stopped.
+  consensus::OpId last_replicate_id_;
+  consensus::OpId last_committed_id_;
+
+  // The clean shutdown checkpoint the log was opened with, if it was closed
+  // cleanly and its last segment is still the one the checkpoint describes.
+  std::unique_ptr<LogCleanShutdownCheckpointPB> recovered_checkpoint_;
+
+  // Whether the file at 'next_segment_path_' is a recycled segment. Set by
+  // the allocation task, and read once allocation has finished.
+  bool next_segment_recycled_;
+
   // If true, sync on all appends.
   bool force_sync_all_;
 
@@ -484,8 +698,8 @@ class Log : public RefCountedThreadSafe<Log> {
   // The status of the most recent log-allocation action.
   Promise<Status> allocation_status_;
 
-  // Read-write lock to protect 'allocation_state_'.
-  mutable RWMutex allocation_lock_;
+  // Read-write lock to protect 'allocation_state_', which every append reads.
+  mutable PerCpuRWMutex allocation_lock_;
   SegmentAllocationState allocation_state_;
 
   // The codec used to compress entries, or nullptr if not configured.
@@ -575,6 +789,32 @@ class LogEntryBatch {
   // Serializes contents of the entry to an internal buffer.
   void Serialize();
 
+  // Serializes the entry and then frames it, as it is to be written to a
+  // segment, into 'encoded_buffer_', compressing the payload with 'codec'
+  // if it is not NULL. Sets 'encode_status_' once done.
+  //
+  // This is run on the log's serialization pool.
+  void SerializeAndEncode(const CompressionCodec* codec);
+
+  // Whether this entry was handed off to be encoded in the background,
+  // in which case it is written out from 'encoded_buffer_'.
+  bool is_encoded_async() const {
+    return is_encoded_async_;
+  }
+
+  // Blocks until the background encoding of this entry is done and returns
+  // its result. Requires is_encoded_async().
+  Status WaitForEncoding() {
+    DCHECK(is_encoded_async_);
+    return encode_status_.Get();
+  }
+
+  // Returns a Slice representing the framed, and possibly compressed,
+  // contents of the entry. Requires a successful WaitForEncoding().
+  Slice encoded_data() const {
+    return Slice(encoded_buffer_);
+  }
+
   // Sets the callback that will be invoked after the entry is
   // appended and synced to disk
   void set_callback(const StatusCallback& cb) {
@@ -614,6 +854,10 @@ class LogEntryBatch {
     replicates_ = replicates;
   }
 
+  // Records 'stage' into the timelines of the sampled replicates of this
+  // batch, see OpTimeline.
+  void RecordOpTimelines(const std::string& tablet_id, OpTimeline::Stage stage) const;
+
   // The type of entries in this batch.
   const LogEntryTypePB type_;
 
@@ -640,6 +884,14 @@ class LogEntryBatch {
   // 'Serialize()'
   faststring buffer_;
 
+  // Set when the entry is submitted for background encoding.
+  bool is_encoded_async_ = false;
+
+  // The result of SerializeAndEncode(), and the buffer into which it frames
+  // the entry.
+  Promise<Status> encode_status_;
+  faststring encoded_buffer_;
+
   DISALLOW_COPY_AND_ASSIGN(LogEntryBatch);
 };
 
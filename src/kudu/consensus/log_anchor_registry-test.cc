@@ -121,5 +121,36 @@ TEST_F(LogAnchorRegistryTest, TestOrderedEarliestOpId) {
   ASSERT_TRUE(s.IsNotFound()) << s.ToString();
 }
 
+// Tests that the earliest index follows anchors which share an index, and
+// anchors whose registration is moved.
+TEST_F(LogAnchorRegistryTest, TestEarliestFollowsUpdates) {
+  scoped_refptr<LogAnchorRegistry> reg(new LogAnchorRegistry());
+  const int kNumAnchors = 100;
+  const string test_name = CURRENT_TEST_NAME();
+
+  LogAnchor anchors[kNumAnchors];
+  for (int i = 0; i < kNumAnchors; i++) {
+    reg->Register(10, test_name, &anchors[i]);
+  }
+  int64_t anchor_idx = -1;
+  ASSERT_OK(reg->GetEarliestRegisteredLogIndex(&anchor_idx));
+  ASSERT_EQ(10, anchor_idx);
+
+  // Move all but the last anchor forward; the earliest stays until it moves too.
+  for (int i = 0; i < kNumAnchors - 1; i++) {
+    ASSERT_OK(reg->UpdateRegistration(20 + i, test_name, &anchors[i]));
+  }
+  ASSERT_OK(reg->GetEarliestRegisteredLogIndex(&anchor_idx));
+  ASSERT_EQ(10, anchor_idx);
+  ASSERT_OK(reg->UpdateRegistration(30, test_name, &anchors[kNumAnchors - 1]));
+  ASSERT_OK(reg->GetEarliestRegisteredLogIndex(&anchor_idx));
+  ASSERT_EQ(20, anchor_idx);
+
+  for (int i = 0; i < kNumAnchors; i++) {
+    ASSERT_OK(reg->Unregister(&anchors[i]));
+  }
+  ASSERT_TRUE(reg->GetEarliestRegisteredLogIndex(&anchor_idx).IsNotFound());
+}
+
 } // namespace log
 } // namespace kudu
@@ -17,6 +17,7 @@
 
 #include "kudu/consensus/log_anchor_registry.h"
 
+#include <limits>
 #include <mutex>
 #include <ostream>
 #include <string>
@@ -36,7 +37,10 @@ using std::string;
 using strings::Substitute;
 using strings::SubstituteAndAppend;
 
-LogAnchorRegistry::LogAnchorRegistry() {
+const int64_t LogAnchorRegistry::kNoAnchors = std::numeric_limits<int64_t>::max();
+
+LogAnchorRegistry::LogAnchorRegistry()
+    : earliest_log_index_(kNoAnchors) {
 }
 
 LogAnchorRegistry::~LogAnchorRegistry() {
@@ -48,6 +52,7 @@ void LogAnchorRegistry::Register(int64_t log_index,
                                  LogAnchor* anchor) {
   std::lock_guard<simple_spinlock> l(lock_);
   RegisterUnlocked(log_index, owner, anchor);
+  UpdateEarliestLogIndexUnlocked();
 }
 
 Status LogAnchorRegistry::UpdateRegistration(int64_t log_index,
@@ -57,29 +62,33 @@ Status LogAnchorRegistry::UpdateRegistration(int64_t log_index,
   RETURN_NOT_OK_PREPEND(UnregisterUnlocked(anchor),
                         "Unable to swap registration, anchor not registered")
   RegisterUnlocked(log_index, owner, anchor);
+  // Only publish the final state, so that readers never see the earliest index
+  // move past this anchor while it is being moved.
+  UpdateEarliestLogIndexUnlocked();
   return Status::OK();
 }
 
 Status LogAnchorRegistry::Unregister(LogAnchor* anchor) {
   std::lock_guard<simple_spinlock> l(lock_);
-  return UnregisterUnlocked(anchor);
+  RETURN_NOT_OK(UnregisterUnlocked(anchor));
+  UpdateEarliestLogIndexUnlocked();
+  return Status::OK();
 }
 
 Status LogAnchorRegistry::UnregisterIfAnchored(LogAnchor* anchor) {
   std::lock_guard<simple_spinlock> l(lock_);
   if (!anchor->is_registered) return Status::OK();
-  return UnregisterUnlocked(anchor);
+  RETURN_NOT_OK(UnregisterUnlocked(anchor));
+  UpdateEarliestLogIndexUnlocked();
+  return Status::OK();
 }
 
 Status LogAnchorRegistry::GetEarliestRegisteredLogIndex(int64_t* log_index) {
-  std::lock_guard<simple_spinlock> l(lock_);
-  auto iter = anchors_.begin();
-  if (iter == anchors_.end()) {
+  int64_t earliest = earliest_log_index_.load(std::memory_order_acquire);
+  if (earliest == kNoAnchors) {
     return Status::NotFound("No anchors in registry");
   }
-
-  // Since this is a sorted map, the first element is the one we want.
-  *log_index = iter->first;
+  *log_index = earliest;
   return Status::OK();
 }
 
@@ -115,25 +124,28 @@ void LogAnchorRegistry::RegisterUnlocked(int64_t log_index,
   anchor->is_registered = true;
   anchor->when_registered = MonoTime::Now();
   AnchorMultiMap::value_type value(log_index, anchor);
-  anchors_.insert(value);
+  anchor->position = anchors_.insert(value);
 }
 
 Status LogAnchorRegistry::UnregisterUnlocked(LogAnchor* anchor) {
   DCHECK(anchor != nullptr);
   DCHECK(anchor->is_registered);
 
-  auto iter = anchors_.find(anchor->log_index);
-  while (iter != anchors_.end()) {
-    if (iter->second == anchor) {
-      anchor->is_registered = false;
-      anchors_.erase(iter);
-      // No need for the iterator to remain valid since we return here.
-      return Status::OK();
-    }
-    ++iter;
+  if (PREDICT_FALSE(!anchor->is_registered)) {
+    return Status::NotFound(Substitute("Anchor with index $0 and owner $1 not found",
+                                       anchor->log_index, anchor->owner));
   }
-  return Status::NotFound(Substitute("Anchor with index $0 and owner $1 not found",
-                                     anchor->log_index, anchor->owner));
+  DCHECK(anchor->position->second == anchor);
+  anchors_.erase(anchor->position);
+  anchor->is_registered = false;
+  return Status::OK();
+}
+
+void LogAnchorRegistry::UpdateEarliestLogIndexUnlocked() {
+  DCHECK(lock_.is_locked());
+  // Since this is a sorted map, the first element is the one we want.
+  earliest_log_index_.store(anchors_.empty() ? kNoAnchors : anchors_.begin()->first,
+                            std::memory_order_release);
 }
 
 LogAnchor::LogAnchor()
@@ -17,6 +17,7 @@
 #ifndef KUDU_CONSENSUS_LOG_ANCHOR_REGISTRY_
 #define KUDU_CONSENSUS_LOG_ANCHOR_REGISTRY_
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <map>
@@ -69,6 +70,8 @@ class LogAnchorRegistry : public RefCountedThreadSafe<LogAnchorRegistry> {
 
   // Query the registry to find the earliest anchored log index in the registry.
   // Returns Status::NotFound if no anchors are currently active.
+  //
+  // This is a constant-time read which doesn't take the registry's lock.
   Status GetEarliestRegisteredLogIndex(int64_t* log_index);
 
   // Simply returns the number of active anchors for use in debugging / tests.
@@ -90,9 +93,17 @@ class LogAnchorRegistry : public RefCountedThreadSafe<LogAnchorRegistry> {
   // Unregister an anchor after taking the lock. See Unregister().
   Status UnregisterUnlocked(LogAnchor* anchor);
 
+  // Publish the first key of 'anchors_' to 'earliest_log_index_'.
+  void UpdateEarliestLogIndexUnlocked();
+
   AnchorMultiMap anchors_;
   mutable simple_spinlock lock_;
 
+  // The first key of 'anchors_', or kNoAnchors if it's empty. Written under
+  // 'lock_' and read without it.
+  static const int64_t kNoAnchors;
+  std::atomic<int64_t> earliest_log_index_;
+
   DISALLOW_COPY_AND_ASSIGN(LogAnchorRegistry);
 };
 
@@ -117,6 +128,10 @@ struct LogAnchor {
   // The index of the log entry we are anchoring on.
   int64_t log_index;
 
+  // Where this anchor sits in the registry, while it is registered, so that
+  // unregistering it doesn't have to search for it.
+  std::multimap<int64_t, LogAnchor*>::iterator position;
+
   // An arbitrary string containing details of the subsystem holding the
   // anchor, and any relevant information about it that should be displayed in
   // the log or the web UI.
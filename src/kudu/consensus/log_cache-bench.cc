@@ -0,0 +1,278 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// A benchmark of the LogCache under concurrent readers. One appender writes
+// ops through the cache into the log, while --bench_peer_lags_ops readers
+// stand in for peers which lag the leader by exponentially distributed
+// numbers of ops. Like the leader's queue, the appender evicts the ops every
+// peer has read and tells the cache where the peers are, and the cache
+// evicts older ops past its memory limits. It reports the hit ratio, the
+// bytes read from the log, the latency of cached and uncached reads, and the
+// contention on the cache's lock.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/clock/clock.h"
+#include "kudu/clock/logical_clock.h"
+#include "kudu/common/timestamp.h"
+#include "kudu/consensus/consensus-test-util.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log_cache.h"
+#include "kudu/consensus/log_util.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/bind.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/jsonwriter.h"
+#include "kudu/util/lock_profile.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
+#include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DEFINE_string(bench_peer_lags_ops, "0,0,1000,100000",
+              "Comma-separated list of the mean lags, in ops, of the peers "
+              "reading from the cache, one reader thread per peer.");
+DEFINE_int32(bench_append_ops_per_sec, 20000,
+             "Rate at which the appender writes ops. 0 means as fast as it can.");
+DEFINE_int32(bench_payload_bytes, 1024, "Size of the payload of each op.");
+DEFINE_int32(bench_read_batch_bytes, 1024 * 1024,
+             "Most bytes of ops a peer reads at a time.");
+DEFINE_int32(bench_run_seconds, 1, "Seconds to run the benchmark for.");
+
+DECLARE_int32(log_cache_size_limit_mb);
+DECLARE_int32(global_log_cache_size_limit_mb);
+
+METRIC_DECLARE_counter(log_reader_bytes_read);
+
+using std::atomic;
+using std::string;
+using std::thread;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+const char* kPeerUuid = "leader";
+const char* kTestTablet = "test-tablet";
+
+void FatalOnError(const Status& s) {
+  CHECK_OK(s);
+}
+
+} // anonymous namespace
+
+class LogCacheBench : public KuduTest {
+ public:
+  LogCacheBench()
+      : clock_(clock::LogicalClock::CreateStartingAt(Timestamp(1))),
+        metric_entity_(METRIC_ENTITY_server.Instantiate(&metric_registry_, "log-cache-bench")),
+        hit_latency_us_(60 * 1000 * 1000, 2),
+        miss_latency_us_(60 * 1000 * 1000, 2),
+        last_appended_(0) {
+  }
+
+  void SetUp() override {
+    KuduTest::SetUp();
+    OverrideFlagForSlowTests("bench_run_seconds", "10");
+
+    fs_manager_.reset(new FsManager(env_, GetTestPath("fs_root")));
+    ASSERT_OK(fs_manager_->CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager_->Open());
+    ASSERT_OK(log::Log::Open(log::LogOptions(), fs_manager_.get(), kTestTablet,
+                             metric_entity_, &log_));
+    cache_.reset(new LogCache(metric_entity_, log_, kPeerUuid, kTestTablet));
+    cache_->Init(MinimumOpId());
+
+    vector<string> lags = strings::Split(FLAGS_bench_peer_lags_ops, ",", strings::SkipEmpty());
+    for (const string& lag : lags) {
+      int64_t mean_lag;
+      ASSERT_TRUE(safe_strto64(lag, &mean_lag)) << "bad lag: " << lag;
+      mean_lags_.push_back(mean_lag);
+    }
+    ASSERT_FALSE(mean_lags_.empty());
+    peer_next_indexes_.reset(new atomic<int64_t>[mean_lags_.size()]);
+    for (int i = 0; i < mean_lags_.size(); i++) {
+      peer_next_indexes_[i] = 1;
+    }
+  }
+
+  void TearDown() override {
+    log_->WaitUntilAllFlushed();
+    KuduTest::TearDown();
+  }
+
+  // Appends ops at --bench_append_ops_per_sec until 'stop' is set.
+  void AppenderThread(const atomic<bool>* stop) {
+    const MonoTime start = MonoTime::Now();
+    int64_t index = 0;
+    while (!stop->load()) {
+      index++;
+      vector<ReplicateRefPtr> msgs;
+      msgs.push_back(make_scoped_refptr_replicate(CreateDummyReplicate(
+          1, index, clock_->Now(), FLAGS_bench_payload_bytes).release()));
+      CHECK_OK(cache_->AppendOperations(msgs, Bind(&FatalOnError)));
+      last_appended_.store(index);
+
+      // Like the leader's queue, evict what every peer has read, and tell the
+      // cache which ops the lagging peers still need.
+      if (index % 100 == 0) {
+        vector<int64_t> next_indexes;
+        int64_t all_read = index;
+        for (int i = 0; i < mean_lags_.size(); i++) {
+          next_indexes.push_back(peer_next_indexes_[i].load());
+          all_read = std::min(all_read, next_indexes.back() - 1);
+        }
+        cache_->EvictThroughOp(all_read);
+        cache_->SetPeerNextIndexes(std::move(next_indexes));
+      }
+
+      if (FLAGS_bench_append_ops_per_sec > 0) {
+        MonoTime due = start + MonoDelta::FromMicroseconds(
+            index * 1000000 / FLAGS_bench_append_ops_per_sec);
+        MonoTime now = MonoTime::Now();
+        if (due > now) {
+          SleepFor(due - now);
+        }
+      }
+    }
+  }
+
+  // Reads ops as peer 'peer_idx' until 'stop' is set, from an exponentially
+  // distributed number of ops behind the last appended one.
+  void ReaderThread(int peer_idx, const atomic<bool>* stop) {
+    Random rng(GetRandomSeed32());
+    while (!stop->load()) {
+      const int64_t last = last_appended_.load();
+      if (last == 0) {
+        SleepFor(MonoDelta::FromMilliseconds(1));
+        continue;
+      }
+      const double mean_lag = mean_lags_[peer_idx];
+      const int64_t lag = static_cast<int64_t>(
+          -mean_lag * std::log(1 - rng.NextDoubleFraction()));
+      const int64_t after = std::max<int64_t>(0, last - 1 - lag);
+
+      const bool hit = cache_->IsCached(after + 1);
+      vector<ReplicateRefPtr> msgs;
+      OpId preceding;
+      MonoTime start = MonoTime::Now();
+      Status s = cache_->ReadOps(after, FLAGS_bench_read_batch_bytes, ReadContext(),
+                                 &msgs, &preceding);
+      int64_t latency_us = (MonoTime::Now() - start).ToMicroseconds();
+      if (!s.ok()) {
+        // The op may not be in the log index yet.
+        continue;
+      }
+      (hit ? hit_latency_us_ : miss_latency_us_).Increment(latency_us);
+      peer_next_indexes_[peer_idx].store(after + 1 + msgs.size());
+    }
+  }
+
+  void SummarizePerf(CpuTimes elapsed) {
+    const HdrHistogram& hits = hit_latency_us_;
+    const HdrHistogram& misses = miss_latency_us_;
+    const int64_t reads = hits.TotalCount() + misses.TotalCount();
+    const int64_t disk_bytes = METRIC_log_reader_bytes_read.Instantiate(metric_entity_)->value();
+
+    std::ostringstream lock_json;
+    JsonWriter jw(&lock_json, JsonWriter::COMPACT);
+    LockProfile::Get("LogCache::lock_")->WriteAsJson(&jw, 3);
+
+    LOG(INFO) << "Peer mean lags:     " << FLAGS_bench_peer_lags_ops << " ops";
+    LOG(INFO) << "Append rate:        " << FLAGS_bench_append_ops_per_sec << " ops/sec of "
+              << FLAGS_bench_payload_bytes << " bytes";
+    LOG(INFO) << "Cache limits:       " << FLAGS_log_cache_size_limit_mb << "MB, global "
+              << FLAGS_global_log_cache_size_limit_mb << "MB";
+    LOG(INFO) << "----------------------------------";
+    LOG(INFO) << "Ops appended:       " << last_appended_.load();
+    LOG(INFO) << "Reads/sec:          " << reads / elapsed.wall_seconds();
+    LOG(INFO) << "Hit ratio:          "
+              << (reads > 0 ? static_cast<double>(hits.TotalCount()) / reads : 0);
+    LOG(INFO) << "Read from disk:     " << disk_bytes / (1024 * 1024) << "MB";
+    LOG(INFO) << "Hit latency:        p50 " << hits.ValueAtPercentile(50) << "us, p99 "
+              << hits.ValueAtPercentile(99) << "us";
+    LOG(INFO) << "Miss latency:       p50 " << misses.ValueAtPercentile(50) << "us, p99 "
+              << misses.ValueAtPercentile(99) << "us";
+    LOG(INFO) << "Cache lock waits:   " << lock_json.str();
+  }
+
+ protected:
+  scoped_refptr<clock::Clock> clock_;
+  MetricRegistry metric_registry_;
+  scoped_refptr<MetricEntity> metric_entity_;
+  std::unique_ptr<FsManager> fs_manager_;
+  scoped_refptr<log::Log> log_;
+  std::unique_ptr<LogCache> cache_;
+
+  // The latencies of the reads whose first op was cached, and of the others.
+  // HdrHistogram is thread-safe.
+  HdrHistogram hit_latency_us_;
+  HdrHistogram miss_latency_us_;
+
+  vector<int64_t> mean_lags_;
+  std::unique_ptr<atomic<int64_t>[]> peer_next_indexes_;
+  atomic<int64_t> last_appended_;
+};
+
+TEST_F(LogCacheBench, BenchmarkLaggingReaders) {
+  atomic<bool> stop(false);
+  Stopwatch sw(Stopwatch::ALL_THREADS);
+  sw.start();
+  vector<thread> threads;
+  threads.emplace_back(&LogCacheBench::AppenderThread, this, &stop);
+  for (int i = 0; i < mean_lags_.size(); i++) {
+    threads.emplace_back(&LogCacheBench::ReaderThread, this, i, &stop);
+  }
+  SleepFor(MonoDelta::FromSeconds(FLAGS_bench_run_seconds));
+  stop = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  sw.stop();
+
+  ASSERT_GT(last_appended_.load(), 0);
+  SummarizePerf(sw.elapsed());
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <memory>
 #include <ostream>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
@@ -46,6 +47,9 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/jsonwriter.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -56,12 +60,18 @@
 
 using std::atomic;
 using std::shared_ptr;
+using std::string;
 using std::thread;
 using std::vector;
 using strings::Substitute;
 
 DECLARE_int32(log_cache_size_limit_mb);
 DECLARE_int32(global_log_cache_size_limit_mb);
+DECLARE_int32(log_cache_compression_threads);
+DECLARE_int32(log_cache_dump_max_entries);
+DECLARE_int32(log_cache_parallel_compression_min_bytes);
+DECLARE_bool(log_cache_deferred_truncation);
+DECLARE_int32(log_cache_spill_tier_capacity_mb);
 
 //METRIC_DECLARE_entity(tablet);
 
@@ -363,6 +373,31 @@ TEST_F(LogCacheTest, TestReplaceMessages) {
             cache_->ToString());
 }
 
+// Tests that append waiters run once the op they wait for is appended, and
+// not after they are cancelled.
+TEST_F(LogCacheTest, TestAppendWaiters) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 2));
+
+  // Op 2 is already there.
+  int runs = 0;
+  ASSERT_EQ(0, cache_->AddAppendWaiter(1, [&runs]() { runs++; }));
+
+  // Appending op 3 runs the waiter for it, and not the one for op 4.
+  uint64_t waiter_3 = cache_->AddAppendWaiter(2, [&runs]() { runs++; });
+  uint64_t waiter_4 = cache_->AddAppendWaiter(3, [&runs]() { runs += 10; });
+  ASSERT_NE(0, waiter_3);
+  ASSERT_NE(waiter_3, waiter_4);
+  ASSERT_OK(AppendReplicateMessagesToCache(3, 1));
+  ASSERT_EQ(1, runs);
+  ASSERT_FALSE(cache_->CancelAppendWaiter(waiter_3));
+
+  // A cancelled waiter doesn't run.
+  ASSERT_TRUE(cache_->CancelAppendWaiter(waiter_4));
+  ASSERT_OK(AppendReplicateMessagesToCache(4, 1));
+  ASSERT_EQ(1, runs);
+  log_->WaitUntilAllFlushed();
+}
+
 // Test that the cache truncates any future messages when either explicitly
 // truncated or replacing any earlier message.
 TEST_F(LogCacheTest, TestTruncation) {
@@ -403,6 +438,290 @@ TEST_F(LogCacheTest, TestTruncation) {
   }
 }
 
+// Test that a deferred truncation fences the truncated ops off from readers
+// right away, and that they're freed as they're overwritten or dropped.
+TEST_F(LogCacheTest, TestDeferredTruncation) {
+  FLAGS_log_cache_deferred_truncation = true;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 10, 100));
+  cache_->TruncateOpsAfter(3);
+
+  // The truncated ops are still held, but can't be read.
+  ASSERT_EQ(10, cache_->metrics_.log_cache_num_ops->value());
+  OpId op;
+  ASSERT_OK(cache_->LookupOpId(3, &op));
+  Status s = cache_->LookupOpId(4, &op);
+  ASSERT_TRUE(s.IsIncomplete()) << "should be truncated, but got: " << s.ToString();
+  ASSERT_FALSE(cache_->HasOpBeenWritten(4));
+  ASSERT_FALSE(cache_->IsCached(4));
+
+  // Appending in their place overwrites them.
+  ASSERT_OK(AppendReplicateMessagesToCache(4, 2, 100));
+  ASSERT_EQ(10, cache_->metrics_.log_cache_num_ops->value());
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(3, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(2, messages.size());
+  ASSERT_EQ(5, messages.back()->get()->id().index());
+  ASSERT_FALSE(cache_->IsCached(6));
+
+  // The rest are freed by the deferred pass, after which appends go on as
+  // usual.
+  cache_->DropTruncatedOps();
+  ASSERT_EQ(5, cache_->metrics_.log_cache_num_ops->value());
+  ASSERT_OK(AppendReplicateMessagesToCache(6, 2, 100));
+  ASSERT_EQ(7, cache_->metrics_.log_cache_num_ops->value());
+  ASSERT_TRUE(cache_->IsCached(7));
+
+  // Truncating again, and then appending before the pass runs, leaves the
+  // cache as consistent as truncating right away.
+  cache_->TruncateOpsAfter(2);
+  ASSERT_OK(AppendReplicateMessagesToCache(3, 1, 100));
+  cache_->DropTruncatedOps();
+  ASSERT_EQ(3, cache_->metrics_.log_cache_num_ops->value());
+  log_->WaitUntilAllFlushed();
+}
+
+// The dumps of the cache list at most --log_cache_dump_max_entries of the
+// newest ops.
+TEST_F(LogCacheTest, TestDumpMaxEntries) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 10));
+  log_->WaitUntilAllFlushed();
+
+  // Without a limit, the special '0' op is listed first.
+  LogCache::DumpSnapshot snapshot = cache_->GetDumpSnapshot();
+  ASSERT_EQ(11, snapshot.entries.size());
+  ASSERT_EQ(0, snapshot.num_omitted);
+  ASSERT_EQ(0, snapshot.entries.front().index);
+
+  FLAGS_log_cache_dump_max_entries = 3;
+  snapshot = cache_->GetDumpSnapshot();
+  ASSERT_EQ(3, snapshot.entries.size());
+  ASSERT_EQ(7, snapshot.num_omitted);
+  ASSERT_EQ(8, snapshot.entries.front().index);
+  ASSERT_EQ(10, snapshot.entries.back().index);
+
+  std::ostringstream out;
+  JsonWriter jw(&out, JsonWriter::COMPACT);
+  cache_->DumpToJson(&jw);
+  ASSERT_STR_CONTAINS(out.str(), "\"num_ops\":10,");
+  ASSERT_STR_CONTAINS(out.str(), "\"num_omitted\":7,");
+  ASSERT_STR_CONTAINS(out.str(), "{\"term\":1,\"index\":10,");
+}
+
+// Test that with the compressed tier enabled, ops over the memory limit are
+// compressed in place rather than evicted.
+TEST_F(LogCacheTest, TestCompressedTier) {
+  FLAGS_log_cache_size_limit_mb = 1;
+  CloseAndReopenCache(MinimumOpId());
+  ASSERT_OK(cache_->SetCompressionCodec("lz4"));
+  ASSERT_OK(cache_->EnableCompressedTier(true));
+
+  const int kPayloadSize = 400 * 1024;
+  for (int64_t index = 1; index <= 4; index++) {
+    gscoped_ptr<ReplicateMsg> msg = CreateDummyReplicate(0, index, clock_->Now(), 0);
+    msg->clear_noop_request();
+    msg->set_op_type(WRITE_OP_EXT);
+    msg->mutable_write_payload()->set_payload(string(kPayloadSize, 'x'));
+    vector<ReplicateRefPtr> msgs = { make_scoped_refptr_replicate(msg.release()) };
+    ASSERT_OK(cache_->AppendOperations(msgs, Bind(&FatalOnError)));
+    log_->WaitUntilAllFlushed();
+  }
+
+  // Without the compressed tier only two of the ops would fit.
+  ASSERT_EQ(4, cache_->num_cached_ops());
+  ASSERT_LT(cache_->BytesUsed(), 1024 * 1024);
+  ASSERT_GT(cache_->metrics_.log_cache_compressed_tier_size->value(), 0);
+
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(4, messages.size());
+  EXPECT_EQ(LZ4, messages.front()->get()->write_payload().compression_codec());
+  EXPECT_EQ(NO_COMPRESSION, messages.back()->get()->write_payload().compression_codec());
+  messages.clear();
+
+  // Evicting demoted ops releases the memory of the compressed tier.
+  cache_->EvictThroughOp(4);
+  ASSERT_EQ(0, cache_->num_cached_ops());
+  ASSERT_EQ(0, cache_->metrics_.log_cache_compressed_tier_size->value());
+}
+
+// Test that the large payloads of a batch compressed in parallel are cached
+// compressed, in order, alongside the small ones compressed inline.
+TEST_F(LogCacheTest, TestParallelCompression) {
+  FLAGS_log_cache_compression_threads = 4;
+  FLAGS_log_cache_parallel_compression_min_bytes = 64 * 1024;
+  CloseAndReopenCache(MinimumOpId());
+  ASSERT_OK(cache_->SetCompressionCodec("lz4"));
+
+  vector<ReplicateRefPtr> msgs;
+  for (int64_t index = 1; index <= 8; index++) {
+    gscoped_ptr<ReplicateMsg> msg = CreateDummyReplicate(0, index, clock_->Now(), 0);
+    msg->clear_noop_request();
+    msg->set_op_type(WRITE_OP_EXT);
+    // Every other op is too small to be compressed in parallel.
+    const int payload_size = index % 2 ? 128 * 1024 : 1024;
+    msg->mutable_write_payload()->set_payload(string(payload_size, 'a' + index));
+    msgs.emplace_back(make_scoped_refptr_replicate(msg.release()));
+  }
+  ASSERT_OK(cache_->AppendOperations(msgs, Bind(&FatalOnError)));
+  log_->WaitUntilAllFlushed();
+
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(8, messages.size());
+  faststring buffer;
+  for (int i = 0; i < messages.size(); i++) {
+    ASSERT_EQ(i + 1, messages[i]->get()->id().index());
+    ASSERT_EQ(LZ4, messages[i]->get()->write_payload().compression_codec());
+    std::unique_ptr<ReplicateMsg> uncompressed;
+    ASSERT_OK(cache_->UncompressMsg(messages[i], buffer, &uncompressed));
+    ASSERT_EQ(msgs[i]->get()->write_payload().payload(),
+              uncompressed->write_payload().payload());
+  }
+}
+
+// Payloads compressed with a dictionary carry its id, and uncompress with it.
+TEST_F(LogCacheTest, TestCompressionDictionary) {
+  ASSERT_OK(cache_->SetCompressionCodec("lz4"));
+  const string row = "INSERT INTO orders (id, status, customer) VALUES ";
+  string dictionary;
+  for (int i = 0; i < 20; i++) {
+    dictionary += row + Substitute("($0, 'shipped', 'customer-$0');", i);
+  }
+  ASSERT_OK(cache_->SetCompressionDictionary(dictionary));
+
+  gscoped_ptr<ReplicateMsg> msg = CreateDummyReplicate(0, 1, clock_->Now(), 0);
+  msg->clear_noop_request();
+  msg->set_op_type(WRITE_OP_EXT);
+  msg->mutable_write_payload()->set_payload(row + "(4242, 'shipped', 'customer-4242');");
+  faststring buffer;
+  std::unique_ptr<ReplicateMsg> compressed;
+  ASSERT_OK(cache_->CompressMsg(msg.get(), buffer, &compressed));
+  ASSERT_TRUE(compressed->write_payload().has_compression_dictionary_id());
+  ASSERT_LT(compressed->write_payload().payload().size() * 2,
+            msg->write_payload().payload().size());
+
+  // Once the dictionary is no longer used to compress, what was compressed
+  // with it still uncompresses.
+  ASSERT_OK(cache_->SetCompressionDictionary(""));
+  std::unique_ptr<ReplicateMsg> uncompressed;
+  ASSERT_OK(cache_->UncompressMsg(make_scoped_refptr_replicate(compressed.release()),
+                                  buffer, &uncompressed));
+  ASSERT_EQ(msg->write_payload().payload(), uncompressed->write_payload().payload());
+  ASSERT_OK(cache_->CompressMsg(msg.get(), buffer, &compressed));
+  ASSERT_FALSE(compressed->write_payload().has_compression_dictionary_id());
+
+  // A payload compressed with a dictionary this process doesn't know about
+  // can't be uncompressed.
+  compressed->mutable_write_payload()->set_compression_dictionary_id(12345);
+  Status s = cache_->UncompressMsg(make_scoped_refptr_replicate(compressed.release()),
+                                   buffer, &uncompressed);
+  ASSERT_TRUE(s.IsNotFound()) << s.ToString();
+}
+
+// Test that evicting around an op which is still in use leaves a hole in the
+// cache which reads fill in from the log.
+TEST_F(LogCacheTest, TestEvictAroundInUseOp) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 10));
+  log_->WaitUntilAllFlushed();
+
+  // Hold a reference to op 3, so that it can't be evicted.
+  vector<ReplicateRefPtr> in_use;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(2, 1, ReadContext(), &in_use, &preceding));
+  ASSERT_EQ(1, in_use.size());
+  ASSERT_EQ(3, in_use[0]->get()->id().index());
+
+  cache_->EvictThroughOp(6);
+  ASSERT_EQ(5, cache_->num_cached_ops());
+  in_use.clear();
+
+  vector<ReplicateRefPtr> messages;
+  ASSERT_OK(cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(10, messages.size());
+  for (int i = 0; i < messages.size(); i++) {
+    ASSERT_EQ(i + 1, messages[i]->get()->id().index());
+  }
+  messages.clear();
+
+  // Once the ring is empty, appends start it over at the next index.
+  cache_->EvictThroughOp(10);
+  ASSERT_EQ(0, cache_->num_cached_ops());
+  ASSERT_OK(AppendReplicateMessagesToCache(11, 100));
+  log_->WaitUntilAllFlushed();
+  ASSERT_EQ(100, cache_->num_cached_ops());
+  ASSERT_OK(cache_->ReadOps(10, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(100, messages.size());
+  EXPECT_EQ("1.10", OpIdToString(preceding));
+}
+
+// Test that ops read from the log for a lagging peer are inserted back into
+// the cache when another peer still needs them.
+TEST_F(LogCacheTest, TestBackfillFromLog) {
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 10));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(6);
+  ASSERT_EQ(4, cache_->num_cached_ops());
+
+  // Only the reader needs the evicted ops, so they're not cached again.
+  cache_->SetPeerNextIndexes({ 3, 11 });
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(2, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(8, messages.size());
+  ASSERT_EQ(4, cache_->num_cached_ops());
+  messages.clear();
+
+  // Another peer will read from op 5, so ops 5 and 6 are worth caching.
+  cache_->SetPeerNextIndexes({ 3, 5 });
+  ASSERT_OK(cache_->ReadOps(2, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(8, messages.size());
+  ASSERT_EQ(6, cache_->num_cached_ops());
+  messages.clear();
+
+  // The second peer is now served from the cache alone.
+  ASSERT_OK(cache_->ReadOps(4, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(6, messages.size());
+  EXPECT_EQ("0.4", OpIdToString(preceding));
+}
+
+// Test that evicted ops are read back from the spill tier rather than the log,
+// and that truncating the cache stops the spilled ops from being read.
+TEST_F(LogCacheTest, TestSpillTier) {
+  FLAGS_log_cache_spill_tier_capacity_mb = 16;
+  CloseAndReopenCache(MinimumOpId());
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 10));
+  log_->WaitUntilAllFlushed();
+  cache_->EvictThroughOp(6);
+  ASSERT_EQ(4, cache_->num_cached_ops());
+  ASSERT_EQ(6, cache_->metrics_.log_cache_ops_spilled->value());
+
+  const int64_t from_log = cache_->metrics_.log_cache_ops_read_from_log->value();
+  vector<ReplicateRefPtr> messages;
+  OpId preceding;
+  ASSERT_OK(cache_->ReadOps(2, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(8, messages.size());
+  for (int i = 0; i < messages.size(); i++) {
+    ASSERT_EQ(i + 3, messages[i]->get()->id().index());
+  }
+  EXPECT_EQ(4, cache_->metrics_.log_cache_ops_read_from_spill_tier->value());
+  EXPECT_EQ(from_log, cache_->metrics_.log_cache_ops_read_from_log->value());
+  messages.clear();
+
+  // Overwriting the tail invalidates what was spilled, so the evicted ops
+  // are read from the log.
+  vector<ReplicateRefPtr> msgs = { make_scoped_refptr_replicate(
+      CreateDummyReplicate(2, 8, clock_->Now(), 0).release()) };
+  ASSERT_OK(cache_->AppendOperations(msgs, Bind(&FatalOnError)));
+  log_->WaitUntilAllFlushed();
+  ASSERT_OK(cache_->ReadOps(2, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+  ASSERT_EQ(6, messages.size());
+  EXPECT_EQ(4, cache_->metrics_.log_cache_ops_read_from_spill_tier->value());
+  EXPECT_EQ(from_log + 4, cache_->metrics_.log_cache_ops_read_from_log->value());
+}
+
 TEST_F(LogCacheTest, TestMTReadAndWrite) {
   atomic<bool> stop { false };
   vector<thread> threads;
@@ -422,22 +741,25 @@ TEST_F(LogCacheTest, TestMTReadAndWrite) {
         index += kBatch;
       }
     });
-  // Add a reader thread.
-  threads.emplace_back([&] {
-      int64_t index = 0;
-      while (!stop) {
-        vector<ReplicateRefPtr> messages;
-        OpId preceding;
-        CHECK_OK(cache_->ReadOps(
-              index,
-              1024 * 1024,
-              ReadContext(),
-              /*for_peer_uuid=*/boost::none,
-              &messages,
-              &preceding));
-        index += messages.size();
-      }
-    });
+  // Add several reader threads, which share the cache lock with each other.
+  const int kNumReaders = 4;
+  for (int i = 0; i < kNumReaders; i++) {
+    threads.emplace_back([&] {
+        int64_t index = 0;
+        while (!stop) {
+          vector<ReplicateRefPtr> messages;
+          OpId preceding;
+          CHECK_OK(cache_->ReadOps(
+                index,
+                1024 * 1024,
+                ReadContext(),
+                /*for_peer_uuid=*/boost::none,
+                &messages,
+                &preceding));
+          index += messages.size();
+        }
+      });
+  }
 
   SleepFor(MonoDelta::FromSeconds(AllowSlowTests() ? 10 : 2));
 }
@@ -17,7 +17,10 @@
 
 #include "kudu/consensus/log_cache.h"
 
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
 #include <mutex>
 #include <ostream>
 #include <string>
@@ -37,21 +40,25 @@
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
-#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/mathlimits.h"
 #include "kudu/gutil/strings/human_readable.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/cache.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/crc.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/jsonwriter.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/slice.h"
+#include "kudu/util/threadpool.h"
 
 DEFINE_int32(log_cache_size_limit_mb, 128,
              "The total per-tablet size of consensus entries which may be kept in memory. "
@@ -65,6 +72,89 @@ DEFINE_int32(global_log_cache_size_limit_mb, 1024,
              "caching log entries across all tablets is kept under this threshold.");
 TAG_FLAG(global_log_cache_size_limit_mb, advanced);
 
+DEFINE_bool(log_cache_backfill_from_log, true,
+            "Whether ops which the log cache reads from the log for a lagging peer "
+            "are inserted back into the cache when other peers still need them and "
+            "there is spare memory for them.");
+TAG_FLAG(log_cache_backfill_from_log, advanced);
+TAG_FLAG(log_cache_backfill_from_log, runtime);
+
+DEFINE_int32(log_cache_compressed_tier_percent, 50,
+             "When the compressed tier of the log cache is enabled, the percentage of "
+             "'log_cache_size_limit_mb' which may be used by compressed ops. Beyond "
+             "that, the oldest ops are evicted rather than compressed.");
+TAG_FLAG(log_cache_compressed_tier_percent, advanced);
+TAG_FLAG(log_cache_compressed_tier_percent, runtime);
+
+DEFINE_int32(log_cache_compression_threads, 0,
+             "If greater than 1, the number of threads on which the payloads of a "
+             "batch of appended write ops are compressed in parallel, when a "
+             "compression codec is set, so that the WAL, the cache and the peers "
+             "get them compressed sooner. The compressed payloads of a batch "
+             "received from the leader are uncompressed for the WAL on the same "
+             "threads. Read when the replica starts.");
+TAG_FLAG(log_cache_compression_threads, experimental);
+
+DEFINE_int32(log_cache_parallel_compression_min_bytes, 64 * 1024,
+             "The smallest payload that is compressed on the threads of "
+             "--log_cache_compression_threads. Smaller ones are compressed by "
+             "the appending thread, where handing them off would cost more than "
+             "it saves.");
+TAG_FLAG(log_cache_parallel_compression_min_bytes, experimental);
+TAG_FLAG(log_cache_parallel_compression_min_bytes, runtime);
+
+DEFINE_bool(raft_proxy_cut_through, false,
+            "Whether the readers waiting for ops to be appended to the log "
+            "cache, such as the proxy requests forwarding them downstream, are "
+            "woken up as soon as the ops are in the cache rather than once "
+            "they are also queued for the local log, which may have to wait "
+            "for the log to drain. The recipients of the forwarded ops ack "
+            "them once they are durable in their own logs.");
+TAG_FLAG(raft_proxy_cut_through, experimental);
+TAG_FLAG(raft_proxy_cut_through, runtime);
+
+DEFINE_int32(log_cache_dump_max_entries, 0,
+             "The most cached ops the dumps of a log cache, e.g. on the status "
+             "pages, list; the newest ones are listed. 0 lists all of them.");
+TAG_FLAG(log_cache_dump_max_entries, experimental);
+TAG_FLAG(log_cache_dump_max_entries, runtime);
+
+DEFINE_bool(log_cache_deferred_truncation, false,
+            "Whether truncating the log cache only moves back the index of the "
+            "next op to append, which fences off the truncated ops from the "
+            "readers, rather than removing them. The ops then appended in their "
+            "place overwrite them, and the rest are dropped by "
+            "DropTruncatedOps(), off the path which truncated them.");
+TAG_FLAG(log_cache_deferred_truncation, experimental);
+TAG_FLAG(log_cache_deferred_truncation, runtime);
+
+DEFINE_int32(log_cache_spill_tier_capacity_mb, 0,
+             "The capacity of a server-wide second tier of the log caches, which "
+             "the ops evicted from them are copied to rather than dropped, so that "
+             "the peers lagging behind by more than a log cache holds are still "
+             "served without reading the log. 0 disables the tier.");
+TAG_FLAG(log_cache_spill_tier_capacity_mb, experimental);
+
+DEFINE_string(log_cache_spill_tier_type, "DRAM",
+              "The memory which the tier of --log_cache_spill_tier_capacity_mb "
+              "is held in: DRAM, or NVM, which requires a build with NVM support "
+              "and is set up by the --nvm_cache_* flags.");
+TAG_FLAG(log_cache_spill_tier_type, experimental);
+
+static bool ValidateSpillTierType(const char* /*flagname*/, const std::string& value) {
+  if (value == "DRAM") {
+    return true;
+  }
+#if defined(HAVE_LIB_VMEM)
+  if (value == "NVM") {
+    return true;
+  }
+#endif
+  LOG(ERROR) << "Unsupported log cache spill tier type: " << value;
+  return false;
+}
+DEFINE_validator(log_cache_spill_tier_type, &ValidateSpillTierType);
+
 using kudu::pb_util::SecureShortDebugString;
 using std::string;
 using std::vector;
@@ -75,27 +165,199 @@ namespace consensus {
 
 METRIC_DEFINE_gauge_int64(server, log_cache_num_ops, "Log Cache Operation Count",
                           MetricUnit::kOperations,
-                          "Number of operations in the log cache.");
+                          "Number of operations in the log cache.",
+                          kudu::PER_CPU);
 METRIC_DEFINE_gauge_int64(server, log_cache_size, "Log Cache Memory Usage",
                           MetricUnit::kBytes,
-                          "Amount of memory in use for caching the local log.");
+                          "Amount of memory in use for caching the local log.",
+                          kudu::PER_CPU);
 METRIC_DEFINE_gauge_int64(server, log_cache_msg_size, "Log Cache Message Size",
                           MetricUnit::kBytes,
                           "Size of the incoming uncompressed payload for the "
-                          "messages in the log_cache");
+                          "messages in the log_cache",
+                          kudu::PER_CPU);
 METRIC_DEFINE_counter(server, log_cache_compressed_payload_size,
                       "Log Cache Compressed Payload Size",
                        MetricUnit::kBytes,
-                       "Size of the compressed msg payload that is sent over the wire");
+                       "Size of the compressed msg payload that is sent over the wire",
+                      kudu::PER_CPU);
 METRIC_DEFINE_counter(server, log_cache_payload_size,
                       "Log Cache Payload Size",
                        MetricUnit::kBytes,
-                      "Size of the msg payload that is written to the log");
+                      "Size of the msg payload that is written to the log",
+                      kudu::PER_CPU);
+METRIC_DEFINE_gauge_int64(server, log_cache_compressed_tier_size,
+                          "Log Cache Compressed Tier Memory Usage",
+                          MetricUnit::kBytes,
+                          "Amount of memory in use for ops which were compressed "
+                          "in the log cache instead of being evicted.");
+METRIC_DEFINE_counter(server, log_cache_ops_read_from_cache,
+                      "Log Cache Ops Read From Cache",
+                      MetricUnit::kOperations,
+                      "Number of ops read for peers which were found in the log cache.");
+METRIC_DEFINE_counter(server, log_cache_ops_read_from_spill_tier,
+                      "Log Cache Ops Read From Spill Tier",
+                      MetricUnit::kOperations,
+                      "Number of ops read for peers which were found in the spill "
+                      "tier of the log cache.");
+METRIC_DEFINE_counter(server, log_cache_ops_read_from_log,
+                      "Log Cache Ops Read From Log",
+                      MetricUnit::kOperations,
+                      "Number of ops read for peers which had to be read from the log.");
+METRIC_DEFINE_counter(server, log_cache_ops_spilled,
+                      "Log Cache Ops Spilled",
+                      MetricUnit::kOperations,
+                      "Number of ops evicted from the log cache which were copied to "
+                      "its spill tier.");
 
 static const char kParentMemTrackerId[] = "log_cache";
 
 typedef vector<const ReplicateMsg*>::const_iterator MsgIter;
 
+namespace {
+// Calculate the total byte size that will be used on the wire to replicate
+// this message as part of a consensus update request. This accounts for the
+// length delimiting and tagging of the message.
+int64_t TotalByteSizeForMessage(const ReplicateMsg& msg) {
+  int msg_size = google::protobuf::internal::WireFormatLite::LengthDelimitedSize(
+    msg.ByteSize());
+  msg_size += 1; // for the type tag
+  return msg_size;
+}
+
+// Returns the server-wide spill tier, creating it for the first log cache which
+// is created while it's enabled, or nullptr if it's disabled. It lives until
+// the process exits.
+Cache* GetSpillTier() {
+  static simple_spinlock lock;
+  static Cache* spill_tier = nullptr;
+  if (FLAGS_log_cache_spill_tier_capacity_mb <= 0) {
+    return nullptr;
+  }
+  std::lock_guard<simple_spinlock> l(lock);
+  if (!spill_tier) {
+    spill_tier = NewLRUCache(
+        FLAGS_log_cache_spill_tier_type == "NVM" ? NVM_CACHE : DRAM_CACHE,
+        FLAGS_log_cache_spill_tier_capacity_mb * 1024L * 1024L,
+        "log_cache_spill_tier");
+  }
+  return spill_tier;
+}
+
+// The source of the spill generations of the log caches.
+std::atomic<uint64_t> next_spill_generation(1);
+
+// The key of the op with 'index' in the spill tier, under 'generation'.
+struct SpillKey {
+  SpillKey(uint64_t generation, int64_t index) {
+    memcpy(buf, &generation, sizeof(generation));
+    memcpy(buf + sizeof(generation), &index, sizeof(index));
+  }
+  Slice slice() const { return Slice(buf, sizeof(buf)); }
+
+  uint8_t buf[sizeof(uint64_t) + sizeof(int64_t)];
+};
+} // anonymous namespace
+
+// The initial number of slots in a LogCache's entry ring.
+static const int64_t kInitialRingSlots = 64;
+
+LogCache::EntryRing::EntryRing()
+  : slots_(kInitialRingSlots),
+    head_(0),
+    first_index_(0),
+    size_(0) {
+}
+
+LogCache::CacheEntry* LogCache::EntryRing::Find(int64_t index) {
+  if (index < first_index_ || index >= end_index()) {
+    return nullptr;
+  }
+  CacheEntry& entry = SlotFor(index);
+  return entry.msg ? &entry : nullptr;
+}
+
+const LogCache::CacheEntry* LogCache::EntryRing::Find(int64_t index) const {
+  if (index < first_index_ || index >= end_index()) {
+    return nullptr;
+  }
+  const CacheEntry& entry = SlotFor(index);
+  return entry.msg ? &entry : nullptr;
+}
+
+int64_t LogCache::EntryRing::NextCachedIndex(int64_t index) const {
+  // The front slot is never empty, so this only scans over the holes left by
+  // out-of-order eviction.
+  for (int64_t i = std::max(index, first_index_); i < end_index(); i++) {
+    if (SlotFor(i).msg) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void LogCache::EntryRing::PushBack(int64_t index, CacheEntry entry) {
+  DCHECK(entry.msg);
+  if (empty()) {
+    head_ = 0;
+    first_index_ = index;
+  } else {
+    CHECK_EQ(index, end_index());
+  }
+  if (size_ == static_cast<int64_t>(slots_.size())) {
+    Grow();
+  }
+  size_++;
+  SlotFor(index) = std::move(entry);
+}
+
+void LogCache::EntryRing::PushFront(int64_t index, CacheEntry entry) {
+  DCHECK(entry.msg);
+  if (empty()) {
+    PushBack(index, std::move(entry));
+    return;
+  }
+  CHECK_EQ(index, first_index_ - 1);
+  if (size_ == static_cast<int64_t>(slots_.size())) {
+    Grow();
+  }
+  head_ = (head_ - 1) & (slots_.size() - 1);
+  first_index_--;
+  size_++;
+  SlotFor(index) = std::move(entry);
+}
+
+LogCache::CacheEntry LogCache::EntryRing::Replace(int64_t index, CacheEntry entry) {
+  DCHECK(entry.msg);
+  CHECK(index >= first_index_ && index < end_index());
+  CacheEntry old = std::move(SlotFor(index));
+  SlotFor(index) = std::move(entry);
+  return old;
+}
+
+void LogCache::EntryRing::PopBack() {
+  DCHECK(!empty());
+  SlotFor(end_index() - 1).msg = nullptr;
+  size_--;
+}
+
+void LogCache::EntryRing::TrimFront() {
+  while (!empty() && !SlotFor(first_index_).msg) {
+    head_ = (head_ + 1) & (slots_.size() - 1);
+    first_index_++;
+    size_--;
+  }
+}
+
+void LogCache::EntryRing::Grow() {
+  vector<CacheEntry> new_slots(slots_.size() * 2);
+  for (int64_t i = 0; i < size_; i++) {
+    new_slots[i] = std::move(SlotFor(first_index_ + i));
+  }
+  slots_.swap(new_slots);
+  head_ = 0;
+}
+
 LogCache::LogCache(const scoped_refptr<MetricEntity>& metric_entity,
                    scoped_refptr<log::Log> log,
                    string local_uuid,
@@ -103,12 +365,18 @@ LogCache::LogCache(const scoped_refptr<MetricEntity>& metric_entity,
   : log_(std::move(log)),
     local_uuid_(std::move(local_uuid)),
     tablet_id_(std::move(tablet_id)),
-    next_index_cond_(&lock_),
+    lock_("LogCache::lock_"),
+    next_index_cond_(&next_index_lock_),
     next_sequential_op_index_(0),
     min_pinned_op_index_(0),
     metrics_(metric_entity),
     codec_(nullptr),
-    enable_compression_on_cache_miss_(false) {
+    dictionary_(nullptr),
+    enable_compression_on_cache_miss_(false),
+    enable_compressed_tier_(false),
+    demoted_bytes_(0),
+    spill_tier_(GetSpillTier()),
+    spill_generation_(next_spill_generation++) {
 
 
   const int64_t max_ops_size_bytes = FLAGS_log_cache_size_limit_mb * 1024L * 1024L;
@@ -119,27 +387,40 @@ LogCache::LogCache(const scoped_refptr<MetricEntity>& metric_entity,
   parent_tracker_ = MemTracker::FindOrCreateGlobalTracker(global_max_ops_size_bytes,
                                                           kParentMemTrackerId);
 
-  // And create a child tracker with the per-tablet limit.
+  // And create a child tracker with the per-tablet limit. Ops are released one
+  // at a time as they're evicted, so the releases are batched.
   tracker_ = MemTracker::CreateTracker(
       max_ops_size_bytes, Substitute("$0:$1:$2", kParentMemTrackerId,
                                      local_uuid, tablet_id),
-      parent_tracker_);
+      parent_tracker_, MemTracker::Accounting::BATCHED);
 
   // Put a fake message at index 0, since this simplifies a lot of our
   // code paths elsewhere.
   auto zero_op = new ReplicateMsg();
   *zero_op->mutable_id() = MinimumOpId();
-  InsertOrDie(&cache_, 0, { make_scoped_refptr_replicate(zero_op), zero_op->SpaceUsed() });
+  zero_op_.msg = make_scoped_refptr_replicate(zero_op);
+  zero_op_.mem_usage = zero_op->SpaceUsed();
+  zero_op_.msg_size = zero_op_.mem_usage;
+  zero_op_.wire_size = TotalByteSizeForMessage(*zero_op);
+
+  // These are reused for every payload compressed or uncompressed.
+  log_cache_compression_buf_.AllowHugePages();
+  demotion_buf_.AllowHugePages();
+
+  if (FLAGS_log_cache_compression_threads > 1) {
+    CHECK_OK(ThreadPoolBuilder("log-cache-compress")
+             .set_max_threads(FLAGS_log_cache_compression_threads)
+             .Build(&compression_pool_));
+  }
 }
 
 LogCache::~LogCache() {
   tracker_->Release(tracker_->consumption());
-  cache_.clear();
 }
 
 void LogCache::Init(const OpId& preceding_op) {
-  std::lock_guard<Mutex> l(lock_);
-  CHECK_EQ(cache_.size(), 1)
+  std::lock_guard<profiled_rw_spinlock> l(lock_);
+  CHECK(cache_.empty())
     << "Cache should have only our special '0' op";
   next_sequential_op_index_ = preceding_op.index() + 1;
   min_pinned_op_index_ = next_sequential_op_index_;
@@ -150,6 +431,7 @@ Status LogCache::SetCompressionCodec(const std::string& codec) {
     LOG(INFO) << "Disabling compression";
     codec_.store(nullptr);
     enable_compression_on_cache_miss_ = false;
+    enable_compressed_tier_ = false;
     return Status::OK();
   }
 
@@ -168,6 +450,22 @@ Status LogCache::SetCompressionCodec(const std::string& codec) {
   return Status::OK();
 }
 
+Status LogCache::SetCompressionDictionary(const std::string& dictionary) {
+  if (dictionary.empty()) {
+    LOG(INFO) << "Disabling the compression dictionary";
+    dictionary_.store(nullptr);
+    return Status::OK();
+  }
+
+  const CompressionDictionary* dict = nullptr;
+  RETURN_NOT_OK_PREPEND(RegisterCompressionDictionary(dictionary, &dict),
+                        "Failed to register compression dictionary for log-cache");
+  LOG(INFO) << "Updating compression dictionary to id " << dict->id()
+            << " of size " << dictionary.size();
+  dictionary_.store(dict);
+  return Status::OK();
+}
+
 Status LogCache::EnableCompressionOnCacheMiss(bool enable) {
   if (enable && codec_ == nullptr) {
     LOG(INFO) << "Compression codec needs to be set before enabling compression on cache miss";
@@ -180,11 +478,25 @@ Status LogCache::EnableCompressionOnCacheMiss(bool enable) {
   return Status::OK();
 }
 
+Status LogCache::EnableCompressedTier(bool enable) {
+  if (enable && codec_ == nullptr) {
+    LOG(INFO) << "Compression codec needs to be set before enabling the compressed tier";
+    return Status::NotSupported("Compression codec is not set");
+  }
+
+  enable_compressed_tier_ = enable;
+
+  LOG(INFO) << "Compressed tier of the log cache is set to: " << enable;
+  return Status::OK();
+}
+
 void LogCache::TruncateOpsAfter(int64_t index) {
+  vector<ReplicateRefPtr> truncated;
   {
-    std::unique_lock<Mutex> l(lock_);
-    TruncateOpsAfterUnlocked(index);
+    std::lock_guard<profiled_rw_spinlock> l(lock_);
+    TruncateOpsAfterUnlocked(index, &truncated);
   }
+  truncated.clear();
 
   // In the base kuduraft implementation this is a no-op
   // because trimming is handled by resetting the append index.
@@ -201,21 +513,41 @@ void LogCache::TruncateOpsAfter(int64_t index) {
                            log_status.ToString(), index));
 }
 
-void LogCache::TruncateOpsAfterUnlocked(int64_t index) {
+void LogCache::DropTruncatedOps() {
+  vector<ReplicateRefPtr> dropped;
+  {
+    std::lock_guard<profiled_rw_spinlock> l(lock_);
+    DropOpsFromUnlocked(next_sequential_op_index_, &dropped);
+  }
+}
+
+void LogCache::TruncateOpsAfterUnlocked(int64_t index, vector<ReplicateRefPtr>* truncated) {
   int64_t first_to_truncate = index + 1;
   // If the index is not consecutive then it must be lower than or equal
   // to the last index, i.e. we're overwriting.
   CHECK_LE(first_to_truncate, next_sequential_op_index_);
 
-  // Now remove the overwritten operations.
-  for (int64_t i = first_to_truncate; i < next_sequential_op_index_; ++i) {
-    auto it = cache_.find(i);
-    if (it != cache_.end()) {
-      AccountForMessageRemovalUnlocked(it->second);
-      cache_.erase(it);
+  // Readers don't look past 'next_sequential_op_index_', so unless the
+  // truncation is deferred, this only frees the overwritten operations.
+  if (!FLAGS_log_cache_deferred_truncation) {
+    DropOpsFromUnlocked(first_to_truncate, truncated);
+  }
+  next_sequential_op_index_ = first_to_truncate;
+  // The truncated ops which were spilled may be overwritten, so stop reading
+  // any of the spilled ops. The ones before the truncation are spilled again
+  // under the new generation as they're evicted.
+  spill_generation_ = next_spill_generation++;
+}
+
+void LogCache::DropOpsFromUnlocked(int64_t first_to_drop, vector<ReplicateRefPtr>* dropped) {
+  while (!cache_.empty() && cache_.end_index() > first_to_drop) {
+    CacheEntry* entry = cache_.Find(cache_.end_index() - 1);
+    if (entry) {
+      AccountForMessageRemovalUnlocked(*entry);
+      dropped->emplace_back(std::move(entry->msg));
     }
+    cache_.PopBack();
   }
-  next_sequential_op_index_ = index + 1;
 }
 
 Status LogCache::UncompressMsg(const ReplicateRefPtr& msg,
@@ -240,19 +572,24 @@ Status LogCache::UncompressMsg(const ReplicateRefPtr& msg,
   Slice compressed_slice(payload.payload().c_str(), compressed_size);
 
   Status status;
-  const CompressionCodec* codec = codec_.load();
-  if (codec && codec->type() == compression_codec) {
-    status = codec->Uncompress(
-        compressed_slice, buffer.data(), uncompressed_size);
+  const CompressionDictionary* dict = nullptr;
+  if (payload.has_compression_dictionary_id()) {
+    dict = FindCompressionDictionary(payload.compression_dictionary_id());
+    if (!dict) {
+      status = Status::NotFound(Substitute("unknown compression dictionary $0",
+                                           payload.compression_dictionary_id()));
+    }
   }
-  else {
+  const CompressionCodec* codec = codec_.load();
+  if (status.ok() && !(codec && codec->type() == compression_codec)) {
     // Either compression is not enabled on this instance OR this message uses a
     // different compression codec. Get the right codec now
     status = GetCompressionCodec(compression_codec, &codec);
-    if (status.ok()) {
-      status = codec->Uncompress(
-          compressed_slice, buffer.data(), uncompressed_size);
-    }
+  }
+  if (status.ok()) {
+    status = dict ?
+        codec->UncompressWithDictionary(compressed_slice, *dict, buffer.data(), uncompressed_size) :
+        codec->Uncompress(compressed_slice, buffer.data(), uncompressed_size);
   }
 
   // Return early if uncompression failed
@@ -306,8 +643,13 @@ Status LogCache::CompressMsg(const ReplicateMsg* msg,
   // TODO: Needs perf testing and maybe add support for streaming compression
   buffer.resize(codec->MaxCompressedLength(uncompressed_slice.size()));
 
+  // Small payloads compress much better with a dictionary of what they
+  // usually look like.
+  const CompressionDictionary* dict =
+      codec->SupportsDictionaries() ? dictionary_.load() : nullptr;
   size_t compressed_len = 0;
-  auto status =
+  auto status = dict ?
+    codec->CompressWithDictionary(uncompressed_slice, *dict, &buffer[0], &compressed_len) :
     codec->Compress(uncompressed_slice, &buffer[0], &compressed_len);
 
   if (!status.ok()) {
@@ -333,6 +675,9 @@ Status LogCache::CompressMsg(const ReplicateMsg* msg,
   write_payload->set_payload(buffer.ToString());
   write_payload->set_compression_codec(codec->type());
   write_payload->set_uncompressed_size(payload_str.size());
+  if (dict) {
+    write_payload->set_compression_dictionary_id(dict->id());
+  }
 
   compressed_msg->reset(rep_msg.release());
   return Status::OK();
@@ -358,6 +703,87 @@ Status LogCache::CompressMsgs(const vector<ReplicateMsg*>& replicate_ptrs,
   return Status::OK();
 }
 
+void LogCache::CompressLargePayloads(const vector<ReplicateRefPtr>& msgs,
+                                     vector<std::unique_ptr<ReplicateMsg>>* compressed) {
+  if (!compression_pool_ || !codec_.load() || enable_compressed_tier_) {
+    return;
+  }
+  const size_t min_bytes = std::max(FLAGS_log_cache_parallel_compression_min_bytes, 1);
+  vector<size_t> large;
+  for (size_t i = 0; i < msgs.size(); i++) {
+    const ReplicateMsg* msg = msgs[i]->get();
+    if (msg->op_type() == WRITE_OP_EXT &&
+        msg->write_payload().compression_codec() == NO_COMPRESSION &&
+        !msg->write_payload().payload_stripped() &&
+        msg->write_payload().payload().size() >= min_bytes) {
+      large.push_back(i);
+    }
+  }
+  if (large.size() < 2) {
+    return;
+  }
+
+  compressed->resize(msgs.size());
+  // The appending thread compresses the last one itself, with its own buffer.
+  CountDownLatch latch(large.size() - 1);
+  for (size_t j = 0; j + 1 < large.size(); j++) {
+    const size_t i = large[j];
+    auto compress = [this, &msgs, compressed, i, &latch]() {
+      faststring buffer;
+      ignore_result(CompressMsg(msgs[i]->get(), buffer, &(*compressed)[i]));
+      latch.CountDown();
+    };
+    if (PREDICT_FALSE(!compression_pool_->SubmitFunc(compress).ok())) {
+      compress();
+    }
+  }
+  ignore_result(CompressMsg(msgs[large.back()]->get(), log_cache_compression_buf_,
+                            &(*compressed)[large.back()]));
+  latch.Wait();
+}
+
+void LogCache::UncompressLargePayloads(const vector<ReplicateRefPtr>& msgs,
+                                       vector<ReplicateRefPtr>* uncompressed) {
+  if (!compression_pool_) {
+    return;
+  }
+  const size_t min_bytes = std::max(FLAGS_log_cache_parallel_compression_min_bytes, 1);
+  vector<size_t> large;
+  for (size_t i = 0; i < msgs.size(); i++) {
+    const WritePayloadPB& payload = msgs[i]->get()->write_payload();
+    if (payload.compression_codec() != NO_COMPRESSION &&
+        static_cast<size_t>(payload.uncompressed_size()) >= min_bytes) {
+      large.push_back(i);
+    }
+  }
+  if (large.size() < 2) {
+    return;
+  }
+
+  // The appending thread uncompresses the last one itself, with its own buffer.
+  CountDownLatch latch(large.size() - 1);
+  auto uncompress = [this, &msgs, uncompressed](size_t i, faststring* buffer) {
+    std::unique_ptr<ReplicateMsg> uncompressed_msg;
+    // Crash if uncompression failed
+    CHECK_OK_PREPEND(UncompressMsg(msgs[i], *buffer, &uncompressed_msg),
+        Substitute("Uncompess failed when writing to log"));
+    (*uncompressed)[i] = make_scoped_refptr_replicate(uncompressed_msg.release());
+  };
+  for (size_t j = 0; j + 1 < large.size(); j++) {
+    const size_t i = large[j];
+    auto task = [&uncompress, i, &latch]() {
+      faststring buffer;
+      uncompress(i, &buffer);
+      latch.CountDown();
+    };
+    if (PREDICT_FALSE(!compression_pool_->SubmitFunc(task).ok())) {
+      task();
+    }
+  }
+  uncompress(large.back(), &log_cache_compression_buf_);
+  latch.Wait();
+}
+
 Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
                                   const StatusCallback& callback) {
   CHECK_GT(msgs.size(), 0);
@@ -371,8 +797,14 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
   vector<CacheEntry> entries_to_insert;
   entries_to_insert.reserve(msgs.size());
 
+  // Large payloads are compressed up front, in parallel. Each op keeps its
+  // place in the batch, so the order of the log is unchanged.
+  vector<std::unique_ptr<ReplicateMsg>> precompressed;
+  CompressLargePayloads(msgs, &precompressed);
+
   bool found_compressed_msgs = false;
-  for (const auto& msg : msgs) {
+  for (size_t i = 0; i < msgs.size(); i++) {
+    const ReplicateRefPtr& msg = msgs[i];
     CacheEntry e;
     e.mem_usage = 0;
     e.msg_size = msg->get()->SpaceUsedLong();
@@ -396,11 +828,19 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
     // nullptr)
     // (3) This is a 'WRITE_OP_EXT' type (config-change/no-op/rotates are not
     // compressed today - these messages are small and can be left uncompressed)
+    // (4) The compressed tier is disabled. Otherwise the msg is kept
+    // uncompressed while it's hot and compressed when it's demoted.
     const CompressionCodec* codec = codec_.load();
-    if (!is_compressed && codec && op_type == WRITE_OP_EXT) {
+    const bool payload_stripped = msg->get()->write_payload().payload_stripped();
+    if (!is_compressed && codec && op_type == WRITE_OP_EXT && !enable_compressed_tier_ &&
+        !payload_stripped) {
       std::unique_ptr<ReplicateMsg> compressed_msg;
-      auto status =
-        CompressMsg(msg->get(), log_cache_compression_buf_, &compressed_msg);
+      Status status;
+      if (!precompressed.empty() && precompressed[i]) {
+        compressed_msg = std::move(precompressed[i]);
+      } else {
+        status = CompressMsg(msg->get(), log_cache_compression_buf_, &compressed_msg);
+      }
       if (status.ok()) {
         // Successfully compressed this msg. So, use the compressed msg to cache
         e.mem_usage = static_cast<int64_t>(compressed_msg->SpaceUsedLong());
@@ -419,11 +859,15 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
 
     compressed_size += e.msg->get()->write_payload().payload().size();
 
-    // Update the crc32 checksum for the payload
-    uint32_t payload_crc32 = crc::Crc32c(
-        e.msg->get()->write_payload().payload().c_str(),
-        e.msg->get()->write_payload().payload().size());
-    e.msg->get()->mutable_write_payload()->set_crc32(payload_crc32);
+    // Update the crc32 checksum for the payload, unless it was left out for a
+    // witness, which keeps the checksum of the payload it never saw.
+    if (!payload_stripped) {
+      uint32_t payload_crc32 = crc::Crc32c(
+          e.msg->get()->write_payload().payload().c_str(),
+          e.msg->get()->write_payload().payload().size());
+      e.msg->get()->mutable_write_payload()->set_crc32(payload_crc32);
+    }
+    e.wire_size = TotalByteSizeForMessage(*e.msg->get());
 
     total_msg_size += e.msg_size;
     mem_required += e.mem_usage;
@@ -433,11 +877,13 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
   int64_t first_idx_in_batch = msgs.front()->get()->id().index();
   int64_t last_idx_in_batch = msgs.back()->get()->id().index();
 
-  std::unique_lock<Mutex> l(lock_);
+  vector<ReplicateRefPtr> removed;
+  vector<ReplicateRefPtr> to_spill;
+  std::unique_lock<profiled_rw_spinlock> l(lock_);
   // If we're not appending a consecutive op we're likely overwriting and
   // need to replace operations in the cache.
   if (first_idx_in_batch != next_sequential_op_index_) {
-    TruncateOpsAfterUnlocked(first_idx_in_batch - 1);
+    TruncateOpsAfterUnlocked(first_idx_in_batch - 1, &removed);
   }
 
   // Try to consume the memory. If it can't be consumed, we may need to evict.
@@ -453,7 +899,11 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
 
     // TODO: we should also try to evict from other tablets - probably better to
     // evict really old ops from another tablet than evict recent ops from this one.
-    EvictSomeUnlocked(min_pinned_op_index_, need_to_free);
+    need_to_free -= DemoteSomeUnlocked(need_to_free, &removed);
+    if (need_to_free > 0) {
+      EvictSomeUnlocked(min_pinned_op_index_, need_to_free, &removed,
+                        spill_tier_ ? &to_spill : nullptr);
+    }
 
     // Force consuming, so that we don't refuse appending data. We might
     // blow past our limit a little bit (as much as the number of tablets times
@@ -464,16 +914,36 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
     borrowed_memory = parent_tracker_->LimitExceeded();
   }
 
+  // Ops left behind by a deferred truncation are overwritten in place. If
+  // they were all evicted from the front, none of what's left is readable.
+  if (!cache_.empty() && first_idx_in_batch < cache_.first_index()) {
+    DropOpsFromUnlocked(first_idx_in_batch, &removed);
+  }
   for (auto& e : entries_to_insert) {
     auto index = e.msg->get()->id().index();
-    EmplaceOrDie(&cache_, index, std::move(e));
+    if (!cache_.empty() && index < cache_.end_index()) {
+      CacheEntry old = cache_.Replace(index, std::move(e));
+      if (old.msg) {
+        AccountForMessageRemovalUnlocked(old);
+        removed.emplace_back(std::move(old.msg));
+      }
+    } else {
+      cache_.PushBack(index, std::move(e));
+    }
     next_sequential_op_index_ = index + 1;
   }
 
   // We drop the lock during the AsyncAppendReplicates call, since it may block
   // if the queue is full, and the queue might not drain if it's trying to call
   // our callback and blocked on this lock.
+  const uint64_t spill_generation = spill_generation_;
   l.unlock();
+  removed.clear();
+
+  const bool cut_through = FLAGS_raft_proxy_cut_through;
+  if (cut_through) {
+    SignalAppendWaiters();
+  }
 
   metrics_.log_cache_size->IncrementBy(mem_required);
   metrics_.log_cache_msg_size->IncrementBy(total_msg_size);
@@ -498,27 +968,25 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
   } else {
     // The batch contains some compressed msgs. It needs to be uncompressed
     // before appending to the log
-    vector<ReplicateRefPtr> uncompressed_msgs;
-    uncompressed_msgs.reserve(msgs.size());
+    // Large payloads are uncompressed in parallel first; whatever is left
+    // compressed after that is uncompressed here, one op after the other.
+    vector<ReplicateRefPtr> uncompressed_msgs(msgs);
+    UncompressLargePayloads(msgs, &uncompressed_msgs);
 
-    for (const auto& msg : msgs) {
+    for (size_t i = 0; i < msgs.size(); i++) {
       const auto compression_codec =
-        msg->get()->write_payload().compression_codec();
+        uncompressed_msgs[i]->get()->write_payload().compression_codec();
 
-      if (compression_codec == NO_COMPRESSION) {
-        // msg is not compressed, use it to write to the log
-        uncompressed_msgs.push_back(msg);
-      } else {
+      if (compression_codec != NO_COMPRESSION) {
         // msg needs to be uncompressed before writing to the log
         std::unique_ptr<ReplicateMsg> uncompressed_msg;
         auto status = UncompressMsg(
-            msg, log_cache_compression_buf_, &uncompressed_msg);
+            msgs[i], log_cache_compression_buf_, &uncompressed_msg);
 
         // Crash if uncompression failed
         CHECK_OK_PREPEND(status,
             Substitute("Uncompess failed when writing to log"));
-        uncompressed_msgs.push_back(
-            make_scoped_refptr_replicate(uncompressed_msg.release()));
+        uncompressed_msgs[i] = make_scoped_refptr_replicate(uncompressed_msg.release());
       }
     }
 
@@ -530,24 +998,68 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
                               callback));
   }
 
+  // The evicted ops are spilled once the batch is on its way to the log.
+  if (!to_spill.empty()) {
+    SpillOps(spill_generation, &to_spill);
+  }
+
   if (!log_status.ok()) {
     LOG_WITH_PREFIX_UNLOCKED(ERROR) << "Couldn't append to log: " << log_status.ToString();
     tracker_->Release(mem_required);
     return log_status;
   }
 
-  // Now signal any threads that might be waiting for Ops to be appended to the
-  // log
-  next_index_cond_.Broadcast();
+  if (!cut_through) {
+    SignalAppendWaiters();
+  }
   return Status::OK();
 }
 
+void LogCache::SignalAppendWaiters() {
+  // Now signal any threads that might be waiting for Ops to be appended to the
+  // log. This is done under 'next_index_lock_' so that a reader can't miss the
+  // signal between checking the next index and starting to wait.
+  vector<std::function<void()>> ready_waiters;
+  {
+    std::lock_guard<Mutex> next_index_lock(next_index_lock_);
+    next_index_cond_.Broadcast();
+    for (auto it = append_waiters_.begin(); it != append_waiters_.end();) {
+      if (it->second.first + 1 < next_sequential_op_index_) {
+        ready_waiters.emplace_back(std::move(it->second.second));
+        it = append_waiters_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  for (const auto& callback : ready_waiters) {
+    callback();
+  }
+}
+
+uint64_t LogCache::AddAppendWaiter(int64_t after_op_index, std::function<void()> callback) {
+  std::lock_guard<Mutex> l(next_index_lock_);
+  if (after_op_index + 1 < next_sequential_op_index_) {
+    return 0;
+  }
+  uint64_t waiter_id = next_append_waiter_id_++;
+  append_waiters_.emplace(waiter_id, std::make_pair(after_op_index, std::move(callback)));
+  return waiter_id;
+}
+
+bool LogCache::CancelAppendWaiter(uint64_t waiter_id) {
+  std::lock_guard<Mutex> l(next_index_lock_);
+  return append_waiters_.erase(waiter_id) > 0;
+}
+
 void LogCache::LogCallback(int64_t last_idx_in_batch,
                            bool borrowed_memory,
                            const StatusCallback& user_callback,
                            const Status& log_status) {
   if (log_status.ok()) {
-    std::lock_guard<Mutex> l(lock_);
+    vector<ReplicateRefPtr> evicted;
+    vector<ReplicateRefPtr> to_spill;
+    std::unique_lock<profiled_rw_spinlock> l(lock_);
     if (min_pinned_op_index_ <= last_idx_in_batch) {
       VLOG_WITH_PREFIX_UNLOCKED(1) << "Updating pinned index to " << (last_idx_in_batch + 1);
       min_pinned_op_index_ = last_idx_in_batch + 1;
@@ -558,22 +1070,35 @@ void LogCache::LogCallback(int64_t last_idx_in_batch,
     if (borrowed_memory) {
       int64_t spare_capacity = parent_tracker_->SpareCapacity();
       if (spare_capacity < 0) {
-        EvictSomeUnlocked(min_pinned_op_index_, -spare_capacity);
+        int64_t need_to_free = -spare_capacity - DemoteSomeUnlocked(-spare_capacity, &evicted);
+        if (need_to_free > 0) {
+          EvictSomeUnlocked(min_pinned_op_index_, need_to_free, &evicted,
+                            spill_tier_ ? &to_spill : nullptr);
+        }
       }
     }
+    const uint64_t spill_generation = spill_generation_;
+    l.unlock();
+    if (!to_spill.empty()) {
+      SpillOps(spill_generation, &to_spill);
+    }
   }
   user_callback.Run(log_status);
 }
 
 bool LogCache::HasOpBeenWritten(int64_t index) const {
-  std::lock_guard<Mutex> l(lock_);
   return index < next_sequential_op_index_;
 }
 
+bool LogCache::IsCached(int64_t index) const {
+  shared_lock<profiled_rw_spinlock> l(lock_);
+  return FindEntryUnlocked(index) != nullptr;
+}
+
 Status LogCache::LookupOpId(int64_t op_index, OpId* op_id) const {
   // First check the log cache itself.
   {
-    std::lock_guard<Mutex> l(lock_);
+    shared_lock<profiled_rw_spinlock> l(lock_);
 
     // We sometimes try to look up OpIds that have never been written
     // on the local node. In that case, don't try to read the op from
@@ -582,11 +1107,11 @@ Status LogCache::LookupOpId(int64_t op_index, OpId* op_id) const {
     if (op_index >= next_sequential_op_index_) {
       return Status::Incomplete(Substitute("Op with index $0 is ahead of the local log "
                                            "(next sequential op: $1)",
-                                           op_index, next_sequential_op_index_));
+                                           op_index, next_sequential_op_index_.load()));
     }
-    auto iter = cache_.find(op_index);
-    if (iter != cache_.end()) {
-      *op_id = iter->second.msg->get()->id();
+    const CacheEntry* entry = FindEntryUnlocked(op_index);
+    if (entry) {
+      *op_id = entry->msg->get()->id();
       return Status::OK();
     }
   }
@@ -595,18 +1120,6 @@ Status LogCache::LookupOpId(int64_t op_index, OpId* op_id) const {
   return log_->LookupOpId(op_index, op_id);
 }
 
-namespace {
-// Calculate the total byte size that will be used on the wire to replicate
-// this message as part of a consensus update request. This accounts for the
-// length delimiting and tagging of the message.
-int64_t TotalByteSizeForMessage(const ReplicateMsg& msg) {
-  int msg_size = google::protobuf::internal::WireFormatLite::LengthDelimitedSize(
-    msg.ByteSize());
-  msg_size += 1; // for the type tag
-  return msg_size;
-}
-} // anonymous namespace
-
 Status LogCache::BlockingReadOps(int64_t after_op_index,
                                  int max_size_bytes,
                                  const ReadContext& context,
@@ -617,7 +1130,7 @@ Status LogCache::BlockingReadOps(int64_t after_op_index,
     MonoTime::Now() + MonoDelta::FromMilliseconds(max_duration_ms);
 
   {
-    std::lock_guard<Mutex> l(lock_);
+    std::lock_guard<Mutex> l(next_index_lock_);
 
     while ((after_op_index + 1) >= next_sequential_op_index_) {
       (void) next_index_cond_.WaitUntil(deadline);
@@ -631,7 +1144,8 @@ Status LogCache::BlockingReadOps(int64_t after_op_index,
       // in the local log
       return Status::Incomplete(Substitute("Op with index $0 is ahead of the local log "
                                            "(next sequential op: $1)",
-                                           after_op_index, next_sequential_op_index_));
+                                           after_op_index,
+                                           next_sequential_op_index_.load()));
     }
   }
 
@@ -650,149 +1164,388 @@ Status LogCache::ReadOps(int64_t after_op_index,
                          OpId* preceding_op) {
   DCHECK_GE(after_op_index, 0);
 
-  // Try to lookup the first OpId in index
-  auto lookUpStatus = LookupOpId(after_op_index, preceding_op);
-  if (!lookUpStatus.ok()) {
-    // On error return early
-    if (lookUpStatus.IsNotFound()) {
-      // If it is a NotFound() error, then do a dummy call into
-      // ReadReplicatesInRange() to read a single op. This is so that it gets a
-      // chance to update the error manager and report the error to upper layer
-      vector<ReplicateMsg*> raw_replicate_ptrs;
-      log_->ReadReplicatesInRange(
-          after_op_index, after_op_index + 1, max_size_bytes, context,
-          &raw_replicate_ptrs);
-      for (ReplicateMsg* msg : raw_replicate_ptrs) {
-        delete msg;
+  int64_t next_index = after_op_index + 1;
+  int64_t remaining_space = max_size_bytes;
+  int64_t up_to = -1;
+  bool done = false;
+  uint64_t spill_generation = 0;
+  int64_t num_from_spill_tier = 0;
+  int64_t num_from_log = 0;
+
+  // A peer reads forward from the last op it was sent, which in the steady
+  // state is still cached. In that case the preceding op and the cached ops
+  // after it are found in a single acquisition of the lock, each in constant
+  // time from its slot in the ring.
+  bool preceding_cached = false;
+  {
+    shared_lock<profiled_rw_spinlock> l(lock_);
+    const CacheEntry* preceding = after_op_index < next_sequential_op_index_ ?
+        FindEntryUnlocked(after_op_index) : nullptr;
+    if (preceding) {
+      *preceding_op = preceding->msg->get()->id();
+      preceding_cached = true;
+      done = ReadCachedOpsUnlocked(&next_index, &remaining_space, messages, &up_to);
+      spill_generation = spill_generation_;
+    }
+  }
+
+  if (!preceding_cached) {
+    // Try to lookup the first OpId in index
+    auto lookUpStatus = LookupOpId(after_op_index, preceding_op);
+    if (!lookUpStatus.ok()) {
+      // On error return early
+      if (lookUpStatus.IsNotFound()) {
+        // If it is a NotFound() error, then do a dummy call into
+        // ReadReplicatesInRange() to read a single op. This is so that it gets a
+        // chance to update the error manager and report the error to upper layer
+        vector<ReplicateMsg*> raw_replicate_ptrs;
+        log_->ReadReplicatesInRange(
+            after_op_index, after_op_index + 1, max_size_bytes, context,
+            &raw_replicate_ptrs);
+        for (ReplicateMsg* msg : raw_replicate_ptrs) {
+          delete msg;
+        }
       }
+
+      return lookUpStatus;
     }
 
-    return lookUpStatus;
+    shared_lock<profiled_rw_spinlock> l(lock_);
+    done = ReadCachedOpsUnlocked(&next_index, &remaining_space, messages, &up_to);
+    spill_generation = spill_generation_;
   }
 
-  std::unique_lock<Mutex> l(lock_);
-  int64_t next_index = after_op_index + 1;
+  while (!done) {
+    // Ops evicted from the cache may still be in the spill tier, in which
+    // case reading the log is only needed past them.
+    if (spill_tier_) {
+      num_from_spill_tier += ReadSpilledOps(spill_generation, up_to, &next_index,
+                                            &remaining_space, messages);
+      if (remaining_space <= 0 || next_index >= next_sequential_op_index_) {
+        break;
+      }
+      if (next_index > up_to) {
+        shared_lock<profiled_rw_spinlock> l(lock_);
+        done = ReadCachedOpsUnlocked(&next_index, &remaining_space, messages, &up_to);
+        spill_generation = spill_generation_;
+        continue;
+      }
+    }
 
-  // Return as many operations as we can, up to the limit
-  int64_t remaining_space = max_size_bytes;
-  while (remaining_space > 0 && next_index < next_sequential_op_index_) {
-
-    // If the messages the peer needs haven't been loaded into the queue yet,
-    // load them.
-    MessageCache::const_iterator iter = cache_.lower_bound(next_index);
-    if (iter == cache_.end() || iter->first != next_index) {
-      int64_t up_to;
-      if (iter == cache_.end()) {
-        // Read all the way to the current op
-        up_to = next_sequential_op_index_ - 1;
+    // The disk read and the post-processing below happen without holding
+    // 'lock_' so that appenders and other readers aren't held up.
+    vector<ReplicateMsg*> raw_replicate_ptrs;
+    RETURN_NOT_OK_PREPEND(
+      log_->ReadReplicatesInRange(
+        next_index, up_to, remaining_space, context, &raw_replicate_ptrs),
+      Substitute("Failed to read ops $0..$1", next_index, up_to));
+
+    VLOG_WITH_PREFIX_UNLOCKED(2)
+        << "Successfully read " << raw_replicate_ptrs.size() << " ops "
+        << "from disk (" << next_index << ".."
+        << (next_index + raw_replicate_ptrs.size() - 1) << ")";
+    PrepareOpsReadFromLog(context, &raw_replicate_ptrs);
+
+    size_t first_read = messages->size();
+    for (ReplicateMsg* msg : raw_replicate_ptrs) {
+      CHECK_EQ(next_index, msg->id().index());
+
+      remaining_space -= TotalByteSizeForMessage(*msg);
+      if (remaining_space > 0 || messages->empty()) {
+        messages->push_back(make_scoped_refptr_replicate(msg));
+        next_index++;
       } else {
-        // Read up to the next entry that's in the cache
-        up_to = iter->first - 1;
+        delete msg;
       }
+    }
+    num_from_log += messages->size() - first_read;
+    if (!context.route_via_proxy) {
+      MaybeBackfillFromLog(*messages, first_read, after_op_index + 1);
+    }
 
-      l.unlock();
+    if (remaining_space <= 0 || next_index >= next_sequential_op_index_) {
+      break;
+    }
+    shared_lock<profiled_rw_spinlock> l(lock_);
+    done = ReadCachedOpsUnlocked(&next_index, &remaining_space, messages, &up_to);
+    spill_generation = spill_generation_;
+  }
 
-      vector<ReplicateMsg*> raw_replicate_ptrs;
-      RETURN_NOT_OK_PREPEND(
-        log_->ReadReplicatesInRange(
-          next_index, up_to, remaining_space, context, &raw_replicate_ptrs),
-        Substitute("Failed to read ops $0..$1", next_index, up_to));
-
-      VLOG_WITH_PREFIX_UNLOCKED(2)
-          << "Successfully read " << raw_replicate_ptrs.size() << " ops "
-          << "from disk (" << next_index << ".."
-          << (next_index + raw_replicate_ptrs.size() - 1) << ")";
-
-      if (enable_compression_on_cache_miss_ && !context.route_via_proxy) {
-        // Compress messages read from the log if:
-        // (1) the feature is enabled through
-        // enable_compression_on_cache_miss_ flag
-        // (2) the request is not for a proxy host (the payload is discarded for
-        // a proxy request and it is wasteful to compress it here)
-        vector<ReplicateMsg*> compressed_replicate_ptrs;
-        (void) CompressMsgs(raw_replicate_ptrs, &compressed_replicate_ptrs);
-
-        // TODO (vinay): Refactor this to not have to copy pointers again into
-        // original vector
-        raw_replicate_ptrs.clear();
-        raw_replicate_ptrs.reserve(compressed_replicate_ptrs.size());
-        raw_replicate_ptrs.insert(
-            raw_replicate_ptrs.end(),
-            compressed_replicate_ptrs.begin(),
-            compressed_replicate_ptrs.end());
-      }
+  metrics_.log_cache_ops_read_from_cache->IncrementBy(
+      messages->size() - num_from_spill_tier - num_from_log);
+  metrics_.log_cache_ops_read_from_spill_tier->IncrementBy(num_from_spill_tier);
+  metrics_.log_cache_ops_read_from_log->IncrementBy(num_from_log);
+  return Status::OK();
+}
 
-      if (!context.route_via_proxy) {
-        // Compute crc checksums for the payload that was read from the log
-        // Note that this is done _only_ for non-proxy requests because payload
-        // is discarded for proxy requests
-        for (ReplicateMsg* msg : raw_replicate_ptrs) {
-          const std::string& payload = msg->write_payload().payload();
-          uint32_t payload_crc32 = crc::Crc32c(payload.c_str(), payload.size());
-          msg->mutable_write_payload()->set_crc32(payload_crc32);
+Status LogCache::AsyncReadOpsFromLog(int64_t after_op_index,
+                                     int64_t max_size_bytes,
+                                     const ReadContext& context,
+                                     const ReadOpsCallback& callback) {
+  DCHECK_GE(after_op_index, 0);
+  const int64_t up_to = next_sequential_op_index_ - 1;
+  if (after_op_index >= up_to) {
+    return Status::Incomplete(Substitute("Op with index $0 is ahead of the local log "
+                                         "(next sequential op: $1)",
+                                         after_op_index, up_to + 1));
+  }
+  OpId preceding_op;
+  RETURN_NOT_OK(LookupOpId(after_op_index, &preceding_op));
+
+  // 'context' only has to outlive the call, so keep what the callback needs.
+  ReadContext prepare_context;
+  prepare_context.route_via_proxy = context.route_via_proxy;
+  return log_->AsyncReadReplicatesInRange(
+      after_op_index + 1, up_to, max_size_bytes, context,
+      [this, after_op_index, max_size_bytes, prepare_context, preceding_op, callback](
+          const Status& s, vector<ReplicateMsg*>* raw_replicate_ptrs) {
+        vector<ReplicateRefPtr> messages;
+        if (!s.ok()) {
+          for (ReplicateMsg* msg : *raw_replicate_ptrs) {
+            delete msg;
+          }
+          callback(s, preceding_op, &messages);
+          return;
         }
+        PrepareOpsReadFromLog(prepare_context, raw_replicate_ptrs);
+        int64_t next_index = after_op_index + 1;
+        int64_t remaining_space = max_size_bytes;
+        for (ReplicateMsg* msg : *raw_replicate_ptrs) {
+          CHECK_EQ(next_index, msg->id().index());
+          remaining_space -= TotalByteSizeForMessage(*msg);
+          if (remaining_space > 0 || messages.empty()) {
+            messages.push_back(make_scoped_refptr_replicate(msg));
+            next_index++;
+          } else {
+            delete msg;
+          }
+        }
+        callback(s, preceding_op, &messages);
+      });
+}
+
+void LogCache::PrepareOpsReadFromLog(const ReadContext& context,
+                                     vector<ReplicateMsg*>* raw_replicate_ptrs) {
+  if (enable_compression_on_cache_miss_ && !context.route_via_proxy) {
+    // Compress messages read from the log if:
+    // (1) the feature is enabled through
+    // enable_compression_on_cache_miss_ flag
+    // (2) the request is not for a proxy host (the payload is discarded for
+    // a proxy request and it is wasteful to compress it here)
+    vector<ReplicateMsg*> compressed_replicate_ptrs;
+    (void) CompressMsgs(*raw_replicate_ptrs, &compressed_replicate_ptrs);
+    raw_replicate_ptrs->swap(compressed_replicate_ptrs);
+  }
+
+  if (!context.route_via_proxy) {
+    // Compute crc checksums for the payload that was read from the log
+    // Note that this is done _only_ for non-proxy requests because payload
+    // is discarded for proxy requests
+    for (ReplicateMsg* msg : *raw_replicate_ptrs) {
+      if (msg->write_payload().payload_stripped()) {
+        continue;
       }
+      const std::string& payload = msg->write_payload().payload();
+      uint32_t payload_crc32 = crc::Crc32c(payload.c_str(), payload.size());
+      msg->mutable_write_payload()->set_crc32(payload_crc32);
+    }
+  }
+}
 
-      l.lock();
+bool LogCache::ReadCachedOpsUnlocked(int64_t* next_index,
+                                     int64_t* remaining_space,
+                                     vector<ReplicateRefPtr>* messages,
+                                     int64_t* up_to) const {
+  if (*remaining_space <= 0 || *next_index >= next_sequential_op_index_) {
+    return true;
+  }
 
-      for (ReplicateMsg* msg : raw_replicate_ptrs) {
-        CHECK_EQ(next_index, msg->id().index());
+  // Pull contiguous messages from the cache until the size limit is achieved
+  // or we hit an op that isn't cached. Only a shared lock is needed since we
+  // just take references to the cached messages.
+  const CacheEntry* entry;
+  while ((entry = FindEntryUnlocked(*next_index)) != nullptr) {
+    *remaining_space -= entry->wire_size;
+    if (*remaining_space < 0 && !messages->empty()) {
+      return true;
+    }
+    messages->push_back(entry->msg);
+    (*next_index)++;
+  }
 
-        remaining_space -= TotalByteSizeForMessage(*msg);
-        if (remaining_space > 0 || messages->empty()) {
-          messages->push_back(make_scoped_refptr_replicate(msg));
-          next_index++;
-        } else {
-          delete msg;
-        }
-      }
+  if (*remaining_space <= 0 || *next_index >= next_sequential_op_index_) {
+    return true;
+  }
 
-    } else {
-      // Pull contiguous messages from the cache until the size limit is achieved.
-      for (; iter != cache_.end(); ++iter) {
-        const ReplicateRefPtr& msg = iter->second.msg;
-        int64_t index = msg->get()->id().index();
-        if (index != next_index) {
-          continue;
-        }
+  // The messages the peer needs haven't been loaded into the queue yet:
+  // read from disk up to the next entry that's in the cache, or all the
+  // way to the current op.
+  int64_t next_cached = cache_.NextCachedIndex(*next_index);
+  *up_to = next_cached == -1 || next_cached >= next_sequential_op_index_ ?
+      next_sequential_op_index_ - 1 : next_cached - 1;
+  return false;
+}
 
-        remaining_space -= TotalByteSizeForMessage(*msg->get());
-        if (remaining_space < 0 && !messages->empty()) {
-          break;
-        }
 
-        messages->push_back(msg);
-        next_index++;
-      }
+void LogCache::SetPeerNextIndexes(vector<int64_t> next_indexes) {
+  std::sort(next_indexes.begin(), next_indexes.end());
+  std::lock_guard<profiled_rw_spinlock> l(lock_);
+  peer_next_indexes_.swap(next_indexes);
+}
+
+void LogCache::MaybeBackfillFromLog(const vector<ReplicateRefPtr>& messages,
+                                    size_t first_read,
+                                    int64_t reader_next_index) {
+  if (!FLAGS_log_cache_backfill_from_log || first_read == messages.size()) {
+    return;
+  }
+  const int64_t first_read_index = messages[first_read]->get()->id().index();
+  const int64_t last_read_index = messages.back()->get()->id().index();
+
+  // SpaceUsed is relatively expensive, so compute it outside the lock.
+  vector<int64_t> mem_usage;
+  mem_usage.reserve(messages.size() - first_read);
+  for (size_t i = first_read; i < messages.size(); i++) {
+    mem_usage.push_back(messages[i]->get()->SpaceUsedLong());
+  }
+
+  std::lock_guard<profiled_rw_spinlock> l(lock_);
+  // Only a range which is contiguous with the cache can be inserted into it.
+  if (cache_.empty() || last_read_index + 1 != cache_.first_index()) {
+    return;
+  }
+
+  // Find the lowest next index of a peer other than the reader: that peer
+  // will read the ops from there on, while nobody needs the ones before it.
+  // If several peers share the reader's next index, the others count.
+  int64_t from_index = -1;
+  bool skipped_reader = false;
+  for (int64_t next_index : peer_next_indexes_) {
+    if (next_index == reader_next_index && !skipped_reader) {
+      skipped_reader = true;
+      continue;
+    }
+    if (next_index <= last_read_index) {
+      from_index = std::max(next_index, first_read_index);
     }
+    break;
   }
-  return Status::OK();
+  if (from_index == -1) {
+    return;
+  }
+
+  int64_t mem_required = 0;
+  int64_t total_msg_size = 0;
+  for (int64_t index = from_index; index <= last_read_index; index++) {
+    mem_required += mem_usage[index - first_read_index];
+  }
+  // Backfilling is opportunistic, so never evict anything for it.
+  if (!tracker_->TryConsume(mem_required)) {
+    return;
+  }
+
+  for (int64_t index = last_read_index; index >= from_index; index--) {
+    const ReplicateRefPtr& msg = messages[first_read + (index - first_read_index)];
+    CacheEntry e;
+    e.msg = msg;
+    e.mem_usage = mem_usage[index - first_read_index];
+    // The uncompressed size isn't known for ops compressed on a cache miss.
+    e.msg_size = e.mem_usage;
+    e.wire_size = TotalByteSizeForMessage(*msg->get());
+    total_msg_size += e.msg_size;
+    cache_.PushFront(index, std::move(e));
+  }
+  metrics_.log_cache_size->IncrementBy(mem_required);
+  metrics_.log_cache_msg_size->IncrementBy(total_msg_size);
+  metrics_.log_cache_num_ops->IncrementBy(last_read_index - from_index + 1);
+
+  VLOG_WITH_PREFIX_UNLOCKED(2) << "Backfilled ops " << from_index << ".." << last_read_index
+                               << " read from the log into the cache";
+}
+
+void LogCache::SpillOps(uint64_t generation, vector<ReplicateRefPtr>* ops) {
+  DCHECK(spill_tier_);
+  for (const ReplicateRefPtr& op : *ops) {
+    const ReplicateMsg* msg = op->get();
+    const SpillKey key(generation, msg->id().index());
+    const size_t size = msg->ByteSizeLong();
+    Cache::PendingHandle* ph = spill_tier_->Allocate(key.slice(), size);
+    if (!ph) {
+      // The tier can't fit the op, e.g. because it's full of ops being read.
+      continue;
+    }
+    msg->SerializeWithCachedSizesToArray(spill_tier_->MutableValue(ph));
+    spill_tier_->Release(spill_tier_->Insert(ph, nullptr));
+  }
+  metrics_.log_cache_ops_spilled->IncrementBy(ops->size());
+  ops->clear();
 }
 
+int64_t LogCache::ReadSpilledOps(uint64_t generation,
+                                 int64_t up_to,
+                                 int64_t* next_index,
+                                 int64_t* remaining_space,
+                                 vector<ReplicateRefPtr>* messages) {
+  int64_t num_read = 0;
+  while (*next_index <= up_to && *remaining_space > 0) {
+    const SpillKey key(generation, *next_index);
+    Cache::UniqueHandle h(spill_tier_->Lookup(key.slice(), Cache::EXPECT_IN_CACHE),
+                          Cache::HandleDeleter(spill_tier_));
+    if (!h) {
+      break;
+    }
+    Slice value = spill_tier_->Value(h.get());
+    std::unique_ptr<ReplicateMsg> msg(new ReplicateMsg);
+    if (!msg->ParseFromArray(value.data(), value.size())) {
+      LOG_WITH_PREFIX_UNLOCKED(DFATAL) << "Couldn't parse spilled op " << *next_index;
+      break;
+    }
+    DCHECK_EQ(*next_index, msg->id().index());
+    *remaining_space -= TotalByteSizeForMessage(*msg);
+    if (*remaining_space < 0 && !messages->empty()) {
+      break;
+    }
+    messages->push_back(make_scoped_refptr_replicate(msg.release()));
+    (*next_index)++;
+    num_read++;
+  }
+  return num_read;
+}
 
 void LogCache::EvictThroughOp(int64_t index) {
-  std::lock_guard<Mutex> lock(lock_);
-
-  EvictSomeUnlocked(index, MathLimits<int64_t>::kMax);
+  vector<ReplicateRefPtr> evicted;
+  vector<ReplicateRefPtr> to_spill;
+  std::unique_lock<profiled_rw_spinlock> lock(lock_);
+
+  EvictSomeUnlocked(index, MathLimits<int64_t>::kMax, &evicted,
+                    spill_tier_ ? &to_spill : nullptr);
+  const uint64_t spill_generation = spill_generation_;
+  lock.unlock();
+  if (!to_spill.empty()) {
+    SpillOps(spill_generation, &to_spill);
+  }
 }
 
-void LogCache::EvictSomeUnlocked(int64_t stop_after_index, int64_t bytes_to_evict) {
+void LogCache::EvictSomeUnlocked(int64_t stop_after_index, int64_t bytes_to_evict,
+                                 vector<ReplicateRefPtr>* evicted,
+                                 vector<ReplicateRefPtr>* to_spill) {
   VLOG_WITH_PREFIX_UNLOCKED(2) << "Evicting log cache index <= "
                       << stop_after_index
                       << " or " << HumanReadableNumBytes::ToString(bytes_to_evict)
                       << ": before state: " << ToStringUnlocked();
 
   int64_t bytes_evicted = 0;
-  for (auto iter = cache_.begin(); iter != cache_.end();) {
-    const CacheEntry& entry = (*iter).second;
-    const ReplicateRefPtr& msg = entry.msg;
-    VLOG_WITH_PREFIX_UNLOCKED(2) << "considering for eviction: " << msg->get()->id();
-    int64_t msg_index = msg->get()->id().index();
-    if (msg_index == 0) {
-      // Always keep our special '0' op.
-      ++iter;
+  int64_t end_index = cache_.empty() ? 0 : cache_.end_index();
+  for (int64_t msg_index = cache_.empty() ? 0 : cache_.first_index();
+       msg_index < end_index;
+       msg_index++) {
+    CacheEntry* entry = cache_.Find(msg_index);
+    if (!entry) {
+      // Already evicted while an earlier op was in use.
       continue;
     }
+    const ReplicateRefPtr& msg = entry->msg;
+    VLOG_WITH_PREFIX_UNLOCKED(2) << "considering for eviction: " << msg->get()->id();
 
     if (msg_index > stop_after_index || msg_index >= min_pinned_op_index_) {
       break;
@@ -801,35 +1554,120 @@ void LogCache::EvictSomeUnlocked(int64_t stop_after_index, int64_t bytes_to_evic
     if (!msg->HasOneRef()) {
       VLOG_WITH_PREFIX_UNLOCKED(2) << "Evicting cache: cannot remove " << msg->get()->id()
                                    << " because it is in-use by a peer.";
-      ++iter;
       continue;
     }
 
     VLOG_WITH_PREFIX_UNLOCKED(2) << "Evicting cache. Removing: " << msg->get()->id();
-    AccountForMessageRemovalUnlocked(entry);
-    bytes_evicted += entry.mem_usage;
-    cache_.erase(iter++);
+    AccountForMessageRemovalUnlocked(*entry);
+    bytes_evicted += entry->mem_usage;
+    // Ops left behind by a deferred truncation were never appended.
+    if (to_spill && msg_index < next_sequential_op_index_) {
+      to_spill->emplace_back(std::move(entry->msg));
+    } else {
+      evicted->emplace_back(std::move(entry->msg));
+    }
 
     if (bytes_evicted >= bytes_to_evict) {
       break;
     }
   }
+  cache_.TrimFront();
   VLOG_WITH_PREFIX_UNLOCKED(1) << "Evicting log cache: after state: " << ToStringUnlocked();
 }
 
+int64_t LogCache::DemoteSomeUnlocked(int64_t bytes_to_free,
+                                     vector<ReplicateRefPtr>* replaced) {
+  if (!enable_compressed_tier_ || cache_.empty()) {
+    return 0;
+  }
+  const CompressionCodec* codec = codec_.load();
+  if (!codec) {
+    return 0;
+  }
+
+  const int64_t tier_limit = tracker_->limit() * FLAGS_log_cache_compressed_tier_percent / 100;
+  int64_t bytes_freed = 0;
+  for (int64_t msg_index = cache_.first_index();
+       msg_index < cache_.end_index() && msg_index < min_pinned_op_index_ &&
+           msg_index < next_sequential_op_index_;
+       msg_index++) {
+    if (bytes_freed >= bytes_to_free || demoted_bytes_ >= tier_limit) {
+      break;
+    }
+
+    CacheEntry* entry = cache_.Find(msg_index);
+    if (!entry || entry->demoted) {
+      continue;
+    }
+    const ReplicateMsg* msg = entry->msg->get();
+    if (msg->op_type() != WRITE_OP_EXT ||
+        msg->write_payload().compression_codec() != NO_COMPRESSION ||
+        !entry->msg->HasOneRef()) {
+      continue;
+    }
+
+    // Ops which don't compress are still counted in the tier, so that we don't
+    // try to compress them again on every append.
+    entry->demoted = true;
+    std::unique_ptr<ReplicateMsg> compressed_msg;
+    if (!CompressMsg(msg, demotion_buf_, &compressed_msg).ok() ||
+        static_cast<int64_t>(compressed_msg->SpaceUsedLong()) >= entry->mem_usage) {
+      demoted_bytes_ += entry->mem_usage;
+      metrics_.log_cache_compressed_tier_size->IncrementBy(entry->mem_usage);
+      continue;
+    }
+
+    const string& payload = compressed_msg->write_payload().payload();
+    compressed_msg->mutable_write_payload()->set_crc32(
+        crc::Crc32c(payload.c_str(), payload.size()));
+
+    int64_t new_mem_usage = compressed_msg->SpaceUsedLong();
+    int64_t freed = entry->mem_usage - new_mem_usage;
+    VLOG_WITH_PREFIX_UNLOCKED(2) << "Demoting " << msg->id() << " to the compressed tier, "
+                                 << "freeing " << freed << " bytes";
+    entry->wire_size = TotalByteSizeForMessage(*compressed_msg);
+    replaced->emplace_back(std::move(entry->msg));
+    entry->msg = make_scoped_refptr_replicate(compressed_msg.release());
+    entry->mem_usage = new_mem_usage;
+
+    tracker_->Release(freed);
+    metrics_.log_cache_size->DecrementBy(freed);
+    demoted_bytes_ += new_mem_usage;
+    metrics_.log_cache_compressed_tier_size->IncrementBy(new_mem_usage);
+    bytes_freed += freed;
+  }
+  return bytes_freed;
+}
+
 void LogCache::AccountForMessageRemovalUnlocked(const LogCache::CacheEntry& entry) {
+  if (entry.demoted) {
+    demoted_bytes_ -= entry.mem_usage;
+    metrics_.log_cache_compressed_tier_size->DecrementBy(entry.mem_usage);
+  }
   tracker_->Release(entry.mem_usage);
   metrics_.log_cache_size->DecrementBy(entry.mem_usage);
   metrics_.log_cache_msg_size->DecrementBy(entry.msg_size);
   metrics_.log_cache_num_ops->Decrement();
 }
 
+const LogCache::CacheEntry* LogCache::FindEntryUnlocked(int64_t index) const {
+  if (index == 0) {
+    return &zero_op_;
+  }
+  // Ops past the next one to append were truncated, but may not have been
+  // dropped yet.
+  if (index >= next_sequential_op_index_) {
+    return nullptr;
+  }
+  return cache_.Find(index);
+}
+
 int64_t LogCache::BytesUsed() const {
   return tracker_->consumption();
 }
 
 string LogCache::StatsString() const {
-  std::lock_guard<Mutex> lock(lock_);
+  shared_lock<profiled_rw_spinlock> lock(lock_);
   return StatsStringUnlocked();
 }
 
@@ -840,7 +1678,7 @@ string LogCache::StatsStringUnlocked() const {
 }
 
 std::string LogCache::ToString() const {
-  std::lock_guard<Mutex> lock(lock_);
+  shared_lock<profiled_rw_spinlock> lock(lock_);
   return ToStringUnlocked();
 }
 
@@ -864,39 +1702,107 @@ void LogCache::DumpToLog() const {
   }
 }
 
+LogCache::DumpSnapshot LogCache::GetDumpSnapshot() const {
+  const int32_t max_entries = FLAGS_log_cache_dump_max_entries;
+  DumpSnapshot snapshot;
+  snapshot.num_omitted = 0;
+  shared_lock<profiled_rw_spinlock> lock(lock_);
+  snapshot.min_pinned_op_index = min_pinned_op_index_;
+  snapshot.num_ops = metrics_.log_cache_num_ops->value();
+  snapshot.bytes = metrics_.log_cache_size->value();
+  // Start with the special '0' op and then jump to the front of the ring,
+  // or to the oldest op which is listed if not all of them are.
+  int64_t first_index = cache_.empty() ? 1 : cache_.first_index();
+  int64_t end_index = cache_.empty() ? 1 : cache_.end_index();
+  int64_t start_index = 0;
+  if (max_entries > 0 && end_index - first_index > max_entries) {
+    start_index = end_index - max_entries;
+    first_index = start_index;
+  }
+  for (int64_t index = start_index; index < end_index;
+       index = std::max(index + 1, first_index)) {
+    const CacheEntry* entry = FindEntryUnlocked(index);
+    if (!entry) {
+      continue;
+    }
+    const ReplicateMsg* msg = entry->msg->get();
+    snapshot.entries.push_back({ msg->id().term(), msg->id().index(), msg->op_type(),
+                                 entry->msg_size, entry->demoted });
+  }
+  snapshot.num_omitted = std::max<int64_t>(
+      0, snapshot.num_ops - static_cast<int64_t>(snapshot.entries.size()));
+  return snapshot;
+}
+
 void LogCache::DumpToStrings(vector<string>* lines) const {
-  std::lock_guard<Mutex> lock(lock_);
-  int counter = 0;
-  lines->push_back(ToStringUnlocked());
+  DumpSnapshot snapshot = GetDumpSnapshot();
+  lines->push_back(Substitute("Pinned index: $0, LogCacheStats(num_ops=$1, bytes=$2)",
+                              snapshot.min_pinned_op_index, snapshot.num_ops, snapshot.bytes));
   lines->push_back("Messages:");
-  for (const auto& entry : cache_) {
-    const ReplicateMsg* msg = entry.second.msg->get();
+  int counter = 0;
+  for (const EntrySummary& e : snapshot.entries) {
     lines->push_back(
       Substitute("Message[$0] $1.$2 : REPLICATE. Type: $3, Size: $4",
-                 counter++, msg->id().term(), msg->id().index(),
-                 OperationType_Name(msg->op_type()),
-                 msg->ByteSize()));
+                 counter++, e.term, e.index,
+                 OperationType_Name(static_cast<OperationType>(e.op_type)),
+                 e.msg_size));
+  }
+  if (snapshot.num_omitted > 0) {
+    lines->push_back(Substitute("($0 older messages omitted)", snapshot.num_omitted));
   }
 }
 
 void LogCache::DumpToHtml(std::ostream& out) const {
   using std::endl;
 
-  std::lock_guard<Mutex> lock(lock_);
+  DumpSnapshot snapshot = GetDumpSnapshot();
   out << "<h3>Messages:</h3>" << endl;
   out << "<table>" << endl;
   out << "<tr><th>Entry</th><th>OpId</th><th>Type</th><th>Size</th><th>Status</th></tr>" << endl;
 
   int counter = 0;
-  for (const auto& entry : cache_) {
-    const ReplicateMsg* msg = entry.second.msg->get();
+  for (const EntrySummary& e : snapshot.entries) {
     out << Substitute("<tr><th>$0</th><th>$1.$2</th><td>REPLICATE $3</td>"
                       "<td>$4</td><td>$5</td></tr>",
-                      counter++, msg->id().term(), msg->id().index(),
-                      OperationType_Name(msg->op_type()),
-                      msg->ByteSize(), SecureShortDebugString(msg->id())) << endl;
+                      counter++, e.term, e.index,
+                      OperationType_Name(static_cast<OperationType>(e.op_type)),
+                      e.msg_size, e.demoted ? "compressed" : "") << endl;
   }
   out << "</table>";
+  if (snapshot.num_omitted > 0) {
+    out << "<p>" << snapshot.num_omitted << " older messages omitted</p>" << endl;
+  }
+}
+
+void LogCache::DumpToJson(JsonWriter* jw) const {
+  DumpSnapshot snapshot = GetDumpSnapshot();
+  jw->StartObject();
+  jw->String("min_pinned_op_index");
+  jw->Int64(snapshot.min_pinned_op_index);
+  jw->String("num_ops");
+  jw->Int64(snapshot.num_ops);
+  jw->String("bytes");
+  jw->Int64(snapshot.bytes);
+  jw->String("num_omitted");
+  jw->Int64(snapshot.num_omitted);
+  jw->String("messages");
+  jw->StartArray();
+  for (const EntrySummary& e : snapshot.entries) {
+    jw->StartObject();
+    jw->String("term");
+    jw->Int64(e.term);
+    jw->String("index");
+    jw->Int64(e.index);
+    jw->String("type");
+    jw->String(OperationType_Name(static_cast<OperationType>(e.op_type)));
+    jw->String("size");
+    jw->Int64(e.msg_size);
+    jw->String("compressed");
+    jw->Bool(e.demoted);
+    jw->EndObject();
+  }
+  jw->EndArray();
+  jw->EndObject();
 }
 
 #define INSTANTIATE_METRIC(x) \
@@ -904,11 +1810,20 @@ void LogCache::DumpToHtml(std::ostream& out) const {
 LogCache::Metrics::Metrics(const scoped_refptr<MetricEntity>& metric_entity)
   : log_cache_num_ops(INSTANTIATE_METRIC(METRIC_log_cache_num_ops)),
     log_cache_size(INSTANTIATE_METRIC(METRIC_log_cache_size)),
-    log_cache_msg_size(INSTANTIATE_METRIC(METRIC_log_cache_msg_size)) {
+    log_cache_msg_size(INSTANTIATE_METRIC(METRIC_log_cache_msg_size)),
+    log_cache_compressed_tier_size(INSTANTIATE_METRIC(METRIC_log_cache_compressed_tier_size)) {
     log_cache_payload_size =
       metric_entity->FindOrCreateCounter(&METRIC_log_cache_payload_size);
     log_cache_compressed_payload_size =
       metric_entity->FindOrCreateCounter(&METRIC_log_cache_compressed_payload_size);
+    log_cache_ops_read_from_cache =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_ops_read_from_cache);
+    log_cache_ops_read_from_spill_tier =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_ops_read_from_spill_tier);
+    log_cache_ops_read_from_log =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_ops_read_from_log);
+    log_cache_ops_spilled =
+      metric_entity->FindOrCreateCounter(&METRIC_log_cache_ops_spilled);
 }
 #undef INSTANTIATE_METRIC
 
@@ -17,7 +17,9 @@
 #ifndef KUDU_CONSENSUS_LOG_CACHE_H
 #define KUDU_CONSENSUS_LOG_CACHE_H
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include <map>
 #include <memory>
@@ -28,10 +30,13 @@
 #include <gtest/gtest_prod.h>
 
 #include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/condition_variable.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/lock_profile.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/status.h"
@@ -39,8 +44,12 @@
 
 namespace kudu {
 
+class Cache;
 class CompressionCodec;
+class CompressionDictionary;
+class JsonWriter;
 class MemTracker;
+class ThreadPool;
 
 namespace log {
 class Log;
@@ -111,6 +120,38 @@ class LogCache {
                          std::vector<ReplicateRefPtr>* messages,
                          OpId* preceding_op);
 
+  // Run with the result of AsyncReadOpsFromLog(): 'preceding_op' is the id
+  // of the op at the requested 'after_op_index'.
+  typedef std::function<void(const Status& s,
+                             const OpId& preceding_op,
+                             std::vector<ReplicateRefPtr>* messages)> ReadOpsCallback;
+
+  // Reads the ops after 'after_op_index' straight from the log, bypassing the
+  // cache, up to 'max_size_bytes' but at least one, in a single
+  // Log::AsyncReadReplicatesInRange() call. A derived log can then serve a
+  // large contiguous range from its own IO threads. 'callback' may run on
+  // the log's threads, or before this returns.
+  //
+  // Returns a bad status, without running 'callback', if the read couldn't
+  // be started, e.g. "Incomplete" if the op after 'after_op_index' hasn't
+  // been appended or "NotFound" if it has been GCed.
+  Status AsyncReadOpsFromLog(int64_t after_op_index,
+                             int64_t max_size_bytes,
+                             const ReadContext& context,
+                             const ReadOpsCallback& callback);
+
+  // Registers 'callback' to be run once the op after 'after_op_index' has
+  // been appended, the non-blocking counterpart of BlockingReadOps(). The
+  // callback runs on the thread appending the op, so it must not block.
+  //
+  // Returns 0 without registering the callback if the op has already been
+  // appended, or else an id to pass to CancelAppendWaiter().
+  uint64_t AddAppendWaiter(int64_t after_op_index, std::function<void()> callback);
+
+  // Unregisters the callback which AddAppendWaiter() returned 'waiter_id'
+  // for. Returns false if it has already run, or is about to.
+  bool CancelAppendWaiter(uint64_t waiter_id);
+
   // Append the operations into the log and the cache.
   // When the messages have completed writing into the on-disk log, fires 'callback'.
   //
@@ -128,13 +169,25 @@ class LogCache {
   //
   // NOTE: unless a new operation is appended followig 'index', this truncation does
   // not persist across server restarts.
+  //
+  // With --log_cache_deferred_truncation, the truncated operations are only
+  // fenced off, which takes constant time, and are left for the operations
+  // appended in their place to overwrite, or for DropTruncatedOps() to free.
   void TruncateOpsAfter(int64_t index);
 
+  // Frees the operations fenced off by a deferred truncation which haven't
+  // been overwritten since.
+  void DropTruncatedOps();
+
   // Return true if an operation with the given index has been written through
   // the cache. The operation may not necessarily be durable yet -- it could still be
   // en route to the log.
   bool HasOpBeenWritten(int64_t index) const;
 
+  // Return true if the operation with the given index is in the cache, so
+  // that reading it doesn't go to disk.
+  bool IsCached(int64_t index) const;
+
   // Evict any operations with op index <= 'index'.
   void EvictThroughOp(int64_t index);
 
@@ -153,6 +206,33 @@ class LogCache {
 
   void DumpToHtml(std::ostream& out) const;
 
+  // Writes the contents of the cache as a JSON object.
+  void DumpToJson(JsonWriter* jw) const;
+
+  // A compact copy of a cached op, for the dumps of the cache.
+  struct EntrySummary {
+    int64_t term;
+    int64_t index;
+    // An OperationType.
+    int32_t op_type;
+    int64_t msg_size;
+    bool demoted;
+  };
+
+  // What the dumps of the cache show, copied under a brief hold of the lock
+  // so that they are rendered without it.
+  struct DumpSnapshot {
+    int64_t min_pinned_op_index;
+    int64_t num_ops;
+    int64_t bytes;
+    // The newest cached ops, oldest first, at most
+    // --log_cache_dump_max_entries of them.
+    std::vector<EntrySummary> entries;
+    // The number of cached ops left out of 'entries'.
+    int64_t num_omitted;
+  };
+  DumpSnapshot GetDumpSnapshot() const;
+
   std::string StatsString() const;
 
   std::string ToString() const;
@@ -172,10 +252,36 @@ class LogCache {
   // Enable (or disable) compression of messages read from log
   Status EnableCompressionOnCacheMiss(bool enable);
 
+  // Sets the dictionary to compress write payloads with, when the codec set
+  // by SetCompressionCodec() supports dictionaries, and registers it so that
+  // payloads compressed with it can be uncompressed. An empty dictionary
+  // stops compressing with one, though payloads compressed with a dictionary
+  // that was registered can still be uncompressed.
+  Status SetCompressionDictionary(const std::string& dictionary);
+
+  // Sets the next indexes of the peers being replicated to, excluding the
+  // local peer. When ReadOps() has to read a range of ops from the log which
+  // ends just before the oldest cached op, it inserts the part of that range
+  // which another peer will still need back into the cache, if there's spare
+  // memory for it, so that the log is read only once for all lagging peers.
+  void SetPeerNextIndexes(std::vector<int64_t> next_indexes);
+
+  // Enable (or disable) the compressed tier of the cache. When enabled, write
+  // ops are cached uncompressed when appended, and are compressed in place
+  // using the codec set by SetCompressionCodec() when the cache is over its
+  // memory limit, rather than being evicted. Up to
+  // --log_cache_compressed_tier_percent of the limit may be used by compressed
+  // ops before the oldest of them are evicted.
+  Status EnableCompressedTier(bool enable);
+
  private:
   FRIEND_TEST(LogCacheTest, TestAppendAndGetMessages);
+  FRIEND_TEST(LogCacheTest, TestCompressedTier);
+  FRIEND_TEST(LogCacheTest, TestCompressionDictionary);
   FRIEND_TEST(LogCacheTest, TestGlobalMemoryLimit);
+  FRIEND_TEST(LogCacheTest, TestParallelCompression);
   FRIEND_TEST(LogCacheTest, TestReplaceMessages);
+  FRIEND_TEST(LogCacheTest, TestSpillTier);
   FRIEND_TEST(LogCacheTest, TestTruncation);
   friend class LogCacheTest;
 
@@ -186,6 +292,23 @@ class LogCache {
                      faststring& buffer,
                      std::unique_ptr<ReplicateMsg>* compressed_msg);
 
+  // With --log_cache_compression_threads, compresses the payloads of the
+  // write ops of 'msgs' of at least --log_cache_parallel_compression_min_bytes
+  // on 'compression_pool_', in parallel, filling the matching entries of
+  // 'compressed'. Leaves 'compressed' empty if fewer than two ops qualify,
+  // and an entry null if its op wasn't compressed.
+  void CompressLargePayloads(const std::vector<ReplicateRefPtr>& msgs,
+                             std::vector<std::unique_ptr<ReplicateMsg>>* compressed);
+
+  // The converse of CompressLargePayloads() for the log: with
+  // --log_cache_compression_threads, uncompresses the compressed payloads of
+  // 'msgs' of at least --log_cache_parallel_compression_min_bytes on
+  // 'compression_pool_', in parallel, replacing the matching entries of
+  // 'uncompressed', which starts out as a copy of 'msgs'. Does nothing if
+  // fewer than two ops qualify; the caller uncompresses whatever is left.
+  void UncompressLargePayloads(const std::vector<ReplicateRefPtr>& msgs,
+                               std::vector<ReplicateRefPtr>* uncompressed);
+
   // Compress all messages in 'replicate_ptrs' and return the compressed
   // messages in 'compressed_replicate_ptrs'. If any message is uncompressable,
   // then it inserts the original msg into 'compressed_replicate_ptrs'
@@ -210,18 +333,160 @@ class LogCache {
     // The uncompressed size of the msg. If msg is not compressed, then it is
     // same as mem_usage
     int64_t msg_size;
+    // The number of bytes 'msg' takes up in a consensus update request,
+    // computed once upon insertion so that ReadOps() needn't re-serialize it.
+    int64_t wire_size;
+    // Whether the entry was moved to the compressed tier by
+    // DemoteSomeUnlocked().
+    bool demoted = false;
+  };
+
+  // A contiguous ring of cache entries addressed by log index: the slot at
+  // offset i from the head holds the op with index 'first_index() + i'.
+  // Since appends are sequential and eviction proceeds from the front, this
+  // keeps consecutive ops adjacent in memory and makes range reads a linear
+  // scan. Slots of ops which were evicted out of order (because an older op
+  // was still in use) are left empty, but the front slot is never empty.
+  class EntryRing {
+   public:
+    EntryRing();
+
+    bool empty() const { return size_ == 0; }
+
+    // The index of the op in the front slot. Only valid if !empty().
+    int64_t first_index() const { return first_index_; }
+
+    // One past the index of the op in the back slot. Only valid if !empty().
+    int64_t end_index() const { return first_index_ + size_; }
+
+    // Returns the entry for 'index', or nullptr if that op isn't cached.
+    CacheEntry* Find(int64_t index);
+    const CacheEntry* Find(int64_t index) const;
+
+    // Returns the lowest index >= 'index' whose op is cached, or -1 if there
+    // is none.
+    int64_t NextCachedIndex(int64_t index) const;
+
+    // Appends 'entry' as the op with 'index', which must be end_index()
+    // unless the ring is empty.
+    void PushBack(int64_t index, CacheEntry entry);
+
+    // Prepends 'entry' as the op with 'index', which must be first_index() - 1
+    // unless the ring is empty.
+    void PushFront(int64_t index, CacheEntry entry);
+
+    // Replaces the entry in the slot for 'index', which must be in
+    // [first_index(), end_index()), returning the previous one, which may be
+    // empty.
+    CacheEntry Replace(int64_t index, CacheEntry entry);
+
+    // Removes the back slot, which must exist.
+    void PopBack();
+
+    // Drops any empty slots from the front, after the entries there have
+    // been moved out.
+    void TrimFront();
+
+   private:
+    CacheEntry& SlotFor(int64_t index) {
+      return slots_[(head_ + (index - first_index_)) & (slots_.size() - 1)];
+    }
+    const CacheEntry& SlotFor(int64_t index) const {
+      return slots_[(head_ + (index - first_index_)) & (slots_.size() - 1)];
+    }
+
+    // Doubles the capacity of the ring, moving the entries so that the front
+    // slot is at position 0.
+    void Grow();
+
+    // The slots of the ring. The size is always a power of two.
+    std::vector<CacheEntry> slots_;
+    // The position in 'slots_' of the front slot.
+    int64_t head_;
+    // The index of the op in the front slot.
+    int64_t first_index_;
+    // The number of slots in use, including empty ones.
+    int64_t size_;
+
+    DISALLOW_COPY_AND_ASSIGN(EntryRing);
   };
 
   // Try to evict the oldest operations from the queue, stopping either when
   // 'bytes_to_evict' bytes have been evicted, or the op with index
   // 'stop_after_index' has been evicted, whichever comes first.
-  void EvictSomeUnlocked(int64_t stop_after_index, int64_t bytes_to_evict);
+  //
+  // The evicted messages are moved to 'evicted', so that the caller can free
+  // them after releasing 'lock_'. If 'to_spill' is set, the evicted messages
+  // of ops which were appended are moved there instead, for the caller to
+  // pass to SpillOps() after releasing 'lock_'.
+  void EvictSomeUnlocked(int64_t stop_after_index, int64_t bytes_to_evict,
+                         std::vector<ReplicateRefPtr>* evicted,
+                         std::vector<ReplicateRefPtr>* to_spill = nullptr);
+
+  // Copies the evicted ops in 'ops' to the spill tier, under 'generation',
+  // and clears 'ops'. Called without holding 'lock_'.
+  void SpillOps(uint64_t generation, std::vector<ReplicateRefPtr>* ops);
+
+  // Like ReadCachedOpsUnlocked(), appends the ops starting at '*next_index',
+  // up to 'up_to', which are in the spill tier under 'generation' to
+  // 'messages', stopping at the first one which isn't. Called without holding
+  // 'lock_'.
+  //
+  // Returns the number of ops read.
+  int64_t ReadSpilledOps(uint64_t generation,
+                         int64_t up_to,
+                         int64_t* next_index,
+                         int64_t* remaining_space,
+                         std::vector<ReplicateRefPtr>* messages);
+
+  // If the compressed tier is enabled, try to free 'bytes_to_free' bytes by
+  // compressing the oldest uncompressed write ops in place, as long as the
+  // compressed tier is under its share of the memory limit. The uncompressed
+  // messages which were replaced are moved to 'replaced'.
+  //
+  // Returns the number of bytes freed.
+  int64_t DemoteSomeUnlocked(int64_t bytes_to_free,
+                             std::vector<ReplicateRefPtr>* replaced);
+
+  // Appends the cached ops starting at '*next_index' to 'messages' while they
+  // fit in '*remaining_space' (though always at least one), advancing both.
+  // Returns true if the read is complete, because the size limit or the end
+  // of the log was reached. Otherwise, sets '*up_to' to the last index of the
+  // uncached range that must be read from the log next.
+  //
+  // Requires that 'lock_' is held, at least shared.
+  bool ReadCachedOpsUnlocked(int64_t* next_index,
+                             int64_t* remaining_space,
+                             std::vector<ReplicateRefPtr>* messages,
+                             int64_t* up_to) const;
+
+  // Compresses and checksums the ops just read from the log, as set up for
+  // 'context', replacing the messages in 'raw_replicate_ptrs' as needed.
+  void PrepareOpsReadFromLog(const ReadContext& context,
+                             std::vector<ReplicateMsg*>* raw_replicate_ptrs);
+
+  // The part of ReadOps() which caches ops read from the log, as described
+  // in SetPeerNextIndexes(). 'messages' are the ops read for the peer whose
+  // next index is 'reader_next_index', of which those starting at 'first_read'
+  // came from the log.
+  void MaybeBackfillFromLog(const std::vector<ReplicateRefPtr>& messages,
+                            size_t first_read,
+                            int64_t reader_next_index);
+
+  // Returns the cached entry for the op with 'index', or nullptr if it isn't
+  // cached.
+  const CacheEntry* FindEntryUnlocked(int64_t index) const;
 
   // Update metrics and MemTracker to account for the removal of the
   // given message.
   void AccountForMessageRemovalUnlocked(const CacheEntry& entry);
 
-  void TruncateOpsAfterUnlocked(int64_t index);
+  // Like EvictSomeUnlocked(), moves the truncated messages to 'truncated'.
+  void TruncateOpsAfterUnlocked(int64_t index, std::vector<ReplicateRefPtr>* truncated);
+
+  // Removes the cached ops with index >= 'first_to_drop', moving their messages
+  // to 'dropped'.
+  void DropOpsFromUnlocked(int64_t first_to_drop, std::vector<ReplicateRefPtr>* dropped);
 
   // Return a string with stats
   std::string StatsStringUnlocked() const;
@@ -230,6 +495,10 @@ class LogCache {
 
   std::string LogPrefixUnlocked() const;
 
+  // Wakes up BlockingReadOps() and runs the append waiters whose ops have
+  // been appended.
+  void SignalAppendWaiters();
+
   void LogCallback(int64_t last_idx_in_batch,
                    bool borrowed_memory,
                    const StatusCallback& user_callback,
@@ -243,17 +512,38 @@ class LogCache {
   // The id of the tablet.
   const std::string tablet_id_;
 
-  mutable Mutex  lock_;
+  // Protects 'cache_' and 'min_pinned_op_index_'. Readers of the cache take
+  // it shared, while appends, truncation and eviction take it exclusively.
+  // Messages removed from the cache are freed only after it is released, so
+  // that readers never wait on the deallocation of evicted ops.
+  mutable profiled_rw_spinlock lock_;
+
+  // Signalled when 'next_sequential_op_index_' advances, for BlockingReadOps().
+  mutable Mutex next_index_lock_;
   ConditionVariable next_index_cond_;
 
-  // An ordered map that serves as the buffer for the cached messages.
-  // Maps from log index -> ReplicateMsg
-  typedef std::map<uint64_t, CacheEntry> MessageCache;
-  MessageCache cache_;
+  // The callbacks registered by AddAppendWaiter(), keyed by id, with the
+  // index of the op after which each waits. Protected by 'next_index_lock_'.
+  std::map<uint64_t, std::pair<int64_t, std::function<void()>>> append_waiters_;
+  uint64_t next_append_waiter_id_ = 1;
+
+  // The special '0' op, which is never evicted. It is kept out of 'cache_'
+  // since the cached indexes are otherwise dense.
+  CacheEntry zero_op_;
+
+  // The buffer for the cached messages, addressed by log index.
+  EntryRing cache_;
+
+  // The sorted next indexes of the remote peers, as set by
+  // SetPeerNextIndexes(). Protected by 'lock_'.
+  std::vector<int64_t> peer_next_indexes_;
 
   // The next log index to append. Each append operation must either
   // start with this log index, or go backward (but never skip forward).
-  int64_t next_sequential_op_index_;
+  // Written with 'lock_' held exclusively, but may be read without it.
+  // With --log_cache_deferred_truncation, 'cache_' may still hold truncated
+  // ops at and past it, which are never read.
+  std::atomic<int64_t> next_sequential_op_index_;
 
   // Any operation with an index >= min_pinned_op_ may not be
   // evicted from the cache. This is used to prevent ops from being evicted
@@ -293,12 +583,27 @@ class LogCache {
     // Payload size of the compressed msg payload that is sent over the wire
     // If compression is disabled, it is the same as log_cache_payload_size
     scoped_refptr<Counter> log_cache_compressed_payload_size;
+
+    // Keeps track of the memory consumed by ops in the compressed tier.
+    scoped_refptr<AtomicGauge<int64_t> > log_cache_compressed_tier_size;
+
+    // The ops read by ReadOps(), by the tier they were found in.
+    scoped_refptr<Counter> log_cache_ops_read_from_cache;
+    scoped_refptr<Counter> log_cache_ops_read_from_spill_tier;
+    scoped_refptr<Counter> log_cache_ops_read_from_log;
+
+    // The evicted ops which were copied to the spill tier.
+    scoped_refptr<Counter> log_cache_ops_spilled;
   };
   Metrics metrics_;
 
   // Compression codec to use
   std::atomic<const CompressionCodec*> codec_;
 
+  // Compression dictionary to use, if the codec supports dictionaries.
+  // Registered dictionaries live until the process exits.
+  std::atomic<const CompressionDictionary*> dictionary_;
+
   // Temporary buffer to use for compression. This is used during append
   // operation to compress and/or uncompress payloads. Note that the same buffer
   // gets reused multiple times - this assumens that AppendOperation is
@@ -308,6 +613,30 @@ class LogCache {
 
   std::atomic<bool> enable_compression_on_cache_miss_;
 
+  std::atomic<bool> enable_compressed_tier_;
+
+  // The memory used by the entries in the compressed tier. Protected by
+  // 'lock_'.
+  int64_t demoted_bytes_;
+
+  // Temporary buffer for compressing demoted ops. Protected by 'lock_'.
+  faststring demotion_buf_;
+
+  // The server-wide tier which evicted ops are copied to, if
+  // --log_cache_spill_tier_capacity_mb is set, or nullptr.
+  Cache* const spill_tier_;
+
+  // Tells this cache's ops in 'spill_tier_' apart from those of other caches
+  // and from those it spilled before a truncation, which may have been
+  // overwritten since. Unique across the caches of the server. Protected by
+  // 'lock_'.
+  uint64_t spill_generation_;
+
+  // Compresses the large payloads of appended ops in parallel, if
+  // --log_cache_compression_threads is greater than 1. Declared last so that
+  // it's shut down first.
+  gscoped_ptr<ThreadPool> compression_pool_;
+
   DISALLOW_COPY_AND_ASSIGN(LogCache);
 };
 
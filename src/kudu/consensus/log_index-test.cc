@@ -15,9 +15,14 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <atomic>
 #include <cstdint>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include <gflags/gflags_declare.h>
+#include <glog/logging.h>
 #include <gtest/gtest.h>
 
 #include "kudu/consensus/log_index.h"
@@ -25,15 +30,28 @@
 #include "kudu/consensus/opid_util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/env.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_bool(log_index_lazy_chunk_open);
+DECLARE_int32(log_index_startup_open_threads);
+
+METRIC_DECLARE_entity(server);
+METRIC_DECLARE_counter(log_index_chunk_mmap_for_read);
+
 namespace kudu {
 namespace log {
 
 using consensus::MakeOpId;
 using consensus::OpId;
+using std::atomic;
+using std::thread;
+using std::vector;
 
 class LogIndexTest : public KuduTest {
  public:
@@ -117,5 +135,103 @@ TEST_F(LogIndexTest, TestMultiSegmentWithGC) {
   VerifyNotFound(2500000);
 }
 
+// Tests that only the latest chunks are opened at startup, that the others are
+// opened when they're first read, and that the least recently used chunk is
+// the one unmapped for another.
+TEST_F(LogIndexTest, TestLazyChunkOpen) {
+  FLAGS_log_index_lazy_chunk_open = true;
+  FLAGS_log_index_startup_open_threads = 2;
+  index_->SetNumEntriesPerChunkForTest(10);
+  for (int64_t index = 1; index < 50; index++) {
+    ASSERT_OK(AddEntry(MakeOpId(1, index), 1, index * 100));
+  }
+
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity = METRIC_ENTITY_server.Instantiate(&registry, "test");
+  index_ = new LogIndex(test_dir_);
+  index_->SetNumEntriesPerChunkForTest(10);
+  index_->SetNumMmapChunks(3);
+  ASSERT_OK(index_->OpenAllChunksOnStartup(env_, entity));
+  scoped_refptr<Counter> mmaps = METRIC_log_index_chunk_mmap_for_read.Instantiate(entity);
+
+  // Chunks 2..4 are mapped at startup.
+  VerifyEntry(MakeOpId(1, 25), 1, 2500);
+  VerifyEntry(MakeOpId(1, 45), 1, 4500);
+  ASSERT_EQ(0, mmaps->value());
+
+  // Opening chunk 0 unmaps chunk 2, the oldest of the ones used as recently.
+  VerifyEntry(MakeOpId(1, 5), 1, 500);
+  ASSERT_EQ(1, mmaps->value());
+
+  // Chunk 3 was used before chunk 0 was mapped, so it's the one unmapped for
+  // chunk 1, rather than the older chunk 0.
+  VerifyEntry(MakeOpId(1, 15), 1, 1500);
+  ASSERT_EQ(2, mmaps->value());
+  VerifyEntry(MakeOpId(1, 5), 1, 500);
+  ASSERT_EQ(2, mmaps->value());
+  VerifyEntry(MakeOpId(1, 35), 1, 3500);
+  ASSERT_EQ(3, mmaps->value());
+
+  // Chunks which were never opened are GCed too.
+  index_->GC(40);
+  VerifyNotFound(25);
+  ASSERT_FALSE(env_->FileExists(JoinPathSegments(test_dir_, "index.000000002")));
+  VerifyEntry(MakeOpId(1, 45), 1, 4500);
+
+  // A latest chunk with the wrong size fails the startup.
+  ASSERT_OK(WriteStringToFile(env_, "x", JoinPathSegments(test_dir_, "index.000000005")));
+  index_ = new LogIndex(test_dir_);
+  index_->SetNumEntriesPerChunkForTest(10);
+  Status s = index_->OpenAllChunksOnStartup(env_, entity);
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+}
+
+// Tests that readers looking up entries scale with the number of threads while
+// a writer keeps appending, and that every lookup sees a complete entry.
+TEST_F(LogIndexTest, TestConcurrentReadersScaling) {
+  index_->SetNumEntriesPerChunkForTest(10000);
+  const int64_t kNumEntries = 50000;
+  const int kLookupsPerThread = AllowSlowTests() ? 2000000 : 100000;
+  for (int64_t i = 1; i <= kNumEntries; i++) {
+    ASSERT_OK(AddEntry(MakeOpId(1, i), i, i * 10));
+  }
+
+  for (int num_readers : { 1, 2, 4, 8 }) {
+    atomic<bool> done(false);
+    atomic<int64_t> next_index(kNumEntries + 1);
+    thread writer([&]() {
+      while (!done) {
+        int64_t i = next_index.fetch_add(1);
+        CHECK_OK(AddEntry(MakeOpId(1, i), i, i * 10));
+      }
+    });
+
+    Stopwatch sw;
+    sw.start();
+    vector<thread> readers;
+    for (int t = 0; t < num_readers; t++) {
+      readers.emplace_back([&, t]() {
+        LogIndexEntry entry;
+        for (int n = 0; n < kLookupsPerThread; n++) {
+          int64_t i = 1 + (n * 7919L + t) % kNumEntries;
+          CHECK_OK(index_->GetEntry(i, &entry));
+          CHECK_EQ(i, entry.segment_sequence_number);
+          CHECK_EQ(i * 10, entry.offset_in_segment);
+        }
+      });
+    }
+    for (auto& t : readers) {
+      t.join();
+    }
+    sw.stop();
+    done = true;
+    writer.join();
+
+    LOG(INFO) << num_readers << " reader(s): "
+              << (num_readers * kLookupsPerThread / sw.elapsed().wall_seconds())
+              << " lookups/sec with a concurrent writer";
+  }
+}
+
 } // namespace log
 } // namespace kudu
@@ -30,8 +30,11 @@
 
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cinttypes>
 #include <cstdint>
@@ -42,9 +45,11 @@
 #include <utility>
 #include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/consensus/opid_util.h"
+#include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/split.h"
@@ -52,7 +57,21 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/env.h"
 #include "kudu/util/errno.h"
-#include "kudu/util/env.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_bool(log_index_lazy_chunk_open, false,
+            "Whether opening a log index at startup only opens and mmaps its "
+            "latest chunks, leaving the older ones to be opened when they're "
+            "first read, and whether the mmapped chunk to unmap for another is "
+            "the least recently used one rather than the oldest. This makes "
+            "startup independent of how much log is retained.");
+TAG_FLAG(log_index_lazy_chunk_open, experimental);
+
+DEFINE_int32(log_index_startup_open_threads, 1,
+             "With --log_index_lazy_chunk_open, the number of threads which the "
+             "latest chunks of a log index are opened and checked on at startup.");
+TAG_FLAG(log_index_startup_open_threads, experimental);
 
 using std::string;
 using std::vector;
@@ -91,8 +110,9 @@ class LogIndex::IndexChunk : public RefCountedThreadSafe<LogIndex::IndexChunk> {
   explicit IndexChunk(string path, int64_t size);
   ~IndexChunk();
 
-  // Open the chunk file
-  Status Open();
+  // Open the chunk file. If 'validate' is true, fails with Corruption if
+  // the file already exists with a size other than 'size'.
+  Status Open(bool validate = false);
 
   // Memory map the chunk file
   // This is not thread safe with GetEntry() and SetEntry(). The caller should
@@ -113,11 +133,21 @@ class LogIndex::IndexChunk : public RefCountedThreadSafe<LogIndex::IndexChunk> {
   // Is this chunk file memory mapped?
   bool IsMmapped() const;
 
+  // Records that the chunk was used during 'epoch' (see
+  // LogIndex::mmap_epoch_).
+  void MarkUsed(int64_t epoch) {
+    if (last_used_.load(std::memory_order_relaxed) != epoch) {
+      last_used_.store(epoch, std::memory_order_relaxed);
+    }
+  }
+  int64_t last_used() const { return last_used_.load(std::memory_order_relaxed); }
+
  private:
   const string path_; // path of the underlying chunk file
   int fd_; // file descriptor
   uint8_t* mapping_; // mmapped memory location of the chunk
   int64_t size_; // configured size for the chunk file
+  std::atomic<int64_t> last_used_; // the last epoch the chunk was used in
 };
 
 namespace  {
@@ -131,7 +161,7 @@ Status CheckError(int rc, const char* operation) {
 } // anonymous namespace
 
 LogIndex::IndexChunk::IndexChunk(std::string path, int64_t size)
-    : path_(std::move(path)), fd_(-1), mapping_(nullptr), size_(size) {}
+    : path_(std::move(path)), fd_(-1), mapping_(nullptr), size_(size), last_used_(0) {}
 
 LogIndex::IndexChunk::~IndexChunk() {
   if (mapping_ != nullptr) {
@@ -147,10 +177,21 @@ LogIndex::IndexChunk::~IndexChunk() {
   }
 }
 
-Status LogIndex::IndexChunk::Open() {
+Status LogIndex::IndexChunk::Open(bool validate) {
   RETRY_ON_EINTR(fd_, open(path_.c_str(), O_CLOEXEC | O_CREAT | O_RDWR, 0666));
   RETURN_NOT_OK(CheckError(fd_, "open"));
 
+  if (validate) {
+    struct stat st;
+    RETURN_NOT_OK(CheckError(fstat(fd_, &st), "fstat"));
+    // A new file is extended below. Any other size means the chunk was
+    // written with a different number of entries per chunk, or damaged.
+    if (st.st_size != 0 && st.st_size != size_) {
+      return Status::Corruption(Substitute("index chunk $0 has size $1, expected $2",
+                                           path_, st.st_size, size_));
+    }
+  }
+
   int err;
   RETRY_ON_EINTR(err, ftruncate(fd_, size_));
   RETURN_NOT_OK(CheckError(fd_, "truncate"));
@@ -205,6 +246,9 @@ bool LogIndex::IndexChunk::IsMmapped() const {
 
 LogIndex::LogIndex(std::string base_dir)
   : base_dir_(std::move(base_dir)),
+    first_chunk_idx_(0),
+    num_open_chunks_(0),
+    mmap_epoch_(0),
     mmap_for_reads_(nullptr) {}
 
 LogIndex::~LogIndex() {
@@ -214,6 +258,50 @@ string LogIndex::GetChunkPath(int64_t chunk_idx) {
   return StringPrintf("%s/index.%09" PRId64, base_dir_.c_str(), chunk_idx);
 }
 
+LogIndex::IndexChunk* LogIndex::FindChunkUnlocked(int64_t chunk_idx) const {
+  int64_t pos = chunk_idx - first_chunk_idx_;
+  if (pos < 0 || pos >= static_cast<int64_t>(open_chunks_.size())) {
+    return nullptr;
+  }
+  return open_chunks_[pos].get();
+}
+
+void LogIndex::InsertChunkUnlocked(int64_t chunk_idx, const scoped_refptr<IndexChunk>& chunk) {
+  DCHECK(open_chunks_lock_.is_write_locked());
+  if (open_chunks_.empty()) {
+    first_chunk_idx_ = chunk_idx;
+  }
+  while (chunk_idx < first_chunk_idx_) {
+    open_chunks_.emplace_front();
+    first_chunk_idx_--;
+  }
+  while (chunk_idx >= first_chunk_idx_ + static_cast<int64_t>(open_chunks_.size())) {
+    open_chunks_.emplace_back();
+  }
+  auto& slot = open_chunks_[chunk_idx - first_chunk_idx_];
+  CHECK(!slot) << "chunk " << chunk_idx << " already open";
+  slot = chunk;
+  num_open_chunks_++;
+}
+
+void LogIndex::EraseChunkUnlocked(int64_t chunk_idx) {
+  DCHECK(open_chunks_lock_.is_write_locked());
+  int64_t pos = chunk_idx - first_chunk_idx_;
+  if (pos < 0 || pos >= static_cast<int64_t>(open_chunks_.size()) || !open_chunks_[pos]) {
+    return;
+  }
+  open_chunks_[pos].reset();
+  num_open_chunks_--;
+  // Keep the directory dense by trimming closed chunks off both ends.
+  while (!open_chunks_.empty() && !open_chunks_.front()) {
+    open_chunks_.pop_front();
+    first_chunk_idx_++;
+  }
+  while (!open_chunks_.empty() && !open_chunks_.back()) {
+    open_chunks_.pop_back();
+  }
+}
+
 Status LogIndex::OpenAllChunksOnStartup(
     Env *env,
     const scoped_refptr<MetricEntity>& metric_entity) {
@@ -225,6 +313,8 @@ Status LogIndex::OpenAllChunksOnStartup(
   mmap_for_reads_ =
     metric_entity->FindOrCreateCounter(&METRIC_log_index_chunk_mmap_for_read);
 
+  const bool lazy = FLAGS_log_index_lazy_chunk_open;
+  vector<int64_t> chunk_idxs;
   for (const auto& fname: children) {
     if (fname.find("index.") != 0) {
       continue;
@@ -242,43 +332,104 @@ Status LogIndex::OpenAllChunksOnStartup(
       continue;
     }
 
+    if (lazy) {
+      chunk_idxs.push_back(chunk_idx);
+      continue;
+    }
+
     VLOG(1) << "Opening index file on startup: " << fname << " for chunk idx " << chunk_idx;
 
     scoped_refptr<IndexChunk> chunk;
     RETURN_NOT_OK(OpenAndInsertChunk(chunk_idx, &chunk, /*should_mmap=*/false));
   }
 
+  if (lazy) {
+    std::sort(chunk_idxs.begin(), chunk_idxs.end());
+    return OpenLatestChunksOnStartup(chunk_idxs);
+  }
+
   // mmap 'kNumChunksToMmap' chunks. Note that the latest chunks are mmapped
   // (chunks having the highest chunk_idx)
+  std::lock_guard<percpu_rwlock> l(open_chunks_lock_);
   int64_t mmapped_chunks = 0;
   for (auto rit = open_chunks_.rbegin(); rit != open_chunks_.rend(); ++rit) {
     if (mmapped_chunks == kNumChunksToMmap) {
       break;
     }
+    if (!*rit) {
+      continue;
+    }
 
-    RETURN_NOT_OK(rit->second->Mmap());
+    RETURN_NOT_OK((*rit)->Mmap());
     mmapped_chunks++;
   }
 
   return Status::OK();
 }
 
+Status LogIndex::OpenLatestChunksOnStartup(const vector<int64_t>& chunk_idxs) {
+  const size_t num_latest = std::min<size_t>(chunk_idxs.size(), kNumChunksToMmap);
+  const size_t first_latest = chunk_idxs.size() - num_latest;
+
+  // Opening, checking and mapping a chunk which isn't shared yet needs no
+  // locking, so the latest chunks are set up in parallel and inserted after.
+  vector<scoped_refptr<IndexChunk>> latest(num_latest);
+  vector<Status> statuses(num_latest);
+  auto open_chunk = [&](size_t i) {
+    scoped_refptr<IndexChunk>* chunk = &latest[i];
+    statuses[i] = OpenChunk(chunk_idxs[first_latest + i], chunk, /*validate=*/true);
+    if (statuses[i].ok()) {
+      statuses[i] = (*chunk)->Mmap();
+    }
+  };
+  const int num_threads = std::min<int>(FLAGS_log_index_startup_open_threads, num_latest);
+  if (num_threads > 1) {
+    gscoped_ptr<ThreadPool> pool;
+    RETURN_NOT_OK(ThreadPoolBuilder("log-index-open")
+                  .set_max_threads(num_threads)
+                  .Build(&pool));
+    for (size_t i = 0; i < num_latest; i++) {
+      RETURN_NOT_OK(pool->SubmitFunc([&open_chunk, i]() { open_chunk(i); }));
+    }
+    pool->Wait();
+    pool->Shutdown();
+  } else {
+    for (size_t i = 0; i < num_latest; i++) {
+      open_chunk(i);
+    }
+  }
+  for (size_t i = 0; i < num_latest; i++) {
+    RETURN_NOT_OK_PREPEND(statuses[i], "Couldn't open index chunk");
+  }
+
+  std::lock_guard<percpu_rwlock> l(open_chunks_lock_);
+  unopened_chunks_.insert(chunk_idxs.begin(), chunk_idxs.begin() + first_latest);
+  const int64_t epoch = ++mmap_epoch_;
+  for (size_t i = 0; i < num_latest; i++) {
+    latest[i]->MarkUsed(epoch);
+    InsertChunkUnlocked(chunk_idxs[first_latest + i], latest[i]);
+  }
+  VLOG(1) << "Opened " << num_latest << " latest index chunks on startup, leaving "
+          << first_latest << " to be opened on demand";
+  return Status::OK();
+}
+
 void LogIndex::SetNumMmapChunks(int64_t num_chunks) {
   if (num_chunks <= 0)
     return;
 
-  std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+  std::lock_guard<percpu_rwlock> l(open_chunks_lock_);
   kNumChunksToMmap = num_chunks;
 
   // If necessary, unmap additional chunks
-  if (open_chunks_.size() <= kNumChunksToMmap) {
+  if (num_open_chunks_ <= kNumChunksToMmap) {
     return;
   }
 
   // get the number of chunks that are currently mmapped
   int64_t num_chunks_mmapped = 0;
-  for (auto it = open_chunks_.begin(); it != open_chunks_.end(); ++it) {
-    if (it->second->IsMmapped()) {
+  for (const auto& chunk : open_chunks_) {
+    if (chunk && chunk->IsMmapped()) {
       num_chunks_mmapped++;
     }
   }
@@ -287,8 +438,8 @@ void LogIndex::SetNumMmapChunks(int64_t num_chunks) {
   for (auto it = open_chunks_.begin();
       it != open_chunks_.end() && num_chunks_mmapped > kNumChunksToMmap;
       ++it) {
-    if (it->second->IsMmapped()) {
-      it->second->Munmap();
+    if (*it && (*it)->IsMmapped()) {
+      (*it)->Munmap();
       num_chunks_mmapped--;
     }
   }
@@ -301,23 +452,54 @@ void LogIndex::SetNumEntriesPerChunkForTest(int64_t entries) {
 }
 
 Status LogIndex::MmapChunk(scoped_refptr<IndexChunk> *chunk) {
-  if (open_chunks_.size() < kNumChunksToMmap) {
+  DCHECK(open_chunks_lock_.is_write_locked());
+  (*chunk)->MarkUsed(++mmap_epoch_);
+  if (num_open_chunks_ < kNumChunksToMmap) {
     RETURN_NOT_OK((*chunk)->Mmap());
     return Status::OK();
   }
 
+  if (FLAGS_log_index_lazy_chunk_open) {
+    // Unmap the least recently used chunk, never the latest one, which the
+    // appends go to, if the limit has been reached.
+    int64_t num_chunks_mmapped = 0;
+    IndexChunk* victim = nullptr;
+    const IndexChunk* latest = nullptr;
+    for (auto rit = open_chunks_.rbegin(); rit != open_chunks_.rend(); ++rit) {
+      if (!*rit) {
+        continue;
+      }
+      if (!latest) {
+        latest = rit->get();
+      }
+      if (!(*rit)->IsMmapped()) {
+        continue;
+      }
+      num_chunks_mmapped++;
+      // Ties go to the oldest chunk, as with the default policy.
+      if (rit->get() != latest &&
+          (!victim || (*rit)->last_used() <= victim->last_used())) {
+        victim = rit->get();
+      }
+    }
+    if (num_chunks_mmapped >= kNumChunksToMmap && victim) {
+      victim->Munmap();
+    }
+    return (*chunk)->Mmap();
+  }
+
   // The victim that needs to be unmapped is the oldest chunk (i.e the chunk
   // with the oldest chunk_idx). See documentation in log_index.h for more
   // details.
   //
   // Note that we have to reverse iterate through the open_chunks_ while the
-  // caller is holding onto the open_chunks_lock_. With 'open_chunks_' map
+  // caller is holding onto the open_chunks_lock_. With 'open_chunks_'
   // having only a few hundred entries, this should be acceptable (to keep
   // things simple)
   int64_t num_chunks_mmapped = 0;
   auto rit = open_chunks_.rbegin();
   for (; rit != open_chunks_.rend(); ++rit) {
-    if (rit->second->IsMmapped()) {
+    if (*rit && (*rit)->IsMmapped()) {
       num_chunks_mmapped++;
     }
 
@@ -328,7 +510,7 @@ Status LogIndex::MmapChunk(scoped_refptr<IndexChunk> *chunk) {
   // If there are 'kNumChunksToMmap' chunks already mmapped, then unmap the
   // 'victim' chunk
   if (num_chunks_mmapped == kNumChunksToMmap && rit != open_chunks_.rend()) {
-    rit->second->Munmap();
+    (*rit)->Munmap();
   }
 
   // Now mmap the provided 'chunk'
@@ -339,12 +521,13 @@ Status LogIndex::MmapChunk(scoped_refptr<IndexChunk> *chunk) {
 
 Status LogIndex::OpenChunk(
     int64_t chunk_idx,
-    scoped_refptr<IndexChunk>* chunk) {
+    scoped_refptr<IndexChunk>* chunk,
+    bool validate) {
   string path = GetChunkPath(chunk_idx);
   int64_t size = kEntriesPerIndexChunk * sizeof(PhysicalEntry);
 
   scoped_refptr<IndexChunk> new_chunk(new IndexChunk(path, size));
-  RETURN_NOT_OK(new_chunk->Open());
+  RETURN_NOT_OK(new_chunk->Open(validate));
 
   chunk->swap(new_chunk);
   return Status::OK();
@@ -356,15 +539,17 @@ Status LogIndex::OpenAndInsertChunk(
     bool should_mmap) {
   RETURN_NOT_OK_PREPEND(OpenChunk(chunk_idx, chunk),
                         "Couldn't open index chunk");
-  std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-  if (PREDICT_FALSE(ContainsKey(open_chunks_, chunk_idx))) {
+  std::lock_guard<percpu_rwlock> l(open_chunks_lock_);
+  IndexChunk* existing = FindChunkUnlocked(chunk_idx);
+  if (PREDICT_FALSE(existing)) {
     // Someone else opened the chunk in the meantime.
     // We'll just return that one.
-    *chunk = FindOrDie(open_chunks_, chunk_idx);
+    *chunk = existing;
     return Status::OK();
   }
 
-  InsertOrDie(&open_chunks_, chunk_idx, *chunk);
+  InsertChunkUnlocked(chunk_idx, *chunk);
+  unopened_chunks_.erase(chunk_idx);
 
   if (should_mmap) {
     RETURN_NOT_OK(MmapChunk(chunk));
@@ -378,18 +563,27 @@ Status LogIndex::GetChunkForIndex(int64_t log_index, bool create,
   CHECK_GT(log_index, 0);
   int64_t chunk_idx = log_index / kEntriesPerIndexChunk;
 
+  bool unopened;
   {
-    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-    if (FindCopy(open_chunks_, chunk_idx, chunk)) {
+    shared_lock<rw_spinlock> l(open_chunks_lock_.get_lock());
+    IndexChunk* existing = FindChunkUnlocked(chunk_idx);
+    if (PREDICT_TRUE(existing)) {
+      *chunk = existing;
       return Status::OK();
     }
+    // A chunk left unopened at startup is opened on first use.
+    unopened = !create && ContainsKey(unopened_chunks_, chunk_idx);
   }
 
-  if (!create) {
+  if (!create && !unopened) {
     return Status::NotFound("chunk not found");
   }
 
-  return OpenAndInsertChunk(chunk_idx, chunk, /*should_mmap=*/true);
+  RETURN_NOT_OK(OpenAndInsertChunk(chunk_idx, chunk, /*should_mmap=*/true));
+  if (unopened && mmap_for_reads_) {
+    mmap_for_reads_->Increment();
+  }
+  return Status::OK();
 }
 
 Status LogIndex::AddEntry(const LogIndexEntry& entry) {
@@ -408,15 +602,21 @@ Status LogIndex::AddEntry(const LogIndexEntry& entry) {
 
   {
     // Grab the 'open_chunks_lock_' to ensure that the chunk does not get
-    // unmapped
-    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-    if (PREDICT_FALSE(!chunk->IsMmapped())) {
-      RETURN_NOT_OK(MmapChunk(&chunk));
+    // unmapped. Shared mode suffices for writing to an already mapped chunk.
+    shared_lock<rw_spinlock> l(open_chunks_lock_.get_lock());
+    if (PREDICT_TRUE(chunk->IsMmapped())) {
+      chunk->SetEntry(index_in_chunk, phys);
+      VLOG(3) << "Added log index entry " << entry.ToString();
+      return Status::OK();
     }
-    chunk->SetEntry(index_in_chunk, phys);
-    VLOG(3) << "Added log index entry " << entry.ToString();
   }
 
+  std::lock_guard<percpu_rwlock> l(open_chunks_lock_);
+  if (!chunk->IsMmapped()) {
+    RETURN_NOT_OK(MmapChunk(&chunk));
+  }
+  chunk->SetEntry(index_in_chunk, phys);
+  VLOG(3) << "Added log index entry " << entry.ToString();
   return Status::OK();
 }
 
@@ -429,11 +629,23 @@ Status LogIndex::GetEntry(int64_t index, LogIndexEntry* entry) {
   DCHECK_LT(index_in_chunk, kEntriesPerIndexChunk);
   PhysicalEntry phys;
 
+  bool found = false;
   {
     // Grab the 'open_chunks_lock_' to ensure that the chunk does not get
     // unmapped
-    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-    if (PREDICT_FALSE(!chunk->IsMmapped())) {
+    shared_lock<rw_spinlock> l(open_chunks_lock_.get_lock());
+    if (PREDICT_TRUE(chunk->IsMmapped())) {
+      chunk->MarkUsed(mmap_epoch_.load(std::memory_order_relaxed));
+      chunk->GetEntry(index_in_chunk, &phys);
+      found = true;
+    }
+  }
+
+  if (PREDICT_FALSE(!found)) {
+    // A lagging reader needs a chunk that has been unmapped: map it, which may
+    // evict another chunk, so this requires the lock exclusively.
+    std::lock_guard<percpu_rwlock> l(open_chunks_lock_);
+    if (!chunk->IsMmapped()) {
       RETURN_NOT_OK(MmapChunk(&chunk));
 
       if (mmap_for_reads_) {
@@ -463,10 +675,19 @@ void LogIndex::GC(int64_t min_index_to_retain) {
   // Enumerate which chunks to delete.
   vector<int64_t> chunks_to_delete;
   {
-    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-    for (auto it = open_chunks_.begin();
-         it != open_chunks_.lower_bound(min_chunk_to_retain); ++it) {
-      chunks_to_delete.push_back(it->first);
+    shared_lock<rw_spinlock> l(open_chunks_lock_.get_lock());
+    for (int64_t chunk_idx = first_chunk_idx_;
+         chunk_idx < min_chunk_to_retain &&
+         chunk_idx < first_chunk_idx_ + static_cast<int64_t>(open_chunks_.size());
+         chunk_idx++) {
+      if (FindChunkUnlocked(chunk_idx)) {
+        chunks_to_delete.push_back(chunk_idx);
+      }
+    }
+    for (auto it = unopened_chunks_.begin();
+         it != unopened_chunks_.end() && *it < min_chunk_to_retain;
+         ++it) {
+      chunks_to_delete.push_back(*it);
     }
   }
 
@@ -480,8 +701,9 @@ void LogIndex::GC(int64_t min_index_to_retain) {
     }
     VLOG(2) << "Deleted log index segment " << path;
     {
-      std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-      open_chunks_.erase(chunk_idx);
+      std::lock_guard<percpu_rwlock> l(open_chunks_lock_);
+      EraseChunkUnlocked(chunk_idx);
+      unopened_chunks_.erase(chunk_idx);
     }
   }
 }
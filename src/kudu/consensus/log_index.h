@@ -17,9 +17,12 @@
 #ifndef KUDU_CONSENSUS_LOG_INDEX_H
 #define KUDU_CONSENSUS_LOG_INDEX_H
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <set>
 #include <string>
-#include <map>
+#include <vector>
 
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/gutil/macros.h"
@@ -87,6 +90,11 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // Opens all chunks files found in the file system and inserts the chunk into
   // 'open_chunks_' map. Also mmaps 'kNumChunksToMmap' latest chunks. Also
   // initializes the metric counter ''mmap_for_reads_'
+  //
+  // With --log_index_lazy_chunk_open, only the 'kNumChunksToMmap' latest
+  // chunks are opened, on up to --log_index_startup_open_threads threads, and
+  // checked to have the expected size. The others are opened by the first
+  // GetEntry() which needs them.
   Status OpenAllChunksOnStartup(
       Env *env, const scoped_refptr<MetricEntity>& metric_entity);
 
@@ -104,15 +112,21 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
       scoped_refptr<IndexChunk>* chunk,
       bool should_mmap);
 
-  // Open the on-disk chunk with the given index.
+  // Open the on-disk chunk with the given index. If 'validate' is true, fails
+  // with Corruption if the file exists with a size other than the chunk size.
   // Note: 'chunk_idx' is the index of the index chunk, not the index of a log _entry_.
   Status OpenChunk(
-      int64_t chunk_idx, 
-      scoped_refptr<IndexChunk>* chunk);
+      int64_t chunk_idx,
+      scoped_refptr<IndexChunk>* chunk,
+      bool validate = false);
+
+  // The part of OpenAllChunksOnStartup() which opens the chunks in
+  // 'chunk_idxs', which were found on disk and are sorted, lazily.
+  Status OpenLatestChunksOnStartup(const std::vector<int64_t>& chunk_idxs);
 
   // mmaps the file corresponding to chunk. The caller should hold
-  // 'open_chunks_lock_' and 'chunk' should have already been opened and
-  // inserted into 'open_chunks_' map.
+  // 'open_chunks_lock_' exclusively and 'chunk' should have already been
+  // opened and inserted into 'open_chunks_'.
   //
   // At any given time, the instance can only mmap a max of 'kChunksToMmap'
   // chunks. Hence, this method might have to 'evict' and unmap a chunk before
@@ -125,6 +139,10 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // 'kChunksToMMap' to be equal to the number of peers in the ring and each
   // peer have its own slot for 'mmapping' an index chunk (but this strategy is
   // not implemented yet). Check 'kChunksToMmap' for more details
+  //
+  // With --log_index_lazy_chunk_open, the victim is instead the least
+  // recently used mmapped chunk other than the latest one, so that the chunks
+  // which several lagging peers read from in turn stay mapped.
   Status MmapChunk(scoped_refptr<IndexChunk>* chunk);
 
   // Return the index chunk which contains the given log index.
@@ -137,16 +155,38 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // Return the path of the given index chunk.
   std::string GetChunkPath(int64_t chunk_idx);
 
+  // Accessors for 'open_chunks_'. The caller must hold 'open_chunks_lock_',
+  // in shared mode for FindChunkUnlocked() and exclusively otherwise.
+  IndexChunk* FindChunkUnlocked(int64_t chunk_idx) const;
+  void InsertChunkUnlocked(int64_t chunk_idx, const scoped_refptr<IndexChunk>& chunk);
+  void EraseChunkUnlocked(int64_t chunk_idx);
+
   // The base directory where index files are located.
   const std::string base_dir_;
 
-  simple_spinlock open_chunks_lock_;
-
-  // Map from chunk index to IndexChunk. The chunk index is the log index modulo
-  // the number of entries per chunk (see docs in log_index.cc).
-  // Protected by open_chunks_lock_
-  typedef std::map<int64_t, scoped_refptr<IndexChunk> > ChunkMap;
-  ChunkMap open_chunks_;
+  // Protects 'open_chunks_' and the mappings of the chunks in it. Lookups and
+  // reads or writes of entries in mapped chunks only take it in shared mode,
+  // on the calling CPU's lock, so that readers and the appending thread don't
+  // contend. Opening, mapping, unmapping and GCing chunks take it exclusively.
+  mutable percpu_rwlock open_chunks_lock_;
+
+  // Directory of open chunks, where open_chunks_[i] holds the chunk with index
+  // 'first_chunk_idx_ + i', or null if that chunk isn't open. The chunk index
+  // is the log index divided by the number of entries per chunk (see docs in
+  // log_index.cc). Since chunks are created and GCed in order, this is dense
+  // and a lookup is a subtraction rather than a tree search.
+  std::deque<scoped_refptr<IndexChunk>> open_chunks_;
+  int64_t first_chunk_idx_;
+  int64_t num_open_chunks_;
+
+  // The chunks found on disk at startup which haven't been opened yet, with
+  // --log_index_lazy_chunk_open. Protected by 'open_chunks_lock_'.
+  std::set<int64_t> unopened_chunks_;
+
+  // Advanced whenever a chunk is mmapped. A chunk records the value when it's
+  // used, which orders the chunks used since the last mmap after the others
+  // for MmapChunk(), without contending on a counter on every lookup.
+  std::atomic<int64_t> mmap_epoch_;
 
   // Number of index chunks to mmap for faster access. The default value is 3.
   //
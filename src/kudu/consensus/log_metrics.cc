@@ -23,6 +23,12 @@ METRIC_DEFINE_counter(server, log_bytes_logged, "Bytes Written to WAL",
                       kudu::MetricUnit::kBytes,
                       "Number of bytes logged since service start");
 
+METRIC_DEFINE_gauge_int64(server, log_gc_pending_bytes, "Log GC Pending Bytes",
+                          kudu::MetricUnit::kBytes,
+                          "Number of bytes of GC'd log segments which have not yet been "
+                          "reclaimed by the background log GC. Only non-zero when "
+                          "--log_async_gc is set");
+
 METRIC_DEFINE_histogram(server, log_sync_latency, "Log Sync Latency",
                         kudu::MetricUnit::kMicroseconds,
                         "Microseconds spent on synchronizing the log segment file",
@@ -36,29 +42,80 @@ METRIC_DEFINE_histogram(server, log_append_latency, "Log Append Latency",
 METRIC_DEFINE_histogram(server, log_group_commit_latency, "Log Group Commit Latency",
                         kudu::MetricUnit::kMicroseconds,
                         "Microseconds spent on committing an entire group",
-                        60000000LU, 2);
+                        60000000LU, 2, kudu::PER_THREAD);
 
 METRIC_DEFINE_histogram(server, log_roll_latency, "Log Roll Latency",
                         kudu::MetricUnit::kMicroseconds,
                         "Microseconds spent on rolling over to a new log segment file",
                         60000000LU, 2);
 
+METRIC_DEFINE_counter(server, log_segments_recycled, "Log Segments Recycled",
+                      kudu::MetricUnit::kUnits,
+                      "Number of new log segments written into the recycled file of a GC'd "
+                      "segment rather than into a newly allocated file");
+
 METRIC_DEFINE_histogram(server, log_entry_batches_per_group, "Log Group Commit Batch Size",
                         kudu::MetricUnit::kRequests,
                         "Number of log entry batches in a group commit group",
                         1024, 2);
 
+METRIC_DEFINE_histogram(server, log_group_commit_target_batches,
+                        "Log Group Commit Target Batch Size",
+                        kudu::MetricUnit::kRequests,
+                        "Number of log entry batches the adaptive group commit controller "
+                        "aimed to gather into a group. Only recorded when "
+                        "--log_group_commit_target_latency_us is set",
+                        1024, 2);
+
+METRIC_DEFINE_histogram(server, log_group_commit_wait_latency, "Log Group Commit Wait Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds the adaptive group commit controller chose to wait for "
+                        "more batches before writing a group. Only recorded when "
+                        "--log_group_commit_target_latency_us is set",
+                        60000000LU, 2);
+
+METRIC_DEFINE_histogram(server, log_serialize_latency, "Log Serialize Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds spent on serializing a batch of replicates before it is "
+                        "queued for appending",
+                        60000000LU, 2);
+
+METRIC_DEFINE_histogram(server, log_group_write_latency, "Log Group Write Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds spent on writing all the batches of a group commit group "
+                        "to the log segment file",
+                        60000000LU, 2);
+
+METRIC_DEFINE_histogram(server, log_sync_wait_latency, "Log Sync Wait Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds the append thread spent waiting for the previous group's "
+                        "sync to finish. Only recorded when --log_pipelined_append is set",
+                        60000000LU, 2);
+
+METRIC_DEFINE_histogram(server, log_group_callback_latency, "Log Group Callback Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds spent on running the callbacks of a group commit group",
+                        60000000LU, 2);
+
 namespace kudu {
 namespace log {
 
 #define MINIT(x) x(METRIC_log_##x.Instantiate(metric_entity))
 LogMetrics::LogMetrics(const scoped_refptr<MetricEntity>& metric_entity)
     : MINIT(bytes_logged),
+      gc_pending_bytes(METRIC_log_gc_pending_bytes.Instantiate(metric_entity, 0)),
       MINIT(sync_latency),
       MINIT(append_latency),
       MINIT(group_commit_latency),
       MINIT(roll_latency),
-      MINIT(entry_batches_per_group) {
+      MINIT(segments_recycled),
+      MINIT(entry_batches_per_group),
+      MINIT(group_commit_target_batches),
+      MINIT(group_commit_wait_latency),
+      MINIT(serialize_latency),
+      MINIT(group_write_latency),
+      MINIT(sync_wait_latency),
+      MINIT(group_callback_latency) {
 }
 #undef MINIT
 
@@ -28,13 +28,23 @@ struct LogMetrics {
 
   // Global stats
   scoped_refptr<Counter> bytes_logged;
+  scoped_refptr<AtomicGauge<int64_t>> gc_pending_bytes;
 
   // Per-group group commit stats
   scoped_refptr<Histogram> sync_latency;
   scoped_refptr<Histogram> append_latency;
   scoped_refptr<Histogram> group_commit_latency;
   scoped_refptr<Histogram> roll_latency;
+  scoped_refptr<Counter> segments_recycled;
   scoped_refptr<Histogram> entry_batches_per_group;
+  scoped_refptr<Histogram> group_commit_target_batches;
+  scoped_refptr<Histogram> group_commit_wait_latency;
+
+  // Per-stage stats of the append pipeline.
+  scoped_refptr<Histogram> serialize_latency;
+  scoped_refptr<Histogram> group_write_latency;
+  scoped_refptr<Histogram> sync_wait_latency;
+  scoped_refptr<Histogram> group_callback_latency;
 };
 
 } // namespace log
@@ -22,22 +22,51 @@
 #include <mutex>
 #include <ostream>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log.pb.h"
 #include "kudu/consensus/log_index.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
 #include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/faststring_pool.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/io_class.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_int32(log_reader_open_threads, 4,
+             "Number of threads used to open, and if necessary rebuild the "
+             "footers of, a tablet's WAL segments when its log is opened. "
+             "If 1, segments are opened sequentially.");
+TAG_FLAG(log_reader_open_threads, advanced);
+
+DEFINE_bool(log_verify_checksums_on_open, false,
+            "Whether to read every entry of every WAL segment, verifying its "
+            "checksum, when a tablet's log is opened. Segments without a footer "
+            "are always scanned in full, regardless of this flag.");
+TAG_FLAG(log_verify_checksums_on_open, advanced);
+
+DEFINE_int64(log_reader_readahead_bytes, 4 * 1024 * 1024,
+             "Number of bytes ahead of the current position, which may span into "
+             "the following segment, that are hinted to the OS for readahead when "
+             "reading a range of operations from the WAL. If 0, no readahead "
+             "hints are issued beyond the OS defaults.");
+TAG_FLAG(log_reader_readahead_bytes, advanced);
+TAG_FLAG(log_reader_readahead_bytes, runtime);
 
 METRIC_DEFINE_counter(server, log_reader_bytes_read, "Bytes Read From Log",
                       kudu::MetricUnit::kBytes,
@@ -56,6 +85,8 @@ using kudu::consensus::OpId;
 using kudu::consensus::ReplicateMsg;
 using kudu::pb_util::SecureDebugString;
 using kudu::pb_util::SecureShortDebugString;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
@@ -72,7 +103,160 @@ struct LogSegmentSeqnoComparator {
     return a->header().sequence_number() < b->header().sequence_number();
   }
 };
+
+// Decodes the entries of a serialized LogEntryBatchPB one at a time, so that
+// the entries of a batch past those a read actually needs are never parsed.
+class LazyEntryBatch {
+ public:
+  // Starts decoding the batch serialized in 'data', which must outlive the
+  // following calls to Next().
+  void Reset(const Slice& data) {
+    remaining_ = data;
+  }
+
+  // Parses the next entry of the batch into 'entry'. Returns NotFound once
+  // all the entries of the batch have been decoded.
+  Status Next(LogEntryPB* entry) {
+    CodedInputStream in(remaining_.data(), remaining_.size());
+    while (true) {
+      uint32_t tag = in.ReadTag();
+      if (tag == 0) {
+        remaining_.clear();
+        return Status::NotFound("no more entries in batch");
+      }
+      if (WireFormatLite::GetTagFieldNumber(tag) != LogEntryBatchPB::kEntryFieldNumber ||
+          WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+        if (!WireFormatLite::SkipField(&in, tag)) {
+          return Status::Corruption("unable to skip unknown field in log entry batch");
+        }
+        continue;
+      }
+      uint32_t length;
+      if (!in.ReadVarint32(&length) ||
+          length > remaining_.size() - in.CurrentPosition()) {
+        return Status::Corruption("truncated entry in log entry batch");
+      }
+      const uint8_t* data = remaining_.data() + in.CurrentPosition();
+      entry->Clear();
+      RETURN_NOT_OK(pb_util::ParseFromArray(entry, data, length));
+      remaining_.remove_prefix(in.CurrentPosition() + length);
+      return Status::OK();
+    }
+  }
+
+ private:
+  Slice remaining_;
+};
+
+// Keeps the OS reading ahead of a sequential read through a log's segments:
+// whenever the read position comes within half a window of the end of what
+// was last hinted, hints the next window, spilling past the end of the
+// current segment into the start of the next one.
+class SegmentReadAhead {
+ public:
+  SegmentReadAhead(const LogReader* reader, int64_t window)
+      : reader_(reader),
+        window_(window),
+        seqno_(-1),
+        end_(0),
+        next_end_(0) {
+  }
+
+  // Notes that the read is now at 'offset' in 'segment'.
+  void Advance(const scoped_refptr<ReadableLogSegment>& segment, int64_t offset) {
+    if (window_ <= 0) {
+      return;
+    }
+    const int64_t seqno = segment->header().sequence_number();
+    if (seqno != seqno_) {
+      // Pick up from where the spill into this segment left off, if any.
+      end_ = (next_ && next_->header().sequence_number() == seqno) ? next_end_ : 0;
+      next_.reset();
+      seqno_ = seqno;
+    }
+    if (offset + window_ / 2 <= end_) {
+      return;
+    }
+
+    const int64_t start = std::max(offset, end_);
+    const int64_t target = offset + window_;
+    const int64_t segment_end = std::min(target, segment->readable_up_to());
+    if (segment_end > start) {
+      segment->ReadAhead(start, segment_end - start);
+      end_ = segment_end;
+    }
+    if (target <= segment->readable_up_to()) {
+      return;
+    }
+
+    if (!next_) {
+      next_ = reader_->GetSegmentBySequenceNumber(seqno + 1);
+      if (!next_) {
+        return;
+      }
+      next_end_ = next_->first_entry_offset();
+    }
+    const int64_t next_target = std::min(next_->first_entry_offset() + target - segment_end,
+                                         next_->readable_up_to());
+    if (next_target > next_end_) {
+      next_->ReadAhead(next_end_, next_target - next_end_);
+      next_end_ = next_target;
+    }
+  }
+
+ private:
+  const LogReader* const reader_;
+  const int64_t window_;
+
+  // The segment being read, and the end of the hinted range within it.
+  int64_t seqno_;
+  int64_t end_;
+
+  // The segment after it, if the hinted range spills into it, and the end of
+  // the hinted range within that segment.
+  scoped_refptr<ReadableLogSegment> next_;
+  int64_t next_end_;
+};
+
+// Opens the segment at 'path' and makes it ready to be appended to a reader,
+// rebuilding its footer if it doesn't have one. Returns OK with a null
+// 'segment' if the segment never had its header written.
+Status OpenSegmentForReader(Env* env, const string& path,
+                            scoped_refptr<ReadableLogSegment>* segment) {
+  Status s = ReadableLogSegment::Open(env, path, segment);
+  if (s.IsUninitialized()) {
+    // This indicates that the segment was created but the writer
+    // crashed before the header was successfully written. In this
+    // case, we should skip it.
+    LOG(WARNING) << "Ignoring log segment " << path << " since it was uninitialized "
+                 << "(probably left after a prior tablet server crash)";
+    segment->reset();
+    return Status::OK();
+  }
+
+  RETURN_NOT_OK_PREPEND(s, "Unable to open readable log segment");
+  DCHECK(*segment);
+  CHECK((*segment)->IsInitialized()) << "Uninitialized segment at: " << (*segment)->path();
+
+  if (!(*segment)->HasFooter()) {
+    VLOG(1) << "Log segment " << path << " was likely left in-progress "
+            << "after a previous crash. Will try to rebuild footer by scanning data.";
+    return (*segment)->RebuildFooterByScanning();
+  }
+  if (FLAGS_log_verify_checksums_on_open) {
+    // Reading each entry verifies its checksum, and reaching the end verifies
+    // the entry count recorded in the footer.
+    LogEntryReader reader(segment->get());
+    while (true) {
+      unique_ptr<LogEntryPB> entry;
+      s = reader.ReadNextEntry(&entry);
+      if (s.IsEndOfFile()) break;
+      RETURN_NOT_OK_PREPEND(s, Substitute("Failed to verify log segment $0", path));
+    }
+  }
+  return Status::OK();
 }
+} // anonymous namespace
 
 const int64_t LogReader::kNoSizeLimit = -1;
 
@@ -82,9 +266,19 @@ Status LogReader::Open(Env* env,
                        const string& tablet_id,
                        const scoped_refptr<MetricEntity>& metric_entity,
                        shared_ptr<LogReader>* reader) {
+  return LogReader::Open(env, vector<string>{ tablet_wal_dir },
+                         index, tablet_id, metric_entity, reader);
+}
+
+Status LogReader::Open(Env* env,
+                       const vector<string>& tablet_wal_dirs,
+                       const scoped_refptr<LogIndex>& index,
+                       const string& tablet_id,
+                       const scoped_refptr<MetricEntity>& metric_entity,
+                       shared_ptr<LogReader>* reader) {
   auto log_reader = LogReader::make_shared(env, index, tablet_id, metric_entity);
 
-  RETURN_NOT_OK_PREPEND(log_reader->Init(tablet_wal_dir),
+  RETURN_NOT_OK_PREPEND(log_reader->Init(tablet_wal_dirs),
                         "Unable to initialize log reader")
   *reader = log_reader;
   return Status::OK();
@@ -95,7 +289,7 @@ Status LogReader::Open(FsManager* fs_manager,
                        const std::string& tablet_id,
                        const scoped_refptr<MetricEntity>& metric_entity,
                        std::shared_ptr<LogReader>* reader) {
-  return LogReader::Open(fs_manager->env(), fs_manager->GetTabletWalDir(tablet_id),
+  return LogReader::Open(fs_manager->env(), fs_manager->GetTabletWalDirs(tablet_id),
                          index, tablet_id, metric_entity, reader);
 }
 
@@ -117,52 +311,71 @@ LogReader::LogReader(Env* env,
 LogReader::~LogReader() {
 }
 
-Status LogReader::Init(const string& tablet_wal_path) {
+Status LogReader::Init(const vector<string>& tablet_wal_paths) {
   {
     std::lock_guard<simple_spinlock> lock(lock_);
     CHECK_EQ(state_, kLogReaderInitialized) << "bad state for Init(): " << state_;
   }
-  VLOG(1) << "Reading wal from path:" << tablet_wal_path;
+  CHECK(!tablet_wal_paths.empty());
 
-  if (!env_->FileExists(tablet_wal_path)) {
-    return Status::IllegalState("Cannot find wal location at", tablet_wal_path);
+  if (!env_->FileExists(tablet_wal_paths[0])) {
+    return Status::IllegalState("Cannot find wal location at", tablet_wal_paths[0]);
   }
 
-  VLOG(1) << "Parsing segments from path: " << tablet_wal_path;
-  // list existing segment files
-  vector<string> log_files;
-
-  RETURN_NOT_OK_PREPEND(env_->GetChildren(tablet_wal_path, &log_files),
-                        "Unable to read children from path");
+  vector<string> segment_paths;
+  for (const string& tablet_wal_path : tablet_wal_paths) {
+    VLOG(1) << "Reading wal from path:" << tablet_wal_path;
+    // Stripe directories are created lazily, so one that doesn't exist simply
+    // holds no segments.
+    if (!env_->FileExists(tablet_wal_path)) {
+      continue;
+    }
 
-  SegmentSequence read_segments;
+    VLOG(1) << "Parsing segments from path: " << tablet_wal_path;
+    // list existing segment files
+    vector<string> log_files;
 
-  // build a log segment from each file
-  for (const string &log_file : log_files) {
-    if (HasPrefixString(log_file, FsManager::kWalFileNamePrefix)) {
-      string fqp = JoinPathSegments(tablet_wal_path, log_file);
-      scoped_refptr<ReadableLogSegment> segment;
-      Status s = ReadableLogSegment::Open(env_, fqp, &segment);
-      if (s.IsUninitialized()) {
-        // This indicates that the segment was created but the writer
-        // crashed before the header was successfully written. In this
-        // case, we should skip it.
-        LOG(WARNING) << "Ignoring log segment " << log_file << " since it was uninitialized "
-                     << "(probably left after a prior tablet server crash)";
-        continue;
+    RETURN_NOT_OK_PREPEND(env_->GetChildren(tablet_wal_path, &log_files),
+                          "Unable to read children from path");
+    for (const string& log_file : log_files) {
+      if (HasPrefixString(log_file, FsManager::kWalFileNamePrefix)) {
+        segment_paths.emplace_back(JoinPathSegments(tablet_wal_path, log_file));
       }
+    }
+  }
 
-      RETURN_NOT_OK_PREPEND(s, "Unable to open readable log segment");
-      DCHECK(segment);
-      CHECK(segment->IsInitialized()) << "Uninitialized segment at: " << segment->path();
-
-      if (!segment->HasFooter()) {
-        VLOG(1) << "Log segment " << fqp << " was likely left in-progress "
-                << "after a previous crash. Will try to rebuild footer by scanning data.";
-        RETURN_NOT_OK(segment->RebuildFooterByScanning());
+  // Build a log segment from each file. Opening a segment reads its header and
+  // footer, and may have to scan the whole segment, so with many retained
+  // segments this is done in parallel.
+  vector<scoped_refptr<ReadableLogSegment>> opened(segment_paths.size());
+  vector<Status> statuses(segment_paths.size());
+  int num_threads = std::min<int>(FLAGS_log_reader_open_threads, segment_paths.size());
+  if (num_threads > 1) {
+    gscoped_ptr<ThreadPool> pool;
+    RETURN_NOT_OK(ThreadPoolBuilder("log-reader-open")
+                  .set_max_threads(num_threads)
+                  .Build(&pool));
+    for (int i = 0; i < segment_paths.size(); i++) {
+      Status s = pool->SubmitFunc([&, i]() {
+        statuses[i] = OpenSegmentForReader(env_, segment_paths[i], &opened[i]);
+      });
+      if (PREDICT_FALSE(!s.ok())) {
+        pool->Wait();
+        return s;
       }
+    }
+    pool->Wait();
+  } else {
+    for (int i = 0; i < segment_paths.size(); i++) {
+      statuses[i] = OpenSegmentForReader(env_, segment_paths[i], &opened[i]);
+    }
+  }
 
-      read_segments.push_back(segment);
+  SegmentSequence read_segments;
+  for (int i = 0; i < segment_paths.size(); i++) {
+    RETURN_NOT_OK(statuses[i]);
+    if (opened[i]) {
+      read_segments.push_back(opened[i]);
     }
   }
 
@@ -261,13 +474,44 @@ Status LogReader::ReadBatchUsingIndexEntry(const LogIndexEntry& index_entry,
                                    index_entry.offset_in_segment));
 
   if (bytes_read_) {
-    bytes_read_->IncrementBy(segment->entry_header_size() + tmp_buf->length());
+    // Mapped segments are read in place, so count the bytes consumed from the
+    // segment rather than those copied into 'tmp_buf'.
+    bytes_read_->IncrementBy(offset - index_entry.offset_in_segment);
     entries_read_->IncrementBy((**batch).entry_size());
   }
 
   return Status::OK();
 }
 
+Status LogReader::ReadBatchPayloadUsingIndexEntry(const LogIndexEntry& index_entry,
+                                                  faststring* tmp_buf,
+                                                  Slice* payload) const {
+  const int64_t index = index_entry.op_id.index();
+
+  scoped_refptr<ReadableLogSegment> segment = GetSegmentBySequenceNumber(
+    index_entry.segment_sequence_number);
+  if (PREDICT_FALSE(!segment)) {
+    return Status::NotFound(Substitute("Segment $0 which contained index $1 has been GCed",
+                                       index_entry.segment_sequence_number,
+                                       index));
+  }
+
+  CHECK_GT(index_entry.offset_in_segment, 0);
+  int64_t offset = index_entry.offset_in_segment;
+  ScopedLatencyMetric scoped(read_batch_latency_.get());
+  RETURN_NOT_OK_PREPEND(segment->ReadEntryBatchPayload(&offset, tmp_buf, payload),
+                        Substitute("Failed to read LogEntry for index $0 from log segment "
+                                   "$1 offset $2",
+                                   index,
+                                   index_entry.segment_sequence_number,
+                                   index_entry.offset_in_segment));
+
+  if (bytes_read_) {
+    bytes_read_->IncrementBy(offset - index_entry.offset_in_segment);
+  }
+  return Status::OK();
+}
+
 Status LogReader::ReadReplicatesInRange(int64_t starting_at,
                                         int64_t up_to,
                                         int64_t max_bytes_to_read,
@@ -275,6 +519,9 @@ Status LogReader::ReadReplicatesInRange(int64_t starting_at,
   DCHECK_GT(starting_at, 0);
   DCHECK_GE(up_to, starting_at);
   DCHECK(log_index_) << "Require an index to random-read logs";
+  // Ranges are read from the WAL when they aren't in the log cache anymore,
+  // i.e. when a peer is catching up, which mustn't slow down appends.
+  ScopedIOClass io_class(IOClass::kBackground);
 
   vector<ReplicateMsg*> replicates_tmp;
   ElementDeleter d(&replicates_tmp);
@@ -282,77 +529,134 @@ Status LogReader::ReadReplicatesInRange(int64_t starting_at,
 
   int64_t total_size = 0;
   bool limit_exceeded = false;
-  faststring tmp_buf;
-  unique_ptr<LogEntryBatchPB> batch;
+  // Reuses the buffer of the thread's previous read, as catch-up reads of
+  // large batches would otherwise allocate and grow a fresh one each time.
+  ScratchFaststring scratch;
+  faststring* tmp_buf = scratch.get();
+  Slice payload;
+  LazyEntryBatch batch;
+  LogEntryPB entry;
+  // The index of the last REPLICATE decoded from 'batch'.
+  int64_t prev_index = 0;
+  SegmentReadAhead readahead(this, FLAGS_log_reader_readahead_bytes);
+  int64_t entries_read = 0;
   for (int64_t index = starting_at; index <= up_to && !limit_exceeded; index++) {
     LogIndexEntry index_entry;
-    RETURN_NOT_OK_PREPEND(log_index_->GetEntry(index, &index_entry),
-                          Substitute("Failed to read log index for op $0", index));
+    Status s = log_index_->GetEntry(index, &index_entry);
+    if (s.IsNotFound()) {
+      s = LookupEntryInSegmentFooters(index, index == starting_at ? nullptr : &prev_index_entry,
+                                      tmp_buf, &index_entry);
+    }
+    RETURN_NOT_OK_PREPEND(s, Substitute("Failed to read log index for op $0", index));
 
     // Since a given LogEntryBatchPB may contain multiple REPLICATE messages,
     // it's likely that this index entry points to the same batch as the previous
-    // one. If that's the case, we've already read this REPLICATE and we can
-    // skip reading the batch again.
+    // one. If that's the case, we carry on decoding the batch from where we
+    // left off rather than reading it again.
     if (index == starting_at ||
         index_entry.segment_sequence_number != prev_index_entry.segment_sequence_number ||
         index_entry.offset_in_segment != prev_index_entry.offset_in_segment) {
-      RETURN_NOT_OK(ReadBatchUsingIndexEntry(index_entry, &tmp_buf, &batch));
-
-      // Sanity-check the property that a batch should only have increasing indexes.
-      int64_t prev_index = 0;
-      for (int i = 0; i < batch->entry_size(); ++i) {
-        LogEntryPB* entry = batch->mutable_entry(i);
-        if (!entry->has_replicate()) continue;
-        int64_t this_index = entry->replicate().id().index();
-        CHECK_GT(this_index, prev_index)
-          << "Expected that an entry batch should only include increasing log indexes: "
-          << index_entry.ToString()
-          << "\nBatch: " << SecureDebugString(*batch);
-        prev_index = this_index;
+      scoped_refptr<ReadableLogSegment> segment =
+          GetSegmentBySequenceNumber(index_entry.segment_sequence_number);
+      if (segment) {
+        // Peers that fall behind read whole runs of segments in order.
+        if (index == starting_at ||
+            index_entry.segment_sequence_number != prev_index_entry.segment_sequence_number) {
+          segment->AdviseSequentialReads();
+        }
+        readahead.Advance(segment, index_entry.offset_in_segment);
       }
+      RETURN_NOT_OK(ReadBatchPayloadUsingIndexEntry(index_entry, tmp_buf, &payload));
+      batch.Reset(payload);
+      prev_index = 0;
     }
 
+    // Decode the batch up to the REPLICATE for 'index', leaving the entries
+    // after it unparsed until (and unless) they are needed.
     bool found = false;
-    for (int i = 0; i < batch->entry_size(); ++i) {
-      LogEntryPB* entry = batch->mutable_entry(i);
-      if (!entry->has_replicate()) {
-        continue;
+    while (!found) {
+      s = batch.Next(&entry);
+      if (s.IsNotFound()) {
+        break;
       }
-
-      if (entry->replicate().id().index() != index) {
+      RETURN_NOT_OK_PREPEND(s, Substitute("Failed to decode log entry batch at $0",
+                                          index_entry.ToString()));
+      entries_read++;
+      if (!entry.has_replicate()) {
         continue;
       }
 
-      int64_t space_required = entry->replicate().SpaceUsed();
-      if (replicates_tmp.empty() ||
-          max_bytes_to_read <= 0 ||
-          total_size + space_required < max_bytes_to_read) {
-        total_size += space_required;
-        replicates_tmp.push_back(entry->release_replicate());
-      } else {
-        limit_exceeded = true;
-      }
-      found = true;
-      break;
+      // Sanity-check the property that a batch should only have increasing indexes.
+      int64_t this_index = entry.replicate().id().index();
+      CHECK_GT(this_index, prev_index)
+        << "Expected that an entry batch should only include increasing log indexes: "
+        << index_entry.ToString();
+      prev_index = this_index;
+      found = this_index == index;
     }
     CHECK(found) << "Incorrect index entry didn't yield expected log entry: "
                  << index_entry.ToString();
 
+    int64_t space_required = entry.replicate().SpaceUsed();
+    if (replicates_tmp.empty() ||
+        max_bytes_to_read <= 0 ||
+        total_size + space_required < max_bytes_to_read) {
+      total_size += space_required;
+      replicates_tmp.push_back(entry.release_replicate());
+    } else {
+      limit_exceeded = true;
+    }
+
     prev_index_entry = index_entry;
   }
 
+  if (entries_read_) {
+    entries_read_->IncrementBy(entries_read);
+  }
   replicates->swap(replicates_tmp);
   return Status::OK();
 }
 
 Status LogReader::LookupOpId(int64_t op_index, OpId* op_id) const {
   LogIndexEntry index_entry;
-  RETURN_NOT_OK_PREPEND(log_index_->GetEntry(op_index, &index_entry),
-                        strings::Substitute("Failed to read log index for op $0", op_index));
+  Status s = log_index_->GetEntry(op_index, &index_entry);
+  if (s.IsNotFound()) {
+    ScratchFaststring tmp_buf;
+    s = LookupEntryInSegmentFooters(op_index, nullptr, tmp_buf.get(), &index_entry);
+  }
+  RETURN_NOT_OK_PREPEND(s, strings::Substitute("Failed to read log index for op $0", op_index));
   *op_id = index_entry.op_id;
   return Status::OK();
 }
 
+Status LogReader::LookupEntryInSegmentFooters(int64_t index, const LogIndexEntry* prev,
+                                              faststring* tmp_buf,
+                                              LogIndexEntry* entry) const {
+  SegmentSequence segments;
+  RETURN_NOT_OK(GetSegmentsSnapshot(&segments));
+  // Later segments hold the latest copy of an index rewritten by truncation.
+  for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+    const scoped_refptr<ReadableLogSegment>& segment = *it;
+    int64_t seqno = segment->header().sequence_number();
+    int64_t min_offset = 0;
+    if (prev && prev->segment_sequence_number == seqno) {
+      // The latest copy of an index is always written after that of the
+      // index preceding it.
+      min_offset = prev->offset_in_segment;
+    }
+    Status s = segment->FindReplicateBatch(index, min_offset, tmp_buf,
+                                           &entry->offset_in_segment, &entry->op_id);
+    if (s.ok()) {
+      entry->segment_sequence_number = seqno;
+      return Status::OK();
+    }
+    if (!s.IsNotFound()) {
+      return s;
+    }
+  }
+  return Status::NotFound(Substitute("op $0 not found in log index or segment footers", index));
+}
+
 Status LogReader::GetSegmentsSnapshot(SegmentSequence* segments) const {
   std::lock_guard<simple_spinlock> lock(lock_);
   CHECK_EQ(state_, kLogReaderReading);
@@ -39,6 +39,7 @@ class FsManager;
 class Histogram;
 class MetricEntity;
 class faststring;
+class Slice;
 
 namespace consensus {
 class OpId;
@@ -69,7 +70,18 @@ class LogReader : public enable_make_shared<LogReader> {
                      const scoped_refptr<MetricEntity>& metric_entity,
                      std::shared_ptr<LogReader>* reader);
 
-  // Same as above, but will use `fs_manager` to determine the default WAL dir
+  // Same as above, but reads the segments found across all of
+  // 'tablet_wal_dirs', as written by a log striped over several WAL roots.
+  // The first directory must exist; the others may be missing if no segment
+  // was ever striped to them.
+  static Status Open(Env* env,
+                     const std::vector<std::string>& tablet_wal_dirs,
+                     const scoped_refptr<LogIndex>& index,
+                     const std::string& tablet_id,
+                     const scoped_refptr<MetricEntity>& metric_entity,
+                     std::shared_ptr<LogReader>* reader);
+
+  // Same as above, but will use `fs_manager` to determine the WAL dirs
   // for the tablet.
   static Status Open(FsManager* fs_manager,
                      const scoped_refptr<LogIndex>& index,
@@ -171,8 +183,22 @@ class LogReader : public enable_make_shared<LogReader> {
                                   faststring* tmp_buf,
                                   std::unique_ptr<LogEntryBatchPB>* batch) const;
 
-  // Reads the headers of all segments in 'tablet_wal_path'.
-  Status Init(const std::string& tablet_wal_path);
+  // Like ReadBatchUsingIndexEntry(), but sets 'payload' to the serialized
+  // batch, pointing into 'tmp_buf' or the segment's mapping, without parsing it.
+  Status ReadBatchPayloadUsingIndexEntry(const LogIndexEntry& index_entry,
+                                         faststring* tmp_buf,
+                                         Slice* payload) const;
+
+  // Looks up 'index' in the sparse indexes of the closed segments' footers,
+  // newest segment first, for when it has fallen out of 'log_index_'. If not
+  // null, 'prev' is the entry of the preceding index, from which the scan may
+  // resume if it is in the same segment.
+  Status LookupEntryInSegmentFooters(int64_t index, const LogIndexEntry* prev,
+                                     faststring* tmp_buf,
+                                     LogIndexEntry* entry) const;
+
+  // Reads the headers of all segments in 'tablet_wal_paths'.
+  Status Init(const std::vector<std::string>& tablet_wal_paths);
 
   // Initializes an 'empty' reader for tests, i.e. does not scan a path looking for segments.
   Status InitEmptyReaderForTests();
@@ -0,0 +1,178 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/log_segment_fetcher.h"
+
+#include <algorithm>
+#include <mutex>
+#include <ostream>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/common/wire_protocol.h"
+#include "kudu/consensus/consensus.proxy.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/rpc/rpc_controller.h"
+#include "kudu/util/crc.h"
+#include "kudu/util/env.h"
+#include "kudu/util/env_util.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/threadpool.h"
+
+namespace kudu {
+namespace consensus {
+
+using rpc::RpcController;
+using std::string;
+using std::unique_ptr;
+using strings::Substitute;
+
+template<class RespClass>
+static Status StatusFromResponse(const Status& rpc_status, const RespClass& resp) {
+  RETURN_NOT_OK(rpc_status);
+  if (resp.has_error()) {
+    return StatusFromPB(resp.error().status());
+  }
+  return Status::OK();
+}
+
+LogSegmentFetcher::LogSegmentFetcher(FsManager* fs_manager,
+                                     string tablet_id,
+                                     string source_uuid,
+                                     std::shared_ptr<ConsensusServiceProxy> proxy,
+                                     Options options)
+    : fs_manager_(DCHECK_NOTNULL(fs_manager)),
+      tablet_id_(std::move(tablet_id)),
+      source_uuid_(std::move(source_uuid)),
+      proxy_(std::move(proxy)),
+      options_(std::move(options)),
+      bytes_fetched_(0) {
+}
+
+Status LogSegmentFetcher::FetchAll() {
+  ListLogSegmentsRequestPB req;
+  req.set_dest_uuid(source_uuid_);
+  req.set_tablet_id(tablet_id_);
+  ListLogSegmentsResponsePB resp;
+  RpcController controller;
+  controller.set_timeout(options_.rpc_timeout);
+  RETURN_NOT_OK_PREPEND(StatusFromResponse(proxy_->ListLogSegments(req, &resp, &controller),
+                                           resp),
+                        "Unable to list the log segments of the source");
+
+  // The WAL may be striped over several directories. Create them up front
+  // rather than racing to do so from the streams.
+  for (const auto& segment : resp.segments()) {
+    RETURN_NOT_OK(env_util::CreateDirIfMissing(
+        fs_manager_->env(),
+        DirName(fs_manager_->GetWalSegmentFileName(tablet_id_, segment.sequence_number()))));
+  }
+
+  gscoped_ptr<ThreadPool> pool;
+  RETURN_NOT_OK(ThreadPoolBuilder("log-fetch")
+                .set_max_threads(std::max(options_.num_streams, 1))
+                .Build(&pool));
+  std::mutex status_lock;
+  Status first_error;
+  for (const auto& segment : resp.segments()) {
+    RETURN_NOT_OK(pool->SubmitFunc([&, segment]() {
+      Status s = FetchSegment(segment);
+      if (PREDICT_FALSE(!s.ok())) {
+        std::lock_guard<std::mutex> l(status_lock);
+        if (first_error.ok()) first_error = s;
+      }
+    }));
+  }
+  pool->Wait();
+  pool->Shutdown();
+  RETURN_NOT_OK(first_error);
+
+  LOG(INFO) << LogPrefix() << "Fetched " << resp.segments_size() << " log segments ("
+            << bytes_fetched() << " new bytes)";
+  return Status::OK();
+}
+
+Status LogSegmentFetcher::FetchSegment(const ListLogSegmentsResponsePB::SegmentPB& segment) {
+  Env* env = fs_manager_->env();
+  const string path = fs_manager_->GetWalSegmentFileName(tablet_id_, segment.sequence_number());
+
+  // Pick up where an earlier fetch stopped.
+  uint64_t local_size = 0;
+  WritableFileOptions opts;
+  opts.mode = Env::CREATE_IF_NON_EXISTING_TRUNCATE;
+  if (env->FileExists(path)) {
+    RETURN_NOT_OK(env->GetFileSize(path, &local_size));
+    if (local_size <= segment.size()) {
+      opts.mode = Env::OPEN_EXISTING;
+    } else {
+      local_size = 0;
+    }
+  }
+  if (local_size == segment.size() && opts.mode == Env::OPEN_EXISTING) {
+    return Status::OK();
+  }
+  unique_ptr<WritableFile> file;
+  RETURN_NOT_OK(env->NewWritableFile(opts, path, &file));
+
+  int64_t offset = local_size;
+  while (offset < segment.size()) {
+    FetchLogSegmentChunkRequestPB req;
+    req.set_dest_uuid(source_uuid_);
+    req.set_tablet_id(tablet_id_);
+    req.set_sequence_number(segment.sequence_number());
+    req.set_offset(offset);
+    req.set_max_length(std::min(options_.chunk_bytes, segment.size() - offset));
+    FetchLogSegmentChunkResponsePB resp;
+    RpcController controller;
+    controller.set_timeout(options_.rpc_timeout);
+    RETURN_NOT_OK_PREPEND(
+        StatusFromResponse(proxy_->FetchLogSegmentChunk(req, &resp, &controller), resp),
+        Substitute("Unable to fetch log segment $0 at offset $1",
+                   segment.sequence_number(), offset));
+
+    Slice chunk;
+    RETURN_NOT_OK(controller.GetInboundSidecar(resp.data_sidecar_idx(), &chunk));
+    if (PREDICT_FALSE(chunk.empty())) {
+      return Status::Incomplete(Substitute("Log segment $0 ended at offset $1, before the $2 "
+                                           "bytes it was listed with",
+                                           segment.sequence_number(), offset, segment.size()));
+    }
+    uint32_t crc = crc::Crc32c(chunk.data(), chunk.size());
+    if (PREDICT_FALSE(crc != resp.crc32())) {
+      return Status::Corruption(Substitute("Checksum mismatch in log segment $0 at offset $1: "
+                                           "expected $2, got $3",
+                                           segment.sequence_number(), offset,
+                                           resp.crc32(), crc));
+    }
+    RETURN_NOT_OK(file->Append(chunk));
+    offset += chunk.size();
+    bytes_fetched_.fetch_add(chunk.size(), std::memory_order_relaxed);
+  }
+  RETURN_NOT_OK(file->Sync());
+  return file->Close();
+}
+
+string LogSegmentFetcher::LogPrefix() const {
+  return Substitute("T $0 P $1: ", tablet_id_, fs_manager_->uuid());
+}
+
+} // namespace consensus
+} // namespace kudu
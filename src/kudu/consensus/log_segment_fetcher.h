@@ -0,0 +1,95 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class FsManager;
+
+namespace consensus {
+
+class ConsensusServiceProxy;
+
+// Copies the WAL segments of a tablet from a peer which runs with
+// --raft_enable_log_segment_streaming, so that a new or rebuilt replica starts
+// from a log close to the source's instead of having every op replayed to it
+// through UpdateConsensus().
+//
+// Segments are fetched in large chunks, several segments at a time, and every
+// chunk is checked against the CRC32C the source computed before it is
+// written. A copy that fails part way can be resumed: whatever was already
+// written is kept, and fetching continues from the end of it.
+//
+// This only copies the log. A state machine which keeps its own data outside
+// of the log is responsible for copying a snapshot of that.
+class LogSegmentFetcher {
+ public:
+  struct Options {
+    // The number of segments fetched concurrently.
+    int num_streams = 4;
+
+    // The most bytes asked for per FetchLogSegmentChunk() call.
+    int64_t chunk_bytes = 8 * 1024 * 1024;
+
+    MonoDelta rpc_timeout = MonoDelta::FromSeconds(30);
+  };
+
+  LogSegmentFetcher(FsManager* fs_manager,
+                    std::string tablet_id,
+                    std::string source_uuid,
+                    std::shared_ptr<ConsensusServiceProxy> proxy,
+                    Options options);
+
+  // Fetches every segment which the source currently has into this server's
+  // WAL directory for the tablet, up to the size it had when listed. The WAL
+  // must not be open while this runs.
+  Status FetchAll();
+
+  // The number of bytes written by this fetcher so far.
+  int64_t bytes_fetched() const {
+    return bytes_fetched_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Fetches 'segment', resuming from the end of the local copy if there is one.
+  Status FetchSegment(const ListLogSegmentsResponsePB::SegmentPB& segment);
+
+  std::string LogPrefix() const;
+
+  FsManager* const fs_manager_;
+  const std::string tablet_id_;
+  const std::string source_uuid_;
+  const std::shared_ptr<ConsensusServiceProxy> proxy_;
+  const Options options_;
+
+  std::atomic<int64_t> bytes_fetched_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogSegmentFetcher);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,117 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "kudu/consensus/log_sync_group.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/env.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+namespace kudu {
+namespace log {
+
+using std::atomic;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+// A group whose syncs take a while and return 'status', rather than syncing
+// any filesystem.
+class SlowSyncGroup : public LogSyncGroup {
+ public:
+  explicit SlowSyncGroup(Status status = Status::OK())
+      : LogSyncGroup(Env::Default(), {}),
+        status_(std::move(status)) {
+  }
+
+ protected:
+  Status SyncFileSystems() override {
+    SleepFor(MonoDelta::FromMilliseconds(10));
+    return status_;
+  }
+
+ private:
+  const Status status_;
+};
+
+class LogSyncGroupTest : public KuduTest {};
+
+TEST_F(LogSyncGroupTest, TestSyncsFileSystem) {
+  const string path = JoinPathSegments(GetTestDataDirectory(), "segment");
+  unique_ptr<WritableFile> file;
+  ASSERT_OK(env_->NewWritableFile(path, &file));
+  ASSERT_OK(file->Append("data"));
+
+  LogSyncGroup group(env_, { GetTestDataDirectory() });
+  ASSERT_OK(group.Sync());
+  ASSERT_EQ(1, group.num_syncs());
+  ASSERT_OK(file->Close());
+}
+
+// Tests that the callers which sync while a sync is in progress wait for the
+// next one, which they share.
+TEST_F(LogSyncGroupTest, TestConcurrentCallersShareSyncs) {
+  const int kNumThreads = 16;
+  const int kSyncsPerThread = 5;
+  SlowSyncGroup group;
+  atomic<int> num_failed(0);
+  vector<thread> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < kSyncsPerThread; j++) {
+        if (!group.Sync().ok()) {
+          num_failed++;
+        }
+      }
+    });
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(0, num_failed);
+  // Each caller waits for at most two syncs, the one in progress and the
+  // next, so the callers of each round share a sync.
+  ASSERT_GE(group.num_syncs(), kSyncsPerThread);
+  ASSERT_LT(group.num_syncs(), kNumThreads * kSyncsPerThread / 2);
+}
+
+TEST_F(LogSyncGroupTest, TestErrorsAreSticky) {
+  SlowSyncGroup group(Status::IOError("injected"));
+  Status s = group.Sync();
+  ASSERT_TRUE(s.IsIOError()) << s.ToString();
+  s = group.Sync();
+  ASSERT_TRUE(s.IsIOError()) << s.ToString();
+  ASSERT_EQ(1, group.num_syncs());
+}
+
+} // namespace log
+} // namespace kudu
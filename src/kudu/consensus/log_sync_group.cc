@@ -0,0 +1,76 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "kudu/consensus/log_sync_group.h"
+
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/port.h"
+#include "kudu/util/env.h"
+
+namespace kudu {
+namespace log {
+
+LogSyncGroup::LogSyncGroup(Env* env, std::vector<std::string> paths)
+    : env_(env),
+      paths_(std::move(paths)),
+      sync_done_(&lock_) {
+}
+
+Status LogSyncGroup::Sync() {
+  MutexLock l(lock_);
+  // A sync in progress may have started before the caller's writes, so only
+  // the one after it is sure to cover them.
+  const int64_t target = syncs_started_ + 1;
+  while (syncs_finished_ < target && error_.ok()) {
+    if (sync_in_progress_) {
+      sync_done_.Wait();
+      continue;
+    }
+    sync_in_progress_ = true;
+    syncs_started_++;
+    l.Unlock();
+    Status s = SyncFileSystems();
+    l.Lock();
+    sync_in_progress_ = false;
+    syncs_finished_ = syncs_started_;
+    if (PREDICT_FALSE(!s.ok())) {
+      LOG(ERROR) << "Error syncing the WAL filesystems: " << s.ToString();
+      error_ = s.CloneAndPrepend("Shared log sync failed");
+    }
+    sync_done_.Broadcast();
+  }
+  return error_;
+}
+
+int64_t LogSyncGroup::num_syncs() const {
+  MutexLock l(lock_);
+  return syncs_finished_;
+}
+
+Status LogSyncGroup::SyncFileSystems() {
+  for (const std::string& path : paths_) {
+    RETURN_NOT_OK(env_->SyncFileSystem(path));
+  }
+  return Status::OK();
+}
+
+} // namespace log
+} // namespace kudu
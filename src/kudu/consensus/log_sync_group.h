@@ -0,0 +1,85 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+class Env;
+
+namespace log {
+
+// Makes the writes of many logs on the same filesystem durable together, with
+// a single syncfs(2) of each filesystem for all of them, rather than an fsync
+// of each log's segment. Shared by the logs of the tablets hosted by a server, so that the
+// device sees one flush per group commit however many tablets there are. See
+// --log_shared_sync.
+//
+// A log which belongs to a group calls Sync() in place of syncing its active
+// segment. If no sync is in progress, the caller syncs the filesystems. The
+// logs which call Sync() while one is in progress wait for it to finish, and
+// then one of them syncs the filesystems for all of them. Any writes made to
+// the filesystems before a sync starts are durable once it's done.
+//
+// A failed sync fails every later Sync(), since the failed writes may have
+// been dropped from the page cache and later syncs wouldn't cover them.
+class LogSyncGroup {
+ public:
+  // Syncs the filesystems which 'paths', the WAL roots, are on through 'env',
+  // which must outlive the group.
+  LogSyncGroup(Env* env, std::vector<std::string> paths);
+  virtual ~LogSyncGroup() = default;
+
+  // Returns once the writes to the filesystems which were made before the
+  // call are durable.
+  Status Sync();
+
+  // Returns the number of syncs of the filesystems done so far.
+  int64_t num_syncs() const;
+
+ protected:
+  // Syncs the filesystems. Overridden by tests.
+  virtual Status SyncFileSystems();
+
+ private:
+  Env* const env_;
+  const std::vector<std::string> paths_;
+
+  mutable Mutex lock_;
+  ConditionVariable sync_done_;
+
+  // The number of syncs started and finished, and whether one is in
+  // progress. Protected by 'lock_'.
+  int64_t syncs_started_ = 0;
+  int64_t syncs_finished_ = 0;
+  bool sync_in_progress_ = false;
+
+  // The error of the first sync which failed. Protected by 'lock_'.
+  Status error_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogSyncGroup);
+};
+
+} // namespace log
+} // namespace kudu
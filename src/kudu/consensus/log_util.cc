@@ -18,8 +18,10 @@
 #include "kudu/consensus/log_util.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <iostream>
+#include <iterator>
 #include <memory>
 
 #include <gflags/gflags.h>
@@ -42,7 +44,9 @@
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/env_util.h"
 #include "kudu/util/fault_injection.h"
+#include "kudu/util/file_cache.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/group_varint-inl.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/pb_util.h"
 
@@ -62,6 +66,28 @@ DEFINE_bool(log_async_preallocate_segments, true,
             "Whether the WAL segments preallocation should happen asynchronously");
 TAG_FLAG(log_async_preallocate_segments, advanced);
 
+DEFINE_int32(log_sparse_index_interval, 64,
+             "Minimum number of REPLICATE indexes between consecutive samples of "
+             "the sparse index persisted in WAL segment footers. Lower values "
+             "make lookups that miss the log index cheaper at the cost of "
+             "larger footers. 0 disables the sparse index.");
+TAG_FLAG(log_sparse_index_interval, advanced);
+
+DEFINE_bool(log_mmap_closed_segments, false,
+            "Whether to memory-map closed WAL segments and read entries "
+            "directly from the mapping. This saves a system call and a copy "
+            "per batch when peers or bootstrap read from the WAL, at the cost "
+            "of I/O errors on those segments crashing the process with SIGBUS "
+            "rather than being reported as errors.");
+TAG_FLAG(log_mmap_closed_segments, experimental);
+
+DEFINE_int32(log_segment_file_cache_capacity, 0,
+             "If positive, WAL segments are opened for reading through a file "
+             "cache shared by all the tablets of the process, which keeps at most "
+             "this many segment files open at a time and reopens evicted ones on "
+             "their next read. If 0, each readable segment keeps its own file open.");
+TAG_FLAG(log_segment_file_cache_capacity, experimental);
+
 DEFINE_double(fault_crash_before_write_log_segment_header, 0.0,
               "Fraction of the time we will crash just before writing the log segment header");
 TAG_FLAG(fault_crash_before_write_log_segment_header, unsafe);
@@ -77,6 +103,49 @@ using strings::SubstituteAndAppend;
 namespace kudu {
 namespace log {
 
+namespace {
+
+// The cache of segment files, once something was opened through it.
+std::atomic<FileCache<RandomAccessFile>*> g_segment_file_cache(nullptr);
+
+FileCache<RandomAccessFile>* CreateSegmentFileCache() {
+  auto* cache = new FileCache<RandomAccessFile>(
+      "wal-segments", Env::Default(), FLAGS_log_segment_file_cache_capacity, nullptr);
+  CHECK_OK(cache->Init());
+  g_segment_file_cache.store(cache);
+  return cache;
+}
+
+// Returns the cache to open the segment files of 'env' through, or nullptr
+// if they're opened directly. The cache is process-wide, so it is only used
+// for the default Env.
+FileCache<RandomAccessFile>* SegmentFileCache(Env* env) {
+  if (FLAGS_log_segment_file_cache_capacity <= 0 || env != Env::Default()) {
+    return nullptr;
+  }
+  static FileCache<RandomAccessFile>* cache = CreateSegmentFileCache();
+  return cache;
+}
+
+} // anonymous namespace
+
+Status OpenLogSegmentFileForRandom(Env* env, const string& path,
+                                   shared_ptr<RandomAccessFile>* file) {
+  FileCache<RandomAccessFile>* cache = SegmentFileCache(env);
+  if (cache) {
+    return cache->OpenExistingFile(path, file);
+  }
+  return env_util::OpenFileForRandom(env, path, file);
+}
+
+Status DeleteLogSegmentFile(Env* env, const string& path) {
+  FileCache<RandomAccessFile>* cache = SegmentFileCache(env);
+  if (cache) {
+    return cache->DeleteFile(path);
+  }
+  return env->DeleteFile(path);
+}
+
 const char kLogSegmentHeaderMagicString[] = "kudulogf";
 
 // A magic that is written as the very last thing when a segment is closed.
@@ -102,7 +171,9 @@ LogOptions::LogOptions()
 : segment_size_mb(FLAGS_log_segment_size_mb),
   force_fsync_all(FLAGS_log_force_fsync_all),
   preallocate_segments(FLAGS_log_preallocate_segments),
-  async_preallocate_segments(FLAGS_log_async_preallocate_segments) {
+  async_preallocate_segments(FLAGS_log_async_preallocate_segments),
+  append_pool(nullptr),
+  sync_group(nullptr) {
 }
 
 ////////////////////////////////////////////////////////////
@@ -125,6 +196,7 @@ LogEntryReader::LogEntryReader(ReadableLogSegment* seg)
   VLOG(1) << "Reading segment entries from "
           << seg_->path_ << ": offset=" << offset_ << " file_size="
           << seg_->file_size() << " readable_to_offset=" << readable_to_offset;
+  seg_->AdviseSequentialReads();
 }
 
 LogEntryReader::~LogEntryReader() {}
@@ -258,6 +330,107 @@ Status LogEntryReader::MakeCorruptionStatus(const Status& status) const {
   return status.CloneAndAppend(err);
 }
 
+////////////////////////////////////////////////////////////
+// SegmentSparseIndex
+////////////////////////////////////////////////////////////
+
+SegmentSparseIndex::SegmentSparseIndex()
+    : last_index_(-1) {
+}
+
+void SegmentSparseIndex::AddBatch(int64_t first_index, int64_t last_index, int64_t offset) {
+  DCHECK_LE(first_index, last_index);
+  DCHECK(samples_.empty() || offset > samples_.back().second);
+  if (FLAGS_log_sparse_index_interval <= 0) {
+    return;
+  }
+  if (first_index <= last_index_) {
+    // The log was truncated: this batch replaces earlier copies of its
+    // indexes, so forget their samples and always sample this batch.
+    while (!samples_.empty() && samples_.back().first >= first_index) {
+      samples_.pop_back();
+    }
+    samples_.emplace_back(first_index, offset);
+  } else if (samples_.empty() ||
+             first_index - samples_.back().first >= FLAGS_log_sparse_index_interval) {
+    samples_.emplace_back(first_index, offset);
+  }
+  last_index_ = last_index;
+}
+
+void SegmentSparseIndex::Clear() {
+  samples_.clear();
+  last_index_ = -1;
+}
+
+void SegmentSparseIndex::EncodeTo(string* dst) const {
+  faststring buf;
+  PutVarint64(&buf, samples_.size());
+  if (!samples_.empty()) {
+    PutVarint64(&buf, samples_[0].first);
+    PutVarint64(&buf, samples_[0].second);
+  }
+  for (size_t i = 1; i < samples_.size(); i += 2) {
+    // Segments are far smaller than 4GB, so deltas always fit in 32 bits.
+    uint32_t deltas[4] = { 0, 0, 0, 0 };
+    for (size_t j = 0; j < 2 && i + j < samples_.size(); j++) {
+      deltas[2 * j] = samples_[i + j].first - samples_[i + j - 1].first;
+      deltas[2 * j + 1] = samples_[i + j].second - samples_[i + j - 1].second;
+    }
+    coding::AppendGroupVarInt32(&buf, deltas[0], deltas[1], deltas[2], deltas[3]);
+  }
+  dst->assign(reinterpret_cast<const char*>(buf.data()), buf.size());
+}
+
+Status SegmentSparseIndex::DecodeFrom(const Slice& data) {
+  Clear();
+  Slice input = data;
+  uint64_t count;
+  if (!GetVarint64(&input, &count)) {
+    return Status::Corruption("could not decode sparse index size");
+  }
+  if (count == 0) {
+    return Status::OK();
+  }
+  uint64_t index;
+  uint64_t offset;
+  if (!GetVarint64(&input, &index) || !GetVarint64(&input, &offset)) {
+    return Status::Corruption("could not decode first sparse index sample");
+  }
+  vector<std::pair<int64_t, int64_t>> samples;
+  samples.reserve(count);
+  samples.emplace_back(index, offset);
+  while (samples.size() < count) {
+    if (input.empty() ||
+        input.size() < coding::DecodeGroupVarInt32_GetGroupSize(input.data())) {
+      return Status::Corruption(Substitute("sparse index truncated after $0 of $1 samples",
+                                           samples.size(), count));
+    }
+    uint32_t deltas[4];
+    const uint8_t* next = coding::DecodeGroupVarInt32_SlowButSafe(
+        input.data(), &deltas[0], &deltas[1], &deltas[2], &deltas[3]);
+    input.remove_prefix(next - input.data());
+    for (int j = 0; j < 2 && samples.size() < count; j++) {
+      samples.emplace_back(samples.back().first + deltas[2 * j],
+                           samples.back().second + deltas[2 * j + 1]);
+    }
+  }
+  samples_.swap(samples);
+  last_index_ = samples_.back().first;
+  return Status::OK();
+}
+
+int64_t SegmentSparseIndex::FindScanStart(int64_t index) const {
+  auto it = std::upper_bound(samples_.begin(), samples_.end(), index,
+                             [](int64_t i, const std::pair<int64_t, int64_t>& sample) {
+                               return i < sample.first;
+                             });
+  if (it == samples_.begin()) {
+    return -1;
+  }
+  return std::prev(it)->second;
+}
+
 ////////////////////////////////////////////////////////////
 // ReadableLogSegment
 ////////////////////////////////////////////////////////////
@@ -267,11 +440,13 @@ Status ReadableLogSegment::Open(Env* env,
                                 scoped_refptr<ReadableLogSegment>* segment) {
   VLOG(1) << "Parsing wal segment: " << path;
   shared_ptr<RandomAccessFile> readable_file;
-  RETURN_NOT_OK_PREPEND(env_util::OpenFileForRandom(env, path, &readable_file),
+  RETURN_NOT_OK_PREPEND(OpenLogSegmentFileForRandom(env, path, &readable_file),
                         "Unable to open file for reading");
 
   segment->reset(new ReadableLogSegment(path, readable_file));
   RETURN_NOT_OK_PREPEND((*segment)->Init(), "Unable to initialize segment");
+  WARN_NOT_OK((*segment)->MaybeMapClosedSegment(env),
+              Substitute("Could not map log segment $0, reading it with pread()", path));
   return Status::OK();
 }
 
@@ -281,7 +456,10 @@ ReadableLogSegment::ReadableLogSegment(
       file_size_(0),
       readable_to_offset_(0),
       readable_file_(std::move(readable_file)),
+      advised_sequential_(false),
+      dropped_from_page_cache_(false),
       codec_(nullptr),
+      entry_header_fence_(0),
       is_initialized_(false),
       footer_was_rebuilt_(false) {}
 
@@ -296,6 +474,7 @@ Status ReadableLogSegment::Init(const LogSegmentHeaderPB& header,
 
   header_.CopyFrom(header);
   RETURN_NOT_OK(InitCompressionCodec());
+  entry_header_fence_ = EntryHeaderFence(header_);
 
   footer_.CopyFrom(footer);
   first_entry_offset_ = first_entry_offset;
@@ -315,6 +494,7 @@ Status ReadableLogSegment::Init(const LogSegmentHeaderPB& header,
   header_.CopyFrom(header);
   first_entry_offset_ = first_entry_offset;
   RETURN_NOT_OK(InitCompressionCodec());
+  entry_header_fence_ = EntryHeaderFence(header_);
   is_initialized_ = true;
 
   // On a new segment, we don't expect any readable entries yet.
@@ -330,6 +510,7 @@ Status ReadableLogSegment::Init() {
 
   RETURN_NOT_OK(ReadHeader());
   RETURN_NOT_OK(InitCompressionCodec());
+  entry_header_fence_ = EntryHeaderFence(header_);
 
   Status s = ReadFooter();
   if (!s.ok()) {
@@ -368,6 +549,65 @@ void ReadableLogSegment::UpdateReadableToOffset(int64_t readable_to_offset) {
   file_size_.StoreMax(readable_to_offset);
 }
 
+Status ReadableLogSegment::MaybeMapClosedSegment(Env* env) {
+  DCHECK(IsInitialized());
+  if (!FLAGS_log_mmap_closed_segments || !HasFooter() || footer_was_rebuilt_) {
+    return Status::OK();
+  }
+  DCHECK(!mapped_file_);
+  return env->NewMemoryMappedFile(path_, &mapped_file_);
+}
+
+void ReadableLogSegment::AdviseSequentialReads() const {
+  if (mapped_file_ && !advised_sequential_.Exchange(true)) {
+    WARN_NOT_OK(mapped_file_->Advise(MemoryMappedFile::SEQUENTIAL),
+                Substitute("Could not advise sequential reads of $0", path_));
+  }
+}
+
+bool ReadableLogSegment::ReadFromMapping(int64_t offset, size_t length, Slice* result) const {
+  if (!mapped_file_ || offset < 0 || offset + length > mapped_file_->size()) {
+    return false;
+  }
+  *result = Slice(mapped_file_->data() + offset, length);
+  return true;
+}
+
+Status ReadableLogSegment::FindReplicateBatch(int64_t index, int64_t min_offset,
+                                              faststring* tmp_buf,
+                                              int64_t* offset,
+                                              OpId* op_id) {
+  if (!HasFooter() || !footer_.has_sparse_index() ||
+      index < footer_.min_replicate_index() || index > footer_.max_replicate_index()) {
+    return Status::NotFound(Substitute("index $0 not in sparse index of $1", index, path_));
+  }
+  SegmentSparseIndex sparse_index;
+  RETURN_NOT_OK_PREPEND(sparse_index.DecodeFrom(footer_.sparse_index()),
+                        Substitute("Could not decode sparse index of $0", path_));
+  int64_t cur_offset = std::max(sparse_index.FindScanStart(index), min_offset);
+  if (cur_offset <= 0) {
+    return Status::NotFound(Substitute("index $0 not in sparse index of $1", index, path_));
+  }
+
+  const int64_t read_up_to =
+      file_size() - footer_.ByteSize() - kLogSegmentFooterMagicAndFooterLength;
+  unique_ptr<LogEntryBatchPB> batch;
+  while (cur_offset < read_up_to) {
+    int64_t batch_offset = cur_offset;
+    EntryHeaderStatus unused_status_detail;
+    RETURN_NOT_OK(ReadEntryHeaderAndBatch(&cur_offset, tmp_buf, &batch,
+                                          &unused_status_detail));
+    for (const LogEntryPB& entry : batch->entry()) {
+      if (entry.has_replicate() && entry.replicate().id().index() == index) {
+        *offset = batch_offset;
+        *op_id = entry.replicate().id();
+        return Status::OK();
+      }
+    }
+  }
+  return Status::NotFound(Substitute("index $0 not found in $1", index, path_));
+}
+
 Status ReadableLogSegment::RebuildFooterByScanning() {
   TRACE_EVENT1("log", "ReadableLogSegment::RebuildFooterByScanning",
                "path", path_);
@@ -441,9 +681,11 @@ Status ReadableLogSegment::ReadHeader() {
                                                 header_size),
                         "Unable to parse protobuf");
 
-  if (header.incompatible_features_size() > 0) {
-    return Status::NotSupported("log segment uses a feature not supported by this version "
-                                "of Kudu");
+  for (int feature : header.incompatible_features()) {
+    if (feature != LogSegmentHeaderPB::FENCED_ENTRY_HEADERS) {
+      return Status::NotSupported("log segment uses a feature not supported by this version "
+                                  "of Kudu");
+    }
   }
 
   header_.Swap(&header);
@@ -642,8 +884,10 @@ Status ReadableLogSegment::ReadEntryHeader(int64_t *offset, EntryHeader* header,
   const size_t header_size = entry_header_size();
   uint8_t scratch[header_size];
   Slice slice(scratch, header_size);
-  RETURN_NOT_OK_PREPEND(readable_file()->Read(*offset, slice),
-                        "Could not read log entry header");
+  if (!ReadFromMapping(*offset, header_size, &slice)) {
+    RETURN_NOT_OK_PREPEND(readable_file()->Read(*offset, slice),
+                          "Could not read log entry header");
+  }
 
   *status_detail = DecodeEntryHeader(slice, header);
   switch (*status_detail) {
@@ -670,7 +914,7 @@ EntryHeaderStatus ReadableLogSegment::DecodeEntryHeader(
     header->msg_length = DecodeFixed32(&data[4]);
     header->msg_crc    = DecodeFixed32(&data[8]);
     header->header_crc = DecodeFixed32(&data[12]);
-    computed_header_crc = crc::Crc32c(&data[0], 12);
+    computed_header_crc = crc::Crc32c(&data[0], 12) ^ entry_header_fence_;
   } else {
     DCHECK_EQ(kEntryHeaderSizeV1, data.size());
     header->msg_length = DecodeFixed32(&data[0]);
@@ -695,65 +939,119 @@ Status ReadableLogSegment::ReadEntryBatch(int64_t* offset,
                                           const EntryHeader& header,
                                           faststring* tmp_buf,
                                           unique_ptr<LogEntryBatchPB>* entry_batch) {
+  Slice entry_batch_slice;
+  RETURN_NOT_OK(ReadEntryBatchData(*offset, header, tmp_buf, &entry_batch_slice));
+
+  unique_ptr<LogEntryBatchPB> read_entry_batch(new LogEntryBatchPB);
+  Status s = pb_util::ParseFromArray(read_entry_batch.get(),
+                              entry_batch_slice.data(),
+                              header.msg_length);
+
+  if (!s.ok()) {
+    return Status::Corruption(Substitute("Could not parse PB. Cause: $0", s.ToString()));
+  }
+
+  *offset += header.msg_length_compressed;
+  entry_batch->reset(read_entry_batch.release());
+  return Status::OK();
+}
+
+Status ReadableLogSegment::ReadEntryBatchPayload(int64_t* offset, faststring* tmp_buf,
+                                                 Slice* payload) {
+  int64_t cur_offset = *offset;
+  EntryHeader header;
+  EntryHeaderStatus unused_status_detail;
+  RETURN_NOT_OK(ReadEntryHeader(&cur_offset, &header, &unused_status_detail));
+  RETURN_NOT_OK(ReadEntryBatchData(cur_offset, header, tmp_buf, payload));
+  *offset = cur_offset + header.msg_length_compressed;
+  return Status::OK();
+}
+
+ReadableLogSegment::~ReadableLogSegment() {
+  // Don't keep the file open in the cache once nothing reads it: it may be
+  // about to be deleted, and another file may later be created at its path.
+  FileCache<RandomAccessFile>* cache = g_segment_file_cache.load();
+  if (cache) {
+    cache->Evict(path_);
+  }
+}
+
+void ReadableLogSegment::DropFromPageCache() const {
+  if (dropped_from_page_cache_.Exchange(true)) {
+    return;
+  }
+  WARN_NOT_OK(readable_file_->DropFromPageCache(0, 0),
+              Substitute("Could not drop log segment $0 from the page cache", path_));
+}
+
+void ReadableLogSegment::ReadAhead(int64_t offset, int64_t length) const {
+  if (mapped_file_ || length <= 0) {
+    // Mapped segments are already advised for sequential reads.
+    return;
+  }
+  WARN_NOT_OK(readable_file_->ReadAhead(offset, length),
+              Substitute("Could not read ahead in log segment $0", path_));
+}
+
+Status ReadableLogSegment::ReadEntryBatchData(int64_t offset,
+                                              const EntryHeader& header,
+                                              faststring* tmp_buf,
+                                              Slice* data) {
   TRACE_EVENT2("log", "ReadableLogSegment::ReadEntryBatch",
                "path", path_,
                "range", Substitute("offset=$0 entry_len=$1",
-                                   *offset, header.msg_length));
+                                   offset, header.msg_length));
 
   if (header.msg_length == 0) {
     return Status::Corruption("Invalid 0 entry length");
   }
   int64_t limit = readable_up_to();
-  if (PREDICT_FALSE(header.msg_length_compressed + *offset > limit)) {
+  if (PREDICT_FALSE(header.msg_length_compressed + offset > limit)) {
     // The log was likely truncated during writing.
     return Status::Corruption(
         Substitute("Could not read $0-byte log entry from offset $1 in $2: "
                    "log only readable up to offset $3",
-                   header.msg_length_compressed, *offset, path_, limit));
+                   header.msg_length_compressed, offset, path_, limit));
   }
 
   tmp_buf->clear();
-  size_t buf_len = header.msg_length_compressed;
+  Slice entry_batch_slice;
+  // Mapped segments are read in place, so 'tmp_buf' only needs to hold the
+  // decompressed copy, if any.
+  bool mapped = ReadFromMapping(offset, header.msg_length_compressed, &entry_batch_slice);
+  size_t uncompress_buf_offset = mapped ? 0 : header.msg_length_compressed;
+  size_t buf_len = uncompress_buf_offset;
   if (codec_) {
     // Reserve some space for the decompressed copy as well.
     buf_len += header.msg_length;
   }
   tmp_buf->resize(buf_len);
-  Slice entry_batch_slice(tmp_buf->data(), header.msg_length_compressed);
-  Status s =  readable_file()->Read(*offset, entry_batch_slice);
-
-  if (!s.ok()) return Status::IOError(Substitute("Could not read entry. Cause: $0",
-                                                 s.ToString()));
+  if (!mapped) {
+    entry_batch_slice = Slice(tmp_buf->data(), header.msg_length_compressed);
+    Status s = readable_file()->Read(offset, entry_batch_slice);
+    if (!s.ok()) return Status::IOError(Substitute("Could not read entry. Cause: $0",
+                                                   s.ToString()));
+  }
 
   // Verify the CRC.
   uint32_t read_crc = crc::Crc32c(entry_batch_slice.data(), entry_batch_slice.size());
   if (PREDICT_FALSE(read_crc != header.msg_crc)) {
     return Status::Corruption(Substitute("Entry CRC mismatch in byte range $0-$1: "
                                          "expected CRC=$2, computed=$3",
-                                         *offset, *offset + header.msg_length,
+                                         offset, offset + header.msg_length,
                                          header.msg_crc, read_crc));
   }
 
   // If it was compressed, decompress it.
   if (codec_) {
     // We pre-reserved space for the decompression up above.
-    uint8_t* uncompress_buf = &(*tmp_buf)[header.msg_length_compressed];
+    uint8_t* uncompress_buf = &(*tmp_buf)[uncompress_buf_offset];
     RETURN_NOT_OK_PREPEND(codec_->Uncompress(entry_batch_slice, uncompress_buf, header.msg_length),
                           "failed to uncompress entry");
     entry_batch_slice = Slice(uncompress_buf, header.msg_length);
   }
 
-  unique_ptr<LogEntryBatchPB> read_entry_batch(new LogEntryBatchPB);
-  s = pb_util::ParseFromArray(read_entry_batch.get(),
-                              entry_batch_slice.data(),
-                              header.msg_length);
-
-  if (!s.ok()) {
-    return Status::Corruption(Substitute("Could not parse PB. Cause: $0", s.ToString()));
-  }
-
-  *offset += header.msg_length_compressed;
-  entry_batch->reset(read_entry_batch.release());
+  *data = entry_batch_slice;
   return Status::OK();
 }
 
@@ -763,7 +1061,8 @@ WritableLogSegment::WritableLogSegment(string path,
       writable_file_(std::move(writable_file)),
       is_header_written_(false),
       is_footer_written_(false),
-      written_offset_(0) {}
+      written_offset_(0),
+      entry_header_fence_(0) {}
 
 Status WritableLogSegment::WriteHeaderAndOpen(const LogSegmentHeaderPB& new_header) {
   MAYBE_FAULT(FLAGS_fault_crash_before_write_log_segment_header);
@@ -782,6 +1081,7 @@ Status WritableLogSegment::WriteHeaderAndOpen(const LogSegmentHeaderPB& new_head
   RETURN_NOT_OK(writable_file()->Append(Slice(buf)));
 
   header_.CopyFrom(new_header);
+  entry_header_fence_ = EntryHeaderFence(header_);
   first_entry_offset_ = buf.size();
   written_offset_ = first_entry_offset_;
   is_header_written_ = true;
@@ -813,6 +1113,22 @@ Status WritableLogSegment::WriteFooterAndClose(const LogSegmentFooterPB& footer)
   return Status::OK();
 }
 
+namespace {
+
+// Fills in the entry header in 'header_buf' for the (possibly compressed)
+// payload 'data_to_write', whose uncompressed size is 'uncompressed_len'.
+// The header CRC is XORed with 'fence', see EntryHeaderFence().
+void EncodeEntryHeader(const Slice& data_to_write, uint32_t uncompressed_len,
+                       uint32_t fence, uint8_t* header_buf) {
+  InlineEncodeFixed32(&header_buf[0], data_to_write.size());
+  InlineEncodeFixed32(&header_buf[4], uncompressed_len);
+  InlineEncodeFixed32(&header_buf[8], crc::Crc32c(data_to_write.data(), data_to_write.size()));
+  InlineEncodeFixed32(&header_buf[12],
+                      crc::Crc32c(&header_buf[0], kEntryHeaderSizeV2 - 4) ^ fence);
+}
+
+} // anonymous namespace
+
 Status WritableLogSegment::WriteEntryBatch(const Slice& data,
                                            const CompressionCodec* codec) {
   DCHECK(is_header_written_);
@@ -835,10 +1151,7 @@ Status WritableLogSegment::WriteEntryBatch(const Slice& data,
   }
 
   // Fill in the header.
-  InlineEncodeFixed32(&header_buf[0], data_to_write.size());
-  InlineEncodeFixed32(&header_buf[4], uncompressed_len);
-  InlineEncodeFixed32(&header_buf[8], crc::Crc32c(data_to_write.data(), data_to_write.size()));
-  InlineEncodeFixed32(&header_buf[12], crc::Crc32c(&header_buf[0], kEntryHeaderSizeV2 - 4));
+  EncodeEntryHeader(data_to_write, uncompressed_len, entry_header_fence_, header_buf);
 
   // Write the header to the file, followed by the batch data itself.
   Slice slices[2] = {
@@ -849,6 +1162,46 @@ Status WritableLogSegment::WriteEntryBatch(const Slice& data,
   return Status::OK();
 }
 
+Status WritableLogSegment::WriteEncodedEntryBatch(const Slice& encoded) {
+  DCHECK(is_header_written_);
+  DCHECK(!is_footer_written_);
+  DCHECK_GT(encoded.size(), kEntryHeaderSizeV2);
+  if (entry_header_fence_ == 0) {
+    RETURN_NOT_OK(writable_file_->Append(encoded));
+  } else {
+    // The batch was encoded without knowing which segment it would be
+    // written to. Fence a copy of its header for this one.
+    uint8_t header_buf[kEntryHeaderSizeV2];
+    memcpy(header_buf, encoded.data(), kEntryHeaderSizeV2);
+    InlineEncodeFixed32(&header_buf[12], DecodeFixed32(&header_buf[12]) ^ entry_header_fence_);
+    Slice slices[2] = {
+      Slice(header_buf, arraysize(header_buf)),
+      Slice(encoded.data() + kEntryHeaderSizeV2, encoded.size() - kEntryHeaderSizeV2) };
+    RETURN_NOT_OK(writable_file_->AppendV(slices));
+  }
+  written_offset_ += encoded.size();
+  return Status::OK();
+}
+
+Status WritableLogSegment::EncodeEntryBatch(const Slice& data,
+                                            const CompressionCodec* codec,
+                                            faststring* encoded) {
+  const uint32_t uncompressed_len = data.size();
+  size_t payload_len;
+  if (codec) {
+    encoded->resize(kEntryHeaderSizeV2 + codec->MaxCompressedLength(uncompressed_len));
+    RETURN_NOT_OK(codec->Compress(data, encoded->data() + kEntryHeaderSizeV2, &payload_len));
+    encoded->resize(kEntryHeaderSizeV2 + payload_len);
+  } else {
+    payload_len = uncompressed_len;
+    encoded->resize(kEntryHeaderSizeV2 + payload_len);
+    memcpy(encoded->data() + kEntryHeaderSizeV2, data.data(), payload_len);
+  }
+  EncodeEntryHeader(Slice(encoded->data() + kEntryHeaderSizeV2, payload_len),
+                    uncompressed_len, 0, encoded->data());
+  return Status::OK();
+}
+
 
 unique_ptr<LogEntryBatchPB> CreateBatchFromAllocatedOperations(
     const vector<consensus::ReplicateRefPtr>& msgs) {
@@ -857,11 +1210,25 @@ unique_ptr<LogEntryBatchPB> CreateBatchFromAllocatedOperations(
   for (const auto& msg : msgs) {
     LogEntryPB* entry_pb = entry_batch->add_entry();
     entry_pb->set_type(log::REPLICATE);
-    entry_pb->set_allocated_replicate(msg->get());
+    // The message may be on the arena of the request it came in with, and
+    // set_allocated_replicate() would copy it onto the heap.
+    entry_pb->unsafe_arena_set_allocated_replicate(msg->get());
   }
   return entry_batch;
 }
 
+uint32_t EntryHeaderFence(const LogSegmentHeaderPB& header) {
+  for (int feature : header.incompatible_features()) {
+    if (feature == LogSegmentHeaderPB::FENCED_ENTRY_HEADERS) {
+      uint8_t buf[sizeof(uint64_t)];
+      InlineEncodeFixed64(buf, header.sequence_number());
+      // Never 0, so that a fenced segment cannot accept unfenced entries.
+      return crc::Crc32c(buf, sizeof(buf)) | 1;
+    }
+  }
+  return 0;
+}
+
 bool IsLogFileName(const string& fname) {
   if (HasPrefixString(fname, ".")) {
     // Hidden file or ./..
@@ -23,6 +23,7 @@
 #include <deque>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <gflags/gflags_declare.h>
@@ -39,6 +40,7 @@
 #include "kudu/util/faststring.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
+#include "kudu/util/status_callback.h"
 
 // Used by other classes, now part of the API.
 DECLARE_bool(log_force_fsync_all);
@@ -46,15 +48,20 @@ DECLARE_bool(log_force_fsync_all);
 namespace kudu {
 
 class CompressionCodec;
+class ThreadPool;
 
 namespace log {
 
 class LogFactory;
+class LogSyncGroup;
 
 // Each log entry is prefixed by a header. See DecodeEntryHeader()
 // implementation for details.
 extern const size_t kEntryHeaderSizeV2;
 
+// A closed segment ends with the footer magic and the footer length.
+extern const size_t kLogSegmentFooterMagicAndFooterLength;
+
 class ReadableLogSegment;
 
 typedef std::vector<std::unique_ptr<LogEntryPB>> LogEntries;
@@ -77,6 +84,16 @@ struct LogOptions {
 
   std::shared_ptr<LogFactory> log_factory;
 
+  // If set, the log appends and syncs its groups on this pool, which it
+  // shares with the other logs of the process, rather than on a thread of its
+  // own. Not owned, and must outlive the log.
+  ThreadPool* append_pool;
+
+  // If set, the log makes its appends durable through this group, which
+  // syncs the filesystem once for all the logs sharing it, rather than by
+  // syncing its own segments. Not owned, and must outlive the log.
+  LogSyncGroup* sync_group;
+
   LogOptions();
 };
 
@@ -168,6 +185,45 @@ class LogEntryReader {
   DISALLOW_COPY_AND_ASSIGN(LogEntryReader);
 };
 
+// A sparse index from REPLICATE index to the offset of the batch holding it,
+// built while a segment is written and persisted in its footer.
+//
+// Samples are kept strictly increasing in both index and offset. When the log
+// is truncated within the segment, samples for the replaced indexes are
+// dropped and the rewriting batch is always sampled, so a forward scan from the
+// last sample at or below an index finds the latest copy of that index first.
+//
+// Encoded as varint64 sample count, varint64 first index and offset, then the
+// (index, offset) deltas of the remaining samples, group-varint encoded two
+// samples per group.
+class SegmentSparseIndex {
+ public:
+  SegmentSparseIndex();
+
+  // Records a REPLICATE batch holding indexes 'first_index' through
+  // 'last_index' starting at 'offset'. Batches must be added in offset order.
+  void AddBatch(int64_t first_index, int64_t last_index, int64_t offset);
+
+  void Clear();
+
+  bool empty() const { return samples_.empty(); }
+
+  void EncodeTo(std::string* dst) const;
+
+  // Replaces the contents of this index with the index encoded in 'data'.
+  Status DecodeFrom(const Slice& data);
+
+  // Returns the offset of the last sampled batch whose first index is at or
+  // below 'index', or -1 if there is none.
+  int64_t FindScanStart(int64_t index) const;
+
+ private:
+  std::vector<std::pair<int64_t, int64_t>> samples_;
+
+  // The highest index added since the last Clear(), or -1.
+  int64_t last_index_;
+};
+
 // A segment of the log can either be a ReadableLogSegment (for replay and
 // consensus catch-up) or a WritableLogSegment (where the Log actually stores
 // state). LogSegments have a maximum size defined in LogOptions (set from the
@@ -213,6 +269,48 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   // vector.
   Status ReadEntries(LogEntries* entries);
 
+  // Maps the segment file into memory, so that entries are subsequently read
+  // as zero-copy slices of the mapping rather than with a read() per batch.
+  //
+  // Does nothing unless --log_mmap_closed_segments is set and the segment has
+  // a footer that wasn't rebuilt, i.e. it was properly closed and will never be
+  // written again. Must be called before the segment is shared with readers.
+  Status MaybeMapClosedSegment(Env* env);
+
+  // Hints that the segment is about to be read front to back, e.g. by
+  // bootstrap or by a lagging peer catching up. No-op unless mapped, and
+  // after the first call.
+  void AdviseSequentialReads() const;
+
+  // Hints that the 'length' bytes from 'offset' are about to be read, so
+  // that they are read into the page cache in the background. No-op if the
+  // segment is mapped.
+  void ReadAhead(int64_t offset, int64_t length) const;
+
+  // Hints that the segment won't be read again soon, e.g. because every peer
+  // has it already, so that its data is dropped from the page cache rather
+  // than crowding out the segments being read. Pages of a mapped segment stay
+  // cached until it's unmapped. No-op after the first call.
+  void DropFromPageCache() const;
+
+  // Reads the entry header at '*offset' and the batch following it, verifying
+  // both checksums and decompressing the batch if needed, but without parsing
+  // it. Sets 'payload' to the serialized LogEntryBatchPB, which points either
+  // into 'tmp_buf' or into the segment's mapping, and advances '*offset' past
+  // the batch.
+  Status ReadEntryBatchPayload(int64_t* offset, faststring* tmp_buf, Slice* payload);
+
+  // Uses the sparse index in this segment's footer to find the batch holding
+  // the latest copy of REPLICATE 'index', scanning forward from the nearest
+  // sampled batch, or from 'min_offset' if that is further along. On success,
+  // sets 'offset' to the start of the batch and 'op_id' to the id of the
+  // REPLICATE.
+  //
+  // Returns NotFound if the segment has no sparse index or doesn't hold
+  // 'index'.
+  Status FindReplicateBatch(int64_t index, int64_t min_offset, faststring* tmp_buf,
+                            int64_t* offset, consensus::OpId* op_id);
+
   // Rebuilds this segment's footer by scanning its entries.
   // This is an expensive operation as it reads and parses the whole segment
   // so it should be only used in the case of a crash, where the footer is
@@ -278,6 +376,7 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   friend class LogEntryReader;
   friend class LogReader;
   FRIEND_TEST(LogTest, TestWriteAndReadToAndFromInProgressSegment);
+  FRIEND_TEST(LogTestOptionalCompression, TestReadReplicatesFromMappedSegments);
 
   struct EntryHeader {
     // The length of the batch data (uncompressed)
@@ -295,7 +394,7 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
     uint32_t header_crc;
   };
 
-  ~ReadableLogSegment() {}
+  ~ReadableLogSegment();
 
   // Helper functions called by Init().
 
@@ -345,6 +444,10 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
                                  std::unique_ptr<LogEntryBatchPB>* batch,
                                  EntryHeaderStatus* status_detail);
 
+  // If the segment is mapped and the mapping covers 'length' bytes at
+  // 'offset', points 'result' at them and returns true.
+  bool ReadFromMapping(int64_t offset, size_t length, Slice* result) const;
+
   // Reads a log entry header from the segment.
   //
   // Also increments the passed offset* by the length of the entry on successful
@@ -367,6 +470,13 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
                         faststring* tmp_buf,
                         std::unique_ptr<LogEntryBatchPB>* entry_batch);
 
+  // Reads the batch framed by 'header' at 'offset', verifies its checksum and
+  // decompresses it, setting 'data' to the serialized batch.
+  Status ReadEntryBatchData(int64_t offset,
+                            const EntryHeader& header,
+                            faststring* tmp_buf,
+                            Slice* data);
+
   void UpdateReadableToOffset(int64_t readable_to_offset);
 
   const std::string path_;
@@ -388,9 +498,23 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   // a readable file for a log segment (used on replay)
   const std::shared_ptr<RandomAccessFile> readable_file_;
 
+  // A read-only mapping of the segment file. Only set for closed segments,
+  // by MaybeMapClosedSegment().
+  std::unique_ptr<MemoryMappedFile> mapped_file_;
+
+  // Whether AdviseSequentialReads() has already advised 'mapped_file_', so
+  // that repeated catch-up reads don't each issue a madvise().
+  mutable AtomicBool advised_sequential_;
+
+  // Whether DropFromPageCache() was already called.
+  mutable AtomicBool dropped_from_page_cache_;
+
   // Compression codec used to decompress entries in this file.
   const CompressionCodec* codec_;
 
+  // XORed into the header CRC of every entry. See EntryHeaderFence().
+  uint32_t entry_header_fence_;
+
   bool is_initialized_;
 
   LogSegmentHeaderPB header_;
@@ -433,11 +557,30 @@ class WritableLogSegment {
   // Write a compressed entry to the log.
   Status WriteEntryBatch(const Slice& data, const CompressionCodec* codec);
 
+  // Appends a batch which was already framed by EncodeEntryBatch(). The
+  // segment must have been opened with the same codec that was used to
+  // encode the batch.
+  Status WriteEncodedEntryBatch(const Slice& encoded);
+
+  // Frames 'data' into 'encoded' exactly as WriteEntryBatch() would write it
+  // out: the entry header including the checksums, followed by the payload,
+  // compressed with 'codec' if it is not NULL. Does not touch any segment
+  // state, so it may be called from any thread.
+  static Status EncodeEntryBatch(const Slice& data,
+                                 const CompressionCodec* codec,
+                                 faststring* encoded);
+
   // Makes sure the I/O buffers in the underlying writable file are flushed.
   Status Sync() {
     return writable_file_->Sync();
   }
 
+  // Like Sync(), but 'cb' may be invoked from another thread once the data
+  // is durable. See WritableFile::SyncAsync().
+  void SyncAsync(const StatusCallback& cb) {
+    writable_file_->SyncAsync(cb);
+  }
+
   // Returns true if the segment header has already been written to disk.
   bool IsHeaderWritten() const {
     return is_header_written_;
@@ -496,6 +639,9 @@ class WritableLogSegment {
   // The offset where the last written entry ends.
   int64_t written_offset_;
 
+  // XORed into the header CRC of every entry. See EntryHeaderFence().
+  uint32_t entry_header_fence_;
+
   // Buffer used for output when compressing.
   faststring compress_buf_;
 
@@ -507,9 +653,25 @@ class WritableLogSegment {
 std::unique_ptr<LogEntryBatchPB> CreateBatchFromAllocatedOperations(
     const std::vector<consensus::ReplicateRefPtr>& msgs);
 
+// Returns the value the header CRC of each entry in a segment with 'header'
+// is XORed with: a fence derived from the sequence number if the segment has
+// the FENCED_ENTRY_HEADERS feature, or 0 otherwise.
+uint32_t EntryHeaderFence(const LogSegmentHeaderPB& header);
+
 // Checks if 'fname' is a correctly formatted name of log segment file.
 bool IsLogFileName(const std::string& fname);
 
+// Opens the log segment file at 'path' for reading. With
+// --log_segment_file_cache_capacity set, the file is opened through a cache
+// shared by the whole process, which bounds the number of segment files open
+// at a time.
+Status OpenLogSegmentFileForRandom(Env* env, const std::string& path,
+                                   std::shared_ptr<RandomAccessFile>* file);
+
+// Deletes the log segment file at 'path'. If the file was opened through the
+// segment file cache, the deletion is deferred until nothing has it open.
+Status DeleteLogSegmentFile(Env* env, const std::string& path);
+
 // Update 'footer' to reflect the given REPLICATE message 'entry_pb'.
 // In particular, updates the min/max seen replicate OpID.
 void UpdateFooterForReplicateEntry(
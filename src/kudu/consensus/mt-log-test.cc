@@ -57,6 +57,7 @@
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/io_uring.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/random.h"
 #include "kudu/util/status.h"
@@ -74,6 +75,16 @@ DEFINE_bool(verify_log, true, "Whether to verify the log by reading it after the
 
 DECLARE_int32(log_thread_idle_threshold_ms);
 DECLARE_int32(log_inject_thread_lifecycle_latency_ms);
+DECLARE_bool(log_pipelined_append);
+DECLARE_int32(log_serialization_threads);
+DECLARE_bool(log_io_uring);
+DECLARE_int32(log_group_commit_target_latency_us);
+DECLARE_bool(log_inject_latency);
+DECLARE_int32(log_inject_latency_ms_mean);
+DECLARE_int32(log_inject_latency_ms_stddev);
+
+METRIC_DECLARE_histogram(log_group_commit_target_batches);
+METRIC_DECLARE_histogram(log_group_commit_wait_latency);
 
 namespace kudu {
 namespace log {
@@ -264,5 +275,65 @@ TEST_F(MultiThreadedLogTest, TestAppendThreadStartStopRaces) {
   ASSERT_NO_FATAL_FAILURE(VerifyLog());
 }
 
+// Same as TestAppends, but with the append thread handing groups off to a
+// separate sync thread.
+TEST_F(MultiThreadedLogTest, TestPipelinedAppends) {
+  FLAGS_log_pipelined_append = true;
+  options_.segment_size_mb = 1;
+  options_.force_fsync_all = true;
+  ASSERT_OK(BuildLog());
+  ASSERT_NO_FATAL_FAILURE(Run());
+  ASSERT_OK(log_->Close());
+  ASSERT_NO_FATAL_FAILURE(VerifyLog());
+}
+
+// Same as TestAppends, but with the batches being serialized and compressed
+// on a pool of threads rather than by the writers and the append thread.
+TEST_F(MultiThreadedLogTest, TestAppendsWithParallelSerialization) {
+  FLAGS_log_serialization_threads = 4;
+  options_.segment_size_mb = 1;
+  ASSERT_OK(BuildLog());
+  ASSERT_NO_FATAL_FAILURE(Run());
+  ASSERT_OK(log_->Close());
+  ASSERT_NO_FATAL_FAILURE(VerifyLog());
+}
+
+// Same as TestAppends, but with the segments being written and synced
+// through io_uring.
+TEST_F(MultiThreadedLogTest, TestAppendsWithIoUring) {
+  if (!IoUring::IsSupported()) {
+    LOG(INFO) << "Skipping test: io_uring is not supported";
+    return;
+  }
+  FLAGS_log_io_uring = true;
+  options_.segment_size_mb = 1;
+  options_.force_fsync_all = true;
+  ASSERT_OK(BuildLog());
+  ASSERT_NO_FATAL_FAILURE(Run());
+  ASSERT_OK(log_->Close());
+  ASSERT_NO_FATAL_FAILURE(VerifyLog());
+}
+
+// Same as TestAppends, but with the adaptive group commit controller delaying
+// syncs to gather larger groups. Sync latency is injected so that the writers
+// queue batches faster than the log can sync them.
+TEST_F(MultiThreadedLogTest, TestAppendsWithAdaptiveGroupCommit) {
+  FLAGS_log_group_commit_target_latency_us = 20000;
+  FLAGS_log_inject_latency = true;
+  FLAGS_log_inject_latency_ms_mean = 5;
+  FLAGS_log_inject_latency_ms_stddev = 0;
+  FLAGS_num_batches_per_thread = 200;
+  options_.segment_size_mb = 1;
+  options_.force_fsync_all = true;
+  ASSERT_OK(BuildLog());
+  ASSERT_NO_FATAL_FAILURE(Run());
+  ASSERT_OK(log_->Close());
+  ASSERT_NO_FATAL_FAILURE(VerifyLog());
+
+  ASSERT_GT(METRIC_log_group_commit_target_batches.Instantiate(metric_entity_)->TotalCount(), 0);
+  ASSERT_GT(METRIC_log_group_commit_wait_latency.Instantiate(metric_entity_)->MaxValueForTests(),
+            0);
+}
+
 } // namespace log
 } // namespace kudu
@@ -0,0 +1,250 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/packed_ops.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/rpc/rpc_header.pb.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DEFINE_int32(packed_ops_bench_batches, 1000,
+             "Number of batches to encode and decode in the packed ops benchmark");
+DEFINE_int32(packed_ops_bench_batch_size, 100,
+             "Number of ops per batch in the packed ops benchmark");
+DEFINE_int32(packed_ops_bench_payload_bytes, 256,
+             "Size of the payload of each op in the packed ops benchmark");
+
+using std::string;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+class PackedOpsTest : public KuduTest {
+ protected:
+  static ReplicateRefPtr MakeWriteOp(int64_t index, int payload_bytes) {
+    ReplicateRefPtr msg = make_scoped_refptr_replicate(new ReplicateMsg);
+    ReplicateMsg* op = msg->get();
+    op->mutable_id()->set_term(3);
+    op->mutable_id()->set_index(index);
+    op->set_timestamp(1000 + index);
+    op->set_op_type(WRITE_OP_EXT);
+    op->set_dependency_key(index % 7);
+    WritePayloadPB* payload = op->mutable_write_payload();
+    payload->set_payload(string(payload_bytes, static_cast<char>('a' + index % 26)));
+    payload->set_crc32(static_cast<uint32_t>(index * 31));
+    return msg;
+  }
+
+  // Returns the ops of 'msgs' serialized as the ops of a request.
+  static string SerializeAsProtobufs(const vector<ReplicateRefPtr>& msgs) {
+    ConsensusRequestPB ops_only;
+    for (const ReplicateRefPtr& msg : msgs) {
+      *ops_only.add_ops() = *msg->get();
+    }
+    return ops_only.SerializePartialAsString();
+  }
+};
+
+// Ops decode exactly as they were encoded, whether they fit the write op
+// layout or are sent as protobufs.
+TEST_F(PackedOpsTest, TestRoundTrip) {
+  vector<ReplicateRefPtr> msgs;
+  msgs.push_back(MakeWriteOp(1, 100));
+
+  // A write op with only some of the optional fields set.
+  ReplicateRefPtr sparse = make_scoped_refptr_replicate(new ReplicateMsg);
+  sparse->get()->mutable_id()->set_term(3);
+  sparse->get()->mutable_id()->set_index(2);
+  sparse->get()->set_timestamp(0);
+  sparse->get()->set_op_type(WRITE_OP_EXT);
+  sparse->get()->mutable_write_payload()->set_compression_codec(LZ4);
+  sparse->get()->mutable_write_payload()->set_uncompressed_size(12345);
+  msgs.push_back(sparse);
+
+  // Ops with fields outside of the layout.
+  ReplicateRefPtr noop = make_scoped_refptr_replicate(new ReplicateMsg);
+  noop->get()->mutable_id()->set_term(3);
+  noop->get()->mutable_id()->set_index(3);
+  noop->get()->set_timestamp(7);
+  noop->get()->set_op_type(NO_OP);
+  noop->get()->mutable_noop_request()->set_payload_for_tests("noop");
+  msgs.push_back(noop);
+  ReplicateRefPtr with_request_id = MakeWriteOp(4, 10);
+  with_request_id->get()->mutable_request_id()->set_client_id("client");
+  with_request_id->get()->mutable_request_id()->set_seq_no(1);
+  with_request_id->get()->mutable_request_id()->set_first_incomplete_seq_no(1);
+  with_request_id->get()->mutable_request_id()->set_attempt_no(0);
+  msgs.push_back(with_request_id);
+  msgs.push_back(MakeWriteOp(5, 0));
+
+  // Ops which can't be encoded relative to the previous one: a lower term,
+  // an index far ahead, and a timestamp going backwards.
+  ReplicateRefPtr lower_term = MakeWriteOp(6, 10);
+  lower_term->get()->mutable_id()->set_term(2);
+  msgs.push_back(lower_term);
+  msgs.push_back(MakeWriteOp(int64_t{1} << 40, 10));
+  ReplicateRefPtr earlier = MakeWriteOp((int64_t{1} << 40) + 1, 10);
+  earlier->get()->set_timestamp(1);
+  msgs.push_back(earlier);
+
+  for (bool delta_encode : { false, true }) {
+    SCOPED_TRACE(delta_encode);
+    string buf;
+    PackOps(msgs, &buf, delta_encode);
+    ConsensusRequestPB req;
+    ASSERT_OK(UnpackOps(buf, &req));
+    ASSERT_EQ(msgs.size(), static_cast<size_t>(req.ops_size()));
+    for (int i = 0; i < req.ops_size(); i++) {
+      ASSERT_EQ(msgs[i]->get()->SerializeAsString(), req.ops(i).SerializeAsString()) << i;
+    }
+
+    // An empty batch.
+    PackOps({}, &buf, delta_encode);
+    ASSERT_OK(UnpackOps(buf, &req));
+    ASSERT_EQ(msgs.size(), static_cast<size_t>(req.ops_size()));
+  }
+}
+
+// Delta encoding shrinks the headers of consecutive write ops.
+TEST_F(PackedOpsTest, TestDeltaEncodingSize) {
+  const int kNumOps = 100;
+  vector<ReplicateRefPtr> msgs;
+  for (int i = 0; i < kNumOps; i++) {
+    msgs.push_back(MakeWriteOp(1000000 + i, 0));
+  }
+  string fixed;
+  PackOps(msgs, &fixed);
+  string delta;
+  PackOps(msgs, &delta, /*delta_encode=*/ true);
+  LOG(INFO) << "Fixed: " << fixed.size() / kNumOps << " bytes per op, delta: "
+            << delta.size() / kNumOps << " bytes per op";
+  ASSERT_LT(delta.size() * 3, fixed.size());
+}
+
+// A damaged or truncated batch is rejected.
+TEST_F(PackedOpsTest, TestCorruption) {
+  vector<ReplicateRefPtr> msgs = { MakeWriteOp(1, 100), MakeWriteOp(2, 100) };
+  for (bool delta_encode : { false, true }) {
+    SCOPED_TRACE(delta_encode);
+    string buf;
+    PackOps(msgs, &buf, delta_encode);
+
+    string damaged = buf;
+    damaged[20] ^= 1;
+    ConsensusRequestPB req;
+    Status s = UnpackOps(damaged, &req);
+    ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+    ASSERT_STR_CONTAINS(s.ToString(), "checksum mismatch");
+
+    s = UnpackOps(Slice(buf.data(), 3), &req);
+    ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+  }
+}
+
+// Reports how many ops per second one core encodes and decodes, as protobufs
+// and packed.
+TEST_F(PackedOpsTest, BenchmarkEncodings) {
+  vector<ReplicateRefPtr> msgs;
+  for (int i = 0; i < FLAGS_packed_ops_bench_batch_size; i++) {
+    msgs.push_back(MakeWriteOp(i + 1, FLAGS_packed_ops_bench_payload_bytes));
+  }
+  const int64_t num_ops =
+      static_cast<int64_t>(FLAGS_packed_ops_bench_batches) * FLAGS_packed_ops_bench_batch_size;
+  auto report = [num_ops](const char* what, const Stopwatch& sw) {
+    LOG(INFO) << what << ": " << num_ops / sw.elapsed().user_cpu_seconds()
+              << " ops/sec per core";
+  };
+
+  string pb_buf;
+  Stopwatch sw;
+  sw.start();
+  for (int i = 0; i < FLAGS_packed_ops_bench_batches; i++) {
+    ConsensusRequestPB ops_only;
+    for (const ReplicateRefPtr& msg : msgs) {
+      ops_only.mutable_ops()->UnsafeArenaAddAllocated(msg->get());
+    }
+    ops_only.SerializePartialToString(&pb_buf);
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    ops_only.mutable_ops()->UnsafeArenaExtractSubrange(0, ops_only.ops_size(), nullptr);
+#else
+    ops_only.mutable_ops()->ExtractSubrange(0, ops_only.ops_size(), nullptr);
+#endif
+  }
+  sw.stop();
+  report("Protobuf encoding", sw);
+  ASSERT_EQ(SerializeAsProtobufs(msgs), pb_buf);
+
+  sw.start();
+  for (int i = 0; i < FLAGS_packed_ops_bench_batches; i++) {
+    ConsensusRequestPB req;
+    CHECK(req.ParsePartialFromString(pb_buf));
+  }
+  sw.stop();
+  report("Protobuf decoding", sw);
+
+  string packed_buf;
+  sw.start();
+  for (int i = 0; i < FLAGS_packed_ops_bench_batches; i++) {
+    PackOps(msgs, &packed_buf);
+  }
+  sw.stop();
+  report("Packed encoding", sw);
+
+  sw.start();
+  for (int i = 0; i < FLAGS_packed_ops_bench_batches; i++) {
+    ConsensusRequestPB req;
+    CHECK_OK(UnpackOps(packed_buf, &req));
+  }
+  sw.stop();
+  report("Packed decoding", sw);
+
+  string delta_buf;
+  sw.start();
+  for (int i = 0; i < FLAGS_packed_ops_bench_batches; i++) {
+    PackOps(msgs, &delta_buf, /*delta_encode=*/ true);
+  }
+  sw.stop();
+  report("Delta packed encoding", sw);
+
+  sw.start();
+  for (int i = 0; i < FLAGS_packed_ops_bench_batches; i++) {
+    ConsensusRequestPB req;
+    CHECK_OK(UnpackOps(delta_buf, &req));
+  }
+  sw.stop();
+  report("Delta packed decoding", sw);
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,440 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/packed_ops.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/coding-inl.h"
+#include "kudu/util/coding.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/crc.h"
+#include "kudu/util/group_varint-inl.h"
+
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+const uint8_t kPackedOpsVersion = 1;
+const uint8_t kDeltaPackedOpsVersion = 2;
+
+// The kinds of encoded ops.
+enum OpKind : uint8_t {
+  kWriteOp = 1,
+  kProtobufOp = 2,
+  // Only in batches of kDeltaPackedOpsVersion.
+  kDeltaWriteOp = 3,
+};
+
+// Flags of a write op.
+enum OpFlags : uint8_t {
+  kHasDependencyKey = 1 << 0,
+  kHasWritePayload = 1 << 1,
+};
+
+// Flags of a write op's payload.
+enum PayloadFlags : uint8_t {
+  kHasPayload = 1 << 0,
+  kHasCompressionCodec = 1 << 1,
+  kHasUncompressedSize = 1 << 2,
+  kHasCrc32 = 1 << 3,
+};
+
+const size_t kBatchHeaderSize = 1 + 4;
+const size_t kBatchTrailerSize = 4;
+const size_t kWriteOpHeaderSize = 1 + 1 + 1 + 4 * 8 + 1 + 4 + 8 + 4 + 4;
+const size_t kProtobufOpHeaderSize = 1 + 4;
+// The kind, the group of deltas, length and flags, then the varint64
+// timestamp delta, dependency key, varint32 codec, varint64 uncompressed
+// size and fixed32 crc32.
+const size_t kMaxDeltaWriteOpHeaderSize = 1 + 17 + 10 + 10 + 5 + 10 + 4;
+
+// The fields of the previous op of a batch, which the next one's are encoded
+// relative to.
+struct PrevOp {
+  uint64_t term = 0;
+  uint64_t index = 0;
+  uint64_t timestamp = 0;
+
+  void Update(const ReplicateMsg& op) {
+    term = op.id().term();
+    index = op.id().index();
+    timestamp = op.timestamp();
+  }
+};
+
+uint64_t ZigZagEncode64(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t ZigZagDecode64(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// Whether all the fields set in 'op' have a place in the write op layout.
+bool CanPackAsWriteOp(const ReplicateMsg& op) {
+  if (!op.has_id() || !op.has_timestamp() || !op.has_op_type() ||
+      op.has_change_config_record() || op.has_proxy_record() ||
+      op.has_request_id() || op.has_noop_request() ||
+      !op.unknown_fields().empty() || !op.id().unknown_fields().empty()) {
+    return false;
+  }
+  if (op.has_write_payload()) {
+    const WritePayloadPB& payload = op.write_payload();
+    if (payload.has_payload_sidecar_idx() || payload.has_compression_dictionary_id() ||
+        payload.has_payload_stripped() || !payload.unknown_fields().empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint8_t* EncodeWriteOp(const ReplicateMsg& op, uint8_t* dst) {
+  const WritePayloadPB& payload = op.write_payload();
+  *dst++ = kWriteOp;
+  *dst++ = static_cast<uint8_t>(op.op_type());
+  *dst++ = (op.has_dependency_key() ? kHasDependencyKey : 0) |
+           (op.has_write_payload() ? kHasWritePayload : 0);
+  InlineEncodeFixed64(dst, op.id().term());
+  InlineEncodeFixed64(dst + 8, op.id().index());
+  InlineEncodeFixed64(dst + 16, op.timestamp());
+  InlineEncodeFixed64(dst + 24, op.dependency_key());
+  dst += 32;
+  *dst++ = (payload.has_payload() ? kHasPayload : 0) |
+           (payload.has_compression_codec() ? kHasCompressionCodec : 0) |
+           (payload.has_uncompressed_size() ? kHasUncompressedSize : 0) |
+           (payload.has_crc32() ? kHasCrc32 : 0);
+  InlineEncodeFixed32(dst, payload.compression_codec());
+  InlineEncodeFixed64(dst + 4, payload.uncompressed_size());
+  InlineEncodeFixed32(dst + 12, payload.crc32());
+  InlineEncodeFixed32(dst + 16, payload.payload().size());
+  dst += 20;
+  memcpy(dst, payload.payload().data(), payload.payload().size());
+  return dst + payload.payload().size();
+}
+
+Status DecodeWriteOp(Slice* in, ReplicateMsg* op) {
+  if (PREDICT_FALSE(in->size() < kWriteOpHeaderSize - 1)) {
+    return Status::Corruption("truncated write op");
+  }
+  const uint8_t* src = in->data();
+  const uint8_t op_type = *src++;
+  const uint8_t flags = *src++;
+  if (PREDICT_FALSE(!OperationType_IsValid(op_type))) {
+    return Status::Corruption(Substitute("invalid op type $0", op_type));
+  }
+  op->mutable_id()->set_term(DecodeFixed64(src));
+  op->mutable_id()->set_index(DecodeFixed64(src + 8));
+  op->set_timestamp(DecodeFixed64(src + 16));
+  op->set_op_type(static_cast<OperationType>(op_type));
+  if (flags & kHasDependencyKey) {
+    op->set_dependency_key(DecodeFixed64(src + 24));
+  }
+  src += 32;
+  const uint8_t payload_flags = *src++;
+  const uint32_t codec = DecodeFixed32(src);
+  const uint64_t uncompressed_size = DecodeFixed64(src + 4);
+  const uint32_t crc32 = DecodeFixed32(src + 12);
+  const uint32_t payload_size = DecodeFixed32(src + 16);
+  in->remove_prefix(kWriteOpHeaderSize - 1);
+  if (PREDICT_FALSE(in->size() < payload_size)) {
+    return Status::Corruption("truncated write payload");
+  }
+  if (flags & kHasWritePayload) {
+    if (PREDICT_FALSE(!CompressionType_IsValid(codec))) {
+      return Status::Corruption(Substitute("invalid compression codec $0", codec));
+    }
+    WritePayloadPB* payload = op->mutable_write_payload();
+    if (payload_flags & kHasPayload) {
+      payload->set_payload(in->data(), payload_size);
+    }
+    if (payload_flags & kHasCompressionCodec) {
+      payload->set_compression_codec(static_cast<CompressionType>(codec));
+    }
+    if (payload_flags & kHasUncompressedSize) {
+      payload->set_uncompressed_size(uncompressed_size);
+    }
+    if (payload_flags & kHasCrc32) {
+      payload->set_crc32(crc32);
+    }
+  }
+  in->remove_prefix(payload_size);
+  return Status::OK();
+}
+
+// Whether 'op', which CanPackAsWriteOp(), can be encoded relative to 'prev':
+// ops of a batch normally share a term and have consecutive indexes.
+bool CanDeltaEncode(const ReplicateMsg& op, const PrevOp& prev) {
+  if (op.id().term() < 0 || op.id().index() < 0) {
+    return false;
+  }
+  const uint64_t kMaxDelta = std::numeric_limits<uint32_t>::max();
+  const uint64_t term = op.id().term();
+  const uint64_t index = op.id().index();
+  return term >= prev.term && term - prev.term <= kMaxDelta &&
+      index >= prev.index && index - prev.index <= kMaxDelta;
+}
+
+// Encodes a write op as:
+//   kind (1 byte) | group varint of (term delta, index delta, payload length,
+//   op_type | flags << 8 | payload flags << 16) | zigzag varint64 timestamp
+//   delta | the dependency key (varint64), compression codec (varint32),
+//   uncompressed size (varint64) and crc32 (fixed32), each only if set |
+//   payload
+uint8_t* EncodeDeltaWriteOp(const ReplicateMsg& op, const PrevOp& prev, uint8_t* dst) {
+  const WritePayloadPB& payload = op.write_payload();
+  const uint8_t flags = (op.has_dependency_key() ? kHasDependencyKey : 0) |
+                        (op.has_write_payload() ? kHasWritePayload : 0);
+  const uint8_t payload_flags = (payload.has_payload() ? kHasPayload : 0) |
+                                (payload.has_compression_codec() ? kHasCompressionCodec : 0) |
+                                (payload.has_uncompressed_size() ? kHasUncompressedSize : 0) |
+                                (payload.has_crc32() ? kHasCrc32 : 0);
+  *dst++ = kDeltaWriteOp;
+  // The stores hang off the end of the group into the fields which follow.
+  dst = coding::EncodeGroupVarInt32(
+      dst,
+      op.id().term() - prev.term,
+      op.id().index() - prev.index,
+      payload.payload().size(),
+      static_cast<uint32_t>(op.op_type()) | (flags << 8) | (payload_flags << 16));
+  dst = EncodeVarint64(dst, ZigZagEncode64(op.timestamp() - prev.timestamp));
+  if (flags & kHasDependencyKey) {
+    dst = EncodeVarint64(dst, op.dependency_key());
+  }
+  if (payload_flags & kHasCompressionCodec) {
+    dst = InlineEncodeVarint32(dst, payload.compression_codec());
+  }
+  if (payload_flags & kHasUncompressedSize) {
+    dst = EncodeVarint64(dst, payload.uncompressed_size());
+  }
+  if (payload_flags & kHasCrc32) {
+    InlineEncodeFixed32(dst, payload.crc32());
+    dst += 4;
+  }
+  memcpy(dst, payload.payload().data(), payload.payload().size());
+  return dst + payload.payload().size();
+}
+
+// Decodes a write op encoded by EncodeDeltaWriteOp(). Reads up to 3 bytes
+// past the group varints, which is safe as the checksum of the batch
+// follows its ops.
+Status DecodeDeltaWriteOp(Slice* in, const PrevOp& prev, ReplicateMsg* op) {
+  if (PREDICT_FALSE(in->empty())) {
+    return Status::Corruption("truncated write op");
+  }
+  const uint8_t sel = (*in)[0];
+  const size_t group_size = 1 + ((sel >> 6) & 3) + ((sel >> 4) & 3) + ((sel >> 2) & 3) +
+      (sel & 3) + 4;
+  if (PREDICT_FALSE(in->size() < group_size)) {
+    return Status::Corruption("truncated write op");
+  }
+  uint32_t term_delta;
+  uint32_t index_delta;
+  uint32_t payload_size;
+  uint32_t packed_flags;
+  coding::DecodeGroupVarInt32(in->data(), &term_delta, &index_delta, &payload_size,
+                              &packed_flags);
+  in->remove_prefix(group_size);
+  const uint8_t op_type = packed_flags & 0xff;
+  const uint8_t flags = (packed_flags >> 8) & 0xff;
+  const uint8_t payload_flags = (packed_flags >> 16) & 0xff;
+  if (PREDICT_FALSE(!OperationType_IsValid(op_type))) {
+    return Status::Corruption(Substitute("invalid op type $0", op_type));
+  }
+  uint64_t timestamp_delta;
+  if (PREDICT_FALSE(!GetVarint64(in, &timestamp_delta))) {
+    return Status::Corruption("truncated timestamp");
+  }
+  op->mutable_id()->set_term(prev.term + term_delta);
+  op->mutable_id()->set_index(prev.index + index_delta);
+  op->set_timestamp(prev.timestamp + ZigZagDecode64(timestamp_delta));
+  op->set_op_type(static_cast<OperationType>(op_type));
+  if (flags & kHasDependencyKey) {
+    uint64_t dependency_key;
+    if (PREDICT_FALSE(!GetVarint64(in, &dependency_key))) {
+      return Status::Corruption("truncated dependency key");
+    }
+    op->set_dependency_key(dependency_key);
+  }
+  uint32_t codec = 0;
+  if ((payload_flags & kHasCompressionCodec) && PREDICT_FALSE(!GetVarint32(in, &codec))) {
+    return Status::Corruption("truncated compression codec");
+  }
+  uint64_t uncompressed_size = 0;
+  if ((payload_flags & kHasUncompressedSize) &&
+      PREDICT_FALSE(!GetVarint64(in, &uncompressed_size))) {
+    return Status::Corruption("truncated uncompressed size");
+  }
+  uint32_t crc32 = 0;
+  if (payload_flags & kHasCrc32) {
+    if (PREDICT_FALSE(in->size() < 4)) {
+      return Status::Corruption("truncated crc32");
+    }
+    crc32 = DecodeFixed32(in->data());
+    in->remove_prefix(4);
+  }
+  if (PREDICT_FALSE(in->size() < payload_size)) {
+    return Status::Corruption("truncated write payload");
+  }
+  if (flags & kHasWritePayload) {
+    if (PREDICT_FALSE(!CompressionType_IsValid(codec))) {
+      return Status::Corruption(Substitute("invalid compression codec $0", codec));
+    }
+    WritePayloadPB* payload = op->mutable_write_payload();
+    if (payload_flags & kHasPayload) {
+      payload->set_payload(in->data(), payload_size);
+    }
+    if (payload_flags & kHasCompressionCodec) {
+      payload->set_compression_codec(static_cast<CompressionType>(codec));
+    }
+    if (payload_flags & kHasUncompressedSize) {
+      payload->set_uncompressed_size(uncompressed_size);
+    }
+    if (payload_flags & kHasCrc32) {
+      payload->set_crc32(crc32);
+    }
+  }
+  in->remove_prefix(payload_size);
+  return Status::OK();
+}
+
+} // anonymous namespace
+
+void PackOps(const vector<ReplicateRefPtr>& msgs, string* buf, bool delta_encode) {
+  // Size the buffer up front, so that the ops are encoded straight into it.
+  // Delta-encoded ops are sized for their largest encoding, and the buffer
+  // is trimmed once they're encoded.
+  size_t size = kBatchHeaderSize + kBatchTrailerSize;
+  PrevOp prev;
+  for (const ReplicateRefPtr& msg : msgs) {
+    const ReplicateMsg& op = *msg->get();
+    if (CanPackAsWriteOp(op)) {
+      size += (delta_encode && CanDeltaEncode(op, prev) ? kMaxDeltaWriteOpHeaderSize :
+               kWriteOpHeaderSize) + op.write_payload().payload().size();
+    } else {
+      size += kProtobufOpHeaderSize + op.ByteSizeLong();
+    }
+    prev.Update(op);
+  }
+  buf->resize(size);
+
+  uint8_t* const start = reinterpret_cast<uint8_t*>(&(*buf)[0]);
+  uint8_t* dst = start;
+  *dst++ = delta_encode ? kDeltaPackedOpsVersion : kPackedOpsVersion;
+  InlineEncodeFixed32(dst, msgs.size());
+  dst += 4;
+  prev = PrevOp();
+  for (const ReplicateRefPtr& msg : msgs) {
+    const ReplicateMsg& op = *msg->get();
+    if (CanPackAsWriteOp(op)) {
+      if (delta_encode && CanDeltaEncode(op, prev)) {
+        dst = EncodeDeltaWriteOp(op, prev, dst);
+      } else {
+        dst = EncodeWriteOp(op, dst);
+      }
+    } else {
+      // The size was cached by ByteSizeLong() above.
+      *dst++ = kProtobufOp;
+      InlineEncodeFixed32(dst, op.GetCachedSize());
+      dst = op.SerializeWithCachedSizesToArray(dst + 4);
+    }
+    prev.Update(op);
+  }
+  InlineEncodeFixed32(dst, crc::Crc32c(start, dst - start));
+  dst += 4;
+  if (delta_encode) {
+    CHECK_LE(static_cast<size_t>(dst - start), size);
+    buf->resize(dst - start);
+  } else {
+    CHECK_EQ(static_cast<size_t>(dst - start), size);
+  }
+}
+
+Status UnpackOps(Slice buf, ConsensusRequestPB* req) {
+  if (PREDICT_FALSE(buf.size() < kBatchHeaderSize + kBatchTrailerSize)) {
+    return Status::Corruption("packed ops too short", std::to_string(buf.size()));
+  }
+  const size_t checked_size = buf.size() - kBatchTrailerSize;
+  const uint32_t expected_crc = DecodeFixed32(buf.data() + checked_size);
+  const uint32_t crc = crc::Crc32c(buf.data(), checked_size);
+  if (PREDICT_FALSE(crc != expected_crc)) {
+    return Status::Corruption(Substitute("packed ops checksum mismatch: expected $0, got $1",
+                                         expected_crc, crc));
+  }
+  const uint8_t version = buf[0];
+  if (PREDICT_FALSE(version != kPackedOpsVersion && version != kDeltaPackedOpsVersion)) {
+    return Status::Corruption(Substitute("unknown version $0 of packed ops", version));
+  }
+  const uint32_t num_ops = DecodeFixed32(buf.data() + 1);
+  Slice in(buf.data() + kBatchHeaderSize, checked_size - kBatchHeaderSize);
+  // Every op takes at least kProtobufOpHeaderSize bytes, which bounds what a
+  // corrupt count makes us reserve.
+  req->mutable_ops()->Reserve(
+      req->ops_size() + std::min<size_t>(num_ops, in.size() / kProtobufOpHeaderSize));
+  PrevOp prev;
+  for (uint32_t i = 0; i < num_ops; i++) {
+    if (PREDICT_FALSE(in.empty())) {
+      return Status::Corruption(Substitute("packed ops end after op $0 of $1", i, num_ops));
+    }
+    const uint8_t kind = in[0];
+    in.remove_prefix(1);
+    ReplicateMsg* op = req->add_ops();
+    if (kind == kWriteOp) {
+      RETURN_NOT_OK_PREPEND(DecodeWriteOp(&in, op), Substitute("unable to decode op $0", i));
+    } else if (kind == kDeltaWriteOp && version == kDeltaPackedOpsVersion) {
+      RETURN_NOT_OK_PREPEND(DecodeDeltaWriteOp(&in, prev, op),
+                            Substitute("unable to decode op $0", i));
+    } else if (kind == kProtobufOp) {
+      if (PREDICT_FALSE(in.size() < kProtobufOpHeaderSize - 1)) {
+        return Status::Corruption(Substitute("truncated op $0", i));
+      }
+      const uint32_t op_size = DecodeFixed32(in.data());
+      in.remove_prefix(kProtobufOpHeaderSize - 1);
+      if (PREDICT_FALSE(in.size() < op_size ||
+                        !op->ParseFromArray(in.data(), op_size))) {
+        return Status::Corruption(Substitute("unable to parse op $0", i));
+      }
+      in.remove_prefix(op_size);
+    } else {
+      return Status::Corruption(Substitute("unknown kind $0 of op $1", kind, i));
+    }
+    prev.Update(*op);
+  }
+  if (PREDICT_FALSE(!in.empty())) {
+    return Status::Corruption(Substitute("$0 bytes left after the packed ops", in.size()));
+  }
+  return Status::OK();
+}
+
+} // namespace consensus
+} // namespace kudu
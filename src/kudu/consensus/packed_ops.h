@@ -0,0 +1,65 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "kudu/consensus/ref_counted_replicate.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+namespace consensus {
+
+class ConsensusRequestPB;
+
+// A fixed-layout encoding of a batch of ops, which a leader may send to the
+// peers which support ConsensusFeatureFlags::PACKED_OPS instead of the ops
+// serialized as protobufs. The common write op is encoded as a fixed-size
+// header followed by its payload, which takes far less CPU to encode and
+// decode than going through the generated protobuf code:
+//
+//   batch:    version (1 byte) | number of ops (fixed32) | op... | crc32c (fixed32)
+//   write op: kind (1 byte) | op_type (1 byte) | flags (1 byte) |
+//             term, index, timestamp, dependency_key (fixed64 each) |
+//             payload flags (1 byte) | compression_codec (fixed32) |
+//             uncompressed_size (fixed64) | crc32 (fixed32) |
+//             payload length (fixed32) | payload
+//   other op: kind (1 byte) | length (fixed32) | the op as a protobuf
+//
+// The checksum covers everything before it. The flags tell which of the
+// fields were set, so that the ops decode exactly as they were encoded. Ops
+// with any other field set, such as config changes, are sent as protobufs.
+//
+// Version 2 of the batch may also hold write ops whose term, index and
+// timestamp are encoded as deltas from the previous op of the batch, with the
+// deltas, payload length and flags in a group varint and the rest of the
+// fields as varints only when set. The ops of a batch usually share a term
+// and have consecutive indexes, so their headers shrink from 56 bytes to
+// around a dozen. Only peers which support PACKED_OPS_V2 can decode these.
+
+// Encodes the ops of 'msgs' into 'buf', as version 2 if 'delta_encode'.
+void PackOps(const std::vector<ReplicateRefPtr>& msgs, std::string* buf,
+             bool delta_encode = false);
+
+// Decodes the ops packed in 'buf', appending them to the ops of 'req'.
+// Returns Corruption if 'buf' isn't a batch of ops encoded by PackOps().
+Status UnpackOps(Slice buf, ConsensusRequestPB* req);
+
+} // namespace consensus
+} // namespace kudu
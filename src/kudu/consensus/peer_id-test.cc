@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "kudu/consensus/peer_id.h"
+
+#include <string>
+#include <unordered_map>
+
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/test_util.h"
+
+using std::string;
+
+namespace kudu {
+namespace consensus {
+
+class PeerIdTest : public KuduTest {};
+
+TEST_F(PeerIdTest, TestCanonicalUuids) {
+  const string kUuid = "0123456789abcdeffedcba9876543210";
+  PeerId id(kUuid);
+  ASSERT_EQ(kUuid, id.uuid());
+  ASSERT_EQ(PeerId(kUuid), id);
+  ASSERT_EQ(PeerId(kUuid).hash(), id.hash());
+  ASSERT_NE(PeerId("0123456789abcdeffedcba9876543211"), id);
+  ASSERT_NE(PeerId("1123456789abcdeffedcba9876543210"), id);
+
+  // Uppercase hex digits aren't canonical, so that ids are equal exactly when
+  // their uuids are.
+  const string kUpperUuid = "0123456789ABCDEFFEDCBA9876543210";
+  ASSERT_NE(PeerId(kUpperUuid), id);
+  ASSERT_EQ(kUpperUuid, PeerId(kUpperUuid).uuid());
+}
+
+TEST_F(PeerIdTest, TestOtherUuids) {
+  for (const char* uuid : { "", "peer-0", "A", "0123456789abcdeffedcba98765432xx",
+                            "0123456789abcdeffedcba98765432100" }) {
+    SCOPED_TRACE(uuid);
+    PeerId id(uuid);
+    ASSERT_EQ(uuid, id.uuid());
+    ASSERT_EQ(PeerId(string(uuid)), id);
+    ASSERT_EQ(PeerId(string(uuid)).hash(), id.hash());
+  }
+  ASSERT_NE(PeerId("peer-0"), PeerId("peer-1"));
+  ASSERT_EQ("", PeerId().uuid());
+  ASSERT_EQ(PeerId(""), PeerId());
+}
+
+// Test that ids order like their uuids, so that ordered maps keyed by them
+// iterate in the same order as ones keyed by uuids.
+TEST_F(PeerIdTest, TestOrdering) {
+  const char* kUuids[] = {
+    "",
+    "0000000000000000ffffffffffffffff",
+    "00000000000000010000000000000000",
+    "A",
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+    "peer-0",
+    "peer-1",
+  };
+  for (int i = 0; i < arraysize(kUuids); i++) {
+    for (int j = 0; j < arraysize(kUuids); j++) {
+      SCOPED_TRACE(strings::Substitute("$0 < $1", kUuids[i], kUuids[j]));
+      ASSERT_EQ(string(kUuids[i]) < string(kUuids[j]), PeerId(kUuids[i]) < PeerId(kUuids[j]));
+    }
+  }
+}
+
+TEST_F(PeerIdTest, TestLookUpByUuid) {
+  std::unordered_map<PeerId, int> peers;
+  peers.emplace(string("0123456789abcdeffedcba9876543210"), 1);
+  peers.emplace(string("peer-0"), 2);
+  ASSERT_EQ(1, peers.at(string("0123456789abcdeffedcba9876543210")));
+  ASSERT_EQ(2, peers.at(string("peer-0")));
+  ASSERT_EQ(0, peers.count(string("peer-1")));
+}
+
+} // namespace consensus
+} // namespace kudu
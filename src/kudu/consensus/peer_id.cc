@@ -0,0 +1,104 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/peer_id.h"
+
+#include <cstring>
+#include <ostream>
+
+#include "kudu/gutil/hash/city.h"
+#include "kudu/gutil/int128.h"
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// The length of a canonical uuid, in hex digits.
+constexpr size_t kCanonicalUuidLength = 32;
+
+// Returns the value of lowercase hex digit 'c', or -1 if it isn't one.
+int HexDigitValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+} // anonymous namespace
+
+PeerId::PeerId() {
+  Parse("", 0);
+}
+
+PeerId::PeerId(const std::string& uuid) {
+  Parse(uuid.data(), uuid.size());
+}
+
+PeerId::PeerId(const char* uuid) {
+  Parse(uuid, strlen(uuid));
+}
+
+void PeerId::Parse(const char* uuid, size_t len) {
+  if (len == kCanonicalUuidLength) {
+    uint64_t halves[2] = { 0, 0 };
+    bool canonical = true;
+    for (size_t i = 0; i < kCanonicalUuidLength && canonical; i++) {
+      int v = HexDigitValue(uuid[i]);
+      canonical = v >= 0;
+      halves[i / 16] = (halves[i / 16] << 4) | v;
+    }
+    if (canonical) {
+      hi_ = halves[0];
+      lo_ = halves[1];
+      canonical_ = true;
+      return;
+    }
+  }
+  uint128 fp = util_hash::CityHash128(uuid, len);
+  hi_ = Uint128High64(fp);
+  lo_ = Uint128Low64(fp);
+  canonical_ = false;
+  other_uuid_.assign(uuid, len);
+}
+
+std::string PeerId::uuid() const {
+  if (!canonical_) {
+    return other_uuid_;
+  }
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string uuid(kCanonicalUuidLength, '0');
+  for (size_t i = 0; i < kCanonicalUuidLength; i++) {
+    uint64_t half = i < 16 ? hi_ : lo_;
+    uuid[i] = kHexDigits[(half >> (4 * (15 - i % 16))) & 0xf];
+  }
+  return uuid;
+}
+
+bool PeerId::operator<(const PeerId& other) const {
+  if (canonical_ && other.canonical_) {
+    // The hex digits order like the values they encode.
+    return hi_ < other.hi_ || (hi_ == other.hi_ && lo_ < other.lo_);
+  }
+  return uuid() < other.uuid();
+}
+
+std::ostream& operator<<(std::ostream& os, const PeerId& id) {
+  return os << id.uuid();
+}
+
+} // namespace consensus
+} // namespace kudu
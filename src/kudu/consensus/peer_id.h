@@ -0,0 +1,85 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+namespace kudu {
+namespace consensus {
+
+// The identity of a peer, as a key for the maps of peers on the hot paths of
+// consensus, in place of its permanent uuid.
+//
+// The uuid is parsed once, when the id is constructed. Uuids in their
+// canonical form, 32 lowercase hex digits, are kept only as the 128 bits
+// they encode: constructing the id of one doesn't allocate, and ids are
+// compared with two integer comparisons and hashed with a multiply. Other
+// uuids, e.g. those of tests, are kept along with a 128-bit fingerprint,
+// which is compared before the uuid itself. Either way, two ids are equal
+// exactly when their uuids are, and ids order like their uuids.
+class PeerId {
+ public:
+  PeerId();
+
+  // Implicit, so that maps keyed by ids can still be looked up by uuid.
+  PeerId(const std::string& uuid); // NOLINT(runtime/explicit)
+  PeerId(const char* uuid); // NOLINT(runtime/explicit)
+
+  // Returns the uuid, for logging and protobufs.
+  std::string uuid() const;
+
+  size_t hash() const {
+    return static_cast<size_t>((hi_ ^ lo_) * 0x9E3779B97F4A7C15ULL);
+  }
+
+  bool operator==(const PeerId& other) const {
+    return hi_ == other.hi_ && lo_ == other.lo_ && canonical_ == other.canonical_ &&
+        (canonical_ || other_uuid_ == other.other_uuid_);
+  }
+  bool operator!=(const PeerId& other) const { return !(*this == other); }
+  bool operator<(const PeerId& other) const;
+
+ private:
+  void Parse(const char* uuid, size_t len);
+
+  // The bits of a canonical uuid, or else the fingerprint of the uuid.
+  uint64_t hi_;
+  uint64_t lo_;
+  bool canonical_;
+
+  // The uuid if it isn't canonical, empty otherwise.
+  std::string other_uuid_;
+};
+
+std::ostream& operator<<(std::ostream& os, const PeerId& id);
+
+} // namespace consensus
+} // namespace kudu
+
+// Specialize std::hash for PeerId
+namespace std {
+template<>
+struct hash<kudu::consensus::PeerId> {
+  size_t operator()(const kudu::consensus::PeerId& id) const {
+    return id.hash();
+  }
+};
+} // namespace std
@@ -23,6 +23,7 @@
 #include <type_traits>
 #include <utility>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/consensus/consensus_peers.h"
@@ -31,11 +32,41 @@
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/metrics.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_bool(raft_dedicated_peer_pool_tokens, false,
+            "Whether each remote peer of a tablet assembles its requests and handles "
+            "its responses on a serial Raft thread pool token of its own, rather than "
+            "on the token it shares with the other peers and with RaftConsensus. With "
+            "a token of its own, a peer which is slow to handle responses doesn't delay "
+            "the heartbeats and requests to the other peers. Takes effect for peers "
+            "created after it is changed.");
+TAG_FLAG(raft_dedicated_peer_pool_tokens, experimental);
+TAG_FLAG(raft_dedicated_peer_pool_tokens, runtime);
+
+DEFINE_bool(raft_prewarm_peer_connections, false,
+            "Whether a replica which becomes leader starts connecting to all the "
+            "other members of the config right away, so that its first requests "
+            "don't wait for the connections to be negotiated. That includes the "
+            "connections for bulk traffic of --raft_bulk_connections_per_peer.");
+TAG_FLAG(raft_prewarm_peer_connections, experimental);
+TAG_FLAG(raft_prewarm_peer_connections, runtime);
+
+METRIC_DEFINE_histogram(server, raft_peer_request_dispatch_latency,
+                        "Peer Request Dispatch Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from a peer being signaled that there is a request "
+                        "to send until the request is handed to the RPC layer. Includes "
+                        "the time queued on the Raft thread pool and assembling the request.",
+                        60000000LU, 2);
 
 using kudu::log::Log;
 using kudu::pb_util::SecureShortDebugString;
 using std::shared_ptr;
+using std::unique_ptr;
 using strings::Substitute;
 
 namespace kudu {
@@ -45,14 +76,21 @@ PeerManager::PeerManager(std::string tablet_id,
                          std::string local_uuid,
                          PeerProxyFactory* peer_proxy_factory,
                          PeerMessageQueue* queue,
+                         ThreadPool* raft_pool,
                          ThreadPoolToken* raft_pool_token,
-                         scoped_refptr<log::Log> log)
+                         scoped_refptr<log::Log> log,
+                         const scoped_refptr<MetricEntity>& metric_entity)
     : tablet_id_(std::move(tablet_id)),
       local_uuid_(std::move(local_uuid)),
       peer_proxy_factory_(peer_proxy_factory),
       queue_(queue),
+      raft_pool_(raft_pool),
       raft_pool_token_(raft_pool_token),
       log_(std::move(log)) {
+  if (metric_entity) {
+    request_dispatch_latency_ =
+        METRIC_raft_peer_request_dispatch_latency.Instantiate(metric_entity);
+  }
 }
 
 PeerManager::~PeerManager() {
@@ -76,16 +114,28 @@ Status PeerManager::UpdateRaftConfig(const RaftConfigPB& config) {
     shared_ptr<PeerProxy> peer_proxy;
     RETURN_NOT_OK_PREPEND(peer_proxy_factory_->NewProxy(peer_pb, &peer_proxy),
                           "Could not obtain a remote proxy to the peer.");
+    if (FLAGS_raft_prewarm_peer_connections) {
+      peer_proxy->WarmUpConnections();
+    }
     peer_proxy_pool_.Put(peer_pb.permanent_uuid(), peer_proxy);
+    ThreadPoolToken* pool_token = raft_pool_token_;
+    if (FLAGS_raft_dedicated_peer_pool_tokens && raft_pool_) {
+      unique_ptr<ThreadPoolToken>& token = peer_pool_tokens_[peer_pb.permanent_uuid()];
+      if (!token) {
+        token = raft_pool_->NewToken(ThreadPool::ExecutionMode::SERIAL);
+      }
+      pool_token = token.get();
+    }
     std::shared_ptr<Peer> remote_peer;
     RETURN_NOT_OK(Peer::NewRemotePeer(peer_pb,
                                       tablet_id_,
                                       local_uuid_,
                                       queue_,
                                       &peer_proxy_pool_,
-                                      raft_pool_token_,
+                                      pool_token,
                                       std::move(peer_proxy),
                                       peer_proxy_factory_->messenger(),
+                                      request_dispatch_latency_,
                                       &remote_peer));
     peers_.emplace(peer_pb.permanent_uuid(), std::move(remote_peer));
   }
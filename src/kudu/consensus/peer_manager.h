@@ -22,6 +22,7 @@
 #include <unordered_map>
 
 #include "kudu/consensus/consensus_peers.h"
+#include "kudu/consensus/peer_id.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/locks.h"
@@ -29,6 +30,9 @@
 
 namespace kudu {
 
+class Histogram;
+class MetricEntity;
+class ThreadPool;
 class ThreadPoolToken;
 
 namespace log {
@@ -46,12 +50,18 @@ class PeerManager {
  public:
   // All of the raw pointer arguments are not owned by the PeerManager
   // and must live at least as long as the PeerManager.
+  //
+  // Peers send their requests and handle their responses on
+  // 'raft_pool_token', or with --raft_dedicated_peer_pool_tokens on a serial
+  // token of their own from 'raft_pool'.
   PeerManager(std::string tablet_id,
               std::string local_uuid,
               PeerProxyFactory* peer_proxy_factory,
               PeerMessageQueue* queue,
+              ThreadPool* raft_pool,
               ThreadPoolToken* raft_pool_token,
-              scoped_refptr<log::Log> log);
+              scoped_refptr<log::Log> log,
+              const scoped_refptr<MetricEntity>& metric_entity);
 
   ~PeerManager();
 
@@ -75,10 +85,17 @@ class PeerManager {
   const std::string local_uuid_;
   PeerProxyFactory* peer_proxy_factory_;
   PeerMessageQueue* queue_;
+  ThreadPool* raft_pool_;
   ThreadPoolToken* raft_pool_token_;
   scoped_refptr<log::Log> log_;
+  scoped_refptr<Histogram> request_dispatch_latency_;
+
+  // The serial tokens of the peers, with --raft_dedicated_peer_pool_tokens,
+  // keyed by peer UUID. They are kept until the PeerManager is destroyed, as
+  // callbacks of closed peers may still be submitting tasks to them.
+  std::unordered_map<PeerId, std::unique_ptr<ThreadPoolToken>> peer_pool_tokens_;
   PeerProxyPool peer_proxy_pool_;
-  std::unordered_map<std::string, std::shared_ptr<Peer>> peers_;
+  std::unordered_map<PeerId, std::shared_ptr<Peer>> peers_;
   mutable simple_spinlock lock_;
 
   DISALLOW_COPY_AND_ASSIGN(PeerManager);
@@ -17,39 +17,88 @@
 
 #include "kudu/consensus/pending_rounds.h"
 
+#include <algorithm>
 #include <ostream>
 #include <utility>
 
+#include <boost/optional/optional.hpp>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "kudu/consensus/apply_scheduler.h"
+#include "kudu/consensus/commit_waiters.h"
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/raft_consensus.h"
 #include "kudu/consensus/time_manager.h"
-#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/debug-util.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/op_timeline.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread_restrictions.h"
 
+DEFINE_bool(raft_batch_commit_notifications, false,
+            "If true, the rounds committed by one advancement of the committed "
+            "index are handed to the ConsensusRoundHandler in a single call, "
+            "so that they can be applied as a group, instead of having their "
+            "replicated callbacks invoked one by one.");
+TAG_FLAG(raft_batch_commit_notifications, experimental);
+TAG_FLAG(raft_batch_commit_notifications, runtime);
+
+METRIC_DEFINE_gauge_int64(server, raft_pending_rounds_bytes,
+                          "Pending Rounds Bytes",
+                          kudu::MetricUnit::kBytes,
+                          "Total size of the replicate messages of the operations "
+                          "which are pending commit on this replica.");
+
 using kudu::pb_util::SecureShortDebugString;
 using std::string;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
 namespace consensus {
 
+namespace {
+
+// Records that the replication of 'round' was reported as finished, into
+// its timeline if it has one.
+void RecordApplied(const string& tablet_id, ConsensusRound* round) {
+  const OpId& id = round->replicate_msg()->id();
+  OpTimeline::Record(tablet_id, id.term(), id.index(), OpTimeline::APPLY);
+}
+
+} // anonymous namespace
+
 //------------------------------------------------------------
 // PendingRounds
 //------------------------------------------------------------
 
-PendingRounds::PendingRounds(string log_prefix, scoped_refptr<ITimeManager> time_manager)
+PendingRounds::PendingRounds(string log_prefix, string tablet_id,
+                             scoped_refptr<ITimeManager> time_manager,
+                             ConsensusRoundHandler* round_handler,
+                             const scoped_refptr<MetricEntity>& metric_entity)
     : log_prefix_(std::move(log_prefix)),
+      tablet_id_(std::move(tablet_id)),
+      pending_bytes_(0),
       last_committed_op_id_(MinimumOpId()),
-      time_manager_(std::move(time_manager)) {}
+      published_committed_seq_(0),
+      published_committed_term_(last_committed_op_id_.term()),
+      published_committed_index_(last_committed_op_id_.index()),
+      time_manager_(std::move(time_manager)),
+      round_handler_(round_handler),
+      apply_scheduler_(nullptr),
+      commit_waiters_(nullptr) {
+  if (metric_entity) {
+    pending_bytes_metric_ = METRIC_raft_pending_rounds_bytes.Instantiate(metric_entity, 0);
+  }
+}
 
 PendingRounds::~PendingRounds() {
 }
@@ -63,10 +112,10 @@ Status PendingRounds::CancelPendingTransactions() {
   LOG_WITH_PREFIX(INFO) << "Trying to abort " << pending_txns_.size()
                         << " pending transactions.";
   for (const auto& txn : pending_txns_) {
-    const scoped_refptr<ConsensusRound>& round = txn.second;
+    const scoped_refptr<ConsensusRound>& round = txn.round;
     // We cancel only transactions whose applies have not yet been triggered.
     LOG_WITH_PREFIX(INFO) << "Aborting transaction as it isn't in flight: "
-                                   << SecureShortDebugString(*txn.second->replicate_msg());
+                                   << SecureShortDebugString(*round->replicate_msg());
     round->NotifyReplicationFinished(Status::Aborted("Transaction aborted"));
   }
   return Status::OK();
@@ -79,38 +128,48 @@ void PendingRounds::AbortOpsAfter(int64_t index) {
   DCHECK_GE(index, 0);
   OpId new_preceding;
 
-  auto iter = pending_txns_.lower_bound(index);
-
   // Either the new preceding id is in the pendings set or it must be equal to the
   // committed index since we can't truncate already committed operations.
-  if (iter != pending_txns_.end() && (*iter).first == index) {
-    new_preceding = (*iter).second->replicate_msg()->id();
-    ++iter;
+  int64_t pos = PositionOfIndex(index);
+  if (pos >= 0) {
+    new_preceding = pending_txns_[pos].round->replicate_msg()->id();
   } else {
     CHECK_EQ(index, last_committed_op_id_.index());
     new_preceding = last_committed_op_id_;
   }
 
-  for (; iter != pending_txns_.end();) {
-    const scoped_refptr<ConsensusRound>& round = (*iter).second;
+  while (!pending_txns_.empty() &&
+         pending_txns_.back().round->replicate_msg()->id().index() > index) {
+    scoped_refptr<ConsensusRound> round = pending_txns_.back().round;
+    UpdatePendingBytes(-pending_txns_.back().bytes);
+    // Erase the entry from pendings.
+    pending_txns_.pop_back();
+
     auto op_type = round->replicate_msg()->op_type();
     LOG_WITH_PREFIX(INFO)
         << "Aborting uncommitted " << OperationType_Name(op_type)
         << " operation due to leader change: " << round->replicate_msg()->id();
 
     round->NotifyReplicationFinished(Status::Aborted("Transaction aborted by new leader"));
-    // Erase the entry from pendings.
-    pending_txns_.erase(iter++);
   }
 }
 
 Status PendingRounds::AddPendingOperation(const scoped_refptr<ConsensusRound>& round) {
-  InsertOrDie(&pending_txns_, round->replicate_msg()->id().index(), round);
+  int64_t index = round->replicate_msg()->id().index();
+  if (!pending_txns_.empty()) {
+    int64_t last_index = pending_txns_.back().round->replicate_msg()->id().index();
+    CHECK_EQ(last_index + 1, index)
+        << LogPrefix() << "Pending operations must be added in index order";
+  }
+  int64_t bytes = round->replicate_msg()->ByteSizeLong();
+  pending_txns_.push_back({ round, bytes });
+  UpdatePendingBytes(bytes);
   return Status::OK();
 }
 
 scoped_refptr<ConsensusRound> PendingRounds::GetPendingOpByIndexOrNull(int64_t index) {
-  return FindPtrOrNull(pending_txns_, index);
+  int64_t pos = PositionOfIndex(index);
+  return pos < 0 ? nullptr : pending_txns_[pos].round;
 }
 
 bool PendingRounds::IsOpCommittedOrPending(const OpId& op_id, bool* term_mismatch) {
@@ -135,7 +194,18 @@ bool PendingRounds::IsOpCommittedOrPending(const OpId& op_id, bool* term_mismatc
 
 OpId PendingRounds::GetLastPendingTransactionOpId() const {
   return pending_txns_.empty()
-      ? MinimumOpId() : (--pending_txns_.end())->second->id();
+      ? MinimumOpId() : pending_txns_.back().round->id();
+}
+
+int64_t PendingRounds::FirstPendingIndexOfTerm(int64_t term, int64_t index) const {
+  int64_t pos = PositionOfIndex(index);
+  if (pos < 0 || pending_txns_[pos].round->id().term() != term) {
+    return -1;
+  }
+  auto first = std::partition_point(
+      pending_txns_.begin(), pending_txns_.begin() + pos,
+      [term](const PendingRound& p) { return p.round->id().term() < term; });
+  return first->round->id().index();
 }
 
 Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
@@ -160,18 +230,17 @@ Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
     return Status::OK();
   }
 
-  // Start at the operation after the last committed one.
-  auto iter = pending_txns_.upper_bound(last_committed_op_id_.index());
-  // Stop at the operation after the last one we must commit.
-  auto end_iter = pending_txns_.upper_bound(committed_index);
-  CHECK(iter != pending_txns_.end());
+  // Ops at or below the last committed one have already been popped, so the
+  // front is the operation after the last committed one.
+  CHECK_GT(GetLastPendingTransactionOpId().index(), last_committed_op_id_.index());
 
   VLOG_WITH_PREFIX(1) << "Last triggered apply was: "
       <<  last_committed_op_id_
-      << " Starting to apply from log index: " << (*iter).first;
+      << " Starting to apply from log index: " << FirstPendingIndex();
 
-  while (iter != end_iter) {
-    scoped_refptr<ConsensusRound> round = (*iter).second; // Make a copy.
+  const bool batch = round_handler_ && FLAGS_raft_batch_commit_notifications;
+  while (!pending_txns_.empty() && FirstPendingIndex() <= committed_index) {
+    scoped_refptr<ConsensusRound> round = PopFront();
     DCHECK(round);
     const OpId& current_id = round->id();
 
@@ -179,19 +248,50 @@ Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
       CHECK_OK(CheckOpInSequence(last_committed_op_id_, current_id));
     }
 
-    pending_txns_.erase(iter++);
     last_committed_op_id_ = round->id();
+    OpTimeline::Record(tablet_id_, current_id.term(), current_id.index(), OpTimeline::COMMIT);
     time_manager_->AdvanceSafeTimeWithMessage(*round->replicate_msg());
-    round->NotifyReplicationFinished(Status::OK());
+    if (apply_scheduler_ && round->replicate_msg()->op_type() == WRITE_OP_EXT) {
+      const ReplicateMsg* msg = round->replicate_msg();
+      boost::optional<uint64_t> key;
+      if (msg->has_dependency_key()) {
+        key = msg->dependency_key();
+      }
+      // The callback may run once this object is gone, so it holds on to
+      // the tablet id of the op's timeline, if it has one.
+      string timeline_tablet_id;
+      if (OpTimeline::IsSampled(current_id.index()) ||
+          OpTimeline::IsTraced(current_id.index())) {
+        timeline_tablet_id = tablet_id_;
+      }
+      apply_scheduler_->Schedule(key, [round, timeline_tablet_id]() {
+        round->NotifyReplicationFinished(Status::OK());
+        RecordApplied(timeline_tablet_id, round.get());
+      });
+    } else if (batch) {
+      committed_rounds_.emplace_back(std::move(round));
+    } else {
+      round->NotifyReplicationFinished(Status::OK());
+      RecordApplied(tablet_id_, round.get());
+    }
   }
 
+  if (!committed_rounds_.empty()) {
+    round_handler_->FinishReplicationOfRounds(committed_rounds_);
+    for (const scoped_refptr<ConsensusRound>& round : committed_rounds_) {
+      RecordApplied(tablet_id_, round.get());
+    }
+    committed_rounds_.clear();
+  }
+
+  PublishLastCommittedOpId();
   return Status::OK();
 }
 
 Status PendingRounds::SetInitialCommittedOpId(const OpId& committed_op) {
   CHECK_EQ(last_committed_op_id_.index(), 0);
   if (!pending_txns_.empty()) {
-    int64_t first_pending_index = pending_txns_.begin()->first;
+    int64_t first_pending_index = FirstPendingIndex();
     if (committed_op.index() < first_pending_index) {
       if (committed_op.index() != first_pending_index - 1) {
         return Status::Corruption(Substitute(
@@ -209,6 +309,7 @@ Status PendingRounds::SetInitialCommittedOpId(const OpId& committed_op) {
   } else {
     last_committed_op_id_ = committed_op;
   }
+  PublishLastCommittedOpId();
   return Status::OK();
 }
 
@@ -232,9 +333,70 @@ int64_t PendingRounds::GetTermWithLastCommittedOp() const {
   return last_committed_op_id_.term();
 }
 
+OpId PendingRounds::GetPublishedLastCommittedOpId() const {
+  while (true) {
+    uint64_t seq = published_committed_seq_.load(std::memory_order_acquire);
+    if (PREDICT_FALSE(seq & 1)) {
+      base::subtle::PauseCPU();
+      continue;
+    }
+    int64_t term = published_committed_term_.load(std::memory_order_relaxed);
+    int64_t index = published_committed_index_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (PREDICT_TRUE(published_committed_seq_.load(std::memory_order_relaxed) == seq)) {
+      return MakeOpId(term, index);
+    }
+  }
+}
+
+void PendingRounds::PublishLastCommittedOpId() {
+  // Writers are serialized by the external synchronization of this class.
+  uint64_t seq = published_committed_seq_.load(std::memory_order_relaxed);
+  published_committed_seq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  published_committed_term_.store(last_committed_op_id_.term(), std::memory_order_relaxed);
+  published_committed_index_.store(last_committed_op_id_.index(), std::memory_order_relaxed);
+  published_committed_seq_.store(seq + 2, std::memory_order_release);
+
+  if (commit_waiters_) {
+    commit_waiters_->Advance(last_committed_op_id_.index());
+  }
+}
+
 int PendingRounds::GetNumPendingTxns() const {
   return pending_txns_.size();
 }
 
+int64_t PendingRounds::FirstPendingIndex() const {
+  DCHECK(!pending_txns_.empty());
+  return pending_txns_.front().round->replicate_msg()->id().index();
+}
+
+int64_t PendingRounds::PositionOfIndex(int64_t index) const {
+  if (pending_txns_.empty()) {
+    return -1;
+  }
+  int64_t pos = index - FirstPendingIndex();
+  if (pos < 0 || pos >= static_cast<int64_t>(pending_txns_.size())) {
+    return -1;
+  }
+  return pos;
+}
+
+scoped_refptr<ConsensusRound> PendingRounds::PopFront() {
+  scoped_refptr<ConsensusRound> round = std::move(pending_txns_.front().round);
+  UpdatePendingBytes(-pending_txns_.front().bytes);
+  pending_txns_.pop_front();
+  return round;
+}
+
+void PendingRounds::UpdatePendingBytes(int64_t delta) {
+  int64_t pending_bytes = pending_bytes_.load(std::memory_order_relaxed) + delta;
+  pending_bytes_.store(pending_bytes, std::memory_order_relaxed);
+  if (pending_bytes_metric_) {
+    pending_bytes_metric_->set_value(pending_bytes);
+  }
+}
+
 }  // namespace consensus
 }  // namespace kudu
@@ -17,33 +17,59 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
-#include <map>
+#include <deque>
 #include <string>
+#include <vector>
 
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
 
 namespace kudu {
 class Status;
 
 namespace consensus {
+class ApplyScheduler;
+class CommitWaiters;
 class ConsensusRound;
+class ConsensusRoundHandler;
 class ITimeManager;
 
 // Tracks the pending consensus rounds being managed by a Raft replica (either leader
 // or follower).
 //
-// This class is not thread-safe.
+// This class is not thread-safe, with the exception of
+// GetPublishedLastCommittedOpId() and GetPendingBytes().
 //
 // TODO(todd): this class inconsistently uses the term "round", "op", and "transaction".
 // We should consolidate to "round".
 class PendingRounds {
  public:
-  PendingRounds(std::string log_prefix, scoped_refptr<ITimeManager> time_manager);
+  // 'round_handler', if not null, is handed the rounds committed by each
+  // AdvanceCommittedIndex() call in one batch when
+  // --raft_batch_commit_notifications is set. 'metric_entity' may be null, in
+  // which case the pending bytes aren't exported as a metric.
+  PendingRounds(std::string log_prefix, std::string tablet_id,
+                scoped_refptr<ITimeManager> time_manager,
+                ConsensusRoundHandler* round_handler = nullptr,
+                const scoped_refptr<MetricEntity>& metric_entity = nullptr);
   ~PendingRounds();
 
+  // Hands the committed write ops to 'apply_scheduler', if not null, instead
+  // of notifying them inline. The scheduler must outlive this object.
+  void SetApplyScheduler(ApplyScheduler* apply_scheduler) {
+    apply_scheduler_ = apply_scheduler;
+  }
+
+  // Runs the callbacks of 'commit_waiters', if not null, as the committed
+  // index advances. The waiters must outlive this object.
+  void SetCommitWaiters(CommitWaiters* commit_waiters) {
+    commit_waiters_ = commit_waiters;
+  }
+
   // Set the committed op during startup. This should be done after
   // appending any of the pending transactions, and will take care
   // of triggering any that are now considered committed.
@@ -76,6 +102,12 @@ class PendingRounds {
   // latest index). This must be called under the lock.
   OpId GetLastPendingTransactionOpId() const;
 
+  // Returns the index of the first pending op of 'term', given that the
+  // pending op at 'index' is of that term, or -1 if it isn't. Since terms
+  // never decrease along the log, that is where the ops of 'term' start
+  // (or the first pending index, if they started before it).
+  int64_t FirstPendingIndexOfTerm(int64_t term, int64_t index) const;
+
   // Used by replicas to cancel pending transactions. Pending transaction are those
   // that have completed prepare/replicate but are waiting on the LEADER's commit
   // to complete. This does not cancel transactions being applied.
@@ -85,32 +117,86 @@ class PendingRounds {
   // i.e. transactions for which Prepare() is done or under way.
   int GetNumPendingTxns() const;
 
+  // Returns the total serialized size of the replicate messages of the pending
+  // transactions. May be called without external synchronization.
+  int64_t GetPendingBytes() const { return pending_bytes_.load(std::memory_order_relaxed); }
+
   // Returns the watermark below which all operations are known to
   // be committed according to consensus.
   // TODO(todd): these should probably be removed in favor of using the queue.
   int64_t GetCommittedIndex() const;
   int64_t GetTermWithLastCommittedOp() const;
 
+  // Returns the OpId of the round that was last committed, as of the end of
+  // the last call to AdvanceCommittedIndex() or SetInitialCommittedOpId().
+  // May be called without external synchronization.
+  OpId GetPublishedLastCommittedOpId() const;
+
   // Checks that 'current' correctly follows 'previous'. Specifically it checks
   // that the term is the same or higher and that the index is sequential.
   static Status CheckOpInSequence(const OpId& previous, const OpId& current);
 
  private:
+  struct PendingRound {
+    scoped_refptr<ConsensusRound> round;
+    // The serialized size of the round's replicate message when it was added.
+    int64_t bytes;
+  };
+
   const std::string& LogPrefix() const { return log_prefix_; }
 
+  // Returns the index of the first pending op. 'pending_txns_' must not be empty.
+  int64_t FirstPendingIndex() const;
+
+  // Returns the position of 'index' in 'pending_txns_', or -1 if no pending op
+  // has that index.
+  int64_t PositionOfIndex(int64_t index) const;
+
+  // Removes the first pending op, returning its round.
+  scoped_refptr<ConsensusRound> PopFront();
+
+  void UpdatePendingBytes(int64_t delta);
+
+  // Copies 'last_committed_op_id_' to the published committed OpId, and
+  // wakes the commit waiters it satisfies.
+  void PublishLastCommittedOpId();
+
   const std::string log_prefix_;
+  const std::string tablet_id_;
 
-  // Index=>Round map that manages pending ops, i.e. operations for which we've
-  // received a replicate message from the leader but have yet to be committed.
-  // The key is the index of the replicate operation.
-  typedef std::map<int64_t, scoped_refptr<ConsensusRound> > IndexToRoundMap;
-  IndexToRoundMap pending_txns_;
+  // The pending ops, i.e. operations for which we've received a replicate
+  // message from the leader but have yet to be committed, in index order.
+  // Pending indexes are contiguous, so the op with index 'i' is found at
+  // position 'i - FirstPendingIndex()'. Commits pop from the front and
+  // aborts pop from the back.
+  std::deque<PendingRound> pending_txns_;
+
+  // Sum of 'bytes' over 'pending_txns_'. Only written under the external
+  // synchronization of this class, but read without it.
+  std::atomic<int64_t> pending_bytes_;
+  scoped_refptr<AtomicGauge<int64_t>> pending_bytes_metric_;
 
   // The OpId of the round that was last committed. Initialized to MinimumOpId().
   OpId last_committed_op_id_;
 
+  // The published copy of 'last_committed_op_id_', written under a sequence
+  // count which is odd while it is written.
+  std::atomic<uint64_t> published_committed_seq_;
+  std::atomic<int64_t> published_committed_term_;
+  std::atomic<int64_t> published_committed_index_;
+
   scoped_refptr<ITimeManager> time_manager_;
 
+  ConsensusRoundHandler* const round_handler_;
+
+  ApplyScheduler* apply_scheduler_;
+
+  CommitWaiters* commit_waiters_;
+
+  // Scratch space for the rounds committed by one AdvanceCommittedIndex()
+  // call, kept to avoid an allocation per commit.
+  std::vector<scoped_refptr<ConsensusRound>> committed_rounds_;
+
   DISALLOW_COPY_AND_ASSIGN(PendingRounds);
 };
 
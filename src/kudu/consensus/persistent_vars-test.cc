@@ -0,0 +1,90 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/persistent_vars.h"
+#include "kudu/consensus/persistent_vars_manager.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+namespace kudu {
+namespace consensus {
+
+using std::shared_ptr;
+using std::string;
+
+static const char* const kTabletId = "test-persistent-vars";
+
+class PersistentVarsTest : public KuduTest {
+ public:
+  PersistentVarsTest()
+    : fs_manager_(env_, GetTestPath("fs_root")) {
+  }
+
+  void SetUp() override {
+    KuduTest::SetUp();
+    ASSERT_OK(fs_manager_.CreateInitialFileSystemLayout());
+    ASSERT_OK(fs_manager_.Open());
+  }
+
+ protected:
+  FsManager fs_manager_;
+};
+
+// Tests that a batch applies all of its changes with one write, and that
+// readers holding the old token are unaffected by it.
+TEST_F(PersistentVarsTest, TestBatchedUpdates) {
+  scoped_refptr<PersistentVarsManager> manager(new PersistentVarsManager(&fs_manager_));
+  scoped_refptr<PersistentVars> vars;
+  ASSERT_OK(manager->CreatePersistentVars(kTabletId, &vars));
+  ASSERT_TRUE(vars->is_start_election_allowed());
+  ASSERT_FALSE(vars->raft_rpc_token());
+
+  vars->set_raft_rpc_token(string("ring-a"));
+  ASSERT_OK(vars->Flush());
+  shared_ptr<const string> old_token = vars->raft_rpc_token();
+  ASSERT_EQ("ring-a", *old_token);
+
+  // Nothing is visible until the batch is committed.
+  PersistentVars::Batch batch = vars->StartBatch();
+  batch.set_allow_start_election(false);
+  batch.set_raft_rpc_token(string("ring-b"));
+  ASSERT_TRUE(batch.changes_raft_rpc_token());
+  ASSERT_TRUE(vars->is_start_election_allowed());
+  ASSERT_EQ("ring-a", *vars->raft_rpc_token());
+
+  ASSERT_OK(vars->CommitBatch(std::move(batch)));
+  ASSERT_FALSE(vars->is_start_election_allowed());
+  ASSERT_EQ("ring-b", *vars->raft_rpc_token());
+  ASSERT_EQ("ring-a", *old_token);
+
+  // A fresh manager loads both changes from disk.
+  manager.reset(new PersistentVarsManager(&fs_manager_));
+  ASSERT_OK(manager->LoadPersistentVars(kTabletId, &vars));
+  ASSERT_FALSE(vars->is_start_election_allowed());
+  ASSERT_EQ("ring-b", *vars->raft_rpc_token());
+}
+
+} // namespace consensus
+} // namespace kudu
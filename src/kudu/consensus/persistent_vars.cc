@@ -17,6 +17,7 @@
 #include "kudu/consensus/persistent_vars.h"
 
 #include <atomic>
+#include <memory>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
@@ -39,39 +40,88 @@ using std::string;
 using strings::Substitute;
 
 bool PersistentVars::is_start_election_allowed() const {
-  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   // allow_start_election is optional with default = true
   // So if it not present, we will allow start elections by default
-  return pb_.allow_start_election();
+  return std::atomic_load_explicit(&snapshot_, std::memory_order_acquire)
+      ->allow_start_election();
 }
 
 void PersistentVars::set_allow_start_election(bool val) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   pb_.set_allow_start_election(val);
+  PublishSnapshot();
 }
 
 std::shared_ptr<const std::string> PersistentVars::raft_rpc_token() const {
-  return std::atomic_load_explicit(&raft_rpc_token_cache_,
-                                   std::memory_order_relaxed);
+  auto snapshot = std::atomic_load_explicit(&snapshot_, std::memory_order_acquire);
+  if (!snapshot->has_raft_rpc_token()) {
+    return nullptr;
+  }
+  // Share ownership of the snapshot the token lives in.
+  return std::shared_ptr<const std::string>(snapshot, &snapshot->raft_rpc_token());
+}
+
+std::shared_ptr<const std::string> PersistentVars::compression_dictionary() const {
+  auto snapshot = std::atomic_load_explicit(&snapshot_, std::memory_order_acquire);
+  if (!snapshot->has_compression_dictionary()) {
+    return nullptr;
+  }
+  return std::shared_ptr<const std::string>(snapshot, &snapshot->compression_dictionary());
 }
 
 void PersistentVars::set_raft_rpc_token(
     boost::optional<std::string> rpc_token) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
   if (rpc_token) {
-    std::atomic_store_explicit(&raft_rpc_token_cache_,
-                               std::make_shared<const std::string>(*rpc_token),
-                               std::memory_order_relaxed);
     pb_.set_raft_rpc_token(*std::move(rpc_token));
   } else {
-    std::atomic_store_explicit(&raft_rpc_token_cache_, {},
-                               std::memory_order_relaxed);
     pb_.clear_raft_rpc_token();
   }
+  PublishSnapshot();
+}
+
+void PersistentVars::Batch::set_allow_start_election(bool val) {
+  pb_.set_allow_start_election(val);
+}
+
+void PersistentVars::Batch::set_raft_rpc_token(boost::optional<std::string> rpc_token) {
+  if (rpc_token) {
+    pb_.set_raft_rpc_token(*std::move(rpc_token));
+  } else {
+    pb_.clear_raft_rpc_token();
+  }
+  changes_raft_rpc_token_ = true;
+}
+
+void PersistentVars::Batch::set_compression_dictionary(
+    boost::optional<std::string> dictionary) {
+  if (dictionary) {
+    pb_.set_compression_dictionary(*std::move(dictionary));
+  } else {
+    pb_.clear_compression_dictionary();
+  }
+  changes_compression_dictionary_ = true;
 }
 
 Status PersistentVars::Flush(FlushMode flush_mode) {
   DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  return WriteToDisk(pb_, flush_mode);
+}
+
+PersistentVars::Batch PersistentVars::StartBatch() const {
+  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  return Batch(pb_);
+}
+
+Status PersistentVars::CommitBatch(Batch batch) {
+  DFAKE_SCOPED_RECURSIVE_LOCK(fake_lock_);
+  RETURN_NOT_OK(WriteToDisk(batch.pb_, OVERWRITE));
+  pb_ = std::move(batch.pb_);
+  PublishSnapshot();
+  return Status::OK();
+}
+
+Status PersistentVars::WriteToDisk(const PersistentVarsPB& pb, FlushMode flush_mode) {
   SCOPED_LOG_SLOW_EXECUTION_PREFIX(WARNING, 500, LogPrefix(), "flushing persistent variables");
 
   // Create directories if needed.
@@ -89,7 +139,7 @@ Status PersistentVars::Flush(FlushMode flush_mode) {
 
   string persistent_vars_file_path = fs_manager_->GetPersistentVarsPath(tablet_id_);
   RETURN_NOT_OK_PREPEND(pb_util::WritePBContainerToPath(
-      fs_manager_->env(), persistent_vars_file_path, pb_,
+      fs_manager_->env(), persistent_vars_file_path, pb,
       flush_mode == OVERWRITE ? pb_util::OVERWRITE : pb_util::NO_OVERWRITE,
       pb_util::SYNC),
           Substitute("Unable to write persistent vars file for tablet $0 to path $1",
@@ -97,12 +147,21 @@ Status PersistentVars::Flush(FlushMode flush_mode) {
   return Status::OK();
 }
 
+void PersistentVars::PublishSnapshot() {
+  std::atomic_store_explicit(&snapshot_,
+                             std::shared_ptr<const PersistentVarsPB>(
+                                 std::make_shared<PersistentVarsPB>(pb_)),
+                             std::memory_order_release);
+}
+
 PersistentVars::PersistentVars(FsManager* fs_manager,
                                      std::string tablet_id,
                                      std::string peer_uuid)
     : fs_manager_(CHECK_NOTNULL(fs_manager)),
       tablet_id_(std::move(tablet_id)),
-      peer_uuid_(std::move(peer_uuid)) {}
+      peer_uuid_(std::move(peer_uuid)) {
+  PublishSnapshot();
+}
 
 Status PersistentVars::Create(FsManager* fs_manager,
                                  const string& tablet_id,
@@ -125,11 +184,7 @@ Status PersistentVars::Load(FsManager* fs_manager,
   RETURN_NOT_OK(pb_util::ReadPBContainerFromPath(fs_manager->env(),
                                                  fs_manager->GetPersistentVarsPath(tablet_id),
                                                  &persistent_vars->pb_));
-  if (persistent_vars->pb_.has_raft_rpc_token()) {
-    persistent_vars->raft_rpc_token_cache_ =
-        std::make_shared<const std::string>(
-            persistent_vars->pb_.raft_rpc_token());
-  }
+  persistent_vars->PublishSnapshot();
   if (persistent_vars_out) *persistent_vars_out = std::move(persistent_vars);
   return Status::OK();
 }
@@ -19,7 +19,9 @@
 #include <atomic>
 #include <cstdint>
 #include <deque>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include <boost/optional/optional.hpp>
 
@@ -40,7 +42,9 @@ class PersistentVarsManager; // IWYU pragma: keep
 class PersistentVarsTest;    // IWYU pragma: keep
 
 // Provides methods to read and write persistent variables.
-// This class is not thread-safe and requires external synchronization.
+// This class is not thread-safe and requires external synchronization, except
+// for the accessors, which read a snapshot of the variables that is published
+// whenever they change and so may be called from any thread without locking.
 class PersistentVars : public RefCountedThreadSafe<PersistentVars> {
  public:
 
@@ -50,6 +54,31 @@ class PersistentVars : public RefCountedThreadSafe<PersistentVars> {
     NO_OVERWRITE
   };
 
+  // A set of changes to the persistent variables, which CommitBatch() makes
+  // durable with a single write and then publishes all at once. Start one
+  // with StartBatch().
+  class Batch {
+   public:
+    void set_allow_start_election(bool val);
+    void set_raft_rpc_token(boost::optional<std::string> rpc_token);
+    void set_compression_dictionary(boost::optional<std::string> dictionary);
+
+    // Whether the batch changes the RPC token.
+    bool changes_raft_rpc_token() const { return changes_raft_rpc_token_; }
+
+    // Whether the batch changes the compression dictionary.
+    bool changes_compression_dictionary() const { return changes_compression_dictionary_; }
+
+   private:
+    friend class PersistentVars;
+
+    explicit Batch(PersistentVarsPB pb) : pb_(std::move(pb)) {}
+
+    PersistentVarsPB pb_;
+    bool changes_raft_rpc_token_ = false;
+    bool changes_compression_dictionary_ = false;
+  };
+
   // Accessor for whether starting elections is allowed
   bool is_start_election_allowed() const;
 
@@ -57,18 +86,25 @@ class PersistentVars : public RefCountedThreadSafe<PersistentVars> {
   void set_allow_start_election(bool val);
 
   // A RPC token used to show proof that we belong to a certain Raft ring
-  //
-  // This method, unlike the rest is thread-safe, but uses relaxed memory order
-  // I.e. You cannot use it for synchronization other process states based on
-  // code ordering
   std::shared_ptr<const std::string> raft_rpc_token() const;
 
   // Change the RPC token, boost::none unsets the token
   void set_raft_rpc_token(boost::optional<std::string> rpc_token);
 
+  // The dictionary to compress write payloads with, or nullptr if there's none
+  std::shared_ptr<const std::string> compression_dictionary() const;
+
   // Persist current state of the protobuf to disk.
   Status Flush(FlushMode flush_mode = OVERWRITE);
 
+  // Returns a batch starting from the current values of the variables.
+  Batch StartBatch() const;
+
+  // Writes the variables in 'batch' to disk with one atomic, synced write.
+  // Only if that succeeds are they applied here; otherwise the variables are
+  // left as they were.
+  Status CommitBatch(Batch batch);
+
  private:
   friend class RefCountedThreadSafe<PersistentVars>;
   friend class PersistentVarsManager;
@@ -95,14 +131,21 @@ class PersistentVars : public RefCountedThreadSafe<PersistentVars> {
   // Check whether the persistent_vars file exists for the given tablet
   static bool FileExists(FsManager* fs_manager, const std::string& tablet_id);
 
+  // Write 'pb' to the persistent vars file, atomically and synchronously.
+  Status WriteToDisk(const PersistentVarsPB& pb, FlushMode flush_mode);
+
+  // Make the readers see the current value of 'pb_'.
+  void PublishSnapshot();
+
   std::string LogPrefix() const;
 
   FsManager* const fs_manager_;
   const std::string tablet_id_;
   const std::string peer_uuid_;
 
-  // A "atomic" cached value of raft_rpc_token
-  std::shared_ptr<const std::string> raft_rpc_token_cache_;
+  // A copy of 'pb_' for the accessors, replaced (never modified) whenever
+  // 'pb_' changes, and read and written with atomic shared_ptr operations.
+  std::shared_ptr<const PersistentVarsPB> snapshot_;
 
   // This fake mutex helps ensure that this PersistentVars object stays
   // externally synchronized.
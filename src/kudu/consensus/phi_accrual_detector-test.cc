@@ -0,0 +1,100 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/phi_accrual_detector.h"
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_util.h"
+
+namespace kudu {
+namespace consensus {
+
+class PhiAccrualDetectorTest : public KuduTest {
+ protected:
+  // Feeds 'detector' 'count' intervals, alternating between 'interval_ms'
+  // plus and minus 'jitter_ms'. Returns the time of the last heartbeat.
+  static MonoTime Feed(PhiAccrualDetector* detector, MonoTime start, int count,
+                       int interval_ms, int jitter_ms) {
+    MonoTime t = start;
+    detector->Heartbeat(t);
+    for (int i = 0; i < count; i++) {
+      t += MonoDelta::FromMilliseconds(interval_ms + (i % 2 ? jitter_ms : -jitter_ms));
+      detector->Heartbeat(t);
+    }
+    return t;
+  }
+};
+
+TEST_F(PhiAccrualDetectorTest, TestPhiGrowsWithSilence) {
+  PhiAccrualDetector detector(100, MonoDelta::FromMilliseconds(10));
+  MonoTime last = Feed(&detector, MonoTime::Now(), 20, 500, 0);
+  ASSERT_EQ(20, detector.num_samples());
+
+  double before = detector.Phi(last + MonoDelta::FromMilliseconds(400));
+  double on_time = detector.Phi(last + MonoDelta::FromMilliseconds(500));
+  double late = detector.Phi(last + MonoDelta::FromMilliseconds(600));
+  ASSERT_LT(before, on_time);
+  ASSERT_LT(on_time, late);
+  ASSERT_NEAR(0.3, on_time, 0.01);
+
+  // TimeToPhi() inverts Phi().
+  MonoDelta t = detector.TimeToPhi(8);
+  ASSERT_GT(t, MonoDelta::FromMilliseconds(500));
+  ASSERT_NEAR(8, detector.Phi(last + t), 0.5);
+}
+
+TEST_F(PhiAccrualDetectorTest, TestJitterDelaysSuspicion) {
+  const MonoTime start = MonoTime::Now();
+  PhiAccrualDetector steady(100, MonoDelta::FromMilliseconds(10));
+  PhiAccrualDetector jittery(100, MonoDelta::FromMilliseconds(10));
+  Feed(&steady, start, 50, 500, 5);
+  Feed(&jittery, start, 50, 500, 200);
+  ASSERT_LT(steady.TimeToPhi(8), jittery.TimeToPhi(8));
+
+  // The minimum standard deviation applies to a perfectly steady leader.
+  PhiAccrualDetector floored(100, MonoDelta::FromMilliseconds(200));
+  Feed(&floored, start, 50, 500, 0);
+  ASSERT_LT(steady.TimeToPhi(8), floored.TimeToPhi(8));
+}
+
+TEST_F(PhiAccrualDetectorTest, TestWindowAndReset) {
+  PhiAccrualDetector detector(10, MonoDelta::FromMilliseconds(10));
+  MonoTime last = Feed(&detector, MonoTime::Now(), 30, 100, 0);
+  ASSERT_EQ(10, detector.num_samples());
+  MonoDelta fast = detector.TimeToPhi(8);
+
+  // Only the latest intervals count.
+  Feed(&detector, last, 10, 1000, 0);
+  ASSERT_EQ(10, detector.num_samples());
+  ASSERT_GT(detector.TimeToPhi(8).ToMilliseconds(), fast.ToMilliseconds() + 800);
+
+  // Short intervals count as the minimum interval.
+  detector.set_min_interval(MonoDelta::FromMilliseconds(1000));
+  Feed(&detector, MonoTime::Now(), 10, 1, 0);
+  ASSERT_GT(detector.TimeToPhi(8).ToMilliseconds(), 1000);
+
+  detector.Reset();
+  ASSERT_EQ(0, detector.num_samples());
+  // The first heartbeat after a reset has no interval to record.
+  detector.Heartbeat(MonoTime::Now());
+  ASSERT_EQ(0, detector.num_samples());
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,105 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/phi_accrual_detector.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+namespace kudu {
+namespace consensus {
+
+PhiAccrualDetector::PhiAccrualDetector(int window_size, MonoDelta min_stddev)
+    : window_size_(window_size),
+      min_stddev_ms_(min_stddev.ToMicroseconds() / 1000.0) {
+  DCHECK_GT(window_size, 0);
+  intervals_ms_.reserve(window_size_);
+}
+
+void PhiAccrualDetector::Heartbeat(MonoTime now) {
+  if (last_heartbeat_.Initialized() && now > last_heartbeat_) {
+    double interval = std::max((now - last_heartbeat_).ToMicroseconds() / 1000.0,
+                               min_interval_ms_);
+    if (intervals_ms_.size() < window_size_) {
+      intervals_ms_.push_back(interval);
+    } else {
+      double& oldest = intervals_ms_[next_];
+      sum_ -= oldest;
+      sum_sq_ -= oldest * oldest;
+      oldest = interval;
+      next_ = (next_ + 1) % window_size_;
+    }
+    sum_ += interval;
+    sum_sq_ += interval * interval;
+  }
+  last_heartbeat_ = now;
+}
+
+void PhiAccrualDetector::Reset() {
+  last_heartbeat_ = MonoTime();
+  intervals_ms_.clear();
+  next_ = 0;
+  sum_ = 0;
+  sum_sq_ = 0;
+}
+
+double PhiAccrualDetector::Phi(MonoTime now) const {
+  DCHECK(last_heartbeat_.Initialized());
+  return PhiAt(std::max((now - last_heartbeat_).ToMicroseconds() / 1000.0, 0.0));
+}
+
+double PhiAccrualDetector::PhiAt(double elapsed_ms) const {
+  DCHECK(!intervals_ms_.empty());
+  const double n = intervals_ms_.size();
+  const double mean = sum_ / n;
+  const double variance = std::max(sum_sq_ / n - mean * mean, 0.0);
+  const double stddev = std::max(std::sqrt(variance), min_stddev_ms_);
+
+  // The logistic approximation of the normal CDF, as used by Akka and
+  // Cassandra, is accurate enough here and cheap to evaluate far into the
+  // tail.
+  const double y = (elapsed_ms - mean) / stddev;
+  const double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+  if (elapsed_ms > mean) {
+    return -std::log10(e / (1.0 + e));
+  }
+  return -std::log10(1.0 - 1.0 / (1.0 + e));
+}
+
+MonoDelta PhiAccrualDetector::TimeToPhi(double phi) const {
+  // Phi grows with the time since the last heartbeat, so search for it.
+  double lo = 0;
+  double hi = std::max(sum_ / intervals_ms_.size(), 1.0);
+  while (PhiAt(hi) < phi && hi < 1e9) {
+    lo = hi;
+    hi *= 2;
+  }
+  for (int i = 0; i < 50 && hi - lo > 0.1; i++) {
+    double mid = (lo + hi) / 2;
+    if (PhiAt(mid) < phi) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return MonoDelta::FromMilliseconds(static_cast<int64_t>(std::ceil(hi)));
+}
+
+} // namespace consensus
+} // namespace kudu
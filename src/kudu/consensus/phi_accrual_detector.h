@@ -0,0 +1,93 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+namespace consensus {
+
+// A phi accrual failure detector (Hayashibara et al.), which a follower feeds
+// with the times it hears from the leader. Rather than a fixed timeout, it
+// estimates the distribution of the intervals between the leader's requests
+// from a window of the latest ones, and expresses the suspicion that the
+// leader failed as phi = -log10(P(no request for this long)). A follower with
+// a steady, close leader reaches a given phi much sooner than one over a
+// jittery cross-region link.
+//
+// Not thread-safe.
+class PhiAccrualDetector {
+ public:
+  // Keeps the last 'window_size' intervals. The standard deviation of the
+  // intervals is taken to be at least 'min_stddev', so that a perfectly
+  // regular leader isn't suspected the moment its next request is late.
+  PhiAccrualDetector(int window_size, MonoDelta min_stddev);
+
+  // Records that the leader was heard from at 'now'.
+  void Heartbeat(MonoTime now);
+
+  // Forgets all the intervals, e.g. when the leader changes.
+  void Reset();
+
+  // The number of intervals in the window.
+  int num_samples() const { return static_cast<int>(intervals_ms_.size()); }
+
+  // Returns phi if the leader isn't heard from until 'now'. Must not be
+  // called before the first interval is recorded.
+  double Phi(MonoTime now) const;
+
+  // Returns how long after the last heartbeat phi reaches 'phi'. Must not be
+  // called before the first interval is recorded.
+  MonoDelta TimeToPhi(double phi) const;
+
+  void set_min_stddev(MonoDelta min_stddev) {
+    min_stddev_ms_ = min_stddev.ToMicroseconds() / 1000.0;
+  }
+
+  // Intervals shorter than 'min_interval' are recorded as that long: when
+  // the leader sends at least that often, requests in between, e.g. while it
+  // replicates writes, say nothing about when the next one is due.
+  void set_min_interval(MonoDelta min_interval) {
+    min_interval_ms_ = min_interval.ToMicroseconds() / 1000.0;
+  }
+
+ private:
+  // Returns phi for 'elapsed_ms' since the last heartbeat.
+  double PhiAt(double elapsed_ms) const;
+
+  const size_t window_size_;
+  double min_stddev_ms_;
+  double min_interval_ms_ = 0;
+
+  MonoTime last_heartbeat_;
+
+  // A ring buffer of the intervals, with their running sums.
+  std::vector<double> intervals_ms_;
+  size_t next_ = 0;
+  double sum_ = 0;
+  double sum_sq_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(PhiAccrualDetector);
+};
+
+} // namespace consensus
+} // namespace kudu
@@ -17,6 +17,7 @@
 
 #include "kudu/consensus/quorum_util.h"
 
+#include <map>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -340,6 +341,59 @@ TEST(QuorumUtilTest, TestIsRaftConfigVoter) {
   ASSERT_FALSE(ReplicaTypesEqual(*peer_b, *peer_c));
 }
 
+TEST(QuorumUtilTest, TestIsRaftConfigWitness) {
+  RaftConfigPB config;
+  AddPeer(&config, "A", V);
+  AddPeer(&config, "B", V);
+  AddPeer(&config, "C", N);
+  config.mutable_peers(1)->mutable_attrs()->set_backing_db_present(false);
+  config.mutable_peers(2)->mutable_attrs()->set_backing_db_present(false);
+
+  // Only a voter without a database is a witness: a non-voter without one is
+  // just a learner.
+  ASSERT_FALSE(IsRaftConfigWitness("A", config));
+  ASSERT_TRUE(IsRaftConfigWitness("B", config));
+  ASSERT_FALSE(IsRaftConfigWitness("C", config));
+  ASSERT_FALSE(IsRaftConfigWitness("D", config));
+  config.mutable_peers(1)->mutable_attrs()->set_backing_db_present(true);
+  ASSERT_FALSE(IsWitness(config.peers(1)));
+}
+
+TEST(QuorumUtilTest, TestRaftConfigView) {
+  RaftConfigPB config;
+  AddPeer(&config, "A", V);
+  AddPeer(&config, "B", V);
+  AddPeer(&config, "C", V);
+  AddPeer(&config, "D", N);
+  config.mutable_peers(0)->mutable_attrs()->set_region("r1");
+  config.mutable_peers(1)->mutable_attrs()->set_region("r1");
+  config.mutable_peers(2)->mutable_attrs()->set_region("r2");
+  (*config.mutable_voter_distribution())["r1"] = 3;
+  (*config.mutable_voter_distribution())["r2"] = 1;
+
+  RaftConfigView view(config);
+  for (const string& uuid : { "A", "B", "C", "D", "E" }) {
+    SCOPED_TRACE(uuid);
+    ASSERT_EQ(IsRaftConfigMember(uuid, config), view.IsMember(uuid));
+    ASSERT_EQ(IsRaftConfigVoter(uuid, config), view.IsVoter(uuid));
+  }
+  ASSERT_EQ("D", view.FindMember("D")->permanent_uuid());
+  ASSERT_EQ(nullptr, view.FindMember("E"));
+  ASSERT_EQ(3, view.num_voters());
+  ASSERT_EQ(2, view.majority_size());
+  ASSERT_EQ("r2", view.QuorumIdOf("C"));
+  ASSERT_EQ("", view.QuorumIdOf("E"));
+
+  const std::map<string, int> voters_per_quorum = { {"r1", 2}, {"r2", 1} };
+  ASSERT_EQ(voters_per_quorum, view.voters_per_quorum());
+
+  std::map<string, int> adjusted(config.voter_distribution().begin(),
+                                 config.voter_distribution().end());
+  AdjustVoterDistributionWithCurrentVoters(config, &adjusted);
+  ASSERT_EQ(adjusted, view.adjusted_voter_distribution());
+  ASSERT_EQ(3, view.voter_distribution().at("r1"));
+}
+
 // Tests paremeterized by the policy on the replica majority's health.
 class QuorumUtilHealthPolicyParamTest :
     public ::testing::Test,
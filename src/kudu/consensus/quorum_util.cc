@@ -91,6 +91,15 @@ bool IsRaftConfigVoter(const std::string& uuid, const RaftConfigPB& config) {
   return false;
 }
 
+bool IsRaftConfigWitness(const std::string& uuid, const RaftConfigPB& config) {
+  for (const RaftPeerPB& peer : config.peers()) {
+    if (peer.permanent_uuid() == uuid) {
+      return IsWitness(peer);
+    }
+  }
+  return false;
+}
+
 bool GetRaftConfigMemberRegion(const std::string& uuid,
     const RaftConfigPB& config, bool *is_voter, std::string *region) {
   for (const RaftPeerPB& peer : config.peers()) {
@@ -1015,5 +1024,53 @@ bool PeerHasValidQuorumId(const RaftPeerPB &peer) {
          !peer.attrs().quorum_id().empty();
 }
 
+bool IsWitness(const RaftPeerPB& peer) {
+  return peer.member_type() == RaftPeerPB::VOTER && peer.has_attrs() &&
+         peer.attrs().has_backing_db_present() && !peer.attrs().backing_db_present();
+}
+
+RaftConfigView::RaftConfigView(RaftConfigPB config)
+    : config_(std::move(config)),
+      num_voters_(CountVoters(config_)),
+      majority_size_(num_voters_ > 0 ? MajoritySize(num_voters_) : 0),
+      voter_distribution_(config_.voter_distribution().begin(),
+                          config_.voter_distribution().end()) {
+  const bool use_quorum_id = IsUseQuorumId(config_.commit_rule());
+  member_index_.reserve(config_.peers_size());
+  quorum_ids_.reserve(config_.peers_size());
+  for (int i = 0; i < config_.peers_size(); i++) {
+    const RaftPeerPB& peer = config_.peers(i);
+    // Like the lookups by UUID above, the first member with a UUID wins.
+    member_index_.emplace(peer.permanent_uuid(), i);
+    quorum_ids_.emplace_back(GetQuorumId(peer, use_quorum_id));
+  }
+  GetActualVoterCountsFromConfig(config_, "", &voters_per_quorum_);
+  adjusted_voter_distribution_ = voter_distribution_;
+  AdjustVoterDistributionWithCurrentVoters(config_, &adjusted_voter_distribution_);
+  GetVoterDistributionForQuorumId(config_, &quorum_id_voter_distribution_);
+}
+
+const RaftPeerPB* RaftConfigView::FindMember(const string& uuid) const {
+  auto it = member_index_.find(uuid);
+  if (it == member_index_.end()) {
+    return nullptr;
+  }
+  return &config_.peers(it->second);
+}
+
+bool RaftConfigView::IsVoter(const string& uuid) const {
+  const RaftPeerPB* peer = FindMember(uuid);
+  return peer && peer->member_type() == RaftPeerPB::VOTER;
+}
+
+const string& RaftConfigView::QuorumIdOf(const string& uuid) const {
+  static const string kNoQuorumId;
+  auto it = member_index_.find(uuid);
+  if (it == member_index_.end()) {
+    return kNoQuorumId;
+  }
+  return quorum_ids_[it->second];
+}
+
 }  // namespace consensus
 }  // namespace kudu
@@ -18,9 +18,13 @@
 #ifndef KUDU_CONSENSUS_QUORUM_UTIL_H_
 #define KUDU_CONSENSUS_QUORUM_UTIL_H_
 
+#include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/gutil/macros.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
@@ -47,6 +51,7 @@ enum class MajorityHealthPolicy {
 
 bool IsRaftConfigMember(const std::string& uuid, const RaftConfigPB& config);
 bool IsRaftConfigVoter(const std::string& uuid, const RaftConfigPB& config);
+bool IsRaftConfigWitness(const std::string& uuid, const RaftConfigPB& config);
 bool GetRaftConfigMemberRegion(const std::string& uuid, const RaftConfigPB& config,
     bool *is_voter, std::string *region);
 bool GetRaftConfigMemberQuorumId(const std::string& uuid, const RaftConfigPB& config,
@@ -187,6 +192,79 @@ std::string GetQuorumId(const RaftPeerPB& peer, bool use_quorum_id);
 // Return true of the peer has a non-empty quorum_id
 bool PeerHasValidQuorumId(const RaftPeerPB& peer);
 
+// Whether 'peer' is a witness: a voter which isn't backed by a database, and
+// so keeps the log only to count towards durability.
+bool IsWitness(const RaftPeerPB& peer);
+
+// An immutable view of a Raft config with the lookups made on hot paths
+// computed up front: members are indexed by UUID, and the voter counts and
+// distributions the FlexiRaft watermark computations need are derived once.
+// Build one per config change and share it instead of calling the free
+// functions above, which scan the config, on every request.
+class RaftConfigView {
+ public:
+  explicit RaftConfigView(RaftConfigPB config);
+
+  const RaftConfigPB& config() const { return config_; }
+
+  // Returns the member with 'uuid', or null if there is none.
+  const RaftPeerPB* FindMember(const std::string& uuid) const;
+
+  // Same as IsRaftConfigMember() and IsRaftConfigVoter().
+  bool IsMember(const std::string& uuid) const {
+    return FindMember(uuid) != nullptr;
+  }
+  bool IsVoter(const std::string& uuid) const;
+
+  // Same as CountVoters() and its MajoritySize(). The majority size is 0
+  // if there are no voters.
+  int num_voters() const { return num_voters_; }
+  int majority_size() const { return majority_size_; }
+
+  // Returns the quorum id of the member with 'uuid' according to the
+  // config's commit rule, or an empty string if there is no such member.
+  const std::string& QuorumIdOf(const std::string& uuid) const;
+
+  // The number of voters in each quorum id, as computed by
+  // GetActualVoterCountsFromConfig().
+  const std::map<std::string, int>& voters_per_quorum() const {
+    return voters_per_quorum_;
+  }
+
+  // The config's voter distribution, as is and as adjusted by
+  // AdjustVoterDistributionWithCurrentVoters().
+  const std::map<std::string, int>& voter_distribution() const {
+    return voter_distribution_;
+  }
+  const std::map<std::string, int>& adjusted_voter_distribution() const {
+    return adjusted_voter_distribution_;
+  }
+
+  // The result of GetVoterDistributionForQuorumId() on the config.
+  const std::map<std::string, int>& quorum_id_voter_distribution() const {
+    return quorum_id_voter_distribution_;
+  }
+
+ private:
+  const RaftConfigPB config_;
+
+  // Maps the UUID of each member to its position in config_.peers().
+  std::unordered_map<std::string, int> member_index_;
+
+  // The quorum id of each member, by position in config_.peers().
+  std::vector<std::string> quorum_ids_;
+
+  int num_voters_;
+  int majority_size_;
+
+  std::map<std::string, int> voters_per_quorum_;
+  std::map<std::string, int> voter_distribution_;
+  std::map<std::string, int> adjusted_voter_distribution_;
+  std::map<std::string, int> quorum_id_voter_distribution_;
+
+  DISALLOW_COPY_AND_ASSIGN(RaftConfigView);
+};
+
 }  // namespace consensus
 }  // namespace kudu
 
@@ -0,0 +1,379 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// An in-process benchmark of replicating writes through a Raft config, using
+// the local peer proxies of consensus-test-util.h over emulated links, with
+// optional region layouts for FlexiRaft and emulated fsync latency. It runs
+// a fixed number of client threads, each waiting for its write to commit on
+// the leader before issuing the next one, and reports the commit throughput,
+// latency percentiles and CPU per op.
+//
+// For example, to benchmark a FlexiRaft config of two regions 20ms apart,
+// whose leader region commits on its own, with 1ms fsyncs:
+//
+//   raft_consensus-bench --bench_peer_regions=r1,r1,r1,r2,r2 \
+//     --bench_cross_region_rtt_us=20000 --bench_fsync_latency_us=1000
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/clock/clock.h"
+#include "kudu/clock/logical_clock.h"
+#include "kudu/common/timestamp.h"
+#include "kudu/consensus/consensus-test-util.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/consensus_meta_manager.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/persistent_vars_manager.h"
+#include "kudu/consensus/quorum_util.h"
+#include "kudu/consensus/raft_consensus.h"
+#include "kudu/consensus/time_manager.h"
+#include "kudu/fs/fs_manager.h"
+#include "kudu/gutil/bind.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/mem_tracker.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_int32(bench_num_peers, 3,
+             "Number of voters in the config, unless --bench_peer_regions is set.");
+DEFINE_string(bench_peer_regions, "",
+              "Comma-separated list of the regions of the voters, one per "
+              "voter, the last of which is the leader. When set, the config "
+              "uses FlexiRaft with a SINGLE_REGION_DYNAMIC commit rule, so "
+              "that ops commit once a majority of the leader's region has "
+              "them.");
+DEFINE_int32(bench_intra_region_rtt_us, 0,
+             "Emulated round-trip time of the links between peers of the same "
+             "region.");
+DEFINE_int32(bench_cross_region_rtt_us, 0,
+             "Emulated round-trip time of the links between peers of different "
+             "regions.");
+DEFINE_int32(bench_link_bandwidth_mbps, 0,
+             "Emulated bandwidth of each link, in megabits per second, which "
+             "delays each request by the time it takes to transfer. 0 means "
+             "unlimited.");
+DEFINE_int32(bench_fsync_latency_us, 0,
+             "Emulated latency added to each sync of the peers' logs.");
+DEFINE_int32(bench_client_threads, 8,
+             "Number of client threads, each keeping one op outstanding.");
+DEFINE_int32(bench_payload_bytes, 1024, "Size of the payload of each op.");
+DEFINE_int32(bench_run_seconds, 1, "Seconds to run the benchmark for.");
+
+DECLARE_bool(enable_flexi_raft);
+DECLARE_bool(enable_leader_failure_detection);
+
+using kudu::log::Log;
+using kudu::log::LogOptions;
+using std::atomic;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+const char* kTestTablet = "TestTablet";
+
+void DoNothing(const string& /* s */) {
+}
+
+// A local peer proxy which delivers each update after the round-trip time of
+// its link, plus the time the request takes to transfer at the link's
+// bandwidth. Each peer has at most one update in flight to another, so the
+// delays of different updates on a link don't add up.
+class EmulatedLinkPeerProxy : public LocalTestPeerProxy {
+ public:
+  EmulatedLinkPeerProxy(std::string peer_uuid, MonoDelta rtt, ThreadPool* pool,
+                        TestPeerMapManager* peers)
+      : LocalTestPeerProxy(std::move(peer_uuid), pool, peers),
+        rtt_(rtt) {}
+
+  void UpdateAsync(const ConsensusRequestPB* request,
+                   ConsensusResponsePB* response,
+                   rpc::RpcController* /* controller */,
+                   const rpc::ResponseCallback& callback) override {
+    RegisterCallback(kUpdate, callback);
+    int64_t delay_us = rtt_.ToMicroseconds();
+    if (FLAGS_bench_link_bandwidth_mbps > 0) {
+      delay_us += request->ByteSizeLong() * 8 / FLAGS_bench_link_bandwidth_mbps;
+    }
+    MonoDelta delay = MonoDelta::FromMicroseconds(delay_us);
+    CHECK_OK(pool_->SubmitFunc([this, request, response, delay]() {
+      SleepFor(delay);
+      SendUpdateRequest(request, response);
+    }));
+  }
+
+ private:
+  const MonoDelta rtt_;
+};
+
+class EmulatedLinkPeerProxyFactory : public PeerProxyFactory {
+ public:
+  EmulatedLinkPeerProxyFactory(std::map<string, string> regions, string local_uuid,
+                               TestPeerMapManager* peers)
+      : regions_(std::move(regions)),
+        local_uuid_(std::move(local_uuid)),
+        peers_(peers) {
+    // Every link delays its updates on a thread of its own.
+    CHECK_OK(ThreadPoolBuilder("bench-peer-pool")
+             .set_max_threads(regions_.size() + 1)
+             .Build(&pool_));
+    CHECK_OK(rpc::MessengerBuilder("bench").Build(&messenger_));
+  }
+
+  Status NewProxy(const RaftPeerPB& peer_pb, shared_ptr<PeerProxy>* proxy) override {
+    const string& uuid = peer_pb.permanent_uuid();
+    bool same_region = FindOrDie(regions_, uuid) == FindOrDie(regions_, local_uuid_);
+    MonoDelta rtt = MonoDelta::FromMicroseconds(
+        same_region ? FLAGS_bench_intra_region_rtt_us : FLAGS_bench_cross_region_rtt_us);
+    proxy->reset(new EmulatedLinkPeerProxy(uuid, rtt, pool_.get(), peers_));
+    return Status::OK();
+  }
+
+  const shared_ptr<rpc::Messenger>& messenger() const override {
+    return messenger_;
+  }
+
+ private:
+  const std::map<string, string> regions_;
+  const string local_uuid_;
+  gscoped_ptr<ThreadPool> pool_;
+  shared_ptr<rpc::Messenger> messenger_;
+  TestPeerMapManager* const peers_;
+};
+
+// Emulates a disk whose syncs take --bench_fsync_latency_us.
+class SlowSyncHooks : public Log::LogFaultHooks {
+ public:
+  Status PostSync() override {
+    SleepFor(MonoDelta::FromMicroseconds(FLAGS_bench_fsync_latency_us));
+    return Status::OK();
+  }
+};
+
+} // anonymous namespace
+
+class RaftConsensusBench : public KuduTest {
+ public:
+  RaftConsensusBench()
+      : clock_(clock::LogicalClock::CreateStartingAt(Timestamp(1))),
+        metric_entity_(METRIC_ENTITY_server.Instantiate(&metric_registry_, "raft-bench")),
+        latency_us_(60 * 1000 * 1000, 2) {
+    options_.tablet_id = kTestTablet;
+    FLAGS_enable_leader_failure_detection = false;
+    CHECK_OK(ThreadPoolBuilder("raft").Build(&raft_pool_));
+  }
+
+  ~RaftConsensusBench() {
+    leader_.reset();
+    peers_->Clear();
+    STLDeleteElements(&txn_factories_);
+    // The logs must be closed before their fs managers are destroyed.
+    logs_.clear();
+    STLDeleteElements(&fs_managers_);
+  }
+
+  // Builds and starts a config laid out as the flags say, and elects its last
+  // peer as the leader.
+  Status BuildAndStartConfig() {
+    vector<string> layout = strings::Split(FLAGS_bench_peer_regions, ",",
+                                           strings::SkipEmpty());
+    const bool flexi_raft = !layout.empty();
+    if (!flexi_raft) {
+      layout.assign(FLAGS_bench_num_peers, "default");
+    }
+    FLAGS_enable_flexi_raft = flexi_raft;
+
+    for (int i = 0; i < layout.size(); i++) {
+      string test_path = GetTestPath(Substitute("peer-$0-root", i));
+      FsManagerOpts opts;
+      opts.wal_root = test_path;
+      opts.data_roots = { test_path };
+      gscoped_ptr<FsManager> fs_manager(new FsManager(env_, opts));
+      RETURN_NOT_OK(fs_manager->CreateInitialFileSystemLayout());
+      RETURN_NOT_OK(fs_manager->Open());
+      cmeta_managers_.emplace_back(new ConsensusMetadataManager(fs_manager.get()));
+      persistent_vars_managers_.emplace_back(new PersistentVarsManager(fs_manager.get()));
+
+      scoped_refptr<Log> log;
+      RETURN_NOT_OK(Log::Open(LogOptions(), fs_manager.get(), kTestTablet, nullptr, &log));
+      if (FLAGS_bench_fsync_latency_us > 0) {
+        log->SetLogFaultHooksForTests(std::make_shared<SlowSyncHooks>());
+      }
+      logs_.emplace_back(std::move(log));
+
+      RaftPeerPB* peer_pb = config_.add_peers();
+      peer_pb->set_member_type(RaftPeerPB::VOTER);
+      peer_pb->set_permanent_uuid(fs_manager->uuid());
+      peer_pb->mutable_attrs()->set_region(layout[i]);
+      HostPortPB* hp = peer_pb->mutable_last_known_addr();
+      hp->set_host(Substitute("peer-$0.fake-domain-for-tests", i));
+      hp->set_port(0);
+      InsertOrDie(&regions_, fs_manager->uuid(), layout[i]);
+      if (flexi_raft) {
+        (*config_.mutable_voter_distribution())[layout[i]]++;
+      }
+      fs_managers_.push_back(fs_manager.release());
+    }
+    if (flexi_raft) {
+      config_.mutable_commit_rule()->set_mode(QuorumMode::SINGLE_REGION_DYNAMIC);
+    }
+    config_.set_opid_index(kInvalidOpIdIndex);
+    peers_.reset(new TestPeerMapManager(config_));
+
+    for (int i = 0; i < config_.peers_size(); i++) {
+      RETURN_NOT_OK(cmeta_managers_[i]->CreateCMeta(kTestTablet, config_, kMinimumTerm));
+      RETURN_NOT_OK(persistent_vars_managers_[i]->CreatePersistentVars(kTestTablet));
+      shared_ptr<RaftConsensus> peer;
+      RETURN_NOT_OK(RaftConsensus::Create(options_, config_.peers(i), cmeta_managers_[i],
+                                          persistent_vars_managers_[i], raft_pool_.get(),
+                                          &peer));
+      peers_->AddPeer(config_.peers(i).permanent_uuid(), peer);
+    }
+
+    ConsensusBootstrapInfo boot_info;
+    for (int i = 0; i < config_.peers_size(); i++) {
+      shared_ptr<RaftConsensus> peer;
+      RETURN_NOT_OK(peers_->GetPeerByIdx(i, &peer));
+      gscoped_ptr<PeerProxyFactory> proxy_factory(new EmulatedLinkPeerProxyFactory(
+          regions_, peer->peer_uuid(), peers_.get()));
+      scoped_refptr<TimeManager> time_manager(new TimeManager(clock_, Timestamp::kMin));
+      auto txn_factory = new TestTransactionFactory(logs_[i].get());
+      txn_factory->SetConsensus(peer.get());
+      txn_factories_.push_back(txn_factory);
+      RETURN_NOT_OK(peer->Start(boot_info, std::move(proxy_factory), logs_[i], time_manager,
+                                txn_factory, metric_entity_, Bind(&DoNothing)));
+    }
+
+    RETURN_NOT_OK(peers_->GetPeerByIdx(config_.peers_size() - 1, &leader_));
+    return leader_->EmulateElection();
+  }
+
+  // Replicates ops through the leader, one at a time, until 'stop' is set.
+  void ClientThread(const atomic<bool>* stop) {
+    const string payload(FLAGS_bench_payload_bytes, 'x');
+    while (!stop->load()) {
+      gscoped_ptr<ReplicateMsg> msg(new ReplicateMsg);
+      msg->set_op_type(WRITE_OP_EXT);
+      msg->mutable_write_payload()->set_payload(payload);
+      msg->set_timestamp(clock_->Now().ToUint64());
+      Synchronizer sync;
+      MonoTime start = MonoTime::Now();
+      scoped_refptr<ConsensusRound> round =
+          leader_->NewRound(std::move(msg), sync.AsStdStatusCallback());
+      CHECK_OK(leader_->Replicate(round));
+      CHECK_OK(sync.Wait());
+      latency_us_.Increment((MonoTime::Now() - start).ToMicroseconds());
+    }
+  }
+
+  void SummarizePerf(CpuTimes elapsed) {
+    const int64_t ops = latency_us_.TotalCount();
+    LOG(INFO) << "Peers:             " << config_.peers_size()
+              << (FLAGS_enable_flexi_raft ? " (FlexiRaft: " + FLAGS_bench_peer_regions + ")"
+                                          : "");
+    LOG(INFO) << "Client threads:    " << FLAGS_bench_client_threads;
+    LOG(INFO) << "Payload:           " << FLAGS_bench_payload_bytes << " bytes";
+    LOG(INFO) << "RTT intra/cross:   " << FLAGS_bench_intra_region_rtt_us << "us / "
+              << FLAGS_bench_cross_region_rtt_us << "us";
+    LOG(INFO) << "Fsync latency:     " << FLAGS_bench_fsync_latency_us << "us";
+    LOG(INFO) << "----------------------------------";
+    LOG(INFO) << "Ops/sec:           " << ops / elapsed.wall_seconds();
+    LOG(INFO) << "Commit latency:    p50 " << latency_us_.ValueAtPercentile(50)
+              << "us, p99 " << latency_us_.ValueAtPercentile(99)
+              << "us, max " << latency_us_.MaxValue() << "us";
+    LOG(INFO) << "User CPU per op:   " << elapsed.user / 1000.0 / ops << "us";
+    LOG(INFO) << "Sys CPU per op:    " << elapsed.system / 1000.0 / ops << "us";
+  }
+
+ protected:
+  ConsensusOptions options_;
+  RaftConfigPB config_;
+  std::map<string, string> regions_;
+  vector<FsManager*> fs_managers_;
+  vector<scoped_refptr<Log>> logs_;
+  gscoped_ptr<ThreadPool> raft_pool_;
+  vector<scoped_refptr<ConsensusMetadataManager>> cmeta_managers_;
+  vector<scoped_refptr<PersistentVarsManager>> persistent_vars_managers_;
+  gscoped_ptr<TestPeerMapManager> peers_;
+  vector<TestTransactionFactory*> txn_factories_;
+  shared_ptr<RaftConsensus> leader_;
+  scoped_refptr<clock::Clock> clock_;
+  MetricRegistry metric_registry_;
+  scoped_refptr<MetricEntity> metric_entity_;
+  HdrHistogram latency_us_;
+};
+
+TEST_F(RaftConsensusBench, BenchmarkReplicate) {
+  OverrideFlagForSlowTests("bench_run_seconds", "10");
+  ASSERT_OK(BuildAndStartConfig());
+
+  atomic<bool> stop(false);
+  Stopwatch sw(Stopwatch::ALL_THREADS);
+  sw.start();
+  vector<thread> threads;
+  for (int i = 0; i < FLAGS_bench_client_threads; i++) {
+    threads.emplace_back(&RaftConsensusBench::ClientThread, this, &stop);
+  }
+  SleepFor(MonoDelta::FromSeconds(FLAGS_bench_run_seconds));
+  stop = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  sw.stop();
+
+  ASSERT_GT(latency_us_.TotalCount(), 0);
+  SummarizePerf(sw.elapsed());
+}
+
+} // namespace consensus
+} // namespace kudu
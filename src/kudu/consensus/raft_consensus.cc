@@ -24,18 +24,21 @@
 #include "kudu/consensus/raft_consensus.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <functional>
 #include <glog/logging.h>
 #include <iterator>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <ostream>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <boost/optional/optional.hpp>
@@ -43,14 +46,18 @@
 #include <gflags/gflags_declare.h>
 #include <google/protobuf/util/message_differencer.h>
 
+#include "kudu/clock/hybrid_clock.h"
 #include "kudu/common/timestamp.h"
 #include "kudu/common/wire_protocol.h"
+#include "kudu/consensus/apply_scheduler.h"
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus_meta.h"
 #include "kudu/consensus/consensus_meta_manager.h"
 #include "kudu/consensus/consensus_peers.h"
+#include "kudu/consensus/election_timeline.h"
 #include "kudu/consensus/leader_election.h"
 #include "kudu/consensus/log.h"
+#include "kudu/consensus/log_cache.h"
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/peer_manager.h"
@@ -58,9 +65,11 @@
 #include "kudu/consensus/persistent_vars.h"
 #include "kudu/consensus/persistent_vars_manager.h"
 #include "kudu/consensus/persistent_vars.pb.h"
+#include "kudu/consensus/phi_accrual_detector.h"
 #include "kudu/consensus/quorum_util.h"
 #include "kudu/consensus/routing.h"
 #include "kudu/consensus/time_manager.h"
+#include "kudu/consensus/traffic_capture.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/macros.h"
@@ -68,17 +77,23 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/stringpiece.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/walltime.h"
+#include "kudu/rpc/messenger.h"
 #include "kudu/rpc/periodic.h"
 #include "kudu/rpc/rpc_context.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/crc.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/jsonwriter.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/op_timeline.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/process_memory.h"
 #include "kudu/util/random.h"
@@ -114,6 +129,45 @@ DEFINE_int32(leader_failure_exp_backoff_max_delta_ms, 20 * 1000,
              "increases exponentially, up to this value.");
 TAG_FLAG(leader_failure_exp_backoff_max_delta_ms, experimental);
 
+DEFINE_bool(raft_follower_time_lag, false,
+            "Whether followers measure how far behind the leader their log and "
+            "their committed data are in wall-clock time, from the hybrid "
+            "timestamps the leader assigned to the last ops they append and "
+            "commit. Needs ops stamped by a hybrid clock, and is only as accurate "
+            "as the servers' clocks are synchronized.");
+TAG_FLAG(raft_follower_time_lag, experimental);
+TAG_FLAG(raft_follower_time_lag, runtime);
+
+DEFINE_bool(raft_phi_failure_detection, false,
+            "Whether followers detect the failure of the leader with a phi accrual "
+            "detector fed by the times they hear from it, instead of after a fixed "
+            "number of missed heartbeat periods. The timeout then adapts to the "
+            "round trip time and jitter of the link to the leader.");
+TAG_FLAG(raft_phi_failure_detection, experimental);
+TAG_FLAG(raft_phi_failure_detection, runtime);
+
+DEFINE_double(raft_phi_suspicion_threshold, 8.0,
+              "With --raft_phi_failure_detection, the phi at which a follower deems "
+              "the leader failed, i.e. when the chance that the leader is merely late "
+              "falls to 10^-phi.");
+TAG_FLAG(raft_phi_suspicion_threshold, experimental);
+TAG_FLAG(raft_phi_suspicion_threshold, runtime);
+
+DEFINE_string(raft_phi_suspicion_thresholds_by_region, "",
+              "With --raft_phi_failure_detection, comma-separated region:phi pairs "
+              "overriding --raft_phi_suspicion_threshold for leaders in those "
+              "regions, e.g. to make followers more patient with a leader across a "
+              "WAN.");
+TAG_FLAG(raft_phi_suspicion_thresholds_by_region, experimental);
+TAG_FLAG(raft_phi_suspicion_thresholds_by_region, runtime);
+
+DEFINE_int32(raft_phi_min_stddev_ms, 100,
+             "With --raft_phi_failure_detection, the lower bound of the standard "
+             "deviation of the intervals between the leader's requests, so that a "
+             "very regular leader isn't deemed failed as soon as a request is late.");
+TAG_FLAG(raft_phi_min_stddev_ms, experimental);
+TAG_FLAG(raft_phi_min_stddev_ms, runtime);
+
 DEFINE_bool(enable_leader_failure_detection, true,
             "Whether to enable failure detection of tablet leaders. If enabled, attempts will be "
             "made to elect a follower as a new leader when the leader is detected to have failed.");
@@ -175,9 +229,64 @@ DEFINE_int32(raft_log_cache_proxy_wait_time_ms, 500,
 TAG_FLAG(raft_log_cache_proxy_wait_time_ms, advanced);
 TAG_FLAG(raft_log_cache_proxy_wait_time_ms, runtime);
 
+DEFINE_bool(raft_proxy_async_fanout, false,
+            "Whether a proxy handles the requests it forwards to its downstream "
+            "peers without tying up an RPC worker thread: it is woken up when "
+            "the proxied ops are appended to its log cache rather than blocking "
+            "for them, and waits for the downstream response asynchronously. "
+            "With --consensus_serialize_ops_once, the requests for the same ops "
+            "to the different downstream peers also share one serialization "
+            "of them.");
+TAG_FLAG(raft_proxy_async_fanout, experimental);
+TAG_FLAG(raft_proxy_async_fanout, runtime);
+
+DEFINE_bool(raft_follower_release_update_lock_for_log_wait, false,
+            "Whether a follower releases its update lock while an UpdateConsensus "
+            "request waits for its ops to be written to the log, so that the "
+            "next request from the leader can be validated and appended behind "
+            "them rather than waiting for the write to finish. A request still "
+            "acks only once all the ops it acks are durable.");
+TAG_FLAG(raft_follower_release_update_lock_for_log_wait, experimental);
+TAG_FLAG(raft_follower_release_update_lock_for_log_wait, runtime);
+
+DEFINE_bool(raft_follower_memory_flow_control, false,
+            "Whether a follower advertises in its UpdateConsensus responses how "
+            "many bytes of ops it can accept before going over its soft memory "
+            "limit, and, when over the limit, drops the ops of a request but "
+            "still processes the rest of it rather than rejecting it outright.");
+TAG_FLAG(raft_follower_memory_flow_control, experimental);
+TAG_FLAG(raft_follower_memory_flow_control, runtime);
+
+DEFINE_int64(raft_replication_memory_budget_mb, 0,
+             "The most memory a leader replica may hold for replicating ops, "
+             "in its log cache and its pending rounds, before it rejects new "
+             "writes with ServiceUnavailable. Past "
+             "--raft_admission_delay_threshold_pct of the budget, writes are "
+             "first delayed by up to --raft_admission_max_delay_ms, the more "
+             "the closer the replica is to the budget, so that writers slow "
+             "down as followers fall behind. 0 disables admission control.");
+TAG_FLAG(raft_replication_memory_budget_mb, experimental);
+TAG_FLAG(raft_replication_memory_budget_mb, runtime);
+
+DEFINE_int32(raft_admission_delay_threshold_pct, 80,
+             "The percentage of --raft_replication_memory_budget_mb past which "
+             "new writes are delayed.");
+TAG_FLAG(raft_admission_delay_threshold_pct, experimental);
+TAG_FLAG(raft_admission_delay_threshold_pct, runtime);
+
+DEFINE_int32(raft_admission_max_delay_ms, 50,
+             "How long a write is delayed for when the replication memory of "
+             "its replica is just short of --raft_replication_memory_budget_mb.");
+TAG_FLAG(raft_admission_max_delay_ms, experimental);
+TAG_FLAG(raft_admission_max_delay_ms, runtime);
+
 DECLARE_int32(memory_limit_warn_threshold_percentage);
 DECLARE_int32(consensus_max_batch_size_bytes); // defined in consensus_queue (expose as method?)
 DECLARE_int32(consensus_rpc_timeout_ms);
+DECLARE_int32(raft_proxy_trace_slow_request_ms);
+DECLARE_bool(raft_fast_leader_transfer);
+DECLARE_bool(consensus_serialize_ops_once);
+DECLARE_bool(raft_witness_metadata_only_log);
 
 DEFINE_bool(raft_derived_log_mode, false,
             "When derived log mode is turned on, certain functions"
@@ -197,6 +306,111 @@ DEFINE_bool(raft_enforce_rpc_token, false,
             "Should enforce that requests and reponses to this instance must "
             "have a matching token as what we have stored.");
 
+DEFINE_bool(raft_lockless_term_binding, false,
+            "If true, CheckLeadershipAndBindTerm() binds rounds to the term "
+            "published by the last leadership change instead of taking the "
+            "consensus lock. Replicate() still verifies the bound term under "
+            "the lock, so a stale binding only aborts the round.");
+TAG_FLAG(raft_lockless_term_binding, experimental);
+TAG_FLAG(raft_lockless_term_binding, runtime);
+
+DEFINE_bool(raft_lockless_state_reads, false,
+            "If true, role(), CurrentTerm(), GetLeaderUuid(), ConsensusState() "
+            "and GetLastOpId() are served from the state published by the "
+            "consensus metadata and the pending rounds on every change, rather "
+            "than under the consensus lock which the write path contends for.");
+TAG_FLAG(raft_lockless_state_reads, experimental);
+TAG_FLAG(raft_lockless_state_reads, runtime);
+
+DEFINE_bool(raft_enable_leader_leases, false,
+            "Whether the leader holds a lease, derived from the election timeout "
+            "during which its followers withhold their votes, that lets reads "
+            "be served locally. Leases aren't available under flexi-raft, and "
+            "are unsafe if elections which ignore a live leader are started "
+            "by hand.");
+TAG_FLAG(raft_enable_leader_leases, experimental);
+TAG_FLAG(raft_enable_leader_leases, runtime);
+
+DEFINE_double(raft_leader_lease_clock_drift, 0.05,
+              "The most that the rate of the monotonic clock of one replica may "
+              "differ from that of another, as a fraction. The leader lease is "
+              "shortened from the minimum election timeout by this fraction.");
+TAG_FLAG(raft_leader_lease_clock_drift, experimental);
+TAG_FLAG(raft_leader_lease_clock_drift, runtime);
+
+DEFINE_bool(raft_pre_vote_hints, false,
+            "Whether leaders tell followers, on every request, how far the "
+            "logs of a majority of the voters extend, and whether a follower "
+            "whose own log is at least that long skips the pre-election when "
+            "its leader fails. Only applies outside of flexi-raft.");
+TAG_FLAG(raft_pre_vote_hints, experimental);
+TAG_FLAG(raft_pre_vote_hints, runtime);
+
+DEFINE_int32(raft_apply_parallelism, 0,
+             "If greater than 1, the number of threads used to apply committed "
+             "write operations. Writes with different dependency keys may then be "
+             "applied concurrently; writes with the same key, or without one, are "
+             "still applied in log order. Read when the replica starts.");
+TAG_FLAG(raft_apply_parallelism, experimental);
+
+DEFINE_bool(raft_term_vote_in_wal, false,
+            "If true, term and vote changes are made durable by appending a "
+            "record to the write-ahead log, group-committed with the entries "
+            "around it, instead of rewriting the consensus metadata file each "
+            "time. The consensus metadata is checkpointed every "
+            "--raft_term_vote_checkpoint_interval records and on shutdown. "
+            "Only turn this off again after a clean shutdown. Has no effect in "
+            "derived log mode. Read when the replica starts.");
+TAG_FLAG(raft_term_vote_in_wal, experimental);
+
+DEFINE_int32(raft_term_vote_checkpoint_interval, 32,
+             "With --raft_term_vote_in_wal, the number of term and vote records "
+             "appended to the log after which the consensus metadata is "
+             "flushed to disk.");
+TAG_FLAG(raft_term_vote_checkpoint_interval, experimental);
+TAG_FLAG(raft_term_vote_checkpoint_interval, runtime);
+
+DEFINE_bool(raft_gc_below_snapshot_index, false,
+            "Whether the log may be GCed below the index through which the round "
+            "handler has durably applied it, even when lagging peers still need "
+            "those ops. Such peers are caught up from the round handler's snapshot.");
+TAG_FLAG(raft_gc_below_snapshot_index, experimental);
+TAG_FLAG(raft_gc_below_snapshot_index, runtime);
+
+DEFINE_int32(raft_election_timeline_history, 0,
+             "Number of the most recent attempts to become leader of which each "
+             "replica keeps the timeline, from the failure of the leader being "
+             "detected through the votes to the first op of the new term "
+             "committing. The timelines feed the election latency metrics. 0 "
+             "disables recording them.");
+TAG_FLAG(raft_election_timeline_history, experimental);
+TAG_FLAG(raft_election_timeline_history, runtime);
+
+DEFINE_bool(raft_coalesce_config_changes, false,
+            "Whether config changes requested while another is pending are "
+            "queued, rather than rejected, and replicated once it is over, as "
+            "many of them at a time as can be combined into one config change "
+            "under the one-voter-at-a-time rule.");
+TAG_FLAG(raft_coalesce_config_changes, experimental);
+TAG_FLAG(raft_coalesce_config_changes, runtime);
+
+DEFINE_int32(raft_follower_checksum_threads, 0,
+             "If greater than 1, the number of threads on which a follower "
+             "verifies the payload checksums of the ops of a received batch in "
+             "parallel, before it waits for the replica's update lock, rather "
+             "than one op after the other while holding it. The threads are "
+             "shared by all the replicas of the process. Read when the first "
+             "batch is received.");
+TAG_FLAG(raft_follower_checksum_threads, experimental);
+
+DEFINE_int32(raft_follower_parallel_checksum_min_bytes, 64 * 1024,
+             "The smallest payload whose checksum is verified on the threads of "
+             "--raft_follower_checksum_threads. Smaller ones are verified by "
+             "the RPC handler thread, where handing them off would cost more "
+             "than it saves.");
+TAG_FLAG(raft_follower_parallel_checksum_min_bytes, experimental);
+TAG_FLAG(raft_follower_parallel_checksum_min_bytes, runtime);
+
 DEFINE_int32(lag_threshold_for_request_vote, -1,
              "The threshold beyond which a VOTER will not give votes to CANDIDATE. -1 to turn it OFF");
 
@@ -213,6 +427,19 @@ METRIC_DEFINE_counter(server, follower_memory_pressure_rejections,
                       kudu::MetricUnit::kRequests,
                       "Number of RPC requests rejected due to "
                       "memory pressure while FOLLOWER.");
+METRIC_DEFINE_counter(server, raft_admission_rejections,
+                      "Replication Admission Rejections",
+                      kudu::MetricUnit::kRequests,
+                      "Number of writes rejected by a leader because the memory it "
+                      "holds for replicating ops was over "
+                      "--raft_replication_memory_budget_mb.");
+METRIC_DEFINE_histogram(server, raft_admission_delay,
+                        "Replication Admission Delay",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds that writes admitted by a leader were delayed "
+                        "for, as the memory it holds for replicating ops neared "
+                        "--raft_replication_memory_budget_mb.",
+                        60000000LU, 2);
 METRIC_DEFINE_gauge_int64(server, raft_term,
                           "Current Raft Consensus Term",
                           kudu::MetricUnit::kUnits,
@@ -234,18 +461,21 @@ METRIC_DEFINE_gauge_int64(server, time_since_last_leader_heartbeat,
 METRIC_DEFINE_counter(server, raft_proxy_num_requests_received,
                       "Number of RPC requests received for proxying to another node",
                       kudu::MetricUnit::kRequests,
-                      "Number of RPC requests (not events) received for proxying to another node.");
+                      "Number of RPC requests (not events) received for proxying to another node.",
+                      kudu::PER_CPU);
 METRIC_DEFINE_counter(server, raft_proxy_num_requests_success,
                       "Number of RPC requests successfully proxied",
                       kudu::MetricUnit::kRequests,
                       "Number of RPC requests (not events) delivered to the next hop without any "
                       "problems. This may include requests where only a subset of events were "
-                      "delivered.");
+                      "delivered.",
+                      kudu::PER_CPU);
 METRIC_DEFINE_counter(server, raft_proxy_num_requests_unknown_dest,
                       "Number of RPC requests failed due to unknown destination",
                       kudu::MetricUnit::kRequests,
                       "Number of RPC requests received that could not be "
-                      "delivered because the destination node was unroutable.");
+                      "delivered because the destination node was unroutable.",
+                      kudu::PER_CPU);
 METRIC_DEFINE_counter(server, raft_proxy_num_requests_log_read_timeout,
                       "Number of RPC requests degraded to heartbeats due to a log read timeout",
                       kudu::MetricUnit::kRequests,
@@ -253,19 +483,115 @@ METRIC_DEFINE_counter(server, raft_proxy_num_requests_log_read_timeout,
                       "reconstituted and delivered to their ultimate "
                       "destination, but due to a log read timeout, were "
                       "gracefully degraded to a heartbeat. Use "
-                      "--raft_log_cache_proxy_wait_time_ms to control the log read timeout.");
+                      "--raft_log_cache_proxy_wait_time_ms to control the log read timeout.",
+                      kudu::PER_CPU);
 METRIC_DEFINE_counter(server, raft_proxy_num_requests_hops_remaining_exhausted,
                       "Number of RPC requests failed due to maximum hops exhausted",
                       kudu::MetricUnit::kRequests,
                       "Number of RPC requests received that were unable to be delivered due to "
                       "exceeding the maximum allowable number of hops. This is usually due to "
-                      "either a routing loop or a misconfigured value for --raft_proxy_max_hops");
+                      "either a routing loop or a misconfigured value for --raft_proxy_max_hops",
+                      kudu::PER_CPU);
+METRIC_DEFINE_histogram(server, raft_proxy_hop_latency,
+                        "Proxy Hop Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from a request for proxying being received until "
+                        "the next hop responded to it. Includes the time spent waiting "
+                        "for the proxied ops to reach the log cache.",
+                        60000000LU, 2);
+METRIC_DEFINE_histogram(server, raft_proxy_traced_hop_1_latency,
+                        "Traced Proxy Hop 1 Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds which the server took to forward the requests "
+                        "traced with --raft_proxy_trace_requests which it was the first "
+                        "proxy of, not counting the time waiting for the next hop.",
+                        60000000LU, 2);
+METRIC_DEFINE_histogram(server, raft_proxy_traced_hop_2_latency,
+                        "Traced Proxy Hop 2 Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Like raft_proxy_traced_hop_1_latency, for the requests which "
+                        "the server was the second proxy of.",
+                        60000000LU, 2);
+METRIC_DEFINE_histogram(server, raft_proxy_traced_hop_3_plus_latency,
+                        "Traced Proxy Hop 3+ Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Like raft_proxy_traced_hop_1_latency, for the requests which "
+                        "the server was the third or a later proxy of.",
+                        60000000LU, 2);
+METRIC_DEFINE_histogram(server, raft_proxy_batch_size,
+                        "Proxy Batch Size",
+                        kudu::MetricUnit::kOperations,
+                        "Number of ops in each RPC request received for proxying to "
+                        "another node.",
+                        10000, 2);
+METRIC_DEFINE_histogram(server, follower_append_time_lag,
+                        "Follower Append Time Lag",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from the leader stamping the last op of each "
+                        "batch a follower appends until the follower appended it. "
+                        "Only recorded with --raft_follower_time_lag.",
+                        3600000000LU, 2);
+METRIC_DEFINE_histogram(server, follower_commit_time_lag,
+                        "Follower Commit Time Lag",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from the leader stamping the last op a follower "
+                        "marks committed, each time its commit index advances, until "
+                        "then. Only recorded with --raft_follower_time_lag.",
+                        3600000000LU, 2);
+METRIC_DEFINE_gauge_int64(server, follower_commit_time_lag_ms,
+                          "Follower Commit Time Lag",
+                          kudu::MetricUnit::kMilliseconds,
+                          "How far behind the leader the committed data of this follower "
+                          "was, in milliseconds, when its commit index last advanced. "
+                          "Zero on a leader replica, or without --raft_follower_time_lag.");
+METRIC_DEFINE_histogram(server, raft_failure_detection_latency,
+                        "Leader Failure Detection Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from a replica last hearing from the leader until "
+                        "its failure detector fired. Only recorded with "
+                        "--raft_election_timeline_history.",
+                        600000000LU, 2);
+METRIC_DEFINE_histogram(server, raft_pre_election_latency,
+                        "Pre-Election Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from a pre-election starting until it was decided. "
+                        "Only recorded with --raft_election_timeline_history.",
+                        600000000LU, 2);
+METRIC_DEFINE_histogram(server, raft_election_vote_flush_latency,
+                        "Election Vote Flush Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from an election starting until the candidate's "
+                        "vote for itself was flushed to the consensus metadata. Only "
+                        "recorded with --raft_election_timeline_history.",
+                        600000000LU, 2);
+METRIC_DEFINE_histogram(server, raft_election_latency,
+                        "Election Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from an election starting until it was decided. "
+                        "Only recorded with --raft_election_timeline_history.",
+                        600000000LU, 2);
+METRIC_DEFINE_histogram(server, raft_leader_noop_commit_latency,
+                        "New Leader No-Op Commit Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from a replica becoming leader until the no-op "
+                        "of its term committed. Only recorded with "
+                        "--raft_election_timeline_history.",
+                        600000000LU, 2);
+METRIC_DEFINE_histogram(server, raft_failover_latency,
+                        "Failover Latency",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds from the start of a replica's successful attempt "
+                        "to become leader, at the earliest when it last heard from the "
+                        "previous leader, until the no-op of its term committed. Only "
+                        "recorded with --raft_election_timeline_history.",
+                        600000000LU, 2);
 
 using boost::optional;
 using google::protobuf::util::MessageDifferencer;
 using kudu::pb_util::SecureShortDebugString;
 using kudu::rpc::PeriodicTimer;
 //using kudu::ServerErrorPB;
+using std::pair;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
@@ -295,11 +621,17 @@ RaftConsensus::RaftConsensus(
       cmeta_manager_(std::move(cmeta_manager)),
       persistent_vars_manager_(std::move(persistent_vars_manager)),
       raft_pool_(raft_pool),
+      update_lock_("RaftConsensus::update_lock_"),
+      lock_("RaftConsensus::lock_"),
       state_(kNew),
+      published_state_(kNew),
       proxy_policy_(options_.proxy_policy),
       rng_(GetRandomSeed32()),
       leader_transfer_in_progress_(false),
+      leader_term_(kNoLeaderTerm),
       withhold_votes_until_(MonoTime::Min()),
+      pre_vote_hint_term_(-1),
+      pre_vote_hint_index_(-1),
       reject_append_entries_(false),
       adjust_voter_distribution_(true),
       withhold_votes_(false),
@@ -308,7 +640,8 @@ RaftConsensus::RaftConsensus(
       failed_elections_candidate_not_in_config_(0),
       disable_noop_(false),
       shutdown_(false),
-      update_calls_for_tests_(0) {
+      update_calls_for_tests_(0),
+      last_failure_detected_micros_(0) {
   DCHECK(local_peer_pb_.has_permanent_uuid());
   DCHECK(cmeta_manager_ != NULL);
   DCHECK(persistent_vars_manager_ != NULL);
@@ -379,12 +712,21 @@ Status RaftConsensus::Start(const ConsensusBootstrapInfo& info,
   DCHECK(log_ != NULL);
   DCHECK(time_manager_ != NULL);
 
+  term_vote_in_wal_ = FLAGS_raft_term_vote_in_wal && !FLAGS_raft_derived_log_mode;
+  if (term_vote_in_wal_) {
+    RETURN_NOT_OK_PREPEND(RecoverTermVoteFromLog(),
+                          "Unable to recover term and vote from the log");
+  }
+
   raft_log_truncation_counter_ =
     metric_entity->FindOrCreateCounter(&METRIC_raft_log_truncation_counter);
 
   term_metric_ = metric_entity->FindOrCreateGauge(&METRIC_raft_term, CurrentTerm());
   follower_memory_pressure_rejections_ =
       metric_entity->FindOrCreateCounter(&METRIC_follower_memory_pressure_rejections);
+  raft_admission_rejections_ =
+      metric_entity->FindOrCreateCounter(&METRIC_raft_admission_rejections);
+  raft_admission_delay_ = metric_entity->FindOrCreateHistogram(&METRIC_raft_admission_delay);
 
   num_failed_elections_metric_ =
       metric_entity->FindOrCreateGauge(&METRIC_failed_elections_since_stable_leader,
@@ -393,6 +735,13 @@ Status RaftConsensus::Start(const ConsensusBootstrapInfo& info,
   METRIC_time_since_last_leader_heartbeat.InstantiateFunctionGauge(
     metric_entity, Bind(&RaftConsensus::GetMillisSinceLastLeaderHeartbeat, Unretained(this)))
     ->AutoDetach(&metric_detacher_);
+  METRIC_follower_commit_time_lag_ms.InstantiateFunctionGauge(
+    metric_entity, Bind(&RaftConsensus::GetCommitTimeLagMillis, Unretained(this)))
+    ->AutoDetach(&metric_detacher_);
+  follower_append_time_lag_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_follower_append_time_lag);
+  follower_commit_time_lag_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_follower_commit_time_lag);
 
   raft_proxy_num_requests_received_ =
       metric_entity->FindOrCreateCounter(&METRIC_raft_proxy_num_requests_received);
@@ -404,6 +753,28 @@ Status RaftConsensus::Start(const ConsensusBootstrapInfo& info,
       metric_entity->FindOrCreateCounter(&METRIC_raft_proxy_num_requests_log_read_timeout);
   raft_proxy_num_requests_hops_remaining_exhausted_ =
       metric_entity->FindOrCreateCounter(&METRIC_raft_proxy_num_requests_hops_remaining_exhausted);
+  raft_proxy_hop_latency_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_proxy_hop_latency);
+  raft_proxy_traced_hop_latency_[0] =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_proxy_traced_hop_1_latency);
+  raft_proxy_traced_hop_latency_[1] =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_proxy_traced_hop_2_latency);
+  raft_proxy_traced_hop_latency_[2] =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_proxy_traced_hop_3_plus_latency);
+  raft_proxy_batch_size_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_proxy_batch_size);
+  failure_detection_latency_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_failure_detection_latency);
+  pre_election_latency_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_pre_election_latency);
+  election_vote_flush_latency_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_election_vote_flush_latency);
+  election_latency_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_election_latency);
+  leader_noop_commit_latency_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_leader_noop_commit_latency);
+  failover_latency_ =
+      metric_entity->FindOrCreateHistogram(&METRIC_raft_failover_latency);
 
   // A single Raft thread pool token is shared between RaftConsensus and
   // PeerManager. Because PeerManager is owned by RaftConsensus, it receives a
@@ -437,16 +808,37 @@ Status RaftConsensus::Start(const ConsensusBootstrapInfo& info,
   queue->SetProxyFailureThreshold(
       2 * MinimumElectionTimeout().ToMilliseconds());
 
+  // Ops are read ahead for lagging peers on a token of their own, so that the
+  // disk reads don't hold up the peers' requests on the raft pool.
+  queue->SetPrefetchPoolToken(raft_pool_->NewToken(ThreadPool::ExecutionMode::CONCURRENT));
+
+  if (auto dictionary = persistent_vars_->compression_dictionary()) {
+    RETURN_NOT_OK_PREPEND(queue->log_cache()->SetCompressionDictionary(*dictionary),
+                          "Unable to set the compression dictionary");
+  }
+
   // A manager for the set of peers that actually send the operations both remotely
   // and to the local wal.
   unique_ptr<PeerManager> peer_manager(new PeerManager(options_.tablet_id,
                                                        peer_uuid(),
                                                        peer_proxy_factory_.get(),
                                                        queue.get(),
+                                                       raft_pool_,
                                                        raft_pool_token_.get(),
-                                                       log_));
+                                                       log_,
+                                                       metric_entity));
 
-  unique_ptr<PendingRounds> pending(new PendingRounds(LogPrefixThreadSafe(), time_manager_));
+  unique_ptr<PendingRounds> pending(new PendingRounds(LogPrefixThreadSafe(), options_.tablet_id,
+                                                      time_manager_, round_handler_,
+                                                      metric_entity));
+
+  unique_ptr<ApplyScheduler> apply_scheduler;
+  if (FLAGS_raft_apply_parallelism > 1) {
+    apply_scheduler.reset(new ApplyScheduler(FLAGS_raft_apply_parallelism));
+    RETURN_NOT_OK(apply_scheduler->Init());
+    pending->SetApplyScheduler(apply_scheduler.get());
+  }
+  pending->SetCommitWaiters(&commit_waiters_);
 
   // Capture a weak_ptr reference into the functor so it can safely handle
   // outliving the consensus instance.
@@ -481,6 +873,7 @@ Status RaftConsensus::Start(const ConsensusBootstrapInfo& info,
     queue_ = std::move(queue);
     peer_manager_ = std::move(peer_manager);
     pending_ = std::move(pending);
+    apply_scheduler_ = std::move(apply_scheduler);
 
     ClearLeaderUnlocked();
 
@@ -550,6 +943,9 @@ Status RaftConsensus::Start(const ConsensusBootstrapInfo& info,
 }
 
 bool RaftConsensus::IsRunning() const {
+  if (FLAGS_raft_lockless_state_reads) {
+    return published_state_.load(std::memory_order_acquire) == kRunning;
+  }
   ThreadRestrictions::AssertWaitAllowed();
   LockGuard l(lock_);
   return state_ == kRunning;
@@ -640,6 +1036,13 @@ Status RaftConsensus::StartElection(ElectionMode mode, ElectionContext context)
       return Status::IllegalState("only voting members can start elections",
           SecureShortDebugString(cmeta_->ActiveConfig()));
     }
+    if (FLAGS_raft_witness_metadata_only_log &&
+        IsRaftConfigWitness(peer_uuid(), cmeta_->ActiveConfig())) {
+      // A witness has only the metadata of the ops, so as leader it couldn't
+      // send the other peers their payloads.
+      return Status::IllegalState("witnesses don't start elections",
+          SecureShortDebugString(cmeta_->ActiveConfig()));
+    }
 
     // In flexi raft mode, we want to start elections only in Candidate
     // regions which have voter_distribution Information.
@@ -663,6 +1066,11 @@ Status RaftConsensus::StartElection(ElectionMode mode, ElectionContext context)
     MonoDelta timeout = LeaderElectionExpBackoffDeltaUnlocked();
     SnoozeFailureDetector(string("starting election"), timeout);
 
+    std::shared_ptr<ElectionTimeline> timeline;
+    if (FLAGS_raft_election_timeline_history > 0) {
+      timeline = BeginElectionTimelineUnlocked(mode, context);
+    }
+
     // Increment the term and vote for ourselves, unless it's a pre-election.
     if (mode != PRE_ELECTION) {
       // TODO(mpercy): Consider using a separate Mutex for voting, which must sync to disk.
@@ -672,6 +1080,9 @@ Status RaftConsensus::StartElection(ElectionMode mode, ElectionContext context)
       RETURN_NOT_OK(HandleTermAdvanceUnlocked(CurrentTermUnlocked() + 1,
                                               SKIP_FLUSH_TO_DISK));
       RETURN_NOT_OK(SetVotedForCurrentTermUnlocked(peer_uuid()));
+      if (timeline) {
+        timeline->RecordPhase(ElectionTimeline::VOTE_FLUSHED);
+      }
     }
 
     RaftConfigPB active_config = cmeta_->ActiveConfig();
@@ -755,7 +1166,8 @@ Status RaftConsensus::StartElection(ElectionMode mode, ElectionContext context)
                   shared_from_this(),
                   std::move(context),
                   std::placeholders::_1),
-                  vote_logger_));
+                  vote_logger_,
+                  std::move(timeline)));
   }
 
   // Start the election outside the lock.
@@ -872,6 +1284,13 @@ Status RaftConsensus::BeginLeaderTransferPeriodUnlocked(
   queue_->BeginWatchForSuccessor(
       successor_uuid, filter_fn, election_ctx.TransferContext());
 
+  // New ops are rejected from here on, so start pushing the rest of the log
+  // to the successor now rather than on its next heartbeat; its ack of our
+  // last op is what tells it to run its election.
+  if (FLAGS_raft_fast_leader_transfer && successor_uuid) {
+    peer_manager_->SignalRequest(true);
+  }
+
   transfer_period_timer_->Start();
   return Status::OK();
 }
@@ -879,6 +1298,12 @@ Status RaftConsensus::BeginLeaderTransferPeriodUnlocked(
 void RaftConsensus::EndLeaderTransferPeriod() {
   transfer_period_timer_->Stop();
   queue_->EndWatchForSuccessor();
+  if (leader_transfer_in_progress_.Load()) {
+    // A successor we notified may still be running its election, which its
+    // voters don't hold back on our account, so acks received until it's
+    // over don't earn a lease.
+    queue_->DiscardAcksSentBefore(MonoTime::Now() + MinimumElectionTimeout());
+  }
   leader_transfer_in_progress_.Store(false, kMemOrderRelease);
 }
 
@@ -911,15 +1336,40 @@ void RaftConsensus::ReportFailureDetectedTask() {
       // heartbeat interval. Reset the failure time if so
       failureTime = std::chrono::system_clock::now();
     }
+    ElectionMode mode = FLAGS_raft_enable_pre_election ? PRE_ELECTION
+                                                       : NORMAL_ELECTION;
+    if (mode == PRE_ELECTION && CanSkipPreElection()) {
+      mode = NORMAL_ELECTION;
+    }
     WARN_NOT_OK(
-        StartElection(FLAGS_raft_enable_pre_election ? PRE_ELECTION
-                                                     : NORMAL_ELECTION,
-                      {ELECTION_TIMEOUT_EXPIRED, failureTime}),
+        StartElection(mode, {ELECTION_TIMEOUT_EXPIRED, failureTime}),
         LogPrefixThreadSafe() + "failed to trigger leader election");
   }
 }
 
+bool RaftConsensus::CanSkipPreElection() {
+  LockGuard l(lock_);
+  const int64_t hint_term = pre_vote_hint_term_;
+  // The hint only vouches for the first election after the leader's last
+  // request; later attempts pre-vote as usual.
+  pre_vote_hint_term_ = -1;
+  if (!FLAGS_raft_pre_vote_hints || FLAGS_enable_flexi_raft || hint_term < 0 ||
+      hint_term != CurrentTermUnlocked()) {
+    return false;
+  }
+  const OpId last_logged = queue_->GetLastOpIdInLog();
+  if (last_logged.term() != hint_term || last_logged.index() < pre_vote_hint_index_) {
+    return false;
+  }
+  LOG_WITH_PREFIX_UNLOCKED(INFO)
+      << "Skipping pre-election: last logged op " << OpIdToString(last_logged)
+      << " is at or past index " << pre_vote_hint_index_
+      << ", which the last leader reported a majority of voters to hold no op past";
+  return true;
+}
+
 void RaftConsensus::ReportFailureDetected() {
+  last_failure_detected_micros_.store(GetMonoTimeMicros(), std::memory_order_relaxed);
   // We're running on a timer thread; start an election on a different thread pool.
   WARN_NOT_OK(raft_pool_token_->SubmitFunc(std::bind(
       &RaftConsensus::ReportFailureDetectedTask, shared_from_this())),
@@ -945,6 +1395,25 @@ Status RaftConsensus::BecomeLeaderUnlocked() {
 
   queue_->RegisterObserver(this);
   RETURN_NOT_OK(RefreshConsensusQueueAndPeersUnlocked());
+  leader_term_.store(CurrentTermUnlocked(), std::memory_order_release);
+
+  // The leader's term starts once its no-op commits, which is where the
+  // timeline of the election which got it there ends.
+  StdStatusCallback noop_cb = &DoNothingStatusCB;
+  std::shared_ptr<ElectionTimeline> timeline = election_timeline_;
+  if (timeline && timeline->term() == CurrentTermUnlocked()) {
+    timeline->RecordPhase(ElectionTimeline::BECAME_LEADER);
+    if (disable_noop_) {
+      FinishElectionTimelineUnlocked(timeline, "won");
+    } else {
+      noop_cb = [this, timeline](const Status& s) {
+        if (s.ok()) {
+          timeline->RecordPhase(ElectionTimeline::NOOP_COMMITTED);
+        }
+        FinishElectionTimelineUnlocked(timeline, s.ok() ? "won" : "no-op aborted");
+      };
+    }
+  }
 
   if (disable_noop_) {
     return Status::OK();
@@ -963,10 +1432,12 @@ Status RaftConsensus::BecomeLeaderUnlocked() {
       &RaftConsensus::NonTxRoundReplicationFinished,
       this,
       round.get(),
-      &DoNothingStatusCB,
+      std::move(noop_cb),
       std::placeholders::_1));
 
   last_leader_communication_time_micros_ = 0;
+  append_time_lag_us_ = -1;
+  commit_time_lag_us_ = -1;
 
   return AppendNewRoundToQueueUnlocked(round);
 }
@@ -995,8 +1466,12 @@ Status RaftConsensus::BecomeReplicaUnlocked(boost::optional<MonoDelta> fd_delta)
 }
 
 Status RaftConsensus::Replicate(const scoped_refptr<ConsensusRound>& round) {
+  if (TrafficCapture* capture = TrafficCapture::Get()) {
+    capture->Record(TrafficCaptureRecordPB::REPLICATE, tablet_id(), { round->replicate_msg() });
+  }
+  RETURN_NOT_OK(AdmitReplication());
 
-  std::lock_guard<simple_spinlock> lock(update_lock_);
+  std::lock_guard<profiled_adaptive_mutex> lock(update_lock_);
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
@@ -1009,6 +1484,74 @@ Status RaftConsensus::Replicate(const scoped_refptr<ConsensusRound>& round) {
   return Status::OK();
 }
 
+Status RaftConsensus::ReplicateBatch(const vector<scoped_refptr<ConsensusRound>>& rounds) {
+  if (rounds.empty()) {
+    return Status::OK();
+  }
+  if (TrafficCapture* capture = TrafficCapture::Get()) {
+    vector<const ReplicateMsg*> msgs;
+    msgs.reserve(rounds.size());
+    for (const scoped_refptr<ConsensusRound>& round : rounds) {
+      msgs.push_back(round->replicate_msg());
+    }
+    capture->Record(TrafficCaptureRecordPB::REPLICATE, tablet_id(), msgs);
+  }
+  RETURN_NOT_OK(AdmitReplication());
+
+  std::lock_guard<profiled_adaptive_mutex> lock(update_lock_);
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    for (const scoped_refptr<ConsensusRound>& round : rounds) {
+      RETURN_NOT_OK(CheckSafeToReplicateUnlocked(*round->replicate_msg()));
+      RETURN_NOT_OK(round->CheckBoundTerm(CurrentTermUnlocked()));
+    }
+    RETURN_NOT_OK(AppendNewRoundsToQueueUnlocked(rounds));
+  }
+
+  peer_manager_->SignalRequest();
+  return Status::OK();
+}
+
+Status RaftConsensus::AdmitReplication() {
+  const int64_t budget = FLAGS_raft_replication_memory_budget_mb * 1024 * 1024;
+  if (PREDICT_TRUE(budget <= 0)) {
+    return Status::OK();
+  }
+  // The queue and the pending rounds are set before the replica starts
+  // running. One which isn't running rejects the write later on anyway.
+  if (published_state_.load(std::memory_order_acquire) != kRunning) {
+    return Status::OK();
+  }
+  const int64_t used = queue_->log_cache()->BytesUsed() + pending_->GetPendingBytes();
+  const int64_t threshold =
+      budget * std::min(std::max(FLAGS_raft_admission_delay_threshold_pct, 0), 100) / 100;
+  if (PREDICT_TRUE(used < threshold)) {
+    return Status::OK();
+  }
+  if (used >= budget) {
+    if (raft_admission_rejections_) raft_admission_rejections_->Increment();
+    KLOG_EVERY_N_SECS(WARNING, 1) << LogPrefixThreadSafe()
+                                  << "Rejecting write: replication memory budget exceeded ("
+                                  << used << " of " << budget << " bytes in use)"
+                                  << THROTTLE_MSG;
+    return Status::ServiceUnavailable(Substitute(
+        "Replication memory budget exceeded: $0 of $1 bytes in use", used, budget));
+  }
+
+  // The delay grows linearly from nothing at the threshold to the longest at
+  // the budget, so that writers slow down gradually as the followers fall
+  // behind rather than all fail at once.
+  const int64_t delay_us = FLAGS_raft_admission_max_delay_ms * 1000LL * (used - threshold) /
+      std::max<int64_t>(budget - threshold, 1);
+  if (delay_us > 0) {
+    ThreadRestrictions::AssertWaitAllowed();
+    SleepFor(MonoDelta::FromMicroseconds(delay_us));
+  }
+  if (raft_admission_delay_) raft_admission_delay_->Increment(delay_us);
+  return Status::OK();
+}
+
 Status RaftConsensus::TruncateCallbackWithRaftLock(int64_t *index_if_truncated) {
   DCHECK(FLAGS_raft_derived_log_mode);
   ThreadRestrictions::AssertWaitAllowed();
@@ -1028,6 +1571,17 @@ Status RaftConsensus::TruncateCallbackWithRaftLock(int64_t *index_if_truncated)
 }
 
 Status RaftConsensus::CheckLeadershipAndBindTerm(const scoped_refptr<ConsensusRound>& round) {
+  if (FLAGS_raft_lockless_term_binding) {
+    // Fast path: the term was published when we became leader and is cleared
+    // before leadership is given up, so binding to it without the lock is
+    // only ever stale in a way that CheckBoundTerm() in Replicate() catches.
+    int64_t term = leader_term_.load(std::memory_order_acquire);
+    if (term != kNoLeaderTerm && !leader_transfer_in_progress_.Load()) {
+      round->BindToTerm(term);
+      return Status::OK();
+    }
+  }
+
   ThreadRestrictions::AssertWaitAllowed();
   LockGuard l(lock_);
   RETURN_NOT_OK(CheckSafeToReplicateUnlocked(*round->replicate_msg()));
@@ -1054,6 +1608,7 @@ Status RaftConsensus::AppendNewRoundToQueueUnlocked(const scoped_refptr<Consensu
   } else {
     *round->replicate_msg()->mutable_id() = queue_->GetNextOpId();
   }
+  OpTimeline::TraceReplicate(options_.tablet_id, round->replicate_msg()->id().index());
   RETURN_NOT_OK(AddPendingOperationUnlocked(round));
 
   // The only reasons for a bad status would be if the log itself were shut down,
@@ -1063,6 +1618,47 @@ Status RaftConsensus::AppendNewRoundToQueueUnlocked(const scoped_refptr<Consensu
   return Status::OK();
 }
 
+Status RaftConsensus::AppendNewRoundsToQueueUnlocked(
+    const vector<scoped_refptr<ConsensusRound>>& rounds) {
+  DCHECK(lock_.is_locked());
+
+  // Check the whole batch before assigning anything, so that the batch is
+  // either appended in full or not at all. As in AppendNewRoundToQueueUnlocked(),
+  // an index set before ::ReplicateBatch() must be the one the round gets.
+  const OpId next_id = queue_->GetNextOpId();
+  for (size_t i = 0; i < rounds.size(); i++) {
+    const ReplicateMsg* msg = rounds[i]->replicate_msg();
+    if (PREDICT_FALSE(msg->op_type() == CHANGE_CONFIG_OP)) {
+      return Status::InvalidArgument("config changes can't be replicated in a batch");
+    }
+    const int64_t index = next_id.index() + i;
+    if (PREDICT_FALSE(msg->id().index() != 0 && msg->id().index() != index)) {
+      return Status::Aborted(
+        strings::Substitute(
+          "Transaction submitted with index $0 mismatches with queue index $1",
+          msg->id().index(), index));
+    }
+  }
+
+  vector<ReplicateRefPtr> msgs;
+  msgs.reserve(rounds.size());
+  for (size_t i = 0; i < rounds.size(); i++) {
+    *rounds[i]->replicate_msg()->mutable_id() = MakeOpId(next_id.term(), next_id.index() + i);
+    OpTimeline::TraceReplicate(options_.tablet_id, next_id.index() + i);
+    // Only config changes can fail to be added.
+    CHECK_OK(AddPendingOperationUnlocked(rounds[i]));
+    msgs.push_back(rounds[i]->replicate_scoped_refptr());
+  }
+
+  // The only reasons for a bad status would be if the log itself were shut down,
+  // or if we had an actual IO error, which we currently don't handle.
+  CHECK_OK_PREPEND(queue_->AppendOperations(
+                       msgs, Bind(CrashIfNotOkStatusCB,
+                                  "Enqueued replicate operation failed to write to WAL")),
+                   Substitute("$0: could not append to queue", LogPrefixUnlocked()));
+  return Status::OK();
+}
+
 Status RaftConsensus::AddPendingOperationUnlocked(const scoped_refptr<ConsensusRound>& round) {
   DCHECK(lock_.is_locked());
   DCHECK(pending_);
@@ -1204,6 +1800,116 @@ void RaftConsensus::NotifyPeerToPromote(const std::string& peer_uuid) {
               LogPrefixThreadSafe() + "Unable to start TryPromoteNonVoterTask");
 }
 
+void RaftConsensus::ReplicateQueuedConfigChangesTask() {
+  vector<StdStatusCallback> batch_cbs;
+  vector<pair<StdStatusCallback, Status>> failed;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    if (cmeta_->has_pending_config()) {
+      // Another config change got in first: wait for it to be over.
+      return;
+    }
+    Status s = CheckRunningUnlocked().AndThen([this] { return CheckActiveLeaderUnlocked(); });
+    if (!s.ok()) {
+      for (QueuedConfigChange& change : queued_config_changes_) {
+        failed.emplace_back(std::move(change.client_cb), s);
+      }
+      queued_config_changes_.clear();
+    }
+
+    // Grow the batch one request at a time, validating each step against
+    // the committed config, which all of them will be applied to at once.
+    const RaftConfigPB committed_config = cmeta_->CommittedConfig();
+    BulkChangeConfigRequestPB batch_req;
+    batch_req.set_tablet_id(options_.tablet_id);
+    RaftConfigPB new_config;
+    while (!queued_config_changes_.empty()) {
+      QueuedConfigChange& change = queued_config_changes_.front();
+      if (change.req.has_cas_config_opid_index() &&
+          change.req.cas_config_opid_index() != committed_config.opid_index()) {
+        failed.emplace_back(std::move(change.client_cb), Status::IllegalState(
+            Substitute("Request specified cas_config_opid_index of $0 but the committed "
+                       "config has opid_index of $1", change.req.cas_config_opid_index(),
+                       committed_config.opid_index())));
+        queued_config_changes_.pop_front();
+        continue;
+      }
+      BulkChangeConfigRequestPB candidate_req = batch_req;
+      for (const auto& item : change.req.config_changes()) {
+        *candidate_req.add_config_changes() = item;
+      }
+      boost::optional<ServerErrorPB::Code> error_code;
+      RaftConfigPB candidate_config;
+      s = CheckBulkConfigChangeAndGetNewConfigUnlocked(candidate_req, &error_code,
+                                                       &candidate_config);
+      if (!s.ok()) {
+        if (!batch_cbs.empty()) {
+          // It may well be valid on its own: leave it for the next batch.
+          break;
+        }
+        failed.emplace_back(std::move(change.client_cb), s);
+        queued_config_changes_.pop_front();
+        continue;
+      }
+      batch_req = std::move(candidate_req);
+      new_config = std::move(candidate_config);
+      batch_cbs.emplace_back(std::move(change.client_cb));
+      queued_config_changes_.pop_front();
+    }
+
+    if (!batch_cbs.empty()) {
+      LOG_WITH_PREFIX_UNLOCKED(INFO) << "Replicating " << batch_cbs.size()
+                                     << " queued config changes as one: "
+                                     << SecureShortDebugString(batch_req);
+      StdStatusCallback batch_cb = [batch_cbs](const Status& status) {
+        for (const StdStatusCallback& cb : batch_cbs) {
+          cb(status);
+        }
+      };
+      s = ReplicateConfigChangeUnlocked(
+          committed_config, std::move(new_config), std::bind(
+              &RaftConsensus::MarkDirtyOnSuccess,
+              this,
+              string("Config change replication complete"),
+              std::move(batch_cb),
+              std::placeholders::_1));
+      if (!s.ok()) {
+        for (StdStatusCallback& cb : batch_cbs) {
+          failed.emplace_back(std::move(cb), s);
+        }
+        batch_cbs.clear();
+      }
+    }
+  }
+
+  for (const auto& entry : failed) {
+    entry.first(entry.second);
+  }
+  if (!batch_cbs.empty()) {
+    peer_manager_->SignalRequest();
+  }
+}
+
+void RaftConsensus::FailQueuedConfigChanges(const Status& s) {
+  std::deque<QueuedConfigChange> changes;
+  {
+    LockGuard l(lock_);
+    changes.swap(queued_config_changes_);
+  }
+  for (const QueuedConfigChange& change : changes) {
+    change.client_cb(s);
+  }
+}
+
+void RaftConsensus::NotifyPeerNeedsSnapshot(const string& peer_uuid, int64_t snapshot_index) {
+  WARN_NOT_OK(raft_pool_token_->SubmitFunc(std::bind(&RaftConsensus::TrySendSnapshotToPeerTask,
+                                                     shared_from_this(),
+                                                     peer_uuid,
+                                                     snapshot_index)),
+              LogPrefixThreadSafe() + "Unable to start TrySendSnapshotToPeerTask");
+}
+
 void RaftConsensus::NotifyPeerToStartElection(const string& peer_uuid,
     boost::optional<PeerMessageQueue::TransferContext> transfer_context) {
   LOG(INFO) << "Instructing follower " << peer_uuid << " to start an election";
@@ -1218,6 +1924,21 @@ void RaftConsensus::NotifyPeerHealthChange() {
   MarkDirty("Peer health change");
 }
 
+void RaftConsensus::NotifyProxyTopologyChange(const ProxyTopologyPB& proxy_topology) {
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  // The topology was built for the config and leadership the queue had, both
+  // of which may have changed since.
+  if (PREDICT_FALSE(state_ != kRunning || cmeta_->active_role() != RaftPeerPB::LEADER)) {
+    return;
+  }
+  LOG_WITH_PREFIX_UNLOCKED(INFO) << "Installing proxy topology built from link costs: "
+                                 << SecureShortDebugString(proxy_topology);
+  WARN_NOT_OK(routing_table_container_->UpdateProxyTopology(
+                  proxy_topology, cmeta_->ActiveConfig(), peer_uuid()),
+              LogPrefixUnlocked() + "Unable to install proxy topology");
+}
+
 void RaftConsensus::TryRemoveFollowerTask(const string& uuid,
                                           const RaftConfigPB& committed_config,
                                           const std::string& reason) {
@@ -1233,6 +1954,34 @@ void RaftConsensus::TryRemoveFollowerTask(const string& uuid,
               LogPrefixThreadSafe() + "Unable to remove follower " + uuid);
 }
 
+void RaftConsensus::TrySendSnapshotToPeerTask(const std::string& peer_uuid,
+                                              int64_t snapshot_index) {
+  string msg = Substitute("attempt to send snapshot through index $0 to peer $1: ",
+                          snapshot_index, peer_uuid);
+  RaftPeerPB peer_pb;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    if (cmeta_->active_role() != RaftPeerPB::LEADER) {
+      LOG_WITH_PREFIX_UNLOCKED(INFO) << msg << "no longer the leader. Doing nothing.";
+      return;
+    }
+    RaftConfigPB active_config = cmeta_->ActiveConfig();
+    RaftPeerPB* member;
+    Status s = GetRaftConfigMember(&active_config, peer_uuid, &member);
+    if (!s.ok()) {
+      LOG_WITH_PREFIX_UNLOCKED(INFO) << msg << "can't find peer in the active config. "
+                                     << "Doing nothing.";
+      return;
+    }
+    peer_pb = *member;
+  }
+
+  LOG(INFO) << LogPrefixThreadSafe() << msg << "the ops it needs have been GCed from the log";
+  WARN_NOT_OK(round_handler_->SendSnapshotToPeer(peer_pb, snapshot_index),
+              LogPrefixThreadSafe() + msg + "failed");
+}
+
 void RaftConsensus::TryPromoteNonVoterTask(const std::string& peer_uuid) {
   string msg = Substitute("attempt to promote peer $0: ", peer_uuid);
   int64_t current_committed_config_index;
@@ -1319,7 +2068,8 @@ void RaftConsensus::TryStartElectionOnPeerTask(const string& peer_uuid,
 }
 
 Status RaftConsensus::Update(const ConsensusRequestPB* request,
-                             ConsensusResponsePB* response) {
+                             ConsensusResponsePB* response,
+                             std::shared_ptr<google::protobuf::Arena> request_arena) {
   update_calls_for_tests_.Increment();
 
   if (PREDICT_FALSE(
@@ -1333,9 +2083,19 @@ Status RaftConsensus::Update(const ConsensusRequestPB* request,
 
   VLOG_WITH_PREFIX(2) << "Replica received request: " << SecureShortDebugString(*request);
 
+  // Checksumming a large batch is done before queueing up behind
+  // 'update_lock_', so that it overlaps with the previous request's work
+  // rather than adding to it.
+  const bool payload_checksums_verified = VerifyPayloadChecksums(*request);
+
   // see var declaration
-  std::lock_guard<simple_spinlock> lock(update_lock_);
-  Status s = UpdateReplica(request, response);
+  std::unique_lock<profiled_adaptive_mutex> lock(update_lock_);
+  Status s = UpdateReplica(request, response, std::move(request_arena), &lock,
+                           payload_checksums_verified);
+  if (FLAGS_raft_follower_memory_flow_control) {
+    response->set_available_bytes(
+        std::max<int64_t>(0, process_memory::SoftLimit() - process_memory::CurrentConsumption()));
+  }
   if (PREDICT_FALSE(VLOG_IS_ON(1))) {
     if (request->ops().empty()) {
       VLOG_WITH_PREFIX(1) << "Replica replied to status only request. Replica: "
@@ -1351,12 +2111,87 @@ static bool IsConsensusOnlyOperation(OperationType op_type) {
   return op_type == NO_OP || op_type == CHANGE_CONFIG_OP;
 }
 
-Status RaftConsensus::StartFollowerTransactionUnlocked(const ReplicateRefPtr& msg) {
+// Returns the pool on which followers verify payload checksums, or null if
+// --raft_follower_checksum_threads is not set. It is never destroyed.
+static ThreadPool* ChecksumPool() {
+  static ThreadPool* pool = []() -> ThreadPool* {
+    if (FLAGS_raft_follower_checksum_threads <= 1) {
+      return nullptr;
+    }
+    gscoped_ptr<ThreadPool> p;
+    CHECK_OK(ThreadPoolBuilder("raft-checksum")
+             .set_max_threads(FLAGS_raft_follower_checksum_threads)
+             .Build(&p));
+    return p.release();
+  }();
+  return pool;
+}
+
+bool RaftConsensus::VerifyPayloadChecksums(const ConsensusRequestPB& request) {
+  ThreadPool* pool = ChecksumPool();
+  if (!pool) {
+    return false;
+  }
+  const size_t min_bytes = std::max(FLAGS_raft_follower_parallel_checksum_min_bytes, 1);
+  vector<const WritePayloadPB*> large;
+  vector<const WritePayloadPB*> small;
+  for (const ReplicateMsg& op : request.ops()) {
+    const WritePayloadPB& payload = op.write_payload();
+    if (payload.crc32() == 0 || payload.payload_stripped()) {
+      continue;
+    }
+    (payload.payload().size() >= min_bytes ? large : small).push_back(&payload);
+  }
+  if (large.size() < 2) {
+    return false;
+  }
+
+  auto matches = [](const WritePayloadPB* payload) {
+    const std::string& data = payload->payload();
+    return crc::Crc32c(data.c_str(), data.size()) == payload->crc32();
+  };
+  std::atomic<bool> all_match(true);
+  // The handler thread verifies the last large payload and the small ones
+  // itself.
+  CountDownLatch latch(large.size() - 1);
+  for (size_t i = 0; i + 1 < large.size(); i++) {
+    const WritePayloadPB* payload = large[i];
+    auto verify = [&matches, payload, &all_match, &latch]() {
+      if (!matches(payload)) {
+        all_match = false;
+      }
+      latch.CountDown();
+    };
+    if (PREDICT_FALSE(!pool->SubmitFunc(verify).ok())) {
+      verify();
+    }
+  }
+  bool handler_match = matches(large.back());
+  for (const WritePayloadPB* payload : small) {
+    handler_match = handler_match && matches(payload);
+  }
+  latch.Wait();
+  return handler_match && all_match;
+}
+
+Status RaftConsensus::StartFollowerTransactionUnlocked(const ReplicateRefPtr& msg,
+                                                       bool payload_checksum_verified) {
   DCHECK(lock_.is_locked());
+  OpTimeline::TraceReceive(options_.tablet_id, msg->get()->id().index());
+
+  // Only a witness may be sent an op without its payload. There is nothing to
+  // validate the checksum of then.
+  const bool payload_stripped = msg->get()->write_payload().payload_stripped();
+  if (PREDICT_FALSE(payload_stripped) &&
+      !IsRaftConfigWitness(peer_uuid(), cmeta_->ActiveConfig())) {
+    return Status::Corruption(Substitute("Rejected: $0 was sent without its payload, "
+                                         "which only a witness may be",
+                                         OpIdToString(msg->get()->id())));
+  }
 
   // Validate crc32 checksum
   uint32_t payload_crc32 = msg->get()->write_payload().crc32();
-  if (payload_crc32 != 0) {
+  if (payload_crc32 != 0 && !payload_stripped && !payload_checksum_verified) {
     const std::string& payload = msg->get()->write_payload().payload();
     uint32_t computed_crc32 = crc::Crc32c(payload.c_str(), payload.size());
     if (payload_crc32 != computed_crc32) {
@@ -1419,9 +2254,37 @@ void RaftConsensus::DeduplicateLeaderRequestUnlocked(ConsensusRequestPB* rpc_req
 
   deduplicated_req->first_message_idx = -1;
 
+  // Fast path for retransmitted ops: by the log matching property, if an op of
+  // the request matches our log then so do all the ops before it. So the
+  // prefix of the request we already have can be skipped after checking a
+  // single op, the last one which isn't above our last logged index, rather
+  // than comparing the ops one by one.
+  int first_unknown_pos = 0;
+  if (rpc_req->ops_size() > 0) {
+    const int64_t first_index = rpc_req->ops(0).id().index();
+    const int64_t last_index = rpc_req->ops(rpc_req->ops_size() - 1).id().index();
+    const int64_t probe_index = std::min(last_index, dedup_up_to_index);
+    if (probe_index >= first_index &&
+        last_index - first_index == rpc_req->ops_size() - 1) {
+      const int probe_pos = static_cast<int>(probe_index - first_index);
+      const OpId& probe_id = rpc_req->ops(probe_pos).id();
+      bool have_prefix = probe_index <= last_committed_index;
+      if (!have_prefix) {
+        scoped_refptr<ConsensusRound> round = pending_->GetPendingOpByIndexOrNull(probe_index);
+        have_prefix = round && OpIdEquals(round->replicate_msg()->id(), probe_id);
+      }
+      if (have_prefix) {
+        VLOG_WITH_PREFIX_UNLOCKED(2) << "Skipping op ids up to " << probe_id
+                                     << " (already received)";
+        deduplicated_req->preceding_opid = &probe_id;
+        first_unknown_pos = probe_pos + 1;
+      }
+    }
+  }
+
   // In this loop we discard duplicates and advance the leader's preceding id
   // accordingly.
-  for (int i = 0; i < rpc_req->ops_size(); i++) {
+  for (int i = first_unknown_pos; i < rpc_req->ops_size(); i++) {
     ReplicateMsg* leader_msg = rpc_req->mutable_ops(i);
 
     if (leader_msg->id().index() <= last_committed_index) {
@@ -1457,7 +2320,13 @@ void RaftConsensus::DeduplicateLeaderRequestUnlocked(ConsensusRequestPB* rpc_req
     if (deduplicated_req->first_message_idx == - 1) {
       deduplicated_req->first_message_idx = i;
     }
-    deduplicated_req->messages.push_back(make_scoped_refptr_replicate(leader_msg));
+    if (deduplicated_req->request_arena) {
+      DCHECK_EQ(deduplicated_req->request_arena.get(), leader_msg->GetArena());
+      deduplicated_req->messages.push_back(
+          make_scoped_refptr_replicate(leader_msg, deduplicated_req->request_arena));
+    } else {
+      deduplicated_req->messages.push_back(make_scoped_refptr_replicate(leader_msg));
+    }
   }
 
   if (deduplicated_req->messages.size() != rpc_req->ops_size()) {
@@ -1515,6 +2384,19 @@ Status RaftConsensus::EnforceLogMatchingPropertyMatchesUnlocked(const LeaderRequ
                              ConsensusErrorPB::PRECEDING_ENTRY_DIDNT_MATCH,
                              Status::IllegalState(error_msg));
 
+  // Tell the leader which term the logs conflict in and where that term
+  // starts in ours, so it can skip past it in one round trip. This must
+  // be computed before the truncation below.
+  int64_t conflict_index = std::min(req.preceding_opid->index(),
+                                    pending_->GetLastPendingTransactionOpId().index());
+  scoped_refptr<ConsensusRound> conflict_round = pending_->GetPendingOpByIndexOrNull(conflict_index);
+  if (conflict_round) {
+    int64_t conflict_term = conflict_round->id().term();
+    response->mutable_status()->set_conflicting_term(conflict_term);
+    response->mutable_status()->set_conflicting_term_first_index(
+        pending_->FirstPendingIndexOfTerm(conflict_term, conflict_index));
+  }
+
   LOG_WITH_PREFIX_UNLOCKED(INFO) << "Refusing update from remote peer "
                         << req.leader_uuid << ": " << error_msg;
 
@@ -1638,12 +2520,20 @@ Status RaftConsensus::CheckLeaderRequestUnlocked(const ConsensusRequestPB* reque
 }
 
 Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
-                                    ConsensusResponsePB* response) {
+                                    ConsensusResponsePB* response,
+                                    std::shared_ptr<google::protobuf::Arena> request_arena,
+                                    std::unique_lock<profiled_adaptive_mutex>* update_guard,
+                                    bool payload_checksums_verified) {
   TRACE_EVENT2("consensus", "RaftConsensus::UpdateReplica",
                "peer", peer_uuid(),
                "tablet", options_.tablet_id);
-  Synchronizer log_synchronizer;
-  StatusCallback sync_status_cb = log_synchronizer.AsStatusCallback();
+  auto log_synchronizer = std::make_shared<Synchronizer>();
+  StatusCallback sync_status_cb = log_synchronizer->AsStatusCallback();
+  const bool release_update_lock =
+      update_guard && FLAGS_raft_follower_release_update_lock_for_log_wait;
+  // The append to wait for before responding: this request's own, or if it
+  // appends nothing, the latest one, which may still be in progress.
+  std::shared_ptr<Synchronizer> wait_for_append;
   // this is a temp variable. reset every time.
   new_leader_detected_failsafe_ = false;
 
@@ -1736,6 +2626,7 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
 
   // The deduplicated request.
   LeaderRequest deduped_req;
+  deduped_req.request_arena = std::move(request_arena);
   auto& messages = deduped_req.messages;
   {
     ThreadRestrictions::AssertWaitAllowed();
@@ -1760,7 +2651,7 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
     // If this particular instance is banned from cluster manager,
     // then we snooze for longer to give other instances an opportunity to win
     // the election
-    SnoozeFailureDetector(boost::none, MinimumElectionTimeoutWithBan());
+    SnoozeFailureDetector(boost::none, LeaderFailureTimeoutUnlocked(request->caller_uuid()));
 
     last_leader_communication_time_micros_ = GetMonoTimeMicros();
 
@@ -1786,6 +2677,13 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
     // from 1x -> 2X of election timeout.
     withhold_votes_until_ = MonoTime::Now() + MinimumElectionTimeout();
 
+    if (request->has_voters_majority_log_index()) {
+      pre_vote_hint_term_ = request->caller_term();
+      pre_vote_hint_index_ = request->voters_majority_log_index();
+    } else {
+      pre_vote_hint_term_ = -1;
+    }
+
     // 1 - Early commit pending (and committed) transactions
 
     // What should we commit?
@@ -1819,14 +2717,23 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
         string msg = StringPrintf(
             "Soft memory limit exceeded (at %.2f%% of capacity)",
             capacity_pct);
+        const bool flow_control = FLAGS_raft_follower_memory_flow_control;
+        const char* action = flow_control ? "Dropping ops of consensus request"
+                                          : "Rejecting consensus request";
         if (capacity_pct >= FLAGS_memory_limit_warn_threshold_percentage) {
-          KLOG_EVERY_N_SECS(WARNING, 1) << "Rejecting consensus request [EVERY 1 second]: " << msg
+          KLOG_EVERY_N_SECS(WARNING, 1) << action << " [EVERY 1 second]: " << msg
                                         << THROTTLE_MSG;
         } else {
-          KLOG_EVERY_N_SECS(INFO, 1) << "Rejecting consensus request [EVERY 1 second]: " << msg
+          KLOG_EVERY_N_SECS(INFO, 1) << action << " [EVERY 1 second]: " << msg
                                      << THROTTLE_MSG;
         }
-        return Status::ServiceUnavailable(msg);
+        if (!flow_control) {
+          return Status::ServiceUnavailable(msg);
+        }
+        // Handle the request as a status-only one: the response tells the
+        // leader how far we got and that we have no room for more ops, so it
+        // holds the ops back rather than resending them blindly.
+        messages.clear();
       }
     }
 
@@ -1848,7 +2755,7 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
       if (op_type == NO_OP) {
         new_leader_detected_failsafe_ = false;
       }
-      prepare_status = StartFollowerTransactionUnlocked(*iter);
+      prepare_status = StartFollowerTransactionUnlocked(*iter, payload_checksums_verified);
       if (PREDICT_FALSE(!prepare_status.ok())) {
         expected_rotation_delay = prepare_status.IsIllegalState() &&
             (prepare_status.ToString().find(
@@ -1917,8 +2824,20 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
       // Since we've prepared, we need to be able to append (or we risk trying to apply
       // later something that wasn't logged). We crash if we can't.
       CHECK_OK(queue_->AppendOperations(messages, sync_status_cb));
+      if (FLAGS_raft_follower_time_lag) {
+        int64_t lag_us = TimeLagMicros(messages.back()->get()->timestamp());
+        if (lag_us >= 0) {
+          append_time_lag_us_ = lag_us;
+          follower_append_time_lag_->Increment(lag_us);
+        }
+      }
+      last_append_synchronizer_ = log_synchronizer;
+      wait_for_append = log_synchronizer;
     } else {
       last_from_leader = *deduped_req.preceding_opid;
+      if (release_update_lock) {
+        wait_for_append = last_append_synchronizer_;
+      }
     }
 
     // 4 - Mark transactions as committed
@@ -1940,6 +2859,15 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
 
     VLOG_WITH_PREFIX_UNLOCKED(1) << "Marking committed up to " << apply_up_to;
     TRACE("Marking committed up to $0", apply_up_to);
+    if (FLAGS_raft_follower_time_lag && apply_up_to > pending_->GetCommittedIndex()) {
+      // The op is still pending until the committed index advances past it.
+      scoped_refptr<ConsensusRound> round = pending_->GetPendingOpByIndexOrNull(apply_up_to);
+      int64_t lag_us = round ? TimeLagMicros(round->replicate_msg()->timestamp()) : -1;
+      if (lag_us >= 0) {
+        commit_time_lag_us_ = lag_us;
+        follower_commit_time_lag_->Increment(lag_us);
+      }
+    }
     CHECK_OK(pending_->AdvanceCommittedIndex(apply_up_to));
     queue_->UpdateFollowerWatermarks(
         apply_up_to,
@@ -1962,17 +2890,24 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
   // We'll re-acquire it before we update the state again.
 
   // Update the last replicated op id
-  if (!messages.empty()) {
+  if (wait_for_append) {
 
     // 5 - We wait for the writes to be durable.
 
-    // Note that this is safe because dist consensus now only supports a single outstanding
-    // request at a time and this way we can allow commits to proceed while we wait.
+    // Note that this is safe because the updates are serialized by
+    // 'update_lock_' up to this point and this way we can allow commits to
+    // proceed while we wait. If the update lock is released here, the next
+    // request can append behind this one; as the log writes complete in
+    // order, the ops of this request, and any before it, are durable once its
+    // own append completes.
+    if (release_update_lock) {
+      update_guard->unlock();
+    }
     TRACE("Waiting on the replicates to finish logging");
     TRACE_EVENT0("consensus", "Wait for log");
     Status s;
     do {
-      s = log_synchronizer.WaitFor(
+      s = wait_for_append->WaitFor(
           MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms));
       // If just waiting for our log append to finish lets snooze the timer.
       // We don't want to fire leader election because we're waiting on our own log.
@@ -2030,7 +2965,7 @@ Status RaftConsensus::RequestVote(const VoteRequestPB* request,
   // We must acquire the update lock in order to ensure that this vote action
   // takes place between requests.
   // Lock ordering: update_lock_ must be acquired before lock_.
-  std::unique_lock<simple_spinlock> update_guard(update_lock_, std::defer_lock);
+  std::unique_lock<profiled_adaptive_mutex> update_guard(update_lock_, std::defer_lock);
   if (FLAGS_enable_leader_failure_detection && !request->ignore_live_leader()) {
     update_guard.try_lock();
   } else {
@@ -2264,6 +3199,17 @@ Status RaftConsensus::BulkChangeConfig(const BulkChangeConfigRequestPB& req,
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
+    // Queue the change behind the pending one, or behind those queued
+    // already, so as to keep them in order.
+    if (FLAGS_raft_coalesce_config_changes &&
+        (cmeta_->has_pending_config() || !queued_config_changes_.empty())) {
+      RETURN_NOT_OK(CheckRunningUnlocked());
+      RETURN_NOT_OK(CheckActiveLeaderUnlocked());
+      queued_config_changes_.push_back({ req, std::move(client_cb) });
+      VLOG_WITH_PREFIX_UNLOCKED(1) << "Queued config change behind the pending one: "
+                                   << SecureShortDebugString(req);
+      return Status::OK();
+    }
     RaftConfigPB new_config;
     CheckBulkConfigChangeAndGetNewConfigUnlocked(req, error_code, &new_config);
     const RaftConfigPB committed_config = cmeta_->CommittedConfig();
@@ -2761,12 +3707,28 @@ void RaftConsensus::Stop() {
       withhold_votes_until_ = MonoTime::Min();
     }
 
+    // Checkpoint any term or vote changes which so far only live in the log.
+    if (cmeta_ && term_vote_records_since_checkpoint_ > 0) {
+      WARN_NOT_OK(cmeta_->Flush(), LogPrefixUnlocked() +
+                  "Unable to checkpoint consensus metadata");
+      term_vote_records_since_checkpoint_ = 0;
+    }
+
     LOG_WITH_PREFIX_UNLOCKED(INFO) << "Raft consensus is shut down!";
   }
 
+  // Let the writes that were already committed finish applying. This is done
+  // outside of 'lock_' since the apply callbacks may need it.
+  if (apply_scheduler_) apply_scheduler_->Shutdown();
+
+  commit_waiters_.Shutdown(Status::Aborted("Raft consensus is shutting down"));
+
   // Shut down things that might acquire locks during destruction.
   if (raft_pool_token_) raft_pool_token_->Shutdown();
   if (failure_detector_) DisableFailureDetector();
+
+  // The queued config changes won't be replicated now.
+  FailQueuedConfigChanges(Status::ServiceUnavailable("Raft consensus is shutting down"));
 }
 
 void RaftConsensus::Shutdown() {
@@ -3047,24 +4009,46 @@ std::string RaftConsensus::GetCandidateContextString(const VoteRequestPB* reques
   return msg;
 }
 
+std::shared_ptr<const ConsensusMetadata::Snapshot> RaftConsensus::PublishedCMetaSnapshot() const {
+  if (!FLAGS_raft_lockless_state_reads ||
+      published_state_.load(std::memory_order_acquire) == kNew) {
+    return nullptr;
+  }
+  // 'cmeta_' is loaded by Init() before the state leaves kNew, and never
+  // replaced afterwards.
+  return cmeta_->snapshot();
+}
+
 RaftPeerPB::Role RaftConsensus::role() const {
+  if (auto snapshot = PublishedCMetaSnapshot()) {
+    return snapshot->active_role;
+  }
   ThreadRestrictions::AssertWaitAllowed();
   LockGuard l(lock_);
   return cmeta_->active_role();
 }
 
 int64_t RaftConsensus::CurrentTerm() const {
+  if (auto snapshot = PublishedCMetaSnapshot()) {
+    return snapshot->current_term;
+  }
   LockGuard l(lock_);
   return CurrentTermUnlocked();
 }
 
 string RaftConsensus::GetLeaderUuid() const {
+  if (auto snapshot = PublishedCMetaSnapshot()) {
+    return snapshot->leader_uuid;
+  }
   LockGuard l(lock_);
   return GetLeaderUuidUnlocked();
 }
 
 std::pair<string, unsigned int> RaftConsensus::GetLeaderHostPort() const
 {
+  if (auto snapshot = PublishedCMetaSnapshot()) {
+    return snapshot->leader_hostport;
+  }
   LockGuard l(lock_);
   return cmeta_->leader_hostport();
 }
@@ -3079,6 +4063,7 @@ void RaftConsensus::SetStateUnlocked(State new_state) {
       break;
     case kStopping:
       CHECK(state_ != kStopped && state_ != kShutdown) << "State = " << State_Name(state_);
+      leader_term_.store(kNoLeaderTerm, std::memory_order_release);
       break;
     case kStopped:
       CHECK_EQ(kStopping, state_);
@@ -3091,6 +4076,7 @@ void RaftConsensus::SetStateUnlocked(State new_state) {
       break;
   }
   state_ = new_state;
+  published_state_.store(new_state, std::memory_order_release);
 }
 
 const char* RaftConsensus::State_Name(State state) {
@@ -3219,21 +4205,40 @@ const string& RaftConsensus::tablet_id() const {
 
 Status RaftConsensus::ConsensusState(ConsensusStatePB* cstate,
                                      IncludeHealthReport report_health) const {
-  ThreadRestrictions::AssertWaitAllowed();
-  UniqueLock l(lock_);
-  if (state_ == kShutdown) {
-    return Status::IllegalState("Tablet replica is shutdown");
+  ConsensusStatePB cstate_tmp;
+  std::unordered_map<string, HealthReportPB> reports;
+  bool merge_reports;
+  auto snapshot = PublishedCMetaSnapshot();
+  State state = published_state_.load(std::memory_order_acquire);
+  if (snapshot && state != kInitialized) {
+    if (state == kShutdown) {
+      return Status::IllegalState("Tablet replica is shutdown");
+    }
+    // 'queue_' is set by Start() before the state becomes kRunning, and
+    // never replaced afterwards.
+    cstate_tmp = snapshot->cstate;
+    merge_reports = report_health == INCLUDE_HEALTH_REPORT &&
+                    snapshot->active_role == RaftPeerPB::LEADER;
+    if (merge_reports) {
+      reports = queue_->ReportHealthOfPeers();
+    }
+  } else {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    if (state_ == kShutdown) {
+      return Status::IllegalState("Tablet replica is shutdown");
+    }
+    cstate_tmp = cmeta_->ToConsensusStatePB();
+    merge_reports = report_health == INCLUDE_HEALTH_REPORT &&
+                    cmeta_->active_role() == RaftPeerPB::LEADER;
+    if (merge_reports) {
+      reports = queue_->ReportHealthOfPeers();
+    }
   }
-  ConsensusStatePB cstate_tmp = cmeta_->ToConsensusStatePB();
 
   // If we need to include the health report, merge it into the committed
   // config iff we believe we are the current leader of the config.
-  if (report_health == INCLUDE_HEALTH_REPORT &&
-      cmeta_->active_role() == RaftPeerPB::LEADER) {
-    auto reports = queue_->ReportHealthOfPeers();
-
-    // We don't need to access the queue anymore, so drop the consensus lock.
-    l.unlock();
+  if (merge_reports) {
 
     // Iterate through each peer in the committed config and attach the health
     // report to it.
@@ -3267,6 +4272,7 @@ Status RaftConsensus::PendingConfig(RaftConfigPB *pendingConfig) const {
 
 void RaftConsensus::DumpStatusHtml(std::ostream& out) const {
   RaftPeerPB::Role role;
+  string state_str;
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
@@ -3275,25 +4281,52 @@ void RaftConsensus::DumpStatusHtml(std::ostream& out) const {
       return;
     }
     role = cmeta_->active_role();
+    state_str = ToStringUnlocked();
   }
+  // The queue details are rendered from snapshots, so that the page doesn't
+  // hold up the write path while it's built.
+  const string queue_str = queue_->ToString();
 
   out << "<h1>Raft Consensus State</h1>" << std::endl;
 
   out << "<h2>State</h2>" << std::endl;
-  out << "<pre>" << EscapeForHtmlToString(ToString()) << "</pre>" << std::endl;
+  out << "<pre>" << EscapeForHtmlToString(state_str) << "</pre>" << std::endl;
   out << "<h2>Queue</h2>" << std::endl;
-  out << "<pre>" << EscapeForHtmlToString(queue_->ToString()) << "</pre>" << std::endl;
+  out << "<pre>" << EscapeForHtmlToString(queue_str) << "</pre>" << std::endl;
 
   // Dump the queues on a leader.
   if (role == RaftPeerPB::LEADER) {
-    out << "<h2>Queue overview</h2>" << std::endl;
-    out << "<pre>" << EscapeForHtmlToString(queue_->ToString()) << "</pre>" << std::endl;
     out << "<hr/>" << std::endl;
     out << "<h2>Queue details</h2>" << std::endl;
     queue_->DumpToHtml(out);
   }
 }
 
+void RaftConsensus::DumpStatusJson(JsonWriter* jw) const {
+  RaftPeerPB::Role role;
+  State state;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    state = state_;
+    role = cmeta_->active_role();
+  }
+  jw->StartObject();
+  jw->String("tablet_id");
+  jw->String(tablet_id());
+  jw->String("peer_uuid");
+  jw->String(peer_uuid());
+  jw->String("state");
+  jw->String(State_Name(state));
+  jw->String("role");
+  jw->String(RaftPeerPB::Role_Name(role));
+  if (state == kRunning) {
+    jw->String("queue");
+    queue_->DumpToJson(jw);
+  }
+  jw->EndObject();
+}
+
 void RaftConsensus::ElectionCallback(ElectionContext context, const ElectionResult& result) {
   // The election callback runs on a reactor thread, so we need to defer to our
   // threadpool. If the threadpool is already shut down for some reason, it's OK --
@@ -3314,6 +4347,10 @@ void RaftConsensus::DoElectionCallback(
   // The vote was granted, become leader.
   ThreadRestrictions::AssertWaitAllowed();
   UniqueLock lock(lock_);
+  std::shared_ptr<ElectionTimeline> timeline;
+  if (election_timeline_ && election_timeline_->term() == election_term) {
+    timeline = election_timeline_;
+  }
   Status s = CheckRunningUnlocked();
   if (PREDICT_FALSE(!s.ok())) {
     LOG_WITH_PREFIX_UNLOCKED(INFO) << "Received " << election_type << " callback for term "
@@ -3356,6 +4393,7 @@ void RaftConsensus::DoElectionCallback(
     if (result.highest_voter_term > CurrentTermUnlocked()) {
       HandleTermAdvanceUnlocked(result.highest_voter_term);
     }
+    FinishElectionTimelineUnlocked(timeline, Substitute("lost $0", election_type));
 
     LOG_WITH_PREFIX_UNLOCKED(INFO)
         << "Leader " << election_type << " lost for term " << election_term
@@ -3376,6 +4414,7 @@ void RaftConsensus::DoElectionCallback(
         << "Leader " << election_type << " decision vote started in "
         << "defunct term " << election_started_in_term << ": "
         << (result.decision == VOTE_GRANTED ? "won" : "lost");
+    FinishElectionTimelineUnlocked(timeline, "term moved on");
     return;
   }
 
@@ -3386,6 +4425,7 @@ void RaftConsensus::DoElectionCallback(
                                       << (result.decision == VOTE_GRANTED ? "won" : "lost")
                                       << ". RaftConfig: "
                                       << SecureShortDebugString(cmeta_->ActiveConfig());
+    FinishElectionTimelineUnlocked(timeline, "not a voter");
     return;
   }
 
@@ -3428,6 +4468,105 @@ void RaftConsensus::DoElectionCallback(
   }
 }
 
+namespace {
+
+// Converts a time from GetMonoTimeMicros() to a MonoTime.
+MonoTime MonoTimeFromMicros(int64_t mono_micros) {
+  return MonoTime::Now() - MonoDelta::FromMicroseconds(GetMonoTimeMicros() - mono_micros);
+}
+
+void IncrementIfInitialized(const scoped_refptr<Histogram>& histogram, const MonoDelta& delta) {
+  if (delta.Initialized()) {
+    histogram->Increment(delta.ToMicroseconds());
+  }
+}
+
+} // anonymous namespace
+
+std::shared_ptr<ElectionTimeline> RaftConsensus::BeginElectionTimelineUnlocked(
+    ElectionMode mode, const ElectionContext& context) {
+  DCHECK(lock_.is_locked());
+  // Both a pre-election and the election it leads to are for the next term.
+  const int64_t term = CurrentTermUnlocked() + 1;
+  if (mode != PRE_ELECTION && election_timeline_ && election_timeline_->term() == term &&
+      election_timeline_->phase_time(ElectionTimeline::PRE_ELECTION_DECIDED).Initialized()) {
+    election_timeline_->RecordPhase(ElectionTimeline::ELECTION_STARTED);
+    return election_timeline_;
+  }
+  FinishElectionTimelineUnlocked(election_timeline_, "superseded");
+
+  election_timeline_ = std::make_shared<ElectionTimeline>(
+      term, ReasonString(context.reason_, context.current_leader_uuid_));
+  if (context.reason_ == ELECTION_TIMEOUT_EXPIRED) {
+    const int64_t last_heard = last_leader_communication_time_micros_;
+    if (last_heard > 0) {
+      election_timeline_->RecordPhase(ElectionTimeline::LEADER_LAST_HEARD,
+                                      MonoTimeFromMicros(last_heard));
+    }
+    const int64_t detected = last_failure_detected_micros_.load(std::memory_order_relaxed);
+    if (detected > 0) {
+      election_timeline_->RecordPhase(ElectionTimeline::FAILURE_DETECTED,
+                                      MonoTimeFromMicros(detected));
+    }
+  }
+  election_timeline_->RecordPhase(mode == PRE_ELECTION ?
+                                  ElectionTimeline::PRE_ELECTION_STARTED :
+                                  ElectionTimeline::ELECTION_STARTED);
+  return election_timeline_;
+}
+
+void RaftConsensus::FinishElectionTimelineUnlocked(
+    const std::shared_ptr<ElectionTimeline>& timeline, const string& outcome) {
+  DCHECK(lock_.is_locked());
+  if (!timeline || !timeline->Finish(outcome)) {
+    return;
+  }
+  IncrementIfInitialized(failure_detection_latency_, timeline->Between(
+      ElectionTimeline::LEADER_LAST_HEARD, ElectionTimeline::FAILURE_DETECTED));
+  IncrementIfInitialized(pre_election_latency_, timeline->Between(
+      ElectionTimeline::PRE_ELECTION_STARTED, ElectionTimeline::PRE_ELECTION_DECIDED));
+  IncrementIfInitialized(election_vote_flush_latency_, timeline->Between(
+      ElectionTimeline::ELECTION_STARTED, ElectionTimeline::VOTE_FLUSHED));
+  IncrementIfInitialized(election_latency_, timeline->Between(
+      ElectionTimeline::ELECTION_STARTED, ElectionTimeline::ELECTION_DECIDED));
+  IncrementIfInitialized(leader_noop_commit_latency_, timeline->Between(
+      ElectionTimeline::BECAME_LEADER, ElectionTimeline::NOOP_COMMITTED));
+  if (outcome == "won") {
+    IncrementIfInitialized(failover_latency_, timeline->TimeTo(
+        disable_noop_ ? ElectionTimeline::BECAME_LEADER : ElectionTimeline::NOOP_COMMITTED));
+  }
+  LOG_WITH_PREFIX_UNLOCKED(INFO) << "Election timeline: " << timeline->ToString();
+
+  if (election_timeline_ == timeline) {
+    election_timeline_.reset();
+  }
+  past_election_timelines_.push_front(timeline);
+  while (past_election_timelines_.size() >
+         static_cast<size_t>(std::max(FLAGS_raft_election_timeline_history, 0))) {
+    past_election_timelines_.pop_back();
+  }
+  if (vote_logger_) {
+    vote_logger_->logElectionTimeline(*timeline);
+  }
+}
+
+void RaftConsensus::WriteElectionTimelinesAsJson(JsonWriter* jw) const {
+  vector<std::shared_ptr<ElectionTimeline>> timelines;
+  {
+    LockGuard l(lock_);
+    if (election_timeline_) {
+      timelines.push_back(election_timeline_);
+    }
+    timelines.insert(timelines.end(), past_election_timelines_.begin(),
+                     past_election_timelines_.end());
+  }
+  jw->StartArray();
+  for (const auto& timeline : timelines) {
+    timeline->WriteAsJson(jw);
+  }
+  jw->EndArray();
+}
+
 void RaftConsensus::NestedElectionDecisionCallback(
     ElectionContext context, const ElectionResult& result) {
   DoElectionCallback(context, result);
@@ -3443,6 +4582,21 @@ boost::optional<OpId> RaftConsensus::GetNextOpId() const {
 }
 
 boost::optional<OpId> RaftConsensus::GetLastOpId(OpIdType type) {
+  if (FLAGS_raft_lockless_state_reads) {
+    // 'queue_' and 'pending_' are set by Start() before the state becomes
+    // kRunning, and never replaced afterwards.
+    State state = published_state_.load(std::memory_order_acquire);
+    if (state != kNew && state != kInitialized) {
+      switch (type) {
+        case RECEIVED_OPID:
+          return queue_->GetLastOpIdInLog();
+        case COMMITTED_OPID:
+          return pending_->GetPublishedLastCommittedOpId();
+        default:
+          break;
+      }
+    }
+  }
   ThreadRestrictions::AssertWaitAllowed();
   LockGuard l(lock_);
   return GetLastOpIdUnlocked(type);
@@ -3470,9 +4624,20 @@ log::RetentionIndexes RaftConsensus::GetRetentionIndexes() {
   // separately -- the worst case is we see a relatively "out of date" watermark
   // which just means we'll retain slightly more than necessary in this invocation
   // of log GC.
-  return log::RetentionIndexes(queue_->GetCommittedIndex(), // for durability
-                               queue_->GetAllReplicatedIndex(), // for peers
-                               queue_->GetRegionDurableIndex()); // for region based durability
+  log::RetentionIndexes indexes(queue_->GetCommittedIndex(), // for durability
+                                queue_->GetAllReplicatedIndex(), // for peers
+                                queue_->GetRegionDurableIndex()); // for region based durability
+
+  // The queue learns of the snapshot before the log is GCed below it, so that
+  // a peer which then misses those ops is sent the snapshot and not failed.
+  int64_t snapshot_index = FLAGS_raft_gc_below_snapshot_index ?
+      round_handler_->GetDurablyAppliedIndex() : -1;
+  queue_->SetSnapshotIndex(snapshot_index);
+  if (snapshot_index >= 0) {
+    indexes.for_peers = std::max(indexes.for_peers,
+                                 std::min(snapshot_index + 1, indexes.for_durability));
+  }
+  return indexes;
 }
 
 void RaftConsensus::MarkDirty(const std::string& reason) {
@@ -3501,6 +4666,12 @@ void RaftConsensus::NonTxRoundReplicationFinished(ConsensusRound* round,
 
   if (op_type == CHANGE_CONFIG_OP) {
     CompleteConfigChangeRoundUnlocked(round, status);
+    // Now that the config change is over, the queued ones may go ahead.
+    if (!queued_config_changes_.empty()) {
+      WARN_NOT_OK(raft_pool_token_->SubmitFunc(std::bind(
+                      &RaftConsensus::ReplicateQueuedConfigChangesTask, shared_from_this())),
+                  LogPrefixUnlocked() + "Unable to start ReplicateQueuedConfigChangesTask");
+    }
     // Fall through to the generic handling.
   }
 
@@ -3612,8 +4783,9 @@ void RaftConsensus::CompleteConfigChangeRoundUnlocked(ConsensusRound* round, con
 
 void RaftConsensus::SetAllowStartElection(bool val) {
   if (PREDICT_FALSE(persistent_vars_->is_start_election_allowed() != val)) {
-    persistent_vars_->set_allow_start_election(val);
-    CHECK_OK(persistent_vars_->Flush());
+    CHECK_OK(UpdatePersistentVars([val](PersistentVars::Batch* batch) {
+      batch->set_allow_start_election(val);
+    }));
   }
 }
 
@@ -3645,6 +4817,30 @@ bool RaftConsensus::ShouldEnforceRaftRpcToken() const {
   return FLAGS_raft_enforce_rpc_token;
 }
 
+Status RaftConsensus::UpdatePersistentVars(
+    const std::function<void(PersistentVars::Batch*)>& update) {
+  LockGuard guard(lock_);
+
+  PersistentVars::Batch batch = persistent_vars_->StartBatch();
+  update(&batch);
+  if (batch.changes_raft_rpc_token() && ShouldEnforceRaftRpcToken()) {
+    return Status::IllegalState("Raft RPC token cannot be changed when "
+                                "we're enforcing token matches");
+  }
+  const bool changes_compression_dictionary = batch.changes_compression_dictionary();
+  RETURN_NOT_OK_PREPEND(persistent_vars_->CommitBatch(std::move(batch)),
+                        "Unable to write persistent vars");
+  if (changes_compression_dictionary && queue_) {
+    auto dictionary = persistent_vars_->compression_dictionary();
+    RETURN_NOT_OK_PREPEND(
+        queue_->log_cache()->SetCompressionDictionary(dictionary ? *dictionary : ""),
+        "Unable to set the compression dictionary");
+  }
+
+  LOG_WITH_PREFIX_UNLOCKED(INFO) << "Persistent vars have been updated";
+  return Status::OK();
+}
+
 void RaftConsensus::EnableFailureDetector(boost::optional<MonoDelta> delta) {
   if (PREDICT_TRUE(FLAGS_enable_leader_failure_detection)) {
     failure_detector_last_snoozed_ = std::chrono::system_clock::now();
@@ -3704,6 +4900,141 @@ void RaftConsensus::SnoozeFailureDetector(boost::optional<string> reason_for_log
   }
 }
 
+bool RaftConsensus::HasValidLease() const {
+  if (!FLAGS_raft_enable_leader_leases) {
+    return false;
+  }
+  if (leader_term_.load(std::memory_order_acquire) == kNoLeaderTerm ||
+      leader_transfer_in_progress_.Load()) {
+    return false;
+  }
+  // Until an op of our own term commits, our committed index may trail that
+  // of the previous leader.
+  if (!queue_->IsCommittedIndexInCurrentTerm()) {
+    return false;
+  }
+  MonoTime lease_start = queue_->GetMajorityAckedSendTime();
+  if (!lease_start.Initialized()) {
+    return false;
+  }
+  double drift = std::min(std::max(FLAGS_raft_leader_lease_clock_drift, 0.0), 1.0);
+  MonoDelta lease = MonoDelta::FromNanoseconds(static_cast<int64_t>(
+      MinimumElectionTimeout().ToNanoseconds() * (1.0 - drift)));
+  return MonoTime::Now() < lease_start + lease;
+}
+
+Status RaftConsensus::GetReadIndex(MonoTime deadline, int64_t* read_index) {
+  TRACE_EVENT0("consensus", "RaftConsensus::GetReadIndex");
+  const MonoTime start = MonoTime::Now();
+  const MonoDelta poll_period = MonoDelta::FromMilliseconds(1);
+  int64_t term;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    RETURN_NOT_OK(CheckRunningUnlocked());
+    RETURN_NOT_OK(CheckActiveLeaderUnlocked());
+    term = CurrentTermUnlocked();
+  }
+
+  bool have_index = false;
+  while (true) {
+    if (leader_term_.load(std::memory_order_acquire) != term) {
+      return Status::IllegalState("lost leadership while getting a read index");
+    }
+    // Until an op of its own term commits, the leader may not yet know of
+    // everything its predecessors committed.
+    if (!have_index && queue_->IsCommittedIndexInCurrentTerm()) {
+      *read_index = queue_->GetCommittedIndex();
+      have_index = true;
+    }
+    if (have_index) {
+      if (HasValidLease()) {
+        return Status::OK();
+      }
+      MonoTime acked = queue_->GetMajorityAckedSendTime();
+      if (acked.Initialized() && acked >= start) {
+        return Status::OK();
+      }
+    }
+
+    bool signal = false;
+    MonoTime now = MonoTime::Now();
+    {
+      std::lock_guard<simple_spinlock> l(read_index_lock_);
+      if (!read_index_last_signal_.Initialized() ||
+          now - read_index_last_signal_ >= poll_period) {
+        read_index_last_signal_ = now;
+        signal = true;
+      }
+    }
+    if (signal) {
+      peer_manager_->SignalRequest(true);
+    }
+    if (now >= deadline) {
+      return Status::TimedOut("timed out confirming leadership for a read index");
+    }
+    SleepFor(poll_period);
+  }
+}
+
+Status RaftConsensus::WaitForReadIndex(MonoTime deadline, int64_t* read_index) {
+  TRACE_EVENT0("consensus", "RaftConsensus::WaitForReadIndex");
+  RaftPeerPB leader_pb;
+  bool is_leader;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    RETURN_NOT_OK(CheckRunningUnlocked());
+    is_leader = cmeta_->active_role() == RaftPeerPB::LEADER;
+    if (!is_leader) {
+      if (cmeta_->leader_uuid().empty()) {
+        return Status::ServiceUnavailable("no known leader to get a read index from");
+      }
+      RETURN_NOT_OK(cmeta_->GetConfigMemberCopy(cmeta_->leader_uuid(), &leader_pb));
+    }
+  }
+
+  if (is_leader) {
+    RETURN_NOT_OK(GetReadIndex(deadline, read_index));
+  } else {
+    shared_ptr<PeerProxy> proxy;
+    RETURN_NOT_OK(peer_proxy_factory_->NewProxy(leader_pb, &proxy));
+    ReadIndexRequestPB req;
+    req.set_dest_uuid(leader_pb.permanent_uuid());
+    req.set_tablet_id(options_.tablet_id);
+    ReadIndexResponsePB resp;
+    rpc::RpcController controller;
+    if (deadline == MonoTime::Max()) {
+      controller.set_timeout(MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+    } else {
+      controller.set_deadline(deadline);
+    }
+    RETURN_NOT_OK_PREPEND(proxy->ReadIndex(&req, &resp, &controller),
+                          "could not get a read index from the leader");
+    if (resp.has_error()) {
+      return StatusFromPB(resp.error().status());
+    }
+    *read_index = resp.read_index();
+  }
+
+  // The read index is committed; wait for it to have been handed to the
+  // round handler here too.
+  while (true) {
+    {
+      ThreadRestrictions::AssertWaitAllowed();
+      LockGuard l(lock_);
+      if (pending_->GetCommittedIndex() >= *read_index) {
+        return Status::OK();
+      }
+    }
+    if (MonoTime::Now() >= deadline) {
+      return Status::TimedOut(Substitute("timed out waiting to commit read index $0",
+                                         *read_index));
+    }
+    SleepFor(MonoDelta::FromMilliseconds(1));
+  }
+}
+
 MonoDelta RaftConsensus::MinimumElectionTimeout() const {
   int32_t failure_timeout = FLAGS_leader_failure_max_missed_heartbeat_periods *
       FLAGS_raft_heartbeat_interval_ms;
@@ -3724,6 +5055,64 @@ MonoDelta RaftConsensus::MinimumElectionTimeoutWithBan() {
   return MonoDelta::FromMilliseconds(failure_timeout);
 }
 
+MonoDelta RaftConsensus::LeaderFailureTimeoutUnlocked(const string& leader_uuid) {
+  DCHECK(lock_.is_locked());
+  // A banned instance keeps snoozing for longer, to let the others win.
+  if (!FLAGS_raft_phi_failure_detection ||
+      fabs(FLAGS_snooze_for_leader_ban_ratio - 1.0) >= 0.001) {
+    leader_arrivals_.reset();
+    return MinimumElectionTimeoutWithBan();
+  }
+
+  static const int kWindowSize = 100;
+  static const int kMinSamples = 10;
+  if (!leader_arrivals_ || leader_arrivals_uuid_ != leader_uuid) {
+    leader_arrivals_.reset(new PhiAccrualDetector(
+        kWindowSize, MonoDelta::FromMilliseconds(FLAGS_raft_phi_min_stddev_ms)));
+    leader_arrivals_uuid_ = leader_uuid;
+  }
+  // The leader sends at least a heartbeat per period, so the time to the
+  // next request is at most that, plus however late the network is.
+  leader_arrivals_->set_min_interval(MonoDelta::FromMilliseconds(FLAGS_raft_heartbeat_interval_ms));
+  leader_arrivals_->set_min_stddev(MonoDelta::FromMilliseconds(FLAGS_raft_phi_min_stddev_ms));
+  leader_arrivals_->Heartbeat(MonoTime::Now());
+  if (leader_arrivals_->num_samples() < kMinSamples) {
+    return MinimumElectionTimeoutWithBan();
+  }
+
+  bool is_voter;
+  string leader_region;
+  GetRaftConfigMemberRegion(leader_uuid, cmeta_->ActiveConfig(), &is_voter, &leader_region);
+  double timeout_ms =
+      leader_arrivals_->TimeToPhi(PhiSuspicionThreshold(leader_region)).ToMilliseconds();
+
+  // Never suspect the leader before its next heartbeat is due, nor, with
+  // leases, before its lease may have run out.
+  double min_timeout_ms = FLAGS_raft_enable_leader_leases
+      ? MinimumElectionTimeout().ToMilliseconds() : FLAGS_raft_heartbeat_interval_ms;
+  timeout_ms = std::min<double>(std::max(timeout_ms, min_timeout_ms),
+                                FLAGS_leader_failure_exp_backoff_max_delta_ms);
+
+  // Randomize like TimeoutBackoffHelper(), so that the followers don't all
+  // start elections at once.
+  timeout_ms *= 1.0 + 0.5 * rng_.NextDoubleFraction();
+  return MonoDelta::FromMilliseconds(static_cast<int64_t>(timeout_ms));
+}
+
+double RaftConsensus::PhiSuspicionThreshold(const string& leader_region) {
+  const string by_region = FLAGS_raft_phi_suspicion_thresholds_by_region;
+  if (!leader_region.empty() && !by_region.empty()) {
+    for (StringPiece entry : strings::Split(by_region, ",", strings::SkipEmpty())) {
+      vector<string> kv = strings::Split(entry, ":");
+      double phi;
+      if (kv.size() == 2 && kv[0] == leader_region && safe_strtod(kv[1], &phi) && phi > 0) {
+        return phi;
+      }
+    }
+  }
+  return FLAGS_raft_phi_suspicion_threshold;
+}
+
 MonoDelta RaftConsensus::LeaderElectionExpBackoffNotInConfig() {
   DCHECK(lock_.is_locked());
   // Compute a backoff factor based on how many leader elections have
@@ -4132,7 +5521,7 @@ Status RaftConsensus::SetCurrentTermBootstrap(int64_t new_term) {
                    "Current: $0, Proposed: $1", CurrentTermUnlocked(), new_term));
   }
   cmeta_->set_current_term(new_term);
-  CHECK_OK(cmeta_->Flush());
+  CHECK_OK(PersistTermVoteUnlocked());
   if (vote_logger_) {
     vote_logger_->advanceEpoch(new_term);
   }
@@ -4152,7 +5541,7 @@ Status RaftConsensus::SetCurrentTermUnlocked(int64_t new_term,
   cmeta_->set_current_term(new_term);
   cmeta_->clear_voted_for();
   if (flush == FLUSH_TO_DISK) {
-    CHECK_OK(cmeta_->Flush());
+    CHECK_OK(PersistTermVoteUnlocked());
   }
 
   ClearLeaderUnlocked();
@@ -4183,6 +5572,7 @@ bool RaftConsensus::HasLeaderUnlocked() const {
 
 void RaftConsensus::ClearLeaderUnlocked() {
   DCHECK(lock_.is_locked());
+  leader_term_.store(kNoLeaderTerm, std::memory_order_release);
   cmeta_->set_leader_uuid("");
 }
 
@@ -4196,10 +5586,63 @@ Status RaftConsensus::SetVotedForCurrentTermUnlocked(const std::string& uuid) {
                "uuid", uuid);
   DCHECK(lock_.is_locked());
   cmeta_->set_voted_for(uuid);
-  CHECK_OK(cmeta_->Flush());
+  CHECK_OK(PersistTermVoteUnlocked());
   return Status::OK();
 }
 
+Status RaftConsensus::PersistTermVoteUnlocked() {
+  DCHECK(lock_.is_locked());
+  // Before Start() there is no log to append to, e.g. when the term is
+  // bumped at bootstrap.
+  if (!term_vote_in_wal_ || !log_) {
+    return cmeta_->Flush();
+  }
+
+  log::TermVotePB term_vote;
+  term_vote.set_current_term(cmeta_->current_term());
+  if (cmeta_->has_voted_for()) {
+    term_vote.set_voted_for(cmeta_->voted_for());
+  }
+  Synchronizer s;
+  RETURN_NOT_OK(log_->AsyncAppendTermVote(term_vote, s.AsStatusCallback()));
+  RETURN_NOT_OK(s.Wait());
+
+  // The log record is what makes the change durable; the consensus metadata
+  // only needs to catch up before the log segment holding the record could be
+  // dropped, which GC guards against by carrying the record forward.
+  if (++term_vote_records_since_checkpoint_ >=
+      FLAGS_raft_term_vote_checkpoint_interval) {
+    RETURN_NOT_OK(cmeta_->Flush());
+    term_vote_records_since_checkpoint_ = 0;
+  }
+  return Status::OK();
+}
+
+Status RaftConsensus::RecoverTermVoteFromLog() {
+  LockGuard l(lock_);
+  log::TermVotePB term_vote;
+  bool found = false;
+  RETURN_NOT_OK(log_->ReadLastTermVote(&term_vote, &found));
+  if (!found) return Status::OK();
+
+  int64_t cmeta_term = cmeta_->current_term();
+  bool newer_term = term_vote.current_term() > cmeta_term;
+  bool newer_vote = term_vote.current_term() == cmeta_term &&
+                    !cmeta_->has_voted_for() && term_vote.has_voted_for();
+  if (!newer_term && !newer_vote) return Status::OK();
+
+  LOG_WITH_PREFIX_UNLOCKED(INFO) << "Recovering term and vote from the log: "
+                                 << SecureShortDebugString(term_vote)
+                                 << " (consensus metadata term: " << cmeta_term << ")";
+  cmeta_->set_current_term(term_vote.current_term());
+  if (term_vote.has_voted_for()) {
+    cmeta_->set_voted_for(term_vote.voted_for());
+  } else {
+    cmeta_->clear_voted_for();
+  }
+  return cmeta_->Flush();
+}
+
 const std::string& RaftConsensus::GetVotedForCurrentTermUnlocked() const {
   DCHECK(lock_.is_locked());
   DCHECK(cmeta_->has_voted_for());
@@ -4212,20 +5655,36 @@ const ConsensusOptions& RaftConsensus::GetOptions() const {
 
 string RaftConsensus::LogPrefix() const {
   ThreadRestrictions::AssertWaitAllowed();
-  LockGuard l(lock_);
+  // Don't make logging threads wait for 'lock_': if another thread holds it,
+  // use the last prefix built, which is at worst a term or role behind.
+  UniqueLock l(lock_, std::try_to_lock);
+  if (!l.owns_lock()) {
+    shared_ptr<const string> prefix = std::atomic_load(&log_prefix_);
+    if (prefix) {
+      return *prefix;
+    }
+    l.lock();
+  }
   return LogPrefixUnlocked();
 }
 
 string RaftConsensus::LogPrefixUnlocked() const {
   DCHECK(lock_.is_locked());
   // 'cmeta_' may not be set if initialization failed.
-  string cmeta_info;
-  if (cmeta_) {
-    cmeta_info = Substitute(" [term $0 $1]",
-                            cmeta_->current_term(),
-                            RaftPeerPB::Role_Name(cmeta_->active_role()));
+  if (!cmeta_) {
+    return Substitute("T $0 P $1: ", options_.tablet_id, peer_uuid());
+  }
+  // Only rebuild the prefix when the term or role changed.
+  const int64_t term = cmeta_->current_term();
+  const RaftPeerPB::Role role = cmeta_->active_role();
+  if (!log_prefix_ || term != log_prefix_term_ || role != log_prefix_role_) {
+    std::atomic_store(&log_prefix_, shared_ptr<const string>(std::make_shared<string>(
+        Substitute("T $0 P $1 [term $2 $3]: ", options_.tablet_id, peer_uuid(),
+                   term, RaftPeerPB::Role_Name(role)))));
+    log_prefix_term_ = term;
+    log_prefix_role_ = role;
   }
-  return Substitute("T $0 P $1$2: ", options_.tablet_id, peer_uuid(), cmeta_info);
+  return *log_prefix_;
 }
 
 string RaftConsensus::LogPrefixThreadSafe() const {
@@ -4259,6 +5718,26 @@ int64_t RaftConsensus::GetMillisSinceLastLeaderHeartbeat() const {
         0 : (GetMonoTimeMicros() - last_leader_communication_time_micros_) / 1000;
 }
 
+int64_t RaftConsensus::TimeLagMicros(uint64_t timestamp) {
+  // Ops which no clock stamped, such as those of a dummy time manager, have no lag.
+  if (timestamp == 0) {
+    return -1;
+  }
+  int64_t stamped_us = clock::HybridClock::GetPhysicalValueMicros(Timestamp(timestamp));
+  return std::max<int64_t>(0, GetCurrentTimeMicros() - stamped_us);
+}
+
+bool RaftConsensus::GetTimeLag(int64_t* append_lag_us, int64_t* commit_lag_us) const {
+  *append_lag_us = append_time_lag_us_;
+  *commit_lag_us = commit_time_lag_us_;
+  return *append_lag_us >= 0 || *commit_lag_us >= 0;
+}
+
+int64_t RaftConsensus::GetCommitTimeLagMillis() const {
+  int64_t lag_us = commit_time_lag_us_;
+  return lag_us < 0 ? 0 : lag_us / 1000;
+}
+
 void RaftConsensus::SetElectionDecisionCallback(ElectionDecisionCallback edcb) {
   CHECK(edcb);
   edcb_ = std::move(edcb);
@@ -4317,6 +5796,45 @@ static void SetupErrorAndRespond(const Status& s,
     } \
   } while (0)
 
+struct RaftConsensus::ProxyFanoutRequest {
+  ~ProxyFanoutRequest() {
+    // The reconstituted ops belong to 'messages'.
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+    downstream_request.mutable_ops()->UnsafeArenaExtractSubrange(
+        /*start=*/ 0, /*num=*/ downstream_request.ops_size(), /*elements=*/ nullptr);
+#else
+    downstream_request.mutable_ops()->ExtractSubrange(
+        /*start=*/ 0, /*num=*/ downstream_request.ops_size(), /*elements=*/ nullptr);
+#endif
+  }
+
+  // The proxied request, owned by 'context' until it is responded to.
+  const ConsensusRequestPB* request = nullptr;
+  ConsensusResponsePB* response = nullptr;
+  rpc::RpcContext* context = nullptr;
+
+  // Snapshot of the active config, to find the downstream peer in.
+  RaftConfigPB active_config;
+  std::string next_uuid;
+  std::string dest_host;
+  uint32_t dest_port = 0;
+
+  int64_t first_op_index = -1;
+  int64_t max_batch_size = 0;
+
+  // Set by whichever of the append waiter and the timeout goes first, which
+  // is the one to continue the request.
+  std::atomic<bool> claimed { false };
+
+  std::vector<ReplicateRefPtr> messages;
+  ConsensusRequestPB downstream_request;
+  ConsensusResponsePB downstream_response;
+  rpc::RpcController controller;
+  shared_ptr<PeerProxy> next_proxy;
+  // When 'downstream_request' was sent.
+  MonoTime downstream_sent;
+};
+
 void RaftConsensus::HandleProxyRequest(const ConsensusRequestPB* request,
                                        ConsensusResponsePB* response,
                                        rpc::RpcContext* context) {
@@ -4335,6 +5853,7 @@ void RaftConsensus::HandleProxyRequest(const ConsensusRequestPB* request,
   }
 
   raft_proxy_num_requests_received_->Increment();
+  raft_proxy_batch_size_->Increment(request->ops_size());
 
   // Initial implementation:
   //
@@ -4417,6 +5936,11 @@ void RaftConsensus::HandleProxyRequest(const ConsensusRequestPB* request,
   if (request->has_raft_rpc_token()){
     downstream_request.set_raft_rpc_token(request->raft_rpc_token());
   }
+  if (request->has_trace_context()) {
+    *downstream_request.mutable_trace_context() = request->trace_context();
+    downstream_request.mutable_trace_context()->set_hop_count(
+        request->trace_context().hop_count() + 1);
+  }
 
   downstream_request.set_proxy_caller_uuid(peer_uuid());
 
@@ -4485,7 +6009,25 @@ void RaftConsensus::HandleProxyRequest(const ConsensusRequestPB* request,
     }
 
     // Now we know that all ops we are reconstituting are consecutive.
-    //
+    if (FLAGS_raft_proxy_async_fanout && request->ops_size() > 0 &&
+        peer_proxy_factory_->messenger()) {
+      auto state = std::make_shared<ProxyFanoutRequest>();
+      state->request = request;
+      state->response = response;
+      state->context = context;
+      state->downstream_request.Swap(&downstream_request);
+      state->active_config = std::move(active_config);
+      state->next_uuid = std::move(next_uuid);
+      if (s.ok()) {
+        state->dest_host = peer_to_send.peer_pb.last_known_addr().host();
+        state->dest_port = peer_to_send.peer_pb.last_known_addr().port();
+      }
+      state->first_op_index = first_op_index;
+      state->max_batch_size = max_batch_size;
+      StartProxyFanout(std::move(state));
+      return;
+    }
+
     // Block until the required op is available in local log. This might timeout
     // based on FLAGS_raft_log_cache_proxy_wait_time_ms in which case we return
     // an error
@@ -4509,27 +6051,7 @@ void RaftConsensus::HandleProxyRequest(const ConsensusRequestPB* request,
 
     // Reconstitute the proxied ops. We silently tolerate proxying a subset of
     // the requested batch.
-    for (int i = 0; i < request->ops_size() && i < messages.size(); i++) {
-      // Ensure that the OpIds match. We don't expect a mismatch to ever
-      // happen, so we log an error locally before reponding to the caller.
-      if (!OpIdEquals(request->ops(i).id(), messages[i]->get()->id())) {
-        string extra_info;
-        if (i > 0) {
-          extra_info = Substitute(" (previously received OpId: $0)",
-                                  OpIdToString(messages[i-1]->get()->id()));
-        }
-        Status s = Status::IllegalState(Substitute(
-            "log cache returned non-consecutive OpId index for message $0 in request: "
-            "requested $1, received $2$3",
-            i,
-            OpIdToString(request->ops(i).id()),
-            OpIdToString(messages[i]->get()->id()),
-            extra_info));
-        LOG_WITH_PREFIX(ERROR) << s.ToString();
-        RET_RESPOND_ERROR_NOT_OK(s);
-      }
-      downstream_request.mutable_ops()->AddAllocated(messages[i]->get());
-    }
+    RET_RESPOND_ERROR_NOT_OK(ReconstituteProxiedOps(*request, messages, &downstream_request));
   }
 
   VLOG_WITH_PREFIX(3) << "Downstream proxy request: " << SecureShortDebugString(downstream_request);
@@ -4566,13 +6088,53 @@ void RaftConsensus::HandleProxyRequest(const ConsensusRequestPB* request,
   // TODO(mpercy): Use an async approach instead.
   CountDownLatch latch(/*count=*/1);
   rpc::ResponseCallback callback = [&latch] { latch.CountDown(); };
+  const MonoTime downstream_sent = MonoTime::Now();
   next_proxy->UpdateAsync(&downstream_request, &downstream_response, &controller, callback);
   latch.Wait();
+  RespondToProxyRequest(*request, controller, downstream_response, downstream_sent,
+                        *next_peer_pb, degraded_to_heartbeat, response, context);
+}
+
+Status RaftConsensus::ReconstituteProxiedOps(const ConsensusRequestPB& request,
+                                              const vector<ReplicateRefPtr>& messages,
+                                              ConsensusRequestPB* downstream_request) {
+  for (int i = 0; i < request.ops_size() && i < messages.size(); i++) {
+    // Ensure that the OpIds match. We don't expect a mismatch to ever
+    // happen, so we log an error locally before reponding to the caller.
+    if (!OpIdEquals(request.ops(i).id(), messages[i]->get()->id())) {
+      string extra_info;
+      if (i > 0) {
+        extra_info = Substitute(" (previously received OpId: $0)",
+                                OpIdToString(messages[i-1]->get()->id()));
+      }
+      Status s = Status::IllegalState(Substitute(
+          "log cache returned non-consecutive OpId index for message $0 in request: "
+          "requested $1, received $2$3",
+          i,
+          OpIdToString(request.ops(i).id()),
+          OpIdToString(messages[i]->get()->id()),
+          extra_info));
+      LOG_WITH_PREFIX(ERROR) << s.ToString();
+      return s;
+    }
+    downstream_request->mutable_ops()->UnsafeArenaAddAllocated(messages[i]->get());
+  }
+  return Status::OK();
+}
+
+void RaftConsensus::RespondToProxyRequest(const ConsensusRequestPB& request,
+                                          const rpc::RpcController& controller,
+                                          const ConsensusResponsePB& downstream_response,
+                                          MonoTime downstream_sent,
+                                          const RaftPeerPB& next_peer_pb,
+                                          bool degraded_to_heartbeat,
+                                          ConsensusResponsePB* response,
+                                          rpc::RpcContext* context) {
   if (PREDICT_FALSE(!controller.status().ok())) {
     RET_RESPOND_ERROR_NOT_OK(controller.status().CloneAndPrepend(
         Substitute("Error proxying request from $0 to $1",
                    SecureShortDebugString(local_peer_pb_),
-                   SecureShortDebugString(*next_peer_pb))));
+                   SecureShortDebugString(next_peer_pb))));
   }
 
   // Proxy the response back to the caller.
@@ -4592,10 +6154,157 @@ void RaftConsensus::HandleProxyRequest(const ConsensusRequestPB* request,
   if (!degraded_to_heartbeat) {
     raft_proxy_num_requests_success_->Increment();
   }
+  const MonoTime now = MonoTime::Now();
+  const int64_t latency_us = (now - context->GetTimeReceived()).ToMicroseconds();
+  raft_proxy_hop_latency_->Increment(latency_us);
+  if (request.has_trace_context()) {
+    RecordTracedProxyHop(request, downstream_response, latency_us,
+                         (now - downstream_sent).ToMicroseconds(), response);
+  }
 
   context->RespondSuccess();
 }
 
+void RaftConsensus::RecordTracedProxyHop(const ConsensusRequestPB& request,
+                                         const ConsensusResponsePB& downstream_response,
+                                         int64_t latency_us,
+                                         int64_t downstream_us,
+                                         ConsensusResponsePB* response) {
+  const ProxyTraceContextPB& trace = request.trace_context();
+  const int hop = trace.hop_count() + 1;
+  *response->mutable_trace_context() = trace;
+  *response->mutable_proxy_hops() = downstream_response.proxy_hops();
+  ProxyHopLatencyPB* own = response->add_proxy_hops();
+  own->set_proxy_uuid(peer_uuid());
+  own->set_hop(hop);
+  own->set_latency_us(latency_us);
+  own->set_downstream_us(downstream_us);
+
+  const int64_t own_us = std::max<int64_t>(0, latency_us - downstream_us);
+  const int position = std::min<int>(std::max(hop, 1), arraysize(raft_proxy_traced_hop_latency_));
+  raft_proxy_traced_hop_latency_[position - 1]->Increment(own_us);
+  const int32_t slow_ms = FLAGS_raft_proxy_trace_slow_request_ms;
+  if (slow_ms > 0 && own_us >= slow_ms * 1000LL) {
+    KLOG_EVERY_N_SECS(INFO, 1) << LogPrefixThreadSafe()
+                               << Substitute("Slow proxy hop $0 of request $1 to $2: took "
+                                             "$3 us, $4 us of which waiting for the next hop",
+                                             hop, trace.request_id(), request.dest_uuid(),
+                                             latency_us, downstream_us)
+                               << THROTTLE_MSG;
+  }
+}
+
+void RaftConsensus::StartProxyFanout(shared_ptr<ProxyFanoutRequest> state) {
+  auto self = shared_from_this();
+  auto continue_on_pool = [self, state](bool timed_out) {
+    Status s = self->raft_pool_token_->SubmitFunc([self, state, timed_out]() {
+      self->ContinueProxyRequest(state, timed_out);
+    });
+    if (PREDICT_FALSE(!s.ok())) {
+      SetupErrorAndRespond(s.CloneAndPrepend("unable to continue proxy request"),
+                           ServerErrorPB::UNKNOWN_ERROR, state->response, state->context);
+    }
+  };
+
+  uint64_t waiter_id = queue_->log_cache()->AddAppendWaiter(
+      state->first_op_index - 1, [state, continue_on_pool]() {
+        if (!state->claimed.exchange(true)) {
+          continue_on_pool(/*timed_out=*/false);
+        }
+      });
+  if (waiter_id == 0) {
+    // The ops are already in the log cache.
+    state->claimed = true;
+    ContinueProxyRequest(state, /*timed_out=*/false);
+    return;
+  }
+
+  peer_proxy_factory_->messenger()->ScheduleOnReactor(
+      [self, state, waiter_id, continue_on_pool](const Status& /*s*/) {
+        if (!state->claimed.exchange(true)) {
+          self->queue_->log_cache()->CancelAppendWaiter(waiter_id);
+          continue_on_pool(/*timed_out=*/true);
+        }
+      },
+      MonoDelta::FromMilliseconds(FLAGS_raft_log_cache_proxy_wait_time_ms));
+}
+
+void RaftConsensus::ContinueProxyRequest(const shared_ptr<ProxyFanoutRequest>& state,
+                                         bool timed_out) {
+  const ConsensusRequestPB* request = state->request;
+  ConsensusResponsePB* response = state->response;
+  rpc::RpcContext* context = state->context;
+
+  bool degraded_to_heartbeat = timed_out;
+  if (!timed_out) {
+    ReadContext read_context;
+    read_context.for_peer_uuid = &request->dest_uuid();
+    if (!state->dest_host.empty()) {
+      read_context.for_peer_host = &state->dest_host;
+      read_context.for_peer_port = state->dest_port;
+    }
+    OpId preceding_id;
+    // As with BlockingReadOps(), a failed read degrades the request to a
+    // heartbeat.
+    WARN_NOT_OK(queue_->log_cache()->ReadOps(state->first_op_index - 1,
+                                             state->max_batch_size,
+                                             read_context,
+                                             &state->messages,
+                                             &preceding_id),
+                LogPrefixThreadSafe() + "Unable to read proxied ops");
+    degraded_to_heartbeat = state->messages.empty();
+    // Only the requested ops are proxied, even if more were read.
+    if (state->messages.size() > static_cast<size_t>(request->ops_size())) {
+      state->messages.resize(request->ops_size());
+    }
+  }
+  if (degraded_to_heartbeat) {
+    // Send a heartbeat to the destination to prevent it from starting a
+    // (pre) election.
+    raft_proxy_num_requests_log_read_timeout_->Increment();
+  }
+  RET_RESPOND_ERROR_NOT_OK(ReconstituteProxiedOps(
+      *request, state->messages, &state->downstream_request));
+
+  VLOG_WITH_PREFIX(3) << "Downstream proxy request: "
+                      << SecureShortDebugString(state->downstream_request);
+
+  RaftPeerPB* next_peer_pb;
+  Status s = GetRaftConfigMember(&state->active_config, state->next_uuid, &next_peer_pb);
+  if (PREDICT_FALSE(!s.ok())) {
+    RET_RESPOND_ERROR_NOT_OK(s.CloneAndPrepend(Substitute(
+        "unable to proxy to peer {} because it is not in the active config: {}",
+        state->next_uuid,
+        SecureShortDebugString(state->active_config))));
+  }
+  if (!next_peer_pb->has_last_known_addr()) {
+    s = Status::IllegalState("no known address for peer", state->next_uuid);
+    LOG_WITH_PREFIX(ERROR) << s.ToString();
+    RET_RESPOND_ERROR_NOT_OK(s);
+  }
+  RET_RESPOND_ERROR_NOT_OK(peer_proxy_factory_->NewProxy(*next_peer_pb, &state->next_proxy));
+
+  state->controller.set_timeout(
+      MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  // Requests to the other downstream peers of this proxy for the same ops
+  // share their serialization.
+  if (FLAGS_consensus_serialize_ops_once && state->downstream_request.ops_size() > 0) {
+    MoveOpsToSharedSidecar(queue_.get(), state->messages, &state->controller,
+                           &state->downstream_request);
+  }
+
+  auto self = shared_from_this();
+  state->downstream_sent = MonoTime::Now();
+  state->next_proxy->UpdateAsync(
+      &state->downstream_request, &state->downstream_response, &state->controller,
+      [self, state, next_peer_pb, degraded_to_heartbeat]() {
+        self->RespondToProxyRequest(*state->request, state->controller,
+                                    state->downstream_response, state->downstream_sent,
+                                    *next_peer_pb, degraded_to_heartbeat,
+                                    state->response, state->context);
+      });
+}
+
 Status RaftConsensus::SetCompressionCodec(const std::string& codec) {
   LockGuard l(lock_);
   return queue_->log_cache()->SetCompressionCodec(codec);
@@ -4606,6 +6315,58 @@ Status RaftConsensus::EnableCompressionOnCacheMiss(bool enable) {
   return queue_->log_cache()->EnableCompressionOnCacheMiss(enable);
 }
 
+Status RaftConsensus::EnableCompressedLogCacheTier(bool enable) {
+  LockGuard l(lock_);
+  return queue_->log_cache()->EnableCompressedTier(enable);
+}
+
+void RaftConsensus::GetLogCacheUsage(int64_t* num_ops, int64_t* bytes) const {
+  LockGuard l(lock_);
+  *num_ops = queue_->log_cache()->num_cached_ops();
+  *bytes = queue_->log_cache()->BytesUsed();
+}
+
+Status RaftConsensus::ReadCommittedOps(int64_t after_index,
+                                       int64_t max_bytes,
+                                       vector<ReplicateRefPtr>* msgs,
+                                       int64_t* committed_index) {
+  msgs->clear();
+  LogCache* log_cache;
+  {
+    LockGuard l(lock_);
+    RETURN_NOT_OK(CheckRunningUnlocked());
+    *committed_index = pending_->GetCommittedIndex();
+    // The queue lives as long as this object does, so the cache can be read
+    // without holding 'lock_' across a read from the log.
+    log_cache = queue_->log_cache();
+  }
+  if (after_index >= *committed_index) {
+    return Status::OK();
+  }
+
+  ReadContext context;
+  OpId preceding_op;
+  RETURN_NOT_OK(log_cache->ReadOps(after_index,
+                                   std::min<int64_t>(max_bytes, std::numeric_limits<int>::max()),
+                                   context, msgs, &preceding_op));
+  // The cache also holds the ops which are yet to be committed.
+  const int64_t up_to = *committed_index;
+  auto first_uncommitted = std::find_if(msgs->begin(), msgs->end(),
+                                        [up_to](const ReplicateRefPtr& msg) {
+                                          return msg->get()->id().index() > up_to;
+                                        });
+  msgs->erase(first_uncommitted, msgs->end());
+  return Status::OK();
+}
+
+Status RaftConsensus::WaitForCommit(int64_t index, const MonoTime& deadline) {
+  return commit_waiters_.WaitForCommit(index, deadline);
+}
+
+void RaftConsensus::OnCommit(int64_t index, StdStatusCallback callback) {
+  commit_waiters_.AddWaiter(index, std::move(callback));
+}
+
 Status RaftConsensus::SetProxyPolicy(const ProxyPolicy& proxy_policy) {
   LockGuard l(lock_);
   proxy_policy_ = proxy_policy;
@@ -4693,6 +6454,13 @@ ConsensusRound::ConsensusRound(RaftConsensus* consensus,
   DCHECK(replicate_msg_);
 }
 
+void ConsensusRoundHandler::FinishReplicationOfRounds(
+    const vector<scoped_refptr<ConsensusRound>>& rounds) {
+  for (const scoped_refptr<ConsensusRound>& round : rounds) {
+    round->NotifyReplicationFinished(Status::OK());
+  }
+}
+
 void ConsensusRound::NotifyReplicationFinished(const Status& status) {
   if (PREDICT_FALSE(!replicated_cb_)) return;
   replicated_cb_(status);
@@ -25,6 +25,8 @@
 
 #include <atomic>
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <iosfwd>
 #include <memory>
 #include <mutex>
@@ -36,6 +38,7 @@
 #include <glog/logging.h>
 #include <gtest/gtest_prod.h>
 
+#include "kudu/consensus/commit_waiters.h"
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus_meta.h"  // IWYU pragma: keep
 #include "kudu/consensus/consensus_queue.h"
@@ -59,6 +62,7 @@
 #endif
 
 #include "kudu/util/atomic.h"
+#include "kudu/util/lock_profile.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/make_shared.h"
 #include "kudu/util/metrics.h"
@@ -68,12 +72,20 @@
 
 DECLARE_int32(lag_threshold_for_request_vote);
 
+namespace google {
+namespace protobuf {
+class Arena;
+} // namespace protobuf
+} // namespace google
+
 namespace kudu {
 
 typedef std::lock_guard<simple_spinlock> Lock;
 typedef gscoped_ptr<Lock> ScopedLock;
 
+class JsonWriter;
 class Status;
+class Synchronizer;
 class ThreadPool;
 class ThreadPoolToken;
 template <typename Sig>
@@ -82,6 +94,7 @@ class Callback;
 namespace rpc {
 class PeriodicTimer;
 class RpcContext;
+class RpcController;
 }
 
 namespace tserver {
@@ -90,11 +103,14 @@ class TSTabletManager;
 
 namespace consensus {
 
+class ApplyScheduler;
 class ConsensusMetadataManager;
 class ConsensusRound;
 class ConsensusRoundHandler;
+class ElectionTimeline;
 class PeerManager;
 class PeerProxyFactory;
+class PhiAccrualDetector;
 class PersistentVarsManager;
 class PendingRounds;
 struct ConsensusBootstrapInfo;
@@ -262,6 +278,13 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // If we should be enforcing incoming consensus RPCs to have a token
   bool ShouldEnforceRaftRpcToken() const;
 
+  // Lets 'update' make several changes to the persistent variables, e.g.
+  // allowing elections and setting the RPC token, and makes them durable with
+  // a single write. Either all of the changes are applied or none are. Changing
+  // the RPC token is refused when SetRaftRpcToken() would refuse it.
+  Status UpdatePersistentVars(
+      const std::function<void(PersistentVars::Batch*)>& update);
+
   // Start tracking the leader for failures. This typically occurs at startup
   // and when the local peer steps down as leader.
   //
@@ -402,8 +425,18 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   //     commit index, which tells them to apply the operation.
   //
   // This method can only be called on the leader, i.e. role() == LEADER
+  //
+  // With --raft_replication_memory_budget_mb, the caller may be delayed before
+  // the round is replicated, or the round rejected with "ServiceUnavailable",
+  // see AdmitReplication().
   Status Replicate(const scoped_refptr<ConsensusRound>& round);
 
+  // Like Replicate(), but for a batch of rounds, which are given consecutive
+  // OpIds in the order of 'rounds' and appended to the queue and the log
+  // together. Either all the rounds are replicated, or none of them is and
+  // the error is returned. Config changes can't be replicated in a batch.
+  Status ReplicateBatch(const std::vector<scoped_refptr<ConsensusRound>>& rounds);
+
   // Ensures that the consensus implementation is currently acting as LEADER,
   // and thus is allowed to submit operations to be prepared before they are
   // replicated. To avoid a time-of-check-to-time-of-use (TOCTOU) race, the
@@ -436,8 +469,13 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // error response could not be formed, which will result in the service
   // returning an UNKNOWN_ERROR RPC error code to the caller and including the
   // stringified Status message.
+  //
+  // If 'request' was allocated on 'request_arena', the ops appended to the log
+  // are taken over in place, holding a reference to the arena, rather than
+  // being released from the request one by one.
   Status Update(const ConsensusRequestPB* request,
-                ConsensusResponsePB* response);
+                ConsensusResponsePB* response,
+                std::shared_ptr<google::protobuf::Arena> request_arena = nullptr);
 
   // Messages sent from CANDIDATEs to voting peers to request their vote
   // in leader election.
@@ -539,6 +577,31 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Returns the current Raft role of this instance.
   RaftPeerPB::Role role() const;
 
+  // Returns true if this replica is the leader and holds a lease under
+  // --raft_enable_leader_leases, i.e. no other replica can have become leader
+  // and the committed index reflects every write committed so far, so that
+  // linearizable reads may be served locally without a round trip.
+  //
+  // The lease lasts for the minimum election timeout, shortened by
+  // --raft_leader_lease_clock_drift, from the latest time a majority of the
+  // voters accepted a request of ours: each of them withholds its vote for
+  // that long after accepting. It is revoked when stepping down and for the
+  // duration of a leadership transfer.
+  bool HasValidLease() const;
+
+  // On the leader, sets 'read_index' to the committed index once leadership
+  // has been confirmed after this call began, either by a valid lease or by
+  // a majority accepting a heartbeat sent after it. The heartbeats are shared
+  // by concurrent callers. Returns IllegalState if this replica isn't, or
+  // stops being, the leader, and TimedOut past 'deadline'.
+  Status GetReadIndex(MonoTime deadline, int64_t* read_index);
+
+  // Waits until this replica has committed every op which the leader had
+  // committed when this call began, so that a read served from this replica
+  // afterwards is linearizable. On a follower the read index is obtained
+  // from the leader with the ReadIndex RPC. Sets 'read_index' to it.
+  Status WaitForReadIndex(MonoTime deadline, int64_t* read_index);
+
   // Returns the current term.
   int64_t CurrentTerm() const;
 
@@ -591,6 +654,16 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   void DumpStatusHtml(std::ostream& out) const;
 
+  // Writes the state of this replica as a JSON object, with the state of its
+  // queue if it's running. As with DumpStatusHtml(), the locks are only held
+  // to copy what's written.
+  void DumpStatusJson(JsonWriter* jw) const;
+
+  // Writes the timelines of the last --raft_election_timeline_history
+  // attempts of this replica to become leader as a JSON array, the one in
+  // progress first if there's one.
+  void WriteElectionTimelinesAsJson(JsonWriter* jw) const;
+
   // Transition to kStopped state. See State enum definition for details.
   // This is a no-op if the tablet is already in kStopped or kShutdown state;
   // otherwise, Raft will pass through the kStopping state on the way to
@@ -631,12 +704,20 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   void NotifyPeerHealthChange() override;
 
+  void NotifyProxyTopologyChange(const ProxyTopologyPB& proxy_topology) override;
+
+  void NotifyPeerNeedsSnapshot(const std::string& peer_uuid,
+                               int64_t snapshot_index) override;
+
   // Return the log indexes which the consensus implementation would like to retain.
   //
   // The returned 'for_durability' index ensures that no logs are GCed before
   // the operation is fully committed. The returned 'for_peers' index indicates
   // the index of the farthest-behind peer so that the log will try to avoid
-  // GCing these before the peer has caught up.
+  // GCing these before the peer has caught up. With
+  // --raft_gc_below_snapshot_index, 'for_peers' is raised to just past the
+  // round handler's durably applied index, since peers behind it are caught
+  // up from the snapshot instead.
   log::RetentionIndexes GetRetentionIndexes();
 
   // Return the on-disk size of the consensus metadata, in bytes.
@@ -644,6 +725,12 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   int64_t GetMillisSinceLastLeaderHeartbeat() const;
 
+  // Returns how far behind the leader, in wall-clock microseconds, the last
+  // op this follower appended and the last one it committed were when it did
+  // so, or -1 for either if unknown. Returns false if both are unknown, such
+  // as on a leader or without --raft_follower_time_lag.
+  bool GetTimeLag(int64_t* append_lag_us, int64_t* commit_lag_us) const;
+
   // Returns true if the request is intended to be proxied.
   bool IsProxyRequest(const ConsensusRequestPB* request) const;
 
@@ -671,6 +758,38 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Enables (or disables) compression of messages read from log
   Status EnableCompressionOnCacheMiss(bool enable);
 
+  // Enables (or disables) the compressed tier of the log cache
+  Status EnableCompressedLogCacheTier(bool enable);
+
+  // Returns the number of ops and bytes held by the log cache.
+  void GetLogCacheUsage(int64_t* num_ops, int64_t* bytes) const;
+
+  // Reads the committed ops after 'after_index', up to 'max_bytes' but at
+  // least one, for a consumer tailing what the tablet commits. The ops are
+  // read through the log cache which the peers are sent ops from, so that a
+  // consumer keeping up is served from memory. Sets 'committed_index' to the
+  // index of the last committed op, and leaves 'msgs' empty if no op after
+  // 'after_index' has been committed.
+  //
+  // Returns "NotFound" if the op after 'after_index' has been GCed.
+  Status ReadCommittedOps(int64_t after_index,
+                          int64_t max_bytes,
+                          std::vector<ReplicateRefPtr>* msgs,
+                          int64_t* committed_index);
+
+  // Blocks until the op with 'index' has been committed on this replica.
+  //
+  // Returns "TimedOut" if it hasn't been by 'deadline', or "Aborted" if
+  // consensus is shut down first.
+  Status WaitForCommit(int64_t index, const MonoTime& deadline);
+
+  // Runs 'callback' with OK once the op with 'index' has been committed on
+  // this replica, or with "Aborted" if consensus is shut down first. It runs
+  // before this returns if the op is already committed, and otherwise on the
+  // thread advancing the committed index while it holds the consensus lock,
+  // so it must neither block nor call back into this object.
+  void OnCommit(int64_t index, StdStatusCallback callback);
+
   // Clear the 'removed_peers_' list managed by consensus_meta
   void ClearRemovedPeersList();
 
@@ -693,6 +812,8 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   FRIEND_TEST(RaftConsensusQuorumTest, TestConsensusStopsIfAMajorityFallsBehind);
   FRIEND_TEST(RaftConsensusQuorumTest, TestLeaderElectionWithQuiescedQuorum);
   FRIEND_TEST(RaftConsensusQuorumTest, TestReplicasEnforceTheLogMatchingProperty);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestFollowerTimeLag);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestReplicationAdmissionControl);
   FRIEND_TEST(RaftConsensusQuorumTest, TestRequestVote);
 
   // RaftConsensus lifecycle states.
@@ -743,6 +864,8 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
     std::string leader_uuid;
     const OpId* preceding_opid;
     std::vector<ReplicateRefPtr> messages;
+    // The arena the leader's request was allocated on, if any.
+    std::shared_ptr<google::protobuf::Arena> request_arena;
     // The positional index of the first message selected to be appended, in the
     // original leader's request message sequence.
     int64_t first_message_idx;
@@ -750,8 +873,8 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
     std::string OpsRangeString() const;
   };
 
-  using LockGuard = std::lock_guard<simple_spinlock>;
-  using UniqueLock = std::unique_lock<simple_spinlock>;
+  using LockGuard = std::lock_guard<profiled_adaptive_mutex>;
+  using UniqueLock = std::unique_lock<profiled_adaptive_mutex>;
 
   // Initializes the RaftConsensus object, including loading the consensus
   // metadata.
@@ -812,9 +935,25 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Updates the state in a replica by storing the received operations in the log
   // and triggering the required transactions. This method won't return until all
   // operations have been stored in the log and all Prepares() have been completed,
-  // and a replica cannot accept any more Update() requests until this is done.
+  // and a replica cannot accept any more Update() requests until this is done,
+  // unless --raft_follower_release_update_lock_for_log_wait is set: then
+  // 'update_guard', which holds 'update_lock_', is released while waiting for
+  // the log so that the next request can append behind this one.
+  // 'payload_checksums_verified' is true if VerifyPayloadChecksums() already
+  // passed for every op of 'request'.
   Status UpdateReplica(const ConsensusRequestPB* request,
-                       ConsensusResponsePB* response);
+                       ConsensusResponsePB* response,
+                       std::shared_ptr<google::protobuf::Arena> request_arena,
+                       std::unique_lock<profiled_adaptive_mutex>* update_guard = nullptr,
+                       bool payload_checksums_verified = false);
+
+  // With --raft_follower_checksum_threads, verifies the payload checksums of
+  // the ops in 'request' in parallel, without holding any lock. Returns true
+  // only if the batch was worth verifying this way and every checksum
+  // matched: otherwise the checksums are left to
+  // StartFollowerTransactionUnlocked(), which rejects a corrupt op and the
+  // ops after it as it always has.
+  static bool VerifyPayloadChecksums(const ConsensusRequestPB& request);
 
   // Deduplicates an RPC request making sure that we get only messages that we
   // haven't appended to our log yet.
@@ -855,7 +994,9 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   // Begin a replica transaction. If the type of message in 'msg' is not a type
   // that uses transactions, delegates to StartConsensusOnlyRoundUnlocked().
-  Status StartFollowerTransactionUnlocked(const ReplicateRefPtr& msg);
+  // The payload checksum is checked unless 'payload_checksum_verified'.
+  Status StartFollowerTransactionUnlocked(const ReplicateRefPtr& msg,
+                                          bool payload_checksum_verified = false);
 
   // Returns true if this node is the only voter in the Raft configuration.
   bool IsSingleVoterConfig() const;
@@ -941,6 +1082,19 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // reactor thread, so it simply defers its work to DoElectionCallback.
   void ElectionCallback(ElectionContext context, const ElectionResult& result);
   void DoElectionCallback(const ElectionContext& context, const ElectionResult& result);
+
+  // Starts the timeline of an election of 'mode' about to start, unless it's
+  // the election which the pre-election of the current timeline led to.
+  // Returns the timeline. Only called if --raft_election_timeline_history is
+  // positive.
+  std::shared_ptr<ElectionTimeline> BeginElectionTimelineUnlocked(
+      ElectionMode mode, const ElectionContext& context);
+
+  // Ends 'timeline' with 'outcome', unless it's null or already over, feeding
+  // its phases to the election metrics and keeping it for
+  // WriteElectionTimelinesAsJson().
+  void FinishElectionTimelineUnlocked(const std::shared_ptr<ElectionTimeline>& timeline,
+                                      const std::string& outcome);
   void NestedElectionDecisionCallback(
       ElectionContext context, const ElectionResult& result);
 
@@ -978,6 +1132,18 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   MonoDelta TimeoutBackoffHelper(double backoff_factor);
 
+  // Records that the leader 'leader_uuid' was just heard from, and returns
+  // how long to snooze the failure detector for. With
+  // --raft_phi_failure_detection, that is when the suspicion the leader
+  // failed, given how regularly it has been heard from, reaches the
+  // threshold for its region; otherwise it's MinimumElectionTimeoutWithBan().
+  MonoDelta LeaderFailureTimeoutUnlocked(const std::string& leader_uuid);
+
+  // Returns the phi threshold for a leader in 'leader_region', from
+  // --raft_phi_suspicion_thresholds_by_region or else
+  // --raft_phi_suspicion_threshold.
+  static double PhiSuspicionThreshold(const std::string& leader_region);
+
   // Handle when the term has advanced beyond the current term.
   //
   // 'flush' may be used to control whether the term change is flushed to disk.
@@ -1009,9 +1175,73 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Attempt to promote the given non-voter to a voter.
   void TryPromoteNonVoterTask(const std::string& peer_uuid);
 
+  // A config change request queued behind the pending config change with
+  // --raft_coalesce_config_changes, and the callback of its caller.
+  struct QueuedConfigChange {
+    BulkChangeConfigRequestPB req;
+    StdStatusCallback client_cb;
+  };
+
+  // Replicates as many of the queued config changes as can be combined into
+  // a single config change, once the pending one is over. The changes which
+  // fail validation are failed through their callbacks; those which just
+  // don't fit in the same config change as the ones before them wait for the
+  // next one.
+  void ReplicateQueuedConfigChangesTask();
+
+  // Fails all the queued config changes with 's'.
+  void FailQueuedConfigChanges(const Status& s);
+
+  // Hand the round handler the peer which needs the snapshot through
+  // 'snapshot_index', if this replica is still its leader.
+  void TrySendSnapshotToPeerTask(const std::string& peer_uuid, int64_t snapshot_index);
+
   void TryStartElectionOnPeerTask(const std::string& peer_uuid,
     const boost::optional<PeerMessageQueue::TransferContext>& transfer_context);
 
+  // The state of a proxy request handled with --raft_proxy_async_fanout,
+  // which lives until the request is responded to.
+  struct ProxyFanoutRequest;
+
+  // Waits, without blocking the calling thread, for the ops of 'state' to
+  // be appended to the local log cache, for up to
+  // --raft_log_cache_proxy_wait_time_ms, then runs ContinueProxyRequest()
+  // on the raft thread pool.
+  void StartProxyFanout(std::shared_ptr<ProxyFanoutRequest> state);
+
+  // Reconstitutes the ops of 'state' from the local log cache, or sends a
+  // heartbeat if they 'timed_out', and sends the downstream request.
+  void ContinueProxyRequest(const std::shared_ptr<ProxyFanoutRequest>& state,
+                            bool timed_out);
+
+  // Adds the ops read from the local log cache as 'messages' to
+  // 'downstream_request', checking that they are the ops which 'request'
+  // proxies. A prefix of the requested ops is tolerated.
+  Status ReconstituteProxiedOps(const ConsensusRequestPB& request,
+                                const std::vector<ReplicateRefPtr>& messages,
+                                ConsensusRequestPB* downstream_request);
+
+  // Responds to the proxy request 'request' with the response of the
+  // downstream peer 'next_peer_pb' to the request sent with 'controller' at
+  // 'downstream_sent'.
+  void RespondToProxyRequest(const ConsensusRequestPB& request,
+                             const rpc::RpcController& controller,
+                             const ConsensusResponsePB& downstream_response,
+                             MonoTime downstream_sent,
+                             const RaftPeerPB& next_peer_pb,
+                             bool degraded_to_heartbeat,
+                             ConsensusResponsePB* response,
+                             rpc::RpcContext* context);
+
+  // Adds this server's hop to the response to the traced proxy request
+  // 'request', after those of the hops downstream of it, and records it in
+  // the histogram for its position.
+  void RecordTracedProxyHop(const ConsensusRequestPB& request,
+                            const ConsensusResponsePB& downstream_response,
+                            int64_t latency_us,
+                            int64_t downstream_us,
+                            ConsensusResponsePB* response);
+
   // Called when the failure detector expires.
   // Submits ReportFailureDetectedTask() to a thread pool.
   void ReportFailureDetected();
@@ -1020,6 +1250,11 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // being shut down).
   void ReportFailureDetectedTask();
 
+  // Returns true if the hint of the last leader request shows that this
+  // replica would win an election, so the pre-election can be skipped.
+  // Consumes the hint. See --raft_pre_vote_hints.
+  bool CanSkipPreElection();
+
   // Handle the completion of replication of a config change operation.
   // If 'status' is OK, this takes care of persisting the new configuration
   // to disk as the committed configuration. A non-OK status indicates that
@@ -1031,6 +1266,9 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // As a leader, append a new ConsensusRound to the queue.
   Status AppendNewRoundToQueueUnlocked(const scoped_refptr<ConsensusRound>& round);
 
+  // As a leader, append a batch of new ConsensusRounds to the queue.
+  Status AppendNewRoundsToQueueUnlocked(const std::vector<scoped_refptr<ConsensusRound>>& rounds);
+
   // As a follower, start a consensus round not associated with a Transaction.
   Status StartConsensusOnlyRoundUnlocked(const ReplicateRefPtr& msg);
 
@@ -1040,6 +1278,13 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // (see Diego Ongaro's thesis section 4.1).
   Status AddPendingOperationUnlocked(const scoped_refptr<ConsensusRound>& round);
 
+  // Applies backpressure to writes as the memory this replica holds for
+  // replicating ops, in its log cache and its pending rounds, nears
+  // --raft_replication_memory_budget_mb. Past the delay threshold it sleeps
+  // for a time which grows with the memory in use, and past the budget it
+  // returns "ServiceUnavailable". Must be called without holding any lock.
+  Status AdmitReplication();
+
   // Checks that the replica is in the appropriate state and role to replicate
   // the provided operation and that the replicate message does not yet have an
   // OpId assigned.
@@ -1090,6 +1335,10 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   bool HasLeaderUnlocked() const;
   void ClearLeaderUnlocked();
 
+  // Returns the last snapshot published by 'cmeta_' if
+  // --raft_lockless_state_reads is set and 'cmeta_' is loaded, null otherwise.
+  std::shared_ptr<const ConsensusMetadata::Snapshot> PublishedCMetaSnapshot() const;
+
   // Return whether this peer has voted in the current term.
   const bool HasVotedCurrentTermUnlocked() const;
 
@@ -1097,6 +1346,15 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // metadata to disk.
   Status SetVotedForCurrentTermUnlocked(const std::string& uuid) WARN_UNUSED_RESULT;
 
+  // Make the current term and vote durable: either by flushing the consensus
+  // metadata, or, with --raft_term_vote_in_wal, by appending a record to the
+  // log and only checkpointing the consensus metadata periodically.
+  Status PersistTermVoteUnlocked() WARN_UNUSED_RESULT;
+
+  // With --raft_term_vote_in_wal, bring the consensus metadata up to date with
+  // the last term and vote record in the log. Called from Start().
+  Status RecoverTermVoteFromLog() WARN_UNUSED_RESULT;
+
   // Return replica's vote for the current term.
   // The vote must be set; use HasVotedCurrentTermUnlocked() to check.
   const std::string& GetVotedForCurrentTermUnlocked() const;
@@ -1143,13 +1401,26 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   //
   // Lock ordering note: If both 'update_lock_' and 'lock_' are to be taken,
   // 'update_lock_' lock must be taken first.
-  mutable simple_spinlock update_lock_;
+  mutable profiled_adaptive_mutex update_lock_;
 
   // Coarse-grained lock that protects all mutable data members.
-  mutable simple_spinlock lock_;
+  //
+  // Both locks are profiled, see /lockz.
+  mutable profiled_adaptive_mutex lock_;
+
+  // The prefix last built by LogPrefixUnlocked(), along with the term and
+  // role it was built for. Only set under 'lock_', but LogPrefix() loads
+  // 'log_prefix_' atomically, without the lock, when another thread holds it.
+  mutable std::shared_ptr<const std::string> log_prefix_;
+  mutable int64_t log_prefix_term_ = -1;
+  mutable RaftPeerPB::Role log_prefix_role_ = RaftPeerPB::UNKNOWN_ROLE;
 
   State state_;
 
+  // A copy of 'state_', stored under 'lock_' but loaded without it by the
+  // accessors which serve --raft_lockless_state_reads.
+  std::atomic<State> published_state_;
+
   // Consensus metadata persistence object.
   scoped_refptr<ConsensusMetadata> cmeta_;
 
@@ -1180,6 +1451,14 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // The queue of messages that must be sent to peers.
   std::unique_ptr<PeerMessageQueue> queue_;
 
+  // Applies committed writes in parallel when --raft_apply_parallelism is
+  // set, null otherwise. Declared before 'pending_', which points to it.
+  std::unique_ptr<ApplyScheduler> apply_scheduler_;
+
+  // The callbacks of WaitForCommit() and OnCommit(). Declared before
+  // 'pending_', which points to it.
+  CommitWaiters commit_waiters_;
+
   // The currently pending rounds that have not yet been committed by
   // consensus. Protected by 'lock_'.
   // TODO(todd) these locks will become more fine-grained.
@@ -1190,7 +1469,24 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   std::shared_ptr<rpc::PeriodicTimer> failure_detector_;
   std::chrono::system_clock::time_point failure_detector_last_snoozed_;
 
+  // With --raft_phi_failure_detection, the arrivals of the requests of the
+  // leader 'leader_arrivals_uuid_'. Protected by 'lock_'.
+  std::unique_ptr<PhiAccrualDetector> leader_arrivals_;
+  std::string leader_arrivals_uuid_;
+
   AtomicBool leader_transfer_in_progress_;
+
+  // The term in which this replica is the leader, or kNoLeaderTerm. Set by
+  // BecomeLeaderUnlocked() and cleared, under 'lock_', whenever leadership
+  // may have been lost, so that CheckLeadershipAndBindTerm() can read it
+  // without the lock when --raft_lockless_term_binding is set.
+  static constexpr int64_t kNoLeaderTerm = -1;
+  std::atomic<int64_t> leader_term_;
+
+  // When GetReadIndex() last signalled the peers to send heartbeats. Shared
+  // by concurrent callers, so that they wait on the same heartbeats.
+  simple_spinlock read_index_lock_;
+  MonoTime read_index_last_signal_;
   boost::optional<std::string> designated_successor_uuid_;
   std::shared_ptr<rpc::PeriodicTimer> transfer_period_timer_;
 
@@ -1215,6 +1511,18 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // nodes from disturbing the healthy leader.
   MonoTime withhold_votes_until_;
 
+  // Whether term and vote changes are appended to the log (see
+  // --raft_term_vote_in_wal), and how many have been appended since the
+  // consensus metadata was last flushed. Protected by 'lock_'.
+  bool term_vote_in_wal_ = false;
+  int term_vote_records_since_checkpoint_ = 0;
+
+  // The voters_majority_log_index of the last request accepted from the
+  // leader, and the leader's term, or -1 if there is none to use. Protected
+  // by 'lock_'.
+  int64_t pre_vote_hint_term_;
+  int64_t pre_vote_hint_index_;
+
   // This is used in tests to reject AppendEntries RPC requests.
   bool reject_append_entries_;
 
@@ -1229,6 +1537,12 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // point to continue sending operations.
   OpId last_received_cur_leader_;
 
+  // The synchronizer of the latest log append by UpdateReplica(). Once
+  // requests no longer wait for their appends under 'update_lock_', a request
+  // which appends nothing itself waits on it, so that it doesn't ack ops which
+  // an earlier request is still writing. Protected by 'lock_'.
+  std::shared_ptr<Synchronizer> last_append_synchronizer_;
+
   // The number of times this node has called and lost a leader election since
   // the last time it saw a stable leader (either itself or another node).
   // This is used to calculate back-off of the election timeout.
@@ -1266,7 +1580,22 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
 
   std::atomic<int64_t> last_leader_communication_time_micros_;
 
+  // Returns the microseconds since the leader stamped an op with the hybrid
+  // time 'timestamp', or -1 if it wasn't stamped.
+  static int64_t TimeLagMicros(uint64_t timestamp);
+
+  // The commit time lag for the follower_commit_time_lag_ms gauge.
+  int64_t GetCommitTimeLagMillis() const;
+
+  // The time lags returned by GetTimeLag(). Reset when becoming leader.
+  std::atomic<int64_t> append_time_lag_us_{-1};
+  std::atomic<int64_t> commit_time_lag_us_{-1};
+  scoped_refptr<Histogram> follower_append_time_lag_;
+  scoped_refptr<Histogram> follower_commit_time_lag_;
+
   scoped_refptr<Counter> follower_memory_pressure_rejections_;
+  scoped_refptr<Histogram> raft_admission_delay_;
+  scoped_refptr<Counter> raft_admission_rejections_;
   scoped_refptr<AtomicGauge<int64_t>> term_metric_;
   scoped_refptr<AtomicGauge<int64_t>> num_failed_elections_metric_;
 
@@ -1286,6 +1615,32 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   scoped_refptr<Counter> raft_proxy_num_requests_unknown_dest_;
   scoped_refptr<Counter> raft_proxy_num_requests_log_read_timeout_;
   scoped_refptr<Counter> raft_proxy_num_requests_hops_remaining_exhausted_;
+  scoped_refptr<Histogram> raft_proxy_hop_latency_;
+  // Indexed by the position of the server on the route of the requests traced
+  // with --raft_proxy_trace_requests, from the first proxy. The last one holds
+  // all the positions from there on.
+  scoped_refptr<Histogram> raft_proxy_traced_hop_latency_[3];
+  scoped_refptr<Histogram> raft_proxy_batch_size_;
+
+  // The timeline of the attempt to become leader in progress, if any, and of
+  // the last ones which are over, most recent first. Protected by 'lock_'.
+  std::shared_ptr<ElectionTimeline> election_timeline_;
+  std::deque<std::shared_ptr<ElectionTimeline>> past_election_timelines_;
+
+  // The config changes waiting for the pending one to be over, in the order
+  // they were requested. Protected by 'lock_'.
+  std::deque<QueuedConfigChange> queued_config_changes_;
+
+  // When the failure detector last fired, from GetMonoTimeMicros().
+  std::atomic<int64_t> last_failure_detected_micros_;
+
+  // Election metrics, fed from the timelines.
+  scoped_refptr<Histogram> failure_detection_latency_;
+  scoped_refptr<Histogram> pre_election_latency_;
+  scoped_refptr<Histogram> election_vote_flush_latency_;
+  scoped_refptr<Histogram> election_latency_;
+  scoped_refptr<Histogram> leader_noop_commit_latency_;
+  scoped_refptr<Histogram> failover_latency_;
 
   DISALLOW_COPY_AND_ASSIGN(RaftConsensus);
 };
@@ -1325,6 +1680,31 @@ class ConsensusRoundHandler {
   // replication. This can be used to trigger callbacks, akin to an Apply() for
   // transaction ops.
   virtual void FinishConsensusOnlyRound(ConsensusRound* round) = 0;
+
+  // Called once per advancement of the committed index with the newly
+  // committed rounds, in index order, when --raft_batch_commit_notifications
+  // is set. Implementations may override this to group-apply the rounds; the
+  // default notifies each round's replicated callback in turn.
+  virtual void FinishReplicationOfRounds(
+      const std::vector<scoped_refptr<ConsensusRound>>& rounds);
+
+  // Returns the index through which the state machine has durably applied
+  // the log, i.e. from which it could serve a snapshot to a peer, or -1 if it
+  // keeps no such snapshot. With --raft_gc_below_snapshot_index, the log is
+  // not retained below this index for lagging peers, which are instead caught
+  // up with SendSnapshotToPeer(). The default keeps no snapshot.
+  virtual int64_t GetDurablyAppliedIndex() { return -1; }
+
+  // Called on the leader when 'peer' needs ops which have been GCed from the
+  // log because they were covered by the snapshot through 'snapshot_index'.
+  // Implementations should stream a snapshot of at least 'snapshot_index' to
+  // the peer and return once the transfer has started; the peer is caught up
+  // from the log once it reports the snapshot's index as its last received
+  // op. Called again only once the snapshot index advances, so a failed
+  // transfer should be retried by the implementation.
+  virtual Status SendSnapshotToPeer(const RaftPeerPB& peer, int64_t snapshot_index) {
+    return Status::NotSupported("state machine does not serve snapshots");
+  }
 };
 
 // Context for a consensus round on the LEADER side, typically created as an
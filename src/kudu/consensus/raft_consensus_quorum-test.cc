@@ -37,6 +37,7 @@
 #include <gtest/gtest.h>
 
 #include "kudu/clock/clock.h"
+#include "kudu/clock/hybrid_clock.h"
 #include "kudu/clock/logical_clock.h"
 #include "kudu/common/common.pb.h"
 //#include "kudu/common/schema.h"
@@ -72,6 +73,7 @@
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/strcat.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
 //#include "kudu/tablet/metadata.pb.h"
 #include "kudu/util/async_util.h"
 #include "kudu/util/mem_tracker.h"
@@ -87,6 +89,12 @@
 
 DECLARE_int32(raft_heartbeat_interval_ms);
 DECLARE_bool(enable_leader_failure_detection);
+DECLARE_bool(raft_batch_commit_notifications);
+DECLARE_bool(raft_lockless_term_binding);
+DECLARE_bool(raft_lockless_state_reads);
+DECLARE_bool(raft_follower_time_lag);
+DECLARE_int64(raft_replication_memory_budget_mb);
+DECLARE_int32(raft_admission_delay_threshold_pct);
 
 //METRIC_DECLARE_entity(tablet);
 
@@ -683,6 +691,282 @@ TEST_F(RaftConsensusQuorumTest, TestFollowersReplicateAndCommitSequence) {
   VerifyLogs(2, 0, 1);
 }
 
+// Tests that a batch of rounds submitted together gets consecutive OpIds and
+// is replicated to the followers.
+TEST_F(RaftConsensusQuorumTest, TestReplicateBatch) {
+  const int kFollower0Idx = 0;
+  const int kFollower1Idx = 1;
+  const int kLeaderIdx = 2;
+  const int kBatchSize = 10;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  for (int i = 0; i < kBatchSize; i++) {
+    gscoped_ptr<ReplicateMsg> msg(new ReplicateMsg());
+    msg->set_op_type(NO_OP);
+    msg->mutable_noop_request();
+    msg->set_timestamp(clock_->Now().ToUint64());
+    gscoped_ptr<Synchronizer> sync(new Synchronizer());
+    rounds.push_back(leader->NewRound(std::move(msg), sync->AsStdStatusCallback()));
+    InsertOrDie(&syncs_, rounds.back().get(), sync.release());
+  }
+  ASSERT_OK(leader->ReplicateBatch(rounds));
+
+  for (int i = 0; i < kBatchSize; i++) {
+    ASSERT_OK(WaitForReplicate(rounds[i].get()));
+    if (i > 0) {
+      ASSERT_EQ(rounds[i - 1]->id().index() + 1, rounds[i]->id().index());
+      ASSERT_EQ(rounds[i - 1]->id().term(), rounds[i]->id().term());
+    }
+  }
+  const OpId& last_op_id = rounds.back()->id();
+  WaitForReplicateIfNotAlreadyPresent(last_op_id, kFollower0Idx);
+  WaitForReplicateIfNotAlreadyPresent(last_op_id, kFollower1Idx);
+}
+
+// Tests that binding a round to the leader's term without taking the consensus
+// lock succeeds only on the leader and yields a round which replicates.
+TEST_F(RaftConsensusQuorumTest, TestLocklessTermBinding) {
+  FLAGS_raft_lockless_term_binding = true;
+  const int kFollower0Idx = 0;
+  const int kLeaderIdx = 2;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  shared_ptr<RaftConsensus> follower0;
+  CHECK_OK(peers_->GetPeerByIdx(kFollower0Idx, &follower0));
+
+  auto new_noop_round = [&](const shared_ptr<RaftConsensus>& peer) {
+    gscoped_ptr<ReplicateMsg> msg(new ReplicateMsg());
+    msg->set_op_type(NO_OP);
+    msg->mutable_noop_request();
+    msg->set_timestamp(clock_->Now().ToUint64());
+    gscoped_ptr<Synchronizer> sync(new Synchronizer());
+    scoped_refptr<ConsensusRound> round =
+        peer->NewRound(std::move(msg), sync->AsStdStatusCallback());
+    InsertOrDie(&syncs_, round.get(), sync.release());
+    return round;
+  };
+
+  scoped_refptr<ConsensusRound> follower_round = new_noop_round(follower0);
+  ASSERT_TRUE(follower0->CheckLeadershipAndBindTerm(follower_round).IsIllegalState());
+
+  scoped_refptr<ConsensusRound> round = new_noop_round(leader);
+  ASSERT_OK(leader->CheckLeadershipAndBindTerm(round));
+  ASSERT_OK(leader->Replicate(round));
+  ASSERT_OK(WaitForReplicate(round.get()));
+  ASSERT_EQ(leader->CurrentTerm(), round->id().term());
+}
+
+// Tests that the state served without the consensus lock matches the state
+// read under it.
+TEST_F(RaftConsensusQuorumTest, TestLocklessStateReads) {
+  const int kFollower0Idx = 0;
+  const int kLeaderIdx = 2;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(5,
+                                        kLeaderIdx,
+                                        WAIT_FOR_ALL_REPLICAS,
+                                        DONT_COMMIT,
+                                        &last_op_id,
+                                        &rounds));
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), kFollower0Idx, kLeaderIdx);
+
+  for (int idx : { kFollower0Idx, kLeaderIdx }) {
+    shared_ptr<RaftConsensus> peer;
+    CHECK_OK(peers_->GetPeerByIdx(idx, &peer));
+    // Let the leader finish advancing its commit index, so that both reads
+    // see the same state.
+    ASSERT_EVENTUALLY([&] {
+      ASSERT_GE(peer->GetLastOpId(COMMITTED_OPID)->index(), last_op_id.index());
+    });
+
+    FLAGS_raft_lockless_state_reads = false;
+    RaftPeerPB::Role role = peer->role();
+    int64_t term = peer->CurrentTerm();
+    string leader_uuid = peer->GetLeaderUuid();
+    OpId received = *peer->GetLastOpId(RECEIVED_OPID);
+    OpId committed = *peer->GetLastOpId(COMMITTED_OPID);
+    ConsensusStatePB cstate;
+    ASSERT_OK(peer->ConsensusState(&cstate));
+
+    FLAGS_raft_lockless_state_reads = true;
+    ASSERT_EQ(role, peer->role());
+    ASSERT_EQ(term, peer->CurrentTerm());
+    ASSERT_EQ(leader_uuid, peer->GetLeaderUuid());
+    ASSERT_TRUE(peer->IsRunning());
+    ASSERT_OPID_EQ(received, *peer->GetLastOpId(RECEIVED_OPID));
+    ASSERT_OPID_EQ(committed, *peer->GetLastOpId(COMMITTED_OPID));
+    ConsensusStatePB lockless_cstate;
+    ASSERT_OK(peer->ConsensusState(&lockless_cstate));
+    ASSERT_EQ(SecureShortDebugString(cstate), SecureShortDebugString(lockless_cstate));
+  }
+}
+
+// Tests that ReadCommittedOps() returns the committed ops in order, and none
+// which are yet to be committed.
+TEST_F(RaftConsensusQuorumTest, TestReadCommittedOps) {
+  const int kFollower0Idx = 0;
+  const int kLeaderIdx = 2;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(5,
+                                        kLeaderIdx,
+                                        WAIT_FOR_ALL_REPLICAS,
+                                        DONT_COMMIT,
+                                        &last_op_id,
+                                        &rounds));
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), kFollower0Idx, kLeaderIdx);
+
+  for (int idx : { kFollower0Idx, kLeaderIdx }) {
+    shared_ptr<RaftConsensus> peer;
+    CHECK_OK(peers_->GetPeerByIdx(idx, &peer));
+    ASSERT_EVENTUALLY([&] {
+      ASSERT_GE(peer->GetLastOpId(COMMITTED_OPID)->index(), last_op_id.index());
+    });
+
+    vector<ReplicateRefPtr> msgs;
+    int64_t committed_index;
+    ASSERT_OK(peer->ReadCommittedOps(0, 1024 * 1024, &msgs, &committed_index));
+    ASSERT_GE(committed_index, last_op_id.index());
+    ASSERT_FALSE(msgs.empty());
+    ASSERT_EQ(committed_index, msgs.back()->get()->id().index());
+    for (int i = 0; i < msgs.size(); i++) {
+      ASSERT_EQ(i + 1, msgs[i]->get()->id().index());
+    }
+
+    // At least one op is returned, however few bytes are asked for.
+    ASSERT_OK(peer->ReadCommittedOps(2, 1, &msgs, &committed_index));
+    ASSERT_EQ(1, msgs.size());
+    ASSERT_EQ(3, msgs[0]->get()->id().index());
+
+    ASSERT_OK(peer->ReadCommittedOps(committed_index, 1024 * 1024, &msgs, &committed_index));
+    ASSERT_TRUE(msgs.empty());
+  }
+}
+
+// Tests that WaitForCommit() and OnCommit() return once the op is committed.
+TEST_F(RaftConsensusQuorumTest, TestCommitWaiters) {
+  const int kFollower0Idx = 0;
+  const int kLeaderIdx = 2;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(kFollower0Idx, &follower));
+  int64_t next_index = follower->GetLastOpId(COMMITTED_OPID)->index() + 1;
+
+  Synchronizer sync;
+  follower->OnCommit(next_index + 4, sync.AsStdStatusCallback());
+  Status s = follower->WaitForCommit(next_index + 1000, MonoTime::Now());
+  ASSERT_TRUE(s.IsTimedOut()) << s.ToString();
+
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(5,
+                                        kLeaderIdx,
+                                        WAIT_FOR_ALL_REPLICAS,
+                                        DONT_COMMIT,
+                                        &last_op_id,
+                                        &rounds));
+  ASSERT_OK(follower->WaitForCommit(last_op_id.index(),
+                                    MonoTime::Now() + MonoDelta::FromSeconds(30)));
+  ASSERT_OK(sync.WaitFor(MonoDelta::FromSeconds(30)));
+
+  // Waiters still waiting when consensus shuts down are aborted.
+  Synchronizer aborted;
+  follower->OnCommit(last_op_id.index() + 100, aborted.AsStdStatusCallback());
+  follower->Shutdown();
+  s = aborted.WaitFor(MonoDelta::FromSeconds(30));
+  ASSERT_TRUE(s.IsAborted()) << s.ToString();
+}
+
+// Tests that the leader runs the writes it replicates through admission
+// control under a replication memory budget.
+TEST_F(RaftConsensusQuorumTest, TestReplicationAdmissionControl) {
+  // Every write goes over the delay threshold, but none over the budget.
+  FLAGS_raft_replication_memory_budget_mb = 64;
+  FLAGS_raft_admission_delay_threshold_pct = 0;
+  const int kLeaderIdx = 2;
+  const int kNumOps = 5;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(kNumOps,
+                                        kLeaderIdx,
+                                        WAIT_FOR_ALL_REPLICAS,
+                                        DONT_COMMIT,
+                                        &last_op_id,
+                                        &rounds));
+
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  ASSERT_GE(leader->raft_admission_delay_->TotalCount(), kNumOps);
+  ASSERT_EQ(0, leader->raft_admission_rejections_->value());
+}
+
+// Tests that, with batched commit notifications, committed rounds reach the
+// round handler instead of having their callbacks invoked one by one.
+TEST_F(RaftConsensusQuorumTest, TestBatchedCommitNotifications) {
+  FLAGS_raft_batch_commit_notifications = true;
+  const int kLeaderIdx = 2;
+  const int kNumOps = 10;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(kNumOps,
+                                        kLeaderIdx,
+                                        WAIT_FOR_ALL_REPLICAS,
+                                        DONT_COMMIT,
+                                        &last_op_id,
+                                        &rounds));
+  // The rounds' callbacks have all fired, and on the leader they must have
+  // been fired through the handler.
+  ASSERT_GE(txn_factories_[kLeaderIdx]->batched_rounds(), kNumOps);
+}
+
+// Tests that the leader hands out read indexes covering what it committed,
+// and that followers don't.
+TEST_F(RaftConsensusQuorumTest, TestReadIndex) {
+  const int kFollower0Idx = 0;
+  const int kLeaderIdx = 2;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(5,
+                                        kLeaderIdx,
+                                        WAIT_FOR_ALL_REPLICAS,
+                                        DONT_COMMIT,
+                                        &last_op_id,
+                                        &rounds));
+
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  shared_ptr<RaftConsensus> follower0;
+  CHECK_OK(peers_->GetPeerByIdx(kFollower0Idx, &follower0));
+
+  const MonoTime deadline = MonoTime::Now() + MonoDelta::FromSeconds(10);
+  int64_t read_index = 0;
+  ASSERT_OK(leader->GetReadIndex(deadline, &read_index));
+  ASSERT_GE(read_index, last_op_id.index());
+  ASSERT_OK(leader->WaitForReadIndex(deadline, &read_index));
+  ASSERT_GE(read_index, last_op_id.index());
+
+  ASSERT_TRUE(follower0->GetReadIndex(deadline, &read_index).IsIllegalState());
+}
+
 TEST_F(RaftConsensusQuorumTest, TestConsensusContinuesIfAMinorityFallsBehind) {
   // Constants with the indexes of peers with certain roles,
   // since peers don't change roles in this test.
@@ -1016,6 +1300,59 @@ TEST_F(RaftConsensusQuorumTest, TestReplicasEnforceTheLogMatchingProperty) {
                       "Log matching property violated");
 }
 
+// Tests that a follower measures how far behind the leader's stamp of an op it
+// was when appending and committing it.
+TEST_F(RaftConsensusQuorumTest, TestFollowerTimeLag) {
+  FLAGS_raft_follower_time_lag = true;
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  OpId last_op_id;
+  shared_ptr<Synchronizer> last_commit_sync;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      1, 2, WAIT_FOR_ALL_REPLICAS, COMMIT_ONE_BY_ONE,
+      &last_op_id, &rounds, &last_commit_sync));
+  ASSERT_OK(last_commit_sync->Wait());
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), 0, 2);
+
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(2, &leader));
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(0, &follower));
+
+  // Send the follower an op the leader stamped a minute ago, and commit it.
+  const int64_t kLagUs = 60 * 1000 * 1000;
+  ConsensusRequestPB req;
+  ConsensusResponsePB resp;
+  req.set_caller_uuid(leader->peer_uuid());
+  req.set_caller_term(last_op_id.term());
+  req.mutable_preceding_id()->CopyFrom(last_op_id);
+  req.set_all_replicated_index(0);
+  ReplicateMsg* replicate = req.add_ops();
+  replicate->set_timestamp(clock::HybridClock::TimestampFromMicroseconds(
+      GetCurrentTimeMicros() - kLagUs).ToUint64());
+  OpId* id = replicate->mutable_id();
+  id->set_term(last_op_id.term());
+  id->set_index(last_op_id.index() + 1);
+  replicate->set_op_type(NO_OP);
+  replicate->mutable_noop_request();
+  req.set_committed_index(id->index());
+  req.set_last_idx_appended_to_leader(id->index());
+  ASSERT_OK(follower->Update(&req, &resp));
+  ASSERT_FALSE(resp.status().has_error()) << SecureShortDebugString(resp);
+
+  int64_t append_lag_us;
+  int64_t commit_lag_us;
+  ASSERT_TRUE(follower->GetTimeLag(&append_lag_us, &commit_lag_us));
+  ASSERT_GE(append_lag_us, kLagUs);
+  ASSERT_GE(commit_lag_us, kLagUs);
+  ASSERT_GE(follower->GetCommitTimeLagMillis(), kLagUs / 1000);
+  ASSERT_EQ(1, follower->follower_commit_time_lag_->TotalCount());
+
+  // The leader is never behind itself.
+  ASSERT_FALSE(leader->GetTimeLag(&append_lag_us, &commit_lag_us));
+}
+
 // Test that RequestVote performs according to "spec".
 TEST_F(RaftConsensusQuorumTest, TestRequestVote) {
   ASSERT_OK(BuildAndStartConfig(3));
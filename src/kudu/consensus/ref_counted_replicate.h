@@ -18,10 +18,20 @@
 #ifndef KUDU_CONSENSUS_REF_COUNTED_REPLICATE_H_
 #define KUDU_CONSENSUS_REF_COUNTED_REPLICATE_H_
 
+#include <memory>
+#include <utility>
+
 #include "kudu/consensus/consensus.pb.h"
+#include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/gscoped_ptr.h"
 
+namespace google {
+namespace protobuf {
+class Arena;
+} // namespace protobuf
+} // namespace google
+
 namespace kudu {
 namespace consensus {
 
@@ -30,11 +40,27 @@ class RefCountedReplicate : public RefCountedThreadSafe<RefCountedReplicate> {
  public:
   explicit RefCountedReplicate(ReplicateMsg* msg) : msg_(msg) {}
 
+  // Wraps 'msg', which was allocated on 'arena', keeping the arena alive for
+  // as long as the message is referenced.
+  RefCountedReplicate(ReplicateMsg* msg, std::shared_ptr<google::protobuf::Arena> arena)
+      : arena_(std::move(arena)),
+        msg_(msg) {}
+
   ReplicateMsg* get() {
     return msg_.get();
   }
 
  private:
+  friend class RefCountedThreadSafe<RefCountedReplicate>;
+
+  ~RefCountedReplicate() {
+    if (arena_) {
+      // The message belongs to the arena.
+      ignore_result(msg_.release());
+    }
+  }
+
+  const std::shared_ptr<google::protobuf::Arena> arena_;
   gscoped_ptr<ReplicateMsg> msg_;
 };
 
@@ -44,6 +70,11 @@ inline ReplicateRefPtr make_scoped_refptr_replicate(ReplicateMsg* replicate) {
   return ReplicateRefPtr(new RefCountedReplicate(replicate));
 }
 
+inline ReplicateRefPtr make_scoped_refptr_replicate(
+    ReplicateMsg* replicate, std::shared_ptr<google::protobuf::Arena> arena) {
+  return ReplicateRefPtr(new RefCountedReplicate(replicate, std::move(arena)));
+}
+
 } // namespace consensus
 } // namespace kudu
 
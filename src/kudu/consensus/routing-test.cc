@@ -20,15 +20,26 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <gtest/gtest.h>
 
 #include "kudu/consensus/consensus-test-util.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/pb_util.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
 
+DECLARE_bool(raft_precompute_next_hops);
+
+using kudu::pb_util::SecureShortDebugString;
 using std::string;
 using std::unique_ptr;
 using std::unordered_map;
+using std::vector;
+using strings::Substitute;
 
 namespace kudu {
 namespace consensus {
@@ -103,5 +114,127 @@ TEST(RoutingTest, TestStaleRouter) {
   ASSERT_EQ("peer-2", next_hop); // Direct routing fallback.
 }
 
+// Tests that each remote region is proxied through its cheapest healthy peer,
+// and that a region's proxy is kept until it degrades or is clearly beaten.
+TEST(RoutingTest, TestCostBasedProxyTopology) {
+  RaftConfigPB raft_config = BuildRaftConfigPBForTests(/*num_voters=*/6);
+  // peer-0 (the leader) and peer-1 are in region "a", peer-2, peer-3 and
+  // peer-4 in region "b", and peer-5 alone in region "c".
+  const char* const kRegions[] = { "a", "a", "b", "b", "b", "c" };
+  for (int i = 0; i < raft_config.peers_size(); i++) {
+    raft_config.mutable_peers(i)->mutable_attrs()->set_region(kRegions[i]);
+  }
+  const string kLeaderUuid = "peer-0";
+
+  unordered_map<string, PeerLinkCost> costs;
+  for (int i = 1; i < raft_config.peers_size(); i++) {
+    PeerLinkCost& cost = costs[raft_config.peers(i).permanent_uuid()];
+    cost.rtt_us = 1000 * i;
+    cost.healthy = true;
+  }
+  costs["peer-3"].rtt_us = 1000;
+
+  // peer-3 is the fastest in region "b"; the other regions go direct.
+  ProxyTopologyPB topology = BuildCostBasedProxyTopology(
+      raft_config, kLeaderUuid, costs, ProxyTopologyPB(), /*switch_cost_ratio=*/1.5);
+  ProxyTopologyPB expected;
+  AddEdge(&expected, /*to=*/"peer-2", /*proxy_from=*/"peer-3");
+  AddEdge(&expected, /*to=*/"peer-4", /*proxy_from=*/"peer-3");
+  ASSERT_EQ(SecureShortDebugString(expected), SecureShortDebugString(topology));
+
+  // A slightly faster candidate doesn't displace the current proxy.
+  costs["peer-2"].rtt_us = 800;
+  topology = BuildCostBasedProxyTopology(
+      raft_config, kLeaderUuid, costs, topology, /*switch_cost_ratio=*/1.5);
+  ASSERT_EQ(SecureShortDebugString(expected), SecureShortDebugString(topology));
+
+  // Once the current proxy degrades, the next cheapest peer takes over.
+  costs["peer-3"].healthy = false;
+  topology = BuildCostBasedProxyTopology(
+      raft_config, kLeaderUuid, costs, topology, /*switch_cost_ratio=*/1.5);
+  expected.Clear();
+  AddEdge(&expected, /*to=*/"peer-3", /*proxy_from=*/"peer-2");
+  AddEdge(&expected, /*to=*/"peer-4", /*proxy_from=*/"peer-2");
+  ASSERT_EQ(SecureShortDebugString(expected), SecureShortDebugString(topology));
+
+  // A peer without a database can't proxy, and a region without any healthy
+  // candidate is shipped to directly.
+  raft_config.mutable_peers(2)->mutable_attrs()->set_backing_db_present(false);
+  costs["peer-4"].healthy = false;
+  topology = BuildCostBasedProxyTopology(
+      raft_config, kLeaderUuid, costs, topology, /*switch_cost_ratio=*/1.5);
+  ASSERT_EQ(0, topology.proxy_edges_size());
+}
+
+// Tests that the precomputed next hops agree with the routing tables as they
+// change, and compares the cost of looking them up in a large config.
+TEST(RoutingTest, TestPrecomputedNextHops) {
+  const int kNumPeers = 128;
+  const int kNumRegions = 8;
+  const int kLookups = AllowSlowTests() ? 10000000 : 500000;
+  RaftConfigPB raft_config = BuildRaftConfigPBForTests(kNumPeers);
+  raft_config.set_opid_index(1);
+  // The first peer of each region is backed by a database and proxies for
+  // the others.
+  for (int i = 0; i < kNumPeers; i++) {
+    RaftPeerAttrsPB* attrs = raft_config.mutable_peers(i)->mutable_attrs();
+    attrs->set_region(Substitute("region-$0", i % kNumRegions));
+    attrs->set_backing_db_present(i < kNumRegions);
+  }
+  vector<string> uuids;
+  for (const RaftPeerPB& peer : raft_config.peers()) {
+    uuids.push_back(peer.permanent_uuid());
+  }
+
+  RoutingTableContainer container(ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY,
+                                  raft_config.peers(0), raft_config,
+                                  /*drt=*/nullptr);
+  container.UpdateLeader("peer-0");
+
+  auto verify_next_hops = [&]() {
+    string expected;
+    string actual;
+    for (const string& src : uuids) {
+      for (const string& dest : uuids) {
+        FLAGS_raft_precompute_next_hops = false;
+        ASSERT_OK(container.NextHop(src, dest, &expected));
+        FLAGS_raft_precompute_next_hops = true;
+        ASSERT_OK(container.NextHop(src, dest, &actual));
+        ASSERT_EQ(expected, actual) << src << " -> " << dest;
+      }
+    }
+  };
+  NO_FATALS(verify_next_hops());
+  string next_hop;
+  ASSERT_OK(container.NextHop("peer-0", "peer-9", &next_hop));
+  ASSERT_EQ("peer-1", next_hop);
+
+  // Peers which aren't in the config go to the routing table.
+  ASSERT_OK(container.NextHop("peer-0", "bogus", &next_hop));
+  ASSERT_EQ("bogus", next_hop);
+
+  // The same goes after the proxy in region-1 leaves the config.
+  raft_config.mutable_peers()->DeleteSubrange(1, 1);
+  raft_config.set_opid_index(2);
+  uuids.erase(uuids.begin() + 1);
+  ASSERT_OK(container.UpdateRaftConfig(raft_config));
+  NO_FATALS(verify_next_hops());
+  ASSERT_OK(container.NextHop("peer-0", "peer-9", &next_hop));
+  ASSERT_EQ("peer-9", next_hop);
+
+  for (bool precompute : { false, true }) {
+    FLAGS_raft_precompute_next_hops = precompute;
+    Stopwatch sw;
+    sw.start();
+    for (int n = 0; n < kLookups; n++) {
+      const string& dest = uuids[(n * 7919L) % uuids.size()];
+      CHECK_OK(container.NextHop(uuids[0], dest, &next_hop));
+    }
+    sw.stop();
+    LOG(INFO) << (precompute ? "precomputed" : "routing table") << ": "
+              << (kLookups / sw.elapsed().wall_seconds()) << " lookups/sec";
+  }
+}
+
 } // namespace consensus
 } // namespace kudu
@@ -17,8 +17,10 @@
 
 #include "kudu/consensus/routing.h"
 
+#include <algorithm>
 #include <unordered_set>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <google/protobuf/util/message_differencer.h>
 
@@ -29,6 +31,7 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/env.h"
 #include "kudu/util/env_util.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/pb_util.h"
@@ -46,6 +49,13 @@ using std::unordered_set;
 using std::vector;
 using strings::Substitute;
 
+DEFINE_bool(raft_precompute_next_hops, false,
+            "Whether to precompute the next hop between every pair of peers "
+            "whenever the routing tables change, so that looking up the next "
+            "hop of a request takes no locks.");
+TAG_FLAG(raft_precompute_next_hops, experimental);
+TAG_FLAG(raft_precompute_next_hops, runtime);
+
 namespace kudu {
 namespace consensus {
 
@@ -533,7 +543,7 @@ Status SimpleRegionRoutingTable::RebuildProxyTopology(RaftConfigPB raft_config)
   // Take a copy of current map
   std::unordered_map<std::string, std::string> current_dst_to_proxy_map;
   {
-    shared_lock<RWMutex> l(lock_);
+    shared_lock<PerCpuRWMutex> l(lock_);
     current_dst_to_proxy_map = dst_to_proxy_map_;
   }
 
@@ -611,7 +621,7 @@ Status SimpleRegionRoutingTable::RebuildProxyTopology(RaftConfigPB raft_config)
     }
   }
 
-  std::lock_guard<RWMutex> l(lock_);
+  std::lock_guard<PerCpuRWMutex> l(lock_);
   proxy_topology_ = std::move(proxy_topology);
   dst_to_proxy_map_ = std::move(dst_to_proxy_map);
   peer_region_map_ = std::move(peer_region_map);
@@ -623,7 +633,7 @@ Status SimpleRegionRoutingTable::RebuildProxyTopology(RaftConfigPB raft_config)
 Status SimpleRegionRoutingTable::NextHop(const std::string& src_uuid,
                                          const std::string& dest_uuid,
                                          std::string* next_hop) const {
-  shared_lock<RWMutex> l(lock_);
+  shared_lock<PerCpuRWMutex> l(lock_);
   const auto& proxy_uuid = dst_to_proxy_map_.find(dest_uuid);
   if (proxy_uuid == dst_to_proxy_map_.end()) {
     // Could not find this destination, route directly to the destination
@@ -644,7 +654,7 @@ Status SimpleRegionRoutingTable::UpdateProxyTopology(
 }
 
 ProxyTopologyPB SimpleRegionRoutingTable::GetProxyTopology() const {
-  shared_lock<RWMutex> l(lock_);
+  shared_lock<PerCpuRWMutex> l(lock_);
   return proxy_topology_;
 }
 
@@ -653,12 +663,12 @@ Status SimpleRegionRoutingTable::UpdateRaftConfig(RaftConfigPB raft_config) {
 }
 
 void SimpleRegionRoutingTable::UpdateLeader(string leader_uuid) {
-  std::lock_guard<RWMutex> l(lock_);
+  std::lock_guard<PerCpuRWMutex> l(lock_);
   leader_uuid_ = std::move(leader_uuid);
 }
 
 void SimpleRegionRoutingTable::SetLocalPeerPB(RaftPeerPB local_peer_pb) {
-  std::lock_guard<RWMutex> l(lock_);
+  std::lock_guard<PerCpuRWMutex> l(lock_);
   local_peer_pb_ = std::move(local_peer_pb);
 }
 
@@ -666,9 +676,53 @@ ProxyPolicy SimpleRegionRoutingTable::GetProxyPolicy() const {
   return ProxyPolicy::SIMPLE_REGION_ROUTING_POLICY;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// NextHopTable
+////////////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<const NextHopTable> NextHopTable::Build(
+    const RaftConfigPB& raft_config,
+    const NextHopFunc& next_hop_fn) {
+  std::shared_ptr<NextHopTable> table(new NextHopTable());
+  for (const RaftPeerPB& peer : raft_config.peers()) {
+    if (InsertIfNotPresent(&table->index_, peer.permanent_uuid(),
+                           static_cast<int>(table->uuids_.size()))) {
+      table->uuids_.push_back(peer.permanent_uuid());
+    }
+  }
+
+  const size_t num_peers = table->uuids_.size();
+  table->next_hops_.assign(num_peers * num_peers, -1);
+  string next_hop;
+  for (size_t src = 0; src < num_peers; src++) {
+    for (size_t dest = 0; dest < num_peers; dest++) {
+      if (!next_hop_fn(table->uuids_[src], table->uuids_[dest], &next_hop).ok()) {
+        continue;
+      }
+      const int* hop_index = FindOrNull(table->index_, next_hop);
+      if (hop_index != nullptr) {
+        table->next_hops_[src * num_peers + dest] = *hop_index;
+      }
+    }
+  }
+  return table;
+}
+
+const string* NextHopTable::Lookup(const string& src_uuid,
+                                   const string& dest_uuid) const {
+  const int* src = FindOrNull(index_, src_uuid);
+  const int* dest = FindOrNull(index_, dest_uuid);
+  if (src == nullptr || dest == nullptr) {
+    return nullptr;
+  }
+  int hop = next_hops_[*src * uuids_.size() + *dest];
+  return hop < 0 ? nullptr : &uuids_[hop];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // RoutingTableContainer implementation
 ////////////////////////////////////////////////////////////////////////////////
+
 RoutingTableContainer::RoutingTableContainer(
       const ProxyPolicy& proxy_policy,
       const RaftPeerPB& local_peer_pb,
@@ -680,11 +734,32 @@ RoutingTableContainer::RoutingTableContainer(
   std::shared_ptr<SimpleRegionRoutingTable> srt;
   SimpleRegionRoutingTable::Create(raft_config, local_peer_pb, &srt);
   srt_ = std::move(srt);
+
+  std::lock_guard<std::mutex> l(update_lock_);
+  raft_config_ = std::move(raft_config);
+  RebuildNextHopsUnlocked();
 }
 
 Status RoutingTableContainer::NextHop(const std::string& src_uuid,
                                       const std::string& dest_uuid,
                                       std::string* next_hop) const {
+  if (FLAGS_raft_precompute_next_hops) {
+    std::shared_ptr<const NextHopTable> next_hops =
+        std::atomic_load_explicit(&next_hops_, std::memory_order_acquire);
+    const string* hop = next_hops ? next_hops->Lookup(src_uuid, dest_uuid) : nullptr;
+    if (hop != nullptr) {
+      *next_hop = *hop;
+      return Status::OK();
+    }
+  }
+  // Pairs without a precomputed hop go to the routing table, so that it
+  // returns the same errors it always has.
+  return ComputeNextHop(src_uuid, dest_uuid, next_hop);
+}
+
+Status RoutingTableContainer::ComputeNextHop(const std::string& src_uuid,
+                                             const std::string& dest_uuid,
+                                             std::string* next_hop) const {
   ProxyPolicy policy = proxy_policy_.load();
 
   switch (policy) {
@@ -708,7 +783,10 @@ Status RoutingTableContainer::UpdateProxyTopology(
     const std::string& leader_uuid) {
   // Explicit routing topology can only be used by durable routing table
   // Update the leader uuid before updating proxy_topology
+  std::lock_guard<std::mutex> l(update_lock_);
+  SCOPED_CLEANUP({ RebuildNextHopsUnlocked(); });
   drt_->UpdateLeader(leader_uuid);
+  raft_config_ = raft_config;
   RETURN_NOT_OK(drt_->UpdateRaftConfig(std::move(raft_config)));
   return drt_->UpdateProxyTopology(std::move(proxy_topology));
 }
@@ -731,6 +809,9 @@ ProxyTopologyPB RoutingTableContainer::GetProxyTopology() const {
 }
 
 Status RoutingTableContainer::UpdateRaftConfig(RaftConfigPB raft_config) {
+  std::lock_guard<std::mutex> l(update_lock_);
+  SCOPED_CLEANUP({ RebuildNextHopsUnlocked(); });
+  raft_config_ = raft_config;
   ProxyPolicy policy = proxy_policy_.load();
 
   switch (policy) {
@@ -746,6 +827,8 @@ Status RoutingTableContainer::UpdateRaftConfig(RaftConfigPB raft_config) {
 }
 
 void RoutingTableContainer::UpdateLeader(string leader_uuid) {
+  std::lock_guard<std::mutex> l(update_lock_);
+  SCOPED_CLEANUP({ RebuildNextHopsUnlocked(); });
   ProxyPolicy policy = proxy_policy_.load();
 
   switch (policy) {
@@ -761,6 +844,8 @@ void RoutingTableContainer::UpdateLeader(string leader_uuid) {
 }
 
 void RoutingTableContainer::SetLocalPeerPB(RaftPeerPB local_peer_pb) {
+  std::lock_guard<std::mutex> l(update_lock_);
+  SCOPED_CLEANUP({ RebuildNextHopsUnlocked(); });
   ProxyPolicy policy = proxy_policy_.load();
 
   switch (policy) {
@@ -782,6 +867,9 @@ Status RoutingTableContainer::SetProxyPolicy(
     const ProxyPolicy& proxy_policy,
     const std::string& leader_uuid,
     RaftConfigPB raft_config) {
+  std::lock_guard<std::mutex> l(update_lock_);
+  SCOPED_CLEANUP({ RebuildNextHopsUnlocked(); });
+  raft_config_ = raft_config;
   drt_->UpdateLeader(leader_uuid);
   srt_->UpdateLeader(leader_uuid);
 
@@ -793,6 +881,16 @@ Status RoutingTableContainer::SetProxyPolicy(
   return Status::OK();
 }
 
+void RoutingTableContainer::RebuildNextHopsUnlocked() {
+  std::shared_ptr<const NextHopTable> next_hops = NextHopTable::Build(
+      raft_config_,
+      [this](const string& src_uuid, const string& dest_uuid, string* next_hop) {
+        return ComputeNextHop(src_uuid, dest_uuid, next_hop);
+      });
+  std::atomic_store_explicit(&next_hops_, std::move(next_hops),
+                             std::memory_order_release);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Global functions.
 ////////////////////////////////////////////////////////////////////////////////
@@ -820,5 +918,114 @@ Status VerifyProxyTopology(const ProxyTopologyPB& proxy_topology) {
   return Status::OK();
 }
 
+ProxyTopologyPB BuildCostBasedProxyTopology(
+    const RaftConfigPB& raft_config,
+    const string& leader_uuid,
+    const unordered_map<string, PeerLinkCost>& link_costs,
+    const ProxyTopologyPB& current_topology,
+    double switch_cost_ratio) {
+  ProxyTopologyPB proxy_topology;
+  const RaftPeerPB* leader_pb = nullptr;
+  unordered_map<string, vector<const RaftPeerPB*>> region_peers;
+  for (const RaftPeerPB& peer : raft_config.peers()) {
+    if (peer.permanent_uuid() == leader_uuid) {
+      leader_pb = &peer;
+      continue;
+    }
+    region_peers[peer.attrs().region()].push_back(&peer);
+  }
+  if (leader_pb == nullptr) {
+    // Without the leader in the config there is nothing to route from.
+    return proxy_topology;
+  }
+
+  // The proxy each peer currently gets its requests from.
+  unordered_map<string, string> current_proxies;
+  for (const ProxyEdgePB& edge : current_topology.proxy_edges()) {
+    current_proxies.emplace(edge.peer_uuid(), edge.proxy_from_uuid());
+  }
+
+  // Returns the link cost of a peer which may proxy, or nullptr if it may not.
+  auto candidate_cost = [&](const RaftPeerPB& peer) -> const PeerLinkCost* {
+    if (!peer.attrs().backing_db_present()) {
+      return nullptr;
+    }
+    const PeerLinkCost* cost = FindOrNull(link_costs, peer.permanent_uuid());
+    if (cost == nullptr || !cost->healthy || cost->rtt_us <= 0) {
+      return nullptr;
+    }
+    return cost;
+  };
+
+  for (const auto& entry : region_peers) {
+    const string& region = entry.first;
+    const vector<const RaftPeerPB*>& peers = entry.second;
+    // Peers in the leader's region are shipped to directly, and proxying
+    // saves nothing for a region with a single peer (rules #1 and #2).
+    if (region == leader_pb->attrs().region() || peers.size() < 2) {
+      continue;
+    }
+
+    const RaftPeerPB* best = nullptr;
+    const PeerLinkCost* best_cost = nullptr;
+    const RaftPeerPB* current = nullptr;
+    const PeerLinkCost* current_cost = nullptr;
+    for (const RaftPeerPB* peer : peers) {
+      const PeerLinkCost* cost = candidate_cost(*peer);
+      if (cost == nullptr) {
+        continue;
+      }
+      if (best == nullptr || cost->rtt_us < best_cost->rtt_us ||
+          (cost->rtt_us == best_cost->rtt_us &&
+           (cost->throughput_bytes_per_sec > best_cost->throughput_bytes_per_sec ||
+            (cost->throughput_bytes_per_sec == best_cost->throughput_bytes_per_sec &&
+             peer->permanent_uuid() < best->permanent_uuid())))) {
+        best = peer;
+        best_cost = cost;
+      }
+      if (current == nullptr) {
+        for (const RaftPeerPB* other : peers) {
+          const string* proxy = FindOrNull(current_proxies, other->permanent_uuid());
+          if (proxy != nullptr && *proxy == peer->permanent_uuid()) {
+            current = peer;
+            current_cost = cost;
+            break;
+          }
+        }
+      }
+    }
+    if (best == nullptr) {
+      // No peer of the region can proxy for it (rule #3).
+      continue;
+    }
+    if (current != nullptr &&
+        current_cost->rtt_us <= best_cost->rtt_us * switch_cost_ratio) {
+      best = current;
+    }
+
+    for (const RaftPeerPB* peer : peers) {
+      if (peer == best) {
+        continue;
+      }
+      ProxyEdgePB* edge = proxy_topology.add_proxy_edges();
+      edge->set_peer_uuid(peer->permanent_uuid());
+      edge->set_proxy_from_uuid(best->permanent_uuid());
+    }
+  }
+
+  // Keep the edges in config order, so that an unchanged topology compares
+  // equal to the one it was built from.
+  unordered_map<string, int> config_order;
+  for (int i = 0; i < raft_config.peers_size(); i++) {
+    config_order.emplace(raft_config.peers(i).permanent_uuid(), i);
+  }
+  std::sort(proxy_topology.mutable_proxy_edges()->begin(),
+            proxy_topology.mutable_proxy_edges()->end(),
+            [&](const ProxyEdgePB& a, const ProxyEdgePB& b) {
+              return config_order[a.peer_uuid()] < config_order[b.peer_uuid()];
+            });
+  return proxy_topology;
+}
+
 } // namespace consensus
 } // namespace kudu
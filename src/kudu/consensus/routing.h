@@ -17,17 +17,21 @@
 
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <boost/optional/optional.hpp>
 
 #include "kudu/consensus/metadata.pb.h"
 #include "kudu/consensus/proxy_policy.h"
 #include "kudu/fs/fs_manager.h"
+#include "kudu/util/percpu_rw_mutex.h"
 #include "kudu/util/rwc_lock.h"
-#include "kudu/util/rw_mutex.h"
 
 namespace kudu {
 
@@ -299,8 +303,9 @@ class SimpleRegionRoutingTable : public IRoutingTable {
  private:
   Status RebuildProxyTopology(RaftConfigPB raft_config);
 
-  // Lock protecting below fields
-  mutable RWMutex lock_;
+  // Lock protecting below fields. Read on the routing of every request, and
+  // only written on config changes.
+  mutable PerCpuRWMutex lock_;
   ProxyTopologyPB proxy_topology_;
   RaftConfigPB raft_config_;
   RaftPeerPB local_peer_pb_;
@@ -309,6 +314,38 @@ class SimpleRegionRoutingTable : public IRoutingTable {
   std::unordered_map<std::string, std::string> dst_to_proxy_map_;
 };
 
+// An immutable table of the next hop from each member of a Raft config to
+// each other member, computed up front so that it can be looked up without
+// taking any locks or walking a routing tree.
+class NextHopTable {
+ public:
+  typedef std::function<Status(const std::string& src_uuid,
+                               const std::string& dest_uuid,
+                               std::string* next_hop)> NextHopFunc;
+
+  // Builds the table from the next hops which 'next_hop_fn' returns for each
+  // pair of members of 'raft_config'. Pairs for which it fails are left out.
+  static std::shared_ptr<const NextHopTable> Build(const RaftConfigPB& raft_config,
+                                                   const NextHopFunc& next_hop_fn);
+
+  // Returns the next hop from 'src_uuid' to 'dest_uuid', or nullptr if the
+  // pair isn't in the table.
+  const std::string* Lookup(const std::string& src_uuid,
+                            const std::string& dest_uuid) const;
+
+ private:
+  NextHopTable() = default;
+
+  // The members of the config, and their positions in 'uuids_'.
+  std::vector<std::string> uuids_;
+  std::unordered_map<std::string, int> index_;
+
+  // The position in 'uuids_' of the next hop from the member at position
+  // 'src' to the one at position 'dest', at 'src * uuids_.size() + dest', or
+  // -1 if there is none.
+  std::vector<int> next_hops_;
+};
+
 // A container to hols all available routing tables (implemented based on
 // routing policy). All routing tables are created during bootstrap. The table
 // that gets used for routing is based on 'proxy_policy_'.
@@ -359,9 +396,27 @@ class RoutingTableContainer {
                         const std::string& leader_uuid,
                         RaftConfigPB raft_config);
  private:
+  // Asks the routing table of the current proxy policy for the next hop.
+  Status ComputeNextHop(const std::string& src_uuid,
+                        const std::string& dest_uuid,
+                        std::string* next_hop) const;
+
+  // Recomputes 'next_hops_' for 'raft_config_' after a change to the
+  // routing tables. 'update_lock_' must be held.
+  void RebuildNextHopsUnlocked();
+
   std::atomic<ProxyPolicy> proxy_policy_;
   std::shared_ptr<SimpleRegionRoutingTable> srt_;
   std::shared_ptr<DurableRoutingTable> drt_;
+
+  // Serializes the updates to the routing tables, and protects 'raft_config_',
+  // the config which 'next_hops_' covers.
+  std::mutex update_lock_;
+  RaftConfigPB raft_config_;
+
+  // The next hops precomputed for --raft_precompute_next_hops. Read and
+  // replaced with std::atomic_load/store.
+  std::shared_ptr<const NextHopTable> next_hops_;
 };
 
 // Verify that a ProxyTopologyPB is well-formed.
@@ -369,5 +424,38 @@ class RoutingTableContainer {
 // Does not attempt to perform multi-hop loop detection because the final
 // routing topology is not defined without a Raft config and leader.
 Status VerifyProxyTopology(const ProxyTopologyPB& proxy_topology);
+
+// The cost of the leader's link to a peer, as measured by the leader.
+struct PeerLinkCost {
+  // Smoothed round trip time of requests to the peer, or zero if it hasn't
+  // been measured yet.
+  int64_t rtt_us = 0;
+
+  // Smoothed rate at which the peer acks the ops sent to it, or zero if it
+  // hasn't been measured yet.
+  int64_t throughput_bytes_per_sec = 0;
+
+  // Whether the peer is reachable and keeping up well enough to proxy for
+  // others.
+  bool healthy = false;
+};
+
+// Builds a proxy topology for DURABLE_ROUTING_POLICY from the measured costs
+// of the leader's links, keyed by peer uuid, so that the leader ships each op
+// once per remote region rather than once per remote peer:
+// 1. Peers in the leader's region get their requests directly.
+// 2. In each other region with more than one peer, the healthy peer backed
+//    by a database with the lowest RTT from the leader (the higher throughput
+//    breaking ties) proxies for the rest of the region.
+// 3. A region without such a peer is shipped to directly.
+// To avoid flapping, the region's proxy in 'current_topology' is kept while
+// it stays healthy and its RTT is within 'switch_cost_ratio' times that of
+// the best candidate.
+ProxyTopologyPB BuildCostBasedProxyTopology(
+    const RaftConfigPB& raft_config,
+    const std::string& leader_uuid,
+    const std::unordered_map<std::string, PeerLinkCost>& link_costs,
+    const ProxyTopologyPB& current_topology,
+    double switch_cost_ratio);
 }  // namespace consensus
 }  // namespace kudu
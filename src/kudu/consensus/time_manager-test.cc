@@ -84,8 +84,8 @@ TEST_F(TimeManagerTest, TestTimeManagerNonLeaderMode) {
   Timestamp init(before.value() + 1);
   Timestamp after(init.value() + 1);
   InitTimeManager(init);
-  ASSERT_EQ(time_manager_->mode_, TimeManager::NON_LEADER);
-  ASSERT_EQ(time_manager_->last_serial_ts_assigned_, init);
+  ASSERT_EQ(time_manager_->mode_.load(), TimeManager::NON_LEADER);
+  ASSERT_EQ(time_manager_->last_serial_ts_assigned_.load(), init.value());
   ASSERT_EQ(time_manager_->GetSafeTime(), init);
 
   // Check that 'before' is safe, as is 'init'. 'after' shouldn't be safe.
@@ -100,7 +100,7 @@ TEST_F(TimeManagerTest, TestTimeManagerNonLeaderMode) {
   message.set_timestamp(after.value());
   // Should accept messages from the leader.
   ASSERT_OK(time_manager_->MessageReceivedFromLeader(message));
-  ASSERT_EQ(time_manager_->last_serial_ts_assigned_, after);
+  ASSERT_EQ(time_manager_->last_serial_ts_assigned_.load(), after.value());
   // .. but shouldn't advance safe time (until we have leader leases).
   ASSERT_EQ(time_manager_->GetSafeTime(), init);
 
@@ -204,5 +204,58 @@ TEST_F(TimeManagerTest, TestTimeManagerLeaderMode) {
   after_latch->Wait();
 }
 
+// Tests that a batch of messages gets increasing timestamps, and that safe time stays pinned
+// until the last of them is appended.
+TEST_F(TimeManagerTest, TestAssignTimestamps) {
+  InitTimeManager();
+  std::vector<ReplicateMsg*> messages;
+  std::vector<unique_ptr<ReplicateMsg>> owned;
+  for (int i = 0; i < 10; i++) {
+    owned.emplace_back(new ReplicateMsg);
+    messages.push_back(owned.back().get());
+  }
+  ASSERT_TRUE(time_manager_->AssignTimestamps(messages).IsIllegalState());
+
+  time_manager_->SetLeaderMode();
+  Timestamp safe_before = time_manager_->GetSafeTime();
+  ASSERT_OK(time_manager_->AssignTimestamps(messages));
+  for (int i = 0; i < messages.size(); i++) {
+    ASSERT_TRUE(messages[i]->has_timestamp());
+    if (i > 0) ASSERT_GT(messages[i]->timestamp(), messages[i - 1]->timestamp());
+  }
+  ASSERT_GT(Timestamp(messages.front()->timestamp()), safe_before);
+  ASSERT_EQ(time_manager_->GetSafeTime(), safe_before);
+
+  time_manager_->AdvanceSafeTimeWithMessage(*messages.back());
+  ASSERT_GT(time_manager_->GetSafeTime(), Timestamp(messages.back()->timestamp()));
+}
+
+// Tests that advancing safe time wakes exactly the waiters whose timestamps it crosses,
+// regardless of the order in which they started waiting.
+TEST_F(TimeManagerTest, TestWaitersWokenInTimestampOrder) {
+  Timestamp init = clock_->Now();
+  InitTimeManager(init);
+  Timestamp ts1(init.value() + 1);
+  Timestamp ts2(init.value() + 2);
+  Timestamp ts3(init.value() + 3);
+  CountDownLatch* latch3 = WaitForSafeTimeAsync(ts3);
+  CountDownLatch* latch1 = WaitForSafeTimeAsync(ts1);
+  CountDownLatch* latch2 = WaitForSafeTimeAsync(ts2);
+
+  time_manager_->AdvanceSafeTime(ts1);
+  latch1->Wait();
+  ASSERT_FALSE(latch2->WaitFor(MonoDelta::FromMilliseconds(50)));
+  ASSERT_FALSE(latch3->WaitFor(MonoDelta::FromMilliseconds(50)));
+
+  // Not advancing safe time wakes no one.
+  time_manager_->AdvanceSafeTime(init);
+  ASSERT_FALSE(latch2->WaitFor(MonoDelta::FromMilliseconds(50)));
+
+  time_manager_->AdvanceSafeTime(ts3);
+  latch2->Wait();
+  latch3->Wait();
+  ASSERT_EQ(ts3, time_manager_->GetSafeTime());
+}
+
 } // namespace consensus
 } // namespace kudu
@@ -22,9 +22,11 @@
 // ********************************************************************
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <mutex>
 #include <ostream>
+#include <vector>
 
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
@@ -81,16 +83,19 @@ ExternalConsistencyMode TimeManager::GetMessageConsistencyMode(const ReplicateMs
 }
 
 TimeManager::TimeManager(scoped_refptr<Clock> clock, Timestamp initial_safe_time)
-  : last_serial_ts_assigned_(initial_safe_time),
-    last_safe_ts_(initial_safe_time),
+  : min_waiter_ts_(Timestamp::kMax.value()),
+    last_serial_ts_assigned_(initial_safe_time.value()),
+    last_safe_ts_(initial_safe_time.value()),
     last_advanced_safe_time_(MonoTime::Now()),
     mode_(NON_LEADER),
     clock_(std::move(clock)) {}
 
 void TimeManager::SetLeaderMode() {
-  Lock l(lock_);
-  mode_ = LEADER;
-  AdvanceSafeTimeAndWakeUpWaitersUnlocked(clock_->Now());
+  {
+    Lock l(lock_);
+    mode_ = LEADER;
+  }
+  AdvanceSafeTimeAndWakeUpWaiters(clock_->Now());
 }
 
 void TimeManager::SetNonLeaderMode() {
@@ -103,7 +108,7 @@ Status TimeManager::AssignTimestamp(ReplicateMsg* message) {
   if (PREDICT_FALSE(mode_ == NON_LEADER)) {
     return Status::IllegalState(Substitute("Cannot assign timestamp to transaction. Tablet is not "
                                            "in leader mode. Last heard from a leader: $0 secs ago.",
-                                           last_advanced_safe_time_.ToString()));
+                                           last_advanced_safe_time_.load().ToString()));
   }
   Timestamp t;
   switch (GetMessageConsistencyMode(*message)) {
@@ -115,6 +120,39 @@ Status TimeManager::AssignTimestamp(ReplicateMsg* message) {
   return Status::OK();
 }
 
+Status TimeManager::AssignTimestamps(const std::vector<ReplicateMsg*>& messages) {
+  Lock l(lock_);
+  if (PREDICT_FALSE(mode_ == NON_LEADER)) {
+    return Status::IllegalState(Substitute("Cannot assign timestamps to transactions. Tablet is "
+                                           "not in leader mode. Last heard from a leader: $0 secs "
+                                           "ago.", last_advanced_safe_time_.load().ToString()));
+  }
+  int num_serial = 0;
+  for (const ReplicateMsg* message : messages) {
+    switch (GetMessageConsistencyMode(*message)) {
+      case COMMIT_WAIT: break;
+      case CLIENT_PROPAGATED: num_serial++; break;
+      default: return Status::NotSupported("Unsupported external consistency mode.");
+    }
+  }
+  std::vector<Timestamp> serial_timestamps;
+  if (num_serial > 0) {
+    clock_->NowBatch(num_serial, &serial_timestamps);
+  }
+  auto next_serial = serial_timestamps.begin();
+  for (ReplicateMsg* message : messages) {
+    if (GetMessageConsistencyMode(*message) == COMMIT_WAIT) {
+      message->set_timestamp(GetSerialTimestampPlusMaxError().value());
+    } else {
+      message->set_timestamp((next_serial++)->value());
+    }
+  }
+  if (num_serial > 0) {
+    last_serial_ts_assigned_.store(serial_timestamps.back().value(), std::memory_order_relaxed);
+  }
+  return Status::OK();
+}
+
 Status TimeManager::MessageReceivedFromLeader(const ReplicateMsg& message) {
   // NOTE: Currently this method just updates the clock and stores the message's timestamp.
   //       It always returns Status::OK() if the clock returns an OK status on Update().
@@ -135,33 +173,28 @@ Status TimeManager::MessageReceivedFromLeader(const ReplicateMsg& message) {
   DCHECK(message.has_timestamp());
   Timestamp t(message.timestamp());
   RETURN_NOT_OK(clock_->Update(t));
-  {
-    Lock l(lock_);
-    CHECK_EQ(mode_, NON_LEADER) << "Cannot receive messages from a leader in leader mode.";
-    if (GetMessageConsistencyMode(message) == CLIENT_PROPAGATED) {
-      last_serial_ts_assigned_ = t;
-    }
+  // The last assigned timestamp only matters in leader mode, so there is nothing to serialize
+  // with here.
+  CHECK_EQ(mode_.load(), NON_LEADER) << "Cannot receive messages from a leader in leader mode.";
+  if (GetMessageConsistencyMode(message) == CLIENT_PROPAGATED) {
+    last_serial_ts_assigned_.store(t.value(), std::memory_order_relaxed);
   }
   return Status::OK();
 }
 
 void TimeManager::AdvanceSafeTimeWithMessage(const ReplicateMsg& message) {
-  Lock l(lock_);
   if (GetMessageConsistencyMode(message) == CLIENT_PROPAGATED) {
-    AdvanceSafeTimeAndWakeUpWaitersUnlocked(Timestamp(message.timestamp()));
+    AdvanceSafeTimeAndWakeUpWaiters(Timestamp(message.timestamp()));
   }
 }
 
 void TimeManager::AdvanceSafeTime(Timestamp safe_time) {
-  Lock l(lock_);
-  CHECK_EQ(mode_, NON_LEADER) << "Cannot advance safe time by timestamp in leader mode.";;
-  AdvanceSafeTimeAndWakeUpWaitersUnlocked(safe_time);
+  CHECK_EQ(mode_.load(), NON_LEADER) << "Cannot advance safe time by timestamp in leader mode.";
+  AdvanceSafeTimeAndWakeUpWaiters(safe_time);
 }
 
-bool TimeManager::HasAdvancedSafeTimeRecentlyUnlocked(string* error_message) {
-  DCHECK(lock_.is_locked());
-
-  MonoDelta time_since_last_advance = MonoTime::Now() - last_advanced_safe_time_;
+bool TimeManager::HasAdvancedSafeTimeRecently(string* error_message) {
+  MonoDelta time_since_last_advance = MonoTime::Now() - last_advanced_safe_time_.load();
   int64_t max_last_advanced = FLAGS_missed_heartbeats_before_rejecting_snapshot_scans *
       FLAGS_raft_heartbeat_interval_ms;
   // Clamp max_last_advanced to 100 ms. Some tests set leader election timeouts really
@@ -177,13 +210,11 @@ bool TimeManager::HasAdvancedSafeTimeRecentlyUnlocked(string* error_message) {
   return true;
 }
 
-bool TimeManager::IsSafeTimeLaggingUnlocked(Timestamp timestamp, string* error_message) {
-  DCHECK(lock_.is_locked());
-
+bool TimeManager::IsSafeTimeLagging(Timestamp timestamp, string* error_message) {
   // Can't calculate safe time lag for the logical clock.
   if (PREDICT_FALSE(!clock_->HasPhysicalComponent())) return false;
-  MonoDelta safe_time_diff = clock_->GetPhysicalComponentDifference(timestamp,
-                                                                    last_safe_ts_);
+  MonoDelta safe_time_diff = clock_->GetPhysicalComponentDifference(
+      timestamp, Timestamp(last_safe_ts_.load(std::memory_order_acquire)));
   if (safe_time_diff.ToMilliseconds() > FLAGS_safe_time_max_lag_ms) {
     *error_message = Substitute("Tablet is lagging too much to be able to serve snapshot scan. "
                                 "Lagging by: $0 ms, (max is $1 ms):",
@@ -194,15 +225,14 @@ bool TimeManager::IsSafeTimeLaggingUnlocked(Timestamp timestamp, string* error_m
   return false;
 }
 
-void TimeManager::MakeWaiterTimeoutMessageUnlocked(Timestamp timestamp, string* error_message) {
-  DCHECK(lock_.is_locked());
-
+void TimeManager::MakeWaiterTimeoutMessage(Timestamp timestamp, string* error_message) {
   string mode = mode_ == LEADER ? "LEADER" : "NON-LEADER";
+  Timestamp safe_ts(last_safe_ts_.load(std::memory_order_acquire));
   string clock_diff = clock_->HasPhysicalComponent() ? clock_->GetPhysicalComponentDifference(
-      timestamp, last_safe_ts_).ToString() : "None (Logical clock)";
+      timestamp, safe_ts).ToString() : "None (Logical clock)";
   *error_message = Substitute("Timed out waiting for ts: $0 to be safe (mode: $1). Current safe "
                               "time: $2 Physical time difference: $3", clock_->Stringify(timestamp),
-                              mode, clock_->Stringify(last_safe_ts_), clock_diff);
+                              mode, clock_->Stringify(safe_ts), clock_diff);
 }
 
 Status TimeManager::WaitUntilSafe(Timestamp timestamp, const MonoTime& deadline) {
@@ -212,18 +242,15 @@ Status TimeManager::WaitUntilSafe(Timestamp timestamp, const MonoTime& deadline)
   // - If this timestamp is before the last safe time return.
   // - If we're not the leader make sure we've heard from the leader recently.
   // - If we're not the leader make sure safe time isn't lagging too much.
-  {
-    Lock l(lock_);
-    if (timestamp < GetSafeTimeUnlocked()) return Status::OK();
+  if (timestamp < GetSafeTime()) return Status::OK();
 
-    if (mode_ == NON_LEADER) {
-      if (IsSafeTimeLaggingUnlocked(timestamp, &error_message)) {
-        return Status::TimedOut(error_message);
-      }
+  if (mode_ == NON_LEADER) {
+    if (IsSafeTimeLagging(timestamp, &error_message)) {
+      return Status::TimedOut(error_message);
+    }
 
-      if (!HasAdvancedSafeTimeRecentlyUnlocked(&error_message)) {
-        return Status::TimedOut(error_message);
-      }
+    if (!HasAdvancedSafeTimeRecently(&error_message)) {
+      return Status::TimedOut(error_message);
     }
   }
 
@@ -239,11 +266,18 @@ Status TimeManager::WaitUntilSafe(Timestamp timestamp, const MonoTime& deadline)
   waiter.timestamp = timestamp;
   waiter.latch = &latch;
 
-  // Register a waiter in waiters_
+  // Register a waiter in waiters_. Safe time may advance without taking 'lock_', so check it
+  // only once 'min_waiter_ts_' accounts for this waiter: any advance this check misses will see
+  // the waiter's timestamp and wake it up.
   {
     Lock l(lock_);
-    if (IsTimestampSafeUnlocked(timestamp)) return Status::OK();
     waiters_.push_back(&waiter);
+    std::push_heap(waiters_.begin(), waiters_.end(), &TimeManager::WaiterIsLater);
+    UpdateMinWaiterTimestampUnlocked();
+    if (IsTimestampSafeUnlocked(timestamp)) {
+      RemoveWaiterUnlocked(&waiter);
+      return Status::OK();
+    }
   }
 
   // Wait until we get notified or 'deadline' elapses.
@@ -255,39 +289,70 @@ Status TimeManager::WaitUntilSafe(Timestamp timestamp, const MonoTime& deadline)
     // Address the case where we were notified after the timeout.
     if (waiter.latch->count() == 0) return Status::OK();
 
-    waiters_.erase(std::find(waiters_.begin(), waiters_.end(), &waiter));
-
-    MakeWaiterTimeoutMessageUnlocked(waiter.timestamp, &error_message);
-    return Status::TimedOut(error_message);
+    RemoveWaiterUnlocked(&waiter);
   }
+  MakeWaiterTimeoutMessage(waiter.timestamp, &error_message);
+  return Status::TimedOut(error_message);
 }
 
-void TimeManager::AdvanceSafeTimeAndWakeUpWaitersUnlocked(Timestamp safe_time) {
-  DCHECK(lock_.is_locked());
+bool TimeManager::TryAdvanceSafeTime(Timestamp safe_time) {
+  uint64_t current = last_safe_ts_.load(std::memory_order_acquire);
+  while (safe_time.value() > current) {
+    if (last_safe_ts_.compare_exchange_weak(current, safe_time.value())) {
+      last_advanced_safe_time_.store(MonoTime::Now(), std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
 
-  if (safe_time <= last_safe_ts_) {
+void TimeManager::AdvanceSafeTimeAndWakeUpWaiters(Timestamp safe_time) {
+  if (!TryAdvanceSafeTime(safe_time)) {
     return;
   }
-  last_safe_ts_ = safe_time;
-  last_advanced_safe_time_ = MonoTime::Now();
-
-  if (PREDICT_FALSE(!waiters_.empty())) {
-    auto iter = waiters_.begin();
-    while (iter != waiters_.end()) {
-      WaitingState* waiter = *iter;
-      if (IsTimestampSafeUnlocked(waiter->timestamp)) {
-        iter = waiters_.erase(iter);
-        waiter->latch->CountDown();
-        continue;
-      }
-      iter++;
-    }
+  // Sequentially consistent with the store of 'min_waiter_ts_' in WaitUntilSafe(), see there.
+  if (PREDICT_TRUE(min_waiter_ts_.load() > safe_time.value())) {
+    return;
+  }
+  Lock l(lock_);
+  WakeUpWaitersUnlocked();
+}
+
+void TimeManager::WakeUpWaitersUnlocked() {
+  DCHECK(lock_.is_locked());
+
+  uint64_t safe_ts = last_safe_ts_.load();
+  while (!waiters_.empty() && waiters_.front()->timestamp.value() <= safe_ts) {
+    std::pop_heap(waiters_.begin(), waiters_.end(), &TimeManager::WaiterIsLater);
+    WaitingState* waiter = waiters_.back();
+    waiters_.pop_back();
+    waiter->latch->CountDown();
   }
+  UpdateMinWaiterTimestampUnlocked();
+}
+
+void TimeManager::RemoveWaiterUnlocked(WaitingState* waiter) {
+  DCHECK(lock_.is_locked());
+
+  auto iter = std::find(waiters_.begin(), waiters_.end(), waiter);
+  if (iter == waiters_.end()) return;
+  waiters_.erase(iter);
+  std::make_heap(waiters_.begin(), waiters_.end(), &TimeManager::WaiterIsLater);
+  UpdateMinWaiterTimestampUnlocked();
+}
+
+void TimeManager::UpdateMinWaiterTimestampUnlocked() {
+  DCHECK(lock_.is_locked());
+  min_waiter_ts_.store(waiters_.empty() ? Timestamp::kMax.value()
+                                        : waiters_.front()->timestamp.value());
+}
+
+bool TimeManager::WaiterIsLater(const WaitingState* a, const WaitingState* b) {
+  return a->timestamp > b->timestamp;
 }
 
 bool TimeManager::IsTimestampSafe(Timestamp timestamp) {
-  Lock l(lock_);
-  return IsTimestampSafeUnlocked(timestamp);
+  return timestamp <= GetSafeTime();
 }
 
 bool TimeManager::IsTimestampSafeUnlocked(Timestamp timestamp) {
@@ -295,6 +360,11 @@ bool TimeManager::IsTimestampSafeUnlocked(Timestamp timestamp) {
 }
 
 Timestamp TimeManager::GetSafeTime() {
+  // In non-leader mode safe time only moves with what the leader sends, so it can be read
+  // without the lock.
+  if (PREDICT_TRUE(mode_.load(std::memory_order_acquire) == NON_LEADER)) {
+    return Timestamp(last_safe_ts_.load(std::memory_order_acquire));
+  }
   Lock l(lock_);
   return GetSafeTimeUnlocked();
 }
@@ -302,7 +372,7 @@ Timestamp TimeManager::GetSafeTime() {
 Timestamp TimeManager::GetSafeTimeUnlocked() {
   DCHECK(lock_.is_locked());
 
-  switch (mode_) {
+  switch (mode_.load()) {
     case LEADER: {
       // In ASCII form, where 'S' represents a safe timestamp, 'A' represents the last assigned
       // timestamp, and 'N' represents the current clock value, the internal state can look like
@@ -322,20 +392,20 @@ Timestamp TimeManager::GetSafeTimeUnlocked() {
       //
       // If the current internal state is a), then we can advance safe time to 'N'. We know the
       // leader will never assign a new timestamp lower than it.
-      if (PREDICT_TRUE(last_serial_ts_assigned_ <= last_safe_ts_)) {
-        last_safe_ts_ = clock_->Now();
-        last_advanced_safe_time_ = MonoTime::Now();
-        return last_safe_ts_;
+      if (PREDICT_TRUE(last_serial_ts_assigned_.load(std::memory_order_relaxed) <=
+                       last_safe_ts_.load())) {
+        TryAdvanceSafeTime(clock_->Now());
+        return Timestamp(last_safe_ts_.load());
       }
       // If the current state is b), then there might be transaction with a timestamp that is lower
       // than 'N' in between assignment and being appended to the queue. We can't consider 'N'
       // safe and thus have to return the last known safe timestamp.
       // Note that there can be at most one single transaction in this state, because prepare
       // is single threaded.
-      return last_safe_ts_;
+      return Timestamp(last_safe_ts_.load());
     }
     case NON_LEADER:
-      return last_safe_ts_;
+      return Timestamp(last_safe_ts_.load());
   }
   __builtin_unreachable(); // silence gcc warnings
 }
@@ -348,8 +418,9 @@ Timestamp TimeManager::GetSerialTimestamp() {
 Timestamp TimeManager::GetSerialTimestampUnlocked() {
   DCHECK(lock_.is_locked());
 
-  last_serial_ts_assigned_ = clock_->Now();
-  return last_serial_ts_assigned_;
+  Timestamp now = clock_->Now();
+  last_serial_ts_assigned_.store(now.value(), std::memory_order_relaxed);
+  return now;
 }
 
 Timestamp TimeManager::GetSerialTimestampPlusMaxError() {
@@ -16,6 +16,8 @@
 // under the License.
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -45,6 +47,7 @@ class ITimeManager : public RefCountedThreadSafe<ITimeManager> {
   virtual void SetLeaderMode() = 0;
   virtual void SetNonLeaderMode() = 0;
   virtual Status AssignTimestamp(ReplicateMsg* message) = 0;
+  virtual Status AssignTimestamps(const std::vector<ReplicateMsg*>& messages) = 0;
   virtual Status MessageReceivedFromLeader(const ReplicateMsg& message) = 0;
   virtual void AdvanceSafeTimeWithMessage(const ReplicateMsg& message) = 0;
   virtual void AdvanceSafeTime(Timestamp safe_time) = 0;
@@ -68,6 +71,10 @@ class TimeManagerDummy : public ITimeManager {
     return Status::OK();
   }
 
+  Status AssignTimestamps(const std::vector<ReplicateMsg*>& messages) override {
+    return Status::OK();
+  }
+
   Status MessageReceivedFromLeader(const ReplicateMsg& message) override {
     return Status::OK();
   }
@@ -153,6 +160,12 @@ class TimeManager : public ITimeManager {
   // Requires Leader mode (non-OK status otherwise).
   Status AssignTimestamp(ReplicateMsg* message) override;
 
+  // Like AssignTimestamp(), for each of 'messages' in turn, but reading the clock once for all
+  // the CLIENT_PROPAGATED ones, which get a consecutive run of timestamps.
+  //
+  // Requires Leader mode (non-OK status otherwise).
+  Status AssignTimestamps(const std::vector<ReplicateMsg*>& messages) override;
+
   // Updates the internal state based on 'message' received from a leader replica.
   // Replicas are expected to call this for every message received from a valid leader.
   //
@@ -205,15 +218,15 @@ class TimeManager : public ITimeManager {
   // If this returns false we might be partitioned or there might be election churn.
   // The client should try again.
   // If this returns false, sets error information in 'error_message'.
-  bool HasAdvancedSafeTimeRecentlyUnlocked(std::string* error_message);
+  bool HasAdvancedSafeTimeRecently(std::string* error_message);
 
   // Returns whether safe time is lagging too much behind 'timestamp' and the client
   // should be forced to retry.
   // If this returns true, sets error information in 'error_message'.
-  bool IsSafeTimeLaggingUnlocked(Timestamp timestamp, std::string* error_message);
+  bool IsSafeTimeLagging(Timestamp timestamp, std::string* error_message);
 
   // Helper to build the final error message of WaitUntilSafe().
-  void MakeWaiterTimeoutMessageUnlocked(Timestamp timestamp, std::string* error_message);
+  void MakeWaiterTimeoutMessage(Timestamp timestamp, std::string* error_message);
 
   // Helper to return the external consistency mode of 'message'.
   static ExternalConsistencyMode GetMessageConsistencyMode(const ReplicateMsg& message);
@@ -236,11 +249,28 @@ class TimeManager : public ITimeManager {
   // Requires that we've waited for the local clock to move past 'timestamp'.
   bool IsTimestampSafe(Timestamp timestamp);
 
-  // Internal, unlocked implementation of IsTimestampSafe().
+  // Internal, locked implementation of IsTimestampSafe().
   bool IsTimestampSafeUnlocked(Timestamp timestamp);
 
-  // Advances safe time and wakes up any waiters.
-  void AdvanceSafeTimeAndWakeUpWaitersUnlocked(Timestamp safe_time);
+  // Orders 'waiters_' so that the waiter with the lowest timestamp is at its head.
+  static bool WaiterIsLater(const WaitingState* a, const WaitingState* b);
+
+  // Advances safe time to 'safe_time', if that is higher than the current safe time, and wakes
+  // up any waiters it crosses. Doesn't need 'lock_' unless there is a waiter to wake up.
+  void AdvanceSafeTimeAndWakeUpWaiters(Timestamp safe_time);
+
+  // Advances safe time to 'safe_time', if that is higher than the current safe time. Returns
+  // whether it did.
+  bool TryAdvanceSafeTime(Timestamp safe_time);
+
+  // Wakes up the waiters whose timestamps are safe.
+  void WakeUpWaitersUnlocked();
+
+  // Removes 'waiter' from 'waiters_'.
+  void RemoveWaiterUnlocked(WaitingState* waiter);
+
+  // Sets 'min_waiter_ts_' from the head of 'waiters_'.
+  void UpdateMinWaiterTimestampUnlocked();
 
   // Internal, unlocked implementation of GetSerialTimestamp().
   Timestamp GetSerialTimestampUnlocked();
@@ -249,28 +279,33 @@ class TimeManager : public ITimeManager {
   // NOTE: GetSerialTimestamp() might still return timestamps that are smaller.
   Timestamp GetSerialTimestampPlusMaxError();
 
-  // Internal, unlocked implementation of GetSafeTime().
+  // Internal, locked implementation of GetSafeTime().
   Timestamp GetSafeTimeUnlocked();
 
-  // Lock to protect the non-const fields below.
+  // Lock to serialize leader-mode timestamp assignment with leader-mode safe time, and to
+  // protect 'waiters_'. Safe time itself is read and, in non-leader mode, advanced without it.
   mutable simple_spinlock lock_;
 
-  // Vector of waiters to be notified when the safe time advances.
-  mutable std::vector<WaitingState*> waiters_;
+  // Waiters to be notified when the safe time advances, as a min-heap on their timestamps.
+  std::vector<WaitingState*> waiters_;
+
+  // The lowest timestamp in 'waiters_', or Timestamp::kMax if there are none. Lets safe time
+  // advance without taking 'lock_' when that wakes up no one.
+  std::atomic<uint64_t> min_waiter_ts_;
 
   // The last serial timestamp that was assigned.
-  Timestamp last_serial_ts_assigned_;
+  std::atomic<uint64_t> last_serial_ts_assigned_;
 
   // On replicas this is the latest safe time received from the leader, on the leader this is
-  // the last serial timestamp appended to the queue.
-  Timestamp last_safe_ts_;
+  // the last serial timestamp appended to the queue. Only ever increases.
+  std::atomic<uint64_t> last_safe_ts_;
 
   // The last time we advanced safe time.
   // Used in the decision of whether we should have waiters wait or try again.
-  MonoTime last_advanced_safe_time_;
+  std::atomic<MonoTime> last_advanced_safe_time_;
 
-  // The current mode of the TimeManager.
-  Mode mode_;
+  // The current mode of the TimeManager. Only changed under 'lock_'.
+  std::atomic<Mode> mode_;
 
   const scoped_refptr<clock::Clock> clock_;
   const std::string local_peer_uuid_;
@@ -0,0 +1,157 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/consensus/traffic_capture.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/opid_util.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/env.h"
+#include "kudu/util/pb_util.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(raft_traffic_capture_sample_interval);
+DECLARE_int64(raft_traffic_capture_max_records);
+
+using kudu::pb_util::ReadablePBContainerFile;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+class TrafficCaptureTest : public KuduTest {
+ protected:
+  static ReplicateMsg MakeWrite(int64_t index, string payload) {
+    ReplicateMsg msg;
+    *msg.mutable_id() = MakeOpId(1, index);
+    msg.set_timestamp(index);
+    msg.set_op_type(WRITE_OP_EXT);
+    msg.mutable_write_payload()->set_payload(std::move(payload));
+    return msg;
+  }
+
+  Status ReadRecords(const string& path, vector<TrafficCaptureRecordPB>* records) {
+    unique_ptr<RandomAccessFile> file;
+    RETURN_NOT_OK(env_->NewRandomAccessFile(path, &file));
+    ReadablePBContainerFile reader(std::move(file));
+    RETURN_NOT_OK(reader.Open());
+    while (true) {
+      TrafficCaptureRecordPB record;
+      Status s = reader.ReadNextPB(&record);
+      if (s.IsEndOfFile()) {
+        return Status::OK();
+      }
+      RETURN_NOT_OK(s);
+      records->emplace_back(std::move(record));
+    }
+  }
+};
+
+// The capture records the shapes of the requests, but none of the payloads.
+TEST_F(TrafficCaptureTest, TestRecordsShapes) {
+  FLAGS_raft_traffic_capture_sample_interval = 2;
+  const string path = GetTestPath("capture");
+  unique_ptr<TrafficCapture> capture;
+  ASSERT_OK(TrafficCapture::Create(env_, path, &capture));
+  // The file must be new.
+  unique_ptr<TrafficCapture> other;
+  ASSERT_TRUE(TrafficCapture::Create(env_, path, &other).IsAlreadyPresent());
+
+  const string compressible(1000, 'a');
+  ReplicateMsg first = MakeWrite(1, compressible);
+  ReplicateMsg second = MakeWrite(2, string(10, 'b'));
+  ReplicateMsg compressed = MakeWrite(3, "xyz");
+  compressed.mutable_write_payload()->set_compression_codec(LZ4);
+  compressed.mutable_write_payload()->set_uncompressed_size(300);
+  ReplicateMsg noop;
+  *noop.mutable_id() = MakeOpId(1, 4);
+  noop.set_timestamp(4);
+  noop.set_op_type(NO_OP);
+
+  capture->Record(TrafficCaptureRecordPB::REPLICATE, "tablet", { &first, &second });
+  capture->Record(TrafficCaptureRecordPB::UPDATE, "tablet", { &compressed });
+  capture->Record(TrafficCaptureRecordPB::UPDATE, "tablet", { &noop });
+  // Heartbeats aren't recorded.
+  capture->Record(TrafficCaptureRecordPB::UPDATE, "tablet", {});
+  ASSERT_EQ(3, capture->num_records());
+  ASSERT_OK(capture->Flush());
+
+  vector<TrafficCaptureRecordPB> records;
+  ASSERT_OK(ReadRecords(path, &records));
+  ASSERT_EQ(3, records.size());
+
+  const TrafficCaptureRecordPB& r0 = records[0];
+  ASSERT_EQ(TrafficCaptureRecordPB::REPLICATE, r0.kind());
+  ASSERT_EQ("tablet", r0.tablet_id());
+  ASSERT_EQ(2, r0.payload_bytes_size());
+  ASSERT_EQ(1000, r0.payload_bytes(0));
+  ASSERT_EQ(10, r0.payload_bytes(1));
+  ASSERT_EQ(1000, r0.uncompressed_bytes(0));
+  ASSERT_EQ(NO_COMPRESSION, r0.compression_codec());
+  // The first request was sampled, and its payloads compress well.
+  ASSERT_GT(r0.sample_bytes(), 0);
+  ASSERT_LT(r0.sample_compressed_bytes(), r0.sample_bytes() / 4);
+
+  const TrafficCaptureRecordPB& r1 = records[1];
+  ASSERT_EQ(TrafficCaptureRecordPB::UPDATE, r1.kind());
+  ASSERT_GE(r1.arrival_us(), r0.arrival_us());
+  ASSERT_EQ(3, r1.payload_bytes(0));
+  ASSERT_EQ(300, r1.uncompressed_bytes(0));
+  ASSERT_EQ(LZ4, r1.compression_codec());
+  ASSERT_FALSE(r1.has_sample_bytes());
+
+  // Ops without a payload count as empty, and an empty request isn't
+  // sampled.
+  const TrafficCaptureRecordPB& r2 = records[2];
+  ASSERT_EQ(0, r2.payload_bytes(0));
+  ASSERT_FALSE(r2.has_sample_bytes());
+
+  // No payload bytes were recorded.
+  uint64_t size;
+  ASSERT_OK(env_->GetFileSize(path, &size));
+  ASSERT_LT(size, compressible.size());
+}
+
+TEST_F(TrafficCaptureTest, TestMaxRecords) {
+  FLAGS_raft_traffic_capture_max_records = 2;
+  unique_ptr<TrafficCapture> capture;
+  const string path = GetTestPath("capture");
+  ASSERT_OK(TrafficCapture::Create(env_, path, &capture));
+  ReplicateMsg msg = MakeWrite(1, "payload");
+  for (int i = 0; i < 5; i++) {
+    capture->Record(TrafficCaptureRecordPB::REPLICATE, "tablet", { &msg });
+  }
+  ASSERT_EQ(2, capture->num_records());
+  // The buffered records are written out when the capture is destroyed.
+  capture.reset();
+  vector<TrafficCaptureRecordPB> records;
+  ASSERT_OK(ReadRecords(path, &records));
+  ASSERT_EQ(2, records.size());
+}
+
+} // namespace consensus
+} // namespace kudu
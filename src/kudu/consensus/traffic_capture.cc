@@ -0,0 +1,249 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/consensus/traffic_capture.h"
+
+#include <algorithm>
+#include <mutex>
+#include <ostream>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <google/protobuf/message.h>
+
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/pb_util.h"
+#include "kudu/util/slice.h"
+
+DEFINE_string(raft_traffic_capture_path, "",
+              "If set, the shape of the replication traffic which the server "
+              "sees is recorded to a new file at this path, for replaying it "
+              "with 'kudu perf raft_replay': when the leader is asked to "
+              "replicate ops and when followers receive them, how many ops "
+              "there were and how big their payloads were, but none of the "
+              "payload bytes. The file must not exist. Records are written "
+              "out about once a second, so those of the last second may be "
+              "lost when the server stops.");
+TAG_FLAG(raft_traffic_capture_path, experimental);
+
+DEFINE_int64(raft_traffic_capture_max_records, 10 * 1000 * 1000,
+             "The number of requests after which --raft_traffic_capture_path "
+             "stops recording, so that a capture left on doesn't fill the "
+             "disk. 0 means no limit.");
+TAG_FLAG(raft_traffic_capture_max_records, experimental);
+TAG_FLAG(raft_traffic_capture_max_records, runtime);
+
+DEFINE_int32(raft_traffic_capture_sample_interval, 16,
+             "One request out of this many which --raft_traffic_capture_path "
+             "records has a sample of its uncompressed payloads compressed "
+             "with LZ4, to record how well they compress. 0 disables the "
+             "sampling.");
+TAG_FLAG(raft_traffic_capture_sample_interval, experimental);
+TAG_FLAG(raft_traffic_capture_sample_interval, runtime);
+
+DEFINE_int32(raft_traffic_capture_sample_bytes, 4096,
+             "How many bytes of the payloads of a request sampled by "
+             "--raft_traffic_capture_sample_interval are compressed.");
+TAG_FLAG(raft_traffic_capture_sample_bytes, experimental);
+TAG_FLAG(raft_traffic_capture_sample_bytes, runtime);
+
+using kudu::pb_util::WritablePBContainerFile;
+using std::lock_guard;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace consensus {
+
+namespace {
+
+// Buffered records are written out once there are this many of them, or
+// once this long has passed since the last write.
+const size_t kFlushBatchRecords = 256;
+const MonoDelta kFlushInterval = MonoDelta::FromSeconds(1);
+
+// Records in 'record' how many bytes LZ4 compresses the start of the
+// payloads of 'ops' to.
+void SampleCompressibility(const vector<const ReplicateMsg*>& ops,
+                           TrafficCaptureRecordPB* record) {
+  const size_t max_bytes = std::max(FLAGS_raft_traffic_capture_sample_bytes, 0);
+  vector<Slice> sample;
+  size_t sample_bytes = 0;
+  for (const ReplicateMsg* op : ops) {
+    if (sample_bytes >= max_bytes) {
+      break;
+    }
+    if (!op->has_write_payload() || op->write_payload().payload().empty()) {
+      continue;
+    }
+    const string& data = op->write_payload().payload();
+    const size_t n = std::min(data.size(), max_bytes - sample_bytes);
+    sample.emplace_back(data.data(), n);
+    sample_bytes += n;
+  }
+  if (sample_bytes == 0) {
+    return;
+  }
+
+  const CompressionCodec* codec;
+  if (!GetCompressionCodec(LZ4, &codec).ok()) {
+    return;
+  }
+  faststring buf;
+  buf.resize(codec->MaxCompressedLength(sample_bytes));
+  size_t compressed_len;
+  if (!codec->Compress(sample, buf.data(), &compressed_len).ok()) {
+    return;
+  }
+  record->set_sample_bytes(sample_bytes);
+  record->set_sample_compressed_bytes(compressed_len);
+}
+
+} // anonymous namespace
+
+TrafficCapture* TrafficCapture::Get() {
+  static TrafficCapture* capture = []() -> TrafficCapture* {
+    if (FLAGS_raft_traffic_capture_path.empty()) {
+      return nullptr;
+    }
+    unique_ptr<TrafficCapture> c;
+    Status s = Create(Env::Default(), FLAGS_raft_traffic_capture_path, &c);
+    if (!s.ok()) {
+      LOG(WARNING) << "Not capturing replication traffic: " << s.ToString();
+      return nullptr;
+    }
+    LOG(INFO) << "Capturing replication traffic to " << FLAGS_raft_traffic_capture_path;
+    return c.release();
+  }();
+  return capture;
+}
+
+Status TrafficCapture::Create(Env* env, const string& path,
+                              unique_ptr<TrafficCapture>* capture) {
+  RWFileOptions opts;
+  opts.mode = Env::CREATE_NON_EXISTING;
+  unique_ptr<RWFile> rw_file;
+  RETURN_NOT_OK_PREPEND(env->NewRWFile(opts, path, &rw_file),
+                        "Unable to create traffic capture file");
+  unique_ptr<WritablePBContainerFile> file(
+      new WritablePBContainerFile(shared_ptr<RWFile>(std::move(rw_file))));
+  RETURN_NOT_OK(file->CreateNew(TrafficCaptureRecordPB()));
+  capture->reset(new TrafficCapture(std::move(file)));
+  return Status::OK();
+}
+
+TrafficCapture::TrafficCapture(unique_ptr<WritablePBContainerFile> file)
+    : start_(MonoTime::Now()),
+      num_records_(0),
+      file_(std::move(file)),
+      last_flush_(start_),
+      failed_(false) {
+}
+
+TrafficCapture::~TrafficCapture() {
+  lock_guard<Mutex> l(lock_);
+  WARN_NOT_OK(FlushUnlocked(), "Unable to write out the traffic capture");
+  WARN_NOT_OK(file_->Close(), "Unable to close the traffic capture");
+}
+
+void TrafficCapture::Record(TrafficCaptureRecordPB::Kind kind,
+                            const string& tablet_id,
+                            const vector<const ReplicateMsg*>& ops) {
+  if (ops.empty()) {
+    return;
+  }
+  // Racing callers may go a few records over the limit, which is harmless.
+  const int64_t max_records = FLAGS_raft_traffic_capture_max_records;
+  if (max_records > 0 && num_records() >= max_records) {
+    return;
+  }
+  const int64_t seqno = num_records_.fetch_add(1, std::memory_order_relaxed);
+
+  TrafficCaptureRecordPB record;
+  record.set_kind(kind);
+  record.set_arrival_us((MonoTime::Now() - start_).ToMicroseconds());
+  record.set_tablet_id(tablet_id);
+  for (const ReplicateMsg* op : ops) {
+    if (!op->has_write_payload()) {
+      record.add_payload_bytes(0);
+      record.add_uncompressed_bytes(0);
+      continue;
+    }
+    const WritePayloadPB& payload = op->write_payload();
+    record.add_payload_bytes(payload.payload().size());
+    if (payload.compression_codec() == NO_COMPRESSION) {
+      record.add_uncompressed_bytes(payload.payload().size());
+    } else {
+      record.add_uncompressed_bytes(payload.uncompressed_size());
+      record.set_compression_codec(payload.compression_codec());
+    }
+  }
+  // How well compressed payloads compress is known already.
+  const int32_t interval = FLAGS_raft_traffic_capture_sample_interval;
+  if (interval > 0 && seqno % interval == 0 &&
+      record.compression_codec() == NO_COMPRESSION) {
+    SampleCompressibility(ops, &record);
+  }
+
+  lock_guard<Mutex> l(lock_);
+  if (failed_) {
+    return;
+  }
+  pending_.emplace_back(std::move(record));
+  if (pending_.size() >= kFlushBatchRecords ||
+      MonoTime::Now() - last_flush_ > kFlushInterval) {
+    WARN_NOT_OK(FlushUnlocked(), "Unable to write out the traffic capture");
+  }
+}
+
+Status TrafficCapture::Flush() {
+  lock_guard<Mutex> l(lock_);
+  return FlushUnlocked();
+}
+
+Status TrafficCapture::FlushUnlocked() {
+  lock_.AssertAcquired();
+  last_flush_ = MonoTime::Now();
+  if (failed_ || pending_.empty()) {
+    return Status::OK();
+  }
+  vector<const google::protobuf::Message*> msgs;
+  msgs.reserve(pending_.size());
+  for (const TrafficCaptureRecordPB& record : pending_) {
+    msgs.push_back(&record);
+  }
+  Status s = file_->AppendBatch(msgs);
+  if (s.ok()) {
+    s = file_->Flush();
+  }
+  pending_.clear();
+  if (!s.ok()) {
+    // Stop rather than leave a gap in the arrival pattern.
+    failed_ = true;
+    return s.CloneAndPrepend("Unable to write traffic capture records");
+  }
+  return Status::OK();
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,106 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class Env;
+
+namespace pb_util {
+class WritablePBContainerFile;
+} // namespace pb_util
+
+namespace consensus {
+
+// Records the shape of the replication traffic which a server sees, for
+// replaying it offline with 'kudu perf raft_replay': when each request
+// arrived, how many ops it carried, how big their payloads were and, for a
+// sample of the requests, how well their payloads compress. None of the
+// payload bytes are recorded.
+//
+// The leader records the ops it's asked to replicate, and followers the
+// UpdateConsensus() requests carrying ops which they receive. Records are
+// buffered, and written to a protobuf container file of
+// TrafficCaptureRecordPB in batches.
+//
+// This class is thread-safe.
+class TrafficCapture {
+ public:
+  // Returns the capture which the process records to, created the first time
+  // this is called, or nullptr if --raft_traffic_capture_path is empty or the
+  // capture file couldn't be created.
+  static TrafficCapture* Get();
+
+  // Creates a capture writing to a new file at 'path', which must not exist.
+  static Status Create(Env* env, const std::string& path,
+                       std::unique_ptr<TrafficCapture>* capture);
+
+  // Writes out the buffered records.
+  ~TrafficCapture();
+
+  // Records a request of 'kind' for 'tablet_id', carrying 'ops'. Requests
+  // without ops, such as heartbeats, aren't recorded. Once the capture holds
+  // --raft_traffic_capture_max_records records, no more are recorded.
+  void Record(TrafficCaptureRecordPB::Kind kind,
+              const std::string& tablet_id,
+              const std::vector<const ReplicateMsg*>& ops);
+
+  // Writes out the buffered records.
+  Status Flush();
+
+  // The number of records which were recorded so far, including those not
+  // written out yet.
+  int64_t num_records() const { return num_records_.load(std::memory_order_relaxed); }
+
+ private:
+  explicit TrafficCapture(std::unique_ptr<pb_util::WritablePBContainerFile> file);
+
+  // Writes out 'pending_'. Requires 'lock_' to be held.
+  Status FlushUnlocked();
+
+  // Arrival times are relative to this.
+  const MonoTime start_;
+
+  std::atomic<int64_t> num_records_;
+
+  // Protects the fields below. Records are written out with it held, but only
+  // once a batch of them has been buffered.
+  Mutex lock_;
+  std::unique_ptr<pb_util::WritablePBContainerFile> file_;
+  std::vector<TrafficCaptureRecordPB> pending_;
+  MonoTime last_flush_;
+
+  // Set if writing to the file failed, after which nothing more is written.
+  bool failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(TrafficCapture);
+};
+
+} // namespace consensus
+} // namespace kudu
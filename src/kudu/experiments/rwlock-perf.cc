@@ -37,9 +37,14 @@
 #include "kudu/util/flags.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/percpu_rw_mutex.h"
 #include "kudu/util/rw_mutex.h"
 
 DEFINE_int32(num_threads, 8, "Number of threads to test");
+DEFINE_int32(write_every_n, 0,
+             "In the tests of the shared reader-writer locks, the lock is taken "
+             "for writing instead of reading every this many iterations, to model "
+             "a read-mostly workload. 0 takes it for reading only.");
 
 using std::thread;
 using std::vector;
@@ -86,6 +91,7 @@ struct SharedData {
   kudu::RWMutex rwlock;
   std::mutex lock;
   kudu::percpu_rwlock per_cpu;
+  kudu::PerCpuRWMutex percpu_rw_mutex;
 };
 
 
@@ -114,24 +120,36 @@ static void depend_on(float val) {
   }
 }
 
-void shared_rwlock_entry(SharedData *shared) {
+// Takes 'lock' for reading, and every FLAGS_write_every_n iterations for
+// writing.
+template<class LockType>
+static void shared_read_mostly_entry(LockType* lock) {
+  const int write_every_n = FLAGS_write_every_n;
   float result = 1;
   for (int i = 0; i < 1000000; i++) {
-    shared->rwlock.lock_shared();
+    if (PREDICT_FALSE(write_every_n > 0 && i % write_every_n == 0)) {
+      lock->lock();
+      result += workload(result);
+      lock->unlock();
+      continue;
+    }
+    lock->lock_shared();
     result += workload(result);
-    shared->rwlock.unlock_shared();
+    lock->unlock_shared();
   }
   depend_on(result);
 }
 
+void shared_rwlock_entry(SharedData *shared) {
+  shared_read_mostly_entry(&shared->rwlock);
+}
+
 void shared_rw_spinlock_entry(SharedData *shared) {
-  float result = 1;
-  for (int i = 0; i < 1000000; i++) {
-    shared->rw_spinlock.lock_shared();
-    result += workload(result);
-    shared->rw_spinlock.unlock_shared();
-  }
-  depend_on(result);
+  shared_read_mostly_entry(&shared->rw_spinlock);
+}
+
+void shared_percpu_rw_mutex_entry(SharedData *shared) {
+  shared_read_mostly_entry(&shared->percpu_rw_mutex);
 }
 
 void shared_mutex_entry(SharedData *shared) {
@@ -177,7 +195,8 @@ enum TestMethod {
   OWN_SPINLOCK,
   PERCPU_RWLOCK,
   NO_LOCK,
-  RW_SPINLOCK
+  RW_SPINLOCK,
+  PERCPU_RW_MUTEX
 };
 
 void test_shared_lock(int num_threads, TestMethod method, const char *name) {
@@ -207,6 +226,9 @@ void test_shared_lock(int num_threads, TestMethod method, const char *name) {
       case RW_SPINLOCK:
         threads.emplace_back(shared_rw_spinlock_entry, &shared);
         break;
+      case PERCPU_RW_MUTEX:
+        threads.emplace_back(shared_percpu_rw_mutex_entry, &shared);
+        break;
       default:
         CHECK(0) << "bad method: " << method;
     }
@@ -218,7 +240,7 @@ void test_shared_lock(int num_threads, TestMethod method, const char *name) {
   }
   int64_t end = CycleClock::Now();
 
-  printf("%13s  % 7d  %" PRId64 "M\n", name, num_threads, (end-start)/1000000);
+  printf("%15s  % 7d  %" PRId64 "M\n", name, num_threads, (end-start)/1000000);
 }
 
 int main(int argc, char **argv) {
@@ -229,8 +251,8 @@ int main(int argc, char **argv) {
   }
   kudu::InitGoogleLoggingSafe(argv[0]);
 
-  printf("        Test   Threads  Cycles\n");
-  printf("------------------------------\n");
+  printf("          Test   Threads  Cycles\n");
+  printf("--------------------------------\n");
 
   for (int num_threads = 1; num_threads <= FLAGS_num_threads; num_threads++) {
     test_shared_lock(num_threads, SHARED_RWLOCK, "shared_rwlock");
@@ -240,6 +262,7 @@ int main(int argc, char **argv) {
     test_shared_lock(num_threads, NO_LOCK, "no_lock");
     test_shared_lock(num_threads, PERCPU_RWLOCK, "percpu_rwlock");
     test_shared_lock(num_threads, RW_SPINLOCK, "rw_spinlock");
+    test_shared_lock(num_threads, PERCPU_RW_MUTEX, "percpu_rw_mutex");
   }
 
 }
@@ -52,6 +52,7 @@ using std::unique_ptr;
 using strings::Substitute;
 
 DECLARE_bool(crash_on_eio);
+DECLARE_bool(fs_data_dirs_load_aware_placement);
 DECLARE_double(env_inject_eio);
 DECLARE_int32(fs_data_dirs_full_disk_cache_seconds);
 DECLARE_int32(fs_target_data_dirs_per_tablet);
@@ -187,6 +188,26 @@ TEST_F(DataDirsTest, TestDeleteDataDirGroup) {
                                     "registered for tablet");
 }
 
+// Test that with load-aware placement, new blocks go to the directory of the
+// group with the fewest writes in flight.
+TEST_F(DataDirsTest, TestLoadAwarePlacement) {
+  FLAGS_fs_data_dirs_load_aware_placement = true;
+  // Both directories of the group are compared for each block.
+  FLAGS_fs_target_data_dirs_per_tablet = 2;
+  ASSERT_OK(dd_manager_->CreateDataDirGroup(test_tablet_name_));
+  DataDir* busy_dd;
+  ASSERT_OK(dd_manager_->GetNextDataDir(test_block_opts_, &busy_dd));
+  {
+    DataDir::ScopedWrite write1(busy_dd);
+    DataDir::ScopedWrite write2(busy_dd);
+    for (int i = 0; i < 10; i++) {
+      DataDir* dd;
+      ASSERT_OK(dd_manager_->GetNextDataDir(test_block_opts_, &dd));
+      ASSERT_NE(busy_dd, dd);
+    }
+  }
+}
+
 TEST_F(DataDirsTest, TestFullDisk) {
   FLAGS_fs_data_dirs_full_disk_cache_seconds = 0;       // Don't cache device fullness.
   FLAGS_fs_data_dirs_reserved_bytes = 1;                // Reserved space.
@@ -32,6 +32,7 @@
 #include <utility>
 #include <vector>
 
+#include <boost/optional/optional.hpp>
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
@@ -91,6 +92,20 @@ DEFINE_int32(fs_data_dirs_full_disk_cache_seconds, 30,
 TAG_FLAG(fs_data_dirs_full_disk_cache_seconds, advanced);
 TAG_FLAG(fs_data_dirs_full_disk_cache_seconds, evolving);
 
+DEFINE_bool(fs_data_dirs_load_aware_placement, false,
+            "If true, a new block goes to the less loaded of two random "
+            "directories of its tablet's group which aren't full, where the "
+            "load of a directory is the number of writes to it in flight "
+            "times their recent latency, rather than to any random one.");
+TAG_FLAG(fs_data_dirs_load_aware_placement, experimental);
+
+DEFINE_bool(fs_data_dirs_avoid_wal_device, false,
+            "If true, new blocks are only placed in data directories on the "
+            "same device as the WAL when no other directory of their tablet's "
+            "group has space, so that block writes don't slow down the WAL's "
+            "syncs.");
+TAG_FLAG(fs_data_dirs_avoid_wal_device, experimental);
+
 DEFINE_bool(fs_lock_data_dirs, true,
             "Lock the data directories to prevent concurrent usage. "
             "Note that read-only concurrent usage is still allowed.");
@@ -222,7 +237,10 @@ DataDir::DataDir(Env* env,
       metadata_file_(std::move(metadata_file)),
       pool_(std::move(pool)),
       is_shutdown_(false),
-      is_full_(false) {
+      is_full_(false),
+      writes_in_flight_(0),
+      write_latency_us_(0),
+      shares_wal_device_(false) {
 }
 
 DataDir::~DataDir() {
@@ -295,6 +313,30 @@ Status DataDir::RefreshIsFull(RefreshMode mode) {
   return Status::OK();
 }
 
+DataDir::ScopedWrite::ScopedWrite(DataDir* dir)
+    : dir_(FLAGS_fs_data_dirs_load_aware_placement ? dir : nullptr) {
+  if (dir_) {
+    dir_->writes_in_flight_.Increment();
+    start_ = MonoTime::Now();
+  }
+}
+
+DataDir::ScopedWrite::~ScopedWrite() {
+  if (!dir_) {
+    return;
+  }
+  // An exponentially weighted moving average, which is only approximate if
+  // writes finish concurrently.
+  int64_t latency_us = (MonoTime::Now() - start_).ToMicroseconds();
+  int64_t average_us = dir_->write_latency_us_.Load();
+  dir_->write_latency_us_.Store(average_us + (latency_us - average_us) / 8);
+  dir_->writes_in_flight_.IncrementBy(-1);
+}
+
+int64_t DataDir::WriteLoad() const {
+  return (writes_in_flight_.Load() + 1) * std::max<int64_t>(write_latency_us_.Load(), 1);
+}
+
 ////////////////////////////////////////////////////////////
 // DataDirGroup
 ////////////////////////////////////////////////////////////
@@ -701,6 +743,18 @@ Status DataDirManager::Open() {
                    JoinStrings(GetDataDirs(), ",")));
   }
 
+  boost::optional<uint64_t> wal_device_id;
+  if (FLAGS_fs_data_dirs_avoid_wal_device && !opts_.wal_root.empty()) {
+    uint64_t device_id;
+    Status s = env_->GetDeviceId(opts_.wal_root, &device_id);
+    if (s.ok()) {
+      wal_device_id = device_id;
+    } else {
+      LOG(WARNING) << "Could not find the device of the WAL root " << opts_.wal_root
+                   << ", placing blocks regardless of it: " << s.ToString();
+    }
+  }
+
   // All instances are present and accounted for. Time to create the in-memory
   // data directory structures.
   int i = 0;
@@ -730,9 +784,18 @@ Status DataDirManager::Open() {
       }
     }
 
+    // Figure out whether the data directory shares the WAL's device.
+    bool shares_wal_device = false;
+    if (instance->healthy() && wal_device_id) {
+      uint64_t device_id;
+      RETURN_NOT_OK(env_->GetDeviceId(data_dir, &device_id));
+      shares_wal_device = device_id == *wal_device_id;
+    }
+
     unique_ptr<DataDir> dd(new DataDir(
         env_, metrics_.get(), fs_type, data_dir, std::move(instance),
         unique_ptr<ThreadPool>(pool.release())));
+    dd->set_shares_wal_device(shares_wal_device);
     dds.emplace_back(std::move(dd));
     i++;
   }
@@ -977,16 +1040,39 @@ Status DataDirManager::GetNextDataDir(const CreateBlockOptions& opts, DataDir**
   iota(random_indices.begin(), random_indices.end(), 0);
   shuffle(random_indices.begin(), random_indices.end(), default_random_engine(rng_.Next()));
 
-  // Randomly select a member of the group that is not full.
+  // Randomly select a member of the group that is not full. Directories on
+  // the WAL's device are only selected if no other is available, and with
+  // load-aware placement, the less loaded of the first two candidates is.
+  DataDir* selected = nullptr;
+  DataDir* wal_device_fallback = nullptr;
   for (int i : random_indices) {
     int uuid_idx = (*group_uuid_indices)[i];
     DataDir* candidate = FindOrDie(data_dir_by_uuid_idx_, uuid_idx);
     Status s = candidate->RefreshIsFull(DataDir::RefreshMode::EXPIRED_ONLY);
     WARN_NOT_OK(s, Substitute("failed to refresh fullness of $0", candidate->dir()));
-    if (s.ok() && !candidate->is_full()) {
+    if (!s.ok() || candidate->is_full()) {
+      continue;
+    }
+    if (FLAGS_fs_data_dirs_avoid_wal_device && candidate->shares_wal_device()) {
+      if (!wal_device_fallback) {
+        wal_device_fallback = candidate;
+      }
+      continue;
+    }
+    if (!FLAGS_fs_data_dirs_load_aware_placement) {
       *dir = candidate;
       return Status::OK();
     }
+    if (!selected) {
+      selected = candidate;
+      continue;
+    }
+    *dir = candidate->WriteLoad() < selected->WriteLoad() ? candidate : selected;
+    return Status::OK();
+  }
+  if (selected || wal_device_fallback) {
+    *dir = selected ? selected : wal_device_fallback;
+    return Status::OK();
   }
   string tablet_id_str = "";
   if (PREDICT_TRUE(!opts.tablet_id.empty())) {
@@ -31,6 +31,7 @@
 #include "kudu/gutil/callback.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/atomic.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -189,6 +190,29 @@ class DataDir {
     return is_full_;
   }
 
+  // Tracks a write of block data to a directory while it's in scope, for
+  // --fs_data_dirs_load_aware_placement. Does nothing if that's off.
+  class ScopedWrite {
+   public:
+    explicit ScopedWrite(DataDir* dir);
+    ~ScopedWrite();
+
+   private:
+    DataDir* dir_;
+    MonoTime start_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedWrite);
+  };
+
+  // How loaded the directory is with writes: the number of writes in flight,
+  // plus the one about to be placed, times the recent write latency in
+  // microseconds.
+  int64_t WriteLoad() const;
+
+  // Whether the directory is on the same device as the WAL.
+  bool shares_wal_device() const { return shares_wal_device_; }
+  void set_shares_wal_device(bool shares) { shares_wal_device_ = shares; }
+
  private:
   Env* env_;
   DataDirMetrics* metrics_;
@@ -204,6 +228,13 @@ class DataDir {
   MonoTime last_check_is_full_;
   bool is_full_;
 
+  // The writes of block data to the directory in flight, and a moving
+  // average of their latency. See ScopedWrite.
+  AtomicInt<int64_t> writes_in_flight_;
+  AtomicInt<int64_t> write_latency_us_;
+
+  bool shares_wal_device_;
+
   DISALLOW_COPY_AND_ASSIGN(DataDir);
 };
 
@@ -233,6 +264,12 @@ struct DataDirManagerOptions {
   //
   // Defaults to ENFORCE_CONSISTENCY.
   ConsistencyCheckBehavior consistency_check;
+
+  // The root of the WAL, so that blocks may be placed away from its device.
+  // See --fs_data_dirs_avoid_wal_device.
+  //
+  // Defaults to empty, for no WAL.
+  std::string wal_root;
 };
 
 // Encapsulates knowledge of data directory management on behalf of block
@@ -339,7 +339,10 @@ Status FileWritableBlock::Append(const Slice& data) {
 
 Status FileWritableBlock::AppendV(ArrayView<const Slice> data) {
   DCHECK(state_ == CLEAN || state_ == DIRTY) << "Invalid state: " << state_;
-  RETURN_NOT_OK_HANDLE_ERROR(writer_->AppendV(data));
+  {
+    DataDir::ScopedWrite write(location_.data_dir());
+    RETURN_NOT_OK_HANDLE_ERROR(writer_->AppendV(data));
+  }
   RETURN_NOT_OK_HANDLE_ERROR(location_.data_dir()->RefreshIsFull(
       DataDir::RefreshMode::ALWAYS));
   state_ = DIRTY;
@@ -395,6 +398,7 @@ Status FileWritableBlock::Close(SyncMode mode) {
     VLOG(3) << "Syncing block " << id();
     if (FLAGS_enable_data_block_fsync) {
       if (block_manager_->metrics_) block_manager_->metrics_->total_disk_sync->Increment();
+      DataDir::ScopedWrite write(location_.data_dir());
       sync = writer_->Sync();
     }
     if (sync.ok()) {
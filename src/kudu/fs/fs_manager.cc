@@ -86,6 +86,13 @@ DEFINE_string(fs_wal_dir, "",
               "Directory with write-ahead logs. If this is not specified, the "
               "program will not start. May be the same as fs_data_dirs");
 TAG_FLAG(fs_wal_dir, stable);
+DEFINE_string(fs_wal_stripe_dirs, "",
+              "Comma-separated list of additional directories across which "
+              "write-ahead log segments are striped round-robin, together "
+              "with fs_wal_dir. Placing these on separate devices spreads WAL "
+              "write and sync bandwidth. The list must not be changed once "
+              "tablets have written segments to it.");
+TAG_FLAG(fs_wal_stripe_dirs, experimental);
 DEFINE_string(fs_data_dirs, "",
               "Comma-separated list of directories with data blocks. If this "
               "is not specified, fs_wal_dir will be used as the sole data "
@@ -142,6 +149,7 @@ FsManagerOpts::FsManagerOpts()
     read_only(false),
     consistency_check(ConsistencyCheckBehavior::ENFORCE_CONSISTENCY) {
   data_roots = strings::Split(FLAGS_fs_data_dirs, ",", strings::SkipEmpty());
+  wal_stripe_roots = strings::Split(FLAGS_fs_wal_stripe_dirs, ",", strings::SkipEmpty());
 }
 
 FsManagerOpts::FsManagerOpts(const string& root)
@@ -189,6 +197,7 @@ Status FsManager::Init() {
   // Deduplicate all of the roots.
   unordered_set<string> all_roots = { opts_.wal_root };
   all_roots.insert(opts_.data_roots.begin(), opts_.data_roots.end());
+  all_roots.insert(opts_.wal_stripe_roots.begin(), opts_.wal_stripe_roots.end());
 
   // If the metadata root not set, Kudu will either use the wal root or the
   // first data root, in which case we needn't canonicalize additional roots.
@@ -252,6 +261,18 @@ Status FsManager::Init() {
   if (InsertIfNotPresent(&unique_roots, canonicalized_wal_fs_root_.path)) {
     canonicalized_all_fs_roots_.emplace_back(canonicalized_wal_fs_root_);
   }
+  unordered_set<string> unique_wal_roots = { canonicalized_wal_fs_root_.path };
+  for (const string& stripe_root : opts_.wal_stripe_roots) {
+    const auto& root = FindOrDie(canonicalized_roots, stripe_root);
+    if (!InsertIfNotPresent(&unique_wal_roots, root.path)) {
+      return Status::InvalidArgument(
+          Substitute("WAL root $0 is configured more than once", root.path));
+    }
+    canonicalized_wal_stripe_roots_.emplace_back(root);
+    if (InsertIfNotPresent(&unique_roots, root.path)) {
+      canonicalized_all_fs_roots_.emplace_back(root);
+    }
+  }
 
   // Decide on a metadata root to use.
   if (opts_.metadata_root.empty()) {
@@ -281,12 +302,20 @@ Status FsManager::Init() {
   const string& wal_root = canonicalized_wal_fs_root_.path;
   RETURN_NOT_OK_PREPEND(canonicalized_wal_fs_root_.status,
       Substitute("Write-ahead log directory $0 failed to canonicalize", wal_root));
+  for (const auto& root : canonicalized_wal_stripe_roots_) {
+    RETURN_NOT_OK_PREPEND(root.status,
+        Substitute("Write-ahead log stripe directory $0 failed to canonicalize", root.path));
+  }
   const string& meta_root = canonicalized_metadata_fs_root_.path;
   RETURN_NOT_OK_PREPEND(canonicalized_metadata_fs_root_.status,
       Substitute("Metadata directory $0 failed to canonicalize", meta_root));
 
   if (VLOG_IS_ON(1)) {
     VLOG(1) << "WAL root: " << canonicalized_wal_fs_root_.path;
+    if (!canonicalized_wal_stripe_roots_.empty()) {
+      VLOG(1) << "WAL stripe roots: " <<
+        JoinStrings(DataDirManager::GetRootNames(canonicalized_wal_stripe_roots_), ",");
+    }
     VLOG(1) << "Metadata root: " << canonicalized_metadata_fs_root_.path;
     VLOG(1) << "Data roots: " <<
       JoinStrings(DataDirManager::GetRootNames(canonicalized_data_fs_roots_), ",");
@@ -354,9 +383,9 @@ Status FsManager::Open(FsReport* report) {
   }
 
   // Ensure all of the ancillary directories exist.
-  vector<string> ancillary_dirs = { GetWalsRootDir(),
-                                    GetTabletMetadataDir(),
-                                    GetConsensusMetadataDir() };
+  vector<string> ancillary_dirs = GetWalsRootDirs();
+  ancillary_dirs.emplace_back(GetTabletMetadataDir());
+  ancillary_dirs.emplace_back(GetConsensusMetadataDir());
   for (const auto& d : ancillary_dirs) {
     bool is_dir;
     RETURN_NOT_OK_PREPEND(env_->IsDirectory(d, &is_dir),
@@ -396,6 +425,7 @@ Status FsManager::Open(FsReport* report) {
     dm_opts.block_manager_type = opts_.block_manager_type;
     dm_opts.read_only = opts_.read_only;
     dm_opts.consistency_check = opts_.consistency_check;
+    dm_opts.wal_root = canonicalized_wal_fs_root_.path;
     LOG_TIMING(INFO, "opening directory manager") {
       RETURN_NOT_OK(DataDirManager::OpenExisting(env_,
           canonicalized_data_fs_roots_, std::move(dm_opts), &dd_manager_));
@@ -482,9 +512,9 @@ Status FsManager::CreateInitialFileSystemLayout(boost::optional<string> uuid) {
                         "unable to create file system roots");
 
   // Create ancillary directories.
-  vector<string> ancillary_dirs = { GetWalsRootDir(),
-                                    GetTabletMetadataDir(),
-                                    GetConsensusMetadataDir() };
+  vector<string> ancillary_dirs = GetWalsRootDirs();
+  ancillary_dirs.emplace_back(GetTabletMetadataDir());
+  ancillary_dirs.emplace_back(GetConsensusMetadataDir());
   for (const string& dir : ancillary_dirs) {
     bool created;
     RETURN_NOT_OK_PREPEND(env_util::CreateDirIfMissing(env_, dir, &created),
@@ -500,6 +530,7 @@ Status FsManager::CreateInitialFileSystemLayout(boost::optional<string> uuid) {
   DataDirManagerOptions dm_opts;
   dm_opts.metric_entity = opts_.metric_entity;
   dm_opts.read_only = opts_.read_only;
+  dm_opts.wal_root = canonicalized_wal_fs_root_.path;
   LOG_TIMING(INFO, "creating directory manager") {
     RETURN_NOT_OK_PREPEND(DataDirManager::CreateNew(
         env_, canonicalized_data_fs_roots_, std::move(dm_opts), &dd_manager_),
@@ -664,6 +695,24 @@ Status FsManager::ListTabletIds(vector<string>* tablet_ids) {
   return Status::OK();
 }
 
+Status FsManager::ListConsensusMetadataTabletIds(vector<string>* tablet_ids) {
+  string dir = GetConsensusMetadataDir();
+  vector<string> children;
+  RETURN_NOT_OK_PREPEND(ListDir(dir, &children),
+                        Substitute("Couldn't list tablets in consensus metadata directory $0",
+                                   dir));
+
+  // The journals, proxy topologies and persistent vars of the tablets are
+  // kept next to their consensus metadata, with a suffix.
+  for (const string& child : children) {
+    if (child.find('.') != string::npos || !IsValidTabletId(child)) {
+      continue;
+    }
+    tablet_ids->push_back(child);
+  }
+  return Status::OK();
+}
+
 string FsManager::GetInstanceMetadataPath(const string& root) const {
   return JoinPathSegments(root, kInstanceMetadataFileName);
 }
@@ -674,9 +723,38 @@ string FsManager::GetTabletWalRecoveryDir(const string& tablet_id) const {
   return path;
 }
 
+vector<string> FsManager::GetWalsRootDirs() const {
+  DCHECK(initted_);
+  vector<string> dirs = { GetWalsRootDir() };
+  for (const auto& root : canonicalized_wal_stripe_roots_) {
+    dirs.emplace_back(JoinPathSegments(root.path, kWalDirName));
+  }
+  return dirs;
+}
+
+vector<string> FsManager::GetTabletWalDirs(const string& tablet_id) const {
+  vector<string> dirs = GetWalsRootDirs();
+  for (auto& dir : dirs) {
+    dir = JoinPathSegments(dir, tablet_id);
+  }
+  return dirs;
+}
+
+string FsManager::GetTabletWalDirForSegment(const string& tablet_id,
+                                            uint64_t sequence_number) const {
+  DCHECK(initted_);
+  uint64_t stripe = sequence_number % (1 + canonicalized_wal_stripe_roots_.size());
+  if (stripe == 0) {
+    return GetTabletWalDir(tablet_id);
+  }
+  return JoinPathSegments(JoinPathSegments(canonicalized_wal_stripe_roots_[stripe - 1].path,
+                                           kWalDirName),
+                          tablet_id);
+}
+
 string FsManager::GetWalSegmentFileName(const string& tablet_id,
                                         uint64_t sequence_number) const {
-  return JoinPathSegments(GetTabletWalDir(tablet_id),
+  return JoinPathSegments(GetTabletWalDirForSegment(tablet_id, sequence_number),
                           strings::Substitute("$0-$1",
                                               kWalFileNamePrefix,
                                               StringPrintf("%09" PRIu64, sequence_number)));
@@ -686,9 +764,10 @@ void FsManager::CleanTmpFiles() {
   DCHECK(!opts_.read_only);
   // Temporary files in the Block Manager directories are cleaned during
   // Block Manager startup.
-  for (const auto& s : { GetWalsRootDir(),
-                         GetTabletMetadataDir(),
-                         GetConsensusMetadataDir() }) {
+  vector<string> dirs = GetWalsRootDirs();
+  dirs.emplace_back(GetTabletMetadataDir());
+  dirs.emplace_back(GetConsensusMetadataDir());
+  for (const auto& s : dirs) {
     WARN_NOT_OK(env_util::DeleteTmpFilesRecursively(env_, s),
                 Substitute("Error deleting tmp files in $0", s));
   }
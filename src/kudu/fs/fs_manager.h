@@ -89,6 +89,14 @@ struct FsManagerOpts {
   // The directory root where WALs will be stored. Cannot be empty.
   std::string wal_root;
 
+  // Additional directory roots across which WAL segments are striped, in
+  // addition to 'wal_root'. If empty, all segments are stored in 'wal_root'.
+  //
+  // Segment N of a tablet is stored in root (N % (1 + wal_stripe_roots.size())),
+  // where root 0 is 'wal_root'. The set and order of stripe roots must not
+  // change once a tablet has written segments to them.
+  std::vector<std::string> wal_stripe_roots;
+
   // The directory root where data blocks will be stored. If empty, Kudu will
   // use the WAL root.
   std::vector<std::string> data_roots;
@@ -206,6 +214,19 @@ class FsManager {
     return JoinPathSegments(GetWalsRootDir(), tablet_id);
   }
 
+  // Returns the WAL directories of all WAL roots, starting with the one
+  // returned by GetWalsRootDir() and followed by any stripe roots.
+  std::vector<std::string> GetWalsRootDirs() const;
+
+  // Returns the tablet's WAL directory in each WAL root, in the same order
+  // as GetWalsRootDirs(). The first entry is always GetTabletWalDir().
+  std::vector<std::string> GetTabletWalDirs(const std::string& tablet_id) const;
+
+  // Returns the tablet WAL directory that holds the segment with sequence
+  // number 'sequence_number'.
+  std::string GetTabletWalDirForSegment(const std::string& tablet_id,
+                                        uint64_t sequence_number) const;
+
   std::string GetTabletWalRecoveryDir(const std::string& tablet_id) const;
 
   std::string GetWalSegmentFileName(const std::string& tablet_id,
@@ -220,6 +241,9 @@ class FsManager {
   // List the tablet IDs in the metadata directory.
   Status ListTabletIds(std::vector<std::string>* tablet_ids);
 
+  // List the IDs of the tablets which have consensus metadata.
+  Status ListConsensusMetadataTabletIds(std::vector<std::string>* tablet_ids);
+
   // Return the path where InstanceMetadataPB is stored.
   std::string GetInstanceMetadataPath(const std::string& root) const;
 
@@ -234,6 +258,11 @@ class FsManager {
     return JoinPathSegments(GetConsensusMetadataDir(), tablet_id);
   }
 
+  // Return the path of the journal of updates to the ConsensusMetadataPB.
+  std::string GetConsensusMetadataJournalPath(const std::string& tablet_id) const {
+    return JoinPathSegments(GetConsensusMetadataDir(), tablet_id + ".journal");
+  }
+
   // Return the path where ProxyTopologyPB is stored.
   std::string GetProxyMetadataPath(const std::string& tablet_id) const {
     return JoinPathSegments(GetConsensusMetadataDir(), tablet_id + ".proxy");
@@ -349,6 +378,7 @@ class FsManager {
   // - The first data root is used as the metadata root.
   // - Common roots in the collections have been deduplicated.
   CanonicalizedRootAndStatus canonicalized_wal_fs_root_;
+  CanonicalizedRootsList canonicalized_wal_stripe_roots_;
   CanonicalizedRootAndStatus canonicalized_metadata_fs_root_;
   CanonicalizedRootsList canonicalized_data_fs_roots_;
   CanonicalizedRootsList canonicalized_all_fs_roots_;
@@ -16,6 +16,7 @@
 // under the License.
 #include "kudu/fs/fs_report.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <utility>
@@ -262,6 +263,7 @@ void FsReport::Stats::MergeFrom(const FsReport::Stats& other) {
   live_block_bytes_aligned += other.live_block_bytes_aligned;
   lbm_container_count += other.lbm_container_count;
   lbm_full_container_count += other.lbm_full_container_count;
+  open_duration_ms = std::max(open_duration_ms, other.open_duration_ms);
 }
 
 string FsReport::Stats::ToString() const {
@@ -269,9 +271,10 @@ string FsReport::Stats::ToString() const {
       "Total live blocks: $0\n"
       "Total live bytes: $1\n"
       "Total live bytes (after alignment): $2\n"
-      "Total number of LBM containers: $3 ($4 full)\n",
+      "Total number of LBM containers: $3 ($4 full)\n"
+      "Time to open: $5 ms\n",
       live_block_count, live_block_bytes, live_block_bytes_aligned,
-      lbm_container_count, lbm_full_container_count);
+      lbm_container_count, lbm_full_container_count, open_duration_ms);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -247,6 +247,10 @@ struct FsReport {
 
     // Total number of full LBM containers.
     int64_t lbm_full_container_count = 0;
+
+    // Time taken to open the block manager, in milliseconds. Data directories
+    // are opened in parallel, so merged stats keep the slowest directory's.
+    int64_t open_duration_ms = 0;
   };
   Stats stats;
 
@@ -76,9 +76,13 @@ using strings::Substitute;
 
 DECLARE_bool(cache_force_single_shard);
 DECLARE_bool(crash_on_eio);
+DECLARE_bool(log_block_manager_defer_repair);
+DECLARE_bool(log_container_batch_hole_punching);
+DECLARE_bool(log_container_batch_metadata_appends);
 DECLARE_double(env_inject_eio);
 DECLARE_double(log_container_excess_space_before_cleanup_fraction);
 DECLARE_double(log_container_live_metadata_before_compact_ratio);
+DECLARE_int32(log_block_manager_open_threads_per_dir);
 DECLARE_int64(block_manager_max_open_files);
 DECLARE_int64(log_container_max_blocks);
 DECLARE_string(block_manager_preflush_control);
@@ -93,6 +97,7 @@ METRIC_DECLARE_counter(block_manager_total_blocks_deleted);
 METRIC_DECLARE_gauge_uint64(log_block_manager_bytes_under_management);
 METRIC_DECLARE_gauge_uint64(log_block_manager_blocks_under_management);
 METRIC_DECLARE_counter(log_block_manager_holes_punched);
+METRIC_DECLARE_counter(log_block_manager_holes_coalesced);
 METRIC_DECLARE_gauge_uint64(log_block_manager_containers);
 METRIC_DECLARE_gauge_uint64(log_block_manager_full_containers);
 
@@ -520,6 +525,61 @@ TEST_F(LogBlockManagerTest, TestBumpBlockIds) {
 
 // Regression test for KUDU-1190, a crash at startup when a block ID has been
 // reused.
+// Test that blocks whose metadata records are appended together, and whose
+// extents are queued on their container to be punched together, are created
+// and deleted like any others.
+TEST_F(LogBlockManagerTest, TestBatchedMetadataAndHolePunching) {
+  FLAGS_log_container_batch_metadata_appends = true;
+  FLAGS_log_container_batch_hole_punching = true;
+
+  vector<BlockId> blocks;
+  unique_ptr<BlockCreationTransaction> transaction = bm_->NewCreationTransaction();
+  for (int i = 0; i < 10; i++) {
+    unique_ptr<WritableBlock> b;
+    ASSERT_OK(bm_->CreateBlock(test_block_opts_, &b));
+    blocks.emplace_back(b->id());
+    ASSERT_OK(b->Append("test data"));
+    ASSERT_OK(b->Finalize());
+    transaction->AddCreatedBlock(std::move(b));
+  }
+  ASSERT_OK(transaction->CommitCreatedBlocks());
+
+  // The blocks' creation records were all appended.
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity = METRIC_ENTITY_server.Instantiate(&registry, "test");
+  ASSERT_OK(ReopenBlockManager(entity));
+  NO_FATALS(CheckLogMetrics(entity,
+      { {10, &METRIC_log_block_manager_blocks_under_management},
+        {1, &METRIC_log_block_manager_containers} }, {}));
+
+  {
+    shared_ptr<BlockDeletionTransaction> deletion_transaction =
+        bm_->NewDeletionTransaction();
+    for (const auto& block : blocks) {
+      deletion_transaction->AddDeletedBlock(block);
+    }
+    vector<BlockId> deleted;
+    ASSERT_OK(deletion_transaction->CommitDeletedBlocks(&deleted));
+    ASSERT_EQ(blocks.size(), deleted.size());
+  }
+  for (const auto& data_dir : dd_manager_->data_dirs()) {
+    data_dir->WaitOnClosures();
+  }
+  // The contiguous blocks were punched as one hole.
+  NO_FATALS(CheckLogMetrics(entity,
+      { {0, &METRIC_log_block_manager_blocks_under_management} },
+      { {1, &METRIC_log_block_manager_holes_punched},
+        {9, &METRIC_log_block_manager_holes_coalesced} }));
+
+  // So were their deletion records.
+  MetricRegistry new_registry;
+  scoped_refptr<MetricEntity> new_entity =
+      METRIC_ENTITY_server.Instantiate(&new_registry, "test");
+  ASSERT_OK(ReopenBlockManager(new_entity));
+  NO_FATALS(CheckLogMetrics(new_entity,
+      { {0, &METRIC_log_block_manager_blocks_under_management} }, {}));
+}
+
 TEST_F(LogBlockManagerTest, TestReuseBlockIds) {
   // Typically, the LBM starts with a random block ID when running as a
   // gtest. In this test, we want to control the block IDs.
@@ -1486,6 +1546,51 @@ TEST_F(LogBlockManagerTest, TestDeleteDeadContainersAtStartup) {
   ASSERT_FALSE(env_->FileExists(metadata_file_name));
 }
 
+TEST_F(LogBlockManagerTest, TestParallelOpenAndDeferredRepair) {
+  FLAGS_log_block_manager_open_threads_per_dir = 4;
+  FLAGS_log_block_manager_defer_repair = true;
+
+  // Force each container to become full once created, and create a few.
+  FLAGS_log_container_max_size = 0;
+  const int kNumBlocks = 8;
+  vector<BlockId> ids;
+  for (int i = 0; i < kNumBlocks; i++) {
+    unique_ptr<WritableBlock> block;
+    ASSERT_OK(bm_->CreateBlock(test_block_opts_, &block));
+    ASSERT_OK(block->Append("a"));
+    ASSERT_OK(block->Close());
+    ids.push_back(block->id());
+  }
+  NO_FATALS(AssertNumContainers(kNumBlocks));
+
+  // All the containers should be opened.
+  FsReport report;
+  ASSERT_OK(ReopenBlockManager(nullptr, &report));
+  ASSERT_EQ(kNumBlocks, report.stats.lbm_container_count);
+  ASSERT_EQ(kNumBlocks, report.stats.live_block_count);
+  ASSERT_OK(report.LogAndCheckForFatalErrors());
+  for (const auto& id : ids) {
+    unique_ptr<ReadableBlock> block;
+    ASSERT_OK(bm_->OpenBlock(id, &block));
+  }
+
+  // Delete half the blocks and reopen. Their containers are dead, but aren't
+  // deleted until the deferred repair runs.
+  {
+    shared_ptr<BlockDeletionTransaction> deletion_transaction =
+        this->bm_->NewDeletionTransaction();
+    for (int i = 0; i < kNumBlocks / 2; i++) {
+      deletion_transaction->AddDeletedBlock(ids[i]);
+    }
+    vector<BlockId> deleted;
+    ASSERT_OK(deletion_transaction->CommitDeletedBlocks(&deleted));
+  }
+  ASSERT_OK(ReopenBlockManager(nullptr, &report));
+  ASSERT_EQ(kNumBlocks / 2, report.stats.live_block_count);
+  dd_manager_->WaitOnClosures();
+  NO_FATALS(AssertNumContainers(kNumBlocks / 2));
+}
+
 TEST_F(LogBlockManagerTest, TestCompactFullContainerMetadataAtStartup) {
   // With this ratio, the metadata of a full container comprised of half dead
   // blocks will be compacted at startup.
@@ -1662,6 +1767,43 @@ TEST_F(LogBlockManagerTest, TestOpenWithFailedDirectories) {
 // 1) a container can be reused when the block is finalized.
 // 2) the block cannot be opened/found until close it.
 // 3) the same container is not marked as available twice.
+TEST_F(LogBlockManagerTest, TestDeleteOpenBlock) {
+  const string kTestData = "test data";
+  unique_ptr<WritableBlock> writer;
+  ASSERT_OK(bm_->CreateBlock(test_block_opts_, &writer));
+  ASSERT_OK(writer->Append(kTestData));
+  ASSERT_OK(writer->Close());
+  ASSERT_TRUE(bm_->open_blocks_.empty());
+
+  // The readers of a block share its LogBlock, which only exists while the
+  // block is open.
+  unique_ptr<ReadableBlock> reader1;
+  unique_ptr<ReadableBlock> reader2;
+  ASSERT_OK(bm_->OpenBlock(writer->id(), &reader1));
+  ASSERT_OK(bm_->OpenBlock(writer->id(), &reader2));
+  ASSERT_EQ(1, bm_->open_blocks_.size());
+  ASSERT_OK(reader2->Close());
+  reader2.reset();
+  ASSERT_EQ(1, bm_->open_blocks_.size());
+
+  // Deleting the block leaves its remaining reader be.
+  {
+    shared_ptr<BlockDeletionTransaction> deletion_transaction =
+        bm_->NewDeletionTransaction();
+    deletion_transaction->AddDeletedBlock(writer->id());
+    vector<BlockId> deleted;
+    ASSERT_OK(deletion_transaction->CommitDeletedBlocks(&deleted));
+    ASSERT_EQ(1, deleted.size());
+  }
+  ASSERT_TRUE(bm_->open_blocks_.empty());
+  ASSERT_TRUE(bm_->OpenBlock(writer->id(), &reader2).IsNotFound());
+  gscoped_ptr<uint8_t[]> scratch(new uint8_t[kTestData.length()]);
+  Slice data(scratch.get(), kTestData.length());
+  ASSERT_OK(reader1->Read(0, data));
+  ASSERT_EQ(kTestData, data.ToString());
+  ASSERT_OK(reader1->Close());
+}
+
 TEST_F(LogBlockManagerTest, TestFinalizeBlock) {
   // Create 4 blocks.
   vector<unique_ptr<WritableBlock>> blocks;
@@ -21,6 +21,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <errno.h>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -47,6 +48,7 @@
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/callback.h"
 #include "kudu/gutil/casts.h"
+#include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
@@ -58,6 +60,7 @@
 #include "kudu/gutil/walltime.h"
 #include "kudu/util/alignment.h"
 #include "kudu/util/array_view.h"
+#include "kudu/util/atomic.h"
 #include "kudu/util/env.h"
 #include "kudu/util/file_cache.h"
 #include "kudu/util/flag_tags.h"
@@ -73,6 +76,7 @@
 #include "kudu/util/slice.h"
 #include "kudu/util/sorted_disjoint_interval_list.h"
 #include "kudu/util/test_util_prod.h"
+#include "kudu/util/threadpool.h"
 #include "kudu/util/trace.h"
 
 DECLARE_bool(enable_data_block_fsync);
@@ -94,6 +98,27 @@ DEFINE_uint64(log_container_preallocate_bytes, 32LU * 1024 * 1024,
               "creating new blocks. Set to 0 to disable preallocation");
 TAG_FLAG(log_container_preallocate_bytes, advanced);
 
+DEFINE_int32(log_container_preallocate_window_ms, 0,
+             "If positive, a log container sizes each preallocation from the "
+             "rate at which blocks filled its previous one, to last about this "
+             "long, between --log_container_preallocate_bytes and 16 times "
+             "that. Otherwise every preallocation is "
+             "--log_container_preallocate_bytes.");
+TAG_FLAG(log_container_preallocate_window_ms, experimental);
+
+DEFINE_bool(log_container_batch_metadata_appends, false,
+            "If true, the metadata records of the blocks closed or deleted "
+            "together in a log container are appended to its metadata file "
+            "with one write, rather than one write for each block.");
+TAG_FLAG(log_container_batch_metadata_appends, experimental);
+
+DEFINE_bool(log_container_batch_hole_punching, false,
+            "If true, the extents of the blocks deleted from a log container "
+            "by concurrent deletions are queued on the container and punched "
+            "together, with adjacent extents coalesced into one hole, rather "
+            "than each deletion punching its own holes.");
+TAG_FLAG(log_container_batch_hole_punching, experimental);
+
 DEFINE_double(log_container_excess_space_before_cleanup_fraction, 0.10,
               "Additional fraction of a log container's calculated size that "
               "must be consumed on disk before the container is considered to "
@@ -107,6 +132,19 @@ DEFINE_double(log_container_live_metadata_before_compact_ratio, 0.50,
               "the container's metadata file will be compacted at startup.");
 TAG_FLAG(log_container_live_metadata_before_compact_ratio, experimental);
 
+DEFINE_int32(log_block_manager_open_threads_per_dir, 1,
+             "Number of threads with which the block manager opens the "
+             "containers of each data directory at startup. Only that many "
+             "containers' block records are held in memory at a time.");
+TAG_FLAG(log_block_manager_open_threads_per_dir, experimental);
+
+DEFINE_bool(log_block_manager_defer_repair, false,
+            "Whether the block manager reclaims space at startup (deleting "
+            "dead containers, truncating full containers and repunching "
+            "deleted blocks) in the background once it's open, rather than "
+            "before it finishes opening.");
+TAG_FLAG(log_block_manager_defer_repair, experimental);
+
 DEFINE_bool(log_block_manager_test_hole_punching, true,
             "Ensure hole punching is supported by the underlying filesystem");
 TAG_FLAG(log_block_manager_test_hole_punching, advanced);
@@ -137,18 +175,29 @@ METRIC_DEFINE_counter(server, log_block_manager_holes_punched,
                       kudu::MetricUnit::kHoles,
                       "Number of holes punched since service start");
 
+METRIC_DEFINE_counter(server, log_block_manager_holes_coalesced,
+                      "Number of Holes Coalesced",
+                      kudu::MetricUnit::kHoles,
+                      "Number of extents of deleted blocks which were punched "
+                      "together with an adjacent one, rather than as a hole "
+                      "of their own, since service start");
+
 namespace kudu {
 
 namespace fs {
 
+using internal::ContainerOpenResult;
+using internal::DeferredRepair;
 using internal::LogBlock;
 using internal::LogBlockContainer;
 using internal::LogBlockDeletionTransaction;
+using internal::LogBlockLocation;
 using internal::LogWritableBlock;
 using pb_util::ReadablePBContainerFile;
 using pb_util::WritablePBContainerFile;
 using std::accumulate;
 using std::map;
+using std::pair;
 using std::set;
 using std::shared_ptr;
 using std::string;
@@ -181,6 +230,7 @@ struct LogBlockManagerMetrics {
   scoped_refptr<AtomicGauge<uint64_t>> full_containers;
 
   scoped_refptr<Counter> holes_punched;
+  scoped_refptr<Counter> holes_coalesced;
 };
 
 #define MINIT(x) x(METRIC_log_block_manager_##x.Instantiate(metric_entity))
@@ -191,7 +241,8 @@ LogBlockManagerMetrics::LogBlockManagerMetrics(const scoped_refptr<MetricEntity>
     GINIT(blocks_under_management),
     GINIT(containers),
     GINIT(full_containers),
-    MINIT(holes_punched) {
+    MINIT(holes_punched),
+    MINIT(holes_coalesced) {
 }
 #undef GINIT
 
@@ -201,22 +252,31 @@ LogBlockManagerMetrics::LogBlockManagerMetrics(const scoped_refptr<MetricEntity>
 
 // The persistent metadata that describes a logical block.
 //
-// A block grows a LogBlock when its data has been synchronized with
-// the disk. That's when it's fully immutable (i.e. none of its metadata
-// can change), and when it becomes readable and persistent.
+// A block's data is immutable once it has been synchronized with the disk,
+// when it becomes readable and persistent. The block map only keeps a live
+// block's location; a LogBlock is made for it when it is opened for reading
+// or deleted, and lasts until the last reader and the deletion are done.
 //
 // LogBlocks are reference counted to simplify support for deletion with
-// outstanding readers. All refcount increments are performed with the
-// block manager lock held, as are deletion-based decrements. However,
-// no lock is held when ~LogReadableBlock decrements the refcount, thus it
-// must be made thread safe (by extending RefCountedThreadSafe instead of
-// the simpler RefCounted).
-class LogBlock : public RefCountedThreadSafe<LogBlock> {
+// outstanding readers. No lock is held when ~LogReadableBlock decrements the
+// refcount, thus it must be thread safe. The block manager finds the LogBlocks
+// of open blocks through raw pointers, so the last reference to be released
+// first has the block manager forget the LogBlock, and the block manager only
+// takes references to LogBlocks which still have one (see TryAddRef()).
+class LogBlock {
  public:
   LogBlock(LogBlockContainer* container, BlockId block_id, int64_t offset,
            int64_t length);
   ~LogBlock() = default;
 
+  // Reference counting, as used by scoped_refptr.
+  void AddRef() const { refs_.Increment(); }
+  void Release() const;
+
+  // Adds a reference unless the last one was already released, in which case
+  // the LogBlock is about to be destroyed. Returns whether one was added.
+  bool TryAddRef() const;
+
   const BlockId& block_id() const { return block_id_; }
   LogBlockContainer* container() const { return container_; }
   int64_t offset() const { return offset_; }
@@ -245,6 +305,8 @@ class LogBlock : public RefCountedThreadSafe<LogBlock> {
   // The block deletion transaction with which this block has been registered.
   shared_ptr<LogBlockDeletionTransaction> transaction_;
 
+  mutable AtomicInt<int32_t> refs_;
+
   DISALLOW_COPY_AND_ASSIGN(LogBlock);
 };
 
@@ -296,6 +358,10 @@ class LogWritableBlock : public WritableBlock {
   // Does not synchronize the written data; that takes place in Close().
   Status AppendMetadata();
 
+  // Fills 'record' with this block's metadata, for it to be written to disk
+  // along with that of other blocks.
+  void BuildMetadataRecord(BlockRecordPB* record) const;
+
   LogBlockContainer* container() const { return container_; }
 
  private:
@@ -376,6 +442,14 @@ class LogBlockContainer {
   // Executes a hole punching operation at 'offset' with the given 'length'.
   void ContainerDeletionAsync(int64_t offset, int64_t length);
 
+  // Queues the extents in 'holes', given as [start, end) offsets, to be
+  // punched along with those queued by other deletions, scheduling
+  // PunchQueuedHoles() if it isn't already scheduled.
+  void QueueHoles(std::vector<std::pair<int64_t, int64_t>> holes);
+
+  // Coalesces the queued extents and punches them.
+  void PunchQueuedHoles();
+
   // Preallocate enough space to ensure that an append of 'next_append_length'
   // can be satisfied by this container. The offset of the beginning of this
   // block must be provided in 'block_start_offset' (since container
@@ -402,6 +476,11 @@ class LogBlockContainer {
   // The on-disk effects of this call are made durable only after SyncMetadata().
   Status AppendMetadata(const BlockRecordPB& pb);
 
+  // Appends all of 'records' to this container's metadata file with one write.
+  //
+  // The on-disk effects of this call are made durable only after SyncMetadata().
+  Status AppendMetadata(const std::vector<BlockRecordPB>& records);
+
   // Asynchronously flush this container's data file from 'offset' through
   // to 'length'.
   //
@@ -458,16 +537,22 @@ class LogBlockContainer {
       std::vector<scoped_refptr<internal::LogBlock>>* dead_blocks,
       uint64_t* max_block_id);
 
-  // Updates internal bookkeeping state to reflect the creation of a block.
-  void BlockCreated(const scoped_refptr<LogBlock>& block);
+  // Returns the length of the block at 'offset' of 'length' bytes, aligned to
+  // the nearest filesystem block size.
+  int64_t FsAlignedLength(int64_t offset, int64_t length) const;
 
-  // Updates internal bookkeeping state to reflect the deletion of a block.
+  // Updates internal bookkeeping state to reflect the creation of the block
+  // at 'offset' of 'length' bytes.
+  void BlockCreated(int64_t offset, int64_t length);
+
+  // Updates internal bookkeeping state to reflect the deletion of the block
+  // at 'offset' of 'length' bytes.
   //
   // This function is thread safe because block deletions can happen concurrently
   // with creations.
   //
   // Note: the container is not made "unfull"; containers remain sparse until deleted.
-  void BlockDeleted(const scoped_refptr<LogBlock>& block);
+  void BlockDeleted(int64_t offset, int64_t length);
 
   // Finalizes a fully written block. It updates the container data file's position,
   // truncates the container if full and marks the container as available.
@@ -552,6 +637,12 @@ class LogBlockContainer {
   // This function is thread unsafe.
   void UpdateNextBlockOffset(int64_t block_offset, int64_t block_length);
 
+  // Returns how many bytes to preallocate at 'offset'. See
+  // --log_container_preallocate_window_ms.
+  //
+  // This function is thread unsafe.
+  int64_t NextPreallocationLength(int64_t offset);
+
   // The owning block manager. Must outlive the container itself.
   LogBlockManager* const block_manager_;
 
@@ -563,6 +654,17 @@ class LogBlockContainer {
   // Offset up to which we have preallocated bytes.
   int64_t preallocated_offset_ = 0;
 
+  // When the last chunk was preallocated, and how long it was.
+  MonoTime last_preallocation_time_;
+  int64_t last_preallocation_length_ = 0;
+
+  // Protects 'queued_holes_'.
+  simple_spinlock queued_holes_lock_;
+
+  // The extents of deleted blocks waiting for PunchQueuedHoles(), as
+  // [start, end) offsets. See --log_container_batch_hole_punching.
+  std::vector<std::pair<int64_t, int64_t>> queued_holes_;
+
   // Opened file handles to the container's files.
   unique_ptr<WritablePBContainerFile> metadata_file_;
   shared_ptr<RWFile> data_file_;
@@ -826,7 +928,7 @@ Status LogBlockContainer::ProcessRecord(
     uint64_t* data_file_size,
     uint64_t* max_block_id) {
   const BlockId block_id(BlockId::FromPB(record->block_id()));
-  scoped_refptr<LogBlock> lb;
+  LogBlockLocation location;
   switch (record->op_type()) {
     case CREATE:
       // First verify that the record's offset/length aren't wildly incorrect.
@@ -856,8 +958,8 @@ Status LogBlockContainer::ProcessRecord(
         break;
       }
 
-      lb = new LogBlock(this, block_id, record->offset(), record->length());
-      if (!InsertIfNotPresent(live_blocks, block_id, lb)) {
+      location = { this, record->offset(), record->length() };
+      if (!InsertIfNotPresent(live_blocks, block_id, location)) {
         // We found a record whose ID matches that of an already created block.
         //
         // TODO(adar): treat as a different kind of inconsistency?
@@ -877,27 +979,30 @@ Status LogBlockContainer::ProcessRecord(
       //
       // If we ignored deleted blocks, we would end up reusing the space
       // belonging to the last deleted block in the container.
-      UpdateNextBlockOffset(lb->offset(), lb->length());
-      BlockCreated(lb);
+      UpdateNextBlockOffset(location.offset, location.length);
+      BlockCreated(location.offset, location.length);
 
       (*live_block_records)[block_id].Swap(record);
       *max_block_id = std::max(*max_block_id, block_id.id());
       break;
-    case DELETE:
-      lb = EraseKeyReturnValuePtr(live_blocks, block_id);
-      if (!lb) {
+    case DELETE: {
+      auto it = live_blocks->find(block_id);
+      if (it == live_blocks->end()) {
         // We found a record for which there is no already created block.
         //
         // TODO(adar): treat as a different kind of inconsistency?
         report->malformed_record_check->entries.emplace_back(ToString(), record);
         break;
       }
+      location = it->second;
+      live_blocks->erase(it);
       VLOG(2) << Substitute("Found DELETE block $0", block_id.ToString());
-      BlockDeleted(lb);
+      BlockDeleted(location.offset, location.length);
 
       CHECK_EQ(1, live_block_records->erase(block_id));
-      dead_blocks->emplace_back(std::move(lb));
+      dead_blocks->emplace_back(new LogBlock(this, block_id, location.offset, location.length));
       break;
+    }
     default:
       // We found a record with an unknown type.
       //
@@ -918,9 +1023,18 @@ Status LogBlockContainer::DoCloseBlocks(const vector<LogWritableBlock*>& blocks,
 
     // Append metadata only after data is synced so that there's
     // no chance of metadata landing on the disk before the data.
-    for (auto* block : blocks) {
-      RETURN_NOT_OK_PREPEND(block->AppendMetadata(),
-                            "unable to append block's metadata during close");
+    if (FLAGS_log_container_batch_metadata_appends && blocks.size() > 1) {
+      vector<BlockRecordPB> records(blocks.size());
+      for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i]->BuildMetadataRecord(&records[i]);
+      }
+      RETURN_NOT_OK_PREPEND(AppendMetadata(records),
+                            "unable to append blocks' metadata during close");
+    } else {
+      for (auto* block : blocks) {
+        RETURN_NOT_OK_PREPEND(block->AppendMetadata(),
+                              "unable to append block's metadata during close");
+      }
     }
 
     if (mode == SYNC) {
@@ -969,7 +1083,10 @@ Status LogBlockContainer::WriteVData(int64_t offset, ArrayView<const Slice> data
   RETURN_NOT_OK_HANDLE_ERROR(read_only_status());
   DCHECK_GE(offset, next_block_offset());
 
-  RETURN_NOT_OK_HANDLE_ERROR(data_file_->WriteV(offset, data));
+  {
+    DataDir::ScopedWrite write(data_dir_);
+    RETURN_NOT_OK_HANDLE_ERROR(data_file_->WriteV(offset, data));
+  }
 
   // This append may have changed the container size if:
   // 1. It was large enough that it blew out the preallocated space.
@@ -1003,6 +1120,17 @@ Status LogBlockContainer::AppendMetadata(const BlockRecordPB& pb) {
   return Status::OK();
 }
 
+Status LogBlockContainer::AppendMetadata(const vector<BlockRecordPB>& records) {
+  RETURN_NOT_OK_HANDLE_ERROR(read_only_status());
+  vector<const google::protobuf::Message*> msgs;
+  msgs.reserve(records.size());
+  for (const auto& record : records) {
+    msgs.push_back(&record);
+  }
+  RETURN_NOT_OK_HANDLE_ERROR(metadata_file_->AppendBatch(msgs));
+  return Status::OK();
+}
+
 Status LogBlockContainer::FlushData(int64_t offset, int64_t length) {
   RETURN_NOT_OK_HANDLE_ERROR(read_only_status());
   DCHECK_GE(offset, 0);
@@ -1021,6 +1149,7 @@ Status LogBlockContainer::SyncData() {
   RETURN_NOT_OK_HANDLE_ERROR(read_only_status());
   if (FLAGS_enable_data_block_fsync) {
     if (metrics_) metrics_->generic_metrics.total_disk_sync->Increment();
+    DataDir::ScopedWrite write(data_dir_);
     RETURN_NOT_OK_HANDLE_ERROR(data_file_->Sync());
   }
   return Status::OK();
@@ -1062,7 +1191,7 @@ Status LogBlockContainer::EnsurePreallocated(int64_t block_start_offset,
   if (block_start_offset > preallocated_offset_ ||
       next_append_length > preallocated_offset_ - block_start_offset) {
     int64_t off = std::max(preallocated_offset_, block_start_offset);
-    int64_t len = FLAGS_log_container_preallocate_bytes;
+    int64_t len = NextPreallocationLength(off);
     RETURN_NOT_OK_HANDLE_ERROR(data_file_->PreAllocate(off, len, RWFile::CHANGE_FILE_SIZE));
     RETURN_NOT_OK_HANDLE_ERROR(data_dir_->RefreshIsFull(DataDir::RefreshMode::ALWAYS));
     VLOG(2) << Substitute("Preallocated $0 bytes at offset $1 in container $2",
@@ -1074,6 +1203,28 @@ Status LogBlockContainer::EnsurePreallocated(int64_t block_start_offset,
   return Status::OK();
 }
 
+int64_t LogBlockContainer::NextPreallocationLength(int64_t offset) {
+  const int64_t base = FLAGS_log_container_preallocate_bytes;
+  int64_t len = base;
+  MonoTime now = MonoTime::Now();
+  if (FLAGS_log_container_preallocate_window_ms > 0 &&
+      last_preallocation_time_.Initialized()) {
+    // Size the next chunk so that, at the rate the previous one was filled,
+    // it lasts about a window.
+    int64_t elapsed_ms = std::max<int64_t>(
+        (now - last_preallocation_time_).ToMilliseconds(), 1);
+    double rate_len = static_cast<double>(last_preallocation_length_) *
+        FLAGS_log_container_preallocate_window_ms / elapsed_ms;
+    len = std::min<int64_t>(std::max<double>(rate_len, base), base * 16);
+    // There's no point preallocating much past the container's maximum size.
+    int64_t remaining = static_cast<int64_t>(FLAGS_log_container_max_size) - offset;
+    len = std::max(base, std::min(len, remaining));
+  }
+  last_preallocation_time_ = now;
+  last_preallocation_length_ = len;
+  return len;
+}
+
 void LogBlockContainer::FinalizeBlock(int64_t block_offset, int64_t block_length) {
   // Updates this container's next block offset before marking it as available
   // to ensure thread safety while updating internal bookkeeping state.
@@ -1119,21 +1270,40 @@ void LogBlockContainer::UpdateNextBlockOffset(int64_t block_offset, int64_t bloc
   }
 }
 
-void LogBlockContainer::BlockCreated(const scoped_refptr<LogBlock>& block) {
-  DCHECK_GE(block->offset(), 0);
+int64_t LogBlockContainer::FsAlignedLength(int64_t offset, int64_t length) const {
+  uint64_t fs_block_size = instance()->filesystem_block_size_bytes();
+
+  // Nearly all blocks are placed on a filesystem block boundary, which means
+  // their length post-alignment is simply their length aligned up to the
+  // nearest fs block size.
+  //
+  // However, due to KUDU-1793, some blocks may start or end at misaligned
+  // offsets. We don't maintain enough state to precisely pinpoint such a
+  // block's (aligned) end offset in this case, so we'll just undercount it.
+  // This should be safe, although it may mean unreclaimed disk space (i.e.
+  // when fs_aligned_length() is used in hole punching).
+  if (PREDICT_TRUE(offset % fs_block_size == 0)) {
+    return KUDU_ALIGN_UP(length, fs_block_size);
+  }
+  return length;
+}
+
+void LogBlockContainer::BlockCreated(int64_t offset, int64_t length) {
+  DCHECK_GE(offset, 0);
 
-  total_bytes_.IncrementBy(block->fs_aligned_length());
+  int64_t aligned_length = FsAlignedLength(offset, length);
+  total_bytes_.IncrementBy(aligned_length);
   total_blocks_.Increment();
-  live_bytes_.IncrementBy(block->length());
-  live_bytes_aligned_.IncrementBy(block->fs_aligned_length());
+  live_bytes_.IncrementBy(length);
+  live_bytes_aligned_.IncrementBy(aligned_length);
   live_blocks_.Increment();
 }
 
-void LogBlockContainer::BlockDeleted(const scoped_refptr<LogBlock>& block) {
-  DCHECK_GE(block->offset(), 0);
+void LogBlockContainer::BlockDeleted(int64_t offset, int64_t length) {
+  DCHECK_GE(offset, 0);
 
-  live_bytes_.IncrementBy(-block->length());
-  live_bytes_aligned_.IncrementBy(-block->fs_aligned_length());
+  live_bytes_.IncrementBy(-length);
+  live_bytes_aligned_.IncrementBy(-FsAlignedLength(offset, length));
   live_blocks_.IncrementBy(-1);
 }
 
@@ -1164,6 +1334,34 @@ void LogBlockContainer::ContainerDeletionAsync(int64_t offset, int64_t length) {
                             data_dir()->dir()));
 }
 
+void LogBlockContainer::QueueHoles(vector<pair<int64_t, int64_t>> holes) {
+  bool schedule;
+  {
+    std::lock_guard<simple_spinlock> l(queued_holes_lock_);
+    schedule = queued_holes_.empty();
+    queued_holes_.insert(queued_holes_.end(), holes.begin(), holes.end());
+  }
+  if (schedule) {
+    ExecClosure(Bind(&LogBlockContainer::PunchQueuedHoles, Unretained(this)));
+  }
+}
+
+void LogBlockContainer::PunchQueuedHoles() {
+  vector<pair<int64_t, int64_t>> holes;
+  {
+    std::lock_guard<simple_spinlock> l(queued_holes_lock_);
+    holes.swap(queued_holes_);
+  }
+  size_t num_queued = holes.size();
+  CHECK_OK_PREPEND(CoalesceIntervals<int64_t>(&holes),
+                   Substitute("could not coalesce hole punching for container: $0",
+                              ToString()));
+  if (metrics_) metrics_->holes_coalesced->IncrementBy(num_queued - holes.size());
+  for (const auto& hole : holes) {
+    ContainerDeletionAsync(hole.first, hole.second - hole.first);
+  }
+}
+
 ///////////////////////////////////////////////////////////
 // LogBlockCreationTransaction
 ////////////////////////////////////////////////////////////
@@ -1261,6 +1459,12 @@ void LogBlockDeletionTransaction::AddDeletedBlock(BlockId block) {
 LogBlockDeletionTransaction::~LogBlockDeletionTransaction() {
   for (auto& entry : deleted_interval_map_) {
     LogBlockContainer* container = entry.first;
+    if (FLAGS_log_container_batch_hole_punching) {
+      // The extents are coalesced with those of other deletions once queued.
+      container->QueueHoles(std::move(entry.second));
+      continue;
+    }
+    size_t num_intervals = entry.second.size();
     CHECK_OK_PREPEND(CoalesceIntervals<int64_t>(&entry.second),
                      Substitute("could not coalesce hole punching for container: $0",
                                 container->ToString()));
@@ -1271,6 +1475,9 @@ LogBlockDeletionTransaction::~LogBlockDeletionTransaction() {
                                   interval.first,
                                   interval.second - interval.first));
     }
+    if (lbm_->metrics_) {
+      lbm_->metrics_->holes_coalesced->IncrementBy(num_intervals - entry.second.size());
+    }
   }
 }
 
@@ -1316,27 +1523,33 @@ LogBlock::LogBlock(LogBlockContainer* container, BlockId block_id,
     : container_(container),
       block_id_(block_id),
       offset_(offset),
-      length_(length) {
+      length_(length),
+      refs_(0) {
   DCHECK_GE(offset, 0);
   DCHECK_GE(length, 0);
 }
 
-int64_t LogBlock::fs_aligned_length() const {
-  uint64_t fs_block_size = container_->instance()->filesystem_block_size_bytes();
+void LogBlock::Release() const {
+  if (refs_.IncrementBy(-1, kMemOrderBarrier) == 0) {
+    container_->block_manager()->ForgetLogBlock(this);
+    delete this;
+  }
+}
 
-  // Nearly all blocks are placed on a filesystem block boundary, which means
-  // their length post-alignment is simply their length aligned up to the
-  // nearest fs block size.
-  //
-  // However, due to KUDU-1793, some blocks may start or end at misaligned
-  // offsets. We don't maintain enough state to precisely pinpoint such a
-  // block's (aligned) end offset in this case, so we'll just undercount it.
-  // This should be safe, although it may mean unreclaimed disk space (i.e.
-  // when fs_aligned_length() is used in hole punching).
-  if (PREDICT_TRUE(offset_ % fs_block_size == 0)) {
-    return KUDU_ALIGN_UP(length_, fs_block_size);
+bool LogBlock::TryAddRef() const {
+  while (true) {
+    int32_t refs = refs_.Load();
+    if (refs == 0) {
+      return false;
+    }
+    if (refs_.CompareAndSet(refs, refs + 1)) {
+      return true;
+    }
   }
-  return length_;
+}
+
+int64_t LogBlock::fs_aligned_length() const {
+  return container_->FsAlignedLength(offset_, length_);
 }
 
 void LogBlock::RegisterDeletion(
@@ -1524,23 +1737,26 @@ void LogWritableBlock::DoClose() {
     container_->FinalizeBlock(block_offset_, block_length_);
   }
 
-  scoped_refptr<LogBlock> lb = container_->block_manager()->AddLogBlock(
-      container_, block_id_, block_offset_, block_length_);
-  CHECK(lb);
-  container_->BlockCreated(lb);
+  CHECK(container_->block_manager()->AddLogBlock(
+      container_, block_id_, block_offset_, block_length_));
+  container_->BlockCreated(block_offset_, block_length_);
   state_ = CLOSED;
 }
 
 Status LogWritableBlock::AppendMetadata() {
   BlockRecordPB record;
-  id().CopyToPB(record.mutable_block_id());
-  record.set_op_type(CREATE);
-  record.set_timestamp_us(GetCurrentTimeMicros());
-  record.set_offset(block_offset_);
-  record.set_length(block_length_);
+  BuildMetadataRecord(&record);
   return container_->AppendMetadata(record);
 }
 
+void LogWritableBlock::BuildMetadataRecord(BlockRecordPB* record) const {
+  id().CopyToPB(record->mutable_block_id());
+  record->set_op_type(CREATE);
+  record->set_timestamp_us(GetCurrentTimeMicros());
+  record->set_offset(block_offset_);
+  record->set_length(block_length_);
+}
+
 ////////////////////////////////////////////////////////////
 // LogReadableBlock
 ////////////////////////////////////////////////////////////
@@ -1667,6 +1883,73 @@ size_t LogReadableBlock::memory_footprint() const {
   return kudu_malloc_usable_size(this);
 }
 
+////////////////////////////////////////////////////////////
+// ContainerOpenResult and DeferredRepair
+////////////////////////////////////////////////////////////
+
+// What opening one or more containers of a data directory found.
+struct ContainerOpenResult {
+  ContainerOpenResult() {
+    // We are going to perform these checks.
+    //
+    // Note: this isn't necessarily the complete set of FsReport checks; there
+    // may be checks that the LBM cannot perform.
+    report.full_container_space_check.emplace();
+    report.incomplete_container_check.emplace();
+    report.malformed_record_check.emplace();
+    report.misaligned_block_check.emplace();
+    report.partial_record_check.emplace();
+  }
+
+  // Moves the contents of 'other' into this result.
+  void MergeFrom(ContainerOpenResult* other) {
+    report.MergeFrom(other->report);
+    need_repunching.insert(need_repunching.end(),
+                           other->need_repunching.begin(),
+                           other->need_repunching.end());
+    other->need_repunching.clear();
+    dead_containers.insert(dead_containers.end(),
+                           std::make_move_iterator(other->dead_containers.begin()),
+                           std::make_move_iterator(other->dead_containers.end()));
+    for (auto& e : other->low_live_block_containers) {
+      low_live_block_containers.emplace(e.first, std::move(e.second));
+    }
+  }
+
+  FsReport report;
+
+  // Deleted blocks whose space hasn't been punched; they will be repunched
+  // during repair.
+  vector<scoped_refptr<LogBlock>> need_repunching;
+
+  // Containers that have nothing but dead blocks; they will be deleted during
+  // repair.
+  vector<string> dead_containers;
+
+  // Containers whose live block ratio is low; their metadata files will be
+  // compacted during repair.
+  unordered_map<string, vector<BlockRecordPB>> low_live_block_containers;
+};
+
+// The repairs of a data directory which only reclaim space, and may thus be
+// performed after the block manager is open.
+//
+// Repairs which affect where new records are appended, i.e. truncating
+// partial records and compacting metadata files, are never deferred.
+struct DeferredRepair {
+  DataDir* dir;
+
+  // Containers which were already removed from the block manager, and whose
+  // files are to be deleted.
+  vector<string> dead_containers;
+
+  // Full containers with excess preallocated space to truncate.
+  vector<LogBlockContainer*> full_containers;
+
+  // Deleted blocks to punch out again.
+  vector<scoped_refptr<LogBlock>> need_repunching;
+};
+
 } // namespace internal
 
 ////////////////////////////////////////////////////////////
@@ -1722,15 +2005,8 @@ LogBlockManager::LogBlockManager(Env* env,
 }
 
 LogBlockManager::~LogBlockManager() {
-  // Release all of the memory accounted by the blocks.
-  int64_t mem = 0;
-  for (const auto& entry : blocks_by_block_id_) {
-    mem += kudu_malloc_usable_size(entry.second.get());
-  }
-  mem_tracker_->Release(mem);
-
-  // A LogBlock's destructor depends on its container, so all LogBlocks must be
-  // destroyed before their containers.
+  // The block map's entries refer to their containers, so they must be
+  // destroyed before the containers.
   blocks_by_block_id_.clear();
 
   // Containers may have outstanding tasks running on data directories; wait
@@ -1783,6 +2059,7 @@ Status LogBlockManager::Open(FsReport* report) {
   }
 
   vector<FsReport> reports(dd_manager_->data_dirs().size());
+  vector<unique_ptr<DeferredRepair>> deferred_repairs(dd_manager_->data_dirs().size());
   vector<Status> statuses(dd_manager_->data_dirs().size());
   int i = -1;
   for (const auto& dd : dd_manager_->data_dirs()) {
@@ -1801,6 +2078,7 @@ Status LogBlockManager::Open(FsReport* report) {
              Unretained(this),
              dd.get(),
              &reports[i],
+             &deferred_repairs[i],
              &statuses[i]));
   }
 
@@ -1837,6 +2115,17 @@ Status LogBlockManager::Open(FsReport* report) {
     RETURN_NOT_OK(merged_report.LogAndCheckForFatalErrors());
   }
 
+  // Now that the block manager is open, reclaim the space that the data
+  // directories' repairs left behind, on the directories' own threads.
+  for (auto& d : deferred_repairs) {
+    if (d) {
+      DataDir* dir = d->dir;
+      dir->ExecClosure(Bind(&LogBlockManager::RepairInBackground,
+                            Unretained(this),
+                            Owned(d.release())));
+    }
+  }
+
   return Status::OK();
 }
 
@@ -1872,7 +2161,10 @@ Status LogBlockManager::OpenBlock(const BlockId& block_id,
   scoped_refptr<LogBlock> lb;
   {
     std::lock_guard<simple_spinlock> l(lock_);
-    lb = FindPtrOrNull(blocks_by_block_id_, block_id);
+    const LogBlockLocation* location = FindOrNull(blocks_by_block_id_, block_id);
+    if (location) {
+      lb = GetLogBlockUnlocked(block_id, *location);
+    }
   }
   if (!lb) {
     return Status::NotFound("Can't find block", block_id.ToString());
@@ -2019,54 +2311,70 @@ bool LogBlockManager::TryUseBlockId(const BlockId& block_id) {
   return InsertIfNotPresent(&open_block_ids_, block_id);
 }
 
-scoped_refptr<LogBlock> LogBlockManager::AddLogBlock(
-    LogBlockContainer* container,
-    const BlockId& block_id,
-    int64_t offset,
-    int64_t length) {
+bool LogBlockManager::AddLogBlock(LogBlockContainer* container,
+                                  const BlockId& block_id,
+                                  int64_t offset,
+                                  int64_t length) {
   std::lock_guard<simple_spinlock> l(lock_);
-  scoped_refptr<LogBlock> lb(new LogBlock(container, block_id, offset, length));
-  mem_tracker_->Consume(kudu_malloc_usable_size(lb.get()));
-
-  if (AddLogBlockUnlocked(lb)) {
-    return lb;
-  }
-  return nullptr;
+  return AddLogBlockUnlocked(block_id, { container, offset, length });
 }
 
-bool LogBlockManager::AddLogBlockUnlocked(scoped_refptr<LogBlock> lb) {
+bool LogBlockManager::AddLogBlockUnlocked(const BlockId& block_id,
+                                          const LogBlockLocation& location) {
   DCHECK(lock_.is_locked());
 
-  // InsertIfNotPresent doesn't use move semantics, so instead we just
-  // insert an empty scoped_refptr and assign into it down below rather
-  // than using the utility function.
-  scoped_refptr<LogBlock>* entry_ptr = &blocks_by_block_id_[lb->block_id()];
-  if (*entry_ptr) {
+  if (!InsertIfNotPresent(&blocks_by_block_id_, block_id, location)) {
     // Already have an entry for this block ID.
     return false;
   }
 
   VLOG(2) << Substitute("Added block: id $0, offset $1, length $2",
-                        lb->block_id().ToString(), lb->offset(), lb->length());
+                        block_id.ToString(), location.offset, location.length);
 
   // There may already be an entry in open_block_ids_ (e.g. we just finished
   // writing out a block).
-  open_block_ids_.erase(lb->block_id());
+  open_block_ids_.erase(block_id);
   if (metrics()) {
     metrics()->blocks_under_management->Increment();
-    metrics()->bytes_under_management->IncrementBy(lb->length());
+    metrics()->bytes_under_management->IncrementBy(location.length);
   }
-
-  *entry_ptr = std::move(lb);
   return true;
 }
 
+scoped_refptr<LogBlock> LogBlockManager::GetLogBlockUnlocked(
+    const BlockId& block_id,
+    const LogBlockLocation& location) {
+  DCHECK(lock_.is_locked());
+  std::lock_guard<simple_spinlock> l(open_blocks_lock_);
+  LogBlock** open_block = &open_blocks_[block_id];
+  if (*open_block && (*open_block)->TryAddRef()) {
+    // Adopt the reference TryAddRef() added. It can't be the last one, so
+    // releasing it doesn't need 'open_blocks_lock_'.
+    scoped_refptr<LogBlock> lb(*open_block);
+    lb->Release();
+    return lb;
+  }
+
+  // Either no LogBlock is open, or the open one's last reference was released
+  // and it's about to forget itself. See ForgetLogBlock().
+  *open_block = new LogBlock(location.container, block_id, location.offset, location.length);
+  return scoped_refptr<LogBlock>(*open_block);
+}
+
+void LogBlockManager::ForgetLogBlock(const LogBlock* lb) {
+  std::lock_guard<simple_spinlock> l(open_blocks_lock_);
+  auto it = open_blocks_.find(lb->block_id());
+  if (it != open_blocks_.end() && it->second == lb) {
+    open_blocks_.erase(it);
+  }
+}
+
 Status LogBlockManager::RemoveLogBlocks(vector<BlockId> block_ids,
                                         vector<scoped_refptr<LogBlock>>* log_blocks,
                                         vector<BlockId>* deleted) {
   Status first_failure;
   vector<scoped_refptr<LogBlock>> lbs;
-  int64_t malloc_space = 0, blocks_length = 0;
+  int64_t blocks_length = 0;
   {
     std::lock_guard<simple_spinlock> l(lock_);
     for (const auto& block_id : block_ids) {
@@ -2076,7 +2384,6 @@ Status LogBlockManager::RemoveLogBlocks(vector<BlockId> block_ids,
       if (!s.ok() && !s.IsNotFound()) {
         if (first_failure.ok()) first_failure = s;
       } else if (s.ok()) {
-        malloc_space += kudu_malloc_usable_size(lb.get());
         blocks_length += lb->length();
         lbs.emplace_back(std::move(lb));
       } else {
@@ -2086,41 +2393,63 @@ Status LogBlockManager::RemoveLogBlocks(vector<BlockId> block_ids,
   }
 
   // Update various metrics.
-  mem_tracker_->Release(malloc_space);
   if (metrics()) {
     metrics()->blocks_under_management->DecrementBy(lbs.size());
     metrics()->bytes_under_management->DecrementBy(blocks_length);
   }
 
+  auto build_record = [](const LogBlock* lb, BlockRecordPB* record) {
+    lb->block_id().CopyToPB(record->mutable_block_id());
+    record->set_op_type(DELETE);
+    record->set_timestamp_us(GetCurrentTimeMicros());
+  };
+  auto record_result = [&](const Status& s, vector<scoped_refptr<LogBlock>>* recorded) {
+    if (!s.ok()) {
+      if (first_failure.ok()) {
+        first_failure = s.CloneAndPrepend(
+            "Unable to append deletion record to block metadata");
+      }
+      return;
+    }
+    for (auto& lb : *recorded) {
+      deleted->emplace_back(lb->block_id());
+      log_blocks->emplace_back(std::move(lb));
+    }
+  };
+
+  // The blocks of each container, whose deletion records are appended with
+  // one write. See --log_container_batch_metadata_appends.
+  map<LogBlockContainer*, vector<scoped_refptr<LogBlock>>> lbs_by_container;
   for (auto& lb : lbs) {
     VLOG(3) << "Deleting block " << lb->block_id();
-    lb->container()->BlockDeleted(lb);
+    lb->container()->BlockDeleted(lb->offset(), lb->length());
 
     // Record the on-disk deletion.
     //
-    // TODO(unknown): what if this fails? Should we restore the in-memory block?
-    BlockRecordPB record;
-    lb->block_id().CopyToPB(record.mutable_block_id());
-    record.set_op_type(DELETE);
-    record.set_timestamp_us(GetCurrentTimeMicros());
-    Status s = lb->container()->AppendMetadata(record);
-
     // We don't bother fsyncing the metadata append for deletes in order to avoid
     // the disk overhead. Even if we did fsync it, we'd still need to account for
     // garbage at startup time (in the event that we crashed just before the
     // fsync).
     //
     // TODO(KUDU-829): Implement GC of orphaned blocks.
-
-    if (!s.ok()) {
-      if (first_failure.ok()) {
-        first_failure = s.CloneAndPrepend(
-            "Unable to append deletion record to block metadata");
-      }
-    } else {
-      deleted->emplace_back(lb->block_id());
-      log_blocks->emplace_back(std::move(lb));
+    //
+    // TODO(unknown): what if this fails? Should we restore the in-memory block?
+    if (FLAGS_log_container_batch_metadata_appends) {
+      LogBlockContainer* container = lb->container();
+      lbs_by_container[container].emplace_back(std::move(lb));
+      continue;
+    }
+    BlockRecordPB record;
+    build_record(lb.get(), &record);
+    vector<scoped_refptr<LogBlock>> recorded = { std::move(lb) };
+    record_result(recorded[0]->container()->AppendMetadata(record), &recorded);
+  }
+  for (auto& entry : lbs_by_container) {
+    vector<BlockRecordPB> records(entry.second.size());
+    for (size_t i = 0; i < entry.second.size(); i++) {
+      build_record(entry.second[i].get(), &records[i]);
     }
+    record_result(entry.first->AppendMetadata(records), &entry.second);
   }
 
   return first_failure;
@@ -2133,7 +2462,7 @@ Status LogBlockManager::RemoveLogBlockUnlocked(const BlockId& block_id,
     return Status::NotFound("Can't find block", block_id.ToString());
   }
 
-  LogBlockContainer* container = it->second->container();
+  LogBlockContainer* container = it->second.container;
   HANDLE_DISK_FAILURE(container->read_only_status(),
       error_manager_->RunErrorNotificationCb(ErrorHandlerType::DISK_ERROR, container->data_dir()));
 
@@ -2148,7 +2477,10 @@ Status LogBlockManager::RemoveLogBlockUnlocked(const BlockId& block_id,
       return Status::IOError("Block is in a failed directory");
     }
   }
-  *lb = std::move(it->second);
+  // If the block is open, its readers and the deletion share its LogBlock.
+  // Either way, the LogBlock is no longer that of a live block.
+  *lb = GetLogBlockUnlocked(block_id, it->second);
+  ForgetLogBlock(lb->get());
   blocks_by_block_id_.erase(it);
 
   VLOG(2) << Substitute("Removed block: id $0, offset $1, length $2",
@@ -2158,34 +2490,15 @@ Status LogBlockManager::RemoveLogBlockUnlocked(const BlockId& block_id,
 
 void LogBlockManager::OpenDataDir(DataDir* dir,
                                   FsReport* report,
+                                  unique_ptr<DeferredRepair>* deferred,
                                   Status* result_status) {
-  FsReport local_report;
-  local_report.data_dirs.push_back(dir->dir());
+  MonoTime start_time = MonoTime::Now();
+  ContainerOpenResult dir_result;
+  dir_result.report.data_dirs.push_back(dir->dir());
 
-  // We are going to perform these checks.
-  //
-  // Note: this isn't necessarily the complete set of FsReport checks; there
-  // may be checks that the LBM cannot perform.
-  local_report.full_container_space_check.emplace();
-  local_report.incomplete_container_check.emplace();
-  local_report.malformed_record_check.emplace();
-  local_report.misaligned_block_check.emplace();
-  local_report.partial_record_check.emplace();
-
-  // Keep track of deleted blocks whose space hasn't been punched; they will
-  // be repunched during repair.
-  vector<scoped_refptr<internal::LogBlock>> need_repunching;
-
-  // Keep track of containers that have nothing but dead blocks; they will be
-  // deleted during repair.
-  vector<string> dead_containers;
-
-  // Keep track of containers whose live block ratio is low; their metadata
-  // files will be compacted during repair.
-  unordered_map<string, vector<BlockRecordPB>> low_live_block_containers;
-
-  // Find all containers and open them.
+  // Find all containers.
   unordered_set<string> containers_seen;
+  vector<string> container_names;
   vector<string> children;
   Status s = env_->GetChildren(dir->dir(), &children);
   if (!s.ok()) {
@@ -2195,7 +2508,6 @@ void LogBlockManager::OpenDataDir(DataDir* dir,
         "Could not list children of $0", dir->dir()));
     return;
   }
-  MonoTime last_opened_container_log_time = MonoTime::Now();
   for (const string& child : children) {
     string container_name;
     if (!TryStripSuffixString(
@@ -2207,221 +2519,275 @@ void LogBlockManager::OpenDataDir(DataDir* dir,
     if (!InsertIfNotPresent(&containers_seen, container_name)) {
       continue;
     }
+    container_names.emplace_back(std::move(container_name));
+  }
 
-    unique_ptr<LogBlockContainer> container;
-    s = LogBlockContainer::Open(
-        this, dir, &local_report, container_name, &container);
-    if (s.IsAborted()) {
-      // Skip the container. Open() added a record of it to 'local_report' for us.
-      continue;
+  // Open them, logging the number of containers opened every 10 seconds.
+  MonoTime last_opened_container_log_time = MonoTime::Now();
+  auto log_progress = [&]() {
+    MonoTime now = MonoTime::Now();
+    if ((now - last_opened_container_log_time).ToSeconds() > 10) {
+      LOG(INFO) << Substitute("Opened $0 log block containers in $1",
+                              dir_result.report.stats.lbm_container_count, dir->dir());
+      last_opened_container_log_time = now;
     }
+  };
+  if (FLAGS_log_block_manager_open_threads_per_dir <= 1) {
+    for (const string& container_name : container_names) {
+      s = OpenContainer(dir, container_name, &dir_result);
+      if (!s.ok()) {
+        *result_status = s;
+        return;
+      }
+      log_progress();
+    }
+  } else {
+    // Each container is opened into its own result, which is merged into the
+    // directory's once the container's blocks are in the block map. Thus, only
+    // as many containers' records as there are threads are in memory at once.
+    gscoped_ptr<ThreadPool> pool;
+    s = ThreadPoolBuilder("lbm-open")
+        .set_max_threads(FLAGS_log_block_manager_open_threads_per_dir)
+        .Build(&pool);
     if (!s.ok()) {
-      *result_status = s.CloneAndPrepend(Substitute(
-          "Could not open container $0", container_name));
+      *result_status = s.CloneAndPrepend("Could not build container open pool");
       return;
     }
-
-    // Process the records, building a container-local map for live blocks and
-    // a list of dead blocks.
-    //
-    // It's important that we don't try to add these blocks to the global map
-    // incrementally as we see each record, since it's possible that one container
-    // has a "CREATE <b>" while another has a "CREATE <b> ; DELETE <b>" pair.
-    // If we processed those two containers in this order, then upon processing
-    // the second container, we'd think there was a duplicate block. Building
-    // the container-local map first ensures that we discount deleted blocks
-    // before checking for duplicate IDs.
-    //
-    // NOTE: Since KUDU-1538, we allocate sequential block IDs, which makes reuse
-    // exceedingly unlikely. However, we might have old data which still exhibits
-    // the above issue.
-    UntrackedBlockMap live_blocks;
-    BlockRecordMap live_block_records;
-    vector<scoped_refptr<internal::LogBlock>> dead_blocks;
-    uint64_t max_block_id = 0;
-    s = container->ProcessRecords(&local_report,
-                                  &live_blocks,
-                                  &live_block_records,
-                                  &dead_blocks,
-                                  &max_block_id);
+    simple_spinlock result_lock;
+    Status first_failure;
+    for (const string& container_name : container_names) {
+      s = pool->SubmitFunc([&, container_name]() {
+        {
+          std::lock_guard<simple_spinlock> l(result_lock);
+          if (!first_failure.ok()) {
+            return;
+          }
+        }
+        ContainerOpenResult result;
+        Status open_status = OpenContainer(dir, container_name, &result);
+        std::lock_guard<simple_spinlock> l(result_lock);
+        if (!open_status.ok()) {
+          if (first_failure.ok()) {
+            first_failure = open_status;
+          }
+          return;
+        }
+        dir_result.MergeFrom(&result);
+        log_progress();
+      });
+      if (!s.ok()) {
+        break;
+      }
+    }
+    pool->Wait();
+    pool->Shutdown();
     if (!s.ok()) {
-      *result_status = s.CloneAndPrepend(Substitute(
-          "Could not process records in container $0", container->ToString()));
+      *result_status = s.CloneAndPrepend("Could not submit container open");
       return;
     }
-
-    // With deleted blocks out of the way, check for misaligned blocks.
-    //
-    // We could also enforce that the record's offset is aligned with the
-    // underlying filesystem's block size, an invariant maintained by the log
-    // block manager. However, due to KUDU-1793, that invariant may have been
-    // broken, so we'll note but otherwise allow it.
-    for (const auto& e : live_blocks) {
-      if (PREDICT_FALSE(e.second->offset() %
-                        container->instance()->filesystem_block_size_bytes() != 0)) {
-        local_report.misaligned_block_check->entries.emplace_back(
-            container->ToString(), e.first);
-
-      }
+    if (!first_failure.ok()) {
+      *result_status = first_failure;
+      return;
     }
+  }
+  // Like the rest of Open(), repairs are performed per data directory to take
+  // advantage of parallelism.
+  s = Repair(dir,
+             &dir_result.report,
+             std::move(dir_result.need_repunching),
+             std::move(dir_result.dead_containers),
+             std::move(dir_result.low_live_block_containers),
+             deferred);
+  if (!s.ok()) {
+    *result_status = s.CloneAndPrepend(Substitute(
+        "fatal error while repairing inconsistencies in data directory $0",
+        dir->dir()));
+    return;
+  }
 
-    if (container->full()) {
-      // Full containers without any live blocks can be deleted outright.
-      //
-      // TODO(adar): this should be reported as an inconsistency once dead
-      // container deletion is also done in real time. Until then, it would be
-      // confusing to report it as such since it'll be a natural event at startup.
-      if (container->live_blocks() == 0) {
-        DCHECK(live_blocks.empty());
-        dead_containers.emplace_back(container->ToString());
-      } else if (static_cast<double>(container->live_blocks()) /
-          container->total_blocks() <= FLAGS_log_container_live_metadata_before_compact_ratio) {
-        // Metadata files of containers with very few live blocks will be compacted.
-        //
-        // TODO(adar): this should be reported as an inconsistency once
-        // container metadata compaction is also done in realtime. Until then,
-        // it would be confusing to report it as such since it'll be a natural
-        // event at startup.
-        vector<BlockRecordPB> records(live_block_records.size());
-        int i = 0;
-        for (auto& e : live_block_records) {
-          records[i].Swap(&e.second);
-          i++;
-        }
+  dir_result.report.stats.open_duration_ms =
+      (MonoTime::Now() - start_time).ToMilliseconds();
+  *report = std::move(dir_result.report);
+  *result_status = Status::OK();
+}
 
-        // Sort the records such that their ordering reflects the ordering in
-        // the pre-compacted metadata file.
-        //
-        // This is preferred to storing the records in an order-preserving
-        // container (such as std::map) because while records are temporarily
-        // retained for every container, only some containers will actually
-        // undergo metadata compaction.
-        std::sort(records.begin(), records.end(),
-                  [](const BlockRecordPB& a, const BlockRecordPB& b) {
-          // Sort by timestamp.
-          if (a.timestamp_us() != b.timestamp_us()) {
-            return a.timestamp_us() < b.timestamp_us();
-          }
+Status LogBlockManager::OpenContainer(DataDir* dir,
+                                      const string& container_name,
+                                      ContainerOpenResult* result) {
+  unique_ptr<LogBlockContainer> container;
+  Status s = LogBlockContainer::Open(
+      this, dir, &result->report, container_name, &container);
+  if (s.IsAborted()) {
+    // Skip the container. Open() added a record of it to the report for us.
+    return Status::OK();
+  }
+  RETURN_NOT_OK_PREPEND(s, Substitute("Could not open container $0", container_name));
 
-          // If the timestamps match, sort by offset.
-          //
-          // If the offsets also match (i.e. both blocks are of zero length),
-          // it doesn't matter which of the two records comes first.
-          return a.offset() < b.offset();
-        });
+  // Process the records, building a container-local map for live blocks and
+  // a list of dead blocks.
+  //
+  // It's important that we don't try to add these blocks to the global map
+  // incrementally as we see each record, since it's possible that one container
+  // has a "CREATE <b>" while another has a "CREATE <b> ; DELETE <b>" pair.
+  // If we processed those two containers in this order, then upon processing
+  // the second container, we'd think there was a duplicate block. Building
+  // the container-local map first ensures that we discount deleted blocks
+  // before checking for duplicate IDs.
+  //
+  // NOTE: Since KUDU-1538, we allocate sequential block IDs, which makes reuse
+  // exceedingly unlikely. However, we might have old data which still exhibits
+  // the above issue.
+  UntrackedBlockMap live_blocks;
+  BlockRecordMap live_block_records;
+  vector<scoped_refptr<internal::LogBlock>> dead_blocks;
+  uint64_t max_block_id = 0;
+  s = container->ProcessRecords(&result->report,
+                                &live_blocks,
+                                &live_block_records,
+                                &dead_blocks,
+                                &max_block_id);
+  RETURN_NOT_OK_PREPEND(s, Substitute(
+      "Could not process records in container $0", container->ToString()));
+
+  // With deleted blocks out of the way, check for misaligned blocks.
+  //
+  // We could also enforce that the record's offset is aligned with the
+  // underlying filesystem's block size, an invariant maintained by the log
+  // block manager. However, due to KUDU-1793, that invariant may have been
+  // broken, so we'll note but otherwise allow it.
+  for (const auto& e : live_blocks) {
+    if (PREDICT_FALSE(e.second.offset %
+                      container->instance()->filesystem_block_size_bytes() != 0)) {
+      result->report.misaligned_block_check->entries.emplace_back(
+          container->ToString(), e.first);
 
-        low_live_block_containers[container->ToString()] = std::move(records);
-      }
+    }
+  }
 
-      // Having processed the block records, let's check whether any full
-      // containers have any extra space (left behind after a crash or from an
-      // older version of Kudu).
-      //
-      // Filesystems are unpredictable beasts and may misreport the amount of
-      // space allocated to a file in various interesting ways. Some examples:
-      // - XFS's speculative preallocation feature may artificially enlarge the
-      //   container's data file without updating its file size. This makes the
-      //   file size untrustworthy for the purposes of measuring allocated space.
-      //   See KUDU-1856 for more details.
-      // - On el6.6/ext4 a container data file that consumed ~32K according to
-      //   its extent tree was actually reported as consuming an additional fs
-      //   block (2k) of disk space. A similar container data file (generated
-      //   via the same workload) on Ubuntu 16.04/ext4 did not exhibit this.
-      //   The suspicion is that older versions of ext4 include interior nodes
-      //   of the extent tree when reporting file block usage.
-      //
-      // To deal with these issues, our extra space cleanup code (deleted block
-      // repunching and container truncation) is gated on an "actual disk space
-      // consumed" heuristic. To prevent unnecessary triggering of the
-      // heuristic, we allow for some slop in our size measurements. The exact
-      // amount of slop is configurable via
-      // log_container_excess_space_before_cleanup_fraction.
+  if (container->full()) {
+    // Full containers without any live blocks can be deleted outright.
+    //
+    // TODO(adar): this should be reported as an inconsistency once dead
+    // container deletion is also done in real time. Until then, it would be
+    // confusing to report it as such since it'll be a natural event at startup.
+    if (container->live_blocks() == 0) {
+      DCHECK(live_blocks.empty());
+      result->dead_containers.emplace_back(container->ToString());
+    } else if (static_cast<double>(container->live_blocks()) /
+        container->total_blocks() <= FLAGS_log_container_live_metadata_before_compact_ratio) {
+      // Metadata files of containers with very few live blocks will be compacted.
       //
-      // Too little slop and we'll do unnecessary work at startup. Too much and
-      // more unused space may go unreclaimed.
-      string data_filename = StrCat(container->ToString(), kContainerDataFileSuffix);
-      uint64_t reported_size;
-      s = env_->GetFileSizeOnDisk(data_filename, &reported_size);
-      if (!s.ok()) {
-        HANDLE_DISK_FAILURE(s, error_manager_->RunErrorNotificationCb(
-            ErrorHandlerType::DISK_ERROR, dir));
-        *result_status = s.CloneAndPrepend(Substitute(
-            "Could not get on-disk file size of container $0", container->ToString()));
-        return;
+      // TODO(adar): this should be reported as an inconsistency once
+      // container metadata compaction is also done in realtime. Until then,
+      // it would be confusing to report it as such since it'll be a natural
+      // event at startup.
+      vector<BlockRecordPB> records(live_block_records.size());
+      int i = 0;
+      for (auto& e : live_block_records) {
+        records[i].Swap(&e.second);
+        i++;
       }
-      int64_t cleanup_threshold_size = container->live_bytes_aligned() *
-          (1 + FLAGS_log_container_excess_space_before_cleanup_fraction);
-      if (reported_size > cleanup_threshold_size) {
-        local_report.full_container_space_check->entries.emplace_back(
-            container->ToString(), reported_size - container->live_bytes_aligned());
-
-        // If the container is to be deleted outright, don't bother repunching
-        // its blocks. The report entry remains, however, so it's clear that
-        // there was a space discrepancy.
-        if (container->live_blocks()) {
-          need_repunching.insert(need_repunching.end(),
-                                 dead_blocks.begin(), dead_blocks.end());
+
+      // Sort the records such that their ordering reflects the ordering in
+      // the pre-compacted metadata file.
+      //
+      // This is preferred to storing the records in an order-preserving
+      // container (such as std::map) because while records are temporarily
+      // retained for every container, only some containers will actually
+      // undergo metadata compaction.
+      std::sort(records.begin(), records.end(),
+                [](const BlockRecordPB& a, const BlockRecordPB& b) {
+        // Sort by timestamp.
+        if (a.timestamp_us() != b.timestamp_us()) {
+          return a.timestamp_us() < b.timestamp_us();
         }
-      }
 
-      local_report.stats.lbm_full_container_count++;
+        // If the timestamps match, sort by offset.
+        //
+        // If the offsets also match (i.e. both blocks are of zero length),
+        // it doesn't matter which of the two records comes first.
+        return a.offset() < b.offset();
+      });
+
+      result->low_live_block_containers[container->ToString()] = std::move(records);
     }
-    local_report.stats.live_block_bytes += container->live_bytes();
-    local_report.stats.live_block_bytes_aligned += container->live_bytes_aligned();
-    local_report.stats.live_block_count += container->live_blocks();
-    local_report.stats.lbm_container_count++;
 
-    // Log number of containers opened every 10 seconds
-    MonoTime now = MonoTime::Now();
-    if ((now - last_opened_container_log_time).ToSeconds() > 10) {
-      LOG(INFO) << Substitute("Opened $0 log block containers in $1",
-                              local_report.stats.lbm_container_count, dir->dir());
-      last_opened_container_log_time = now;
+    // Having processed the block records, let's check whether any full
+    // containers have any extra space (left behind after a crash or from an
+    // older version of Kudu).
+    //
+    // Filesystems are unpredictable beasts and may misreport the amount of
+    // space allocated to a file in various interesting ways. Some examples:
+    // - XFS's speculative preallocation feature may artificially enlarge the
+    //   container's data file without updating its file size. This makes the
+    //   file size untrustworthy for the purposes of measuring allocated space.
+    //   See KUDU-1856 for more details.
+    // - On el6.6/ext4 a container data file that consumed ~32K according to
+    //   its extent tree was actually reported as consuming an additional fs
+    //   block (2k) of disk space. A similar container data file (generated
+    //   via the same workload) on Ubuntu 16.04/ext4 did not exhibit this.
+    //   The suspicion is that older versions of ext4 include interior nodes
+    //   of the extent tree when reporting file block usage.
+    //
+    // To deal with these issues, our extra space cleanup code (deleted block
+    // repunching and container truncation) is gated on an "actual disk space
+    // consumed" heuristic. To prevent unnecessary triggering of the
+    // heuristic, we allow for some slop in our size measurements. The exact
+    // amount of slop is configurable via
+    // log_container_excess_space_before_cleanup_fraction.
+    //
+    // Too little slop and we'll do unnecessary work at startup. Too much and
+    // more unused space may go unreclaimed.
+    string data_filename = StrCat(container->ToString(), kContainerDataFileSuffix);
+    uint64_t reported_size;
+    s = env_->GetFileSizeOnDisk(data_filename, &reported_size);
+    if (!s.ok()) {
+      HANDLE_DISK_FAILURE(s, error_manager_->RunErrorNotificationCb(
+          ErrorHandlerType::DISK_ERROR, dir));
+      return s.CloneAndPrepend(Substitute(
+          "Could not get on-disk file size of container $0", container->ToString()));
+    }
+    int64_t cleanup_threshold_size = container->live_bytes_aligned() *
+        (1 + FLAGS_log_container_excess_space_before_cleanup_fraction);
+    if (reported_size > cleanup_threshold_size) {
+      result->report.full_container_space_check->entries.emplace_back(
+          container->ToString(), reported_size - container->live_bytes_aligned());
+
+      // If the container is to be deleted outright, don't bother repunching
+      // its blocks. The report entry remains, however, so it's clear that
+      // there was a space discrepancy.
+      if (container->live_blocks()) {
+        result->need_repunching.insert(result->need_repunching.end(),
+                                       dead_blocks.begin(), dead_blocks.end());
+      }
     }
 
-    next_block_id_.StoreMax(max_block_id + 1);
+    result->report.stats.lbm_full_container_count++;
+  }
+  result->report.stats.live_block_bytes += container->live_bytes();
+  result->report.stats.live_block_bytes_aligned += container->live_bytes_aligned();
+  result->report.stats.live_block_count += container->live_blocks();
+  result->report.stats.lbm_container_count++;
 
-    // Under the lock, merge this map into the main block map and add
-    // the container.
-    {
-      std::lock_guard<simple_spinlock> l(lock_);
-      // To avoid cacheline contention during startup, we aggregate all of the
-      // memory in a local and add it to the mem-tracker in a single increment
-      // at the end of this loop.
-      int64_t mem_usage = 0;
-      for (UntrackedBlockMap::value_type& e : live_blocks) {
-        int block_mem = kudu_malloc_usable_size(e.second.get());
-        if (!AddLogBlockUnlocked(std::move(e.second))) {
-          // TODO(adar): track as an inconsistency?
-          LOG(FATAL) << "Found duplicate CREATE record for block " << e.first
-                     << " which already is alive from another container when "
-                     << " processing container " << container->ToString();
-        }
-        mem_usage += block_mem;
-      }
+  next_block_id_.StoreMax(max_block_id + 1);
 
-      mem_tracker_->Consume(mem_usage);
-      AddNewContainerUnlocked(container.get());
-      MakeContainerAvailableUnlocked(container.release());
+  // Under the lock, merge this map into the main block map and add
+  // the container.
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    for (const UntrackedBlockMap::value_type& e : live_blocks) {
+      if (!AddLogBlockUnlocked(e.first, e.second)) {
+        // TODO(adar): track as an inconsistency?
+        LOG(FATAL) << "Found duplicate CREATE record for block " << e.first
+                   << " which already is alive from another container when "
+                   << " processing container " << container->ToString();
+      }
     }
-  }
 
-  // Like the rest of Open(), repairs are performed per data directory to take
-  // advantage of parallelism.
-  s = Repair(dir,
-             &local_report,
-             std::move(need_repunching),
-             std::move(dead_containers),
-             std::move(low_live_block_containers));
-  if (!s.ok()) {
-    *result_status = s.CloneAndPrepend(Substitute(
-        "fatal error while repairing inconsistencies in data directory $0",
-        dir->dir()));
-    return;
+    AddNewContainerUnlocked(container.get());
+    MakeContainerAvailableUnlocked(container.release());
   }
-
-  *report = std::move(local_report);
-  *result_status = Status::OK();
+  return Status::OK();
 }
 
 #define RETURN_NOT_OK_LBM_DISK_FAILURE_PREPEND(status_expr, msg) do { \
@@ -2443,7 +2809,8 @@ Status LogBlockManager::Repair(
     FsReport* report,
     vector<scoped_refptr<internal::LogBlock>> need_repunching,
     vector<string> dead_containers,
-    unordered_map<string, vector<BlockRecordPB>> low_live_block_containers) {
+    unordered_map<string, vector<BlockRecordPB>> low_live_block_containers,
+    unique_ptr<DeferredRepair>* deferred) {
   if (opts_.read_only) {
     LOG(INFO) << "Read-only block manager, skipping repair";
     return Status::OK();
@@ -2495,41 +2862,6 @@ Status LogBlockManager::Repair(
   }
 
 
-  // Delete all dead containers.
-  //
-  // After the deletions, the data directory is sync'ed to reduce the chance
-  // of a data file existing without its corresponding metadata file (or vice
-  // versa) in the event of a crash. The block manager would treat such a case
-  // as corruption and require manual intervention.
-  //
-  // TODO(adar) the above is not fool-proof; a crash could manifest in between
-  // any pair of deletions. That said, the odds of it happening are incredibly
-  // rare, and manual resolution isn't hard (just delete the existing file).
-  int64_t deleted_metadata_bytes = 0;
-  for (const auto& d : dead_containers) {
-    string data_file_name = StrCat(d, kContainerDataFileSuffix);
-    string metadata_file_name = StrCat(d, kContainerMetadataFileSuffix);
-
-    uint64_t metadata_size;
-    Status s = env_->GetFileSize(metadata_file_name, &metadata_size);
-    if (s.ok()) {
-      deleted_metadata_bytes += metadata_size;
-    } else {
-      WARN_NOT_OK_LBM_DISK_FAILURE(s,
-          "Could not get size of dead container metadata file " + metadata_file_name);
-    }
-
-    WARN_NOT_OK_LBM_DISK_FAILURE(file_cache_.DeleteFile(data_file_name),
-                "Could not delete dead container data file " + data_file_name);
-    WARN_NOT_OK_LBM_DISK_FAILURE(file_cache_.DeleteFile(metadata_file_name),
-                "Could not delete dead container metadata file " + metadata_file_name);
-  }
-  if (!dead_containers.empty()) {
-    WARN_NOT_OK_LBM_DISK_FAILURE(env_->SyncDir(dir->dir()), "Could not sync data directory");
-    LOG(INFO) << Substitute("Deleted $0 dead containers ($1 metadata bytes)",
-                            dead_containers.size(), deleted_metadata_bytes);
-  }
-
   // Truncate partial metadata records.
   //
   // This is a fatal inconsistency; if the repair fails, we cannot proceed.
@@ -2588,44 +2920,6 @@ Status LogBlockManager::Repair(
     }
   }
 
-  // Truncate any excess preallocated space in full containers.
-  //
-  // This is a non-fatal inconsistency; we can just as easily ignore the extra
-  // disk space consumption.
-  if (report->full_container_space_check) {
-    for (auto& fcp : report->full_container_space_check->entries) {
-      internal::LogBlockContainer* container = FindPtrOrNull(containers_by_name,
-                                                             fcp.container);
-      if (!container) {
-        // The container was deleted outright.
-        fcp.repaired = true;
-        continue;
-      }
-
-      Status s = container->TruncateDataToNextBlockOffset();
-      if (s.ok()) {
-        fcp.repaired = true;
-      }
-      WARN_NOT_OK(s, "could not truncate excess preallocated space");
-    }
-  }
-
-  // Repunch all requested holes. Any excess space reclaimed was already
-  // tracked by LBMFullContainerSpaceCheck.
-  //
-  // Register deletions to a single BlockDeletionTransaction. So, the repunched
-  // holes belonging to the same container can be coalesced.
-  shared_ptr<LogBlockDeletionTransaction> transaction =
-      std::make_shared<LogBlockDeletionTransaction>(this);
-  for (const auto& b : need_repunching) {
-    b->RegisterDeletion(transaction);
-    transaction->AddBlock(b);
-  }
-
-  // Clearing this vector drops the last references to the LogBlocks within,
-  // triggering the repunching operations.
-  need_repunching.clear();
-
   // "Compact" metadata files with few live blocks by rewriting them with only
   // the live block records.
   int64_t metadata_files_compacted = 0;
@@ -2675,9 +2969,123 @@ Status LogBlockManager::Repair(
                             metadata_files_compacted, metadata_bytes_delta);
   }
 
+  // Reclaim space, either now or once the block manager is open.
+  if (FLAGS_log_block_manager_defer_repair) {
+    deferred->reset(new DeferredRepair());
+    (*deferred)->dir = dir;
+    (*deferred)->dead_containers = std::move(dead_containers);
+    if (report->full_container_space_check) {
+      for (const auto& fcp : report->full_container_space_check->entries) {
+        internal::LogBlockContainer* container = FindPtrOrNull(containers_by_name,
+                                                               fcp.container);
+        if (container) {
+          (*deferred)->full_containers.push_back(container);
+        }
+      }
+    }
+    (*deferred)->need_repunching = std::move(need_repunching);
+    return Status::OK();
+  }
+
+  DeleteDeadContainers(dir, dead_containers);
+
+  // Truncate any excess preallocated space in full containers.
+  //
+  // This is a non-fatal inconsistency; we can just as easily ignore the extra
+  // disk space consumption.
+  if (report->full_container_space_check) {
+    for (auto& fcp : report->full_container_space_check->entries) {
+      internal::LogBlockContainer* container = FindPtrOrNull(containers_by_name,
+                                                             fcp.container);
+      if (!container) {
+        // The container was deleted outright.
+        fcp.repaired = true;
+        continue;
+      }
+
+      Status s = container->TruncateDataToNextBlockOffset();
+      if (s.ok()) {
+        fcp.repaired = true;
+      }
+      WARN_NOT_OK(s, "could not truncate excess preallocated space");
+    }
+  }
+
+  // Repunch all requested holes. Any excess space reclaimed was already
+  // tracked by LBMFullContainerSpaceCheck.
+  RepunchBlocks(std::move(need_repunching));
   return Status::OK();
 }
 
+void LogBlockManager::RepairInBackground(DeferredRepair* repair) {
+  MonoTime start_time = MonoTime::Now();
+  DeleteDeadContainers(repair->dir, repair->dead_containers);
+  for (LogBlockContainer* container : repair->full_containers) {
+    WARN_NOT_OK(container->TruncateDataToNextBlockOffset(),
+                "could not truncate excess preallocated space");
+  }
+  RepunchBlocks(std::move(repair->need_repunching));
+  LOG(INFO) << Substitute("Reclaimed space in data directory $0 in the background "
+                          "($1 dead containers, $2 full containers, took $3 ms)",
+                          repair->dir->dir(), repair->dead_containers.size(),
+                          repair->full_containers.size(),
+                          (MonoTime::Now() - start_time).ToMilliseconds());
+}
+
+void LogBlockManager::DeleteDeadContainers(DataDir* dir,
+                                           const vector<string>& dead_containers) {
+  // Delete all dead containers.
+  //
+  // After the deletions, the data directory is sync'ed to reduce the chance
+  // of a data file existing without its corresponding metadata file (or vice
+  // versa) in the event of a crash. The block manager would treat such a case
+  // as corruption and require manual intervention.
+  //
+  // TODO(adar) the above is not fool-proof; a crash could manifest in between
+  // any pair of deletions. That said, the odds of it happening are incredibly
+  // rare, and manual resolution isn't hard (just delete the existing file).
+  int64_t deleted_metadata_bytes = 0;
+  for (const auto& d : dead_containers) {
+    string data_file_name = StrCat(d, kContainerDataFileSuffix);
+    string metadata_file_name = StrCat(d, kContainerMetadataFileSuffix);
+
+    uint64_t metadata_size;
+    Status s = env_->GetFileSize(metadata_file_name, &metadata_size);
+    if (s.ok()) {
+      deleted_metadata_bytes += metadata_size;
+    } else {
+      WARN_NOT_OK_LBM_DISK_FAILURE(s,
+          "Could not get size of dead container metadata file " + metadata_file_name);
+    }
+
+    WARN_NOT_OK_LBM_DISK_FAILURE(file_cache_.DeleteFile(data_file_name),
+                "Could not delete dead container data file " + data_file_name);
+    WARN_NOT_OK_LBM_DISK_FAILURE(file_cache_.DeleteFile(metadata_file_name),
+                "Could not delete dead container metadata file " + metadata_file_name);
+  }
+  if (!dead_containers.empty()) {
+    WARN_NOT_OK_LBM_DISK_FAILURE(env_->SyncDir(dir->dir()), "Could not sync data directory");
+    LOG(INFO) << Substitute("Deleted $0 dead containers ($1 metadata bytes)",
+                            dead_containers.size(), deleted_metadata_bytes);
+  }
+}
+
+void LogBlockManager::RepunchBlocks(vector<scoped_refptr<LogBlock>> need_repunching) {
+  // Register deletions to a single BlockDeletionTransaction. So, the repunched
+  // holes belonging to the same container can be coalesced.
+  shared_ptr<LogBlockDeletionTransaction> transaction =
+      std::make_shared<LogBlockDeletionTransaction>(this);
+  for (const auto& b : need_repunching) {
+    b->RegisterDeletion(transaction);
+    transaction->AddBlock(b);
+  }
+
+  // Clearing this vector drops the last references to the LogBlocks within,
+  // triggering the repunching operations.
+  need_repunching.clear();
+}
+
+
 Status LogBlockManager::RewriteMetadataFile(const LogBlockContainer& container,
                                             const vector<BlockRecordPB>& records,
                                             int64_t* file_bytes_delta) {
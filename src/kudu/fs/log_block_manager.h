@@ -60,7 +60,21 @@ class LogBlockContainer;
 class LogBlockDeletionTransaction;
 class LogWritableBlock;
 
+struct ContainerOpenResult;
+struct DeferredRepair;
 struct LogBlockManagerMetrics;
+
+// The location of a live block, as kept inline in the block map.
+struct LogBlockLocation {
+  // The container holding the block. Must outlive the block map's entry.
+  LogBlockContainer* container;
+
+  // The block's offset in the container.
+  int64_t offset;
+
+  // The block's length.
+  int64_t length;
+};
 } // namespace internal
 
 // A log-backed (i.e. sequentially allocated file) block storage
@@ -213,6 +227,7 @@ class LogBlockManager : public BlockManager {
   FRIEND_TEST(LogBlockManagerTest, TestAbortBlock);
   FRIEND_TEST(LogBlockManagerTest, TestCloseFinalizedBlock);
   FRIEND_TEST(LogBlockManagerTest, TestCompactFullContainerMetadataAtStartup);
+  FRIEND_TEST(LogBlockManagerTest, TestDeleteOpenBlock);
   FRIEND_TEST(LogBlockManagerTest, TestFinalizeBlock);
   FRIEND_TEST(LogBlockManagerTest, TestLIFOContainerSelection);
   FRIEND_TEST(LogBlockManagerTest, TestLookupBlockLimit);
@@ -222,17 +237,21 @@ class LogBlockManager : public BlockManager {
   FRIEND_TEST(LogBlockManagerTest, TestReuseBlockIds);
   FRIEND_TEST(LogBlockManagerTest, TestFailMultipleTransactionsPerContainer);
 
+  friend class internal::LogBlock;
   friend class internal::LogBlockContainer;
   friend class internal::LogBlockDeletionTransaction;
   friend class internal::LogWritableBlock;
 
   // Type for the actual block map used to store all live blocks.
-  // We use sparse_hash_map<> here to reduce memory overhead.
+  // We use sparse_hash_map<> here to reduce memory overhead, and keep the
+  // blocks' locations inline rather than a LogBlock object per block: a
+  // LogBlock only exists while its block is open for reading or being
+  // deleted (see open_blocks_).
   typedef MemTrackerAllocator<
-      std::pair<const BlockId, scoped_refptr<internal::LogBlock>>> BlockAllocator;
+      std::pair<const BlockId, internal::LogBlockLocation>> BlockAllocator;
   typedef spp::sparse_hash_map<
       BlockId,
-      scoped_refptr<internal::LogBlock>,
+      internal::LogBlockLocation,
       BlockIdHash,
       BlockIdEqual,
       BlockAllocator> BlockMap;
@@ -242,7 +261,7 @@ class LogBlockManager : public BlockManager {
   // Only used during startup.
   typedef std::unordered_map<
       const BlockId,
-      scoped_refptr<internal::LogBlock>,
+      internal::LogBlockLocation,
       BlockIdHash,
       BlockIdEqual> UntrackedBlockMap;
 
@@ -297,21 +316,30 @@ class LogBlockManager : public BlockManager {
   // use), false otherwise.
   bool TryUseBlockId(const BlockId& block_id);
 
-  // Adds a LogBlock to in-memory data structures.
+  // Adds a block to in-memory data structures.
   //
-  // Returns the created LogBlock if it was successfully added or nullptr if a
-  // block with that ID was already present.
-  scoped_refptr<internal::LogBlock> AddLogBlock(
-      internal::LogBlockContainer* container,
+  // Returns true if the block was successfully added, false if a block with
+  // that ID was already present.
+  bool AddLogBlock(internal::LogBlockContainer* container,
+                   const BlockId& block_id,
+                   int64_t offset,
+                   int64_t length);
+
+  // Unlocked variant of AddLogBlock(). Must hold 'lock_'.
+  //
+  // Returns true if the block was successfully added, false if it was already present.
+  bool AddLogBlockUnlocked(const BlockId& block_id,
+                           const internal::LogBlockLocation& location);
+
+  // Returns the LogBlock of the live block 'block_id' at 'location', creating
+  // it if none is open. Must hold 'lock_'.
+  scoped_refptr<internal::LogBlock> GetLogBlockUnlocked(
       const BlockId& block_id,
-      int64_t offset,
-      int64_t length);
+      const internal::LogBlockLocation& location);
 
-  // Unlocked variant of AddLogBlock() for an already-constructed LogBlock object.
-  // Must hold 'lock_'.
-  //
-  // Returns true if the LogBlock was successfully added, false if it was already present.
-  bool AddLogBlockUnlocked(scoped_refptr<internal::LogBlock> lb);
+  // Forgets 'lb' as the open LogBlock of its block, if it is. Called when the
+  // block is deleted, and before 'lb' is destroyed.
+  void ForgetLogBlock(const internal::LogBlock* lb);
 
   // Removes the given set of LogBlocks from in-memory data structures, and
   // appends the block deletion metadata to record the on-disk deletion.
@@ -339,6 +367,11 @@ class LogBlockManager : public BlockManager {
   // 3. Containers in 'low_live_block_containers' will have their metadata
   //    files compacted.
   //
+  // If --log_block_manager_defer_repair is set, repairs 1 and 2 and the
+  // truncation of full containers' excess space are not performed here but
+  // returned in 'deferred', to be performed by RepairInBackground() once the
+  // block manager is open.
+  //
   // Returns an error if repairing a fatal inconsistency failed.
   Status Repair(DataDir* dir,
                 FsReport* report,
@@ -346,7 +379,17 @@ class LogBlockManager : public BlockManager {
                 std::vector<std::string> dead_containers,
                 std::unordered_map<
                     std::string,
-                    std::vector<BlockRecordPB>> low_live_block_containers);
+                    std::vector<BlockRecordPB>> low_live_block_containers,
+                std::unique_ptr<internal::DeferredRepair>* deferred);
+
+  // Performs the repairs which Repair() deferred to 'repair'.
+  void RepairInBackground(internal::DeferredRepair* repair);
+
+  // Deletes the files of the containers in 'dead_containers' from 'dir'.
+  void DeleteDeadContainers(DataDir* dir, const std::vector<std::string>& dead_containers);
+
+  // Punches out the blocks in 'need_repunching' again.
+  void RepunchBlocks(std::vector<scoped_refptr<internal::LogBlock>> need_repunching);
 
   // Rewrites a container metadata file, appending all entries in 'records'.
   // The new metadata file is created as a temporary file and renamed over the
@@ -364,11 +407,20 @@ class LogBlockManager : public BlockManager {
   // results of consistency checking (and repair, if applicable) are written to
   // 'report'.
   //
-  // Success or failure is set in 'result_status'.
+  // Success or failure is set in 'result_status'. Any repairs deferred until
+  // the block manager is open are returned in 'deferred'.
   void OpenDataDir(DataDir* dir,
                    FsReport* report,
+                   std::unique_ptr<internal::DeferredRepair>* deferred,
                    Status* result_status);
 
+  // Opens the container 'container_name' in 'dir', adding its live blocks to
+  // the block manager and its inconsistencies and the repairs it needs to
+  // 'result'.
+  Status OpenContainer(DataDir* dir,
+                       const std::string& container_name,
+                       internal::ContainerOpenResult* result);
+
   // Perform basic initialization.
   Status Init();
 
@@ -425,6 +477,18 @@ class LogBlockManager : public BlockManager {
   // they're WritableBlocks that were closed.
   BlockMap blocks_by_block_id_;
 
+  // Protects open_blocks_. Taken after 'lock_' when both are held.
+  simple_spinlock open_blocks_lock_;
+
+  // The LogBlocks of the live blocks which are open for reading, so that
+  // deleting a block yields the same LogBlock as its readers hold, and its
+  // space is only reclaimed once they're done with it. LogBlocks remove
+  // themselves before they're destroyed.
+  std::unordered_map<BlockId,
+                     internal::LogBlock*,
+                     BlockIdHash,
+                     BlockIdEqual> open_blocks_;
+
   // Contains block IDs for WritableBlocks that are still open for writing.
   // When a WritableBlock is closed, its ID is moved to blocks_by_block_id.
   //
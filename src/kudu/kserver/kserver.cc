@@ -23,6 +23,7 @@
 #include <mutex>
 #include <ostream>
 #include <string>
+#include <utility>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -90,6 +91,13 @@ METRIC_DEFINE_histogram(server, op_apply_run_time, "Operation Apply Run Time",
                         10000000, 2);
 #endif
 
+METRIC_DEFINE_histogram(server, raft_pool_thread_start_time, "Raft Pool Thread Start Time",
+                        MetricUnit::kMicroseconds,
+                        "Time it took to start each worker thread of the raft thread pool. "
+                        "Frequent starts indicate that idle threads are exiting only to be "
+                        "started again; see --thread_pool_park_idle_threads.",
+                        10000000, 2);
+
 namespace {
 
 int GetThreadPoolThreadLimit(Env* env) {
@@ -159,10 +167,14 @@ Status KuduServer::Init() {
                 .set_max_threads(server_wide_pool_limit)
                 .Build(&tablet_prepare_pool_));
 #endif
+  ThreadPoolMetrics raft_pool_metrics;
+  raft_pool_metrics.thread_start_time_us_histogram =
+      METRIC_raft_pool_thread_start_time.Instantiate(metric_entity_);
   RETURN_NOT_OK(ThreadPoolBuilder("raft")
                 .set_trace_metric_prefix("raft")
                 .set_max_threads(server_wide_pool_limit)
                 .set_idle_timeout(MonoDelta::FromSeconds(static_cast<double>(FLAGS_raft_thread_pool_idle_timeout_second)))
+                .set_metrics(std::move(raft_pool_metrics))
                 .Build(&raft_pool_));
 
   return Status::OK();
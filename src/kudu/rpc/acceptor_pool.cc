@@ -28,6 +28,7 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/messenger.h"
+#include "kudu/rpc/socket_profile.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
@@ -168,6 +169,15 @@ void AcceptorPool::RunThread() {
           << s.ToString() << THROTTLE_MSG;
       continue;
     }
+    SocketProfile profile;
+    if (messenger_->FindSocketProfile(remote, &profile)) {
+      s = profile.ApplyTo(&new_sock);
+      if (!s.ok()) {
+        KLOG_EVERY_N_SECS(WARNING, 1) << "Acceptor with remote = " << remote.ToString()
+            << " failed to apply socket profile (" << profile.ToString() << "): "
+            << s.ToString() << THROTTLE_MSG;
+      }
+    }
     rpc_connections_accepted_->Increment();
     messenger_->RegisterInboundSocket(&new_sock, remote);
   }
@@ -125,6 +125,7 @@ ClientNegotiation::ClientNegotiation(unique_ptr<Socket> socket,
       encryption_(encryption),
       tls_negotiated_(false),
       normal_tls_negotiated_(false),
+      tls_awaiting_server_ack_(false),
       authn_token_(std::move(authn_token)),
       psecret_(nullptr, std::free),
       negotiated_authn_(AuthenticationType::INVALID),
@@ -198,8 +199,12 @@ Status ClientNegotiation::Negotiate(unique_ptr<ErrorStatusPB>* rpc_error) {
   // TODO(KUDU-1921): allow the client to require TLS.
   if (encryption_ != RpcEncryption::DISABLED &&
       ContainsKey(server_features_, TLS)) {
+    Sockaddr server_addr;
+    if (socket_->GetPeerAddress(&server_addr).ok()) {
+      tls_session_key_ = server_addr.ToString();
+    }
     RETURN_NOT_OK(tls_context_->InitiateHandshake(security::TlsHandshakeType::CLIENT,
-                                                  &tls_handshake_));
+                                                  &tls_handshake_, tls_session_key_));
 
     if (negotiated_authn_ == AuthenticationType::SASL) {
       // When using SASL authentication, verifying the server's certificate is
@@ -541,16 +546,37 @@ Status ClientNegotiation::HandleTlsHandshake(const NegotiatePB& response) {
     return Status::NotAuthorized("No TLS handshake token in TLS_HANDSHAKE response from server");
   }
 
-  string token;
-  Status s = tls_handshake_.Continue(response.tls_handshake(), &token);
-  if (s.IsIncomplete()) {
-    // Another roundtrip is required to complete the handshake.
-    RETURN_NOT_OK(SendTlsHandshake(std::move(token)));
+  if (tls_awaiting_server_ack_) {
+    if (PREDICT_FALSE(!response.tls_handshake().empty())) {
+      return Status::NotAuthorized("unexpected TLS handshake token after the handshake completed");
+    }
+  } else {
+    string token;
+    Status s = tls_handshake_.Continue(response.tls_handshake(), &token);
+    if (s.IsIncomplete()) {
+      // Another roundtrip is required to complete the handshake.
+      RETURN_NOT_OK(SendTlsHandshake(std::move(token)));
+    }
+
+    // Check that the handshake step didn't produce an error. Will also propagate
+    // an Incomplete status.
+    RETURN_NOT_OK(s);
+
+    if (!token.empty()) {
+      // When a session is resumed, the server sends its Finished message first
+      // and the handshake completes on our side before the server sees ours.
+      // The server responds to every TLS_HANDSHAKE message, so wait for it to
+      // acknowledge ours before using the connection.
+      RETURN_NOT_OK(SendTlsHandshake(std::move(token)));
+      tls_awaiting_server_ack_ = true;
+      return Status::Incomplete("waiting for the server to complete the TLS handshake");
+    }
   }
 
-  // Check that the handshake step didn't produce an error. Will also propagate
-  // an Incomplete status.
-  RETURN_NOT_OK(s);
+  if (tls_handshake_.session_reused()) {
+    TRACE("Resumed TLS session");
+  }
+  tls_context_->CacheSession(tls_session_key_, tls_handshake_);
 
   // TLS handshake is finished.
   if (ContainsKey(server_features_, TLS_AUTHENTICATION_ONLY) &&
@@ -240,6 +240,14 @@ class ClientNegotiation {
   bool tls_negotiated_;
   bool normal_tls_negotiated_;
 
+  // Identifies the server to the cache of TLS sessions to resume.
+  std::string tls_session_key_;
+
+  // Whether the TLS handshake is complete on our side, but the server has yet
+  // to acknowledge the last handshake message, which we send when a session
+  // is resumed.
+  bool tls_awaiting_server_ack_;
+
   // TSK state.
   boost::optional<security::SignedTokenPB> authn_token_;
 
@@ -24,10 +24,13 @@
 #include <set>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 #include <boost/intrusive/detail/list_iterator.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/intrusive/list.hpp>
 #include <ev.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/map-util.h"
@@ -41,12 +44,71 @@
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/rpc_introspection.pb.h"
+#include "kudu/rpc/serialization.h"
 #include "kudu/rpc/transfer.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/net/socket.h"
 #include "kudu/util/status.h"
 
+DEFINE_int32(rpc_max_outbound_queue_calls, 0,
+             "If positive, the most calls which may wait to be sent on an outbound "
+             "connection. Further calls fail with ServiceUnavailable until the "
+             "remote end reads some, rather than building up a backlog behind a "
+             "slow peer.");
+TAG_FLAG(rpc_max_outbound_queue_calls, experimental);
+TAG_FLAG(rpc_max_outbound_queue_calls, runtime);
+
+DEFINE_int64(rpc_max_outbound_queue_bytes, 0,
+             "If positive, the most bytes of calls which may wait to be sent on an "
+             "outbound connection. Further calls fail with ServiceUnavailable until "
+             "the remote end reads some. A call is always queued on a connection "
+             "with nothing else to send, however large.");
+TAG_FLAG(rpc_max_outbound_queue_bytes, experimental);
+TAG_FLAG(rpc_max_outbound_queue_bytes, runtime);
+
+DEFINE_string(rpc_compression_codec, "none",
+              "The codec which client connections compress their calls with, "
+              "if the messenger has no compression policy and the server supports "
+              "it: one of 'none', 'lz4', 'snappy' or 'zlib'. The server compresses "
+              "its responses to compressed calls with the same codec. Applies to "
+              "the connections negotiated after it is set.");
+TAG_FLAG(rpc_compression_codec, experimental);
+TAG_FLAG(rpc_compression_codec, runtime);
+DEFINE_validator(rpc_compression_codec, [](const char* /*n*/, const std::string& v) {
+  return boost::iequals(v, "none") || boost::iequals(v, "lz4") ||
+         boost::iequals(v, "snappy") || boost::iequals(v, "zlib");
+});
+
+DEFINE_int32(rpc_compression_min_frame_bytes, 1024,
+             "The smallest RPC frame which connections that compress their calls, "
+             "and the responses to them, compress. Smaller frames are sent as they "
+             "are, as are the frames which compression doesn't make smaller.");
+TAG_FLAG(rpc_compression_min_frame_bytes, experimental);
+TAG_FLAG(rpc_compression_min_frame_bytes, runtime);
+
+DEFINE_int64(rpc_coalesce_transfers_max_bytes, 0,
+             "If positive, connections write the transfers queued behind the one "
+             "they are sending with the same writev, as long as the transfers "
+             "written together take at most this many bytes, rather than making "
+             "a system call, and usually sending a packet, for each of them.");
+TAG_FLAG(rpc_coalesce_transfers_max_bytes, experimental);
+TAG_FLAG(rpc_coalesce_transfers_max_bytes, runtime);
+
+DEFINE_int32(rpc_cork_window_us, 0,
+             "If positive, and --rpc_coalesce_transfers_max_bytes is too, a "
+             "connection with nothing to send waits up to this many microseconds "
+             "before writing a newly queued transfer, so that the transfers queued "
+             "meanwhile are written along with it. It writes right away once "
+             "--rpc_coalesce_transfers_max_bytes are queued.");
+TAG_FLAG(rpc_cork_window_us, experimental);
+TAG_FLAG(rpc_cork_window_us, runtime);
+
+DECLARE_bool(rpc_reactor_timer_wheel);
+
 using std::includes;
 using std::set;
 using std::shared_ptr;
@@ -72,6 +134,9 @@ Connection::Connection(ReactorThread *reactor_thread,
       direction_(direction),
       last_activity_time_(MonoTime::Now()),
       is_epoll_registered_(false),
+      num_queued_outbound_calls_(0),
+      num_queued_outbound_bytes_(0),
+      total_write_stall_us_(0),
       next_call_id_(1),
       credentials_policy_(policy),
       negotiation_complete_(false),
@@ -96,9 +161,52 @@ void Connection::EpollRegister(ev::loop_ref& loop) {
   read_io_.set(socket_->GetFd(), ev::READ);
   read_io_.set<Connection, &Connection::ReadHandler>(this);
   read_io_.start();
+  cork_timer_.set(loop);
+  cork_timer_.set<Connection, &Connection::CorkTimerHandler>(this);
+  is_epoll_registered_ = true;
+}
+
+void Connection::WaitToNegotiate(ev::loop_ref& loop, MonoTime deadline) {
+  DCHECK(reactor_thread_->IsCurrentThread());
+  DCHECK(!negotiation_complete_);
+  negotiation_deadline_ = deadline;
+  ev::io& io = direction_ == ConnectionDirection::CLIENT ? write_io_ : read_io_;
+  io.set(loop);
+  io.set(socket_->GetFd(), direction_ == ConnectionDirection::CLIENT ? ev::WRITE : ev::READ);
+  io.set<Connection, &Connection::NegotiationReadyHandler>(this);
+  io.start();
+  negotiation_wait_timer_.set(loop);
+  negotiation_wait_timer_.set<Connection, &Connection::NegotiationWaitTimeoutHandler>(this);
+  negotiation_wait_timer_.start((deadline - MonoTime::Now()).ToSeconds(), 0);
   is_epoll_registered_ = true;
 }
 
+void Connection::NegotiationReadyHandler(ev::io& /*watcher*/, int /*revents*/) {
+  SubmitNegotiation();
+}
+
+void Connection::NegotiationWaitTimeoutHandler(ev::timer& /*watcher*/, int /*revents*/) {
+  // The negotiation times out as soon as it starts.
+  SubmitNegotiation();
+}
+
+void Connection::SubmitNegotiation() {
+  DCHECK(reactor_thread_->IsCurrentThread());
+  // The negotiation thread does blocking I/O on the socket, which the
+  // reactor must stop watching first.
+  read_io_.stop();
+  write_io_.stop();
+  negotiation_wait_timer_.stop();
+  is_epoll_registered_ = false;
+  // A connect which failed makes the socket writable as well, in which case
+  // the negotiation fails right away.
+  Status s = reactor_thread_->SubmitConnectionNegotiation(this, negotiation_deadline_);
+  if (PREDICT_FALSE(!s.ok())) {
+    reactor_thread_->DestroyConnection(this, s.CloneAndPrepend(
+        "Unable to start connection negotiation"));
+  }
+}
+
 Connection::~Connection() {
   // Must clear the outbound_transfers_ list before deleting.
   CHECK(outbound_transfers_.begin() == outbound_transfers_.end());
@@ -174,13 +282,13 @@ void Connection::Shutdown(const Status &status,
 
   // Clear any outbound transfers.
   while (!outbound_transfers_.empty()) {
-    OutboundTransfer *t = &outbound_transfers_.front();
-    outbound_transfers_.pop_front();
-    delete t;
+    delete PopOutboundTransfer();
   }
 
   read_io_.stop();
   write_io_.stop();
+  negotiation_wait_timer_.stop();
+  cork_timer_.stop();
   is_epoll_registered_ = false;
   if (socket_) {
     Status sc_status = socket_->Close();
@@ -202,9 +310,23 @@ void Connection::QueueOutbound(gscoped_ptr<OutboundTransfer> transfer) {
 
   DVLOG(3) << "Queueing transfer: " << transfer->HexDump();
 
+  if (transfer->is_for_outbound_call()) {
+    num_queued_outbound_calls_++;
+  }
+  num_queued_outbound_bytes_ += transfer->TotalLength();
   outbound_transfers_.push_back(*transfer.release());
 
   if (negotiation_complete_ && !write_io_.is_active()) {
+    // Hold back what is queued for the cork window, unless it would already
+    // fill a write, so that the transfers queued meanwhile go out with it.
+    const int32_t cork_window_us = FLAGS_rpc_cork_window_us;
+    if (cork_window_us > 0 && FLAGS_rpc_coalesce_transfers_max_bytes > 0 &&
+        num_queued_outbound_bytes_ < FLAGS_rpc_coalesce_transfers_max_bytes) {
+      if (!cork_timer_.is_active()) {
+        cork_timer_.start(cork_window_us / 1e6, 0);
+      }
+      return;
+    }
     // Optimistically assume that the socket is writable if we didn't already
     // have something queued.
     if (ProcessOutboundTransfers() == kMoreToSend) {
@@ -213,29 +335,63 @@ void Connection::QueueOutbound(gscoped_ptr<OutboundTransfer> transfer) {
   }
 }
 
+OutboundTransfer* Connection::PopOutboundTransfer() {
+  return RemoveOutboundTransfer(&outbound_transfers_.front());
+}
+
+OutboundTransfer* Connection::RemoveOutboundTransfer(OutboundTransfer* transfer) {
+  outbound_transfers_.erase(outbound_transfers_.iterator_to(*transfer));
+  if (transfer->is_for_outbound_call()) {
+    num_queued_outbound_calls_--;
+  }
+  num_queued_outbound_bytes_ -= transfer->TotalLength();
+  return transfer;
+}
+
 Connection::CallAwaitingResponse::~CallAwaitingResponse() {
   DCHECK(conn->reactor_thread_->IsCurrentThread());
 }
 
 void Connection::CallAwaitingResponse::HandleTimeout(ev::timer &watcher, int revents) {
-  if (remaining_timeout > 0) {
-    if (watcher.remaining() < -1.0) {
-      LOG(WARNING) << "RPC call timeout handler was delayed by "
-                   << -watcher.remaining() << "s! This may be due to a process-wide "
-                   << "pause such as swapping, logging-related delays, or allocator lock "
-                   << "contention. Will allow an additional "
-                   << remaining_timeout << "s for a response.";
-    }
+  if (MaybeStartSecondStage(-watcher.remaining(), [&](double timeout) {
+        watcher.set(timeout, 0);
+        watcher.start();
+      })) {
+    return;
+  }
 
-    watcher.set(remaining_timeout, 0);
-    watcher.start();
-    remaining_timeout = 0;
+  conn->HandleOutboundCallTimeout(this);
+}
+
+void Connection::CallAwaitingResponse::HandleWheelTimeout() {
+  if (MaybeStartSecondStage((MonoTime::Now() - wheel_timer.deadline()).ToSeconds(),
+                            [&](double timeout) {
+        conn->reactor_thread_->ScheduleTimer(&wheel_timer, MonoDelta::FromSeconds(timeout));
+      })) {
     return;
   }
 
   conn->HandleOutboundCallTimeout(this);
 }
 
+bool Connection::CallAwaitingResponse::MaybeStartSecondStage(
+    double late_secs, const std::function<void(double)>& arm) {
+  if (remaining_timeout <= 0) {
+    return false;
+  }
+  if (late_secs > 1.0) {
+    LOG(WARNING) << "RPC call timeout handler was delayed by "
+                 << late_secs << "s! This may be due to a process-wide "
+                 << "pause such as swapping, logging-related delays, or allocator lock "
+                 << "contention. Will allow an additional "
+                 << remaining_timeout << "s for a response.";
+  }
+
+  arm(remaining_timeout);
+  remaining_timeout = 0;
+  return true;
+}
+
 void Connection::HandleOutboundCallTimeout(CallAwaitingResponse *car) {
   DCHECK(reactor_thread_->IsCurrentThread());
   DCHECK(car->call);
@@ -324,6 +480,19 @@ void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
     return;
   }
 
+  const int32_t max_calls = FLAGS_rpc_max_outbound_queue_calls;
+  const int64_t max_bytes = FLAGS_rpc_max_outbound_queue_bytes;
+  if (PREDICT_FALSE((max_calls > 0 && num_queued_outbound_calls_ >= max_calls) ||
+                    (max_bytes > 0 && num_queued_outbound_bytes_ >= max_bytes))) {
+    // Push back on the caller rather than queueing the call behind a backlog
+    // which the remote end isn't reading.
+    reactor_thread_->RecordOutboundQueueFull();
+    call->SetFailed(Status::ServiceUnavailable(Substitute(
+        "$0: outbound queue is full ($1 calls, $2 bytes waiting to be sent)",
+        ToString(), num_queued_outbound_calls_, num_queued_outbound_bytes_)));
+    return;
+  }
+
   // At this point the call has a serialized request, but no call header, since we haven't
   // yet assigned a call ID.
   DCHECK(!call->call_id_assigned());
@@ -338,6 +507,24 @@ void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
   // Serialize the actual bytes to be put on the wire.
   TransferPayload tmp_slices;
   size_t n_slices = call->SerializeTo(&tmp_slices);
+  if (request_codec_) {
+    size_t frame_size = 0;
+    for (const Slice& slice : tmp_slices) {
+      frame_size += slice.size();
+    }
+    if (static_cast<int64_t>(frame_size) >= FLAGS_rpc_compression_min_frame_bytes) {
+      size_t compressed_size;
+      MonoDelta cpu_time;
+      Status s = call->CompressTo(*request_codec_, &tmp_slices, &compressed_size, &cpu_time);
+      if (PREDICT_TRUE(s.ok())) {
+        reactor_thread_->RecordFrameCompression(frame_size, compressed_size, cpu_time);
+        n_slices = tmp_slices.size();
+      } else {
+        KLOG_EVERY_N_SECS(WARNING, 60) << ToString() << ": unable to compress call: "
+                                       << s.ToString();
+      }
+    }
+  }
 
   call->SetQueued();
 
@@ -351,9 +538,6 @@ void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
   // Set up the timeout timer.
   const MonoDelta &timeout = call->controller()->timeout();
   if (timeout.Initialized()) {
-    reactor_thread_->RegisterTimeout(&car->timeout_timer);
-    car->timeout_timer.set<CallAwaitingResponse, // NOLINT(*)
-                           &CallAwaitingResponse::HandleTimeout>(car.get());
 
     // For calls with a timeout of at least 500ms, we actually run the timeout
     // handler in two stages. The first timeout fires with a timeout 10% less
@@ -388,8 +572,17 @@ void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
       car->remaining_timeout = 0;
     }
 
-    car->timeout_timer.set(time, 0);
-    car->timeout_timer.start();
+    if (FLAGS_rpc_reactor_timer_wheel) {
+      CallAwaitingResponse* car_ptr = car.get();
+      car->wheel_timer.set_callback([car_ptr]() { car_ptr->HandleWheelTimeout(); });
+      reactor_thread_->ScheduleTimer(&car->wheel_timer, MonoDelta::FromSeconds(time));
+    } else {
+      reactor_thread_->RegisterTimeout(&car->timeout_timer);
+      car->timeout_timer.set<CallAwaitingResponse, // NOLINT(*)
+                             &CallAwaitingResponse::HandleTimeout>(car.get());
+      car->timeout_timer.set(time, 0);
+      car->timeout_timer.start();
+    }
   }
 
   TransferCallbacks *cb = new CallTransferCallbacks(std::move(call), this);
@@ -507,7 +700,7 @@ void Connection::ReadHandler(ev::io &watcher, int revents) {
 
   while (true) {
     if (!inbound_) {
-      inbound_.reset(new InboundTransfer());
+      inbound_.reset(new InboundTransfer(reactor_thread_->receive_buffer_pool()));
     }
     Status status = inbound_->ReceiveBuffer(*socket_);
     if (PREDICT_FALSE(!status.ok())) {
@@ -571,7 +764,17 @@ void Connection::HandleIncomingCall(gscoped_ptr<InboundTransfer> transfer) {
 void Connection::HandleCallResponse(gscoped_ptr<InboundTransfer> transfer) {
   DCHECK(reactor_thread_->IsCurrentThread());
   gscoped_ptr<CallResponse> resp(new CallResponse);
-  CHECK_OK(resp->ParseFrom(std::move(transfer)));
+  MonoDelta uncompress_cpu_time;
+  Status s = resp->ParseFrom(std::move(transfer), &uncompress_cpu_time);
+  if (PREDICT_FALSE(!s.ok())) {
+    // The responses which follow on the socket can't be trusted either.
+    LOG(WARNING) << ToString() << ": received bad response: " << s.ToString();
+    reactor_thread_->DestroyConnection(this, s.CloneAndPrepend("received bad response"));
+    return;
+  }
+  if (uncompress_cpu_time.Initialized()) {
+    reactor_thread_->RecordFrameDecompression(uncompress_cpu_time);
+  }
 
   CallAwaitingResponse *car_ptr =
     EraseKeyReturnValuePtr(&awaiting_response_, resp->call_id());
@@ -581,7 +784,8 @@ void Connection::HandleCallResponse(gscoped_ptr<InboundTransfer> transfer) {
     return;
   }
 
-  // The car->timeout_timer ev::timer will be stopped automatically by its destructor.
+  // The car->timeout_timer ev::timer, or car->wheel_timer, will be stopped
+  // automatically by its destructor.
   scoped_car car(car_pool_.make_scoped_ptr(car_ptr));
 
   if (PREDICT_FALSE(!car->call)) {
@@ -613,74 +817,117 @@ void Connection::WriteHandler(ev::io &watcher, int revents) {
     write_io_.stop();
     return;
   }
+  if (write_stall_start_.Initialized()) {
+    const MonoDelta stall = MonoTime::Now() - write_stall_start_;
+    total_write_stall_us_ += stall.ToMicroseconds();
+    reactor_thread_->RecordWriteStall(stall);
+    write_stall_start_ = MonoTime();
+  }
   if (ProcessOutboundTransfers() == kNoMoreToSend) {
     write_io_.stop();
   }
 }
 
+bool Connection::StartOutboundTransfer(OutboundTransfer* transfer) {
+  DCHECK(!transfer->TransferStarted());
+  if (!transfer->is_for_outbound_call()) {
+    return true;
+  }
+  CallAwaitingResponse* car = FindOrDie(awaiting_response_, transfer->call_id());
+  if (!car->call) {
+    // If the call has already timed out or has already been cancelled, the 'call'
+    // field would be set to NULL. In that case, don't bother sending it.
+    transfer->Abort(Status::Aborted("already timed out or cancelled"));
+    return false;
+  }
+
+  // If this is the start of the transfer, then check if the server has the
+  // required RPC flags. We have to wait until just before the transfer in
+  // order to ensure that the negotiation has taken place, so that the flags
+  // are available.
+  const set<RpcFeatureFlag>& required_features = car->call->required_rpc_features();
+  if (!includes(remote_features_.begin(), remote_features_.end(),
+                required_features.begin(), required_features.end())) {
+    Status s = Status::NotSupported("server does not support the required RPC features");
+    transfer->Abort(s);
+    Phase phase = negotiation_complete_ ? Phase::REMOTE_CALL : Phase::CONNECTION_NEGOTIATION;
+    car->call->SetFailed(std::move(s), phase);
+    // Test cancellation when 'call_' is in 'FINISHED_ERROR' state.
+    MaybeInjectCancellation(car->call);
+    car->call.reset();
+    return false;
+  }
+
+  car->call->SetSending();
+
+  // Test cancellation when 'call_' is in 'SENDING' state.
+  MaybeInjectCancellation(car->call);
+  return true;
+}
+
 Connection::ProcessOutboundTransfersResult Connection::ProcessOutboundTransfers() {
+  cork_timer_.stop();
+  const int64_t max_batch_bytes = FLAGS_rpc_coalesce_transfers_max_bytes;
+  std::vector<OutboundTransfer*>& batch = outbound_batch_;
   while (!outbound_transfers_.empty()) {
     OutboundTransfer* transfer = &(outbound_transfers_.front());
-    transfer = &(outbound_transfers_.front());
-
-    if (!transfer->TransferStarted()) {
-
-      if (transfer->is_for_outbound_call()) {
-        CallAwaitingResponse* car = FindOrDie(awaiting_response_, transfer->call_id());
-        if (!car->call) {
-          // If the call has already timed out or has already been cancelled, the 'call'
-          // field would be set to NULL. In that case, don't bother sending it.
-          outbound_transfers_.pop_front();
-          transfer->Abort(Status::Aborted("already timed out or cancelled"));
-          delete transfer;
-          continue;
-        }
+    if (!transfer->TransferStarted() && !StartOutboundTransfer(transfer)) {
+      delete PopOutboundTransfer();
+      continue;
+    }
 
-        // If this is the start of the transfer, then check if the server has the
-        // required RPC flags. We have to wait until just before the transfer in
-        // order to ensure that the negotiation has taken place, so that the flags
-        // are available.
-        const set<RpcFeatureFlag>& required_features = car->call->required_rpc_features();
-        if (!includes(remote_features_.begin(), remote_features_.end(),
-                      required_features.begin(), required_features.end())) {
-          outbound_transfers_.pop_front();
-          Status s = Status::NotSupported("server does not support the required RPC features");
-          transfer->Abort(s);
-          Phase phase = negotiation_complete_ ? Phase::REMOTE_CALL : Phase::CONNECTION_NEGOTIATION;
-          car->call->SetFailed(std::move(s), phase);
-          // Test cancellation when 'call_' is in 'FINISHED_ERROR' state.
-          MaybeInjectCancellation(car->call);
-          car->call.reset();
-          delete transfer;
+    // Queue the small transfers behind the first one into the same write.
+    // A batch only ever grows while its first transfer is being sent, which
+    // TLS relies on: a write which didn't go through must be retried with at
+    // least the same bytes.
+    batch.assign(1, transfer);
+    if (max_batch_bytes > 0) {
+      int64_t batch_bytes = transfer->TotalLength();
+      auto it = outbound_transfers_.begin();
+      for (++it; it != outbound_transfers_.end() && batch.size() < static_cast<size_t>(IOV_MAX);) {
+        OutboundTransfer* next = &*it++;
+        batch_bytes += next->TotalLength();
+        if (batch_bytes > max_batch_bytes) {
+          break;
+        }
+        if (!next->TransferStarted() && !StartOutboundTransfer(next)) {
+          batch_bytes -= next->TotalLength();
+          delete RemoveOutboundTransfer(next);
           continue;
         }
-
-        car->call->SetSending();
-
-        // Test cancellation when 'call_' is in 'SENDING' state.
-        MaybeInjectCancellation(car->call);
+        batch.push_back(next);
       }
+      reactor_thread_->RecordTransfersPerWrite(batch.size());
     }
 
     last_activity_time_ = reactor_thread_->cur_time();
-    Status status = transfer->SendBuffer(*socket_);
+    Status status = OutboundTransfer::SendBuffers(*socket_, batch.data(), batch.size());
     if (PREDICT_FALSE(!status.ok())) {
       KLOG_EVERY_N_SECS(WARNING, 300) << ToString() << " send error [EVERY 300 seconds]: " << status.ToString();
       reactor_thread_->DestroyConnection(this, status);
       return kConnectionDestroyed;
     }
 
-    if (!transfer->TransferFinished()) {
-      DVLOG(3) << ToString() << ": writeHandler: xfer not finished.";
-      return kMoreToSend;
+    for (OutboundTransfer* sent : batch) {
+      if (!sent->TransferFinished()) {
+        DVLOG(3) << ToString() << ": writeHandler: xfer not finished.";
+        // The socket's send buffer is full until the write handler runs.
+        write_stall_start_ = MonoTime::Now();
+        return kMoreToSend;
+      }
+      delete PopOutboundTransfer();
     }
-
-    outbound_transfers_.pop_front();
-    delete transfer;
   }
   return kNoMoreToSend;
 }
 
+void Connection::CorkTimerHandler(ev::timer& /*watcher*/, int /*revents*/) {
+  DCHECK(reactor_thread_->IsCurrentThread());
+  if (!write_io_.is_active() && ProcessOutboundTransfers() == kMoreToSend) {
+    write_io_.start();
+  }
+}
+
 std::string Connection::ToString() const {
   // This may be called from other threads, so we cannot
   // include anything in the output about the current state,
@@ -733,6 +980,19 @@ void Connection::CompleteNegotiation(Status negotiation_status,
 void Connection::MarkNegotiationComplete() {
   DCHECK(reactor_thread_->IsCurrentThread());
   negotiation_complete_ = true;
+
+  if (direction_ == ConnectionDirection::CLIENT && ContainsKey(remote_features_, COMPRESSION)) {
+    const RpcCompressionPolicy& policy =
+        reactor_thread_->reactor()->messenger()->rpc_compression_policy();
+    CompressionType type = policy ? policy(outbound_connection_id())
+                                  : GetCompressionCodecType(FLAGS_rpc_compression_codec);
+    Status s = GetCompressionCodec(type, &request_codec_);
+    if (PREDICT_FALSE(!s.ok())) {
+      LOG(WARNING) << ToString() << ": not compressing calls, unable to use codec "
+                   << CompressionType_Name(type) << ": " << s.ToString();
+      request_codec_ = nullptr;
+    }
+  }
 }
 
 Status Connection::DumpPB(const DumpRunningRpcsRequestPB& req,
@@ -744,6 +1004,15 @@ Status Connection::DumpPB(const DumpRunningRpcsRequestPB& req,
   } else {
     resp->set_state(RpcConnectionPB::NEGOTIATING);
   }
+  // While negotiating, the socket belongs to the negotiation thread.
+  TcpInfo tcp_info;
+  if (negotiation_complete_ && socket_ && socket_->GetTcpInfo(&tcp_info).ok()) {
+    TcpInfoPB* tcp_info_pb = resp->mutable_tcp_info();
+    tcp_info_pb->set_rtt_us(tcp_info.rtt_us);
+    tcp_info_pb->set_rtt_var_us(tcp_info.rtt_var_us);
+    tcp_info_pb->set_snd_cwnd(tcp_info.snd_cwnd);
+    tcp_info_pb->set_total_retransmits(tcp_info.total_retransmits);
+  }
 
   if (direction_ == ConnectionDirection::CLIENT) {
     for (const car_map_t::value_type& entry : awaiting_response_) {
@@ -754,6 +1023,13 @@ Status Connection::DumpPB(const DumpRunningRpcsRequestPB& req,
     }
 
     resp->set_outbound_queue_size(num_queued_outbound_transfers());
+    resp->set_outbound_queue_calls(num_queued_outbound_calls_);
+    resp->set_outbound_queue_bytes(num_queued_outbound_bytes_);
+    int64_t write_stall_us = total_write_stall_us_;
+    if (write_stall_start_.Initialized()) {
+      write_stall_us += (MonoTime::Now() - write_stall_start_).ToMicroseconds();
+    }
+    resp->set_write_stall_us(write_stall_us);
   } else if (direction_ == ConnectionDirection::SERVER) {
     if (negotiation_complete_) {
       // It's racy to dump credentials while negotiating, since the Connection
@@ -20,12 +20,14 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <boost/intrusive/list.hpp>
 #include <boost/optional/optional.hpp>
@@ -40,6 +42,7 @@
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/remote_user.h"
+#include "kudu/rpc/timer_wheel.h"
 #include "kudu/rpc/transfer.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
@@ -49,6 +52,8 @@
 
 namespace kudu {
 
+class CompressionCodec;
+
 namespace rpc {
 
 class DumpRunningRpcsRequestPB;
@@ -96,6 +101,13 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // one epoll loop at a time.
   void EpollRegister(ev::loop_ref& loop);
 
+  // Watch our socket on 'loop' until the negotiation can start without
+  // waiting on the network: for a client connection until the connect
+  // completes, for a server connection until the client sends something.
+  // Then, or once 'deadline' passes, the negotiation, to be done by
+  // 'deadline', is handed to a negotiation thread.
+  void WaitToNegotiate(ev::loop_ref& loop, MonoTime deadline);
+
   ~Connection();
 
   MonoTime last_activity_time() const {
@@ -116,6 +128,10 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // marked failed. The caller is expected to check if 'call' has been cancelled
   // before making the call.
   // Takes ownership of the 'call' object regardless of whether it succeeds or fails.
+  //
+  // If the connection already has --rpc_max_outbound_queue_calls calls or
+  // --rpc_max_outbound_queue_bytes bytes waiting to be sent, the call is
+  // failed with ServiceUnavailable rather than queued behind them.
   void QueueOutboundCall(std::shared_ptr<OutboundCall> call);
 
   // Queue a call response back to the client on the server side.
@@ -173,6 +189,15 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // libev callback when we may write to the socket.
   void WriteHandler(ev::io &watcher, int revents);
 
+  // libev callbacks when the socket is ready to negotiate, or when it's time
+  // to negotiate anyway. See WaitToNegotiate().
+  void NegotiationReadyHandler(ev::io &watcher, int revents);
+  void NegotiationWaitTimeoutHandler(ev::timer &watcher, int revents);
+
+  // libev callback at the end of the cork window of what was queued while
+  // there was nothing to send. See --rpc_cork_window_us.
+  void CorkTimerHandler(ev::timer &watcher, int revents);
+
   enum ProcessOutboundTransfersResult {
     // All of the transfers in the queue have been sent successfully.
     // The queue is now empty.
@@ -265,10 +290,22 @@ class Connection : public RefCountedThreadSafe<Connection> {
     // Notification from libev that the call has timed out.
     void HandleTimeout(ev::timer &watcher, int revents);
 
+    // Notification from the reactor thread's timer wheel that the call has
+    // timed out.
+    void HandleWheelTimeout();
+
+    // Returns whether the second stage of the timeout is left, arming it with
+    // 'arm' if so. 'late_secs' is how late the timer fired.
+    bool MaybeStartSecondStage(double late_secs,
+                               const std::function<void(double)>& arm);
+
     Connection *conn;
     std::shared_ptr<OutboundCall> call;
     ev::timer timeout_timer;
 
+    // Used instead of 'timeout_timer' with --rpc_reactor_timer_wheel.
+    TimerWheel::Timer wheel_timer;
+
     // We time out RPC calls in two stages. This is set to the amount of timeout
     // remaining after the next timeout fires. See Connection::QueueOutboundCall().
     double remaining_timeout;
@@ -308,6 +345,22 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // This must be called from the reactor thread.
   void QueueOutbound(gscoped_ptr<OutboundTransfer> transfer);
 
+  // Removes the first transfer from 'outbound_transfers_' and returns it.
+  OutboundTransfer* PopOutboundTransfer();
+
+  // Removes 'transfer' from 'outbound_transfers_' and returns it.
+  OutboundTransfer* RemoveOutboundTransfer(OutboundTransfer* transfer);
+
+  // Gets 'transfer', which is about to be sent for the first time, ready to
+  // send. Returns false if it was aborted instead, because its call timed
+  // out, was cancelled or needs RPC features the server lacks, in which case
+  // the caller must remove and delete it.
+  bool StartOutboundTransfer(OutboundTransfer* transfer);
+
+  // Stops watching the socket for WaitToNegotiate() and hands the negotiation
+  // to a negotiation thread.
+  void SubmitNegotiation();
+
   // Internal test function for injecting cancellation request when 'call'
   // reaches state specified in 'FLAGS_rpc_inject_cancellation_state'.
   void MaybeInjectCancellation(const std::shared_ptr<OutboundCall> &call);
@@ -343,6 +396,15 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // notifies us when our socket is readable.
   ev::io read_io_;
 
+  // Fires at the deadline of the negotiation that WaitToNegotiate() waits
+  // to start.
+  ev::timer negotiation_wait_timer_;
+  MonoTime negotiation_deadline_;
+
+  // Fires at the end of the cork window of the transfers queued while there
+  // was nothing to send.
+  ev::timer cork_timer_;
+
   // Set to true when the connection is registered on a loop.
   // This is used for a sanity check in the destructor that we are properly
   // un-registered before shutting down.
@@ -351,6 +413,19 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // waiting to be sent
   boost::intrusive::list<OutboundTransfer> outbound_transfers_; // NOLINT(*)
 
+  // The transfers ProcessOutboundTransfers() is writing together, kept
+  // around to save allocating it for each write.
+  std::vector<OutboundTransfer*> outbound_batch_;
+
+  // The number of calls and of bytes in 'outbound_transfers_'.
+  int32_t num_queued_outbound_calls_;
+  int64_t num_queued_outbound_bytes_;
+
+  // When the socket last became unable to take more of 'outbound_transfers_',
+  // if it still can't, and the total microseconds it couldn't.
+  MonoTime write_stall_start_;
+  int64_t total_write_stall_us_;
+
   // Calls which have been sent and are now waiting for a response.
   car_map_t awaiting_response_;
 
@@ -367,6 +442,10 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // RPC features supported by the remote end of the connection.
   std::set<RpcFeatureFlag> remote_features_;
 
+  // The codec that this client connection compresses its requests with, as
+  // picked when negotiation completed, or null if it doesn't compress them.
+  const CompressionCodec* request_codec_ = nullptr;
+
   // Pool from which CallAwaitingResponse objects are allocated.
   // Also a funny name.
   ObjectPool<CallAwaitingResponse> car_pool_;
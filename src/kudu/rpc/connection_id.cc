@@ -54,9 +54,14 @@ string ConnectionId::ToString() const {
     remote = remote_.ToString();
   }
 
-  return strings::Substitute("{remote=$0, user_credentials=$1}",
+  string stripe;
+  if (stripe_ != 0) {
+    stripe = strings::Substitute(", stripe=$0", stripe_);
+  }
+  return strings::Substitute("{remote=$0, user_credentials=$1$2}",
                              remote,
-                             user_credentials_.ToString());
+                             user_credentials_.ToString(),
+                             stripe);
 }
 
 size_t ConnectionId::HashCode() const {
@@ -64,13 +69,15 @@ size_t ConnectionId::HashCode() const {
   boost::hash_combine(seed, remote_.HashCode());
   boost::hash_combine(seed, hostname_);
   boost::hash_combine(seed, user_credentials_.HashCode());
+  boost::hash_combine(seed, stripe_);
   return seed;
 }
 
 bool ConnectionId::Equals(const ConnectionId& other) const {
   return remote() == other.remote() &&
       hostname_ == other.hostname_ &&
-      user_credentials().Equals(other.user_credentials());
+      user_credentials().Equals(other.user_credentials()) &&
+      stripe_ == other.stripe_;
 }
 
 size_t ConnectionIdHash::operator() (const ConnectionId& conn_id) const {
@@ -50,6 +50,12 @@ class ConnectionId {
 
   const UserCredentials& user_credentials() const { return user_credentials_; }
 
+  // Calls with different stripes go over different connections, even if the
+  // rest of their ConnectionIds are the same. Defaults to 0.
+  void set_stripe(int stripe) { stripe_ = stripe; }
+
+  int stripe() const { return stripe_; }
+
   // Copy state from another object to this one.
   void CopyFrom(const ConnectionId& other);
 
@@ -68,6 +74,8 @@ class ConnectionId {
   std::string hostname_;
 
   UserCredentials user_credentials_;
+
+  int stripe_ = 0;
 };
 
 class ConnectionIdHash {
@@ -32,6 +32,7 @@
 
 #include "kudu/gutil/callback.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/request_tracker.h"
 #include "kudu/rpc/response_callback.h"
 #include "kudu/rpc/result_tracker.h"
@@ -624,6 +625,43 @@ TEST_F(ExactlyOnceRpcTest, TestExactlyOnceSemanticsGarbageCollectionStressTest)
   NO_PENDING_FATALS();
 }
 
+// Tests that the clients spread across the shards of the result tracker are each
+// garbage collected, and only once their responses or themselves expired.
+TEST_F(ExactlyOnceRpcTest, TestGarbageCollectionAcrossShards) {
+  FLAGS_remember_clients_ttl_ms = 500;
+  FLAGS_remember_responses_ttl_ms = 100;
+  ASSERT_OK(StartServer());
+
+  const int kNumClients = 50;
+  auto make_calls = [&](Status* last_status) {
+    for (int i = 0; i < kNumClients; i++) {
+      RpcController controller;
+      ExactlyOnceRequestPB req;
+      ExactlyOnceResponsePB resp;
+      req.set_value_to_add(1);
+      AddRequestId(&controller, strings::Substitute("client-$0", i), 0, attempt_nos_++);
+      *last_status = proxy_->AddExactlyOnce(req, &resp, &controller);
+      if (!last_status->ok()) return;
+    }
+  };
+  Status s;
+  make_calls(&s);
+  ASSERT_OK(s);
+  int64_t memory_consumption = mem_tracker_->consumption();
+
+  // The responses expire before the clients do.
+  SleepFor(MonoDelta::FromMilliseconds(FLAGS_remember_responses_ttl_ms));
+  result_tracker_->GCResults();
+  ASSERT_LT(mem_tracker_->consumption(), memory_consumption);
+  ASSERT_GT(mem_tracker_->consumption(), 0);
+  make_calls(&s);
+  ASSERT_TRUE(s.IsRemoteError()) << s.ToString();
+  ASSERT_STR_CONTAINS(s.ToString(), "is stale");
+
+  SleepFor(MonoDelta::FromMilliseconds(FLAGS_remember_clients_ttl_ms));
+  result_tracker_->GCResults();
+  ASSERT_EQ(0, mem_tracker_->consumption());
+}
 
 } // namespace rpc
 } // namespace kudu
@@ -21,6 +21,7 @@
 #include <memory>
 #include <ostream>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <google/protobuf/message.h>
 #include <google/protobuf/message_lite.h>
@@ -28,13 +29,18 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/connection.h"
+#include "kudu/rpc/reactor.h"
 #include "kudu/rpc/rpc_introspection.pb.h"
 #include "kudu/rpc/rpc_sidecar.h"
 #include "kudu/rpc/rpcz_store.h"
 #include "kudu/rpc/serialization.h"
 #include "kudu/rpc/service_if.h"
 #include "kudu/rpc/transfer.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/debug/trace_event.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/trace.h"
@@ -45,6 +51,18 @@ class FieldDescriptor;
 }
 }
 
+DEFINE_int32(rpc_trace_sample_every_n_calls, 1,
+             "Trace one in every this many inbound calls received by each reactor "
+             "thread. The untraced calls skip allocating a trace and formatting the "
+             "TRACE() messages for it, and so are left out of the /rpcz samples and "
+             "of the traces logged for slow calls. All calls are traced if this is "
+             "1 or less, or if --rpc_dump_all_traces is set.");
+TAG_FLAG(rpc_trace_sample_every_n_calls, experimental);
+TAG_FLAG(rpc_trace_sample_every_n_calls, runtime);
+
+DECLARE_bool(rpc_dump_all_traces);
+DECLARE_int32(rpc_compression_min_frame_bytes);
+
 using google::protobuf::FieldDescriptor;
 using google::protobuf::Message;
 using google::protobuf::MessageLite;
@@ -56,9 +74,27 @@ using strings::Substitute;
 namespace kudu {
 namespace rpc {
 
+namespace {
+
+// Whether to trace the call arriving on this thread.
+bool ShouldTraceCall() {
+  static __thread int32_t calls_since_traced = 0;
+  const int32_t every_n = FLAGS_rpc_trace_sample_every_n_calls;
+  if (PREDICT_TRUE(every_n <= 1) || PREDICT_FALSE(FLAGS_rpc_dump_all_traces)) {
+    return true;
+  }
+  if (++calls_since_traced < every_n) {
+    return false;
+  }
+  calls_since_traced = 0;
+  return true;
+}
+
+} // anonymous namespace
+
 InboundCall::InboundCall(Connection* conn)
   : conn_(conn),
-    trace_(new Trace),
+    trace_(ShouldTraceCall() ? new Trace : nullptr),
     method_info_(nullptr),
     deadline_(MonoTime::Max()) {
   RecordCallReceived();
@@ -70,6 +106,24 @@ Status InboundCall::ParseFrom(gscoped_ptr<InboundTransfer> transfer) {
   TRACE_EVENT_FLOW_BEGIN0("rpc", "InboundCall", this);
   TRACE_EVENT0("rpc", "InboundCall::ParseFrom");
   RETURN_NOT_OK(serialization::ParseMessage(transfer->data(), &header_, &serialized_request_));
+  if (PREDICT_FALSE(header_.has_frame_compression())) {
+    // The body is the actual request frame, compressed.
+    RETURN_NOT_OK(GetCompressionCodec(header_.frame_compression(), &response_codec_));
+    if (PREDICT_FALSE(!response_codec_)) {
+      return Status::Corruption("Invalid packet: frame compressed without a codec");
+    }
+    MonoDelta cpu_time;
+    RETURN_NOT_OK(serialization::UncompressFrame(*response_codec_, serialized_request_,
+                                                 header_.uncompressed_frame_size(),
+                                                 &uncompressed_frame_, &cpu_time));
+    conn_->reactor_thread()->RecordFrameDecompression(cpu_time);
+    header_.Clear();
+    RETURN_NOT_OK(serialization::ParseMessage(Slice(uncompressed_frame_), &header_,
+                                              &serialized_request_));
+    if (PREDICT_FALSE(header_.has_frame_compression())) {
+      return Status::Corruption("Invalid packet: compressed frame is compressed again");
+    }
+  }
 
   // Adopt the service/method info from the header as soon as it's available.
   if (PREDICT_FALSE(!header_.has_remote_method())) {
@@ -177,6 +231,7 @@ void InboundCall::SerializeResponseBuffer(const MessageLite& response,
     // happened.
   }
 
+  compressed_response_buf_.clear();
   uint32_t protobuf_msg_size = response.ByteSize();
 
   ResponseHeader resp_hdr;
@@ -195,14 +250,56 @@ void InboundCall::SerializeResponseBuffer(const MessageLite& response,
   int64_t main_msg_size = sidecar_byte_size + response_msg_buf_.size();
   serialization::SerializeHeader(resp_hdr, main_msg_size,
                                  &response_hdr_buf_);
+  if (response_codec_ && static_cast<int64_t>(response_hdr_buf_.size()) + main_msg_size >=
+                             FLAGS_rpc_compression_min_frame_bytes) {
+    CompressResponseBuffer();
+  }
+}
+
+void InboundCall::CompressResponseBuffer() {
+  TransferPayload frame;
+  SerializeResponseTo(&frame);
+  size_t frame_size = 0;
+  for (const Slice& slice : frame) {
+    frame_size += slice.size();
+  }
+  MonoDelta cpu_time;
+  Status s = serialization::CompressFrame(*response_codec_, frame, &compressed_response_buf_,
+                                          &cpu_time);
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_EVERY_N_SECS(WARNING, 60) << ToString() << ": unable to compress response: "
+                                   << s.ToString();
+    compressed_response_buf_.clear();
+    return;
+  }
+  conn_->reactor_thread()->RecordFrameCompression(
+      frame_size, compressed_response_buf_.size(), cpu_time);
+  if (compressed_response_buf_.size() >= frame_size) {
+    compressed_response_buf_.clear();
+    return;
+  }
+
+  ResponseHeader resp_hdr;
+  resp_hdr.set_call_id(header_.call_id());
+  resp_hdr.set_frame_compression(response_codec_->type());
+  resp_hdr.set_uncompressed_frame_size(frame_size);
+  serialization::SerializeHeader(resp_hdr, compressed_response_buf_.size(),
+                                 &response_hdr_buf_);
 }
 
 size_t InboundCall::SerializeResponseTo(TransferPayload* slices) const {
   TRACE_EVENT0("rpc", "InboundCall::SerializeResponseTo");
   DCHECK_GT(response_hdr_buf_.size(), 0);
   DCHECK_GT(response_msg_buf_.size(), 0);
+  if (compressed_response_buf_.size() > 0) {
+    // The message and the sidecars are in the compressed frame.
+    slices->resize(2);
+    (*slices)[0] = Slice(response_hdr_buf_);
+    (*slices)[1] = Slice(compressed_response_buf_);
+    return 2;
+  }
   size_t n_slices = 2 + outbound_sidecars_.size();
-  DCHECK_LE(n_slices, slices->size());
+  slices->resize(n_slices);
   auto slice_iter = slices->begin();
   *slice_iter++ = Slice(response_hdr_buf_);
   *slice_iter++ = Slice(response_msg_buf_);
@@ -340,11 +437,13 @@ Status InboundCall::GetInboundSidecar(int idx, Slice* sidecar) const {
 
 void InboundCall::DiscardTransfer() {
   transfer_.reset();
+  uncompressed_frame_.clear();
+  uncompressed_frame_.shrink_to_fit();
 }
 
 size_t InboundCall::GetTransferSize() {
   if (!transfer_) return 0;
-  return transfer_->data().size();
+  return transfer_->data().size() + uncompressed_frame_.size();
 }
 
 } // namespace rpc
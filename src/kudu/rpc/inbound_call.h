@@ -47,6 +47,7 @@ class MessageLite;
 
 namespace kudu {
 
+class CompressionCodec;
 class Histogram;
 class Sockaddr;
 class Trace;
@@ -143,6 +144,8 @@ class InboundCall {
 
   const scoped_refptr<Connection>& connection() const;
 
+  // Returns the trace of this call, or nullptr if it wasn't sampled for
+  // tracing when it arrived (see --rpc_trace_sample_every_n_calls).
   Trace* trace();
 
   const InboundCallTiming& timing() const {
@@ -221,6 +224,10 @@ class InboundCall {
   void SerializeResponseBuffer(const google::protobuf::MessageLite& response,
                                bool is_success);
 
+  // Replaces the response serialized by SerializeResponseBuffer() with a frame
+  // which carries it compressed with 'response_codec_', if that's smaller.
+  void CompressResponseBuffer();
+
   // When RPC call Handle() completed execution on the server side.
   // Updates the Histogram with time elapsed since the call was started,
   // and should only be called once on a given instance.
@@ -242,10 +249,24 @@ class InboundCall {
   // by 'serialized_request_' above.
   gscoped_ptr<InboundTransfer> transfer_;
 
+  // If the call arrived compressed, the request frame uncompressed, which
+  // 'serialized_request_' and the inbound sidecars refer into instead. It's
+  // discarded along with 'transfer_'.
+  faststring uncompressed_frame_;
+
+  // The codec the call arrived compressed with, which its response is
+  // compressed with too, or null if it arrived uncompressed.
+  const CompressionCodec* response_codec_ = nullptr;
+
   // The buffers for serialized response. Set by SerializeResponseBuffer().
   faststring response_hdr_buf_;
   faststring response_msg_buf_;
 
+  // If the response is sent compressed, the body of the frame which carries
+  // it, whose header is then in 'response_hdr_buf_'. Set by
+  // CompressResponseBuffer().
+  faststring compressed_response_buf_;
+
   // Vector of additional sidecars that are tacked on to the call's response
   // after serialization of the protobuf. See rpc/rpc_sidecar.h for more info.
   std::vector<std::unique_ptr<RpcSidecar>> outbound_sidecars_;
@@ -258,7 +279,7 @@ class InboundCall {
   // many slices as header_.sidecar_offsets_size().
   Slice inbound_sidecar_slices_[TransferLimits::kMaxSidecars];
 
-  // The trace buffer.
+  // The trace buffer, if the call is traced.
   scoped_refptr<Trace> trace_;
 
   // Timing information related to this RPC call.
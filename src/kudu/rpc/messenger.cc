@@ -17,6 +17,7 @@
 
 #include "kudu/rpc/messenger.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <functional>
 #include <mutex>
@@ -25,6 +26,7 @@
 #include <type_traits>
 #include <utility>
 
+#include <boost/algorithm/string/predicate.hpp>
 #include <glog/logging.h>
 
 #include "kudu/gutil/gscoped_ptr.h"
@@ -49,9 +51,11 @@
 #include "kudu/security/tls_context.h"
 #include "kudu/security/token_verifier.h"
 #include "kudu/util/flags.h"
+#include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/socket.h"
+#include "kudu/util/os-util.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread_restrictions.h"
@@ -60,6 +64,7 @@
 using std::string;
 using std::shared_ptr;
 using std::make_shared;
+using std::vector;
 using strings::Substitute;
 
 constexpr int kMinSockBuf = 1024;
@@ -71,6 +76,25 @@ template <typename Signature> class function;
 namespace kudu {
 namespace rpc {
 
+namespace {
+
+Status ParseReactorCpuAffinity(const string& value, ReactorCpuAffinity* affinity) {
+  if (boost::iequals(value, "none")) {
+    *affinity = ReactorCpuAffinity::NONE;
+  } else if (boost::iequals(value, "core")) {
+    *affinity = ReactorCpuAffinity::CORE;
+  } else if (boost::iequals(value, "numa_node")) {
+    *affinity = ReactorCpuAffinity::NUMA_NODE;
+  } else {
+    return Status::InvalidArgument(Substitute(
+        "reactor CPU affinity must be one of 'none', 'core', or 'numa_node', not '$0'",
+        value));
+  }
+  return Status::OK();
+}
+
+} // anonymous namespace
+
 MessengerBuilder::MessengerBuilder(std::string name)
     : name_(std::move(name)),
       connection_keepalive_time_(MonoDelta::FromMilliseconds(65000)),
@@ -87,7 +111,8 @@ MessengerBuilder::MessengerBuilder(std::string name)
       enable_inbound_tls_(false),
       reuseport_(false),
       send_buf_(0),
-      receive_buf_(0){
+      receive_buf_(0),
+      reactor_cpu_affinity_("none") {
 }
 
 MessengerBuilder& MessengerBuilder::set_connection_keepalive_time(const MonoDelta &keepalive) {
@@ -211,6 +236,17 @@ MessengerBuilder& MessengerBuilder::set_receive_buf(int receive_buf) {
   return *this;
 }
 
+MessengerBuilder& MessengerBuilder::set_reactor_cpu_affinity(
+    const string& reactor_cpu_affinity) {
+  reactor_cpu_affinity_ = reactor_cpu_affinity;
+  return *this;
+}
+
+MessengerBuilder& MessengerBuilder::set_rpc_compression_policy(RpcCompressionPolicy policy) {
+  rpc_compression_policy_ = std::move(policy);
+  return *this;
+}
+
 Status MessengerBuilder::Build(shared_ptr<Messenger> *msgr) {
   // Initialize SASL library before we start making requests
   RETURN_NOT_OK(SaslInit(!keytab_file_.empty()));
@@ -229,6 +265,9 @@ Status MessengerBuilder::Build(shared_ptr<Messenger> *msgr) {
                               rpc_encryption_,
                               &new_msgr->encryption_));
 
+  RETURN_NOT_OK(ParseReactorCpuAffinity(reactor_cpu_affinity_,
+                                        &new_msgr->reactor_cpu_affinity_));
+
   RETURN_NOT_OK(new_msgr->Init());
   if (new_msgr->encryption_ != RpcEncryption::DISABLED && enable_inbound_tls_) {
     auto* tls_context = new_msgr->mutable_tls_context();
@@ -398,10 +437,19 @@ void Messenger::QueueOutboundCall(const shared_ptr<OutboundCall> &call) {
   reactor->QueueOutboundCall(call);
 }
 
+void Messenger::WarmUpConnection(const ConnectionId& conn_id) {
+  Reactor *reactor = RemoteToReactor(conn_id.remote());
+  reactor->QueueWarmUpConnection(conn_id);
+}
+
 void Messenger::QueueInboundCall(gscoped_ptr<InboundCall> call) {
-  shared_lock<rw_spinlock> guard(lock_.get_lock());
-  scoped_refptr<RpcService>* service = FindOrNull(rpc_services_,
-                                                  call->remote_method().service_name());
+  // The service may handle the call right away, on this thread, so it's called
+  // without holding 'lock_'.
+  scoped_refptr<RpcService> service;
+  {
+    shared_lock<rw_spinlock> guard(lock_.get_lock());
+    FindCopy(rpc_services_, call->remote_method().service_name(), &service);
+  }
   if (PREDICT_FALSE(!service)) {
     Status s =  Status::ServiceUnavailable(Substitute("service $0 not registered on $1",
                                                       call->remote_method().service_name(), name_));
@@ -410,10 +458,10 @@ void Messenger::QueueInboundCall(gscoped_ptr<InboundCall> call) {
     return;
   }
 
-  call->set_method_info((*service)->LookupMethod(call->remote_method()));
+  call->set_method_info(service->LookupMethod(call->remote_method()));
 
   // The RpcService will respond to the client on success or failure.
-  WARN_NOT_OK((*service)->QueueInboundCall(std::move(call)), "Unable to handle RPC call");
+  WARN_NOT_OK(service->QueueInboundCall(std::move(call)), "Unable to handle RPC call");
 }
 
 void Messenger::QueueCancellation(const shared_ptr<OutboundCall> &call) {
@@ -422,7 +470,7 @@ void Messenger::QueueCancellation(const shared_ptr<OutboundCall> &call) {
 }
 
 void Messenger::RegisterInboundSocket(Socket *new_socket, const Sockaddr &remote) {
-  Reactor *reactor = RemoteToReactor(remote);
+  Reactor *reactor = InboundSocketToReactor(*new_socket, remote);
   reactor->RegisterInboundSocket(new_socket, remote);
 }
 
@@ -441,6 +489,8 @@ Messenger::Messenger(const MessengerBuilder &bld)
     reuseport_(bld.reuseport_),
     send_buf_(bld.send_buf_),
     receive_buf_(bld.receive_buf_),
+    rpc_compression_policy_(bld.rpc_compression_policy_),
+    reactor_cpu_affinity_(ReactorCpuAffinity::NONE),
     retain_self_(this) {
   for (int i = 0; i < bld.num_reactors_; i++) {
     reactors_.push_back(new Reactor(retain_self_, i, bld));
@@ -469,8 +519,66 @@ Reactor* Messenger::RemoteToReactor(const Sockaddr &remote) {
   return reactors_[reactor_idx];
 }
 
+Reactor* Messenger::InboundSocketToReactor(const Socket& socket, const Sockaddr& remote) {
+  if (reactor_cpu_affinity_ == ReactorCpuAffinity::NONE) {
+    return RemoteToReactor(remote);
+  }
+  int cpu;
+  Status s = socket.GetIncomingCpu(&cpu);
+  if (PREDICT_FALSE(!s.ok() || cpu < 0)) {
+    KLOG_FIRST_N(WARNING, 1) << "Unable to get the incoming CPU of an inbound connection: "
+                             << s.ToString();
+    return RemoteToReactor(remote);
+  }
+  // Handing the connection to a reactor on the CPU which processes its packets,
+  // or failing that on the same NUMA node, keeps receiving and deserializing
+  // its calls cache-local.
+  vector<Reactor*> candidates;
+  for (Reactor* r : reactors_) {
+    if (std::find(r->cpus().begin(), r->cpus().end(), cpu) != r->cpus().end()) {
+      candidates.push_back(r);
+    }
+  }
+  if (candidates.empty()) {
+    for (const NumaNode& node : reactor_numa_nodes_) {
+      if (std::find(node.cpus.begin(), node.cpus.end(), cpu) == node.cpus.end()) {
+        continue;
+      }
+      for (Reactor* r : reactors_) {
+        if (r->numa_node() == node.id) {
+          candidates.push_back(r);
+        }
+      }
+    }
+  }
+  if (candidates.empty()) {
+    return RemoteToReactor(remote);
+  }
+  return candidates[remote.HashCode() % candidates.size()];
+}
+
+Status Messenger::PinReactors() {
+  RETURN_NOT_OK_PREPEND(GetNumaNodes(&reactor_numa_nodes_),
+                        "Unable to get the NUMA nodes to pin the reactors to");
+  const int num_nodes = reactor_numa_nodes_.size();
+  for (int i = 0; i < num_reactors(); i++) {
+    const NumaNode& node = reactor_numa_nodes_[i % num_nodes];
+    vector<int> cpus;
+    if (reactor_cpu_affinity_ == ReactorCpuAffinity::CORE) {
+      cpus.push_back(node.cpus[(i / num_nodes) % node.cpus.size()]);
+    } else {
+      cpus = node.cpus;
+    }
+    reactors_[i]->set_cpu_affinity(std::move(cpus), node.id);
+  }
+  return Status::OK();
+}
+
 Status Messenger::Init() {
   RETURN_NOT_OK(tls_context_->Init());
+  if (reactor_cpu_affinity_ != ReactorCpuAffinity::NONE) {
+    RETURN_NOT_OK(PinReactors());
+  }
   for (Reactor* r : reactors_) {
     RETURN_NOT_OK(r->Init());
   }
@@ -544,6 +652,21 @@ void Messenger::set_receive_buffer(int receive_buf){
   receive_buf_ = receive_buf;
 }
 
+void Messenger::SetSocketProfile(const Sockaddr& remote, const SocketProfile& profile) {
+  std::lock_guard<simple_spinlock> l(socket_profiles_lock_);
+  socket_profiles_[remote.host()] = profile;
+}
+
+bool Messenger::FindSocketProfile(const Sockaddr& remote, SocketProfile* profile) const {
+  std::lock_guard<simple_spinlock> l(socket_profiles_lock_);
+  auto it = socket_profiles_.find(remote.host());
+  if (it == socket_profiles_.end()) {
+    return false;
+  }
+  *profile = it->second;
+  return true;
+}
+
 ThreadPool* Messenger::negotiation_pool(ConnectionDirection dir) {
   switch (dir) {
     case ConnectionDirection::CLIENT: return client_negotiation_pool_.get();
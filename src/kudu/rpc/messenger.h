@@ -18,6 +18,7 @@
 #define KUDU_RPC_MESSENGER_H
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -31,12 +32,15 @@
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/rpc/connection_direction.h"
+#include "kudu/rpc/socket_profile.h"
 #include "kudu/security/security_flags.h"
 #include "kudu/security/token.pb.h"
+#include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
+#include "kudu/util/os-util.h"
 #include "kudu/util/status.h"
 
 namespace boost {
@@ -60,6 +64,7 @@ using security::RpcAuthentication;
 using security::RpcEncryption;
 
 class AcceptorPool;
+class ConnectionId;
 class DumpRunningRpcsRequestPB;
 class DumpRunningRpcsResponsePB;
 class InboundCall;
@@ -69,6 +74,22 @@ class Reactor;
 class RpcService;
 class RpczStore;
 
+// How the reactor threads of a Messenger are pinned to CPUs.
+enum class ReactorCpuAffinity {
+  // The reactor threads may run on any CPU.
+  NONE,
+  // Each reactor thread is pinned to a CPU. The reactors are spread across
+  // the NUMA nodes.
+  CORE,
+  // Each reactor thread is pinned to the CPUs of a NUMA node. The reactors
+  // are spread across the NUMA nodes.
+  NUMA_NODE,
+};
+
+// Returns the codec which a client connection to 'conn_id' compresses its
+// calls with, or NO_COMPRESSION. See MessengerBuilder::set_rpc_compression_policy().
+typedef std::function<CompressionType(const ConnectionId& conn_id)> RpcCompressionPolicy;
+
 struct AcceptorPoolInfo {
  public:
   explicit AcceptorPoolInfo(Sockaddr bind_address)
@@ -166,6 +187,11 @@ class MessengerBuilder {
   // Configure the messenger to set the SO_REUSEPORT socket option.
   MessengerBuilder& set_reuseport();
 
+  // Set how the reactor threads are pinned to CPUs: 'none', 'core' or 'numa_node'.
+  // When they are pinned, each inbound connection is handed to a reactor on the
+  // CPU, or else the NUMA node, which the kernel processes its packets on.
+  MessengerBuilder& set_reactor_cpu_affinity(const std::string& reactor_cpu_affinity);
+
   // Configure the messanger to set the SO_SNDBUF socket option for outbound sockets.
   // 0 turns off the socket option. Values below kMinTcpBuf are treated as 0.
   MessengerBuilder& set_send_buf(int send_buf);
@@ -174,6 +200,14 @@ class MessengerBuilder {
   // 0 turns off the socket option. Values below kMinTcpBuf are treated as 0.
   MessengerBuilder& set_receive_buf(int receive_buf);
 
+  // Set the policy which picks the codec that each client connection
+  // compresses its calls with, such as one which compresses them on the links
+  // between regions and leaves those within a region alone. It's consulted
+  // once for each connection, when its negotiation completes, and only if the
+  // server supports compression. Without a policy, every connection uses
+  // --rpc_compression_codec.
+  MessengerBuilder& set_rpc_compression_policy(RpcCompressionPolicy policy);
+
   Status Build(std::shared_ptr<Messenger> *msgr);
 
  private:
@@ -199,6 +233,8 @@ class MessengerBuilder {
   bool reuseport_;
   int send_buf_;
   int receive_buf_;
+  std::string reactor_cpu_affinity_;
+  RpcCompressionPolicy rpc_compression_policy_;
 };
 
 // A Messenger is a container for the reactor threads which run event loops
@@ -272,6 +308,11 @@ class Messenger {
   // Queue a cancellation for the given outbound call.
   void QueueCancellation(const std::shared_ptr<OutboundCall> &call);
 
+  // Start establishing the connection of 'conn_id' on the reactor its calls
+  // are assigned to, so that the first of them doesn't wait for the connect
+  // and negotiation. Does nothing if the connection is up already.
+  void WarmUpConnection(const ConnectionId& conn_id);
+
   // Take ownership of the socket via Socket::Release
   void RegisterInboundSocket(Socket *new_socket, const Sockaddr &remote);
 
@@ -316,6 +357,12 @@ class Messenger {
 
   int num_reactors() const { return reactors_.size(); }
 
+  ReactorCpuAffinity reactor_cpu_affinity() const { return reactor_cpu_affinity_; }
+
+  // The NUMA nodes which the reactor threads are pinned to, or empty if they
+  // aren't pinned.
+  const std::vector<NumaNode>& reactor_numa_nodes() const { return reactor_numa_nodes_; }
+
   const std::string& name() const {
     return name_;
   }
@@ -347,8 +394,22 @@ class Messenger {
     return receive_buf_;
   }
 
+  // The policy set by MessengerBuilder::set_rpc_compression_policy(), if any.
+  const RpcCompressionPolicy& rpc_compression_policy() const {
+    return rpc_compression_policy_;
+  }
+
   void set_receive_buffer(int receive_buf);
 
+  // Applies 'profile' to the sockets of the connections made to, and accepted
+  // from, the host of 'remote', whatever their port, from then on. Existing
+  // connections keep their options.
+  void SetSocketProfile(const Sockaddr& remote, const SocketProfile& profile);
+
+  // Returns true and copies the profile set for the host of 'remote' into
+  // 'profile', if there's one.
+  bool FindSocketProfile(const Sockaddr& remote, SocketProfile* profile) const;
+
  private:
   FRIEND_TEST(TestRpc, TestConnectionKeepalive);
   FRIEND_TEST(TestRpc, TestConnectionAlwaysKeepalive);
@@ -361,6 +422,15 @@ class Messenger {
   explicit Messenger(const MessengerBuilder &bld);
 
   Reactor* RemoteToReactor(const Sockaddr &remote);
+
+  // Returns the reactor to handle the inbound connection 'socket' from
+  // 'remote' with. When the reactors are pinned, prefers those on the CPU, or
+  // else the NUMA node, which the kernel last processed its packets on.
+  Reactor* InboundSocketToReactor(const Socket& socket, const Sockaddr& remote);
+
+  // Pins the reactors to the CPUs of 'reactor_numa_nodes_', as set by
+  // 'reactor_cpu_affinity_'.
+  Status PinReactors();
   Status Init();
   void RunTimeoutThread();
   void UpdateCurTime();
@@ -403,6 +473,12 @@ class Messenger {
 
   std::vector<Reactor*> reactors_;
 
+  ReactorCpuAffinity reactor_cpu_affinity_;
+
+  // The NUMA nodes which the reactors are pinned to. Empty unless
+  // 'reactor_cpu_affinity_' is set.
+  std::vector<NumaNode> reactor_numa_nodes_;
+
   // Separate client and server negotiation pools to avoid possibility of distributed
   // deadlock. See KUDU-2041.
   gscoped_ptr<ThreadPool> client_negotiation_pool_;
@@ -440,6 +516,12 @@ class Messenger {
   // inbound sockets. 0 or negative values will skip setting the option.
   int receive_buf_;
 
+  const RpcCompressionPolicy rpc_compression_policy_;
+
+  // The socket profiles set by SetSocketProfile(), keyed by host.
+  mutable simple_spinlock socket_profiles_lock_;
+  std::unordered_map<std::string, SocketProfile> socket_profiles_;
+
   // The ownership of the Messenger object is somewhat subtle. The pointer graph
   // looks like this:
   //
@@ -0,0 +1,47 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kudu {
+namespace rpc {
+
+// Hashes the name of a method of a generated service to one of 'num_slots'
+// slots, which must be a power of two, mixing in 'seed'. For each service,
+// protoc-gen-krpc searches for a seed under which its methods all land in
+// distinct slots, so that the generated service finds the method of a call
+// with one hash and one string comparison. It's constexpr so that the
+// generated code checks the slots it was given at compile time.
+constexpr uint32_t MethodNameSlot(const char* name, size_t len,
+                                  uint32_t seed, uint32_t num_slots) {
+  // FNV-1a, with a final mix since only the low bits are used.
+  uint32_t h = 2166136261u ^ seed;
+  for (size_t i = 0; i < len; i++) {
+    h ^= static_cast<uint8_t>(name[i]);
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h & (num_slots - 1);
+}
+
+} // namespace rpc
+} // namespace kudu
@@ -78,7 +78,8 @@ DEFINE_bool(rpc_allow_external_cert_authentication, false,
 TAG_FLAG(rpc_allow_external_cert_authentication, advanced);
 
 DEFINE_bool(rpc_load_cert_files_each_negotiation, false,
-            "reload the cert files in the SSL context ech time to make sure they have not expired");
+            "reload the cert files in the SSL context on each negotiation in which "
+            "they changed on disk, to make sure they have not expired");
 TAG_FLAG(rpc_load_cert_files_each_negotiation, advanced);
 
 DEFINE_string(rpc_certificate_file, "",
@@ -331,14 +332,15 @@ void Negotiation::RunNegotiation(const scoped_refptr<Connection>& conn,
                                  RpcEncryption encryption,
                                  MonoTime deadline) {
   Messenger* messenger = conn->reactor_thread()->reactor()->messenger();
-  // In case certificate files should be rechecked each negotiation
+  // In case certificate files should be rechecked each negotiation. They are
+  // only parsed again if they changed on disk.
   if (FLAGS_rpc_load_cert_files_each_negotiation &&
       // All 3 certificate files are properly populated
       !FLAGS_rpc_certificate_file.empty() &&
       !FLAGS_rpc_private_key_file.empty() &&
       !FLAGS_rpc_ca_certificate_file.empty()) {
     auto* tls_context = messenger->mutable_tls_context();
-    Status reload_status = tls_context->LoadCertFiles(
+    Status reload_status = tls_context->LoadCertFilesIfChanged(
         FLAGS_rpc_ca_certificate_file,
         FLAGS_rpc_certificate_file,
         FLAGS_rpc_private_key_file,
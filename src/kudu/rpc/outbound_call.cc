@@ -40,6 +40,8 @@
 #include "kudu/rpc/rpc_sidecar.h"
 #include "kudu/rpc/serialization.h"
 #include "kudu/rpc/transfer.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/kernel_stack_watchdog.h"
 #include "kudu/util/net/sockaddr.h"
@@ -91,8 +93,17 @@ OutboundCall::OutboundCall(const ConnectionId& conn_id,
   DVLOG(4) << "OutboundCall " << this << " constructed with state_: " << StateName(state_)
            << " and RPC timeout: "
            << (controller->timeout().Initialized() ? controller->timeout().ToString() : "none");
+  Init();
+}
+
+OutboundCall::~OutboundCall() {
+  DCHECK(IsFinished());
+  DVLOG(4) << "OutboundCall " << this << " destroyed with state_: " << StateName(state_);
+}
+
+void OutboundCall::Init() {
   header_.set_call_id(kInvalidCallId);
-  remote_method.ToPB(header_.mutable_remote_method());
+  remote_method_.ToPB(header_.mutable_remote_method());
   start_time_ = MonoTime::Now();
 
   if (!controller_->required_server_features().empty()) {
@@ -104,9 +115,58 @@ OutboundCall::OutboundCall(const ConnectionId& conn_id,
   }
 }
 
-OutboundCall::~OutboundCall() {
+void OutboundCall::Reinit(const ConnectionId& conn_id,
+                          const RemoteMethod& remote_method,
+                          google::protobuf::Message* response_storage,
+                          RpcController* controller,
+                          ResponseCallback callback) {
   DCHECK(IsFinished());
-  DVLOG(4) << "OutboundCall " << this << " destroyed with state_: " << StateName(state_);
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    state_ = READY;
+    status_ = Status::OK();
+    error_pb_.reset();
+  }
+  // Clearing the header, rather than constructing a new one, keeps the
+  // strings its fields were serialized from allocated.
+  header_.Clear();
+  remote_method_ = remote_method;
+  required_rpc_features_.clear();
+  conn_id_.CopyFrom(conn_id);
+  callback_ = std::move(callback);
+  controller_ = DCHECK_NOTNULL(controller);
+  response_ = DCHECK_NOTNULL(response_storage);
+  header_buf_.clear();
+  request_buf_.clear();
+  compressed_header_buf_.clear();
+  compressed_body_buf_.clear();
+  request_slices_.clear();
+  sidecar_byte_size_ = -1;
+  cancellation_requested_ = false;
+  DVLOG(4) << "OutboundCall " << this << " reinitialized";
+  Init();
+}
+
+void OutboundCall::ReleaseForReuse(size_t max_buffer_bytes) {
+  DCHECK(IsFinished());
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    error_pb_.reset();
+  }
+  callback_ = NULL;
+  controller_ = nullptr;
+  response_ = nullptr;
+  request_keepalive_.reset();
+  call_response_.reset();
+  sidecars_.clear();
+  request_slices_.clear();
+  for (faststring* buf : { &header_buf_, &request_buf_,
+                           &compressed_header_buf_, &compressed_body_buf_ }) {
+    buf->clear();
+    if (buf->capacity() > max_buffer_bytes) {
+      buf->shrink_to_fit();
+    }
+  }
 }
 
 size_t OutboundCall::SerializeTo(TransferPayload* slices) {
@@ -122,20 +182,53 @@ size_t OutboundCall::SerializeTo(TransferPayload* slices) {
     header_.add_required_feature_flags(feature);
   }
 
+  size_t request_size = request_buf_.size();
+  if (!request_slices_.empty()) {
+    request_size = 0;
+    for (const Slice& slice : request_slices_) {
+      request_size += slice.size();
+    }
+  }
   DCHECK_LE(0, sidecar_byte_size_);
   serialization::SerializeHeader(
-      header_, sidecar_byte_size_ + request_buf_.size(), &header_buf_);
+      header_, sidecar_byte_size_ + request_size, &header_buf_);
 
-  size_t n_slices = 2 + sidecars_.size();
-  DCHECK_LE(n_slices, slices->size());
-  auto slice_iter = slices->begin();
-  *slice_iter++ = Slice(header_buf_);
-  *slice_iter++ = Slice(request_buf_);
+  slices->clear();
+  slices->reserve(2 + request_slices_.size() + sidecars_.size());
+  slices->emplace_back(header_buf_);
+  if (request_slices_.empty()) {
+    slices->emplace_back(request_buf_);
+  } else {
+    slices->insert(slices->end(), request_slices_.begin(), request_slices_.end());
+  }
   for (auto& sidecar : sidecars_) {
-    *slice_iter++ = sidecar->AsSlice();
+    slices->push_back(sidecar->AsSlice());
+  }
+  return slices->size();
+}
+
+Status OutboundCall::CompressTo(const CompressionCodec& codec, TransferPayload* slices,
+                                size_t* compressed_size, MonoDelta* cpu_time) {
+  size_t frame_size = 0;
+  for (const Slice& slice : *slices) {
+    frame_size += slice.size();
+  }
+  RETURN_NOT_OK(serialization::CompressFrame(codec, *slices, &compressed_body_buf_, cpu_time));
+  *compressed_size = compressed_body_buf_.size();
+  if (compressed_body_buf_.size() >= frame_size) {
+    compressed_body_buf_.clear();
+    return Status::OK();
   }
-  DCHECK_EQ(slice_iter - slices->begin(), n_slices);
-  return n_slices;
+
+  RequestHeader header;
+  header.set_call_id(header_.call_id());
+  header.set_frame_compression(codec.type());
+  header.set_uncompressed_frame_size(frame_size);
+  serialization::SerializeHeader(header, compressed_body_buf_.size(), &compressed_header_buf_);
+  slices->clear();
+  slices->emplace_back(compressed_header_buf_);
+  slices->emplace_back(compressed_body_buf_);
+  return Status::OK();
 }
 
 void OutboundCall::SetRequestPayload(const Message& req,
@@ -156,7 +249,14 @@ void OutboundCall::SetRequestPayload(const Message& req,
     sidecar_byte_size_ += sidecar_bytes;
   }
 
-  serialization::SerializeMessage(req, &request_buf_, sidecar_byte_size_, true);
+  if (controller_->request_gather_min_bytes_ > 0) {
+    request_keepalive_ = std::move(controller_->request_gather_keepalive_);
+    serialization::SerializeMessageGathered(req, controller_->request_gather_min_bytes_,
+                                            sidecar_byte_size_, &request_buf_,
+                                            &request_slices_);
+  } else {
+    serialization::SerializeMessage(req, &request_buf_, sidecar_byte_size_, true);
+  }
 }
 
 Status OutboundCall::status() const {
@@ -334,6 +434,8 @@ void OutboundCall::SetSent() {
   // which allocated it -- this lets it keep to thread-local operations instead
   // of taking a mutex to put memory back on the global freelist.
   delete [] header_buf_.release();
+  delete [] compressed_header_buf_.release();
+  delete [] compressed_body_buf_.release();
 
   // request_buf_ is also done being used here, but since it was allocated by
   // the caller thread, we would rather let that thread free it whenever it
@@ -508,10 +610,30 @@ Status CallResponse::GetSidecar(int idx, Slice* sidecar) const {
   return Status::OK();
 }
 
-Status CallResponse::ParseFrom(gscoped_ptr<InboundTransfer> transfer) {
+Status CallResponse::ParseFrom(gscoped_ptr<InboundTransfer> transfer,
+                               MonoDelta* uncompress_cpu_time) {
   CHECK(!parsed_);
   RETURN_NOT_OK(serialization::ParseMessage(transfer->data(), &header_,
                                             &serialized_response_));
+  if (PREDICT_FALSE(header_.has_frame_compression())) {
+    // The body is the actual response frame, compressed.
+    const CompressionCodec* codec;
+    RETURN_NOT_OK(GetCompressionCodec(header_.frame_compression(), &codec));
+    if (PREDICT_FALSE(!codec)) {
+      return Status::Corruption("Invalid packet: frame compressed without a codec");
+    }
+    RETURN_NOT_OK(serialization::UncompressFrame(*codec, serialized_response_,
+                                                 header_.uncompressed_frame_size(),
+                                                 &uncompressed_frame_, uncompress_cpu_time));
+    header_.Clear();
+    RETURN_NOT_OK(serialization::ParseMessage(Slice(uncompressed_frame_), &header_,
+                                              &serialized_response_));
+    if (PREDICT_FALSE(header_.has_frame_compression())) {
+      return Status::Corruption("Invalid packet: compressed frame is compressed again");
+    }
+    // Nothing refers into the compressed frame any more.
+    transfer.reset();
+  }
 
   // Use information from header to extract the payload slices.
   RETURN_NOT_OK(RpcSidecar::ParseSidecars(header_.sidecar_offsets(),
@@ -52,10 +52,14 @@ class Message;
 } // namespace google
 
 namespace kudu {
+
+class CompressionCodec;
+
 namespace rpc {
 
 class CallResponse;
 class DumpRunningRpcsRequestPB;
+class OutboundCallPool;
 class RpcCallInProgressPB;
 class RpcController;
 class RpcSidecar;
@@ -93,7 +97,8 @@ class OutboundCall {
   // ownership of any sidecars that should accompany this request.
   //
   // Because the request data is fully serialized by this call, 'req' may be subsequently
-  // mutated with no ill effects.
+  // mutated with no ill effects, unless the controller asked for the request to be
+  // serialized gathered (see RpcController::SetRequestGather()).
   void SetRequestPayload(const google::protobuf::Message& req,
       std::vector<std::unique_ptr<RpcSidecar>>&& sidecars);
 
@@ -109,6 +114,13 @@ class OutboundCall {
   // Returns the number of slices in the serialized call.
   size_t SerializeTo(TransferPayload* slices);
 
+  // Replaces the call serialized into 'slices' by SerializeTo() with a frame
+  // which carries it compressed with 'codec', if that's smaller. Stores the
+  // size of the compressed call in 'compressed_size', and the CPU time it took
+  // in 'cpu_time'. This is called from the Reactor thread.
+  Status CompressTo(const CompressionCodec& codec, TransferPayload* slices,
+                    size_t* compressed_size, MonoDelta* cpu_time);
+
   // Mark in the call that cancellation has been requested. If the call hasn't yet
   // started sending or has finished sending the RPC request but is waiting for a
   // response, cancel the RPC right away. Otherwise, wait until the RPC has finished
@@ -190,6 +202,7 @@ class OutboundCall {
   }
 
  private:
+  friend class OutboundCallPool;
   friend class RpcController;
   FRIEND_TEST(TestRpc, TestCancellation);
 
@@ -211,6 +224,21 @@ class OutboundCall {
 
   static std::string StateName(State state);
 
+  // Sets up the header and the required features of a new call from
+  // 'controller_'. Called once the members passed to the constructor are set.
+  void Init();
+
+  // Makes this finished call a new one, as if it had been constructed with
+  // these arguments, but keeping the capacity of its header and buffers.
+  void Reinit(const ConnectionId& conn_id, const RemoteMethod& remote_method,
+              google::protobuf::Message* response_storage,
+              RpcController* controller, ResponseCallback callback);
+
+  // Drops what this finished call refers to other than its own buffers, such as
+  // its response and request keepalive, before it's kept free for reuse.
+  // Buffers which grew beyond 'max_buffer_bytes' are freed too.
+  void ReleaseForReuse(size_t max_buffer_bytes);
+
   // Mark the call as cancelled. This also invokes the callback to notify the caller.
   void SetCancelled();
 
@@ -255,7 +283,8 @@ class OutboundCall {
   // RPC-system features required to send this call.
   std::set<RpcFeatureFlag> required_rpc_features_;
 
-  const ConnectionId conn_id_;
+  // Not const, since a pooled call is reinitialized for another connection.
+  ConnectionId conn_id_;
   ResponseCallback callback_;
   RpcController* controller_;
 
@@ -266,6 +295,17 @@ class OutboundCall {
   faststring header_buf_;
   faststring request_buf_;
 
+  // If the request is sent compressed, the header and the body of the frame
+  // which carries it. Set by CompressTo().
+  faststring compressed_header_buf_;
+  faststring compressed_body_buf_;
+
+  // If the request was serialized gathered, the slices which make it up: pieces
+  // of 'request_buf_' and the request's large fields, which 'request_keepalive_'
+  // keeps valid until this call is destroyed. Otherwise, empty.
+  std::vector<Slice> request_slices_;
+  std::shared_ptr<const void> request_keepalive_;
+
   // Once a response has been received for this call, contains that response.
   // Otherwise NULL.
   gscoped_ptr<CallResponse> call_response_;
@@ -296,8 +336,10 @@ class CallResponse {
   CallResponse();
 
   // Parse the response received from a call. This must be called before any
-  // other methods on this object.
-  Status ParseFrom(gscoped_ptr<InboundTransfer> transfer);
+  // other methods on this object. If the response was compressed, the CPU
+  // time it took to uncompress is stored in 'uncompress_cpu_time'.
+  Status ParseFrom(gscoped_ptr<InboundTransfer> transfer,
+                   MonoDelta* uncompress_cpu_time = nullptr);
 
   // Return true if the call succeeded.
   bool is_success() const {
@@ -339,6 +381,10 @@ class CallResponse {
   // and sidecar_slices_ refer into its data.
   gscoped_ptr<InboundTransfer> transfer_;
 
+  // If the response was compressed, the response frame uncompressed, which
+  // serialized_response_ and sidecar_slices_ refer into instead.
+  faststring uncompressed_frame_;
+
   DISALLOW_COPY_AND_ASSIGN(CallResponse);
 };
 
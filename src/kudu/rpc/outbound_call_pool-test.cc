@@ -0,0 +1,125 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/outbound_call_pool.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/rpc/connection_id.h"
+#include "kudu/rpc/outbound_call.h"
+#include "kudu/rpc/remote_method.h"
+#include "kudu/rpc/rpc_controller.h"
+#include "kudu/rpc/rpc_sidecar.h"
+#include "kudu/rpc/rtest.pb.h"
+#include "kudu/rpc/transfer.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_util.h"
+
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+using kudu::rpc_test::AddRequestPB;
+using kudu::rpc_test::AddResponsePB;
+
+namespace kudu {
+namespace rpc {
+
+class OutboundCallPoolTest : public KuduTest {
+ protected:
+  // Serializes 'req' as call 'call_id' of 'call' and returns the frame.
+  static string Serialize(OutboundCall* call, const AddRequestPB& req, int32_t call_id) {
+    call->SetRequestPayload(req, vector<unique_ptr<RpcSidecar>>());
+    call->set_call_id(call_id);
+    TransferPayload slices;
+    call->SerializeTo(&slices);
+    string frame;
+    for (const Slice& slice : slices) {
+      frame.append(reinterpret_cast<const char*>(slice.data()), slice.size());
+    }
+    return frame;
+  }
+
+  const RemoteMethod method_ = RemoteMethod("kudu.rpc_test.CalculatorService", "Add");
+};
+
+// Tests that a finished call returns to the pool once released and is handed
+// out again as a new call, which serializes like a freshly constructed one.
+TEST_F(OutboundCallPoolTest, TestReuse) {
+  shared_ptr<OutboundCallPool> pool = OutboundCallPool::Create(1);
+  AddRequestPB req;
+  req.set_x(10);
+  req.set_y(20);
+  AddResponsePB resp;
+  int callbacks = 0;
+
+  OutboundCall* first_call;
+  {
+    RpcController controller;
+    shared_ptr<OutboundCall> call = pool->Get(ConnectionId(), method_, &resp, &controller,
+                                              [&]() { callbacks++; });
+    first_call = call.get();
+    Serialize(call.get(), req, 1);
+    call->SetFailed(Status::NetworkError("injected"));
+    ASSERT_EQ(1, callbacks);
+    ASSERT_EQ(0, pool->num_free());
+  }
+  ASSERT_EQ(1, pool->num_free());
+
+  RpcController controller;
+  shared_ptr<OutboundCall> call = pool->Get(ConnectionId(), method_, &resp, &controller,
+                                            [&]() { callbacks++; });
+  ASSERT_EQ(first_call, call.get());
+  ASSERT_EQ(0, pool->num_free());
+  ASSERT_FALSE(call->IsFinished());
+  ASSERT_FALSE(call->call_id_assigned());
+
+  req.set_x(30);
+  RpcController fresh_controller;
+  OutboundCall fresh(ConnectionId(), method_, &resp, &fresh_controller, []() {});
+  ASSERT_EQ(Serialize(&fresh, req, 2), Serialize(call.get(), req, 2));
+  fresh.SetFailed(Status::NetworkError("injected"));
+  call->SetFailed(Status::NetworkError("injected"));
+  ASSERT_EQ(2, callbacks);
+}
+
+// Tests that calls beyond the pool's limit are freed rather than kept, and
+// that calls outliving their pool are freed when released.
+TEST_F(OutboundCallPoolTest, TestLimitAndPoolDestruction) {
+  shared_ptr<OutboundCallPool> pool = OutboundCallPool::Create(1);
+  AddResponsePB resp;
+  RpcController controllers[3];
+  vector<shared_ptr<OutboundCall>> calls;
+  for (RpcController& controller : controllers) {
+    calls.emplace_back(pool->Get(ConnectionId(), method_, &resp, &controller, []() {}));
+    calls.back()->SetFailed(Status::NetworkError("injected"));
+  }
+  calls.pop_back();
+  calls.pop_back();
+  ASSERT_EQ(1, pool->num_free());
+
+  pool.reset();
+  calls.clear();
+}
+
+} // namespace rpc
+} // namespace kudu
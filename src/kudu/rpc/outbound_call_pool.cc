@@ -0,0 +1,111 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/outbound_call_pool.h"
+
+#include <mutex>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/stl_util.h"
+#include "kudu/rpc/outbound_call.h"
+#include "kudu/util/flag_tags.h"
+
+DEFINE_int32(rpc_outbound_call_pool_size, 0,
+             "The number of finished outbound calls each proxy keeps for reuse, "
+             "along with their request header and serialization buffers, rather "
+             "than allocating them for each call. Pooling is enabled for the "
+             "proxies created while this is positive.");
+TAG_FLAG(rpc_outbound_call_pool_size, experimental);
+TAG_FLAG(rpc_outbound_call_pool_size, runtime);
+
+using std::shared_ptr;
+using std::weak_ptr;
+
+namespace kudu {
+namespace rpc {
+
+const size_t OutboundCallPool::kMaxKeptBufferBytes = 1024 * 1024;
+
+shared_ptr<OutboundCallPool> OutboundCallPool::Create(size_t max_free) {
+  return shared_ptr<OutboundCallPool>(new OutboundCallPool(max_free));
+}
+
+OutboundCallPool::OutboundCallPool(size_t max_free)
+    : max_free_(max_free) {
+  free_calls_.reserve(max_free_);
+}
+
+OutboundCallPool::~OutboundCallPool() {
+  STLDeleteElements(&free_calls_);
+}
+
+shared_ptr<OutboundCall> OutboundCallPool::Get(const ConnectionId& conn_id,
+                                               const RemoteMethod& remote_method,
+                                               google::protobuf::Message* response_storage,
+                                               RpcController* controller,
+                                               ResponseCallback callback) {
+  OutboundCall* call = nullptr;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (!free_calls_.empty()) {
+      call = free_calls_.back();
+      free_calls_.pop_back();
+    }
+  }
+  if (call) {
+    call->Reinit(conn_id, remote_method, response_storage, controller, std::move(callback));
+  } else {
+    call = new OutboundCall(conn_id, remote_method, response_storage, controller,
+                            std::move(callback));
+  }
+  // The deleter only holds a weak reference, so that calls still referenced
+  // by a connection don't keep a destroyed proxy's pool alive.
+  weak_ptr<OutboundCallPool> pool = shared_from_this();
+  return shared_ptr<OutboundCall>(call, [pool](OutboundCall* c) {
+    shared_ptr<OutboundCallPool> p = pool.lock();
+    if (p) {
+      p->Release(c);
+    } else {
+      delete c;
+    }
+  });
+}
+
+size_t OutboundCallPool::num_free() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  return free_calls_.size();
+}
+
+void OutboundCallPool::Release(OutboundCall* call) {
+  // Drop what the call refers to before taking the lock, since destroying its
+  // callback or response may run arbitrary destructors.
+  call->ReleaseForReuse(kMaxKeptBufferBytes);
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (free_calls_.size() < max_free_) {
+      free_calls_.push_back(call);
+      return;
+    }
+  }
+  delete call;
+}
+
+} // namespace rpc
+} // namespace kudu
@@ -0,0 +1,101 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef KUDU_RPC_OUTBOUND_CALL_POOL_H
+#define KUDU_RPC_OUTBOUND_CALL_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/rpc/response_callback.h"
+#include "kudu/util/locks.h"
+
+DECLARE_int32(rpc_outbound_call_pool_size);
+
+namespace google {
+namespace protobuf {
+class Message;
+} // namespace protobuf
+} // namespace google
+
+namespace kudu {
+namespace rpc {
+
+class ConnectionId;
+class OutboundCall;
+class RemoteMethod;
+class RpcController;
+
+// A free list of finished OutboundCalls, from which a proxy which sends a
+// steady stream of similar calls, such as a leader's proxy to a peer, takes
+// the calls it sends. A call taken from the pool returns to it when the last
+// reference to it is dropped, typically when its controller is reset for the
+// next request, and keeps its request header and serialization buffers, so
+// that the next call to the peer doesn't reallocate them. Responses already
+// land in buffers from the reactor's ReceiveBufferPool.
+//
+// Calls are returned from whichever thread drops them, so this class is
+// thread-safe. Calls still in flight when the pool is destroyed are freed
+// rather than returned.
+class OutboundCallPool : public std::enable_shared_from_this<OutboundCallPool> {
+ public:
+  // The serialization buffers of a call which grew beyond this size are freed
+  // before the call is kept for reuse, so that an occasional huge request
+  // doesn't stay pinned by an idle call.
+  static const size_t kMaxKeptBufferBytes;
+
+  // Creates a pool which keeps up to 'max_free' finished calls for reuse.
+  static std::shared_ptr<OutboundCallPool> Create(size_t max_free);
+
+  ~OutboundCallPool();
+
+  // Returns a call with the given arguments, as if by the OutboundCall
+  // constructor, reusing a free one if there is one.
+  std::shared_ptr<OutboundCall> Get(const ConnectionId& conn_id,
+                                    const RemoteMethod& remote_method,
+                                    google::protobuf::Message* response_storage,
+                                    RpcController* controller,
+                                    ResponseCallback callback);
+
+  // Returns the number of finished calls kept for reuse.
+  size_t num_free() const;
+
+ private:
+  explicit OutboundCallPool(size_t max_free);
+
+  // Keeps 'call', which has finished and is no longer referenced, for reuse
+  // unless 'max_free_' calls already are, in which case it's destroyed.
+  void Release(OutboundCall* call);
+
+  const size_t max_free_;
+
+  mutable simple_spinlock lock_;
+
+  // The free calls. Protected by 'lock_'.
+  std::vector<OutboundCall*> free_calls_;
+
+  DISALLOW_COPY_AND_ASSIGN(OutboundCallPool);
+};
+
+} // namespace rpc
+} // namespace kudu
+
+#endif // KUDU_RPC_OUTBOUND_CALL_POOL_H
@@ -45,6 +45,7 @@
 #include "kudu/gutil/strings/strip.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
+#include "kudu/rpc/method_hash.h"
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/util/status.h"
 #include "kudu/util/string_case.h"
@@ -79,6 +80,31 @@ optional<string> GetAuthzMethod(const MethodDescriptor& method) {
   return boost::none;
 }
 
+// Finds the seed, and the number of slots, under which MethodNameSlot()
+// hashes the names of the methods of 'service' to distinct slots. There are
+// at least twice as many slots as methods, so a seed is found quickly.
+void FindMethodSlots(const ServiceDescriptor& service, uint32_t* seed, uint32_t* num_slots) {
+  *num_slots = 2;
+  while (*num_slots < 2 * static_cast<uint32_t>(service.method_count())) {
+    *num_slots *= 2;
+  }
+  while (true) {
+    for (*seed = 0; *seed < (1 << 16); (*seed)++) {
+      set<uint32_t> slots;
+      for (int i = 0; i < service.method_count(); i++) {
+        const string& name = service.method(i)->name();
+        if (!slots.insert(MethodNameSlot(name.data(), name.size(), *seed, *num_slots)).second) {
+          break;
+        }
+      }
+      if (slots.size() == static_cast<size_t>(service.method_count())) {
+        return;
+      }
+    }
+    *num_slots *= 2;
+  }
+}
+
 } // anonymous namespace
 
 class Substituter {
@@ -207,7 +233,17 @@ class MethodSubstitutions : public Substituter {
     (*map)["metric_enum_key"] = strings::Substitute("kMetricIndex$0", method_->name());
     bool track_result = static_cast<bool>(method_->options().GetExtension(track_rpc_result));
     (*map)["track_result"] = track_result ? " true" : "false";
+    bool on_reactor = static_cast<bool>(method_->options().GetExtension(run_on_reactor));
+    (*map)["run_on_reactor"] = on_reactor ? "true" : "false";
+    (*map)["priority_class"] =
+        RpcPriorityClass_Name(method_->options().GetExtension(priority_class));
     (*map)["authz_method"] = GetAuthzMethod(*method_).get_value_or("AuthorizeAllowAll");
+    uint32_t seed;
+    uint32_t num_slots;
+    FindMethodSlots(*method_->service(), &seed, &num_slots);
+    const string& name = method_->name();
+    (*map)["rpc_name_length"] = SimpleItoa(name.size());
+    (*map)["method_slot"] = SimpleItoa(MethodNameSlot(name.data(), name.size(), seed, num_slots));
   }
 
   // Strips the package from method arguments if they are in the same package as
@@ -249,6 +285,11 @@ class ServiceSubstitutions : public Substituter {
     (*map)["service_name"] = service_->name();
     (*map)["full_service_name"] = service_->full_name();
     (*map)["service_method_count"] = SimpleItoa(service_->method_count());
+    uint32_t seed;
+    uint32_t num_slots;
+    FindMethodSlots(*service_, &seed, &num_slots);
+    (*map)["method_slot_seed"] = SimpleItoa(seed);
+    (*map)["method_slot_count"] = SimpleItoa(num_slots);
 
     // TODO: upgrade to protobuf 2.5.x and attach service comments
     // to the generated service classes using the SourceLocation API.
@@ -448,6 +489,7 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
       "#include \"$path_no_extension$.pb.h\"\n"
       "#include \"$path_no_extension$.service.h\"\n"
       "\n"
+      "#include \"kudu/rpc/method_hash.h\"\n"
       "#include \"kudu/rpc/result_tracker.h\"\n"
       "#include \"kudu/rpc/service_if.h\"\n"
       "#include \"kudu/util/metrics.h\"\n"
@@ -468,7 +510,7 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
           "  \"$rpc_full_name$ RPC Time\",\n"
           "  kudu::MetricUnit::kMicroseconds,\n"
           "  \"Microseconds spent handling $rpc_full_name$() RPC requests\",\n"
-          "  60000000LU, 2);\n"
+          "  60000000LU, 2, kudu::PER_THREAD);\n"
           "\n");
         subs->Pop();
       }
@@ -496,6 +538,8 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
         "$service_name$If::$service_name$If(const scoped_refptr<MetricEntity>& entity,"
             " const scoped_refptr<ResultTracker>& result_tracker) {\n"
             "result_tracker_ = result_tracker;\n"
+            "method_slot_seed_ = $method_slot_seed$;\n"
+            "methods_by_slot_.resize($method_slot_count$);\n"
       );
       for (int method_idx = 0; method_idx < service->method_count();
            ++method_idx) {
@@ -514,6 +558,8 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
               "                           ctx);\n"
               "    };\n"
               "    mi->track_result = $track_result$;\n"
+              "    mi->run_on_reactor = $run_on_reactor$;\n"
+              "    mi->priority_class = ::kudu::rpc::$priority_class$;\n"
               "    mi->handler_latency_histogram =\n"
               "        METRIC_handler_latency_$rpc_full_name_plainchars$.Instantiate(entity);\n"
               "    mi->func = [this](const Message* req, Message* resp, RpcContext* ctx) {\n"
@@ -521,6 +567,10 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
               "                       static_cast<$response$*>(resp),\n"
               "                       ctx);\n"
               "    };\n"
+              "    static_assert(::kudu::rpc::MethodNameSlot(\"$rpc_name$\", $rpc_name_length$,\n"
+              "                                              $method_slot_seed$, $method_slot_count$)\n"
+              "                  == $method_slot$, \"method slots out of date\");\n"
+              "    methods_by_slot_[$method_slot$] = { \"$rpc_name$\", mi.get() };\n"
               "    methods_by_name_[\"$rpc_name$\"] = std::move(mi);\n"
               "  }\n");
         subs->Pop();
@@ -17,6 +17,7 @@
 
 #include "kudu/rpc/proxy.h"
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <utility>
@@ -27,6 +28,7 @@
 
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/outbound_call.h"
+#include "kudu/rpc/outbound_call_pool.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/remote_method.h"
 #include "kudu/rpc/response_callback.h"
@@ -66,6 +68,11 @@ Proxy::Proxy(std::shared_ptr<Messenger> messenger,
   UserCredentials creds;
   creds.set_real_user(std::move(real_user));
   conn_id_ = ConnectionId(remote, std::move(hostname), std::move(creds));
+
+  int32_t pool_size = FLAGS_rpc_outbound_call_pool_size;
+  if (pool_size > 0) {
+    call_pool_ = OutboundCallPool::Create(pool_size);
+  }
 }
 
 Proxy::~Proxy() {
@@ -79,8 +86,12 @@ void Proxy::AsyncRequest(const string& method,
   CHECK(!controller->call_) << "Controller should be reset";
   base::subtle::NoBarrier_Store(&is_started_, true);
   RemoteMethod remote_method(service_name_, method);
-  controller->call_.reset(
-      new OutboundCall(conn_id_, remote_method, response, controller, callback));
+  if (call_pool_) {
+    controller->call_ = call_pool_->Get(conn_id_, remote_method, response, controller, callback);
+  } else {
+    controller->call_.reset(
+        new OutboundCall(conn_id_, remote_method, response, controller, callback));
+  }
   controller->SetRequestParam(req);
   controller->SetMessenger(messenger_.get());
 
@@ -108,6 +119,16 @@ void Proxy::set_user_credentials(const UserCredentials& user_credentials) {
   conn_id_.set_user_credentials(user_credentials);
 }
 
+void Proxy::set_connection_stripe(int stripe) {
+  CHECK(base::subtle::NoBarrier_Load(&is_started_) == false)
+    << "It is illegal to call set_connection_stripe() after request processing has started";
+  conn_id_.set_stripe(stripe);
+}
+
+void Proxy::WarmUpConnection() {
+  messenger_->WarmUpConnection(conn_id_);
+}
+
 std::string Proxy::ToString() const {
   return strings::Substitute("$0@$1", service_name_, conn_id_.ToString());
 }
@@ -40,6 +40,7 @@ class Sockaddr;
 namespace rpc {
 
 class Messenger;
+class OutboundCallPool;
 class RpcController;
 class UserCredentials;
 
@@ -90,6 +91,11 @@ class Proxy {
   //           thereafter. It may be invoked either on the caller's thread
   //           or by an RPC IO thread, and thus should take care to not
   //           block or perform any heavy CPU work.
+  //
+  // If the connection to the remote server has more calls or bytes waiting to
+  // be sent than --rpc_max_outbound_queue_calls or
+  // --rpc_max_outbound_queue_bytes allow, the call fails with
+  // ServiceUnavailable without being sent, and may be retried later.
   void AsyncRequest(const std::string& method,
                     const google::protobuf::Message& req,
                     google::protobuf::Message* resp,
@@ -109,6 +115,15 @@ class Proxy {
   // Get the user credentials which should be used to log in.
   const UserCredentials& user_credentials() const { return conn_id_.user_credentials(); }
 
+  // Make the calls of this proxy go over the connection of 'stripe' to the
+  // remote server, rather than share the default one with the other proxies
+  // to it. See ConnectionId::set_stripe().
+  void set_connection_stripe(int stripe);
+
+  // Start establishing the connection which the calls of this proxy go
+  // over, ahead of the first call. See Messenger::WarmUpConnection().
+  void WarmUpConnection();
+
   std::string ToString() const;
 
  private:
@@ -117,6 +132,10 @@ class Proxy {
   ConnectionId conn_id_;
   mutable Atomic32 is_started_;
 
+  // The finished calls kept for reuse by this proxy's calls, if
+  // --rpc_outbound_call_pool_size was positive when it was created.
+  std::shared_ptr<OutboundCallPool> call_pool_;
+
   DISALLOW_COPY_AND_ASSIGN(Proxy);
 };
 
@@ -19,6 +19,7 @@
 
 #include <boost/bind.hpp> // IWYU pragma: keep
 #include <boost/function.hpp>
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
@@ -30,6 +31,8 @@
 #include "kudu/util/test_macros.h"
 #include "kudu/util/thread.h"
 
+DECLARE_bool(rpc_reactor_timer_wheel);
+
 using std::shared_ptr;
 
 namespace kudu {
@@ -108,5 +111,29 @@ TEST_F(ReactorTest, TestReschedulesOnSameReactorThread) {
   latch_.Wait();
 }
 
+// Tests that the tasks kept on the reactor threads' timer wheels run no
+// earlier than they were scheduled for, and are aborted on shutdown.
+TEST_F(ReactorTest, TestTimerWheel) {
+  FLAGS_rpc_reactor_timer_wheel = true;
+  latch_.Reset(2);
+  MonoTime before = MonoTime::Now();
+  messenger_->ScheduleOnReactor(
+      boost::bind(&ReactorTest::ScheduledTask, this, _1, Status::OK()),
+      MonoDelta::FromMilliseconds(100));
+  messenger_->ScheduleOnReactor(
+      boost::bind(&ReactorTest::ScheduledTask, this, _1, Status::OK()),
+      MonoDelta::FromMilliseconds(0));
+  latch_.Wait();
+  CHECK_GE((MonoTime::Now() - before).ToMilliseconds(), 100);
+
+  latch_.Reset(1);
+  messenger_->ScheduleOnReactor(
+      boost::bind(&ReactorTest::ScheduledTask, this, _1,
+                  Status::Aborted("doesn't matter")),
+      MonoDelta::FromSeconds(60));
+  messenger_->Shutdown();
+  latch_.Wait();
+}
+
 } // namespace rpc
 } // namespace kudu
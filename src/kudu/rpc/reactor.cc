@@ -17,6 +17,7 @@
 
 #include "kudu/rpc/reactor.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <memory>
 #include <mutex>
@@ -34,21 +35,26 @@
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/join.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/client_negotiation.h"
 #include "kudu/rpc/connection.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/negotiation.h"
 #include "kudu/rpc/outbound_call.h"
+#include "kudu/rpc/receive_buffer_pool.h"
 #include "kudu/rpc/rpc_introspection.pb.h"
 #include "kudu/rpc/server_negotiation.h"
+#include "kudu/rpc/socket_profile.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/debug/sanitizer_scopes.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/net/socket.h"
+#include "kudu/util/os-util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread.h"
 #include "kudu/util/thread_restrictions.h"
@@ -80,6 +86,34 @@ DEFINE_bool(rpc_reopen_outbound_connections, false,
 TAG_FLAG(rpc_reopen_outbound_connections, unsafe);
 TAG_FLAG(rpc_reopen_outbound_connections, runtime);
 
+DEFINE_int32(rpc_reactor_busy_poll_us, 0,
+             "If positive, reactor threads busy-poll for network activity for up to "
+             "this many microseconds after they last found any, before blocking "
+             "until there is more. It is also set as SO_BUSY_POLL on the sockets of "
+             "the connections, which needs CAP_NET_ADMIN beyond net.core.busy_read. "
+             "This trades CPU, which shows as reactor load in the "
+             "reactor_load_percent and reactor_active_latency_us metrics, for "
+             "lower latency. Applies to reactor threads started after it is set.");
+TAG_FLAG(rpc_reactor_busy_poll_us, experimental);
+
+DEFINE_bool(rpc_reactor_timer_wheel, false,
+            "Whether the reactor threads keep the timeouts of outbound calls and the "
+            "delayed tasks, such as those of periodic timers, on a timer wheel, which "
+            "arms and cancels them in constant time, rather than each as a libev "
+            "timer. The timers on the wheel fire up to 10ms late.");
+TAG_FLAG(rpc_reactor_timer_wheel, experimental);
+TAG_FLAG(rpc_reactor_timer_wheel, runtime);
+
+DEFINE_bool(rpc_negotiation_wait_on_reactor, false,
+            "Whether the reactor threads wait for new connections to be ready to "
+            "negotiate before handing them to a negotiation thread: outbound "
+            "connections until the connect completes, inbound ones until the client "
+            "sends its first bytes. Connections to slow or unreachable servers and "
+            "idle clients then don't hold up negotiation threads, which keeps "
+            "handshakes from queuing behind them during mass reconnects.");
+TAG_FLAG(rpc_negotiation_wait_on_reactor, experimental);
+TAG_FLAG(rpc_negotiation_wait_on_reactor, runtime);
+
 METRIC_DEFINE_histogram(server, reactor_load_percent,
                         "Reactor Thread Load Percentage",
                         kudu::MetricUnit::kUnits,
@@ -97,10 +131,74 @@ METRIC_DEFINE_histogram(server, reactor_active_latency_us,
                         "to the latency of both inbound and outbound RPCs.",
                         1000000, 2);
 
+METRIC_DEFINE_counter(server, rpc_outbound_queue_full,
+                      "RPC Outbound Queue Full",
+                      kudu::MetricUnit::kRequests,
+                      "Number of outbound RPCs failed without being sent because "
+                      "the outbound queue of their connection held more calls or "
+                      "bytes than allowed by --rpc_max_outbound_queue_calls or "
+                      "--rpc_max_outbound_queue_bytes.");
+
+METRIC_DEFINE_histogram(server, rpc_connection_write_stall_us,
+                        "RPC Connection Write Stall Time",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Histogram of the time that connections with data to send "
+                        "waited for their socket to become writable, because the "
+                        "remote end wasn't reading fast enough.",
+                        60000000LU, 2);
+
+METRIC_DEFINE_histogram(server, rpc_transfers_per_write,
+                        "RPC Transfers Per Write",
+                        kudu::MetricUnit::kUnits,
+                        "Histogram of the number of RPC transfers connections wrote "
+                        "with each write to their socket, when writing the transfers "
+                        "queued together. See --rpc_coalesce_transfers_max_bytes.",
+                        1024, 2);
+
+METRIC_DEFINE_counter(server, rpc_frame_bytes_uncompressed,
+                      "RPC Frame Bytes Before Compression",
+                      kudu::MetricUnit::kBytes,
+                      "Number of bytes of the RPC frames which were compressed, "
+                      "before compression. See MessengerBuilder::"
+                      "set_rpc_compression_policy() and --rpc_compression_codec.",
+                      kudu::PER_CPU);
+
+METRIC_DEFINE_counter(server, rpc_frame_bytes_compressed,
+                      "RPC Frame Bytes After Compression",
+                      kudu::MetricUnit::kBytes,
+                      "Number of bytes the RPC frames which were compressed took "
+                      "once compressed. Frames which compression didn't make "
+                      "smaller were sent uncompressed.",
+                      kudu::PER_CPU);
+
+METRIC_DEFINE_histogram(server, rpc_frame_compression_ratio_percent,
+                        "RPC Frame Compression Ratio",
+                        kudu::MetricUnit::kUnits,
+                        "The size of each compressed RPC frame, as a percentage "
+                        "of its size before compression.", 1000, 2);
+
+METRIC_DEFINE_histogram(server, rpc_frame_compression_cpu_time_us,
+                        "RPC Frame Compression CPU Time",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Histogram of the CPU time spent compressing each "
+                        "compressed RPC frame.", 60000000LU, 2);
+
+METRIC_DEFINE_histogram(server, rpc_frame_decompression_cpu_time_us,
+                        "RPC Frame Decompression CPU Time",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Histogram of the CPU time spent uncompressing each "
+                        "compressed RPC frame received.", 60000000LU, 2);
+
 namespace kudu {
 namespace rpc {
 
 namespace {
+
+// The tick and number of slots of the reactor threads' timer wheels, whose
+// turns take about 10 seconds.
+const MonoDelta kTimerWheelTick = MonoDelta::FromMilliseconds(10);
+const int kTimerWheelSlots = 1024;
+
 Status ShutdownError(bool aborted) {
   const char* msg = "reactor is shutting down";
   return aborted ?
@@ -127,6 +225,8 @@ void DoInitLibEv() {
 
 ReactorThread::ReactorThread(Reactor *reactor, const MessengerBuilder& bld)
   : loop_(kDefaultLibEvFlags),
+    timer_wheel_(kTimerWheelTick, kTimerWheelSlots, MonoTime::Now()),
+    timer_wheel_timer_started_(false),
     cur_time_(MonoTime::Now()),
     last_unused_tcp_scan_(cur_time_),
     reactor_(reactor),
@@ -142,6 +242,25 @@ ReactorThread::ReactorThread(Reactor *reactor, const MessengerBuilder& bld)
         METRIC_reactor_active_latency_us.Instantiate(bld.metric_entity_);
     load_percent_histogram_ =
         METRIC_reactor_load_percent.Instantiate(bld.metric_entity_);
+    outbound_queue_full_counter_ =
+        METRIC_rpc_outbound_queue_full.Instantiate(bld.metric_entity_);
+    write_stall_us_histogram_ =
+        METRIC_rpc_connection_write_stall_us.Instantiate(bld.metric_entity_);
+    transfers_per_write_histogram_ =
+        METRIC_rpc_transfers_per_write.Instantiate(bld.metric_entity_);
+    frame_bytes_uncompressed_counter_ =
+        METRIC_rpc_frame_bytes_uncompressed.Instantiate(bld.metric_entity_);
+    frame_bytes_compressed_counter_ =
+        METRIC_rpc_frame_bytes_compressed.Instantiate(bld.metric_entity_);
+    frame_compression_ratio_histogram_ =
+        METRIC_rpc_frame_compression_ratio_percent.Instantiate(bld.metric_entity_);
+    frame_compression_cpu_us_histogram_ =
+        METRIC_rpc_frame_compression_cpu_time_us.Instantiate(bld.metric_entity_);
+    frame_decompression_cpu_us_histogram_ =
+        METRIC_rpc_frame_decompression_cpu_time_us.Instantiate(bld.metric_entity_);
+  }
+  if (FLAGS_rpc_receive_buffer_pool_max_bytes > 0) {
+    receive_buffer_pool_ = ReceiveBufferPool::Create(reactor_->name());
   }
 }
 
@@ -161,6 +280,10 @@ Status ReactorThread::Init() {
   timer_.start(coarse_timer_granularity_.ToSeconds(),
                coarse_timer_granularity_.ToSeconds());
 
+  // The timer wheel's timer is started once there are timers on the wheel.
+  timer_wheel_timer_.set(loop_);
+  timer_wheel_timer_.set<ReactorThread, &ReactorThread::TimerWheelHandler>(this); // NOLINT(*)
+
   // Register our callbacks. ev++ doesn't provide handy wrappers for these.
   ev_set_userdata(loop_, this);
   ev_set_loop_release_cb(loop_, &ReactorThread::AboutToPollCb, &ReactorThread::PollCompleteCb);
@@ -171,6 +294,14 @@ Status ReactorThread::Init() {
 }
 
 void ReactorThread::InvokePendingCb(struct ev_loop* loop) {
+  ReactorThread* thr = static_cast<ReactorThread*>(ev_userdata(loop));
+  if (thr->busy_poll_cycles_ > 0) {
+    // RunBusyPollLoop() accounts for the whole of each active period.
+    thr->found_work_ |= ev_pending_count(loop) > 0;
+    ev_invoke_pending(loop);
+    return;
+  }
+
   // Calculate the number of cycles spent calling our callbacks.
   // This is called quite frequently so we use CycleClock rather than MonoTime
   // since it's a bit faster.
@@ -179,7 +310,6 @@ void ReactorThread::InvokePendingCb(struct ev_loop* loop) {
   int64_t dur_cycles = CycleClock::Now() - start;
 
   // Contribute this to our histogram.
-  ReactorThread* thr = static_cast<ReactorThread*>(ev_userdata(loop));
   if (thr->invoke_us_histogram_) {
     thr->invoke_us_histogram_->Increment(dur_cycles * 1000000 / base::CyclesPerSecond());
   }
@@ -203,6 +333,7 @@ void ReactorThread::PollCompleteCb(struct ev_loop* loop) noexcept {
 
   int64_t poll_cycles = cycle_clock_after_poll - thr->cycle_clock_before_poll_;
   thr->cycle_clock_before_poll_ = -1;
+  thr->cycle_clock_after_poll_ = cycle_clock_after_poll;
   thr->total_poll_cycles_ += poll_cycles;
 }
 
@@ -316,6 +447,7 @@ void ReactorThread::AsyncHandler(ev::async& /*watcher*/, int /*revents*/) {
   if (PREDICT_FALSE(reactor_->closing())) {
     ShutdownInternal();
     loop_.break_loop(); // break the epoll loop and terminate the thread
+    loop_broken_ = true;
     return;
   }
 
@@ -376,6 +508,17 @@ void ReactorThread::AssignOutboundCall(shared_ptr<OutboundCall> call) {
   conn->QueueOutboundCall(std::move(call));
 }
 
+void ReactorThread::WarmUpConnection(const ConnectionId& conn_id) {
+  DCHECK(IsCurrentThread());
+  scoped_refptr<Connection> conn;
+  Status s = FindOrStartConnection(conn_id, CredentialsPolicy::ANY_CREDENTIALS, &conn);
+  if (PREDICT_FALSE(!s.ok())) {
+    // The first call over the connection will try again.
+    VLOG(1) << name() << ": unable to warm up connection to "
+            << conn_id.ToString() << ": " << s.ToString();
+  }
+}
+
 void ReactorThread::CancelOutboundCall(const shared_ptr<OutboundCall>& call) {
   DCHECK(IsCurrentThread());
 
@@ -431,6 +574,30 @@ void ReactorThread::RegisterTimeout(ev::timer *watcher) {
   watcher->set(loop_);
 }
 
+void ReactorThread::ScheduleTimer(TimerWheel::Timer* timer, MonoDelta delay) {
+  DCHECK(IsCurrentThread());
+  timer_wheel_.Schedule(timer, MonoTime::Now() + delay);
+  if (!timer_wheel_timer_started_) {
+    const double tick = timer_wheel_.tick().ToSeconds();
+    timer_wheel_timer_.start(tick, tick);
+    timer_wheel_timer_started_ = true;
+  }
+}
+
+void ReactorThread::TimerWheelHandler(ev::timer& /*watcher*/, int revents) {
+  DCHECK(IsCurrentThread());
+  if (EV_ERROR & revents) {
+    LOG(WARNING) << "Reactor " << name() << " got an error in "
+      "the timer wheel handler.";
+    return;
+  }
+  timer_wheel_.Advance(MonoTime::Now());
+  if (timer_wheel_.empty()) {
+    timer_wheel_timer_.stop();
+    timer_wheel_timer_started_ = false;
+  }
+}
+
 void ReactorThread::ScanIdleConnections() {
   DCHECK(IsCurrentThread());
   // Enforce TCP connection timeouts: server-side connections.
@@ -499,8 +666,17 @@ bool ReactorThread::IsCurrentThread() const {
 void ReactorThread::RunThread() {
   ThreadRestrictions::SetWaitAllowed(false);
   ThreadRestrictions::SetIOAllowed(false);
+  if (!reactor_->cpus().empty()) {
+    WARN_NOT_OK(SetCurrentThreadCpuAffinity(reactor_->cpus()),
+                Substitute("$0: unable to pin to CPUs $1", name(),
+                           JoinInts(reactor_->cpus(), ",")));
+  }
   DVLOG(6) << "Calling ReactorThread::RunThread()...";
-  loop_.run(0);
+  if (FLAGS_rpc_reactor_busy_poll_us > 0) {
+    RunBusyPollLoop(FLAGS_rpc_reactor_busy_poll_us);
+  } else {
+    loop_.run(0);
+  }
   VLOG(1) << name() << " thread exiting.";
 
   // No longer need the messenger. This causes the messenger to
@@ -508,6 +684,32 @@ void ReactorThread::RunThread() {
   reactor_->messenger_.reset();
 }
 
+void ReactorThread::RunBusyPollLoop(int busy_poll_us) {
+  busy_poll_cycles_ = std::max<int64_t>(
+      1, static_cast<int64_t>(busy_poll_us * base::CyclesPerSecond() / 1000000));
+  while (!loop_broken_) {
+    // Block until there's something to do, and do it.
+    loop_.run(ev::ONCE);
+    const int64_t active_start = cycle_clock_after_poll_;
+
+    // Then keep polling without blocking, until nothing has turned up for
+    // 'busy_poll_cycles_'. The polls are so short that the time spinning
+    // counts as reactor load.
+    int64_t last_work = CycleClock::Now();
+    while (!loop_broken_ && CycleClock::Now() - last_work < busy_poll_cycles_) {
+      found_work_ = false;
+      loop_.run(ev::NOWAIT);
+      if (found_work_) {
+        last_work = CycleClock::Now();
+      }
+    }
+    if (invoke_us_histogram_) {
+      invoke_us_histogram_->Increment(
+          (CycleClock::Now() - active_start) * 1000000 / base::CyclesPerSecond());
+    }
+  }
+}
+
 bool ReactorThread::FindConnection(const ConnectionId& conn_id,
                                    CredentialsPolicy cred_policy,
                                    scoped_refptr<Connection>* conn) {
@@ -571,6 +773,14 @@ Status ReactorThread::FindOrStartConnection(const ConnectionId& conn_id,
   // Create a new socket and start connecting to the remote.
   Socket sock;
   RETURN_NOT_OK(CreateClientSocket(&sock, reactor_->messenger_->get_send_buffer()));
+  SocketProfile profile;
+  if (reactor_->messenger_->FindSocketProfile(conn_id.remote(), &profile)) {
+    // Set before connecting, since the window scale is negotiated then.
+    Status s = profile.ApplyTo(&sock);
+    LOG_IF(WARNING, !s.ok()) << "Unable to apply socket profile (" << profile.ToString()
+                             << ") to the connection to " << conn_id.remote().ToString()
+                             << ": " << s.ToString();
+  }
   RETURN_NOT_OK(StartConnect(&sock, conn_id.remote()));
 
   unique_ptr<Socket> new_socket(new Socket(sock.Release()));
@@ -604,6 +814,17 @@ Status ReactorThread::StartConnectionNegotiation(const scoped_refptr<Connection>
   MonoTime deadline = MonoTime::Now() +
       MonoDelta::FromMilliseconds(reactor()->messenger()->rpc_negotiation_timeout_ms());
 
+  if (FLAGS_rpc_negotiation_wait_on_reactor) {
+    // The connection submits the negotiation once its socket is ready.
+    conn->WaitToNegotiate(loop_, deadline);
+    return Status::OK();
+  }
+  return SubmitConnectionNegotiation(conn, deadline);
+}
+
+Status ReactorThread::SubmitConnectionNegotiation(const scoped_refptr<Connection>& conn,
+                                                  MonoTime deadline) {
+  DCHECK(IsCurrentThread());
   scoped_refptr<Trace> trace(new Trace());
   ADOPT_TRACE(trace.get());
   TRACE("Submitting negotiation task for $0", conn->ToString());
@@ -634,6 +855,14 @@ void ReactorThread::CompleteConnectionNegotiation(
     return;
   }
 
+  if (FLAGS_rpc_reactor_busy_poll_us > 0) {
+    s = conn->socket()->SetBusyPoll(FLAGS_rpc_reactor_busy_poll_us);
+    if (PREDICT_FALSE(!s.ok())) {
+      KLOG_FIRST_N(WARNING, 1) << name() << ": unable to set SO_BUSY_POLL on connections: "
+                               << s.ToString();
+    }
+  }
+
   conn->MarkNegotiationComplete();
   conn->EpollRegister(loop_);
 }
@@ -715,11 +944,16 @@ void DelayedTask::Run(ReactorThread* thread) {
 
   // Schedule the task to run later.
   thread_ = thread;
+  thread_->scheduled_tasks_.push_back(*this);
+  if (FLAGS_rpc_reactor_timer_wheel) {
+    wheel_timer_.set_callback([this]() { Fire(0); });
+    thread_->ScheduleTimer(&wheel_timer_, when_);
+    return;
+  }
   timer_.set(thread->loop_);
   timer_.set<DelayedTask, &DelayedTask::TimerHandler>(this); // NOLINT(*)
   timer_.start(when_.ToSeconds(), // after
                0);                // repeat
-  thread_->scheduled_tasks_.push_back(*this);
 }
 
 void DelayedTask::Abort(const Status& abort_status) {
@@ -728,6 +962,10 @@ void DelayedTask::Abort(const Status& abort_status) {
 }
 
 void DelayedTask::TimerHandler(ev::timer& /*watcher*/, int revents) {
+  Fire(revents);
+}
+
+void DelayedTask::Fire(int revents) {
   DCHECK(is_linked()) << "should be linked on scheduled_tasks_";
   // We will free this task's memory.
   thread_->scheduled_tasks_.erase(thread_->scheduled_tasks_.iterator_to(*this));
@@ -747,6 +985,7 @@ Reactor::Reactor(shared_ptr<Messenger> messenger,
     : messenger_(std::move(messenger)),
       name_(StringPrintf("%s_R%03d", messenger_->name().c_str(), index)),
       closing_(false),
+      numa_node_(-1),
       thread_(this, bld) {
   static std::once_flag libev_once;
   std::call_once(libev_once, DoInitLibEv);
@@ -938,6 +1177,28 @@ void Reactor::QueueResetConnections() {
     ScheduleReactorTask(new ResetConnectionsTask());
 }
 
+class WarmUpConnectionTask : public ReactorTask {
+ public:
+  explicit WarmUpConnectionTask(ConnectionId conn_id)
+      : conn_id_(std::move(conn_id)) {}
+
+  void Run(ReactorThread* reactor) override {
+    reactor->WarmUpConnection(conn_id_);
+    delete this;
+  }
+
+  void Abort(const Status& /*status*/) override {
+    delete this;
+  }
+
+ private:
+  const ConnectionId conn_id_;
+};
+
+void Reactor::QueueWarmUpConnection(const ConnectionId& conn_id) {
+  ScheduleReactorTask(new WarmUpConnectionTask(conn_id));
+}
+
 void Reactor::ScheduleReactorTask(ReactorTask *task) {
   {
     std::unique_lock<LockType> l(lock_);
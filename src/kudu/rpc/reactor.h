@@ -22,6 +22,8 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <boost/function.hpp> // IWYU pragma: keep
 #include <boost/intrusive/list.hpp>
@@ -34,6 +36,7 @@
 #include "kudu/rpc/connection_id.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/rpc_header.pb.h"
+#include "kudu/rpc/timer_wheel.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
@@ -54,6 +57,7 @@ class DumpRunningRpcsResponsePB;
 class OutboundCall;
 class Reactor;
 class ReactorThread;
+class ReceiveBufferPool;
 enum class CredentialsPolicy;
 
 // Simple metrics information from within a reactor.
@@ -118,6 +122,10 @@ class DelayedTask : public ReactorTask {
   // libev callback for when the registered timer fires.
   void TimerHandler(ev::timer& watcher, int revents);
 
+  // Runs the task once its delay has passed, or aborts it if 'revents' has
+  // an error.
+  void Fire(int revents);
+
   // User function to invoke when timer fires or when task is aborted.
   const boost::function<void(const Status&)> func_;
 
@@ -127,8 +135,10 @@ class DelayedTask : public ReactorTask {
   // Link back to registering reactor thread.
   ReactorThread* thread_;
 
-  // libev timer. Set when Run() is invoked.
+  // libev timer. Set when Run() is invoked, unless the reactor thread's
+  // timer wheel is used instead.
   ev::timer timer_;
+  TimerWheel::Timer wheel_timer_;
 };
 
 // A ReactorThread is a libev event handler thread which manages I/O
@@ -177,6 +187,11 @@ class ReactorThread {
   // Does not set a timeout or start it.
   void RegisterTimeout(ev::timer *watcher);
 
+  // Schedules 'timer' on this thread's timer wheel to fire once 'delay' has
+  // passed. Unlike the libev timers, arming and cancelling these takes
+  // constant time, but they fire up to a tick of the wheel late.
+  void ScheduleTimer(TimerWheel::Timer* timer, MonoDelta delay);
+
   // This may be called from another thread.
   const std::string &name() const;
 
@@ -203,16 +218,73 @@ class ReactorThread {
   // Must be called from the reactor thread.
   Status GetMetrics(ReactorMetrics *metrics);
 
+  // The pool which this thread's connections receive large messages into, or
+  // null if --rpc_receive_buffer_pool_max_bytes was not set when it was
+  // created.
+  const std::shared_ptr<ReceiveBufferPool>& receive_buffer_pool() const {
+    return receive_buffer_pool_;
+  }
+
+  // Counts an outbound call failed because its connection's outbound queue
+  // was full.
+  void RecordOutboundQueueFull() {
+    if (outbound_queue_full_counter_) {
+      outbound_queue_full_counter_->Increment();
+    }
+  }
+
+  // Records that a connection couldn't write for 'stall', because its
+  // socket's send buffer was full.
+  void RecordWriteStall(const MonoDelta& stall) {
+    if (write_stall_us_histogram_) {
+      write_stall_us_histogram_->Increment(stall.ToMicroseconds());
+    }
+  }
+
+  // Records that a connection wrote 'n_transfers' transfers with a single
+  // write. See --rpc_coalesce_transfers_max_bytes.
+  void RecordTransfersPerWrite(size_t n_transfers) {
+    if (transfers_per_write_histogram_) {
+      transfers_per_write_histogram_->Increment(n_transfers);
+    }
+  }
+
+  // Records that a frame of 'uncompressed_bytes' was compressed into
+  // 'compressed_bytes', using 'cpu_time'. May be called from any thread.
+  void RecordFrameCompression(size_t uncompressed_bytes, size_t compressed_bytes,
+                              const MonoDelta& cpu_time) {
+    if (frame_bytes_uncompressed_counter_) {
+      frame_bytes_uncompressed_counter_->IncrementBy(uncompressed_bytes);
+      frame_bytes_compressed_counter_->IncrementBy(compressed_bytes);
+      frame_compression_ratio_histogram_->Increment(
+          uncompressed_bytes == 0 ? 100 : compressed_bytes * 100 / uncompressed_bytes);
+      frame_compression_cpu_us_histogram_->Increment(cpu_time.ToMicroseconds());
+    }
+  }
+
+  // Records that a compressed frame was uncompressed using 'cpu_time'. May be
+  // called from any thread.
+  void RecordFrameDecompression(const MonoDelta& cpu_time) {
+    if (frame_decompression_cpu_us_histogram_) {
+      frame_decompression_cpu_us_histogram_->Increment(cpu_time.ToMicroseconds());
+    }
+  }
+
  private:
   friend class AssignOutboundCallTask;
   friend class CancellationTask;
   friend class ResetConnectionsTask;
   friend class RegisterConnectionTask;
+  friend class WarmUpConnectionTask;
   friend class DelayedTask;
 
   // Run the main event loop of the reactor.
   void RunThread();
 
+  // Runs the event loop, busy-polling for up to 'busy_poll_us' after each
+  // time there was something to do before blocking again.
+  void RunBusyPollLoop(int busy_poll_us);
+
   // When libev has noticed that it needs to wake up an application watcher,
   // it calls this callback. The callback simply calls back into libev's
   // ev_invoke_pending() to trigger all the watcher callbacks, but
@@ -241,6 +313,11 @@ class ReactorThread {
                                CredentialsPolicy cred_policy,
                                scoped_refptr<Connection>* conn);
 
+  // Hand the negotiation of 'conn', to be done by 'deadline', to a
+  // negotiation thread.
+  Status SubmitConnectionNegotiation(const scoped_refptr<Connection>& conn,
+                                     MonoTime deadline);
+
   // Shut down the given connection, removing it from the connection tracking
   // structures of this reactor.
   //
@@ -255,6 +332,9 @@ class ReactorThread {
   // is skipped.
   void ScanIdleConnections();
 
+  // libev callback which advances the timer wheel every tick.
+  void TimerWheelHandler(ev::timer& watcher, int revents);
+
   // Create a new client socket (non-blocking, NODELAY)
   // buf_size can be specified to set SO_RCVBUF. 0 to skip setting
   static Status CreateClientSocket(Socket *sock, int buf_size = 0);
@@ -266,6 +346,10 @@ class ReactorThread {
   // If this fails, the call is marked failed and completed.
   void AssignOutboundCall(std::shared_ptr<OutboundCall> call);
 
+  // Start connecting and negotiating with the remote of 'conn_id', unless
+  // there is a connection to it already.
+  void WarmUpConnection(const ConnectionId& conn_id);
+
   // Cancel the outbound call. May update corresponding connection
   // object to remove call from the CallAwaitingResponse object.
   // Also mark the call as slated for cancellation so the callback
@@ -294,6 +378,12 @@ class ReactorThread {
   // Handles the periodic timer.
   ev::timer timer_;
 
+  // The timers scheduled with ScheduleTimer(), and the libev timer which
+  // advances them every tick while there are any.
+  TimerWheel timer_wheel_;
+  ev::timer timer_wheel_timer_;
+  bool timer_wheel_timer_started_;
+
   // Scheduled (but not yet run) delayed tasks.
   //
   // Each task owns its own memory and must be freed by its TaskRun and
@@ -323,6 +413,14 @@ class ReactorThread {
   // Metrics.
   scoped_refptr<Histogram> invoke_us_histogram_;
   scoped_refptr<Histogram> load_percent_histogram_;
+  scoped_refptr<Counter> outbound_queue_full_counter_;
+  scoped_refptr<Histogram> write_stall_us_histogram_;
+  scoped_refptr<Histogram> transfers_per_write_histogram_;
+  scoped_refptr<Counter> frame_bytes_uncompressed_counter_;
+  scoped_refptr<Counter> frame_bytes_compressed_counter_;
+  scoped_refptr<Histogram> frame_compression_ratio_histogram_;
+  scoped_refptr<Histogram> frame_compression_cpu_us_histogram_;
+  scoped_refptr<Histogram> frame_decompression_cpu_us_histogram_;
 
   // Total number of client connections opened during Reactor's lifetime.
   uint64_t total_client_conns_cnt_;
@@ -336,10 +434,25 @@ class ReactorThread {
   // Total number of server normal TLS connections opened during Reactor's lifetime.
   uint64_t total_server_normal_tls_conns_cnt_;
 
+  // See receive_buffer_pool().
+  std::shared_ptr<ReceiveBufferPool> receive_buffer_pool_;
+
   // Set prior to calling epoll and then reset back to -1 after each invocation
   // completes. Used for accounting total_poll_cycles_.
   int64_t cycle_clock_before_poll_ = -1;
 
+  // The cycle-time at which the last invocation of epoll completed.
+  int64_t cycle_clock_after_poll_ = 0;
+
+  // How long RunBusyPollLoop() spins for, or 0 if the loop doesn't busy-poll.
+  int64_t busy_poll_cycles_ = 0;
+
+  // Whether an iteration of the busy-polling loop had watchers to invoke.
+  bool found_work_ = false;
+
+  // Set once the loop has been broken to shut down the reactor.
+  bool loop_broken_ = false;
+
   // The total number of cycles spent in epoll_wait() since this thread
   // started.
   int64_t total_poll_cycles_ = 0;
@@ -391,6 +504,10 @@ class Reactor {
   // Queues a task to reset this reactor's connections
   void QueueResetConnections();
 
+  // Queues a task to establish the connection of 'conn_id' ahead of the
+  // first call over it.
+  void QueueWarmUpConnection(const ConnectionId& conn_id);
+
   // Schedule the given task's Run() method to be called on the
   // reactor thread.
   // If the reactor shuts down before it is run, the Abort method will be
@@ -419,6 +536,19 @@ class Reactor {
     return thread_.IsCurrentThread();
   }
 
+  // Pins the reactor thread to 'cpus', on NUMA node 'numa_node'. Must be
+  // called before Init().
+  void set_cpu_affinity(std::vector<int> cpus, int numa_node) {
+    cpus_ = std::move(cpus);
+    numa_node_ = numa_node;
+  }
+
+  // The CPUs which the reactor thread is pinned to, or empty if it isn't.
+  const std::vector<int>& cpus() const { return cpus_; }
+
+  // The NUMA node which the reactor thread is pinned to, or -1 if it isn't.
+  int numa_node() const { return numa_node_; }
+
  private:
   friend class ReactorThread;
   typedef simple_spinlock LockType;
@@ -437,6 +567,9 @@ class Reactor {
   // Guarded by lock_.
   boost::intrusive::list<ReactorTask> pending_tasks_; // NOLINT(build/include_what_you_use)
 
+  std::vector<int> cpus_;
+  int numa_node_;
+
   ReactorThread thread_;
 
   DISALLOW_COPY_AND_ASSIGN(Reactor);
@@ -0,0 +1,102 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/rpc/receive_buffer_pool.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/huge_pages.h"
+#include "kudu/util/mem_tracker.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_string(buffer_huge_pages);
+
+using std::shared_ptr;
+
+namespace kudu {
+namespace rpc {
+
+class ReceiveBufferPoolTest : public KuduTest {};
+
+// Tests that buffers are handed out by size class, reused once returned, and
+// freed rather than kept once the pool holds its limit of free bytes.
+TEST_F(ReceiveBufferPoolTest, TestSizeClassesAndReuse) {
+  const int64_t kMin = ReceiveBufferPool::kMinBufferSize;
+  FLAGS_rpc_receive_buffer_pool_max_bytes = 4 * kMin;
+  shared_ptr<ReceiveBufferPool> pool = ReceiveBufferPool::Create("test");
+
+  uint8_t* first_data;
+  {
+    ReceiveBufferPool::Buffer buf = pool->Allocate(kMin + 1);
+    ASSERT_EQ(2 * kMin, buf.capacity());
+    ASSERT_EQ(2 * kMin, pool->mem_tracker()->consumption());
+    first_data = buf.data();
+  }
+  ASSERT_EQ(2 * kMin, pool->free_bytes());
+  ASSERT_EQ(2 * kMin, pool->mem_tracker()->consumption());
+
+  // A request of the same size class gets the freed buffer back, another
+  // size class a new one.
+  ReceiveBufferPool::Buffer same = pool->Allocate(2 * kMin);
+  ASSERT_EQ(first_data, same.data());
+  ASSERT_EQ(0, pool->free_bytes());
+  ReceiveBufferPool::Buffer small = pool->Allocate(kMin);
+  ASSERT_EQ(kMin, small.capacity());
+  ASSERT_EQ(3 * kMin, pool->mem_tracker()->consumption());
+
+  // Buffers beyond the limit of free bytes are freed when returned.
+  ReceiveBufferPool::Buffer big = pool->Allocate(4 * kMin);
+  ReceiveBufferPool::Buffer moved = std::move(same);
+  ASSERT_FALSE(same);
+  moved = ReceiveBufferPool::Buffer();
+  big = ReceiveBufferPool::Buffer();
+  ASSERT_EQ(2 * kMin, pool->free_bytes());
+  ASSERT_EQ(3 * kMin, pool->mem_tracker()->consumption());
+
+  // The pool outlives the buffers handed out from it.
+  pool.reset();
+  ASSERT_TRUE(small);
+}
+
+// Tests that the buffers of a huge page or more of a pool created with
+// --buffer_huge_pages are mapped on huge pages, and unmapped when freed.
+TEST_F(ReceiveBufferPoolTest, TestHugePages) {
+  FLAGS_buffer_huge_pages = "thp";
+  FLAGS_rpc_receive_buffer_pool_max_bytes = kHugePageSize;
+  shared_ptr<ReceiveBufferPool> pool = ReceiveBufferPool::Create("test");
+  const int64_t initial_bytes = HugePageBufferBytes();
+
+  ReceiveBufferPool::Buffer small = pool->Allocate(ReceiveBufferPool::kMinBufferSize);
+  ASSERT_EQ(initial_bytes, HugePageBufferBytes());
+  {
+    ReceiveBufferPool::Buffer big = pool->Allocate(kHugePageSize);
+    ASSERT_EQ(initial_bytes + kHugePageSize, HugePageBufferBytes());
+    big.data()[kHugePageSize - 1] = 1;
+  }
+  // The free buffer is kept, and unmapped with the pool.
+  ASSERT_EQ(initial_bytes + kHugePageSize, HugePageBufferBytes());
+  small = ReceiveBufferPool::Buffer();
+  pool.reset();
+  ASSERT_EQ(initial_bytes, HugePageBufferBytes());
+}
+
+} // namespace rpc
+} // namespace kudu
@@ -0,0 +1,187 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/receive_buffer_pool.h"
+
+#include <mutex>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/bits.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/huge_pages.h"
+#include "kudu/util/mem_tracker.h"
+
+DEFINE_int64(rpc_receive_buffer_pool_max_bytes, 0,
+             "The most bytes of free buffers that each reactor thread keeps to "
+             "receive large inbound messages into, rather than allocating a buffer "
+             "the size of each message. Pooling is enabled for the reactors created "
+             "while this is positive.");
+TAG_FLAG(rpc_receive_buffer_pool_max_bytes, experimental);
+TAG_FLAG(rpc_receive_buffer_pool_max_bytes, runtime);
+
+using std::shared_ptr;
+using std::string;
+using strings::Substitute;
+
+namespace kudu {
+namespace rpc {
+
+const size_t ReceiveBufferPool::kMinBufferSize = 64 * 1024;
+
+ReceiveBufferPool::Buffer::Buffer(shared_ptr<ReceiveBufferPool> pool, uint8_t* data,
+                                  int size_class)
+    : pool_(std::move(pool)),
+      data_(data),
+      size_class_(size_class) {
+}
+
+ReceiveBufferPool::Buffer::Buffer(Buffer&& other) noexcept
+    : pool_(std::move(other.pool_)),
+      data_(other.data_),
+      size_class_(other.size_class_) {
+  other.data_ = nullptr;
+  other.size_class_ = -1;
+}
+
+ReceiveBufferPool::Buffer& ReceiveBufferPool::Buffer::operator=(Buffer&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    pool_ = std::move(other.pool_);
+    data_ = other.data_;
+    size_class_ = other.size_class_;
+    other.data_ = nullptr;
+    other.size_class_ = -1;
+  }
+  return *this;
+}
+
+ReceiveBufferPool::Buffer::~Buffer() {
+  Reset();
+}
+
+size_t ReceiveBufferPool::Buffer::capacity() const {
+  return data_ ? SizeOfClass(size_class_) : 0;
+}
+
+void ReceiveBufferPool::Buffer::Reset() {
+  if (data_) {
+    pool_->Release(data_, size_class_);
+    data_ = nullptr;
+    size_class_ = -1;
+  }
+  pool_.reset();
+}
+
+shared_ptr<ReceiveBufferPool> ReceiveBufferPool::Create(const string& name) {
+  shared_ptr<MemTracker> parent = MemTracker::FindOrCreateGlobalTracker(
+      -1, "rpc_receive_buffers");
+  return shared_ptr<ReceiveBufferPool>(new ReceiveBufferPool(
+      MemTracker::CreateTracker(-1, Substitute("$0-receive-buffers", name), parent,
+                                MemTracker::Accounting::BATCHED)));
+}
+
+ReceiveBufferPool::ReceiveBufferPool(shared_ptr<MemTracker> mem_tracker)
+    : mem_tracker_(std::move(mem_tracker)),
+      huge_pages_(UseHugePageBuffer(kHugePageSize)),
+      free_bytes_(0) {
+}
+
+ReceiveBufferPool::~ReceiveBufferPool() {
+  for (size_t size_class = 0; size_class < free_buffers_.size(); size_class++) {
+    for (uint8_t* data : free_buffers_[size_class]) {
+      FreeBuffer(data, size_class);
+    }
+  }
+  mem_tracker_->Release(free_bytes_);
+}
+
+bool ReceiveBufferPool::OnHugePages(int size_class) const {
+  return huge_pages_ && SizeOfClass(size_class) >= kHugePageSize;
+}
+
+uint8_t* ReceiveBufferPool::NewBuffer(int size_class) const {
+  size_t size = SizeOfClass(size_class);
+  if (OnHugePages(size_class)) {
+    uint8_t* data = AllocateHugePageBuffer(&size);
+    CHECK(data) << "out of memory mapping a receive buffer";
+    DCHECK_EQ(SizeOfClass(size_class), size);
+    return data;
+  }
+  return new uint8_t[size];
+}
+
+void ReceiveBufferPool::FreeBuffer(uint8_t* data, int size_class) const {
+  if (OnHugePages(size_class)) {
+    FreeHugePageBuffer(data, SizeOfClass(size_class));
+  } else {
+    delete[] data;
+  }
+}
+
+int ReceiveBufferPool::SizeClass(size_t size) {
+  if (size <= kMinBufferSize) {
+    return 0;
+  }
+  return Bits::Log2Ceiling64(size) - Bits::Log2Ceiling64(kMinBufferSize);
+}
+
+ReceiveBufferPool::Buffer ReceiveBufferPool::Allocate(size_t size) {
+  const int size_class = SizeClass(size);
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (static_cast<size_t>(size_class) < free_buffers_.size() &&
+        !free_buffers_[size_class].empty()) {
+      // Reuse the most recently released buffer, whose pages are the most
+      // likely to still be resident.
+      uint8_t* data = free_buffers_[size_class].back();
+      free_buffers_[size_class].pop_back();
+      free_bytes_ -= SizeOfClass(size_class);
+      return Buffer(shared_from_this(), data, size_class);
+    }
+  }
+  mem_tracker_->Consume(SizeOfClass(size_class));
+  return Buffer(shared_from_this(), NewBuffer(size_class), size_class);
+}
+
+void ReceiveBufferPool::Release(uint8_t* data, int size_class) {
+  const int64_t size = SizeOfClass(size_class);
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (free_bytes_ + size <= FLAGS_rpc_receive_buffer_pool_max_bytes) {
+      if (static_cast<size_t>(size_class) >= free_buffers_.size()) {
+        free_buffers_.resize(size_class + 1);
+      }
+      free_buffers_[size_class].push_back(data);
+      free_bytes_ += size;
+      return;
+    }
+  }
+  FreeBuffer(data, size_class);
+  mem_tracker_->Release(size);
+}
+
+int64_t ReceiveBufferPool::free_bytes() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  return free_bytes_;
+}
+
+} // namespace rpc
+} // namespace kudu
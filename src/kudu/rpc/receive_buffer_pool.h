@@ -0,0 +1,140 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef KUDU_RPC_RECEIVE_BUFFER_POOL_H
+#define KUDU_RPC_RECEIVE_BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+
+DECLARE_int64(rpc_receive_buffer_pool_max_bytes);
+
+namespace kudu {
+
+class MemTracker;
+
+namespace rpc {
+
+// A pool of the buffers which large inbound messages are received into, so
+// that a follower ingesting big UpdateConsensus batches doesn't allocate and
+// free a buffer the size of each one. Buffers come in power-of-two size
+// classes, starting at kMinBufferSize, and up to
+// --rpc_receive_buffer_pool_max_bytes of free buffers are kept across the
+// size classes. The buffers handed out and kept free are accounted to a
+// MemTracker.
+//
+// With --buffer_huge_pages set when a pool is created, its buffers of a huge
+// page or more are mapped on huge pages.
+//
+// Each reactor thread has its own pool. Buffers are returned to it from
+// whichever thread destroys them, usually a service thread once the
+// InboundCall which received them is done, so this class is thread-safe.
+class ReceiveBufferPool : public std::enable_shared_from_this<ReceiveBufferPool> {
+ public:
+  // A buffer taken from the pool. Returns itself to the pool when destroyed.
+  class Buffer {
+   public:
+    Buffer() : data_(nullptr), size_class_(-1) {}
+    Buffer(Buffer&& other) noexcept;
+    Buffer& operator=(Buffer&& other) noexcept;
+    ~Buffer();
+
+    uint8_t* data() const { return data_; }
+    size_t capacity() const;
+
+    explicit operator bool() const { return data_ != nullptr; }
+
+   private:
+    friend class ReceiveBufferPool;
+
+    Buffer(std::shared_ptr<ReceiveBufferPool> pool, uint8_t* data, int size_class);
+
+    // Returns the buffer to its pool, leaving this one empty.
+    void Reset();
+
+    std::shared_ptr<ReceiveBufferPool> pool_;
+    uint8_t* data_;
+    int size_class_;
+
+    DISALLOW_COPY_AND_ASSIGN(Buffer);
+  };
+
+  // Messages smaller than this are received into buffers of their own.
+  static const size_t kMinBufferSize;
+
+  // Creates a pool whose MemTracker, named after 'name', is a child of the
+  // global "rpc_receive_buffers" tracker.
+  static std::shared_ptr<ReceiveBufferPool> Create(const std::string& name);
+
+  ~ReceiveBufferPool();
+
+  // Returns a buffer of at least 'size' bytes, which should be no less than
+  // kMinBufferSize. Reuses a free buffer of the size class if there is one.
+  Buffer Allocate(size_t size);
+
+  // Returns the number of bytes of free buffers kept for reuse.
+  int64_t free_bytes() const;
+
+  const std::shared_ptr<MemTracker>& mem_tracker() const { return mem_tracker_; }
+
+ private:
+  explicit ReceiveBufferPool(std::shared_ptr<MemTracker> mem_tracker);
+
+  // Returns the size class of the buffers which 'size' bytes fit in.
+  static int SizeClass(size_t size);
+
+  static size_t SizeOfClass(int size_class) { return kMinBufferSize << size_class; }
+
+  // Keeps 'data', of 'size_class', for reuse unless that would exceed
+  // --rpc_receive_buffer_pool_max_bytes, in which case it's freed.
+  void Release(uint8_t* data, int size_class);
+
+  // Whether the buffers of 'size_class' are mapped on huge pages.
+  bool OnHugePages(int size_class) const;
+
+  // Allocate and free the memory of a buffer of 'size_class'.
+  uint8_t* NewBuffer(int size_class) const;
+  void FreeBuffer(uint8_t* data, int size_class) const;
+
+  const std::shared_ptr<MemTracker> mem_tracker_;
+
+  // Whether --buffer_huge_pages was set when the pool was created.
+  const bool huge_pages_;
+
+  mutable simple_spinlock lock_;
+
+  // The free buffers, by size class. Protected by 'lock_'.
+  std::vector<std::vector<uint8_t*>> free_buffers_;
+
+  // The total size of 'free_buffers_'. Protected by 'lock_'.
+  int64_t free_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReceiveBufferPool);
+};
+
+} // namespace rpc
+} // namespace kudu
+
+#endif // KUDU_RPC_RECEIVE_BUFFER_POOL_H
@@ -18,6 +18,7 @@
 #include "kudu/rpc/result_tracker.h"
 
 #include <algorithm>
+#include <functional>
 #include <mutex>
 #include <ostream>
 
@@ -57,6 +58,14 @@ DEFINE_int64(result_tracker_gc_interval_ms, 1000,
     "Interval at which the result tracker will look for entries to GC.");
 TAG_FLAG(result_tracker_gc_interval_ms, hidden);
 
+DEFINE_int32(result_tracker_num_shards, 16,
+    "Number of shards, by client id, that the result tracker splits the clients "
+    "it remembers into. Each shard has its own lock, so RPCs from clients of "
+    "different shards are tracked concurrently. Takes effect for the result "
+    "trackers created after it's set.");
+TAG_FLAG(result_tracker_num_shards, advanced);
+TAG_FLAG(result_tracker_num_shards, experimental);
+
 namespace kudu {
 namespace rpc {
 
@@ -105,9 +114,13 @@ struct ScopedMemTrackerUpdater {
 
 ResultTracker::ResultTracker(shared_ptr<MemTracker> mem_tracker)
     : mem_tracker_(std::move(mem_tracker)),
-      clients_(ClientStateMap::key_compare(),
-               ClientStateMapAllocator(mem_tracker_)),
-      gc_thread_stop_latch_(1) {}
+      gc_thread_stop_latch_(1) {
+  int num_shards = std::max(1, FLAGS_result_tracker_num_shards);
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; i++) {
+    shards_.emplace_back(new Shard(mem_tracker_));
+  }
+}
 
 ResultTracker::~ResultTracker() {
   if (gc_thread_) {
@@ -115,32 +128,43 @@ ResultTracker::~ResultTracker() {
     gc_thread_->Join();
   }
 
-  lock_guard<simple_spinlock> l(lock_);
   // Release all the memory for the stuff we'll delete on destruction.
-  for (auto& client_state : clients_) {
-    client_state.second->GCCompletionRecords(
-        mem_tracker_, [] (SequenceNumber, CompletionRecord*){ return true; });
-    mem_tracker_->Release(client_state.second->memory_footprint());
+  for (auto& shard : shards_) {
+    lock_guard<simple_spinlock> l(shard->lock);
+    for (auto& client_state : shard->clients) {
+      client_state.second->GCCompletionRecords(
+          mem_tracker_, [] (SequenceNumber, CompletionRecord*){ return true; });
+      mem_tracker_->Release(client_state.second->memory_footprint());
+    }
   }
 }
 
+ResultTracker::Shard* ResultTracker::FindShard(const string& client_id) const {
+  return shards_[std::hash<string>()(client_id) % shards_.size()].get();
+}
+
 ResultTracker::RpcState ResultTracker::TrackRpc(const RequestIdPB& request_id,
                                                 Message* response,
                                                 RpcContext* context) {
-  lock_guard<simple_spinlock> l(lock_);
-  return TrackRpcUnlocked(request_id, response, context);
+  Shard* shard = FindShard(request_id.client_id());
+  lock_guard<simple_spinlock> l(shard->lock);
+  return TrackRpcUnlocked(shard, request_id, response, context);
 }
 
-ResultTracker::RpcState ResultTracker::TrackRpcUnlocked(const RequestIdPB& request_id,
+ResultTracker::RpcState ResultTracker::TrackRpcUnlocked(Shard* shard,
+                                                        const RequestIdPB& request_id,
                                                         Message* response,
                                                         RpcContext* context) {
   ClientState* client_state = ComputeIfAbsent(
-      &clients_,
+      &shard->clients,
       request_id.client_id(),
       [&]{
         unique_ptr<ClientState> client_state(new ClientState(mem_tracker_));
         mem_tracker_->Consume(client_state->memory_footprint());
         client_state->stale_before_seq_no = request_id.first_incomplete_seq_no();
+        shard->client_expiry_queue.push(
+            { MonoTime::Now() + MonoDelta::FromMilliseconds(FLAGS_remember_clients_ttl_ms),
+              request_id.client_id() });
         return client_state;
       })->get();
 
@@ -197,6 +221,7 @@ ResultTracker::RpcState ResultTracker::TrackRpcUnlocked(const RequestIdPB& reque
       // If the RPC is COMPLETED and the request originates from a client (context, response are
       // non-null) copy the response and reply immediately. If there is no context/response
       // do nothing.
+      ScheduleResponsesGCUnlocked(shard, request_id.client_id());
       if (context != nullptr) {
         DCHECK_NOTNULL(response)->CopyFrom(*completion_record->response);
         context->call_->RespondSuccess(*response);
@@ -222,12 +247,13 @@ ResultTracker::RpcState ResultTracker::TrackRpcUnlocked(const RequestIdPB& reque
 }
 
 ResultTracker::RpcState ResultTracker::TrackRpcOrChangeDriver(const RequestIdPB& request_id) {
-  lock_guard<simple_spinlock> l(lock_);
-  RpcState state = TrackRpcUnlocked(request_id, nullptr, nullptr);
+  Shard* shard = FindShard(request_id.client_id());
+  lock_guard<simple_spinlock> l(shard->lock);
+  RpcState state = TrackRpcUnlocked(shard, request_id, nullptr, nullptr);
 
   if (state != RpcState::IN_PROGRESS) return state;
 
-  CompletionRecord* completion_record = FindCompletionRecordOrDieUnlocked(request_id);
+  CompletionRecord* completion_record = FindCompletionRecordOrDieUnlocked(shard, request_id);
   ScopedMemTrackerUpdater<CompletionRecord> updater(mem_tracker_.get(), completion_record);
 
   // ... if we did find a CompletionRecord change the driver and return true.
@@ -242,8 +268,9 @@ ResultTracker::RpcState ResultTracker::TrackRpcOrChangeDriver(const RequestIdPB&
 }
 
 bool ResultTracker::IsCurrentDriver(const RequestIdPB& request_id) {
-  lock_guard<simple_spinlock> l(lock_);
-  CompletionRecord* completion_record = FindCompletionRecordOrNullUnlocked(request_id);
+  Shard* shard = FindShard(request_id.client_id());
+  lock_guard<simple_spinlock> l(shard->lock);
+  CompletionRecord* completion_record = FindCompletionRecordOrNullUnlocked(shard, request_id);
 
   // If we couldn't find the CompletionRecord, someone might have called FailAndRespond() so
   // just return false.
@@ -257,11 +284,12 @@ bool ResultTracker::IsCurrentDriver(const RequestIdPB& request_id) {
 void ResultTracker::LogAndTraceAndRespondSuccess(RpcContext* context,
                                                  const Message& msg) {
   InboundCall* call = context->call_;
+  Trace* trace = context->trace();
   VLOG(1) << this << " " << call->remote_method().service_name() << ": Sending RPC success "
       "response for " << call->ToString() << ":" << std::endl << SecureDebugString(msg);
   TRACE_EVENT_ASYNC_END2("rpc_call", "RPC", this,
                          "response", pb_util::PbTracer::TracePb(msg),
-                         "trace", context->trace()->DumpToString());
+                         "trace", trace ? trace->DumpToString() : string());
   call->RespondSuccess(msg);
   delete context;
 }
@@ -269,33 +297,37 @@ void ResultTracker::LogAndTraceAndRespondSuccess(RpcContext* context,
 void ResultTracker::LogAndTraceFailure(RpcContext* context,
                                        const Message& msg) {
   InboundCall* call = context->call_;
+  Trace* trace = context->trace();
   VLOG(1) << this << " " << call->remote_method().service_name() << ": Sending RPC failure "
       "response for " << call->ToString() << ": " << SecureDebugString(msg);
   TRACE_EVENT_ASYNC_END2("rpc_call", "RPC", this,
                          "response", pb_util::PbTracer::TracePb(msg),
-                         "trace", context->trace()->DumpToString());
+                         "trace", trace ? trace->DumpToString() : string());
 }
 
 void ResultTracker::LogAndTraceFailure(RpcContext* context,
                                        ErrorStatusPB_RpcErrorCodePB err,
                                        const Status& status) {
   InboundCall* call = context->call_;
+  Trace* trace = context->trace();
   VLOG(1) << this << " " << call->remote_method().service_name() << ": Sending RPC failure "
       "response for " << call->ToString() << ": " << status.ToString();
   TRACE_EVENT_ASYNC_END2("rpc_call", "RPC", this,
                          "status", status.ToString(),
-                         "trace", context->trace()->DumpToString());
+                         "trace", trace ? trace->DumpToString() : string());
 }
 
 ResultTracker::CompletionRecord* ResultTracker::FindCompletionRecordOrDieUnlocked(
-    const RequestIdPB& request_id) {
-  ClientState* client_state = DCHECK_NOTNULL(FindPointeeOrNull(clients_, request_id.client_id()));
+    Shard* shard, const RequestIdPB& request_id) {
+  ClientState* client_state =
+      DCHECK_NOTNULL(FindPointeeOrNull(shard->clients, request_id.client_id()));
   return DCHECK_NOTNULL(FindPointeeOrNull(client_state->completion_records, request_id.seq_no()));
 }
 
 pair<ResultTracker::ClientState*, ResultTracker::CompletionRecord*>
-ResultTracker::FindClientStateAndCompletionRecordOrNullUnlocked(const RequestIdPB& request_id) {
-  ClientState* client_state = FindPointeeOrNull(clients_, request_id.client_id());
+ResultTracker::FindClientStateAndCompletionRecordOrNullUnlocked(Shard* shard,
+                                                                const RequestIdPB& request_id) {
+  ClientState* client_state = FindPointeeOrNull(shard->clients, request_id.client_id());
   CompletionRecord* completion_record = nullptr;
   if (client_state != nullptr) {
     completion_record = FindPointeeOrNull(client_state->completion_records, request_id.seq_no());
@@ -304,28 +336,37 @@ ResultTracker::FindClientStateAndCompletionRecordOrNullUnlocked(const RequestIdP
 }
 
 ResultTracker::CompletionRecord*
-ResultTracker::FindCompletionRecordOrNullUnlocked(const RequestIdPB& request_id) {
-  return FindClientStateAndCompletionRecordOrNullUnlocked(request_id).second;
+ResultTracker::FindCompletionRecordOrNullUnlocked(Shard* shard, const RequestIdPB& request_id) {
+  return FindClientStateAndCompletionRecordOrNullUnlocked(shard, request_id).second;
+}
+
+void ResultTracker::ScheduleResponsesGCUnlocked(Shard* shard, const string& client_id) {
+  shard->response_expiry_queue.push(
+      { MonoTime::Now() + MonoDelta::FromMilliseconds(FLAGS_remember_responses_ttl_ms),
+        client_id });
 }
 
 void ResultTracker::RecordCompletionAndRespond(const RequestIdPB& request_id,
                                                const Message* response) {
   vector<OnGoingRpcInfo> to_respond;
   {
-    lock_guard<simple_spinlock> l(lock_);
+    Shard* shard = FindShard(request_id.client_id());
+    lock_guard<simple_spinlock> l(shard->lock);
 
-    CompletionRecord* completion_record = FindCompletionRecordOrDieUnlocked(request_id);
+    CompletionRecord* completion_record = FindCompletionRecordOrDieUnlocked(shard, request_id);
     ScopedMemTrackerUpdater<CompletionRecord> updater(mem_tracker_.get(), completion_record);
 
     CHECK_EQ(completion_record->driver_attempt_no, request_id.attempt_no())
         << "Called RecordCompletionAndRespond() from an executor identified with an "
         << "attempt number that was not marked as the driver for the RPC. RequestId: "
-        << SecureShortDebugString(request_id) << "\nTracker state:\n " << ToStringUnlocked();
+        << SecureShortDebugString(request_id) << "\nTracker state:\n "
+        << ShardToStringUnlocked(*shard);
     DCHECK_EQ(completion_record->state, RpcState::IN_PROGRESS);
     completion_record->response.reset(DCHECK_NOTNULL(response)->New());
     completion_record->response->CopyFrom(*response);
     completion_record->state = RpcState::COMPLETED;
     completion_record->last_updated = MonoTime::Now();
+    ScheduleResponsesGCUnlocked(shard, request_id.client_id());
 
     CHECK_EQ(completion_record->driver_attempt_no, request_id.attempt_no());
 
@@ -364,11 +405,12 @@ void ResultTracker::FailAndRespondInternal(const RequestIdPB& request_id,
                                            const HandleOngoingRpcFunc& func) {
   vector<OnGoingRpcInfo> to_handle;
   {
-    lock_guard<simple_spinlock> l(lock_);
-    auto state_and_record = FindClientStateAndCompletionRecordOrNullUnlocked(request_id);
+    Shard* shard = FindShard(request_id.client_id());
+    lock_guard<simple_spinlock> l(shard->lock);
+    auto state_and_record = FindClientStateAndCompletionRecordOrNullUnlocked(shard, request_id);
     if (PREDICT_FALSE(state_and_record.first == nullptr)) {
       LOG(FATAL) << "Couldn't find ClientState for request: " << SecureShortDebugString(request_id)
-                 << ". \nTracker state:\n" << ToStringUnlocked();
+                 << ". \nTracker state:\n" << ShardToStringUnlocked(*shard);
     }
 
     CompletionRecord* completion_record = state_and_record.second;
@@ -413,6 +455,8 @@ void ResultTracker::FailAndRespondInternal(const RequestIdPB& request_id,
       unique_ptr<CompletionRecord> completion_record =
           EraseKeyReturnValuePtr(&state_and_record.first->completion_records, seq_no);
       mem_tracker_->Release(completion_record->memory_footprint());
+      // The responses after the deleted record may be waiting on it to be GCed.
+      ScheduleResponsesGCUnlocked(shard, request_id.client_id());
     }
   }
 
@@ -471,8 +515,13 @@ void ResultTracker::RunGCThread() {
 }
 
 void ResultTracker::GCResults() {
-  lock_guard<simple_spinlock> l(lock_);
-  MonoTime now = MonoTime::Now();
+  for (auto& shard : shards_) {
+    GCShard(shard.get(), MonoTime::Now());
+  }
+}
+
+void ResultTracker::GCShard(Shard* shard, MonoTime now) {
+  lock_guard<simple_spinlock> l(shard->lock);
   // Calculate the instants before which we'll start GCing ClientStates and CompletionRecords.
   MonoTime time_to_gc_clients_from = now;
   time_to_gc_clients_from.AddDelta(
@@ -481,52 +530,85 @@ void ResultTracker::GCResults() {
   time_to_gc_responses_from.AddDelta(
       MonoDelta::FromMilliseconds(-FLAGS_remember_responses_ttl_ms));
 
-  // Now go through the ClientStates. If we haven't heard from a client in a while
-  // GC it and all its completion records (making sure there isn't actually one in progress first).
-  // If we've heard from a client recently, but some of its responses are old, GC those responses.
-  for (auto iter = clients_.begin(); iter != clients_.end();) {
-    auto& client_state = iter->second;
-    if (client_state->last_heard_from < time_to_gc_clients_from) {
-      // Client should be GCed.
-      bool ongoing_request = false;
+  // Go through the clients whose responses may have expired, GCing those responses.
+  // A client gets an entry each time one of its responses is updated, so one whose
+  // oldest responses expired further back has had them GCed by an earlier entry.
+  auto& response_queue = shard->response_expiry_queue;
+  while (!response_queue.empty() && response_queue.top().deadline < now) {
+    ClientState* client_state = FindPointeeOrNull(shard->clients,
+                                                  response_queue.top().client_id);
+    if (client_state != nullptr) {
       client_state->GCCompletionRecords(
-          mem_tracker_,
-          [&] (SequenceNumber, CompletionRecord* completion_record) {
-            if (PREDICT_FALSE(completion_record->state == RpcState::IN_PROGRESS)) {
-              ongoing_request = true;
-              return false;
-            }
-            return true;
-          });
-      // Don't delete the client state if there is still a request in execution.
-      if (PREDICT_FALSE(ongoing_request)) {
-        ++iter;
-        continue;
-      }
-      mem_tracker_->Release(client_state->memory_footprint());
-      iter = clients_.erase(iter);
-    } else {
-      // Client can't be GCed, but its calls might be GCable.
-      iter->second->GCCompletionRecords(
           mem_tracker_,
           [&] (SequenceNumber, CompletionRecord* completion_record) {
             return completion_record->state != RpcState::IN_PROGRESS &&
                 completion_record->last_updated < time_to_gc_responses_from;
           });
-      ++iter;
     }
+    response_queue.pop();
+  }
+
+  // Now go through the clients which may not have been heard from in a while.
+  // GC those and all their completion records (making sure there isn't actually
+  // one in progress first). The ones heard from since are looked at again once
+  // they may have expired.
+  auto& client_queue = shard->client_expiry_queue;
+  vector<ExpiryEntry> to_requeue;
+  while (!client_queue.empty() && client_queue.top().deadline < now) {
+    ExpiryEntry entry = client_queue.top();
+    client_queue.pop();
+    auto iter = shard->clients.find(entry.client_id);
+    if (iter == shard->clients.end()) {
+      continue;
+    }
+    auto& client_state = iter->second;
+    if (client_state->last_heard_from >= time_to_gc_clients_from) {
+      entry.deadline = client_state->last_heard_from +
+          MonoDelta::FromMilliseconds(FLAGS_remember_clients_ttl_ms);
+      to_requeue.emplace_back(std::move(entry));
+      continue;
+    }
+    // Client should be GCed.
+    bool ongoing_request = false;
+    client_state->GCCompletionRecords(
+        mem_tracker_,
+        [&] (SequenceNumber, CompletionRecord* completion_record) {
+          if (PREDICT_FALSE(completion_record->state == RpcState::IN_PROGRESS)) {
+            ongoing_request = true;
+            return false;
+          }
+          return true;
+        });
+    // Don't delete the client state if there is still a request in execution,
+    // try again on the next run.
+    if (PREDICT_FALSE(ongoing_request)) {
+      entry.deadline = now + MonoDelta::FromMilliseconds(FLAGS_result_tracker_gc_interval_ms);
+      to_requeue.emplace_back(std::move(entry));
+      continue;
+    }
+    mem_tracker_->Release(client_state->memory_footprint());
+    shard->clients.erase(iter);
+  }
+  for (auto& entry : to_requeue) {
+    client_queue.push(std::move(entry));
   }
 }
 
 string ResultTracker::ToString() {
-  lock_guard<simple_spinlock> l(lock_);
-  return ToStringUnlocked();
+  string result = Substitute("ResultTracker[this: $0, Num. Shards: $1, Shards:\n",
+                             this, shards_.size());
+  for (auto& shard : shards_) {
+    lock_guard<simple_spinlock> l(shard->lock);
+    result.append(ShardToStringUnlocked(*shard));
+  }
+  result.append("]");
+  return result;
 }
 
-string ResultTracker::ToStringUnlocked() const {
-  string result = Substitute("ResultTracker[this: $0, Num. Client States: $1, Client States:\n",
-                             this, clients_.size());
-  for (auto& cs : clients_) {
+string ResultTracker::ShardToStringUnlocked(const Shard& shard) const {
+  string result = Substitute("Shard[Num. Client States: $0, Client States:\n",
+                             shard.clients.size());
+  for (auto& cs : shard.clients) {
     SubstituteAndAppend(&result, Substitute("\n\tClient: $0, $1", cs.first, cs.second->ToString()));
   }
   result.append("]");
@@ -20,6 +20,7 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <queue>
 #include <string>
 #include <utility>
 #include <vector>
@@ -231,13 +232,13 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
   void StartGCThread();
 
   // Runs time-based garbage collection on the results this result tracker is caching.
-  // When garbage collection runs, it goes through all ClientStates and:
+  // When garbage collection runs, it goes through the expired entries of each shard's
+  // expiry queues, one shard at a time, and:
   // - If a ClientState is older than the 'remember_clients_ttl_ms' flag and no
   //   requests are in progress, GCs the ClientState and all its CompletionRecords.
-  // - If a ClientState is newer than the 'remember_clients_ttl_ms' flag, goes
-  //   through all CompletionRecords and:
-  //   - If the CompletionRecord is older than the 'remember_responses_ttl_secs' flag,
-  //     GCs the CompletionRecord and advances the 'stale_before_seq_no' watermark.
+  // - If a CompletionRecord is older than the 'remember_responses_ttl_ms' flag,
+  //   GCs the CompletionRecord and advances the 'stale_before_seq_no' watermark.
+  // Clients and responses which haven't expired aren't visited.
   //
   // Typically this is invoked from an internal thread started by 'StartGCThread()'.
   void GCResults();
@@ -333,7 +334,49 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
     }
   };
 
-  RpcState TrackRpcUnlocked(const RequestIdPB& request_id,
+  typedef MemTrackerAllocator<std::pair<const std::string,
+                                        std::unique_ptr<ClientState>>> ClientStateMapAllocator;
+  typedef std::map<std::string,
+                   std::unique_ptr<ClientState>,
+                   std::less<std::string>,
+                   ClientStateMapAllocator> ClientStateMap;
+
+  // A client whose state, or whose responses, GCResults() must look at once
+  // 'deadline' has passed. Entries are only hints: a client may have been heard
+  // from, or may be gone, by the time its entry expires.
+  struct ExpiryEntry {
+    MonoTime deadline;
+    std::string client_id;
+
+    bool operator>(const ExpiryEntry& other) const {
+      return deadline > other.deadline;
+    }
+  };
+  typedef std::priority_queue<ExpiryEntry,
+                              std::vector<ExpiryEntry>,
+                              std::greater<ExpiryEntry>> ExpiryQueue;
+
+  // The clients whose ids hash to the same shard, with their own lock, so that
+  // RPCs from different clients don't contend.
+  struct Shard {
+    explicit Shard(const std::shared_ptr<MemTracker>& mem_tracker)
+        : clients(ClientStateMap::key_compare(), ClientStateMapAllocator(mem_tracker)) {}
+
+    // Protects everything below and the state contained in each ClientState.
+    simple_spinlock lock;
+
+    ClientStateMap clients;
+
+    // When each client may be forgotten, and when each response may be GCed.
+    ExpiryQueue client_expiry_queue;
+    ExpiryQueue response_expiry_queue;
+  };
+
+  // Returns the shard which tracks the RPCs of 'client_id'.
+  Shard* FindShard(const std::string& client_id) const;
+
+  RpcState TrackRpcUnlocked(Shard* shard,
+                            const RequestIdPB& request_id,
                             google::protobuf::Message* response,
                             RpcContext* context);
 
@@ -344,10 +387,19 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
   void FailAndRespondInternal(const rpc::RequestIdPB& request_id,
                               const HandleOngoingRpcFunc& func);
 
-  CompletionRecord* FindCompletionRecordOrNullUnlocked(const RequestIdPB& request_id);
-  CompletionRecord* FindCompletionRecordOrDieUnlocked(const RequestIdPB& request_id);
+  CompletionRecord* FindCompletionRecordOrNullUnlocked(Shard* shard,
+                                                       const RequestIdPB& request_id);
+  CompletionRecord* FindCompletionRecordOrDieUnlocked(Shard* shard,
+                                                      const RequestIdPB& request_id);
   std::pair<ClientState*, CompletionRecord*> FindClientStateAndCompletionRecordOrNullUnlocked(
-      const RequestIdPB& request_id);
+      Shard* shard, const RequestIdPB& request_id);
+
+  // Schedules a look at the responses of 'client_id', once the ones updated
+  // now are due to be GCed.
+  static void ScheduleResponsesGCUnlocked(Shard* shard, const std::string& client_id);
+
+  // Runs GCResults() on the entries of 'shard' which expired before 'now'.
+  void GCShard(Shard* shard, MonoTime now);
 
   // A handler must handle an RPC attempt if:
   // 1 - It's its own attempt. I.e. it has the same attempt number of the handler.
@@ -369,26 +421,16 @@ class ResultTracker : public RefCountedThreadSafe<ResultTracker> {
   void LogAndTraceFailure(RpcContext* context, ErrorStatusPB_RpcErrorCodePB err,
                           const Status& status);
 
-  std::string ToStringUnlocked() const;
+  std::string ShardToStringUnlocked(const Shard& shard) const;
 
   void RunGCThread();
 
   // The memory tracker that tracks this ResultTracker's memory consumption.
   std::shared_ptr<kudu::MemTracker> mem_tracker_;
 
-  // Lock that protects access to 'clients_' and to the state contained in each
-  // ClientState.
-  // TODO consider a per-ClientState lock if we find this too coarse grained.
-  simple_spinlock lock_;
-
-  typedef MemTrackerAllocator<std::pair<const std::string,
-                                        std::unique_ptr<ClientState>>> ClientStateMapAllocator;
-  typedef std::map<std::string,
-                   std::unique_ptr<ClientState>,
-                   std::less<std::string>,
-                   ClientStateMapAllocator> ClientStateMap;
-
-  ClientStateMap clients_;
+  // The shards, by hash of the client id. Their number is set by
+  // --result_tracker_num_shards when the tracker is created.
+  std::vector<std::unique_ptr<Shard>> shards_;
 
   // The thread which runs GC, and a latch to stop it.
   scoped_refptr<Thread> gc_thread_;
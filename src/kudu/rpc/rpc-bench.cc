@@ -34,6 +34,7 @@
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/rpc-test-base.h"
 #include "kudu/rpc/rpc_controller.h"
+#include "kudu/rpc/rpc_sidecar.h"
 #include "kudu/rpc/rtest.pb.h"
 #include "kudu/rpc/rtest.proxy.h"
 #include "kudu/util/countdown_latch.h"
@@ -41,6 +42,7 @@
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
@@ -74,6 +76,13 @@ DEFINE_int32(run_seconds, 1, "Seconds to run the test");
 DECLARE_bool(rpc_encrypt_loopback_connections);
 DEFINE_bool(enable_encryption, false, "Whether to enable TLS encryption for rpc-bench");
 
+DEFINE_int32(consensus_update_bytes, 64 * 1024,
+             "For the consensus traffic benchmark, the size of the sidecar of the "
+             "calls standing in for UpdateConsensus calls carrying ops.");
+DEFINE_int32(consensus_heartbeat_percent, 80,
+             "For the consensus traffic benchmark, the percentage of calls which "
+             "stand in for heartbeats, with no payload.");
+
 METRIC_DECLARE_histogram(reactor_load_percent);
 METRIC_DECLARE_histogram(reactor_active_latency_us);
 
@@ -293,6 +302,141 @@ TEST_F(RpcBench, BenchmarkCallsAsync) {
   SummarizePerf(sw.elapsed(), total_reqs, false);
 }
 
+// Reproduces the shape of consensus traffic: a leader's reactors sending a
+// mix of calls carrying batches of ops as sidecars and of tiny heartbeats,
+// with and without TLS. Reports the latencies of both kinds of calls, the
+// payload bytes sent per second and the CPU spent per byte, so that changes
+// to the transport can be weighed against the traffic which matters.
+class ConsensusTrafficBench : public RpcBench,
+                              public ::testing::WithParamInterface<bool> {
+ public:
+  void SetUp() override {
+    FLAGS_enable_encryption = GetParam();
+    RpcBench::SetUp();
+  }
+};
+INSTANTIATE_TEST_CASE_P(Encryption, ConsensusTrafficBench, testing::Values(false, true));
+
+class ConsensusAsyncWorkload {
+ public:
+  ConsensusAsyncWorkload(RpcBench* bench, shared_ptr<Messenger> messenger,
+                         const string* payload, HdrHistogram* update_latency_us,
+                         HdrHistogram* heartbeat_latency_us)
+    : bench_(bench),
+      messenger_(std::move(messenger)),
+      payload_(payload),
+      update_latency_us_(update_latency_us),
+      heartbeat_latency_us_(heartbeat_latency_us),
+      request_count_(0),
+      payload_bytes_(0),
+      is_heartbeat_(false) {
+    controller_.set_timeout(MonoDelta::FromSeconds(10));
+    proxy_.reset(new CalculatorServiceProxy(messenger_, bench_->server_addr_, "localhost"));
+  }
+
+  void CallOneRpc() {
+    if (request_count_ > 0) {
+      CHECK_OK(controller_.status());
+      CHECK_EQ(req_.x() + req_.y(), resp_.result());
+      int64_t latency_us = (MonoTime::Now() - start_time_).ToMicroseconds();
+      (is_heartbeat_ ? heartbeat_latency_us_ : update_latency_us_)->Increment(latency_us);
+    }
+    if (!Acquire_Load(&bench_->should_run_)) {
+      bench_->stop_.CountDown();
+      return;
+    }
+    controller_.Reset();
+    req_.set_x(request_count_);
+    req_.set_y(request_count_);
+    is_heartbeat_ = request_count_ % 100 < FLAGS_consensus_heartbeat_percent;
+    if (!is_heartbeat_) {
+      int idx;
+      CHECK_OK(controller_.AddOutboundSidecar(RpcSidecar::FromSlice(*payload_), &idx));
+      payload_bytes_ += payload_->size();
+    }
+    request_count_++;
+    start_time_ = MonoTime::Now();
+    proxy_->AddAsync(req_,
+                     &resp_,
+                     &controller_,
+                     bind(&ConsensusAsyncWorkload::CallOneRpc, this));
+  }
+
+  RpcBench* bench_;
+  shared_ptr<Messenger> messenger_;
+  unique_ptr<CalculatorServiceProxy> proxy_;
+  const string* payload_;
+  HdrHistogram* update_latency_us_;
+  HdrHistogram* heartbeat_latency_us_;
+  uint32_t request_count_;
+  int64_t payload_bytes_;
+  bool is_heartbeat_;
+  MonoTime start_time_;
+  RpcController controller_;
+  AddRequestPB req_;
+  AddResponsePB resp_;
+};
+
+TEST_P(ConsensusTrafficBench, BenchmarkConsensusTraffic) {
+  int threads = FLAGS_client_threads;
+  int concurrency = FLAGS_async_call_concurrency;
+  const string payload(FLAGS_consensus_update_bytes, 'x');
+  HdrHistogram update_latency_us(60000000LU, 3);
+  HdrHistogram heartbeat_latency_us(60000000LU, 3);
+
+  vector<shared_ptr<Messenger>> messengers;
+  for (int i = 0; i < threads; i++) {
+    shared_ptr<Messenger> m;
+    ASSERT_OK(CreateMessenger("Client", &m, 1, FLAGS_enable_encryption));
+    messengers.emplace_back(std::move(m));
+  }
+
+  vector<unique_ptr<ConsensusAsyncWorkload>> workloads;
+  for (int i = 0; i < concurrency; i++) {
+    workloads.emplace_back(new ConsensusAsyncWorkload(
+        this, messengers[i % threads], &payload, &update_latency_us, &heartbeat_latency_us));
+  }
+
+  stop_.Reset(concurrency);
+
+  Stopwatch sw(Stopwatch::ALL_THREADS);
+  sw.start();
+
+  for (int i = 0; i < concurrency; i++) {
+    workloads[i]->CallOneRpc();
+  }
+
+  SleepFor(MonoDelta::FromSeconds(FLAGS_run_seconds));
+  Release_Store(&should_run_, false);
+
+  sw.stop();
+
+  stop_.Wait();
+  int total_reqs = 0;
+  int64_t total_bytes = 0;
+  for (int i = 0; i < concurrency; i++) {
+    total_reqs += workloads[i]->request_count_;
+    total_bytes += workloads[i]->payload_bytes_;
+  }
+
+  const CpuTimes elapsed = sw.elapsed();
+  SummarizePerf(elapsed, total_reqs, false);
+  LOG(INFO) << "Update bytes:     " << FLAGS_consensus_update_bytes;
+  LOG(INFO) << "Heartbeats:       " << FLAGS_consensus_heartbeat_percent << "%";
+  LOG(INFO) << "Payload MB/sec:   " << total_bytes / elapsed.wall_seconds() / (1024 * 1024);
+  if (total_bytes > 0) {
+    LOG(INFO) << "CPU per KB:       "
+              << (elapsed.user + elapsed.system) / 1000.0 / (total_bytes / 1024.0) << "us";
+  }
+  for (const auto& h : { std::make_pair("Update", &update_latency_us),
+                         std::make_pair("Heartbeat", &heartbeat_latency_us) }) {
+    LOG(INFO) << h.first << " latency p50/p99/p999: "
+              << h.second->ValueAtPercentile(50) << "/"
+              << h.second->ValueAtPercentile(99) << "/"
+              << h.second->ValueAtPercentile(99.9) << "us";
+  }
+}
+
 } // namespace rpc
 } // namespace kudu
 
@@ -459,6 +459,9 @@ class RpcTestBase : public KuduTest {
           MonoDelta::FromMilliseconds(std::min(keepalive_time_ms_ / 5, 100)));
     }
     bld.set_metric_entity(metric_entity_);
+    if (compression_policy_) {
+      bld.set_rpc_compression_policy(compression_policy_);
+    }
     return bld.Build(messenger);
   }
 
@@ -637,6 +640,7 @@ class RpcTestBase : public KuduTest {
     scoped_refptr<MetricEntity> metric_entity = server_messenger_->metric_entity();
     service_pool_ = new ServicePool(std::move(service), metric_entity, service_queue_length_);
     server_messenger_->RegisterService(service_name_, service_pool_);
+    service_pool_->set_numa_nodes(server_messenger_->reactor_numa_nodes());
     RETURN_NOT_OK(service_pool_->Init(n_worker_threads_));
 
     return Status::OK();
@@ -652,6 +656,7 @@ class RpcTestBase : public KuduTest {
   int service_queue_length_;
   int n_server_reactor_threads_;
   int keepalive_time_ms_;
+  RpcCompressionPolicy compression_policy_;
 
   MetricRegistry metric_registry_;
   scoped_refptr<MetricEntity> metric_entity_;
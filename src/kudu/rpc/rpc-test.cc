@@ -60,6 +60,7 @@
 #include "kudu/security/test/test_certs.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/sockaddr.h"
@@ -74,12 +75,24 @@
 
 METRIC_DECLARE_histogram(handler_latency_kudu_rpc_test_CalculatorService_Sleep);
 METRIC_DECLARE_histogram(rpc_incoming_queue_time);
+METRIC_DECLARE_histogram(reactor_active_latency_us);
+METRIC_DECLARE_histogram(rpc_transfers_per_write);
+METRIC_DECLARE_counter(rpc_frame_bytes_uncompressed);
+METRIC_DECLARE_counter(rpc_frame_bytes_compressed);
+METRIC_DECLARE_histogram(rpc_frame_decompression_cpu_time_us);
 
 DECLARE_bool(rpc_reopen_outbound_connections);
 DECLARE_int32(rpc_negotiation_inject_delay_ms);
+DECLARE_int32(rpc_reactor_busy_poll_us);
 DECLARE_bool(authenticate_via_CN);
 DECLARE_string(trusted_CNs);
 DECLARE_bool(use_normal_tls);
+DECLARE_bool(rpc_tls_session_resumption);
+DECLARE_bool(rpc_negotiation_wait_on_reactor);
+DECLARE_bool(rpc_reactor_timer_wheel);
+DECLARE_string(rpc_compression_codec);
+DECLARE_int64(rpc_coalesce_transfers_max_bytes);
+DECLARE_int32(rpc_cork_window_us);
 
 using std::shared_ptr;
 using std::string;
@@ -148,6 +161,35 @@ TEST_F(TestRpc, TestConnHeaderValidation) {
   ASSERT_OK(serialization::ValidateConnHeader(Slice(buf, conn_hdr_len)));
 }
 
+// Test that a message serialized gathered is made up of the same bytes as
+// one serialized in full, with its large fields pointed at rather than copied.
+TEST_F(TestRpc, TestSerializeMessageGathered) {
+  rpc_test::EchoRequestPB req;
+  req.set_data(string(64 * 1024, 'x'));
+  req.ByteSize();
+  for (int additional_size : { 0, 100 }) {
+    faststring full;
+    serialization::SerializeMessage(req, &full, additional_size, true);
+
+    // Only the data field is large enough to be left out of the buffer.
+    faststring buf;
+    vector<Slice> slices;
+    serialization::SerializeMessageGathered(req, 1024, additional_size, &buf, &slices);
+    ASSERT_EQ(2, slices.size());
+    ASSERT_EQ(req.data().data(), reinterpret_cast<const char*>(slices[1].data()));
+    string gathered;
+    for (const Slice& slice : slices) {
+      gathered.append(slice.ToString());
+    }
+    ASSERT_EQ(full.ToString(), gathered);
+
+    // With no field large enough, the buffer holds the whole message.
+    serialization::SerializeMessageGathered(req, 1024 * 1024, additional_size, &buf, &slices);
+    ASSERT_EQ(1, slices.size());
+    ASSERT_EQ(full.ToString(), slices[0].ToString());
+  }
+}
+
 // Regression test for KUDU-2041
 TEST_P(TestRpc, TestNegotiationDeadlock) {
   bool enable_ssl = GetParam();
@@ -459,6 +501,107 @@ TEST_P(TestRpc, TestConnectionKeepalive) {
   ASSERT_EQ(0, metrics.num_client_connections_) << "Client should have 0 client connections";
 }
 
+// Test that proxies with different connection stripes call the same server
+// over connections of their own, and those with the same stripe share one.
+TEST_P(TestRpc, TestConnectionStripes) {
+  n_server_reactor_threads_ = 1;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+
+  vector<unique_ptr<Proxy>> proxies;
+  for (int stripe : { 0, 1, 1, 2 }) {
+    proxies.emplace_back(new Proxy(client_messenger, server_addr, server_addr.host(),
+                                   GenericCalculatorService::static_service_name()));
+    proxies.back()->set_connection_stripe(stripe);
+    ASSERT_OK(DoTestSyncCall(*proxies.back(), GenericCalculatorService::kAddMethodName));
+  }
+
+  ReactorMetrics metrics;
+  ASSERT_OK(client_messenger->reactors_[0]->GetMetrics(&metrics));
+  ASSERT_EQ(3, metrics.num_client_connections_);
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_OK(server_messenger_->reactors_[0]->GetMetrics(&metrics));
+    ASSERT_EQ(3, metrics.num_server_connections_);
+  });
+}
+
+// A connection which is warmed up is negotiated ahead of the first call, which
+// then goes over it.
+TEST_P(TestRpc, TestWarmUpConnection) {
+  n_server_reactor_threads_ = 1;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+
+  Proxy p(client_messenger, server_addr, server_addr.host(),
+          GenericCalculatorService::static_service_name());
+  p.WarmUpConnection();
+  ReactorMetrics metrics;
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_OK(server_messenger_->reactors_[0]->GetMetrics(&metrics));
+    ASSERT_EQ(1, metrics.num_server_connections_);
+  });
+
+  // Warming up a connection that is up does nothing.
+  p.WarmUpConnection();
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  ASSERT_OK(client_messenger->reactors_[0]->GetMetrics(&metrics));
+  ASSERT_EQ(1, metrics.num_client_connections_);
+  ASSERT_EQ(1, metrics.total_client_connections_);
+}
+
+// A client which connects to a server again resumes its TLS session with it.
+TEST_P(TestRpc, TestTlsSessionResumption) {
+  bool enable_ssl = GetParam();
+  if (!enable_ssl) return;
+  FLAGS_rpc_tls_session_resumption = true;
+  Sockaddr server_addr;
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+
+  // Each stripe negotiates a connection of its own.
+  for (int stripe = 0; stripe < 3; stripe++) {
+    Proxy p(client_messenger, server_addr, server_addr.host(),
+            GenericCalculatorService::static_service_name());
+    p.set_connection_stripe(stripe);
+    ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  }
+}
+
+// With the reactors waiting for connections to be ready to negotiate, a client
+// which connects but sends nothing doesn't get in the way of the others, and
+// its connection still times out.
+TEST_P(TestRpc, TestNegotiationWaitOnReactor) {
+  FLAGS_rpc_negotiation_wait_on_reactor = true;
+  n_server_reactor_threads_ = 1;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  Socket idle_sock;
+  ASSERT_OK(idle_sock.Init(0));
+  ASSERT_OK(idle_sock.Connect(server_addr));
+
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(client_messenger, server_addr, server_addr.host(),
+          GenericCalculatorService::static_service_name());
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+
+  ReactorMetrics metrics;
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_OK(server_messenger_->reactors_[0]->GetMetrics(&metrics));
+    ASSERT_EQ(1, metrics.num_server_connections_);
+  });
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+}
+
 // Test that idle connection is kept alive when 'keepalive_time_ms_' is set to -1.
 TEST_P(TestRpc, TestConnectionAlwaysKeepalive) {
   // Only run one reactor per messenger, so we can grab the metrics from that
@@ -851,6 +994,118 @@ TEST_P(TestRpc, TestCallTimeout) {
   ASSERT_NO_FATAL_FAILURE(DoTestExpectTimeout(p, MonoDelta::FromMilliseconds(1500)));
 }
 
+// Like the above, with the call timeouts kept on the reactor's timer wheel.
+TEST_P(TestRpc, TestCallTimeoutOnTimerWheel) {
+  FLAGS_rpc_reactor_timer_wheel = true;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(client_messenger, server_addr, server_addr.host(),
+          GenericCalculatorService::static_service_name());
+
+  ASSERT_NO_FATAL_FAILURE(DoTestExpectTimeout(p, MonoDelta::FromNanoseconds(1)));
+  ASSERT_NO_FATAL_FAILURE(DoTestExpectTimeout(p, MonoDelta::FromMilliseconds(200)));
+  ASSERT_NO_FATAL_FAILURE(DoTestExpectTimeout(p, MonoDelta::FromMilliseconds(1500)));
+}
+
+// Test that with --rpc_compression_codec calls and their responses, sidecars
+// included, are sent compressed, and that a messenger's policy decides which
+// of its connections compress.
+TEST_P(TestRpc, TestCompressedCalls) {
+  FLAGS_rpc_compression_codec = "lz4";
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(client_messenger, server_addr, server_addr.host(),
+          GenericCalculatorService::static_service_name());
+
+  auto counter_value = [&](const CounterPrototype& prototype) {
+    auto metric_map = metric_entity_->UnsafeMetricsMapForTests();
+    return down_cast<Counter*>(FindOrDie(metric_map, &prototype).get())->value();
+  };
+  auto num_decompressed = [&]() {
+    auto metric_map = metric_entity_->UnsafeMetricsMapForTests();
+    auto* metric = FindOrDie(metric_map, &METRIC_rpc_frame_decompression_cpu_time_us).get();
+    return down_cast<Histogram*>(metric)->TotalCount();
+  };
+
+  // The first call goes out before the connection has negotiated compression.
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  ASSERT_EQ(0, counter_value(METRIC_rpc_frame_bytes_uncompressed));
+
+  // The sidecars of both the call and its response are compressed, and come
+  // out intact.
+  ASSERT_OK(DoTestOutgoingSidecar(p, 4096, 100 * 1024));
+  ASSERT_EQ(2, num_decompressed());
+  const int64_t uncompressed_bytes = counter_value(METRIC_rpc_frame_bytes_uncompressed);
+  ASSERT_GT(uncompressed_bytes, 2 * 100 * 1024);
+  ASSERT_LT(counter_value(METRIC_rpc_frame_bytes_compressed), uncompressed_bytes / 10);
+
+  // Small calls, and their responses, aren't compressed.
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  ASSERT_EQ(uncompressed_bytes, counter_value(METRIC_rpc_frame_bytes_uncompressed));
+
+  // A policy which keeps the connections to the server uncompressed.
+  int num_policy_calls = 0;
+  compression_policy_ = [&](const ConnectionId& conn_id) {
+    num_policy_calls++;
+    CHECK_EQ(server_addr.ToString(), conn_id.remote().ToString());
+    return NO_COMPRESSION;
+  };
+  shared_ptr<Messenger> policy_messenger;
+  ASSERT_OK(CreateMessenger("PolicyClient", &policy_messenger, 1, enable_ssl));
+  Proxy policy_proxy(policy_messenger, server_addr, server_addr.host(),
+                     GenericCalculatorService::static_service_name());
+  ASSERT_OK(DoTestSyncCall(policy_proxy, GenericCalculatorService::kAddMethodName));
+  ASSERT_OK(DoTestOutgoingSidecar(policy_proxy, 4096, 100 * 1024));
+  ASSERT_EQ(1, num_policy_calls);
+  ASSERT_EQ(uncompressed_bytes, counter_value(METRIC_rpc_frame_bytes_uncompressed));
+  ASSERT_EQ(2, num_decompressed());
+}
+
+// Test that with a cork window the small calls queued on a connection, and
+// their responses, are written together, and all get through.
+TEST_P(TestRpc, TestCoalescedTransfers) {
+  FLAGS_rpc_coalesce_transfers_max_bytes = 64 * 1024;
+  FLAGS_rpc_cork_window_us = 10000;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(client_messenger, server_addr, server_addr.host(),
+          GenericCalculatorService::static_service_name());
+  ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+
+  const int n_calls = 100;
+  vector<AddRequestPB> reqs(n_calls);
+  vector<AddResponsePB> resps(n_calls);
+  vector<unique_ptr<RpcController>> controllers;
+  CountDownLatch latch(n_calls);
+  for (int i = 0; i < n_calls; i++) {
+    reqs[i].set_x(i);
+    reqs[i].set_y(i);
+    controllers.emplace_back(new RpcController());
+    p.AsyncRequest(GenericCalculatorService::kAddMethodName, reqs[i], &resps[i],
+                   controllers.back().get(),
+                   boost::bind(&CountDownLatch::CountDown, boost::ref(latch)));
+  }
+  latch.Wait();
+  for (int i = 0; i < n_calls; i++) {
+    ASSERT_OK(controllers[i]->status());
+    ASSERT_EQ(2 * i, static_cast<int>(resps[i].result()));
+  }
+
+  auto metric_map = metric_entity_->UnsafeMetricsMapForTests();
+  auto* histogram = down_cast<Histogram*>(
+      FindOrDie(metric_map, &METRIC_rpc_transfers_per_write).get());
+  ASSERT_GT(histogram->MaxValueForTests(), 1U);
+}
+
 // Inject 500ms delay in negotiation, and send a call with a short timeout, followed by
 // one with a long timeout. The call with the long timeout should succeed even though
 // the previous one failed.
@@ -1374,6 +1629,57 @@ TEST_P(TestRpc, TestCancellationMultiThreads) {
   client_messenger->Shutdown();
 }
 
+// Test that calls succeed, and the reactors' load is still measured, when the
+// reactors busy-poll.
+TEST_P(TestRpc, TestCallWithBusyPollingReactors) {
+  FLAGS_rpc_reactor_busy_poll_us = 100;
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(client_messenger, server_addr, server_addr.host(),
+          GenericCalculatorService::static_service_name());
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+  }
+  ASSERT_GT(METRIC_reactor_active_latency_us.Instantiate(metric_entity_)->TotalCount(), 0);
+}
+
+// Test that calls succeed when the server's reactors, and with them its
+// service threads, are pinned to CPUs.
+TEST_F(TestRpc, TestCallWithPinnedReactors) {
+  for (const char* affinity : { "core", "numa_node" }) {
+    SCOPED_TRACE(affinity);
+    MessengerBuilder mb("TestServer");
+    mb.set_num_reactors(4)
+        .set_reactor_cpu_affinity(affinity)
+        .set_metric_entity(metric_entity_);
+    shared_ptr<Messenger> server_messenger;
+    ASSERT_OK(mb.Build(&server_messenger));
+    ASSERT_FALSE(server_messenger->reactor_numa_nodes().empty());
+
+    Sockaddr server_addr;
+    ASSERT_OK(StartTestServerWithCustomMessenger(&server_addr, server_messenger));
+    shared_ptr<Messenger> client_messenger;
+    ASSERT_OK(CreateMessenger("Client", &client_messenger));
+    Proxy p(client_messenger, server_addr, server_addr.host(),
+            GenericCalculatorService::static_service_name());
+    for (int i = 0; i < 10; i++) {
+      ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+    }
+    client_messenger->Shutdown();
+    service_pool_->Shutdown();
+    server_messenger->Shutdown();
+  }
+
+  MessengerBuilder mb("TestServer");
+  mb.set_reactor_cpu_affinity("sometimes");
+  shared_ptr<Messenger> messenger;
+  Status s = mb.Build(&messenger);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+}
+
 TEST_F(TestRpc, TestCallWithNormalTLSOnServerOnly) {
   FLAGS_authenticate_via_CN = true;
   FLAGS_trusted_CNs = "myclient.com";
@@ -22,8 +22,10 @@
 #include <utility>
 
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 #include <google/protobuf/message.h>
 
+#include "kudu/gutil/basictypes.h"
 #include "kudu/rpc/connection.h"
 #include "kudu/rpc/inbound_call.h"
 #include "kudu/rpc/remote_method.h"
@@ -48,8 +50,10 @@ namespace rpc {
 
 RpcContext::RpcContext(InboundCall *call,
                        const google::protobuf::Message *request_pb,
-                       google::protobuf::Message *response_pb)
+                       google::protobuf::Message *response_pb,
+                       std::shared_ptr<google::protobuf::Arena> request_arena)
   : call_(CHECK_NOTNULL(call)),
+    request_arena_(std::move(request_arena)),
     request_pb_(request_pb),
     response_pb_(response_pb) {
   VLOG(4) << call_->remote_method().service_name() << ": Received RPC request for "
@@ -60,6 +64,13 @@ RpcContext::RpcContext(InboundCall *call,
 }
 
 RpcContext::~RpcContext() {
+  if (request_arena_) {
+    // The request belongs to the arena, and so may the response.
+    ignore_result(request_pb_.release());
+    if (response_pb_->GetArena() == request_arena_.get()) {
+      ignore_result(response_pb_.release());
+    }
+  }
 }
 
 void RpcContext::SetResultTracker(scoped_refptr<ResultTracker> result_tracker) {
@@ -76,7 +87,7 @@ void RpcContext::RespondSuccess() {
         << call_->ToString() << ":" << std::endl << SecureDebugString(*response_pb_);
     TRACE_EVENT_ASYNC_END2("rpc_call", "RPC", this,
                            "response", pb_util::PbTracer::TracePb(*response_pb_),
-                           "trace", trace()->DumpToString());
+                           "trace", trace() ? trace()->DumpToString() : string());
     call_->RespondSuccess(*response_pb_);
     delete this;
   }
@@ -91,7 +102,7 @@ void RpcContext::RespondNoCache() {
         << call_->ToString() << ": " << SecureDebugString(*response_pb_);
     TRACE_EVENT_ASYNC_END2("rpc_call", "RPC", this,
                            "response", pb_util::PbTracer::TracePb(*response_pb_),
-                           "trace", trace()->DumpToString());
+                           "trace", trace() ? trace()->DumpToString() : string());
     // This is a bit counter intuitive, but when we get the failure but set the error on the
     // call's response we call RespondSuccess() instead of RespondFailure().
     call_->RespondSuccess(*response_pb_);
@@ -112,7 +123,7 @@ void RpcContext::RespondRpcFailure(ErrorStatusPB_RpcErrorCodePB err, const Statu
         << call_->ToString() << ": " << status.ToString();
     TRACE_EVENT_ASYNC_END2("rpc_call", "RPC", this,
                            "status", status.ToString(),
-                           "trace", trace()->DumpToString());
+                           "trace", trace() ? trace()->DumpToString() : string());
     call_->RespondFailure(err, status);
     delete this;
   }
@@ -133,7 +144,7 @@ void RpcContext::RespondApplicationError(int error_ext_id, const std::string& me
     }
     TRACE_EVENT_ASYNC_END2("rpc_call", "RPC", this,
                            "response", pb_util::PbTracer::TracePb(app_error_pb),
-                           "trace", trace()->DumpToString());
+                           "trace", trace() ? trace()->DumpToString() : string());
     call_->RespondApplicationError(error_ext_id, message, app_error_pb);
     delete this;
   }
@@ -31,6 +31,7 @@
 
 namespace google {
 namespace protobuf {
+class Arena;
 class Message;
 } // namespace protobuf
 } // namespace google
@@ -66,10 +67,12 @@ class RpcSidecar;
 class RpcContext {
  public:
   // Create an RpcContext. This is called only from generated code
-  // and is not a public API.
+  // and is not a public API. If 'request_arena' is set, 'request_pb' was
+  // allocated on it rather than being owned by the context.
   RpcContext(InboundCall *call,
              const google::protobuf::Message *request_pb,
-             google::protobuf::Message *response_pb);
+             google::protobuf::Message *response_pb,
+             std::shared_ptr<google::protobuf::Arena> request_arena = nullptr);
 
   ~RpcContext();
 
@@ -80,7 +83,7 @@ class RpcContext {
   // authorization).
   void SetResultTracker(scoped_refptr<ResultTracker> result_tracker);
 
-  // Return the trace buffer for this call.
+  // Return the trace buffer for this call, or nullptr if it isn't traced.
   Trace* trace();
 
   // Send a response to the call. The service may call this method
@@ -203,6 +206,14 @@ class RpcContext {
   std::string service_name() const;
 
   const google::protobuf::Message *request_pb() const { return request_pb_.get(); }
+
+  // The arena the request was allocated on, if its method sets
+  // RpcMethodInfo::use_request_arena. Holding a reference to it keeps the
+  // request's messages alive after the call completes. The response is on
+  // it too, unless the method's results are tracked.
+  const std::shared_ptr<google::protobuf::Arena>& request_arena() const {
+    return request_arena_;
+  }
   google::protobuf::Message *response_pb() const { return response_pb_.get(); }
 
   // Return an upper bound on the client timeout deadline. This does not
@@ -241,8 +252,9 @@ class RpcContext {
  private:
   friend class ResultTracker;
   InboundCall* const call_;
-  const gscoped_ptr<const google::protobuf::Message> request_pb_;
-  const gscoped_ptr<google::protobuf::Message> response_pb_;
+  const std::shared_ptr<google::protobuf::Arena> request_arena_;
+  gscoped_ptr<const google::protobuf::Message> request_pb_;
+  gscoped_ptr<google::protobuf::Message> response_pb_;
   scoped_refptr<ResultTracker> result_tracker_;
 };
 
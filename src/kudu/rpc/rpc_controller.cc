@@ -63,6 +63,8 @@ void RpcController::Swap(RpcController* other) {
   std::swap(timeout_, other->timeout_);
   std::swap(credentials_policy_, other->credentials_policy_);
   std::swap(call_, other->call_);
+  std::swap(request_gather_min_bytes_, other->request_gather_min_bytes_);
+  std::swap(request_gather_keepalive_, other->request_gather_keepalive_);
 }
 
 void RpcController::Reset() {
@@ -75,6 +77,8 @@ void RpcController::Reset() {
   credentials_policy_ = CredentialsPolicy::ANY_CREDENTIALS;
   messenger_ = nullptr;
   outbound_sidecars_total_bytes_ = 0;
+  request_gather_min_bytes_ = 0;
+  request_gather_keepalive_.reset();
 }
 
 bool RpcController::finished() const {
@@ -167,6 +171,12 @@ void RpcController::SetRequestParam(const google::protobuf::Message& req) {
   call_->SetRequestPayload(req, std::move(outbound_sidecars_));
 }
 
+void RpcController::SetRequestGather(int64_t min_bytes, std::shared_ptr<const void> keepalive) {
+  DCHECK(!call_ || call_->state() == OutboundCall::READY);
+  request_gather_min_bytes_ = min_bytes;
+  request_gather_keepalive_ = std::move(keepalive);
+}
+
 void RpcController::Cancel() {
   DCHECK(call_);
   DCHECK(messenger_);
@@ -225,6 +225,14 @@ class RpcController {
   // exceed TransferLimits::kMaxTotalSidecarBytes.
   Status AddOutboundSidecar(std::unique_ptr<RpcSidecar> car, int* idx);
 
+  // Asks for the next request to be serialized gathered: its string and bytes
+  // fields of at least 'min_bytes', including those of nested messages, are
+  // sent from where they are rather than copied into the serialized request.
+  // The request is sent as the same bytes either way. 'keepalive' must keep
+  // the memory of those fields valid and unmodified, since the request may
+  // still be being sent after the call times out. Cleared by Reset().
+  void SetRequestGather(int64_t min_bytes, std::shared_ptr<const void> keepalive);
+
   // Cancel the call associated with the RpcController. This function should only be
   // called when there is an outstanding outbound call. It's always safe to call
   // Cancel() after you've sent a call, so long as you haven't called Reset() yet.
@@ -274,6 +282,11 @@ class RpcController {
   // of TransferLimits::kMaxTotalSidecarBytes.
   int32_t outbound_sidecars_total_bytes_ = 0;
 
+  // Set by SetRequestGather(). The request is serialized gathered if
+  // 'request_gather_min_bytes_' is positive.
+  int64_t request_gather_min_bytes_ = 0;
+  std::shared_ptr<const void> request_gather_keepalive_;
+
   DISALLOW_COPY_AND_ASSIGN(RpcController);
 };
 
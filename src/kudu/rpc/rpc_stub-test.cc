@@ -43,6 +43,7 @@
 #include "kudu/gutil/stl_util.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/proxy.h"
+#include "kudu/rpc/remote_method.h"
 #include "kudu/rpc/rpc-test-base.h"
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/rpc/rpc_header.pb.h"
@@ -68,6 +69,14 @@
 
 DEFINE_bool(is_panic_test_child, false, "Used by TestRpcPanic");
 DECLARE_bool(socket_inject_short_recvs);
+DECLARE_int32(rpc_num_high_priority_service_threads);
+DECLARE_int64(rpc_max_outbound_queue_bytes);
+DECLARE_int32(rpc_reactor_handler_budget_us);
+DECLARE_int32(rpc_trace_sample_every_n_calls);
+
+METRIC_DECLARE_counter(rpc_outbound_queue_full);
+METRIC_DECLARE_counter(rpcs_handled_on_reactor);
+METRIC_DECLARE_counter(rpcs_over_reactor_budget);
 
 using kudu::pb_util::SecureDebugString;
 using std::shared_ptr;
@@ -157,6 +166,42 @@ TEST_F(RpcStubTest, TestBigCallData) {
   }
 }
 
+// Test that calls are failed with ServiceUnavailable rather than queued on a
+// connection which already has too many bytes waiting to be sent.
+TEST_F(RpcStubTest, TestOutboundQueueLimit) {
+  const int kNumSentAtOnce = 10;
+  CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
+  // Connect first, so that the calls queue behind each other being sent.
+  NO_FATALS(SendSimpleCall());
+  FLAGS_rpc_max_outbound_queue_bytes = 1;
+
+  EchoRequestPB req;
+  req.set_data(string(10 * 1024 * 1024, 'x'));
+  vector<unique_ptr<EchoResponsePB>> resps;
+  vector<unique_ptr<RpcController>> controllers;
+  CountDownLatch latch(kNumSentAtOnce);
+  for (int i = 0; i < kNumSentAtOnce; i++) {
+    resps.emplace_back(new EchoResponsePB);
+    controllers.emplace_back(new RpcController);
+    p.EchoAsync(req, resps.back().get(), controllers.back().get(),
+                boost::bind(&CountDownLatch::CountDown, boost::ref(latch)));
+  }
+  latch.Wait();
+
+  int num_rejected = 0;
+  for (const auto& c : controllers) {
+    if (c->status().IsServiceUnavailable()) {
+      ASSERT_STR_CONTAINS(c->status().ToString(), "outbound queue is full");
+      num_rejected++;
+    } else {
+      ASSERT_OK(c->status());
+    }
+  }
+  ASSERT_GT(num_rejected, 0);
+  ASSERT_LT(num_rejected, kNumSentAtOnce);
+  ASSERT_EQ(num_rejected, METRIC_rpc_outbound_queue_full.Instantiate(metric_entity_)->value());
+}
+
 TEST_F(RpcStubTest, TestRespondDeferred) {
   CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
 
@@ -168,6 +213,88 @@ TEST_F(RpcStubTest, TestRespondDeferred) {
   ASSERT_OK(p.Sleep(req, &resp, &controller));
 }
 
+// Test that the calls of methods with the run_on_reactor option are handled on
+// the reactor thread, until one of them overruns its budget.
+TEST_F(RpcStubTest, TestHandleOnReactor) {
+  CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
+  scoped_refptr<Counter> handled = METRIC_rpcs_handled_on_reactor.Instantiate(metric_entity_);
+  scoped_refptr<Counter> overruns = METRIC_rpcs_over_reactor_budget.Instantiate(metric_entity_);
+
+  // Calls are queued for service threads unless there's a budget.
+  {
+    RpcController controller;
+    EchoRequestPB req;
+    req.set_data("hello");
+    EchoResponsePB resp;
+    ASSERT_OK(p.Echo(req, &resp, &controller));
+    ASSERT_EQ(0, handled->value());
+  }
+
+  FLAGS_rpc_reactor_handler_budget_us = 100000;
+  {
+    RpcController controller;
+    EchoRequestPB req;
+    req.set_data("hello");
+    EchoResponsePB resp;
+    ASSERT_OK(p.Echo(req, &resp, &controller));
+    ASSERT_EQ("hello", resp.data());
+    ASSERT_EQ(1, handled->value());
+  }
+
+  // A call over the budget is still handled on the reactor, but the method's
+  // next calls go to service threads.
+  for (int i = 0; i < 2; i++) {
+    RpcController controller;
+    SleepRequestPB req;
+    req.set_sleep_micros(200000);
+    SleepResponsePB resp;
+    ASSERT_OK(p.Sleep(req, &resp, &controller));
+    ASSERT_EQ(2, handled->value());
+    ASSERT_EQ(1, overruns->value());
+  }
+}
+
+class RpcStubHighPriorityTest : public RpcStubTest {
+ public:
+  void SetUp() override {
+    FLAGS_rpc_num_high_priority_service_threads = 1;
+    RpcStubTest::SetUp();
+  }
+};
+
+// Test that the calls of HIGH_PRIORITY methods are handled by service threads
+// of their own while all the others are busy.
+TEST_F(RpcStubHighPriorityTest, TestHighPriorityLane) {
+  CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
+
+  // Tie up all the normal service threads.
+  CountDownLatch latch(n_worker_threads_);
+  vector<unique_ptr<SleepResponsePB>> resps;
+  vector<unique_ptr<RpcController>> controllers;
+  SleepRequestPB sleep_req;
+  sleep_req.set_sleep_micros(2000000);
+  for (int i = 0; i < n_worker_threads_; i++) {
+    resps.emplace_back(new SleepResponsePB);
+    controllers.emplace_back(new RpcController);
+    controllers.back()->set_timeout(MonoDelta::FromSeconds(10));
+    p.SleepAsync(sleep_req, resps.back().get(), controllers.back().get(),
+                 boost::bind(&CountDownLatch::CountDown, boost::ref(latch)));
+  }
+  SleepFor(MonoDelta::FromMilliseconds(100));
+
+  RpcController controller;
+  controller.set_timeout(MonoDelta::FromSeconds(1));
+  WhoAmIRequestPB req;
+  WhoAmIResponsePB resp;
+  ASSERT_OK(p.WhoAmI(req, &resp, &controller));
+  ASSERT_EQ(1, service_pool_->HighPriorityIncomingQueueTimeMetricForTests()->TotalCount());
+
+  latch.Wait();
+  for (const auto& c : controllers) {
+    ASSERT_OK(c->status());
+  }
+}
+
 // Test that the default user credentials are propagated to the server.
 TEST_F(RpcStubTest, TestDefaultCredentialsPropagated) {
   CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
@@ -367,6 +494,19 @@ TEST_F(RpcStubTest, TestCallMissingMethod) {
   ASSERT_STR_CONTAINS(s.ToString(), "with an invalid method name: DoesNotExist");
 }
 
+// Test that the generated service finds each of its methods through its
+// perfect hash of their names, and nothing else.
+TEST_F(RpcStubTest, TestLookupMethod) {
+  CalculatorService service(metric_entity_, result_tracker_);
+  ASSERT_FALSE(service.methods_by_name().empty());
+  for (const auto& entry : service.methods_by_name()) {
+    RemoteMethod method(CalculatorService::static_service_name(), entry.first);
+    ASSERT_EQ(entry.second.get(), service.LookupMethod(method)) << entry.first;
+  }
+  RemoteMethod missing(CalculatorService::static_service_name(), "DoesNotExist");
+  ASSERT_EQ(nullptr, service.LookupMethod(missing));
+}
+
 TEST_F(RpcStubTest, TestApplicationError) {
   CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
 
@@ -671,6 +811,27 @@ TEST_F(RpcStubTest, TestDumpSampledCalls) {
   ASSERT_STR_CONTAINS(SecureDebugString(sampled_rpcs), "duration_ms");
 }
 
+// Calls which aren't sampled for tracing when they arrive are handled as usual,
+// but never make it into the sampled calls.
+TEST_F(RpcStubTest, TestUntracedCallsAreNotSampled) {
+  FLAGS_rpc_trace_sample_every_n_calls = 1000000;
+  CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
+
+  for (int i = 0; i < 10; i++) {
+    RpcController controller;
+    SleepRequestPB req;
+    req.set_sleep_micros(1000);
+    SleepResponsePB resp;
+    ASSERT_OK(p.Sleep(req, &resp, &controller));
+  }
+
+  DumpRpczStoreResponsePB sampled_rpcs;
+  server_messenger_->rpcz_store()->DumpPB(DumpRpczStoreRequestPB(), &sampled_rpcs);
+  for (const auto& method : sampled_rpcs.methods()) {
+    ASSERT_EQ(0, method.samples_size()) << SecureDebugString(sampled_rpcs);
+  }
+}
+
 namespace {
 struct RefCountedTest : public RefCountedThreadSafe<RefCountedTest> {
 };
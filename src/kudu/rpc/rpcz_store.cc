@@ -143,6 +143,9 @@ MethodSampler* RpczStore::SamplerForCall(InboundCall* call) {
 }
 
 void MethodSampler::SampleCall(InboundCall* call) {
+  // Only the calls which were traced are worth keeping as samples.
+  if (!call->trace()) return;
+
   // First determine which sample bucket to put this in.
   int duration_ms = call->timing().TotalDuration().ToMilliseconds();
 
@@ -254,14 +257,18 @@ void RpczStore::LogTrace(InboundCall* call) {
                    << "(" << HumanReadableElapsedTime::ToShortString(duration_ms * .001) << "). "
                    << "Client timeout " << timeout_ms << " ms "
                    << "(" << HumanReadableElapsedTime::ToShortString(timeout_ms * .001) << ")";
-      string s = call->trace()->DumpToString();
-      if (!s.empty()) {
-        LOG(WARNING) << "Trace:\n" << s;
+      if (call->trace()) {
+        string s = call->trace()->DumpToString();
+        if (!s.empty()) {
+          LOG(WARNING) << "Trace:\n" << s;
+        }
       }
       return;
     }
   }
 
+  if (!call->trace()) return;
+
   if (PREDICT_FALSE(FLAGS_rpc_dump_all_traces)) {
     LOG(INFO) << call->ToString() << " took " << duration_ms << "ms. Trace:";
     call->trace()->Dump(&LOG(INFO), true);
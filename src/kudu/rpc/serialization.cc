@@ -17,30 +17,50 @@
 
 #include "kudu/rpc/serialization.h"
 
+#include <algorithm>
 #include <limits>
 #include <ostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
 #include <google/protobuf/message_lite.h>
 #include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <google/protobuf/wire_format.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "kudu/gutil/endian.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stringprintf.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/constants.h"
+#include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
+#include "kudu/util/stopwatch.h"
 
 DECLARE_int64(rpc_max_message_size);
 
+using google::protobuf::FieldDescriptor;
+using google::protobuf::Message;
 using google::protobuf::MessageLite;
+using google::protobuf::Reflection;
+using google::protobuf::internal::WireFormat;
+using google::protobuf::internal::WireFormatLite;
 using google::protobuf::io::CodedInputStream;
 using google::protobuf::io::CodedOutputStream;
+using google::protobuf::io::ZeroCopyOutputStream;
+using std::pair;
+using std::string;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -53,17 +73,20 @@ enum {
   kHeaderPosAuthProto = 2
 };
 
-void SerializeMessage(const MessageLite& message, faststring* param_buf,
-                        int additional_size, bool use_cached_size) {
+namespace {
+
+// Computes the size prefix with which 'message', followed by 'additional_size'
+// bytes, is serialized, and the size of the serialized message including that
+// prefix.
+void ComputeMessageSizes(const MessageLite& message, int pb_size, int additional_size,
+                         int64_t* recorded_size, int64_t* size_with_delim) {
   DCHECK_GE(additional_size, 0);
-  int pb_size = use_cached_size ? message.GetCachedSize() : message.ByteSize();
-  DCHECK_EQ(message.ByteSize(), pb_size);
   // Use 8-byte integers to avoid overflowing when additional_size approaches INT_MAX.
-  int64_t recorded_size = static_cast<int64_t>(pb_size) +
+  *recorded_size = static_cast<int64_t>(pb_size) +
       static_cast<int64_t>(additional_size);
-  int64_t size_with_delim = static_cast<int64_t>(pb_size) +
-      static_cast<int64_t>(CodedOutputStream::VarintSize32(recorded_size));
-  int64_t total_size = size_with_delim + static_cast<int64_t>(additional_size);
+  *size_with_delim = static_cast<int64_t>(pb_size) +
+      static_cast<int64_t>(CodedOutputStream::VarintSize32(*recorded_size));
+  int64_t total_size = *size_with_delim + static_cast<int64_t>(additional_size);
   // The message format relies on an unsigned 32-bit integer to express the size, so
   // the message must not exceed this size. Since additional_size is limited to INT_MAX,
   // this is a safe limitation.
@@ -75,6 +98,115 @@ void SerializeMessage(const MessageLite& message, faststring* param_buf,
                                "Sending anyway, but peer may reject the data.",
                                message.GetTypeName(), total_size, FLAGS_rpc_max_message_size);
   }
+}
+
+// The least that FaststringOutputStream grows its buffer by.
+const size_t kMinGrowth = 1024;
+
+// An output stream which appends to a faststring.
+class FaststringOutputStream : public ZeroCopyOutputStream {
+ public:
+  explicit FaststringOutputStream(faststring* buf) : buf_(buf) {}
+
+  bool Next(void** data, int* size) override {
+    const size_t old_size = buf_->size();
+    buf_->resize(std::max<size_t>(old_size * 2, kMinGrowth));
+    *data = buf_->data() + old_size;
+    *size = buf_->size() - old_size;
+    return true;
+  }
+
+  void BackUp(int count) override {
+    DCHECK_LE(static_cast<size_t>(count), buf_->size());
+    buf_->resize(buf_->size() - count);
+  }
+
+  int64_t ByteCount() const override {
+    return buf_->size();
+  }
+
+ private:
+  faststring* buf_;
+};
+
+// Serializes 'message' to 'out' using its cached sizes, except for the string
+// and bytes fields of at least 'min_external_bytes', for which only the tag
+// and length are written. The offset in the stream at which each of those
+// fields belongs is appended to 'external', along with a slice of the field.
+void SerializeFieldsGathered(const Message& message, int64_t min_external_bytes,
+                             CodedOutputStream* out,
+                             vector<pair<int64_t, Slice>>* external) {
+  if (message.GetDescriptor()->options().message_set_wire_format()) {
+    message.SerializeWithCachedSizes(out);
+    return;
+  }
+  const Reflection* reflection = message.GetReflection();
+  vector<const FieldDescriptor*> fields;
+  reflection->ListFields(message, &fields);
+  for (const FieldDescriptor* field : fields) {
+    if (field->is_map()) {
+      WireFormat::SerializeFieldWithCachedSizes(field, message, out);
+      continue;
+    }
+    const uint32_t tag = WireFormatLite::MakeTag(field->number(),
+                                                 WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+    switch (field->type()) {
+      case FieldDescriptor::TYPE_STRING:
+      case FieldDescriptor::TYPE_BYTES: {
+        if (field->is_repeated()) {
+          break;
+        }
+        string scratch;
+        const string& value = reflection->GetStringReference(message, field, &scratch);
+        // A field which isn't stored as a string can't be pointed at.
+        if (&value == &scratch || static_cast<int64_t>(value.size()) < min_external_bytes) {
+          break;
+        }
+        out->WriteTag(tag);
+        out->WriteVarint32(value.size());
+        external->emplace_back(out->ByteCount(), Slice(value));
+        continue;
+      }
+      case FieldDescriptor::TYPE_MESSAGE: {
+        // Only messages with fields large enough to leave out are worth
+        // walking through.
+        auto serialize_sub_message = [&](const Message& sub_message) {
+          const int size = sub_message.GetCachedSize();
+          out->WriteTag(tag);
+          out->WriteVarint32(size);
+          if (size < min_external_bytes) {
+            sub_message.SerializeWithCachedSizes(out);
+          } else {
+            SerializeFieldsGathered(sub_message, min_external_bytes, out, external);
+          }
+        };
+        if (field->is_repeated()) {
+          const int n = reflection->FieldSize(message, field);
+          for (int i = 0; i < n; i++) {
+            serialize_sub_message(reflection->GetRepeatedMessage(message, field, i));
+          }
+        } else {
+          serialize_sub_message(reflection->GetMessage(message, field));
+        }
+        continue;
+      }
+      default:
+        break;
+    }
+    WireFormat::SerializeFieldWithCachedSizes(field, message, out);
+  }
+  WireFormat::SerializeUnknownFields(reflection->GetUnknownFields(message), out);
+}
+
+} // anonymous namespace
+
+void SerializeMessage(const MessageLite& message, faststring* param_buf,
+                        int additional_size, bool use_cached_size) {
+  int pb_size = use_cached_size ? message.GetCachedSize() : message.ByteSize();
+  DCHECK_EQ(message.ByteSize(), pb_size);
+  int64_t recorded_size;
+  int64_t size_with_delim;
+  ComputeMessageSizes(message, pb_size, additional_size, &recorded_size, &size_with_delim);
 
   param_buf->resize(size_with_delim);
   uint8_t* dst = param_buf->data();
@@ -83,6 +215,44 @@ void SerializeMessage(const MessageLite& message, faststring* param_buf,
   CHECK_EQ(dst, param_buf->data() + size_with_delim);
 }
 
+void SerializeMessageGathered(const Message& message, int64_t min_external_bytes,
+                              int additional_size, faststring* param_buf,
+                              vector<Slice>* slices) {
+  DCHECK_GT(min_external_bytes, 0);
+  int pb_size = message.GetCachedSize();
+  DCHECK_EQ(message.ByteSize(), pb_size);
+  int64_t recorded_size;
+  int64_t size_with_delim;
+  ComputeMessageSizes(message, pb_size, additional_size, &recorded_size, &size_with_delim);
+
+  param_buf->clear();
+  vector<pair<int64_t, Slice>> external;
+  {
+    FaststringOutputStream stream(param_buf);
+    CodedOutputStream out(&stream);
+    out.WriteVarint32(recorded_size);
+    SerializeFieldsGathered(message, min_external_bytes, &out, &external);
+    CHECK(!out.HadError());
+  }
+
+  // Interleave the fields left out with the pieces of 'param_buf' between them.
+  slices->clear();
+  int64_t offset = 0;
+  int64_t total_size = param_buf->size();
+  for (const auto& e : external) {
+    if (e.first > offset) {
+      slices->emplace_back(param_buf->data() + offset, e.first - offset);
+    }
+    slices->emplace_back(e.second);
+    offset = e.first;
+    total_size += e.second.size();
+  }
+  if (offset < static_cast<int64_t>(param_buf->size())) {
+    slices->emplace_back(param_buf->data() + offset, param_buf->size() - offset);
+  }
+  CHECK_EQ(total_size, size_with_delim);
+}
+
 void SerializeHeader(const MessageLite& header,
                      size_t param_len,
                      faststring* header_buf) {
@@ -181,6 +351,74 @@ Status ParseMessage(const Slice& buf,
   return Status::OK();
 }
 
+namespace {
+
+MonoDelta CpuTime(const Stopwatch& sw) {
+  const CpuTimes t = sw.elapsed();
+  return MonoDelta::FromNanoseconds(t.user + t.system);
+}
+
+} // anonymous namespace
+
+Status CompressFrame(const CompressionCodec& codec,
+                     const vector<Slice>& frame,
+                     faststring* body_buf,
+                     MonoDelta* cpu_time) {
+  Stopwatch sw;
+  sw.start();
+  size_t frame_size = 0;
+  for (const Slice& s : frame) {
+    frame_size += s.size();
+  }
+  const size_t max_len = codec.MaxCompressedLength(frame_size);
+  const size_t max_prefix_len = CodedOutputStream::VarintSize32(max_len);
+  body_buf->resize(max_prefix_len + max_len);
+  size_t compressed_len;
+  RETURN_NOT_OK(codec.Compress(frame, body_buf->data() + max_prefix_len, &compressed_len));
+
+  // Now that the length is known, move the prefix up against the compressed
+  // bytes, rather than moving them.
+  const size_t prefix_len = CodedOutputStream::VarintSize32(compressed_len);
+  uint8_t* start = body_buf->data() + max_prefix_len - prefix_len;
+  CodedOutputStream::WriteVarint32ToArray(compressed_len, start);
+  if (start != body_buf->data()) {
+    memmove(body_buf->data(), start, prefix_len + compressed_len);
+  }
+  body_buf->resize(prefix_len + compressed_len);
+  sw.stop();
+  if (cpu_time) {
+    *cpu_time = CpuTime(sw);
+  }
+  return Status::OK();
+}
+
+Status UncompressFrame(const CompressionCodec& codec,
+                       const Slice& body,
+                       uint32_t uncompressed_size,
+                       faststring* frame,
+                       MonoDelta* cpu_time) {
+  if (PREDICT_FALSE(uncompressed_size < kMsgLengthPrefixLength ||
+                    uncompressed_size > FLAGS_rpc_max_message_size)) {
+    return Status::Corruption(Substitute(
+        "Invalid packet: compressed frame of $0 bytes, expected at most $1",
+        uncompressed_size, FLAGS_rpc_max_message_size));
+  }
+  Stopwatch sw;
+  sw.start();
+  frame->resize(uncompressed_size);
+  RETURN_NOT_OK_PREPEND(codec.Uncompress(body, frame->data(), uncompressed_size),
+                        "Invalid packet: unable to uncompress frame");
+  if (PREDICT_FALSE(NetworkByteOrder::Load32(frame->data()) !=
+                    uncompressed_size - kMsgLengthPrefixLength)) {
+    return Status::Corruption("Invalid packet: compressed frame has a bad length prefix");
+  }
+  sw.stop();
+  if (cpu_time) {
+    *cpu_time = CpuTime(sw);
+  }
+  return Status::OK();
+}
+
 void SerializeConnHeader(uint8_t* buf) {
   memcpy(reinterpret_cast<char *>(buf), kMagicNumber, kMagicNumberLength);
   buf += kMagicNumberLength;
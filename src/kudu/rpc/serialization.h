@@ -20,15 +20,19 @@
 
 #include <cstdint>
 #include <cstring>
+#include <vector>
 
 namespace google {
 namespace protobuf {
+class Message;
 class MessageLite;
 } // namespace protobuf
 } // namespace google
 
 namespace kudu {
 
+class CompressionCodec;
+class MonoDelta;
 class Status;
 class faststring;
 class Slice;
@@ -55,6 +59,16 @@ void SerializeMessage(const google::protobuf::MessageLite& message,
                       faststring* param_buf, int additional_size = 0,
                       bool use_cached_size = false);
 
+// Like SerializeMessage() with 'use_cached_size', except that the string and
+// bytes fields of at least 'min_external_bytes', including those of nested
+// messages, aren't copied into 'param_buf'. Instead, 'slices' is filled with
+// slices which, concatenated, form the serialized message: pieces of
+// 'param_buf' interleaved with slices pointing at those fields. So the message
+// must not be mutated or destroyed until the slices have been sent.
+void SerializeMessageGathered(const google::protobuf::Message& message,
+                              int64_t min_external_bytes, int additional_size,
+                              faststring* param_buf, std::vector<Slice>* slices);
+
 // Serialize the request or response header into a buffer which is allocated
 // by this function.
 // Includes leading 32-bit length of the buffer.
@@ -74,6 +88,26 @@ Status ParseMessage(const Slice& buf,
                     google::protobuf::MessageLite* parsed_header,
                     Slice* parsed_main_message);
 
+// Compresses the frame made up of 'frame', from its length prefix on, with
+// 'codec', into 'body_buf' as the varint-prefixed main message of a frame
+// which carries it, whose header is to mark it with 'frame_compression'.
+// The CPU time it took is stored in 'cpu_time', if not null.
+Status CompressFrame(const CompressionCodec& codec,
+                     const std::vector<Slice>& frame,
+                     faststring* body_buf,
+                     MonoDelta* cpu_time = nullptr);
+
+// Uncompresses the body of a frame marked with 'frame_compression', as
+// returned by ParseMessage(), into the frame of 'uncompressed_size' bytes
+// which the body holds. Returns Corruption if it doesn't hold one, or if
+// the frame is larger than --rpc_max_message_size.
+// The CPU time it took is stored in 'cpu_time', if not null.
+Status UncompressFrame(const CompressionCodec& codec,
+                       const Slice& body,
+                       uint32_t uncompressed_size,
+                       faststring* frame,
+                       MonoDelta* cpu_time = nullptr);
+
 // Serialize the RPC connection header (magic number + flags).
 // buf must have 7 bytes available (kMagicNumberLength + kHeaderFlagsLength).
 void SerializeConnHeader(uint8_t* buf);
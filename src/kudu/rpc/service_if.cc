@@ -17,24 +17,32 @@
 
 #include "kudu/rpc/service_if.h"
 
+#include <cstddef>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 
+#include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/port.h"
+#include "kudu/gutil/singleton.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/connection.h"
 #include "kudu/rpc/inbound_call.h"
+#include "kudu/rpc/method_hash.h"
 #include "kudu/rpc/remote_method.h"
 #include "kudu/rpc/result_tracker.h"
 #include "kudu/rpc/rpc_context.h"
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/net/socket.h"
 #include "kudu/util/slice.h"
@@ -46,6 +54,21 @@
 DEFINE_bool(enable_exactly_once, true, "Whether to enable exactly once semantics.");
 TAG_FLAG(enable_exactly_once, hidden);
 
+DEFINE_int32(rpc_request_arena_pool_size, 0,
+             "How many protobuf arenas to keep for reuse by the calls of methods "
+             "whose requests are allocated on an arena, along with the first block "
+             "of each, so that such a call whose request and response fit in the "
+             "block doesn't allocate them from the heap. 0 creates an arena for "
+             "each call.");
+TAG_FLAG(rpc_request_arena_pool_size, experimental);
+
+DEFINE_int32(rpc_request_arena_block_bytes, 64 * 1024,
+             "Size of the first block of each of the arenas kept by "
+             "--rpc_request_arena_pool_size.");
+TAG_FLAG(rpc_request_arena_block_bytes, experimental);
+
+using google::protobuf::Arena;
+using google::protobuf::ArenaOptions;
 using google::protobuf::Message;
 using std::string;
 using std::unique_ptr;
@@ -54,6 +77,74 @@ using strings::Substitute;
 namespace kudu {
 namespace rpc {
 
+namespace {
+
+// Arenas for the requests of calls, which are reset and kept for the next
+// calls once the last reference to them is dropped, rather than freed.
+class RequestArenaPool {
+ public:
+  static RequestArenaPool* GetSingleton() {
+    return Singleton<RequestArenaPool>::get();
+  }
+
+  std::shared_ptr<Arena> Get() {
+    if (FLAGS_rpc_request_arena_pool_size <= 0) {
+      return std::make_shared<Arena>();
+    }
+    PooledArena* pooled = nullptr;
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      if (!free_.empty()) {
+        pooled = free_.back();
+        free_.pop_back();
+      }
+    }
+    if (!pooled) {
+      pooled = new PooledArena(FLAGS_rpc_request_arena_block_bytes);
+    }
+    return std::shared_ptr<Arena>(&pooled->arena, [this, pooled](Arena* /* arena */) {
+      Return(pooled);
+    });
+  }
+
+ private:
+  // An arena whose first block is its own, which outlives resets of the arena.
+  struct PooledArena {
+    explicit PooledArena(size_t block_bytes)
+        : block(new char[block_bytes]),
+          arena(Options(block.get(), block_bytes)) {
+    }
+
+    static ArenaOptions Options(char* block, size_t block_bytes) {
+      ArenaOptions opts;
+      opts.initial_block = block;
+      opts.initial_block_size = block_bytes;
+      return opts;
+    }
+
+    const unique_ptr<char[]> block;
+    Arena arena;
+  };
+
+  void Return(PooledArena* pooled) {
+    // Destroys what's on the arena and frees its blocks, but the first.
+    pooled->arena.Reset();
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      if (free_.size() < static_cast<size_t>(FLAGS_rpc_request_arena_pool_size)) {
+        free_.push_back(pooled);
+        return;
+      }
+    }
+    delete pooled;
+  }
+
+  simple_spinlock lock_;
+  std::vector<PooledArena*> free_;
+};
+
+} // anonymous namespace
+
 ServiceIf::~ServiceIf() {
 }
 
@@ -104,13 +195,28 @@ void GeneratedServiceIf::Handle(InboundCall *call) {
     RespondBadMethod(call);
     return;
   }
-  unique_ptr<Message> req(method_info->req_prototype->New());
-  if (PREDICT_FALSE(!ParseParam(call, req.get()))) {
+  // Requests allocated on an arena belong to it rather than to 'req_owner'.
+  std::shared_ptr<Arena> arena;
+  unique_ptr<Message> req_owner;
+  Message* req;
+  if (method_info->use_request_arena) {
+    arena = RequestArenaPool::GetSingleton()->Get();
+    req = method_info->req_prototype->New(arena.get());
+  } else {
+    req_owner.reset(method_info->req_prototype->New());
+    req = req_owner.get();
+  }
+  if (PREDICT_FALSE(!ParseParam(call, req))) {
     return;
   }
-  Message* resp = method_info->resp_prototype->New();
+  // The response goes on the arena too, unless the result tracker may keep
+  // it for retries of the call.
+  Message* resp = arena && !method_info->track_result ?
+      method_info->resp_prototype->New(arena.get()) :
+      method_info->resp_prototype->New();
 
-  RpcContext* ctx = new RpcContext(call, req.release(), resp);
+  ignore_result(req_owner.release());
+  RpcContext* ctx = new RpcContext(call, req, resp, std::move(arena));
   if (!method_info->authz_method(ctx->request_pb(), resp, ctx)) {
     // The authz_method itself should have responded to the RPC.
     return;
@@ -142,6 +248,14 @@ void GeneratedServiceIf::Handle(InboundCall *call) {
 
 RpcMethodInfo* GeneratedServiceIf::LookupMethod(const RemoteMethod& method) {
   DCHECK_EQ(method.service_name(), service_name());
+  if (PREDICT_TRUE(!methods_by_slot_.empty())) {
+    const string& name = method.method_name();
+    // No other method hashes to the slot, so if the method isn't there, the
+    // service doesn't have it.
+    const auto& slot = methods_by_slot_[MethodNameSlot(
+        name.data(), name.size(), method_slot_seed_, methods_by_slot_.size())];
+    return PREDICT_TRUE(slot.second && slot.first == name) ? slot.second : nullptr;
+  }
   const auto& it = methods_by_name_.find(method.method_name());
   if (PREDICT_FALSE(it == methods_by_name_.end())) {
     return nullptr;
@@ -149,6 +263,14 @@ RpcMethodInfo* GeneratedServiceIf::LookupMethod(const RemoteMethod& method) {
   return it->second.get();
 }
 
+bool GeneratedServiceIf::HasHighPriorityMethods() const {
+  for (const auto& entry : methods_by_name_) {
+    if (entry.second->priority_class == HIGH_PRIORITY) {
+      return true;
+    }
+  }
+  return false;
+}
 
 } // namespace rpc
 } // namespace kudu
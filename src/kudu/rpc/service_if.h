@@ -17,15 +17,19 @@
 #ifndef KUDU_RPC_SERVICE_IF_H
 #define KUDU_RPC_SERVICE_IF_H
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <google/protobuf/message.h>
 
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/util/metrics.h"
 
 namespace kudu {
@@ -52,6 +56,23 @@ struct RpcMethodInfo : public RefCountedThreadSafe<RpcMethodInfo> {
   // Whether we should track this method's result, using ResultTracker.
   bool track_result;
 
+  // Whether calls may be handled on the reactor thread which received them,
+  // as set by the method's 'run_on_reactor' option.
+  bool run_on_reactor = false;
+
+  // The GetMonoTimeMicros() until which calls are queued for service threads
+  // anyway, because a call handled on a reactor thread overran its budget.
+  std::atomic<int64_t> reactor_suspended_until_us{0};
+
+  // The class of priority of the method's calls, as set by the method's
+  // 'priority_class' option.
+  RpcPriorityClass priority_class = NORMAL_PRIORITY;
+
+  // Whether requests are allocated on a protobuf arena, which the handler may
+  // keep alive past the call (see RpcContext::request_arena()) to take over
+  // parts of the request without copying them out of it.
+  bool use_request_arena = false;
+
   // The authorization function for this RPC. If this function
   // returns false, the RPC has already been handled (i.e. rejected)
   // by the authorization function.
@@ -77,6 +98,10 @@ class ServiceIf {
   // specific feature flag.
   virtual bool SupportsFeature(uint32_t feature) const;
 
+  // Whether any of the service's methods has the 'priority_class' option set
+  // to HIGH_PRIORITY.
+  virtual bool HasHighPriorityMethods() const { return false; }
+
   // Look up the method being requested by the remote call.
   //
   // If this returns nullptr, then certain functionality like
@@ -114,6 +139,8 @@ class GeneratedServiceIf : public ServiceIf {
 
   RpcMethodInfo* LookupMethod(const RemoteMethod& method) override;
 
+  bool HasHighPriorityMethods() const override;
+
   // Returns the mapping from method names to method infos.
   typedef std::unordered_map<std::string, scoped_refptr<RpcMethodInfo>> MethodInfoMap;
   const MethodInfoMap& methods_by_name() const { return methods_by_name_; }
@@ -125,6 +152,14 @@ class GeneratedServiceIf : public ServiceIf {
   // must not be modified.
   MethodInfoMap methods_by_name_;
 
+  // The methods by the slot MethodNameSlot() hashes their names to under
+  // 'method_slot_seed_', each with its name, as set up by the constructor of
+  // the generated subclass. Empty if it doesn't, in which case
+  // 'methods_by_name_' is searched instead. The method infos belong to
+  // 'methods_by_name_'.
+  std::vector<std::pair<std::string, RpcMethodInfo*>> methods_by_slot_;
+  uint32_t method_slot_seed_ = 0;
+
   // The result tracker for this service's methods.
   scoped_refptr<ResultTracker> result_tracker_;
 };
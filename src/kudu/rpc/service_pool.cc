@@ -26,6 +26,7 @@
 #include <vector>
 
 #include <boost/optional/optional.hpp>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/basictypes.h"
@@ -33,18 +34,57 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/join.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/walltime.h"
+#include "kudu/rpc/connection.h"
 #include "kudu/rpc/inbound_call.h"
+#include "kudu/rpc/reactor.h"
 #include "kudu/rpc/remote_method.h"
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/service_if.h"
 #include "kudu/rpc/service_queue.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/net/sockaddr.h"
+#include "kudu/util/os-util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread.h"
 #include "kudu/util/trace.h"
 
+DEFINE_int32(rpc_reactor_handler_budget_us, 0,
+             "If positive, calls of the methods with the run_on_reactor option are "
+             "handled on the reactor thread which received them, saving the hand-off "
+             "to a service thread, as long as their handlers take no longer than this "
+             "many microseconds. A method whose handler overruns this has its calls "
+             "handed to service threads for the next second.");
+TAG_FLAG(rpc_reactor_handler_budget_us, experimental);
+TAG_FLAG(rpc_reactor_handler_budget_us, runtime);
+
+DEFINE_int32(rpc_num_high_priority_service_threads, 0,
+             "If positive, each service with methods of the HIGH_PRIORITY class, "
+             "such as the consensus votes and heartbeats, queues their calls "
+             "separately and starts this many service threads of its own to "
+             "handle them, so that they don't wait behind the calls of its other "
+             "methods.");
+TAG_FLAG(rpc_num_high_priority_service_threads, experimental);
+
+DEFINE_int32(rpc_service_queue_shards, 1,
+             "The number of shards of each service queue, each with its own lock. "
+             "Service threads whose shard is empty steal calls queued in other "
+             "shards, so calls are only approximately handled in deadline order "
+             "once there is more than one. May help when many service and reactor "
+             "threads contend on the queue.");
+TAG_FLAG(rpc_service_queue_shards, experimental);
+
+static bool ValidateServiceQueueShards(const char* /*flagname*/, int32_t value) {
+  if (value <= 0) {
+    LOG(ERROR) << "Invalid number of service queue shards: " << value;
+    return false;
+  }
+  return true;
+}
+DEFINE_validator(rpc_service_queue_shards, &ValidateServiceQueueShards);
+
 using std::shared_ptr;
 using std::string;
 using std::vector;
@@ -54,6 +94,14 @@ METRIC_DEFINE_histogram(server, rpc_incoming_queue_time,
                         "RPC Queue Time",
                         kudu::MetricUnit::kMicroseconds,
                         "Number of microseconds incoming RPC requests spend in the worker queue",
+                        60000000LU, 3, kudu::PER_THREAD);
+
+METRIC_DEFINE_histogram(server, rpc_high_priority_incoming_queue_time,
+                        "High Priority RPC Queue Time",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Number of microseconds incoming RPC requests of high priority "
+                        "methods spend in their worker queue, when they have service "
+                        "threads of their own",
                         60000000LU, 3);
 
 METRIC_DEFINE_counter(server, rpcs_timed_out_in_queue,
@@ -68,6 +116,18 @@ METRIC_DEFINE_counter(server, rpcs_queue_overflow,
                       "Number of RPCs dropped because the service queue "
                       "was full.");
 
+METRIC_DEFINE_counter(server, rpcs_handled_on_reactor,
+                      "RPCs Handled On Reactor",
+                      kudu::MetricUnit::kRequests,
+                      "Number of RPCs handled on the reactor thread which received "
+                      "them rather than on a service thread.");
+
+METRIC_DEFINE_counter(server, rpcs_over_reactor_budget,
+                      "RPCs Over Reactor Handler Budget",
+                      kudu::MetricUnit::kRequests,
+                      "Number of RPCs handled on a reactor thread whose handlers took "
+                      "longer than --rpc_reactor_handler_budget_us.");
+
 namespace kudu {
 namespace rpc {
 
@@ -75,10 +135,15 @@ ServicePool::ServicePool(gscoped_ptr<ServiceIf> service,
                          const scoped_refptr<MetricEntity>& entity,
                          size_t service_queue_length)
   : service_(std::move(service)),
-    service_queue_(service_queue_length),
+    service_queue_(service_queue_length, FLAGS_rpc_service_queue_shards),
     incoming_queue_time_(METRIC_rpc_incoming_queue_time.Instantiate(entity)),
+    high_priority_queue_(service_queue_length),
+    high_priority_queue_time_(METRIC_rpc_high_priority_incoming_queue_time.Instantiate(entity)),
+    has_high_priority_lane_(false),
     rpcs_timed_out_in_queue_(METRIC_rpcs_timed_out_in_queue.Instantiate(entity)),
     rpcs_queue_overflow_(METRIC_rpcs_queue_overflow.Instantiate(entity)),
+    rpcs_handled_on_reactor_(METRIC_rpcs_handled_on_reactor.Instantiate(entity)),
+    rpcs_over_reactor_budget_(METRIC_rpcs_over_reactor_budget.Instantiate(entity)),
     closing_(false),
     logged_busy_(false) {
 }
@@ -91,14 +156,25 @@ Status ServicePool::Init(int num_threads) {
   for (int i = 0; i < num_threads; i++) {
     scoped_refptr<kudu::Thread> new_thread;
     CHECK_OK(kudu::Thread::Create("service pool", "rpc worker",
-        &ServicePool::RunThread, this, &new_thread));
+        &ServicePool::RunThread, this, NORMAL_PRIORITY, i, &new_thread));
     threads_.push_back(new_thread);
   }
+  const int num_high_priority_threads = FLAGS_rpc_num_high_priority_service_threads;
+  if (num_high_priority_threads > 0 && service_->HasHighPriorityMethods()) {
+    has_high_priority_lane_ = true;
+    for (int i = 0; i < num_high_priority_threads; i++) {
+      scoped_refptr<kudu::Thread> new_thread;
+      CHECK_OK(kudu::Thread::Create("service pool", "rpc high priority worker",
+          &ServicePool::RunThread, this, HIGH_PRIORITY, i, &new_thread));
+      threads_.push_back(new_thread);
+    }
+  }
   return Status::OK();
 }
 
 void ServicePool::Shutdown() {
   service_queue_.Shutdown();
+  high_priority_queue_.Shutdown();
 
   MutexLock lock(shutdown_lock_);
   if (closing_) return;
@@ -108,24 +184,24 @@ void ServicePool::Shutdown() {
     CHECK_OK(ThreadJoiner(thread.get()).Join());
   }
 
-  // Now we must drain the service queue.
+  // Now we must drain the service queues.
   Status status = Status::ServiceUnavailable("Service is shutting down");
   std::unique_ptr<InboundCall> incoming;
-  while (service_queue_.BlockingGet(&incoming)) {
+  while (service_queue_.TryGet(&incoming) || high_priority_queue_.TryGet(&incoming)) {
     incoming.release()->RespondFailure(ErrorStatusPB::FATAL_SERVER_SHUTTING_DOWN, status);
   }
 
   service_->Shutdown();
 }
 
-void ServicePool::RejectTooBusy(InboundCall* c) {
+void ServicePool::RejectTooBusy(InboundCall* c, const LifoServiceQueue& queue) {
   string err_msg =
       Substitute("$0 request on $1 from $2 dropped due to backpressure. "
                  "The service queue is full; it has $3 items.",
                  c->remote_method().method_name(),
                  service_->service_name(),
                  c->remote_address().ToString(),
-                 service_queue_.max_size());
+                 queue.max_size());
   rpcs_queue_overflow_->Increment();
   KLOG_EVERY_N_SECS(WARNING, 300) << err_msg;
   c->RespondFailure(ErrorStatusPB::ERROR_SERVER_TOO_BUSY,
@@ -135,7 +211,7 @@ void ServicePool::RejectTooBusy(InboundCall* c) {
     // throttle, as don't want to flood log with lines if
     // pool is always at edge of queue.
     KLOG_EVERY_N_SECS(WARNING, 600) << err_msg << " Contents of service queue:\n"
-        << service_queue_.ToString();
+        << queue.ToString();
     logged_busy_ = true;
   }
 
@@ -145,7 +221,7 @@ void ServicePool::RejectTooBusy(InboundCall* c) {
 }
 
 std::string ServicePool::RpcServiceQueueToString() const {
-  return service_queue_.ToString();
+  return service_queue_.ToString() + high_priority_queue_.ToString();
 }
 
 RpcMethodInfo* ServicePool::LookupMethod(const RemoteMethod& method) {
@@ -170,18 +246,36 @@ Status ServicePool::QueueInboundCall(gscoped_ptr<InboundCall> call) {
                                            ", "));
   }
 
+  const int32_t budget_us = FLAGS_rpc_reactor_handler_budget_us;
+  RpcMethodInfo* method_info = c->method_info();
+  if (budget_us > 0 && method_info && method_info->run_on_reactor &&
+      GetMonoTimeMicros() >= method_info->reactor_suspended_until_us.load(
+          std::memory_order_relaxed)) {
+    HandleOnReactor(c, budget_us);
+    return Status::OK();
+  }
+
   TRACE_TO(c->trace(), "Inserting onto call queue");
 
   // Queue message on service queue
   boost::optional<InboundCall*> evicted;
-  auto queue_status = service_queue_.Put(c, &evicted);
+  int numa_node = -1;
+  if (!numa_nodes_.empty() && c->connection()) {
+    numa_node = c->connection()->reactor_thread()->reactor()->numa_node();
+  }
+  LifoServiceQueue* queue = &service_queue_;
+  if (has_high_priority_lane_ && method_info &&
+      method_info->priority_class == HIGH_PRIORITY) {
+    queue = &high_priority_queue_;
+  }
+  auto queue_status = queue->Put(c, &evicted, numa_node);
   if (queue_status == QUEUE_FULL) {
-    RejectTooBusy(c);
+    RejectTooBusy(c, *queue);
     return Status::OK();
   }
 
   if (PREDICT_FALSE(evicted != boost::none)) {
-    RejectTooBusy(*evicted);
+    RejectTooBusy(*evicted, *queue);
   }
 
   // success in enqueu. Clear the printed state for busy
@@ -205,15 +299,58 @@ Status ServicePool::QueueInboundCall(gscoped_ptr<InboundCall> call) {
   return status;
 }
 
-void ServicePool::RunThread() {
+void ServicePool::HandleOnReactor(InboundCall* c, int32_t budget_us) {
+  // The handler may respond, and so free the call, before it returns.
+  RpcMethodInfo* method_info = c->method_info();
+  const string method_name = c->remote_method().method_name();
+  c->RecordHandlingStarted(incoming_queue_time_.get());
+  ADOPT_TRACE(c->trace());
+  TRACE_TO(c->trace(), "Handling call on the reactor thread");
+  rpcs_handled_on_reactor_->Increment();
+
+  const int64_t start_us = GetMonoTimeMicros();
+  service_->Handle(c);
+  const int64_t end_us = GetMonoTimeMicros();
+
+  if (PREDICT_FALSE(end_us - start_us > budget_us)) {
+    // The method's handler can't be relied on to stay on budget: stop holding
+    // up the reactor with it for a while.
+    rpcs_over_reactor_budget_->Increment();
+    method_info->reactor_suspended_until_us.store(end_us + kReactorSuspensionUs,
+                                                  std::memory_order_relaxed);
+    KLOG_EVERY_N_SECS(WARNING, 10) << Substitute(
+        "$0.$1 took $2us on a reactor thread, over its budget of $3us; "
+        "handing its calls to service threads for a while",
+        service_->service_name(), method_name, end_us - start_us, budget_us);
+  }
+}
+
+void ServicePool::RunThread(RpcPriorityClass priority_class, int worker_idx) {
+  LifoServiceQueue* queue = &service_queue_;
+  Histogram* queue_time = incoming_queue_time_.get();
+  if (priority_class == HIGH_PRIORITY) {
+    queue = &high_priority_queue_;
+    queue_time = high_priority_queue_time_.get();
+  }
+  int numa_node = -1;
+  if (!numa_nodes_.empty()) {
+    const NumaNode& node = numa_nodes_[worker_idx % numa_nodes_.size()];
+    Status s = SetCurrentThreadCpuAffinity(node.cpus);
+    if (s.ok()) {
+      numa_node = node.id;
+    } else {
+      KLOG_FIRST_N(WARNING, 1) << "Unable to pin " << service_name()
+                               << " worker to NUMA node " << node.id << ": " << s.ToString();
+    }
+  }
   while (true) {
     std::unique_ptr<InboundCall> incoming;
-    if (!service_queue_.BlockingGet(&incoming)) {
+    if (!queue->BlockingGet(&incoming, numa_node)) {
       VLOG(1) << "ServicePool: messenger shutting down.";
       return;
     }
 
-    incoming->RecordHandlingStarted(incoming_queue_time_.get());
+    incoming->RecordHandlingStarted(queue_time);
     ADOPT_TRACE(incoming->trace());
 
     if (PREDICT_FALSE(incoming->ClientTimedOut())) {
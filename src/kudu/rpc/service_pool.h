@@ -20,6 +20,7 @@
 
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <utility>
@@ -29,9 +30,11 @@
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/rpc_service.h"
 #include "kudu/rpc/service_queue.h"
 #include "kudu/util/mutex.h"
+#include "kudu/util/os-util.h"
 #include "kudu/util/status.h"
 
 namespace kudu {
@@ -69,6 +72,15 @@ class ServicePool : public RpcService {
     too_busy_hook_ = std::move(hook);
   }
 
+  // Spread the worker threads across 'numa_nodes', pinning each to the CPUs
+  // of its node, and hand each call to an idle worker on the NUMA node of the
+  // reactor which received it where there is one, so that a call is handled
+  // on the node whose caches it was received into. Must be called before
+  // Init().
+  void set_numa_nodes(std::vector<NumaNode> numa_nodes) {
+    numa_nodes_ = std::move(numa_nodes);
+  }
+
   // Start up the thread pool.
   virtual Status Init(int num_threads);
 
@@ -87,6 +99,10 @@ class ServicePool : public RpcService {
     return incoming_queue_time_.get();
   }
 
+  const Histogram* HighPriorityIncomingQueueTimeMetricForTests() const {
+    return high_priority_queue_time_.get();
+  }
+
   const Counter* RpcsQueueOverflowMetric() const {
     return rpcs_queue_overflow_.get();
   }
@@ -99,15 +115,39 @@ class ServicePool : public RpcService {
   std::string RpcServiceQueueToString() const;
 
  private:
-  void RunThread();
-  void RejectTooBusy(InboundCall* c);
+  // Handles the calls of 'priority_class' until the pool is shut down.
+  // 'worker_idx' picks the NUMA node of 'numa_nodes_' which the thread is
+  // pinned to.
+  void RunThread(RpcPriorityClass priority_class, int worker_idx);
+  void RejectTooBusy(InboundCall* c, const LifoServiceQueue& queue);
+
+  // Handles 'c' on the calling reactor thread. If the handler takes longer
+  // than 'budget_us', the method's calls are queued for service threads for
+  // the next kReactorSuspensionUs.
+  void HandleOnReactor(InboundCall* c, int32_t budget_us);
+
+  static const int64_t kReactorSuspensionUs = 1000000;
 
   gscoped_ptr<ServiceIf> service_;
   std::vector<scoped_refptr<kudu::Thread> > threads_;
   LifoServiceQueue service_queue_;
   scoped_refptr<Histogram> incoming_queue_time_;
+
+  // The queue of the calls of HIGH_PRIORITY methods, and the time they spend
+  // in it. Only used if 'has_high_priority_lane_', in which case threads of
+  // their own handle the calls, otherwise they go in 'service_queue_'.
+  LifoServiceQueue high_priority_queue_;
+  scoped_refptr<Histogram> high_priority_queue_time_;
+  bool has_high_priority_lane_;
+
   scoped_refptr<Counter> rpcs_timed_out_in_queue_;
   scoped_refptr<Counter> rpcs_queue_overflow_;
+  scoped_refptr<Counter> rpcs_handled_on_reactor_;
+  scoped_refptr<Counter> rpcs_over_reactor_budget_;
+
+  // The NUMA nodes which the worker threads are pinned to, or empty if they
+  // aren't pinned.
+  std::vector<NumaNode> numa_nodes_;
 
   mutable Mutex shutdown_lock_;
   bool closing_;
@@ -50,6 +50,9 @@ DEFINE_int32(num_consumers, 20,
 DEFINE_int32(max_queue_size, 50,
              "Max queue length");
 
+DEFINE_int32(num_shards, 4,
+             "Number of shards of the sharded queue");
+
 namespace kudu {
 namespace rpc {
 
@@ -97,8 +100,10 @@ void ConsumerThread(Queue* queue) {
   }
 }
 
-TEST(TestServiceQueue, LifoServiceQueuePerf) {
-  LifoServiceQueue queue(FLAGS_max_queue_size);
+void RunQueuePerf(int num_shards) {
+  LifoServiceQueue queue(FLAGS_max_queue_size, num_shards);
+  inprogress = 0;
+  total = 0;
   vector<std::thread> producers;
   vector<std::thread> consumers;
 
@@ -140,6 +145,7 @@ TEST(TestServiceQueue, LifoServiceQueuePerf) {
   float user_cpu_micros_per_req = static_cast<float>(sw.elapsed().user / 1000.0 / delta);
   float sys_cpu_micros_per_req = static_cast<float>(sw.elapsed().system / 1000.0 / delta);
 
+  LOG(INFO) << "Shards:           " << num_shards;
   LOG(INFO) << "Reqs/sec:         " << (int32_t)reqs_per_second;
   LOG(INFO) << "User CPU per req: " << user_cpu_micros_per_req << "us";
   LOG(INFO) << "Sys CPU per req:  " << sys_cpu_micros_per_req << "us";
@@ -147,5 +153,49 @@ TEST(TestServiceQueue, LifoServiceQueuePerf) {
   LOG(INFO) << "Avg idle workers:     " << total_idle_workers / static_cast<double>(total_sample);
 }
 
+TEST(TestServiceQueue, LifoServiceQueuePerf) {
+  RunQueuePerf(1);
+}
+
+TEST(TestServiceQueue, ShardedLifoServiceQueuePerf) {
+  RunQueuePerf(FLAGS_num_shards);
+}
+
+// Calls queued in shards which no consumer belongs to are stolen by the
+// consumers of other shards, and are all handled before the consumers see the
+// queue shut down.
+TEST(TestServiceQueue, TestStealFromOtherShards) {
+  const int kNumShards = 4;
+  const int kNumCalls = 100;
+  LifoServiceQueue queue(kNumCalls * kNumShards, kNumShards);
+  std::atomic<int> handled(0);
+  std::thread consumer([&]() {
+    unique_ptr<InboundCall> call;
+    while (queue.BlockingGet(&call)) {
+      handled++;
+      call.reset();
+    }
+  });
+
+  // Producers on different threads put their calls into different shards.
+  vector<std::thread> producers;
+  for (int i = 0; i < kNumShards; i++) {
+    producers.emplace_back([&]() {
+      for (int j = 0; j < kNumCalls; j++) {
+        boost::optional<InboundCall*> evicted;
+        CHECK_EQ(QUEUE_SUCCESS, queue.Put(new InboundCall(nullptr), &evicted));
+        CHECK(evicted == boost::none);
+      }
+    });
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  queue.Shutdown();
+  consumer.join();
+  ASSERT_EQ(kNumCalls * kNumShards, handled);
+  ASSERT_TRUE(queue.empty());
+}
+
 } // namespace rpc
 } // namespace kudu
@@ -17,8 +17,12 @@
 
 #include "kudu/rpc/service_queue.h"
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <mutex>
 #include <ostream>
+#include <vector>
 
 #include <boost/optional/optional.hpp>
 
@@ -29,101 +33,273 @@ namespace rpc {
 
 __thread LifoServiceQueue::ConsumerState* LifoServiceQueue::tl_consumer_ = nullptr;
 
-LifoServiceQueue::LifoServiceQueue(int max_size)
+namespace {
+// The index which the calling thread was given among the producer threads of
+// all the queues, or -1 if it hasn't produced yet.
+__thread int tl_producer_idx = -1;
+std::atomic<int> next_producer_idx(0);
+} // anonymous namespace
+
+LifoServiceQueue::LifoServiceQueue(int max_size, int num_shards)
    : shutdown_(false),
      max_queue_size_(max_size) {
   CHECK_GT(max_queue_size_, 0);
+  CHECK_GT(num_shards, 0);
+  max_shard_size_ = std::max(1, (max_size + num_shards - 1) / num_shards);
+  for (int i = 0; i < num_shards; i++) {
+    shards_.emplace_back(new Shard);
+  }
 }
 
 LifoServiceQueue::~LifoServiceQueue() {
-  DCHECK(queue_.empty())
-      << "ServiceQueue holds bare pointers at destruction time";
+  for (const auto& shard : shards_) {
+    DCHECK(shard->queue.empty())
+        << "ServiceQueue holds bare pointers at destruction time";
+  }
+}
+
+int LifoServiceQueue::ProducerShard() const {
+  if (shards_.size() == 1) {
+    return 0;
+  }
+  // Spreading the producer threads, usually the reactor threads, across the
+  // shards keeps each shard's lock to a few of them.
+  if (PREDICT_FALSE(tl_producer_idx == -1)) {
+    tl_producer_idx = next_producer_idx++;
+  }
+  return tl_producer_idx % shards_.size();
+}
+
+LifoServiceQueue::ConsumerState* LifoServiceQueue::PopWaitingConsumer(Shard* shard,
+                                                                      int numa_node) {
+  auto& waiting = shard->waiting_consumers;
+  DCHECK(!waiting.empty());
+  // Prefer the most recently idle consumer on the call's NUMA node, if any.
+  auto it = waiting.end() - 1;
+  if (numa_node != -1) {
+    auto on_node = std::find_if(waiting.rbegin(), waiting.rend(),
+                                [numa_node](const ConsumerState* c) {
+                                  return c->numa_node() == numa_node;
+                                });
+    if (on_node != waiting.rend()) {
+      it = std::next(on_node).base();
+    }
+  }
+  auto consumer = *it;
+  waiting.erase(it);
+  shard->num_waiting--;
+  return consumer;
+}
+
+LifoServiceQueue::ConsumerState* LifoServiceQueue::PopWaitingConsumerOfOtherShard(
+    const Shard* shard, int numa_node) {
+  for (const auto& other : shards_) {
+    if (other.get() == shard || other->num_waiting == 0) {
+      continue;
+    }
+    std::lock_guard<simple_spinlock> l(other->lock);
+    if (!other->waiting_consumers.empty()) {
+      return PopWaitingConsumer(other.get(), numa_node);
+    }
+  }
+  return nullptr;
+}
+
+void LifoServiceQueue::TakeEarliest(Shard* shard, std::unique_ptr<InboundCall>* out) {
+  auto it = shard->queue.begin();
+  out->reset(*it);
+  shard->queue.erase(it);
+  shard->num_queued--;
+}
+
+bool LifoServiceQueue::TrySteal(const Shard* shard, std::unique_ptr<InboundCall>* out) {
+  for (const auto& other : shards_) {
+    if (other.get() == shard || other->num_queued == 0) {
+      continue;
+    }
+    std::lock_guard<simple_spinlock> l(other->lock);
+    if (!other->queue.empty()) {
+      TakeEarliest(other.get(), out);
+      return true;
+    }
+  }
+  return false;
 }
 
-bool LifoServiceQueue::BlockingGet(std::unique_ptr<InboundCall>* out) {
+bool LifoServiceQueue::BlockingGet(std::unique_ptr<InboundCall>* out, int numa_node) {
   auto consumer = tl_consumer_;
   if (PREDICT_FALSE(!consumer)) {
-    consumer = tl_consumer_ = new ConsumerState(this);
-    std::lock_guard<simple_spinlock> l(lock_);
+    std::lock_guard<simple_spinlock> l(consumers_lock_);
+    consumer = tl_consumer_ = new ConsumerState(this, numa_node,
+                                                consumers_.size() % shards_.size());
     consumers_.emplace_back(consumer);
   }
+  Shard* shard = shards_[consumer->shard()].get();
+  const bool sharded = shards_.size() > 1;
 
   while (true) {
     {
-      std::lock_guard<simple_spinlock> l(lock_);
-      if (!queue_.empty()) {
-        auto it = queue_.begin();
-        out->reset(*it);
-        queue_.erase(it);
+      std::unique_lock<simple_spinlock> l(shard->lock);
+      if (!shard->queue.empty()) {
+        TakeEarliest(shard, out);
         return true;
       }
+      if (sharded) {
+        l.unlock();
+        if (TrySteal(shard, out)) {
+          return true;
+        }
+        l.lock();
+        if (!shard->queue.empty()) {
+          TakeEarliest(shard, out);
+          return true;
+        }
+      }
       if (PREDICT_FALSE(shutdown_)) {
-        return false;
+        // No call is queued once the queue is shut down, so this only takes
+        // what is left in the other shards.
+        l.unlock();
+        return sharded && TrySteal(shard, out);
       }
       consumer->DCheckBoundInstance(this);
-      waiting_consumers_.push_back(consumer);
+      shard->waiting_consumers.push_back(consumer);
+      shard->num_waiting++;
+    }
+    if (sharded) {
+      // A producer which queued a call in another shard after we looked
+      // there either sees that we are waiting and wakes us, or is seen here.
+      bool queued_elsewhere = false;
+      for (const auto& other : shards_) {
+        if (other.get() != shard && other->num_queued > 0) {
+          queued_elsewhere = true;
+          break;
+        }
+      }
+      if (queued_elsewhere) {
+        std::lock_guard<simple_spinlock> l(shard->lock);
+        auto& waiting = shard->waiting_consumers;
+        auto it = std::find(waiting.begin(), waiting.end(), consumer);
+        // Unless a producer already popped us, in which case it posts to us.
+        if (it != waiting.end()) {
+          waiting.erase(it);
+          shard->num_waiting--;
+          continue;
+        }
+      }
     }
     InboundCall* call = consumer->Wait();
     if (call != nullptr) {
       out->reset(call);
       return true;
     }
-    // if call == nullptr, this means we are shutting down the queue.
-    // Loop back around and re-check 'shutdown_'.
+    // if call == nullptr, this means we are shutting down the queue, or a
+    // call was queued in another shard. Loop back around and re-check.
   }
 }
 
-QueueStatus LifoServiceQueue::Put(InboundCall* call,
-                                  boost::optional<InboundCall*>* evicted) {
-  std::unique_lock<simple_spinlock> l(lock_);
-  if (PREDICT_FALSE(shutdown_)) {
-    return QUEUE_SHUTDOWN;
+bool LifoServiceQueue::TryGet(std::unique_ptr<InboundCall>* out) {
+  for (const auto& shard : shards_) {
+    std::lock_guard<simple_spinlock> l(shard->lock);
+    if (!shard->queue.empty()) {
+      TakeEarliest(shard.get(), out);
+      return true;
+    }
   }
+  return false;
+}
+
+QueueStatus LifoServiceQueue::Put(InboundCall* call,
+                                  boost::optional<InboundCall*>* evicted,
+                                  int numa_node) {
+  Shard* shard = shards_[ProducerShard()].get();
+  const bool sharded = shards_.size() > 1;
+  std::unique_lock<simple_spinlock> l(shard->lock);
+  bool looked_elsewhere = false;
+  while (true) {
+    if (PREDICT_FALSE(shutdown_)) {
+      return QUEUE_SHUTDOWN;
+    }
 
-  DCHECK(!(waiting_consumers_.size() > 0 && queue_.size() > 0));
+    DCHECK(!(shard->waiting_consumers.size() > 0 && shard->queue.size() > 0));
 
-  // fast path
-  if (queue_.empty() && waiting_consumers_.size() > 0) {
-    auto consumer = waiting_consumers_[waiting_consumers_.size() - 1];
-    waiting_consumers_.pop_back();
-    // Notify condition var(and wake up consumer thread) takes time,
-    // so put it out of spinlock scope.
+    // fast path
+    if (shard->queue.empty() && shard->waiting_consumers.size() > 0) {
+      auto consumer = PopWaitingConsumer(shard, numa_node);
+      // Notify condition var(and wake up consumer thread) takes time,
+      // so put it out of spinlock scope.
+      l.unlock();
+      consumer->Post(call);
+      return QUEUE_SUCCESS;
+    }
+    if (!sharded || looked_elsewhere) {
+      break;
+    }
+
+    // Rather than queueing the call, hand it to an idle consumer of another
+    // shard, if any.
     l.unlock();
-    consumer->Post(call);
-    return QUEUE_SUCCESS;
+    auto consumer = PopWaitingConsumerOfOtherShard(shard, numa_node);
+    if (consumer) {
+      consumer->Post(call);
+      return QUEUE_SUCCESS;
+    }
+    looked_elsewhere = true;
+    l.lock();
   }
 
-  if (PREDICT_FALSE(queue_.size() >= max_queue_size_)) {
+  if (PREDICT_FALSE(shard->queue.size() >= max_shard_size_)) {
     // eviction
-    DCHECK_EQ(queue_.size(), max_queue_size_);
-    auto it = queue_.end();
+    DCHECK_EQ(shard->queue.size(), max_shard_size_);
+    auto it = shard->queue.end();
     --it;
     if (DeadlineLess(*it, call)) {
       return QUEUE_FULL;
     }
 
     *evicted = *it;
-    queue_.erase(it);
+    shard->queue.erase(it);
+    shard->num_queued--;
   }
 
-  queue_.insert(call);
+  shard->queue.insert(call);
+  shard->num_queued++;
+  if (sharded) {
+    l.unlock();
+    // Wake a consumer of another shard which went idle since we looked, so
+    // that it steals the call.
+    auto consumer = PopWaitingConsumerOfOtherShard(shard, numa_node);
+    if (consumer) {
+      consumer->Post(nullptr);
+    }
+  }
   return QUEUE_SUCCESS;
 }
 
 void LifoServiceQueue::Shutdown() {
-  std::lock_guard<simple_spinlock> l(lock_);
+  std::vector<std::unique_lock<simple_spinlock>> locks;
+  for (const auto& shard : shards_) {
+    locks.emplace_back(shard->lock);
+  }
   shutdown_ = true;
 
   // Post a nullptr to wake up any consumers which are waiting.
-  for (auto* cs : waiting_consumers_) {
-    cs->Post(nullptr);
+  for (const auto& shard : shards_) {
+    for (auto* cs : shard->waiting_consumers) {
+      cs->Post(nullptr);
+    }
+    shard->waiting_consumers.clear();
+    shard->num_waiting = 0;
   }
-  waiting_consumers_.clear();
 }
 
 bool LifoServiceQueue::empty() const {
-  std::lock_guard<simple_spinlock> l(lock_);
-  return queue_.empty();
+  for (const auto& shard : shards_) {
+    std::lock_guard<simple_spinlock> l(shard->lock);
+    if (!shard->queue.empty()) {
+      return false;
+    }
+  }
+  return true;
 }
 
 int LifoServiceQueue::max_size() const {
@@ -133,10 +309,12 @@ int LifoServiceQueue::max_size() const {
 std::string LifoServiceQueue::ToString() const {
   std::string ret;
 
-  std::lock_guard<simple_spinlock> l(lock_);
-  for (const auto* t : queue_) {
-    ret.append(t->ToString());
-    ret.append("\n");
+  for (const auto& shard : shards_) {
+    std::lock_guard<simple_spinlock> l(shard->lock);
+    for (const auto* t : shard->queue) {
+      ret.append(t->ToString());
+      ret.append("\n");
+    }
   }
   return ret;
 }
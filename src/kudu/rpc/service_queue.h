@@ -17,6 +17,7 @@
 #ifndef KUDU_UTIL_SERVICE_QUEUE_H
 #define KUDU_UTIL_SERVICE_QUEUE_H
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <set>
@@ -24,7 +25,6 @@
 
 #include <glog/logging.h>
 
-#include "kudu/gutil/dynamic_annotations.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/rpc/inbound_call.h"
 #include "kudu/util/condition_variable.h"
@@ -72,18 +72,36 @@ enum QueueStatus {
 //   work rate, the queue implementation itself is never used. Thus, we can
 //   have a priority queue without paying extra for it in the common case.
 //
+// With many service threads, the single lock which every producer and
+// consumer takes becomes contended. The queue may thus be split into shards,
+// each with its own lock, queue and stack of waiting consumers, and an equal
+// part of the maximum size. Each consumer belongs to one shard, and each
+// producer thread puts its calls into one shard. A call for which no consumer
+// of its shard is waiting is handed to a waiting consumer of another shard if
+// there is one, and consumers whose shard's queue is empty steal the calls
+// queued in other shards. Calls are thus dequeued in earliest-deadline first
+// order within each shard, but only approximately across shards.
+//
 // NOTE: because of the use of thread-local consumer records, once a consumer
 // thread accesses one LifoServiceQueue, it becomes "bound" to that queue and
 // must never access any other instance.
 class LifoServiceQueue {
  public:
-  explicit LifoServiceQueue(int max_size);
+  explicit LifoServiceQueue(int max_size, int num_shards = 1);
 
   ~LifoServiceQueue();
 
   // Get an element from the queue.  Returns false if we were shut down prior to
   // getting the element.
-  bool BlockingGet(std::unique_ptr<InboundCall>* out);
+  //
+  // 'numa_node' is the NUMA node which the calling thread is pinned to, or -1
+  // if it isn't pinned. It must be the same on every call from a thread.
+  bool BlockingGet(std::unique_ptr<InboundCall>* out, int numa_node = -1);
+
+  // Takes the call with the earliest deadline out of the queue without
+  // waiting, and without binding the calling thread to the queue. Returns
+  // false if the queue is empty. Used to drain a queue which was shut down.
+  bool TryGet(std::unique_ptr<InboundCall>* out);
 
   // Add a new call to the queue.
   // Returns:
@@ -95,7 +113,11 @@ class LifoServiceQueue {
   // In the case of a 'QUEUE_SUCCESS' response, the new element may have bumped
   // another call out of the queue. In that case, *evicted will be set to the
   // call that was bumped.
-  QueueStatus Put(InboundCall* call, boost::optional<InboundCall*>* evicted);
+  //
+  // If 'numa_node' isn't -1, 'call' is preferably handed to a waiting consumer
+  // which is pinned to that NUMA node.
+  QueueStatus Put(InboundCall* call, boost::optional<InboundCall*>* evicted,
+                  int numa_node = -1);
 
   // Shut down the queue.
   // When a blocking queue is shut down, no more elements can be added to it,
@@ -110,24 +132,23 @@ class LifoServiceQueue {
 
   std::string ToString() const;
 
+  int num_shards() const { return shards_.size(); }
+
   // Return an estimate of the current queue length.
   int estimated_queue_length() const {
-    ANNOTATE_IGNORE_READS_BEGIN();
-    // The C++ standard says that std::multiset::size must be constant time,
-    // so this method won't try to traverse any actual nodes of the underlying
-    // RB tree. Investigation of the libstdcxx implementation confirms that
-    // size() is a simple field access of the _Rb_tree structure.
-    int ret = queue_.size();
-    ANNOTATE_IGNORE_READS_END();
+    int ret = 0;
+    for (const auto& shard : shards_) {
+      ret += shard->num_queued.load(std::memory_order_relaxed);
+    }
     return ret;
   }
 
   // Return an estimate of the number of idle threads currently awaiting work.
   int estimated_idle_worker_count() const {
-    ANNOTATE_IGNORE_READS_BEGIN();
-    // Size of a vector is a simple field access so this is safe.
-    int ret = waiting_consumers_.size();
-    ANNOTATE_IGNORE_READS_END();
+    int ret = 0;
+    for (const auto& shard : shards_) {
+      ret += shard->num_waiting.load(std::memory_order_relaxed);
+    }
     return ret;
   }
 
@@ -159,10 +180,12 @@ class LifoServiceQueue {
   // post work using Post().
   class ConsumerState {
    public:
-    explicit ConsumerState(LifoServiceQueue* queue) :
+    ConsumerState(LifoServiceQueue* queue, int numa_node, int shard) :
         cond_(&lock_),
         call_(nullptr),
         should_wake_(false),
+        numa_node_(numa_node),
+        shard_(shard),
         bound_queue_(queue) {
     }
 
@@ -189,31 +212,78 @@ class LifoServiceQueue {
       DCHECK_EQ(q, bound_queue_);
     }
 
+    int numa_node() const { return numa_node_; }
+
+    int shard() const { return shard_; }
+
    private:
     Mutex lock_;
     ConditionVariable cond_;
     InboundCall* call_;
     bool should_wake_;
 
+    // The NUMA node which the consumer thread is pinned to, or -1.
+    const int numa_node_;
+
+    // The index of the shard which the consumer takes calls from first.
+    const int shard_;
+
     // For the purpose of assertions, tracks the LifoServiceQueue instance that
     // this consumer is reading from.
     LifoServiceQueue* bound_queue_;
   };
 
+  struct Shard {
+    mutable simple_spinlock lock;
+
+    // Stack of consumer threads which are currently waiting for work.
+    std::vector<ConsumerState*> waiting_consumers;
+
+    // The actual queue. Work is only added to the queue when there were no
+    // consumers available for a "direct hand-off".
+    std::multiset<InboundCall*, DeadlineLessStruct> queue;
+
+    // The sizes of 'waiting_consumers' and 'queue', which are only changed
+    // under 'lock' but may be read without it.
+    std::atomic<int> num_waiting{0};
+    std::atomic<int> num_queued{0};
+  };
+
+  // Returns the index of the shard which the calling producer thread puts
+  // its calls into.
+  int ProducerShard() const;
+
+  // Pops the consumer to hand a call to from the non-empty waiting consumers
+  // of 'shard', whose lock must be held. Prefers the most recently idle
+  // consumer on 'numa_node', if any.
+  static ConsumerState* PopWaitingConsumer(Shard* shard, int numa_node);
+
+  // Pops a waiting consumer of any shard other than 'shard', or returns
+  // nullptr if there is none.
+  ConsumerState* PopWaitingConsumerOfOtherShard(const Shard* shard, int numa_node);
+
+  // Takes the call with the earliest deadline queued in 'shard', whose lock
+  // must be held.
+  static void TakeEarliest(Shard* shard, std::unique_ptr<InboundCall>* out);
+
+  // Takes the call with the earliest deadline out of the first shard other
+  // than 'shard' which has calls queued. Returns false if there are none.
+  bool TrySteal(const Shard* shard, std::unique_ptr<InboundCall>* out);
+
   static __thread ConsumerState* tl_consumer_;
 
-  mutable simple_spinlock lock_;
-  bool shutdown_;
+  // Set with the locks of all the shards held.
+  std::atomic<bool> shutdown_;
   int max_queue_size_;
 
-  // Stack of consumer threads which are currently waiting for work.
-  std::vector<ConsumerState*> waiting_consumers_;
+  // The most calls queued in each shard.
+  int max_shard_size_;
 
-  // The actual queue. Work is only added to the queue when there were no
-  // consumers available for a "direct hand-off".
-  std::multiset<InboundCall*, DeadlineLessStruct> queue_;
+  std::vector<std::unique_ptr<Shard>> shards_;
 
   // The total set of consumers who have ever accessed this queue.
+  // Protected by 'consumers_lock_'.
+  simple_spinlock consumers_lock_;
   std::vector<std::unique_ptr<ConsumerState>> consumers_;
 
   DISALLOW_COPY_AND_ASSIGN(LifoServiceQueue);
@@ -0,0 +1,107 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/socket_profile.h"
+
+#include <gflags/gflags.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/net/socket.h"
+
+DEFINE_int32(rpc_in_region_socket_buf_bytes, 0,
+             "SO_SNDBUF and SO_RCVBUF of the connections to peers in this server's "
+             "region, when sockets are tuned per region. 0 leaves them as the "
+             "messenger sets them.");
+TAG_FLAG(rpc_in_region_socket_buf_bytes, experimental);
+TAG_FLAG(rpc_in_region_socket_buf_bytes, runtime);
+
+DEFINE_int32(rpc_cross_region_socket_buf_bytes, 0,
+             "SO_SNDBUF and SO_RCVBUF of the connections to peers in other regions, "
+             "when sockets are tuned per region. Links with a large bandwidth-delay "
+             "product need buffers of at least that product to be saturated. 0 "
+             "leaves them as the messenger sets them.");
+TAG_FLAG(rpc_cross_region_socket_buf_bytes, experimental);
+TAG_FLAG(rpc_cross_region_socket_buf_bytes, runtime);
+
+DEFINE_string(rpc_cross_region_socket_congestion_control, "",
+              "The TCP congestion control algorithm, such as 'bbr', of the "
+              "connections to peers in other regions, when sockets are tuned per "
+              "region. If empty, the system default is used.");
+TAG_FLAG(rpc_cross_region_socket_congestion_control, experimental);
+TAG_FLAG(rpc_cross_region_socket_congestion_control, runtime);
+
+DEFINE_int32(rpc_cross_region_socket_notsent_lowat_bytes, 0,
+             "TCP_NOTSENT_LOWAT of the connections to peers in other regions, when "
+             "sockets are tuned per region, so that large socket buffers don't hold "
+             "more unsent data than needed to keep the link busy. 0 leaves it unset.");
+TAG_FLAG(rpc_cross_region_socket_notsent_lowat_bytes, experimental);
+TAG_FLAG(rpc_cross_region_socket_notsent_lowat_bytes, runtime);
+
+using std::string;
+using strings::Substitute;
+
+namespace kudu {
+namespace rpc {
+
+SocketProfile SocketProfile::InRegion() {
+  SocketProfile profile;
+  profile.send_buf = FLAGS_rpc_in_region_socket_buf_bytes;
+  profile.receive_buf = FLAGS_rpc_in_region_socket_buf_bytes;
+  return profile;
+}
+
+SocketProfile SocketProfile::CrossRegion() {
+  SocketProfile profile;
+  profile.send_buf = FLAGS_rpc_cross_region_socket_buf_bytes;
+  profile.receive_buf = FLAGS_rpc_cross_region_socket_buf_bytes;
+  profile.congestion_control = FLAGS_rpc_cross_region_socket_congestion_control;
+  profile.notsent_lowat = FLAGS_rpc_cross_region_socket_notsent_lowat_bytes;
+  return profile;
+}
+
+Status SocketProfile::ApplyTo(Socket* sock) const {
+  Status ret;
+  auto update = [&](const Status& s) {
+    if (ret.ok()) {
+      ret = s;
+    }
+  };
+  if (send_buf > 0) {
+    update(sock->SetSendBuf(send_buf));
+  }
+  if (receive_buf > 0) {
+    update(sock->SetReceiveBuf(receive_buf));
+  }
+  if (!congestion_control.empty()) {
+    update(sock->SetCongestionControl(congestion_control));
+  }
+  if (notsent_lowat > 0) {
+    update(sock->SetNotSentLowat(notsent_lowat));
+  }
+  return ret;
+}
+
+string SocketProfile::ToString() const {
+  return Substitute("send_buf=$0 receive_buf=$1 congestion_control=$2 notsent_lowat=$3",
+                    send_buf, receive_buf,
+                    congestion_control.empty() ? "default" : congestion_control,
+                    notsent_lowat);
+}
+
+} // namespace rpc
+} // namespace kudu
@@ -0,0 +1,65 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef KUDU_RPC_SOCKET_PROFILE_H
+#define KUDU_RPC_SOCKET_PROFILE_H
+
+#include <string>
+
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class Socket;
+
+namespace rpc {
+
+// Socket options which suit a kind of link, such as one between regions,
+// whose bandwidth-delay product wants large buffers, or one within a region,
+// which wants small buffers for low latency. A messenger applies the profile
+// set for a remote host, if any, to the connections it makes to and accepts
+// from that host. See Messenger::SetSocketProfile().
+struct SocketProfile {
+  // SO_SNDBUF and SO_RCVBUF, or 0 to leave them as the messenger sets them.
+  int send_buf = 0;
+  int receive_buf = 0;
+
+  // TCP_CONGESTION, such as "bbr", or empty to leave the system default.
+  std::string congestion_control;
+
+  // TCP_NOTSENT_LOWAT, or 0 to leave it unset.
+  int notsent_lowat = 0;
+
+  // The profile of links to hosts in this server's region, from the
+  // --rpc_in_region_socket_* flags.
+  static SocketProfile InRegion();
+
+  // The profile of links to hosts in other regions, from the
+  // --rpc_cross_region_socket_* flags.
+  static SocketProfile CrossRegion();
+
+  // Sets the options of this profile on 'sock'. All the options are tried,
+  // and the first failure, if any, is returned.
+  Status ApplyTo(Socket* sock) const;
+
+  std::string ToString() const;
+};
+
+} // namespace rpc
+} // namespace kudu
+
+#endif // KUDU_RPC_SOCKET_PROFILE_H
@@ -0,0 +1,116 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/timer_wheel.h"
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_util.h"
+
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+namespace rpc {
+
+class TimerWheelTest : public KuduTest {
+ protected:
+  static MonoDelta Ms(int64_t ms) { return MonoDelta::FromMilliseconds(ms); }
+};
+
+// Tests that timers fire once their deadlines pass, and not before, including
+// the ones which expire on later turns of the wheel.
+TEST_F(TimerWheelTest, TestFiresAfterDeadline) {
+  const MonoTime start = MonoTime::Now();
+  TimerWheel wheel(Ms(10), 8, start);
+
+  vector<int> fired;
+  const vector<int> delays_ms = { 5, 10, 25, 79, 80, 81, 400 };
+  vector<unique_ptr<TimerWheel::Timer>> timers;
+  for (int delay_ms : delays_ms) {
+    timers.emplace_back(new TimerWheel::Timer);
+    timers.back()->set_callback([&fired, delay_ms]() { fired.push_back(delay_ms); });
+    wheel.Schedule(timers.back().get(), start + Ms(delay_ms));
+  }
+  ASSERT_EQ(delays_ms.size(), wheel.size());
+
+  for (int now_ms = 0; now_ms <= 500; now_ms++) {
+    wheel.Advance(start + Ms(now_ms));
+    for (int delay_ms : fired) {
+      ASSERT_LE(delay_ms, now_ms);
+      ASSERT_GT(delay_ms + 10, now_ms) << "fired more than a tick late";
+    }
+    for (const auto& t : timers) {
+      if (t->is_scheduled()) {
+        ASSERT_GT(t->deadline(), start + Ms(now_ms - 10));
+      }
+    }
+    fired.clear();
+  }
+  ASSERT_TRUE(wheel.empty());
+}
+
+// Tests that timers may be cancelled and rescheduled, including from the
+// callbacks of other timers firing on the same tick, and that advancing by
+// more than a turn of the wheel fires everything which expired.
+TEST_F(TimerWheelTest, TestCancelAndReschedule) {
+  const MonoTime start = MonoTime::Now();
+  TimerWheel wheel(Ms(10), 4, start);
+
+  int fired_a = 0;
+  int fired_b = 0;
+  unique_ptr<TimerWheel::Timer> a(new TimerWheel::Timer);
+  unique_ptr<TimerWheel::Timer> b(new TimerWheel::Timer);
+  TimerWheel::Timer c;
+  a->set_callback([&]() { fired_a++; b.reset(); });
+  b->set_callback([&]() { fired_b++; a.reset(); });
+  c.set_callback([&]() { wheel.Schedule(&c, start + Ms(1000)); });
+  wheel.Schedule(a.get(), start + Ms(20));
+  wheel.Schedule(b.get(), start + Ms(20));
+  wheel.Schedule(&c, start + Ms(15));
+
+  // Only one of 'a' and 'b' fires: the first one destroys the other.
+  wheel.Advance(start + Ms(30));
+  ASSERT_EQ(1, fired_a + fired_b);
+  ASSERT_EQ(1, wheel.size());
+  ASSERT_TRUE(c.is_scheduled());
+
+  // Rescheduling a timer moves it, cancelling it takes it off the wheel.
+  wheel.Schedule(&c, start + Ms(2000));
+  wheel.Advance(start + Ms(1500));
+  ASSERT_TRUE(c.is_scheduled());
+  wheel.Cancel(&c);
+  ASSERT_TRUE(wheel.empty());
+  wheel.Cancel(&c);
+
+  // A deadline in the past fires on the next tick.
+  int fired_late = 0;
+  TimerWheel::Timer late;
+  late.set_callback([&]() { fired_late++; });
+  wheel.Schedule(&late, start);
+  wheel.Advance(start + Ms(1505));
+  ASSERT_EQ(0, fired_late);
+  wheel.Advance(start + Ms(1510));
+  ASSERT_EQ(1, fired_late);
+}
+
+} // namespace rpc
+} // namespace kudu
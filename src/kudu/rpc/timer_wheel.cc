@@ -0,0 +1,138 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/timer_wheel.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace kudu {
+namespace rpc {
+
+TimerWheel::Timer::Timer()
+    : wheel_(nullptr),
+      slot_(0),
+      prev_(nullptr),
+      next_(nullptr),
+      expiry_tick_(0) {
+}
+
+TimerWheel::Timer::~Timer() {
+  if (wheel_) {
+    wheel_->Cancel(this);
+  }
+}
+
+TimerWheel::TimerWheel(MonoDelta tick, int num_slots, MonoTime now)
+    : tick_us_(std::max<int64_t>(1, tick.ToMicroseconds())),
+      start_(now),
+      slots_(std::max(1, num_slots) + 1, nullptr),
+      expired_slot_(slots_.size() - 1),
+      current_tick_(0),
+      size_(0) {
+}
+
+TimerWheel::~TimerWheel() {
+  for (Timer* head : slots_) {
+    for (Timer* t = head; t != nullptr; t = t->next_) {
+      t->wheel_ = nullptr;
+    }
+  }
+}
+
+int64_t TimerWheel::TickOf(MonoTime t) const {
+  return (t - start_).ToMicroseconds() / tick_us_;
+}
+
+void TimerWheel::Schedule(Timer* timer, MonoTime deadline) {
+  if (timer->wheel_) {
+    Cancel(timer);
+  }
+  // Round up, so that the timer doesn't fire before its deadline.
+  int64_t expiry_tick = ((deadline - start_).ToMicroseconds() + tick_us_ - 1) / tick_us_;
+  expiry_tick = std::max(expiry_tick, current_tick_ + 1);
+  timer->wheel_ = this;
+  timer->expiry_tick_ = expiry_tick;
+  timer->deadline_ = deadline;
+  Link(timer, expiry_tick % expired_slot_);
+  size_++;
+}
+
+void TimerWheel::Cancel(Timer* timer) {
+  if (!timer->wheel_) return;
+  DCHECK_EQ(this, timer->wheel_);
+  Unlink(timer);
+  timer->wheel_ = nullptr;
+  size_--;
+}
+
+void TimerWheel::Advance(MonoTime now) {
+  const int64_t now_tick = TickOf(now);
+  if (now_tick <= current_tick_) {
+    return;
+  }
+  // Once a whole turn of the wheel has passed, every slot has been looked at.
+  const int64_t last_tick = std::min<int64_t>(now_tick, current_tick_ + expired_slot_);
+  for (int64_t tick = current_tick_ + 1; tick <= last_tick; tick++) {
+    Timer* t = slots_[tick % expired_slot_];
+    while (t != nullptr) {
+      Timer* next = t->next_;
+      if (t->expiry_tick_ <= now_tick) {
+        Unlink(t);
+        Link(t, expired_slot_);
+      }
+      t = next;
+    }
+  }
+  current_tick_ = now_tick;
+
+  // The callbacks may cancel or destroy any of the expired timers which are
+  // yet to fire, which unlinks them from the list of expired timers.
+  while (Timer* t = slots_[expired_slot_]) {
+    Cancel(t);
+    if (t->callback_) {
+      t->callback_();
+    }
+  }
+}
+
+void TimerWheel::Link(Timer* timer, size_t slot) {
+  timer->slot_ = slot;
+  timer->prev_ = nullptr;
+  timer->next_ = slots_[slot];
+  if (timer->next_) {
+    timer->next_->prev_ = timer;
+  }
+  slots_[slot] = timer;
+}
+
+void TimerWheel::Unlink(Timer* timer) {
+  if (timer->prev_) {
+    timer->prev_->next_ = timer->next_;
+  } else {
+    slots_[timer->slot_] = timer->next_;
+  }
+  if (timer->next_) {
+    timer->next_->prev_ = timer->prev_;
+  }
+  timer->prev_ = nullptr;
+  timer->next_ = nullptr;
+}
+
+} // namespace rpc
+} // namespace kudu
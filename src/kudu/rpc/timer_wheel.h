@@ -0,0 +1,134 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+namespace rpc {
+
+// A hashed wheel of timers, for a reactor thread to arm and cancel large
+// numbers of timers, such as the timeouts of outbound calls, in constant
+// time rather than through libev's heap of timers.
+//
+// Time is divided into ticks, and each timer is kept in the slot of the
+// tick it expires at, modulo the number of slots, along with the number of
+// the tick. Advance() goes through the slots of the ticks which have passed
+// and runs the callbacks of the timers which expired, leaving the ones
+// which expire on later turns of the wheel in place. A timer never fires
+// before its deadline, but may fire up to a tick after it.
+//
+// This class is not thread-safe: the wheel and its timers are only used
+// from their reactor thread.
+class TimerWheel {
+ public:
+  class Timer {
+   public:
+    Timer();
+
+    // Cancels the timer if it's scheduled.
+    ~Timer();
+
+    // Sets the function to run when the timer fires.
+    void set_callback(std::function<void()> callback) {
+      callback_ = std::move(callback);
+    }
+
+    bool is_scheduled() const { return wheel_ != nullptr; }
+
+    // The deadline the timer was last scheduled for.
+    MonoTime deadline() const { return deadline_; }
+
+   private:
+    friend class TimerWheel;
+
+    std::function<void()> callback_;
+
+    // The wheel the timer is scheduled on, or nullptr if it isn't.
+    TimerWheel* wheel_;
+
+    // The slot the timer is linked into, and its neighbours there.
+    size_t slot_;
+    Timer* prev_;
+    Timer* next_;
+
+    // The tick at which the timer expires.
+    int64_t expiry_tick_;
+    MonoTime deadline_;
+
+    DISALLOW_COPY_AND_ASSIGN(Timer);
+  };
+
+  // Creates a wheel of 'num_slots' slots of 'tick' each, whose first tick
+  // starts at 'now'.
+  TimerWheel(MonoDelta tick, int num_slots, MonoTime now);
+
+  // Unschedules the timers left on the wheel, without running them.
+  ~TimerWheel();
+
+  // Schedules 'timer' to fire once 'deadline' has passed, rescheduling it
+  // if it was already scheduled. A deadline which has already passed fires
+  // on the next tick.
+  void Schedule(Timer* timer, MonoTime deadline);
+
+  // Unschedules 'timer'. Does nothing if it isn't scheduled.
+  void Cancel(Timer* timer);
+
+  // Fires the timers whose deadlines passed by 'now', in no particular order.
+  // The callbacks may schedule and cancel any timers, including the one
+  // firing, and may destroy it.
+  void Advance(MonoTime now);
+
+  // Returns the number of scheduled timers.
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  MonoDelta tick() const { return MonoDelta::FromMicroseconds(tick_us_); }
+
+ private:
+  // Returns the number of the tick 't' falls into.
+  int64_t TickOf(MonoTime t) const;
+
+  void Link(Timer* timer, size_t slot);
+  void Unlink(Timer* timer);
+
+  const int64_t tick_us_;
+  const MonoTime start_;
+
+  // The heads of the lists of timers, one for each slot, followed by the
+  // list of the timers which expired and are about to fire.
+  std::vector<Timer*> slots_;
+  const size_t expired_slot_;
+
+  // The last tick which Advance() went through.
+  int64_t current_tick_;
+
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+} // namespace rpc
+} // namespace kudu
@@ -21,9 +21,11 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include <set>
+#include <utility>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -79,9 +81,12 @@ using strings::Substitute;
 TransferCallbacks::~TransferCallbacks()
 {}
 
-InboundTransfer::InboundTransfer()
-  : total_length_(kMsgLengthPrefixLength),
+InboundTransfer::InboundTransfer(std::shared_ptr<ReceiveBufferPool> pool)
+  : pool_(std::move(pool)),
+    total_length_(kMsgLengthPrefixLength),
     cur_offset_(0) {
+  // Messages which aren't received into pooled buffers may be large batches.
+  buf_.AllowHugePages();
   buf_.resize(kMsgLengthPrefixLength);
 }
 
@@ -118,7 +123,12 @@ Status InboundTransfer::ReceiveBuffer(Socket &socket) {
       return Status::NetworkError(Substitute("RPC frame had invalid length of $0",
                                              total_length_));
     }
-    buf_.resize(total_length_);
+    if (pool_ && total_length_ >= ReceiveBufferPool::kMinBufferSize) {
+      pooled_buf_ = pool_->Allocate(total_length_);
+      memcpy(pooled_buf_.data(), buf_.data(), kMsgLengthPrefixLength);
+    } else {
+      buf_.resize(total_length_);
+    }
 
     // Fall through to receive the message body, which is likely to be already
     // available on the socket.
@@ -133,7 +143,8 @@ Status InboundTransfer::ReceiveBuffer(Socket &socket) {
   // currently only used for unit tests.
   int32_t rem = std::min(total_length_ - cur_offset_,
       static_cast<uint32_t>(std::numeric_limits<int32_t>::max()));
-  Status status = socket.Recv(&buf_[cur_offset_], rem, &nread);
+  uint8_t* buf = pooled_buf_ ? pooled_buf_.data() : buf_.data();
+  Status status = socket.Recv(buf + cur_offset_, rem, &nread);
   RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
   cur_offset_ += nread;
 
@@ -177,10 +188,8 @@ OutboundTransfer::OutboundTransfer(int32_t call_id,
     aborted_(false) {
 
   n_payload_slices_ = n_payload_slices;
-  CHECK_LE(n_payload_slices_, payload_slices_.size());
-  for (int i = 0; i < n_payload_slices; i++) {
-    payload_slices_[i] = payload[i];
-  }
+  CHECK_LE(n_payload_slices_, payload.size());
+  payload_slices_.assign(payload.begin(), payload.begin() + n_payload_slices);
 }
 
 OutboundTransfer::~OutboundTransfer() {
@@ -198,40 +207,61 @@ void OutboundTransfer::Abort(const Status &status) {
 }
 
 Status OutboundTransfer::SendBuffer(Socket &socket) {
-  CHECK_LT(cur_slice_idx_, n_payload_slices_);
-
-  started_ = true;
-  int n_iovecs = n_payload_slices_ - cur_slice_idx_;
-  struct iovec iovec[n_iovecs];
-  {
-    int offset_in_slice = cur_offset_in_slice_;
-    for (int i = 0; i < n_iovecs; i++) {
-      Slice &slice = payload_slices_[cur_slice_idx_ + i];
-      iovec[i].iov_base = slice.mutable_data() + offset_in_slice;
-      iovec[i].iov_len = slice.size() - offset_in_slice;
-
-      offset_in_slice = 0;
-    }
+  OutboundTransfer* transfer = this;
+  return SendBuffers(socket, &transfer, 1);
+}
+
+Status OutboundTransfer::SendBuffers(Socket& socket, OutboundTransfer* const* transfers,
+                                     size_t n_transfers) {
+  struct iovec iovec[IOV_MAX];
+  int n_iovecs = 0;
+  for (size_t i = 0; i < n_transfers; i++) {
+    OutboundTransfer* transfer = transfers[i];
+    CHECK_LT(transfer->cur_slice_idx_, transfer->n_payload_slices_);
+    transfer->started_ = true;
+    n_iovecs += transfer->FillIovecs(iovec + n_iovecs, IOV_MAX - n_iovecs);
   }
 
   int64_t written;
   Status status = socket.Writev(iovec, n_iovecs, &written);
   RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
 
+  for (size_t i = 0; i < n_transfers && written > 0; i++) {
+    transfers[i]->AdvanceBy(&written);
+  }
+  DCHECK_EQ(0, written);
+  return Status::OK();
+}
+
+int OutboundTransfer::FillIovecs(struct iovec* iovecs, int max_iovecs) {
+  int n_iovecs = std::min<int>(n_payload_slices_ - cur_slice_idx_, max_iovecs);
+  int offset_in_slice = cur_offset_in_slice_;
+  for (int i = 0; i < n_iovecs; i++) {
+    Slice &slice = payload_slices_[cur_slice_idx_ + i];
+    iovecs[i].iov_base = slice.mutable_data() + offset_in_slice;
+    iovecs[i].iov_len = slice.size() - offset_in_slice;
+
+    offset_in_slice = 0;
+  }
+  return n_iovecs;
+}
+
+void OutboundTransfer::AdvanceBy(int64_t* written) {
   // Adjust our accounting of current writer position.
   for (int i = cur_slice_idx_; i < n_payload_slices_; i++) {
     Slice &slice = payload_slices_[i];
     int rem_in_slice = slice.size() - cur_offset_in_slice_;
     DCHECK_GE(rem_in_slice, 0);
 
-    if (written >= rem_in_slice) {
+    if (*written >= rem_in_slice) {
       // Used up this entire slice, advance to the next slice.
       cur_slice_idx_++;
       cur_offset_in_slice_ = 0;
-      written -= rem_in_slice;
+      *written -= rem_in_slice;
     } else {
       // Partially used up this slice, just advance the offset within it.
-      cur_offset_in_slice_ += written;
+      cur_offset_in_slice_ += *written;
+      *written = 0;
       break;
     }
   }
@@ -243,8 +273,6 @@ Status OutboundTransfer::SendBuffer(Socket &socket) {
     DCHECK_LT(cur_slice_idx_, n_payload_slices_);
     DCHECK_LT(cur_offset_in_slice_, payload_slices_[cur_slice_idx_].size());
   }
-
-  return Status::OK();
 }
 
 bool OutboundTransfer::TransferStarted() const {
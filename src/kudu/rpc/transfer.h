@@ -18,11 +18,12 @@
 #ifndef KUDU_RPC_TRANSFER_H
 #define KUDU_RPC_TRANSFER_H
 
-#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <limits.h>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/intrusive/list_hook.hpp>
 #include <gflags/gflags_declare.h>
@@ -30,12 +31,15 @@
 
 #include "kudu/gutil/macros.h"
 #include "kudu/rpc/constants.h"
+#include "kudu/rpc/receive_buffer_pool.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
 DECLARE_int64(rpc_max_message_size);
 
+struct iovec;
+
 namespace kudu {
 
 class Socket;
@@ -55,7 +59,10 @@ class TransferLimits {
   DISALLOW_IMPLICIT_CONSTRUCTORS(TransferLimits);
 };
 
-typedef std::array<Slice, TransferLimits::kMaxPayloadSlices> TransferPayload;
+// The slices of a message to send. Holds at most kMaxPayloadSlices slices,
+// unless the message body was serialized gathered (see
+// RpcController::SetRequestGather()), in which case it's split further.
+typedef std::vector<Slice> TransferPayload;
 
 // This class is used internally by the RPC layer to represent an inbound
 // transfer in progress.
@@ -66,7 +73,10 @@ typedef std::array<Slice, TransferLimits::kMaxPayloadSlices> TransferPayload;
 class InboundTransfer {
  public:
 
-  InboundTransfer();
+  // If 'pool' is set, messages of at least ReceiveBufferPool::kMinBufferSize
+  // are received into a buffer from it, which is returned to it when this
+  // transfer is destroyed.
+  explicit InboundTransfer(std::shared_ptr<ReceiveBufferPool> pool = nullptr);
 
   // read from the socket into our buffer
   Status ReceiveBuffer(Socket &socket);
@@ -78,7 +88,7 @@ class InboundTransfer {
   bool TransferFinished() const;
 
   Slice data() const {
-    return Slice(buf_);
+    return pooled_buf_ ? Slice(pooled_buf_.data(), total_length_) : Slice(buf_);
   }
 
   // Return a string indicating the status of this transfer (number of bytes received, etc)
@@ -91,6 +101,11 @@ class InboundTransfer {
 
   faststring buf_;
 
+  // Holds the message instead of 'buf_' once its length is known, if it is
+  // large enough to come from 'pool_'.
+  const std::shared_ptr<ReceiveBufferPool> pool_;
+  ReceiveBufferPool::Buffer pooled_buf_;
+
   uint32_t total_length_;
   uint32_t cur_offset_;
 
@@ -114,8 +129,7 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
   // memory of the slices. The slices must remain valid until the callback
   // is triggered.
   //
-  // NOTE: 'payload' is currently restricted to a maximum of kMaxPayloadSlices
-  // slices.
+  // At most IOV_MAX slices are written to the socket at a time.
   // ------------------------------------------------------------
 
   // Create an outbound transfer for a call request.
@@ -141,6 +155,14 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
   // send from our buffers into the sock
   Status SendBuffer(Socket &socket);
 
+  // Sends as much of the 'n_transfers' transfers at 'transfers', in order,
+  // as 'socket' takes with a single writev, so that many small transfers
+  // don't each cost a system call and a packet. The first transfer may be
+  // partially sent already. Marks all of the transfers as started, even if
+  // no bytes of them were sent.
+  static Status SendBuffers(Socket& socket, OutboundTransfer* const* transfers,
+                            size_t n_transfers);
+
   // Return true if any bytes have yet been sent.
   bool TransferStarted() const;
 
@@ -169,8 +191,15 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
                    size_t n_payload_slices,
                    TransferCallbacks *callbacks);
 
-  // Slices to send. Uses an array here instead of a vector to avoid an expensive
-  // vector construction (improved performance a couple percent).
+  // Fills up to 'max_iovecs' of 'iovecs' with what is left to send, and
+  // returns how many it filled.
+  int FillIovecs(struct iovec* iovecs, int max_iovecs);
+
+  // Accounts for up to '*written' bytes having been sent, subtracting them
+  // from '*written', and notifies the callbacks if the transfer finished.
+  void AdvanceBy(int64_t* written);
+
+  // Slices to send.
   TransferPayload payload_slices_;
   size_t n_payload_slices_;
 
@@ -33,6 +33,7 @@
 
 #include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/macros.h"
+#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/security/ca/cert_management.h"
 #include "kudu/security/cert.h"
@@ -41,6 +42,7 @@
 #include "kudu/security/openssl_util.h"
 #include "kudu/security/security_flags.h"
 #include "kudu/security/tls_handshake.h"
+#include "kudu/util/env.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/scoped_cleanup.h"
@@ -90,6 +92,14 @@ TAG_FLAG(create_new_x509_store_each_time, experimental);
 DEFINE_bool(enable_normal_tls, false,
     "Whether to perform normal TLS handshake.");
 
+DEFINE_bool(rpc_tls_session_resumption, false,
+            "Whether clients resume the TLS session of their last connection to a "
+            "server when they reconnect to it, which saves the key exchange and the "
+            "certificate checks of a full handshake. Servers always let clients "
+            "resume their sessions.");
+TAG_FLAG(rpc_tls_session_resumption, experimental);
+TAG_FLAG(rpc_tls_session_resumption, runtime);
+
 namespace kudu {
 namespace security {
 
@@ -98,6 +108,17 @@ using ca::CertRequestGenerator;
 template<> struct SslTypeTraits<SSL> {
   static constexpr auto kFreeFunc = &SSL_free;
 };
+
+namespace {
+
+// The context of the sessions which servers let clients resume. Required to
+// resume sessions in which the client presented a certificate.
+const unsigned char kSessionIdContext[] = "kudu-rpc";
+
+// The most client sessions kept for resumption.
+const size_t kMaxCachedSessions = 1024;
+
+} // anonymous namespace
 template<> struct SslTypeTraits<X509_STORE_CTX> {
   static constexpr auto kFreeFunc = &X509_STORE_CTX_free;
 };
@@ -224,6 +245,11 @@ Status TlsContext::Init() {
 #endif
 #endif
 
+  OPENSSL_RET_NOT_OK(
+      SSL_CTX_set_session_id_context(ctx_.get(), kSessionIdContext,
+                                     sizeof(kSessionIdContext) - 1),
+      "failed to set TLS session id context");
+
   // TODO(KUDU-1926): is it possible to disable client-side renegotiation? it seems there
   // have been various CVEs related to this feature that we don't need.
   return Status::OK();
@@ -614,6 +640,28 @@ Status TlsContext::LoadCertFiles(const string& ca_path,
   return Status::OK();
 }
 
+Status TlsContext::LoadCertFilesIfChanged(const string& ca_path,
+                                          const string& certificate_path,
+                                          const string& key_path,
+                                          bool use_new_store) {
+  // The size and modification time of each file tell whether it changed.
+  string version;
+  for (const string* path : { &ca_path, &certificate_path, &key_path }) {
+    uint64_t size;
+    int64_t mtime;
+    RETURN_NOT_OK(Env::Default()->GetFileSize(*path, &size));
+    RETURN_NOT_OK(Env::Default()->GetFileModifiedTime(*path, &mtime));
+    version += Substitute("$0:$1:$2;", *path, size, mtime);
+  }
+  std::lock_guard<Mutex> l(cert_files_lock_);
+  if (version == loaded_cert_files_version_) {
+    return Status::OK();
+  }
+  RETURN_NOT_OK(LoadCertFiles(ca_path, certificate_path, key_path, use_new_store));
+  loaded_cert_files_version_ = std::move(version);
+  return Status::OK();
+}
+
 Status TlsContext::SetSupportedAlpns(
     const std::vector<std::string>& alpns,
     bool is_server) {
@@ -682,10 +730,21 @@ Status TlsContext::CreateSSL(TlsHandshake* handshake) const {
 }
 
 Status TlsContext::InitiateHandshake(TlsHandshakeType handshake_type,
-                                     TlsHandshake* handshake) const {
+                                     TlsHandshake* handshake,
+                                     const string& session_key) const {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   RETURN_NOT_OK(CreateSSL(handshake));
 
+  if (handshake_type == TlsHandshakeType::CLIENT && !session_key.empty() &&
+      FLAGS_rpc_tls_session_resumption) {
+    std::lock_guard<simple_spinlock> l(sessions_lock_);
+    const auto it = sessions_.find(session_key);
+    // If the server doesn't resume the session, the handshake is a full one.
+    if (it != sessions_.end() && SSL_set_session(handshake->ssl(), it->second.get()) != 1) {
+      return Status::RuntimeError("failed to set TLS session", GetOpenSSLErrors());
+    }
+  }
+
   SSL_set_bio(handshake->ssl(),
               BIO_new(BIO_s_mem()),
               BIO_new(BIO_s_mem()));
@@ -702,5 +761,28 @@ Status TlsContext::InitiateHandshake(TlsHandshakeType handshake_type,
   return Status::OK();
 }
 
+void TlsContext::CacheSession(const string& session_key, const TlsHandshake& handshake) const {
+  SCOPED_OPENSSL_NO_PENDING_ERRORS;
+  if (session_key.empty() || !FLAGS_rpc_tls_session_resumption) {
+    return;
+  }
+  SSL* ssl = handshake.ssl_.get();
+  CHECK(ssl);
+  // A session whose server certificate didn't verify, say because the server
+  // hadn't got a signed one yet, is left for a full handshake to redo.
+  if (SSL_get_verify_result(ssl) != X509_V_OK) {
+    return;
+  }
+  c_unique_ptr<SSL_SESSION> session = ssl_make_unique(SSL_get1_session(ssl));
+  if (!session) {
+    return;
+  }
+  std::lock_guard<simple_spinlock> l(sessions_lock_);
+  if (sessions_.size() >= kMaxCachedSessions && !ContainsKey(sessions_, session_key)) {
+    sessions_.clear();
+  }
+  sessions_[session_key] = std::move(session);
+}
+
 } // namespace security
 } // namespace kudu
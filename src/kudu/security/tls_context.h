@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/optional/optional.hpp>
@@ -28,6 +29,7 @@
 #include "kudu/security/openssl_util.h"
 #include "kudu/security/tls_handshake.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/rw_mutex.h"
 #include "kudu/util/status.h"
 // IWYU pragma: no_include "kudu/security/cert.h"
@@ -181,6 +183,14 @@ class TlsContext {
                        const std::string& key_path,
                        bool use_new_store) WARN_UNUSED_RESULT;
 
+  // Like LoadCertFiles(), but does nothing if none of the files changed size
+  // or modification time since the last time they were loaded by this method,
+  // so that calling it on each negotiation doesn't parse them every time.
+  Status LoadCertFilesIfChanged(const std::string& ca_path,
+                                const std::string& certificate_path,
+                                const std::string& key_path,
+                                bool use_new_store) WARN_UNUSED_RESULT;
+
   // Load the server certificate and key (PEM encoded).
   Status LoadCertificateAndKey(const std::string& certificate_path,
                                const std::string& key_path) WARN_UNUSED_RESULT;
@@ -220,8 +230,18 @@ class TlsContext {
   Status CreateSSL(TlsHandshake* handshake) const WARN_UNUSED_RESULT;
 
   // Initiates a new TlsHandshake instance.
+  //
+  // With --rpc_tls_session_resumption, a client handshake offers to resume
+  // the session cached for 'session_key', which identifies the server, if
+  // there is one.
   Status InitiateHandshake(TlsHandshakeType handshake_type,
-                           TlsHandshake* handshake) const WARN_UNUSED_RESULT;
+                           TlsHandshake* handshake,
+                           const std::string& session_key = "") const WARN_UNUSED_RESULT;
+
+  // Caches the session of 'handshake', a completed client handshake, for the
+  // next handshakes with 'session_key' to resume. Must be called before the
+  // handshake is finished. Does nothing without --rpc_tls_session_resumption.
+  void CacheSession(const std::string& session_key, const TlsHandshake& handshake) const;
 
   // Return the number of certs that have been marked as trusted.
   // Used by tests.
@@ -261,6 +281,15 @@ class TlsContext {
   // alpn protocols in wire format
   std::vector<unsigned char> server_alpns_;
   bool client_alpns_are_set_{false};
+
+  // The client sessions to resume, by session key. Protected by 'sessions_lock_'.
+  mutable simple_spinlock sessions_lock_;
+  mutable std::unordered_map<std::string, c_unique_ptr<SSL_SESSION>> sessions_;
+
+  // Serializes LoadCertFilesIfChanged(), and protects the sizes and
+  // modification times of the files it last loaded.
+  Mutex cert_files_lock_;
+  std::string loaded_cert_files_version_;
 };
 
 } // namespace security
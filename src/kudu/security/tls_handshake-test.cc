@@ -43,6 +43,7 @@
 using std::string;
 using std::vector;
 
+DECLARE_bool(rpc_tls_session_resumption);
 DECLARE_int32(ipki_server_key_size);
 
 namespace kudu {
@@ -215,6 +216,49 @@ TEST_F(TestTlsHandshake, TestHandshakeSequence) {
   ASSERT_EQ(buf2.size(), 0);
 }
 
+// A client which connects again resumes its session with the server, in which
+// case the client is the one to send the last handshake message.
+TEST_F(TestTlsHandshake, TestSessionResumption) {
+  FLAGS_rpc_tls_session_resumption = true;
+  PrivateKey ca_key;
+  Cert ca_cert;
+  ASSERT_OK(GenerateSelfSignedCAForTests(&ca_key, &ca_cert));
+  ASSERT_OK(ConfigureTlsContext(PkiConfig::SIGNED, ca_cert, ca_key, &client_tls_));
+  ASSERT_OK(ConfigureTlsContext(PkiConfig::SIGNED, ca_cert, ca_key, &server_tls_));
+
+  for (int i = 0; i < 2; i++) {
+    SCOPED_TRACE(i);
+    TlsHandshake client;
+    TlsHandshake server;
+    ASSERT_OK(client_tls_.InitiateHandshake(TlsHandshakeType::CLIENT, &client, "server"));
+    ASSERT_OK(server_tls_.InitiateHandshake(TlsHandshakeType::SERVER, &server));
+
+    string to_server;
+    string to_client;
+    ASSERT_TRUE(client.Continue("", &to_server).IsIncomplete());
+    ASSERT_TRUE(server.Continue(to_server, &to_client).IsIncomplete());
+    if (i == 0) {
+      // A full handshake.
+      ASSERT_TRUE(client.Continue(to_client, &to_server).IsIncomplete());
+      ASSERT_OK(server.Continue(to_server, &to_client));
+      ASSERT_OK(client.Continue(to_client, &to_server));
+      ASSERT_TRUE(to_server.empty());
+      ASSERT_FALSE(client.session_reused());
+    } else {
+      ASSERT_OK(client.Continue(to_client, &to_server));
+      ASSERT_FALSE(to_server.empty());
+      ASSERT_OK(server.Continue(to_server, &to_client));
+      ASSERT_TRUE(to_client.empty());
+      ASSERT_TRUE(client.session_reused());
+      ASSERT_TRUE(server.session_reused());
+      // The certificates are those of the resumed session.
+      Cert cert;
+      ASSERT_OK(server.GetRemoteCert(&cert));
+    }
+    client_tls_.CacheSession("server", client);
+  }
+}
+
 // Tests that the TlsContext can transition from self signed cert to signed
 // cert, and that it rejects invalid certs along the way. We are testing this
 // here instead of in a dedicated TlsContext test because it requires completing
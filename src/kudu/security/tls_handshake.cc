@@ -20,6 +20,7 @@
 #include <memory>
 #include <string>
 
+#include <gflags/gflags.h>
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -28,6 +29,8 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/security/cert.h"
 #include "kudu/security/tls_socket.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
 #include "kudu/util/net/socket.h"
 #include "kudu/util/status.h"
 #include "kudu/util/trace.h"
@@ -36,6 +39,15 @@
 #include "kudu/security/x509_check_host.h"
 #endif // OPENSSL_VERSION_NUMBER
 
+DEFINE_bool(rpc_tls_kernel_offload, false,
+            "Whether to install the keys of TLS sessions into the kernel (kTLS) once "
+            "they are established, so that the kernel rather than OpenSSL encrypts "
+            "what is sent on the connections. Only TLS 1.2 sessions with an AES-GCM "
+            "cipher are offloaded, on Linux kernels with the 'tls' module; other "
+            "connections are encrypted by OpenSSL as before.");
+TAG_FLAG(rpc_tls_kernel_offload, experimental);
+TAG_FLAG(rpc_tls_kernel_offload, runtime);
+
 using std::string;
 using std::unique_ptr;
 using strings::Substitute;
@@ -120,7 +132,7 @@ Status TlsHandshake::SSLHandshake(std::unique_ptr<Socket>* socket, bool is_serve
   }
 
   // Transfer the SSL instance to the socket.
-  socket->reset(new TlsSocket(fd, std::move(ssl_)));
+  *socket = WrapSocket(fd);
 
   return Status::OK();
 }
@@ -262,11 +274,23 @@ Status TlsHandshake::Finish(unique_ptr<Socket>* socket) {
   }
 
   // Transfer the SSL instance to the socket.
-  socket->reset(new TlsSocket(fd, std::move(ssl_)));
+  *socket = WrapSocket(fd);
 
   return Status::OK();
 }
 
+unique_ptr<Socket> TlsHandshake::WrapSocket(int fd) {
+  unique_ptr<TlsSocket> socket(new TlsSocket(fd, std::move(ssl_)));
+  if (FLAGS_rpc_tls_kernel_offload) {
+    Status s = socket->EnableKernelTlsSend();
+    if (!s.ok()) {
+      KLOG_EVERY_N_SECS(INFO, 60) << "TLS encryption not offloaded to the kernel: "
+                                  << s.ToString();
+    }
+  }
+  return unique_ptr<Socket>(socket.release());
+}
+
 Status TlsHandshake::FinishNoWrap(const Socket& socket) {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   RETURN_NOT_OK(GetCerts());
@@ -303,6 +327,11 @@ string TlsHandshake::GetProtocol() const {
   return SSL_get_version(ssl_.get());
 }
 
+bool TlsHandshake::session_reused() const {
+  CHECK(has_started_);
+  return SSL_session_reused(ssl_.get());
+}
+
 string TlsHandshake::GetCipherDescription() const {
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   CHECK(has_started_);
@@ -140,6 +140,11 @@ class TlsHandshake {
   // Only valid to call after the handshake is complete and before 'Finish()'.
   std::string GetCipherDescription() const;
 
+  // Whether the handshake resumed an earlier session rather than doing a full
+  // handshake. Only valid to call after the handshake is complete and before
+  // 'Finish()'.
+  bool session_reused() const;
+
  private:
   friend class TlsContext;
 
@@ -166,6 +171,10 @@ class TlsHandshake {
   // Verifies that the handshake is valid for the provided socket.
   Status Verify(const Socket& socket) const WARN_UNUSED_RESULT;
 
+  // Transfers 'ssl_' to a new TlsSocket on 'fd', offloading its encryption
+  // to the kernel if --rpc_tls_kernel_offload is set.
+  std::unique_ptr<Socket> WrapSocket(int fd);
+
   // Owned SSL handle.
   c_unique_ptr<SSL> ssl_;
 
@@ -17,15 +17,30 @@
 
 #include "kudu/security/tls_socket.h"
 
+#include <sys/socket.h>
 #include <sys/uio.h>
 
+#if defined(__linux__)
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif // defined(__linux__)
+
+#include <algorithm>
 #include <cerrno>
 #include <cstddef>
+#include <cstring>
 #include <string>
 #include <utility>
 
 #include <glog/logging.h>
+#include <openssl/bio.h>
+#include <openssl/crypto.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/obj_mac.h>
+#include <openssl/ssl.h>
 
 #include "kudu/gutil/basictypes.h"
 #include "kudu/gutil/strings/substitute.h"
@@ -34,19 +49,191 @@
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/net/socket.h"
 
+#if defined(__linux__) && defined(TLS_TX) && OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define KUDU_HAS_KERNEL_TLS 1
+#endif
+
 namespace kudu {
 namespace security {
 
+#ifdef KUDU_HAS_KERNEL_TLS
+namespace {
+
+// The TLS 1.2 alert record which the socket sends when it's closed.
+const unsigned char kTlsAlertRecordType = 21;
+const unsigned char kCloseNotifyAlert[] = { 1 /* warning */, 0 /* close_notify */ };
+
+// The longest AES-GCM key, of AES-256.
+const size_t kMaxKeyLen = 32;
+
+// The TLS 1.2 PRF (RFC 5246, section 5) of 'secret' over 'label' and 'seed',
+// filling 'out_len' bytes of 'out'.
+bool Tls12Prf(const EVP_MD* md, const uint8_t* secret, size_t secret_len,
+              const std::string& label_and_seed, uint8_t* out, size_t out_len) {
+  uint8_t a[EVP_MAX_MD_SIZE];
+  unsigned int a_len;
+  // A(1) = HMAC(secret, seed)
+  if (!HMAC(md, secret, secret_len,
+            reinterpret_cast<const uint8_t*>(label_and_seed.data()), label_and_seed.size(),
+            a, &a_len)) {
+    return false;
+  }
+  while (out_len > 0) {
+    // P_hash = HMAC(secret, A(i) + seed) + ...
+    std::string input(reinterpret_cast<const char*>(a), a_len);
+    input.append(label_and_seed);
+    uint8_t block[EVP_MAX_MD_SIZE];
+    unsigned int block_len;
+    if (!HMAC(md, secret, secret_len, reinterpret_cast<const uint8_t*>(input.data()),
+              input.size(), block, &block_len)) {
+      return false;
+    }
+    size_t n = std::min<size_t>(block_len, out_len);
+    memcpy(out, block, n);
+    out += n;
+    out_len -= n;
+    OPENSSL_cleanse(block, sizeof(block));
+    // A(i+1) = HMAC(secret, A(i))
+    uint8_t next_a[EVP_MAX_MD_SIZE];
+    if (!HMAC(md, secret, secret_len, a, a_len, next_a, &a_len)) {
+      return false;
+    }
+    memcpy(a, next_a, a_len);
+  }
+  OPENSSL_cleanse(a, sizeof(a));
+  return true;
+}
+
+} // anonymous namespace
+#endif // KUDU_HAS_KERNEL_TLS
+
 TlsSocket::TlsSocket(int fd, c_unique_ptr<SSL> ssl)
     : Socket(fd),
-      ssl_(std::move(ssl)) {
+      ssl_(std::move(ssl)),
+      kernel_tls_send_(false) {
 }
 
 TlsSocket::~TlsSocket() {
   ignore_result(Close());
 }
 
+Status TlsSocket::EnableKernelTlsSend() {
+  SCOPED_OPENSSL_NO_PENDING_ERRORS;
+  CHECK(ssl_);
+  CHECK(!kernel_tls_send_);
+#ifdef KUDU_HAS_KERNEL_TLS
+  SSL* ssl = ssl_.get();
+  if (SSL_version(ssl) != TLS1_2_VERSION) {
+    return Status::NotSupported("kernel TLS offload requires TLS 1.2",
+                                SSL_get_version(ssl));
+  }
+  const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl);
+  const int cipher_nid = cipher ? SSL_CIPHER_get_cipher_nid(cipher) : NID_undef;
+  size_t key_len;
+  if (cipher_nid == NID_aes_128_gcm) {
+    key_len = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+#ifdef TLS_CIPHER_AES_GCM_256
+  } else if (cipher_nid == NID_aes_256_gcm) {
+    key_len = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+#endif
+  } else {
+    return Status::NotSupported("kernel TLS offload requires an AES-GCM cipher",
+                                cipher ? SSL_CIPHER_get_name(cipher) : "none");
+  }
+  const EVP_MD* md = SSL_CIPHER_get_handshake_digest(cipher);
+  if (!md) {
+    return Status::NotSupported("unknown PRF digest of cipher", SSL_CIPHER_get_name(cipher));
+  }
+
+  // Derive the key block (RFC 5246, section 6.3) of the session. AES-GCM
+  // suites have no MAC keys, so it is made of the client and server write
+  // keys followed by the client and server implicit nonces ("salts").
+  const size_t kSaltLen = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+  uint8_t master_key[SSL_MAX_MASTER_KEY_LENGTH];
+  size_t master_key_len = SSL_SESSION_get_master_key(SSL_get_session(ssl), master_key,
+                                                     sizeof(master_key));
+  std::string label_and_seed = "key expansion";
+  uint8_t random[SSL3_RANDOM_SIZE];
+  label_and_seed.append(reinterpret_cast<const char*>(random),
+                        SSL_get_server_random(ssl, random, sizeof(random)));
+  label_and_seed.append(reinterpret_cast<const char*>(random),
+                        SSL_get_client_random(ssl, random, sizeof(random)));
+  uint8_t key_block[2 * (kMaxKeyLen + kSaltLen)];
+  const size_t key_block_len = 2 * (key_len + kSaltLen);
+  bool derived = master_key_len > 0 &&
+      Tls12Prf(md, master_key, master_key_len, label_and_seed, key_block, key_block_len);
+  OPENSSL_cleanse(master_key, sizeof(master_key));
+  if (!derived) {
+    return Status::RuntimeError("failed to derive the TLS session keys", GetOpenSSLErrors());
+  }
+  const bool is_server = SSL_is_server(ssl);
+  const uint8_t* write_key = key_block + (is_server ? key_len : 0);
+  const uint8_t* write_salt = key_block + 2 * key_len + (is_server ? kSaltLen : 0);
+
+  // The handshake is over and nothing but the Finished message has been sent
+  // with the session keys yet, so the next record is the second one. The
+  // explicit nonce of each record is its sequence number, as with OpenSSL.
+  uint8_t rec_seq[TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  union {
+    struct tls12_crypto_info_aes_gcm_128 aes_128;
+#ifdef TLS_CIPHER_AES_GCM_256
+    struct tls12_crypto_info_aes_gcm_256 aes_256;
+#endif
+  } crypto_info;
+  memset(&crypto_info, 0, sizeof(crypto_info));
+  socklen_t crypto_info_len = 0;
+  if (key_len == TLS_CIPHER_AES_GCM_128_KEY_SIZE) {
+    auto* info = &crypto_info.aes_128;
+    info->info.version = TLS_1_2_VERSION;
+    info->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+    memcpy(info->key, write_key, key_len);
+    memcpy(info->salt, write_salt, kSaltLen);
+    memcpy(info->iv, rec_seq, sizeof(info->iv));
+    memcpy(info->rec_seq, rec_seq, sizeof(info->rec_seq));
+    crypto_info_len = sizeof(*info);
+  } else {
+#ifdef TLS_CIPHER_AES_GCM_256
+    auto* info = &crypto_info.aes_256;
+    info->info.version = TLS_1_2_VERSION;
+    info->info.cipher_type = TLS_CIPHER_AES_GCM_256;
+    memcpy(info->key, write_key, key_len);
+    memcpy(info->salt, write_salt, kSaltLen);
+    memcpy(info->iv, rec_seq, sizeof(info->iv));
+    memcpy(info->rec_seq, rec_seq, sizeof(info->rec_seq));
+    crypto_info_len = sizeof(*info);
+#endif
+  }
+  OPENSSL_cleanse(key_block, sizeof(key_block));
+
+  // If either call fails the socket keeps working as a plain TCP socket, so
+  // OpenSSL carries on encrypting.
+  int err = 0;
+  if (setsockopt(GetFd(), SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+    err = errno;
+  } else if (setsockopt(GetFd(), SOL_TLS, TLS_TX, &crypto_info, crypto_info_len) != 0) {
+    err = errno;
+  }
+  OPENSSL_cleanse(&crypto_info, sizeof(crypto_info));
+  if (err != 0) {
+    return Status::NetworkError("failed to install the TLS session keys into the kernel",
+                                ErrnoToString(err), err);
+  }
+
+  // The kernel now owns the write side of the session. Whatever OpenSSL
+  // would still write, like its close_notify alert, goes nowhere instead of
+  // corrupting the stream; Close() has the kernel send the alert.
+  SSL_set0_wbio(ssl, BIO_new(BIO_s_null()));
+  kernel_tls_send_ = true;
+  return Status::OK();
+#else
+  return Status::NotSupported("kernel TLS offload isn't supported by this build");
+#endif // KUDU_HAS_KERNEL_TLS
+}
+
 Status TlsSocket::Write(const uint8_t *buf, int32_t amt, int32_t *nwritten) {
+  if (kernel_tls_send_) {
+    return Socket::Write(buf, amt, nwritten);
+  }
   CHECK(ssl_);
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
 
@@ -79,6 +266,10 @@ Status TlsSocket::Write(const uint8_t *buf, int32_t amt, int32_t *nwritten) {
 }
 
 Status TlsSocket::Writev(const struct ::iovec *iov, int iov_len, int64_t *nwritten) {
+  if (kernel_tls_send_) {
+    // The kernel encrypts what is written, so there is nothing to emulate.
+    return Socket::Writev(iov, iov_len, nwritten);
+  }
   SCOPED_OPENSSL_NO_PENDING_ERRORS;
   CHECK(ssl_);
 
@@ -220,6 +411,30 @@ Status TlsSocket::Close() {
     return Status::OK();
   }
 
+#ifdef KUDU_HAS_KERNEL_TLS
+  if (kernel_tls_send_) {
+    // OpenSSL can't write to the socket anymore, so the close_notify alert
+    // is sent as a record of its own by the kernel.
+    char cbuf[CMSG_SPACE(sizeof(kTlsAlertRecordType))];
+    memset(cbuf, 0, sizeof(cbuf));
+    struct iovec iov;
+    iov.iov_base = const_cast<unsigned char*>(kCloseNotifyAlert);
+    iov.iov_len = sizeof(kCloseNotifyAlert);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(kTlsAlertRecordType));
+    *CMSG_DATA(cmsg) = kTlsAlertRecordType;
+    ignore_result(sendmsg(GetFd(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL));
+  }
+#endif // KUDU_HAS_KERNEL_TLS
+
   // Start the TLS shutdown processes. We don't care about waiting for the
   // response, since the underlying socket will not be reused.
   int32_t ret = SSL_shutdown(ssl_.get());
@@ -47,17 +47,32 @@ class TlsSocket : public Socket {
 
   Status Close() override WARN_UNUSED_RESULT;
 
+  // Whether the kernel encrypts what is written to the socket.
+  bool kernel_tls_send() const { return kernel_tls_send_; }
+
  private:
 
   friend class TlsHandshake;
 
   TlsSocket(int fd, c_unique_ptr<SSL> ssl);
 
+  // Installs the write keys of the session into the kernel (kTLS), so that
+  // writes go straight to the socket and are encrypted by the kernel, or by
+  // the NIC if it supports TLS offload. Reads are still decrypted by
+  // OpenSSL. Must be called right after the handshake, before anything is
+  // written, and only for TLS 1.2 sessions with an AES-GCM cipher. Returns
+  // NotSupported if the session or the build can't be offloaded, in which
+  // case the socket keeps working as before.
+  Status EnableKernelTlsSend() WARN_UNUSED_RESULT;
+
   // Owned SSL handle.
   c_unique_ptr<SSL> ssl_;
 
   // Socket-local buffer used by Writev().
   faststring buf_;
+
+  // Whether EnableKernelTlsSend() succeeded.
+  bool kernel_tls_send_;
 };
 
 } // namespace security
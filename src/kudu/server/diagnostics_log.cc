@@ -17,6 +17,7 @@
 
 #include "kudu/server/diagnostics_log.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -41,10 +42,12 @@
 #include "kudu/util/env.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/jsonwriter.h"
+#include "kudu/util/lock_profile.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
+#include "kudu/util/op_timeline.h"
 #include "kudu/util/random.h"
 #include "kudu/util/random_util.h"
 #include "kudu/util/rolling_log.h"
@@ -84,6 +87,9 @@ TAG_FLAG(diagnostics_log_stack_traces_interval_ms, experimental);
 namespace kudu {
 namespace server {
 
+// The number of holder call sites logged for each lock.
+static const int kMaxLockHolderSites = 5;
+
 // Track which symbols have been emitted to the log already.
 class DiagnosticsLog::SymbolSet {
  public:
@@ -234,6 +240,8 @@ void DiagnosticsLog::RunThread() {
     Status s;
     if (what == WakeupType::METRICS) {
       WARN_NOT_OK(LogMetrics(), "Unable to collect metrics to diagnostics log");
+      WARN_NOT_OK(LogLockProfiles(), "Unable to collect lock profiles to diagnostics log");
+      WARN_NOT_OK(LogOpTimelines(), "Unable to collect op timelines to diagnostics log");
     }
 
 #ifdef FB_DO_NOT_REMOVE
@@ -375,6 +383,39 @@ Status DiagnosticsLog::LogMetrics() {
   return Status::OK();
 }
 
+Status DiagnosticsLog::LogLockProfiles() {
+  // Like metrics, locks which were never waited for aren't logged.
+  vector<LockProfile*> profiles = LockProfile::GetAll();
+  if (std::none_of(profiles.begin(), profiles.end(),
+                   [](const LockProfile* p) { return p->wait_count() > 0; })) {
+    return Status::OK();
+  }
+
+  std::ostringstream buf;
+  MicrosecondsInt64 now = GetCurrentTimeMicros();
+  buf << "I" << FormatTimestampForLog(now)
+      << " locks " << now << " ";
+  JsonWriter writer(&buf, JsonWriter::COMPACT);
+  LockProfile::WriteAllAsJson(&writer, kMaxLockHolderSites);
+  buf << "\n";
+  return log_->Append(buf.str());
+}
+
+Status DiagnosticsLog::LogOpTimelines() {
+  std::ostringstream timelines;
+  JsonWriter writer(&timelines, JsonWriter::COMPACT);
+  OpTimeline::WriteFinishedAsJson(&writer);
+  if (timelines.str() == "[]") {
+    return Status::OK();
+  }
+
+  std::ostringstream buf;
+  MicrosecondsInt64 now = GetCurrentTimeMicros();
+  buf << "I" << FormatTimestampForLog(now)
+      << " op_timelines " << now << " " << timelines.str() << "\n";
+  return log_->Append(buf.str());
+}
+
 
 } // namespace server
 } // namespace kudu
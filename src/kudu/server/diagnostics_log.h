@@ -65,6 +65,8 @@ class DiagnosticsLog {
 
   void RunThread();
   Status LogMetrics();
+  Status LogLockProfiles();
+  Status LogOpTimelines();
 #ifdef FB_DO_NOT_REMOVE
   Status LogStacks(const std::string& reason);
 #endif
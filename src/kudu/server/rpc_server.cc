@@ -154,6 +154,7 @@ Status RpcServer::RegisterService(gscoped_ptr<rpc::ServiceIf> service) {
   scoped_refptr<rpc::ServicePool> service_pool =
     new rpc::ServicePool(std::move(service), messenger_->metric_entity(),
                          options_.service_queue_length);
+  service_pool->set_numa_nodes(messenger_->reactor_numa_nodes());
   RETURN_NOT_OK(service_pool->Init(options_.num_service_threads));
   auto* service_pool_raw_ptr = service_pool.get();
   service_pool->set_too_busy_hook([this, service_pool_raw_ptr]() {
@@ -78,6 +78,7 @@
 #include "kudu/util/flag_validators.h"
 #include "kudu/util/flags.h"
 #include "kudu/util/jsonwriter.h"
+#include "kudu/util/lock_profile.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
@@ -95,6 +96,15 @@
 DEFINE_int32(num_reactor_threads, 4, "Number of libev reactor threads to start.");
 TAG_FLAG(num_reactor_threads, advanced);
 
+DEFINE_string(rpc_reactor_cpu_affinity, "none",
+              "How to pin the RPC reactor threads to CPUs: 'none', 'core' to pin each "
+              "to a CPU, or 'numa_node' to pin each to the CPUs of a NUMA node. The "
+              "reactors are spread across the NUMA nodes. When they are pinned, "
+              "inbound connections are handed to a reactor on the CPU or NUMA node "
+              "which their packets are processed on, and the service threads are "
+              "pinned to the reactors' NUMA nodes to handle the calls received there.");
+TAG_FLAG(rpc_reactor_cpu_affinity, experimental);
+
 DEFINE_int32(min_negotiation_threads, 0, "Minimum number of connection negotiation threads.");
 TAG_FLAG(min_negotiation_threads, advanced);
 
@@ -106,6 +116,14 @@ DEFINE_int64(rpc_negotiation_timeout_ms, 3000,
 TAG_FLAG(rpc_negotiation_timeout_ms, advanced);
 TAG_FLAG(rpc_negotiation_timeout_ms, runtime);
 
+DEFINE_bool(server_parallel_init, false,
+            "If true, the server builds its RPC messenger, which sets up its "
+            "TLS context and starts its reactors, while it opens its "
+            "filesystem, and the tablet manager opens the system tablet's WAL "
+            "while it sets up Raft from the consensus metadata, rather than "
+            "one after the other.");
+TAG_FLAG(server_parallel_init, experimental);
+
 DEFINE_bool(webserver_enabled, true, "Whether to enable the web server on this daemon. "
             "NOTE: disabling the web server is also likely to prevent monitoring systems "
             "from properly capturing metrics.");
@@ -198,6 +216,17 @@ TAG_FLAG(rpc_default_keepalive_time_ms, advanced);
 
 DECLARE_bool(use_hybrid_clock);
 
+METRIC_DEFINE_gauge_int64(server, startup_fs_open_duration,
+                          "Startup Filesystem Open Duration",
+                          kudu::MetricUnit::kMilliseconds,
+                          "Time the server took to open or create its filesystem "
+                          "layout when it started.");
+METRIC_DEFINE_gauge_int64(server, startup_messenger_build_duration,
+                          "Startup Messenger Build Duration",
+                          kudu::MetricUnit::kMilliseconds,
+                          "Time the server took to build its RPC messenger, "
+                          "including its TLS context, when it started.");
+
 using kudu::security::RpcAuthentication;
 using kudu::security::RpcEncryption;
 using std::ostringstream;
@@ -349,7 +378,8 @@ ServerBase::ServerBase(string name, const ServerBaseOptions& options,
                                                       metric_namespace)),
       rpc_server_(new RpcServer(options.rpc_opts)),
       result_tracker_(new rpc::ResultTracker(shared_ptr<MemTracker>(
-          MemTracker::CreateTracker(-1, "result-tracker", mem_tracker_)))),
+          MemTracker::CreateTracker(-1, "result-tracker", mem_tracker_,
+                                    MemTracker::Accounting::BATCHED)))),
       is_first_run_(false),
       options_(options),
       stop_background_threads_latch_(1) {
@@ -444,6 +474,51 @@ Status ServerBase::Init() {
 
   RETURN_NOT_OK(security::InitKerberosForServer(FLAGS_principal, FLAGS_keytab_file));
 
+  const MonoTime fs_open_start = MonoTime::Now();
+  if (FLAGS_server_parallel_init) {
+    // The messenger doesn't depend on the filesystem, and setting up its TLS
+    // context and reactors may take as long as opening the filesystem.
+    Status messenger_status;
+    scoped_refptr<Thread> messenger_thread;
+    RETURN_NOT_OK(Thread::Create("server", "init-messenger",
+                                 [this, &messenger_status]() {
+                                   messenger_status = BuildMessenger();
+                                 },
+                                 &messenger_thread));
+    Status fs_status = OpenFs();
+    METRIC_startup_fs_open_duration.Instantiate(
+        metric_entity_, (MonoTime::Now() - fs_open_start).ToMilliseconds());
+    messenger_thread->Join();
+    RETURN_NOT_OK(fs_status);
+    RETURN_NOT_OK(messenger_status);
+    RETURN_NOT_OK(InitAcls());
+  } else {
+    RETURN_NOT_OK(OpenFs());
+    METRIC_startup_fs_open_duration.Instantiate(
+        metric_entity_, (MonoTime::Now() - fs_open_start).ToMilliseconds());
+    RETURN_NOT_OK(InitAcls());
+    RETURN_NOT_OK(BuildMessenger());
+  }
+
+  rpc_server_->set_too_busy_hook(std::bind(
+      &ServerBase::ServiceQueueOverflowed, this, std::placeholders::_1));
+
+  RETURN_NOT_OK(rpc_server_->Init(messenger_));
+
+  // Bind the RPC server so that the
+  // local raft peer can be initialized
+  RETURN_NOT_OK(rpc_server_->Bind());
+  clock_->RegisterMetrics(metric_entity_);
+
+  RETURN_NOT_OK_PREPEND(StartMetricsLogging(), "Could not enable metrics logging");
+
+  result_tracker_->StartGCThread();
+  RETURN_NOT_OK(StartExcessLogFileDeleterThread());
+
+  return Status::OK();
+}
+
+Status ServerBase::OpenFs() {
   fs::FsReport report;
   Status s = fs_manager_->Open(&report);
   if (s.IsNotFound()) {
@@ -467,9 +542,11 @@ Status ServerBase::Init() {
   }
   RETURN_NOT_OK_PREPEND(s, "Failed to load FS layout");
   RETURN_NOT_OK(report.LogAndCheckForFatalErrors());
+  return Status::OK();
+}
 
-  RETURN_NOT_OK(InitAcls());
-
+Status ServerBase::BuildMessenger() {
+  const MonoTime start = MonoTime::Now();
   // Create the Messenger.
   rpc::MessengerBuilder builder(name_);
 
@@ -487,6 +564,7 @@ Status ServerBase::Init() {
          .set_epki_certificate_authority_file(FLAGS_rpc_ca_certificate_file)
          .set_epki_private_password_key_cmd(FLAGS_rpc_private_key_password_cmd)
          .set_keytab_file(FLAGS_keytab_file)
+         .set_reactor_cpu_affinity(FLAGS_rpc_reactor_cpu_affinity)
          .enable_inbound_tls();
 
   if (options_.rpc_opts.rpc_reuseport) {
@@ -503,21 +581,8 @@ Status ServerBase::Init() {
   builder.set_receive_buf(options_.rpc_opts.receive_buffer_size);
 
   RETURN_NOT_OK(builder.Build(&messenger_));
-  rpc_server_->set_too_busy_hook(std::bind(
-      &ServerBase::ServiceQueueOverflowed, this, std::placeholders::_1));
-
-  RETURN_NOT_OK(rpc_server_->Init(messenger_));
-
-  // Bind the RPC server so that the
-  // local raft peer can be initialized
-  RETURN_NOT_OK(rpc_server_->Bind());
-  clock_->RegisterMetrics(metric_entity_);
-
-  RETURN_NOT_OK_PREPEND(StartMetricsLogging(), "Could not enable metrics logging");
-
-  result_tracker_->StartGCThread();
-  RETURN_NOT_OK(StartExcessLogFileDeleterThread());
-
+  METRIC_startup_messenger_build_duration.Instantiate(
+      metric_entity_, (MonoTime::Now() - start).ToMilliseconds());
   return Status::OK();
 }
 
@@ -725,6 +790,7 @@ Status ServerBase::Start() {
     AddRpczPathHandlers(messenger_, web_server_.get());
     RegisterMetricsJsonHandler(web_server_.get(), metric_registry_.get());
     TracingPathHandlers::RegisterHandlers(web_server_.get());
+    RegisterLockProfilePathHandler(web_server_.get());
     web_server_->set_footer_html(FooterHtml());
     RETURN_NOT_OK(web_server_->Start());
   }
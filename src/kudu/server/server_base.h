@@ -203,6 +203,12 @@ class ServerBase {
   // The ACL of users who may act as part of the Kudu service.
   security::SimpleAcl service_acl_;
  private:
+  // Opens the filesystem layout, creating it on the first run.
+  Status OpenFs();
+
+  // Builds 'messenger_'.
+  Status BuildMessenger();
+
   Status InitAcls();
   void GenerateInstanceID();
   Status DumpServerInfo(const std::string& path,
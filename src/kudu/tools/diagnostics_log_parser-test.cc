@@ -17,14 +17,18 @@
 
 #include "kudu/tools/diagnostics_log_parser.h"
 
+#include <cstdint>
 #include <memory>
 #include <ostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include <gtest/gtest.h>
 #include <rapidjson/document.h>
 
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/hdr_histogram.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 
@@ -35,6 +39,7 @@ using std::string;
 using std::stringstream;
 using std::unique_ptr;
 using std::vector;
+using strings::Substitute;
 
 TEST(DiagLogParserTest, TestParseLine) {
   // Lines have the following format:
@@ -232,5 +237,74 @@ TEST(DiagLogParserTest, TestParseStacks) {
   ASSERT_OK(lp.ParseLine(line));
 }
 
+TEST(DiagLogParserTest, TestParseOpTimelines) {
+  NoopLogVisitor lv;
+  LogParser lp(&lv);
+
+  string line = "I0220 17:38:09.950546 op_timelines 1519177089950546 {}";
+  Status s = lp.ParseLine(line);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_STR_CONTAINS(s.ToString(), "expected op timelines data to be a JSON array");
+
+  line = "I0220 17:38:09.950546 op_timelines 1519177089950546 [{\"tablet_id\" : \"t\"}]";
+  s = lp.ParseLine(line);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_STR_CONTAINS(s.ToString(), "no 'term' field in op timeline");
+
+  line = "I0220 17:38:09.950546 op_timelines 1519177089950546 "
+         "[{\"tablet_id\":\"t\",\"term\":1,\"index\":10,\"start_us\":100,"
+         "\"applied\":true,\"events\":[{\"stage\":\"enqueue\"}]}]";
+  s = lp.ParseLine(line);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_STR_CONTAINS(s.ToString(), "expected op timeline events to have a stage and a time");
+}
+
+// The stages of the timelines in the window are aggregated, each from the
+// stage it follows.
+TEST(DiagLogParserTest, TestAggregateOpTimelines) {
+  OpTimelineAggregatingLogVisitor lv(1000, 2000);
+  LogParser lp(&lv);
+
+  auto timeline = [](int64_t index, int64_t start_us) {
+    return Substitute(
+        "{\"tablet_id\":\"t\",\"term\":1,\"index\":$0,\"start_us\":$1,"
+        "\"applied\":true,\"events\":["
+        "{\"stage\":\"enqueue\",\"us\":0},"
+        "{\"stage\":\"peer_send\",\"peer\":\"p\",\"us\":10},"
+        "{\"stage\":\"wal_write\",\"us\":20},"
+        "{\"stage\":\"peer_send\",\"peer\":\"p\",\"us\":25},"
+        "{\"stage\":\"fsync\",\"us\":120},"
+        "{\"stage\":\"peer_ack\",\"peer\":\"p\",\"us\":310},"
+        "{\"stage\":\"commit\",\"us\":320},"
+        "{\"stage\":\"apply\",\"us\":$2}]}",
+        index, start_us, 320 + index);
+  };
+  // Only the first two timelines are in the window.
+  string line = Substitute("I0220 17:38:09.950546 op_timelines 1519177089950546 [$0,$1,$2]",
+                           timeline(10, 1000), timeline(20, 1999), timeline(30, 2000));
+  ASSERT_OK(lp.ParseLine(line));
+  ASSERT_EQ(2, lv.num_timelines());
+
+  auto check = [&](const string& stage, int64_t min_us, int64_t max_us) {
+    const HdrHistogram* h = lv.StageLatencies(stage);
+    ASSERT_TRUE(h != nullptr) << stage;
+    ASSERT_EQ(2U, h->TotalCount()) << stage;
+    ASSERT_EQ(min_us, static_cast<int64_t>(h->MinValue())) << stage;
+    ASSERT_EQ(max_us, static_cast<int64_t>(h->MaxValue())) << stage;
+  };
+  NO_FATALS(check("wal_write", 20, 20));
+  NO_FATALS(check("fsync", 100, 100));
+  NO_FATALS(check("peer_send[p]", 10, 10));
+  NO_FATALS(check("peer_ack[p]", 300, 300));
+  NO_FATALS(check("commit", 320, 320));
+  NO_FATALS(check("apply", 10, 20));
+  ASSERT_TRUE(lv.StageLatencies("peer_ack") == nullptr);
+
+  std::ostringstream out;
+  lv.DumpStageLatencies(&out);
+  ASSERT_STR_CONTAINS(out.str(), "Stage latencies of 2 ops");
+  ASSERT_STR_CONTAINS(out.str(), "peer_ack[p]");
+}
+
 } // namespace tools
 } // namespace kudu
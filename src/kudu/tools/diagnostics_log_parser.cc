@@ -17,6 +17,7 @@
 
 #include "kudu/tools/diagnostics_log_parser.h"
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <iomanip>
@@ -33,6 +34,7 @@
 #include "kudu/gutil/strings/join.h"
 #include "kudu/gutil/strings/numbers.h"
 #include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/strcat.h"
 #include "kudu/gutil/strings/stringpiece.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/jsonreader.h"
@@ -52,6 +54,7 @@ const char* RecordTypeToString(RecordType r) {
   switch (r) {
     case RecordType::kStacks: return "stacks"; break;
     case RecordType::kSymbols: return "symbols"; break;
+    case RecordType::kOpTimelines: return "op_timelines"; break;
     case RecordType::kUnknown: return "<unknown>"; break;
   }
   return "<unreachable>";
@@ -85,6 +88,85 @@ void StackDumpingLogVisitor::VisitStacksRecord(const StacksRecord& sr) {
   }
 }
 
+namespace {
+
+// Timelines only hold latencies up to this long.
+const int64_t kMaxStageLatencyUs = 3600LL * 1000 * 1000;
+
+} // anonymous namespace
+
+OpTimelineAggregatingLogVisitor::OpTimelineAggregatingLogVisitor(int64_t start_us,
+                                                                 int64_t end_us)
+    : start_us_(start_us),
+      end_us_(end_us) {
+}
+
+void OpTimelineAggregatingLogVisitor::VisitOpTimeline(const OpTimelineRecord& timeline) {
+  if (timeline.start_us < start_us_ || (end_us_ > 0 && timeline.start_us >= end_us_)) {
+    return;
+  }
+  num_timelines_++;
+
+  // The time of the first occurrence of each stage, per peer for the
+  // per-peer stages: retried sends don't count.
+  std::map<string, int64_t> first;
+  for (const auto& e : timeline.events) {
+    string key = e.peer.empty() ? e.stage : Substitute("$0[$1]", e.stage, e.peer);
+    first.emplace(std::move(key), e.us);
+  }
+  auto since = [&](const string& stage, const string& from) {
+    const int64_t* stage_us = FindOrNull(first, stage);
+    const int64_t* from_us = FindOrNull(first, from);
+    if (stage_us && from_us) {
+      AddLatency(stage, *stage_us - *from_us);
+    }
+  };
+  since("wal_write", "enqueue");
+  since("fsync", "wal_write");
+  since("commit", "enqueue");
+  since("apply", "commit");
+  const StringPiece kSend("peer_send[");
+  const StringPiece kAck("peer_ack[");
+  for (const auto& e : first) {
+    StringPiece key(e.first);
+    if (key.starts_with(kSend)) {
+      since(e.first, "enqueue");
+    } else if (key.starts_with(kAck)) {
+      key.remove_prefix(kAck.size());
+      since(e.first, StrCat(kSend, key));
+    }
+  }
+}
+
+void OpTimelineAggregatingLogVisitor::AddLatency(const string& stage, int64_t us) {
+  auto& hist = stages_[stage];
+  if (!hist) {
+    hist.reset(new HdrHistogram(kMaxStageLatencyUs, 3));
+  }
+  hist->Increment(std::min(std::max<int64_t>(us, 0), kMaxStageLatencyUs));
+}
+
+const HdrHistogram* OpTimelineAggregatingLogVisitor::StageLatencies(const string& stage) const {
+  const auto* hist = FindOrNull(stages_, stage);
+  return hist ? hist->get() : nullptr;
+}
+
+void OpTimelineAggregatingLogVisitor::DumpStageLatencies(std::ostream* out) const {
+  *out << "Stage latencies of " << num_timelines_ << " ops, in microseconds:" << endl;
+  *out << std::left << std::setw(48) << "stage" << std::right
+       << std::setw(10) << "count" << std::setw(10) << "p50" << std::setw(10) << "p99"
+       << std::setw(10) << "p99.9" << std::setw(10) << "max" << endl;
+  for (const auto& e : stages_) {
+    const HdrHistogram& h = *e.second;
+    *out << std::left << std::setw(48) << e.first << std::right
+         << std::setw(10) << h.TotalCount()
+         << std::setw(10) << h.ValueAtPercentile(50)
+         << std::setw(10) << h.ValueAtPercentile(99)
+         << std::setw(10) << h.ValueAtPercentile(99.9)
+         << std::setw(10) << h.MaxValue() << endl;
+  }
+}
+
 Status ParsedLine::Parse(string line) {
   // Take ownership of the line to avoid copying substrings.
   line_ = std::move(line);
@@ -120,6 +202,8 @@ Status ParsedLine::Parse(string line) {
     type_ = RecordType::kSymbols;
   } else if (fields[2] == "stacks") {
     type_ = RecordType::kStacks;
+  } else if (fields[2] == "op_timelines") {
+    type_ = RecordType::kOpTimelines;
   } else {
     type_ = RecordType::kUnknown;
   }
@@ -145,6 +229,9 @@ Status LogParser::ParseLine(string line) {
       RETURN_NOT_OK(ParseStacks(pl));
       break;
     }
+    case RecordType::kOpTimelines:
+      RETURN_NOT_OK(ParseOpTimelines(pl));
+      break;
     default:
       break;
   }
@@ -248,6 +335,65 @@ Status LogParser::ParseStacks(const ParsedLine& pl) {
   return Status::OK();
 }
 
+Status LogParser::ParseOpTimeline(const rapidjson::Value& json, OpTimelineRecord* timeline) {
+  if (PREDICT_FALSE(!json.IsObject())) {
+    return Status::InvalidArgument("expected op timelines to be JSON objects");
+  }
+  for (const char* field : { "tablet_id", "term", "index", "start_us", "applied", "events" }) {
+    if (PREDICT_FALSE(!json.HasMember(field))) {
+      return Status::InvalidArgument(Substitute("no '$0' field in op timeline", field));
+    }
+  }
+  if (PREDICT_FALSE(!json["tablet_id"].IsString() || !json["term"].IsInt64() ||
+                    !json["index"].IsInt64() || !json["start_us"].IsInt64() ||
+                    !json["applied"].IsBool() || !json["events"].IsArray())) {
+    return Status::InvalidArgument("unexpected types of op timeline fields");
+  }
+  OpTimelineRecord ret;
+  ret.tablet_id = json["tablet_id"].GetString();
+  ret.term = json["term"].GetInt64();
+  ret.index = json["index"].GetInt64();
+  ret.start_us = json["start_us"].GetInt64();
+  ret.applied = json["applied"].GetBool();
+  const auto& events = json["events"];
+  for (const rapidjson::Value* event = events.Begin();
+       event != events.End();
+       ++event) {
+    if (PREDICT_FALSE(!event->IsObject() || !event->HasMember("stage") ||
+                      !event->HasMember("us") || !(*event)["stage"].IsString() ||
+                      !(*event)["us"].IsInt64())) {
+      return Status::InvalidArgument("expected op timeline events to have a stage and a time");
+    }
+    OpTimelineRecord::Event e;
+    e.stage = (*event)["stage"].GetString();
+    e.us = (*event)["us"].GetInt64();
+    if (event->HasMember("peer")) {
+      if (PREDICT_FALSE(!(*event)["peer"].IsString())) {
+        return Status::InvalidArgument("expected op timeline event peers to be strings");
+      }
+      e.peer = (*event)["peer"].GetString();
+    }
+    ret.events.emplace_back(std::move(e));
+  }
+  *timeline = std::move(ret);
+  return Status::OK();
+}
+
+Status LogParser::ParseOpTimelines(const ParsedLine& pl) {
+  const rapidjson::Value& json = *pl.json();
+  if (!json.IsArray()) {
+    return Status::InvalidArgument("expected op timelines data to be a JSON array");
+  }
+  for (const rapidjson::Value* t = json.Begin();
+       t != json.End();
+       ++t) {
+    OpTimelineRecord timeline;
+    RETURN_NOT_OK(ParseOpTimeline(*t, &timeline));
+    visitor_->VisitOpTimeline(timeline);
+  }
+  return Status::OK();
+}
+
 } // namespace tools
 } // namespace kudu
 
@@ -17,7 +17,10 @@
 
 #pragma once
 
+#include <cstdint>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -27,6 +30,7 @@
 #include <rapidjson/document.h>
 
 #include "kudu/gutil/strings/stringpiece.h"
+#include "kudu/util/hdr_histogram.h"
 #include "kudu/util/jsonreader.h"
 #include "kudu/util/status.h"
 
@@ -38,6 +42,7 @@ namespace tools {
 enum class RecordType {
   kSymbols,
   kStacks,
+  kOpTimelines,
   kUnknown
 };
 
@@ -65,12 +70,37 @@ struct StacksRecord {
   std::vector<Group> groups;
 };
 
+// The sampled timeline of the replication of an op, see OpTimeline.
+struct OpTimelineRecord {
+  struct Event {
+    // The stage of the replication, e.g. "wal_write".
+    std::string stage;
+    // The peer of the per-peer stages, empty for the others.
+    std::string peer;
+    // The microseconds since the first event of the timeline.
+    int64_t us;
+  };
+
+  std::string tablet_id;
+  int64_t term;
+  int64_t index;
+
+  // The wall time of the first event of the timeline, in microseconds.
+  int64_t start_us;
+
+  // Whether the op was applied before its timeline was logged.
+  bool applied;
+
+  std::vector<Event> events;
+};
+
 // Interface for consuming the parsed records from a diagnostics log.
 class LogVisitor {
  public:
   virtual ~LogVisitor() {}
   virtual void VisitSymbol(const std::string& addr, const std::string& symbol) = 0;
   virtual void VisitStacksRecord(const StacksRecord& sr) = 0;
+  virtual void VisitOpTimeline(const OpTimelineRecord& /* timeline */) {}
 };
 
 // LogVisitor implementation which dumps the parsed stack records to cout.
@@ -89,6 +119,50 @@ class StackDumpingLogVisitor : public LogVisitor {
   const std::string kUnknownSymbol = "<unknown>";
 };
 
+// LogVisitor implementation which aggregates the op timelines started within
+// a window of time into the latency distribution of each replication stage,
+// so that a spike of the replication latency can be attributed to the WAL,
+// the network or a follower.
+//
+// The latency of a stage is measured from the stage it follows:
+//
+//   wal_write       since enqueue
+//   fsync           since wal_write
+//   peer_send       since enqueue, for each peer
+//   peer_ack        since the first peer_send to the same peer
+//   commit          since enqueue
+//   apply           since commit
+class OpTimelineAggregatingLogVisitor : public LogVisitor {
+ public:
+  // Aggregates the timelines which started in ['start_us', 'end_us'), in
+  // wall time microseconds. An 'end_us' of 0 leaves the window open.
+  OpTimelineAggregatingLogVisitor(int64_t start_us, int64_t end_us);
+
+  void VisitSymbol(const std::string& /* addr */, const std::string& /* symbol */) override {}
+  void VisitStacksRecord(const StacksRecord& /* sr */) override {}
+  void VisitOpTimeline(const OpTimelineRecord& timeline) override;
+
+  // Returns the latency distribution of 'stage' in microseconds, or nullptr
+  // if no timeline had it. The per-peer stages are named after their peer,
+  // e.g. "peer_ack[<uuid>]".
+  const HdrHistogram* StageLatencies(const std::string& stage) const;
+
+  // The number of timelines aggregated so far.
+  int64_t num_timelines() const { return num_timelines_; }
+
+  // Writes the count and the percentiles of the latency of each stage.
+  void DumpStageLatencies(std::ostream* out) const;
+
+ private:
+  void AddLatency(const std::string& stage, int64_t us);
+
+  const int64_t start_us_;
+  const int64_t end_us_;
+  int64_t num_timelines_ = 0;
+
+  std::map<std::string, std::unique_ptr<HdrHistogram>> stages_;
+};
+
 // A parsed line from the diagnostics log.
 //
 // Each line contains a timestamp, a record type, and some JSON data.
@@ -141,6 +215,10 @@ class LogParser {
 
   Status ParseStacks(const ParsedLine& lf);
 
+  static Status ParseOpTimeline(const rapidjson::Value& json, OpTimelineRecord* timeline);
+
+  Status ParseOpTimelines(const ParsedLine& pl);
+
   LogVisitor* visitor_;
 };
 
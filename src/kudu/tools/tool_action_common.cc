@@ -20,6 +20,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstddef>
 #include <iomanip>
@@ -60,6 +61,7 @@
 #include "kudu/tools/tool.pb.h" // IWYU pragma: keep
 #include "kudu/tools/tool_action.h"
 #include "kudu/tserver/tserver_admin.proxy.h"   // IWYU pragma: keep
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/jsonwriter.h"
 #include "kudu/util/memory/arena.h"
@@ -92,6 +94,9 @@ DEFINE_string(format, "pretty",
               "Format to use for printing list output tables.\n"
               "Possible values: pretty, space, tsv, csv, and json");
 
+DEFINE_int32(fanout_concurrency, 32,
+             "Maximum number of RPCs to keep in flight at once when contacting "
+             "many servers in parallel.");
 DEFINE_string(flag_tags, "", "Comma-separated list of tags used to restrict which "
                              "flags are returned. An empty value matches all tags");
 DEFINE_bool(all_flags, false, "Whether to return all flags, or only flags that "
@@ -270,6 +275,59 @@ Status SetServerFlag(const string& address, uint16_t default_port,
 }
 */
 
+namespace {
+
+// The state of a FanOutRpcs() call, shared with the callbacks of its RPCs.
+struct RpcFanOut {
+  RpcFanOut(size_t num_calls, const StartRpcFunc& start_call)
+      : num_calls(num_calls),
+        start_call(start_call),
+        rpcs(new RpcController[num_calls]),
+        latch(num_calls),
+        next_call(0) {
+  }
+
+  const size_t num_calls;
+  const StartRpcFunc& start_call;
+  unique_ptr<RpcController[]> rpcs;
+  CountDownLatch latch;
+  std::atomic<size_t> next_call;
+};
+
+// Issues the next RPC of 'fan_out' not issued yet, if any. Once it
+// completes, its callback issues the one after, so that the number in flight
+// stays the same until they run out.
+void StartNextRpc(RpcFanOut* fan_out) {
+  size_t i = fan_out->next_call++;
+  if (i >= fan_out->num_calls) {
+    return;
+  }
+  RpcController* rpc = &fan_out->rpcs[i];
+  rpc->set_timeout(MonoDelta::FromMilliseconds(FLAGS_timeout_ms));
+  fan_out->start_call(i, rpc, [fan_out]() {
+    StartNextRpc(fan_out);
+    fan_out->latch.CountDown();
+  });
+}
+
+} // anonymous namespace
+
+void FanOutRpcs(size_t num_calls, const StartRpcFunc& start_call,
+                vector<Status>* statuses) {
+  RpcFanOut fan_out(num_calls, start_call);
+  size_t in_flight = std::min<size_t>(num_calls, std::max(FLAGS_fanout_concurrency, 1));
+  for (size_t i = 0; i < in_flight; i++) {
+    StartNextRpc(&fan_out);
+  }
+  fan_out.latch.Wait();
+
+  statuses->clear();
+  statuses->reserve(num_calls);
+  for (size_t i = 0; i < num_calls; i++) {
+    statuses->emplace_back(fan_out.rpcs[i].status());
+  }
+}
+
 bool MatchesAnyPattern(const vector<string>& patterns, const string& str) {
   // Consider no filter a wildcard.
   if (patterns.empty()) return true;
@@ -17,15 +17,19 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <ostream>
 #include <string>
 #include <vector>
 
+#include "kudu/common/wire_protocol.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/rpc/response_callback.h"
 #include "kudu/util/status.h"
 
 namespace boost {
@@ -126,6 +130,35 @@ Status SetServerFlag(const std::string& address, uint16_t default_port,
                      const std::string& flag, const std::string& value);
 */
 
+// Starts the asynchronous RPC number 'i' of a fan-out with 'rpc', whose
+// deadline is already set, arranging for 'done' to run when it completes.
+// Must not block: it may run on a reactor thread, from the callback of an
+// earlier RPC.
+typedef std::function<void(size_t i,
+                           rpc::RpcController* rpc,
+                           const rpc::ResponseCallback& done)> StartRpcFunc;
+
+// Issues 'num_calls' asynchronous RPCs with 'start_call', keeping at most
+// --fanout_concurrency of them in flight, and waits for all of them to
+// complete. Each RPC gets --timeout_ms from when it's issued, so a fan-out to
+// many servers takes about as long as the slowest of them.
+//
+// Returns the controller status of each call in 'statuses'; the caller is
+// expected to check the responses for application errors.
+void FanOutRpcs(size_t num_calls, const StartRpcFunc& start_call,
+                std::vector<Status>* statuses);
+
+// Returns the error of an RPC: 'rpc_status' if it failed, or else the error
+// carried in 'resp', if any.
+template<class RespClass>
+Status RpcStatus(const Status& rpc_status, const RespClass& resp) {
+  RETURN_NOT_OK(rpc_status);
+  if (resp.has_error()) {
+    return StatusFromPB(resp.error().status());
+  }
+  return Status::OK();
+}
+
 // Return true if 'str' matches any of the patterns in 'patterns', or if
 // 'patterns' is empty.
 bool MatchesAnyPattern(const std::vector<std::string>& patterns, const std::string& str);
@@ -19,17 +19,28 @@
 #include <array>
 #include <cerrno>
 #include <fstream> // IWYU pragma: keep
+#include <iostream>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include <gflags/gflags.h>
+
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/tools/diagnostics_log_parser.h"
 #include "kudu/tools/tool_action.h"
 #include "kudu/util/errno.h"
 #include "kudu/util/status.h"
 
+DEFINE_int64(start_time_us, 0,
+             "Only aggregate the op timelines which started at or after this wall "
+             "time, in microseconds since the epoch like the timestamps of the log "
+             "records");
+DEFINE_int64(end_time_us, 0,
+             "Only aggregate the op timelines which started before this wall time, in "
+             "microseconds since the epoch. 0 means no end");
+
 namespace kudu {
 namespace tools {
 
@@ -45,14 +56,13 @@ const char* kLogPathArg = "path";
 
 namespace {
 
-Status ParseStacksFromPath(const string& path) {
+Status ParseFromPath(const string& path, LogVisitor* visitor) {
   errno = 0;
   ifstream in(path);
   if (!in.is_open()) {
     return Status::IOError(ErrnoToString(errno));
   }
-  StackDumpingLogVisitor dlv;
-  LogParser lp(&dlv);
+  LogParser lp(visitor);
   string line;
   int line_number = 0;
   while (std::getline(in, line)) {
@@ -69,13 +79,26 @@ Status ParseStacks(const RunnerContext& context) {
   // The file names are such that lexicographic sorting reflects
   // timestamp-based sorting.
   std::sort(paths.begin(), paths.end());
+  StackDumpingLogVisitor dlv;
   for (const auto& path : paths) {
-    RETURN_NOT_OK_PREPEND(ParseStacksFromPath(path),
+    RETURN_NOT_OK_PREPEND(ParseFromPath(path, &dlv),
                           Substitute("failed to parse stacks from $0", path));
   }
   return Status::OK();
 }
 
+Status ParseOpTimelines(const RunnerContext& context) {
+  vector<string> paths = context.variadic_args;
+  std::sort(paths.begin(), paths.end());
+  OpTimelineAggregatingLogVisitor visitor(FLAGS_start_time_us, FLAGS_end_time_us);
+  for (const auto& path : paths) {
+    RETURN_NOT_OK_PREPEND(ParseFromPath(path, &visitor),
+                          Substitute("failed to parse op timelines from $0", path));
+  }
+  visitor.DumpStageLatencies(&std::cout);
+  return Status::OK();
+}
+
 } // anonymous namespace
 
 unique_ptr<Mode> BuildDiagnoseMode() {
@@ -85,9 +108,19 @@ unique_ptr<Mode> BuildDiagnoseMode() {
       .AddRequiredVariadicParameter({ kLogPathArg, "path to log file(s) to parse" })
       .Build();
 
+  unique_ptr<Action> parse_op_timelines =
+      ActionBuilder("parse_op_timelines", &ParseOpTimelines)
+      .Description("Aggregate the sampled op timelines of a diagnostics log into the "
+                   "latency distribution of each replication stage")
+      .AddRequiredVariadicParameter({ kLogPathArg, "path to log file(s) to parse" })
+      .AddOptionalParameter("start_time_us")
+      .AddOptionalParameter("end_time_us")
+      .Build();
+
   return ModeBuilder("diagnose")
       .Description("Diagnostic tools for Kudu servers and clusters")
       .AddAction(std::move(parse_stacks))
+      .AddAction(std::move(parse_op_timelines))
       .Build();
 }
 
@@ -159,8 +159,48 @@
 //      |  | thread2 +---------+
 //      |  |         | tabletC |
 //      v  +---------+         v
+//
+// 'raft_loadgen' drives load through the Raft config of one tablet instead,
+// with opaque writes which no state machine applies. For example, with 8
+// threads each keeping a 4KB write outstanding for a minute, compressed with
+// LZ4, against a config whose servers run with --raft_enable_replicate_write:
+//
+//   kudu perf raft_loadgen \
+//     --num_threads=8 \
+//     --raft_loadgen_payload_bytes=4096 \
+//     --raft_loadgen_compression_codec=lz4 \
+//     --raft_loadgen_run_time_sec=60 \
+//     --format=json \
+//     ts1:7050,ts2:7050,ts3:7050 <tablet_id>
+//
+// 'raft_loadgen' doubles as a performance regression gate. Run once on a
+// reference machine with --raft_loadgen_save_baseline_path to record the
+// commit throughput, p99 latency, host CPU per op and bytes replicated per
+// op, with a tolerance for each, and then with --raft_loadgen_baseline_path
+// to fail if any of them got worse by more than its tolerance. Tolerances
+// may be edited in the baseline file; latency is usually noisier than the
+// rest. The CPU is that of the whole host, less the tool's own, so it's only
+// meaningful when the servers run on the host alone, as in a local cluster
+// of each topology to guard, e.g. plain Raft, FlexiRaft or proxied:
+//
+//   kudu perf raft_loadgen \
+//     --raft_loadgen_baseline_path=baselines/flexiraft-3x4k.json \
+//     ts1:7050,ts2:7050,ts3:7050 <tablet_id>
+//
+// 'raft_replay' replays the writes which a leader captured with
+// --raft_traffic_capture_path instead, with the same arrival pattern and
+// payloads of the same sizes and compressibility, for example twice as fast
+// as they were captured:
+//
+//   kudu perf raft_replay \
+//     --raft_replay_speed=2 \
+//     ts1:7050,ts2:7050,ts3:7050 <tablet_id> /path/to/capture
+
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdlib>
 #include <iomanip>
@@ -179,6 +219,7 @@
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 
+#ifdef FB_DO_NOT_REMOVE
 #include "kudu/client/client.h"
 #include "kudu/client/scan_batch.h"
 #include "kudu/client/schema.h"
@@ -188,24 +229,50 @@
 #include "kudu/common/partial_row.h"
 #include "kudu/common/schema.h"
 #include "kudu/common/types.h"
+#include "kudu/util/decimal_util.h"
+#include "kudu/util/int128.h"
+#include "kudu/util/oid_generator.h"
+#endif
+#include "kudu/common/wire_protocol.h"
+#include "kudu/common/wire_protocol.pb.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/consensus.proxy.h"
+#include "kudu/consensus/opid.pb.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/strings/join.h"
+#include "kudu/gutil/strings/numbers.h"
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/strcat.h"
+#include "kudu/gutil/stringprintf.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/rpc/response_callback.h"
+#include "kudu/rpc/rpc_controller.h"
 #include "kudu/tools/tool_action.h"
 #include "kudu/tools/tool_action_common.h"
-#include "kudu/util/decimal_util.h"
+#include "kudu/tserver/tablet_server.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/crc.h"
+#include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/flag_validators.h"
-#include "kudu/util/int128.h"
-#include "kudu/util/oid_generator.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/jsonreader.h"
+#include "kudu/util/jsonwriter.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/pb_util.h"
 #include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
+#include "kudu/util/semaphore.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/stopwatch.h"
 
+#ifdef FB_DO_NOT_REMOVE
 using kudu::ColumnSchema;
 using kudu::KuduPartialRow;
-using kudu::Stopwatch;
 using kudu::TypeInfo;
 using kudu::client::KuduClient;
 using kudu::client::KuduClientBuilder;
@@ -220,7 +287,23 @@ using kudu::client::KuduSession;
 using kudu::client::KuduTable;
 using kudu::client::KuduTableCreator;
 using kudu::client::sp::shared_ptr;
+#endif
+using kudu::Stopwatch;
+using kudu::consensus::ConsensusServiceProxy;
+using kudu::consensus::GetLastOpIdRequestPB;
+using kudu::consensus::GetLastOpIdResponsePB;
+using kudu::consensus::GetNodeInstanceRequestPB;
+using kudu::consensus::GetNodeInstanceResponsePB;
+using kudu::consensus::ReadIndexRequestPB;
+using kudu::consensus::ReadIndexResponsePB;
+using kudu::consensus::ReplicateWriteRequestPB;
+using kudu::consensus::ReplicateWriteResponsePB;
+using kudu::consensus::TrafficCaptureRecordPB;
+using kudu::consensus::WritePayloadPB;
+using kudu::pb_util::ReadablePBContainerFile;
+using kudu::rpc::RpcController;
 using std::accumulate;
+using std::atomic;
 using std::cerr;
 using std::cout;
 using std::endl;
@@ -235,6 +318,7 @@ using std::vector;
 using strings::Substitute;
 using strings::SubstituteAndAppend;
 
+#ifdef FB_DO_NOT_REMOVE
 DEFINE_double(buffer_flush_watermark_pct, 0.5,
               "Mutation buffer flush watermark, in percentage of total size.");
 DEFINE_int32(buffer_size_bytes, 4 * 1024 * 1024,
@@ -261,9 +345,12 @@ DEFINE_uint64(num_rows_per_thread, 1000,
               "Number of rows each thread generates and inserts; "
               "0 means unlimited. All rows generated by a thread are inserted "
               "in the context of the same session.");
+#endif
 DEFINE_int32(num_threads, 2,
-             "Number of generator threads to run. Each thread runs its own "
-             "KuduSession.");
+             "Number of generator threads to run. With 'loadgen', each thread "
+             "runs its own KuduSession; with 'raft_loadgen', each thread keeps "
+             "one write outstanding at a time.");
+#ifdef FB_DO_NOT_REMOVE
 DEFINE_bool(run_scan, false,
             "Whether to run post-insertion scan to verify that the count of "
             "the inserted rows matches the expected number. If enabled, "
@@ -316,12 +403,47 @@ DEFINE_bool(use_random, false,
             "Whether to use random numbers instead of sequential ones. "
             "In case of using random numbers collisions are possible over "
             "the data for columns with unique constraint (e.g. primary key).");
+#endif
+
+DEFINE_int32(raft_loadgen_payload_bytes, 1024,
+             "Size of the payload of each write issued by 'raft_loadgen', "
+             "before compression.");
+DEFINE_string(raft_loadgen_compression_codec, "none",
+              "Codec with which 'raft_loadgen' compresses the payload of its "
+              "writes before sending them: one of 'none', 'snappy', 'lz4' "
+              "or 'zlib'.");
+DEFINE_int32(raft_loadgen_run_time_sec, 10,
+             "For how long 'raft_loadgen' issues writes, in seconds.");
+DEFINE_string(raft_loadgen_baseline_path, "",
+              "If set, the baseline which 'raft_loadgen' compares its results "
+              "with once the load stops, failing if any of them is worse than "
+              "the baseline by more than the baseline's tolerance for it.");
+DEFINE_string(raft_loadgen_save_baseline_path, "",
+              "If set, the file to which 'raft_loadgen' writes its results as "
+              "a baseline for --raft_loadgen_baseline_path, with a tolerance "
+              "of --raft_loadgen_baseline_tolerance_pct for each of them.");
+DEFINE_int32(raft_loadgen_baseline_tolerance_pct, 10,
+             "The tolerance of each result of a baseline written to "
+             "--raft_loadgen_save_baseline_path, in percent of the result.");
+DEFINE_double(raft_replay_speed, 1.0,
+              "How many times faster than they were captured 'raft_replay' "
+              "replays the writes of a traffic capture.");
+DEFINE_string(raft_replay_capture_tablet_id, "",
+              "If set, 'raft_replay' replays only the writes which were "
+              "captured for this tablet, rather than those of all tablets.");
+DEFINE_int32(raft_replay_max_outstanding, 1024,
+             "How many writes 'raft_replay' keeps outstanding at most. Once "
+             "this many haven't committed, it falls behind the captured "
+             "arrival pattern, which it reports as 'max_late_us'.");
+
+DECLARE_int64(timeout_ms);
 
 namespace kudu {
 namespace tools {
 
 namespace {
 
+#ifdef FB_DO_NOT_REMOVE
 bool ValidatePartitionFlags() {
   int num_tablets = FLAGS_table_num_hash_partitions * FLAGS_table_num_range_partitions;
   if (num_tablets <= 1) {
@@ -741,9 +863,632 @@ Status TestLoadGenerator(const RunnerContext& context) {
   return Status::OK();
 }
 
+#endif
+
+const char* const kTServerAddressesArg = "tserver_addresses";
+
+// One member of the Raft config which 'raft_loadgen' drives load against.
+struct RaftPeer {
+  string address;
+  string uuid;
+  unique_ptr<ConsensusServiceProxy> proxy;
+
+  // How many ops the peer had received fewer than the leader, at worst and
+  // when the load stopped, or -1 if it couldn't be told.
+  int64_t max_lag = -1;
+  int64_t last_lag = -1;
+};
+
+// What the writer threads of 'raft_loadgen' record, shared among them.
+struct RaftLoadStats {
+  // Latencies of up to a minute are tracked; HdrHistogram is thread-safe.
+  RaftLoadStats() : latency_us(60 * 1000 * 1000, 2) {}
+
+  HdrHistogram latency_us;
+  atomic<int64_t> num_errors { 0 };
+
+  simple_spinlock lock;
+  Status first_error;
+};
+
+Status GetLastReceivedIndex(const RaftPeer& peer, const string& tablet_id, int64_t* index) {
+  GetLastOpIdRequestPB req;
+  req.set_dest_uuid(peer.uuid);
+  req.set_tablet_id(tablet_id);
+  req.set_opid_type(consensus::RECEIVED_OPID);
+  GetLastOpIdResponsePB resp;
+  RpcController rpc;
+  rpc.set_timeout(MonoDelta::FromMilliseconds(FLAGS_timeout_ms));
+  RETURN_NOT_OK(peer.proxy->GetLastOpId(req, &resp, &rpc));
+  if (resp.has_error()) {
+    return StatusFromPB(resp.error().status());
+  }
+  *index = resp.opid().index();
+  return Status::OK();
+}
+
+// Connects to the servers at 'addresses', returning them in 'peers' with the
+// leader of 'tablet_id' first.
+Status ConnectToRaftPeers(const vector<string>& addresses, const string& tablet_id,
+                          vector<RaftPeer>* peers) {
+  for (const string& address : addresses) {
+    RaftPeer peer;
+    peer.address = address;
+    RETURN_NOT_OK(BuildProxy(address, tserver::TabletServer::kDefaultPort, &peer.proxy));
+    peers->emplace_back(std::move(peer));
+  }
+
+  GetNodeInstanceRequestPB instance_req;
+  vector<GetNodeInstanceResponsePB> instances(peers->size());
+  vector<Status> statuses;
+  FanOutRpcs(peers->size(),
+             [&](size_t i, RpcController* rpc, const rpc::ResponseCallback& done) {
+    (*peers)[i].proxy->GetNodeInstanceAsync(instance_req, &instances[i], rpc, done);
+  }, &statuses);
+  for (int i = 0; i < peers->size(); i++) {
+    RETURN_NOT_OK_PREPEND(statuses[i], Substitute("unable to get the uuid of $0",
+                                                  (*peers)[i].address));
+    (*peers)[i].uuid = instances[i].node_instance().permanent_uuid();
+  }
+
+  // Only the leader serves ReadIndex().
+  vector<ReadIndexRequestPB> reqs(peers->size());
+  vector<ReadIndexResponsePB> resps(peers->size());
+  for (int i = 0; i < peers->size(); i++) {
+    reqs[i].set_dest_uuid((*peers)[i].uuid);
+    reqs[i].set_tablet_id(tablet_id);
+  }
+  FanOutRpcs(peers->size(),
+             [&](size_t i, RpcController* rpc, const rpc::ResponseCallback& done) {
+    (*peers)[i].proxy->ReadIndexAsync(reqs[i], &resps[i], rpc, done);
+  }, &statuses);
+  for (int i = 0; i < peers->size(); i++) {
+    if (RpcStatus(statuses[i], resps[i]).ok()) {
+      std::swap((*peers)[0], (*peers)[i]);
+      return Status::OK();
+    }
+  }
+  return Status::NotFound(Substitute("none of the servers leads tablet $0", tablet_id));
+}
+
+// Generates the payload of the writes, compressed with
+// --raft_loadgen_compression_codec. It's made of random letters of a small
+// alphabet so that it compresses about as well as typical row data does.
+Status MakeWritePayload(WritePayloadPB* payload) {
+  Random rng(GetRandomSeed32());
+  string data(FLAGS_raft_loadgen_payload_bytes, '\0');
+  for (char& c : data) {
+    c = 'a' + rng.Uniform(16);
+  }
+
+  CompressionType type = GetCompressionCodecType(FLAGS_raft_loadgen_compression_codec);
+  if (type == NO_COMPRESSION) {
+    payload->set_payload(std::move(data));
+  } else {
+    const CompressionCodec* codec;
+    RETURN_NOT_OK(GetCompressionCodec(type, &codec));
+    faststring buf;
+    buf.resize(codec->MaxCompressedLength(data.size()));
+    size_t compressed_len;
+    RETURN_NOT_OK(codec->Compress(Slice(data), buf.data(), &compressed_len));
+    payload->set_payload(buf.data(), compressed_len);
+    payload->set_compression_codec(type);
+    payload->set_uncompressed_size(data.size());
+  }
+  payload->set_crc32(crc::Crc32c(payload->payload().data(), payload->payload().size()));
+  return Status::OK();
+}
+
+// Issues writes of 'payload' to 'leader' one after the other until 'deadline'
+// or the first error.
+void RaftWriterThread(const RaftPeer* leader,
+                      const string& tablet_id,
+                      const WritePayloadPB& payload,
+                      const MonoTime& deadline,
+                      RaftLoadStats* stats) {
+  ReplicateWriteRequestPB req;
+  req.set_dest_uuid(leader->uuid);
+  req.set_tablet_id(tablet_id);
+  *req.mutable_write_payload() = payload;
+  while (MonoTime::Now() < deadline) {
+    ReplicateWriteResponsePB resp;
+    RpcController rpc;
+    rpc.set_timeout(MonoDelta::FromMilliseconds(FLAGS_timeout_ms));
+    MonoTime start = MonoTime::Now();
+    Status s = leader->proxy->ReplicateWrite(req, &resp, &rpc);
+    if (s.ok() && resp.has_error()) {
+      s = StatusFromPB(resp.error().status());
+    }
+    if (PREDICT_FALSE(!s.ok())) {
+      stats->num_errors++;
+      lock_guard<simple_spinlock> l(stats->lock);
+      if (stats->first_error.ok()) {
+        stats->first_error = s;
+      }
+      return;
+    }
+    stats->latency_us.Increment((MonoTime::Now() - start).ToMicroseconds());
+  }
+}
+
+// Records how far behind the leader each follower in 'peers' is.
+void SampleReplicationLag(const string& tablet_id, vector<RaftPeer>* peers) {
+  int64_t leader_index;
+  if (!GetLastReceivedIndex(peers->front(), tablet_id, &leader_index).ok()) {
+    return;
+  }
+  for (auto it = peers->begin() + 1; it != peers->end(); ++it) {
+    int64_t index;
+    if (!GetLastReceivedIndex(*it, tablet_id, &index).ok()) {
+      it->last_lag = -1;
+      continue;
+    }
+    it->last_lag = std::max<int64_t>(0, leader_index - index);
+    it->max_lag = std::max(it->max_lag, it->last_lag);
+  }
+}
+
+// Prints how far behind the leader each follower in 'peers' was.
+Status PrintReplicationLag(const vector<RaftPeer>& peers) {
+  DataTable lag({ "uuid", "address", "role", "max_lag_ops", "final_lag_ops" });
+  for (int i = 0; i < peers.size(); i++) {
+    const RaftPeer& peer = peers[i];
+    lag.AddRow({ peer.uuid, peer.address, i == 0 ? "LEADER" : "FOLLOWER",
+                 i == 0 ? "0" : std::to_string(peer.max_lag),
+                 i == 0 ? "0" : std::to_string(peer.last_lag) });
+  }
+  return lag.PrintTo(cout);
+}
+
+// The CPU time used by all the processes of the host so far, in microseconds.
+Status GetHostCpuUs(int64_t* cpu_us) {
+  faststring buf;
+  RETURN_NOT_OK(ReadFileToString(Env::Default(), "/proc/stat", &buf));
+  // The first line adds up all CPUs: "cpu user nice system idle iowait ...",
+  // in clock ticks. Only idle and iowait ticks weren't spent running.
+  const string contents = buf.ToString();
+  vector<string> fields = strings::Split(contents.substr(0, contents.find('\n')), " ",
+                                         strings::SkipEmpty());
+  if (fields.size() < 5 || fields[0] != "cpu") {
+    return Status::Corruption("unexpected /proc/stat contents");
+  }
+  uint64_t busy_ticks = 0;
+  for (int i = 1; i < fields.size(); i++) {
+    uint64_t ticks;
+    if (!safe_strtou64(fields[i], &ticks)) {
+      return Status::Corruption("unexpected /proc/stat contents", fields[i]);
+    }
+    if (i != 4 && i != 5) {
+      busy_ticks += ticks;
+    }
+  }
+  *cpu_us = busy_ticks * 1000000 / sysconf(_SC_CLK_TCK);
+  return Status::OK();
+}
+
+// The CPU time used by this process so far, in microseconds.
+int64_t GetSelfCpuUs() {
+  rusage ru;
+  CHECK_ERR(getrusage(RUSAGE_SELF, &ru));
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000L +
+      ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// A result of 'raft_loadgen' which a baseline keeps, and whether more of
+// it is better.
+struct RaftPerfResult {
+  const char* name;
+  bool higher_is_better;
+  // -1 if it couldn't be measured.
+  int64_t value;
+};
+
+// Writes 'results' to 'path' as a baseline, each with a tolerance of
+// --raft_loadgen_baseline_tolerance_pct.
+Status SaveRaftPerfBaseline(const string& path, const vector<RaftPerfResult>& results) {
+  ostringstream out;
+  JsonWriter jw(&out, JsonWriter::PRETTY);
+  jw.StartObject();
+  for (const RaftPerfResult& result : results) {
+    if (result.value < 0) {
+      continue;
+    }
+    jw.String(result.name);
+    jw.StartObject();
+    jw.String("value");
+    jw.Int64(result.value);
+    jw.String("tolerance_pct");
+    jw.Int(FLAGS_raft_loadgen_baseline_tolerance_pct);
+    jw.EndObject();
+  }
+  jw.EndObject();
+  out << endl;
+  return WriteStringToFile(Env::Default(), out.str(), path);
+}
+
+// Compares 'results' with the baseline at 'path', printing how they compare
+// and returning an error if any of them regressed. The results which the
+// baseline doesn't have, or which couldn't be measured, aren't compared.
+Status CheckRaftPerfBaseline(const string& path, const vector<RaftPerfResult>& results) {
+  faststring buf;
+  RETURN_NOT_OK_PREPEND(ReadFileToString(Env::Default(), path, &buf),
+                        "unable to read the baseline");
+  JsonReader reader(buf.ToString());
+  RETURN_NOT_OK_PREPEND(reader.Init(), Substitute("unable to parse baseline $0", path));
+
+  DataTable table({ "result", "baseline", "measured", "change_pct", "tolerance_pct",
+                    "verdict" });
+  vector<string> regressed;
+  for (const RaftPerfResult& result : results) {
+    const rapidjson::Value* entry;
+    if (!reader.ExtractObject(reader.root(), result.name, &entry).ok()) {
+      continue;
+    }
+    int64_t baseline;
+    int32_t tolerance_pct;
+    RETURN_NOT_OK_PREPEND(reader.ExtractInt64(entry, "value", &baseline),
+                          Substitute("bad baseline for $0", result.name));
+    RETURN_NOT_OK_PREPEND(reader.ExtractInt32(entry, "tolerance_pct", &tolerance_pct),
+                          Substitute("bad baseline for $0", result.name));
+    if (result.value < 0 || baseline <= 0) {
+      table.AddRow({ result.name, std::to_string(baseline), std::to_string(result.value),
+                     "", std::to_string(tolerance_pct), "SKIPPED" });
+      continue;
+    }
+    const double change_pct = 100.0 * (result.value - baseline) / baseline;
+    const bool worse = result.higher_is_better ? -change_pct > tolerance_pct
+                                               : change_pct > tolerance_pct;
+    if (worse) {
+      regressed.emplace_back(result.name);
+    }
+    table.AddRow({ result.name, std::to_string(baseline), std::to_string(result.value),
+                   StringPrintf("%+.1f", change_pct), std::to_string(tolerance_pct),
+                   worse ? "REGRESSED" : "OK" });
+  }
+  RETURN_NOT_OK(table.PrintTo(cout));
+  if (!regressed.empty()) {
+    return Status::RuntimeError(Substitute("regressed from baseline $0", path),
+                                JoinStrings(regressed, ", "));
+  }
+  return Status::OK();
+}
+
+Status RaftLoadGenerator(const RunnerContext& context) {
+  const string& tablet_id = FindOrDie(context.required_args, kTabletIdArg);
+  vector<string> addresses = strings::Split(
+      FindOrDie(context.required_args, kTServerAddressesArg), ",", strings::SkipEmpty());
+  if (addresses.empty()) {
+    return Status::InvalidArgument("At least one tablet server address must be specified");
+  }
+  if (FLAGS_num_threads <= 0 || FLAGS_raft_loadgen_payload_bytes < 0) {
+    return Status::InvalidArgument("--num_threads must be positive and "
+                                   "--raft_loadgen_payload_bytes non-negative");
+  }
+
+  vector<RaftPeer> peers;
+  RETURN_NOT_OK(ConnectToRaftPeers(addresses, tablet_id, &peers));
+  WritePayloadPB payload;
+  RETURN_NOT_OK(MakeWritePayload(&payload));
+
+  RaftLoadStats stats;
+  const MonoTime deadline = MonoTime::Now() +
+      MonoDelta::FromSeconds(FLAGS_raft_loadgen_run_time_sec);
+  int64_t host_cpu_start_us;
+  const bool have_host_cpu = GetHostCpuUs(&host_cpu_start_us).ok();
+  const int64_t self_cpu_start_us = GetSelfCpuUs();
+  Stopwatch sw;
+  sw.start();
+  vector<thread> threads;
+  for (int i = 0; i < FLAGS_num_threads; i++) {
+    threads.emplace_back(&RaftWriterThread, &peers.front(), std::cref(tablet_id),
+                         std::cref(payload), std::cref(deadline), &stats);
+  }
+  // Sample the followers' lag about once a second while the load runs, and
+  // once more when it stops.
+  while (MonoTime::Now() < deadline &&
+         stats.num_errors.load() < FLAGS_num_threads) {
+    SleepFor(std::min(MonoDelta::FromSeconds(1), deadline - MonoTime::Now()));
+    SampleReplicationLag(tablet_id, &peers);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  sw.stop();
+  int64_t host_cpu_end_us;
+  const bool have_host_cpu_end = have_host_cpu && GetHostCpuUs(&host_cpu_end_us).ok();
+  const int64_t self_cpu_us = GetSelfCpuUs() - self_cpu_start_us;
+  SampleReplicationLag(tablet_id, &peers);
+
+  const HdrHistogram& latency = stats.latency_us;
+  const double secs = sw.elapsed().wall_seconds();
+  const int64_t ops = latency.TotalCount();
+  // The CPU the servers used, taken as that of the host less the tool's own.
+  const int64_t host_cpu_us_per_op = have_host_cpu_end && ops > 0 ?
+      std::max<int64_t>(0, host_cpu_end_us - host_cpu_start_us - self_cpu_us) / ops : -1;
+  // Every follower receives each payload once, however it's routed.
+  const int64_t replicated_bytes_per_op =
+      payload.payload().size() * (peers.size() - 1);
+  DataTable summary({ "ops", "errors", "ops_per_sec", "payload_mb_per_sec",
+                      "p50_us", "p95_us", "p99_us", "p999_us", "max_us",
+                      "host_cpu_us_per_op", "replicated_bytes_per_op" });
+  summary.AddRow({ std::to_string(ops),
+                   std::to_string(stats.num_errors.load()),
+                   StringPrintf("%.1f", secs > 0 ? ops / secs : 0),
+                   StringPrintf("%.2f", secs > 0 ?
+                       ops * payload.payload().size() / secs / (1024 * 1024) : 0),
+                   std::to_string(latency.ValueAtPercentile(50)),
+                   std::to_string(latency.ValueAtPercentile(95)),
+                   std::to_string(latency.ValueAtPercentile(99)),
+                   std::to_string(latency.ValueAtPercentile(99.9)),
+                   std::to_string(latency.MaxValue()),
+                   std::to_string(host_cpu_us_per_op),
+                   std::to_string(replicated_bytes_per_op) });
+  RETURN_NOT_OK(summary.PrintTo(cout));
+
+  RETURN_NOT_OK(PrintReplicationLag(peers));
+
+  const vector<RaftPerfResult> results = {
+    { "ops_per_sec", true, secs > 0 ? static_cast<int64_t>(ops / secs) : -1 },
+    { "p99_us", false, ops > 0 ? latency.ValueAtPercentile(99) : -1 },
+    { "host_cpu_us_per_op", false, host_cpu_us_per_op },
+    { "replicated_bytes_per_op", false, replicated_bytes_per_op },
+  };
+  if (!FLAGS_raft_loadgen_save_baseline_path.empty()) {
+    RETURN_NOT_OK_PREPEND(SaveRaftPerfBaseline(FLAGS_raft_loadgen_save_baseline_path, results),
+                          "unable to save the baseline");
+  }
+  if (!FLAGS_raft_loadgen_baseline_path.empty() && ops > 0) {
+    RETURN_NOT_OK(CheckRaftPerfBaseline(FLAGS_raft_loadgen_baseline_path, results));
+  }
+
+  lock_guard<simple_spinlock> l(stats.lock);
+  if (ops == 0 && !stats.first_error.ok()) {
+    return stats.first_error.CloneAndPrepend("no write committed");
+  }
+  return Status::OK();
+}
+
+const char* const kCapturePathArg = "capture_path";
+
+// Reads the records of the traffic capture at 'path' which
+// 'raft_replay' replays into 'records', counting those it skips in
+// 'num_skipped'.
+Status ReadTrafficCapture(const string& path,
+                          vector<TrafficCaptureRecordPB>* records,
+                          int64_t* num_skipped) {
+  unique_ptr<RandomAccessFile> file;
+  RETURN_NOT_OK_PREPEND(Env::Default()->NewRandomAccessFile(path, &file),
+                        "unable to open the traffic capture");
+  ReadablePBContainerFile reader(std::move(file));
+  RETURN_NOT_OK_PREPEND(reader.Open(), "unable to read the traffic capture");
+  *num_skipped = 0;
+  while (true) {
+    TrafficCaptureRecordPB record;
+    Status s = reader.ReadNextPB(&record);
+    // The last record may have been cut short when the server stopped.
+    if (s.IsEndOfFile() || s.IsIncomplete()) {
+      return Status::OK();
+    }
+    RETURN_NOT_OK_PREPEND(s, "unable to read the traffic capture");
+    // Followers receive the ops which their leader was asked to replicate,
+    // so only the leaders' records are replayed.
+    if (record.kind() != TrafficCaptureRecordPB::REPLICATE ||
+        (!FLAGS_raft_replay_capture_tablet_id.empty() &&
+         record.tablet_id() != FLAGS_raft_replay_capture_tablet_id)) {
+      (*num_skipped)++;
+      continue;
+    }
+    records->emplace_back(std::move(record));
+  }
+}
+
+// Makes up payloads of the sizes and compressibility which a traffic capture
+// recorded. The start of an uncompressed payload is made of random bytes,
+// which don't compress, and the rest of one repeated letter, which
+// compresses to next to nothing, in the proportion which makes it compress
+// about as well as the captured payloads did.
+class ReplayPayloadMaker {
+ public:
+  ReplayPayloadMaker() : rng_(GetRandomSeed32()), ratio_(1.0) {}
+
+  // Takes in how well the payloads of 'record' compress, if it tells.
+  void Observe(const TrafficCaptureRecordPB& record) {
+    if (record.compression_codec() != NO_COMPRESSION) {
+      const int64_t compressed = accumulate(record.payload_bytes().begin(),
+                                            record.payload_bytes().end(), int64_t{0});
+      const int64_t uncompressed = accumulate(record.uncompressed_bytes().begin(),
+                                              record.uncompressed_bytes().end(), int64_t{0});
+      if (uncompressed > 0) {
+        ratio_ = std::min(1.0, static_cast<double>(compressed) / uncompressed);
+      }
+    } else if (record.sample_bytes() > 0) {
+      // Requests which weren't sampled compress like the last one which was.
+      ratio_ = std::min(1.0, static_cast<double>(record.sample_compressed_bytes()) /
+                             record.sample_bytes());
+    }
+  }
+
+  // Makes the payload of the 'i'th op of 'record' into 'payload'.
+  Status Make(const TrafficCaptureRecordPB& record, int i, WritePayloadPB* payload) {
+    const size_t size = record.uncompressed_bytes(i);
+    const size_t num_random = size * ratio_;
+    while (random_.size() < num_random) {
+      random_.push_back(static_cast<char>(rng_.Next32()));
+    }
+    string data;
+    data.reserve(size);
+    data.append(random_, 0, num_random);
+    data.append(size - num_random, 'a');
+
+    const CompressionType type = record.compression_codec();
+    if (type == NO_COMPRESSION) {
+      payload->set_payload(std::move(data));
+    } else {
+      const CompressionCodec* codec;
+      RETURN_NOT_OK(GetCompressionCodec(type, &codec));
+      buf_.resize(codec->MaxCompressedLength(data.size()));
+      size_t compressed_len;
+      RETURN_NOT_OK(codec->Compress(Slice(data), buf_.data(), &compressed_len));
+      payload->set_payload(buf_.data(), compressed_len);
+      payload->set_compression_codec(type);
+      payload->set_uncompressed_size(data.size());
+    }
+    payload->set_crc32(crc::Crc32c(payload->payload().data(), payload->payload().size()));
+    return Status::OK();
+  }
+
+ private:
+  Random rng_;
+
+  // How many bytes the payloads compress to, for each uncompressed byte.
+  double ratio_;
+
+  // Random bytes, as many as the largest payload has needed so far.
+  string random_;
+  faststring buf_;
+};
+
+// A write which 'raft_replay' has outstanding.
+struct ReplayWrite {
+  ReplicateWriteRequestPB req;
+  ReplicateWriteResponsePB resp;
+  RpcController rpc;
+  MonoTime sent;
+};
+
+Status RaftReplay(const RunnerContext& context) {
+  const string& tablet_id = FindOrDie(context.required_args, kTabletIdArg);
+  vector<string> addresses = strings::Split(
+      FindOrDie(context.required_args, kTServerAddressesArg), ",", strings::SkipEmpty());
+  if (addresses.empty()) {
+    return Status::InvalidArgument("At least one tablet server address must be specified");
+  }
+  if (FLAGS_raft_replay_speed <= 0 || FLAGS_raft_replay_max_outstanding <= 0) {
+    return Status::InvalidArgument("--raft_replay_speed and "
+                                   "--raft_replay_max_outstanding must be positive");
+  }
+
+  vector<TrafficCaptureRecordPB> records;
+  int64_t num_skipped;
+  RETURN_NOT_OK(ReadTrafficCapture(FindOrDie(context.required_args, kCapturePathArg),
+                                   &records, &num_skipped));
+  if (records.empty()) {
+    return Status::NotFound("the traffic capture holds no writes to replay");
+  }
+
+  vector<RaftPeer> peers;
+  RETURN_NOT_OK(ConnectToRaftPeers(addresses, tablet_id, &peers));
+  const RaftPeer& leader = peers.front();
+
+  RaftLoadStats stats;
+  Semaphore outstanding(FLAGS_raft_replay_max_outstanding);
+  ReplayPayloadMaker payloads;
+  int64_t num_writes = 0;
+  int64_t payload_bytes = 0;
+  int64_t max_late_us = 0;
+
+  const int64_t first_arrival_us = records.front().arrival_us();
+  const int64_t captured_us = records.back().arrival_us() - first_arrival_us;
+  Stopwatch sw;
+  sw.start();
+  const MonoTime start = MonoTime::Now();
+  MonoTime next_lag_sample = start + MonoDelta::FromSeconds(1);
+  for (const TrafficCaptureRecordPB& record : records) {
+    const MonoTime due = start + MonoDelta::FromMicroseconds(
+        (record.arrival_us() - first_arrival_us) / FLAGS_raft_replay_speed);
+    MonoTime now = MonoTime::Now();
+    if (now >= next_lag_sample) {
+      SampleReplicationLag(tablet_id, &peers);
+      next_lag_sample = now + MonoDelta::FromSeconds(1);
+      now = MonoTime::Now();
+    }
+    if (now < due) {
+      SleepFor(due - now);
+    }
+    payloads.Observe(record);
+    for (int i = 0; i < record.uncompressed_bytes_size(); i++) {
+      // Ops without a payload are the leader's own, such as its no-op and
+      // config changes, rather than writes.
+      if (record.uncompressed_bytes(i) == 0) {
+        continue;
+      }
+      outstanding.Acquire();
+      max_late_us = std::max(max_late_us, (MonoTime::Now() - due).ToMicroseconds());
+      ReplayWrite* write = new ReplayWrite;
+      write->req.set_dest_uuid(leader.uuid);
+      write->req.set_tablet_id(tablet_id);
+      Status s = payloads.Make(record, i, write->req.mutable_write_payload());
+      if (PREDICT_FALSE(!s.ok())) {
+        delete write;
+        outstanding.Release();
+        return s.CloneAndPrepend("unable to make the payload of a write");
+      }
+      num_writes++;
+      payload_bytes += write->req.write_payload().payload().size();
+      write->rpc.set_timeout(MonoDelta::FromMilliseconds(FLAGS_timeout_ms));
+      write->sent = MonoTime::Now();
+      leader.proxy->ReplicateWriteAsync(write->req, &write->resp, &write->rpc,
+                                        [write, &stats, &outstanding]() {
+        Status s = write->rpc.status();
+        if (s.ok() && write->resp.has_error()) {
+          s = StatusFromPB(write->resp.error().status());
+        }
+        if (PREDICT_TRUE(s.ok())) {
+          stats.latency_us.Increment((MonoTime::Now() - write->sent).ToMicroseconds());
+        } else {
+          stats.num_errors++;
+          lock_guard<simple_spinlock> l(stats.lock);
+          if (stats.first_error.ok()) {
+            stats.first_error = s;
+          }
+        }
+        delete write;
+        outstanding.Release();
+      });
+    }
+  }
+  // Wait for the last writes to commit.
+  for (int i = 0; i < FLAGS_raft_replay_max_outstanding; i++) {
+    outstanding.Acquire();
+  }
+  sw.stop();
+  SampleReplicationLag(tablet_id, &peers);
+
+  const HdrHistogram& latency = stats.latency_us;
+  const double secs = sw.elapsed().wall_seconds();
+  const int64_t ops = latency.TotalCount();
+  DataTable summary({ "requests", "skipped_requests", "writes", "ops", "errors",
+                      "captured_sec", "replayed_sec", "ops_per_sec", "payload_mb_per_sec",
+                      "max_late_us", "p50_us", "p95_us", "p99_us", "p999_us", "max_us" });
+  summary.AddRow({ std::to_string(records.size()),
+                   std::to_string(num_skipped),
+                   std::to_string(num_writes),
+                   std::to_string(ops),
+                   std::to_string(stats.num_errors.load()),
+                   StringPrintf("%.1f", captured_us / 1e6),
+                   StringPrintf("%.1f", secs),
+                   StringPrintf("%.1f", secs > 0 ? ops / secs : 0),
+                   StringPrintf("%.2f", secs > 0 ? payload_bytes / secs / (1024 * 1024) : 0),
+                   std::to_string(max_late_us),
+                   std::to_string(latency.ValueAtPercentile(50)),
+                   std::to_string(latency.ValueAtPercentile(95)),
+                   std::to_string(latency.ValueAtPercentile(99)),
+                   std::to_string(latency.ValueAtPercentile(99.9)),
+                   std::to_string(latency.MaxValue()) });
+  RETURN_NOT_OK(summary.PrintTo(cout));
+  RETURN_NOT_OK(PrintReplicationLag(peers));
+
+  lock_guard<simple_spinlock> l(stats.lock);
+  if (ops == 0 && !stats.first_error.ok()) {
+    return stats.first_error.CloneAndPrepend("no write committed");
+  }
+  return Status::OK();
+}
+
 } // anonymous namespace
 
 unique_ptr<Mode> BuildPerfMode() {
+#ifdef FB_DO_NOT_REMOVE
   unique_ptr<Action> insert =
       ActionBuilder("loadgen", &TestLoadGenerator)
       .Description("Run load generation with optional scan afterwards")
@@ -787,10 +1532,75 @@ unique_ptr<Mode> BuildPerfMode() {
       .AddOptionalParameter("table_num_replicas")
       .AddOptionalParameter("use_random")
       .Build();
+#endif
+
+  unique_ptr<Action> raft_insert =
+      ActionBuilder("raft_loadgen", &RaftLoadGenerator)
+      .Description("Run load generation against the Raft config of a tablet")
+      .ExtraDescription(
+          "Issues opaque writes to the leader of the tablet's Raft config "
+          "for --raft_loadgen_run_time_sec, each thread waiting for its "
+          "write to commit before issuing the next one, then reports the "
+          "commit throughput and latency percentiles, and how many ops "
+          "behind the leader each follower was. The servers must be run "
+          "with --raft_enable_replicate_write. With --format=json, the "
+          "summary and the per-peer lag are printed as one JSON array each. "
+          "With --raft_loadgen_baseline_path, also fails if the commit "
+          "throughput, p99 latency, host CPU per op or bytes replicated per "
+          "op regressed from the baseline by more than its tolerance.")
+      .AddRequiredParameter({ kTServerAddressesArg,
+          "Comma-separated list of the addresses of the tablet servers "
+          "hosting the tablet's replicas. Addresses are in 'hostname:port' "
+          "form where port may be omitted if a server listens at the "
+          "default port." })
+      .AddRequiredParameter({ kTabletIdArg, kTabletIdArgDesc })
+      .AddOptionalParameter("format")
+      .AddOptionalParameter("num_threads")
+      .AddOptionalParameter("raft_loadgen_baseline_path")
+      .AddOptionalParameter("raft_loadgen_baseline_tolerance_pct")
+      .AddOptionalParameter("raft_loadgen_compression_codec")
+      .AddOptionalParameter("raft_loadgen_payload_bytes")
+      .AddOptionalParameter("raft_loadgen_run_time_sec")
+      .AddOptionalParameter("raft_loadgen_save_baseline_path")
+      .AddOptionalParameter("timeout_ms")
+      .Build();
+
+  unique_ptr<Action> raft_replay =
+      ActionBuilder("raft_replay", &RaftReplay)
+      .Description("Replay a traffic capture against the Raft config of a tablet")
+      .ExtraDescription(
+          "Replays the writes which leaders were asked to replicate while "
+          "servers ran with --raft_traffic_capture_path, issuing opaque "
+          "writes to the leader of the tablet's Raft config at the captured "
+          "arrival times, with payloads of the captured sizes which compress "
+          "about as well as the captured ones did. Reports the commit "
+          "throughput and latency percentiles, how far behind the captured "
+          "arrival pattern the replay fell, and how many ops behind the "
+          "leader each follower was. What followers captured is skipped, as "
+          "it's what their leaders replicated. The servers must be run "
+          "with --raft_enable_replicate_write.")
+      .AddRequiredParameter({ kTServerAddressesArg,
+          "Comma-separated list of the addresses of the tablet servers "
+          "hosting the tablet's replicas. Addresses are in 'hostname:port' "
+          "form where port may be omitted if a server listens at the "
+          "default port." })
+      .AddRequiredParameter({ kTabletIdArg, kTabletIdArgDesc })
+      .AddRequiredParameter({ kCapturePathArg,
+          "Path to the file which --raft_traffic_capture_path captured to." })
+      .AddOptionalParameter("format")
+      .AddOptionalParameter("raft_replay_capture_tablet_id")
+      .AddOptionalParameter("raft_replay_max_outstanding")
+      .AddOptionalParameter("raft_replay_speed")
+      .AddOptionalParameter("timeout_ms")
+      .Build();
 
   return ModeBuilder("perf")
       .Description("Measure the performance of a Kudu cluster")
+#ifdef FB_DO_NOT_REMOVE
       .AddAction(std::move(insert))
+#endif
+      .AddAction(std::move(raft_insert))
+      .AddAction(std::move(raft_replay))
       .Build();
 }
 
@@ -0,0 +1,597 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+//
+// Checks the replication health of a single Raft config, ksck-style, by
+// asking each of its members for its consensus state and last OpIds:
+//
+//   kudu raft check <tserver_addresses> <tablet_id> [--watch_interval_sec=1]
+//
+// and traces the replication of sampled ops on a set of servers at once,
+// see OpTimeline::CaptureTrace():
+//
+//   kudu raft trace <tserver_addresses> [--trace_duration_ms=10000] > trace.json
+//
+// The members of the config are found from the committed config of the
+// first of 'tserver_addresses' which hosts the tablet, so one address is
+// enough. For every member it prints its role, term and indexes, how far it
+// is behind the leader in ops, in bytes and in seconds, the rate at which it
+// receives ops, an estimate of how long it needs to catch up, the peer its
+// requests are proxied from, and what's wrong with it, if anything.
+//
+// Every member is sampled at once, with asynchronous RPCs. Rates are measured
+// between two samples, 'rate_sample_ms' apart for a single check, or between
+// successive samples in watch mode. Lag in bytes is estimated from the
+// average size of the ops in the leader's log cache, and lag in seconds from
+// the rate at which the leader appends ops.
+
+#include "kudu/tools/tool_action.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+
+#include "kudu/common/wire_protocol.h"
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/consensus.proxy.h"
+#include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/strip.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/rpc/response_callback.h"
+#include "kudu/rpc/rpc_controller.h"
+#include "kudu/tools/tool_action_common.h"
+#include "kudu/tserver/tablet_server.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+DEFINE_int32(watch_interval_sec, 0,
+             "If positive, check the config again every this many seconds "
+             "until interrupted, instead of checking it once.");
+DEFINE_int32(rate_sample_ms, 1000,
+             "How far apart the two samples a single check takes are, to "
+             "measure the rates at which the replicas receive ops.");
+
+DEFINE_int32(trace_duration_ms, 10000,
+             "How long 'kudu raft trace' traces the servers for.");
+DEFINE_int32(trace_sample_interval, 100,
+             "'kudu raft trace' traces one op out of this many, by index.");
+
+DECLARE_int64(timeout_ms);
+
+namespace kudu {
+namespace tools {
+
+using consensus::CaptureConsensusTraceRequestPB;
+using consensus::CaptureConsensusTraceResponsePB;
+using consensus::ConsensusServiceProxy;
+using consensus::ConsensusStatePB;
+using consensus::GetConsensusStateRequestPB;
+using consensus::GetConsensusStateResponsePB;
+using consensus::GetLastOpIdRequestPB;
+using consensus::GetLastOpIdResponsePB;
+using consensus::GetNodeInstanceRequestPB;
+using consensus::GetNodeInstanceResponsePB;
+using consensus::HealthReportPB;
+using consensus::ProxyTopologyPB;
+using consensus::RaftPeerPB;
+using rpc::RpcController;
+using std::cout;
+using std::endl;
+using std::map;
+using std::string;
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
+using strings::Substitute;
+
+namespace {
+
+const char* const kTServerAddressesArg = "tserver_addresses";
+
+// A member of the config being checked, and what its last two samples found.
+struct RaftMember {
+  string uuid;
+  string address;
+  unique_ptr<ConsensusServiceProxy> proxy;
+
+  // From the latest sample. The other fields are only valid if 'status' is OK.
+  Status status;
+  MonoTime sampled_at;
+  ConsensusStatePB cstate;
+  ProxyTopologyPB proxy_topology;
+  int64_t cached_ops = 0;
+  int64_t cached_bytes = 0;
+  int64_t received_index = -1;
+  int64_t committed_index = -1;
+
+  // From the sample before, or -1 if there wasn't a good one.
+  MonoTime prev_sampled_at;
+  int64_t prev_received_index = -1;
+};
+
+Status GetUuid(ConsensusServiceProxy* proxy, string* uuid) {
+  GetNodeInstanceRequestPB req;
+  GetNodeInstanceResponsePB resp;
+  RpcController rpc;
+  rpc.set_timeout(MonoDelta::FromMilliseconds(FLAGS_timeout_ms));
+  RETURN_NOT_OK(proxy->GetNodeInstance(req, &resp, &rpc));
+  *uuid = resp.node_instance().permanent_uuid();
+  return Status::OK();
+}
+
+Status GetConsensusState(const RaftMember& member, const string& tablet_id,
+                         GetConsensusStateResponsePB::TabletConsensusInfoPB* info) {
+  GetConsensusStateRequestPB req;
+  req.set_dest_uuid(member.uuid);
+  req.add_tablet_ids(tablet_id);
+  req.set_report_health(consensus::INCLUDE_HEALTH_REPORT);
+  GetConsensusStateResponsePB resp;
+  RpcController rpc;
+  rpc.set_timeout(MonoDelta::FromMilliseconds(FLAGS_timeout_ms));
+  RETURN_NOT_OK(RpcStatus(member.proxy->GetConsensusState(req, &resp, &rpc), resp));
+  if (resp.tablets_size() != 1 || !resp.tablets(0).has_cstate()) {
+    return Status::NotFound("tablet not hosted", tablet_id);
+  }
+  *info = resp.tablets(0);
+  return Status::OK();
+}
+
+// What a sample asks a member and what it answers.
+struct MemberSample {
+  GetConsensusStateRequestPB cstate_req;
+  GetConsensusStateResponsePB cstate_resp;
+  GetLastOpIdRequestPB received_req;
+  GetLastOpIdResponsePB received_resp;
+  GetLastOpIdRequestPB committed_req;
+  GetLastOpIdResponsePB committed_resp;
+};
+
+// The calls each member is sampled with.
+const int kCallsPerSample = 3;
+
+// Samples the consensus state and last received and committed OpIds of
+// every member at once, so that a slow or unreachable one doesn't hold up
+// the others, nor skew their lags. What each member answered before is kept
+// for the rates.
+void SampleMembers(const string& tablet_id, vector<RaftMember>* members) {
+  vector<RaftMember*> sampled;
+  for (RaftMember& member : *members) {
+    if (member.status.ok() && member.received_index >= 0) {
+      member.prev_received_index = member.received_index;
+      member.prev_sampled_at = member.sampled_at;
+    } else {
+      member.prev_received_index = -1;
+    }
+    if (member.proxy) {
+      sampled.push_back(&member);
+    }
+  }
+
+  vector<MemberSample> samples(sampled.size());
+  for (int i = 0; i < sampled.size(); i++) {
+    MemberSample* sample = &samples[i];
+    sample->cstate_req.set_dest_uuid(sampled[i]->uuid);
+    sample->cstate_req.add_tablet_ids(tablet_id);
+    sample->cstate_req.set_report_health(consensus::INCLUDE_HEALTH_REPORT);
+    sample->received_req.set_dest_uuid(sampled[i]->uuid);
+    sample->received_req.set_tablet_id(tablet_id);
+    sample->received_req.set_opid_type(consensus::RECEIVED_OPID);
+    sample->committed_req = sample->received_req;
+    sample->committed_req.set_opid_type(consensus::COMMITTED_OPID);
+  }
+  vector<Status> statuses;
+  FanOutRpcs(kCallsPerSample * sampled.size(),
+             [&](size_t i, RpcController* rpc, const rpc::ResponseCallback& done) {
+    ConsensusServiceProxy* proxy = sampled[i / kCallsPerSample]->proxy.get();
+    MemberSample* sample = &samples[i / kCallsPerSample];
+    switch (i % kCallsPerSample) {
+      case 0:
+        proxy->GetConsensusStateAsync(sample->cstate_req, &sample->cstate_resp, rpc, done);
+        break;
+      case 1:
+        proxy->GetLastOpIdAsync(sample->received_req, &sample->received_resp, rpc, done);
+        break;
+      default:
+        proxy->GetLastOpIdAsync(sample->committed_req, &sample->committed_resp, rpc, done);
+        break;
+    }
+  }, &statuses);
+
+  const MonoTime now = MonoTime::Now();
+  for (int i = 0; i < sampled.size(); i++) {
+    RaftMember* member = sampled[i];
+    const MemberSample& sample = samples[i];
+    const GetConsensusStateResponsePB& cstate_resp = sample.cstate_resp;
+    Status s = RpcStatus(statuses[kCallsPerSample * i], cstate_resp);
+    if (s.ok() && (cstate_resp.tablets_size() != 1 || !cstate_resp.tablets(0).has_cstate())) {
+      s = Status::NotFound("tablet not hosted", tablet_id);
+    }
+    if (s.ok()) {
+      s = RpcStatus(statuses[kCallsPerSample * i + 1], sample.received_resp);
+    }
+    if (s.ok()) {
+      s = RpcStatus(statuses[kCallsPerSample * i + 2], sample.committed_resp);
+    }
+    member->sampled_at = now;
+    member->status = s;
+    if (!s.ok()) {
+      continue;
+    }
+    const auto& info = cstate_resp.tablets(0);
+    member->cstate = info.cstate();
+    member->proxy_topology = info.proxy_topology();
+    member->cached_ops = info.log_cache_num_ops();
+    member->cached_bytes = info.log_cache_bytes();
+    member->received_index = sample.received_resp.opid().index();
+    member->committed_index = sample.committed_resp.opid().index();
+  }
+}
+
+// Finds the members of the config of 'tablet_id' from the committed config
+// of the first server in 'addresses' hosting it.
+Status DiscoverMembers(const vector<string>& addresses, const string& tablet_id,
+                       vector<RaftMember>* members) {
+  Status first_error;
+  for (const string& address : addresses) {
+    RaftMember seed;
+    seed.address = address;
+    Status s = BuildProxy(address, tserver::TabletServer::kDefaultPort, &seed.proxy);
+    if (s.ok()) {
+      s = GetUuid(seed.proxy.get(), &seed.uuid);
+    }
+    GetConsensusStateResponsePB::TabletConsensusInfoPB info;
+    if (s.ok()) {
+      s = GetConsensusState(seed, tablet_id, &info);
+    }
+    if (!s.ok()) {
+      if (first_error.ok()) {
+        first_error = s.CloneAndPrepend(Substitute("unable to check $0", address));
+      }
+      continue;
+    }
+
+    for (const RaftPeerPB& peer : info.cstate().committed_config().peers()) {
+      RaftMember member;
+      member.uuid = peer.permanent_uuid();
+      if (member.uuid == seed.uuid) {
+        member.address = seed.address;
+        member.proxy = std::move(seed.proxy);
+      } else if (peer.has_last_known_addr()) {
+        member.address = Substitute("$0:$1", peer.last_known_addr().host(),
+                                    peer.last_known_addr().port());
+        member.status = BuildProxy(member.address, tserver::TabletServer::kDefaultPort,
+                                   &member.proxy);
+      } else {
+        member.status = Status::NotFound("no known address");
+      }
+      members->emplace_back(std::move(member));
+    }
+    return Status::OK();
+  }
+  return first_error.ok() ? Status::InvalidArgument("no tablet server addresses") : first_error;
+}
+
+// Returns the member which leads the config in the highest term any member
+// knows of, or nullptr if none does.
+const RaftMember* FindLeader(const vector<RaftMember>& members) {
+  const RaftMember* leader = nullptr;
+  for (const RaftMember& member : members) {
+    if (member.status.ok() && member.cstate.leader_uuid() == member.uuid &&
+        (!leader || member.cstate.current_term() > leader->cstate.current_term())) {
+      leader = &member;
+    }
+  }
+  return leader;
+}
+
+// Returns the rate at which 'member' received ops between its last two
+// samples, or a negative value if it can't be told.
+double ReceiveRate(const RaftMember& member) {
+  if (!member.status.ok() || member.prev_received_index < 0) {
+    return -1;
+  }
+  double secs = (member.sampled_at - member.prev_sampled_at).ToSeconds();
+  if (secs <= 0) {
+    return -1;
+  }
+  return (member.received_index - member.prev_received_index) / secs;
+}
+
+string HealthOf(const RaftMember* leader, const string& uuid) {
+  if (!leader) {
+    return "UNKNOWN";
+  }
+  for (const RaftPeerPB& peer : leader->cstate.committed_config().peers()) {
+    if (peer.permanent_uuid() == uuid && peer.has_health_report()) {
+      return HealthReportPB::HealthStatus_Name(peer.health_report().overall_health());
+    }
+  }
+  return "UNKNOWN";
+}
+
+// Prints a row per member of the config and returns how many of them have
+// problems.
+Status PrintCheck(const vector<RaftMember>& members, int* num_unhealthy) {
+  const RaftMember* leader = FindLeader(members);
+  unordered_map<string, const RaftMember*> by_uuid;
+  for (const RaftMember& member : members) {
+    by_uuid[member.uuid] = &member;
+  }
+  // Who each member's requests are proxied from, as the leader routes them.
+  map<string, string> proxied_from;
+  if (leader) {
+    for (const auto& edge : leader->proxy_topology.proxy_edges()) {
+      proxied_from[edge.peer_uuid()] = edge.proxy_from_uuid();
+    }
+  }
+  double leader_rate = leader ? ReceiveRate(*leader) : -1;
+  double avg_op_bytes = leader && leader->cached_ops > 0 ?
+      static_cast<double>(leader->cached_bytes) / leader->cached_ops : 0;
+
+  DataTable table({ "uuid", "address", "role", "term", "received", "committed",
+                    "lag_ops", "lag_bytes", "lag_sec", "ops_per_sec",
+                    "catch_up_sec", "proxy_from", "health", "status" });
+  *num_unhealthy = 0;
+  for (const RaftMember& member : members) {
+    const string& proxy_uuid = FindWithDefault(proxied_from, member.uuid, "");
+    string health = HealthOf(leader, member.uuid);
+    if (!member.status.ok()) {
+      (*num_unhealthy)++;
+      table.AddRow({ member.uuid, member.address, "", "", "", "", "", "", "", "",
+                     "", proxy_uuid, health,
+                     "UNREACHABLE: " + member.status.ToString() });
+      continue;
+    }
+
+    const RaftPeerPB* pb = nullptr;
+    for (const RaftPeerPB& peer : member.cstate.committed_config().peers()) {
+      if (peer.permanent_uuid() == member.uuid) pb = &peer;
+    }
+    string role = leader == &member ? "LEADER" :
+        (pb && pb->member_type() == RaftPeerPB::NON_VOTER ? "LEARNER" : "FOLLOWER");
+
+    string problem;
+    if (!leader) {
+      problem = "NO_LEADER";
+    } else if (member.cstate.current_term() < leader->cstate.current_term()) {
+      problem = Substitute("STALE_TERM (leader is in term $0)", leader->cstate.current_term());
+    } else if (member.cstate.leader_uuid() != leader->uuid) {
+      problem = member.cstate.has_leader_uuid() ?
+          Substitute("WRONG_LEADER (follows $0)", member.cstate.leader_uuid()) :
+          "NO_LEADER_KNOWN";
+    } else if (health == "FAILED" || health == "FAILED_UNRECOVERABLE") {
+      problem = "FAILED";
+    } else if (!proxy_uuid.empty()) {
+      const RaftMember* proxy = FindPtrOrNull(by_uuid, proxy_uuid);
+      string proxy_health = HealthOf(leader, proxy_uuid);
+      if (!proxy || !proxy->status.ok() ||
+          proxy_health == "FAILED" || proxy_health == "FAILED_UNRECOVERABLE") {
+        problem = Substitute("PROXY_UNHEALTHY ($0)", proxy_uuid);
+      }
+    }
+    if (!problem.empty()) {
+      (*num_unhealthy)++;
+    }
+
+    string lag_ops, lag_bytes, lag_sec, catch_up_sec;
+    double rate = ReceiveRate(member);
+    if (leader) {
+      int64_t lag = std::max<int64_t>(0, leader->received_index - member.received_index);
+      lag_ops = std::to_string(lag);
+      lag_bytes = std::to_string(static_cast<int64_t>(lag * avg_op_bytes));
+      if (lag == 0) {
+        lag_sec = "0";
+        catch_up_sec = "0";
+      } else if (leader_rate > 0) {
+        lag_sec = StringPrintf("%.1f", lag / leader_rate);
+        if (rate >= 0) {
+          catch_up_sec = rate > leader_rate ?
+              StringPrintf("%.1f", lag / (rate - leader_rate)) : "never";
+        }
+      } else if (leader_rate == 0 && rate > 0) {
+        // The leader is idle, so the member catches up at its own rate.
+        catch_up_sec = StringPrintf("%.1f", lag / rate);
+      }
+    }
+    table.AddRow({ member.uuid, member.address, role,
+                   std::to_string(member.cstate.current_term()),
+                   std::to_string(member.received_index),
+                   std::to_string(member.committed_index),
+                   lag_ops, lag_bytes, lag_sec,
+                   rate >= 0 ? StringPrintf("%.1f", rate) : "",
+                   catch_up_sec, proxy_uuid, health,
+                   problem.empty() ? "OK" : problem });
+  }
+  return table.PrintTo(cout);
+}
+
+Status CheckRaftConfig(const RunnerContext& context) {
+  const string& tablet_id = FindOrDie(context.required_args, kTabletIdArg);
+  vector<string> addresses = strings::Split(
+      FindOrDie(context.required_args, kTServerAddressesArg), ",", strings::SkipEmpty());
+  if (FLAGS_watch_interval_sec < 0 || FLAGS_rate_sample_ms < 0) {
+    return Status::InvalidArgument("--watch_interval_sec and --rate_sample_ms "
+                                   "must not be negative");
+  }
+
+  vector<RaftMember> members;
+  RETURN_NOT_OK(DiscoverMembers(addresses, tablet_id, &members));
+  SampleMembers(tablet_id, &members);
+
+  int num_unhealthy;
+  if (FLAGS_watch_interval_sec == 0) {
+    SleepFor(MonoDelta::FromMilliseconds(FLAGS_rate_sample_ms));
+    SampleMembers(tablet_id, &members);
+    RETURN_NOT_OK(PrintCheck(members, &num_unhealthy));
+    if (num_unhealthy > 0) {
+      return Status::RuntimeError(Substitute("$0 of $1 replicas of tablet $2 are unhealthy",
+                                             num_unhealthy, members.size(), tablet_id));
+    }
+    cout << "OK" << endl;
+    return Status::OK();
+  }
+
+  // Each round costs three small RPCs per member, so it's fine to watch a
+  // config every second for as long as it takes.
+  const MonoTime start = MonoTime::Now();
+  MonoTime next = start;
+  while (true) {
+    next += MonoDelta::FromSeconds(FLAGS_watch_interval_sec);
+    MonoTime now = MonoTime::Now();
+    if (next > now) {
+      SleepFor(next - now);
+    } else {
+      // A round took longer than the interval; don't try to make up for it.
+      next = now;
+    }
+    SampleMembers(tablet_id, &members);
+    cout << Substitute("+$0s", static_cast<int64_t>((MonoTime::Now() - start).ToSeconds()))
+         << endl;
+    RETURN_NOT_OK(PrintCheck(members, &num_unhealthy));
+    cout << endl;
+  }
+}
+
+// Appends the events of 'trace_json', a trace in the Chrome trace event
+// format, to the comma-separated 'events'.
+void AppendTraceEvents(const string& trace_json, string* events) {
+  size_t begin = trace_json.find('[');
+  size_t end = trace_json.rfind(']');
+  if (begin == string::npos || end == string::npos || end <= begin) {
+    // The trace has no events.
+    return;
+  }
+  string body = trace_json.substr(begin + 1, end - begin - 1);
+  StripWhiteSpace(&body);
+  if (body.empty()) {
+    return;
+  }
+  if (!events->empty()) {
+    events->append(",\n");
+  }
+  events->append(body);
+}
+
+Status TraceRaftServers(const RunnerContext& context) {
+  vector<string> addresses = strings::Split(
+      FindOrDie(context.required_args, kTServerAddressesArg), ",", strings::SkipEmpty());
+  if (addresses.empty()) {
+    return Status::InvalidArgument("no tablet server addresses");
+  }
+  if (FLAGS_trace_duration_ms <= 0 || FLAGS_trace_sample_interval <= 0) {
+    return Status::InvalidArgument("--trace_duration_ms and --trace_sample_interval "
+                                   "must be positive");
+  }
+  vector<unique_ptr<ConsensusServiceProxy>> proxies(addresses.size());
+  for (int i = 0; i < addresses.size(); i++) {
+    RETURN_NOT_OK(BuildProxy(addresses[i], tserver::TabletServer::kDefaultPort, &proxies[i]));
+  }
+
+  CaptureConsensusTraceRequestPB req;
+  req.set_duration_ms(FLAGS_trace_duration_ms);
+  req.set_sample_interval(FLAGS_trace_sample_interval);
+  vector<CaptureConsensusTraceResponsePB> resps(addresses.size());
+  vector<Status> statuses;
+  // Every server is traced at once, so that the flows of the ops continue
+  // from the leader to the followers. A server only answers once its trace
+  // is over.
+  FLAGS_timeout_ms += FLAGS_trace_duration_ms;
+  FanOutRpcs(addresses.size(),
+             [&](size_t i, RpcController* rpc, const rpc::ResponseCallback& done) {
+    proxies[i]->CaptureConsensusTraceAsync(req, &resps[i], rpc, done);
+  }, &statuses);
+
+  string events;
+  for (int i = 0; i < addresses.size(); i++) {
+    RETURN_NOT_OK_PREPEND(RpcStatus(statuses[i], resps[i]),
+                          Substitute("unable to trace $0", addresses[i]));
+    AppendTraceEvents(resps[i].trace_json(), &events);
+  }
+  cout << "{\"traceEvents\": [\n" << events << "]}" << endl;
+  return Status::OK();
+}
+
+} // anonymous namespace
+
+unique_ptr<Mode> BuildRaftMode() {
+  unique_ptr<Action> check =
+      ActionBuilder("check", &CheckRaftConfig)
+      .Description("Check the replication health of a Raft config")
+      .ExtraDescription("Asks every member of the config of the tablet for its "
+                        "consensus state and last received and committed OpIds, "
+                        "and prints a row per member with its role, term, lag "
+                        "behind the leader in ops, bytes and seconds, receive "
+                        "rate, estimated time to catch up, proxy and health. "
+                        "Exits with an error if any member is unreachable, "
+                        "disagrees about the leader or term, is failed, or is "
+                        "proxied through such a member. With --watch_interval_sec, "
+                        "keeps checking until interrupted.")
+      .AddRequiredParameter({ kTServerAddressesArg,
+          "Comma-separated list of addresses of tablet servers hosting the "
+          "tablet, in 'hostname:port' form where port may be omitted if a "
+          "server listens at the default port. The members of the config are "
+          "found from the first one which answers." })
+      .AddRequiredParameter({ kTabletIdArg, kTabletIdArgDesc })
+      .AddOptionalParameter("format")
+      .AddOptionalParameter("rate_sample_ms")
+      .AddOptionalParameter("timeout_ms")
+      .AddOptionalParameter("watch_interval_sec")
+      .Build();
+
+  unique_ptr<Action> trace =
+      ActionBuilder("trace", &TraceRaftServers)
+      .Description("Trace the replication pipeline of tablet servers")
+      .ExtraDescription("Traces the replication of one op out of "
+                        "--trace_sample_interval, by index, on every server "
+                        "for --trace_duration_ms: where the leader replicates "
+                        "the op, appends it to its log cache, writes and syncs "
+                        "it to the WAL, sends it to each peer and gets its "
+                        "acks, where a follower receives and appends it, and "
+                        "where it's committed and applied. Prints the traces of "
+                        "the servers merged in the Chrome trace event format, "
+                        "which chrome://tracing and Perfetto load, with the "
+                        "events of each op tied together by a flow. The servers "
+                        "must be run with --raft_trace_capture_max_duration_ms.")
+      .AddRequiredParameter({ kTServerAddressesArg,
+          "Comma-separated list of addresses of tablet servers to trace, in "
+          "'hostname:port' form where port may be omitted if a server listens "
+          "at the default port." })
+      .AddOptionalParameter("timeout_ms")
+      .AddOptionalParameter("trace_duration_ms")
+      .AddOptionalParameter("trace_sample_interval")
+      .Build();
+
+  return ModeBuilder("raft")
+      .Description("Operate on Raft configs")
+      .AddAction(std::move(check))
+      .AddAction(std::move(trace))
+      .Build();
+}
+
+} // namespace tools
+} // namespace kudu
@@ -17,27 +17,62 @@
 
 #include "kudu/tools/tool_action.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include <gflags/gflags.h>
+
+#include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.pb.h"
 #include "kudu/consensus/log_util.h"
+#include "kudu/consensus/opid.pb.h"
+#include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/tools/tool_action_common.h"
 #include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/path_util.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_int32(scan_threads, 4,
+             "Number of threads with which to scan WAL segments. Each segment "
+             "is scanned by a single thread.");
 
 namespace kudu {
 namespace tools {
 
+using consensus::OperationType_Name;
+using log::LogEntryBatchPB;
+using log::LogEntryPB;
+using log::LogEntryTypePB_Name;
 using log::ReadableLogSegment;
+using std::cout;
+using std::endl;
+using std::map;
 using std::string;
 using std::unique_ptr;
+using std::vector;
+using strings::Substitute;
 
 namespace {
 
+const char* const kWalDirArg = "wal_dir";
+
+#ifdef FB_DO_NOT_REMOVE
 const char* const kPathArg = "path";
 
 Status Dump(const RunnerContext& context) {
@@ -48,10 +83,245 @@ Status Dump(const RunnerContext& context) {
   RETURN_NOT_OK(PrintSegment(segment));
   return Status::OK();
 }
+#endif
+
+// Sizes of the entries of one kind across the scanned segments. Shared by the
+// scanning threads, which is fine since HdrHistogram is thread-safe.
+class EntrySizes {
+ public:
+  // Returns the histogram of the entries of kind 'name', creating it if needed.
+  HdrHistogram* Get(const string& name) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    unique_ptr<HdrHistogram>& histogram = histograms_[name];
+    if (!histogram) {
+      histogram.reset(new HdrHistogram(kMaxEntrySize, 2));
+    }
+    return histogram.get();
+  }
+
+  const map<string, unique_ptr<HdrHistogram>>& histograms() const {
+    return histograms_;
+  }
+
+ private:
+  static const uint64_t kMaxEntrySize = 1LU << 32;
+
+  simple_spinlock lock_;
+  map<string, unique_ptr<HdrHistogram>> histograms_;
+};
+
+// What scanning a segment found.
+struct SegmentScan {
+  string path;
+  int64_t sequence_number = -1;
+  int64_t num_batches = 0;
+  int64_t num_entries = 0;
+
+  // Bytes of batches as written, including entry headers, and as decoded.
+  int64_t disk_bytes = 0;
+  int64_t data_bytes = 0;
+
+  // The first and last REPLICATE indexes, in the order they appear.
+  int64_t first_index = -1;
+  int64_t last_index = -1;
+
+  // Number of REPLICATEs whose index skips past the one appearing before
+  // them, and of those whose index goes back to or before it, as happens when
+  // the log is truncated by a new leader.
+  int64_t index_gaps = 0;
+  int64_t index_rewinds = 0;
+
+  // The first problem with the segment, which stops its scan: a corrupt or
+  // unreadable batch, or a footer which disagrees with the segment's entries.
+  Status status;
+};
+
+// Scans the segment at 'path', verifying the checksums of every batch and
+// parsing its entries, but not converting them to text.
+void ScanSegment(const string& path, EntrySizes* sizes, SegmentScan* scan) {
+  scan->path = path;
+  scoped_refptr<ReadableLogSegment> segment;
+  Status s = ReadableLogSegment::Open(Env::Default(), path, &segment);
+  if (!s.ok()) {
+    scan->status = s;
+    return;
+  }
+  scan->sequence_number = segment->header().sequence_number();
+
+  HdrHistogram* batch_sizes = sizes->Get("batch");
+  faststring tmp_buf;
+  LogEntryBatchPB batch;
+  int64_t offset = segment->first_entry_offset();
+  const int64_t read_up_to = segment->readable_up_to();
+  while (offset + segment->entry_header_size() < read_up_to) {
+    const int64_t batch_offset = offset;
+    Slice payload;
+    s = segment->ReadEntryBatchPayload(&offset, &tmp_buf, &payload);
+    if (!s.ok()) {
+      scan->status = s.CloneAndPrepend(Substitute("batch at offset $0", batch_offset));
+      return;
+    }
+    batch.Clear();
+    if (!batch.ParseFromArray(payload.data(), payload.size())) {
+      scan->status = Status::Corruption(
+          Substitute("unable to parse batch at offset $0", batch_offset));
+      return;
+    }
+    scan->num_batches++;
+    scan->disk_bytes += offset - batch_offset;
+    scan->data_bytes += payload.size();
+    batch_sizes->Increment(offset - batch_offset);
+
+    for (const LogEntryPB& entry : batch.entry()) {
+      scan->num_entries++;
+      if (entry.type() != log::REPLICATE || !entry.has_replicate()) {
+        sizes->Get(LogEntryTypePB_Name(entry.type()))->Increment(entry.ByteSizeLong());
+        continue;
+      }
+      const auto& replicate = entry.replicate();
+      sizes->Get(OperationType_Name(replicate.op_type()))->Increment(replicate.ByteSizeLong());
+      int64_t index = replicate.id().index();
+      if (scan->first_index == -1) {
+        scan->first_index = index;
+      } else if (index > scan->last_index + 1) {
+        scan->index_gaps++;
+      } else if (index <= scan->last_index) {
+        scan->index_rewinds++;
+      }
+      scan->last_index = index;
+    }
+  }
+
+  if (segment->HasFooter() && segment->footer().num_entries() != scan->num_entries) {
+    scan->status = Status::Corruption(
+        Substitute("footer claims $0 entries", segment->footer().num_entries()));
+  }
+}
+
+// Scans every segment in the WAL directory of the context's arguments on
+// --scan_threads threads, returning the scans in log order.
+Status ScanSegments(const RunnerContext& context,
+                    EntrySizes* sizes,
+                    vector<SegmentScan>* scans) {
+  const string& wal_dir = FindOrDie(context.required_args, kWalDirArg);
+  vector<string> children;
+  RETURN_NOT_OK_PREPEND(Env::Default()->GetChildren(wal_dir, &children),
+                        "unable to list WAL directory");
+  vector<string> paths;
+  for (const string& child : children) {
+    if (log::IsLogFileName(child)) {
+      paths.emplace_back(JoinPathSegments(wal_dir, child));
+    }
+  }
+
+  gscoped_ptr<ThreadPool> pool;
+  RETURN_NOT_OK(ThreadPoolBuilder("wal-scan")
+                .set_max_threads(std::max(FLAGS_scan_threads, 1))
+                .Build(&pool));
+  scans->resize(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    const string& path = paths[i];
+    SegmentScan* scan = &(*scans)[i];
+    RETURN_NOT_OK(pool->SubmitFunc([path, sizes, scan]() {
+      ScanSegment(path, sizes, scan);
+    }));
+  }
+  pool->Wait();
+  pool->Shutdown();
+
+  // Segments which couldn't be opened sort first.
+  std::sort(scans->begin(), scans->end(),
+            [](const SegmentScan& a, const SegmentScan& b) {
+    return a.sequence_number < b.sequence_number;
+  });
+  return Status::OK();
+}
+
+string Ratio(int64_t a, int64_t b) {
+  return b == 0 ? "" : StringPrintf("%.2f", static_cast<double>(a) / b);
+}
+
+Status Scan(const RunnerContext& context) {
+  EntrySizes sizes;
+  vector<SegmentScan> scans;
+  RETURN_NOT_OK(ScanSegments(context, &sizes, &scans));
+
+  DataTable table({ "sequence_number", "path", "batches", "entries",
+                    "disk_bytes", "data_bytes", "compression_ratio",
+                    "first_index", "last_index", "index_gaps", "index_rewinds",
+                    "status" });
+  SegmentScan total;
+  int64_t last_index = -1;
+  int num_bad_segments = 0;
+  for (SegmentScan& scan : scans) {
+    // A gap between this segment and the one before it is one within the log.
+    if (scan.first_index != -1) {
+      if (last_index != -1 && scan.first_index > last_index + 1) {
+        scan.index_gaps++;
+      } else if (last_index != -1 && scan.first_index <= last_index) {
+        scan.index_rewinds++;
+      }
+      last_index = scan.last_index;
+    }
+    table.AddRow({ std::to_string(scan.sequence_number), scan.path,
+                   std::to_string(scan.num_batches), std::to_string(scan.num_entries),
+                   std::to_string(scan.disk_bytes), std::to_string(scan.data_bytes),
+                   Ratio(scan.data_bytes, scan.disk_bytes),
+                   std::to_string(scan.first_index), std::to_string(scan.last_index),
+                   std::to_string(scan.index_gaps), std::to_string(scan.index_rewinds),
+                   scan.status.ToString() });
+    total.num_batches += scan.num_batches;
+    total.num_entries += scan.num_entries;
+    total.disk_bytes += scan.disk_bytes;
+    total.data_bytes += scan.data_bytes;
+    total.index_gaps += scan.index_gaps;
+    total.index_rewinds += scan.index_rewinds;
+    // Preallocated segments which were never written are not a problem.
+    if (!scan.status.ok() && !scan.status.IsUninitialized()) {
+      num_bad_segments++;
+    }
+  }
+  table.AddRow({ "", "total",
+                 std::to_string(total.num_batches), std::to_string(total.num_entries),
+                 std::to_string(total.disk_bytes), std::to_string(total.data_bytes),
+                 Ratio(total.data_bytes, total.disk_bytes),
+                 scans.empty() ? "-1" : std::to_string(scans.front().first_index),
+                 std::to_string(last_index),
+                 std::to_string(total.index_gaps), std::to_string(total.index_rewinds),
+                 Substitute("$0 of $1 segments bad", num_bad_segments, scans.size()) });
+  RETURN_NOT_OK(table.PrintTo(cout));
+  if (num_bad_segments > 0) {
+    return Status::Corruption(Substitute("$0 bad WAL segments", num_bad_segments));
+  }
+  return Status::OK();
+}
+
+Status Stats(const RunnerContext& context) {
+  EntrySizes sizes;
+  vector<SegmentScan> scans;
+  RETURN_NOT_OK(ScanSegments(context, &sizes, &scans));
+
+  DataTable table({ "kind", "count", "bytes", "min_bytes", "mean_bytes",
+                    "p50_bytes", "p95_bytes", "p99_bytes", "max_bytes" });
+  for (const auto& e : sizes.histograms()) {
+    const HdrHistogram& h = *e.second;
+    if (h.TotalCount() == 0) {
+      continue;
+    }
+    table.AddRow({ e.first, std::to_string(h.TotalCount()), std::to_string(h.TotalSum()),
+                   std::to_string(h.MinValue()), StringPrintf("%.1f", h.MeanValue()),
+                   std::to_string(h.ValueAtPercentile(50)),
+                   std::to_string(h.ValueAtPercentile(95)),
+                   std::to_string(h.ValueAtPercentile(99)),
+                   std::to_string(h.MaxValue()) });
+  }
+  return table.PrintTo(cout);
+}
 
 } // anonymous namespace
 
 unique_ptr<Mode> BuildWalMode() {
+#ifdef FB_DO_NOT_REMOVE
   unique_ptr<Action> dump =
       ActionBuilder("dump", &Dump)
       .Description("Dump a WAL (write-ahead log) file")
@@ -60,10 +330,40 @@ unique_ptr<Mode> BuildWalMode() {
       .AddOptionalParameter("print_meta")
       .AddOptionalParameter("truncate_data")
       .Build();
+#endif
+
+  unique_ptr<Action> scan =
+      ActionBuilder("scan", &Scan)
+      .Description("Verify every segment of a WAL (write-ahead log)")
+      .ExtraDescription("Reads every batch of every segment in the WAL directory, "
+                        "verifying its checksums and parsing its entries, and "
+                        "prints a row per segment with its sizes, compression "
+                        "ratio, REPLICATE index range, index gaps and status, "
+                        "followed by a row of totals. Exits with an error if any "
+                        "segment is corrupt.")
+      .AddRequiredParameter({ kWalDirArg, "path to a tablet's WAL directory" })
+      .AddOptionalParameter("format")
+      .AddOptionalParameter("scan_threads")
+      .Build();
+
+  unique_ptr<Action> stats =
+      ActionBuilder("stats", &Stats)
+      .Description("Summarize the entries of a WAL (write-ahead log)")
+      .ExtraDescription("Prints the number and size distribution of the batches "
+                        "and of each kind of entry, by operation type for "
+                        "REPLICATEs, across every segment in the WAL directory.")
+      .AddRequiredParameter({ kWalDirArg, "path to a tablet's WAL directory" })
+      .AddOptionalParameter("format")
+      .AddOptionalParameter("scan_threads")
+      .Build();
 
   return ModeBuilder("wal")
       .Description("Operate on WAL (write-ahead log) files")
+#ifdef FB_DO_NOT_REMOVE
       .AddAction(std::move(dump))
+#endif
+      .AddAction(std::move(scan))
+      .AddAction(std::move(stats))
       .Build();
 }
 
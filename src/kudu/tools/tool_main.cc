@@ -68,13 +68,14 @@ unique_ptr<Mode> RootMode(const string& name) {
       //.AddMode(BuildLocalReplicaMode())
       //.AddMode(BuildMasterMode())
       .AddMode(BuildPbcMode())
-      //.AddMode(BuildPerfMode())
+      .AddMode(BuildPerfMode())
+      .AddMode(BuildRaftMode())
       //.AddMode(BuildRemoteReplicaMode())
       //.AddMode(BuildTableMode())
       //.AddMode(BuildTabletMode())
       //.AddMode(BuildTestMode())
       //.AddMode(BuildTServerMode())
-      //.AddMode(BuildWalMode())
+      .AddMode(BuildWalMode())
       .Build();
 }
 
@@ -33,16 +33,22 @@
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
 #include <glog/logging.h>
+#include <google/protobuf/io/coded_stream.h>
 
 #include "kudu/clock/clock.h"
 #include "kudu/common/timestamp.h"
 #include "kudu/common/wire_protocol.h"
 #include "kudu/common/wire_protocol.pb.h"
 #include "kudu/consensus/consensus.pb.h"
+#include "kudu/consensus/log.h"
+#include "kudu/consensus/log_reader.h"
+#include "kudu/consensus/log_util.h"
 #include "kudu/consensus/opid.pb.h"
+#include "kudu/consensus/packed_ops.h"
 #include "kudu/consensus/raft_consensus.h"
 #include "kudu/consensus/replica_management.pb.h"
 #include "kudu/consensus/time_manager.h"
+#include "kudu/consensus/traffic_capture.h"
 #include "kudu/gutil/casts.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/map-util.h"
@@ -59,25 +65,69 @@
 #include "kudu/util/auto_release_pool.h"
 #include "kudu/util/crc.h"
 #include "kudu/util/debug/trace_event.h"
+#include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/memory/arena.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/op_timeline.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/process_memory.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
+#include "kudu/util/thread.h"
 #include "kudu/util/trace.h"
 #include "kudu/util/trace_metrics.h"
 
+DEFINE_bool(raft_enable_log_segment_streaming, false,
+            "Whether this server serves ListLogSegments() and "
+            "FetchLogSegmentChunk(), which let a new or rebuilt replica copy "
+            "the WAL segments of this one in bulk instead of having them "
+            "replayed through UpdateConsensus().");
+TAG_FLAG(raft_enable_log_segment_streaming, experimental);
+TAG_FLAG(raft_enable_log_segment_streaming, runtime);
+
+DEFINE_int64(raft_log_segment_chunk_max_bytes, 8 * 1024 * 1024,
+             "The most bytes of a WAL segment returned by one "
+             "FetchLogSegmentChunk() call.");
+TAG_FLAG(raft_log_segment_chunk_max_bytes, experimental);
+TAG_FLAG(raft_log_segment_chunk_max_bytes, runtime);
+
+DEFINE_bool(raft_enable_replicate_write, false,
+            "Whether this server serves ReplicateWrite(), which replicates "
+            "an opaque write through a tablet's Raft config on behalf of a "
+            "client such as 'kudu perf raft_loadgen'. Only meant for "
+            "benchmarking configs with no state machine applying the writes.");
+TAG_FLAG(raft_enable_replicate_write, experimental);
+TAG_FLAG(raft_enable_replicate_write, runtime);
+
+DEFINE_int32(raft_trace_capture_max_duration_ms, 0,
+             "The longest a CaptureConsensusTrace() call may trace the "
+             "replication of ops on this server for. 0 disables the call.");
+TAG_FLAG(raft_trace_capture_max_duration_ms, experimental);
+TAG_FLAG(raft_trace_capture_max_duration_ms, runtime);
+
+DEFINE_int64(raft_read_committed_ops_max_bytes, 0,
+             "The most bytes of ops a ReadCommittedOps() call returns, for "
+             "consumers tailing the committed ops of a tablet. 0 disables "
+             "the call.");
+TAG_FLAG(raft_read_committed_ops_max_bytes, experimental);
+TAG_FLAG(raft_read_committed_ops_max_bytes, runtime);
+
 DECLARE_bool(raft_prepare_replacement_before_eviction);
 DECLARE_int32(memory_limit_warn_threshold_percentage);
 
 using google::protobuf::RepeatedPtrField;
+using kudu::consensus::BatchConsensusRequestPB;
+using kudu::consensus::BatchConsensusResponsePB;
 using kudu::consensus::BulkChangeConfigRequestPB;
+using kudu::consensus::CaptureConsensusTraceRequestPB;
+using kudu::consensus::CaptureConsensusTraceResponsePB;
+using kudu::consensus::FetchLogSegmentChunkRequestPB;
+using kudu::consensus::FetchLogSegmentChunkResponsePB;
 using kudu::consensus::ChangeConfigRequestPB;
 using kudu::consensus::ChangeConfigResponsePB;
 using kudu::consensus::ConsensusRequestPB;
@@ -87,12 +137,23 @@ using kudu::consensus::GetNodeInstanceRequestPB;
 using kudu::consensus::GetNodeInstanceResponsePB;
 using kudu::consensus::LeaderStepDownRequestPB;
 using kudu::consensus::LeaderStepDownResponsePB;
+using kudu::consensus::ListLogSegmentsRequestPB;
+using kudu::consensus::ListLogSegmentsResponsePB;
 using kudu::consensus::OpId;
+using kudu::consensus::ConsensusRound;
 using kudu::consensus::RaftConsensus;
+using kudu::consensus::ReadCommittedOpsRequestPB;
+using kudu::consensus::ReadCommittedOpsResponsePB;
+using kudu::consensus::ReplicateMsg;
+using kudu::consensus::ReplicateRefPtr;
+using kudu::consensus::ReplicateWriteRequestPB;
+using kudu::consensus::ReplicateWriteResponsePB;
 using kudu::consensus::LeaderElectionContextPB;
 using kudu::consensus::RunLeaderElectionRequestPB;
 using kudu::consensus::RunLeaderElectionResponsePB;
 using kudu::consensus::TimeManager;
+using kudu::consensus::TrafficCapture;
+using kudu::consensus::TrafficCaptureRecordPB;
 using kudu::consensus::UnsafeChangeConfigRequestPB;
 using kudu::consensus::UnsafeChangeConfigResponsePB;
 using kudu::consensus::VoteRequestPB;
@@ -120,6 +181,13 @@ namespace kudu {
 
 namespace tserver {
 
+static void SetupError(ServerErrorPB* error,
+                       const Status& s,
+                       ServerErrorPB::Code code) {
+  StatusToPB(s, error->mutable_status());
+  error->set_code(code);
+}
+
 static void SetupErrorAndRespond(ServerErrorPB* error,
                                  const Status& s,
                                  ServerErrorPB::Code code,
@@ -131,8 +199,7 @@ static void SetupErrorAndRespond(ServerErrorPB* error,
     return;
   }
 
-  StatusToPB(s, error->mutable_status());
-  error->set_code(code);
+  SetupError(error, s, code);
   context->RespondNoCache();
 }
 
@@ -203,39 +270,60 @@ bool CheckUuidMatchOrRespond(TSTabletManager* tablet_manager,
 }
 
 
+// Looks up the consensus of 'tablet_id'. On failure, also returns the code
+// of the error to respond with in 'error_code'.
+Status GetConsensus(TSTabletManager* tablet_manager,
+                    const string& tablet_id,
+                    shared_ptr<RaftConsensus>* consensus_out,
+                    ServerErrorPB::Code* error_code) {
+  shared_ptr<RaftConsensus> tmp_consensus = tablet_manager->shared_consensus(tablet_id);
+  if (!tmp_consensus) {
+    // Once the system tablet is set up, the tablet manager knows every
+    // tablet it hosts.
+    if (tablet_manager->shared_consensus()) {
+      *error_code = ServerErrorPB::TABLET_NOT_FOUND;
+      return Status::NotFound("Tablet not found", tablet_id);
+    }
+    *error_code = ServerErrorPB::CONSENSUS_NOT_RUNNING;
+    return Status::ServiceUnavailable("Raft Consensus unavailable",
+                                      "Tablet replica not initialized");
+  }
+  *consensus_out = std::move(tmp_consensus);
+  return Status::OK();
+}
+
 template<class RespClass>
 bool GetConsensusOrRespond(TSTabletManager* tablet_manager,
+                           const string& tablet_id,
                            RespClass* resp,
                            rpc::RpcContext* context,
                            shared_ptr<RaftConsensus>* consensus_out) {
-  shared_ptr<RaftConsensus> tmp_consensus = tablet_manager->shared_consensus();
-  if (!tmp_consensus) {
-    Status s = Status::ServiceUnavailable("Raft Consensus unavailable",
-                                          "Tablet replica not initialized");
-    SetupErrorAndRespond(resp->mutable_error(), s,
-                         ServerErrorPB::CONSENSUS_NOT_RUNNING, context);
+  ServerErrorPB::Code error_code;
+  Status s = GetConsensus(tablet_manager, tablet_id, consensus_out, &error_code);
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s, error_code, context);
     return false;
   }
-  *consensus_out = std::move(tmp_consensus);
   return true;
 }
 
-template <class ReqType, class RespType>
-bool CheckRaftRpcTokenOrRespond(const std::string& method_name,
-                                const ReqType* req, RespType resp,
-                                rpc::RpcContext* context,
-                                const consensus::RaftConsensus& consensus,
-                                const scoped_refptr<Counter>& mismatch_counter) {
+// Returns NotAuthorized if the raft RPC token of 'req' doesn't match the one
+// of 'consensus', and 'consensus' enforces it.
+template <class ReqType>
+Status CheckRaftRpcToken(const std::string& method_name,
+                         const ReqType* req,
+                         const consensus::RaftConsensus& consensus,
+                         const scoped_refptr<Counter>& mismatch_counter) {
   const auto &ownToken = consensus.GetRaftRpcToken();
   if (!ownToken && !req->has_raft_rpc_token()) {
     // Empty on both, nothing to enforce
-    return true;
+    return Status::OK();
   }
 
   if (ownToken && req->has_raft_rpc_token() &&
       *ownToken == req->raft_rpc_token()) {
     // Tokens match
-    return true;
+    return Status::OK();
   }
 
   mismatch_counter->Increment();
@@ -250,15 +338,27 @@ bool CheckRaftRpcTokenOrRespond(const std::string& method_name,
     KLOG_EVERY_N_SECS(WARNING, 300)
         << method_name
         << ": Token mismatch ignored: " << std::move(error_message);
-    return true;
+    return Status::OK();
   }
 
   KLOG_EVERY_N_SECS(ERROR, 60)
       << method_name << ": Rejecting incoming RPC: " << error_message;
-  SetupErrorAndRespond(resp->mutable_error(),
-                       Status::NotAuthorized(std::move(error_message)),
-                       ServerErrorPB::RING_TOKEN_MISMATCH, context);
-  return false;
+  return Status::NotAuthorized(std::move(error_message));
+}
+
+template <class ReqType, class RespType>
+bool CheckRaftRpcTokenOrRespond(const std::string& method_name,
+                                const ReqType* req, RespType resp,
+                                rpc::RpcContext* context,
+                                const consensus::RaftConsensus& consensus,
+                                const scoped_refptr<Counter>& mismatch_counter) {
+  Status s = CheckRaftRpcToken(method_name, req, consensus, mismatch_counter);
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s,
+                         ServerErrorPB::RING_TOKEN_MISMATCH, context);
+    return false;
+  }
+  return true;
 }
 
 template <class RespType>
@@ -312,6 +412,10 @@ ConsensusServiceImpl::ConsensusServiceImpl(ServerBase* server,
       request_rpc_token_mismatches_(
           server->metric_entity()->FindOrCreateCounter(
       &METRIC_raft_rpc_token_num_request_mismatches)) {
+  // Allocate each update on an arena, which the ops RaftConsensus takes over
+  // from it keep alive, instead of allocating every op's messages separately.
+  FindOrDie(methods_by_name_, "UpdateConsensus")->use_request_arena = true;
+  FindOrDie(methods_by_name_, "BatchUpdateConsensus")->use_request_arena = true;
 }
 
 ConsensusServiceImpl::~ConsensusServiceImpl() {
@@ -323,6 +427,71 @@ bool ConsensusServiceImpl::AuthorizeServiceUser(const google::protobuf::Message*
   return server_->Authorize(rpc, ServerBase::SUPER_USER | ServerBase::SERVICE_USER);
 }
 
+bool ConsensusServiceImpl::SupportsFeature(uint32_t feature) const {
+  switch (feature) {
+    case consensus::PACKED_OPS:
+    case consensus::PACKED_OPS_V2:
+    case consensus::BATCH_UPDATE_CONSENSUS:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Parses the ops that the leader sent as an RPC sidecar into the ops of 'req'.
+static Status RestoreOpsFromSidecar(ConsensusRequestPB* req,
+                                    const rpc::RpcContext* context) {
+  if (req->has_packed_ops_sidecar_idx()) {
+    Slice sidecar;
+    RETURN_NOT_OK_PREPEND(context->GetInboundSidecar(req->packed_ops_sidecar_idx(), &sidecar),
+                          "Unable to read the ops of the request");
+    RETURN_NOT_OK_PREPEND(consensus::UnpackOps(sidecar, req),
+                          "Unable to decode the ops of the request");
+    req->clear_packed_ops_sidecar_idx();
+    return Status::OK();
+  }
+  if (!req->has_ops_sidecar_idx()) {
+    return Status::OK();
+  }
+  Slice sidecar;
+  RETURN_NOT_OK_PREPEND(context->GetInboundSidecar(req->ops_sidecar_idx(), &sidecar),
+                        "Unable to read the ops of the request");
+  // The sidecar holds the ops as they would be serialized in 'req', so it
+  // parses straight into it.
+  google::protobuf::io::CodedInputStream in(sidecar.data(), sidecar.size());
+#if GOOGLE_PROTOBUF_VERSION >= 3006000
+  in.SetTotalBytesLimit(sidecar.size());
+#else
+  in.SetTotalBytesLimit(sidecar.size(), -1);
+#endif
+  if (PREDICT_FALSE(!req->MergePartialFromCodedStream(&in) ||
+                    !in.ConsumedEntireMessage() ||
+                    !req->IsInitialized())) {
+    return Status::Corruption("Unable to parse the ops of the request");
+  }
+  req->clear_ops_sidecar_idx();
+  return Status::OK();
+}
+
+// Moves the write payloads that the leader sent as RPC sidecars back into the
+// ops of 'req'.
+static Status RestorePayloadsFromSidecars(ConsensusRequestPB* req,
+                                          const rpc::RpcContext* context) {
+  for (consensus::ReplicateMsg& op : *req->mutable_ops()) {
+    if (!op.has_write_payload() || !op.write_payload().has_payload_sidecar_idx()) {
+      continue;
+    }
+    consensus::WritePayloadPB* payload = op.mutable_write_payload();
+    Slice sidecar;
+    RETURN_NOT_OK_PREPEND(context->GetInboundSidecar(payload->payload_sidecar_idx(), &sidecar),
+                          Substitute("Unable to read the payload of op $0",
+                                     SecureShortDebugString(op.id())));
+    payload->set_payload(sidecar.data(), sidecar.size());
+    payload->clear_payload_sidecar_idx();
+  }
+  return Status::OK();
+}
+
 void ConsensusServiceImpl::UpdateConsensus(const ConsensusRequestPB* req,
                                            ConsensusResponsePB* resp,
                                            rpc::RpcContext* context) {
@@ -333,7 +502,7 @@ void ConsensusServiceImpl::UpdateConsensus(const ConsensusRequestPB* req,
 
   // Submit the update directly to the TabletReplica's RaftConsensus instance.
   shared_ptr<RaftConsensus> consensus;
-  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) return;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
 
   if (auto ownToken = consensus->GetRaftRpcToken()) {
     // Stamp response token regardless of whether if it matches request so
@@ -346,13 +515,34 @@ void ConsensusServiceImpl::UpdateConsensus(const ConsensusRequestPB* req,
     return;
   }
 
+  // The request is owned by the RPC context, so it's safe to fill it in.
+  Status s = RestoreOpsFromSidecar(const_cast<ConsensusRequestPB*>(req), context);
+  if (PREDICT_TRUE(s.ok())) {
+    s = RestorePayloadsFromSidecars(const_cast<ConsensusRequestPB*>(req), context);
+  }
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s,
+                         ServerErrorPB::UNKNOWN_ERROR,
+                         context);
+    return;
+  }
+
+  if (TrafficCapture* capture = TrafficCapture::Get()) {
+    vector<const ReplicateMsg*> ops;
+    ops.reserve(req->ops_size());
+    for (const ReplicateMsg& op : req->ops()) {
+      ops.push_back(&op);
+    }
+    capture->Record(TrafficCaptureRecordPB::UPDATE, req->tablet_id(), ops);
+  }
+
   // Fast path for proxy requests.
   if (consensus->IsProxyRequest(req)) {
     consensus->HandleProxyRequest(req, resp, context);
     return;
   }
 
-  Status s = consensus->Update(req, resp);
+  s = consensus->Update(req, resp, context->request_arena());
   if (PREDICT_FALSE(!s.ok())) {
     // Clear the response first, since a partially-filled response could
     // result in confusing a caller, or in having missing required fields
@@ -364,6 +554,63 @@ void ConsensusServiceImpl::UpdateConsensus(const ConsensusRequestPB* req,
                          context);
     return;
   }
+  // Let the leader match the response with the hops of the traced request.
+  if (req->has_trace_context()) {
+    *resp->mutable_trace_context() = req->trace_context();
+  }
+  context->RespondSuccess();
+}
+
+void ConsensusServiceImpl::BatchUpdateConsensus(const BatchConsensusRequestPB* req,
+                                                BatchConsensusResponsePB* resp,
+                                                rpc::RpcContext* context) {
+  DVLOG(3) << "Received Consensus Batch Update RPC: " << SecureDebugString(*req);
+  const string& local_uuid = tablet_manager_->NodeInstance().permanent_uuid();
+  resp->mutable_responses()->Reserve(req->requests_size());
+  for (const ConsensusRequestPB& update : req->requests()) {
+    ConsensusResponsePB* update_resp = resp->add_responses();
+    if (PREDICT_FALSE(update.dest_uuid() != local_uuid)) {
+      Status s = Status::InvalidArgument(Substitute("BatchUpdateConsensus: Wrong destination "
+                                                    "UUID requested. Local UUID: $0. "
+                                                    "Requested UUID: $1",
+                                                    local_uuid, update.dest_uuid()));
+      LOG(WARNING) << s.ToString() << ": from " << context->requestor_string();
+      SetupError(update_resp->mutable_error(), s, ServerErrorPB::WRONG_SERVER_UUID);
+      continue;
+    }
+    // The sidecars of the call aren't the requests' own, and requests to be
+    // proxied need the context of a call of their own to be forwarded.
+    if (PREDICT_FALSE(update.has_proxy_dest_uuid() || update.has_ops_sidecar_idx() ||
+                      update.has_packed_ops_sidecar_idx())) {
+      SetupError(update_resp->mutable_error(),
+                 Status::InvalidArgument("Request can't be batched"),
+                 ServerErrorPB::UNKNOWN_ERROR);
+      continue;
+    }
+
+    shared_ptr<RaftConsensus> consensus;
+    ServerErrorPB::Code error_code;
+    Status s = GetConsensus(tablet_manager_, update.tablet_id(), &consensus, &error_code);
+    if (PREDICT_FALSE(!s.ok())) {
+      SetupError(update_resp->mutable_error(), s, error_code);
+      continue;
+    }
+    if (auto ownToken = consensus->GetRaftRpcToken()) {
+      update_resp->set_raft_rpc_token(*std::move(ownToken));
+    }
+    s = CheckRaftRpcToken("BatchUpdateConsensus", &update, *consensus,
+                          request_rpc_token_mismatches_);
+    if (PREDICT_FALSE(!s.ok())) {
+      SetupError(update_resp->mutable_error(), s, ServerErrorPB::RING_TOKEN_MISMATCH);
+      continue;
+    }
+
+    s = consensus->Update(&update, update_resp, context->request_arena());
+    if (PREDICT_FALSE(!s.ok())) {
+      update_resp->Clear();
+      SetupError(update_resp->mutable_error(), s, ServerErrorPB::UNKNOWN_ERROR);
+    }
+  }
   context->RespondSuccess();
 }
 
@@ -378,7 +625,7 @@ void ConsensusServiceImpl::RequestConsensusVote(const VoteRequestPB* req,
   boost::optional<OpId> last_logged_opid;
   // Submit the vote request directly to the consensus instance.
   shared_ptr<RaftConsensus> consensus;
-  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) return;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
 
   if (auto ownToken = consensus->GetRaftRpcToken()) {
     // Stamp response token regardless of whether if it matches request so
@@ -413,7 +660,7 @@ void ConsensusServiceImpl::ChangeConfig(const ChangeConfigRequestPB* req,
   }
 
   shared_ptr<RaftConsensus> consensus;
-  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) return;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
   boost::optional<ServerErrorPB::Code> error_code;
   Status s = consensus->ChangeConfig(*req, BindHandleResponse(req, resp, context), &error_code);
   if (PREDICT_FALSE(!s.ok())) {
@@ -432,7 +679,7 @@ void ConsensusServiceImpl::BulkChangeConfig(const BulkChangeConfigRequestPB* req
   }
 
   shared_ptr<RaftConsensus> consensus;
-  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) return;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
   boost::optional<ServerErrorPB::Code> error_code;
   Status s = consensus->BulkChangeConfig(*req, BindHandleResponse(req, resp, context), &error_code);
   if (PREDICT_FALSE(!s.ok())) {
@@ -452,7 +699,7 @@ void ConsensusServiceImpl::UnsafeChangeConfig(const UnsafeChangeConfigRequestPB*
   }
 
   shared_ptr<RaftConsensus> consensus;
-  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) {
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) {
     return;
   }
   boost::optional<ServerErrorPB::Code> error_code;
@@ -474,7 +721,7 @@ void ConsensusServiceImpl::ChangeProxyTopology(const consensus::ChangeProxyTopol
   }
 
   shared_ptr<RaftConsensus> consensus;
-  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) {
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) {
     return;
   }
 
@@ -499,7 +746,7 @@ void ConsensusServiceImpl::RunLeaderElection(const RunLeaderElectionRequestPB* r
   }
 
   shared_ptr<RaftConsensus> consensus;
-  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) return;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
 
   if (!CheckRaftRpcTokenOrRespond("RunLeaderElection", req, resp, context,
                                   *consensus, request_rpc_token_mismatches_)) {
@@ -545,7 +792,7 @@ void ConsensusServiceImpl::LeaderStepDown(const LeaderStepDownRequestPB* req,
   }
 
   shared_ptr<RaftConsensus> consensus;
-  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) return;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
   Status s = consensus->StepDown(resp);
   if (PREDICT_FALSE(!s.ok())) {
     SetupErrorAndRespond(resp->mutable_error(), s,
@@ -556,6 +803,80 @@ void ConsensusServiceImpl::LeaderStepDown(const LeaderStepDownRequestPB* req,
   context->RespondSuccess();
 }
 
+void ConsensusServiceImpl::ReadIndex(const consensus::ReadIndexRequestPB* req,
+                                     consensus::ReadIndexResponsePB* resp,
+                                     rpc::RpcContext* context) {
+  DVLOG(3) << "Received ReadIndex RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(tablet_manager_, "ReadIndex", req, resp, context)) {
+    return;
+  }
+
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
+  int64_t read_index;
+  Status s = consensus->GetReadIndex(context->GetClientDeadline(), &read_index);
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s,
+                         s.IsIllegalState() ? ServerErrorPB::NOT_THE_LEADER
+                                            : ServerErrorPB::UNKNOWN_ERROR,
+                         context);
+    return;
+  }
+  resp->set_read_index(read_index);
+  context->RespondSuccess();
+}
+
+void ConsensusServiceImpl::ReplicateWrite(const ReplicateWriteRequestPB* req,
+                                          ReplicateWriteResponsePB* resp,
+                                          rpc::RpcContext* context) {
+  DVLOG(3) << "Received ReplicateWrite RPC for tablet " << req->tablet_id();
+  if (!CheckUuidMatchOrRespond(tablet_manager_, "ReplicateWrite", req, resp, context)) {
+    return;
+  }
+  if (!FLAGS_raft_enable_replicate_write) {
+    SetupErrorAndRespond(resp->mutable_error(),
+                         Status::NotSupported("ReplicateWrite is disabled"),
+                         ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
+
+  gscoped_ptr<ReplicateMsg> msg(new ReplicateMsg);
+  msg->set_op_type(consensus::WRITE_OP_EXT);
+  *msg->mutable_write_payload() = req->write_payload();
+  Status s = consensus->time_manager()->AssignTimestamp(msg.get());
+
+  // The round outlives its callback, so the callback may read the op's id
+  // from it while responding. The response is sent once the op commits, or
+  // fails if, say, the leader loses its leadership before it does.
+  scoped_refptr<ConsensusRound> round;
+  if (s.ok()) {
+    round = consensus->NewRound(std::move(msg));
+    ConsensusRound* r = round.get();
+    round->SetConsensusReplicatedCallback([resp, context, r](const Status& status) {
+      if (PREDICT_FALSE(!status.ok())) {
+        SetupErrorAndRespond(resp->mutable_error(), status,
+                             ServerErrorPB::UNKNOWN_ERROR, context);
+        return;
+      }
+      *resp->mutable_opid() = r->id();
+      context->RespondSuccess();
+    });
+    s = consensus->CheckLeadershipAndBindTerm(round);
+  }
+  if (s.ok()) {
+    s = consensus->Replicate(round);
+  }
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s,
+                         s.IsIllegalState() ? ServerErrorPB::NOT_THE_LEADER
+                                            : ServerErrorPB::UNKNOWN_ERROR,
+                         context);
+  }
+}
+
 void ConsensusServiceImpl::GetLastOpId(const consensus::GetLastOpIdRequestPB *req,
                                        consensus::GetLastOpIdResponsePB *resp,
                                        rpc::RpcContext *context) {
@@ -565,7 +886,7 @@ void ConsensusServiceImpl::GetLastOpId(const consensus::GetLastOpIdRequestPB *re
   }
 
   shared_ptr<RaftConsensus> consensus;
-  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) return;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
   if (PREDICT_FALSE(req->opid_type() == consensus::UNKNOWN_OPID_TYPE)) {
     HandleUnknownError(Status::InvalidArgument("Invalid opid_type specified to GetLastOpId()"),
                        resp, context);
@@ -583,11 +904,118 @@ void ConsensusServiceImpl::GetLastOpId(const consensus::GetLastOpIdRequestPB *re
   context->RespondSuccess();
 }
 
+// Returns the segments of the tablet's log, or responds with an error and
+// returns false if they can't be streamed.
+template<class RespClass>
+bool GetLogSegmentsOrRespond(TSTabletManager* tablet_manager,
+                             const string& tablet_id,
+                             RespClass* resp,
+                             rpc::RpcContext* context,
+                             log::SegmentSequence* segments) {
+  if (!FLAGS_raft_enable_log_segment_streaming) {
+    SetupErrorAndRespond(resp->mutable_error(),
+                         Status::NotSupported("Log segment streaming is disabled"),
+                         ServerErrorPB::UNKNOWN_ERROR, context);
+    return false;
+  }
+  scoped_refptr<log::Log> log = tablet_manager->log(tablet_id);
+  if (!log || !log->reader()) {
+    SetupErrorAndRespond(resp->mutable_error(),
+                         Status::ServiceUnavailable("Log unavailable"),
+                         ServerErrorPB::CONSENSUS_NOT_RUNNING, context);
+    return false;
+  }
+  Status s = log->reader()->GetSegmentsSnapshot(segments);
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s, ServerErrorPB::UNKNOWN_ERROR, context);
+    return false;
+  }
+  return true;
+}
+
+void ConsensusServiceImpl::ListLogSegments(const ListLogSegmentsRequestPB* req,
+                                           ListLogSegmentsResponsePB* resp,
+                                           rpc::RpcContext* context) {
+  DVLOG(3) << "Received ListLogSegments RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(tablet_manager_, "ListLogSegments", req, resp, context)) {
+    return;
+  }
+  log::SegmentSequence segments;
+  if (!GetLogSegmentsOrRespond(tablet_manager_, req->tablet_id(), resp, context, &segments)) return;
+
+  for (const auto& segment : segments) {
+    auto* segment_pb = resp->add_segments();
+    segment_pb->set_sequence_number(segment->header().sequence_number());
+    segment_pb->set_size(segment->readable_up_to());
+    segment_pb->set_closed(segment->HasFooter());
+  }
+  context->RespondSuccess();
+}
+
+void ConsensusServiceImpl::FetchLogSegmentChunk(const FetchLogSegmentChunkRequestPB* req,
+                                                FetchLogSegmentChunkResponsePB* resp,
+                                                rpc::RpcContext* context) {
+  DVLOG(3) << "Received FetchLogSegmentChunk RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(tablet_manager_, "FetchLogSegmentChunk", req, resp, context)) {
+    return;
+  }
+  log::SegmentSequence segments;
+  if (!GetLogSegmentsOrRespond(tablet_manager_, req->tablet_id(), resp, context, &segments)) return;
+
+  auto iter = std::find_if(segments.begin(), segments.end(),
+                           [&](const scoped_refptr<log::ReadableLogSegment>& segment) {
+                             return segment->header().sequence_number() ==
+                                    req->sequence_number();
+                           });
+  if (iter == segments.end()) {
+    SetupErrorAndRespond(resp->mutable_error(),
+                         Status::NotFound(Substitute("No log segment with sequence number $0",
+                                                     req->sequence_number())),
+                         ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+  // Only hand out bytes which hold complete entries, so that a chunk never
+  // ends in the middle of one that is still being written.
+  int64_t segment_size = (*iter)->readable_up_to();
+  if (PREDICT_FALSE(req->offset() < 0 || req->offset() > segment_size)) {
+    SetupErrorAndRespond(resp->mutable_error(),
+                         Status::InvalidArgument(Substitute("Offset $0 is out of bounds; the "
+                                                            "segment has $1 bytes",
+                                                            req->offset(), segment_size)),
+                         ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+  int64_t length = std::min<int64_t>(segment_size - req->offset(),
+                            FLAGS_raft_log_segment_chunk_max_bytes);
+  if (req->has_max_length()) {
+    length = std::min<int64_t>(length, req->max_length());
+  }
+
+  unique_ptr<faststring> chunk(new faststring);
+  chunk->resize(length);
+  Status s;
+  if (length > 0) {
+    s = (*iter)->readable_file()->Read(req->offset(), Slice(chunk->data(), length));
+  }
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s, ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+  resp->set_crc32(crc::Crc32c(chunk->data(), chunk->size()));
+  resp->set_segment_size(segment_size);
+  int idx;
+  s = context->AddOutboundSidecar(RpcSidecar::FromFaststring(std::move(chunk)), &idx);
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s, ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+  resp->set_data_sidecar_idx(idx);
+  context->RespondSuccess();
+}
+
 void ConsensusServiceImpl::GetConsensusState(const consensus::GetConsensusStateRequestPB* req,
                                              consensus::GetConsensusStateResponsePB* resp,
                                              rpc::RpcContext* context) {
-
-#if 0
   DVLOG(3) << "Received GetConsensusState RPC: " << SecureDebugString(*req);
   if (!CheckUuidMatchOrRespond(tablet_manager_, "GetConsensusState", req, resp, context)) {
     return;
@@ -596,14 +1024,14 @@ void ConsensusServiceImpl::GetConsensusState(const consensus::GetConsensusStateR
   unordered_set<string> requested_ids(req->tablet_ids().begin(), req->tablet_ids().end());
   bool all_ids = requested_ids.empty();
 
-  vector<scoped_refptr<TabletReplica>> tablet_replicas;
-  tablet_manager_->GetTabletReplicas(&tablet_replicas);
-  for (const scoped_refptr<TabletReplica>& replica : tablet_replicas) {
-    if (!all_ids && !ContainsKey(requested_ids, replica->tablet_id())) {
+  vector<string> tablet_ids;
+  tablet_manager_->GetTabletIds(&tablet_ids);
+  for (const string& tablet_id : tablet_ids) {
+    if (!all_ids && !ContainsKey(requested_ids, tablet_id)) {
       continue;
     }
 
-    shared_ptr<RaftConsensus> consensus(replica->shared_consensus());
+    shared_ptr<RaftConsensus> consensus(tablet_manager_->shared_consensus(tablet_id));
     if (!consensus) {
       continue;
     }
@@ -614,7 +1042,23 @@ void ConsensusServiceImpl::GetConsensusState(const consensus::GetConsensusStateR
       DCHECK(s.IsIllegalState()) << s.ToString();
       continue;
     }
-    tablet_info.set_tablet_id(replica->tablet_id());
+    tablet_info.set_tablet_id(tablet_id);
+    *tablet_info.mutable_proxy_topology() = consensus->GetProxyTopology();
+    int64_t cached_ops;
+    int64_t cached_bytes;
+    consensus->GetLogCacheUsage(&cached_ops, &cached_bytes);
+    tablet_info.set_log_cache_num_ops(cached_ops);
+    tablet_info.set_log_cache_bytes(cached_bytes);
+    int64_t append_lag_us;
+    int64_t commit_lag_us;
+    if (consensus->GetTimeLag(&append_lag_us, &commit_lag_us)) {
+      if (append_lag_us >= 0) {
+        tablet_info.set_append_time_lag_us(append_lag_us);
+      }
+      if (commit_lag_us >= 0) {
+        tablet_info.set_commit_time_lag_us(commit_lag_us);
+      }
+    }
     *resp->add_tablets() = std::move(tablet_info);
   }
   const auto scheme = FLAGS_raft_prepare_replacement_before_eviction
@@ -622,8 +1066,113 @@ void ConsensusServiceImpl::GetConsensusState(const consensus::GetConsensusStateR
       : consensus::ReplicaManagementInfoPB::EVICT_FIRST;
   resp->mutable_replica_management_info()->set_replacement_scheme(scheme);
 
-#endif
+  context->RespondSuccess();
+}
 
+void ConsensusServiceImpl::CaptureConsensusTrace(const CaptureConsensusTraceRequestPB* req,
+                                                 CaptureConsensusTraceResponsePB* resp,
+                                                 rpc::RpcContext* context) {
+  DVLOG(3) << "Received CaptureConsensusTrace RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(tablet_manager_, "CaptureConsensusTrace", req, resp, context)) {
+    return;
+  }
+  const int32_t max_duration_ms = FLAGS_raft_trace_capture_max_duration_ms;
+  if (max_duration_ms <= 0) {
+    SetupErrorAndRespond(resp->mutable_error(),
+                         Status::NotSupported("Consensus trace capture is disabled"),
+                         ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+  if (req->duration_ms() <= 0 || req->duration_ms() > max_duration_ms) {
+    SetupErrorAndRespond(resp->mutable_error(),
+                         Status::InvalidArgument(Substitute("The duration must be between 1 "
+                                                            "and $0 ms", max_duration_ms)),
+                         ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+
+  // The capture blocks for its whole duration, so it runs on a thread of its
+  // own rather than holding up a service thread.
+  scoped_refptr<Thread> thread;
+  Status s = Thread::Create("consensus", "trace-capture", [req, resp, context]() {
+      Status s = OpTimeline::CaptureTrace(MonoDelta::FromMilliseconds(req->duration_ms()),
+                                          req->sample_interval(),
+                                          resp->mutable_trace_json());
+      if (PREDICT_FALSE(!s.ok())) {
+        SetupErrorAndRespond(resp->mutable_error(), s, ServerErrorPB::UNKNOWN_ERROR, context);
+        return;
+      }
+      context->RespondSuccess();
+    }, &thread);
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s, ServerErrorPB::UNKNOWN_ERROR, context);
+  }
+}
+
+void ConsensusServiceImpl::ReadCommittedOps(const ReadCommittedOpsRequestPB* req,
+                                            ReadCommittedOpsResponsePB* resp,
+                                            rpc::RpcContext* context) {
+  DVLOG(3) << "Received ReadCommittedOps RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(tablet_manager_, "ReadCommittedOps", req, resp, context)) {
+    return;
+  }
+  int64_t max_bytes = FLAGS_raft_read_committed_ops_max_bytes;
+  if (max_bytes <= 0) {
+    SetupErrorAndRespond(resp->mutable_error(),
+                         Status::NotSupported("Reading committed ops is disabled"),
+                         ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+  if (PREDICT_FALSE(req->after_index() < 0)) {
+    SetupErrorAndRespond(resp->mutable_error(),
+                         Status::InvalidArgument("The index must not be negative"),
+                         ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+  if (req->has_max_bytes() && req->max_bytes() > 0) {
+    max_bytes = std::min(max_bytes, req->max_bytes());
+  }
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, req->tablet_id(), resp, context, &consensus)) return;
+
+  vector<ReplicateRefPtr> msgs;
+  int64_t committed_index;
+  Status s = consensus->ReadCommittedOps(req->after_index(), max_bytes, &msgs, &committed_index);
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s,
+                         s.IsIllegalState() ? ServerErrorPB::CONSENSUS_NOT_RUNNING
+                                            : ServerErrorPB::UNKNOWN_ERROR,
+                         context);
+    return;
+  }
+  resp->set_committed_index(committed_index);
+  resp->set_last_index(msgs.empty() ? req->after_index() : msgs.back()->get()->id().index());
+  if (msgs.empty()) {
+    context->RespondSuccess();
+    return;
+  }
+
+  // The ops are serialized as the 'ops' of a request, the way the leader
+  // sends them to its peers, straight from the messages the cache holds.
+  ConsensusRequestPB ops_only;
+  for (const ReplicateRefPtr& msg : msgs) {
+    ops_only.mutable_ops()->UnsafeArenaAddAllocated(msg->get());
+  }
+  unique_ptr<faststring> buf(new faststring);
+  buf->resize(ops_only.ByteSizeLong());
+  ops_only.SerializeWithCachedSizesToArray(buf->data());
+#if GOOGLE_PROTOBUF_VERSION >= 3017003
+  ops_only.mutable_ops()->UnsafeArenaExtractSubrange(0, ops_only.ops_size(), nullptr);
+#else
+  ops_only.mutable_ops()->ExtractSubrange(0, ops_only.ops_size(), nullptr);
+#endif
+  int idx;
+  s = context->AddOutboundSidecar(RpcSidecar::FromFaststring(std::move(buf)), &idx);
+  if (PREDICT_FALSE(!s.ok())) {
+    SetupErrorAndRespond(resp->mutable_error(), s, ServerErrorPB::UNKNOWN_ERROR, context);
+    return;
+  }
+  resp->set_ops_sidecar_idx(idx);
   context->RespondSuccess();
 }
 
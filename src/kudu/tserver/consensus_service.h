@@ -41,10 +41,14 @@ class ServerBase;
 
 namespace consensus {
 class BulkChangeConfigRequestPB;
+class CaptureConsensusTraceRequestPB;
+class CaptureConsensusTraceResponsePB;
 class ChangeConfigRequestPB;
 class ChangeConfigResponsePB;
 class ConsensusRequestPB;
 class ConsensusResponsePB;
+class FetchLogSegmentChunkRequestPB;
+class FetchLogSegmentChunkResponsePB;
 class GetConsensusStateRequestPB;
 class GetConsensusStateResponsePB;
 class GetLastOpIdRequestPB;
@@ -53,6 +57,14 @@ class GetNodeInstanceRequestPB;
 class GetNodeInstanceResponsePB;
 class LeaderStepDownRequestPB;
 class LeaderStepDownResponsePB;
+class ListLogSegmentsRequestPB;
+class ListLogSegmentsResponsePB;
+class ReadCommittedOpsRequestPB;
+class ReadCommittedOpsResponsePB;
+class ReadIndexRequestPB;
+class ReadIndexResponsePB;
+class ReplicateWriteRequestPB;
+class ReplicateWriteResponsePB;
 class RunLeaderElectionRequestPB;
 class RunLeaderElectionResponsePB;
 class StartTabletCopyRequestPB;
@@ -83,10 +95,16 @@ class ConsensusServiceImpl : public consensus::ConsensusServiceIf {
                             google::protobuf::Message* resp,
                             rpc::RpcContext* context) override;
 
+  bool SupportsFeature(uint32_t feature) const override;
+
   virtual void UpdateConsensus(const consensus::ConsensusRequestPB* req,
                                consensus::ConsensusResponsePB* resp,
                                rpc::RpcContext* context) override;
 
+  virtual void BatchUpdateConsensus(const consensus::BatchConsensusRequestPB* req,
+                                    consensus::BatchConsensusResponsePB* resp,
+                                    rpc::RpcContext* context) override;
+
   virtual void RequestConsensusVote(const consensus::VoteRequestPB* req,
                                     consensus::VoteResponsePB* resp,
                                     rpc::RpcContext* context) override;
@@ -123,10 +141,34 @@ class ConsensusServiceImpl : public consensus::ConsensusServiceIf {
                            consensus::GetLastOpIdResponsePB* resp,
                            rpc::RpcContext* context) override;
 
+  virtual void ReadIndex(const consensus::ReadIndexRequestPB* req,
+                         consensus::ReadIndexResponsePB* resp,
+                         rpc::RpcContext* context) override;
+
+  virtual void ReplicateWrite(const consensus::ReplicateWriteRequestPB* req,
+                              consensus::ReplicateWriteResponsePB* resp,
+                              rpc::RpcContext* context) override;
+
+  virtual void ListLogSegments(const consensus::ListLogSegmentsRequestPB* req,
+                               consensus::ListLogSegmentsResponsePB* resp,
+                               rpc::RpcContext* context) override;
+
+  virtual void FetchLogSegmentChunk(const consensus::FetchLogSegmentChunkRequestPB* req,
+                                    consensus::FetchLogSegmentChunkResponsePB* resp,
+                                    rpc::RpcContext* context) override;
+
   virtual void GetConsensusState(const consensus::GetConsensusStateRequestPB* req,
                                  consensus::GetConsensusStateResponsePB* resp,
                                  rpc::RpcContext* context) override;
 
+  virtual void CaptureConsensusTrace(const consensus::CaptureConsensusTraceRequestPB* req,
+                                     consensus::CaptureConsensusTraceResponsePB* resp,
+                                     rpc::RpcContext* context) override;
+
+  virtual void ReadCommittedOps(const consensus::ReadCommittedOpsRequestPB* req,
+                                consensus::ReadCommittedOpsResponsePB* resp,
+                                rpc::RpcContext* context) override;
+
  private:
   server::ServerBase* server_;
   TSTabletManager* tablet_manager_;
@@ -17,6 +17,7 @@
 
 #include "kudu/tserver/simple_tablet_manager.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <mutex>
@@ -45,6 +46,7 @@
 #include "kudu/consensus/proxy_policy.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/consensus/log.h"
+#include "kudu/consensus/log_sync_group.h"
 #include "kudu/consensus/log_util.h"
 #include "kudu/consensus/log_anchor_registry.h"
 #include "kudu/consensus/metadata.pb.h"
@@ -70,13 +72,50 @@
 #include "kudu/util/monotime.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
+#include "kudu/util/oid_generator.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/stopwatch.h"
+#include "kudu/util/thread.h"
 #include "kudu/util/threadpool.h"
 #include "kudu/util/trace.h"
 #include "kudu/util/pb_util.h"
 
+DEFINE_int32(tablet_manager_wal_append_threads, 0,
+             "If positive, the WALs of all the tablets hosted by this server "
+             "append and sync their groups on a shared pool of this many "
+             "threads, rather than each on an append thread of its own. Bounds "
+             "the WAL threads of a server hosting many tablets.");
+TAG_FLAG(tablet_manager_wal_append_threads, experimental);
+
+DEFINE_bool(tablet_manager_shared_wal_sync, false,
+            "If true, the WALs of all the tablets hosted by this server make "
+            "their appends durable together, with one syncfs() of each WAL "
+            "filesystem for all the tablets whose groups are waiting, rather "
+            "than an fsync of each tablet's segment. Only worth it if the "
+            "WAL filesystems hold little but the WALs, since all of their "
+            "dirty data is synced. Linux only, and not with --log_io_uring.");
+TAG_FLAG(tablet_manager_shared_wal_sync, experimental);
+
+DEFINE_int32(tablet_manager_num_tablets_to_open_simultaneously, 1,
+             "How many of the tablets hosted by this server, besides the "
+             "system tablet, to open at once when the server starts. Opening "
+             "a tablet replays its WAL, so a server hosting many tablets "
+             "starts faster when they're opened in parallel.");
+TAG_FLAG(tablet_manager_num_tablets_to_open_simultaneously, experimental);
+
 DECLARE_bool(enable_flexi_raft);
+DECLARE_bool(server_parallel_init);
+
+METRIC_DEFINE_gauge_int64(server, startup_raft_setup_duration,
+                          "Startup Raft Setup Duration",
+                          kudu::MetricUnit::kMilliseconds,
+                          "Time the server took to set up Raft and open the "
+                          "WAL of the system tablet when it started.");
+METRIC_DEFINE_gauge_int64(server, startup_tablets_open_duration,
+                          "Startup Hosted Tablets Open Duration",
+                          kudu::MetricUnit::kMilliseconds,
+                          "Time the server took to open the tablets it hosts, "
+                          "besides the system tablet, when it started.");
 
 using std::set;
 using std::shared_ptr;
@@ -107,6 +146,7 @@ using consensus::RECEIVED_OPID;
 using consensus::RaftConfigPB;
 using consensus::RaftPeerPB;
 using consensus::RaftConsensus;
+using consensus::ConsensusRoundHandler;
 using consensus::kMinimumTerm;
 using fs::DataDirManager;
 using log::Log;
@@ -127,6 +167,12 @@ TSTabletManager::TSTabletManager(TabletServer* server)
     metric_registry_(server->metric_registry()),
     state_(MANAGER_INITIALIZING),
     mark_dirty_clbk_(Bind(&TSTabletManager::MarkTabletDirty, Unretained(this))) {
+  if (FLAGS_tablet_manager_wal_append_threads > 0) {
+    CHECK_OK(ThreadPoolBuilder("wal-append")
+             .set_min_threads(0)
+             .set_max_threads(FLAGS_tablet_manager_wal_append_threads)
+             .Build(&wal_append_pool_));
+  }
 }
 
 TSTabletManager::~TSTabletManager() {
@@ -137,6 +183,11 @@ TSTabletManager::~TSTabletManager() {
   if (log_) {
     WARN_NOT_OK(log_->Close(), "Error closing Log");
   }
+  for (const auto& entry : tablets_) {
+    if (entry.second->log) {
+      WARN_NOT_OK(entry.second->log->Close(), LogPrefix(entry.first) + "Error closing Log");
+    }
+  }
 }
 
 Status TSTabletManager::Load(FsManager *fs_manager) {
@@ -183,7 +234,47 @@ Status TSTabletManager::Load(FsManager *fs_manager) {
     }
   }
 
-  return SetupRaft();
+  RETURN_NOT_OK(SetupRaft());
+
+  // Reopen the tablets created by CreateTablet().
+  MonoTime start = MonoTime::Now();
+  vector<string> tablet_ids;
+  RETURN_NOT_OK(fs_manager->ListConsensusMetadataTabletIds(&tablet_ids));
+  tablet_ids.erase(std::remove(tablet_ids.begin(), tablet_ids.end(), kSysCatalogTabletId),
+                   tablet_ids.end());
+  vector<shared_ptr<HostedTablet>> tablets(tablet_ids.size());
+  vector<Status> statuses(tablet_ids.size());
+  if (FLAGS_tablet_manager_num_tablets_to_open_simultaneously > 1 && tablet_ids.size() > 1) {
+    // The consensus metadata and persistent vars managers lock their maps,
+    // so the tablets may be set up concurrently.
+    gscoped_ptr<ThreadPool> open_pool;
+    RETURN_NOT_OK(ThreadPoolBuilder("tablet-open")
+                  .set_max_threads(FLAGS_tablet_manager_num_tablets_to_open_simultaneously)
+                  .Build(&open_pool));
+    for (size_t i = 0; i < tablet_ids.size(); i++) {
+      RETURN_NOT_OK(open_pool->SubmitFunc([this, i, &tablet_ids, &tablets, &statuses]() {
+        statuses[i] = SetupHostedTablet(tablet_ids[i], &tablets[i]);
+      }));
+    }
+    open_pool->Wait();
+  } else {
+    for (size_t i = 0; i < tablet_ids.size(); i++) {
+      statuses[i] = SetupHostedTablet(tablet_ids[i], &tablets[i]);
+      if (!statuses[i].ok()) {
+        break;
+      }
+    }
+  }
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    for (size_t i = 0; i < tablet_ids.size(); i++) {
+      RETURN_NOT_OK_PREPEND(statuses[i], "Unable to open tablet " + tablet_ids[i]);
+      tablets_.emplace(tablet_ids[i], std::move(tablets[i]));
+    }
+  }
+  METRIC_startup_tablets_open_duration.Instantiate(
+      server_->metric_entity(), (MonoTime::Now() - start).ToMilliseconds());
+  return Status::OK();
 }
 
 Status TSTabletManager::CreateNew(FsManager *fs_manager) {
@@ -368,6 +459,11 @@ bool TSTabletManager::IsRunning() const {
 Status TSTabletManager::Init(bool is_first_run) {
   CHECK_EQ(state(), MANAGER_INITIALIZING);
 
+  if (FLAGS_tablet_manager_shared_wal_sync) {
+    wal_sync_group_.reset(new log::LogSyncGroup(fs_manager_->env(),
+                                                fs_manager_->GetWalsRootDirs()));
+  }
+
   if (is_first_run) {
     LOG(INFO) << "TSTabletManager::Init: is_first_run detected. Calling CreateNew";
     RETURN_NOT_OK_PREPEND(
@@ -404,12 +500,43 @@ Status TSTabletManager::Start(bool is_first_run) {
   VLOG(2) << "T " << kSysCatalogTabletId << " P " << consensus_->peer_uuid() << ": Peer starting";
   VLOG(2) << "RaftConfig before starting: " << SecureDebugString(consensus_->CommittedConfig());
 
-  gscoped_ptr<PeerProxyFactory> peer_proxy_factory;
-  scoped_refptr<ITimeManager> time_manager;
+  // We cannot hold 'lock_' while we call RaftConsensus::Start() because it
+  // may invoke TabletReplica::StartFollowerTransaction() during startup,
+  // causing a self-deadlock. We take a ref to members protected by 'lock_'
+  // before unlocking.
+  RETURN_NOT_OK(consensus_->Start(
+        bootstrap_info_, NewPeerProxyFactory(),
+        log_, NewTimeManager(),
+        round_handler(), server_->metric_entity(), mark_dirty_clbk_));
 
-  peer_proxy_factory.reset(
-      new RpcPeerProxyFactory(server_->messenger(), server_->metric_entity()));
+  RETURN_NOT_OK_PREPEND(WaitUntilRunning(),
+                        "Failed waiting for the raft to run");
 
+  vector<shared_ptr<HostedTablet>> tablets;
+  {
+    shared_lock<RWMutex> l(lock_);
+    for (const auto& entry : tablets_) {
+      tablets.push_back(entry.second);
+    }
+  }
+  for (const auto& tablet : tablets) {
+    RETURN_NOT_OK_PREPEND(StartHostedTablet(tablet),
+                          "Unable to start tablet " + tablet->consensus->tablet_id());
+  }
+
+  set_state(MANAGER_RUNNING);
+  return Status::OK();
+}
+
+gscoped_ptr<PeerProxyFactory> TSTabletManager::NewPeerProxyFactory() const {
+  // All the tablets send their requests through the server's messenger.
+  return gscoped_ptr<PeerProxyFactory>(
+      new RpcPeerProxyFactory(server_->messenger(), server_->metric_entity(),
+                              local_peer_pb_.attrs().region()));
+}
+
+scoped_refptr<ITimeManager> TSTabletManager::NewTimeManager() const {
+  scoped_refptr<ITimeManager> time_manager;
   if (server_->opts().enable_time_manager) {
     // THIS IS OBVIOUSLY NOT CORRECT.
     // ONLY TO MAKE CODE COMPILE [ Anirban ]
@@ -418,31 +545,131 @@ Status TSTabletManager::Start(bool is_first_run) {
   } else {
     time_manager.reset(new TimeManagerDummy());
   }
+  return time_manager;
+}
 
-  ConsensusRoundHandler *round_handler = this;
+ConsensusRoundHandler* TSTabletManager::round_handler() {
   // If round handler comes from server options then override it
   if (server_->opts().round_handler) {
-    round_handler = server_->opts().round_handler;
+    return server_->opts().round_handler;
   }
+  return this;
+}
 
-  // We cannot hold 'lock_' while we call RaftConsensus::Start() because it
-  // may invoke TabletReplica::StartFollowerTransaction() during startup,
-  // causing a self-deadlock. We take a ref to members protected by 'lock_'
-  // before unlocking.
-  RETURN_NOT_OK(consensus_->Start(
-        bootstrap_info_, std::move(peer_proxy_factory),
-        log_, std::move(time_manager),
-        round_handler, server_->metric_entity(), mark_dirty_clbk_));
+LogOptions TSTabletManager::MakeLogOptions() const {
+  LogOptions log_options;
+  log_options.append_pool = wal_append_pool_.get();
+  log_options.sync_group = wal_sync_group_.get();
+  return log_options;
+}
 
-  RETURN_NOT_OK_PREPEND(WaitUntilRunning(),
-                        "Failed waiting for the raft to run");
+Status TSTabletManager::SetupHostedTablet(const string& tablet_id,
+                                          shared_ptr<HostedTablet>* tablet) {
+  if (!persistent_vars_manager_->PersistentVarsFileExists(tablet_id)) {
+    RETURN_NOT_OK_PREPEND(persistent_vars_manager_->CreatePersistentVars(tablet_id),
+                          "Unable to create persistent vars file for tablet " + tablet_id);
+  }
 
-  set_state(MANAGER_RUNNING);
+  ConsensusOptions options;
+  options.tablet_id = tablet_id;
+  options.proxy_policy = server_->opts().proxy_policy;
+
+  auto new_tablet = std::make_shared<HostedTablet>();
+  LOG(INFO) << LogPrefix(tablet_id) << "Creating Raft for the tablet";
+  RETURN_NOT_OK(RaftConsensus::Create(std::move(options),
+                                      local_peer_pb_,
+                                      cmeta_manager_,
+                                      persistent_vars_manager_,
+                                      server_->raft_pool(),
+                                      &new_tablet->consensus));
+  if (server_->opts().disable_noop) {
+    new_tablet->consensus->DisableNoOpEntries();
+  }
+
+  // The callbacks and the log factory of the server options belong to the
+  // system tablet, so the other tablets keep their own native WALs.
+  RETURN_NOT_OK(Log::Open(MakeLogOptions(), fs_manager_, tablet_id,
+                          server_->metric_entity(), &new_tablet->log));
+  new_tablet->log->GetRecoveryInfo(&new_tablet->bootstrap_info);
+  if (new_tablet->bootstrap_info.last_id.term() > new_tablet->consensus->CurrentTerm()) {
+    new_tablet->consensus->SetCurrentTermBootstrap(new_tablet->bootstrap_info.last_id.term());
+  }
+  *tablet = std::move(new_tablet);
   return Status::OK();
 }
 
+Status TSTabletManager::StartHostedTablet(const shared_ptr<HostedTablet>& tablet) {
+  return tablet->consensus->Start(
+      tablet->bootstrap_info, NewPeerProxyFactory(),
+      tablet->log, NewTimeManager(),
+      round_handler(), server_->metric_entity(), mark_dirty_clbk_);
+}
+
+Status TSTabletManager::CreateTablet(const string& tablet_id, const RaftConfigPB& config) {
+  if (!IsRunning()) {
+    return Status::IllegalState("The tablet manager isn't running");
+  }
+  // The ids are kept as the file names of the consensus metadata, which
+  // only canonical uuids are reopened from.
+  string canonical_id;
+  RETURN_NOT_OK(ObjectIdGenerator().Canonicalize(tablet_id, &canonical_id));
+  if (canonical_id != tablet_id) {
+    return Status::InvalidArgument("The tablet id must be a canonical uuid", tablet_id);
+  }
+
+  MutexLock creation_lock(create_tablet_lock_);
+  {
+    shared_lock<RWMutex> l(lock_);
+    if (tablet_id == kSysCatalogTabletId || ContainsKey(tablets_, tablet_id)) {
+      return Status::AlreadyPresent("Tablet already exists", tablet_id);
+    }
+  }
+  RETURN_NOT_OK(consensus::VerifyRaftConfig(config));
+  RETURN_NOT_OK_PREPEND(cmeta_manager_->CreateCMeta(tablet_id, config, consensus::kMinimumTerm),
+                        "Unable to persist consensus metadata for tablet " + tablet_id);
+  RETURN_NOT_OK_PREPEND(cmeta_manager_->CreateDRT(tablet_id, config, {}),
+                        "Unable to create new durable routing table for tablet " + tablet_id);
+
+  shared_ptr<HostedTablet> tablet;
+  RETURN_NOT_OK(SetupHostedTablet(tablet_id, &tablet));
+  {
+    std::lock_guard<RWMutex> l(lock_);
+    tablets_.emplace(tablet_id, tablet);
+  }
+  // Like that of the system tablet, the consensus is started with 'lock_'
+  // released.
+  return StartHostedTablet(tablet);
+}
+
+shared_ptr<RaftConsensus> TSTabletManager::shared_consensus(const string& tablet_id) const {
+  shared_lock<RWMutex> l(lock_);
+  if (tablet_id.empty() || tablet_id == kSysCatalogTabletId || tablets_.empty()) {
+    return consensus_;
+  }
+  const shared_ptr<HostedTablet>* tablet = FindOrNull(tablets_, tablet_id);
+  return tablet ? (*tablet)->consensus : nullptr;
+}
+
+scoped_refptr<Log> TSTabletManager::log(const string& tablet_id) const {
+  shared_lock<RWMutex> l(lock_);
+  if (tablet_id.empty() || tablet_id == kSysCatalogTabletId || tablets_.empty()) {
+    return log_;
+  }
+  const shared_ptr<HostedTablet>* tablet = FindOrNull(tablets_, tablet_id);
+  return tablet ? (*tablet)->log : nullptr;
+}
+
+void TSTabletManager::GetTabletIds(vector<string>* tablet_ids) const {
+  shared_lock<RWMutex> l(lock_);
+  tablet_ids->push_back(kSysCatalogTabletId);
+  for (const auto& entry : tablets_) {
+    tablet_ids->push_back(entry.first);
+  }
+}
+
 Status TSTabletManager::SetupRaft() {
   CHECK_EQ(state(), MANAGER_INITIALIZING);
+  MonoTime start = MonoTime::Now();
 
   InitLocalRaftPeerPB();
 
@@ -462,6 +689,29 @@ Status TSTabletManager::SetupRaft() {
         server_->opts().topology_config.initial_raft_rpc_token();
   }
 
+  // Open the log, while passing in the factory class.
+  // Factory could be empty.
+  LogOptions log_options = MakeLogOptions();
+  log_options.log_factory = server_->opts().log_factory;
+  auto open_log = [&]() {
+    return Log::Open(log_options, fs_manager_, kSysCatalogTabletId,
+                     server_->metric_entity(), &log_);
+  };
+
+  // Opening the log may replay a long WAL, which doesn't depend on the
+  // consensus, so they may be set up at the same time.
+  Status s1;
+  scoped_refptr<Thread> log_thread;
+  if (FLAGS_server_parallel_init) {
+    RETURN_NOT_OK(Thread::Create("tablet-manager", "open-log",
+                                 [&]() { s1 = open_log(); }, &log_thread));
+  }
+  auto join_log = MakeScopedCleanup([&]() {
+    if (log_thread) {
+      log_thread->Join();
+    }
+  });
+
   shared_ptr<RaftConsensus> consensus;
   TRACE("Creating consensus");
   LOG(INFO) << LogPrefix(kSysCatalogTabletId) << "Creating Raft for the system tablet";
@@ -498,12 +748,13 @@ Status TSTabletManager::SetupRaft() {
   scoped_refptr<ConsensusMetadata> cmeta;
   Status s = cmeta_manager_->LoadCMeta(kSysCatalogTabletId, &cmeta);
 
-  // Open the log, while passing in the factory class.
-  // Factory could be empty.
-  LogOptions log_options;
-  log_options.log_factory = server_->opts().log_factory;
-  Status s1 = Log::Open(log_options, fs_manager_, kSysCatalogTabletId,
-      server_->metric_entity(), &log_);
+  if (log_thread) {
+    log_thread->Join();
+    join_log.cancel();
+  } else {
+    s1 = open_log();
+  }
+  RETURN_NOT_OK(s1);
 
   // Abstracted logs will do their own log recovery
   // during Log::Open->Log::Init (virtual call). bootstrap_info
@@ -529,14 +780,19 @@ Status TSTabletManager::SetupRaft() {
   // an instance to the term of the Last Logged OpId.
   // In the MySQL first_run case, MySQL is expected to pass in
   // log_bootstrap_on_first_run in options.
-  if (server_->opts().log_factory && (!server_->is_first_run_ ||
-      server_->opts().log_bootstrap_on_first_run)) {
+  //
+  // The native log only knows its last operations if it was closed cleanly
+  // with --log_clean_shutdown_checkpoint, and leaves 'bootstrap_info_' as it
+  // is otherwise.
+  if (!server_->is_first_run_ || server_->opts().log_bootstrap_on_first_run) {
     log_->GetRecoveryInfo(&bootstrap_info_);
     if (bootstrap_info_.last_id.term() > consensus_->CurrentTerm()) {
       consensus_->SetCurrentTermBootstrap(bootstrap_info_.last_id.term());
     }
   }
-  return s1;
+  METRIC_startup_raft_setup_duration.Instantiate(
+      server_->metric_entity(), (MonoTime::Now() - start).ToMilliseconds());
+  return Status::OK();
 }
 
 void TSTabletManager::Shutdown() {
@@ -565,6 +821,16 @@ void TSTabletManager::Shutdown() {
   }
 
   if (consensus_) consensus_->Shutdown();
+  vector<shared_ptr<HostedTablet>> tablets;
+  {
+    shared_lock<RWMutex> l(lock_);
+    for (const auto& entry : tablets_) {
+      tablets.push_back(entry.second);
+    }
+  }
+  for (const auto& tablet : tablets) {
+    tablet->consensus->Shutdown();
+  }
 
   state_ = MANAGER_SHUTDOWN;
 }
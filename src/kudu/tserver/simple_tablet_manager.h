@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -38,6 +39,7 @@
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/rw_mutex.h"
 #include "kudu/util/status.h"
 
@@ -56,11 +58,15 @@ class MonoDelta;
 namespace log {
 
 class Log;
+class LogSyncGroup;
+struct LogOptions;
 }
 
 namespace consensus {
 class ConsensusMetadataManager;
+class ITimeManager;
 class OpId;
+class PeerProxyFactory;
 class PersistentVarsManager;
 struct ElectionResult;
 } // namespace consensus
@@ -123,11 +129,41 @@ class TSTabletManager : public consensus::ConsensusRoundHandler {
     return consensus_;
   }
 
+  // Returns the consensus of the tablet with 'tablet_id', or nullptr if it
+  // isn't hosted here. An empty id stands for the system tablet. While only
+  // the system tablet is hosted, it's returned for any id, as requests to
+  // servers hosting a single tablet have never been checked against its id.
+  std::shared_ptr<consensus::RaftConsensus> shared_consensus(
+      const std::string& tablet_id) const;
+
+  // Returns the log of the tablet with 'tablet_id', looked up like
+  // shared_consensus(tablet_id).
+  scoped_refptr<log::Log> log(const std::string& tablet_id) const;
+
   consensus::RaftConsensus* consensus() {
     shared_lock<RWMutex> l(lock_);
     return consensus_.get();
   }
 
+  scoped_refptr<log::Log> log() const {
+    shared_lock<RWMutex> l(lock_);
+    return log_;
+  }
+
+  // Creates a Raft group for a new tablet with 'config', hosted besides the
+  // system tablet, and starts it. It shares the messenger, the raft thread
+  // pool and, with --tablet_manager_wal_append_threads, the WAL append
+  // threads of the server, and its log cache is accounted against the
+  // global log cache limit. The tablet is reopened when the server restarts.
+  //
+  // Returns AlreadyPresent if a tablet with 'tablet_id' exists.
+  Status CreateTablet(const std::string& tablet_id,
+                      const consensus::RaftConfigPB& config);
+
+  // Fills 'tablet_ids' with the ids of the hosted tablets, the system tablet
+  // first.
+  void GetTabletIds(std::vector<std::string>* tablet_ids) const;
+
   // Marks the tablet as dirty so that it's included in the next heartbeat.
   void MarkTabletDirty(const std::string& reason) {
   }
@@ -165,6 +201,29 @@ class TSTabletManager : public consensus::ConsensusRoundHandler {
   // call.
   Status SetupRaft();
 
+  // A tablet hosted besides the system tablet.
+  struct HostedTablet {
+    std::shared_ptr<consensus::RaftConsensus> consensus;
+    scoped_refptr<log::Log> log;
+    consensus::ConsensusBootstrapInfo bootstrap_info;
+  };
+
+  // Creates the consensus and opens the log of the hosted tablet with
+  // 'tablet_id', whose consensus metadata already exists.
+  Status SetupHostedTablet(const std::string& tablet_id,
+                           std::shared_ptr<HostedTablet>* tablet);
+
+  // Starts the consensus of 'tablet'.
+  Status StartHostedTablet(const std::shared_ptr<HostedTablet>& tablet);
+
+  // Returns the options of the logs of the tablets.
+  log::LogOptions MakeLogOptions() const;
+
+  // Return what the consensus of every tablet is started with.
+  gscoped_ptr<consensus::PeerProxyFactory> NewPeerProxyFactory() const;
+  scoped_refptr<consensus::ITimeManager> NewTimeManager() const;
+  consensus::ConsensusRoundHandler* round_handler();
+
   // Initializes the RaftPeerPB for the local peer.
   // Guaranteed to include both uuid and last_seen_addr fields.
   // Crashes with an invariant check if the RPC server is not currently in a
@@ -190,6 +249,15 @@ class TSTabletManager : public consensus::ConsensusRoundHandler {
   const scoped_refptr<consensus::ConsensusMetadataManager> cmeta_manager_;
   const scoped_refptr<consensus::PersistentVarsManager> persistent_vars_manager_;
 
+  // Pool on which the logs of all the tablets append and sync, if
+  // --tablet_manager_wal_append_threads is positive. Declared before the
+  // logs, so that it's destroyed after them.
+  gscoped_ptr<ThreadPool> wal_append_pool_;
+
+  // Makes the appends of all the tablets' logs durable together, with
+  // --tablet_manager_shared_wal_sync. Also destroyed after the logs.
+  gscoped_ptr<log::LogSyncGroup> wal_sync_group_;
+
   // Kudu log, which was created by the passed in
   // factory entity
   scoped_refptr<kudu::log::Log> log_;
@@ -217,6 +285,13 @@ class TSTabletManager : public consensus::ConsensusRoundHandler {
 
   std::shared_ptr<consensus::RaftConsensus> consensus_;
 
+  // The tablets hosted besides the system tablet, by tablet id. Protected by
+  // 'lock_'.
+  std::map<std::string, std::shared_ptr<HostedTablet>> tablets_;
+
+  // Serializes CreateTablet() calls.
+  Mutex create_tablet_lock_;
+
   DISALLOW_COPY_AND_ASSIGN(TSTabletManager);
 };
 
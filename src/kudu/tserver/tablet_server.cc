@@ -46,6 +46,7 @@
 #include "kudu/tserver/tserver_path_handlers.h"
 #include "kudu/util/maintenance_manager.h"
 #endif
+#include "kudu/util/metrics.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread.h"
@@ -54,6 +55,10 @@ using std::string;
 using kudu::fs::ErrorHandlerType;
 using kudu::rpc::ServiceIf;
 
+#ifdef FB_DO_NOT_REMOVE
+METRIC_DECLARE_histogram(log_group_commit_latency);
+#endif
+
 namespace kudu {
 namespace tserver {
 
@@ -120,6 +125,9 @@ Status TabletServer::Init() {
 
   maintenance_manager_.reset(new MaintenanceManager(
       MaintenanceManager::kDefaultOptions, fs_manager_->uuid()));
+  // Defer high I/O maintenance while WAL group commits are slow.
+  maintenance_manager_->set_foreground_latency_histogram(
+      METRIC_log_group_commit_latency.Instantiate(metric_entity()));
 
   heartbeater_.reset(new Heartbeater(opts_, this));
   RETURN_NOT_OK_PREPEND(scanner_manager_->StartRemovalThread(),
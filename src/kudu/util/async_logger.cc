@@ -17,19 +17,117 @@
 
 #include "kudu/util/async_logger.h"
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <thread>
 
+#include "kudu/gutil/bits.h"
+#include "kudu/gutil/port.h"
 #include "kudu/util/monotime.h"
 
+using std::shared_ptr;
 using std::string;
+using std::vector;
 
 namespace kudu {
 
+namespace {
+std::atomic<uint64_t> next_logger_id { 0 };
+} // anonymous namespace
+
+// A ring of messages, which a single thread appends to and the logger
+// thread takes out of, without locking.
+class AsyncLogger::ThreadBuffer {
+ public:
+  explicit ThreadBuffer(int capacity)
+      : capacity_(uint64_t{1} << Bits::Log2Ceiling(capacity)),
+        data_(new char[capacity_]) {
+  }
+
+  // Appends a message. Returns false if it doesn't fit in the free space.
+  // Only called by the thread owning the buffer.
+  bool Append(uint64_t seq, time_t ts, bool force_flush, const char* message, int message_len) {
+    const uint64_t size = sizeof(Header) + message_len;
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (size > capacity_ - (tail - head_.load(std::memory_order_acquire))) {
+      return false;
+    }
+    Header h { seq, ts, message_len, force_flush };
+    CopyIn(tail, &h, sizeof(h));
+    CopyIn(tail + sizeof(h), message, message_len);
+    tail_.store(tail + size, std::memory_order_release);
+    return true;
+  }
+
+  // Returns the end of the newest message so far.
+  uint64_t tail() const { return tail_.load(std::memory_order_acquire); }
+
+  // Moves the messages of the ring which end by 'tail' to 'buf'. Only called
+  // by the logger thread.
+  void Drain(uint64_t tail, Buffer* buf) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    while (head != tail) {
+      Header h;
+      CopyOut(head, &h, sizeof(h));
+      string message(h.message_len, '\0');
+      CopyOut(head + sizeof(h), &message[0], h.message_len);
+      head += sizeof(h) + h.message_len;
+      buf->add(Msg(h.seq, h.ts, std::move(message)), h.force_flush);
+    }
+    head_.store(head, std::memory_order_release);
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+  // Set once the logger is destroyed, for the thread to drop the buffer.
+  void set_closed() { closed_.store(true, std::memory_order_release); }
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+ private:
+  struct Header {
+    uint64_t seq;
+    time_t ts;
+    int message_len;
+    bool force_flush;
+  };
+
+  void CopyIn(uint64_t pos, const void* src, size_t n) {
+    const size_t offset = pos & (capacity_ - 1);
+    const size_t first = std::min<size_t>(n, capacity_ - offset);
+    memcpy(&data_[offset], src, first);
+    memcpy(&data_[0], static_cast<const char*>(src) + first, n - first);
+  }
+
+  void CopyOut(uint64_t pos, void* dst, size_t n) const {
+    const size_t offset = pos & (capacity_ - 1);
+    const size_t first = std::min<size_t>(n, capacity_ - offset);
+    memcpy(dst, &data_[offset], first);
+    memcpy(static_cast<char*>(dst) + first, &data_[0], n - first);
+  }
+
+  const uint64_t capacity_;
+  const std::unique_ptr<char[]> data_;
+
+  // The positions of the oldest message and of the end of the newest one,
+  // which only grow: they are taken modulo the capacity to index 'data_'.
+  alignas(CACHELINE_SIZE) std::atomic<uint64_t> head_ { 0 };
+  alignas(CACHELINE_SIZE) std::atomic<uint64_t> tail_ { 0 };
+
+  std::atomic<bool> closed_ { false };
+
+  DISALLOW_COPY_AND_ASSIGN(ThreadBuffer);
+};
+
 AsyncLogger::AsyncLogger(google::base::Logger* wrapped,
-                         int max_buffer_bytes) :
+                         int max_buffer_bytes,
+                         int thread_buffer_bytes) :
     max_buffer_bytes_(max_buffer_bytes),
+    thread_buffer_bytes_(thread_buffer_bytes),
     wrapped_(DCHECK_NOTNULL(wrapped)),
+    id_(next_logger_id++),
     wake_flusher_cond_(&lock_),
     free_buffer_cond_(&lock_),
     flush_complete_cond_(&lock_),
@@ -38,7 +136,11 @@ AsyncLogger::AsyncLogger(google::base::Logger* wrapped,
   DCHECK_GT(max_buffer_bytes_, 0);
 }
 
-AsyncLogger::~AsyncLogger() {}
+AsyncLogger::~AsyncLogger() {
+  for (const auto& tb : thread_buffers_) {
+    tb->set_closed();
+  }
+}
 
 void AsyncLogger::Start() {
   CHECK_EQ(state_, INITTED);
@@ -56,20 +158,59 @@ void AsyncLogger::Stop() {
   thread_.join();
   CHECK(active_buf_->messages.empty());
   CHECK(flushing_buf_->messages.empty());
+  CHECK(!ThreadBuffersHaveMessagesUnlocked());
+}
+
+AsyncLogger::ThreadBuffer* AsyncLogger::GetThreadBuffer() {
+  // The ring buffers of the calling thread, by the id of their logger.
+  static thread_local vector<std::pair<uint64_t, shared_ptr<ThreadBuffer>>> buffers;
+  for (auto it = buffers.begin(); it != buffers.end();) {
+    if (it->first == id_) {
+      return it->second.get();
+    }
+    it = it->second->closed() ? buffers.erase(it) : it + 1;
+  }
+  shared_ptr<ThreadBuffer> tb = std::make_shared<ThreadBuffer>(thread_buffer_bytes_);
+  {
+    MutexLock l(lock_);
+    thread_buffers_.push_back(tb);
+  }
+  buffers.emplace_back(id_, tb);
+  return tb.get();
+}
+
+bool AsyncLogger::ThreadBuffersHaveMessagesUnlocked() const {
+  return std::any_of(thread_buffers_.begin(), thread_buffers_.end(),
+                     [](const shared_ptr<ThreadBuffer>& tb) { return !tb->empty(); });
+}
+
+void AsyncLogger::WakeFlusherIfWaiting() {
+  // Pairs with the logger thread setting 'flusher_waiting_' before it looks
+  // at the ring buffers for the last time: either it sees the message, or
+  // this sees it waiting.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (flusher_waiting_.load(std::memory_order_relaxed)) {
+    MutexLock l(lock_);
+    wake_flusher_cond_.Signal();
+  }
 }
 
 void AsyncLogger::Write(bool force_flush,
                         time_t timestamp,
                         const char* message,
                         int message_len) {
-  {
+  const uint64_t seq = next_seq_.fetch_add(1, std::memory_order_relaxed);
+  if (thread_buffer_bytes_ > 0 &&
+      GetThreadBuffer()->Append(seq, timestamp, force_flush, message, message_len)) {
+    WakeFlusherIfWaiting();
+  } else {
     MutexLock l(lock_);
     DCHECK_EQ(state_, RUNNING);
     while (BufferFull(*active_buf_)) {
       app_threads_blocked_count_for_tests_++;
       free_buffer_cond_.Wait();
     }
-    active_buf_->add(Msg(timestamp, string(message, message_len)),
+    active_buf_->add(Msg(seq, timestamp, string(message, message_len)),
                      force_flush);
     wake_flusher_cond_.Signal();
   }
@@ -111,10 +252,21 @@ uint32_t AsyncLogger::LogSize() {
 }
 
 void AsyncLogger::RunThread() {
+  // The ring buffers to drain, along with how far.
+  vector<std::pair<shared_ptr<ThreadBuffer>, uint64_t>> to_drain;
   MutexLock l(lock_);
-  while (state_ == RUNNING || active_buf_->needs_flush_or_write()) {
+  while (state_ == RUNNING || active_buf_->needs_flush_or_write() ||
+         ThreadBuffersHaveMessagesUnlocked()) {
     while (!active_buf_->needs_flush_or_write() && state_ == RUNNING) {
-      if (!wake_flusher_cond_.WaitFor(MonoDelta::FromSeconds(FLAGS_logbufsecs))) {
+      flusher_waiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ThreadBuffersHaveMessagesUnlocked()) {
+        flusher_waiting_.store(false, std::memory_order_relaxed);
+        break;
+      }
+      bool signaled = wake_flusher_cond_.WaitFor(MonoDelta::FromSeconds(FLAGS_logbufsecs));
+      flusher_waiting_.store(false, std::memory_order_relaxed);
+      if (!signaled) {
         // In case of wait timeout, force it to flush regardless whether there is anything enqueued.
         active_buf_->flush = true;
       }
@@ -127,8 +279,30 @@ void AsyncLogger::RunThread() {
     if (BufferFull(*flushing_buf_)) {
       free_buffer_cond_.Broadcast();
     }
+    // Drop the ring buffers of the threads which exited, once they're empty.
+    thread_buffers_.erase(
+        std::remove_if(thread_buffers_.begin(), thread_buffers_.end(),
+                       [](const shared_ptr<ThreadBuffer>& tb) {
+                         return tb.use_count() == 1 && tb->empty();
+                       }),
+        thread_buffers_.end());
+    // Only the messages appended to the rings by now go along with the
+    // swapped buffer: a message which went to the shared buffer after the
+    // swap may have been written before messages appended to a ring since.
+    for (const auto& tb : thread_buffers_) {
+      to_drain.emplace_back(tb, tb->tail());
+    }
     l.Unlock();
 
+    if (!to_drain.empty()) {
+      for (const auto& tb_and_tail : to_drain) {
+        tb_and_tail.first->Drain(tb_and_tail.second, flushing_buf_.get());
+      }
+      std::sort(flushing_buf_->messages.begin(), flushing_buf_->messages.end(),
+                [](const Msg& a, const Msg& b) { return a.seq < b.seq; });
+      to_drain.clear();
+    }
+
     for (const auto& msg : flushing_buf_->messages) {
       wrapped_->Write(false, msg.ts, msg.message.data(), msg.message.size());
     }
@@ -18,6 +18,7 @@
 
 #include "kudu/gutil/macros.h"
 
+#include <atomic>
 #include <cstdint>
 #include <ctime>
 #include <memory>
@@ -58,10 +59,20 @@ namespace kudu {
 // NOTE: the logger limits the total amount of buffer space, so if the underlying
 // log blocks for too long, eventually the threads generating the log messages
 // will block as well. This prevents runaway memory usage.
+//
+// If 'thread_buffer_bytes' is set, each thread writing to the logger also gets
+// a ring buffer of that size, which only it appends to and only the logger
+// thread takes messages out of. Writing a message which fits in the ring then
+// takes no lock, and only wakes the logger thread if it's waiting for work, so
+// a burst of messages from many threads doesn't serialize them on the lock of
+// the shared buffer. The logger thread writes the messages of all the buffers
+// in the order they were written. Messages which don't fit in the ring of
+// their thread go to the shared buffers.
 class AsyncLogger : public google::base::Logger {
  public:
   AsyncLogger(google::base::Logger* wrapped,
-              int max_buffer_bytes);
+              int max_buffer_bytes,
+              int thread_buffer_bytes = 0);
   ~AsyncLogger();
 
   void Start();
@@ -112,11 +123,14 @@ class AsyncLogger : public google::base::Logger {
   // Arenas and allocate both the message data and Msg struct from them, forming
   // a linked list.
   struct Msg {
+    // The order in which the message was written, across all threads.
+    uint64_t seq;
     time_t ts;
     std::string message;
 
-    Msg(time_t ts, std::string message)
-        : ts(ts),
+    Msg(uint64_t seq, time_t ts, std::string message)
+        : seq(seq),
+          ts(ts),
           message(std::move(message)) {
     }
   };
@@ -154,14 +168,39 @@ class AsyncLogger : public google::base::Logger {
     DISALLOW_COPY_AND_ASSIGN(Buffer);
   };
 
+  // The ring buffer of a thread. Defined in async_logger.cc.
+  class ThreadBuffer;
+
+  // Returns the ring buffer of the calling thread, creating it on the
+  // thread's first message.
+  ThreadBuffer* GetThreadBuffer();
+
+  // Whether any ring buffer has messages.
+  bool ThreadBuffersHaveMessagesUnlocked() const;
+
+  // Wakes the logger thread if it's waiting for messages.
+  void WakeFlusherIfWaiting();
+
   bool BufferFull(const Buffer& buf) const;
   void RunThread();
 
-  // The maximum number of bytes used by the entire class.
+  // The maximum number of bytes used by the entire class, leaving aside
+  // the ring buffers of the threads.
   const int max_buffer_bytes_;
+  const int thread_buffer_bytes_;
   google::base::Logger* const wrapped_;
   std::thread thread_;
 
+  // Tells the ring buffers of different loggers apart.
+  const uint64_t id_;
+
+  // The sequence number of the next message.
+  std::atomic<uint64_t> next_seq_ { 0 };
+
+  // Set by the logger thread while it waits for messages, so that threads
+  // appending to their ring buffers know to wake it.
+  std::atomic<bool> flusher_waiting_ { false };
+
   // Count of how many times an application thread was blocked due to
   // a full buffer.
   int app_threads_blocked_count_for_tests_ = 0;
@@ -192,6 +231,10 @@ class AsyncLogger : public google::base::Logger {
   // after a successful flush.
   std::unique_ptr<Buffer> flushing_buf_;
 
+  // The ring buffers of the threads which wrote to the logger, owned
+  // along with the threads themselves.
+  std::vector<std::shared_ptr<ThreadBuffer>> thread_buffers_;
+
   // Trigger for the logger thread to stop.
   enum State {
     INITTED,
@@ -44,6 +44,8 @@
 DEFINE_int32(num_threads, 16, "The number of threads to access the cache concurrently.");
 DEFINE_int32(run_seconds, 1, "The number of seconds to run the benchmark");
 
+DECLARE_string(cache_eviction_policy);
+
 using std::atomic;
 using std::pair;
 using std::string;
@@ -75,13 +77,17 @@ struct BenchSetup {
   // in the cache.
   double dataset_cache_ratio;
 
+  // The eviction policy of the cache, as for --cache_eviction_policy.
+  string policy;
+
   string ToString() const {
     string ret;
     switch (pattern) {
       case Pattern::ZIPFIAN: ret += "ZIPFIAN"; break;
       case Pattern::UNIFORM: ret += "UNIFORM"; break;
     }
-    ret += StringPrintf(" ratio=%.2fx n_unique=%d", dataset_cache_ratio, max_key());
+    ret += StringPrintf(" ratio=%.2fx n_unique=%d policy=%s",
+                        dataset_cache_ratio, max_key(), policy.c_str());
     return ret;
   }
 
@@ -97,7 +103,8 @@ class CacheBench : public KuduTest,
   void SetUp() override {
     KuduTest::SetUp();
 
-    cache_.reset(NewLRUCache(DRAM_CACHE, kCacheCapacity, "test-cache"));
+    FLAGS_cache_eviction_policy = GetParam().policy;
+    cache_.reset(NewCache(DRAM_CACHE, kCacheCapacity, kEntrySize, "test-cache"));
   }
 
   // Run queries against the cache until '*done' becomes true.
@@ -159,12 +166,17 @@ class CacheBench : public KuduTest,
 };
 
 // Test both distributions, and for each, test both the case where the data
-// fits in the cache and where it is a bit larger.
+// fits in the cache, where nearly every query is a lookup which hits, and
+// where it is a bit larger, for both eviction policies.
 INSTANTIATE_TEST_CASE_P(Patterns, CacheBench, testing::ValuesIn(std::vector<BenchSetup>{
-      {BenchSetup::Pattern::ZIPFIAN, 1.0},
-      {BenchSetup::Pattern::ZIPFIAN, 3.0},
-      {BenchSetup::Pattern::UNIFORM, 1.0},
-      {BenchSetup::Pattern::UNIFORM, 3.0}
+      {BenchSetup::Pattern::ZIPFIAN, 1.0, "lru"},
+      {BenchSetup::Pattern::ZIPFIAN, 3.0, "lru"},
+      {BenchSetup::Pattern::UNIFORM, 1.0, "lru"},
+      {BenchSetup::Pattern::UNIFORM, 3.0, "lru"},
+      {BenchSetup::Pattern::ZIPFIAN, 1.0, "clock"},
+      {BenchSetup::Pattern::ZIPFIAN, 3.0, "clock"},
+      {BenchSetup::Pattern::UNIFORM, 1.0, "clock"},
+      {BenchSetup::Pattern::UNIFORM, 3.0, "clock"}
     }));
 
 TEST_P(CacheBench, RunBench) {
@@ -5,7 +5,10 @@
 #include <cassert>
 #include <cstring>
 #include <memory>
+#include <ostream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <glog/logging.h>
@@ -22,6 +25,7 @@
 #include "kudu/util/faststring.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/random.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
@@ -31,6 +35,7 @@ DECLARE_string(nvm_cache_path);
 #endif // defined(__linux__)
 
 DECLARE_double(cache_memtracker_approximation_ratio);
+DECLARE_string(cache_eviction_policy);
 
 namespace kudu {
 
@@ -45,8 +50,11 @@ static int DecodeInt(const Slice& k) {
   return DecodeFixed32(k.data());
 }
 
+// The type of the cache, and its eviction policy.
+typedef std::pair<CacheType, std::string> CacheTestParam;
+
 class CacheTest : public KuduTest,
-                  public ::testing::WithParamInterface<CacheType>,
+                  public ::testing::WithParamInterface<CacheTestParam>,
                   public Cache::EvictionCallback {
  public:
 
@@ -76,12 +84,15 @@ class CacheTest : public KuduTest,
     // assertions on the MemTracker in this test.
     FLAGS_cache_memtracker_approximation_ratio = 0;
 
-    cache_.reset(NewLRUCache(GetParam(), kCacheSize, "cache_test"));
+    FLAGS_cache_eviction_policy = GetParam().second;
+    cache_.reset(NewCache(GetParam().first, kCacheSize, /*estimated_entry_charge=*/1024,
+                          "cache_test"));
 
-    MemTracker::FindTracker("cache_test-sharded_lru_cache", &mem_tracker_);
+    MemTracker::FindTracker(
+        "cache_test-sharded_" + GetParam().second + "_cache", &mem_tracker_);
     // Since nvm cache does not have memtracker due to the use of
     // tcmalloc for this we only check for it in the DRAM case.
-    if (GetParam() == DRAM_CACHE) {
+    if (GetParam().first == DRAM_CACHE) {
       ASSERT_TRUE(mem_tracker_.get());
     }
 
@@ -114,9 +125,14 @@ class CacheTest : public KuduTest,
 };
 
 #if defined(__linux__)
-INSTANTIATE_TEST_CASE_P(CacheTypes, CacheTest, ::testing::Values(DRAM_CACHE, NVM_CACHE));
+INSTANTIATE_TEST_CASE_P(CacheTypes, CacheTest, ::testing::Values(
+    CacheTestParam(DRAM_CACHE, "lru"),
+    CacheTestParam(DRAM_CACHE, "clock"),
+    CacheTestParam(NVM_CACHE, "lru")));
 #else
-INSTANTIATE_TEST_CASE_P(CacheTypes, CacheTest, ::testing::Values(DRAM_CACHE));
+INSTANTIATE_TEST_CASE_P(CacheTypes, CacheTest, ::testing::Values(
+    CacheTestParam(DRAM_CACHE, "lru"),
+    CacheTestParam(DRAM_CACHE, "clock")));
 #endif // defined(__linux__)
 
 TEST_P(CacheTest, TrackMemory) {
@@ -243,4 +259,47 @@ TEST_P(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
 }
 
+// Threads looking up, inserting and erasing the same keys at once only ever
+// find the values inserted for the keys they look up.
+TEST_P(CacheTest, ConcurrentAccess) {
+  const int kNumThreads = 8;
+  const int kNumKeys = 1000;
+  const int kOpsPerThread = AllowSlowTests() ? 1000000 : 50000;
+  const int kCharge = kCacheSize / (kNumKeys / 2);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      Random r(t);
+      for (int i = 0; i < kOpsPerThread; i++) {
+        int key = r.Uniform(kNumKeys);
+        switch (r.Uniform(10)) {
+          case 0:
+            Erase(key);
+            break;
+          case 1:
+          case 2: {
+            std::string key_str = EncodeInt(key);
+            std::string val_str = EncodeInt(key * 2);
+            Cache::PendingHandle* ph = cache_->Allocate(key_str, val_str.size(), kCharge);
+            memcpy(cache_->MutableValue(ph), val_str.data(), val_str.size());
+            cache_->Release(cache_->Insert(ph, nullptr));
+            break;
+          }
+          default: {
+            Cache::Handle* h = cache_->Lookup(EncodeInt(key), Cache::EXPECT_IN_CACHE);
+            if (h != nullptr) {
+              CHECK_EQ(key * 2, DecodeInt(cache_->Value(h)));
+              cache_->Release(h);
+            }
+            break;
+          }
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
 }  // namespace kudu
@@ -27,6 +27,7 @@
 #include "kudu/gutil/sysinfo.h"
 #include "kudu/util/alignment.h"
 #include "kudu/util/cache_metrics.h"
+#include "kudu/util/clock_cache.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/malloc.h"
@@ -49,6 +50,22 @@ DEFINE_double(cache_memtracker_approximation_ratio, 0.01,
               "this ratio to improve performance. For tests.");
 TAG_FLAG(cache_memtracker_approximation_ratio, hidden);
 
+DEFINE_string(cache_eviction_policy, "lru",
+              "The eviction policy of the caches in DRAM: 'lru', or 'clock', whose "
+              "lookups take no locks, for caches read by many threads at once. "
+              "Caches in NVM always use 'lru'.");
+TAG_FLAG(cache_eviction_policy, experimental);
+
+static bool ValidateCacheEvictionPolicy(const char* flag_name, const std::string& flag_value) {
+  if (flag_value == "lru" || flag_value == "clock") {
+    return true;
+  }
+  LOG(ERROR) << "Invalid value for --" << flag_name << ": " << flag_value
+             << " (expected 'lru' or 'clock')";
+  return false;
+}
+DEFINE_validator(cache_eviction_policy, &ValidateCacheEvictionPolicy);
+
 using std::atomic;
 using std::shared_ptr;
 using std::string;
@@ -569,4 +586,12 @@ Cache* NewLRUCache(CacheType type, size_t capacity, const string& id) {
   }
 }
 
+Cache* NewCache(CacheType type, size_t capacity, size_t estimated_entry_charge,
+                const string& id) {
+  if (type == DRAM_CACHE && FLAGS_cache_eviction_policy == "clock") {
+    return NewClockCache(capacity, estimated_entry_charge, id);
+  }
+  return NewLRUCache(type, capacity, id);
+}
+
 }  // namespace kudu
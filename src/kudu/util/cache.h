@@ -12,8 +12,9 @@
 //
 // This is taken from LevelDB and evolved to fit the kudu codebase.
 //
-// TODO: this is pretty lock-heavy. Would be good to sub out something
-// a little more concurrent.
+// The LRU cache is pretty lock-heavy: each lookup and release takes the lock
+// of a shard. The clock cache (see clock_cache.h) looks up entries without
+// locking, at the cost of a coarser eviction policy.
 
 #ifndef KUDU_UTIL_CACHE_H_
 #define KUDU_UTIL_CACHE_H_
@@ -41,6 +42,12 @@ enum CacheType {
 // of Cache uses a least-recently-used eviction policy.
 Cache* NewLRUCache(CacheType type, size_t capacity, const std::string& id);
 
+// Create a new cache with a fixed size capacity, whose eviction policy is
+// chosen by --cache_eviction_policy. Caches which may use the clock policy
+// are sized for entries charged 'estimated_entry_charge' on average.
+Cache* NewCache(CacheType type, size_t capacity, size_t estimated_entry_charge,
+                const std::string& id);
+
 class Cache {
  public:
   // Callback interface which is called when an entry is evicted from the
@@ -0,0 +1,616 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/clock_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/bits.h"
+#include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/hash/city.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/stl_util.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/sysinfo.h"
+#include "kudu/util/alignment.h"
+#include "kudu/util/cache.h"
+#include "kudu/util/cache_metrics.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/malloc.h"
+#include "kudu/util/mem_tracker.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/slice.h"
+#include "kudu/util/test_util_prod.h"
+
+DECLARE_bool(cache_force_single_shard);
+DECLARE_double(cache_memtracker_approximation_ratio);
+
+using std::atomic;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace kudu {
+
+namespace {
+
+struct ClockSlot;
+
+// An entry is a variable length heap-allocated structure, laid out like the
+// entries of the LRU cache.
+struct ClockHandle {
+  Cache::EvictionCallback* eviction_callback;
+  // The slot holding the entry, or nullptr if the entry found no free slot
+  // and was handed back to its inserter without being cached.
+  ClockSlot* slot;
+  size_t charge;
+  uint32_t key_length;
+  uint32_t val_length;
+  uint32_t hash;
+
+  // The storage for the key/value pair itself. The data is stored as:
+  //   [key bytes ...] [padding up to 8-byte boundary] [value bytes ...]
+  uint8_t kv_data[1];   // Beginning of key/value pair
+
+  Slice key() const {
+    return Slice(kv_data, key_length);
+  }
+
+  uint8_t* mutable_val_ptr() {
+    int val_offset = KUDU_ALIGN_UP(key_length, sizeof(void*));
+    return &kv_data[val_offset];
+  }
+
+  const uint8_t* val_ptr() const {
+    return const_cast<ClockHandle*>(this)->mutable_val_ptr();
+  }
+
+  Slice value() const {
+    return Slice(val_ptr(), val_length);
+  }
+};
+
+// The states of a slot, kept in the top bits of its 'meta'.
+//
+//   EMPTY         the slot holds no entry.
+//   CONSTRUCTION  the slot is owned by the thread filling or freeing it.
+//   VISIBLE       the entry of the slot can be looked up.
+//   INVISIBLE     the entry was erased or replaced, and is freed when its
+//                 last reference is released.
+enum SlotState : uint64_t {
+  EMPTY = 0,
+  CONSTRUCTION = 1,
+  VISIBLE = 2,
+  INVISIBLE = 3
+};
+
+constexpr int kStateShift = 62;
+constexpr uint64_t kRefsMask = (uint64_t{1} << 32) - 1;
+
+uint64_t StateOf(uint64_t meta) { return meta >> kStateShift; }
+uint64_t RefsOf(uint64_t meta) { return meta & kRefsMask; }
+uint64_t MetaOf(SlotState state) { return static_cast<uint64_t>(state) << kStateShift; }
+
+// What to add to 'meta' to move a slot from 'from' to 'to', leaving its
+// references alone.
+uint64_t StateDelta(SlotState from, SlotState to) {
+  return (static_cast<uint64_t>(to) - static_cast<uint64_t>(from)) << kStateShift;
+}
+
+// A slot of the table of a shard. The slots live as long as the shard, so
+// any thread may look at any slot without locking: the state of a slot and
+// the number of references to its entry are packed into 'meta', which is
+// only changed atomically.
+//
+// Lookups take a reference before they know whether a slot holds the entry
+// they're after, and drop it if it doesn't, so even the slots which are
+// EMPTY or under CONSTRUCTION may briefly have references. Because of this,
+// states are changed by adding to 'meta' rather than by storing to it, and
+// an entry may only be freed by the thread which moves its slot from zero
+// references to CONSTRUCTION.
+struct ClockSlot {
+  ClockSlot()
+      : meta(0),
+        hash(0),
+        displacements(0),
+        handle(nullptr),
+        countdown(0) {
+  }
+
+  atomic<uint64_t> meta;
+
+  // The hash of the entry, to skip mismatching slots without taking a reference.
+  atomic<uint32_t> hash;
+
+  // The number of entries held by later slots which probed this one on
+  // insertion. Probes stop at the first slot with none.
+  atomic<uint32_t> displacements;
+
+  // Only written while the slot is under CONSTRUCTION, and only read while
+  // holding a reference to a VISIBLE or INVISIBLE slot.
+  ClockHandle* handle;
+
+  // How many more times the clock hand may pass the entry before evicting
+  // it. Lookups raise it, up to kMaxCountdown.
+  atomic<uint8_t> countdown;
+};
+
+// Entries which are looked up often survive this many turns of the hand
+// without being looked up again.
+constexpr uint8_t kMaxCountdown = 3;
+// Entries which are never looked up after their insertion survive one turn.
+constexpr uint8_t kInitialCountdown = 1;
+
+// The tables are sized for this ratio of their slots to hold entries of the
+// estimated charge, and evict entries past the higher ratio regardless of
+// their charge, since the probes of nearly full tables get long.
+constexpr double kLoadFactor = 0.7;
+constexpr double kMaxLoadFactor = 0.9;
+constexpr size_t kMinSlots = 16;
+
+// The number of slots the hand moves over at a time, so that inserting
+// threads which need to evict entries don't all fight over the hand.
+constexpr size_t kEvictionBatch = 8;
+
+// A single shard of the sharded cache.
+//
+// Lookups and releases only touch the slots they look at, without locking.
+// Insertions claim a free slot by probing the table from the home slot of
+// their hash, and first evict entries if the shard is over its capacity:
+// the clock hand moves over the slots a batch at a time, decrementing the
+// countdowns of the entries it passes and evicting the unreferenced ones
+// whose countdowns ran out.
+class ClockCacheShard {
+ public:
+  ClockCacheShard(MemTracker* tracker, size_t capacity, size_t num_slots);
+  ~ClockCacheShard();
+
+  void SetMetrics(CacheMetrics* metrics) { metrics_ = metrics; }
+
+  Cache::Handle* Insert(ClockHandle* handle, Cache::EvictionCallback* eviction_callback);
+  // Like Cache::Lookup, but with an extra "hash" parameter.
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash, bool caching);
+  void Release(ClockHandle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+
+ private:
+  ClockSlot* SlotAt(size_t i) { return &slots_[i & mask_]; }
+
+  // Takes a reference to the entry of 'slot' if the slot is VISIBLE and
+  // the entry's key is 'key'. Returns whether it did.
+  bool TryRef(ClockSlot* slot, const Slice& key, uint32_t hash);
+
+  // Drops a reference to the entry of 'slot', freeing the entry if it was
+  // the last reference to an INVISIBLE entry.
+  void Unref(ClockSlot* slot);
+
+  // Evicts the entry of 'slot' if it's VISIBLE, unreferenced, and its
+  // countdown ran out, or else decrements its countdown.
+  void TryEvict(ClockSlot* slot);
+
+  // Moves the clock hand until the shard has room for an entry of 'charge',
+  // or until the hand went around the table enough times to have evicted
+  // every entry which isn't referenced.
+  void EvictIfNeeded(size_t charge);
+
+  // Claims a free slot for an entry of 'hash', moving it to CONSTRUCTION.
+  // Returns nullptr if the table has no free slot.
+  ClockSlot* ClaimSlot(uint32_t hash);
+
+  // Empties 'slot', which the caller moved to CONSTRUCTION, and frees its entry.
+  void FreeSlot(ClockSlot* slot);
+
+  // Call the user's eviction callback, if it exists, and free the entry.
+  void FreeEntry(ClockHandle* e);
+
+  // Update the memtracker's consumption by the given amount, buffering the
+  // updates like the LRU cache does.
+  void UpdateMemTracker(int64_t delta);
+
+  const size_t capacity_;
+  const size_t max_occupancy_;
+  const size_t mask_;
+  const unique_ptr<ClockSlot[]> slots_;
+
+  // The total charge of the entries in the slots, and the number of slots
+  // which aren't EMPTY.
+  atomic<size_t> usage_;
+  atomic<size_t> occupancy_;
+
+  // The next slot for the clock hand to look at, modulo the number of slots.
+  atomic<size_t> hand_;
+
+  MemTracker* mem_tracker_;
+  atomic<int64_t> deferred_consumption_ { 0 };
+  const int64_t max_deferred_consumption_;
+
+  CacheMetrics* metrics_;
+
+  DISALLOW_COPY_AND_ASSIGN(ClockCacheShard);
+};
+
+ClockCacheShard::ClockCacheShard(MemTracker* tracker, size_t capacity, size_t num_slots)
+    : capacity_(capacity),
+      max_occupancy_(std::max<size_t>(1, num_slots * kMaxLoadFactor)),
+      mask_(num_slots - 1),
+      slots_(new ClockSlot[num_slots]),
+      usage_(0),
+      occupancy_(0),
+      hand_(0),
+      mem_tracker_(tracker),
+      max_deferred_consumption_(capacity * FLAGS_cache_memtracker_approximation_ratio),
+      metrics_(nullptr) {
+  DCHECK_EQ(0, num_slots & mask_) << "the number of slots must be a power of 2";
+}
+
+ClockCacheShard::~ClockCacheShard() {
+  for (size_t i = 0; i <= mask_; i++) {
+    ClockSlot* slot = &slots_[i];
+    uint64_t meta = slot->meta.load(std::memory_order_acquire);
+    if (StateOf(meta) == VISIBLE || StateOf(meta) == INVISIBLE) {
+      DCHECK_EQ(0, RefsOf(meta)) << "caller has an unreleased handle";
+      FreeEntry(slot->handle);
+    }
+  }
+  mem_tracker_->Consume(deferred_consumption_);
+}
+
+bool ClockCacheShard::TryRef(ClockSlot* slot, const Slice& key, uint32_t hash) {
+  // Look before taking a reference, so that lookups don't dirty the cache
+  // lines of the slots they probe past.
+  uint64_t meta = slot->meta.load(std::memory_order_acquire);
+  if (StateOf(meta) != VISIBLE || slot->hash.load(std::memory_order_relaxed) != hash) {
+    return false;
+  }
+  meta = slot->meta.fetch_add(1, std::memory_order_acq_rel);
+  if (PREDICT_TRUE(StateOf(meta) == VISIBLE && slot->handle->key() == key)) {
+    return true;
+  }
+  Unref(slot);
+  return false;
+}
+
+void ClockCacheShard::Unref(ClockSlot* slot) {
+  uint64_t old_meta = slot->meta.fetch_sub(1, std::memory_order_acq_rel);
+  DCHECK_GT(RefsOf(old_meta), 0);
+  if (StateOf(old_meta) == INVISIBLE && RefsOf(old_meta) == 1) {
+    // Fails if another lookup took a reference in the meantime, in which
+    // case dropping that reference frees the entry.
+    uint64_t expected = MetaOf(INVISIBLE);
+    if (slot->meta.compare_exchange_strong(expected, MetaOf(CONSTRUCTION),
+                                           std::memory_order_acq_rel)) {
+      FreeSlot(slot);
+    }
+  }
+}
+
+void ClockCacheShard::TryEvict(ClockSlot* slot) {
+  uint64_t meta = slot->meta.load(std::memory_order_acquire);
+  if (StateOf(meta) != VISIBLE) {
+    return;
+  }
+  uint8_t countdown = slot->countdown.load(std::memory_order_relaxed);
+  if (countdown > 0) {
+    slot->countdown.store(countdown - 1, std::memory_order_relaxed);
+    return;
+  }
+  if (RefsOf(meta) != 0) {
+    return;
+  }
+  uint64_t expected = MetaOf(VISIBLE);
+  if (slot->meta.compare_exchange_strong(expected, MetaOf(CONSTRUCTION),
+                                         std::memory_order_acq_rel)) {
+    FreeSlot(slot);
+  }
+}
+
+void ClockCacheShard::EvictIfNeeded(size_t charge) {
+  const size_t max_steps = (kMaxCountdown + 1) * (mask_ + 1);
+  for (size_t steps = 0; steps < max_steps; steps += kEvictionBatch) {
+    if (usage_.load(std::memory_order_relaxed) + charge <= capacity_ &&
+        occupancy_.load(std::memory_order_relaxed) < max_occupancy_) {
+      return;
+    }
+    size_t start = hand_.fetch_add(kEvictionBatch, std::memory_order_relaxed);
+    for (size_t i = 0; i < kEvictionBatch; i++) {
+      TryEvict(SlotAt(start + i));
+    }
+  }
+}
+
+ClockSlot* ClockCacheShard::ClaimSlot(uint32_t hash) {
+  for (size_t i = 0; i <= mask_; i++) {
+    ClockSlot* slot = SlotAt(hash + i);
+    uint64_t meta = slot->meta.load(std::memory_order_relaxed);
+    while (StateOf(meta) == EMPTY) {
+      if (slot->meta.compare_exchange_weak(meta, meta + StateDelta(EMPTY, CONSTRUCTION),
+                                           std::memory_order_acq_rel)) {
+        return slot;
+      }
+    }
+    slot->displacements.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Every slot is taken: undo the displacements.
+  for (size_t i = 0; i <= mask_; i++) {
+    SlotAt(hash + i)->displacements.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return nullptr;
+}
+
+void ClockCacheShard::FreeSlot(ClockSlot* slot) {
+  ClockHandle* e = slot->handle;
+  slot->handle = nullptr;
+  const size_t index = slot - slots_.get();
+  for (size_t i = e->hash & mask_; i != index; i = (i + 1) & mask_) {
+    slots_[i].displacements.fetch_sub(1, std::memory_order_relaxed);
+  }
+  usage_.fetch_sub(e->charge, std::memory_order_relaxed);
+  occupancy_.fetch_sub(1, std::memory_order_relaxed);
+  slot->meta.fetch_add(StateDelta(CONSTRUCTION, EMPTY), std::memory_order_release);
+  FreeEntry(e);
+}
+
+void ClockCacheShard::FreeEntry(ClockHandle* e) {
+  if (e->eviction_callback) {
+    e->eviction_callback->EvictedEntry(e->key(), e->value());
+  }
+  UpdateMemTracker(-static_cast<int64_t>(e->charge));
+  if (PREDICT_TRUE(metrics_)) {
+    metrics_->cache_usage->DecrementBy(e->charge);
+    metrics_->evictions->Increment();
+  }
+  delete [] reinterpret_cast<uint8_t*>(e);
+}
+
+void ClockCacheShard::UpdateMemTracker(int64_t delta) {
+  int64_t old_deferred = deferred_consumption_.fetch_add(delta);
+  int64_t new_deferred = old_deferred + delta;
+
+  if (new_deferred > max_deferred_consumption_ ||
+      new_deferred < -max_deferred_consumption_) {
+    int64_t to_propagate = deferred_consumption_.exchange(0, std::memory_order_relaxed);
+    mem_tracker_->Consume(to_propagate);
+  }
+}
+
+Cache::Handle* ClockCacheShard::Lookup(const Slice& key, uint32_t hash, bool caching) {
+  ClockHandle* e = nullptr;
+  for (size_t i = 0; i <= mask_; i++) {
+    ClockSlot* slot = SlotAt(hash + i);
+    if (TryRef(slot, key, hash)) {
+      e = slot->handle;
+      uint8_t countdown = slot->countdown.load(std::memory_order_relaxed);
+      if (countdown < kMaxCountdown) {
+        slot->countdown.store(countdown + 1, std::memory_order_relaxed);
+      }
+      break;
+    }
+    if (slot->displacements.load(std::memory_order_relaxed) == 0) {
+      break;
+    }
+  }
+
+  if (metrics_) {
+    metrics_->lookups->Increment();
+    bool was_hit = (e != nullptr);
+    if (was_hit) {
+      if (caching) {
+        metrics_->cache_hits_caching->Increment();
+      } else {
+        metrics_->cache_hits->Increment();
+      }
+    } else {
+      if (caching) {
+        metrics_->cache_misses_caching->Increment();
+      } else {
+        metrics_->cache_misses->Increment();
+      }
+    }
+  }
+
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+void ClockCacheShard::Release(ClockHandle* e) {
+  if (PREDICT_TRUE(e->slot)) {
+    Unref(e->slot);
+  } else {
+    FreeEntry(e);
+  }
+}
+
+Cache::Handle* ClockCacheShard::Insert(ClockHandle* e,
+                                       Cache::EvictionCallback* eviction_callback) {
+  e->eviction_callback = eviction_callback;
+  UpdateMemTracker(e->charge);
+  if (PREDICT_TRUE(metrics_)) {
+    metrics_->cache_usage->IncrementBy(e->charge);
+    metrics_->inserts->Increment();
+  }
+
+  // Replace the entry of the key, if there's one. Concurrent insertions of
+  // the same key may leave several entries for it, which lookups pick from
+  // and erasure removes together.
+  Erase(e->key(), e->hash);
+  EvictIfNeeded(e->charge);
+
+  ClockSlot* slot = ClaimSlot(e->hash);
+  if (PREDICT_FALSE(!slot)) {
+    // Every slot holds a referenced entry: the entry is freed on release.
+    e->slot = nullptr;
+    return reinterpret_cast<Cache::Handle*>(e);
+  }
+  e->slot = slot;
+  slot->handle = e;
+  slot->hash.store(e->hash, std::memory_order_relaxed);
+  slot->countdown.store(kInitialCountdown, std::memory_order_relaxed);
+  usage_.fetch_add(e->charge, std::memory_order_relaxed);
+  occupancy_.fetch_add(1, std::memory_order_relaxed);
+  // Publish the entry, with a reference for the caller.
+  slot->meta.fetch_add(StateDelta(CONSTRUCTION, VISIBLE) + 1, std::memory_order_release);
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+void ClockCacheShard::Erase(const Slice& key, uint32_t hash) {
+  for (size_t i = 0; i <= mask_; i++) {
+    ClockSlot* slot = SlotAt(hash + i);
+    if (TryRef(slot, key, hash)) {
+      // Hide the entry from lookups, unless another thread already did.
+      uint64_t meta = slot->meta.load(std::memory_order_relaxed);
+      while (StateOf(meta) == VISIBLE &&
+             !slot->meta.compare_exchange_weak(meta, meta + StateDelta(VISIBLE, INVISIBLE),
+                                               std::memory_order_acq_rel)) {
+      }
+      Unref(slot);
+    }
+    if (slot->displacements.load(std::memory_order_relaxed) == 0) {
+      break;
+    }
+  }
+}
+
+class ShardedClockCache : public Cache {
+ private:
+  shared_ptr<MemTracker> mem_tracker_;
+  gscoped_ptr<CacheMetrics> metrics_;
+  vector<ClockCacheShard*> shards_;
+
+  // Number of bits of hash used to determine the shard.
+  const int shard_bits_;
+
+  // Protects 'metrics_'. Used only when metrics are set, to ensure
+  // that they are set only once in test environments.
+  simple_spinlock metrics_lock_;
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return util_hash::CityHash64(
+      reinterpret_cast<const char *>(s.data()), s.size());
+  }
+
+  uint32_t Shard(uint32_t hash) {
+    // Widen to uint64 before shifting, or else on a single CPU,
+    // we would try to shift a uint32_t by 32 bits, which is undefined.
+    return static_cast<uint64_t>(hash) >> (32 - shard_bits_);
+  }
+
+ public:
+  ShardedClockCache(size_t capacity, size_t estimated_entry_charge, const string& id)
+      : shard_bits_(PREDICT_FALSE(FLAGS_cache_force_single_shard) ?
+                    0 : Bits::Log2Ceiling(base::NumCPUs())) {
+    // Like the LRU cache, reuse the MemTracker of a singleton cache.
+    mem_tracker_ = MemTracker::FindOrCreateGlobalTracker(
+        -1, strings::Substitute("$0-sharded_clock_cache", id));
+
+    int num_shards = 1 << shard_bits_;
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    const size_t entries_per_shard = per_shard / std::max<size_t>(1, estimated_entry_charge);
+    const size_t num_slots = std::max<size_t>(
+        kMinSlots, size_t{1} << Bits::Log2Ceiling64(entries_per_shard / kLoadFactor + 1));
+    VLOG(1) << "Will use " << num_shards << " shards of " << num_slots
+            << " slots for clock cache.";
+    for (int s = 0; s < num_shards; s++) {
+      shards_.push_back(new ClockCacheShard(mem_tracker_.get(), per_shard, num_slots));
+    }
+  }
+
+  virtual ~ShardedClockCache() {
+    STLDeleteElements(&shards_);
+  }
+
+  virtual Handle* Insert(PendingHandle* handle,
+                         Cache::EvictionCallback* eviction_callback) override {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(DCHECK_NOTNULL(handle));
+    return shards_[Shard(h->hash)]->Insert(h, eviction_callback);
+  }
+  virtual Handle* Lookup(const Slice& key, CacheBehavior caching) override {
+    const uint32_t hash = HashSlice(key);
+    return shards_[Shard(hash)]->Lookup(key, hash, caching == EXPECT_IN_CACHE);
+  }
+  virtual void Release(Handle* handle) override {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+    shards_[Shard(h->hash)]->Release(h);
+  }
+  virtual void Erase(const Slice& key) override {
+    const uint32_t hash = HashSlice(key);
+    shards_[Shard(hash)]->Erase(key, hash);
+  }
+  virtual Slice Value(Handle* handle) override {
+    return reinterpret_cast<ClockHandle*>(handle)->value();
+  }
+  virtual void SetMetrics(const scoped_refptr<MetricEntity>& entity) override {
+    // See ShardedLRUCache::SetMetrics().
+    std::lock_guard<simple_spinlock> l(metrics_lock_);
+    if (metrics_) {
+      CHECK(IsGTest()) << "Metrics should only be set once per Cache singleton";
+      return;
+    }
+    metrics_.reset(new CacheMetrics(entity));
+    for (ClockCacheShard* shard : shards_) {
+      shard->SetMetrics(metrics_.get());
+    }
+  }
+
+  virtual PendingHandle* Allocate(Slice key, int val_len, int charge) override {
+    int key_len = key.size();
+    DCHECK_GE(key_len, 0);
+    DCHECK_GE(val_len, 0);
+    int key_len_padded = KUDU_ALIGN_UP(key_len, sizeof(void*));
+    uint8_t* buf = new uint8_t[sizeof(ClockHandle)
+                               + key_len_padded + val_len // the kv_data VLA data
+                               - 1 // (the VLA has a 1-byte placeholder)
+                               ];
+    ClockHandle* handle = reinterpret_cast<ClockHandle*>(buf);
+    handle->key_length = key_len;
+    handle->val_length = val_len;
+    handle->charge = (charge == kAutomaticCharge) ? kudu_malloc_usable_size(buf) : charge;
+    handle->hash = HashSlice(key);
+    memcpy(handle->kv_data, key.data(), key_len);
+
+    return reinterpret_cast<PendingHandle*>(handle);
+  }
+
+  virtual void Free(PendingHandle* h) override {
+    uint8_t* data = reinterpret_cast<uint8_t*>(h);
+    delete [] data;
+  }
+
+  virtual uint8_t* MutableValue(PendingHandle* h) override {
+    return reinterpret_cast<ClockHandle*>(h)->mutable_val_ptr();
+  }
+};
+
+}  // end anonymous namespace
+
+Cache* NewClockCache(size_t capacity, size_t estimated_entry_charge, const string& id) {
+  return new ShardedClockCache(capacity, estimated_entry_charge, id);
+}
+
+}  // namespace kudu
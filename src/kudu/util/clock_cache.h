@@ -0,0 +1,37 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_CLOCK_CACHE_H_
+#define KUDU_UTIL_CLOCK_CACHE_H_
+
+#include <cstddef>
+#include <string>
+
+namespace kudu {
+class Cache;
+
+// Create a cache in DRAM with the given capacity, which evicts its entries
+// with the CLOCK algorithm and looks them up without taking any locks.
+//
+// Each shard of the cache has a fixed number of slots for entries, sized for
+// entries charged 'estimated_entry_charge' on average: if the entries are
+// much smaller than this, they are evicted before the cache reaches its
+// capacity.
+Cache* NewClockCache(size_t capacity, size_t estimated_entry_charge, const std::string& id);
+
+}  // namespace kudu
+
+#endif
@@ -18,6 +18,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <string>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -31,6 +32,7 @@
 
 namespace kudu {
 
+using std::string;
 using std::vector;
 
 class TestCompression : public KuduTest {};
@@ -87,4 +89,59 @@ TEST_F(TestCompression, TestZlibCompressionCodec) {
   TestCompressionCodec(ZLIB);
 }
 
+// Small inputs which look like the dictionary compress much better with it than
+// without, and only uncompress with the same dictionary.
+TEST_F(TestCompression, TestDictionaries) {
+  string sample;
+  for (int i = 0; i < 20; i++) {
+    sample += "{\"table\": \"orders\", \"column\": \"status\", \"row\": " +
+              std::to_string(i * 37) + "}";
+  }
+  const CompressionDictionary* dict;
+  ASSERT_OK(RegisterCompressionDictionary(sample, &dict));
+  ASSERT_EQ(dict, FindCompressionDictionary(dict->id()));
+  const CompressionDictionary* same_dict;
+  ASSERT_OK(RegisterCompressionDictionary(sample, &same_dict));
+  ASSERT_EQ(dict, same_dict);
+  const CompressionDictionary* other_dict;
+  ASSERT_OK(RegisterCompressionDictionary("something else entirely", &other_dict));
+  ASSERT_NE(dict->id(), other_dict->id());
+
+  const string input = "{\"table\": \"orders\", \"column\": \"status\", \"row\": 4242}";
+  for (CompressionType type : { SNAPPY, LZ4, ZLIB }) {
+    SCOPED_TRACE(CompressionType_Name(type));
+    const CompressionCodec* codec;
+    ASSERT_OK(GetCompressionCodec(type, &codec));
+    gscoped_array<uint8_t> cbuffer(new uint8_t[codec->MaxCompressedLength(input.size())]);
+    string output(input.size(), '\0');
+    uint8_t* ubuffer = reinterpret_cast<uint8_t*>(&output[0]);
+    size_t compressed;
+    if (!codec->SupportsDictionaries()) {
+      Status s = codec->CompressWithDictionary(input, *dict, cbuffer.get(), &compressed);
+      ASSERT_TRUE(s.IsNotSupported()) << s.ToString();
+      continue;
+    }
+
+    size_t compressed_without_dict;
+    ASSERT_OK(codec->Compress(input, cbuffer.get(), &compressed_without_dict));
+    ASSERT_OK(codec->CompressWithDictionary(input, *dict, cbuffer.get(), &compressed));
+    ASSERT_LT(compressed * 2, compressed_without_dict);
+    ASSERT_OK(codec->UncompressWithDictionary(Slice(cbuffer.get(), compressed), *dict,
+                                              ubuffer, input.size()));
+    ASSERT_EQ(input, output);
+    Status s = codec->UncompressWithDictionary(Slice(cbuffer.get(), compressed), *other_dict,
+                                               ubuffer, input.size());
+    if (s.ok()) {
+      // LZ4 has no way to tell, but the output is garbage.
+      ASSERT_NE(input, output);
+    }
+
+    // The same per-thread state compresses and uncompresses without a dictionary
+    // in between.
+    ASSERT_OK(codec->Compress(input, cbuffer.get(), &compressed));
+    ASSERT_OK(codec->Uncompress(Slice(cbuffer.get(), compressed), ubuffer, input.size()));
+    ASSERT_EQ(input, output);
+  }
+}
+
 } // namespace kudu
@@ -17,9 +17,13 @@
 
 #include "kudu/util/compression/compression_codec.h"
 
+#include <cstring>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <glog/logging.h>
@@ -28,22 +32,57 @@
 #include <snappy.h>
 #include <zlib.h>
 
+#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/singleton.h"
 #include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/crc.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/string_case.h"
+#include "kudu/util/threadlocal.h"
 
 namespace kudu {
 
 using std::vector;
+using strings::Substitute;
+
+CompressionDictionary::CompressionDictionary(const Slice& data)
+    : data_(data.ToString()),
+      id_(crc::Crc32c(data.data(), data.size())),
+      lz4_stream_(new char[sizeof(LZ4_stream_t)]) {
+  LZ4_stream_t* stream = reinterpret_cast<LZ4_stream_t*>(lz4_stream_.get());
+  memset(stream, 0, sizeof(*stream));
+  // LZ4 only refers back to the last 64KB of the dictionary.
+  LZ4_loadDict(stream, data_.data(), data_.size());
+}
+
+CompressionDictionary::~CompressionDictionary() {
+}
 
 CompressionCodec::CompressionCodec() {
 }
 CompressionCodec::~CompressionCodec() {
 }
 
+Status CompressionCodec::CompressWithDictionary(const Slice& /* input */,
+                                                const CompressionDictionary& /* dict */,
+                                                uint8_t* /* compressed */,
+                                                size_t* /* compressed_length */) const {
+  return Status::NotSupported("compression codec doesn't support dictionaries",
+                              CompressionType_Name(type()));
+}
+
+Status CompressionCodec::UncompressWithDictionary(const Slice& /* compressed */,
+                                                  const CompressionDictionary& /* dict */,
+                                                  uint8_t* /* uncompressed */,
+                                                  size_t /* uncompressed_length */) const {
+  return Status::NotSupported("compression codec doesn't support dictionaries",
+                              CompressionType_Name(type()));
+}
+
 class SlicesSource : public snappy::Source {
  public:
   explicit SlicesSource(const std::vector<Slice>& slices)
@@ -178,9 +217,11 @@ class Lz4Codec : public CompressionCodec {
   Status Uncompress(const Slice& compressed,
                     uint8_t *uncompressed,
                     size_t uncompressed_length) const override {
-    int n = LZ4_decompress_fast(reinterpret_cast<const char *>(compressed.data()),
-                                reinterpret_cast<char *>(uncompressed), uncompressed_length);
-    if (n != compressed.size()) {
+    // The bounds-checked decoder, since the input may come off the network.
+    int n = LZ4_decompress_safe(reinterpret_cast<const char *>(compressed.data()),
+                                reinterpret_cast<char *>(uncompressed),
+                                compressed.size(), uncompressed_length);
+    if (n < 0 || static_cast<size_t>(n) != uncompressed_length) {
       return Status::Corruption(
         StringPrintf("unable to uncompress the buffer. error near %d, buffer", -n),
                      KUDU_REDACT(compressed.ToDebugString(100)));
@@ -195,12 +236,52 @@ class Lz4Codec : public CompressionCodec {
   CompressionType type() const override {
     return LZ4;
   }
+
+  bool SupportsDictionaries() const override {
+    return true;
+  }
+
+  Status CompressWithDictionary(const Slice& input,
+                                const CompressionDictionary& dict,
+                                uint8_t *compressed,
+                                size_t *compressed_length) const override {
+    // Copying the stream which loaded the dictionary is much cheaper than
+    // hashing the dictionary into a fresh stream for every input.
+    BLOCK_STATIC_THREAD_LOCAL(LZ4_stream_t, stream);
+    memcpy(stream, dict.lz4_stream_.get(), sizeof(*stream));
+    int n = LZ4_compress_fast_continue(stream,
+                                       reinterpret_cast<const char *>(input.data()),
+                                       reinterpret_cast<char *>(compressed),
+                                       input.size(), MaxCompressedLength(input.size()), 1);
+    if (n <= 0) {
+      return Status::IOError("unable to compress the buffer");
+    }
+    *compressed_length = n;
+    return Status::OK();
+  }
+
+  Status UncompressWithDictionary(const Slice& compressed,
+                                  const CompressionDictionary& dict,
+                                  uint8_t *uncompressed,
+                                  size_t uncompressed_length) const override {
+    int n = LZ4_decompress_safe_usingDict(reinterpret_cast<const char *>(compressed.data()),
+                                          reinterpret_cast<char *>(uncompressed),
+                                          compressed.size(), uncompressed_length,
+                                          reinterpret_cast<const char *>(dict.data().data()),
+                                          dict.data().size());
+    if (n < 0 || static_cast<size_t>(n) != uncompressed_length) {
+      return Status::Corruption(
+        StringPrintf("unable to uncompress the buffer. error near %d, buffer", -n),
+                     KUDU_REDACT(compressed.ToDebugString(100)));
+    }
+    return Status::OK();
+  }
 };
 
-/**
- * TODO: use a instance-local Arena and pass alloc/free into zlib
- * so that it allocates from the arena.
- */
+// Compresses and uncompresses with streams which each thread keeps and
+// resets between calls, rather than with ::compress() and ::uncompress(),
+// which allocate and initialize a stream, with its window and hash tables,
+// for every call.
 class ZlibCodec : public CompressionCodec {
  public:
   static ZlibCodec *GetSingleton() {
@@ -209,39 +290,161 @@ class ZlibCodec : public CompressionCodec {
 
   Status Compress(const Slice& input,
                   uint8_t *compressed, size_t *compressed_length) const override {
-    *compressed_length = MaxCompressedLength(input.size());
-    int err = ::compress(compressed, compressed_length, input.data(), input.size());
-    return err == Z_OK ? Status::OK() : Status::IOError("unable to compress the buffer");
+    return Deflate(&input, 1, nullptr, compressed, compressed_length);
   }
 
   Status Compress(const vector<Slice>& input_slices,
                   uint8_t *compressed, size_t *compressed_length) const override {
-    if (input_slices.size() == 1) {
-      return Compress(input_slices[0], compressed, compressed_length);
-    }
-
-    // TODO: use z_stream
-    SlicesSource source(input_slices);
-    faststring buffer;
-    source.Dump(&buffer);
-    return Compress(Slice(buffer.data(), buffer.size()), compressed, compressed_length);
+    return Deflate(input_slices.data(), input_slices.size(), nullptr,
+                   compressed, compressed_length);
   }
 
   Status Uncompress(const Slice& compressed,
                     uint8_t *uncompressed, size_t uncompressed_length) const override {
-    int err = ::uncompress(uncompressed, &uncompressed_length,
-                           compressed.data(), compressed.size());
-    return err == Z_OK ? Status::OK() : Status::Corruption("unable to uncompress the buffer");
+    return Inflate(compressed, nullptr, uncompressed, uncompressed_length);
   }
 
   size_t MaxCompressedLength(size_t source_bytes) const override {
-    // one-time overhead of six bytes for the entire stream plus five bytes per 16 KB block
-    return source_bytes + (6 + (5 * ((source_bytes + 16383) >> 14)));
+    // one-time overhead of six bytes for the entire stream plus five bytes per 16 KB block,
+    // and four for the id of a dictionary
+    return source_bytes + (10 + (5 * ((source_bytes + 16383) >> 14)));
   }
 
   CompressionType type() const override {
     return ZLIB;
   }
+
+  bool SupportsDictionaries() const override {
+    return true;
+  }
+
+  Status CompressWithDictionary(const Slice& input,
+                                const CompressionDictionary& dict,
+                                uint8_t *compressed,
+                                size_t *compressed_length) const override {
+    return Deflate(&input, 1, &dict, compressed, compressed_length);
+  }
+
+  Status UncompressWithDictionary(const Slice& compressed,
+                                  const CompressionDictionary& dict,
+                                  uint8_t *uncompressed,
+                                  size_t uncompressed_length) const override {
+    return Inflate(compressed, &dict, uncompressed, uncompressed_length);
+  }
+
+ private:
+  // The streams of a thread, which are initialized on first use.
+  struct Streams {
+    Streams() : deflate_initialized(false), inflate_initialized(false) {
+      memset(&deflater, 0, sizeof(deflater));
+      memset(&inflater, 0, sizeof(inflater));
+    }
+
+    ~Streams() {
+      if (deflate_initialized) {
+        deflateEnd(&deflater);
+      }
+      if (inflate_initialized) {
+        inflateEnd(&inflater);
+      }
+    }
+
+    z_stream deflater;
+    z_stream inflater;
+    bool deflate_initialized;
+    bool inflate_initialized;
+  };
+
+  static Streams* ThreadStreams() {
+    BLOCK_STATIC_THREAD_LOCAL(Streams, streams);
+    return streams;
+  }
+
+  // Compresses the 'num_slices' slices of 'slices' as one input, with 'dict'
+  // unless it's nullptr.
+  Status Deflate(const Slice* slices, size_t num_slices, const CompressionDictionary* dict,
+                 uint8_t *compressed, size_t *compressed_length) const {
+    Streams* streams = ThreadStreams();
+    z_stream* zs = &streams->deflater;
+    int err;
+    if (PREDICT_FALSE(!streams->deflate_initialized)) {
+      // The same parameters as ::compress().
+      err = deflateInit(zs, Z_DEFAULT_COMPRESSION);
+      if (err != Z_OK) {
+        return Status::RuntimeError("unable to initialize zlib stream", zError(err));
+      }
+      streams->deflate_initialized = true;
+    } else {
+      deflateReset(zs);
+    }
+    if (dict) {
+      err = deflateSetDictionary(zs, dict->data().data(), dict->data().size());
+      if (err != Z_OK) {
+        return Status::IOError("unable to set the compression dictionary", zError(err));
+      }
+    }
+
+    size_t input_size = 0;
+    for (size_t i = 0; i < num_slices; i++) {
+      input_size += slices[i].size();
+    }
+    zs->next_out = compressed;
+    zs->avail_out = MaxCompressedLength(input_size);
+    err = Z_OK;
+    for (size_t i = 0; i < num_slices && err == Z_OK; i++) {
+      if (slices[i].empty()) continue;
+      zs->next_in = const_cast<uint8_t*>(slices[i].data());
+      zs->avail_in = slices[i].size();
+      err = deflate(zs, Z_NO_FLUSH);
+      if (zs->avail_in != 0) {
+        err = Z_BUF_ERROR;
+      }
+    }
+    if (err == Z_OK) {
+      zs->next_in = nullptr;
+      zs->avail_in = 0;
+      err = deflate(zs, Z_FINISH);
+    }
+    if (err != Z_STREAM_END) {
+      return Status::IOError("unable to compress the buffer", zError(err));
+    }
+    *compressed_length = zs->total_out;
+    return Status::OK();
+  }
+
+  // Uncompresses 'compressed' with 'dict', if the data was compressed with a
+  // dictionary and 'dict' isn't nullptr.
+  static Status Inflate(const Slice& compressed, const CompressionDictionary* dict,
+                        uint8_t *uncompressed, size_t uncompressed_length) {
+    Streams* streams = ThreadStreams();
+    z_stream* zs = &streams->inflater;
+    int err;
+    if (PREDICT_FALSE(!streams->inflate_initialized)) {
+      err = inflateInit(zs);
+      if (err != Z_OK) {
+        return Status::RuntimeError("unable to initialize zlib stream", zError(err));
+      }
+      streams->inflate_initialized = true;
+    } else {
+      inflateReset(zs);
+    }
+    zs->next_in = const_cast<uint8_t*>(compressed.data());
+    zs->avail_in = compressed.size();
+    zs->next_out = uncompressed;
+    zs->avail_out = uncompressed_length;
+    err = inflate(zs, Z_FINISH);
+    if (err == Z_NEED_DICT && dict) {
+      // Fails if the data was compressed with another dictionary.
+      err = inflateSetDictionary(zs, dict->data().data(), dict->data().size());
+      if (err == Z_OK) {
+        err = inflate(zs, Z_FINISH);
+      }
+    }
+    if (err != Z_STREAM_END) {
+      return Status::Corruption("unable to uncompress the buffer", zError(err));
+    }
+    return Status::OK();
+  }
 };
 
 Status GetCompressionCodec(CompressionType compression,
@@ -283,4 +486,52 @@ CompressionType GetCompressionCodecType(const std::string& name) {
   return NO_COMPRESSION;
 }
 
+namespace {
+
+// The registered dictionaries, by id.
+class DictionaryRegistry {
+ public:
+  static DictionaryRegistry* GetSingleton() {
+    return Singleton<DictionaryRegistry>::get();
+  }
+
+  Status Register(std::unique_ptr<CompressionDictionary> new_dict,
+                  const CompressionDictionary** dict) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    auto& existing = dictionaries_[new_dict->id()];
+    if (existing) {
+      if (existing->data() != new_dict->data()) {
+        return Status::AlreadyPresent(
+            Substitute("another compression dictionary has id $0", existing->id()));
+      }
+    } else {
+      existing = std::move(new_dict);
+    }
+    *dict = existing.get();
+    return Status::OK();
+  }
+
+  const CompressionDictionary* Find(uint32_t id) const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    const auto* dict = FindOrNull(dictionaries_, id);
+    return dict ? dict->get() : nullptr;
+  }
+
+ private:
+  mutable simple_spinlock lock_;
+  std::unordered_map<uint32_t, std::unique_ptr<CompressionDictionary>> dictionaries_;
+};
+
+} // anonymous namespace
+
+Status RegisterCompressionDictionary(const Slice& data,
+                                     const CompressionDictionary** dict) {
+  std::unique_ptr<CompressionDictionary> new_dict(new CompressionDictionary(data));
+  return DictionaryRegistry::GetSingleton()->Register(std::move(new_dict), dict);
+}
+
+const CompressionDictionary* FindCompressionDictionary(uint32_t id) {
+  return DictionaryRegistry::GetSingleton()->Find(id);
+}
+
 } // namespace kudu
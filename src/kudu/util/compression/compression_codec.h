@@ -19,6 +19,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -30,6 +31,39 @@
 
 namespace kudu {
 
+// Data which the inputs to compress are expected to have much in common
+// with, such as a sample of small and similar payloads. Codecs which support
+// dictionaries compress an input as if the dictionary preceded it, so that
+// even inputs too small to compress well on their own can refer back to it.
+//
+// Data compressed with a dictionary can only be uncompressed with the same
+// dictionary, which is identified by the checksum of its contents. See
+// RegisterCompressionDictionary().
+class CompressionDictionary {
+ public:
+  ~CompressionDictionary();
+
+  uint32_t id() const { return id_; }
+
+  Slice data() const { return Slice(data_); }
+
+ private:
+  friend class Lz4Codec;
+  friend Status RegisterCompressionDictionary(const Slice& data,
+                                              const CompressionDictionary** dict);
+
+  explicit CompressionDictionary(const Slice& data);
+
+  const std::string data_;
+  const uint32_t id_;
+
+  // An LZ4 stream which has loaded the dictionary. Each compression starts
+  // from a copy of it rather than loading the dictionary again.
+  std::unique_ptr<char[]> lz4_stream_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompressionDictionary);
+};
+
 class CompressionCodec {
  public:
   CompressionCodec();
@@ -61,6 +95,28 @@ class CompressionCodec {
 
   // Return the type of compression implemented by this codec.
   virtual CompressionType type() const = 0;
+
+  // Whether the codec implements CompressWithDictionary() and
+  // UncompressWithDictionary().
+  virtual bool SupportsDictionaries() const { return false; }
+
+  // Like Compress(), but compresses 'input' as if 'dict' preceded it. The
+  // output is at most MaxCompressedLength(input.size()) bytes long, and can
+  // only be uncompressed by UncompressWithDictionary() with the same 'dict'.
+  //
+  // Returns NotSupported if the codec doesn't support dictionaries.
+  virtual Status CompressWithDictionary(const Slice& input,
+                                        const CompressionDictionary& dict,
+                                        uint8_t *compressed,
+                                        size_t *compressed_length) const;
+
+  // Like Uncompress(), for data compressed by CompressWithDictionary().
+  //
+  // Returns NotSupported if the codec doesn't support dictionaries.
+  virtual Status UncompressWithDictionary(const Slice& compressed,
+                                          const CompressionDictionary& dict,
+                                          uint8_t *uncompressed,
+                                          size_t uncompressed_length) const;
  private:
   DISALLOW_COPY_AND_ASSIGN(CompressionCodec);
 };
@@ -74,5 +130,21 @@ Status GetCompressionCodec(CompressionType compression,
 // Returns the compression codec type given the name
 CompressionType GetCompressionCodecType(const std::string& name);
 
+// Registers a dictionary made of 'data' and returns it in 'dict', so that
+// data compressed with it can later be uncompressed by looking it up by id
+// with FindCompressionDictionary(). Registering the same contents again
+// returns the dictionary registered first.
+//
+// Dictionaries are never unregistered, and live until the process exits.
+//
+// Returns AlreadyPresent if a dictionary with other contents and the same id
+// is registered.
+Status RegisterCompressionDictionary(const Slice& data,
+                                     const CompressionDictionary** dict);
+
+// Returns the registered dictionary with the given id, or nullptr if there's
+// none.
+const CompressionDictionary* FindCompressionDictionary(uint32_t id);
+
 } // namespace kudu
 #endif
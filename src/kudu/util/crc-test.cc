@@ -79,6 +79,40 @@ TEST_F(CrcTest, TestCRC32C) {
   ASSERT_EQ(kExpectedCrc, data_crc3);
 }
 
+// The three-way split of large buffers agrees with crcutil, whatever the
+// length and alignment of the data.
+TEST_F(CrcTest, TestCRC32CLengthsAndAlignments) {
+  const uint8_t* buf;
+  size_t buflen;
+  GenerateBenchmarkData(&buf, &buflen);
+  gscoped_ptr<const uint8_t[]> data(buf);
+  Crc* crc32c = GetCrc32cInstance();
+  for (size_t length : { 0, 1, 7, 8, 255, 767, 768, 769, 24575, 24576, 24577, 1000000 }) {
+    for (size_t offset : { 0, 1, 5 }) {
+      uint64_t expected = 0;
+      crc32c->Compute(buf + offset, length, &expected);
+      ASSERT_EQ(expected, Crc32c(buf + offset, length)) << length << " " << offset;
+    }
+  }
+}
+
+// Combining the CRCs of two chunks gives the CRC of both.
+TEST_F(CrcTest, TestCRC32CCombine) {
+  const uint8_t* buf;
+  size_t buflen;
+  GenerateBenchmarkData(&buf, &buflen);
+  gscoped_ptr<const uint8_t[]> data(buf);
+  for (size_t length : { 0, 1, 100, 1000000 }) {
+    const uint32_t expected = Crc32c(buf, length);
+    for (size_t split : { static_cast<size_t>(0), length / 3, length }) {
+      ASSERT_EQ(expected, Crc32cCombine(Crc32c(buf, split),
+                                        Crc32c(buf + split, length - split),
+                                        length - split))
+          << length << " " << split;
+    }
+  }
+}
+
 // Simple benchmark of CRC32C throughput.
 // We should expect about 8 bytes per cycle in throughput on a single core.
 TEST_F(CrcTest, BenchmarkCRC32C) {
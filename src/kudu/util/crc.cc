@@ -16,9 +16,19 @@
 // under the License.
 #include "kudu/util/crc.h"
 
+#include <cstring>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 #include <crcutil/interface.h>
 
+#include "kudu/gutil/bits.h"
 #include "kudu/gutil/once.h"
+#include "kudu/gutil/port.h"
 #include "kudu/util/debug/leakcheck_disabler.h"
 
 namespace kudu {
@@ -40,16 +50,172 @@ Crc* GetCrc32cInstance() {
   return crc32c_instance;
 }
 
+namespace {
+
+// The CRC32C polynomial, bit-reversed.
+const uint32_t kPoly = 0x82f63b78;
+
+// Operators over GF(2) which append zeros to the data a CRC covers, as 32x32
+// matrices of bits: one for each power of two number of bytes.
+uint32_t zeros_ops[64][32];
+
+// Returns 'mat' times 'vec'.
+uint32_t Gf2MatrixTimes(const uint32_t* mat, uint32_t vec) {
+  uint32_t sum = 0;
+  for (; vec != 0; vec >>= 1, mat++) {
+    if (vec & 1) {
+      sum ^= *mat;
+    }
+  }
+  return sum;
+}
+
+// Sets 'square' to 'mat' times itself.
+void Gf2MatrixSquare(uint32_t* square, const uint32_t* mat) {
+  for (int n = 0; n < 32; n++) {
+    square[n] = Gf2MatrixTimes(mat, mat[n]);
+  }
+}
+
+// Returns 'crc' with 'length' zero bytes appended to its data.
+uint32_t AppendZeros(uint32_t crc, size_t length) {
+  for (int k = 0; length != 0; k++, length >>= 1) {
+    if (length & 1) {
+      crc = Gf2MatrixTimes(zeros_ops[k], crc);
+    }
+  }
+  return crc;
+}
+
+#if defined(__SSE4_2__) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32))
+
+#if defined(__SSE4_2__)
+inline uint32_t HwCrc8(uint32_t crc, uint8_t v) { return _mm_crc32_u8(crc, v); }
+inline uint32_t HwCrc64(uint32_t crc, uint64_t v) {
+  return static_cast<uint32_t>(_mm_crc32_u64(crc, v));
+}
+#else
+inline uint32_t HwCrc8(uint32_t crc, uint8_t v) { return __crc32cb(crc, v); }
+inline uint32_t HwCrc64(uint32_t crc, uint64_t v) { return __crc32cd(crc, v); }
+#endif
+
+// The lengths of the chunks which the three streams of instructions run
+// over, for long and for shorter buffers. Each instruction takes three
+// cycles to give its result but a new one can start every cycle, so three
+// independent streams keep the unit busy.
+const size_t kLongChunk = 8192;
+const size_t kShortChunk = 256;
+
+// Tables which append kLongChunk and kShortChunk zeros to a CRC a byte of
+// it at a time.
+uint32_t long_shift[4][256];
+uint32_t short_shift[4][256];
+
+void InitShiftTable(uint32_t table[4][256], size_t length) {
+  uint32_t op[32];
+  int k = Bits::Log2Floor64(length);
+  memcpy(op, zeros_ops[k], sizeof(op));
+  for (uint32_t n = 0; n < 256; n++) {
+    table[0][n] = Gf2MatrixTimes(op, n);
+    table[1][n] = Gf2MatrixTimes(op, n << 8);
+    table[2][n] = Gf2MatrixTimes(op, n << 16);
+    table[3][n] = Gf2MatrixTimes(op, n << 24);
+  }
+}
+
+inline uint32_t Shift(const uint32_t table[4][256], uint32_t crc) {
+  return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+         table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+// Runs three streams over the three chunks of 'chunk' bytes which start at
+// '*next', while there are at least three left.
+inline uint32_t Crc3Way(uint32_t crc0, const uint8_t** next, size_t* length,
+                        size_t chunk, const uint32_t shift[4][256]) {
+  while (*length >= chunk * 3) {
+    uint32_t crc1 = 0;
+    uint32_t crc2 = 0;
+    const uint8_t* p = *next;
+    const uint8_t* const end = p + chunk;
+    do {
+      crc0 = HwCrc64(crc0, UNALIGNED_LOAD64(p));
+      crc1 = HwCrc64(crc1, UNALIGNED_LOAD64(p + chunk));
+      crc2 = HwCrc64(crc2, UNALIGNED_LOAD64(p + chunk * 2));
+      p += 8;
+    } while (p < end);
+    crc0 = Shift(shift, crc0) ^ crc1;
+    crc0 = Shift(shift, crc0) ^ crc2;
+    *next += chunk * 3;
+    *length -= chunk * 3;
+  }
+  return crc0;
+}
+
+uint32_t HwCrc32c(const void* data, size_t length, uint32_t crc) {
+  const uint8_t* next = static_cast<const uint8_t*>(data);
+  uint32_t crc0 = ~crc;
+  while (length != 0 && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+    crc0 = HwCrc8(crc0, *next++);
+    length--;
+  }
+  crc0 = Crc3Way(crc0, &next, &length, kLongChunk, long_shift);
+  crc0 = Crc3Way(crc0, &next, &length, kShortChunk, short_shift);
+  for (; length >= 8; next += 8, length -= 8) {
+    crc0 = HwCrc64(crc0, UNALIGNED_LOAD64(next));
+  }
+  while (length != 0) {
+    crc0 = HwCrc8(crc0, *next++);
+    length--;
+  }
+  return ~crc0;
+}
+
+#define KUDU_HAS_HW_CRC32C 1
+#endif
+
+GoogleOnceType tables_once = GOOGLE_ONCE_INIT;
+
+void InitTables() {
+  // The operator for one zero bit, which is squared for two, four and then
+  // eight bits.
+  uint32_t odd[32];
+  uint32_t even[32];
+  odd[0] = kPoly;
+  for (int n = 1; n < 32; n++) {
+    odd[n] = 1U << (n - 1);
+  }
+  Gf2MatrixSquare(even, odd);
+  Gf2MatrixSquare(odd, even);
+  Gf2MatrixSquare(zeros_ops[0], odd);
+  for (int k = 1; k < 64; k++) {
+    Gf2MatrixSquare(zeros_ops[k], zeros_ops[k - 1]);
+  }
+#ifdef KUDU_HAS_HW_CRC32C
+  InitShiftTable(long_shift, kLongChunk);
+  InitShiftTable(short_shift, kShortChunk);
+#endif
+}
+
+} // anonymous namespace
+
 uint32_t Crc32c(const void* data, size_t length) {
-  uint64_t crc32 = 0;
-  GetCrc32cInstance()->Compute(data, length, &crc32);
-  return static_cast<uint32_t>(crc32); // Only uses lower 32 bits.
+  return Crc32c(data, length, 0);
 }
 
 uint32_t Crc32c(const void* data, size_t length, uint32_t prev_crc32) {
+#ifdef KUDU_HAS_HW_CRC32C
+  GoogleOnceInit(&tables_once, &InitTables);
+  return HwCrc32c(data, length, prev_crc32);
+#else
   uint64_t crc_tmp = static_cast<uint64_t>(prev_crc32);
   GetCrc32cInstance()->Compute(data, length, &crc_tmp);
   return static_cast<uint32_t>(crc_tmp); // Only uses lower 32 bits.
+#endif
+}
+
+uint32_t Crc32cCombine(uint32_t crc1, uint32_t crc2, size_t length2) {
+  GoogleOnceInit(&tables_once, &InitTables);
+  return AppendZeros(crc1, length2) ^ crc2;
 }
 
 } // namespace crc
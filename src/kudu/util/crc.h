@@ -31,12 +31,23 @@ typedef crcutil_interface::CRC Crc;
 Crc* GetCrc32cInstance();
 
 // Helper function to simply calculate a CRC32C of the given data.
+//
+// Uses the CRC32 instructions of SSE4.2 or ARMv8 where the build targets
+// them, running three streams of them over each large buffer at once.
 uint32_t Crc32c(const void* data, size_t length);
 
 // Given CRC value of previous chunk of data,
 // extends it to new chunk and returns the result.
 uint32_t Crc32c(const void* data, size_t length, uint32_t prev_crc32);
 
+// Given the CRCs of two chunks of data, the second of which is 'length2'
+// bytes long, returns the CRC of the two chunks one after the other, without
+// looking at the data. Takes time logarithmic in 'length2'.
+//
+// This lets chunks of a large buffer be checksummed in parallel, and the
+// checksums of parts of a message be reused for the whole message.
+uint32_t Crc32cCombine(uint32_t crc1, uint32_t crc2, size_t length2);
+
 } // namespace crc
 } // namespace kudu
 
@@ -654,6 +654,90 @@ TEST_F(TestEnv, TestReopen) {
   ASSERT_EQ(first + second, s.ToString());
 }
 
+TEST_F(TestEnv, TestReopenAndOverwrite) {
+  string test_path = GetTestPath("test_env_wf");
+  string first = "The quick brown fox jumps over the lazy dog";
+  string second = "A lazy dog";
+
+  unique_ptr<WritableFile> writer;
+  ASSERT_OK(env_->NewWritableFile(test_path, &writer));
+  ASSERT_OK(writer->Append(first));
+  ASSERT_OK(writer->Close());
+
+  // Reopen it and overwrite it from the start with something shorter. The
+  // rest of the old contents should be truncated away on close.
+  WritableFileOptions opts;
+  opts.mode = Env::OPEN_EXISTING;
+  opts.overwrite_existing = true;
+  ASSERT_OK(env_->NewWritableFile(opts, test_path, &writer));
+  ASSERT_EQ(0, writer->Size());
+  ASSERT_OK(writer->Append(second));
+  ASSERT_EQ(second.length(), writer->Size());
+  ASSERT_OK(writer->Close());
+
+  faststring contents;
+  ASSERT_OK(ReadFileToString(env_, test_path, &contents));
+  ASSERT_EQ(second, contents.ToString());
+
+  // Overwriting isn't supported with direct I/O.
+  opts.direct_io = true;
+  Status s = env_->NewWritableFile(opts, test_path, &writer);
+  ASSERT_TRUE(s.IsNotSupported()) << s.ToString();
+}
+
+TEST_F(TestEnv, TestDirectIOWritableFile) {
+  string test_path = GetTestPath("test_env_direct_wf");
+  WritableFileOptions opts;
+  opts.direct_io = true;
+  opts.sync_on_close = true;
+  unique_ptr<WritableFile> writer;
+  Status s = env_->NewWritableFile(opts, test_path, &writer);
+  if (s.IsNotSupported()) {
+    LOG(INFO) << "Skipping test: " << s.ToString();
+    return;
+  }
+  ASSERT_OK(s);
+  ASSERT_OK(writer->PreAllocate(1024 * 1024));
+
+  // Append unaligned chunks, some of which cross block boundaries.
+  string expected;
+  Random r(SeedRandom());
+  for (int i = 0; i < 100; i++) {
+    string chunk = RandomString(1 + r.Uniform(10000), &r);
+    ASSERT_OK(writer->Append(chunk));
+    expected += chunk;
+    ASSERT_EQ(expected.size(), writer->Size());
+  }
+  ASSERT_OK(writer->Sync());
+  ASSERT_OK(writer->Close());
+
+  // The padding and the preallocated space must be gone.
+  shared_ptr<RandomAccessFile> reader;
+  ASSERT_OK(env_util::OpenFileForRandom(env_, test_path, &reader));
+  uint64_t size;
+  ASSERT_OK(reader->Size(&size));
+  ASSERT_EQ(expected.size(), size);
+  unique_ptr<uint8_t[]> scratch(new uint8_t[size]);
+  Slice result(scratch.get(), size);
+  ASSERT_OK(reader->Read(0, result));
+  ASSERT_EQ(expected, result.ToString());
+
+  // Reopen the file and keep appending from its unaligned end.
+  opts.mode = Env::OPEN_EXISTING;
+  ASSERT_OK(env_->NewWritableFile(opts, test_path, &writer));
+  ASSERT_EQ(expected.size(), writer->Size());
+  ASSERT_OK(writer->Append("more data"));
+  expected += "more data";
+  ASSERT_OK(writer->Close());
+  ASSERT_OK(env_util::OpenFileForRandom(env_, test_path, &reader));
+  ASSERT_OK(reader->Size(&size));
+  ASSERT_EQ(expected.size(), size);
+  scratch.reset(new uint8_t[size]);
+  result = Slice(scratch.get(), size);
+  ASSERT_OK(reader->Read(0, result));
+  ASSERT_EQ(expected, result.ToString());
+}
+
 TEST_F(TestEnv, TestIsDirectory) {
   string dir = GetTestPath("a_directory");
   ASSERT_OK(env_->CreateDir(dir));
@@ -8,8 +8,10 @@
 
 #include <glog/logging.h>
 
+#include "kudu/gutil/callback.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/slice.h"
+#include "kudu/util/status.h"
 
 using std::unique_ptr;
 
@@ -18,15 +20,27 @@ namespace kudu {
 Env::~Env() {
 }
 
+Status Env::NewMemoryMappedFile(const std::string& fname,
+                                unique_ptr<MemoryMappedFile>* /* result */) {
+  return Status::NotSupported("memory-mapped files are not supported", fname);
+}
+
 SequentialFile::~SequentialFile() {
 }
 
 RandomAccessFile::~RandomAccessFile() {
 }
 
+MemoryMappedFile::~MemoryMappedFile() {
+}
+
 WritableFile::~WritableFile() {
 }
 
+void WritableFile::SyncAsync(const StatusCallback& cb) {
+  cb.Run(Sync());
+}
+
 RWFile::~RWFile() {
 }
 
@@ -24,11 +24,13 @@
 #include "kudu/gutil/callback_forward.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/util/status.h"
+#include "kudu/util/status_callback.h"
 
 namespace kudu {
 
 class faststring;
 class FileLock;
+class MemoryMappedFile;
 class RandomAccessFile;
 class RWFile;
 class SequentialFile;
@@ -97,6 +99,16 @@ class Env {
                                      const std::string& fname,
                                      std::unique_ptr<RandomAccessFile>* result) = 0;
 
+  // Map the entire contents of an existing file read-only into memory.
+  // The file must not be truncated or rewritten while it is mapped, since
+  // touching a page past the end of the file raises SIGBUS.
+  //
+  // The returned mapping may be concurrently accessed by multiple threads.
+  //
+  // The default implementation returns Status::NotSupported.
+  virtual Status NewMemoryMappedFile(const std::string& fname,
+                                     std::unique_ptr<MemoryMappedFile>* result);
+
   // Create an object that writes to a new file with the specified
   // name.  Deletes any existing file with the same name and creates a
   // new file.  On success, stores a pointer to the new file in
@@ -173,6 +185,11 @@ class Env {
   // Synchronize the entry for a specific directory.
   virtual Status SyncDir(const std::string& dirname) = 0;
 
+  // Synchronize the whole filesystem which 'path' is on, making the data
+  // written to all of its files durable, as syncfs(2) does. Only supported
+  // on Linux.
+  virtual Status SyncFileSystem(const std::string& path) = 0;
+
   // Recursively delete the specified directory.
   // This should operate safely, not following any symlinks, etc.
   virtual Status DeleteRecursively(const std::string &dirname) = 0;
@@ -342,6 +359,12 @@ class Env {
   // On success, 'result' contains the answer. On failure, 'result' is unset.
   virtual Status IsOnXfsFilesystem(const std::string& path, bool* result) = 0;
 
+  // Gets the id of the device holding the filesystem the given path resides
+  // on, so that paths on the same device have the same id.
+  //
+  // On success, 'device_id' contains the id. On failure, it is unset.
+  virtual Status GetDeviceId(const std::string& path, uint64_t* device_id) = 0;
+
   // Gets the kernel release string for this machine.
   virtual std::string GetKernelRelease() = 0;
 
@@ -438,6 +461,24 @@ class RandomAccessFile {
   // Returns the size of the file
   virtual Status Size(uint64_t *size) const = 0;
 
+  // Hints that 'length' bytes starting at 'offset' will be read soon, so that
+  // the implementation may start reading them into the page cache in the
+  // background. Returns without waiting for the data.
+  //
+  // The default implementation does nothing.
+  virtual Status ReadAhead(uint64_t /*offset*/, size_t /*length*/) const {
+    return Status::OK();
+  }
+
+  // Hints that the 'length' bytes starting at 'offset' won't be read again
+  // soon, so that the implementation may drop them from the page cache. A
+  // 'length' of 0 extends to the end of the file.
+  //
+  // The default implementation does nothing.
+  virtual Status DropFromPageCache(uint64_t /*offset*/, size_t /*length*/) const {
+    return Status::OK();
+  }
+
   // Returns the filename provided when the RandomAccessFile was constructed.
   virtual const std::string& filename() const = 0;
 
@@ -446,6 +487,38 @@ class RandomAccessFile {
   virtual size_t memory_footprint() const = 0;
 };
 
+// A read-only view of an entire file mapped into memory.
+//
+// Reads through data() are zero-copy and don't issue system calls. However,
+// an I/O error while faulting a page in raises SIGBUS instead of returning a
+// Status, so this should only be used for files that are already durable and
+// no longer being written.
+class MemoryMappedFile {
+ public:
+  // Hints to the kernel about how the mapping is going to be read.
+  enum AccessPattern {
+    NORMAL,
+    SEQUENTIAL,
+    RANDOM
+  };
+
+  MemoryMappedFile() { }
+  virtual ~MemoryMappedFile();
+
+  // The start of the mapping. May be null if the file is empty.
+  virtual const uint8_t* data() const = 0;
+
+  // The size of the mapping, i.e. the size of the file when it was mapped.
+  virtual uint64_t size() const = 0;
+
+  // Advises the kernel that the mapping will be read according to 'pattern',
+  // e.g. so that it reads ahead aggressively during sequential scans.
+  virtual Status Advise(AccessPattern pattern) const = 0;
+
+  // Returns the filename provided when the MemoryMappedFile was constructed.
+  virtual const std::string& filename() const = 0;
+};
+
 // Creation-time options for WritableFile
 struct WritableFileOptions {
   // Call Sync() during Close().
@@ -454,9 +527,42 @@ struct WritableFileOptions {
   // See CreateMode for details.
   Env::CreateMode mode;
 
+  // Open the file with O_DIRECT and O_DSYNC, so that every append is a single
+  // durable write that bypasses the page cache. Appends are padded with zeros
+  // up to the next block boundary on disk; the padding is overwritten by the
+  // next append and truncated away on Close(). PreAllocate() zero-fills the
+  // preallocated range so that later writes don't have to convert unwritten
+  // extents.
+  //
+  // Not supported by every platform or filesystem (e.g. tmpfs), in which case
+  // opening the file returns Status::NotSupported.
+  bool direct_io;
+
+  // Issue appends and syncs through io_uring. Appends are queued and handed
+  // to the kernel together with the next sync as one linked chain, and
+  // SyncAsync() returns without waiting for the kernel. Ignored if
+  // 'direct_io' is set.
+  //
+  // Opening the file returns Status::NotSupported if the kernel lacks
+  // io_uring.
+  bool use_io_uring;
+
+  // If 'mode' is OPEN_EXISTING, start appending at the beginning of the file
+  // rather than at its end, overwriting the existing contents in place. What
+  // is left of them past the last append is truncated by Close(), as if it
+  // had been preallocated. This reuses the file's blocks without freeing and
+  // reallocating them.
+  //
+  // Not supported together with 'direct_io' or 'use_io_uring', in which case
+  // opening the file returns Status::NotSupported.
+  bool overwrite_existing;
+
   WritableFileOptions()
     : sync_on_close(false),
-      mode(Env::CREATE_IF_NON_EXISTING_TRUNCATE) { }
+      mode(Env::CREATE_IF_NON_EXISTING_TRUNCATE),
+      direct_io(false),
+      use_io_uring(false),
+      overwrite_existing(false) { }
 };
 
 // Options specified when a file is opened for random access.
@@ -508,6 +614,14 @@ class WritableFile {
 
   virtual Status Sync() = 0;
 
+  // Like Sync(), but may return before the data is durable, in which case
+  // 'cb' is invoked from another thread once it is. Callbacks are invoked in
+  // the order in which their syncs were requested.
+  //
+  // The default implementation syncs inline and invokes 'cb' before
+  // returning.
+  virtual void SyncAsync(const StatusCallback& cb);
+
   virtual uint64_t Size() const = 0;
 
   // Returns the filename provided when the WritableFile was constructed.
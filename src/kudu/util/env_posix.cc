@@ -8,6 +8,7 @@
 #include <fts.h>
 #include <glob.h>
 #include <pthread.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
@@ -17,12 +18,15 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <deque>
+#include <limits>
 #include <map>
 #include <memory>
 #include <numeric>
@@ -47,21 +51,27 @@
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
+#include "kudu/util/alignment.h"
 #include "kudu/util/array_view.h"
+#include "kudu/util/async_util.h"
+#include "kudu/util/condition_variable.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/env.h"
 #include "kudu/util/errno.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/flags.h"
+#include "kudu/util/io_uring.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/malloc.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 #include "kudu/util/stopwatch.h"
+#include "kudu/util/thread.h"
 #include "kudu/util/thread_restrictions.h"
 #include "kudu/util/trace.h"
 
@@ -627,6 +637,28 @@ class PosixRandomAccessFile: public RandomAccessFile {
     return Status::OK();
   }
 
+  virtual Status ReadAhead(uint64_t offset, size_t length) const override {
+    TRACE_EVENT1("io", "PosixRandomAccessFile::ReadAhead", "path", filename_);
+#if defined(__linux__)
+    int err = posix_fadvise(fd_, offset, length, POSIX_FADV_WILLNEED);
+    if (PREDICT_FALSE(err != 0)) {
+      return IOError(filename_, err);
+    }
+#endif
+    return Status::OK();
+  }
+
+  virtual Status DropFromPageCache(uint64_t offset, size_t length) const override {
+    TRACE_EVENT1("io", "PosixRandomAccessFile::DropFromPageCache", "path", filename_);
+#if defined(__linux__)
+    int err = posix_fadvise(fd_, offset, length, POSIX_FADV_DONTNEED);
+    if (PREDICT_FALSE(err != 0)) {
+      return IOError(filename_, err);
+    }
+#endif
+    return Status::OK();
+  }
+
   virtual const string& filename() const override { return filename_; }
 
   virtual size_t memory_footprint() const override {
@@ -634,6 +666,46 @@ class PosixRandomAccessFile: public RandomAccessFile {
   }
 };
 
+// mmap() based read-only view of a whole file.
+class PosixMemoryMappedFile : public MemoryMappedFile {
+ public:
+  PosixMemoryMappedFile(string fname, uint8_t* base, uint64_t size)
+      : filename_(std::move(fname)), base_(base), size_(size) {}
+
+  ~PosixMemoryMappedFile() {
+    if (base_ != nullptr && munmap(base_, size_) != 0) {
+      PLOG(WARNING) << "Failed to unmap " << filename_;
+    }
+  }
+
+  virtual const uint8_t* data() const override { return base_; }
+
+  virtual uint64_t size() const override { return size_; }
+
+  virtual Status Advise(AccessPattern pattern) const override {
+    if (base_ == nullptr) {
+      return Status::OK();
+    }
+    int advice = MADV_NORMAL;
+    switch (pattern) {
+      case NORMAL: break;
+      case SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+      case RANDOM: advice = MADV_RANDOM; break;
+    }
+    if (madvise(base_, size_, advice) != 0) {
+      return IOError(filename_, errno);
+    }
+    return Status::OK();
+  }
+
+  virtual const string& filename() const override { return filename_; }
+
+ private:
+  const string filename_;
+  uint8_t* const base_;
+  const uint64_t size_;
+};
+
 // Use non-memory mapped POSIX files to write data to a file.
 //
 // TODO (perf) investigate zeroing a pre-allocated allocated area in
@@ -641,12 +713,12 @@ class PosixRandomAccessFile: public RandomAccessFile {
 class PosixWritableFile : public WritableFile {
  public:
   PosixWritableFile(string fname, int fd, uint64_t file_size,
-                    bool sync_on_close)
+                    bool sync_on_close, uint64_t pre_allocated_size = 0)
       : filename_(std::move(fname)),
         fd_(fd),
         sync_on_close_(sync_on_close),
         filesize_(file_size),
-        pre_allocated_size_(0),
+        pre_allocated_size_(pre_allocated_size),
         pending_sync_(false),
         closed_(false) {}
 
@@ -759,8 +831,7 @@ class PosixWritableFile : public WritableFile {
     TRACE_EVENT1("io", "PosixWritableFile::Sync", "path", filename_);
     ThreadRestrictions::AssertIOAllowed();
     LOG_SLOW_EXECUTION(WARNING, 1000, Substitute("sync call for $0", filename_)) {
-      if (pending_sync_) {
-        pending_sync_ = false;
+      if (pending_sync_.exchange(false)) {
         RETURN_NOT_OK(DoSync(fd_, filename_));
       }
     }
@@ -780,8 +851,551 @@ class PosixWritableFile : public WritableFile {
 
   uint64_t filesize_;
   uint64_t pre_allocated_size_;
-  bool pending_sync_;
+  // Atomic since the WAL may sync the file from one thread while appending
+  // to it from another.
+  std::atomic<bool> pending_sync_;
+  bool closed_;
+};
+
+#if defined(__linux__)
+// Writes a file with O_DIRECT and O_DSYNC. See WritableFileOptions::direct_io.
+//
+// The file keeps an aligned buffer whose head always holds the partially
+// written last block of the file, so that each append can rewrite that block
+// together with the new data in a single aligned pwrite().
+class PosixDirectWritableFile : public WritableFile {
+ public:
+  PosixDirectWritableFile(string fname, int fd, uint64_t file_size,
+                          bool sync_on_close)
+      : filename_(std::move(fname)),
+        fd_(fd),
+        sync_on_close_(sync_on_close),
+        filesize_(file_size),
+        pre_allocated_size_(0),
+        buf_(nullptr),
+        buf_capacity_(0),
+        closed_(false) {}
+
+  ~PosixDirectWritableFile() {
+    WARN_NOT_OK(Close(), "Failed to close " + filename_);
+    free(buf_);
+  }
+
+  // Loads the partially written last block, if any, into the buffer.
+  Status Init() {
+    RETURN_NOT_OK(EnsureCapacity(kDirectIOBlockSize));
+    size_t tail_len = filesize_ % kDirectIOBlockSize;
+    if (tail_len > 0) {
+      ssize_t r;
+      RETRY_ON_EINTR(r, pread(fd_, buf_, kDirectIOBlockSize,
+                              KUDU_ALIGN_DOWN(filesize_, kDirectIOBlockSize)));
+      if (r < static_cast<ssize_t>(tail_len)) {
+        return r < 0 ? IOError(filename_, errno) :
+            Status::IOError(Substitute("$0: short read of last block", filename_));
+      }
+    }
+    return Status::OK();
+  }
+
+  virtual Status Append(const Slice& data) override {
+    return AppendV(ArrayView<const Slice>(&data, 1));
+  }
+
+  virtual Status AppendV(ArrayView<const Slice> data) override {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    ThreadRestrictions::AssertIOAllowed();
+    size_t tail_len = filesize_ % kDirectIOBlockSize;
+    size_t bytes_to_write = 0;
+    for (const Slice& s : data) {
+      bytes_to_write += s.size();
+    }
+    size_t padded_len = KUDU_ALIGN_UP(tail_len + bytes_to_write, kDirectIOBlockSize);
+    RETURN_NOT_OK(EnsureCapacity(padded_len));
+
+    uint8_t* dst = buf_ + tail_len;
+    for (const Slice& s : data) {
+      memcpy(dst, s.data(), s.size());
+      dst += s.size();
+    }
+    memset(dst, 0, buf_ + padded_len - dst);
+
+    uint64_t block_offset = KUDU_ALIGN_DOWN(filesize_, kDirectIOBlockSize);
+    Slice padded(buf_, padded_len);
+    RETURN_NOT_OK(DoWriteV(fd_, filename_, block_offset, ArrayView<const Slice>(&padded, 1)));
+    filesize_ += bytes_to_write;
+
+    // Keep the new partially written last block at the head of the buffer.
+    size_t new_tail_len = filesize_ % kDirectIOBlockSize;
+    if (new_tail_len > 0 && padded_len > kDirectIOBlockSize) {
+      memmove(buf_, buf_ + padded_len - kDirectIOBlockSize, new_tail_len);
+    }
+    return Status::OK();
+  }
+
+  virtual Status PreAllocate(uint64_t size) override {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+
+    TRACE_EVENT1("io", "PosixDirectWritableFile::PreAllocate", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    uint64_t offset = KUDU_ALIGN_UP(std::max(filesize_, pre_allocated_size_),
+                                    kDirectIOBlockSize);
+    uint64_t end = KUDU_ALIGN_UP(std::max(filesize_, pre_allocated_size_) + size,
+                                 kDirectIOBlockSize);
+    int ret;
+    RETRY_ON_EINTR(ret, fallocate(fd_, 0, offset, end - offset));
+    if (ret != 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+      return IOError(filename_, errno);
+    }
+
+    // Zero the range so that the extents are written, rather than merely
+    // allocated, by the time appends land on them.
+    const size_t kZeroChunkSize = 1024 * 1024;
+    uint8_t* zeros;
+    if (posix_memalign(reinterpret_cast<void**>(&zeros), kDirectIOBlockSize,
+                       kZeroChunkSize) != 0) {
+      return Status::RuntimeError("unable to allocate aligned buffer");
+    }
+    auto free_zeros = MakeScopedCleanup([&]() { free(zeros); });
+    memset(zeros, 0, kZeroChunkSize);
+    for (uint64_t pos = offset; pos < end; pos += kZeroChunkSize) {
+      Slice chunk(zeros, std::min<uint64_t>(kZeroChunkSize, end - pos));
+      RETURN_NOT_OK(DoWriteV(fd_, filename_, pos, ArrayView<const Slice>(&chunk, 1)));
+    }
+    pre_allocated_size_ = end;
+    return Status::OK();
+  }
+
+  virtual Status Close() override {
+    if (closed_) {
+      return Status::OK();
+    }
+    TRACE_EVENT1("io", "PosixDirectWritableFile::Close", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    Status s;
+
+    // Drop both the block padding and any preallocated space.
+    int ret;
+    RETRY_ON_EINTR(ret, ftruncate(fd_, filesize_));
+    if (ret != 0) {
+      s = IOError(filename_, errno);
+    }
+
+    // The data itself is already durable, but the truncation isn't.
+    if (sync_on_close_) {
+      Status sync_status = DoSync(fd_, filename_);
+      if (!sync_status.ok()) {
+        LOG(ERROR) << "Unable to Sync " << filename_ << ": " << sync_status.ToString();
+        if (s.ok()) {
+          s = sync_status;
+        }
+      }
+    }
+
+    RETRY_ON_EINTR(ret, close(fd_));
+    if (ret < 0) {
+      if (s.ok()) {
+        s = IOError(filename_, errno);
+      }
+    }
+
+    closed_ = true;
+    return s;
+  }
+
+  virtual Status Flush(FlushMode mode) override {
+    // Every append is already written through to the device.
+    return Status::OK();
+  }
+
+  virtual Status Sync() override {
+    // Every append is already durable thanks to O_DSYNC.
+    return Status::OK();
+  }
+
+  virtual uint64_t Size() const override {
+    return filesize_;
+  }
+
+  virtual const string& filename() const override { return filename_; }
+
+ private:
+  // The alignment required for the buffer, offset and length of the
+  // writes.
+  static const size_t kDirectIOBlockSize = 4096;
+
+  // Grows 'buf_' to hold at least 'size' bytes, preserving the last block.
+  Status EnsureCapacity(size_t size) {
+    if (size <= buf_capacity_) {
+      return Status::OK();
+    }
+    size_t new_capacity = KUDU_ALIGN_UP(std::max(size, buf_capacity_ * 2), kDirectIOBlockSize);
+    uint8_t* new_buf;
+    if (posix_memalign(reinterpret_cast<void**>(&new_buf), kDirectIOBlockSize,
+                       new_capacity) != 0) {
+      return Status::RuntimeError("unable to allocate aligned buffer");
+    }
+    if (buf_) {
+      memcpy(new_buf, buf_, kDirectIOBlockSize);
+      free(buf_);
+    }
+    buf_ = new_buf;
+    buf_capacity_ = new_capacity;
+    return Status::OK();
+  }
+
+  const string filename_;
+  const int fd_;
+  const bool sync_on_close_;
+
+  uint64_t filesize_;
+  uint64_t pre_allocated_size_;
+
+  // Aligned buffer, of 'buf_capacity_' bytes, from which writes are issued.
+  uint8_t* buf_;
+  size_t buf_capacity_;
+
+  bool closed_;
+
+  DISALLOW_COPY_AND_ASSIGN(PosixDirectWritableFile);
+};
+#endif // defined(__linux__)
+
+// Writes a file through io_uring. See WritableFileOptions::use_io_uring.
+//
+// Appends copy the data and queue a write to the ring, linked to the next
+// queued request. SyncAsync() queues an fdatasync() which waits for all the
+// earlier writes, and submits the whole chain with one system call. A
+// dedicated thread reaps the completions and runs the sync callbacks in
+// order.
+//
+// The first I/O error is sticky: every later append or sync fails with it.
+class PosixIoUringWritableFile : public WritableFile {
+ public:
+  PosixIoUringWritableFile(string fname, int fd, uint64_t file_size,
+                           bool sync_on_close, unique_ptr<IoUring> ring)
+      : filename_(std::move(fname)),
+        fd_(fd),
+        sync_on_close_(sync_on_close),
+        ring_(std::move(ring)),
+        filesize_(file_size),
+        pre_allocated_size_(0),
+        next_seq_(0),
+        queued_(0),
+        ops_cond_(&lock_),
+        closed_(false) {}
+
+  ~PosixIoUringWritableFile() {
+    WARN_NOT_OK(Close(), "Failed to close " + filename_);
+  }
+
+  Status Init() {
+    return Thread::Create("io", "io-uring-reaper", &PosixIoUringWritableFile::ReapLoop,
+                          this, &reaper_);
+  }
+
+  virtual Status Append(const Slice& data) override {
+    return AppendV(ArrayView<const Slice>(&data, 1));
+  }
+
+  virtual Status AppendV(ArrayView<const Slice> data) override {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    MutexLock l(lock_);
+    RETURN_NOT_OK(error_);
+    WaitForRoomUnlocked();
+    ops_.emplace_back();
+    Op* op = &ops_.back();
+    op->seq = next_seq_++;
+    for (const Slice& s : data) {
+      op->buf.append(s.data(), s.size());
+    }
+    op->iov.iov_base = op->buf.data();
+    op->iov.iov_len = op->buf.size();
+    RETURN_NOT_OK(QueueUnlocked([&]() {
+        return ring_->QueueWriteV(fd_, &op->iov, 1, filesize_, op->seq, /*link=*/true);
+      }));
+    filesize_ += op->buf.size();
+    if (queued_ >= kMaxQueuedWrites) {
+      RETURN_NOT_OK(SubmitUnlocked());
+    }
+    return Status::OK();
+  }
+
+  virtual Status PreAllocate(uint64_t size) override {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+
+    TRACE_EVENT1("io", "PosixIoUringWritableFile::PreAllocate", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    uint64_t offset;
+    {
+      MutexLock l(lock_);
+      offset = std::max(filesize_, pre_allocated_size_);
+    }
+    int ret;
+    RETRY_ON_EINTR(ret, fallocate(fd_, 0, offset, size));
+    if (ret != 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+      return IOError(filename_, errno);
+    }
+    MutexLock l(lock_);
+    pre_allocated_size_ = offset + size;
+    return Status::OK();
+  }
+
+  virtual Status Close() override {
+    if (closed_) {
+      return Status::OK();
+    }
+    TRACE_EVENT1("io", "PosixIoUringWritableFile::Close", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    Status s;
+    if (sync_on_close_) {
+      s = Sync();
+    } else {
+      // Wait for all the writes to complete, without making them durable.
+      Synchronizer barrier;
+      QueueBarrier(barrier.AsStatusCallback(), /*sync=*/false);
+      s = barrier.Wait();
+    }
+
+    if (reaper_) {
+      {
+        MutexLock l(lock_);
+        Status stop = QueueUnlocked([&]() {
+            return ring_->QueueNop(/*drain=*/true, kStopReaperTag);
+          });
+        if (stop.ok()) {
+          stop = SubmitUnlocked();
+        }
+        CHECK_OK(stop);
+      }
+      reaper_->Join();
+    }
+
+    if (filesize_ < pre_allocated_size_) {
+      int ret;
+      RETRY_ON_EINTR(ret, ftruncate(fd_, filesize_));
+      if (ret != 0 && s.ok()) {
+        s = IOError(filename_, errno);
+      }
+    }
+
+    int ret;
+    RETRY_ON_EINTR(ret, close(fd_));
+    if (ret < 0 && s.ok()) {
+      s = IOError(filename_, errno);
+    }
+    closed_ = true;
+    return s;
+  }
+
+  virtual Status Flush(FlushMode mode) override {
+    if (mode == FLUSH_SYNC) {
+      return Sync();
+    }
+    MutexLock l(lock_);
+    return SubmitUnlocked();
+  }
+
+  virtual Status Sync() override {
+    TRACE_EVENT1("io", "PosixIoUringWritableFile::Sync", "path", filename_);
+    DCHECK(Thread::current_thread() != reaper_.get())
+        << "cannot block on a sync from the completion thread";
+    Synchronizer sync;
+    SyncAsync(sync.AsStatusCallback());
+    return sync.Wait();
+  }
+
+  virtual void SyncAsync(const StatusCallback& cb) override {
+    QueueBarrier(cb, /*sync=*/true);
+  }
+
+  virtual uint64_t Size() const override {
+    MutexLock l(lock_);
+    return filesize_;
+  }
+
+  virtual const string& filename() const override { return filename_; }
+
+ private:
+  // A request handed to the ring and not yet reaped.
+  struct Op {
+    uint64_t seq;
+
+    // The data of a write, and the iovec pointing to it.
+    faststring buf;
+    struct iovec iov;
+
+    // For syncs and barriers, which have no data: the callback to run.
+    StatusCallback cb;
+
+    bool done = false;
+    Status status;
+  };
+
+  // The user data of the request which stops the reaper thread.
+  static const uint64_t kStopReaperTag = std::numeric_limits<uint64_t>::max();
+
+  // The number of appends that may be queued before they're submitted
+  // without waiting for a sync.
+  static const int kMaxQueuedWrites = 32;
+
+  // The maximum number of requests in flight. Kept below the completion
+  // queue size so that completions are never dropped.
+  static const size_t kMaxInFlight = 256;
+
+  // Queues a request which runs 'cb' with the result once all earlier
+  // requests are done: an fdatasync() if 'sync' is set, or otherwise a no-op.
+  void QueueBarrier(const StatusCallback& cb, bool sync) {
+    MutexLock l(lock_);
+    WaitForRoomUnlocked();
+    ops_.emplace_back();
+    Op* op = &ops_.back();
+    op->seq = next_seq_++;
+    op->cb = cb;
+    uint64_t seq = op->seq;
+    Status s = QueueUnlocked([&]() {
+        if (sync && !FLAGS_never_fsync) {
+          return ring_->QueueFsync(fd_, !FLAGS_env_use_fsync, /*drain=*/true, seq);
+        }
+        return ring_->QueueNop(/*drain=*/true, seq);
+      });
+    if (s.ok()) {
+      s = SubmitUnlocked();
+    }
+    if (PREDICT_FALSE(!s.ok())) {
+      // The request never made it to the kernel. Fail it in order, once the
+      // requests ahead of it are reaped.
+      LOG(ERROR) << filename_ << ": unable to submit to io_uring: " << s.ToString();
+      if (error_.ok()) {
+        error_ = s;
+      }
+      op->done = true;
+      op->status = s;
+      if (ops_.size() == 1) {
+        // Nothing is in flight ahead of it, so the reaper would never get to
+        // this request.
+        ops_.pop_front();
+        ops_cond_.Broadcast();
+        l.Unlock();
+        cb.Run(s);
+      }
+    }
+  }
+
+  // Calls 'queue' to queue a request, submitting the already queued requests
+  // first if the submission queue is full.
+  template <class F>
+  Status QueueUnlocked(const F& queue) {
+    Status s = queue();
+    if (s.IsServiceUnavailable()) {
+      RETURN_NOT_OK(SubmitUnlocked());
+      s = queue();
+    }
+    if (s.ok()) {
+      queued_++;
+    }
+    return s;
+  }
+
+  Status SubmitUnlocked() {
+    lock_.AssertAcquired();
+    queued_ = 0;
+    return ring_->Submit();
+  }
+
+  void WaitForRoomUnlocked() {
+    while (ops_.size() >= kMaxInFlight) {
+      // The remaining requests must be in the kernel's hands for the reaper to
+      // ever make room.
+      WARN_NOT_OK(SubmitUnlocked(), "unable to submit to io_uring");
+      ops_cond_.Wait();
+    }
+  }
+
+  void ReapLoop() {
+    vector<IoUring::Completion> completions;
+    vector<std::pair<StatusCallback, Status>> to_run;
+    bool stop = false;
+    while (!stop) {
+      completions.clear();
+      to_run.clear();
+      Status s = ring_->WaitForCompletions(&completions);
+      {
+        MutexLock l(lock_);
+        if (PREDICT_FALSE(!s.ok())) {
+          LOG(ERROR) << filename_ << ": " << s.ToString();
+          for (Op& op : ops_) {
+            op.done = true;
+            op.status = s;
+          }
+          stop = true;
+        }
+        for (const IoUring::Completion& c : completions) {
+          if (c.user_data == kStopReaperTag) {
+            stop = true;
+            continue;
+          }
+          DCHECK(!ops_.empty());
+          Op& op = ops_[c.user_data - ops_.front().seq];
+          DCHECK_EQ(op.seq, c.user_data);
+          op.done = true;
+          if (c.res < 0) {
+            op.status = IOError(filename_, -c.res);
+          } else if (op.cb.is_null() && static_cast<size_t>(c.res) != op.buf.size()) {
+            op.status = Status::IOError(Substitute("$0: short write of $1 out of $2 bytes",
+                                                   filename_, c.res, op.buf.size()));
+          }
+        }
+        while (!ops_.empty() && ops_.front().done) {
+          Op& op = ops_.front();
+          if (!op.status.ok() && error_.ok()) {
+            error_ = op.status;
+          }
+          if (!op.cb.is_null()) {
+            to_run.emplace_back(op.cb, error_.ok() ? op.status : error_);
+          }
+          ops_.pop_front();
+        }
+        ops_cond_.Broadcast();
+      }
+      for (const auto& cb_and_status : to_run) {
+        cb_and_status.first.Run(cb_and_status.second);
+      }
+    }
+  }
+
+  const string filename_;
+  const int fd_;
+  const bool sync_on_close_;
+  const unique_ptr<IoUring> ring_;
+
+  // Protects all the state below, and submission to 'ring_'.
+  mutable Mutex lock_;
+
+  uint64_t filesize_;
+  uint64_t pre_allocated_size_;
+
+  // The sequence number, also used as the ring's user data, of the next
+  // request.
+  uint64_t next_seq_;
+
+  // The number of requests queued to the ring but not yet submitted.
+  int queued_;
+
+  // Requests handed to the ring which have not been reaped in order yet.
+  // Ordered by sequence number.
+  std::deque<Op> ops_;
+
+  // Signaled when requests are reaped.
+  ConditionVariable ops_cond_;
+
+  // The first I/O error encountered, if any.
+  Status error_;
+
+  scoped_refptr<Thread> reaper_;
   bool closed_;
+
+  DISALLOW_COPY_AND_ASSIGN(PosixIoUringWritableFile);
 };
 
 class PosixRWFile : public RWFile {
@@ -1107,6 +1721,39 @@ class PosixEnv : public Env {
     return Status::OK();
   }
 
+  virtual Status NewMemoryMappedFile(const string& fname,
+                                     unique_ptr<MemoryMappedFile>* result) override {
+    TRACE_EVENT1("io", "PosixEnv::NewMemoryMappedFile", "path", fname);
+    MAYBE_RETURN_EIO(fname, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    ThreadRestrictions::AssertIOAllowed();
+    int fd;
+    RETRY_ON_EINTR(fd, open(fname.c_str(), O_RDONLY));
+    if (fd < 0) {
+      return IOError(fname, errno);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    auto close_fd = MakeScopedCleanup([&]() {
+      int err;
+      RETRY_ON_EINTR(err, close(fd));
+    });
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      return IOError(fname, errno);
+    }
+    uint64_t size = st.st_size;
+    uint8_t* base = nullptr;
+    if (size > 0) {
+      void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (addr == MAP_FAILED) {
+        return IOError(fname, errno);
+      }
+      base = static_cast<uint8_t*>(addr);
+    }
+    result->reset(new PosixMemoryMappedFile(fname, base, size));
+    return Status::OK();
+  }
+
   virtual Status NewWritableFile(const string& fname,
                                  unique_ptr<WritableFile>* result) override {
     return NewWritableFile(WritableFileOptions(), fname, result);
@@ -1256,6 +1903,27 @@ class PosixEnv : public Env {
     return Status::OK();
   }
 
+  virtual Status SyncFileSystem(const string& path) override {
+    TRACE_EVENT1("io", "SyncFileSystem", "path", path);
+    MAYBE_RETURN_EIO(path, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    ThreadRestrictions::AssertIOAllowed();
+    if (FLAGS_never_fsync) return Status::OK();
+#if defined(__APPLE__)
+    return Status::NotSupported("syncfs() is not supported on macOS", path);
+#else
+    int fd;
+    RETRY_ON_EINTR(fd, open(path.c_str(), O_RDONLY));
+    if (fd < 0) {
+      return IOError(path, errno);
+    }
+    ScopedFdCloser fd_closer(fd);
+    if (syncfs(fd) != 0) {
+      return IOError(path, errno);
+    }
+    return Status::OK();
+#endif
+  }
+
   virtual Status DeleteRecursively(const string &name) override {
     return Walk(name, POST_ORDER, Bind(&PosixEnv::DeleteRecursivelyCb,
                                        Unretained(this)));
@@ -1704,6 +2372,18 @@ class PosixEnv : public Env {
     return DoIsOnXfsFilesystem(path, result);
   }
 
+  virtual Status GetDeviceId(const string& path, uint64_t* device_id) override {
+    TRACE_EVENT1("io", "PosixEnv::GetDeviceId", "path", path);
+    MAYBE_RETURN_EIO(path, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    ThreadRestrictions::AssertIOAllowed();
+    struct stat s;
+    if (stat(path.c_str(), &s) != 0) {
+      return IOError(path, errno);
+    }
+    *device_id = s.st_dev;
+    return Status::OK();
+  }
+
   virtual string GetKernelRelease() override {
     // There's no reason for this to ever fail.
     struct utsname u;
@@ -1790,10 +2470,73 @@ class PosixEnv : public Env {
     if (opts.mode == OPEN_EXISTING) {
       RETURN_NOT_OK(GetFileSize(fname, &file_size));
     }
+    if (opts.mode == OPEN_EXISTING && opts.overwrite_existing) {
+      if (opts.direct_io || opts.use_io_uring) {
+        int ret;
+        RETRY_ON_EINTR(ret, close(fd));
+        return Status::NotSupported("cannot overwrite an existing file with direct I/O or "
+                                    "io_uring", fname);
+      }
+      // The existing contents are treated as preallocated space.
+      result->reset(new PosixWritableFile(fname, fd, 0, opts.sync_on_close, file_size));
+      return Status::OK();
+    }
+    if (opts.direct_io) {
+      return InstantiateDirectWritableFile(fname, fd, file_size, opts, result);
+    }
+    if (opts.use_io_uring) {
+      unique_ptr<IoUring> ring;
+      Status s = IoUring::Create(kIoUringEntries, &ring);
+      if (!s.ok()) {
+        int ret;
+        RETRY_ON_EINTR(ret, close(fd));
+        return s;
+      }
+      unique_ptr<PosixIoUringWritableFile> file(new PosixIoUringWritableFile(
+          fname, fd, file_size, opts.sync_on_close, std::move(ring)));
+      RETURN_NOT_OK(file->Init());
+      result->reset(file.release());
+      return Status::OK();
+    }
     result->reset(new PosixWritableFile(fname, fd, file_size, opts.sync_on_close));
     return Status::OK();
   }
 
+  // The number of submission queue entries of the ring of each file opened
+  // with WritableFileOptions::use_io_uring.
+  static const uint32_t kIoUringEntries = 128;
+
+  // Reopens 'fname' for direct I/O and closes 'fd', which was opened
+  // without it.
+  Status InstantiateDirectWritableFile(const string& fname,
+                                       int fd,
+                                       uint64_t file_size,
+                                       const WritableFileOptions& opts,
+                                       unique_ptr<WritableFile>* result) {
+    int ret;
+#if defined(__linux__)
+    int direct_fd;
+    RETRY_ON_EINTR(direct_fd, open(fname.c_str(), O_RDWR | O_DIRECT | O_DSYNC));
+    int err = errno;
+    RETRY_ON_EINTR(ret, close(fd));
+    if (direct_fd < 0) {
+      if (err == EINVAL) {
+        return Status::NotSupported(
+            Substitute("$0: filesystem does not support direct I/O", fname));
+      }
+      return IOError(fname, err);
+    }
+    unique_ptr<PosixDirectWritableFile> file(
+        new PosixDirectWritableFile(fname, direct_fd, file_size, opts.sync_on_close));
+    RETURN_NOT_OK(file->Init());
+    result->reset(file.release());
+    return Status::OK();
+#else
+    RETRY_ON_EINTR(ret, close(fd));
+    return Status::NotSupported("direct I/O is not supported on this platform");
+#endif
+  }
+
   Status DeleteRecursivelyCb(FileType type, const string& dirname, const string& basename) {
     string full_path = JoinPathSegments(dirname, basename);
     Status s;
@@ -18,14 +18,19 @@
 #include <algorithm>
 #include <cstring>
 #include <memory>
+#include <string>
 
+#include <gflags/gflags_declare.h>
 #include <gtest/gtest.h>
 
 #include "kudu/util/faststring.h"
+#include "kudu/util/huge_pages.h"
 #include "kudu/util/random.h"
 #include "kudu/util/random_util.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_string(buffer_huge_pages);
+
 namespace kudu {
 class FaststringTest : public KuduTest {};
 
@@ -62,4 +67,74 @@ TEST_F(FaststringTest, TestShrinkToFit_Random) {
   }
 }
 
+// Test swapping strings held inline and on the heap, in every combination.
+TEST_F(FaststringTest, TestSwap) {
+  const std::string kShort = "short";
+  const std::string kLong(faststring::kInitialCapacity * 3, 'x');
+  for (const auto& a_contents : { kShort, kLong }) {
+    for (const auto& b_contents : { kShort + "er", kLong + "er" }) {
+      faststring a;
+      a.append(a_contents);
+      faststring b;
+      b.append(b_contents);
+      const uint8_t* a_data = a.data();
+      const uint8_t* b_data = b.data();
+      a.swap(b);
+      ASSERT_EQ(b_contents, a.ToString());
+      ASSERT_EQ(a_contents, b.ToString());
+      // Heap buffers change hands rather than being copied.
+      if (b_contents.size() > faststring::kInitialCapacity) {
+        ASSERT_EQ(b_data, a.data());
+      }
+      if (a_contents.size() > faststring::kInitialCapacity) {
+        ASSERT_EQ(a_data, b.data());
+      }
+      a.append("!");
+      b.append("!");
+      ASSERT_EQ(b_contents + "!", a.ToString());
+      ASSERT_EQ(a_contents + "!", b.ToString());
+    }
+  }
+}
+
+// Test that a string allowed on huge pages moves to a huge page mapping once
+// it's large enough, and keeps its contents through growing, swapping,
+// shrinking and releasing.
+TEST_F(FaststringTest, TestHugePages) {
+  FLAGS_buffer_huge_pages = "thp";
+  const int64_t initial_bytes = HugePageBufferBytes();
+  const std::string kContents(kHugePageSize / 2, 'x');
+  faststring s;
+  s.AllowHugePages();
+  s.append(kContents);
+  ASSERT_EQ(initial_bytes, HugePageBufferBytes());
+
+  s.append(kContents);
+  s.append(kContents);
+  ASSERT_EQ(0, s.capacity() % kHugePageSize);
+  ASSERT_EQ(initial_bytes + s.capacity(), HugePageBufferBytes());
+  ASSERT_EQ(0, reinterpret_cast<uintptr_t>(s.data()) % kHugePageSize);
+  ASSERT_EQ(kContents + kContents + kContents, s.ToString());
+
+  // Strings which aren't allowed on huge pages stay on the heap.
+  faststring other;
+  other.append(s.data(), s.size());
+  ASSERT_EQ(initial_bytes + s.capacity(), HugePageBufferBytes());
+
+  // The mapping changes hands with the contents.
+  other.swap(s);
+  ASSERT_EQ(initial_bytes + other.capacity(), HugePageBufferBytes());
+  other.resize(kHugePageSize + 1);
+  other.shrink_to_fit();
+  ASSERT_EQ(initial_bytes, HugePageBufferBytes());
+  ASSERT_EQ(kHugePageSize + 1, other.size());
+
+  s.reserve(2 * kHugePageSize);
+  s.append(kContents);
+  ASSERT_GT(HugePageBufferBytes(), initial_bytes);
+  std::unique_ptr<uint8_t[]> released(s.release());
+  ASSERT_EQ(initial_bytes, HugePageBufferBytes());
+  ASSERT_EQ(0, memcmp(released.get(), kContents.data(), kContents.size()));
+}
+
 } // namespace kudu
@@ -17,8 +17,13 @@
 
 #include "kudu/util/faststring.h"
 
-#include <glog/logging.h>
+#include <initializer_list>
 #include <memory>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/util/huge_pages.h"
 
 namespace kudu {
 
@@ -37,36 +42,88 @@ void faststring::GrowByAtLeast(size_t count) {
 
 void faststring::GrowArray(size_t newcapacity) {
   DCHECK_GE(newcapacity, capacity_);
-  std::unique_ptr<uint8_t[]> newdata(new uint8_t[newcapacity]);
+  uint8_t* newdata = nullptr;
+  bool on_huge_pages = false;
+  if (allow_huge_pages_ && UseHugePageBuffer(newcapacity)) {
+    newdata = AllocateHugePageBuffer(&newcapacity);
+    on_huge_pages = newdata != nullptr;
+  }
+  if (!newdata) {
+    newdata = new uint8_t[newcapacity];
+  }
   if (len_ > 0) {
     memcpy(&newdata[0], &data_[0], len_);
   }
-  capacity_ = newcapacity;
   if (data_ != initial_data_) {
-    delete[] data_;
+    FreeArray();
   } else {
     ASAN_POISON_MEMORY_REGION(initial_data_, arraysize(initial_data_));
   }
 
-  data_ = newdata.release();
+  capacity_ = newcapacity;
+  on_huge_pages_ = on_huge_pages;
+  data_ = newdata;
   ASAN_POISON_MEMORY_REGION(data_ + len_, capacity_ - len_);
 }
 
+void faststring::FreeArray() {
+  DCHECK_NE(data_, initial_data_);
+  if (on_huge_pages_) {
+    ASAN_UNPOISON_MEMORY_REGION(data_, capacity_);
+    FreeHugePageBuffer(data_, capacity_);
+    on_huge_pages_ = false;
+  } else {
+    delete[] data_;
+  }
+}
+
 void faststring::ShrinkToFitInternal() {
   DCHECK_NE(data_, initial_data_);
   if (len_ <= kInitialCapacity) {
     ASAN_UNPOISON_MEMORY_REGION(initial_data_, len_);
     memcpy(initial_data_, &data_[0], len_);
-    delete[] data_;
+    FreeArray();
     data_ = initial_data_;
     capacity_ = kInitialCapacity;
   } else {
     std::unique_ptr<uint8_t[]> newdata(new uint8_t[len_]);
     memcpy(&newdata[0], &data_[0], len_);
-    delete[] data_;
+    FreeArray();
     data_ = newdata.release();
     capacity_ = len_;
   }
 }
 
+void faststring::swap(faststring& other) {
+  if (this == &other) return;
+  const bool inline_data = data_ == initial_data_;
+  const bool other_inline_data = other.data_ == other.initial_data_;
+  ASAN_UNPOISON_MEMORY_REGION(initial_data_, arraysize(initial_data_));
+  ASAN_UNPOISON_MEMORY_REGION(other.initial_data_, arraysize(other.initial_data_));
+  uint8_t tmp[kInitialCapacity];
+  memcpy(tmp, initial_data_, kInitialCapacity);
+  memcpy(initial_data_, other.initial_data_, kInitialCapacity);
+  memcpy(other.initial_data_, tmp, kInitialCapacity);
+
+  std::swap(data_, other.data_);
+  std::swap(len_, other.len_);
+  std::swap(capacity_, other.capacity_);
+  std::swap(on_huge_pages_, other.on_huge_pages_);
+  // The heap buffers changed hands, but the inline ones stay in place.
+  if (inline_data) {
+    other.data_ = other.initial_data_;
+  }
+  if (other_inline_data) {
+    data_ = initial_data_;
+  }
+
+  for (faststring* s : { this, &other }) {
+    if (s->data_ != s->initial_data_) {
+      ASAN_POISON_MEMORY_REGION(s->initial_data_, arraysize(s->initial_data_));
+    } else {
+      ASAN_POISON_MEMORY_REGION(s->data_ + s->len_, s->capacity_ - s->len_);
+    }
+  }
+}
+
 } // namespace kudu
@@ -40,14 +40,18 @@ class faststring {
   faststring() :
     data_(initial_data_),
     len_(0),
-    capacity_(kInitialCapacity) {
+    capacity_(kInitialCapacity),
+    allow_huge_pages_(false),
+    on_huge_pages_(false) {
   }
 
   // Construct a string with the given capacity, in bytes.
   explicit faststring(size_t capacity)
     : data_(initial_data_),
       len_(0),
-      capacity_(kInitialCapacity) {
+      capacity_(kInitialCapacity),
+      allow_huge_pages_(false),
+      on_huge_pages_(false) {
     if (capacity > capacity_) {
       data_ = new uint8_t[capacity];
       capacity_ = capacity;
@@ -58,10 +62,17 @@ class faststring {
   ~faststring() {
     ASAN_UNPOISON_MEMORY_REGION(initial_data_, arraysize(initial_data_));
     if (data_ != initial_data_) {
-      delete[] data_;
+      FreeArray();
     }
   }
 
+  // Lets the buffer be mapped on huge pages when it grows to a huge page or
+  // more, if --buffer_huge_pages is set (see huge_pages.h). For the large
+  // buffers which are reused and gone through in bulk.
+  void AllowHugePages() {
+    allow_huge_pages_ = true;
+  }
+
   // Reset the valid length of the string to 0.
   //
   // This does not free up any memory. The capacity of the string remains unchanged.
@@ -89,9 +100,13 @@ class faststring {
   // NOTE: the data pointer returned by release() is not necessarily the pointer
   uint8_t *release() WARN_UNUSED_RESULT {
     uint8_t *ret = data_;
-    if (ret == initial_data_) {
+    if (ret == initial_data_ || on_huge_pages_) {
+      // The caller frees the array with delete[].
       ret = new uint8_t[len_];
       memcpy(ret, data_, len_);
+      if (data_ != initial_data_) {
+        FreeArray();
+      }
     }
     len_ = 0;
     capacity_ = kInitialCapacity;
@@ -217,6 +232,10 @@ class faststring {
     ShrinkToFitInternal();
   }
 
+  // Exchanges the contents and buffers of this string and 'other', without
+  // copying any heap-allocated data.
+  void swap(faststring& other);
+
   // Return a copy of this string as a std::string.
   std::string ToString() const {
     return std::string(reinterpret_cast<const char *>(data()),
@@ -248,10 +267,18 @@ class faststring {
 
   void ShrinkToFitInternal();
 
+  // Frees the array in 'data_', which mustn't be 'initial_data_'.
+  void FreeArray();
+
   uint8_t* data_;
   uint8_t initial_data_[kInitialCapacity];
   size_t len_;
   size_t capacity_;
+
+  // Whether AllowHugePages() was called, and whether 'data_' is a mapping
+  // from AllocateHugePageBuffer() of 'capacity_' bytes.
+  bool allow_huge_pages_;
+  bool on_huge_pages_;
 };
 
 } // namespace kudu
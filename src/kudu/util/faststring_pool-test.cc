@@ -0,0 +1,104 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/faststring_pool.h"
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/faststring.h"
+#include "kudu/util/test_util.h"
+
+namespace kudu {
+
+class FaststringPoolTest : public KuduTest {};
+
+TEST_F(FaststringPoolTest, TestReusesBuffers) {
+  FaststringPool pool(2, 1024 * 1024);
+  const uint8_t* small_data;
+  const uint8_t* large_data;
+  {
+    faststring small;
+    pool.Acquire(1000, &small);
+    small_data = small.data();
+    faststring large;
+    pool.Acquire(100000, &large);
+    large_data = large.data();
+    large.append("abc", 3);
+    pool.Release(&small);
+    pool.Release(&large);
+    ASSERT_EQ(0, large.size());
+  }
+  ASSERT_EQ(2, pool.num_buffers());
+
+  // A buffer which is large enough goes to the smallest request it fits.
+  faststring buf;
+  pool.Acquire(500, &buf);
+  ASSERT_EQ(small_data, buf.data());
+  ASSERT_EQ(0, buf.size());
+  faststring buf2;
+  pool.Acquire(50000, &buf2);
+  ASSERT_EQ(large_data, buf2.data());
+  ASSERT_EQ(0, pool.num_buffers());
+
+  // With nothing pooled, buffers are allocated as usual.
+  faststring buf3;
+  pool.Acquire(2000, &buf3);
+  ASSERT_GE(buf3.capacity(), 2000);
+
+  // The pool is bounded.
+  pool.Release(&buf);
+  pool.Release(&buf2);
+  pool.Release(&buf3);
+  ASSERT_EQ(2, pool.num_buffers());
+  ASSERT_GE(buf3.capacity(), 2000);
+}
+
+TEST_F(FaststringPoolTest, TestLimitsBufferCapacity) {
+  FaststringPool pool(2, 1024);
+  faststring buf;
+  buf.reserve(4096);
+  pool.Release(&buf);
+  ASSERT_EQ(0, pool.num_buffers());
+  // Inline buffers aren't pooled.
+  faststring inline_buf;
+  pool.Release(&inline_buf);
+  ASSERT_EQ(0, pool.num_buffers());
+}
+
+TEST_F(FaststringPoolTest, TestScratchReusesBuffer) {
+  const uint8_t* data;
+  {
+    ScratchFaststring scratch;
+    scratch.get()->resize(10000);
+    data = scratch.get()->data();
+  }
+  {
+    ScratchFaststring scratch;
+    ASSERT_EQ(0, scratch.get()->size());
+    ASSERT_EQ(data, scratch.get()->data());
+
+    // A nested scratch faststring starts out empty, and the outer buffer is
+    // the one kept once both are gone.
+    ScratchFaststring nested;
+    ASSERT_NE(data, nested.get()->data());
+    nested.get()->resize(100);
+  }
+  ScratchFaststring scratch;
+  ASSERT_EQ(data, scratch.get()->data());
+}
+
+} // namespace kudu
@@ -0,0 +1,109 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/faststring_pool.h"
+
+#include <mutex>
+
+#include <glog/logging.h>
+
+namespace kudu {
+
+FaststringPool::FaststringPool(size_t max_buffers, size_t max_buffer_capacity)
+    : max_buffer_capacity_(max_buffer_capacity) {
+  slots_.reserve(max_buffers);
+  for (size_t i = 0; i < max_buffers; i++) {
+    slots_.emplace_back(new faststring);
+  }
+}
+
+FaststringPool::~FaststringPool() {
+}
+
+void FaststringPool::Acquire(size_t capacity, faststring* buf) {
+  DCHECK_EQ(0, buf->size());
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    // The smallest buffer which is large enough, and the largest one.
+    faststring* fit = nullptr;
+    faststring* largest = nullptr;
+    for (const auto& slot : slots_) {
+      const size_t slot_capacity = slot->capacity();
+      if (slot_capacity <= faststring::kInitialCapacity) {
+        continue;
+      }
+      if (slot_capacity >= capacity && (!fit || slot_capacity < fit->capacity())) {
+        fit = slot.get();
+      }
+      if (!largest || slot_capacity > largest->capacity()) {
+        largest = slot.get();
+      }
+    }
+    faststring* best = fit ? fit : largest;
+    if (best && best->capacity() > buf->capacity()) {
+      best->swap(*buf);
+    }
+  }
+  buf->reserve(capacity);
+}
+
+void FaststringPool::Release(faststring* buf) {
+  buf->clear();
+  const size_t capacity = buf->capacity();
+  if (capacity <= faststring::kInitialCapacity || capacity > max_buffer_capacity_) {
+    return;
+  }
+  std::lock_guard<simple_spinlock> l(lock_);
+  for (const auto& slot : slots_) {
+    if (slot->capacity() <= faststring::kInitialCapacity) {
+      slot->swap(*buf);
+      return;
+    }
+  }
+}
+
+size_t FaststringPool::num_buffers() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  size_t n = 0;
+  for (const auto& slot : slots_) {
+    if (slot->capacity() > faststring::kInitialCapacity) {
+      n++;
+    }
+  }
+  return n;
+}
+
+constexpr size_t ScratchFaststring::kMaxRetainedCapacity;
+
+DEFINE_STATIC_THREAD_LOCAL(faststring, ScratchFaststring, tls_buf_);
+
+ScratchFaststring::ScratchFaststring() {
+  INIT_STATIC_THREAD_LOCAL(faststring, tls_buf_);
+  buf_.swap(*tls_buf_);
+}
+
+ScratchFaststring::~ScratchFaststring() {
+  // Keep the larger of the two buffers, e.g. the outer one when nested
+  // scratch faststrings unwind.
+  if (buf_.capacity() > tls_buf_->capacity() &&
+      buf_.capacity() <= kMaxRetainedCapacity) {
+    buf_.clear();
+    buf_.swap(*tls_buf_);
+  }
+}
+
+} // namespace kudu
@@ -0,0 +1,95 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/threadlocal.h"
+
+namespace kudu {
+
+// A bounded pool of the heap buffers of faststrings, for code which builds
+// large faststrings over and over, e.g. serialized WAL batches, to reuse
+// buffers of the right size rather than allocate and grow a fresh one each
+// time. Buffers move in and out of the pool with faststring::swap(), so
+// neither acquiring nor releasing a buffer allocates.
+//
+// This class is thread-safe.
+class FaststringPool {
+ public:
+  // Creates a pool of up to 'max_buffers' buffers of up to
+  // 'max_buffer_capacity' bytes each.
+  FaststringPool(size_t max_buffers, size_t max_buffer_capacity);
+  ~FaststringPool();
+
+  // Gives the empty 'buf' the smallest pooled buffer of at least 'capacity'
+  // bytes if there's one, or else the largest, and reserves 'capacity'.
+  void Acquire(size_t capacity, faststring* buf);
+
+  // Clears 'buf' and takes its buffer into the pool if it's on the heap, no
+  // larger than the maximum capacity and the pool isn't full. Otherwise, the
+  // buffer is left to 'buf'.
+  void Release(faststring* buf);
+
+  // Returns the number of buffers in the pool.
+  size_t num_buffers() const;
+
+ private:
+  const size_t max_buffer_capacity_;
+
+  mutable simple_spinlock lock_;
+
+  // The faststrings holding the pooled buffers. Each of them is either
+  // empty, holding no heap buffer, or holds a pooled buffer.
+  std::vector<std::unique_ptr<faststring>> slots_;
+
+  DISALLOW_COPY_AND_ASSIGN(FaststringPool);
+};
+
+// A faststring to use as scratch space within a scope, which reuses the
+// buffer the previous scratch faststring of the thread grew to, rather than
+// allocating its own. Scratch faststrings may nest, in which case the inner
+// ones start out empty.
+//
+// Example:
+//   ScratchFaststring scratch;
+//   RETURN_NOT_OK(ReadEntries(..., scratch.get()));
+class ScratchFaststring {
+ public:
+  // The largest buffer a thread keeps around for its next scratch faststring.
+  static constexpr size_t kMaxRetainedCapacity = 8 * 1024 * 1024;
+
+  ScratchFaststring();
+  ~ScratchFaststring();
+
+  faststring* get() { return &buf_; }
+
+ private:
+  // The buffer the thread keeps for its next scratch faststring.
+  DECLARE_STATIC_THREAD_LOCAL(faststring, tls_buf_);
+
+  faststring buf_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScratchFaststring);
+};
+
+} // namespace kudu
@@ -277,6 +277,29 @@ TYPED_TEST(FileCacheTest, TestInvalidation) {
   ASSERT_EQ(kData2.size(), size);
 }
 
+TYPED_TEST(FileCacheTest, TestEviction) {
+  const string kFile = this->GetTestPath("foo");
+  const string kData = "test data";
+  ASSERT_OK(this->WriteTestFile(kFile, kData));
+
+  shared_ptr<TypeParam> f;
+  ASSERT_OK(this->cache_->OpenExistingFile(kFile, &f));
+  ASSERT_EQ(this->initial_open_fds_ + 1, this->CountOpenFds());
+
+  // Evicting the file closes it, but the descriptor stays usable.
+  this->cache_->Evict(kFile);
+  ASSERT_EQ(this->initial_open_fds_, this->CountOpenFds());
+  uint64_t size;
+  ASSERT_OK(f->Size(&size));
+  ASSERT_EQ(kData.size(), size);
+  ASSERT_EQ(this->initial_open_fds_ + 1, this->CountOpenFds());
+
+  // Evicting a file that isn't open does nothing.
+  this->cache_->Evict(kFile);
+  this->cache_->Evict(this->GetTestPath("bar"));
+  ASSERT_EQ(this->initial_open_fds_, this->CountOpenFds());
+}
+
 
 TYPED_TEST(FileCacheTest, TestHeavyReads) {
   const int kNumFiles = 20;
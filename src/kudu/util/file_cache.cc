@@ -378,6 +378,18 @@ class Descriptor<RandomAccessFile> : public RandomAccessFile {
     return opened.file()->Size(size);
   }
 
+  Status ReadAhead(uint64_t offset, size_t length) const override {
+    ScopedOpenedDescriptor<RandomAccessFile> opened(&base_);
+    RETURN_NOT_OK(ReopenFileIfNecessary(&opened));
+    return opened.file()->ReadAhead(offset, length);
+  }
+
+  Status DropFromPageCache(uint64_t offset, size_t length) const override {
+    ScopedOpenedDescriptor<RandomAccessFile> opened(&base_);
+    RETURN_NOT_OK(ReopenFileIfNecessary(&opened));
+    return opened.file()->DropFromPageCache(offset, length);
+  }
+
   const string& filename() const override {
     return base_.filename();
   }
@@ -458,7 +470,7 @@ FileCache<FileType>::FileCache(const string& cache_name,
     : env_(env),
       cache_name_(cache_name),
       eviction_cb_(new EvictionCallback<FileType>()),
-      cache_(NewLRUCache(DRAM_CACHE, max_open_files, cache_name)),
+      cache_(NewCache(DRAM_CACHE, max_open_files, /*estimated_entry_charge=*/1, cache_name)),
       running_(1) {
   if (entity) {
     cache_->SetMetrics(entity);
@@ -528,6 +540,11 @@ Status FileCache<FileType>::DeleteFile(const string& file_name) {
   return env_->DeleteFile(file_name);
 }
 
+template <class FileType>
+void FileCache<FileType>::Evict(const string& file_name) {
+  cache_->Erase(file_name);
+}
+
 template <class FileType>
 void FileCache<FileType>::Invalidate(const string& file_name) {
   // Ensure that there is an invalidated descriptor in the map for this filename.
@@ -153,6 +153,14 @@ class FileCache {
   // from multiple threads.
   void Invalidate(const std::string& file_name);
 
+  // Closes the open file for 'file_name', if the cache holds one. Unlike
+  // Invalidate(), outstanding descriptors remain usable, and reopen the file
+  // on their next use.
+  //
+  // Meant for files which are about to be deleted or rewritten outside of the
+  // cache, so that the cache doesn't keep their data alive.
+  void Evict(const std::string& file_name);
+
   // Returns the number of entries in the descriptor map.
   //
   // Only intended for unit tests.
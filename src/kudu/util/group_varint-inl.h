@@ -203,9 +203,20 @@ inline const uint8_t *DecodeGroupVarInt32_SSE_Add(
 }
 
 
-// Append a set of group-varint encoded integers to the given faststring.
-inline void AppendGroupVarInt32(
-  faststring *s,
+// Returns the number of bytes which group-varint encoding the given integers
+// takes, including the tag byte.
+inline size_t CalcGroupVarInt32Size(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  return 1 + CalcRequiredBytes32(a) + CalcRequiredBytes32(b) +
+      CalcRequiredBytes32(c) + CalcRequiredBytes32(d);
+}
+
+// Encode a set of group-varint encoded integers to 'dst', which must have 3
+// bytes of room beyond the encoded integers: they are written with 4-byte
+// stores. The bytes past the encoded integers are garbage.
+//
+// Returns a pointer following the last encoded integer.
+inline uint8_t *EncodeGroupVarInt32(
+  uint8_t *dst,
   uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
 
   uint8_t a_tag = CalcRequiredBytes32(a) - 1;
@@ -219,12 +230,28 @@ inline void AppendGroupVarInt32(
     (c_tag << 2) |
     (d_tag);
 
-  uint8_t size = 1 +
-    a_tag + 1 +
-    b_tag + 1 +
-    c_tag + 1 +
-    d_tag + 1;
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+#error dont support big endian currently
+#endif
+
+  *dst++ = prefix_byte;
+  memcpy(dst, &a, 4);
+  dst += a_tag + 1;
+  memcpy(dst, &b, 4);
+  dst += b_tag + 1;
+  memcpy(dst, &c, 4);
+  dst += c_tag + 1;
+  memcpy(dst, &d, 4);
+  dst += d_tag + 1;
+  return dst;
+}
+
+// Append a set of group-varint encoded integers to the given faststring.
+inline void AppendGroupVarInt32(
+  faststring *s,
+  uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
 
+  size_t size = CalcGroupVarInt32Size(a, b, c, d);
   size_t old_size = s->size();
 
   // Reserving 4 extra bytes means we can use simple
@@ -232,21 +259,7 @@ inline void AppendGroupVarInt32(
   // if we hang off the end of the array into the "empty" area, it's OK.
   // We'll chop it back off down below.
   s->resize(old_size + size + 4);
-  uint8_t *ptr = &((*s)[old_size]);
-
-#if __BYTE_ORDER != __LITTLE_ENDIAN
-#error dont support big endian currently
-#endif
-
-  *ptr++ = prefix_byte;
-  memcpy(ptr, &a, 4);
-  ptr += a_tag + 1;
-  memcpy(ptr, &b, 4);
-  ptr += b_tag + 1;
-  memcpy(ptr, &c, 4);
-  ptr += c_tag + 1;
-  memcpy(ptr, &d, 4);
-
+  EncodeGroupVarInt32(&((*s)[old_size]), a, b, c, d);
   s->resize(old_size + size);
 }
 
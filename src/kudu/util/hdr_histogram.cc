@@ -26,6 +26,8 @@
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 
@@ -35,6 +37,7 @@
 #include "kudu/gutil/bits.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/status.h"
+#include "kudu/util/threadlocal.h"
 
 using base::subtle::Atomic64;
 using base::subtle::NoBarrier_AtomicIncrement;
@@ -334,6 +337,257 @@ void HdrHistogram::ResetHistogram(){
   counts_.reset(new Atomic64[counts_array_length_]());
 }
 
+///////////////////////////////////////////////////////////////////////
+// HdrHistogramRecorder
+///////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Hands out the slots of the recorders in the lists of counts of the threads.
+struct RecorderSlots {
+  // Also protects ThreadCounts::recorder, and is held by the threads which
+  // exit, so that they don't flush into a recorder being destroyed.
+  simple_spinlock lock;
+  int next_slot = 0;
+  std::vector<int> free_slots;
+};
+
+RecorderSlots* GetRecorderSlots() {
+  // Leaked, since threads may exit after static destructors ran.
+  static RecorderSlots* slots = new RecorderSlots;
+  return slots;
+}
+
+} // anonymous namespace
+
+// The counts which a thread recorded into a recorder.
+struct HdrHistogramRecorder::ThreadCounts {
+  typedef std::atomic<uint64_t> Count;
+
+  ThreadCounts(HdrHistogramRecorder* r, int num_chunks)
+      : recorder(r),
+        total_count(0),
+        total_sum(0),
+        min_value(std::numeric_limits<uint64_t>::max()),
+        max_value(0),
+        chunks(new std::atomic<Count*>[num_chunks]()),
+        flushed_count(0),
+        flushed_sum(0),
+        flushed_chunks(new std::unique_ptr<uint64_t[]>[num_chunks]) {
+  }
+
+  ~ThreadCounts() {
+    FreeChunks(recorder == nullptr ? 0 : recorder.load()->num_chunks_);
+  }
+
+  void FreeChunks(int num_chunks) {
+    for (int i = 0; i < num_chunks; i++) {
+      delete[] chunks[i].load();
+      chunks[i] = nullptr;
+    }
+  }
+
+  // nullptr once the recorder was destroyed.
+  std::atomic<HdrHistogramRecorder*> recorder;
+
+  // Written only by the recording thread, which stores rather than adds, and
+  // read by flushes. The chunks are allocated as they're first recorded into.
+  Count total_count;
+  Count total_sum;
+  Count min_value;
+  Count max_value;
+  std::unique_ptr<std::atomic<Count*>[]> chunks;
+
+  // What the previous flush added to the histogram, protected by the lock of
+  // the recorder.
+  uint64_t flushed_count;
+  uint64_t flushed_sum;
+  std::unique_ptr<std::unique_ptr<uint64_t[]>[]> flushed_chunks;
+} CACHELINE_ALIGNED;
+
+// The counts of a thread, indexed by the slots of the recorders. Flushed and
+// freed when the thread exits.
+struct HdrHistogramRecorder::ThreadCountsList {
+  ~ThreadCountsList() {
+    RecorderSlots* slots = GetRecorderSlots();
+    std::lock_guard<simple_spinlock> l(slots->lock);
+    for (ThreadCounts* tc : counts) {
+      if (tc == nullptr) continue;
+      HdrHistogramRecorder* r = tc->recorder;
+      if (r != nullptr) {
+        std::lock_guard<simple_spinlock> rl(r->lock_);
+        r->FlushThread(tc);
+        r->threads_.erase(std::find(r->threads_.begin(), r->threads_.end(), tc));
+      }
+      delete tc;
+    }
+  }
+
+  std::vector<ThreadCounts*> counts;
+};
+
+DEFINE_STATIC_THREAD_LOCAL(HdrHistogramRecorder::ThreadCountsList, HdrHistogramRecorder,
+                           tls_counts_);
+
+HdrHistogramRecorder::HdrHistogramRecorder(HdrHistogram* histogram)
+    : histogram_(CHECK_NOTNULL(histogram)),
+      chunk_magnitude_(histogram->sub_bucket_half_count_magnitude_),
+      num_chunks_(histogram->counts_array_length_ >> chunk_magnitude_),
+      slot_([] {
+        RecorderSlots* slots = GetRecorderSlots();
+        std::lock_guard<simple_spinlock> l(slots->lock);
+        if (slots->free_slots.empty()) {
+          return slots->next_slot++;
+        }
+        int slot = slots->free_slots.back();
+        slots->free_slots.pop_back();
+        return slot;
+      }()) {
+}
+
+HdrHistogramRecorder::~HdrHistogramRecorder() {
+  RecorderSlots* slots = GetRecorderSlots();
+  std::lock_guard<simple_spinlock> l(slots->lock);
+  std::lock_guard<simple_spinlock> rl(lock_);
+  // The threads free what's left of their counts when they exit, or when
+  // another recorder takes the slot.
+  for (ThreadCounts* tc : threads_) {
+    tc->FreeChunks(num_chunks_);
+    tc->recorder = nullptr;
+  }
+  slots->free_slots.push_back(slot_);
+}
+
+void HdrHistogramRecorder::IncrementBy(int64_t value, int64_t count) {
+  DCHECK_GE(value, 0);
+  DCHECK_GE(count, 0);
+  ThreadCounts* tc = nullptr;
+  if (PREDICT_TRUE(tls_counts_ != nullptr && static_cast<size_t>(slot_) < tls_counts_->counts.size())) {
+    tc = tls_counts_->counts[slot_];
+  }
+  if (PREDICT_FALSE(tc == nullptr ||
+                    tc->recorder.load(std::memory_order_relaxed) != this)) {
+    tc = RegisterThread();
+  }
+
+  const int bucket_index = histogram_->BucketIndex(value);
+  const int sub_bucket_index = histogram_->SubBucketIndex(value, bucket_index);
+  const int index = histogram_->CountsArrayIndex(bucket_index, sub_bucket_index);
+  std::atomic<ThreadCounts::Count*>& chunk = tc->chunks[index >> chunk_magnitude_];
+  ThreadCounts::Count* counts = chunk.load(std::memory_order_relaxed);
+  if (PREDICT_FALSE(counts == nullptr)) {
+    counts = new ThreadCounts::Count[1 << chunk_magnitude_]();
+    chunk.store(counts, std::memory_order_release);
+  }
+
+  // Only this thread writes its counts, so they need no atomic additions.
+  ThreadCounts::Count& c = counts[index & ((1 << chunk_magnitude_) - 1)];
+  c.store(c.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+  tc->total_sum.store(tc->total_sum.load(std::memory_order_relaxed) + value * count,
+                      std::memory_order_relaxed);
+  if (PREDICT_FALSE(value < tc->min_value.load(std::memory_order_relaxed))) {
+    tc->min_value.store(value, std::memory_order_relaxed);
+  }
+  if (PREDICT_FALSE(value > tc->max_value.load(std::memory_order_relaxed))) {
+    tc->max_value.store(value, std::memory_order_relaxed);
+  }
+  // The total count goes last, so that a flush which sees it also sees the
+  // rest of what was recorded.
+  tc->total_count.store(tc->total_count.load(std::memory_order_relaxed) + count,
+                        std::memory_order_release);
+}
+
+HdrHistogramRecorder::ThreadCounts* HdrHistogramRecorder::RegisterThread() {
+  INIT_STATIC_THREAD_LOCAL(ThreadCountsList, tls_counts_);
+
+  RecorderSlots* slots = GetRecorderSlots();
+  std::lock_guard<simple_spinlock> l(slots->lock);
+  std::vector<ThreadCounts*>& counts = tls_counts_->counts;
+  if (counts.size() <= static_cast<size_t>(slot_)) {
+    counts.resize(slot_ + 1, nullptr);
+  }
+  // Counts left in the slot belong to a recorder which was destroyed.
+  delete counts[slot_];
+  ThreadCounts* tc = new ThreadCounts(this, num_chunks_);
+  counts[slot_] = tc;
+  std::lock_guard<simple_spinlock> rl(lock_);
+  threads_.push_back(tc);
+  return tc;
+}
+
+void HdrHistogramRecorder::Flush() {
+  std::lock_guard<simple_spinlock> l(lock_);
+  for (ThreadCounts* tc : threads_) {
+    FlushThread(tc);
+  }
+}
+
+void HdrHistogramRecorder::FlushThread(ThreadCounts* tc) {
+  const uint64_t total_count = tc->total_count.load(std::memory_order_acquire);
+  if (total_count == tc->flushed_count) {
+    return;
+  }
+  // Look at the counts first, which may be ahead of the totals if the thread
+  // is recording; the totals are made to agree with them.
+  const int chunk_size = 1 << chunk_magnitude_;
+  shared_lock<rw_spinlock> hist_lock(histogram_->histogram_mutex_);
+  uint64_t added_count = 0;
+  int lowest_index = -1;
+  int highest_index = -1;
+  for (int i = 0; i < num_chunks_; i++) {
+    ThreadCounts::Count* counts = tc->chunks[i].load(std::memory_order_acquire);
+    if (counts == nullptr) continue;
+    std::unique_ptr<uint64_t[]>& flushed = tc->flushed_chunks[i];
+    if (!flushed) {
+      flushed.reset(new uint64_t[chunk_size]());
+    }
+    for (int j = 0; j < chunk_size; j++) {
+      const uint64_t count = counts[j].load(std::memory_order_relaxed);
+      if (count == flushed[j]) continue;
+      const int index = (i << chunk_magnitude_) + j;
+      NoBarrier_AtomicIncrement(&histogram_->counts_[index], count - flushed[j]);
+      added_count += count - flushed[j];
+      flushed[j] = count;
+      if (lowest_index == -1) lowest_index = index;
+      highest_index = index;
+    }
+  }
+  if (added_count == 0) {
+    return;
+  }
+  const uint64_t total_sum = tc->total_sum.load(std::memory_order_relaxed);
+  NoBarrier_AtomicIncrement(&histogram_->total_count_, added_count);
+  NoBarrier_AtomicIncrement(&histogram_->total_sum_, total_sum - tc->flushed_sum);
+  tc->flushed_count += added_count;
+  tc->flushed_sum = total_sum;
+
+  // The thread's min and max may predate a reset of the histogram, but the
+  // values just added lie within the buckets between the lowest and highest
+  // ones added to.
+  auto value_at = [this, chunk_size](int index) {
+    const int bucket_index = std::max(0, (index >> chunk_magnitude_) - 1);
+    const int sub_bucket_index = index - ((bucket_index + 1) << chunk_magnitude_) + chunk_size;
+    return HdrHistogram::ValueFromIndex(bucket_index, sub_bucket_index);
+  };
+  const Atomic64 min = std::max(tc->min_value.load(std::memory_order_relaxed),
+                                histogram_->LowestEquivalentValue(value_at(lowest_index)));
+  // Values past the highest trackable value are counted in its bucket, but
+  // the max is exact.
+  Atomic64 max = tc->max_value.load(std::memory_order_relaxed);
+  const uint64_t highest_value = value_at(highest_index);
+  if (!histogram_->ValuesAreEquivalent(highest_value, histogram_->highest_trackable_value_)) {
+    max = std::min<Atomic64>(max, histogram_->HighestEquivalentValue(highest_value));
+  }
+  Atomic64 min_val;
+  while (min < (min_val = NoBarrier_Load(&histogram_->min_value_))) {
+    if (NoBarrier_CompareAndSwap(&histogram_->min_value_, min_val, min) == min_val) break;
+  }
+  Atomic64 max_val;
+  while (max > (max_val = NoBarrier_Load(&histogram_->max_value_))) {
+    if (NoBarrier_CompareAndSwap(&histogram_->max_value_, max_val, max) == max_val) break;
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////
 // AbstractHistogramIterator
 ///////////////////////////////////////////////////////////////////////
@@ -50,11 +50,15 @@
 
 #include <stdint.h>
 
+#include <atomic>
+#include <vector>
+
 #include "kudu/gutil/atomicops.h"
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/port.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/threadlocal.h"
 
 namespace kudu {
 
@@ -173,6 +177,7 @@ class HdrHistogram {
 
  private:
   friend class AbstractHistogramIterator;
+  friend class HdrHistogramRecorder;
 
   static const uint64_t kMinHighestTrackableValue = 2;
   static const int kMinValidNumSignificantDigits = 1;
@@ -203,6 +208,64 @@ class HdrHistogram {
   HdrHistogram& operator=(const HdrHistogram& other); // Disable assignment operator.
 };
 
+// Records values for an HdrHistogram without shared writes, in the spirit of
+// the Recorder of the Java HdrHistogram: each thread records into counts of
+// its own, and Flush() adds what the threads recorded since the previous
+// flush to the histogram. HdrHistogram::Increment() instead makes every
+// recording thread write the same counts, totals and lock, which bounces
+// their cache lines between the cores of hot histograms.
+//
+// The counts of a thread are allocated one magnitude bucket at a time, as the
+// thread first records into it, and are flushed when the thread exits.
+//
+// The min and max which a flush adds to the histogram are exact, unless the
+// histogram was reset since the thread recorded its min or max, in which case
+// they are within the precision of the histogram.
+//
+// This class is thread-safe, but must outlive the threads recording into it,
+// and the histogram must outlive it.
+class HdrHistogramRecorder {
+ public:
+  explicit HdrHistogramRecorder(HdrHistogram* histogram);
+  ~HdrHistogramRecorder();
+
+  void Increment(int64_t value) { IncrementBy(value, 1); }
+  void IncrementBy(int64_t value, int64_t count);
+
+  // Adds the values recorded since the previous flush to the histogram.
+  void Flush();
+
+ private:
+  struct ThreadCounts;
+  struct ThreadCountsList;
+
+  // Returns the counts of the calling thread, creating them if needed.
+  ThreadCounts* RegisterThread();
+
+  // Adds to the histogram what 'tc' recorded since it was last flushed.
+  // Requires 'lock_'.
+  void FlushThread(ThreadCounts* tc);
+
+  // The counts of the calling thread, indexed by the slots of the recorders.
+  DECLARE_STATIC_THREAD_LOCAL(ThreadCountsList, tls_counts_);
+
+  HdrHistogram* const histogram_;
+
+  // The counts of a thread are allocated in chunks of the counts of a
+  // magnitude bucket of the histogram, of 2^chunk_magnitude_ counts.
+  const int chunk_magnitude_;
+  const int num_chunks_;
+
+  // The index of the counts of this recorder in each thread's list.
+  const int slot_;
+
+  // Protects 'threads_' and the flush state of their counts.
+  simple_spinlock lock_;
+  std::vector<ThreadCounts*> threads_;
+
+  DISALLOW_COPY_AND_ASSIGN(HdrHistogramRecorder);
+};
+
 // Value returned from iterators.
 struct HistogramIterationValue {
   HistogramIterationValue()
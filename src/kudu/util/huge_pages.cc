@@ -0,0 +1,112 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/huge_pages.h"
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/util/flag_tags.h"
+
+DEFINE_string(buffer_huge_pages, "none",
+              "Whether the large buffers of RPC transfers, WAL batches and log "
+              "cache compression are mapped on huge pages, to reduce TLB misses: "
+              "'none', 'thp' for transparent huge pages, requested with "
+              "madvise(), or 'hugetlb' for the huge pages reserved in "
+              "/proc/sys/vm/nr_hugepages, falling back to 'thp' once they run out.");
+TAG_FLAG(buffer_huge_pages, experimental);
+TAG_FLAG(buffer_huge_pages, runtime);
+DEFINE_validator(buffer_huge_pages, [](const char* /*n*/, const std::string& v) {
+  return v == "none" || v == "thp" || v == "hugetlb";
+});
+
+namespace kudu {
+
+const size_t kHugePageSize = 2 * 1024 * 1024;
+
+namespace {
+
+std::atomic<int64_t> huge_page_buffer_bytes(0);
+
+size_t RoundUpToHugePage(size_t size) {
+  return (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+
+} // anonymous namespace
+
+bool UseHugePageBuffer(size_t size) {
+  return size >= kHugePageSize && FLAGS_buffer_huge_pages != "none";
+}
+
+uint8_t* AllocateHugePageBuffer(size_t* size) {
+  const size_t rounded = RoundUpToHugePage(*size);
+#if defined(MAP_HUGETLB)
+  if (FLAGS_buffer_huge_pages == "hugetlb") {
+    void* p = mmap(nullptr, rounded, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      *size = rounded;
+      huge_page_buffer_bytes += rounded;
+      return static_cast<uint8_t*>(p);
+    }
+  }
+#endif
+
+  // Transparent huge pages only back the huge-page-aligned parts of a
+  // mapping, so map an extra huge page and trim the mapping to alignment.
+  const size_t mapped = rounded + kHugePageSize;
+  void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    PLOG(WARNING) << "Unable to map a buffer of " << rounded << " bytes";
+    return nullptr;
+  }
+  uintptr_t start = reinterpret_cast<uintptr_t>(p);
+  uintptr_t aligned = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  if (aligned > start) {
+    munmap(p, aligned - start);
+  }
+  if (start + mapped > aligned + rounded) {
+    munmap(reinterpret_cast<void*>(aligned + rounded), start + mapped - aligned - rounded);
+  }
+#if defined(MADV_HUGEPAGE)
+  // Failing just leaves the buffer on regular pages.
+  madvise(reinterpret_cast<void*>(aligned), rounded, MADV_HUGEPAGE);
+#endif
+  *size = rounded;
+  huge_page_buffer_bytes += rounded;
+  return reinterpret_cast<uint8_t*>(aligned);
+}
+
+void FreeHugePageBuffer(uint8_t* data, size_t size) {
+  DCHECK_EQ(0, size % kHugePageSize);
+  if (munmap(data, size) != 0) {
+    PLOG(DFATAL) << "Unable to unmap a buffer of " << size << " bytes";
+  }
+  huge_page_buffer_bytes -= size;
+}
+
+int64_t HugePageBufferBytes() {
+  return huge_page_buffer_bytes.load(std::memory_order_relaxed);
+}
+
+} // namespace kudu
@@ -0,0 +1,49 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kudu {
+
+// Large buffers which are iterated over or copied in bulk, such as those of
+// RPC transfers and WAL batches, can be mapped on huge pages, per
+// --buffer_huge_pages, so that going through them takes fewer TLB misses.
+// Buffers smaller than kHugePageSize are never mapped on huge pages.
+
+// The size of a huge page, which huge page buffers are sized and aligned to.
+extern const size_t kHugePageSize;
+
+// Returns whether a buffer of 'size' bytes should be allocated with
+// AllocateHugePageBuffer().
+bool UseHugePageBuffer(size_t size);
+
+// Maps a buffer of at least '*size' bytes on huge pages, setting '*size' to
+// its actual size, a multiple of kHugePageSize. Falls back to transparent huge
+// pages, and then to regular pages, if the pages of --buffer_huge_pages can't
+// be had. Returns nullptr if no memory could be mapped.
+uint8_t* AllocateHugePageBuffer(size_t* size);
+
+// Unmaps 'data', a buffer of 'size' bytes returned by AllocateHugePageBuffer().
+void FreeHugePageBuffer(uint8_t* data, size_t size);
+
+// Returns the number of bytes currently mapped by AllocateHugePageBuffer(),
+// so that benchmarks can tell how much of their buffers it backed.
+int64_t HugePageBufferBytes();
+
+} // namespace kudu
@@ -0,0 +1,84 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "kudu/util/io_class.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <thread>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/test_util.h"
+
+DECLARE_bool(enable_io_classes);
+
+namespace kudu {
+
+class IOClassTest : public KuduTest {
+ protected:
+  // Returns the I/O priority of the calling thread, as the kernel reports it.
+  static int GetIOPrio() {
+#if defined(__linux__)
+    return syscall(SYS_ioprio_get, 1 /* IOPRIO_WHO_PROCESS */, 0);
+#else
+    return 0;
+#endif
+  }
+};
+
+TEST_F(IOClassTest, TestScopesNestAndRestore) {
+  FLAGS_enable_io_classes = true;
+  // Run in a thread of its own, so as not to change this one's priority.
+  std::thread t([]() {
+    const int initial_prio = GetIOPrio();
+    ASSERT_EQ(IOClass::kDefault, GetThreadIOClass());
+    {
+      ScopedIOClass bg(IOClass::kBackground);
+      ASSERT_EQ(IOClass::kBackground, GetThreadIOClass());
+      const int bg_prio = GetIOPrio();
+      {
+        ScopedIOClass idle(IOClass::kIdle);
+        ASSERT_EQ(IOClass::kIdle, GetThreadIOClass());
+        {
+          // Setting the same class again changes nothing.
+          ScopedIOClass idle_again(IOClass::kIdle);
+          ASSERT_EQ(IOClass::kIdle, GetThreadIOClass());
+        }
+        ASSERT_EQ(IOClass::kIdle, GetThreadIOClass());
+      }
+      ASSERT_EQ(IOClass::kBackground, GetThreadIOClass());
+      ASSERT_EQ(bg_prio, GetIOPrio());
+    }
+    ASSERT_EQ(IOClass::kDefault, GetThreadIOClass());
+    ASSERT_EQ(initial_prio, GetIOPrio());
+  });
+  t.join();
+}
+
+TEST_F(IOClassTest, TestDisabled) {
+  FLAGS_enable_io_classes = false;
+  ScopedIOClass bg(IOClass::kBackground);
+  ASSERT_EQ(IOClass::kDefault, GetThreadIOClass());
+}
+
+} // namespace kudu
@@ -0,0 +1,119 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "kudu/util/io_class.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <ostream>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/util/errno.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
+
+DEFINE_bool(enable_io_classes, false,
+            "Whether to give the threads doing foreground WAL appends a higher I/O "
+            "priority than the ones doing background I/O, such as WAL catch-up reads, "
+            "segment preallocation and GC, so that append latency holds up while peers "
+            "catch up. Only has an effect with an I/O scheduler which supports I/O "
+            "priorities.");
+TAG_FLAG(enable_io_classes, experimental);
+TAG_FLAG(enable_io_classes, runtime);
+
+namespace kudu {
+
+namespace {
+
+// The class the calling thread's I/O priority was last set to.
+__thread IOClass g_thread_io_class = IOClass::kDefault;
+
+#if defined(__linux__)
+// From linux/ioprio.h, which isn't exported to userspace on older systems.
+constexpr int kIOPrioClassShift = 13;
+constexpr int kIOPrioClassNone = 0;
+constexpr int kIOPrioClassBestEffort = 2;
+constexpr int kIOPrioClassIdle = 3;
+constexpr int kIOPrioWhoProcess = 1;
+
+int IOPrioValue(IOClass io_class) {
+  switch (io_class) {
+    case IOClass::kDefault: return kIOPrioClassNone << kIOPrioClassShift;
+    case IOClass::kForeground: return (kIOPrioClassBestEffort << kIOPrioClassShift) | 0;
+    case IOClass::kBackground: return (kIOPrioClassBestEffort << kIOPrioClassShift) | 7;
+    case IOClass::kIdle: return kIOPrioClassIdle << kIOPrioClassShift;
+  }
+  LOG(FATAL) << "unknown I/O class";
+  return 0;
+}
+#endif
+
+void SetThreadIOClass(IOClass io_class) {
+  if (io_class == g_thread_io_class) {
+    return;
+  }
+#if defined(__linux__)
+  // With IOPRIO_WHO_PROCESS, 0 stands for the calling thread.
+  if (syscall(SYS_ioprio_set, kIOPrioWhoProcess, 0, IOPrioValue(io_class)) != 0) {
+    int err = errno;
+    KLOG_FIRST_N(WARNING, 1) << "Unable to set the I/O class of a thread to "
+                             << IOClassToString(io_class) << ": " << ErrnoToString(err);
+    return;
+  }
+#endif
+  g_thread_io_class = io_class;
+}
+
+} // anonymous namespace
+
+const char* IOClassToString(IOClass io_class) {
+  switch (io_class) {
+    case IOClass::kDefault: return "default";
+    case IOClass::kForeground: return "foreground";
+    case IOClass::kBackground: return "background";
+    case IOClass::kIdle: return "idle";
+  }
+  LOG(FATAL) << "unknown I/O class";
+  return "";
+}
+
+IOClass GetThreadIOClass() {
+  return g_thread_io_class;
+}
+
+ScopedIOClass::ScopedIOClass(IOClass io_class)
+    : active_(FLAGS_enable_io_classes),
+      prev_(g_thread_io_class) {
+  if (active_) {
+    SetThreadIOClass(io_class);
+  }
+}
+
+ScopedIOClass::~ScopedIOClass() {
+  if (active_) {
+    SetThreadIOClass(prev_);
+  }
+}
+
+} // namespace kudu
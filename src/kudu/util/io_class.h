@@ -0,0 +1,76 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include "kudu/gutil/macros.h"
+
+namespace kudu {
+
+// The classes of I/O which the server tells apart, so that the kernel's I/O
+// scheduler can serve foreground WAL appends ahead of background work such as
+// catch-up reads, segment preallocation and GC.
+//
+// On Linux, I/O priorities are a property of the thread issuing the I/O, so
+// a class is given to the threads (or stretches of work) doing a kind of I/O,
+// rather than to files. They only have an effect with --enable_io_classes,
+// and with an I/O scheduler which honors them, e.g. BFQ, or mq-deadline on
+// recent kernels.
+enum class IOClass {
+  // No priority of its own: the kernel derives one from the thread's CPU
+  // priority.
+  kDefault,
+  // Latency-sensitive I/O on the write path, e.g. WAL appends and syncs.
+  kForeground,
+  // I/O which may be delayed for the foreground, e.g. WAL catch-up reads and
+  // segment preallocation.
+  kBackground,
+  // I/O which only gets the device when nothing else uses it, e.g. the
+  // reclamation of GC'd segments.
+  kIdle,
+};
+
+const char* IOClassToString(IOClass io_class);
+
+// Returns the class of the I/O issued by the calling thread.
+IOClass GetThreadIOClass();
+
+// Gives the I/O issued by the calling thread 'io_class' for the lifetime of
+// the object, restoring the class it had before once destroyed. Setting the
+// class the thread already has doesn't issue a system call, so these may be
+// placed around short, hot stretches of work.
+//
+// Example:
+//   {
+//     ScopedIOClass io(IOClass::kBackground);
+//     RETURN_NOT_OK(file->PreAllocate(...));
+//   }
+class ScopedIOClass {
+ public:
+  explicit ScopedIOClass(IOClass io_class);
+  ~ScopedIOClass();
+
+ private:
+  // Whether the class was changed, i.e. whether --enable_io_classes was set
+  // when the object was constructed.
+  const bool active_;
+  const IOClass prev_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedIOClass);
+};
+
+} // namespace kudu
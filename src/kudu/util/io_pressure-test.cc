@@ -0,0 +1,100 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/io_pressure.h"
+
+#include <cstdint>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+METRIC_DEFINE_entity(test_entity);
+METRIC_DEFINE_histogram(test_entity, test_write_latency, "Test Write Latency",
+                        kudu::MetricUnit::kMicroseconds, "", 60000000LU, 2);
+
+using std::string;
+
+namespace kudu {
+
+class IOPressureMonitorTest : public KuduTest {};
+
+TEST_F(IOPressureMonitorTest, TestParseDiskStatsIOTicks) {
+  const string kDiskStats =
+      "   8       0 sda 100 0 200 30 40 0 50 60 0 1234 90\n"
+      " 259       0 nvme0n1 1 2 3 4 5 6 7 8 9 5678 11 0 0 0 0\n"
+      "   8       1 sda1 1 2 3 4\n";
+  int64_t io_ticks_ms;
+  ASSERT_OK(IOPressureMonitor::ParseDiskStatsIOTicks(kDiskStats, "sda", &io_ticks_ms));
+  ASSERT_EQ(1234, io_ticks_ms);
+  ASSERT_OK(IOPressureMonitor::ParseDiskStatsIOTicks(kDiskStats, "nvme0n1", &io_ticks_ms));
+  ASSERT_EQ(5678, io_ticks_ms);
+  // Too few fields.
+  ASSERT_TRUE(IOPressureMonitor::ParseDiskStatsIOTicks(
+      kDiskStats, "sda1", &io_ticks_ms).IsNotFound());
+  ASSERT_TRUE(IOPressureMonitor::ParseDiskStatsIOTicks(
+      kDiskStats, "sdb", &io_ticks_ms).IsNotFound());
+  ASSERT_TRUE(IOPressureMonitor::ParseDiskStatsIOTicks(
+      "   8       0 sda 1 2 3 4 5 6 7 8 9 x 11\n", "sda", &io_ticks_ms).IsCorruption());
+}
+
+// Test that each latency sample only covers what was recorded since the
+// previous one.
+TEST_F(IOPressureMonitorTest, TestLatencyWindow) {
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity = METRIC_ENTITY_test_entity.Instantiate(&registry, "test");
+  scoped_refptr<Histogram> hist = METRIC_test_write_latency.Instantiate(entity);
+
+  IOPressureMonitor monitor;
+  ASSERT_EQ(-1, monitor.LatencyAtPercentile(99));
+  monitor.set_latency_histogram(hist);
+
+  for (int i = 0; i < 100; i++) {
+    hist->Increment(10000);
+  }
+  monitor.Sample(MonoTime::Now());
+  ASSERT_NEAR(10000, monitor.LatencyAtPercentile(99), 100);
+
+  // Nothing was recorded since.
+  monitor.Sample(MonoTime::Now());
+  ASSERT_EQ(-1, monitor.LatencyAtPercentile(99));
+
+  for (int i = 0; i < 100; i++) {
+    hist->Increment(100);
+  }
+  monitor.Sample(MonoTime::Now());
+  ASSERT_NEAR(100, monitor.LatencyAtPercentile(99), 1);
+}
+
+// Test sampling the utilization of a device, if this machine has any.
+TEST_F(IOPressureMonitorTest, TestDeviceUtilization) {
+  IOPressureMonitor monitor;
+  monitor.set_devices({ "no-such-device" });
+  monitor.Sample(MonoTime::Now());
+  SleepFor(MonoDelta::FromMilliseconds(10));
+  monitor.Sample(MonoTime::Now());
+  ASSERT_EQ(-1, monitor.max_device_utilization_pct());
+  ASSERT_TRUE(monitor.busiest_device().empty());
+}
+
+} // namespace kudu
@@ -0,0 +1,158 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/io_pressure.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/strings/numbers.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/metrics.h"
+
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+
+namespace {
+
+// The index of the "io_ticks" field of a line of /proc/diskstats, counting
+// the major and minor numbers and the device name.
+constexpr int kDiskStatsIOTicksField = 12;
+
+} // anonymous namespace
+
+IOPressureMonitor::IOPressureMonitor()
+    : max_device_utilization_pct_(-1) {
+}
+
+IOPressureMonitor::~IOPressureMonitor() {
+}
+
+void IOPressureMonitor::set_latency_histogram(scoped_refptr<Histogram> histogram) {
+  latency_histogram_ = std::move(histogram);
+  last_latency_.reset();
+  window_latency_.reset();
+}
+
+void IOPressureMonitor::set_devices(vector<string> devices) {
+  devices_ = std::move(devices);
+  last_io_ticks_ms_.assign(devices_.size(), -1);
+  max_device_utilization_pct_ = -1;
+  busiest_device_.clear();
+}
+
+void IOPressureMonitor::Sample(MonoTime now) {
+  SampleLatency();
+  SampleDevices(now);
+  last_sample_time_ = now;
+}
+
+void IOPressureMonitor::SampleLatency() {
+  if (!latency_histogram_) {
+    return;
+  }
+  std::unique_ptr<HdrHistogram> current(new HdrHistogram(*latency_histogram_->histogram()));
+  std::unique_ptr<HdrHistogram> window;
+  if (!last_latency_) {
+    // The first sample covers everything recorded so far.
+    window.reset(new HdrHistogram(*current));
+  } else {
+    window.reset(new HdrHistogram(current->highest_trackable_value(),
+                                  current->num_significant_digits()));
+    RecordedValuesIterator iter(current.get());
+    while (iter.HasNext()) {
+      HistogramIterationValue value;
+      CHECK_OK(iter.Next(&value));
+      const uint64_t before = last_latency_->CountInBucketForValue(value.value_iterated_to);
+      if (value.count_at_value_iterated_to > before) {
+        window->IncrementBy(value.value_iterated_to,
+                            value.count_at_value_iterated_to - before);
+      }
+    }
+  }
+  last_latency_ = std::move(current);
+  window_latency_ = std::move(window);
+}
+
+void IOPressureMonitor::SampleDevices(MonoTime now) {
+  if (devices_.empty()) {
+    return;
+  }
+  faststring diskstats;
+  Status s = ReadFileToString(Env::Default(), "/proc/diskstats", &diskstats);
+  if (!s.ok()) {
+    KLOG_FIRST_N(WARNING, 1) << "Unable to sample device utilization: " << s.ToString();
+    return;
+  }
+  const string contents = diskstats.ToString();
+  const double elapsed_ms = last_sample_time_.Initialized() ?
+      (now - last_sample_time_).ToMilliseconds() : 0;
+  max_device_utilization_pct_ = -1;
+  busiest_device_.clear();
+  for (int i = 0; i < devices_.size(); i++) {
+    int64_t io_ticks_ms;
+    if (!ParseDiskStatsIOTicks(contents, devices_[i], &io_ticks_ms).ok()) {
+      last_io_ticks_ms_[i] = -1;
+      continue;
+    }
+    if (last_io_ticks_ms_[i] >= 0 && elapsed_ms > 0) {
+      double pct = std::min(100.0, 100.0 * (io_ticks_ms - last_io_ticks_ms_[i]) / elapsed_ms);
+      if (pct > max_device_utilization_pct_) {
+        max_device_utilization_pct_ = pct;
+        busiest_device_ = devices_[i];
+      }
+    }
+    last_io_ticks_ms_[i] = io_ticks_ms;
+  }
+}
+
+int64_t IOPressureMonitor::LatencyAtPercentile(double percentile) const {
+  if (!window_latency_ || window_latency_->TotalCount() == 0) {
+    return -1;
+  }
+  return window_latency_->ValueAtPercentile(percentile);
+}
+
+Status IOPressureMonitor::ParseDiskStatsIOTicks(const string& diskstats,
+                                                const string& device,
+                                                int64_t* io_ticks_ms) {
+  for (StringPiece line : strings::Split(diskstats, "\n", strings::SkipEmpty())) {
+    vector<StringPiece> fields = strings::Split(line, " ", strings::SkipEmpty());
+    if (fields.size() <= kDiskStatsIOTicksField || fields[2] != device) {
+      continue;
+    }
+    if (!safe_strto64(fields[kDiskStatsIOTicksField].data(),
+                      fields[kDiskStatsIOTicksField].size(), io_ticks_ms)) {
+      return Status::Corruption(Substitute("unable to parse the I/O ticks of $0", device),
+                                line.ToString());
+    }
+    return Status::OK();
+  }
+  return Status::NotFound("no such device in /proc/diskstats", device);
+}
+
+} // namespace kudu
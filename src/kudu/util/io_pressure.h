@@ -0,0 +1,101 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class HdrHistogram;
+class Histogram;
+
+// Samples signals of how loaded the foreground I/O path is: the latency of
+// foreground operations, e.g. WAL group commits, as recorded into a
+// histogram, and the utilization of a set of block devices. Each sample
+// covers the time since the previous one, so that the signals follow the
+// current load rather than the average since startup.
+//
+// This class is not thread-safe.
+class IOPressureMonitor {
+ public:
+  IOPressureMonitor();
+  ~IOPressureMonitor();
+
+  // Sets the histogram of the latency of foreground operations, in
+  // microseconds. May be null, for no latency signal.
+  void set_latency_histogram(scoped_refptr<Histogram> histogram);
+
+  // Sets the block devices to sample the utilization of, by their names in
+  // /proc/diskstats, e.g. "nvme0n1".
+  void set_devices(std::vector<std::string> devices);
+
+  const std::vector<std::string>& devices() const { return devices_; }
+
+  // Takes a sample, covering the time since the previous one. The first
+  // latency sample covers everything recorded before it.
+  void Sample(MonoTime now);
+
+  // The time of the last sample, uninitialized if none was taken.
+  MonoTime last_sample_time() const { return last_sample_time_; }
+
+  // Returns the latency at 'percentile' of the foreground operations recorded
+  // in the last sample, or -1 if none were.
+  int64_t LatencyAtPercentile(double percentile) const;
+
+  // The highest utilization of any of the devices over the last sample, in
+  // percent, or -1 if unknown; and the device it's the utilization of.
+  double max_device_utilization_pct() const { return max_device_utilization_pct_; }
+  const std::string& busiest_device() const { return busiest_device_; }
+
+  // Parses the number of milliseconds 'device' spent doing I/O (the
+  // "io_ticks" field) out of the contents of /proc/diskstats.
+  static Status ParseDiskStatsIOTicks(const std::string& diskstats,
+                                      const std::string& device,
+                                      int64_t* io_ticks_ms);
+
+ private:
+  void SampleLatency();
+  void SampleDevices(MonoTime now);
+
+  scoped_refptr<Histogram> latency_histogram_;
+
+  // A copy of 'latency_histogram_' as of the last sample, and the values
+  // recorded into it between the last two samples.
+  std::unique_ptr<HdrHistogram> last_latency_;
+  std::unique_ptr<HdrHistogram> window_latency_;
+
+  std::vector<std::string> devices_;
+
+  // The I/O ticks of each device as of the last sample, or -1 if unknown.
+  std::vector<int64_t> last_io_ticks_ms_;
+
+  MonoTime last_sample_time_;
+  double max_device_utilization_pct_;
+  std::string busiest_device_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOPressureMonitor);
+};
+
+} // namespace kudu
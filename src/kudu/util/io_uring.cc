@@ -0,0 +1,305 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/io_uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/port.h"
+#include "kudu/util/errno.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define KUDU_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#endif
+
+namespace kudu {
+
+#if defined(KUDU_HAVE_IO_URING)
+
+namespace {
+
+int SysIoUringSetup(uint32_t entries, struct io_uring_params* p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int SysIoUringEnter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                                  flags, nullptr, 0));
+}
+
+Status IoUringError(const char* what, int err) {
+  return Status::IOError(what, ErrnoToString(err), err);
+}
+
+} // anonymous namespace
+
+bool IoUring::IsSupported() {
+  std::unique_ptr<IoUring> ring;
+  return Create(1, &ring).ok();
+}
+
+IoUring::IoUring()
+    : ring_fd_(-1),
+      sq_ring_(MAP_FAILED),
+      sq_ring_size_(0),
+      cq_ring_(MAP_FAILED),
+      cq_ring_size_(0),
+      sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+      sqes_size_(0),
+      to_submit_(0) {
+}
+
+IoUring::~IoUring() {
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+Status IoUring::Create(uint32_t entries, std::unique_ptr<IoUring>* ring) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = SysIoUringSetup(entries, &p);
+  if (fd < 0) {
+    int err = errno;
+    if (err == ENOSYS || err == EPERM) {
+      return Status::NotSupported("io_uring is not available", ErrnoToString(err), err);
+    }
+    return IoUringError("io_uring_setup() failed", err);
+  }
+  std::unique_ptr<IoUring> r(new IoUring());
+  r->ring_fd_ = fd;
+
+  r->sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  r->cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    r->sq_ring_size_ = std::max(r->sq_ring_size_, r->cq_ring_size_);
+    r->cq_ring_size_ = r->sq_ring_size_;
+  }
+  r->sq_ring_ = mmap(nullptr, r->sq_ring_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (r->sq_ring_ == MAP_FAILED) {
+    return IoUringError("unable to map io_uring submission ring", errno);
+  }
+  if (single_mmap) {
+    r->cq_ring_ = r->sq_ring_;
+  } else {
+    r->cq_ring_ = mmap(nullptr, r->cq_ring_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (r->cq_ring_ == MAP_FAILED) {
+      return IoUringError("unable to map io_uring completion ring", errno);
+    }
+  }
+  r->sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(nullptr, r->sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return IoUringError("unable to map io_uring submission entries", errno);
+  }
+  r->sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+  uint8_t* sq = static_cast<uint8_t*>(r->sq_ring_);
+  r->sq_head_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.head);
+  r->sq_tail_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.tail);
+  r->sq_array_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.array);
+  r->sq_mask_ = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_mask);
+  r->sq_entries_ = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_entries);
+
+  uint8_t* cq = static_cast<uint8_t*>(r->cq_ring_);
+  r->cq_head_ = reinterpret_cast<uint32_t*>(cq + p.cq_off.head);
+  r->cq_tail_ = reinterpret_cast<uint32_t*>(cq + p.cq_off.tail);
+  r->cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+  r->cq_mask_ = *reinterpret_cast<uint32_t*>(cq + p.cq_off.ring_mask);
+
+  *ring = std::move(r);
+  return Status::OK();
+}
+
+struct io_uring_sqe* IoUring::NextSqe() {
+  uint32_t head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  uint32_t tail = *sq_tail_;
+  if (tail - head >= sq_entries_) {
+    return nullptr;
+  }
+  struct io_uring_sqe* sqe = &sqes_[tail & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+void IoUring::PublishSqe() {
+  uint32_t tail = *sq_tail_;
+  sq_array_[tail & sq_mask_] = tail & sq_mask_;
+  // The kernel may look at the entry as soon as the tail has moved past it.
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  to_submit_++;
+}
+
+uint32_t IoUring::SubmissionSpaceLeft() const {
+  uint32_t head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  return sq_entries_ - (*sq_tail_ - head);
+}
+
+Status IoUring::QueueWriteV(int fd, const struct iovec* iov, int iovcnt, uint64_t offset,
+                            uint64_t user_data, bool link) {
+  struct io_uring_sqe* sqe = NextSqe();
+  if (sqe == nullptr) {
+    return Status::ServiceUnavailable("io_uring submission queue is full");
+  }
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->addr = reinterpret_cast<uint64_t>(iov);
+  sqe->len = iovcnt;
+  sqe->user_data = user_data;
+  if (link) {
+    sqe->flags |= IOSQE_IO_LINK;
+  }
+  PublishSqe();
+  return Status::OK();
+}
+
+Status IoUring::QueueFsync(int fd, bool datasync, bool drain, uint64_t user_data) {
+  struct io_uring_sqe* sqe = NextSqe();
+  if (sqe == nullptr) {
+    return Status::ServiceUnavailable("io_uring submission queue is full");
+  }
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = fd;
+  sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+  sqe->user_data = user_data;
+  if (drain) {
+    sqe->flags |= IOSQE_IO_DRAIN;
+  }
+  PublishSqe();
+  return Status::OK();
+}
+
+Status IoUring::QueueNop(bool drain, uint64_t user_data) {
+  struct io_uring_sqe* sqe = NextSqe();
+  if (sqe == nullptr) {
+    return Status::ServiceUnavailable("io_uring submission queue is full");
+  }
+  sqe->opcode = IORING_OP_NOP;
+  sqe->user_data = user_data;
+  if (drain) {
+    sqe->flags |= IOSQE_IO_DRAIN;
+  }
+  PublishSqe();
+  return Status::OK();
+}
+
+Status IoUring::Submit() {
+  while (to_submit_ > 0) {
+    int ret = SysIoUringEnter(ring_fd_, to_submit_, 0, 0);
+    if (ret < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return IoUringError("io_uring_enter() failed to submit", errno);
+    }
+    to_submit_ -= std::min<uint32_t>(ret, to_submit_);
+  }
+  return Status::OK();
+}
+
+Status IoUring::WaitForCompletions(std::vector<Completion>* completions) {
+  while (true) {
+    uint32_t head = *cq_head_;
+    uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      for (; head != tail; head++) {
+        const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        completions->push_back({ cqe.user_data, cqe.res });
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      return Status::OK();
+    }
+    int ret = SysIoUringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+    if (ret < 0 && errno != EINTR && errno != EAGAIN) {
+      return IoUringError("io_uring_enter() failed to wait for completions", errno);
+    }
+  }
+}
+
+#else // !defined(KUDU_HAVE_IO_URING)
+
+bool IoUring::IsSupported() {
+  return false;
+}
+
+IoUring::IoUring() : ring_fd_(-1), to_submit_(0) {
+}
+
+IoUring::~IoUring() {
+}
+
+Status IoUring::Create(uint32_t /*entries*/, std::unique_ptr<IoUring>* /*ring*/) {
+  return Status::NotSupported("io_uring is not supported on this platform");
+}
+
+Status IoUring::QueueWriteV(int /*fd*/, const struct iovec* /*iov*/, int /*iovcnt*/,
+                            uint64_t /*offset*/, uint64_t /*user_data*/, bool /*link*/) {
+  LOG(FATAL) << "io_uring is not supported on this platform";
+  return Status::NotSupported("");
+}
+
+Status IoUring::QueueFsync(int /*fd*/, bool /*datasync*/, bool /*drain*/,
+                           uint64_t /*user_data*/) {
+  LOG(FATAL) << "io_uring is not supported on this platform";
+  return Status::NotSupported("");
+}
+
+Status IoUring::QueueNop(bool /*drain*/, uint64_t /*user_data*/) {
+  LOG(FATAL) << "io_uring is not supported on this platform";
+  return Status::NotSupported("");
+}
+
+Status IoUring::Submit() {
+  LOG(FATAL) << "io_uring is not supported on this platform";
+  return Status::NotSupported("");
+}
+
+Status IoUring::WaitForCompletions(std::vector<Completion>* /*completions*/) {
+  LOG(FATAL) << "io_uring is not supported on this platform";
+  return Status::NotSupported("");
+}
+
+uint32_t IoUring::SubmissionSpaceLeft() const {
+  return 0;
+}
+
+#endif // defined(KUDU_HAVE_IO_URING)
+
+} // namespace kudu
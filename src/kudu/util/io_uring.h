@@ -0,0 +1,138 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_IO_URING_H
+#define KUDU_UTIL_IO_URING_H
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/status.h"
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+namespace kudu {
+
+// A minimal io_uring [1] submission/completion queue pair, talking to the
+// kernel through the raw system calls so that no extra library is required.
+//
+// Only the operations needed by the WAL are provided: vectored writes,
+// fsync/fdatasync and no-ops. Requests may be linked so that the kernel only
+// starts a request once the previous one in the chain has completed.
+//
+// Thread safety: submission (Queue*() and Submit()) must be done by one thread
+// at a time, and completion (WaitForCompletions()) by one thread at a time,
+// but the two sides may run concurrently.
+//
+// 1. https://kernel.dk/io_uring.pdf
+class IoUring {
+ public:
+  struct Completion {
+    // The 'user_data' that the corresponding request was queued with.
+    uint64_t user_data;
+
+    // The result of the request: the number of bytes for a write, 0 for
+    // fsync, or a negative errno.
+    int32_t res;
+  };
+
+  // Returns whether io_uring is supported by the running kernel.
+  static bool IsSupported();
+
+  // Sets up a ring with room for at least 'entries' outstanding submissions.
+  // Returns Status::NotSupported if the kernel doesn't provide io_uring.
+  static Status Create(uint32_t entries, std::unique_ptr<IoUring>* ring);
+
+  ~IoUring();
+
+  // Queues a pwritev() of 'iovcnt' buffers in 'iov' at 'offset' of 'fd'. The
+  // buffers, and 'iov' itself, must remain valid until the completion has
+  // been reaped.
+  //
+  // Returns Status::ServiceUnavailable if the submission queue is full, in
+  // which case Submit() must be called first.
+  Status QueueWriteV(int fd, const struct iovec* iov, int iovcnt, uint64_t offset,
+                     uint64_t user_data, bool link);
+
+  // Queues an fdatasync() of 'fd', or an fsync() if 'datasync' is false.
+  // With 'drain', the kernel waits for all previously submitted requests to
+  // complete before starting this one.
+  Status QueueFsync(int fd, bool datasync, bool drain, uint64_t user_data);
+
+  // Queues a request which does nothing, e.g. to wake up a thread blocked in
+  // WaitForCompletions(). With 'drain', it completes only once all the
+  // previously submitted requests have.
+  Status QueueNop(bool drain, uint64_t user_data);
+
+  // Hands all the queued requests to the kernel. Does not wait for them to
+  // complete.
+  Status Submit();
+
+  // Blocks until at least one request has completed, and then appends all of
+  // the available completions to 'completions'.
+  Status WaitForCompletions(std::vector<Completion>* completions);
+
+  // The number of requests which may be queued before the submission queue
+  // is full.
+  uint32_t SubmissionSpaceLeft() const;
+
+ private:
+  IoUring();
+
+  // Returns the next free submission queue entry, zeroed, or NULL if the
+  // queue is full. The entry is only visible to the kernel once it has been
+  // filled in and published with PublishSqe().
+  struct io_uring_sqe* NextSqe();
+
+  // Publishes the entry returned by the last call to NextSqe().
+  void PublishSqe();
+
+  int ring_fd_;
+
+  // The mapped rings and their sizes.
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  // Pointers into the mapped submission ring.
+  uint32_t* sq_head_;
+  uint32_t* sq_tail_;
+  uint32_t* sq_array_;
+  uint32_t sq_mask_;
+  uint32_t sq_entries_;
+
+  // Pointers into the mapped completion ring.
+  uint32_t* cq_head_;
+  uint32_t* cq_tail_;
+  struct io_uring_cqe* cqes_;
+  uint32_t cq_mask_;
+
+  // The number of queued entries not yet handed to the kernel.
+  uint32_t to_submit_;
+
+  DISALLOW_COPY_AND_ASSIGN(IoUring);
+};
+
+} // namespace kudu
+#endif // KUDU_UTIL_IO_URING_H
@@ -0,0 +1,102 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/lock_profile.h"
+
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "kudu/util/jsonwriter.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::string;
+
+namespace kudu {
+
+class LockProfileTest : public KuduTest {};
+
+// Locks of the same name share a profile.
+TEST_F(LockProfileTest, TestRegistry) {
+  LockProfile* p = LockProfile::Get("LockProfileTest::registry");
+  ASSERT_EQ(p, LockProfile::Get("LockProfileTest::registry"));
+  ASSERT_NE(p, LockProfile::Get("LockProfileTest::other"));
+  ASSERT_EQ("LockProfileTest::registry", p->name());
+  bool found = false;
+  for (LockProfile* profile : LockProfile::GetAll()) {
+    found |= profile == p;
+  }
+  ASSERT_TRUE(found);
+}
+
+// Uncontended locking records nothing, and a thread which waits for the lock
+// records its wait against the holder.
+template <class Lock>
+void TestContention(const string& name) {
+  ProfiledLock<Lock> lock(name);
+  LockProfile* profile = LockProfile::Get(name);
+  {
+    std::lock_guard<ProfiledLock<Lock>> l(lock);
+  }
+  ASSERT_EQ(0U, profile->wait_count());
+
+  std::atomic<bool> waiting(false);
+  std::thread waiter;
+  {
+    std::lock_guard<ProfiledLock<Lock>> l(lock);
+    waiter = std::thread([&]() {
+      waiting = true;
+      std::lock_guard<ProfiledLock<Lock>> l(lock);
+    });
+    while (!waiting) {
+      SleepFor(MonoDelta::FromMilliseconds(1));
+    }
+    SleepFor(MonoDelta::FromMilliseconds(50));
+  }
+  waiter.join();
+  ASSERT_EQ(1U, profile->wait_count());
+
+  std::ostringstream out;
+  JsonWriter jw(&out, JsonWriter::COMPACT);
+  profile->WriteAsJson(&jw, 10);
+  const string json = out.str();
+  ASSERT_STR_CONTAINS(json, "\"name\":\"" + name + "\"");
+  ASSERT_STR_CONTAINS(json, "\"waits\":1");
+  ASSERT_STR_MATCHES(json, "\"max_wait_us\":[0-9]{5,}");
+  ASSERT_STR_CONTAINS(json, "\"holders\":[{\"site\":");
+}
+
+TEST_F(LockProfileTest, TestSpinlockContention) {
+  NO_FATALS(TestContention<simple_spinlock>("LockProfileTest::spinlock"));
+}
+
+TEST_F(LockProfileTest, TestAdaptiveMutexContention) {
+  NO_FATALS(TestContention<adaptive_mutex>("LockProfileTest::adaptive_mutex"));
+}
+
+TEST_F(LockProfileTest, TestRWSpinlockContention) {
+  NO_FATALS(TestContention<rw_spinlock>("LockProfileTest::rw_spinlock"));
+}
+
+} // namespace kudu
@@ -0,0 +1,180 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/lock_profile.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/stringprintf.h"
+#include "kudu/util/jsonwriter.h"
+#include "kudu/util/web_callback_registry.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+// GLog already implements symbolization. Just import their hidden symbol.
+namespace google {
+// Symbolizes a program counter.  On success, returns true and write the
+// symbol name to "out".  The symbol name is demangled if possible
+// (supports symbols generated by GCC 3.x or newer).  Otherwise,
+// returns false.
+bool Symbolize(void *pc, char *out, int out_size);
+}
+
+namespace kudu {
+
+namespace {
+
+// Waits are tracked up to a minute.
+constexpr uint64_t kMaxWaitMicros = 60 * 1000 * 1000;
+
+// The number of holder call sites shown for each lock on /lockz.
+constexpr int kPathHandlerMaxSites = 20;
+
+struct ProfileRegistry {
+  simple_spinlock lock;
+  std::map<string, unique_ptr<LockProfile>> profiles;
+};
+
+ProfileRegistry* GetRegistry() {
+  static ProfileRegistry* registry = new ProfileRegistry();
+  return registry;
+}
+
+} // anonymous namespace
+
+LockProfile* LockProfile::Get(const string& name) {
+  ProfileRegistry* registry = GetRegistry();
+  std::lock_guard<simple_spinlock> l(registry->lock);
+  unique_ptr<LockProfile>& profile = registry->profiles[name];
+  if (!profile) {
+    profile.reset(new LockProfile(name));
+  }
+  return profile.get();
+}
+
+vector<LockProfile*> LockProfile::GetAll() {
+  ProfileRegistry* registry = GetRegistry();
+  std::lock_guard<simple_spinlock> l(registry->lock);
+  vector<LockProfile*> ret;
+  ret.reserve(registry->profiles.size());
+  for (const auto& e : registry->profiles) {
+    ret.push_back(e.second.get());
+  }
+  return ret;
+}
+
+LockProfile::LockProfile(string name)
+    : name_(std::move(name)),
+      wait_us_(kMaxWaitMicros, 2) {
+}
+
+void LockProfile::RecordWait(MonoDelta wait, const void* holder_site) {
+  const int64_t wait_us = std::min<int64_t>(wait.ToMicroseconds(), kMaxWaitMicros);
+  wait_us_.Increment(wait_us);
+  std::lock_guard<simple_spinlock> l(sites_lock_);
+  SiteStats* stats = &sites_[holder_site];
+  stats->waits++;
+  stats->total_wait_us += wait_us;
+}
+
+void LockProfile::WriteAsJson(JsonWriter* jw, int max_sites) const {
+  // Snapshot the sites, so that symbolizing them doesn't hold up waiters.
+  vector<std::pair<const void*, SiteStats>> sites;
+  {
+    std::lock_guard<simple_spinlock> l(sites_lock_);
+    sites.assign(sites_.begin(), sites_.end());
+  }
+  std::sort(sites.begin(), sites.end(),
+            [](const std::pair<const void*, SiteStats>& a,
+               const std::pair<const void*, SiteStats>& b) {
+              return a.second.total_wait_us > b.second.total_wait_us;
+            });
+  if (sites.size() > static_cast<size_t>(max_sites)) {
+    sites.resize(max_sites);
+  }
+
+  jw->StartObject();
+  jw->String("name");
+  jw->String(name_);
+  jw->String("waits");
+  jw->Uint64(wait_us_.TotalCount());
+  jw->String("total_wait_us");
+  jw->Uint64(wait_us_.TotalSum());
+  jw->String("mean_wait_us");
+  jw->Double(wait_us_.MeanValue());
+  jw->String("p50_wait_us");
+  jw->Uint64(wait_us_.ValueAtPercentile(50));
+  jw->String("p99_wait_us");
+  jw->Uint64(wait_us_.ValueAtPercentile(99));
+  jw->String("p999_wait_us");
+  jw->Uint64(wait_us_.ValueAtPercentile(99.9));
+  jw->String("max_wait_us");
+  jw->Uint64(wait_us_.MaxValue());
+  jw->String("holders");
+  jw->StartArray();
+  for (const auto& site : sites) {
+    jw->StartObject();
+    jw->String("site");
+    jw->String(StringPrintf("%p", site.first));
+    char buf[1024];
+    // The site is a return address: subtract 1 to symbolize the call itself.
+    if (site.first &&
+        google::Symbolize(static_cast<char*>(const_cast<void*>(site.first)) - 1,
+                          buf, sizeof(buf))) {
+      jw->String("symbol");
+      jw->String(buf);
+    }
+    jw->String("waits");
+    jw->Int64(site.second.waits);
+    jw->String("total_wait_us");
+    jw->Int64(site.second.total_wait_us);
+    jw->EndObject();
+  }
+  jw->EndArray();
+  jw->EndObject();
+}
+
+void LockProfile::WriteAllAsJson(JsonWriter* jw, int max_sites) {
+  jw->StartArray();
+  for (const LockProfile* profile : GetAll()) {
+    if (profile->wait_count() > 0) {
+      profile->WriteAsJson(jw, max_sites);
+    }
+  }
+  jw->EndArray();
+}
+
+void RegisterLockProfilePathHandler(WebCallbackRegistry* web) {
+  auto callback = [](const WebCallbackRegistry::WebRequest& /* req */,
+                     WebCallbackRegistry::PrerenderedWebResponse* resp) {
+    JsonWriter writer(resp->output, JsonWriter::PRETTY);
+    LockProfile::WriteAllAsJson(&writer, kPathHandlerMaxSites);
+  };
+  DCHECK_NOTNULL(web)->RegisterPrerenderedPathHandler("/lockz", "Locks", callback,
+                                                      false /* is_styled */,
+                                                      true /* is_on_nav_bar */);
+}
+
+} // namespace kudu
@@ -0,0 +1,171 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+#include "kudu/util/hdr_histogram.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+
+namespace kudu {
+
+class JsonWriter;
+class WebCallbackRegistry;
+
+// The contention of a named lock, or of all the locks sharing a name, such
+// as the locks of the RaftConsensus instances of every tablet: how long
+// threads waited for the lock, and which call sites held it meanwhile.
+//
+// Profiles are created on first use and live as long as the process.
+// All methods are thread-safe.
+class LockProfile {
+ public:
+  // Returns the profile named 'name', creating it if there's none.
+  static LockProfile* Get(const std::string& name);
+
+  // Returns every profile, ordered by name.
+  static std::vector<LockProfile*> GetAll();
+
+  // Records that a thread waited 'wait' for the lock, which the call site
+  // 'holder_site' held when the thread started waiting.
+  void RecordWait(MonoDelta wait, const void* holder_site);
+
+  const std::string& name() const { return name_; }
+
+  // The number of waits recorded so far.
+  uint64_t wait_count() const { return wait_us_.TotalCount(); }
+
+  // Writes the profile as a JSON object: the name of the lock, the
+  // distribution of its wait times in microseconds, and the 'max_sites'
+  // holder call sites which were waited on the longest in total, symbolized.
+  void WriteAsJson(JsonWriter* jw, int max_sites) const;
+
+  // Writes the profiles of every lock which was ever waited for as a JSON
+  // array, in the same format as WriteAsJson().
+  static void WriteAllAsJson(JsonWriter* jw, int max_sites);
+
+ private:
+  explicit LockProfile(std::string name);
+
+  struct SiteStats {
+    int64_t waits = 0;
+    int64_t total_wait_us = 0;
+  };
+
+  const std::string name_;
+  HdrHistogram wait_us_;
+
+  // Protects 'sites_'.
+  mutable simple_spinlock sites_lock_;
+  std::unordered_map<const void*, SiteStats> sites_;
+
+  DISALLOW_COPY_AND_ASSIGN(LockProfile);
+};
+
+// A lock which profiles its contention into the LockProfile of its name.
+//
+// Taking the lock uncontended only costs storing the call site into the
+// lock. A thread which has to wait times the wait, and attributes it to the
+// call site which held the lock when it started waiting.
+//
+// 'Lock' is simple_spinlock, adaptive_mutex, rw_spinlock, or any lock with
+// the same interface. Shared acquisitions of reader-writer locks are only
+// timed when a writer holds the lock, and don't count as holders.
+template <class Lock>
+class ProfiledLock {
+ public:
+  explicit ProfiledLock(const std::string& name)
+      : profile_(LockProfile::Get(name)) {
+  }
+
+  // Not inlined, so that the return address is the call site.
+  ATTRIBUTE_NOINLINE void lock() {
+    if (PREDICT_FALSE(!lock_.try_lock())) {
+      LockContended();
+    }
+    holder_site_.store(__builtin_return_address(0), std::memory_order_relaxed);
+  }
+
+  ATTRIBUTE_NOINLINE bool try_lock() {
+    if (lock_.try_lock()) {
+      holder_site_.store(__builtin_return_address(0), std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  void unlock() {
+    lock_.unlock();
+  }
+
+  void lock_shared() {
+    if (PREDICT_FALSE(lock_.is_write_locked())) {
+      const void* holder = holder_site_.load(std::memory_order_relaxed);
+      MonoTime start = MonoTime::Now();
+      lock_.lock_shared();
+      profile_->RecordWait(MonoTime::Now() - start, holder);
+      return;
+    }
+    lock_.lock_shared();
+  }
+
+  void unlock_shared() {
+    lock_.unlock_shared();
+  }
+
+  bool is_locked() const {
+    return lock_.is_locked();
+  }
+
+  bool is_write_locked() const {
+    return lock_.is_write_locked();
+  }
+
+ private:
+  void LockContended() {
+    const void* holder = holder_site_.load(std::memory_order_relaxed);
+    MonoTime start = MonoTime::Now();
+    lock_.lock();
+    profile_->RecordWait(MonoTime::Now() - start, holder);
+  }
+
+  mutable Lock lock_;
+
+  // The call site which last took the lock exclusively.
+  std::atomic<const void*> holder_site_ { nullptr };
+
+  LockProfile* const profile_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProfiledLock);
+};
+
+typedef ProfiledLock<simple_spinlock> profiled_spinlock;
+typedef ProfiledLock<adaptive_mutex> profiled_adaptive_mutex;
+typedef ProfiledLock<rw_spinlock> profiled_rw_spinlock;
+
+// Registers the /lockz page, which serves the profiles of the locks which
+// were ever waited for as JSON.
+void RegisterLockProfilePathHandler(WebCallbackRegistry* web);
+
+} // namespace kudu
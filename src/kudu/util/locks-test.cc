@@ -0,0 +1,106 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#include "kudu/util/locks.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/stopwatch.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+using std::thread;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+
+class LocksTest : public KuduTest {};
+
+// Threads incrementing a counter under the lock never lose an increment.
+TEST_F(LocksTest, TestAdaptiveMutexExclusion) {
+  const int kNumThreads = 8;
+  const int kIncrementsPerThread = AllowSlowTests() ? 1000000 : 100000;
+  adaptive_mutex lock;
+  int64_t counter = 0;
+  vector<thread> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < kIncrementsPerThread; j++) {
+        std::lock_guard<adaptive_mutex> l(lock);
+        counter++;
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(kNumThreads * kIncrementsPerThread, counter);
+  ASSERT_FALSE(lock.is_locked());
+  LOG(INFO) << "spin acquisitions: " << lock.num_spin_acquisitions()
+            << ", parks: " << lock.num_parks();
+}
+
+// A thread waiting for a lock which stays held parks rather than spinning,
+// and is woken up when the lock is released.
+TEST_F(LocksTest, TestAdaptiveMutexParks) {
+  adaptive_mutex lock;
+  lock.lock();
+  ASSERT_FALSE(lock.try_lock());
+  thread waiter([&]() {
+    std::lock_guard<adaptive_mutex> l(lock);
+  });
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(1, lock.num_parks());
+  });
+  SleepFor(MonoDelta::FromMilliseconds(50));
+  lock.unlock();
+  waiter.join();
+  ASSERT_FALSE(lock.is_locked());
+  ASSERT_TRUE(lock.try_lock());
+  lock.unlock();
+}
+
+// Compares the uncontended cost of adaptive_mutex with simple_spinlock's.
+template <class Lock>
+void BenchmarkUncontended(const char* name) {
+  const int kIterations = AllowSlowTests() ? 100000000 : 10000000;
+  Lock lock;
+  Stopwatch sw;
+  sw.start();
+  for (int i = 0; i < kIterations; i++) {
+    std::lock_guard<Lock> l(lock);
+  }
+  sw.stop();
+  LOG(INFO) << Substitute("$0: $1 ns per uncontended lock and unlock", name,
+                          sw.elapsed().wall * 1.0 / kIterations);
+}
+
+TEST_F(LocksTest, BenchmarkUncontended) {
+  BenchmarkUncontended<simple_spinlock>("simple_spinlock");
+  BenchmarkUncontended<adaptive_mutex>("adaptive_mutex");
+}
+
+} // namespace kudu
@@ -17,6 +17,12 @@
 
 #include "kudu/util/locks.h"
 
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "kudu/gutil/atomicops.h"
 #include "kudu/util/malloc.h"
 
@@ -44,4 +50,63 @@ size_t percpu_rwlock::memory_footprint_including_this() const {
   return kudu_malloc_usable_size(this) + memory_footprint_excluding_this();
 }
 
+namespace {
+
+// The bounds of how long a contended adaptive_mutex spins, in pauses. The
+// upper one is the spin count of base::SpinLock.
+const int kMinAdaptiveSpins = 10;
+const int kMaxAdaptiveSpins = 1000;
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int),
+              "the state of adaptive_mutex must be usable as a futex word");
+
+void FutexWait(std::atomic<int>* word, int value) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAIT_PRIVATE, value,
+          nullptr, nullptr, 0);
+#else
+  sched_yield();
+#endif
+}
+
+void FutexWakeOne(std::atomic<int>* word) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAKE_PRIVATE, 1,
+          nullptr, nullptr, 0);
+#endif
+}
+
+} // anonymous namespace
+
+void adaptive_mutex::LockSlow() {
+  // Spinning can't help if there's no other CPU for the holder to run on.
+  static const int max_spins = base::NumCPUs() > 1 ? kMaxAdaptiveSpins : 0;
+  const int estimate = spin_estimate_.load(std::memory_order_relaxed);
+  const int spin_limit = std::min(max_spins, estimate * 2 + kMinAdaptiveSpins);
+  int spins = 0;
+  for (; spins < spin_limit; spins++) {
+    int state = state_.load(std::memory_order_relaxed);
+    if (state == kUnlocked &&
+        state_.compare_exchange_weak(state, kLocked, std::memory_order_acquire)) {
+      spin_estimate_.store(estimate + (spins - estimate) / 8, std::memory_order_relaxed);
+      num_spin_acquisitions_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    base::subtle::PauseCPU();
+  }
+  spin_estimate_.store(estimate + (spin_limit - estimate) / 8, std::memory_order_relaxed);
+  num_parks_.fetch_add(1, std::memory_order_relaxed);
+
+  // Mark the lock as having waiters, so that the holder wakes one up, and park
+  // until it's released. A woken thread takes the lock in the same state,
+  // since other threads may still be parked.
+  while (state_.exchange(kLockedWithWaiters, std::memory_order_acquire) != kUnlocked) {
+    FutexWait(&state_, kLockedWithWaiters);
+  }
+}
+
+void adaptive_mutex::WakeWaiter() {
+  FutexWakeOne(&state_);
+}
+
 } // namespace kudu
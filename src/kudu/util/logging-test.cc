@@ -18,6 +18,7 @@
 #include <atomic>
 #include <cstdint>
 #include <ctime>
+#include <map>
 #include <ostream>
 #include <string>
 #include <thread>
@@ -168,6 +169,58 @@ TEST(LoggingTest, TestAsyncLogger) {
   ASSERT_GT(async.app_threads_blocked_count_for_tests(), 0);
 }
 
+// Counting logger which also checks that the messages of each writer, as
+// named by the message, come in the order of their timestamps.
+class OrderCheckingLogger : public CountingLogger {
+ public:
+  void Write(bool force_flush,
+             time_t timestamp,
+             const char* message,
+             int message_len) override {
+    time_t& last = last_timestamps_[string(message, message_len)];
+    if (timestamp < last) {
+      out_of_order_count_++;
+    }
+    last = timestamp;
+    CountingLogger::Write(force_flush, timestamp, message, message_len);
+  }
+
+  std::map<string, time_t> last_timestamps_;
+  int out_of_order_count_ = 0;
+};
+
+// Threads writing to their own buffers lose no messages, and the messages of
+// each thread are written in order, even when the buffers fill up.
+TEST(LoggingTest, TestAsyncLoggerThreadBuffers) {
+  const int kNumThreads = 4;
+  const int kNumMessages = 10000;
+  const int kBuffer = 10000;
+  const int kThreadBuffer = 1024;
+  OrderCheckingLogger base;
+  AsyncLogger async(&base, kBuffer, kThreadBuffer);
+  async.Start();
+
+  vector<std::thread> threads;
+  Barrier go_barrier(kNumThreads);
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&, i]() {
+        const string name = std::to_string(i);
+        go_barrier.Wait();
+        for (int m = 0; m < kNumMessages; m++) {
+          async.Write(m % 100 == 0, m, name.data(), name.size());
+        }
+        async.Flush();
+      });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  async.Stop();
+  ASSERT_EQ(base.message_count_, kNumMessages * kNumThreads);
+  ASSERT_EQ(0, base.out_of_order_count_);
+  ASSERT_LT(base.flush_count_, kNumMessages * kNumThreads);
+}
+
 TEST(LoggingTest, TestAsyncLoggerAutoFlush) {
   const int kBuffer = 10000;
   CountingLogger base;
@@ -61,6 +61,13 @@ DEFINE_int32(log_async_buffer_bytes_per_level, 2 * 1024 * 1024,
              "level. Only relevant when --log_async is enabled.");
 TAG_FLAG(log_async_buffer_bytes_per_level, hidden);
 
+DEFINE_int32(log_async_thread_buffer_bytes, 0,
+             "If positive, each thread logging to a level gets a buffer of this "
+             "many bytes, which it appends messages to without taking any lock, "
+             "in addition to the buffers shared by the threads. Only relevant "
+             "when --log_async is enabled.");
+TAG_FLAG(log_async_thread_buffer_bytes, experimental);
+
 DEFINE_int32(max_log_files, 10,
     "Maximum number of log files to retain per severity level. The most recent "
     "log files are retained. If set to 0, all log files are retained.");
@@ -142,7 +149,8 @@ void EnableAsyncLogging() {
   // to ensure that we get the fatal log message written before exiting.
   for (auto level : { google::INFO, google::WARNING, google::ERROR }) {
     auto* orig = google::base::GetLogger(level);
-    auto* async = new AsyncLogger(orig, FLAGS_log_async_buffer_bytes_per_level);
+    auto* async = new AsyncLogger(orig, FLAGS_log_async_buffer_bytes_per_level,
+                                  FLAGS_log_async_thread_buffer_bytes);
     async->Start();
     google::base::SetLogger(level, async);
   }
@@ -55,8 +55,13 @@ METRIC_DEFINE_gauge_uint32(test, maintenance_ops_running,
 METRIC_DEFINE_histogram(test, maintenance_op_duration,
                         "Maintenance Operation Duration",
                         kudu::MetricUnit::kSeconds, "", 60000000LU, 2);
+METRIC_DEFINE_histogram(test, foreground_write_latency,
+                        "Foreground Write Latency",
+                        kudu::MetricUnit::kMicroseconds, "", 60000000LU, 2);
 
+DECLARE_int32(maintenance_manager_max_defer_ms);
 DECLARE_int64(log_target_replay_size_mb);
+DECLARE_int64(maintenance_manager_defer_latency_target_us);
 
 namespace kudu {
 
@@ -262,6 +267,40 @@ TEST_F(MaintenanceManagerTest, TestMemoryPressure) {
   manager_->UnregisterOp(&op);
 }
 
+// Test that high I/O ops are deferred while foreground writes are slow, but
+// only for up to --maintenance_manager_max_defer_ms.
+TEST_F(MaintenanceManagerTest, TestDeferForForegroundLatency) {
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity = METRIC_ENTITY_test.Instantiate(&registry, "latency");
+  scoped_refptr<Histogram> latency = METRIC_foreground_write_latency.Instantiate(entity);
+  for (int i = 0; i < 100; i++) {
+    latency->Increment(50000);
+  }
+  manager_->set_foreground_latency_histogram(latency);
+  FLAGS_maintenance_manager_defer_latency_target_us = 10000;
+  FLAGS_maintenance_manager_max_defer_ms = 60000;
+
+  TestMaintenanceOp op("op", MaintenanceOp::HIGH_IO_USAGE);
+  op.set_perf_improvement(10);
+  manager_->RegisterOp(&op);
+
+  ASSERT_EVENTUALLY([&]() {
+      MaintenanceManagerStatusPB status_pb;
+      manager_->GetMaintenanceManagerStatusDump(&status_pb);
+      ASSERT_TRUE(status_pb.io_pressure().deferring());
+      ASSERT_GT(status_pb.io_pressure().num_deferrals(), 0);
+      ASSERT_STR_CONTAINS(status_pb.io_pressure().reason(), "latency");
+    });
+  ASSERT_EQ(0, op.DurationHistogram()->TotalCount());
+
+  // Once the op has been deferred for long enough, it runs anyway.
+  FLAGS_maintenance_manager_max_defer_ms = 10;
+  ASSERT_EVENTUALLY([&]() {
+      ASSERT_EQ(op.DurationHistogram()->TotalCount(), 1);
+    });
+  manager_->UnregisterOp(&op);
+}
+
 // Test that ops are prioritized correctly when we add log retention.
 TEST_F(MaintenanceManagerTest, TestLogRetentionPrioritization) {
   const int64_t kMB = 1024 * 1024;
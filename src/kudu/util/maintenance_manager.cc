@@ -33,6 +33,8 @@
 #include "kudu/gutil/dynamic_annotations.h"
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/stringprintf.h"
+#include "kudu/gutil/strings/join.h"
+#include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/debug/trace_logging.h"
@@ -50,6 +52,7 @@
 
 using std::pair;
 using std::string;
+using std::vector;
 using strings::Substitute;
 
 DEFINE_int32(maintenance_manager_num_threads, 1,
@@ -90,8 +93,50 @@ DEFINE_double(data_gc_prioritization_prob, 0.5,
              "such as delta compaction.");
 TAG_FLAG(data_gc_prioritization_prob, experimental);
 
+DEFINE_int64(maintenance_manager_defer_latency_target_us, 0,
+             "If positive, high I/O maintenance operations are deferred while "
+             "the latency of foreground writes, e.g. WAL group commits, at "
+             "--maintenance_manager_defer_latency_percentile is over this many "
+             "microseconds. 0 disables deferring on latency.");
+TAG_FLAG(maintenance_manager_defer_latency_target_us, experimental);
+TAG_FLAG(maintenance_manager_defer_latency_target_us, runtime);
+
+DEFINE_double(maintenance_manager_defer_latency_percentile, 99,
+              "The percentile of the latency of foreground writes compared with "
+              "--maintenance_manager_defer_latency_target_us.");
+TAG_FLAG(maintenance_manager_defer_latency_percentile, experimental);
+TAG_FLAG(maintenance_manager_defer_latency_percentile, runtime);
+
+DEFINE_double(maintenance_manager_defer_device_utilization_pct, 0,
+              "If positive, high I/O maintenance operations are deferred while "
+              "any of --maintenance_manager_monitored_devices is busy more than "
+              "this percentage of the time. 0 disables deferring on device "
+              "utilization.");
+TAG_FLAG(maintenance_manager_defer_device_utilization_pct, experimental);
+TAG_FLAG(maintenance_manager_defer_device_utilization_pct, runtime);
+
+DEFINE_string(maintenance_manager_monitored_devices, "",
+              "Comma-separated names of the block devices, as in /proc/diskstats, "
+              "whose utilization is compared with "
+              "--maintenance_manager_defer_device_utilization_pct.");
+TAG_FLAG(maintenance_manager_monitored_devices, experimental);
+TAG_FLAG(maintenance_manager_monitored_devices, runtime);
+
+DEFINE_int32(maintenance_manager_max_defer_ms, 60000,
+             "The longest high I/O maintenance operations are deferred for in a "
+             "row because of I/O pressure, after which one is run anyway.");
+TAG_FLAG(maintenance_manager_max_defer_ms, experimental);
+TAG_FLAG(maintenance_manager_max_defer_ms, runtime);
+
 namespace kudu {
 
+namespace {
+
+// How often the I/O pressure is sampled while deciding whether to defer ops.
+const MonoDelta kIOPressureSampleInterval = MonoDelta::FromSeconds(1);
+
+} // anonymous namespace
+
 MaintenanceOpStats::MaintenanceOpStats() {
   Clear();
 }
@@ -154,7 +199,8 @@ MaintenanceManager::MaintenanceManager(const Options& options,
     running_ops_(0),
     completed_ops_count_(0),
     rand_(GetRandomSeed32()),
-    memory_pressure_func_(&process_memory::UnderMemoryPressure) {
+    memory_pressure_func_(&process_memory::UnderMemoryPressure),
+    num_io_deferrals_(0) {
   CHECK_OK(ThreadPoolBuilder("MaintenanceMgr").set_min_threads(num_threads_)
                .set_max_threads(num_threads_).Build(&thread_pool_));
   uint32_t history_size = options.history_size == 0 ?
@@ -286,6 +332,14 @@ void MaintenanceManager::RunSchedulerThread() {
       continue;
     }
 
+    string defer_reason;
+    if (ShouldDeferForIOPressure(op, &defer_reason)) {
+      VLOG_AND_TRACE("maintenance", 1) << LogPrefix() << "Deferring " << op->name()
+                                       << ": " << defer_reason;
+      prev_iter_found_no_work = true;
+      continue;
+    }
+
     // Prepare the maintenance operation.
     op->running_++;
     running_ops_++;
@@ -449,6 +503,63 @@ pair<MaintenanceOp*, string> MaintenanceManager::FindBestOp() {
   return {nullptr, "no ops with positive improvement"};
 }
 
+bool MaintenanceManager::ShouldDeferForIOPressure(MaintenanceOp* op, string* reason) {
+  const int64_t latency_target_us = FLAGS_maintenance_manager_defer_latency_target_us;
+  const double utilization_target_pct = FLAGS_maintenance_manager_defer_device_utilization_pct;
+  double capacity_pct;
+  if ((latency_target_us <= 0 && utilization_target_pct <= 0) ||
+      op->io_usage() != MaintenanceOp::HIGH_IO_USAGE ||
+      memory_pressure_func_(&capacity_pct)) {
+    io_deferred_since_ = MonoTime();
+    return false;
+  }
+
+  MonoTime now = MonoTime::Now();
+  const string& devices = FLAGS_maintenance_manager_monitored_devices;
+  if (devices != JoinStrings(io_pressure_monitor_.devices(), ",")) {
+    vector<string> device_names = strings::Split(devices, ",", strings::SkipEmpty());
+    io_pressure_monitor_.set_devices(std::move(device_names));
+  }
+  if (!io_pressure_monitor_.last_sample_time().Initialized() ||
+      now - io_pressure_monitor_.last_sample_time() >= kIOPressureSampleInterval) {
+    io_pressure_monitor_.Sample(now);
+  }
+
+  vector<string> reasons;
+  const double percentile = FLAGS_maintenance_manager_defer_latency_percentile;
+  int64_t latency_us = io_pressure_monitor_.LatencyAtPercentile(percentile);
+  if (latency_target_us > 0 && latency_us > latency_target_us) {
+    reasons.emplace_back(Substitute("p$0 foreground write latency $1us over $2us",
+                                    percentile, latency_us, latency_target_us));
+  }
+  double utilization_pct = io_pressure_monitor_.max_device_utilization_pct();
+  if (utilization_target_pct > 0 && utilization_pct > utilization_target_pct) {
+    reasons.emplace_back(StringPrintf("%s %.1f%% utilized",
+                                      io_pressure_monitor_.busiest_device().c_str(),
+                                      utilization_pct));
+  }
+  if (reasons.empty()) {
+    io_deferred_since_ = MonoTime();
+    return false;
+  }
+
+  if (!io_deferred_since_.Initialized()) {
+    io_deferred_since_ = now;
+  }
+  MonoDelta deferred_for = now - io_deferred_since_;
+  if (deferred_for.ToMilliseconds() >= FLAGS_maintenance_manager_max_defer_ms) {
+    LOG_WITH_PREFIX(INFO) << "Running " << op->name() << " despite I/O pressure ("
+                          << JoinStrings(reasons, ", ") << "): ops have been deferred for "
+                          << deferred_for.ToString();
+    io_deferred_since_ = MonoTime();
+    return false;
+  }
+  *reason = JoinStrings(reasons, ", ");
+  last_io_deferral_reason_ = *reason;
+  num_io_deferrals_++;
+  return true;
+}
+
 void MaintenanceManager::LaunchOp(MaintenanceOp* op) {
   int64_t thread_id = Thread::CurrentThreadId();
   OpInstance op_instance;
@@ -532,6 +643,26 @@ void MaintenanceManager::GetMaintenanceManagerStatusDump(MaintenanceManagerStatu
     }
   }
 
+  MaintenanceManagerStatusPB::IOPressurePB* io_pressure_pb = out_pb->mutable_io_pressure();
+  io_pressure_pb->set_deferring(io_deferred_since_.Initialized());
+  io_pressure_pb->set_num_deferrals(num_io_deferrals_);
+  if (!last_io_deferral_reason_.empty()) {
+    io_pressure_pb->set_reason(last_io_deferral_reason_);
+  }
+  int64_t latency_us = io_pressure_monitor_.LatencyAtPercentile(
+      FLAGS_maintenance_manager_defer_latency_percentile);
+  if (latency_us >= 0) {
+    io_pressure_pb->set_foreground_latency_us(latency_us);
+  }
+  if (io_pressure_monitor_.max_device_utilization_pct() >= 0) {
+    io_pressure_pb->set_device_utilization_pct(io_pressure_monitor_.max_device_utilization_pct());
+    io_pressure_pb->set_busiest_device(io_pressure_monitor_.busiest_device());
+  }
+  if (io_deferred_since_.Initialized()) {
+    io_pressure_pb->set_deferred_for_millis(
+        (MonoTime::Now() - io_deferred_since_).ToMilliseconds());
+  }
+
   for (int n = 1; n <= completed_ops_.size(); n++) {
     int i = completed_ops_count_ - n;
     if (i < 0) break;
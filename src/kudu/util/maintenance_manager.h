@@ -35,6 +35,7 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/atomic.h"
 #include "kudu/util/condition_variable.h"
+#include "kudu/util/io_pressure.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/random.h"
@@ -297,6 +298,14 @@ class MaintenanceManager : public std::enable_shared_from_this<MaintenanceManage
     memory_pressure_func_ = std::move(f);
   }
 
+  // Sets the histogram of the latency of foreground writes, e.g. WAL group
+  // commits, in microseconds. High I/O ops are deferred while its recent
+  // percentiles are over --maintenance_manager_defer_latency_target_us.
+  void set_foreground_latency_histogram(scoped_refptr<Histogram> histogram) {
+    std::lock_guard<Mutex> guard(lock_);
+    io_pressure_monitor_.set_latency_histogram(std::move(histogram));
+  }
+
   static const Options kDefaultOptions;
 
  private:
@@ -316,6 +325,14 @@ class MaintenanceManager : public std::enable_shared_from_this<MaintenanceManage
   // suitable for logging.
   std::pair<MaintenanceOp*, std::string> FindBestOp();
 
+  // Returns true if 'op' should not be launched yet because the foreground
+  // I/O path is too loaded, setting 'reason' to why. Ops are never deferred
+  // under memory pressure, nor for longer than
+  // --maintenance_manager_max_defer_ms in a row.
+  //
+  // Must be called with 'lock_' held.
+  bool ShouldDeferForIOPressure(MaintenanceOp* op, std::string* reason);
+
   void LaunchOp(MaintenanceOp* op);
 
   std::string LogPrefix() const;
@@ -340,6 +357,16 @@ class MaintenanceManager : public std::enable_shared_from_this<MaintenanceManage
   // This is indirected for testing purposes.
   std::function<bool(double*)> memory_pressure_func_;
 
+  // Samples the load of the foreground I/O path, to defer high I/O ops by.
+  // Protected by lock_, as are the deferral state below.
+  IOPressureMonitor io_pressure_monitor_;
+
+  // When the ops have been deferred since, uninitialized if they aren't being
+  // deferred; how many times an op was deferred; and why the last one was.
+  MonoTime io_deferred_since_;
+  int64_t num_io_deferrals_;
+  std::string last_io_deferral_reason_;
+
   // Running instances lock.
   //
   // This is separate of lock_ so that worker threads don't need to take the
@@ -27,6 +27,7 @@
 #include <utility>
 #include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
@@ -34,6 +35,8 @@
 #include "kudu/util/monotime.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_int64(mem_tracker_batch_bytes);
+
 namespace kudu {
 
 using std::equal_to;
@@ -203,6 +206,53 @@ TEST(MemTrackerTest, ScopedTrackedConsumption) {
   ASSERT_EQ(0, m->consumption());
 }
 
+TEST(MemTrackerTest, BatchedAccounting) {
+  FLAGS_mem_tracker_batch_bytes = 1000;
+  shared_ptr<MemTracker> p = MemTracker::CreateTracker(-1, "p");
+  shared_ptr<MemTracker> c = MemTracker::CreateTracker(5000, "c", p,
+                                                       MemTracker::Accounting::BATCHED);
+  // The tracker itself is exact, while the parent trails by less than a
+  // batch for each CPU.
+  for (int i = 0; i < 100; i++) {
+    c->Consume(10);
+  }
+  EXPECT_EQ(1000, c->consumption());
+  EXPECT_LE(p->consumption(), 1000);
+  c->FlushPendingConsumption();
+  EXPECT_EQ(1000, p->consumption());
+
+  // TryConsume() flushes what's pending before giving up.
+  EXPECT_FALSE(c->TryConsume(4500));
+  c->Release(600);
+  EXPECT_EQ(1000, p->consumption());
+  EXPECT_TRUE(c->TryConsume(4500));
+  EXPECT_EQ(4900, p->consumption());
+  EXPECT_EQ(4900, c->consumption());
+
+  // Threads on different CPUs add up to the right total.
+  vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < 10000; j++) {
+        c->Consume(j % 100);
+        c->Release(j % 100 / 2);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  int64_t per_thread = 0;
+  for (int j = 0; j < 10000; j++) {
+    per_thread += j % 100 - j % 100 / 2;
+  }
+  c->FlushPendingConsumption();
+  EXPECT_EQ(4900 + 8 * per_thread, c->consumption());
+  EXPECT_EQ(c->consumption(), p->consumption());
+  c->Release(c->consumption());
+  FLAGS_mem_tracker_batch_bytes = 0;
+}
+
 TEST(MemTrackerTest, CollisionDetection) {
   shared_ptr<MemTracker> p = MemTracker::CreateTracker(-1, "parent");
   shared_ptr<MemTracker> c = MemTracker::CreateTracker(-1, "child", p);
@@ -25,11 +25,23 @@
 #include <memory>
 #include <ostream>
 
+#include <gflags/gflags.h>
+
 #include "kudu/gutil/once.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/process_memory.h"
+#include "kudu/util/striped64.h"
+
+DEFINE_int64(mem_tracker_batch_bytes, 0,
+             "How many bytes of consumption each CPU holds for a memory tracker "
+             "which batches its accounting before passing them to the tracker's "
+             "ancestors. Such trackers are updated at high rates, such as for each "
+             "op of the log cache or each RPC. Their ancestors may lag by this many "
+             "bytes for each CPU. 0 makes every tracker exact.");
+TAG_FLAG(mem_tracker_batch_bytes, experimental);
 
 namespace kudu {
 
@@ -50,37 +62,44 @@ static shared_ptr<MemTracker> root_tracker;
 static GoogleOnceType root_tracker_once = GOOGLE_ONCE_INIT;
 
 void MemTracker::CreateRootTracker() {
-  root_tracker.reset(new MemTracker(-1, "root", shared_ptr<MemTracker>()));
+  root_tracker.reset(new MemTracker(-1, "root", shared_ptr<MemTracker>(), Accounting::EXACT));
   root_tracker->Init();
 }
 
 shared_ptr<MemTracker> MemTracker::CreateTracker(int64_t byte_limit,
                                                  const string& id,
-                                                 shared_ptr<MemTracker> parent) {
+                                                 shared_ptr<MemTracker> parent,
+                                                 Accounting accounting) {
   shared_ptr<MemTracker> real_parent;
   if (parent) {
     real_parent = std::move(parent);
   } else {
     real_parent = GetRootTracker();
   }
-  shared_ptr<MemTracker> tracker(new MemTracker(byte_limit, id, real_parent));
+  shared_ptr<MemTracker> tracker(new MemTracker(byte_limit, id, real_parent, accounting));
   real_parent->AddChildTracker(tracker);
   tracker->Init();
 
   return tracker;
 }
 
-MemTracker::MemTracker(int64_t byte_limit, const string& id, shared_ptr<MemTracker> parent)
+MemTracker::MemTracker(int64_t byte_limit, const string& id, shared_ptr<MemTracker> parent,
+                       Accounting accounting)
     : limit_(byte_limit),
       id_(id),
       descr_(Substitute("memory consumption for $0", id)),
       parent_(std::move(parent)),
-      consumption_(0) {
+      consumption_(0),
+      batch_bytes_(FLAGS_mem_tracker_batch_bytes) {
+  if (accounting == Accounting::BATCHED && batch_bytes_ > 0) {
+    pending_.reset(new PerCpuAdder);
+  }
   VLOG(1) << "Creating tracker " << ToString();
 }
 
 MemTracker::~MemTracker() {
   VLOG(1) << "Destroying tracker " << ToString();
+  FlushPendingConsumption();
   if (parent_) {
     DCHECK(consumption() == 0) << "Memory tracker " << ToString()
         << " has unreleased consumption " << consumption();
@@ -197,9 +216,10 @@ void MemTracker::Consume(int64_t bytes) {
   if (bytes == 0) {
     return;
   }
-  for (auto& tracker : all_trackers_) {
-    tracker->consumption_.IncrementBy(bytes);
+  if (pending_) {
+    bytes = pending_->IncrementAndTakeIfPast(bytes, batch_bytes_);
   }
+  UpdateConsumption(bytes);
 }
 
 bool MemTracker::TryConsume(int64_t bytes) {
@@ -207,7 +227,21 @@ bool MemTracker::TryConsume(int64_t bytes) {
     Release(-bytes);
     return true;
   }
+  if (PREDICT_TRUE(TryConsumeFlushed(bytes))) {
+    return true;
+  }
+  // The CPUs may hold releases which make room.
+  if (pending_) {
+    int64_t flushed = pending_->TakeAll();
+    UpdateConsumption(flushed);
+    if (flushed < 0) {
+      return TryConsumeFlushed(bytes);
+    }
+  }
+  return false;
+}
 
+bool MemTracker::TryConsumeFlushed(int64_t bytes) {
   int i = 0;
   // Walk the tracker tree top-down, consuming memory from each in turn.
   for (i = all_trackers_.size() - 1; i >= 0; --i) {
@@ -245,6 +279,10 @@ void MemTracker::Release(int64_t bytes) {
   if (bytes == 0) {
     return;
   }
+  if (pending_) {
+    UpdateConsumption(pending_->IncrementAndTakeIfPast(-bytes, batch_bytes_));
+    return;
+  }
 
   for (auto& tracker : all_trackers_) {
     tracker->consumption_.IncrementBy(-bytes);
@@ -252,6 +290,28 @@ void MemTracker::Release(int64_t bytes) {
   process_memory::MaybeGCAfterRelease(bytes);
 }
 
+void MemTracker::UpdateConsumption(int64_t bytes) {
+  if (bytes == 0) {
+    return;
+  }
+  for (auto& tracker : all_trackers_) {
+    tracker->consumption_.IncrementBy(bytes);
+  }
+  if (bytes < 0) {
+    process_memory::MaybeGCAfterRelease(-bytes);
+  }
+}
+
+void MemTracker::FlushPendingConsumption() {
+  if (pending_) {
+    UpdateConsumption(pending_->TakeAll());
+  }
+}
+
+int64_t MemTracker::PendingConsumption() const {
+  return pending_->Value();
+}
+
 bool MemTracker::AnyLimitExceeded() {
   for (const auto& tracker : limit_trackers_) {
     if (tracker->LimitExceeded()) {
@@ -264,7 +324,7 @@ bool MemTracker::AnyLimitExceeded() {
 int64_t MemTracker::SpareCapacity() const {
   int64_t result = std::numeric_limits<int64_t>::max();
   for (const auto& tracker : limit_trackers_) {
-    int64_t mem_left = tracker->limit() - tracker->consumption();
+    int64_t mem_left = tracker->limit() - tracker->consumption_.current_value();
     result = std::min(result, mem_left);
   }
   return result;
@@ -31,6 +31,8 @@
 
 namespace kudu {
 
+class PerCpuAdder;
+
 // A MemTracker tracks memory consumption; it contains an optional limit and is
 // arranged into a tree structure such that the consumption tracked by a
 // MemTracker is also tracked by its ancestors.
@@ -54,9 +56,28 @@ namespace kudu {
 // Memory consumption is tracked via calls to Consume()/Release(), either to
 // the tracker itself or to one of its descendants.
 //
+// A tracker created with Accounting::BATCHED keeps the consumption it's given
+// in a counter for each CPU, and only passes it up the tree once the counter
+// of a CPU is --mem_tracker_batch_bytes away from zero. Consume() and
+// Release() then usually cost an uncontended add to a cache line of the
+// current CPU, rather than an atomic update of every ancestor. In exchange,
+// the consumption of the ancestors, and what limits are checked against,
+// lags by up to that many bytes for each CPU.
+//
 // This class is thread-safe.
 class MemTracker : public std::enable_shared_from_this<MemTracker> {
  public:
+  // How a tracker accounts for Consume() and Release().
+  enum class Accounting {
+    // Every call updates the tracker and its ancestors.
+    EXACT,
+
+    // Calls add to a counter of the CPU they run on, which is flushed to the
+    // tracker and its ancestors once it's past --mem_tracker_batch_bytes.
+    // This is the same as EXACT if the flag is 0.
+    BATCHED,
+  };
+
   ~MemTracker();
 
   // Creates and adds the tracker to the tree so that it can be retrieved with
@@ -69,7 +90,8 @@ class MemTracker : public std::enable_shared_from_this<MemTracker> {
   static std::shared_ptr<MemTracker> CreateTracker(
       int64_t byte_limit,
       const std::string& id,
-      std::shared_ptr<MemTracker> parent = std::shared_ptr<MemTracker>());
+      std::shared_ptr<MemTracker> parent = std::shared_ptr<MemTracker>(),
+      Accounting accounting = Accounting::EXACT);
 
   // If a tracker with the specified 'id' and 'parent' exists in the tree, sets
   // 'tracker' to reference that instance. Returns false if no such tracker
@@ -106,6 +128,9 @@ class MemTracker : public std::enable_shared_from_this<MemTracker> {
   // they can all consume 'bytes'. If this brings any of them over, none of them
   // are updated.
   // Returns true if the try succeeded.
+  //
+  // A BATCHED tracker updates the tracker and its ancestors right away, and
+  // flushes its CPUs' counters before giving up.
   bool TryConsume(int64_t bytes);
 
   // Decreases consumption of this tracker and its ancestors by 'bytes'.
@@ -121,25 +146,39 @@ class MemTracker : public std::enable_shared_from_this<MemTracker> {
   // If this tracker has a limit, checks the limit and attempts to free up some memory if
   // the limit is exceeded by calling any added GC functions. Returns true if the limit is
   // exceeded after calling the GC functions. Returns false if there is no limit.
+  //
+  // This reads a single atomic: for a BATCHED tracker, what's left in the
+  // counters of its CPUs, and of its BATCHED descendants, isn't counted.
   bool LimitExceeded() {
-    return limit_ >= 0 && limit_ < consumption();
+    return limit_ >= 0 && limit_ < consumption_.current_value();
   }
 
   // Returns the maximum consumption that can be made without exceeding the limit on
   // this tracker or any of its parents. Returns int64_t::max() if there are no
   // limits and a negative value if any limit is already exceeded.
+  //
+  // Like LimitExceeded(), this leaves out what BATCHED trackers are yet to flush.
   int64_t SpareCapacity() const;
 
+  // Passes what the CPUs of a BATCHED tracker hold up the tree. Does nothing
+  // for an EXACT tracker.
+  void FlushPendingConsumption();
+
 
   int64_t limit() const { return limit_; }
   bool has_limit() const { return limit_ >= 0; }
   const std::string& id() const { return id_; }
 
-  // Returns the memory consumed in bytes.
+  // Returns the memory consumed in bytes. For a BATCHED tracker, this sums
+  // the counters of all the CPUs.
   int64_t consumption() const {
+    if (pending_) {
+      return consumption_.current_value() + PendingConsumption();
+    }
     return consumption_.current_value();
   }
 
+  // For a BATCHED tracker, the peak only covers what has been flushed.
   int64_t peak_consumption() const { return consumption_.max_value(); }
 
   // Retrieve the parent tracker, or NULL If one is not set.
@@ -152,11 +191,22 @@ class MemTracker : public std::enable_shared_from_this<MemTracker> {
  private:
   // byte_limit < 0 means no limit
   // 'id' is the label for LogUsage() and web UI.
-  MemTracker(int64_t byte_limit, const std::string& id, std::shared_ptr<MemTracker> parent);
+  MemTracker(int64_t byte_limit, const std::string& id, std::shared_ptr<MemTracker> parent,
+             Accounting accounting);
 
   // Further initializes the tracker.
   void Init();
 
+  // Adds 'bytes', which may be negative, to the consumption of this tracker
+  // and its ancestors.
+  void UpdateConsumption(int64_t bytes);
+
+  // The variant of TryConsume() which ignores what's pending.
+  bool TryConsumeFlushed(int64_t bytes);
+
+  // Returns the sum of the counters of the CPUs of a BATCHED tracker.
+  int64_t PendingConsumption() const;
+
   // Adds tracker to child_trackers_.
   void AddChildTracker(const std::shared_ptr<MemTracker>& tracker);
 
@@ -176,6 +226,12 @@ class MemTracker : public std::enable_shared_from_this<MemTracker> {
 
   HighWaterMark consumption_;
 
+  // For a BATCHED tracker, the consumption not yet passed up the tree, kept
+  // by CPU, and how far from zero a CPU's gets before it is. nullptr for an
+  // EXACT tracker.
+  std::unique_ptr<PerCpuAdder> pending_;
+  const int64_t batch_bytes_;
+
   // this tracker plus all of its ancestors
   std::vector<MemTracker*> all_trackers_;
   // all_trackers_ with valid limits
@@ -32,9 +32,11 @@
 #include "kudu/gutil/map-util.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/hdr_histogram.h"
+#include "kudu/util/histogram.pb.h"
 #include "kudu/util/jsonreader.h"
 #include "kudu/util/jsonwriter.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/metrics.pb.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
@@ -91,6 +93,32 @@ TEST_F(MetricsTest, SimpleAtomicGaugeTest) {
   ASSERT_EQ(5, mem_usage->value());
 }
 
+METRIC_DEFINE_counter(test_entity, test_per_cpu_counter, "Test Per-CPU Counter",
+                      MetricUnit::kRequests, "Description of test per-CPU counter",
+                      kudu::PER_CPU);
+METRIC_DEFINE_gauge_int64(test_entity, test_per_cpu_gauge, "Test Per-CPU Gauge",
+                          MetricUnit::kBytes, "Description of test per-CPU gauge",
+                          kudu::PER_CPU);
+
+TEST_F(MetricsTest, PerCpuMetricsTest) {
+  scoped_refptr<Counter> requests = METRIC_test_per_cpu_counter.Instantiate(entity_);
+  ASSERT_TRUE(requests->IsUntouched());
+  requests->Increment();
+  requests->IncrementBy(2);
+  ASSERT_EQ(3, requests->value());
+
+  scoped_refptr<AtomicGauge<int64_t>> mem_usage =
+      METRIC_test_per_cpu_gauge.Instantiate(entity_, 10);
+  ASSERT_EQ(10, mem_usage->value());
+  mem_usage->IncrementBy(7);
+  mem_usage->Decrement();
+  ASSERT_EQ(16, mem_usage->value());
+  mem_usage->set_value(5);
+  ASSERT_EQ(5, mem_usage->value());
+  mem_usage->DecrementBy(5);
+  ASSERT_EQ(0, mem_usage->value());
+}
+
 METRIC_DEFINE_gauge_int64(test_entity, test_func_gauge, "Test Function Gauge",
                           MetricUnit::kBytes, "Test Gauge 2");
 
@@ -176,6 +204,29 @@ TEST_F(MetricsTest, SimpleHistogramTest) {
   // TODO: Test coverage needs to be improved a lot.
 }
 
+METRIC_DEFINE_histogram(test_entity, test_per_thread_hist, "Test Per-Thread Histogram",
+                        MetricUnit::kMilliseconds, "foo", 1000000, 3, kudu::PER_THREAD);
+
+TEST_F(MetricsTest, PerThreadHistogramTest) {
+  scoped_refptr<Histogram> hist = METRIC_test_per_thread_hist.Instantiate(entity_);
+  hist->Increment(2);
+  hist->IncrementBy(4, 1);
+  ASSERT_EQ(2, hist->MinValueForTests());
+  ASSERT_EQ(3, hist->MeanValueForTests());
+  ASSERT_EQ(4, hist->MaxValueForTests());
+  ASSERT_EQ(2, hist->TotalCount());
+  ASSERT_EQ(1, hist->CountInBucketForValueForTests(4));
+
+  HistogramSnapshotPB snapshot;
+  MetricJsonOptions opts;
+  opts.include_raw_histograms = true;
+  hist->Increment(4);
+  ASSERT_OK(hist->GetHistogramSnapshotPB(&snapshot, opts));
+  ASSERT_EQ(3, snapshot.total_count());
+  ASSERT_EQ(2, snapshot.counts_size());
+  ASSERT_EQ(2, snapshot.counts(1));
+}
+
 TEST_F(MetricsTest, JsonPrintTest) {
   scoped_refptr<Counter> test_counter = METRIC_test_counter.Instantiate(entity_);
   test_counter->Increment();
@@ -357,6 +408,71 @@ TEST_F(MetricsTest, TestDumpOnlyChanged) {
   ASSERT_STR_CONTAINS(GetJson(new_epoch), "{\"name\":\"test_counter\",\"value\":2}");
 }
 
+// Test that the binary output only includes the metrics modified since the
+// epoch of the previous dump, and that it round-trips histogram buckets.
+TEST_F(MetricsTest, TestWriteAsProtobuf) {
+  scoped_refptr<Counter> test_counter = METRIC_test_counter.Instantiate(entity_);
+  scoped_refptr<Histogram> hist = METRIC_test_hist.Instantiate(entity_);
+  scoped_refptr<AtomicGauge<uint64_t> > atomic_gauge =
+    METRIC_test_gauge.Instantiate(entity_, 0);
+  entity_->SetAttribute("test_attr", "attr_val");
+  test_counter->IncrementBy(3);
+  atomic_gauge->set_value(7);
+  const vector<uint64_t> kValues = { 1, 2, 2, 100, 5000 };
+  for (uint64_t v : kValues) {
+    hist->Increment(v);
+  }
+
+  MetricJsonOptions opts;
+  MetricsSnapshotPB snapshot;
+  ASSERT_OK(registry_.WriteAsProtobuf({ "*" }, opts, &snapshot));
+  ASSERT_EQ(Metric::current_epoch(), snapshot.next_epoch());
+  ASSERT_EQ(1, snapshot.entities_size());
+  const MetricEntitySnapshotPB& entity_pb = snapshot.entities(0);
+  ASSERT_EQ("test_entity", entity_pb.type());
+  ASSERT_EQ("my-test", entity_pb.id());
+  ASSERT_EQ(1, entity_pb.attributes_size());
+  ASSERT_EQ("attr_val", entity_pb.attributes(0).value());
+  ASSERT_EQ(3, entity_pb.metrics_size());
+  for (const MetricSnapshotPB& m : entity_pb.metrics()) {
+    if (m.name() == "test_counter") {
+      ASSERT_EQ(3, m.int_value());
+    } else if (m.name() == "test_gauge") {
+      ASSERT_EQ(7, m.uint_value());
+    } else {
+      ASSERT_EQ("test_hist", m.name());
+      const HistogramDeltaPB& h = m.histogram();
+      ASSERT_EQ(kValues.size(), h.total_count());
+      ASSERT_EQ(5105, h.total_sum());
+      ASSERT_EQ(1, h.min());
+      ASSERT_EQ(hist->MaxValueForTests(), h.max());
+      ASSERT_EQ(4, h.value_deltas_size());
+      ASSERT_EQ(h.value_deltas_size(), h.counts_size());
+      uint64_t value = 0;
+      for (int i = 0; i < h.value_deltas_size(); i++) {
+        value += h.value_deltas(i);
+        ASSERT_EQ(hist->CountInBucketForValueForTests(value), h.counts(i));
+      }
+      ASSERT_GE(value, h.max());
+    }
+  }
+
+  // Nothing changed since the previous dump, so there's nothing to dump.
+  int64_t since_epoch = snapshot.next_epoch();
+  opts.only_modified_in_or_after_epoch = since_epoch;
+  snapshot.Clear();
+  ASSERT_OK(registry_.WriteAsProtobuf({ "*" }, opts, &snapshot));
+  ASSERT_EQ(0, snapshot.entities_size());
+
+  // ... until a metric is modified again.
+  test_counter->Increment();
+  snapshot.Clear();
+  ASSERT_OK(registry_.WriteAsProtobuf({ "*" }, opts, &snapshot));
+  ASSERT_EQ(1, snapshot.entities_size());
+  ASSERT_EQ(1, snapshot.entities(0).metrics_size());
+  ASSERT_EQ("test_counter", snapshot.entities(0).metrics(0).name());
+  ASSERT_EQ(4, snapshot.entities(0).metrics(0).int_value());
+}
 
 // Test that 'include_untouched_metrics=false' prevents dumping counters and histograms
 // which have never been incremented.
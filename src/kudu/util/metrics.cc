@@ -29,6 +29,7 @@
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/hdr_histogram.h"
 #include "kudu/util/histogram.pb.h"
+#include "kudu/util/metrics.pb.h"
 #include "kudu/util/status.h"
 #include "kudu/util/string_case.h"
 
@@ -272,6 +273,61 @@ Status MetricEntity::WriteAsJson(JsonWriter* writer,
   return Status::OK();
 }
 
+Status MetricEntity::WriteAsProtobuf(const vector<string>& requested_metrics,
+                                     const MetricJsonOptions& opts,
+                                     MetricsSnapshotPB* snapshot) const {
+  bool select_all = MatchMetricInList(id(), requested_metrics);
+
+  // Unlike the JSON, the metrics don't need to be in any order.
+  vector<scoped_refptr<Metric>> metrics;
+  AttributeMap attrs;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    for (const MetricMap::value_type& val : metric_map_) {
+      const scoped_refptr<Metric>& metric = val.second;
+      if (!metric->ModifiedInOrAfterEpoch(opts.only_modified_in_or_after_epoch)) {
+        continue;
+      }
+      if (select_all || MatchMetricInList(val.first->name(), requested_metrics)) {
+        metrics.push_back(metric);
+      }
+    }
+    if (metrics.empty()) {
+      return Status::OK();
+    }
+    if (opts.include_entity_attributes) {
+      attrs = attributes_;
+    }
+  }
+
+  MetricEntitySnapshotPB* entity_pb = snapshot->add_entities();
+  for (const auto& m : metrics) {
+    if (!opts.include_untouched_metrics && m->IsUntouched()) {
+      continue;
+    }
+    MetricSnapshotPB* metric_pb = entity_pb->add_metrics();
+    metric_pb->set_name(m->prototype()->name());
+    Status s = m->WriteAsProtobuf(metric_pb, opts);
+    if (PREDICT_FALSE(!s.ok())) {
+      WARN_NOT_OK(s, Substitute("Failed to write $0 as protobuf", m->prototype()->name()));
+      entity_pb->mutable_metrics()->RemoveLast();
+    }
+  }
+  if (entity_pb->metrics_size() == 0) {
+    snapshot->mutable_entities()->RemoveLast();
+    return Status::OK();
+  }
+
+  entity_pb->set_type(prototype_->name());
+  entity_pb->set_id(id_);
+  for (const AttributeMap::value_type& val : attrs) {
+    MetricEntitySnapshotPB::AttributePB* attr_pb = entity_pb->add_attributes();
+    attr_pb->set_key(val.first);
+    attr_pb->set_value(val.second);
+  }
+  return Status::OK();
+}
+
 void MetricEntity::RetireOldMetrics() {
   MonoTime now(MonoTime::Now());
 
@@ -507,6 +563,30 @@ scoped_refptr<MetricEntity> MetricRegistry::FindOrCreateEntity(
 
 std::atomic<int64_t> Metric::g_epoch_;
 
+Status MetricRegistry::WriteAsProtobuf(const vector<string>& requested_metrics,
+                                       const MetricJsonOptions& opts,
+                                       MetricsSnapshotPB* snapshot) const {
+  // The metrics modified from here on are modified in or after the new
+  // epoch, which is what the next scrape asks for.
+  Metric::IncrementEpoch();
+  snapshot->set_next_epoch(Metric::current_epoch());
+
+  EntityMap entities;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    entities = entities_;
+  }
+  for (const auto& e : entities) {
+    WARN_NOT_OK(e.second->WriteAsProtobuf(requested_metrics, opts, snapshot),
+                Substitute("Failed to write entity $0 as protobuf", e.second->id()));
+  }
+
+  // See WriteAsJson().
+  entities.clear();
+  const_cast<MetricRegistry*>(this)->RetireOldMetrics();
+  return Status::OK();
+}
+
 Metric::Metric(const MetricPrototype* prototype)
     : prototype_(prototype),
       m_epoch_(current_epoch()) {
@@ -547,6 +627,40 @@ Status Gauge::WriteAsJson(JsonWriter* writer,
   return Status::OK();
 }
 
+Status Gauge::WriteAsProtobuf(MetricSnapshotPB* pb,
+                              const MetricJsonOptions& /*opts*/) const {
+  WriteValue(pb);
+  return Status::OK();
+}
+
+void Gauge::SetValue(MetricSnapshotPB* pb, int32_t value) {
+  pb->set_int_value(value);
+}
+
+void Gauge::SetValue(MetricSnapshotPB* pb, uint32_t value) {
+  pb->set_uint_value(value);
+}
+
+void Gauge::SetValue(MetricSnapshotPB* pb, int64_t value) {
+  pb->set_int_value(value);
+}
+
+void Gauge::SetValue(MetricSnapshotPB* pb, uint64_t value) {
+  pb->set_uint_value(value);
+}
+
+void Gauge::SetValue(MetricSnapshotPB* pb, double value) {
+  pb->set_double_value(value);
+}
+
+void Gauge::SetValue(MetricSnapshotPB* pb, bool value) {
+  pb->set_bool_value(value);
+}
+
+void Gauge::SetValue(MetricSnapshotPB* pb, const string& value) {
+  pb->set_string_value(value);
+}
+
 //
 // StringGauge
 //
@@ -570,6 +684,10 @@ void StringGauge::WriteValue(JsonWriter* writer) const {
   writer->String(value());
 }
 
+void StringGauge::WriteValue(MetricSnapshotPB* pb) const {
+  SetValue(pb, value());
+}
+
 //
 // Counter
 //
@@ -580,10 +698,13 @@ scoped_refptr<Counter> CounterPrototype::Instantiate(const scoped_refptr<MetricE
 }
 
 Counter::Counter(const CounterPrototype* proto) : Metric(proto) {
+  if (proto->flags() & PER_CPU) {
+    per_cpu_value_.reset(new PerCpuAdder);
+  }
 }
 
 int64_t Counter::value() const {
-  return value_.Value();
+  return per_cpu_value_ ? per_cpu_value_->Value() : value_.Value();
 }
 
 void Counter::Increment() {
@@ -592,6 +713,10 @@ void Counter::Increment() {
 
 void Counter::IncrementBy(int64_t amount) {
   UpdateModificationEpoch();
+  if (per_cpu_value_) {
+    per_cpu_value_->IncrementBy(amount);
+    return;
+  }
   value_.IncrementBy(amount);
 }
 
@@ -608,6 +733,12 @@ Status Counter::WriteAsJson(JsonWriter* writer,
   return Status::OK();
 }
 
+Status Counter::WriteAsProtobuf(MetricSnapshotPB* pb,
+                                const MetricJsonOptions& /*opts*/) const {
+  pb->set_int_value(value());
+  return Status::OK();
+}
+
 /////////////////////////////////////////////////
 // HistogramPrototype
 /////////////////////////////////////////////////
@@ -638,15 +769,21 @@ scoped_refptr<Histogram> HistogramPrototype::Instantiate(
 Histogram::Histogram(const HistogramPrototype* proto)
   : Metric(proto),
     histogram_(new HdrHistogram(proto->max_trackable_value(), proto->num_sig_digits())) {
+  if (proto->flags() & PER_THREAD) {
+    recorder_.reset(new HdrHistogramRecorder(histogram_.get()));
+  }
 }
 
 void Histogram::Increment(int64_t value) {
-  UpdateModificationEpoch();
-  histogram_->Increment(value);
+  IncrementBy(value, 1);
 }
 
 void Histogram::IncrementBy(int64_t value, int64_t amount) {
   UpdateModificationEpoch();
+  if (recorder_) {
+    recorder_->IncrementBy(value, amount);
+    return;
+  }
   histogram_->IncrementBy(value, amount);
 }
 
@@ -661,8 +798,38 @@ Status Histogram::WriteAsJson(JsonWriter* writer,
   return Status::OK();
 }
 
+Status Histogram::WriteAsProtobuf(MetricSnapshotPB* pb,
+                                  const MetricJsonOptions& opts) const {
+  FlushPerThreadCounts();
+  HistogramDeltaPB* delta_pb = pb->mutable_histogram();
+  if (histogram_->TotalCount() == 0) {
+    delta_pb->set_total_count(0);
+    return Status::OK();
+  }
+  HdrHistogram snapshot(*histogram_);
+  if (opts.refresh_histogram_metrics) {
+    histogram_->ResetHistogram();
+  }
+  delta_pb->set_total_count(snapshot.TotalCount());
+  delta_pb->set_total_sum(snapshot.TotalSum());
+  delta_pb->set_min(snapshot.MinValue());
+  delta_pb->set_max(snapshot.MaxValue());
+
+  uint64_t prev_value = 0;
+  RecordedValuesIterator iter(&snapshot);
+  while (iter.HasNext()) {
+    HistogramIterationValue value;
+    RETURN_NOT_OK(iter.Next(&value));
+    delta_pb->add_value_deltas(value.value_iterated_to - prev_value);
+    delta_pb->add_counts(value.count_at_value_iterated_to);
+    prev_value = value.value_iterated_to;
+  }
+  return Status::OK();
+}
+
 Status Histogram::GetHistogramSnapshotPB(HistogramSnapshotPB* snapshot_pb,
                                          const MetricJsonOptions& opts) const {
+  FlushPerThreadCounts();
   snapshot_pb->set_name(prototype_->name());
   if (opts.include_schema_info) {
     snapshot_pb->set_type(MetricType::Name(prototype_->type()));
@@ -713,21 +880,26 @@ Status Histogram::GetHistogramSnapshotPB(HistogramSnapshotPB* snapshot_pb,
 }
 
 uint64_t Histogram::CountInBucketForValueForTests(uint64_t value) const {
+  FlushPerThreadCounts();
   return histogram_->CountInBucketForValue(value);
 }
 
 uint64_t Histogram::TotalCount() const {
+  FlushPerThreadCounts();
   return histogram_->TotalCount();
 }
 
 uint64_t Histogram::MinValueForTests() const {
+  FlushPerThreadCounts();
   return histogram_->MinValue();
 }
 
 uint64_t Histogram::MaxValueForTests() const {
+  FlushPerThreadCounts();
   return histogram_->MaxValue();
 }
 double Histogram::MeanValueForTests() const {
+  FlushPerThreadCounts();
   return histogram_->MeanValue();
 }
 
@@ -104,6 +104,16 @@
 //                            "Total number of threads started on this server",
 //                            kudu::EXPOSE_AS_COUNTER);
 //
+// Counters and integer gauges which are updated from many threads at high
+// rates may be defined with the 'PER_CPU' flag, which shards their values over
+// one cache line per CPU (see PerCpuAdder), so that updating them costs the
+// same however many cores do so. For example:
+//
+// METRIC_DEFINE_counter(server, rpcs_queued, "RPCs Queued",
+//                       kudu::MetricUnit::kRequests,
+//                       "Number of RPCs queued on the service queue",
+//                       kudu::PER_CPU);
+//
 //
 // Metrics ownership
 // ------------------------------------------------------------
@@ -221,6 +231,17 @@
 //      ...
 // ]
 //
+// =============
+// Binary output
+// =============
+//
+// MetricRegistry::WriteAsProtobuf() dumps the same metrics as a
+// MetricsSnapshotPB (see metrics.proto), for scrapers which poll too often to
+// pay for formatting and parsing JSON. It leaves out the schema of the
+// metrics, and hands back the epoch to ask the next scrape for, so that each
+// scrape only costs as much as the metrics which changed since the previous
+// one. Histograms are dumped as their recorded buckets, delta-encoded.
+//
 /////////////////////////////////////////////////////
 
 #include <atomic>
@@ -259,9 +280,9 @@
 
 // Convenience macros to define metric prototypes.
 // See the documentation at the top of this file for example usage.
-#define METRIC_DEFINE_counter(entity, name, label, unit, desc)   \
+#define METRIC_DEFINE_counter(entity, name, label, unit, desc, ...) \
   ::kudu::CounterPrototype METRIC_##name(                        \
-      ::kudu::MetricPrototype::CtorArgs(#entity, #name, label, unit, desc))
+      ::kudu::MetricPrototype::CtorArgs(#entity, #name, label, unit, desc, ## __VA_ARGS__))
 
 #define METRIC_DEFINE_gauge_string(entity, name, label, unit, desc, ...) \
   ::kudu::GaugePrototype<std::string> METRIC_##name(                 \
@@ -285,9 +306,9 @@
   ::kudu::GaugePrototype<double> METRIC_##name(                      \
       ::kudu::MetricPrototype::CtorArgs(#entity, #name, label, unit, desc, ## __VA_ARGS__))
 
-#define METRIC_DEFINE_histogram(entity, name, label, unit, desc, max_val, num_sig_digits) \
+#define METRIC_DEFINE_histogram(entity, name, label, unit, desc, max_val, num_sig_digits, ...) \
   ::kudu::HistogramPrototype METRIC_##name(                                       \
-      ::kudu::MetricPrototype::CtorArgs(#entity, #name, label, unit, desc), \
+      ::kudu::MetricPrototype::CtorArgs(#entity, #name, label, unit, desc, ## __VA_ARGS__), \
     max_val, num_sig_digits)
 
 // The following macros act as forward declarations for entity types and metric prototypes.
@@ -349,6 +370,8 @@ class HistogramPrototype;
 class HistogramSnapshotPB;
 
 class MetricEntity;
+class MetricSnapshotPB;
+class MetricsSnapshotPB;
 
 } // namespace kudu
 
@@ -497,6 +520,11 @@ class MetricEntity : public RefCountedThreadSafe<MetricEntity> {
                      const std::vector<std::string>& requested_metrics,
                      const MetricJsonOptions& opts) const;
 
+  // See MetricRegistry::WriteAsProtobuf()
+  Status WriteAsProtobuf(const std::vector<std::string>& requested_metrics,
+                         const MetricJsonOptions& opts,
+                         MetricsSnapshotPB* snapshot) const;
+
   const MetricMap& UnsafeMetricsMapForTests() const { return metric_map_; }
 
   // Mark that the given metric should never be retired until the metric
@@ -574,6 +602,10 @@ class Metric : public RefCountedThreadSafe<Metric> {
   virtual Status WriteAsJson(JsonWriter* writer,
                              const MetricJsonOptions& opts) const = 0;
 
+  // ... and as the value of a metric, with no schema, for the binary output.
+  virtual Status WriteAsProtobuf(MetricSnapshotPB* pb,
+                                 const MetricJsonOptions& opts) const = 0;
+
   const MetricPrototype* prototype() const { return prototype_; }
 
   // Return true if this metric has never been touched.
@@ -662,6 +694,16 @@ class MetricRegistry {
                      const std::vector<std::string>& requested_metrics,
                      const MetricJsonOptions& opts) const;
 
+  // Like WriteAsJson(), but dumps the metrics into 'snapshot', leaving out the
+  // entities none of whose metrics are dumped.
+  //
+  // This also advances the metrics epoch, and sets 'snapshot->next_epoch()' to
+  // the 'only_modified_in_or_after_epoch' which gets the metrics modified
+  // after this call.
+  Status WriteAsProtobuf(const std::vector<std::string>& requested_metrics,
+                         const MetricJsonOptions& opts,
+                         MetricsSnapshotPB* snapshot) const;
+
   // For each registered entity, retires orphaned metrics. If an entity has no more
   // metrics and there are no external references, entities are removed as well.
   //
@@ -726,7 +768,16 @@ class MetricPrototypeRegistry {
 enum PrototypeFlags {
   // Flag which causes a Gauge prototype to expose itself as if it
   // were a counter.
-  EXPOSE_AS_COUNTER = 1 << 0
+  EXPOSE_AS_COUNTER = 1 << 0,
+
+  // Flag which shards the values of a Counter or an integer AtomicGauge over
+  // one cache line per CPU, which are summed when the value is read.
+  PER_CPU = 1 << 1,
+
+  // Flag which makes a Histogram record into counts of each recording thread,
+  // which are merged into the histogram when it's read. See
+  // HdrHistogramRecorder.
+  PER_THREAD = 1 << 2,
 };
 
 class MetricPrototype {
@@ -761,6 +812,7 @@ class MetricPrototype {
   const char* label() const { return args_.label_; }
   MetricUnit::Type unit() const { return args_.unit_; }
   const char* description() const { return args_.description_; }
+  uint32_t flags() const { return args_.flags_; }
   virtual MetricType::Type type() const = 0;
 
   // Writes the fields of this prototype to the given JSON writer.
@@ -821,9 +873,21 @@ class Gauge : public Metric {
   virtual ~Gauge() {}
   virtual Status WriteAsJson(JsonWriter* w,
                              const MetricJsonOptions& opts) const override;
+  virtual Status WriteAsProtobuf(MetricSnapshotPB* pb,
+                                 const MetricJsonOptions& opts) const override;
 
  protected:
   virtual void WriteValue(JsonWriter* writer) const = 0;
+  virtual void WriteValue(MetricSnapshotPB* pb) const = 0;
+
+  // Set the field of 'pb' for the type of 'value'.
+  static void SetValue(MetricSnapshotPB* pb, int32_t value);
+  static void SetValue(MetricSnapshotPB* pb, uint32_t value);
+  static void SetValue(MetricSnapshotPB* pb, int64_t value);
+  static void SetValue(MetricSnapshotPB* pb, uint64_t value);
+  static void SetValue(MetricSnapshotPB* pb, double value);
+  static void SetValue(MetricSnapshotPB* pb, bool value);
+  static void SetValue(MetricSnapshotPB* pb, const std::string& value);
  private:
   DISALLOW_COPY_AND_ASSIGN(Gauge);
 };
@@ -841,6 +905,7 @@ class StringGauge : public Gauge {
 
  protected:
   virtual void WriteValue(JsonWriter* writer) const override;
+  virtual void WriteValue(MetricSnapshotPB* pb) const override;
  private:
   std::string value_;
   mutable simple_spinlock lock_;  // Guards value_
@@ -854,19 +919,38 @@ class AtomicGauge : public Gauge {
   AtomicGauge(const GaugePrototype<T>* proto, T initial_value)
     : Gauge(proto),
       value_(initial_value) {
+    if (proto->flags() & PER_CPU) {
+      per_cpu_value_.reset(new PerCpuAdder);
+      per_cpu_value_->Set(static_cast<int64_t>(initial_value));
+    }
   }
   T value() const {
+    if (per_cpu_value_) {
+      return static_cast<T>(per_cpu_value_->Value());
+    }
     return static_cast<T>(value_.Load(kMemOrderRelease));
   }
   virtual void set_value(const T& value) {
+    if (per_cpu_value_) {
+      per_cpu_value_->Set(static_cast<int64_t>(value));
+      return;
+    }
     value_.Store(static_cast<int64_t>(value), kMemOrderNoBarrier);
   }
   void Increment() {
     UpdateModificationEpoch();
+    if (per_cpu_value_) {
+      per_cpu_value_->Increment();
+      return;
+    }
     value_.IncrementBy(1, kMemOrderNoBarrier);
   }
   virtual void IncrementBy(int64_t amount) {
     UpdateModificationEpoch();
+    if (per_cpu_value_) {
+      per_cpu_value_->IncrementBy(amount);
+      return;
+    }
     value_.IncrementBy(amount, kMemOrderNoBarrier);
   }
   void Decrement() {
@@ -882,7 +966,12 @@ class AtomicGauge : public Gauge {
   virtual void WriteValue(JsonWriter* writer) const override {
     writer->Value(value());
   }
+  virtual void WriteValue(MetricSnapshotPB* pb) const override {
+    SetValue(pb, value());
+  }
   AtomicInt<int64_t> value_;
+  // Set instead of 'value_' if the gauge is PER_CPU.
+  gscoped_ptr<PerCpuAdder> per_cpu_value_;
  private:
   DISALLOW_COPY_AND_ASSIGN(AtomicGauge);
 };
@@ -957,6 +1046,10 @@ class FunctionGauge : public Gauge {
     writer->Value(value());
   }
 
+  virtual void WriteValue(MetricSnapshotPB* pb) const override {
+    SetValue(pb, value());
+  }
+
   // Reset this FunctionGauge to return a specific value.
   // This should be used during destruction. If you want a settable
   // Gauge, use a normal Gauge instead of a FunctionGauge.
@@ -1043,6 +1136,8 @@ class Counter : public Metric {
   void IncrementBy(int64_t amount);
   virtual Status WriteAsJson(JsonWriter* w,
                              const MetricJsonOptions& opts) const override;
+  virtual Status WriteAsProtobuf(MetricSnapshotPB* pb,
+                                 const MetricJsonOptions& opts) const override;
 
   virtual bool IsUntouched() const override {
     return value() == 0;
@@ -1056,6 +1151,8 @@ class Counter : public Metric {
   explicit Counter(const CounterPrototype* proto);
 
   LongAdder value_;
+  // Set instead of 'value_' if the counter is PER_CPU.
+  gscoped_ptr<PerCpuAdder> per_cpu_value_;
   DISALLOW_COPY_AND_ASSIGN(Counter);
 };
 
@@ -1091,6 +1188,8 @@ class Histogram : public Metric {
 
   virtual Status WriteAsJson(JsonWriter* w,
                              const MetricJsonOptions& opts) const override;
+  virtual Status WriteAsProtobuf(MetricSnapshotPB* pb,
+                                 const MetricJsonOptions& opts) const override;
 
   // Returns a snapshot of this histogram including the bucketed values and counts.
   Status GetHistogramSnapshotPB(HistogramSnapshotPB* snapshot_pb,
@@ -1098,7 +1197,10 @@ class Histogram : public Metric {
 
   // Returns a pointer to the underlying histogram. The implementation of HdrHistogram
   // is thread safe.
-  const HdrHistogram* histogram() const { return histogram_.get(); }
+  const HdrHistogram* histogram() const {
+    FlushPerThreadCounts();
+    return histogram_.get();
+  }
 
   uint64_t CountInBucketForValueForTests(uint64_t value) const;
   uint64_t MinValueForTests() const;
@@ -1114,7 +1216,18 @@ class Histogram : public Metric {
   friend class MetricEntity;
   explicit Histogram(const HistogramPrototype* proto);
 
+  // Merges into 'histogram_' what the threads recorded, if the histogram is
+  // PER_THREAD.
+  void FlushPerThreadCounts() const {
+    if (recorder_) {
+      recorder_->Flush();
+    }
+  }
+
   const gscoped_ptr<HdrHistogram> histogram_;
+  // Set, and recorded into instead of 'histogram_', if the histogram is
+  // PER_THREAD.
+  gscoped_ptr<HdrHistogramRecorder> recorder_;
   DISALLOW_COPY_AND_ASSIGN(Histogram);
 };
 
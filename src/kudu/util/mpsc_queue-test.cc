@@ -0,0 +1,198 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/mpsc_queue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/blocking_queue.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DEFINE_int32(mpsc_queue_num_producers, 16,
+             "Number of threads putting elements in the queues of the benchmark");
+DEFINE_int32(mpsc_queue_puts_per_producer, 50000,
+             "Number of elements each producer of the benchmark puts");
+
+using std::string;
+using std::thread;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+
+TEST(MpscQueueTest, TestBlockingDrainTo) {
+  MpscQueue<int32_t> test_queue(3);
+  ASSERT_EQ(test_queue.Put(1), QUEUE_SUCCESS);
+  ASSERT_EQ(test_queue.Put(2), QUEUE_SUCCESS);
+  ASSERT_EQ(test_queue.Put(3), QUEUE_SUCCESS);
+  vector<int32_t> out = { 0 };
+  ASSERT_OK(test_queue.BlockingDrainTo(&out, MonoTime::Now() + MonoDelta::FromSeconds(30)));
+  ASSERT_EQ((vector<int32_t>{ 0, 1, 2, 3 }), out);
+  ASSERT_TRUE(test_queue.empty());
+
+  // Set a deadline in the past and ensure we time out.
+  Status s = test_queue.BlockingDrainTo(&out, MonoTime::Now() - MonoDelta::FromSeconds(1));
+  ASSERT_TRUE(s.IsTimedOut());
+
+  // Ensure that if the queue is shut down, we get Aborted status.
+  test_queue.Shutdown();
+  s = test_queue.BlockingDrainTo(&out, MonoTime::Now() - MonoDelta::FromSeconds(1));
+  ASSERT_TRUE(s.IsAborted());
+  ASSERT_EQ(test_queue.Put(4), QUEUE_SHUTDOWN);
+  ASSERT_FALSE(test_queue.BlockingPut(4));
+}
+
+// Test that, when the queue is shut down with elements still pending,
+// Drain still returns OK until the elements are all gone.
+TEST(MpscQueueTest, TestDrainAfterShutdown) {
+  MpscQueue<int32_t> q(3);
+  ASSERT_EQ(q.Put(1), QUEUE_SUCCESS);
+  ASSERT_EQ(q.Put(2), QUEUE_SUCCESS);
+  q.Shutdown();
+
+  vector<int32_t> out;
+  ASSERT_OK(q.BlockingDrainTo(&out));
+  ASSERT_EQ((vector<int32_t>{ 1, 2 }), out);
+  Status s = q.BlockingDrainTo(&out);
+  ASSERT_TRUE(s.IsAborted()) << s.ToString();
+}
+
+namespace {
+
+struct LengthLogicalSize {
+  static size_t logical_size(const string& s) {
+    return s.length();
+  }
+};
+
+} // anonymous namespace
+
+TEST(MpscQueueTest, TestLogicalSize) {
+  MpscQueue<string, LengthLogicalSize> test_queue(4);
+  ASSERT_EQ(test_queue.Put("a"), QUEUE_SUCCESS);
+  ASSERT_EQ(test_queue.Put("bcd"), QUEUE_SUCCESS);
+  ASSERT_EQ(test_queue.Put("e"), QUEUE_FULL);
+
+  // Draining makes room again.
+  vector<string> out;
+  ASSERT_OK(test_queue.BlockingDrainTo(&out));
+  ASSERT_EQ(test_queue.Put("e"), QUEUE_SUCCESS);
+}
+
+// Test that a put into a full queue waits for the consumer to make room, and
+// that a drain waits for a put.
+TEST(MpscQueueTest, TestBlockingPutAndDrain) {
+  MpscQueue<int32_t> q(1);
+  ASSERT_TRUE(q.BlockingPut(1));
+  std::atomic<bool> put_done(false);
+  thread producer([&]() {
+    CHECK(q.BlockingPut(2));
+    put_done = true;
+  });
+  SleepFor(MonoDelta::FromMilliseconds(50));
+  ASSERT_FALSE(put_done);
+
+  vector<int32_t> out;
+  ASSERT_OK(q.BlockingDrainTo(&out));
+  ASSERT_OK(q.BlockingDrainTo(&out, MonoTime::Now() + MonoDelta::FromSeconds(30)));
+  producer.join();
+  ASSERT_TRUE(put_done);
+  ASSERT_EQ((vector<int32_t>{ 1, 2 }), out);
+
+  // A consumer waiting without a deadline is woken by a put, and then by the
+  // shutdown.
+  thread consumer([&]() {
+    vector<int32_t> drained;
+    CHECK_OK(q.BlockingDrainTo(&drained));
+    CHECK_EQ(1, drained.size());
+    CHECK(q.BlockingDrainTo(&drained).IsAborted());
+  });
+  SleepFor(MonoDelta::FromMilliseconds(50));
+  ASSERT_TRUE(q.BlockingPut(3));
+  SleepFor(MonoDelta::FromMilliseconds(50));
+  q.Shutdown();
+  consumer.join();
+}
+
+// Runs 'num_producers' threads which each put 'puts_per_producer' elements
+// into a queue of type 'Queue', one by one, while a single consumer drains
+// them. Checks that the elements of each producer come out in the order it
+// put them in, and returns how long it took to drain them all.
+template <class Queue>
+MonoDelta RunProducers(int num_producers, int puts_per_producer) {
+  Queue q(1024);
+  vector<thread> producers;
+  MonoTime start = MonoTime::Now();
+  for (int p = 0; p < num_producers; p++) {
+    producers.emplace_back([&, p]() {
+      for (int i = 0; i < puts_per_producer; i++) {
+        CHECK(q.BlockingPut((static_cast<int64_t>(p) << 32) | i));
+      }
+    });
+  }
+
+  vector<int64_t> next(num_producers, 0);
+  int64_t remaining = static_cast<int64_t>(num_producers) * puts_per_producer;
+  vector<int64_t> out;
+  while (remaining > 0) {
+    out.clear();
+    CHECK_OK(q.BlockingDrainTo(&out));
+    for (int64_t elem : out) {
+      int p = static_cast<int>(elem >> 32);
+      CHECK_EQ(next[p]++, elem & 0xffffffff);
+    }
+    remaining -= out.size();
+  }
+  MonoDelta elapsed = MonoTime::Now() - start;
+  for (auto& t : producers) {
+    t.join();
+  }
+  q.Shutdown();
+  return elapsed;
+}
+
+TEST(MpscQueueTest, TestMultipleProducers) {
+  RunProducers<MpscQueue<int64_t>>(8, 10000);
+}
+
+// Compares the time it takes many producers to go through a BlockingQueue
+// and an MpscQueue.
+TEST(MpscQueueTest, TestManyProducersBenchmark) {
+  const int num_producers = FLAGS_mpsc_queue_num_producers;
+  const int puts = AllowSlowTests() ? FLAGS_mpsc_queue_puts_per_producer :
+                                      FLAGS_mpsc_queue_puts_per_producer / 10;
+  MonoDelta blocking = RunProducers<BlockingQueue<int64_t>>(num_producers, puts);
+  MonoDelta lock_free = RunProducers<MpscQueue<int64_t>>(num_producers, puts);
+  LOG(INFO) << Substitute("$0 producers putting $1 elements each: BlockingQueue took $2, "
+                          "MpscQueue took $3",
+                          num_producers, puts, blocking.ToString(), lock_free.ToString());
+}
+
+} // namespace kudu
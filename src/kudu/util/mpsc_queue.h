@@ -0,0 +1,271 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/atomicops.h"
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+#include "kudu/util/blocking_queue.h"
+#include "kudu/util/condition_variable.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+// A multi-producer, single-consumer queue with the same size-based
+// backpressure and batch drain as BlockingQueue, but which producers push to
+// without taking a lock: elements are pushed onto a lock-free stack, which
+// the consumer takes as a whole and reverses to drain them in FIFO order.
+//
+// The lock, and the condition variables, are only used by a producer which
+// waits for the queue to have room and by a consumer which waits for the
+// queue to have elements, and are only signalled when one of them waits.
+//
+// Only one thread may drain the queue at a time.
+template <typename T, class LOGICAL_SIZE = DefaultLogicalSize>
+class MpscQueue {
+ public:
+  explicit MpscQueue(size_t max_size)
+    : head_(nullptr),
+      size_(0),
+      max_size_(max_size),
+      shutdown_(false),
+      active_producers_(0),
+      waiting_producers_(0),
+      consumer_waiting_(false),
+      not_empty_(&lock_),
+      not_full_(&lock_) {
+  }
+
+  // If the queue holds a bare pointer, it must be empty on destruction, since
+  // it may have ownership of the pointer.
+  ~MpscQueue() {
+    DCHECK(empty() || !std::is_pointer<T>::value)
+        << "MpscQueue holds bare pointers at destruction time";
+    Node* node = head_.load(std::memory_order_relaxed);
+    while (node) {
+      Node* next = node->next;
+      delete node;
+      node = next;
+    }
+  }
+
+  // Get all elements from the queue and append them to a vector, in the order
+  // they were put.
+  //
+  // If 'deadline' passes and no elements have been returned from the
+  // queue, returns Status::TimedOut(). If 'deadline' is uninitialized,
+  // no deadline is used.
+  //
+  // If the queue has been shut down, but there are still elements waiting,
+  // then it returns those elements as if the queue were not yet shut down.
+  //
+  // Returns:
+  // - OK if successful
+  // - TimedOut if the deadline passed
+  // - Aborted if the queue shut down
+  Status BlockingDrainTo(std::vector<T>* out, MonoTime deadline = MonoTime()) {
+    while (true) {
+      if (TakeAll(out)) {
+        return Status::OK();
+      }
+      if (PREDICT_FALSE(shutdown_.load())) {
+        // A producer which saw the queue open may still be pushing: the queue
+        // is only drained for good once it's done.
+        if (active_producers_.load() == 0) {
+          return TakeAll(out) ? Status::OK() : Status::Aborted("");
+        }
+        base::subtle::PauseCPU();
+        continue;
+      }
+
+      MutexLock l(lock_);
+      consumer_waiting_.store(true);
+      while (head_.load() == nullptr && !shutdown_.load()) {
+        if (!deadline.Initialized()) {
+          not_empty_.Wait();
+        } else if (PREDICT_FALSE(!not_empty_.WaitUntil(deadline))) {
+          consumer_waiting_.store(false);
+          return Status::TimedOut("");
+        }
+      }
+      consumer_waiting_.store(false);
+    }
+  }
+
+  // Attempts to put the given value in the queue.
+  // Returns:
+  //   QUEUE_SUCCESS: if successfully inserted
+  //   QUEUE_FULL: if the queue has reached max_size
+  //   QUEUE_SHUTDOWN: if someone has already called Shutdown()
+  QueueStatus Put(const T& val) {
+    if (size_.load(std::memory_order_relaxed) >= max_size_) {
+      return QUEUE_FULL;
+    }
+    ScopedProducer producer(this);
+    if (shutdown_.load()) {
+      return QUEUE_SHUTDOWN;
+    }
+    Push(val);
+    return QUEUE_SUCCESS;
+  }
+
+  // Puts the given value in the queue; if the queue is full, blocks until
+  // space becomes available. Returns false if we were shutdown prior
+  // to enqueueing the element.
+  bool BlockingPut(const T& val) {
+    while (true) {
+      {
+        ScopedProducer producer(this);
+        if (shutdown_.load()) {
+          return false;
+        }
+        if (size_.load(std::memory_order_relaxed) < max_size_) {
+          Push(val);
+          return true;
+        }
+      }
+      MutexLock l(lock_);
+      waiting_producers_.fetch_add(1);
+      while (!shutdown_.load() && size_.load() >= max_size_) {
+        not_full_.Wait();
+      }
+      waiting_producers_.fetch_sub(1);
+    }
+  }
+
+  // Shut down the queue.
+  // When a queue is shut down, no more elements can be added to it, and
+  // Put() will return QUEUE_SHUTDOWN. Existing elements will drain out of it,
+  // and then BlockingDrainTo() will start returning Aborted.
+  void Shutdown() {
+    shutdown_.store(true);
+    MutexLock l(lock_);
+    not_full_.Broadcast();
+    not_empty_.Broadcast();
+  }
+
+  bool empty() const {
+    return head_.load() == nullptr;
+  }
+
+  size_t max_size() const {
+    return max_size_;
+  }
+
+ private:
+  struct Node {
+    T val;
+    Node* next;
+  };
+
+  // Counts a producer in 'active_producers_' for its lifetime, so that the
+  // consumer doesn't take the queue for drained while it's pushing.
+  class ScopedProducer {
+   public:
+    explicit ScopedProducer(MpscQueue* queue) : queue_(queue) {
+      queue_->active_producers_.fetch_add(1);
+    }
+    ~ScopedProducer() {
+      queue_->active_producers_.fetch_sub(1);
+    }
+   private:
+    MpscQueue* const queue_;
+  };
+
+  void Push(const T& val) {
+    Node* node = new Node{ val, head_.load(std::memory_order_relaxed) };
+    size_.fetch_add(LOGICAL_SIZE::logical_size(val), std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(node->next, node)) {
+    }
+    // The consumer sets 'consumer_waiting_' before checking 'head_' under
+    // 'lock_', so either it sees the push or it's waiting for the signal.
+    if (consumer_waiting_.load()) {
+      MutexLock l(lock_);
+      not_empty_.Signal();
+    }
+  }
+
+  // Appends all elements to 'out', oldest first. Returns false if the queue
+  // was empty.
+  bool TakeAll(std::vector<T>* out) {
+    Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+    if (!node) {
+      return false;
+    }
+    Node* reversed = nullptr;
+    size_t num_nodes = 0;
+    while (node) {
+      Node* next = node->next;
+      node->next = reversed;
+      reversed = node;
+      node = next;
+      num_nodes++;
+    }
+    out->reserve(out->size() + num_nodes);
+    size_t logical_size = 0;
+    while (reversed) {
+      Node* next = reversed->next;
+      logical_size += LOGICAL_SIZE::logical_size(reversed->val);
+      out->push_back(std::move(reversed->val));
+      delete reversed;
+      reversed = next;
+    }
+    size_.fetch_sub(logical_size);
+    // A producer increments 'waiting_producers_' under 'lock_' before it
+    // checks the size, so either it sees the room made here or it's waiting
+    // for the signal.
+    if (waiting_producers_.load() > 0) {
+      MutexLock l(lock_);
+      not_full_.Broadcast();
+    }
+    return true;
+  }
+
+  // The most recently pushed element, linked to the ones pushed before it.
+  std::atomic<Node*> head_;
+
+  // The sum of the logical sizes of the elements in the queue.
+  std::atomic<size_t> size_;
+  const size_t max_size_;
+
+  std::atomic<bool> shutdown_;
+
+  // The producers which may push an element, and those which are waiting for
+  // the queue to have room.
+  std::atomic<int> active_producers_;
+  std::atomic<int> waiting_producers_;
+
+  // Whether the consumer is waiting for the queue to have elements.
+  std::atomic<bool> consumer_waiting_;
+
+  Mutex lock_;
+  ConditionVariable not_empty_;
+  ConditionVariable not_full_;
+
+  DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+} // namespace kudu
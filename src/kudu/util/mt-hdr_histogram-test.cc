@@ -113,4 +113,51 @@ TEST_F(MtHdrHistogramTest, ConcurrentCopyWhileWritingTest) {
   delete[] threads;
 }
 
+// Record from many threads through a recorder while flushing, and check that
+// the flushes add up to exactly what was recorded, including by the threads
+// which exited before the last flush.
+TEST_F(MtHdrHistogramTest, ConcurrentRecorderTest) {
+  const uint64_t kMaxValue = 100000;
+  HdrHistogram hist(kMaxValue, 3);
+  HdrHistogram expected(kMaxValue, 3);
+  {
+    HdrHistogramRecorder recorder(&hist);
+    auto record = [&](int thread_idx) {
+      for (uint64_t i = 0; i < num_times_; i++) {
+        recorder.Increment((thread_idx * 7919 + i * 31) % (kMaxValue * 2));
+      }
+    };
+    for (int t = 0; t < num_threads_; t++) {
+      for (uint64_t i = 0; i < num_times_; i++) {
+        expected.Increment((t * 7919 + i * 31) % (kMaxValue * 2));
+      }
+    }
+
+    vector<scoped_refptr<kudu::Thread>> threads(num_threads_);
+    for (int i = 0; i < num_threads_; i++) {
+      CHECK_OK(kudu::Thread::Create("test", strings::Substitute("thread-$0", i),
+          [&record, i]() { record(i); }, &threads[i]));
+    }
+    uint64_t last_count = 0;
+    for (int i = 0; i < 10; i++) {
+      recorder.Flush();
+      ASSERT_GE(hist.TotalCount(), last_count);
+      last_count = hist.TotalCount();
+      SleepFor(MonoDelta::FromMicroseconds(100));
+    }
+    for (int i = 0; i < num_threads_; i++) {
+      CHECK_OK(ThreadJoiner(threads[i].get()).Join());
+    }
+    recorder.Flush();
+  }
+
+  ASSERT_EQ(expected.TotalCount(), hist.TotalCount());
+  ASSERT_EQ(expected.TotalSum(), hist.TotalSum());
+  ASSERT_EQ(expected.MinValue(), hist.MinValue());
+  ASSERT_EQ(expected.MaxValue(), hist.MaxValue());
+  for (uint64_t v = 0; v <= kMaxValue; v = hist.NextNonEquivalentValue(v)) {
+    ASSERT_EQ(expected.CountInBucketForValue(v), hist.CountInBucketForValue(v)) << v;
+  }
+}
+
 } // namespace kudu
@@ -92,6 +92,22 @@ TEST_F(MultiThreadedMetricsTest, CounterIncrementTest) {
   ASSERT_EQ(num_threads * num_increments, counter->value());
 }
 
+METRIC_DEFINE_counter(test_entity, test_per_cpu_counter, "Test Per-CPU Counter",
+                      MetricUnit::kRequests, "Test per-CPU counter",
+                      kudu::PER_CPU);
+
+// Ensure that incrementing a per-CPU counter is thread-safe.
+TEST_F(MultiThreadedMetricsTest, PerCpuCounterIncrementTest) {
+  scoped_refptr<MetricEntity> entity = METRIC_ENTITY_test_entity.Instantiate(&registry_, "my-test");
+  scoped_refptr<Counter> counter = METRIC_test_per_cpu_counter.Instantiate(entity);
+  int num_threads = FLAGS_mt_metrics_test_num_threads;
+  int num_increments = 1000;
+  boost::function<void()> f =
+      boost::bind(CountWithCounter, counter, num_increments);
+  RunWithManyThreads(&f, num_threads);
+  ASSERT_EQ(num_threads * num_increments, counter->value());
+}
+
 // Helper function to register a bunch of counters in a loop.
 void MultiThreadedMetricsTest::RegisterCounters(
     const scoped_refptr<MetricEntity>& metric_entity,
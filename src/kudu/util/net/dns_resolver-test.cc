@@ -21,16 +21,28 @@
 #include <string>
 #include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/util.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
+DECLARE_int32(dns_resolver_cache_ttl_sec);
+DECLARE_int32(dns_resolver_cache_stale_sec);
+
+METRIC_DECLARE_entity(server);
+METRIC_DECLARE_counter(dns_resolver_cache_hits);
+METRIC_DECLARE_counter(dns_resolver_cache_stale_hits);
+METRIC_DECLARE_counter(dns_resolver_cache_misses);
+
 using std::vector;
 
 namespace kudu {
@@ -56,4 +68,59 @@ TEST_F(DnsResolverTest, TestResolution) {
   }
 }
 
+// Tests that resolutions are served from the cache within their TTL, served
+// stale and refreshed in the background past it, and resolved again once past
+// their stale window.
+TEST_F(DnsResolverTest, TestCaching) {
+  FLAGS_dns_resolver_cache_ttl_sec = 1;
+  FLAGS_dns_resolver_cache_stale_sec = 60;
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity = METRIC_ENTITY_server.Instantiate(&registry, "test");
+  DnsResolver resolver(entity);
+  auto hits = [&]() { return METRIC_dns_resolver_cache_hits.Instantiate(entity)->value(); };
+  auto stale_hits = [&]() {
+    return METRIC_dns_resolver_cache_stale_hits.Instantiate(entity)->value();
+  };
+  auto misses = [&]() { return METRIC_dns_resolver_cache_misses.Instantiate(entity)->value(); };
+
+  HostPort hp("localhost", 12345);
+  vector<Sockaddr> addrs;
+  ASSERT_OK(resolver.ResolveAddresses(hp, &addrs));
+  ASSERT_FALSE(addrs.empty());
+  ASSERT_EQ(1, misses());
+
+  vector<Sockaddr> cached;
+  ASSERT_OK(resolver.ResolveAddresses(hp, &cached));
+  ASSERT_EQ(addrs.size(), cached.size());
+  ASSERT_EQ(1, hits());
+
+  // The async variant calls back inline on a hit.
+  Synchronizer s;
+  resolver.ResolveAddresses(hp, &cached, s.AsStatusCallback());
+  ASSERT_OK(s.Wait());
+  ASSERT_EQ(2, hits());
+
+  // Past the TTL, the entry is served stale while it's refreshed, after which
+  // it's fresh again.
+  SleepFor(MonoDelta::FromMilliseconds(1100));
+  ASSERT_OK(resolver.ResolveAddresses(hp, &cached));
+  ASSERT_FALSE(cached.empty());
+  ASSERT_EQ(1, stale_hits());
+  ASSERT_EVENTUALLY([&]() {
+    int64_t hits_before = hits();
+    ASSERT_OK(resolver.ResolveAddresses(hp, &cached));
+    ASSERT_EQ(hits_before + 1, hits());
+  });
+  ASSERT_EQ(1, misses());
+
+  // Without a stale window, an expired entry is resolved again.
+  FLAGS_dns_resolver_cache_stale_sec = 0;
+  HostPort other_hp("localhost", 12346);
+  ASSERT_OK(resolver.ResolveAddresses(other_hp, &cached));
+  ASSERT_EQ(2, misses());
+  SleepFor(MonoDelta::FromMilliseconds(1100));
+  ASSERT_OK(resolver.ResolveAddresses(other_hp, &cached));
+  ASSERT_EQ(3, misses());
+}
+
 } // namespace kudu
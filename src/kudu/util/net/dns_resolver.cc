@@ -17,6 +17,11 @@
 
 #include "kudu/util/net/dns_resolver.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <utility>
 #include <vector>
 
 #include <boost/bind.hpp> // IWYU pragma: keep
@@ -25,6 +30,8 @@
 
 #include "kudu/gutil/callback.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/metrics.h"
 #include "kudu/util/threadpool.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/status.h"
@@ -32,34 +39,182 @@
 DEFINE_int32(dns_num_resolver_threads, 1, "The number of threads to use for DNS resolution");
 TAG_FLAG(dns_num_resolver_threads, advanced);
 
+DEFINE_int32(dns_resolver_cache_ttl_sec, 0,
+             "How long, in seconds, the addresses a host resolved to are cached "
+             "and served without resolving it again. If 0, addresses aren't cached.");
+TAG_FLAG(dns_resolver_cache_ttl_sec, experimental);
+TAG_FLAG(dns_resolver_cache_ttl_sec, runtime);
+
+DEFINE_int32(dns_resolver_cache_stale_sec, 60,
+             "How long, in seconds, past --dns_resolver_cache_ttl_sec cached "
+             "addresses are still served while they're refreshed in the background. "
+             "A failed refresh leaves them in place, so this bounds how long a host "
+             "whose resolution fails keeps its last known addresses.");
+TAG_FLAG(dns_resolver_cache_stale_sec, experimental);
+TAG_FLAG(dns_resolver_cache_stale_sec, runtime);
+
+METRIC_DEFINE_counter(server, dns_resolver_cache_hits,
+                      "DNS Resolver Cache Hits", kudu::MetricUnit::kCacheHits,
+                      "Number of resolutions served from the DNS resolver's cache "
+                      "within their TTL");
+METRIC_DEFINE_counter(server, dns_resolver_cache_stale_hits,
+                      "DNS Resolver Cache Stale Hits", kudu::MetricUnit::kCacheHits,
+                      "Number of resolutions served from the DNS resolver's cache "
+                      "past their TTL, while being refreshed in the background");
+METRIC_DEFINE_counter(server, dns_resolver_cache_misses,
+                      "DNS Resolver Cache Misses", kudu::MetricUnit::kCacheQueries,
+                      "Number of resolutions which weren't cached, or were past "
+                      "their stale window, and waited on DNS");
+METRIC_DEFINE_counter(server, dns_resolver_refresh_failures,
+                      "DNS Resolver Refresh Failures", kudu::MetricUnit::kRequests,
+                      "Number of background refreshes of cached addresses which "
+                      "failed, leaving the stale addresses in place");
+
 using std::vector;
 
 namespace kudu {
 
-DnsResolver::DnsResolver() {
+// Above this many entries, entries past their stale window are purged from
+// the cache whenever one is added.
+static const size_t kMaxCacheEntriesBeforePurge = 1024;
+
+namespace {
+void IncrementIfSet(const scoped_refptr<Counter>& counter) {
+  if (counter) {
+    counter->Increment();
+  }
+}
+} // anonymous namespace
+
+DnsResolver::DnsResolver(const scoped_refptr<MetricEntity>& metric_entity) {
   CHECK_OK(ThreadPoolBuilder("dns-resolver")
            .set_max_threads(FLAGS_dns_num_resolver_threads)
            .Build(&pool_));
+  if (metric_entity) {
+    cache_hits_ = METRIC_dns_resolver_cache_hits.Instantiate(metric_entity);
+    cache_stale_hits_ = METRIC_dns_resolver_cache_stale_hits.Instantiate(metric_entity);
+    cache_misses_ = METRIC_dns_resolver_cache_misses.Instantiate(metric_entity);
+    refresh_failures_ = METRIC_dns_resolver_refresh_failures.Instantiate(metric_entity);
+  }
 }
 
 DnsResolver::~DnsResolver() {
   pool_->Shutdown();
 }
 
-namespace {
-void DoResolution(const HostPort &hostport, vector<Sockaddr>* addresses,
-                  const StatusCallback& cb) {
-  cb.Run(hostport.ResolveAddresses(addresses));
-}
-} // anonymous namespace
-
 void DnsResolver::ResolveAddresses(const HostPort& hostport,
                                    vector<Sockaddr>* addresses,
                                    const StatusCallback& cb) {
-  Status s = pool_->SubmitFunc(boost::bind(&DoResolution, hostport, addresses, cb));
+  if (LookupCached(hostport, addresses)) {
+    cb.Run(Status::OK());
+    return;
+  }
+  Status s = pool_->SubmitFunc(boost::bind(&DnsResolver::DoResolution, this,
+                                           hostport, addresses, cb));
   if (!s.ok()) {
     cb.Run(s);
   }
 }
 
+Status DnsResolver::ResolveAddresses(const HostPort& hostport, vector<Sockaddr>* addresses) {
+  if (LookupCached(hostport, addresses)) {
+    return Status::OK();
+  }
+  return ResolveAndCache(hostport, addresses);
+}
+
+bool DnsResolver::LookupCached(const HostPort& hostport, vector<Sockaddr>* addresses) {
+  if (FLAGS_dns_resolver_cache_ttl_sec <= 0) {
+    return false;
+  }
+  MonoTime now = MonoTime::Now();
+  bool refresh = false;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    auto it = cache_.find(hostport.ToString());
+    if (it == cache_.end() || now >= it->second.stale_until) {
+      IncrementIfSet(cache_misses_);
+      return false;
+    }
+    CacheEntry* entry = &it->second;
+    if (addresses) {
+      *addresses = entry->addresses;
+    }
+    if (now < entry->fresh_until) {
+      IncrementIfSet(cache_hits_);
+      return true;
+    }
+    IncrementIfSet(cache_stale_hits_);
+    if (!entry->refreshing) {
+      entry->refreshing = true;
+      refresh = true;
+    }
+  }
+  if (refresh) {
+    Status s = pool_->SubmitFunc(boost::bind(&DnsResolver::Refresh, this, hostport));
+    if (!s.ok()) {
+      std::lock_guard<simple_spinlock> l(lock_);
+      auto it = cache_.find(hostport.ToString());
+      if (it != cache_.end()) {
+        it->second.refreshing = false;
+      }
+    }
+  }
+  return true;
+}
+
+Status DnsResolver::ResolveAndCache(const HostPort& hostport, vector<Sockaddr>* addresses) {
+  int32_t ttl_sec = FLAGS_dns_resolver_cache_ttl_sec;
+  if (ttl_sec <= 0) {
+    return hostport.ResolveAddresses(addresses);
+  }
+  vector<Sockaddr> resolved;
+  RETURN_NOT_OK(hostport.ResolveAddresses(&resolved));
+
+  MonoTime now = MonoTime::Now();
+  CacheEntry entry;
+  entry.addresses = resolved;
+  entry.fresh_until = now + MonoDelta::FromSeconds(ttl_sec);
+  entry.stale_until = entry.fresh_until +
+      MonoDelta::FromSeconds(std::max(0, FLAGS_dns_resolver_cache_stale_sec));
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (cache_.size() >= kMaxCacheEntriesBeforePurge) {
+      for (auto it = cache_.begin(); it != cache_.end();) {
+        if (now >= it->second.stale_until && !it->second.refreshing) {
+          it = cache_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    cache_[hostport.ToString()] = std::move(entry);
+  }
+  if (addresses) {
+    *addresses = std::move(resolved);
+  }
+  return Status::OK();
+}
+
+void DnsResolver::DoResolution(const HostPort& hostport, vector<Sockaddr>* addresses,
+                               const StatusCallback& cb) {
+  cb.Run(ResolveAndCache(hostport, addresses));
+}
+
+void DnsResolver::Refresh(const HostPort& hostport) {
+  Status s = ResolveAndCache(hostport, nullptr);
+  if (s.ok()) {
+    return;
+  }
+  IncrementIfSet(refresh_failures_);
+  KLOG_EVERY_N_SECS(WARNING, 10) << "Unable to refresh the cached addresses of "
+                                 << hostport.ToString() << ": " << s.ToString()
+                                 << THROTTLE_MSG;
+  std::lock_guard<simple_spinlock> l(lock_);
+  auto it = cache_.find(hostport.ToString());
+  if (it != cache_.end()) {
+    it->second.refreshing = false;
+  }
+}
+
 } // namespace kudu
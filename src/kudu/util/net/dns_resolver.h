@@ -17,22 +17,39 @@
 #ifndef KUDU_UTIL_NET_DNS_RESOLVER_H
 #define KUDU_UTIL_NET_DNS_RESOLVER_H
 
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/macros.h"
+#include "kudu/gutil/ref_counted.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/net/sockaddr.h"
+#include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
 
 namespace kudu {
 
+class Counter;
 class HostPort;
-class Sockaddr;
+class MetricEntity;
 class ThreadPool;
 
 // DNS Resolver which supports async address resolution.
+//
+// If --dns_resolver_cache_ttl_sec is positive, resolved addresses are cached
+// for that long. Once an entry's TTL has passed, it is still served for up to
+// --dns_resolver_cache_stale_sec more while it's refreshed in the background,
+// so that callers such as the consensus peer proxy factory don't wait on a
+// slow DNS server for hosts they've resolved before. Failed resolutions
+// aren't cached, and a failed refresh leaves the stale entry in place.
 class DnsResolver {
  public:
-  DnsResolver();
+  // If 'metric_entity' is set, the cache's hits and misses are counted in
+  // metrics of it.
+  explicit DnsResolver(const scoped_refptr<MetricEntity>& metric_entity = nullptr);
   ~DnsResolver();
 
   // Resolve any addresses corresponding to this host:port pair.
@@ -46,15 +63,62 @@ class DnsResolver {
   //
   // NOTE: the callback should be fast since it is called by the DNS
   // resolution thread.
-  // NOTE: in some rare cases, the callback may also be called inline
-  // from this function call, on the caller's thread.
+  // NOTE: the callback is called inline from this function call, on the
+  // caller's thread, when the addresses are cached, and in some rare cases
+  // otherwise.
   void ResolveAddresses(const HostPort& hostport,
                         std::vector<Sockaddr>* addresses,
                         const StatusCallback& cb);
 
+  // Like HostPort::ResolveAddresses(), but returns the cached addresses of
+  // this host:port pair if there are any, resolving it on the caller's thread
+  // only if there aren't.
+  Status ResolveAddresses(const HostPort& hostport, std::vector<Sockaddr>* addresses);
+
  private:
+  // The addresses a host:port pair resolved to.
+  struct CacheEntry {
+    std::vector<Sockaddr> addresses;
+
+    // Until when the addresses are served without refreshing them.
+    MonoTime fresh_until;
+
+    // Until when the addresses are served at all.
+    MonoTime stale_until;
+
+    // Whether a background refresh of the entry is pending.
+    bool refreshing = false;
+  };
+
+  // Returns true and copies the cached addresses of 'hostport' into
+  // 'addresses', if not NULL, if it has an entry which isn't past its stale
+  // window. Schedules a refresh of the entry if it's past its TTL.
+  bool LookupCached(const HostPort& hostport, std::vector<Sockaddr>* addresses);
+
+  // Resolves 'hostport' and caches the result, if caching is enabled and the
+  // resolution succeeds.
+  Status ResolveAndCache(const HostPort& hostport, std::vector<Sockaddr>* addresses);
+
+  // Resolves 'hostport' and calls 'cb' with the result. Runs on 'pool_'.
+  void DoResolution(const HostPort& hostport, std::vector<Sockaddr>* addresses,
+                    const StatusCallback& cb);
+
+  // Re-resolves the cached entry of 'hostport'. Runs on 'pool_'.
+  void Refresh(const HostPort& hostport);
+
   gscoped_ptr<ThreadPool> pool_;
 
+  simple_spinlock lock_;
+
+  // The cached addresses, keyed by host:port pair. Protected by 'lock_'.
+  std::unordered_map<std::string, CacheEntry> cache_;
+
+  // Cache metrics, NULL unless a metric entity was given.
+  scoped_refptr<Counter> cache_hits_;
+  scoped_refptr<Counter> cache_stale_hits_;
+  scoped_refptr<Counter> cache_misses_;
+  scoped_refptr<Counter> refresh_failures_;
+
   DISALLOW_COPY_AND_ASSIGN(DnsResolver);
 };
 
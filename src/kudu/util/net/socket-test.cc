@@ -86,4 +86,33 @@ TEST_F(SocketTest, TestRecvReset) {
 TEST_F(SocketTest, TestRecvEOF) {
   DoTest(true, "recv got EOF from 127.0.0.1:[0-9]+");
 }
+
+// Tests setting the TCP tuning options and reading TCP_INFO of a connection.
+TEST_F(SocketTest, TestTcpTuningAndInfo) {
+#if defined(__linux__)
+  Sockaddr address;
+  address.ParseString("127.0.0.1", 0);
+  Socket listener;
+  ASSERT_OK(listener.Init(0));
+  ASSERT_OK(listener.BindAndListen(address, 0));
+  Sockaddr listen_address;
+  ASSERT_OK(listener.GetSocketAddress(&listen_address));
+
+  Socket client;
+  ASSERT_OK(client.Init(0));
+  // "reno" is built into every kernel, unlike "bbr".
+  ASSERT_OK(client.SetCongestionControl("reno"));
+  ASSERT_OK(client.SetNotSentLowat(128 * 1024));
+  ASSERT_FALSE(client.SetCongestionControl("no-such-algorithm").ok());
+  ASSERT_OK(client.Connect(listen_address));
+  Sockaddr new_addr;
+  Socket server;
+  ASSERT_OK(listener.Accept(&server, &new_addr, 0));
+
+  TcpInfo info;
+  ASSERT_OK(client.GetTcpInfo(&info));
+  ASSERT_GT(info.snd_cwnd, 0);
+  ASSERT_EQ(0, info.total_retransmits);
+#endif
+}
 } // namespace kudu
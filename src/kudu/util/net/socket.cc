@@ -266,6 +266,40 @@ Status Socket::SetReceiveBuf(int receive_buf) {
   return SetSockBuf(SO_RCVBUF, "SO_RCVBUF", receive_buf);
 }
 
+Status Socket::SetBusyPoll(int busy_poll_us) {
+#if defined(SO_BUSY_POLL)
+  RETURN_NOT_OK_PREPEND(SetSockOpt(SOL_SOCKET, SO_BUSY_POLL, busy_poll_us),
+                        "failed to set SO_BUSY_POLL");
+  return Status::OK();
+#else
+  return Status::NotSupported("SO_BUSY_POLL is not supported on this platform");
+#endif
+}
+
+Status Socket::SetCongestionControl(const string& algorithm) {
+#if defined(TCP_CONGESTION)
+  DCHECK_GE(fd_, 0);
+  if (::setsockopt(fd_, IPPROTO_TCP, TCP_CONGESTION, algorithm.data(), algorithm.size()) == -1) {
+    int err = errno;
+    return Status::NetworkError(Substitute("failed to set TCP_CONGESTION to $0", algorithm),
+                                ErrnoToString(err), err);
+  }
+  return Status::OK();
+#else
+  return Status::NotSupported("TCP_CONGESTION is not supported on this platform");
+#endif
+}
+
+Status Socket::SetNotSentLowat(int notsent_lowat) {
+#if defined(TCP_NOTSENT_LOWAT)
+  RETURN_NOT_OK_PREPEND(SetSockOpt(IPPROTO_TCP, TCP_NOTSENT_LOWAT, notsent_lowat),
+                        Substitute("failed to set TCP_NOTSENT_LOWAT to $0", notsent_lowat));
+  return Status::OK();
+#else
+  return Status::NotSupported("TCP_NOTSENT_LOWAT is not supported on this platform");
+#endif
+}
+
 Status Socket::BindAndListen(const Sockaddr &sockaddr,
                              int listen_queue_size) {
   RETURN_NOT_OK(SetReuseAddr(true));
@@ -420,6 +454,41 @@ Status Socket::GetSockError() const {
   return Status::OK();
 }
 
+Status Socket::GetIncomingCpu(int* cpu) const {
+#if defined(SO_INCOMING_CPU)
+  int val = -1;
+  socklen_t val_len = sizeof(val);
+  DCHECK_GE(fd_, 0);
+  if (::getsockopt(fd_, SOL_SOCKET, SO_INCOMING_CPU, &val, &val_len) != 0) {
+    int err = errno;
+    return Status::NetworkError("getsockopt(SO_INCOMING_CPU) failed", ErrnoToString(err), err);
+  }
+  *cpu = val;
+  return Status::OK();
+#else
+  return Status::NotSupported("SO_INCOMING_CPU is not supported on this platform");
+#endif
+}
+
+Status Socket::GetTcpInfo(TcpInfo* info) const {
+#if defined(__linux__) && defined(TCP_INFO)
+  struct tcp_info val;
+  socklen_t val_len = sizeof(val);
+  DCHECK_GE(fd_, 0);
+  if (::getsockopt(fd_, IPPROTO_TCP, TCP_INFO, &val, &val_len) != 0) {
+    int err = errno;
+    return Status::NetworkError("getsockopt(TCP_INFO) failed", ErrnoToString(err), err);
+  }
+  info->rtt_us = val.tcpi_rtt;
+  info->rtt_var_us = val.tcpi_rttvar;
+  info->snd_cwnd = val.tcpi_snd_cwnd;
+  info->total_retransmits = val.tcpi_total_retrans;
+  return Status::OK();
+#else
+  return Status::NotSupported("TCP_INFO is not supported on this platform");
+#endif
+}
+
 Status Socket::Write(const uint8_t *buf, int32_t amt, int32_t *nwritten) {
   if (amt <= 0) {
     return Status::NetworkError(
@@ -19,6 +19,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <string>
 
 #include "kudu/gutil/macros.h"
 #include "kudu/util/status.h"
@@ -31,6 +32,19 @@ class MonoDelta;
 class MonoTime;
 class Sockaddr;
 
+// What the kernel reports about a TCP connection through TCP_INFO.
+struct TcpInfo {
+  // The smoothed round trip time and its variance.
+  int64_t rtt_us = 0;
+  int64_t rtt_var_us = 0;
+
+  // The congestion window, in segments.
+  int64_t snd_cwnd = 0;
+
+  // The segments retransmitted over the connection's lifetime.
+  int64_t total_retransmits = 0;
+};
+
 class Socket {
  public:
   static const int FLAG_NONBLOCKING = 0x1;
@@ -94,6 +108,20 @@ class Socket {
   // Sets SO_RCVBUF to 'receive_buf'.
   Status SetReceiveBuf(int receive_buf);
 
+  // Sets SO_BUSY_POLL, the microseconds to busy-poll the device queue for
+  // when there's no data to receive. Returns NotSupported on platforms
+  // without the option.
+  Status SetBusyPoll(int busy_poll_us);
+
+  // Sets TCP_CONGESTION, the congestion control algorithm such as "bbr".
+  // Returns NotSupported on platforms without the option.
+  Status SetCongestionControl(const std::string& algorithm);
+
+  // Sets TCP_NOTSENT_LOWAT, the most unsent bytes to keep queued in the socket
+  // before it stops being writable. Returns NotSupported on platforms without
+  // the option.
+  Status SetNotSentLowat(int notsent_lowat);
+
   // Convenience method to invoke the common sequence:
   // 1) SetReuseAddr(true)
   // 2) Bind()
@@ -131,6 +159,15 @@ class Socket {
   // get the error status using getsockopt(2)
   Status GetSockError() const;
 
+  // Call getsockopt(2) to get the CPU which the kernel last processed this
+  // socket's incoming packets on (SO_INCOMING_CPU). Returns NotSupported on
+  // platforms without the option.
+  Status GetIncomingCpu(int* cpu) const;
+
+  // Call getsockopt(2) to get TCP_INFO. Returns NotSupported on platforms
+  // without the option.
+  Status GetTcpInfo(TcpInfo* info) const;
+
   // Write up to 'amt' bytes from 'buf' to the socket. The number of bytes
   // actually written will be stored in 'nwritten'. If an error is returned,
   // the value of 'nwritten' is undefined.
@@ -0,0 +1,138 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/op_timeline.h"
+
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/jsonwriter.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+#include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(op_timeline_sample_interval);
+
+using std::string;
+
+namespace kudu {
+
+class OpTimelineTest : public KuduTest {
+ protected:
+  static string WriteFinished() {
+    std::ostringstream out;
+    JsonWriter jw(&out, JsonWriter::COMPACT);
+    OpTimeline::WriteFinishedAsJson(&jw);
+    return out.str();
+  }
+};
+
+TEST_F(OpTimelineTest, TestSampling) {
+  FLAGS_op_timeline_sample_interval = 0;
+  OpTimeline::Record("t", 1, 10, OpTimeline::ENQUEUE);
+  OpTimeline::Record("t", 1, 10, OpTimeline::APPLY);
+  ASSERT_EQ("[]", WriteFinished());
+
+  // Only the ops whose indexes are multiples of the interval are sampled.
+  FLAGS_op_timeline_sample_interval = 5;
+  ASSERT_TRUE(OpTimeline::IsSampled(10));
+  ASSERT_FALSE(OpTimeline::IsSampled(11));
+  OpTimeline::Record("t", 1, 11, OpTimeline::ENQUEUE);
+  OpTimeline::Record("t", 1, 11, OpTimeline::APPLY);
+  ASSERT_EQ("[]", WriteFinished());
+}
+
+// A timeline is handed out once its op is applied, with its events in order.
+TEST_F(OpTimelineTest, TestTimeline) {
+  FLAGS_op_timeline_sample_interval = 5;
+  OpTimeline::Record("t", 2, 10, OpTimeline::ENQUEUE);
+  OpTimeline::Record("t", 2, 10, OpTimeline::WAL_WRITE);
+  OpTimeline::Record("t", 2, 10, OpTimeline::PEER_SEND, "peer");
+  // Acks cover a range of ops, only some of which are sampled.
+  OpTimeline::RecordRange("t", 3, 12, OpTimeline::PEER_ACK, "peer");
+  OpTimeline::Record("t", 2, 10, OpTimeline::COMMIT);
+  ASSERT_EQ("[]", WriteFinished());
+
+  OpTimeline::Record("t", 2, 10, OpTimeline::APPLY);
+  string json = WriteFinished();
+  ASSERT_STR_CONTAINS(json, "{\"tablet_id\":\"t\",\"term\":2,\"index\":10,");
+  ASSERT_STR_CONTAINS(json, "\"applied\":true");
+  ASSERT_STR_MATCHES(json, "\"enqueue\".*\"wal_write\".*\"peer_send\",\"peer\":\"peer\""
+                           ".*\"peer_ack\",\"peer\":\"peer\".*\"commit\".*\"apply\"");
+  // The ack to index 5 made a timeline of its own, which isn't finished yet.
+  ASSERT_STR_NOT_CONTAINS(json, "\"index\":5,");
+  ASSERT_EQ("[]", WriteFinished());
+}
+
+// An op replaced by one of a later term finishes the timeline of the old one.
+TEST_F(OpTimelineTest, TestReplacedOp) {
+  FLAGS_op_timeline_sample_interval = 5;
+  OpTimeline::Record("t", 3, 20, OpTimeline::ENQUEUE);
+  OpTimeline::Record("t", 4, 20, OpTimeline::ENQUEUE);
+  string json = WriteFinished();
+  ASSERT_STR_CONTAINS(json, "\"term\":3,\"index\":20,");
+  ASSERT_STR_CONTAINS(json, "\"applied\":false");
+
+  OpTimeline::Record("t", 4, 20, OpTimeline::APPLY);
+  json = WriteFinished();
+  ASSERT_STR_CONTAINS(json, "\"term\":4,\"index\":20,");
+}
+
+// While a trace is captured, the stages of the sampled ops are traced as
+// events tied together by the flow of each op.
+TEST_F(OpTimelineTest, TestCaptureTrace) {
+  FLAGS_op_timeline_sample_interval = 0;
+  ASSERT_FALSE(OpTimeline::IsTraced(10));
+
+  string trace_json;
+  Status capture_status;
+  std::thread capture([&]() {
+    capture_status = OpTimeline::CaptureTrace(MonoDelta::FromMilliseconds(500), 5,
+                                              &trace_json);
+  });
+  while (!OpTimeline::IsTraced(10)) {
+    SleepFor(MonoDelta::FromMilliseconds(1));
+  }
+  ASSERT_FALSE(OpTimeline::IsTraced(11));
+  // Only one trace is captured at a time.
+  string other_json;
+  Status s = OpTimeline::CaptureTrace(MonoDelta::FromMilliseconds(1), 5, &other_json);
+  ASSERT_TRUE(s.IsIllegalState()) << s.ToString();
+
+  OpTimeline::TraceReplicate("t", 10);
+  OpTimeline::Record("t", 2, 10, OpTimeline::ENQUEUE);
+  OpTimeline::RecordRange("t", 3, 12, OpTimeline::PEER_ACK, "peer");
+  OpTimeline::TraceReplicate("t", 11);
+  capture.join();
+  ASSERT_OK(capture_status);
+  ASSERT_FALSE(OpTimeline::IsTraced(10));
+
+  ASSERT_STR_MATCHES(trace_json, "\"name\":\"replicate\"");
+  ASSERT_STR_MATCHES(trace_json, "\"ph\":\"s\"");
+  ASSERT_STR_MATCHES(trace_json, "\"step\":\"enqueue\"");
+  ASSERT_STR_MATCHES(trace_json, "\"step\":\"peer_ack\"");
+  ASSERT_STR_NOT_CONTAINS(trace_json, "\"index\":11");
+  // Nothing was sampled for the timelines.
+  ASSERT_EQ("[]", WriteFinished());
+}
+
+} // namespace kudu
@@ -0,0 +1,313 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/op_timeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/walltime.h"
+#include "kudu/util/debug/trace_event.h"
+#include "kudu/util/debug/trace_event_impl.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/hash_util.h"
+#include "kudu/util/jsonwriter.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+
+DEFINE_int32(op_timeline_sample_interval, 0,
+             "Record the timeline of the replication of one op out of this many, by "
+             "index, into the diagnostics log: when it was enqueued, written and synced "
+             "to the WAL, sent to and acknowledged by each peer, committed and applied. "
+             "0 disables the sampling.");
+TAG_FLAG(op_timeline_sample_interval, experimental);
+TAG_FLAG(op_timeline_sample_interval, runtime);
+
+using kudu::debug::CategoryFilter;
+using kudu::debug::TraceLog;
+using kudu::debug::TraceResultBuffer;
+using std::string;
+using std::vector;
+
+namespace kudu {
+
+namespace {
+
+// Timelines which weren't applied after this long are finished anyway, e.g.
+// those of ops which were aborted, or applied while sampling was off.
+const MonoDelta kMaxTimelineAge = MonoDelta::FromSeconds(120);
+
+// Bounds on the number of timelines kept, in case nothing hands them out.
+// Ops recorded beyond them aren't sampled.
+const size_t kMaxPendingTimelines = 10000;
+const size_t kMaxFinishedTimelines = 10000;
+
+struct Event {
+  OpTimeline::Stage stage;
+  string peer_uuid;
+  MonoTime time;
+};
+
+struct Timeline {
+  string tablet_id;
+  int64_t term = -1;
+  int64_t index = 0;
+  int64_t start_walltime_us = 0;
+  bool applied = false;
+  vector<Event> events;
+};
+
+typedef std::pair<string, int64_t> TimelineKey;
+
+struct TimelineState {
+  simple_spinlock lock;
+  std::map<TimelineKey, Timeline> pending;
+  std::deque<Timeline> finished;
+};
+
+TimelineState* GetState() {
+  static TimelineState* state = new TimelineState();
+  return state;
+}
+
+// The sample interval of the running CaptureTrace(), or 0 if there is none.
+std::atomic<int32_t> g_trace_sample_interval(0);
+
+// Whether the op at 'index' is sampled one out of 'interval'.
+bool IsSampledOneOf(int32_t interval, int64_t index) {
+  return interval > 0 && index > 0 && index % interval == 0;
+}
+
+// The id of the flow of the op at 'index' of 'tablet_id'. It's the same on
+// every server.
+uint64_t TraceFlowId(const string& tablet_id, int64_t index) {
+  return HashUtil::MurmurHash2_64(tablet_id.data(), static_cast<int>(tablet_id.size()), index);
+}
+
+// Traces the event 'name' of the op at 'index' of 'tablet_id', starting its
+// flow if 'begin'.
+void TraceEvent(const string& tablet_id, int64_t index, const char* name,
+                const string& peer_uuid, bool begin) {
+  const uint64_t flow_id = TraceFlowId(tablet_id, index);
+  TRACE_EVENT2("consensus.op", name, "tablet_id", tablet_id, "index", index);
+  if (begin) {
+    TRACE_EVENT_FLOW_BEGIN0("consensus.op", "op", flow_id);
+  } else if (peer_uuid.empty()) {
+    TRACE_EVENT_FLOW_STEP0("consensus.op", "op", flow_id, name);
+  } else {
+    TRACE_EVENT_FLOW_STEP1("consensus.op", "op", flow_id, name, "peer", peer_uuid);
+  }
+}
+
+// Moves 'it' from the pending timelines to the finished ones.
+void FinishUnlocked(TimelineState* state, std::map<TimelineKey, Timeline>::iterator it) {
+  if (state->finished.size() >= kMaxFinishedTimelines) {
+    state->finished.pop_front();
+  }
+  state->finished.emplace_back(std::move(it->second));
+  state->pending.erase(it);
+}
+
+void RecordUnlocked(TimelineState* state, const string& tablet_id, int64_t term,
+                    int64_t index, OpTimeline::Stage stage, const string& peer_uuid,
+                    MonoTime now) {
+  TimelineKey key(tablet_id, index);
+  auto it = state->pending.find(key);
+  if (it != state->pending.end() && term >= 0 && it->second.term >= 0 &&
+      it->second.term != term) {
+    // The op was replaced by one of another term: the old one is done.
+    FinishUnlocked(state, it);
+    it = state->pending.end();
+  }
+  if (it == state->pending.end()) {
+    if (state->pending.size() >= kMaxPendingTimelines) {
+      return;
+    }
+    it = state->pending.emplace(std::move(key), Timeline()).first;
+    Timeline* t = &it->second;
+    t->tablet_id = tablet_id;
+    t->index = index;
+    t->start_walltime_us = GetCurrentTimeMicros();
+  }
+  Timeline* t = &it->second;
+  if (t->term < 0) {
+    t->term = term;
+  }
+  t->events.push_back({ stage, peer_uuid, now });
+  if (stage == OpTimeline::APPLY) {
+    t->applied = true;
+    FinishUnlocked(state, it);
+  }
+}
+
+} // anonymous namespace
+
+const char* OpTimeline::StageToString(Stage stage) {
+  switch (stage) {
+    case ENQUEUE: return "enqueue";
+    case WAL_WRITE: return "wal_write";
+    case FSYNC: return "fsync";
+    case PEER_SEND: return "peer_send";
+    case PEER_ACK: return "peer_ack";
+    case COMMIT: return "commit";
+    case APPLY: return "apply";
+  }
+  LOG(FATAL) << "unknown stage " << static_cast<int>(stage);
+  return "";
+}
+
+bool OpTimeline::IsSampled(int64_t index) {
+  return IsSampledOneOf(FLAGS_op_timeline_sample_interval, index);
+}
+
+bool OpTimeline::IsTraced(int64_t index) {
+  return IsSampledOneOf(g_trace_sample_interval.load(std::memory_order_relaxed), index);
+}
+
+void OpTimeline::Record(const string& tablet_id, int64_t term, int64_t index,
+                        Stage stage, const string& peer_uuid) {
+  if (PREDICT_FALSE(IsTraced(index))) {
+    TraceEvent(tablet_id, index, StageToString(stage), peer_uuid, false);
+  }
+  if (PREDICT_TRUE(!IsSampled(index))) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  TimelineState* state = GetState();
+  std::lock_guard<simple_spinlock> l(state->lock);
+  RecordUnlocked(state, tablet_id, term, index, stage, peer_uuid, now);
+}
+
+void OpTimeline::RecordRange(const string& tablet_id, int64_t after_index,
+                             int64_t last_index, Stage stage, const string& peer_uuid) {
+  const int32_t trace_interval = g_trace_sample_interval.load(std::memory_order_relaxed);
+  if (PREDICT_FALSE(trace_interval > 0)) {
+    int64_t first = std::max<int64_t>(after_index, 0) / trace_interval * trace_interval +
+        trace_interval;
+    for (int64_t index = first; index <= last_index; index += trace_interval) {
+      TraceEvent(tablet_id, index, StageToString(stage), peer_uuid, false);
+    }
+  }
+  const int32_t interval = FLAGS_op_timeline_sample_interval;
+  if (PREDICT_TRUE(interval <= 0) || last_index <= after_index) {
+    return;
+  }
+  int64_t first = std::max<int64_t>(after_index, 0) / interval * interval + interval;
+  if (first > last_index) {
+    return;
+  }
+  MonoTime now = MonoTime::Now();
+  TimelineState* state = GetState();
+  std::lock_guard<simple_spinlock> l(state->lock);
+  for (int64_t index = first; index <= last_index; index += interval) {
+    RecordUnlocked(state, tablet_id, -1, index, stage, peer_uuid, now);
+  }
+}
+
+void OpTimeline::TraceReplicate(const string& tablet_id, int64_t index) {
+  if (PREDICT_FALSE(IsTraced(index))) {
+    TraceEvent(tablet_id, index, "replicate", "", true);
+  }
+}
+
+void OpTimeline::TraceReceive(const string& tablet_id, int64_t index) {
+  if (PREDICT_FALSE(IsTraced(index))) {
+    TraceEvent(tablet_id, index, "receive", "", false);
+  }
+}
+
+Status OpTimeline::CaptureTrace(MonoDelta duration, int32_t sample_interval,
+                                string* trace_json) {
+  if (sample_interval <= 0) {
+    return Status::InvalidArgument("the sample interval must be positive");
+  }
+  TraceLog* tl = TraceLog::GetInstance();
+  int32_t expected = 0;
+  if (tl->IsEnabled() ||
+      !g_trace_sample_interval.compare_exchange_strong(expected, sample_interval)) {
+    return Status::IllegalState("tracing is already enabled");
+  }
+  tl->SetEnabled(CategoryFilter("consensus.op,consensus,log"),
+                 TraceLog::RECORDING_MODE,
+                 TraceLog::RECORD_CONTINUOUSLY);
+  SleepFor(duration);
+  g_trace_sample_interval = 0;
+  tl->SetDisabled();
+  *trace_json = TraceResultBuffer::FlushTraceLogToString();
+  return Status::OK();
+}
+
+void OpTimeline::WriteFinishedAsJson(JsonWriter* jw) {
+  TimelineState* state = GetState();
+  std::deque<Timeline> finished;
+  {
+    MonoTime now = MonoTime::Now();
+    std::lock_guard<simple_spinlock> l(state->lock);
+    for (auto it = state->pending.begin(); it != state->pending.end();) {
+      auto next = std::next(it);
+      if (now - it->second.events.front().time > kMaxTimelineAge) {
+        FinishUnlocked(state, it);
+      }
+      it = next;
+    }
+    finished.swap(state->finished);
+  }
+
+  jw->StartArray();
+  for (const Timeline& t : finished) {
+    const MonoTime start = t.events.front().time;
+    jw->StartObject();
+    jw->String("tablet_id");
+    jw->String(t.tablet_id);
+    jw->String("term");
+    jw->Int64(t.term);
+    jw->String("index");
+    jw->Int64(t.index);
+    jw->String("start_us");
+    jw->Int64(t.start_walltime_us);
+    jw->String("applied");
+    jw->Bool(t.applied);
+    jw->String("events");
+    jw->StartArray();
+    for (const Event& e : t.events) {
+      jw->StartObject();
+      jw->String("stage");
+      jw->String(StageToString(e.stage));
+      if (!e.peer_uuid.empty()) {
+        jw->String("peer");
+        jw->String(e.peer_uuid);
+      }
+      jw->String("us");
+      jw->Int64((e.time - start).ToMicroseconds());
+      jw->EndObject();
+    }
+    jw->EndArray();
+    jw->EndObject();
+  }
+  jw->EndArray();
+}
+
+} // namespace kudu
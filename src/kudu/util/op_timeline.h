@@ -0,0 +1,112 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "kudu/util/monotime.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+class JsonWriter;
+
+// Sampled timelines of replicated ops: when each stage of the replication
+// of an op happened on this server, from the enqueueing of the op to its
+// application. With --op_timeline_sample_interval set to N, every op whose
+// index is a multiple of N is sampled; since the choice only depends on the
+// index, the leader and the followers sample the same ops.
+//
+// The timelines of the ops which were applied, or which were started long
+// enough ago that they are unlikely to ever be, are handed out by
+// WriteFinishedAsJson(), which the diagnostics log calls periodically.
+//
+// While CaptureTrace() runs, the stages of the ops it samples are also traced
+// as events of the "consensus.op" category, along with where the leader
+// starts replicating an op and where a follower receives it.
+//
+// All methods are thread-safe.
+class OpTimeline {
+ public:
+  enum Stage {
+    // The op was handed to the consensus queue, on the leader when it is
+    // replicated and on a follower when it is received.
+    ENQUEUE,
+    // The op was written to the local WAL.
+    WAL_WRITE,
+    // The WAL was synced with the op in it.
+    FSYNC,
+    // The op was put in a request to a peer (leader only).
+    PEER_SEND,
+    // A peer acknowledged the op (leader only).
+    PEER_ACK,
+    // The op was found committed.
+    COMMIT,
+    // The replication of the op was reported as finished to the application.
+    APPLY,
+  };
+
+  static const char* StageToString(Stage stage);
+
+  // Whether the op at 'index' is sampled.
+  static bool IsSampled(int64_t index);
+
+  // Records that the op 'term'.'index' of 'tablet_id' reached 'stage' now,
+  // on 'peer_uuid' for the per-peer stages. Does nothing if the op isn't
+  // sampled. A negative term matches the op at 'index' whatever its term.
+  static void Record(const std::string& tablet_id, int64_t term, int64_t index,
+                     Stage stage, const std::string& peer_uuid = "");
+
+  // Same as Record(), for every sampled op in ('after_index', 'last_index'].
+  static void RecordRange(const std::string& tablet_id, int64_t after_index,
+                          int64_t last_index, Stage stage,
+                          const std::string& peer_uuid = "");
+
+  // Whether the op at 'index' is traced by a running CaptureTrace().
+  static bool IsTraced(int64_t index);
+
+  // Traces that the leader starts replicating the op at 'index' of
+  // 'tablet_id', if it's traced.
+  static void TraceReplicate(const std::string& tablet_id, int64_t index);
+
+  // Traces that a follower received the op at 'index' of 'tablet_id' from
+  // its leader, if it's traced.
+  static void TraceReceive(const std::string& tablet_id, int64_t index);
+
+  // Traces the replication of one op out of 'sample_interval', by index, for
+  // 'duration', along with the other events of the "consensus" and "log"
+  // categories, and sets 'trace_json' to the trace in the Chrome trace event
+  // format, which chrome://tracing and Perfetto load. The events of an op are
+  // tied together by flow events named "op", whose id only depends on the
+  // tablet and the index of the op, so that the flows continue across the
+  // traces of the leader and of the followers once they're merged.
+  //
+  // Blocks for 'duration'. Returns IllegalState if tracing is already
+  // enabled, e.g. by another capture.
+  static Status CaptureTrace(MonoDelta duration, int32_t sample_interval,
+                             std::string* trace_json);
+
+  // Writes the finished timelines as a JSON array, and forgets them. Each
+  // timeline is an object holding the tablet, term and index of the op, the
+  // wall time at which it was first recorded in microseconds, whether it
+  // was applied, and its events, each with its stage, its peer if any, and
+  // the microseconds since the first event.
+  static void WriteFinishedAsJson(JsonWriter* jw);
+};
+
+} // namespace kudu
@@ -20,6 +20,7 @@
 #include <unistd.h>
 
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -27,6 +28,7 @@
 #include "kudu/util/test_macros.h"
 
 using std::string;
+using std::vector;
 
 namespace kudu {
 
@@ -59,4 +61,27 @@ TEST(OsUtilTest, TestSelfNameWithParens) {
   RunTest("a(b(c((d))e)", 111, 222, 333);
 }
 
+TEST(OsUtilTest, TestParseCpuList) {
+  vector<int> cpus;
+  ASSERT_OK(ParseCpuList("0-3,8,10-11\n", &cpus));
+  ASSERT_EQ(vector<int>({ 0, 1, 2, 3, 8, 10, 11 }), cpus);
+  ASSERT_OK(ParseCpuList("\n", &cpus));
+  ASSERT_TRUE(cpus.empty());
+  ASSERT_TRUE(ParseCpuList("3-1", &cpus).IsInvalidArgument());
+  ASSERT_TRUE(ParseCpuList("a", &cpus).IsInvalidArgument());
+}
+
+#if defined(__linux__)
+TEST(OsUtilTest, TestGetNumaNodes) {
+  vector<NumaNode> nodes;
+  ASSERT_OK(GetNumaNodes(&nodes));
+  ASSERT_FALSE(nodes.empty());
+  for (const NumaNode& node : nodes) {
+    ASSERT_FALSE(node.cpus.empty());
+  }
+  // The calling thread may be restricted to any of the reported CPUs.
+  ASSERT_OK(SetCurrentThreadCpuAffinity(nodes[0].cpus));
+}
+#endif // defined(__linux__)
+
 } // namespace kudu
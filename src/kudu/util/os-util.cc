@@ -25,11 +25,15 @@
 #include "kudu/util/os-util.h"
 
 #include <fcntl.h>
+#include <sched.h>
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstddef>
 #include <fstream>
+#include <iterator>
 #include <string>
 #include <utility>
 #include <vector>
@@ -40,11 +44,14 @@
 #include "kudu/gutil/strings/numbers.h"
 #include "kudu/gutil/strings/split.h"
 #include "kudu/gutil/strings/stringpiece.h"
+#include "kudu/gutil/strings/strip.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
 #include "kudu/util/env.h"
+#include "kudu/util/errno.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/logging.h"
+#include "kudu/util/path_util.h"
 
 using std::ifstream;
 using std::istreambuf_iterator;
@@ -131,6 +138,108 @@ Status GetThreadStats(int64_t tid, ThreadStats* stats) {
   return ParseStat(buffer, nullptr, stats); // don't want the name
 }
 
+Status ParseCpuList(const string& list, vector<int>* cpus) {
+  cpus->clear();
+  string trimmed = list;
+  StripWhiteSpace(&trimmed);
+  for (StringPiece range : Split(trimmed, ",", strings::SkipEmpty())) {
+    std::pair<StringPiece, StringPiece> bounds = Split(range, "-");
+    int32_t first;
+    int32_t last;
+    if (!safe_strto32(bounds.first.data(), bounds.first.size(), &first)) {
+      return Status::InvalidArgument("invalid CPU list", list);
+    }
+    last = first;
+    if (!bounds.second.empty() &&
+        !safe_strto32(bounds.second.data(), bounds.second.size(), &last)) {
+      return Status::InvalidArgument("invalid CPU list", list);
+    }
+    if (first < 0 || last < first) {
+      return Status::InvalidArgument("invalid CPU list", list);
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+  }
+  return Status::OK();
+}
+
+Status GetNumaNodes(vector<NumaNode>* nodes) {
+#ifndef __linux__
+  return Status::NotSupported("NUMA topology is only available on Linux");
+#else
+  nodes->clear();
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    int err = errno;
+    return Status::RuntimeError("sched_getaffinity() failed", ErrnoToString(err), err);
+  }
+  auto is_allowed = [&](int cpu) {
+    return cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed);
+  };
+
+  Env* env = Env::Default();
+  const string kNodesDir = "/sys/devices/system/node";
+  vector<string> children;
+  if (env->GetChildren(kNodesDir, &children).ok()) {
+    for (const string& child : children) {
+      string suffix;
+      int32_t id;
+      if (!TryStripPrefixString(child, "node", &suffix) || !safe_strto32(suffix, &id)) {
+        continue;
+      }
+      faststring buf;
+      RETURN_NOT_OK(ReadFileToString(env, JoinPathSegments(
+          JoinPathSegments(kNodesDir, child), "cpulist"), &buf));
+      NumaNode node;
+      node.id = id;
+      vector<int> cpus;
+      RETURN_NOT_OK(ParseCpuList(buf.ToString(), &cpus));
+      std::copy_if(cpus.begin(), cpus.end(), std::back_inserter(node.cpus), is_allowed);
+      if (!node.cpus.empty()) {
+        nodes->emplace_back(std::move(node));
+      }
+    }
+  }
+  if (nodes->empty()) {
+    // No NUMA topology: all the CPUs are on the same node.
+    NumaNode node;
+    node.id = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (is_allowed(cpu)) {
+        node.cpus.push_back(cpu);
+      }
+    }
+    nodes->emplace_back(std::move(node));
+  }
+  std::sort(nodes->begin(), nodes->end(),
+            [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+  return Status::OK();
+#endif // __linux__
+}
+
+Status SetCurrentThreadCpuAffinity(const vector<int>& cpus) {
+#ifndef __linux__
+  return Status::NotSupported("CPU affinity is only supported on Linux");
+#else
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return Status::InvalidArgument(Substitute("invalid CPU $0", cpu));
+    }
+    CPU_SET(cpu, &set);
+  }
+  // On Linux, a pid of 0 means the calling thread.
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    int err = errno;
+    return Status::RuntimeError("sched_setaffinity() failed", ErrnoToString(err), err);
+  }
+  return Status::OK();
+#endif // __linux__
+}
+
 void DisableCoreDumps() {
   struct rlimit lim;
   PCHECK(getrlimit(RLIMIT_CORE, &lim) == 0);
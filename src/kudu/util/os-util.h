@@ -26,6 +26,7 @@
 #include <cstdint>
 #include <string>
 #include <type_traits> // IWYU pragma: keep
+#include <vector>
 
 #include "kudu/util/status.h"
 
@@ -60,6 +61,23 @@ Status GetThreadStats(int64_t tid, ThreadStats* stats);
 //
 // This is useful particularly in tests where we have injected failures and don't
 // want to generate a core dump from an "expected" crash.
+// A NUMA node, and those of its CPUs which this process may run on.
+struct NumaNode {
+  int id;
+  std::vector<int> cpus;
+};
+
+// Parses a list of CPUs in the kernel's format, such as "0-3,8,10-11".
+Status ParseCpuList(const std::string& list, std::vector<int>* cpus);
+
+// Gets the NUMA nodes which have CPUs that this process may run on, ordered
+// by node id. On a host which doesn't report its NUMA topology, all the CPUs
+// are on node 0.
+Status GetNumaNodes(std::vector<NumaNode>* nodes);
+
+// Restricts the calling thread to running on 'cpus'.
+Status SetCurrentThreadCpuAffinity(const std::vector<int>& cpus);
+
 void DisableCoreDumps();
 
 // Return true if this process appears to be running under a debugger or strace.
@@ -0,0 +1,146 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/percpu_rw_mutex.h"
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/atomic.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/test_util.h"
+
+using std::lock_guard;
+using std::thread;
+using std::try_to_lock;
+using std::unique_lock;
+using std::vector;
+
+namespace kudu {
+
+class PerCpuRWMutexTest : public KuduTest {
+ protected:
+  PerCpuRWMutex lock_;
+};
+
+TEST_F(PerCpuRWMutexTest, TestTryLocks) {
+  // Readers share the lock, and keep writers out.
+  ASSERT_TRUE(lock_.TryReadLock());
+  ASSERT_TRUE(lock_.TryReadLock());
+  ASSERT_FALSE(lock_.TryWriteLock());
+  lock_.ReadUnlock();
+  ASSERT_FALSE(lock_.TryWriteLock());
+  lock_.ReadUnlock();
+
+  // A writer keeps everyone else out.
+  ASSERT_TRUE(lock_.TryWriteLock());
+  ASSERT_FALSE(lock_.TryReadLock());
+  ASSERT_FALSE(lock_.TryWriteLock());
+  lock_.WriteUnlock();
+
+  ASSERT_TRUE(lock_.TryReadLock());
+  lock_.ReadUnlock();
+}
+
+// A reader may take the lock on one CPU and release it on another.
+TEST_F(PerCpuRWMutexTest, TestUnlockFromOtherThread) {
+  lock_.ReadLock();
+  thread t([&]() { lock_.ReadUnlock(); });
+  t.join();
+  ASSERT_TRUE(lock_.TryWriteLock());
+  lock_.WriteUnlock();
+}
+
+// Multi-threaded test that tries to find deadlocks, and checks that the
+// writers exclude each other and the readers.
+TEST_F(PerCpuRWMutexTest, TestDeadlocksAndExclusion) {
+  uint64_t number_of_writes = 0;
+  AtomicInt<uint64_t> number_of_reads(0);
+  // Incremented by the writers and checked by the readers, which must never
+  // see it odd.
+  AtomicInt<uint64_t> writer_generation(0);
+
+  AtomicBool done(false);
+  vector<thread> threads;
+
+  auto write = [&]() {
+    writer_generation.Increment();
+    number_of_writes++;
+    writer_generation.Increment();
+  };
+  auto read = [&]() {
+    CHECK_EQ(0, writer_generation.Load() % 2);
+    number_of_reads.Increment();
+  };
+
+  // Start several blocking and non-blocking read-write workloads.
+  for (int i = 0; i < 2; i++) {
+    threads.emplace_back([&](){
+      while (!done.Load()) {
+        lock_guard<PerCpuRWMutex> l(lock_);
+        write();
+      }
+    });
+    threads.emplace_back([&](){
+      while (!done.Load()) {
+        unique_lock<PerCpuRWMutex> l(lock_, try_to_lock);
+        if (l.owns_lock()) {
+          write();
+        }
+      }
+    });
+  }
+
+  // Start several blocking and non-blocking read-only workloads.
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&](){
+      while (!done.Load()) {
+        shared_lock<PerCpuRWMutex> l(lock_);
+        read();
+      }
+    });
+    threads.emplace_back([&](){
+      while (!done.Load()) {
+        shared_lock<PerCpuRWMutex> l(lock_, try_to_lock);
+        if (l.owns_lock()) {
+          read();
+        }
+      }
+    });
+  }
+
+  SleepFor(MonoDelta::FromSeconds(1));
+  done.Store(true);
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  lock_guard<PerCpuRWMutex> l(lock_);
+  LOG(INFO) << "Number of writes: " << number_of_writes;
+  LOG(INFO) << "Number of reads: " << number_of_reads.Load();
+  ASSERT_GT(number_of_writes, 0);
+  ASSERT_GT(number_of_reads.Load(), 0);
+}
+
+} // namespace kudu
@@ -0,0 +1,120 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/percpu_rw_mutex.h"
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/sysinfo.h"
+
+namespace kudu {
+
+PerCpuRWMutex::PerCpuRWMutex()
+#if defined(__APPLE__)
+    : n_cpus_(1),
+#else
+    : n_cpus_(base::MaxCPUIndex() + 1),
+#endif
+      counters_(new PaddedCounter[n_cpus_]),
+      writer_(false) {
+  CHECK_GT(n_cpus_, 0);
+  for (int i = 0; i < n_cpus_; i++) {
+    counters_[i].readers.store(0, std::memory_order_relaxed);
+  }
+}
+
+PerCpuRWMutex::~PerCpuRWMutex() {
+  DCHECK(!writer_.load());
+  DCHECK_EQ(0, CountReaders());
+}
+
+// The readers count themselves in and then check for a writer, while the
+// writers announce themselves and then count the readers. With sequentially
+// consistent operations on both sides, either the reader sees the writer,
+// or the writer sees the reader.
+//
+// Writers set 'writer_' under 'wait_lock_', so that a reader which checks it
+// and counts itself in under 'wait_lock_' can't race with a writer either.
+
+void PerCpuRWMutex::ReadLockSlow(std::atomic<int64_t>* readers) {
+  readers->fetch_sub(1);
+  std::unique_lock<std::mutex> l(wait_lock_);
+  // The writer may have counted this reader before it backed out.
+  readers_gone_.notify_one();
+  writer_gone_.wait(l, [this]() { return !writer_.load(); });
+  counters_[CurrentCpu()].readers.fetch_add(1);
+}
+
+void PerCpuRWMutex::WakeWriter() {
+  std::lock_guard<std::mutex> l(wait_lock_);
+  readers_gone_.notify_one();
+}
+
+bool PerCpuRWMutex::TryReadLock() {
+  std::atomic<int64_t>* readers = &counters_[CurrentCpu()].readers;
+  readers->fetch_add(1);
+  if (PREDICT_TRUE(!writer_.load())) {
+    return true;
+  }
+  readers->fetch_sub(1);
+  WakeWriter();
+  return false;
+}
+
+void PerCpuRWMutex::WriteLock() {
+  write_lock_.lock();
+  std::unique_lock<std::mutex> l(wait_lock_);
+  writer_.store(true);
+  readers_gone_.wait(l, [this]() { return CountReaders() == 0; });
+}
+
+void PerCpuRWMutex::WriteUnlock() {
+  {
+    std::lock_guard<std::mutex> l(wait_lock_);
+    writer_.store(false);
+  }
+  writer_gone_.notify_all();
+  write_lock_.unlock();
+}
+
+bool PerCpuRWMutex::TryWriteLock() {
+  if (!write_lock_.try_lock()) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> l(wait_lock_);
+    writer_.store(true);
+    if (CountReaders() == 0) {
+      return true;
+    }
+    writer_.store(false);
+  }
+  // Readers may have started waiting for this writer in the meantime.
+  writer_gone_.notify_all();
+  write_lock_.unlock();
+  return false;
+}
+
+int64_t PerCpuRWMutex::CountReaders() const {
+  int64_t readers = 0;
+  for (int i = 0; i < n_cpus_; i++) {
+    readers += counters_[i].readers.load();
+  }
+  return readers;
+}
+
+} // namespace kudu
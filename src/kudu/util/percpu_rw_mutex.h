@@ -0,0 +1,130 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <sched.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/gutil/port.h"
+
+namespace kudu {
+
+// A reader-writer mutex for read-mostly state, after the Linux kernel's
+// percpu-rwsem (and the "big reader" locks it replaced).
+//
+// Readers count themselves into a counter of the CPU they run on, each on
+// its own cacheline, so that concurrent readers on different CPUs don't
+// write to a shared cacheline the way they do with RWMutex or rw_spinlock.
+// A reader may release the lock from a different CPU than the one it took
+// it on: only the sum of the counters matters. In exchange, writers are
+// expensive: taking the lock visits the counter of every CPU, and waits
+// for the readers in flight to leave.
+//
+// Writers are preferred: once a writer waits for the lock, new readers
+// block until it has released it. As with RWMutex::Priority::PREFER_WRITING,
+// this means the lock must not be taken recursively for reading.
+//
+// Both readers and writers block, rather than spin, when they have to wait.
+class PerCpuRWMutex {
+ public:
+  PerCpuRWMutex();
+  ~PerCpuRWMutex();
+
+  void ReadLock() {
+    std::atomic<int64_t>* readers = &counters_[CurrentCpu()].readers;
+    readers->fetch_add(1);
+    if (PREDICT_FALSE(writer_.load())) {
+      ReadLockSlow(readers);
+    }
+  }
+
+  void ReadUnlock() {
+    counters_[CurrentCpu()].readers.fetch_sub(1);
+    if (PREDICT_FALSE(writer_.load())) {
+      WakeWriter();
+    }
+  }
+
+  bool TryReadLock();
+
+  void WriteLock();
+  void WriteUnlock();
+  bool TryWriteLock();
+
+  // Aliases for use with std::lock_guard and kudu::shared_lock.
+  void lock() { WriteLock(); }
+  void unlock() { WriteUnlock(); }
+  bool try_lock() { return TryWriteLock(); }
+  void lock_shared() { ReadLock(); }
+  void unlock_shared() { ReadUnlock(); }
+  bool try_lock_shared() { return TryReadLock(); }
+
+ private:
+  struct PaddedCounter {
+    std::atomic<int64_t> readers;
+    char padding[CACHELINE_SIZE - sizeof(std::atomic<int64_t>)];
+  };
+
+  int CurrentCpu() const {
+#if defined(__APPLE__)
+    // OSX doesn't have a way to get the index of the CPU running this thread.
+    return 0;
+#else
+    int cpu = sched_getcpu();
+    return PREDICT_TRUE(cpu >= 0 && cpu < n_cpus_) ? cpu : 0;
+#endif
+  }
+
+  // Backs out the reader which counted itself into 'readers' while a writer
+  // held or waited for the lock, and waits for the writer to be done.
+  void ReadLockSlow(std::atomic<int64_t>* readers);
+
+  // Wakes the writer, if any, waiting for the readers to leave.
+  void WakeWriter();
+
+  // Returns the number of readers holding the lock. Only meaningful while
+  // 'writer_' is set, which keeps new readers out.
+  int64_t CountReaders() const;
+
+  const int n_cpus_;
+  std::unique_ptr<PaddedCounter[]> counters_;
+
+  // Set while a writer holds or waits for the lock.
+  std::atomic<bool> writer_;
+
+  // Serializes the writers, and is held for as long as a writer holds the
+  // lock.
+  std::mutex write_lock_;
+
+  // Protects the waits of the slow paths: the writer waiting for the readers
+  // to leave on 'readers_gone_', and the readers waiting for the writer to
+  // release the lock on 'writer_gone_'.
+  std::mutex wait_lock_;
+  std::condition_variable readers_gone_;
+  std::condition_variable writer_gone_;
+
+  DISALLOW_COPY_AND_ASSIGN(PerCpuRWMutex);
+};
+
+} // namespace kudu
@@ -54,6 +54,31 @@ TEST(Striped64Test, TestBasic) {
   ASSERT_EQ(adder.Value(), 0);
 }
 
+TEST(Striped64Test, TestPerCpuAdderBasic) {
+  PerCpuAdder adder;
+  ASSERT_EQ(adder.Value(), 0);
+  adder.IncrementBy(100);
+  ASSERT_EQ(adder.Value(), 100);
+  adder.Increment();
+  ASSERT_EQ(adder.Value(), 101);
+  adder.Decrement();
+  ASSERT_EQ(adder.Value(), 100);
+  adder.Set(-7);
+  ASSERT_EQ(adder.Value(), -7);
+  adder.Reset();
+  ASSERT_EQ(adder.Value(), 0);
+
+  // What's taken is no longer part of the value.
+  int64_t taken = 0;
+  for (int i = 0; i < 100; i++) {
+    taken += adder.IncrementAndTakeIfPast(10, 50);
+  }
+  ASSERT_GT(taken, 0);
+  ASSERT_EQ(1000, taken + adder.Value());
+  ASSERT_EQ(1000 - taken, adder.TakeAll());
+  ASSERT_EQ(adder.Value(), 0);
+}
+
 template <class Adder>
 class MultiThreadTest {
  public:
@@ -131,10 +156,15 @@ void RunMultiTest(int64_t num_operations, int64_t num_threads) {
   MultiThreadTest<LongAdder> test(num_operations, num_threads);
   test.Run();
   MonoTime end2 = MonoTime::Now();
+  MultiThreadTest<PerCpuAdder> per_cpu_test(num_operations, num_threads);
+  per_cpu_test.Run();
+  MonoTime end3 = MonoTime::Now();
   MonoDelta basic = end1 - start;
   MonoDelta striped = end2 - end1;
+  MonoDelta per_cpu = end3 - end2;
   LOG(INFO) << "Basic counter took   " << basic.ToMilliseconds() << "ms.";
   LOG(INFO) << "Striped counter took " << striped.ToMilliseconds() << "ms.";
+  LOG(INFO) << "Per-CPU counter took " << per_cpu.ToMilliseconds() << "ms.";
 }
 
 // Compare a single-thread workload. Demonstrates the overhead of LongAdder over AtomicInt.
@@ -18,6 +18,7 @@
 #include "kudu/util/striped64.h"
 
 #include <mm_malloc.h>
+#include <sched.h>
 #include <unistd.h>
 
 #include <cstdlib>
@@ -188,4 +189,57 @@ int64_t LongAdder::Value() const {
   return sum;
 }
 
+//
+// PerCpuAdder
+//
+
+PerCpuAdder::PerCpuAdder() {
+  void* cell_buffer = nullptr;
+  int err = posix_memalign(&cell_buffer, CACHELINE_SIZE, sizeof(Cell) * kNumCells);
+  CHECK_EQ(0, err) << "error calling posix_memalign" << std::endl;
+  cells_ = new (cell_buffer) Cell[kNumCells];
+}
+
+PerCpuAdder::~PerCpuAdder() {
+  // Cell is a POD, so no need to destruct each one.
+  free(cells_);
+}
+
+int PerCpuAdder::CurrentCell() {
+  int cpu = sched_getcpu();
+  if (PREDICT_FALSE(cpu < 0)) {
+    // Without getcpu(), spread the threads over the Cells round-robin.
+    static std::atomic<int> next_cell(0);
+    static __thread int tls_cell = -1;
+    if (tls_cell < 0) {
+      tls_cell = next_cell++ & kCellMask;
+    }
+    cpu = tls_cell;
+  }
+  return cpu & kCellMask;
+}
+
+int64_t PerCpuAdder::Value() const {
+  int64_t sum = 0;
+  for (int i = 0; i < kNumCells; i++) {
+    sum += cells_[i].value_.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+int64_t PerCpuAdder::TakeAll() {
+  int64_t sum = 0;
+  for (int i = 0; i < kNumCells; i++) {
+    sum += cells_[i].value_.exchange(0, std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+void PerCpuAdder::Set(int64_t value) {
+  cells_[0].value_.store(value, std::memory_order_relaxed);
+  for (int i = 1; i < kNumCells; i++) {
+    cells_[i].value_.store(0, std::memory_order_relaxed);
+  }
+}
+
 } // namespace kudu
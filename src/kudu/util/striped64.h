@@ -163,6 +163,64 @@ class LongAdder : Striped64 {
   DISALLOW_COPY_AND_ASSIGN(LongAdder);
 };
 
+// A 64-bit number sharded over cache-line-padded Cells, one for each CPU,
+// which are summed when it's read.
+//
+// Unlike LongAdder, which only spreads its updates once they contend, an
+// update goes straight to the Cell of the CPU the thread runs on, as found by
+// sched_getcpu() (which glibc serves from the thread's rseq area, or from the
+// vDSO on older kernels). Since only the threads running on a CPU update its
+// Cell, the update is an uncontended atomic add to a cache line which stays
+// with that CPU, and costs the same however many cores update the number.
+// This costs a cache line for each CPU, rounded up to a power of two, for
+// each number, so it's meant for the few numbers updated from all cores at
+// high rates.
+class PerCpuAdder {
+ public:
+  PerCpuAdder();
+  ~PerCpuAdder();
+
+  void IncrementBy(int64_t x) {
+    cells_[CurrentCell()].value_.fetch_add(x, std::memory_order_relaxed);
+  }
+  void Increment() { IncrementBy(1); }
+  void Decrement() { IncrementBy(-1); }
+
+  // Adds 'x' to the Cell of the current CPU. If that leaves the Cell
+  // 'threshold' or more away from zero, empties the Cell and returns what it
+  // held, which is then no longer part of the value. Otherwise returns 0.
+  int64_t IncrementAndTakeIfPast(int64_t x, int64_t threshold) {
+    std::atomic<int64_t>& cell = cells_[CurrentCell()].value_;
+    const int64_t v = cell.fetch_add(x, std::memory_order_relaxed) + x;
+    if (PREDICT_TRUE(v < threshold && v > -threshold)) {
+      return 0;
+    }
+    return cell.exchange(0, std::memory_order_relaxed);
+  }
+
+  // Returns the current value.
+  // Note this is not an atomic snapshot in the presence of concurrent updates.
+  int64_t Value() const;
+
+  // Empties every Cell and returns what they held. Unlike Value() followed by
+  // Reset(), no concurrent update is lost: each is either taken or left.
+  int64_t TakeAll();
+
+  // Sets the value to 'value'. Updates which race with this may be lost.
+  void Set(int64_t value);
+
+  // Resets the value to zero.
+  void Reset() { Set(0); }
+
+ private:
+  // Returns the index of the Cell of the current CPU.
+  static int CurrentCell();
+
+  striped64::internal::Cell* cells_;
+
+  DISALLOW_COPY_AND_ASSIGN(PerCpuAdder);
+};
+
 } // namespace kudu
 
 #endif
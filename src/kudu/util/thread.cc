@@ -84,6 +84,14 @@ METRIC_DEFINE_gauge_uint64(server, threads_running,
                            kudu::MetricUnit::kThreads,
                            "Current number of running threads");
 
+METRIC_DEFINE_gauge_uint64(server, thread_start_time_us,
+                           "Thread Start Time",
+                           kudu::MetricUnit::kMicroseconds,
+                           "Total time spent starting threads on this server. "
+                           "Divided by the threads started, this is the average "
+                           "latency of starting a thread.",
+                           kudu::EXPOSE_AS_COUNTER);
+
 METRIC_DEFINE_gauge_uint64(server, cpu_utime,
                            "User CPU Time",
                            kudu::MetricUnit::kMilliseconds,
@@ -139,6 +147,14 @@ static uint64_t GetInVoluntaryContextSwitches() {
   return ru.ru_nivcsw;
 }
 
+// Total microseconds spent in Thread::StartThread() by successful starts.
+// Kept outside of ThreadMgr so that it's updated without its lock.
+static Atomic64 thread_start_time_us = 0;
+
+static uint64_t GetThreadStartTimeUs() {
+  return base::subtle::NoBarrier_Load(&thread_start_time_us);
+}
+
 class ThreadMgr;
 
 __thread Thread* Thread::tls_ = NULL;
@@ -256,6 +272,9 @@ Status ThreadMgr::StartInstrumentation(const scoped_refptr<MetricEntity>& metric
   metrics->NeverRetire(
       METRIC_threads_running.InstantiateFunctionGauge(metrics,
         Bind(&ThreadMgr::ReadThreadsRunning, Unretained(this))));
+  metrics->NeverRetire(
+      METRIC_thread_start_time_us.InstantiateFunctionGauge(metrics,
+        Bind(&GetThreadStartTimeUs)));
   metrics->NeverRetire(
       METRIC_cpu_utime.InstantiateFunctionGauge(metrics,
         Bind(&GetCpuUTime)));
@@ -505,6 +524,7 @@ Status Thread::StartThread(const std::string& category, const std::string& name,
                            scoped_refptr<Thread> *holder) {
   TRACE_COUNTER_INCREMENT("threads_started", 1);
   TRACE_COUNTER_SCOPE_LATENCY_US("thread_start_us");
+  const MonoTime start = MonoTime::Now();
   GoogleOnceInit(&once, &InitThreading);
 
   const string log_prefix = Substitute("$0 ($1) ", name, category);
@@ -558,6 +578,8 @@ Status Thread::StartThread(const std::string& category, const std::string& name,
   cleanup.cancel();
 
   VLOG(2) << "Started thread " << t->tid()<< " - " << category << ":" << name;
+  base::subtle::NoBarrier_AtomicIncrement(&thread_start_time_us,
+                                          (MonoTime::Now() - start).ToMicroseconds());
   return Status::OK();
 }
 
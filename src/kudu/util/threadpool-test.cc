@@ -66,6 +66,7 @@ using std::vector;
 
 using strings::Substitute;
 
+DECLARE_bool(thread_pool_park_idle_threads);
 DECLARE_int32(thread_inject_start_latency_ms);
 
 namespace kudu {
@@ -421,6 +422,9 @@ METRIC_DEFINE_histogram(test_entity, queue_time, "queue time",
 METRIC_DEFINE_histogram(test_entity, run_time, "run time",
                         MetricUnit::kMicroseconds, "run time", 1000, 1);
 
+METRIC_DEFINE_histogram(test_entity, thread_start_time, "thread start time",
+                        MetricUnit::kMicroseconds, "thread start time", 1000000, 1);
+
 TEST_F(ThreadPoolTest, TestMetrics) {
   MetricRegistry registry;
   vector<ThreadPoolMetrics> all_metrics;
@@ -468,6 +472,46 @@ TEST_F(ThreadPoolTest, TestMetrics) {
   ASSERT_EQ(6, all_metrics[0].run_time_us_histogram->TotalCount());
 }
 
+// Test that with --thread_pool_park_idle_threads, threads outlive the idle
+// timeout and are reused, so that threads are only started when the pool grows.
+TEST_F(ThreadPoolTest, TestParkIdleThreads) {
+  FLAGS_thread_pool_park_idle_threads = true;
+  MetricRegistry registry;
+  scoped_refptr<MetricEntity> entity = METRIC_ENTITY_test_entity.Instantiate(
+      &registry, "test");
+  ThreadPoolMetrics metrics;
+  metrics.thread_start_time_us_histogram = METRIC_thread_start_time.Instantiate(entity);
+  ASSERT_OK(RebuildPoolWithBuilder(ThreadPoolBuilder(kDefaultPoolName)
+                                   .set_min_threads(0)
+                                   .set_max_threads(3)
+                                   .set_idle_timeout(MonoDelta::FromMilliseconds(1))
+                                   .set_metrics(metrics)));
+
+  for (int round = 0; round < 3; round++) {
+    CountDownLatch latch(1);
+    ASSERT_OK(pool_->Submit(SlowTask::NewSlowTask(&latch)));
+    ASSERT_OK(pool_->Submit(SlowTask::NewSlowTask(&latch)));
+    latch.CountDown();
+    pool_->Wait();
+    // Well past the idle timeout, the threads are still there.
+    SleepFor(MonoDelta::FromMilliseconds(50));
+    ASSERT_EQ(2, pool_->num_threads());
+  }
+  ASSERT_EQ(2, metrics.thread_start_time_us_histogram->TotalCount());
+
+  // Growing the pool still starts a thread.
+  CountDownLatch latch(1);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(pool_->Submit(SlowTask::NewSlowTask(&latch)));
+  }
+  ASSERT_EQ(3, pool_->num_threads());
+  latch.CountDown();
+  pool_->Wait();
+  ASSERT_EQ(3, metrics.thread_start_time_us_histogram->TotalCount());
+  pool_->Shutdown();
+  ASSERT_EQ(0, pool_->num_threads());
+}
+
 // Test that a thread pool will crash if asked to run its own blocking
 // functions in a pool thread.
 //
@@ -938,4 +982,159 @@ TEST_F(ThreadPoolTest, TestLIFOThreadWakeUps) {
   NO_PENDING_FATALS();
 }
 
+// Tasks submitted by the workers of a work-stealing pool go to their own
+// queues, and are stolen by the other workers.
+TEST_F(ThreadPoolTest, TestWorkStealingNestedSubmissions) {
+  const int kNumThreads = 4;
+  const int kNumOuterTasks = 50;
+  const int kNumInnerTasks = 20;
+  ASSERT_OK(RebuildPoolWithBuilder(ThreadPoolBuilder(kDefaultPoolName)
+                                   .set_max_threads(kNumThreads)
+                                   .set_work_stealing(true)));
+  ASSERT_EQ(kNumThreads, pool_->num_threads());
+
+  atomic<int32_t> v(0);
+  for (int i = 0; i < kNumOuterTasks; i++) {
+    ASSERT_OK(pool_->SubmitFunc([&]() {
+      for (int j = 0; j < kNumInnerTasks; j++) {
+        CHECK_OK(pool_->SubmitFunc([&]() {
+          v++;
+        }));
+      }
+      v++;
+    }));
+  }
+  pool_->Wait();
+  ASSERT_EQ(kNumOuterTasks * (kNumInnerTasks + 1), v);
+  pool_->Shutdown();
+  ASSERT_TRUE(pool_->SubmitFunc([](){}).IsServiceUnavailable());
+}
+
+// The tasks of SERIAL tokens run one at a time and in order, whichever
+// workers they end up on, while the tokens run concurrently.
+TEST_F(ThreadPoolTest, TestWorkStealingSerialTokens) {
+  const int kNumTokens = 8;
+  const int kNumSubmissions = 100;
+  ASSERT_OK(RebuildPoolWithBuilder(ThreadPoolBuilder(kDefaultPoolName)
+                                   .set_max_threads(4)
+                                   .set_work_stealing(true)));
+  vector<unique_ptr<ThreadPoolToken>> tokens;
+  vector<vector<int>> results(kNumTokens);
+  vector<unique_ptr<atomic<int32_t>>> running;
+  atomic<bool> overlapped(false);
+  for (int i = 0; i < kNumTokens; i++) {
+    tokens.emplace_back(pool_->NewToken(ThreadPool::ExecutionMode::SERIAL));
+    running.emplace_back(new atomic<int32_t>(0));
+  }
+  for (int i = 0; i < kNumSubmissions; i++) {
+    for (int t = 0; t < kNumTokens; t++) {
+      atomic<int32_t>* token_running = running[t].get();
+      vector<int>* result = &results[t];
+      ASSERT_OK(tokens[t]->SubmitFunc([&overlapped, token_running, result, i]() {
+        if ((*token_running)++ != 0) {
+          overlapped = true;
+        }
+        result->push_back(i);
+        (*token_running)--;
+      }));
+    }
+  }
+  for (auto& t : tokens) {
+    t->Wait();
+  }
+  ASSERT_FALSE(overlapped);
+  for (const auto& result : results) {
+    ASSERT_EQ(kNumSubmissions, static_cast<int>(result.size()));
+    for (int i = 0; i < kNumSubmissions; i++) {
+      ASSERT_EQ(i, result[i]);
+    }
+  }
+}
+
+// Shutting down the tokens and the pool releases the tasks still queued, and
+// waits for the ones running.
+TEST_P(ThreadPoolTestTokenTypes, TestWorkStealingShutdown) {
+  ASSERT_OK(RebuildPoolWithBuilder(ThreadPoolBuilder(kDefaultPoolName)
+                                   .set_max_threads(2)
+                                   .set_work_stealing(true)));
+  unique_ptr<ThreadPoolToken> t1(pool_->NewToken(GetParam()));
+  unique_ptr<ThreadPoolToken> t2(pool_->NewToken(GetParam()));
+  CountDownLatch latch(1);
+  atomic<int32_t> v(0);
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(t1->SubmitFunc([&]() {
+      latch.Wait();
+      v++;
+    }));
+    ASSERT_OK(t2->SubmitFunc([&]() {
+      latch.Wait();
+      v++;
+    }));
+  }
+  latch.CountDown();
+  t1->Shutdown();
+  ASSERT_TRUE(t1->SubmitFunc([](){}).IsServiceUnavailable());
+  ASSERT_OK(t2->SubmitFunc([](){}));
+  pool_->Shutdown();
+  ASSERT_TRUE(t2->SubmitFunc([](){}).IsServiceUnavailable());
+  pool_->Wait();
+}
+
+// Counts how many of the tasks submitted with it ran, and how many of the
+// copies moved into the tasks were destroyed.
+class MoveOnlyTask {
+ public:
+  MoveOnlyTask(atomic<int32_t>* runs, atomic<int32_t>* destroyed)
+      : runs_(runs),
+        destroyed_(new Destroyed(destroyed)) {
+  }
+
+  void operator()() {
+    (*runs_)++;
+  }
+
+ private:
+  struct Destroyed {
+    explicit Destroyed(atomic<int32_t>* count) : count(count) {}
+    ~Destroyed() {
+      (*count)++;
+    }
+    atomic<int32_t>* count;
+  };
+
+  atomic<int32_t>* runs_;
+  unique_ptr<Destroyed> destroyed_;
+};
+
+// Move-only functions may be submitted, with or without a token, and are
+// destroyed whether they ran or were dropped at shutdown.
+TEST_F(ThreadPoolTest, TestSubmitMoveOnlyFunctions) {
+  for (bool work_stealing : { false, true }) {
+    ASSERT_OK(RebuildPoolWithBuilder(ThreadPoolBuilder(kDefaultPoolName)
+                                     .set_max_threads(1)
+                                     .set_work_stealing(work_stealing)));
+    atomic<int32_t> runs(0);
+    atomic<int32_t> destroyed(0);
+    unique_ptr<ThreadPoolToken> t = pool_->NewToken(ThreadPool::ExecutionMode::SERIAL);
+    for (int i = 0; i < 10; i++) {
+      ASSERT_OK(pool_->Submit(MoveOnlyTask(&runs, &destroyed)));
+      ASSERT_OK(t->Submit(MoveOnlyTask(&runs, &destroyed)));
+    }
+    pool_->Wait();
+    ASSERT_EQ(20, runs);
+    ASSERT_EQ(20, destroyed);
+
+    CountDownLatch latch(1);
+    ASSERT_OK(t->Submit([&latch]() { latch.Wait(); }));
+    for (int i = 0; i < 10; i++) {
+      ASSERT_OK(t->Submit(MoveOnlyTask(&runs, &destroyed)));
+    }
+    latch.CountDown();
+    t.reset();
+    pool_->Shutdown();
+    ASSERT_TRUE(pool_->Submit(MoveOnlyTask(&runs, &destroyed)).IsServiceUnavailable());
+    ASSERT_EQ(31, destroyed);
+  }
+}
+
 } // namespace kudu
@@ -17,15 +17,19 @@
 
 #include "kudu/util/threadpool.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <deque>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <boost/function.hpp> // IWYU pragma: keep
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/callback.h"
@@ -34,12 +38,24 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/sysinfo.h"
 #include "kudu/gutil/walltime.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/thread.h"
 #include "kudu/util/trace.h"
 #include "kudu/util/trace_metrics.h"
 
+DEFINE_bool(thread_pool_park_idle_threads, false,
+            "Whether the worker threads of a thread pool that have been idle "
+            "for longer than the pool's idle timeout stay parked, waiting for "
+            "work, rather than exiting. Parked threads cost only their stacks, "
+            "and a pool then starts a thread only when it has more tasks to run "
+            "concurrently than it ever had, instead of restarting threads after "
+            "every quiet spell.");
+TAG_FLAG(thread_pool_park_idle_threads, experimental);
+TAG_FLAG(thread_pool_park_idle_threads, runtime);
+
 namespace kudu {
 
 using std::deque;
@@ -48,36 +64,38 @@ using std::string;
 using std::unique_ptr;
 using strings::Substitute;
 
+// The work-stealing pool whose worker is the current thread, if any, and the
+// index of the worker.
+static __thread ThreadPool* tls_work_stealing_pool = nullptr;
+static __thread int tls_worker_idx = -1;
+
+// The number of tasks a pool keeps for reuse, at most.
+static const size_t kMaxFreeTasks = 1024;
+
 ////////////////////////////////////////////////////////
-// FunctionRunnable
+// RunnableFunction
 ////////////////////////////////////////////////////////
 
-class FunctionRunnable : public Runnable {
- public:
-  explicit FunctionRunnable(boost::function<void()> func) : func_(std::move(func)) {}
-
-  void Run() override {
-    func_();
+// The function of a task submitted as a Runnable.
+struct RunnableFunction {
+  void operator()() const {
+    runnable->Run();
   }
 
- private:
-  boost::function<void()> func_;
+  shared_ptr<Runnable> runnable;
 };
 
 ////////////////////////////////////////////////////////
-// ClosureRunnable
+// ClosureFunction
 ////////////////////////////////////////////////////////
 
-class ClosureRunnable : public Runnable {
- public:
-  explicit ClosureRunnable(Closure cl) : cl_(std::move(cl)) {}
-
-  void Run() override {
-    cl_.Run();
+// The function of a task submitted as a Closure.
+struct ClosureFunction {
+  void operator()() const {
+    cl.Run();
   }
 
- private:
-  Closure cl_;
+  Closure cl;
 };
 
 ////////////////////////////////////////////////////////
@@ -89,7 +107,8 @@ ThreadPoolBuilder::ThreadPoolBuilder(string name)
       min_threads_(0),
       max_threads_(base::NumCPUs()),
       max_queue_size_(std::numeric_limits<int>::max()),
-      idle_timeout_(MonoDelta::FromMilliseconds(500)) {}
+      idle_timeout_(MonoDelta::FromMilliseconds(500)),
+      work_stealing_(false) {}
 
 ThreadPoolBuilder& ThreadPoolBuilder::set_trace_metric_prefix(const string& prefix) {
   trace_metric_prefix_ = prefix;
@@ -123,6 +142,11 @@ ThreadPoolBuilder& ThreadPoolBuilder::set_metrics(ThreadPoolMetrics metrics) {
   return *this;
 }
 
+ThreadPoolBuilder& ThreadPoolBuilder::set_work_stealing(bool work_stealing) {
+  work_stealing_ = work_stealing;
+  return *this;
+}
+
 Status ThreadPoolBuilder::Build(gscoped_ptr<ThreadPool>* pool) const {
   pool->reset(new ThreadPool(*this));
   RETURN_NOT_OK((*pool)->Init());
@@ -140,8 +164,9 @@ ThreadPoolToken::ThreadPoolToken(ThreadPool* pool,
       metrics_(std::move(metrics)),
       pool_(pool),
       state_(State::IDLE),
-      not_running_cond_(&pool->lock_),
-      active_threads_(0) {
+      not_running_cond_(pool->work_stealing_ ? &own_lock_ : &pool->lock_),
+      active_threads_(0),
+      queued_runs_(0) {
 }
 
 ThreadPoolToken::~ThreadPoolToken() {
@@ -150,27 +175,38 @@ ThreadPoolToken::~ThreadPoolToken() {
 }
 
 Status ThreadPoolToken::SubmitClosure(Closure c) {
-  return Submit(std::make_shared<ClosureRunnable>(std::move(c)));
+  return Submit(ClosureFunction{ std::move(c) });
 }
 
 Status ThreadPoolToken::SubmitFunc(boost::function<void()> f) {
-  return Submit(std::make_shared<FunctionRunnable>(std::move(f)));
+  return Submit(ThreadPool::Function(std::move(f)));
 }
 
 Status ThreadPoolToken::Submit(shared_ptr<Runnable> r) {
-  return pool_->DoSubmit(std::move(r), this);
+  return Submit(RunnableFunction{ std::move(r) });
+}
+
+Status ThreadPoolToken::Submit(ThreadPool::Function f) {
+  return pool_->DoSubmit(std::move(f), this);
+}
+
+Mutex& ThreadPoolToken::lock() const {
+  return pool_->work_stealing_ ? own_lock_ : pool_->lock_;
 }
 
 void ThreadPoolToken::Shutdown() {
-  MutexLock unique_lock(pool_->lock_);
+  MutexLock unique_lock(lock());
   pool_->CheckNotPoolThreadUnlocked();
 
   // Clear the queue under the lock, but defer the releasing of the tasks
   // outside the lock, in case there are concurrent threads wanting to access
   // the ThreadPool. The task's destructors may acquire locks, etc, so this
   // also prevents lock inversions.
-  std::deque<ThreadPool::Task> to_release = std::move(entries_);
-  pool_->total_queued_tasks_ -= to_release.size();
+  ThreadPool::TaskList to_release;
+  to_release.swap(entries_);
+  if (!pool_->work_stealing_) {
+    pool_->total_queued_tasks_ -= to_release.size();
+  }
 
   switch (state()) {
     case State::IDLE:
@@ -187,6 +223,9 @@ void ThreadPoolToken::Shutdown() {
       // Plus doing it this way (rather than switching to QUIESCING and waiting
       // for a worker thread to process the queue entry) helps retain state
       // transition symmetry with ThreadPool::Shutdown.
+      //
+      // The runs of a token of a work-stealing pool are left in the queues of
+      // the workers, which drop them.
       for (auto it = pool_->queue_.begin(); it != pool_->queue_.end();) {
         if (*it == this) {
           it = pool_->queue_.erase(it);
@@ -195,7 +234,7 @@ void ThreadPoolToken::Shutdown() {
         }
       }
 
-      if (active_threads_ == 0) {
+      if (active_threads_ == 0 && queued_runs_ == 0) {
         Transition(State::QUIESCED);
         break;
       }
@@ -214,15 +253,15 @@ void ThreadPoolToken::Shutdown() {
 
   // Finally release the queued tasks, outside the lock.
   unique_lock.Unlock();
-  for (auto& t : to_release) {
-    if (t.trace) {
-      t.trace->Release();
-    }
+  const int64_t num_released = to_release.size();
+  to_release.clear_and_dispose([this](ThreadPool::Task* t) { pool_->ReleaseTask(t); });
+  if (pool_->work_stealing_ && num_released > 0) {
+    pool_->FinishTasks(num_released);
   }
 }
 
 void ThreadPoolToken::Wait() {
-  MutexLock unique_lock(pool_->lock_);
+  MutexLock unique_lock(lock());
   pool_->CheckNotPoolThreadUnlocked();
   while (IsActive()) {
     not_running_cond_.Wait();
@@ -230,7 +269,7 @@ void ThreadPoolToken::Wait() {
 }
 
 bool ThreadPoolToken::WaitUntil(const MonoTime& until) {
-  MutexLock unique_lock(pool_->lock_);
+  MutexLock unique_lock(lock());
   pool_->CheckNotPoolThreadUnlocked();
   while (IsActive()) {
     if (!not_running_cond_.WaitUntil(until)) {
@@ -265,12 +304,13 @@ void ThreadPoolToken::Transition(State new_state) {
             new_state == State::QUIESCED);
       CHECK(entries_.empty());
       if (new_state == State::QUIESCING) {
-        CHECK_GT(active_threads_, 0);
+        CHECK(active_threads_ > 0 || queued_runs_ > 0);
       }
       break;
     case State::QUIESCING:
       CHECK(new_state == State::QUIESCED);
       CHECK_EQ(active_threads_, 0);
+      CHECK_EQ(queued_runs_, 0);
       break;
     case State::QUIESCED:
       CHECK(false); // QUIESCED is a terminal state
@@ -313,6 +353,7 @@ ThreadPool::ThreadPool(const ThreadPoolBuilder& builder)
     max_threads_(builder.max_threads_),
     max_queue_size_(builder.max_queue_size_),
     idle_timeout_(builder.idle_timeout_),
+    work_stealing_(builder.work_stealing_),
     pool_status_(Status::Uninitialized("The pool was not initialized.")),
     idle_cond_(&lock_),
     no_threads_cond_(&lock_),
@@ -321,7 +362,18 @@ ThreadPool::ThreadPool(const ThreadPoolBuilder& builder)
     active_threads_(0),
     total_queued_tasks_(0),
     tokenless_(NewToken(ExecutionMode::CONCURRENT)),
-    metrics_(builder.metrics_) {
+    metrics_(builder.metrics_),
+    ws_queued_runs_(0),
+    ws_outstanding_tasks_(0),
+    ws_num_sleepers_(0),
+    ws_accepting_(false),
+    ws_next_queue_(0),
+    ws_work_cond_(&lock_) {
+  if (work_stealing_) {
+    for (int i = 0; i < max_threads_; i++) {
+      worker_queues_.emplace_back(new WorkerQueue);
+    }
+  }
   string prefix = !builder.trace_metric_prefix_.empty() ?
       builder.trace_metric_prefix_ : builder.name_;
 
@@ -337,6 +389,7 @@ ThreadPool::~ThreadPool() {
       "Threadpool $0 destroyed with $1 allocated tokens",
       name_, tokens_.size());
   Shutdown();
+  free_tasks_.clear_and_dispose([](Task* t) { delete t; });
 }
 
 Status ThreadPool::Init() {
@@ -344,6 +397,26 @@ Status ThreadPool::Init() {
     return Status::NotSupported("The thread pool is already initialized");
   }
   pool_status_ = Status::OK();
+  if (work_stealing_) {
+    // The workers of a work-stealing pool all start up front, and run until
+    // the pool is shut down.
+    ws_accepting_ = true;
+    num_threads_pending_start_ = max_threads_;
+    for (int i = 0; i < max_threads_; i++) {
+      Status status = kudu::Thread::Create(
+          "thread pool", strings::Substitute("$0 [worker]", name_),
+          &ThreadPool::WorkStealingDispatchThread, this, i, nullptr);
+      if (!status.ok()) {
+        {
+          MutexLock l(lock_);
+          num_threads_pending_start_ -= max_threads_ - i;
+        }
+        Shutdown();
+        return status;
+      }
+    }
+    return Status::OK();
+  }
   num_threads_pending_start_ = min_threads_;
   for (int i = 0; i < min_threads_; i++) {
     Status status = CreateThread();
@@ -356,6 +429,10 @@ Status ThreadPool::Init() {
 }
 
 void ThreadPool::Shutdown() {
+  if (work_stealing_) {
+    ShutdownWorkStealing();
+    return;
+  }
   MutexLock unique_lock(lock_);
   CheckNotPoolThreadUnlocked();
 
@@ -370,11 +447,9 @@ void ThreadPool::Shutdown() {
   // wanting to access the ThreadPool. The task's destructors may acquire
   // locks, etc, so this also prevents lock inversions.
   queue_.clear();
-  std::deque<std::deque<Task>> to_release;
+  TaskList to_release;
   for (auto* t : tokens_) {
-    if (!t->entries_.empty()) {
-      to_release.emplace_back(std::move(t->entries_));
-    }
+    to_release.splice(to_release.end(), t->entries_);
     switch (t->state()) {
       case ThreadPoolToken::State::IDLE:
         // The token is idle; we can quiesce it immediately.
@@ -414,13 +489,7 @@ void ThreadPool::Shutdown() {
 
   // Finally release the queued tasks, outside the lock.
   unique_lock.Unlock();
-  for (auto& token : to_release) {
-    for (auto& t : token) {
-      if (t.trace) {
-        t.trace->Release();
-      }
-    }
-  }
+  to_release.clear_and_dispose([this](Task* t) { ReleaseTask(t); });
 }
 
 unique_ptr<ThreadPoolToken> ThreadPool::NewToken(ExecutionMode mode) {
@@ -445,19 +514,54 @@ void ThreadPool::ReleaseToken(ThreadPoolToken* t) {
 }
 
 Status ThreadPool::SubmitClosure(Closure c) {
-  return Submit(std::make_shared<ClosureRunnable>(std::move(c)));
+  return Submit(ClosureFunction{ std::move(c) });
 }
 
 Status ThreadPool::SubmitFunc(boost::function<void()> f) {
-  return Submit(std::make_shared<FunctionRunnable>(std::move(f)));
+  return Submit(Function(std::move(f)));
 }
 
 Status ThreadPool::Submit(shared_ptr<Runnable> r) {
-  return DoSubmit(std::move(r), tokenless_.get());
+  return Submit(RunnableFunction{ std::move(r) });
+}
+
+Status ThreadPool::Submit(Function f) {
+  return DoSubmit(std::move(f), tokenless_.get());
 }
 
-Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
+ThreadPool::Task* ThreadPool::NewTask() {
+  {
+    std::lock_guard<simple_spinlock> l(free_tasks_lock_);
+    if (!free_tasks_.empty()) {
+      Task* task = &free_tasks_.front();
+      free_tasks_.pop_front();
+      return task;
+    }
+  }
+  return new Task();
+}
+
+void ThreadPool::ReleaseTask(Task* task) {
+  if (task->trace) {
+    task->trace->Release();
+    task->trace = nullptr;
+  }
+  task->func.reset();
+  {
+    std::lock_guard<simple_spinlock> l(free_tasks_lock_);
+    if (free_tasks_.size() < kMaxFreeTasks) {
+      free_tasks_.push_front(*task);
+      return;
+    }
+  }
+  delete task;
+}
+
+Status ThreadPool::DoSubmit(Function f, ThreadPoolToken* token) {
   DCHECK(token);
+  if (work_stealing_) {
+    return DoSubmitWorkStealing(std::move(f), token);
+  }
   MonoTime submit_time = MonoTime::Now();
 
   MutexLock guard(lock_);
@@ -507,21 +611,21 @@ Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
     num_threads_pending_start_++;
   }
 
-  Task task;
-  task.runnable = std::move(r);
-  task.trace = Trace::CurrentTrace();
+  Task* task = NewTask();
+  task->func = std::move(f);
+  task->trace = Trace::CurrentTrace();
   // Need to AddRef, since the thread which submitted the task may go away,
   // and we don't want the trace to be destructed while waiting in the queue.
-  if (task.trace) {
-    task.trace->AddRef();
+  if (task->trace) {
+    task->trace->AddRef();
   }
-  task.submit_time = submit_time;
+  task->submit_time = submit_time;
 
   // Add the task to the token's queue.
   ThreadPoolToken::State state = token->state();
   DCHECK(state == ThreadPoolToken::State::IDLE ||
          state == ThreadPoolToken::State::RUNNING);
-  token->entries_.emplace_back(std::move(task));
+  token->entries_.push_back(*task);
   if (state == ThreadPoolToken::State::IDLE ||
       token->mode() == ExecutionMode::CONCURRENT) {
     queue_.emplace_back(token);
@@ -573,7 +677,7 @@ Status ThreadPool::DoSubmit(shared_ptr<Runnable> r, ThreadPoolToken* token) {
 void ThreadPool::Wait() {
   MutexLock unique_lock(lock_);
   CheckNotPoolThreadUnlocked();
-  while (total_queued_tasks_ > 0 || active_threads_ > 0) {
+  while (HasOutstandingTasks()) {
     idle_cond_.Wait();
   }
 }
@@ -581,7 +685,7 @@ void ThreadPool::Wait() {
 bool ThreadPool::WaitUntil(const MonoTime& until) {
   MutexLock unique_lock(lock_);
   CheckNotPoolThreadUnlocked();
-  while (total_queued_tasks_ > 0 || active_threads_ > 0) {
+  while (HasOutstandingTasks()) {
     if (!idle_cond_.WaitUntil(until)) {
       return false;
     }
@@ -626,7 +730,7 @@ void ThreadPool::DispatchThread() {
           idle_threads_.erase(idle_threads_.iterator_to(me));
         }
       });
-      if (permanent) {
+      if (permanent || FLAGS_thread_pool_park_idle_threads) {
         me.not_empty.Wait();
       } else {
         if (!me.not_empty.WaitFor(idle_timeout_)) {
@@ -651,7 +755,7 @@ void ThreadPool::DispatchThread() {
     queue_.pop_front();
     DCHECK_EQ(ThreadPoolToken::State::RUNNING, token->state());
     DCHECK(!token->entries_.empty());
-    Task task = std::move(token->entries_.front());
+    Task* task = &token->entries_.front();
     token->entries_.pop_front();
     token->active_threads_++;
     --total_queued_tasks_;
@@ -659,46 +763,7 @@ void ThreadPool::DispatchThread() {
 
     unique_lock.Unlock();
 
-    // Release the reference which was held by the queued item.
-    ADOPT_TRACE(task.trace);
-    if (task.trace) {
-      task.trace->Release();
-    }
-
-    // Update metrics
-    MonoTime now(MonoTime::Now());
-    int64_t queue_time_us = (now - task.submit_time).ToMicroseconds();
-    TRACE_COUNTER_INCREMENT(queue_time_trace_metric_name_, queue_time_us);
-    if (metrics_.queue_time_us_histogram) {
-      metrics_.queue_time_us_histogram->Increment(queue_time_us);
-    }
-    if (token->metrics_.queue_time_us_histogram) {
-      token->metrics_.queue_time_us_histogram->Increment(queue_time_us);
-    }
-
-    // Execute the task
-    {
-      MicrosecondsInt64 start_wall_us = GetMonoTimeMicros();
-
-      task.runnable->Run();
-
-      int64_t wall_us = GetMonoTimeMicros() - start_wall_us;
-
-      if (metrics_.run_time_us_histogram) {
-        metrics_.run_time_us_histogram->Increment(wall_us);
-      }
-      if (token->metrics_.run_time_us_histogram) {
-        token->metrics_.run_time_us_histogram->Increment(wall_us);
-      }
-      TRACE_COUNTER_INCREMENT(run_wall_time_trace_metric_name_, wall_us);
-    }
-    // Destruct the task while we do not hold the lock.
-    //
-    // The task's destructor may be expensive if it has a lot of bound
-    // objects, and we don't want to block submission of the threadpool.
-    // In the worst case, the destructor might even try to do something
-    // with this threadpool, and produce a deadlock.
-    task.runnable.reset();
+    RunTask(token, task);
     unique_lock.Lock();
 
     // Possible states:
@@ -740,14 +805,338 @@ void ThreadPool::DispatchThread() {
   }
 }
 
+Status ThreadPool::DoSubmitWorkStealing(Function f, ThreadPoolToken* token) {
+  MonoTime submit_time = MonoTime::Now();
+  if (PREDICT_FALSE(!ws_accepting_)) {
+    return Status::ServiceUnavailable("The pool has been shut down.");
+  }
+
+  // Size limit check.
+  const int64_t capacity = static_cast<int64_t>(max_threads_) + max_queue_size_;
+  const int64_t outstanding = ws_outstanding_tasks_++;
+  if (outstanding >= capacity) {
+    FinishTasks(1);
+    return Status::ServiceUnavailable(
+        Substitute("Thread pool is at capacity ($0/$1 tasks queued or running)",
+                   outstanding, capacity));
+  }
+
+  Task* task = NewTask();
+  task->func = std::move(f);
+  task->trace = Trace::CurrentTrace();
+  // Need to AddRef, since the thread which submitted the task may go away,
+  // and we don't want the trace to be destructed while waiting in the queue.
+  if (task->trace) {
+    task->trace->AddRef();
+  }
+  task->submit_time = submit_time;
+  const int64_t length_at_submit = std::max<int64_t>(0, ws_queued_runs_);
+
+  if (token == tokenless_.get()) {
+    PushRun(Run{ token, task }, false);
+  } else {
+    bool push;
+    {
+      MutexLock l(token->own_lock_);
+      if (PREDICT_FALSE(!token->MaySubmitNewTasks())) {
+        l.Unlock();
+        ReleaseTask(task);
+        FinishTasks(1);
+        return Status::ServiceUnavailable("Thread pool token was shut down");
+      }
+      ThreadPoolToken::State state = token->state();
+      DCHECK(state == ThreadPoolToken::State::IDLE ||
+             state == ThreadPoolToken::State::RUNNING);
+      token->entries_.push_back(*task);
+      // A SERIAL token has a single run, queued or running, while it has tasks.
+      push = state == ThreadPoolToken::State::IDLE ||
+             token->mode() == ExecutionMode::CONCURRENT;
+      if (state == ThreadPoolToken::State::IDLE) {
+        token->Transition(ThreadPoolToken::State::RUNNING);
+      }
+      if (push) {
+        token->queued_runs_++;
+      }
+    }
+    if (push) {
+      PushRun(Run{ token, nullptr }, false);
+    }
+  }
+
+  if (metrics_.queue_length_histogram) {
+    metrics_.queue_length_histogram->Increment(length_at_submit);
+  }
+  if (token->metrics_.queue_length_histogram) {
+    token->metrics_.queue_length_histogram->Increment(length_at_submit);
+  }
+  return Status::OK();
+}
+
+void ThreadPool::PushRun(Run run, bool at_front) {
+  const size_t idx = tls_work_stealing_pool == this
+      ? tls_worker_idx : ws_next_queue_++ % worker_queues_.size();
+  WorkerQueue* queue = worker_queues_[idx].get();
+  {
+    std::lock_guard<simple_spinlock> l(queue->lock);
+    if (at_front) {
+      queue->runs.emplace_front(std::move(run));
+    } else {
+      queue->runs.emplace_back(std::move(run));
+    }
+  }
+  // A worker counts itself as sleeping before it checks for runs, and the
+  // run is counted before checking for sleepers, so either the worker finds
+  // the run or it's woken up.
+  ws_queued_runs_++;
+  if (ws_num_sleepers_ > 0) {
+    MutexLock l(lock_);
+    ws_work_cond_.Signal();
+  }
+  // No worker may be left to take the run if the pool was shut down meanwhile.
+  if (PREDICT_FALSE(!ws_accepting_)) {
+    DrainRuns();
+  }
+}
+
+bool ThreadPool::PopRun(int idx, Run* run) {
+  const int num_queues = worker_queues_.size();
+  {
+    WorkerQueue* queue = worker_queues_[idx].get();
+    std::lock_guard<simple_spinlock> l(queue->lock);
+    if (!queue->runs.empty()) {
+      *run = std::move(queue->runs.back());
+      queue->runs.pop_back();
+      return true;
+    }
+  }
+  for (int i = 1; i < num_queues; i++) {
+    WorkerQueue* queue = worker_queues_[(idx + i) % num_queues].get();
+    std::lock_guard<simple_spinlock> l(queue->lock);
+    if (!queue->runs.empty()) {
+      *run = std::move(queue->runs.front());
+      queue->runs.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::ProcessRun(Run run, bool drop) {
+  ws_queued_runs_--;
+  ThreadPoolToken* token = run.token;
+  if (token == tokenless_.get()) {
+    if (PREDICT_TRUE(!drop && ws_accepting_)) {
+      RunTask(token, run.task);
+    } else {
+      ReleaseTask(run.task);
+    }
+    FinishTasks(1);
+    return;
+  }
+
+  // Take the token's next task, unless the token was shut down meanwhile.
+  Task* task;
+  {
+    MutexLock l(token->own_lock_);
+    token->queued_runs_--;
+    // The tasks of a token which a run is dropped for are left to the
+    // shutdown of the pool to release.
+    if (drop || token->entries_.empty()) {
+      token->MaybeFinishQuiescing();
+      return;
+    }
+    DCHECK_EQ(ThreadPoolToken::State::RUNNING, token->state());
+    task = &token->entries_.front();
+    token->entries_.pop_front();
+    token->active_threads_++;
+  }
+
+  RunTask(token, task);
+
+  // Possible states, as in DispatchThread(). A SERIAL token with more tasks
+  // is re-queued at the front of the queue, so that it doesn't keep this
+  // worker from the other runs queued on it.
+  bool requeue = false;
+  {
+    MutexLock l(token->own_lock_);
+    ThreadPoolToken::State state = token->state();
+    DCHECK(state == ThreadPoolToken::State::RUNNING ||
+           state == ThreadPoolToken::State::QUIESCING);
+    if (--token->active_threads_ == 0) {
+      if (state == ThreadPoolToken::State::QUIESCING) {
+        DCHECK(token->entries_.empty());
+        token->MaybeFinishQuiescing();
+      } else if (token->entries_.empty()) {
+        token->Transition(ThreadPoolToken::State::IDLE);
+      } else if (token->mode() == ExecutionMode::SERIAL) {
+        token->queued_runs_++;
+        requeue = true;
+      }
+    }
+  }
+  if (requeue) {
+    PushRun(Run{ token, nullptr }, true);
+  }
+  FinishTasks(1);
+}
+
+void ThreadPool::DrainRuns() {
+  for (const auto& queue : worker_queues_) {
+    std::deque<Run> runs;
+    {
+      std::lock_guard<simple_spinlock> l(queue->lock);
+      runs.swap(queue->runs);
+    }
+    for (Run& run : runs) {
+      ProcessRun(std::move(run), true);
+    }
+  }
+}
+
+void ThreadPool::FinishTasks(int64_t n) {
+  if (ws_outstanding_tasks_.fetch_sub(n) == n) {
+    MutexLock l(lock_);
+    idle_cond_.Broadcast();
+  }
+}
+
+void ThreadPool::WorkStealingDispatchThread(int idx) {
+  {
+    MutexLock l(lock_);
+    InsertOrDie(&threads_, Thread::current_thread());
+    DCHECK_GT(num_threads_pending_start_, 0);
+    num_threads_++;
+    num_threads_pending_start_--;
+  }
+  tls_work_stealing_pool = this;
+  tls_worker_idx = idx;
+
+  while (true) {
+    Run run;
+    if (PopRun(idx, &run)) {
+      ProcessRun(std::move(run), false);
+      continue;
+    }
+    MutexLock l(lock_);
+    if (!ws_accepting_) {
+      break;
+    }
+    ws_num_sleepers_++;
+    while (ws_queued_runs_ <= 0 && ws_accepting_) {
+      ws_work_cond_.Wait();
+    }
+    ws_num_sleepers_--;
+  }
+
+  tls_work_stealing_pool = nullptr;
+  tls_worker_idx = -1;
+  MutexLock l(lock_);
+  CHECK_EQ(threads_.erase(Thread::current_thread()), 1);
+  num_threads_--;
+  if (num_threads_ + num_threads_pending_start_ == 0) {
+    no_threads_cond_.Broadcast();
+  }
+}
+
+void ThreadPool::ShutdownWorkStealing() {
+  MutexLock unique_lock(lock_);
+  CheckNotPoolThreadUnlocked();
+
+  // As in Shutdown(), the tasks are released outside of the locks. The runs
+  // are left for the workers to drop, or for DrainRuns() once they're gone.
+  pool_status_ = Status::ServiceUnavailable("The pool has been shut down.");
+  ws_accepting_ = false;
+  TaskList to_release;
+  for (auto* t : tokens_) {
+    MutexLock l(t->own_lock_);
+    to_release.splice(to_release.end(), t->entries_);
+    switch (t->state()) {
+      case ThreadPoolToken::State::IDLE:
+        t->Transition(ThreadPoolToken::State::QUIESCED);
+        break;
+      case ThreadPoolToken::State::RUNNING:
+        t->Transition(t->active_threads_ > 0 || t->queued_runs_ > 0 ?
+            ThreadPoolToken::State::QUIESCING :
+            ThreadPoolToken::State::QUIESCED);
+        break;
+      default:
+        break;
+    }
+  }
+
+  ws_work_cond_.Broadcast();
+  while (num_threads_ + num_threads_pending_start_ > 0) {
+    no_threads_cond_.Wait();
+  }
+  unique_lock.Unlock();
+  DrainRuns();
+
+  const int64_t num_released = to_release.size();
+  to_release.clear_and_dispose([this](Task* t) { ReleaseTask(t); });
+  if (num_released > 0) {
+    FinishTasks(num_released);
+  }
+}
+
+void ThreadPool::RunTask(ThreadPoolToken* token, Task* task) {
+  // Release the reference which was held by the queued item.
+  ADOPT_TRACE(task->trace);
+  if (task->trace) {
+    task->trace->Release();
+    task->trace = nullptr;
+  }
+
+  // Update metrics
+  MonoTime now(MonoTime::Now());
+  int64_t queue_time_us = (now - task->submit_time).ToMicroseconds();
+  TRACE_COUNTER_INCREMENT(queue_time_trace_metric_name_, queue_time_us);
+  if (metrics_.queue_time_us_histogram) {
+    metrics_.queue_time_us_histogram->Increment(queue_time_us);
+  }
+  if (token->metrics_.queue_time_us_histogram) {
+    token->metrics_.queue_time_us_histogram->Increment(queue_time_us);
+  }
+
+  // Execute the task
+  {
+    MicrosecondsInt64 start_wall_us = GetMonoTimeMicros();
+
+    task->func();
+
+    int64_t wall_us = GetMonoTimeMicros() - start_wall_us;
+
+    if (metrics_.run_time_us_histogram) {
+      metrics_.run_time_us_histogram->Increment(wall_us);
+    }
+    if (token->metrics_.run_time_us_histogram) {
+      token->metrics_.run_time_us_histogram->Increment(wall_us);
+    }
+    TRACE_COUNTER_INCREMENT(run_wall_time_trace_metric_name_, wall_us);
+  }
+  // Destruct the task while we do not hold the lock.
+  //
+  // The task's destructor may be expensive if it has a lot of bound
+  // objects, and we don't want to block submission of the threadpool.
+  // In the worst case, the destructor might even try to do something
+  // with this threadpool, and produce a deadlock.
+  ReleaseTask(task);
+}
+
 Status ThreadPool::CreateThread() {
-  return kudu::Thread::Create("thread pool", strings::Substitute("$0 [worker]", name_),
-                              &ThreadPool::DispatchThread, this, nullptr);
+  const MonoTime start = MonoTime::Now();
+  Status s = kudu::Thread::Create("thread pool", strings::Substitute("$0 [worker]", name_),
+                                  &ThreadPool::DispatchThread, this, nullptr);
+  if (s.ok() && metrics_.thread_start_time_us_histogram) {
+    metrics_.thread_start_time_us_histogram->Increment(
+        (MonoTime::Now() - start).ToMicroseconds());
+  }
+  return s;
 }
 
 void ThreadPool::CheckNotPoolThreadUnlocked() {
   Thread* current = Thread::current_thread();
-  if (ContainsKey(threads_, current)) {
+  // The tokens of a work-stealing pool don't hold 'lock_' to call this.
+  if (work_stealing_ ? tls_work_stealing_pool == this : ContainsKey(threads_, current)) {
     LOG(FATAL) << Substitute("Thread belonging to thread pool '$0' with "
         "name '$1' called pool function that would result in deadlock",
         name_, current->name());
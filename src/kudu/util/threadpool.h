@@ -17,11 +17,14 @@
 #ifndef KUDU_UTIL_THREAD_POOL_H
 #define KUDU_UTIL_THREAD_POOL_H
 
+#include <atomic>
+#include <cstdint>
 #include <deque>
 #include <iosfwd>
 #include <memory>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/list_hook.hpp>
@@ -33,10 +36,12 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/condition_variable.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/status.h"
+#include "kudu/util/unique_function.h"
 
 namespace boost {
 template <typename Signature>
@@ -67,6 +72,11 @@ struct ThreadPoolMetrics {
 
   // Measures the amount of time that tasks spend running.
   scoped_refptr<Histogram> run_time_us_histogram;
+
+  // Measures the amount of time it takes to start each worker thread, so its
+  // count is the number of worker threads started. Only used for the
+  // pool-wide metrics.
+  scoped_refptr<Histogram> thread_start_time_us_histogram;
 };
 
 // ThreadPool takes a lot of arguments. We provide sane defaults with a builder.
@@ -108,12 +118,18 @@ struct ThreadPoolMetrics {
 //    Default: INT_MAX.
 //
 // idle_timeout: How long we'll keep around an idle thread before timing it out.
-//    We always keep at least min_threads.
+//    We always keep at least min_threads. With --thread_pool_park_idle_threads
+//    idle threads are kept regardless.
 //    Default: 500 milliseconds.
 //
 // metrics: Histograms, counters, etc. to update on various threadpool events.
 //    Default: not set.
 //
+// work_stealing: Whether each worker thread has a queue of its own, which the
+//    other workers steal from when theirs is empty, rather than all of them
+//    sharing one queue under the pool's lock. See ThreadPool for details.
+//    Default: false.
+//
 class ThreadPoolBuilder {
  public:
   explicit ThreadPoolBuilder(std::string name);
@@ -126,6 +142,7 @@ class ThreadPoolBuilder {
   ThreadPoolBuilder& set_max_queue_size(int max_queue_size);
   ThreadPoolBuilder& set_idle_timeout(const MonoDelta& idle_timeout);
   ThreadPoolBuilder& set_metrics(ThreadPoolMetrics metrics);
+  ThreadPoolBuilder& set_work_stealing(bool work_stealing);
 
   // Instantiate a new ThreadPool with the existing builder arguments.
   Status Build(gscoped_ptr<ThreadPool>* pool) const;
@@ -139,6 +156,7 @@ class ThreadPoolBuilder {
   int max_queue_size_;
   MonoDelta idle_timeout_;
   ThreadPoolMetrics metrics_;
+  bool work_stealing_;
 
   DISALLOW_COPY_AND_ASSIGN(ThreadPoolBuilder);
 };
@@ -164,6 +182,21 @@ class ThreadPoolBuilder {
 // from starving one another. However, tokenless (and CONCURRENT token-based)
 // tasks can starve SERIAL token-based tasks.
 //
+// A work-stealing pool (see ThreadPoolBuilder::set_work_stealing()) runs
+// max_threads threads for as long as it's up, each with a queue of its own.
+// A task submitted from a worker thread goes to the back of the worker's
+// queue, and the worker runs the task at the back of its queue next, so that
+// a task often runs right after, and on the same thread as, the task which
+// submitted it. Tasks submitted from other threads are spread over the
+// queues. A worker whose queue is empty steals from the front of the others'.
+// Submitting a task only takes the lock of a queue, along with the lock of
+// its token, if any, rather than a lock shared by the whole pool. Queues hold
+// the tasks of a SERIAL token in the token itself, with one entry standing
+// for the token in at most one queue at a time, so that stealing the entry
+// moves the whole token and its tasks still run one at a time, in order. Tasks
+// submitted without a token, or through different tokens, don't run in the
+// order they were submitted in.
+//
 // Usage Example:
 //    static void Func(int n) { ... }
 //    class Task : public Runnable { ... }
@@ -178,8 +211,12 @@ class ThreadPoolBuilder {
 //            .Build(&thread_pool));
 //    thread_pool->Submit(shared_ptr<Runnable>(new Task()));
 //    thread_pool->SubmitFunc(boost::bind(&Func, 10));
+//    thread_pool->Submit([]() { Func(10); });
 class ThreadPool {
  public:
+  // A function for Submit().
+  typedef UniqueFunction<> Function;
+
   ~ThreadPool();
 
   // Wait for the running tasks to complete and then shutdown the threads.
@@ -199,6 +236,12 @@ class ThreadPool {
   // Submits a Runnable class.
   Status Submit(std::shared_ptr<Runnable> r) WARN_UNUSED_RESULT;
 
+  // Submits a function, which may be move-only. The function is stored in a
+  // task which the pool keeps for reuse once it has run, so that submitting a
+  // function of at most Function's inline capacity, such as a lambda
+  // capturing a few pointers, doesn't allocate.
+  Status Submit(Function f) WARN_UNUSED_RESULT;
+
   // Waits until all the tasks are completed.
   void Wait();
 
@@ -243,14 +286,33 @@ class ThreadPool {
   friend class ThreadPoolBuilder;
   friend class ThreadPoolToken;
 
-  // Client-provided task to be executed by this pool.
-  struct Task {
-    std::shared_ptr<Runnable> runnable;
+  // Client-provided task to be executed by this pool. Tasks are linked into
+  // the queues of their tokens, and into 'free_tasks_' once they've run.
+  struct Task : public boost::intrusive::list_base_hook<> {
+    Task() : trace(nullptr) {}
+
+    Function func;
     Trace* trace;
 
     // Time at which the entry was submitted to the pool.
     MonoTime submit_time;
   };
+  typedef boost::intrusive::list<Task> TaskList; // NOLINT(build/include_what_you_use)
+
+  // An entry of the queue of a worker of a work-stealing pool. Tasks
+  // submitted without a token are queued as they are; the tasks of tokens
+  // remain queued on their token, and the entry stands for the next of them.
+  struct Run {
+    ThreadPoolToken* token;
+    Task* task;
+  };
+
+  // The queue of a worker of a work-stealing pool. The worker takes runs from
+  // the back, and the other workers steal them from the front.
+  struct WorkerQueue {
+    simple_spinlock lock;
+    std::deque<Run> runs;
+  };
 
   // Creates a new thread pool using a builder.
   explicit ThreadPool(const ThreadPoolBuilder& builder);
@@ -261,6 +323,21 @@ class ThreadPool {
   // Dispatcher responsible for dequeueing and executing the tasks
   void DispatchThread();
 
+  // Dispatcher of the worker 'idx' of a work-stealing pool.
+  void WorkStealingDispatchThread(int idx);
+
+  // Runs 'task' of 'token', updates the metrics, and releases the task.
+  void RunTask(ThreadPoolToken* token, Task* task);
+
+  // Returns a task to submit: one from 'free_tasks_' if there is any.
+  Task* NewTask();
+
+  // Destroys the function of 'task', releases its trace, if it still holds a
+  // reference to it, and keeps the task in 'free_tasks_' for reuse, or else
+  // deletes it. Since the function's destructor may take locks, this must be
+  // called without holding the pool's or the token's lock.
+  void ReleaseTask(Task* task);
+
   // Create new thread.
   //
   // REQUIRES: caller has incremented 'num_threads_pending_start_' ahead of this call.
@@ -271,7 +348,43 @@ class ThreadPool {
   void CheckNotPoolThreadUnlocked();
 
   // Submits a task to be run via token.
-  Status DoSubmit(std::shared_ptr<Runnable> r, ThreadPoolToken* token);
+  Status DoSubmit(Function f, ThreadPoolToken* token);
+
+  // DoSubmit() of a work-stealing pool.
+  Status DoSubmitWorkStealing(Function f, ThreadPoolToken* token);
+
+  // Queues 'run' on the queue of the current worker thread, or on the next
+  // queue for other threads, and wakes up a sleeping worker if there is one.
+  // Re-queued runs of SERIAL tokens go to the front, behind the others.
+  void PushRun(Run run, bool at_front);
+
+  // Takes the run at the back of worker 'idx''s queue, or else steals the one
+  // at the front of another worker's. Returns false if all queues are empty.
+  bool PopRun(int idx, Run* run);
+
+  // Runs the task 'run' stands for, if it still has one, and re-queues the
+  // run's SERIAL token if it has more. If 'drop' is true, or the pool is shut
+  // down, drops the task queued along with the run instead, if any.
+  void ProcessRun(Run run, bool drop);
+
+  // Drops the runs left in the queues of a work-stealing pool which is shut
+  // down, along with the tasks queued without a token, on the calling thread.
+  void DrainRuns();
+
+  // Accounts for 'n' tasks of a work-stealing pool having been run or
+  // dropped, waking up the waiters of Wait() if no more are outstanding.
+  void FinishTasks(int64_t n);
+
+  // Shutdown() of a work-stealing pool.
+  void ShutdownWorkStealing();
+
+  // Returns true if any tasks are either queued or running.
+  //
+  // Protected by lock_, for pools which aren't work-stealing.
+  bool HasOutstandingTasks() const {
+    return work_stealing_ ? ws_outstanding_tasks_ > 0
+                          : total_queued_tasks_ > 0 || active_threads_ > 0;
+  }
 
   // Releases token 't' and invalidates it.
   void ReleaseToken(ThreadPoolToken* t);
@@ -281,6 +394,7 @@ class ThreadPool {
   const int max_threads_;
   const int max_queue_size_;
   const MonoDelta idle_timeout_;
+  const bool work_stealing_;
 
   // Overall status of the pool. Set to an error when the pool is shut down.
   //
@@ -359,12 +473,45 @@ class ThreadPool {
   };
   boost::intrusive::list<IdleThread> idle_threads_; // NOLINT(build/include_what_you_use)
 
+  // Tasks which were run or dropped, kept for reuse by later submissions so
+  // that submitting doesn't allocate. Up to kMaxFreeTasks are kept.
+  //
+  // Protected by free_tasks_lock_.
+  simple_spinlock free_tasks_lock_;
+  TaskList free_tasks_;
+
   // ExecutionMode::CONCURRENT token used by the pool for tokenless submission.
   std::unique_ptr<ThreadPoolToken> tokenless_;
 
   // Metrics for the entire thread pool.
   const ThreadPoolMetrics metrics_;
 
+  // The state of a work-stealing pool. Since submitting a task doesn't take
+  // 'lock_', these are atomics, and 'lock_' only serves to sleep on
+  // 'ws_work_cond_', 'idle_cond_' and 'no_threads_cond_'.
+  //
+  // The queues of the workers, one for each of max_threads_ workers.
+  std::vector<std::unique_ptr<WorkerQueue>> worker_queues_;
+
+  // The number of runs in 'worker_queues_'. May briefly turn negative, as a
+  // run is counted after it's queued.
+  std::atomic<int64_t> ws_queued_runs_;
+
+  // The number of tasks submitted and not yet run or dropped.
+  std::atomic<int64_t> ws_outstanding_tasks_;
+
+  // The number of workers sleeping on 'ws_work_cond_', waiting for runs.
+  std::atomic<int> ws_num_sleepers_;
+
+  // Whether the pool accepts tasks: set by Init() and cleared by Shutdown().
+  std::atomic<bool> ws_accepting_;
+
+  // The queue which the next task submitted from outside of the pool goes to.
+  std::atomic<uint32_t> ws_next_queue_;
+
+  // Condition variable for "a run was queued".
+  ConditionVariable ws_work_cond_;
+
   const char* queue_time_trace_metric_name_;
   const char* run_wall_time_trace_metric_name_;
 
@@ -393,6 +540,9 @@ class ThreadPoolToken {
   // Submits a Runnable class.
   Status Submit(std::shared_ptr<Runnable> r) WARN_UNUSED_RESULT;
 
+  // Submits a function, which may be move-only, as ThreadPool::Submit() does.
+  Status Submit(ThreadPool::Function f) WARN_UNUSED_RESULT;
+
   // Marks the token as unusable for future submissions. Any queued tasks not
   // yet running are destroyed. If tasks are in flight, Shutdown() will wait
   // on their completion before returning.
@@ -458,6 +608,18 @@ class ThreadPoolToken {
   // Changes this token's state to 'new_state' taking actions as needed.
   void Transition(State new_state);
 
+  // Transitions a QUIESCING token of a work-stealing pool to QUIESCED once
+  // none of its tasks are running and none of its runs are queued.
+  void MaybeFinishQuiescing() {
+    if (state_ == State::QUIESCING && active_threads_ == 0 && queued_runs_ == 0) {
+      Transition(State::QUIESCED);
+    }
+  }
+
+  // The lock protecting the mutable members of this token: the pool's lock,
+  // unless the pool is work-stealing.
+  Mutex& lock() const;
+
   // Returns true if this token has a task queued and ready to run, or if a
   // task belonging to this token is already running.
   bool IsActive() const {
@@ -487,7 +649,10 @@ class ThreadPoolToken {
   State state_;
 
   // Queued client tasks.
-  std::deque<ThreadPool::Task> entries_;
+  ThreadPool::TaskList entries_;
+
+  // Protects the mutable members of a token of a work-stealing pool.
+  mutable Mutex own_lock_;
 
   // Condition variable for "token is idle". Waiters wake up when the token
   // transitions to IDLE or QUIESCED.
@@ -497,6 +662,11 @@ class ThreadPoolToken {
   // token.
   int active_threads_;
 
+  // Number of runs of the token in the queues of a work-stealing pool. It
+  // only reaches QUIESCED once these have been dropped, so that they never
+  // point to a token which was destroyed.
+  int queued_runs_;
+
   DISALLOW_COPY_AND_ASSIGN(ThreadPoolToken);
 };
 
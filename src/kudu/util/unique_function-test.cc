@@ -0,0 +1,99 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/unique_function.h"
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+namespace kudu {
+
+// Counts its calls and how many copies of it are alive.
+class Counter {
+ public:
+  Counter(int* calls, int* live) : calls_(calls), live_(live) {
+    (*live_)++;
+  }
+  Counter(const Counter& other) : calls_(other.calls_), live_(other.live_) {
+    (*live_)++;
+  }
+  ~Counter() {
+    (*live_)--;
+  }
+
+  void operator()() {
+    (*calls_)++;
+  }
+
+ private:
+  int* calls_;
+  int* live_;
+  char padding_[128];
+};
+
+TEST(TestUniqueFunction, TestInline) {
+  int calls = 0;
+  UniqueFunction<> f([&calls]() { calls++; });
+  ASSERT_TRUE(f);
+  f();
+  UniqueFunction<> g(std::move(f));
+  ASSERT_FALSE(f);
+  g();
+  ASSERT_EQ(2, calls);
+  g.reset();
+  ASSERT_FALSE(g);
+  ASSERT_FALSE(UniqueFunction<>());
+}
+
+TEST(TestUniqueFunction, TestMoveOnly) {
+  std::unique_ptr<int> p(new int(0));
+  int* value = p.get();
+  UniqueFunction<> f(std::bind([](const std::unique_ptr<int>& p) { (*p)++; }, std::move(p)));
+  UniqueFunction<> g;
+  g = std::move(f);
+  g();
+  ASSERT_EQ(1, *value);
+  static_assert(!std::is_copy_constructible<UniqueFunction<>>::value,
+                "UniqueFunction may not be copied");
+}
+
+// Callables which don't fit are kept on the heap, and destroyed along with
+// the function.
+TEST(TestUniqueFunction, TestLargeCallable) {
+  static_assert(!UniqueFunction<>::StoredInline<Counter>(), "Counter doesn't fit inline");
+  static_assert(UniqueFunction<sizeof(Counter)>::StoredInline<Counter>(), "Counter fits inline");
+  int calls = 0;
+  int live = 0;
+  {
+    UniqueFunction<> f(Counter(&calls, &live));
+    ASSERT_EQ(1, live);
+    UniqueFunction<> g(std::move(f));
+    g();
+    ASSERT_EQ(1, live);
+    UniqueFunction<sizeof(Counter)> h(Counter(&calls, &live));
+    h();
+    ASSERT_EQ(2, live);
+  }
+  ASSERT_EQ(2, calls);
+  ASSERT_EQ(0, live);
+}
+
+} // namespace kudu
@@ -0,0 +1,166 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/gutil/macros.h"
+
+namespace kudu {
+
+// A move-only void() function, which stores callables of up to
+// 'kInlineCapacity' bytes, such as lambdas capturing a few pointers, inline
+// rather than on the heap. Unlike std::function and boost::function, it may
+// hold callables which can't be copied, and constructing one from a small
+// callable never allocates. Larger callables are moved to the heap.
+//
+// Example:
+//    std::unique_ptr<Foo> foo(...);
+//    UniqueFunction<> f(std::bind(&Foo::Run, std::move(foo)));
+//    f();
+template <size_t kInlineCapacity = 48>
+class UniqueFunction {
+ public:
+  UniqueFunction() : ops_(nullptr) {}
+
+  // Takes 'f', which may be any callable taking no arguments.
+  template <class F,
+            class = typename std::enable_if<
+                !std::is_same<typename std::decay<F>::type, UniqueFunction>::value>::type,
+            class = decltype(std::declval<typename std::decay<F>::type&>()())>
+  UniqueFunction(F&& f) { // NOLINT(runtime/explicit)
+    typedef typename std::decay<F>::type Fn;
+    typedef typename std::conditional<StoredInline<Fn>(), InlineOps<Fn>, HeapOps<Fn>>::type Ops;
+    Ops::Construct(&storage_, std::forward<F>(f));
+    ops_ = &Ops::kOps;
+  }
+
+  UniqueFunction(UniqueFunction&& other) : ops_(other.ops_) {
+    if (ops_) {
+      ops_->move(&other.storage_, &storage_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  UniqueFunction& operator=(UniqueFunction&& other) {
+    if (this != &other) {
+      reset();
+      if (other.ops_) {
+        other.ops_->move(&other.storage_, &storage_);
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  ~UniqueFunction() {
+    reset();
+  }
+
+  // Calls the callable. May not be called on an empty function.
+  void operator()() {
+    DCHECK(ops_);
+    ops_->invoke(&storage_);
+  }
+
+  // Destroys the callable, leaving the function empty.
+  void reset() {
+    if (ops_) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  // Whether callables of type 'F' are stored inline.
+  template <class F>
+  static constexpr bool StoredInline() {
+    return sizeof(F) <= kInlineCapacity &&
+        alignof(std::max_align_t) % alignof(F) == 0;
+  }
+
+ private:
+  typedef typename std::aligned_storage<kInlineCapacity, alignof(std::max_align_t)>::type Storage;
+
+  // What calls, moves and destroys a type of callable, from its storage.
+  struct Ops {
+    void (*invoke)(Storage* s);
+    void (*move)(Storage* from, Storage* to);
+    void (*destroy)(Storage* s);
+  };
+
+  template <class F>
+  struct InlineOps {
+    template <class Arg>
+    static void Construct(Storage* s, Arg&& f) {
+      new (s) F(std::forward<Arg>(f));
+    }
+    static F* Get(Storage* s) { return reinterpret_cast<F*>(s); }
+    static void Invoke(Storage* s) { (*Get(s))(); }
+    static void Move(Storage* from, Storage* to) {
+      new (to) F(std::move(*Get(from)));
+      Get(from)->~F();
+    }
+    static void Destroy(Storage* s) { Get(s)->~F(); }
+    static constexpr Ops kOps = { &Invoke, &Move, &Destroy };
+  };
+
+  template <class F>
+  struct HeapOps {
+    template <class Arg>
+    static void Construct(Storage* s, Arg&& f) {
+      Get(s) = new F(std::forward<Arg>(f));
+    }
+    static F*& Get(Storage* s) { return *reinterpret_cast<F**>(s); }
+    static void Invoke(Storage* s) { (*Get(s))(); }
+    static void Move(Storage* from, Storage* to) {
+      new (to) F*(Get(from));
+    }
+    static void Destroy(Storage* s) { delete Get(s); }
+    static constexpr Ops kOps = { &Invoke, &Move, &Destroy };
+  };
+
+  static_assert(kInlineCapacity >= sizeof(void*),
+                "the inline capacity must fit a pointer to a callable on the heap");
+
+  Storage storage_;
+
+  // What to call, move and destroy the callable with, or nullptr if the
+  // function is empty.
+  const Ops* ops_;
+
+  DISALLOW_COPY_AND_ASSIGN(UniqueFunction);
+};
+
+template <size_t kInlineCapacity>
+template <class F>
+constexpr typename UniqueFunction<kInlineCapacity>::Ops
+    UniqueFunction<kInlineCapacity>::InlineOps<F>::kOps;
+
+template <size_t kInlineCapacity>
+template <class F>
+constexpr typename UniqueFunction<kInlineCapacity>::Ops
+    UniqueFunction<kInlineCapacity>::HeapOps<F>::kOps;
+
+} // namespace kudu